@@ -0,0 +1,126 @@
+/*
+ * Internet checksum for arm64
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/compiler.h>
+#include <linux/types.h>
+#include <asm/byteorder.h>
+#include <asm/checksum.h>
+
+/* one's complement addition: fold the carry out of bit 63 back in */
+static inline u64 csum_add64(u64 sum, u64 data)
+{
+	sum += data;
+	return sum + (sum < data);
+}
+
+static inline unsigned int from64to16(u64 x)
+{
+	x = (x & 0xffffffff) + (x >> 32);
+	x = (x & 0xffffffff) + (x >> 32);
+	x = (x & 0xffff) + (x >> 16);
+	x = (x & 0xffff) + (x >> 16);
+	return x;
+}
+
+/*
+ * Replaces the generic 32-bit loop in lib/checksum.c.  The bulk of the
+ * buffer is summed 64 bits at a time into four independent accumulators
+ * so that the adds and carry checks of neighbouring words can issue in
+ * parallel; the carries are counted separately and folded in at the end.
+ */
+unsigned int do_csum(const unsigned char *buff, int len)
+{
+	unsigned int odd, result;
+	u64 sum = 0;
+
+	if (len <= 0)
+		return 0;
+
+	odd = 1 & (unsigned long)buff;
+	if (odd) {
+#ifdef __LITTLE_ENDIAN
+		sum = *buff << 8;
+#else
+		sum = *buff;
+#endif
+		len--;
+		buff++;
+	}
+
+	/* bring buff up to 64-bit alignment */
+	if (len >= 2 && (2 & (unsigned long)buff)) {
+		sum += *(const u16 *)buff;
+		len -= 2;
+		buff += 2;
+	}
+	if (len >= 4 && (4 & (unsigned long)buff)) {
+		sum += *(const u32 *)buff;
+		len -= 4;
+		buff += 4;
+	}
+
+	if (len >= 32) {
+		const u64 *p = (const u64 *)buff;
+		u64 s0 = sum, s1 = 0, s2 = 0, s3 = 0;
+		u64 c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+		do {
+			u64 w0 = p[0], w1 = p[1], w2 = p[2], w3 = p[3];
+
+			s0 += w0;
+			c0 += s0 < w0;
+			s1 += w1;
+			c1 += s1 < w1;
+			s2 += w2;
+			c2 += s2 < w2;
+			s3 += w3;
+			c3 += s3 < w3;
+			p += 4;
+			len -= 32;
+		} while (len >= 32);
+
+		sum = csum_add64(s0, s1);
+		sum = csum_add64(sum, s2);
+		sum = csum_add64(sum, s3);
+		sum = csum_add64(sum, c0 + c1 + c2 + c3);
+		buff = (const unsigned char *)p;
+	}
+
+	while (len >= 8) {
+		sum = csum_add64(sum, *(const u64 *)buff);
+		len -= 8;
+		buff += 8;
+	}
+	if (len & 4) {
+		sum = csum_add64(sum, *(const u32 *)buff);
+		buff += 4;
+	}
+	if (len & 2) {
+		sum = csum_add64(sum, *(const u16 *)buff);
+		buff += 2;
+	}
+	if (len & 1)
+#ifdef __LITTLE_ENDIAN
+		sum = csum_add64(sum, *buff);
+#else
+		sum = csum_add64(sum, *buff << 8);
+#endif
+
+	result = from64to16(sum);
+	if (odd)
+		result = ((result >> 8) & 0xff) | ((result & 0xff) << 8);
+	return result;
+}
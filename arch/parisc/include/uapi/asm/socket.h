@@ -84,4 +84,9 @@
 #define SO_ATTACH_BPF		0x402B
 #define SO_DETACH_BPF		SO_DETACH_FILTER
 
+#define SO_ATTACH_REUSEPORT_CBPF	0x402C
+#define SO_ATTACH_REUSEPORT_EBPF	0x402D
+
+#define SO_ZEROCOPY		0x402E
+
 #endif /* _UAPI_ASM_SOCKET_H */
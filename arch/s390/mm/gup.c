@@ -59,7 +59,9 @@ static inline int gup_huge_pmd(pmd_t *pmdp, pmd_t pmd, unsigned long addr,
 	mask = result | _SEGMENT_ENTRY_INVALID;
 	if ((pmd_val(pmd) & mask) != result)
 		return 0;
-	VM_BUG_ON(!pfn_valid(pmd_val(pmd) >> PAGE_SHIFT));
+	/* DAX maps memory without struct pages with huge PMDs */
+	if (!pfn_valid(pmd_val(pmd) >> PAGE_SHIFT))
+		return 0;
 
 	refs = 0;
 	head = pmd_page(pmd);
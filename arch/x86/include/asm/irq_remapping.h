@@ -31,6 +31,16 @@ struct msi_msg;
 struct pci_dev;
 struct irq_cfg;
 
+enum irq_remap_cap {
+	IRQ_POSTING_CAP = 0,
+};
+
+/* Target of an interrupt that is posted directly to a vCPU */
+struct vcpu_data {
+	u64 pi_desc_addr;	/* Physical address of the posted-intr desc */
+	u32 vector;		/* Guest vector of the interrupt */
+};
+
 #ifdef CONFIG_IRQ_REMAP
 
 extern void set_irq_remapping_broken(void);
@@ -56,6 +66,10 @@ extern bool setup_remapped_irq(int irq,
 
 void irq_remap_modify_chip_defaults(struct irq_chip *chip);
 
+extern bool irq_remapping_cap(enum irq_remap_cap cap);
+extern int irq_remap_set_vcpu_affinity(unsigned int irq,
+				       struct vcpu_data *vcpu);
+
 #else  /* CONFIG_IRQ_REMAP */
 
 static inline void set_irq_remapping_broken(void) { }
@@ -97,6 +111,17 @@ static inline bool setup_remapped_irq(int irq,
 {
 	return false;
 }
+
+static inline bool irq_remapping_cap(enum irq_remap_cap cap)
+{
+	return false;
+}
+
+static inline int irq_remap_set_vcpu_affinity(unsigned int irq,
+					      struct vcpu_data *vcpu)
+{
+	return -ENODEV;
+}
 #endif /* CONFIG_IRQ_REMAP */
 
 #define dmar_alloc_hwirq()	irq_alloc_hwirq(-1)
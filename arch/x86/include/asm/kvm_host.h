@@ -41,6 +41,16 @@
 #define KVM_PIO_PAGE_OFFSET 1
 #define KVM_COALESCED_MMIO_PAGE_OFFSET 2
 
+/* halt polling only reduces halt latency by 5-7 us, 500us is enough */
+#define KVM_HALT_POLL_NS_DEFAULT 500000
+
+/*
+ * mmu_lock is taken for read by TDP page faults that only need to fill in
+ * a missing leaf spte; everything else takes it for write.
+ */
+#define KVM_HAVE_MMU_RWLOCK
+#define KVM_MMU_RMAP_LOCKS 64
+
 #define KVM_IRQCHIP_NUM_PINS  KVM_IOAPIC_NUM_PINS
 
 #define CR0_RESERVED_BITS                                               \
@@ -582,12 +592,22 @@ struct kvm_arch {
 	 */
 	struct list_head active_mmu_pages;
 	struct list_head zapped_obsolete_pages;
+	/*
+	 * Serializes rmap updates done by page faults that hold mmu_lock
+	 * for read, hashed by gfn.
+	 */
+	spinlock_t mmu_rmap_locks[KVM_MMU_RMAP_LOCKS];
+	/* Slots whose large sptes are waiting to be recovered. */
+	DECLARE_BITMAP(mmu_collapse_slots, KVM_MEM_SLOTS_NUM);
+	struct work_struct mmu_collapse_work;
 
 	struct list_head assigned_dev_head;
 	struct iommu_domain *iommu_domain;
 	bool iommu_noncoherent;
 #define __KVM_HAVE_ARCH_NONCOHERENT_DMA
 	atomic_t noncoherent_dma_count;
+#define __KVM_HAVE_ARCH_IRQ_ROUTING_UPDATE
+	atomic_t assigned_device_count;
 	struct kvm_pic *vpic;
 	struct kvm_ioapic *vioapic;
 	struct kvm_pit *vpit;
@@ -666,6 +686,7 @@ struct kvm_vcpu_stat {
 	u32 nmi_window_exits;
 	u32 halt_exits;
 	u32 halt_successful_poll;
+	u32 halt_attempted_poll;
 	u32 halt_wakeup;
 	u32 request_irq_exits;
 	u32 irq_exits;
@@ -827,6 +848,9 @@ struct kvm_x86_ops {
 	 *  - enable_log_dirty_pt_masked:
 	 *	called when reenabling log dirty for the GFNs in the mask after
 	 *	corresponding bits are cleared in slot->dirty_bitmap.
+	 *  - cpu_dirty_log_size:
+	 *	number of dirty GFNs the hardware can log before flushing them
+	 *	at vmexit, which the dirty ring must keep room for.
 	 */
 	void (*slot_enable_log_dirty)(struct kvm *kvm,
 				      struct kvm_memory_slot *slot);
@@ -836,6 +860,23 @@ struct kvm_x86_ops {
 	void (*enable_log_dirty_pt_masked)(struct kvm *kvm,
 					   struct kvm_memory_slot *slot,
 					   gfn_t offset, unsigned long mask);
+	int cpu_dirty_log_size;
+
+	/*
+	 * Hooks for VT-d posted interrupts:
+	 *  - pre_block:
+	 *	called before the vCPU halts, returns 1 if an interrupt was
+	 *	already posted and the vCPU must not block.
+	 *  - post_block:
+	 *	called after the vCPU is woken up.
+	 *  - update_pi_irte:
+	 *	post the host irq @host_irq directly to the vCPU that guest
+	 *	irq @guest_irq targets, or undo it if @set is false.
+	 */
+	int (*pre_block)(struct kvm_vcpu *vcpu);
+	void (*post_block)(struct kvm_vcpu *vcpu);
+	int (*update_pi_irte)(struct kvm *kvm, unsigned int host_irq,
+			      uint32_t guest_irq, bool set);
 };
 
 struct kvm_arch_async_pf {
@@ -1166,6 +1207,10 @@ void kvm_arch_async_page_ready(struct kvm_vcpu *vcpu,
 bool kvm_arch_can_inject_async_page_present(struct kvm_vcpu *vcpu);
 extern bool kvm_find_async_pf_gfn(struct kvm_vcpu *vcpu, gfn_t gfn);
 
+void kvm_arch_start_assignment(struct kvm *kvm);
+void kvm_arch_end_assignment(struct kvm *kvm);
+bool kvm_arch_has_assigned_device(struct kvm *kvm);
+
 void kvm_complete_insn_gp(struct kvm_vcpu *vcpu, int err);
 
 int kvm_is_in_guest(void);
@@ -35,8 +35,11 @@ extern unsigned long __phys_addr_symbol(unsigned long);
 #endif
 
 void clear_page(void *page);
+void clear_page_nocache(void *page);
 void copy_page(void *to, void *from);
 
+#define __HAVE_ARCH_CLEAR_PAGE_NOCACHE
+
 #endif	/* !__ASSEMBLY__ */
 
 #ifdef CONFIG_X86_VSYSCALL_EMULATION
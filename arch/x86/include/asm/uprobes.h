@@ -49,6 +49,10 @@ struct arch_uprobe {
 			u8	ilen;
 			u8	opc1;
 		}			branch;
+		struct {
+			u8	reg_offset;	/* to the start of pt_regs */
+			u8	ilen;
+		}			push;
 		struct {
 			u8	fixups;
 			u8	ilen;
@@ -21,6 +21,8 @@ struct vsyscall_gtod_data {
 	cycle_t	mask;
 	u32	mult;
 	u32	shift;
+	u32	raw_mult;
+	u32	raw_shift;
 
 	/* open coded 'struct timespec' */
 	u64		wall_time_snsec;
@@ -31,6 +33,10 @@ struct vsyscall_gtod_data {
 	gtod_long_t	wall_time_coarse_nsec;
 	gtod_long_t	monotonic_time_coarse_sec;
 	gtod_long_t	monotonic_time_coarse_nsec;
+	gtod_long_t	monotonic_time_raw_sec;
+	u64		monotonic_time_raw_snsec;
+	gtod_long_t	boottime_sec;
+	u64		boottime_snsec;
 
 	int		tz_minuteswest;
 	int		tz_dsttime;
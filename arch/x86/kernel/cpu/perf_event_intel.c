@@ -197,6 +197,25 @@ EVENT_ATTR_STR(mem-loads,	mem_ld_nhm,	"event=0x0b,umask=0x10,ldlat=3");
 EVENT_ATTR_STR(mem-loads,	mem_ld_snb,	"event=0xcd,umask=0x1,ldlat=3");
 EVENT_ATTR_STR(mem-stores,	mem_st_snb,	"event=0xcd,umask=0x2");
 
+/*
+ * TopDown level 1 events, Sandy Bridge and later.  The core issues up
+ * to four uops per cycle, so the slot counts are cycles scaled by four.
+ * These count per thread; with SMT active the metrics are approximate.
+ */
+EVENT_ATTR_STR(topdown-total-slots,	  td_total_slots,
+	       "event=0x3c,umask=0x0");
+EVENT_ATTR_STR(topdown-total-slots.scale, td_total_slots_scale,	"4");
+EVENT_ATTR_STR(topdown-slots-issued,	  td_slots_issued,
+	       "event=0xe,umask=0x1");
+EVENT_ATTR_STR(topdown-slots-retired,	  td_slots_retired,
+	       "event=0xc2,umask=0x2");
+EVENT_ATTR_STR(topdown-fetch-bubbles,	  td_fetch_bubbles,
+	       "event=0x9c,umask=0x1");
+EVENT_ATTR_STR(topdown-recovery-bubbles,  td_recovery_bubbles,
+	       "event=0xd,umask=0x3,cmask=1");
+EVENT_ATTR_STR(topdown-recovery-bubbles.scale, td_recovery_bubbles_scale,
+	       "4");
+
 struct attribute *nhm_events_attrs[] = {
 	EVENT_PTR(mem_ld_nhm),
 	NULL,
@@ -205,6 +224,13 @@ struct attribute *nhm_events_attrs[] = {
 struct attribute *snb_events_attrs[] = {
 	EVENT_PTR(mem_ld_snb),
 	EVENT_PTR(mem_st_snb),
+	EVENT_PTR(td_total_slots),
+	EVENT_PTR(td_total_slots_scale),
+	EVENT_PTR(td_slots_issued),
+	EVENT_PTR(td_slots_retired),
+	EVENT_PTR(td_fetch_bubbles),
+	EVENT_PTR(td_recovery_bubbles),
+	EVENT_PTR(td_recovery_bubbles_scale),
 	NULL,
 };
 
@@ -2979,6 +3005,13 @@ static struct attribute *hsw_events_attrs[] = {
 	EVENT_PTR(cycles_ct),
 	EVENT_PTR(mem_ld_hsw),
 	EVENT_PTR(mem_st_hsw),
+	EVENT_PTR(td_total_slots),
+	EVENT_PTR(td_total_slots_scale),
+	EVENT_PTR(td_slots_issued),
+	EVENT_PTR(td_slots_retired),
+	EVENT_PTR(td_fetch_bubbles),
+	EVENT_PTR(td_recovery_bubbles),
+	EVENT_PTR(td_recovery_bubbles_scale),
 	NULL
 };
 
@@ -27,6 +27,7 @@ void update_vsyscall_tz(void)
 void update_vsyscall(struct timekeeper *tk)
 {
 	struct vsyscall_gtod_data *vdata = &vsyscall_gtod_data;
+	struct timespec64 offs_boot = ktime_to_timespec64(tk->offs_boot);
 
 	gtod_write_begin(vdata);
 
@@ -36,6 +37,8 @@ void update_vsyscall(struct timekeeper *tk)
 	vdata->mask		= tk->tkr_mono.mask;
 	vdata->mult		= tk->tkr_mono.mult;
 	vdata->shift		= tk->tkr_mono.shift;
+	vdata->raw_mult		= tk->tkr_raw.mult;
+	vdata->raw_shift	= tk->tkr_raw.shift;
 
 	vdata->wall_time_sec		= tk->xtime_sec;
 	vdata->wall_time_snsec		= tk->tkr_mono.xtime_nsec;
@@ -52,6 +55,23 @@ void update_vsyscall(struct timekeeper *tk)
 		vdata->monotonic_time_sec++;
 	}
 
+	/* tkr_raw shares cycle_last with tkr_mono and has no xtime_nsec */
+	vdata->monotonic_time_raw_sec	= tk->raw_time.tv_sec;
+	vdata->monotonic_time_raw_snsec	= (u64)tk->raw_time.tv_nsec
+					<< tk->tkr_raw.shift;
+
+	vdata->boottime_sec		= vdata->monotonic_time_sec
+					+ offs_boot.tv_sec;
+	vdata->boottime_snsec		= vdata->monotonic_time_snsec
+					+ ((u64)offs_boot.tv_nsec
+						<< tk->tkr_mono.shift);
+	while (vdata->boottime_snsec >=
+					(((u64)NSEC_PER_SEC) << tk->tkr_mono.shift)) {
+		vdata->boottime_snsec -=
+					((u64)NSEC_PER_SEC) << tk->tkr_mono.shift;
+		vdata->boottime_sec++;
+	}
+
 	vdata->wall_time_coarse_sec	= tk->xtime_sec;
 	vdata->wall_time_coarse_nsec	= (long)(tk->tkr_mono.xtime_nsec >>
 						 tk->tkr_mono.shift);
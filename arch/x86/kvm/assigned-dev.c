@@ -237,10 +237,55 @@ static void deassign_guest_irq(struct kvm *kvm,
 	assigned_dev->irq_requested_type &= ~(KVM_DEV_IRQ_GUEST_MASK);
 }
 
+/*
+ * With VT-d posted interrupts, deliver the MSI or MSI-X interrupts of @dev
+ * straight to the vcpu that the guest routed them to, bypassing the host
+ * handlers, or hand them back to the host if @set is false.
+ * Called with kvm->lock held.
+ */
+static void kvm_assigned_dev_update_pi(struct kvm *kvm,
+				       struct kvm_assigned_dev_kernel *dev,
+				       bool set)
+{
+	int i;
+
+	if (!kvm_x86_ops->update_pi_irte)
+		return;
+
+	if ((dev->irq_requested_type & KVM_DEV_IRQ_HOST_MSI) &&
+	    (dev->irq_requested_type & KVM_DEV_IRQ_GUEST_MSI)) {
+		kvm_x86_ops->update_pi_irte(kvm, dev->host_irq,
+					    dev->guest_irq, set);
+	} else if ((dev->irq_requested_type & KVM_DEV_IRQ_HOST_MSIX) &&
+		   (dev->irq_requested_type & KVM_DEV_IRQ_GUEST_MSIX)) {
+		for (i = 0; i < dev->entries_nr; i++)
+			kvm_x86_ops->update_pi_irte(kvm,
+					dev->host_msix_entries[i].vector,
+					dev->guest_msix_entries[i].vector,
+					set);
+	}
+}
+
+/* Re-target posted interrupts after the guest changed its MSI routes. */
+void kvm_assigned_dev_update_irq_routing(struct kvm *kvm)
+{
+	struct kvm_assigned_dev_kernel *dev;
+
+	if (!kvm_x86_ops->update_pi_irte)
+		return;
+
+	mutex_lock(&kvm->lock);
+	list_for_each_entry(dev, &kvm->arch.assigned_dev_head, list)
+		kvm_assigned_dev_update_pi(kvm, dev, true);
+	mutex_unlock(&kvm->lock);
+}
+
 /* The function implicit hold kvm->lock mutex due to cancel_work_sync() */
 static void deassign_host_irq(struct kvm *kvm,
 			      struct kvm_assigned_dev_kernel *assigned_dev)
 {
+	kvm_assigned_dev_update_pi(kvm, assigned_dev, false);
+
 	/*
 	 * We disable irq here to prevent further events.
 	 *
@@ -336,6 +381,7 @@ static void kvm_free_assigned_device(struct kvm *kvm,
 
 	list_del(&assigned_dev->list);
 	kfree(assigned_dev);
+	kvm_arch_end_assignment(kvm);
 }
 
 void kvm_free_all_assigned_devices(struct kvm *kvm)
@@ -598,6 +644,8 @@ static int kvm_vm_ioctl_assign_irq(struct kvm *kvm,
 
 	if (guest_irq_type)
 		r = assign_guest_irq(kvm, match, assigned_irq, guest_irq_type);
+	if (!r)
+		kvm_assigned_dev_update_pi(kvm, match, true);
 out:
 	mutex_unlock(&kvm->lock);
 	return r;
@@ -778,6 +826,7 @@ static int kvm_vm_ioctl_assign_device(struct kvm *kvm,
 	if (r)
 		goto out_list_del;
 
+	kvm_arch_start_assignment(kvm);
 out:
 	srcu_read_unlock(&kvm->srcu, idx);
 	mutex_unlock(&kvm->lock);
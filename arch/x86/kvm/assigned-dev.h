@@ -14,6 +14,7 @@ long kvm_vm_ioctl_assigned_device(struct kvm *kvm, unsigned ioctl,
 				  unsigned long arg);
 
 void kvm_free_all_assigned_devices(struct kvm *kvm);
+void kvm_assigned_dev_update_irq_routing(struct kvm *kvm);
 #else
 static inline int kvm_iommu_unmap_guest(struct kvm *kvm)
 {
@@ -27,6 +28,7 @@ static inline long kvm_vm_ioctl_assigned_device(struct kvm *kvm, unsigned ioctl,
 }
 
 static inline void kvm_free_all_assigned_devices(struct kvm *kvm) {}
+static inline void kvm_assigned_dev_update_irq_routing(struct kvm *kvm) {}
 #endif /* CONFIG_KVM_DEVICE_ASSIGNMENT */
 
 #endif /* ARCH_X86_KVM_ASSIGNED_DEV_H */
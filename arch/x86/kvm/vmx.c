@@ -46,6 +46,7 @@
 #include <asm/debugreg.h>
 #include <asm/kexec.h>
 #include <asm/apic.h>
+#include <asm/irq_remapping.h>
 
 #include "trace.h"
 
@@ -444,10 +445,28 @@ struct nested_vmx {
 
 #define POSTED_INTR_ON  0
 /* Posted-Interrupt Descriptor */
+#define POSTED_INTR_SN  1
+
 struct pi_desc {
 	u32 pir[8];     /* Posted interrupt requested */
-	u32 control;	/* bit 0 of control is outstanding notification bit */
-	u32 rsvd[7];
+	union {
+		struct {
+				/* bit 256 - Outstanding Notification */
+			u16	on	: 1,
+				/* bit 257 - Suppress Notification */
+				sn	: 1,
+				/* bit 271:258 - Reserved */
+				rsvd_1	: 14;
+				/* bit 279:272 - Notification Vector */
+			u8	nv;
+				/* bit 287:280 - Reserved */
+			u8	rsvd_2;
+				/* bit 319:288 - Notification Destination */
+			u32	ndst;
+		};
+		u64 control;
+	};
+	u32 rsvd[6];
 } __aligned(64);
 
 static bool pi_test_and_set_on(struct pi_desc *pi_desc)
@@ -467,6 +486,21 @@ static int pi_test_and_set_pir(int vector, struct pi_desc *pi_desc)
 	return test_and_set_bit(vector, (unsigned long *)pi_desc->pir);
 }
 
+static void pi_clear_on(struct pi_desc *pi_desc)
+{
+	clear_bit(POSTED_INTR_ON, (unsigned long *)&pi_desc->control);
+}
+
+static void pi_set_sn(struct pi_desc *pi_desc)
+{
+	set_bit(POSTED_INTR_SN, (unsigned long *)&pi_desc->control);
+}
+
+static int pi_test_on(struct pi_desc *pi_desc)
+{
+	return test_bit(POSTED_INTR_ON, (unsigned long *)&pi_desc->control);
+}
+
 struct vcpu_vmx {
 	struct kvm_vcpu       vcpu;
 	unsigned long         host_rsp;
@@ -537,6 +571,13 @@ struct vcpu_vmx {
 	/* Posted interrupt descriptor */
 	struct pi_desc pi_desc;
 
+	/*
+	 * While halted with VT-d posted interrupts in use, the vcpu sits on
+	 * the blocked_vcpu_on_cpu list of pre_pcpu.
+	 */
+	struct list_head blocked_vcpu_list;
+	int pre_pcpu;
+
 	/* Support for a guest hypervisor (nested VMX) */
 	struct nested_vmx nested;
 
@@ -831,6 +872,13 @@ static DEFINE_PER_CPU(struct vmcs *, current_vmcs);
 static DEFINE_PER_CPU(struct list_head, loaded_vmcss_on_cpu);
 static DEFINE_PER_CPU(struct desc_ptr, host_gdt);
 
+/*
+ * Halted vcpus whose VT-d posted interrupts raise the wakeup vector on
+ * this CPU; protected by blocked_vcpu_on_cpu_lock.
+ */
+static DEFINE_PER_CPU(struct list_head, blocked_vcpu_on_cpu);
+static DEFINE_PER_CPU(spinlock_t, blocked_vcpu_on_cpu_lock);
+
 static unsigned long *vmx_io_bitmap_a;
 static unsigned long *vmx_io_bitmap_b;
 static unsigned long *vmx_msr_bitmap_legacy;
@@ -1912,6 +1960,63 @@ static void vmx_load_host_state(struct vcpu_vmx *vmx)
 	preempt_enable();
 }
 
+/*
+ * VT-d posted interrupts are written by the IOMMU into the pi_desc of the
+ * target vcpu, which then notifies NDST with vector NV.  While the vcpu
+ * runs, NV is POSTED_INTR_VECTOR and NDST the CPU it runs on; while it is
+ * preempted, SN suppresses the notification; while it is halted, NV is
+ * POSTED_INTR_WAKEUP_VECTOR so that wakeup_handler() can kick it.
+ */
+static bool vmx_pi_enabled(struct kvm *kvm)
+{
+	return kvm_x86_ops->update_pi_irte && irqchip_in_kernel(kvm);
+}
+
+static u32 pi_ndst(int cpu)
+{
+	u32 dest = cpu_physical_id(cpu);
+
+	return x2apic_enabled() ? dest : (dest << 8) & 0xFF00;
+}
+
+static void vmx_vcpu_pi_load(struct kvm_vcpu *vcpu, int cpu)
+{
+	struct pi_desc *pi_desc = &to_vmx(vcpu)->pi_desc;
+	struct pi_desc old, new;
+
+	if (!vmx_pi_enabled(vcpu->kvm))
+		return;
+
+	do {
+		old.control = new.control = pi_desc->control;
+
+		/* A halted vcpu keeps the wakeup vector until post_block. */
+		if (old.nv != POSTED_INTR_WAKEUP_VECTOR) {
+			new.ndst = pi_ndst(cpu);
+			new.nv = POSTED_INTR_VECTOR;
+		}
+		new.sn = 0;
+	} while (cmpxchg(&pi_desc->control, old.control,
+			 new.control) != old.control);
+
+	/*
+	 * Interrupts posted while SN was set did not set ON; set it now so
+	 * that they are delivered at the next VM entry.
+	 */
+	smp_mb__after_atomic();
+	if (!bitmap_empty((unsigned long *)pi_desc->pir, NR_VECTORS))
+		pi_test_and_set_on(pi_desc);
+}
+
+static void vmx_vcpu_pi_put(struct kvm_vcpu *vcpu)
+{
+	if (!vmx_pi_enabled(vcpu->kvm))
+		return;
+
+	if (vcpu->preempted)
+		pi_set_sn(&to_vmx(vcpu)->pi_desc);
+}
+
 /*
  * Switches to specified vcpu, until a matching vcpu_put(), but assumes
  * vcpu mutex is already taken.
@@ -1962,10 +2067,14 @@ static void vmx_vcpu_load(struct kvm_vcpu *vcpu, int cpu)
 		vmcs_writel(HOST_IA32_SYSENTER_ESP, sysenter_esp); /* 22.2.3 */
 		vmx->loaded_vmcs->cpu = cpu;
 	}
+
+	vmx_vcpu_pi_load(vcpu, cpu);
 }
 
 static void vmx_vcpu_put(struct kvm_vcpu *vcpu)
 {
+	vmx_vcpu_pi_put(vcpu);
+
 	__vmx_load_host_state(to_vmx(vcpu));
 	if (!vmm_exclusive) {
 		__loaded_vmcs_clear(to_vmx(vcpu)->loaded_vmcs);
@@ -4471,6 +4580,148 @@ static void vmx_sync_pir_to_irr_dummy(struct kvm_vcpu *vcpu)
 	return;
 }
 
+/*
+ * Handler for POSTED_INTR_WAKEUP_VECTOR: kick the halted vcpus of this
+ * CPU that VT-d has posted an interrupt to.
+ */
+static void wakeup_handler(void)
+{
+	struct vcpu_vmx *vmx;
+	int cpu = smp_processor_id();
+
+	spin_lock(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+	list_for_each_entry(vmx, &per_cpu(blocked_vcpu_on_cpu, cpu),
+			    blocked_vcpu_list) {
+		if (pi_test_on(&vmx->pi_desc))
+			kvm_vcpu_kick(&vmx->vcpu);
+	}
+	spin_unlock(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+}
+
+static void vmx_pi_unlink_blocked(struct vcpu_vmx *vmx)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&per_cpu(blocked_vcpu_on_cpu_lock, vmx->pre_pcpu),
+			  flags);
+	list_del(&vmx->blocked_vcpu_list);
+	spin_unlock_irqrestore(&per_cpu(blocked_vcpu_on_cpu_lock,
+					vmx->pre_pcpu), flags);
+	vmx->pre_pcpu = -1;
+}
+
+/*
+ * Route VT-d notifications for a vcpu that is about to halt to the wakeup
+ * vector.  Returns 1 if an interrupt has already been posted, in which
+ * case the vcpu must not block.
+ */
+static int vmx_pre_block(struct kvm_vcpu *vcpu)
+{
+	struct vcpu_vmx *vmx = to_vmx(vcpu);
+	struct pi_desc *pi_desc = &vmx->pi_desc;
+	struct pi_desc old, new;
+	unsigned long flags;
+
+	if (!vmx_pi_enabled(vcpu->kvm) ||
+	    !kvm_arch_has_assigned_device(vcpu->kvm))
+		return 0;
+
+	/*
+	 * The vcpu can be migrated from here on, so both the list and the
+	 * notification destination use pre_pcpu.
+	 */
+	vmx->pre_pcpu = vcpu->cpu;
+	spin_lock_irqsave(&per_cpu(blocked_vcpu_on_cpu_lock, vmx->pre_pcpu),
+			  flags);
+	list_add_tail(&vmx->blocked_vcpu_list,
+		      &per_cpu(blocked_vcpu_on_cpu, vmx->pre_pcpu));
+	spin_unlock_irqrestore(&per_cpu(blocked_vcpu_on_cpu_lock,
+					vmx->pre_pcpu), flags);
+
+	do {
+		old.control = new.control = pi_desc->control;
+
+		if (old.on) {
+			vmx_pi_unlink_blocked(vmx);
+			return 1;
+		}
+
+		new.ndst = pi_ndst(vmx->pre_pcpu);
+		new.nv = POSTED_INTR_WAKEUP_VECTOR;
+	} while (cmpxchg(&pi_desc->control, old.control,
+			 new.control) != old.control);
+
+	return 0;
+}
+
+static void vmx_post_block(struct kvm_vcpu *vcpu)
+{
+	struct vcpu_vmx *vmx = to_vmx(vcpu);
+	struct pi_desc *pi_desc = &vmx->pi_desc;
+	struct pi_desc old, new;
+	int cpu;
+
+	if (vmx->pre_pcpu == -1)
+		return;
+
+	/* With preemption off, vmx_vcpu_pi_load() cannot race with us. */
+	cpu = get_cpu();
+	do {
+		old.control = new.control = pi_desc->control;
+		new.ndst = pi_ndst(cpu);
+		new.sn = 0;
+		new.nv = POSTED_INTR_VECTOR;
+	} while (cmpxchg(&pi_desc->control, old.control,
+			 new.control) != old.control);
+	put_cpu();
+
+	vmx_pi_unlink_blocked(vmx);
+}
+
+/*
+ * Post @host_irq directly into the pi_desc of the vcpu that @guest_irq is
+ * routed to, or give it back to the host if @set is false or the guest
+ * interrupt does not target exactly one vcpu.
+ */
+static int vmx_update_pi_irte(struct kvm *kvm, unsigned int host_irq,
+			      uint32_t guest_irq, bool set)
+{
+	struct kvm_kernel_irq_routing_entry entries[KVM_NR_IRQCHIPS];
+	struct kvm_vcpu *vcpu = NULL;
+	struct vcpu_data vcpu_info;
+	struct kvm_lapic_irq irq;
+	int idx, i, n, ret;
+
+	if (!set)
+		return irq_remap_set_vcpu_affinity(host_irq, NULL);
+
+	if (!irqchip_in_kernel(kvm) || !kvm_arch_has_assigned_device(kvm))
+		return 0;
+
+	idx = srcu_read_lock(&kvm->irq_srcu);
+	n = kvm_irq_map_gsi(kvm, entries, guest_irq);
+	for (i = 0; i < n; i++) {
+		if (entries[i].type != KVM_IRQ_ROUTING_MSI)
+			continue;
+
+		kvm_set_msi_irq(&entries[i], &irq);
+		if ((irq.delivery_mode == APIC_DM_FIXED ||
+		     irq.delivery_mode == APIC_DM_LOWEST) &&
+		    kvm_intr_is_single_vcpu(kvm, &irq, &vcpu))
+			break;
+	}
+
+	if (i < n) {
+		vcpu_info.pi_desc_addr = __pa(&to_vmx(vcpu)->pi_desc);
+		vcpu_info.vector = irq.vector;
+		ret = irq_remap_set_vcpu_affinity(host_irq, &vcpu_info);
+	} else
+		ret = irq_remap_set_vcpu_affinity(host_irq, NULL);
+	srcu_read_unlock(&kvm->irq_srcu, idx);
+
+	return ret;
+}
+
 /*
  * Set up the vmcs's constant host-state fields, i.e., host-state fields that
  * will not change in the lifetime of the guest.
@@ -4799,8 +5050,11 @@ static void vmx_vcpu_reset(struct kvm_vcpu *vcpu)
 
 	kvm_make_request(KVM_REQ_APIC_PAGE_RELOAD, vcpu);
 
-	if (vmx_vm_has_apicv(vcpu->kvm))
-		memset(&vmx->pi_desc, 0, sizeof(struct pi_desc));
+	/* Leave the VT-d notification fields alone, vcpu load owns them */
+	if (vmx_vm_has_apicv(vcpu->kvm)) {
+		memset(vmx->pi_desc.pir, 0, sizeof(vmx->pi_desc.pir));
+		pi_clear_on(&vmx->pi_desc);
+	}
 
 	if (vmx->vpid != 0)
 		vmcs_write16(VIRTUAL_PROCESSOR_ID, vmx->vpid);
@@ -6209,8 +6463,21 @@ static __init int hardware_setup(void)
 		kvm_x86_ops->slot_disable_log_dirty = NULL;
 		kvm_x86_ops->flush_log_dirty = NULL;
 		kvm_x86_ops->enable_log_dirty_pt_masked = NULL;
+		kvm_x86_ops->cpu_dirty_log_size = 0;
 	}
 
+	for_each_possible_cpu(i) {
+		INIT_LIST_HEAD(&per_cpu(blocked_vcpu_on_cpu, i));
+		spin_lock_init(&per_cpu(blocked_vcpu_on_cpu_lock, i));
+	}
+
+	if (!enable_apicv || !irq_remapping_cap(IRQ_POSTING_CAP)) {
+		kvm_x86_ops->pre_block = NULL;
+		kvm_x86_ops->post_block = NULL;
+		kvm_x86_ops->update_pi_irte = NULL;
+	} else
+		kvm_set_posted_intr_wakeup_handler(wakeup_handler);
+
 	return alloc_kvm_area();
 
 out8:
@@ -6238,6 +6505,8 @@ out:
 
 static __exit void hardware_unsetup(void)
 {
+	kvm_set_posted_intr_wakeup_handler(NULL);
+
 	free_page((unsigned long)vmx_msr_bitmap_legacy_x2apic);
 	free_page((unsigned long)vmx_msr_bitmap_longmode_x2apic);
 	free_page((unsigned long)vmx_msr_bitmap_legacy);
@@ -8187,6 +8456,16 @@ static void __noclone vmx_vcpu_run(struct kvm_vcpu *vcpu)
 		vmx->nested.sync_shadow_vmcs = false;
 	}
 
+	/*
+	 * VT-d may have posted an interrupt while we were in root mode, in
+	 * which case its notification went to the host.  Raise it again so
+	 * that it is processed at VM entry; interrupts are disabled here.
+	 */
+	if (vmx_pi_enabled(vcpu->kvm) && !is_guest_mode(vcpu) &&
+	    kvm_arch_has_assigned_device(vcpu->kvm) &&
+	    pi_test_on(&vmx->pi_desc))
+		apic->send_IPI_self(POSTED_INTR_VECTOR);
+
 	if (test_bit(VCPU_REGS_RSP, (unsigned long *)&vcpu->arch.regs_dirty))
 		vmcs_writel(GUEST_RSP, vcpu->arch.regs[VCPU_REGS_RSP]);
 	if (test_bit(VCPU_REGS_RIP, (unsigned long *)&vcpu->arch.regs_dirty))
@@ -8404,6 +8683,9 @@ static struct kvm_vcpu *vmx_create_vcpu(struct kvm *kvm, unsigned int id)
 
 	allocate_vpid(vmx);
 
+	INIT_LIST_HEAD(&vmx->blocked_vcpu_list);
+	vmx->pre_pcpu = -1;
+
 	err = kvm_vcpu_init(&vmx->vcpu, kvm, id);
 	if (err)
 		goto free_vcpu;
@@ -10279,6 +10561,11 @@ static struct kvm_x86_ops vmx_x86_ops = {
 	.slot_disable_log_dirty = vmx_slot_disable_log_dirty,
 	.flush_log_dirty = vmx_flush_log_dirty,
 	.enable_log_dirty_pt_masked = vmx_enable_log_dirty_pt_masked,
+	.cpu_dirty_log_size = PML_ENTITY_NUM,
+
+	.pre_block = vmx_pre_block,
+	.post_block = vmx_post_block,
+	.update_pi_irte = vmx_update_pi_irte,
 };
 
 static int __init vmx_init(void)
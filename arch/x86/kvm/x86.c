@@ -146,6 +146,7 @@ struct kvm_stats_debugfs_item debugfs_entries[] = {
 	{ "nmi_window", VCPU_STAT(nmi_window_exits) },
 	{ "halt_exits", VCPU_STAT(halt_exits) },
 	{ "halt_successful_poll", VCPU_STAT(halt_successful_poll) },
+	{ "halt_attempted_poll", VCPU_STAT(halt_attempted_poll) },
 	{ "halt_wakeup", VCPU_STAT(halt_wakeup) },
 	{ "hypercalls", VCPU_STAT(hypercalls) },
 	{ "request_irq", VCPU_STAT(request_irq_exits) },
@@ -5205,9 +5206,9 @@ static bool reexecute_instruction(struct kvm_vcpu *vcpu, gva_t cr2,
 	if (vcpu->arch.mmu.direct_map) {
 		unsigned int indirect_shadow_pages;
 
-		spin_lock(&vcpu->kvm->mmu_lock);
+		write_lock(&vcpu->kvm->mmu_lock);
 		indirect_shadow_pages = vcpu->kvm->arch.indirect_shadow_pages;
-		spin_unlock(&vcpu->kvm->mmu_lock);
+		write_unlock(&vcpu->kvm->mmu_lock);
 
 		if (indirect_shadow_pages)
 			kvm_mmu_unprotect_page(vcpu->kvm, gpa_to_gfn(gpa));
@@ -6230,6 +6231,14 @@ static int vcpu_enter_guest(struct kvm_vcpu *vcpu)
 		vcpu->run->request_interrupt_window;
 	bool req_immediate_exit = false;
 
+	/* Let userspace harvest the dirty ring before it can overflow. */
+	if (unlikely(vcpu->kvm->dirty_ring_size &&
+		     kvm_dirty_ring_soft_full(&vcpu->dirty_ring))) {
+		vcpu->run->exit_reason = KVM_EXIT_DIRTY_RING_FULL;
+		r = 0;
+		goto out;
+	}
+
 	if (vcpu->requests) {
 		if (kvm_check_request(KVM_REQ_MMU_RELOAD, vcpu))
 			kvm_mmu_unload(vcpu);
@@ -6444,10 +6453,15 @@ out:
 
 static inline int vcpu_block(struct kvm *kvm, struct kvm_vcpu *vcpu)
 {
-	if (!kvm_arch_vcpu_runnable(vcpu)) {
+	if (!kvm_arch_vcpu_runnable(vcpu) &&
+	    (!kvm_x86_ops->pre_block || kvm_x86_ops->pre_block(vcpu) == 0)) {
 		srcu_read_unlock(&kvm->srcu, vcpu->srcu_idx);
 		kvm_vcpu_block(vcpu);
 		vcpu->srcu_idx = srcu_read_lock(&kvm->srcu);
+
+		if (kvm_x86_ops->post_block)
+			kvm_x86_ops->post_block(vcpu);
+
 		if (!kvm_check_request(KVM_REQ_UNHALT, vcpu))
 			return 1;
 	}
@@ -7414,8 +7428,38 @@ void kvm_arch_sched_in(struct kvm_vcpu *vcpu, int cpu)
 	kvm_x86_ops->sched_in(vcpu, cpu);
 }
 
+int kvm_cpu_dirty_log_size(void)
+{
+	return kvm_x86_ops->cpu_dirty_log_size;
+}
+
+/*
+ * Recover large sptes for slots whose dirty logging was turned off.  This
+ * walks every 4k rmap of the slot, so it is done here rather than in the
+ * KVM_SET_USER_MEMORY_REGION ioctl that stopped the dirty logging.
+ */
+static void kvm_mmu_collapse_fn(struct work_struct *work)
+{
+	struct kvm_arch *ka = container_of(work, struct kvm_arch,
+					   mmu_collapse_work);
+	struct kvm *kvm = container_of(ka, struct kvm, arch);
+	struct kvm_memory_slot *slot;
+	int id;
+
+	mutex_lock(&kvm->slots_lock);
+	for_each_set_bit(id, ka->mmu_collapse_slots, KVM_MEM_SLOTS_NUM) {
+		clear_bit(id, ka->mmu_collapse_slots);
+		slot = id_to_memslot(kvm->memslots, id);
+		if (slot->npages && !(slot->flags & KVM_MEM_LOG_DIRTY_PAGES))
+			kvm_mmu_zap_collapsible_sptes(kvm, slot);
+	}
+	mutex_unlock(&kvm->slots_lock);
+}
+
 int kvm_arch_init_vm(struct kvm *kvm, unsigned long type)
 {
+	int i;
+
 	if (type)
 		return -EINVAL;
 
@@ -7424,6 +7468,7 @@ int kvm_arch_init_vm(struct kvm *kvm, unsigned long type)
 	INIT_LIST_HEAD(&kvm->arch.zapped_obsolete_pages);
 	INIT_LIST_HEAD(&kvm->arch.assigned_dev_head);
 	atomic_set(&kvm->arch.noncoherent_dma_count, 0);
+	atomic_set(&kvm->arch.assigned_device_count, 0);
 
 	/* Reserve bit 0 of irq_sources_bitmap for userspace irq source */
 	set_bit(KVM_USERSPACE_IRQ_SOURCE_ID, &kvm->arch.irq_sources_bitmap);
@@ -7440,6 +7485,10 @@ int kvm_arch_init_vm(struct kvm *kvm, unsigned long type)
 	INIT_DELAYED_WORK(&kvm->arch.kvmclock_update_work, kvmclock_update_fn);
 	INIT_DELAYED_WORK(&kvm->arch.kvmclock_sync_work, kvmclock_sync_fn);
 
+	for (i = 0; i < KVM_MMU_RMAP_LOCKS; i++)
+		spin_lock_init(&kvm->arch.mmu_rmap_locks[i]);
+	INIT_WORK(&kvm->arch.mmu_collapse_work, kvm_mmu_collapse_fn);
+
 	return 0;
 }
 
@@ -7479,6 +7528,7 @@ void kvm_arch_sync_events(struct kvm *kvm)
 {
 	cancel_delayed_work_sync(&kvm->arch.kvmclock_sync_work);
 	cancel_delayed_work_sync(&kvm->arch.kvmclock_update_work);
+	cancel_work_sync(&kvm->arch.mmu_collapse_work);
 	kvm_free_all_assigned_devices(kvm);
 	kvm_free_pit(kvm);
 }
@@ -7715,12 +7765,16 @@ void kvm_arch_commit_memory_region(struct kvm *kvm,
 	 *
 	 * Scan sptes if dirty logging has been stopped, dropping those
 	 * which can be collapsed into a single large-page spte.  Later
-	 * page faults will create the large-page sptes.
+	 * page faults will create the large-page sptes.  The scan is done
+	 * from a work item so that it does not delay the ioctl or the vcpus
+	 * that are waiting for mmu_lock.
 	 */
 	if ((change != KVM_MR_DELETE) &&
 		(old->flags & KVM_MEM_LOG_DIRTY_PAGES) &&
-		!(new->flags & KVM_MEM_LOG_DIRTY_PAGES))
-		kvm_mmu_zap_collapsible_sptes(kvm, new);
+		!(new->flags & KVM_MEM_LOG_DIRTY_PAGES)) {
+		set_bit(new->id, kvm->arch.mmu_collapse_slots);
+		schedule_work(&kvm->arch.mmu_collapse_work);
+	}
 
 	/*
 	 * Set up write protection and/or dirty logging for the new slot.
@@ -7971,6 +8025,28 @@ bool kvm_arch_has_noncoherent_dma(struct kvm *kvm)
 }
 EXPORT_SYMBOL_GPL(kvm_arch_has_noncoherent_dma);
 
+void kvm_arch_start_assignment(struct kvm *kvm)
+{
+	atomic_inc(&kvm->arch.assigned_device_count);
+}
+
+void kvm_arch_end_assignment(struct kvm *kvm)
+{
+	atomic_dec(&kvm->arch.assigned_device_count);
+}
+
+bool kvm_arch_has_assigned_device(struct kvm *kvm)
+{
+	return atomic_read(&kvm->arch.assigned_device_count);
+}
+EXPORT_SYMBOL_GPL(kvm_arch_has_assigned_device);
+
+/* Guest MSI routes may have moved, re-target posted interrupts. */
+void kvm_arch_irq_routing_update(struct kvm *kvm)
+{
+	kvm_assigned_dev_update_irq_routing(kvm);
+}
+
 EXPORT_TRACEPOINT_SYMBOL_GPL(kvm_exit);
 EXPORT_TRACEPOINT_SYMBOL_GPL(kvm_inj_virq);
 EXPORT_TRACEPOINT_SYMBOL_GPL(kvm_page_fault);
@@ -1161,6 +1161,23 @@ __do_page_fault(struct pt_regs *regs, unsigned long error_code,
 	if (error_code & PF_WRITE)
 		flags |= FAULT_FLAG_WRITE;
 
+	/*
+	 * Not-present faults from user space on anonymous memory can often
+	 * be handled without the mmap_sem.  Anything the speculative path
+	 * can't handle comes back as VM_FAULT_RETRY and goes the usual way.
+	 */
+	if ((flags & FAULT_FLAG_USER) &&
+	    !(error_code & (PF_PROT | PF_INSTR | PF_RSVD))) {
+		fault = handle_speculative_fault(mm, address, flags);
+		if (!(fault & VM_FAULT_RETRY)) {
+			tsk->min_flt++;
+			perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1,
+				      regs, address);
+			check_v8086_mode(regs, address, tsk);
+			return;
+		}
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
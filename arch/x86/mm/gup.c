@@ -129,7 +129,9 @@ static noinline int gup_huge_pmd(pmd_t pmd, unsigned long addr,
 		return 0;
 	/* hugepages are never "special" */
 	VM_BUG_ON(pte_flags(pte) & _PAGE_SPECIAL);
-	VM_BUG_ON(!pfn_valid(pte_pfn(pte)));
+	/* but DAX maps memory without struct pages with them */
+	if (!pfn_valid(pte_pfn(pte)))
+		return 0;
 
 	refs = 0;
 	head = pte_page(pte);
@@ -183,6 +185,9 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 			if (!gup_huge_pmd(pmd, addr, next, write, pages, nr))
 				return 0;
 		} else {
+			/* pte tables shared by fork are mapped read-only */
+			if (write && !pmd_write(pmd))
+				return 0;
 			if (!gup_pte_range(pmd, addr, next, write, pages, nr))
 				return 0;
 		}
@@ -876,6 +876,59 @@ int bio_add_page(struct bio *bio, struct page *page, unsigned int len,
 }
 EXPORT_SYMBOL(bio_add_page);
 
+/**
+ * bio_iov_iter_get_pages - pin user or kernel pages and add them to a bio
+ * @bio: bio to add pages to
+ * @iter: iov iterator describing the region to be mapped
+ *
+ * Pins as many pages from @iter as fit into @bio's remaining bvecs and
+ * adds them with bio_add_page(), so the queue limits are honoured.  The
+ * iterator is advanced past what was added, pages that didn't fit are
+ * released again.  The pages in the bio have to be released with
+ * put_page() once the I/O is done.
+ */
+int bio_iov_iter_get_pages(struct bio *bio, struct iov_iter *iter)
+{
+	unsigned short nr_pages = bio->bi_max_vecs - bio->bi_vcnt;
+	struct bio_vec *bv = bio->bi_io_vec + bio->bi_vcnt;
+	struct page **pages;
+	size_t offset, added = 0;
+	ssize_t size;
+	int i;
+
+	/*
+	 * Borrow the upper half of the unused bvecs for the page array.
+	 * bio_add_page() fills bvec i only after page i has been consumed,
+	 * and bvec i never overlaps a page pointer beyond i.
+	 */
+	pages = (struct page **)bv + nr_pages;
+
+	size = iov_iter_get_pages(iter, pages, LONG_MAX, nr_pages, &offset);
+	if (unlikely(size <= 0))
+		return size ? size : -EFAULT;
+	nr_pages = DIV_ROUND_UP(size + offset, PAGE_SIZE);
+
+	for (i = 0; i < nr_pages; i++) {
+		unsigned int len = min_t(size_t, PAGE_SIZE - offset,
+					 size - added);
+
+		if (bio_add_page(bio, pages[i], len, offset) != len)
+			break;
+		added += len;
+		offset = 0;
+	}
+
+	/* a single page always fits into an empty bio */
+	for (; i < nr_pages; i++)
+		put_page(pages[i]);
+	if (!added)
+		return -EINVAL;
+
+	iov_iter_advance(iter, added);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(bio_iov_iter_get_pages);
+
 struct submit_bio_ret {
 	struct completion event;
 	int error;
@@ -1931,6 +1984,7 @@ static struct bio_set *__bioset_create(unsigned int pool_size,
 	bs->bio_pool = mempool_create_slab_pool(pool_size, bs->bio_slab);
 	if (!bs->bio_pool)
 		goto bad;
+	mempool_enable_percpu(bs->bio_pool, GFP_KERNEL);
 
 	if (create_bvec_pool) {
 		bs->bvec_pool = biovec_create_pool(pool_size);
@@ -839,6 +839,7 @@ blkcg_css_alloc(struct cgroup_subsys_state *parent_css)
 
 	blkcg->cfq_weight = CFQ_WEIGHT_DEFAULT;
 	blkcg->cfq_leaf_weight = CFQ_WEIGHT_DEFAULT;
+	blkcg->iocost_weight = IOCOST_WEIGHT_DEFAULT;
 done:
 	spin_lock_init(&blkcg->lock);
 	INIT_RADIX_TREE(&blkcg->blkg_tree, GFP_ATOMIC);
@@ -859,9 +860,18 @@ done:
  */
 int blkcg_init_queue(struct request_queue *q)
 {
+	int ret;
+
 	might_sleep();
 
-	return blk_throtl_init(q);
+	ret = blk_throtl_init(q);
+	if (ret)
+		return ret;
+
+	ret = blk_iocost_init(q);
+	if (ret)
+		blk_throtl_exit(q);
+	return ret;
 }
 
 /**
@@ -882,6 +892,7 @@ void blkcg_drain_queue(struct request_queue *q)
 		return;
 
 	blk_throtl_drain(q);
+	blk_iocost_drain(q);
 }
 
 /**
@@ -896,6 +907,7 @@ void blkcg_exit_queue(struct request_queue *q)
 	blkg_destroy_all(q);
 	spin_unlock_irq(q->queue_lock);
 
+	blk_iocost_exit(q);
 	blk_throtl_exit(q);
 }
 
@@ -39,6 +39,7 @@
 #include "blk.h"
 #include "blk-cgroup.h"
 #include "blk-mq.h"
+#include "blk-mq-sched.h"
 
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_bio_remap);
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_rq_remap);
@@ -544,8 +545,10 @@ void blk_cleanup_queue(struct request_queue *q)
 	del_timer_sync(&q->backing_dev_info.laptop_mode_wb_timer);
 	blk_sync_queue(q);
 
-	if (q->mq_ops)
+	if (q->mq_ops) {
+		blk_mq_sched_teardown(q);
 		blk_mq_free_queue(q);
+	}
 
 	spin_lock_irq(lock);
 	if (q->queue_lock != &q->__queue_lock)
@@ -589,6 +592,7 @@ int blk_init_rl(struct request_list *rl, struct request_queue *q,
 					  q->node);
 	if (!rl->rq_pool)
 		return -ENOMEM;
+	mempool_enable_percpu(rl->rq_pool, gfp_mask);
 
 	return 0;
 }
@@ -1870,6 +1874,9 @@ generic_make_request_checks(struct bio *bio)
 	if (blk_throtl_bio(q, bio))
 		return false;	/* throttled, will be resubmitted later */
 
+	if (blk_iocost_bio(q, bio))
+		return false;	/* held back, will be resubmitted later */
+
 	trace_block_bio_queue(q, bio);
 	return true;
 
@@ -3202,6 +3209,49 @@ void blk_finish_plug(struct blk_plug *plug)
 }
 EXPORT_SYMBOL(blk_finish_plug);
 
+/**
+ * blk_poll - poll for completions on the hardware queue of this CPU
+ * @q: the queue to poll
+ *
+ * Description:
+ *    Requests submitted from this CPU are queued on the hardware queue it
+ *    maps to, so that is where a task spinning for its own REQ_HIPRI I/O
+ *    will find the completions.  Returns true if any request was
+ *    completed.  Only blk-mq drivers that provide a ->poll handler can be
+ *    polled, and only while QUEUE_FLAG_POLL is set.
+ *
+ *    Unless io_poll_delay is -1, the caller may first be put to sleep
+ *    until the most recently issued REQ_HIPRI request is expected to be
+ *    close to completion, so a polling task doesn't burn the whole device
+ *    latency spinning.
+ */
+bool blk_poll(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int ret;
+
+	if (!q->mq_ops || !q->mq_ops->poll ||
+	    !test_bit(QUEUE_FLAG_POLL, &q->queue_flags))
+		return false;
+
+	hctx = q->mq_ops->map_queue(q, get_cpu());
+	put_cpu();
+
+	hctx->poll_considered++;
+	if (blk_mq_poll_hybrid_sleep(q, hctx))
+		hctx->poll_sleeps++;
+
+	hctx->poll_invoked++;
+	ret = q->mq_ops->poll(hctx);
+	if (ret > 0) {
+		hctx->poll_success++;
+		return true;
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 #ifdef CONFIG_PM
 /**
  * blk_pm_runtime_init - Block layer runtime PM initialization routine
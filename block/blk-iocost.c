@@ -0,0 +1,738 @@
+/*
+ * Proportional IO control based on a model of the device's cost
+ *
+ * Every bio is charged an estimate of the device time it takes, from a
+ * linear model of the device: a fixed cost per IO, an extra cost when the
+ * IO doesn't continue where the previous one of the group ended, and a
+ * cost per 4k page transferred.  Device time passes with wall clock time
+ * and is shared among the cgroups issuing IO in proportion to their
+ * weights, hierarchically: a group gets the share of its parent scaled by
+ * its weight over the sum of the weights of its active siblings.
+ *
+ * Each group keeps a virtual time which advances by the cost of each bio
+ * it issues divided by its share.  Bios are issued while the group's vtime
+ * isn't ahead of the clock and are held otherwise until the clock catches
+ * up.  A group which has been idle can't bank more than IOCOST_MARGIN_NS
+ * of unused device time.  A group with no active siblings anywhere on its
+ * path to the root isn't charged at all, so that a lone group is never
+ * held back by a pessimistic model.
+ *
+ * As this works on bios above the request queue, it applies to blk-mq
+ * devices as well as to legacy ones.  IO from the root cgroup is not
+ * controlled.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/ktime.h>
+#include "blk-cgroup.h"
+#include "blk.h"
+
+/* Groups which issued no IO for a period stop competing for the device */
+#define IOCOST_PERIOD		(HZ / 10)
+
+/* Most device time an idle group can bank */
+#define IOCOST_MARGIN_NS	(10 * NSEC_PER_MSEC)
+
+/* Fixed point one for hierarchical shares of the device */
+#define IOCOST_HWEIGHT_ONE	(1U << 16)
+
+/* Size of the pages the transfer cost of the model is expressed for */
+#define IOCOST_PAGE_SHIFT	12
+
+/*
+ * Default model, roughly a mid-range NVMe SSD.  The model of each device
+ * can be set through the iocost.*_nsec files of the root cgroup.
+ */
+#define IOCOST_DFL_READ_IO_NSEC		1000
+#define IOCOST_DFL_READ_SEEK_NSEC	1500
+#define IOCOST_DFL_READ_PAGE_NSEC	1500
+#define IOCOST_DFL_WRITE_IO_NSEC	2000
+#define IOCOST_DFL_WRITE_SEEK_NSEC	2000
+#define IOCOST_DFL_WRITE_PAGE_NSEC	2000
+
+static struct blkcg_policy blkcg_policy_iocost;
+
+struct iocost_grp {
+	/* must be the first member */
+	struct blkg_policy_data	pd;
+
+	/* iocost_data this group belongs to */
+	struct iocost_data	*iocd;
+
+	/* weight for this device, 0 if the cgroup's weight applies */
+	unsigned int		dev_weight;
+	/* weight in effect, and the one to switch to under queue_lock */
+	unsigned int		weight;
+	unsigned int		new_weight;
+
+	/*
+	 * An active group is on iocd->active_list and has its weight
+	 * counted in its parent's child_active_sum.  A group is active
+	 * while it or any of its descendants issued IO recently.
+	 */
+	bool			active;
+	struct list_head	active_node;
+	unsigned int		nr_active_children;
+	unsigned int		child_active_sum;
+	unsigned long		last_io;	/* jiffies */
+
+	/* share of the device in IOCOST_HWEIGHT_ONE units */
+	u32			hweight;
+	/* iocd->hweight_gen @hweight was computed for */
+	unsigned int		hweight_gen;
+
+	/* device time consumed, in nsecs of ktime_get_ns() */
+	u64			vtime;
+	/* where the last bio charged ended, to tell seeks */
+	sector_t		cursor;
+
+	/* bios waiting for @vtime, the group holds a blkg ref while any */
+	struct bio_list		bios;
+	struct timer_list	wait_timer;
+
+	/* number of bios which had to wait */
+	u64			nr_waited;
+};
+
+struct iocost_data {
+	struct request_queue	*queue;
+
+	/* cost model in nsecs of device time, indexed by READ/WRITE */
+	u64			io_nsec[2];
+	u64			seek_nsec[2];
+	u64			page_nsec[2];
+
+	/* active iocost_grp's */
+	struct list_head	active_list;
+	/* bumped whenever the share of any group may have changed */
+	unsigned int		hweight_gen;
+	/* deactivates idle groups, runs while any group is active */
+	struct timer_list	period_timer;
+
+	/* bios let through after waiting, issued by dispatch_work */
+	struct bio_list		dispatch_bios;
+	struct work_struct	dispatch_work;
+};
+
+static inline struct iocost_grp *pd_to_iocg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct iocost_grp, pd) : NULL;
+}
+
+static inline struct iocost_grp *blkg_to_iocg(struct blkcg_gq *blkg)
+{
+	return pd_to_iocg(blkg_to_pd(blkg, &blkcg_policy_iocost));
+}
+
+static inline struct blkcg_gq *iocg_to_blkg(struct iocost_grp *iocg)
+{
+	return pd_to_blkg(&iocg->pd);
+}
+
+static inline struct iocost_grp *iocg_parent(struct iocost_grp *iocg)
+{
+	struct blkcg_gq *parent = iocg_to_blkg(iocg)->parent;
+
+	return parent ? blkg_to_iocg(parent) : NULL;
+}
+
+static void iocg_set_weight(struct iocost_grp *iocg, unsigned int weight)
+{
+	struct iocost_grp *parent = iocg_parent(iocg);
+
+	if (iocg->active && parent) {
+		parent->child_active_sum += weight - iocg->weight;
+		iocg->iocd->hweight_gen++;
+	}
+	iocg->weight = weight;
+}
+
+static void iocg_activate(struct iocost_grp *iocg)
+{
+	struct iocost_data *iocd = iocg->iocd;
+	struct iocost_grp *parent;
+
+	if (iocg->weight != iocg->new_weight)
+		iocg_set_weight(iocg, iocg->new_weight);
+
+	if (iocg->active)
+		return;
+
+	for (; !iocg->active; iocg = parent) {
+		iocg->active = true;
+		list_add_tail(&iocg->active_node, &iocd->active_list);
+
+		parent = iocg_parent(iocg);
+		if (!parent)
+			break;
+		parent->nr_active_children++;
+		parent->child_active_sum += iocg->weight;
+	}
+
+	iocd->hweight_gen++;
+	if (!timer_pending(&iocd->period_timer))
+		mod_timer(&iocd->period_timer, jiffies + IOCOST_PERIOD);
+}
+
+static void iocg_deactivate(struct iocost_grp *iocg)
+{
+	struct iocost_grp *parent = iocg_parent(iocg);
+
+	iocg->active = false;
+	list_del_init(&iocg->active_node);
+	iocg->iocd->hweight_gen++;
+
+	if (parent) {
+		parent->nr_active_children--;
+		parent->child_active_sum -= iocg->weight;
+	}
+}
+
+static bool iocg_idle(struct iocost_grp *iocg)
+{
+	return !iocg->nr_active_children && bio_list_empty(&iocg->bios) &&
+	       time_after_eq(jiffies, iocg->last_io + IOCOST_PERIOD);
+}
+
+/* share of the device of an active group */
+static u32 iocg_hweight(struct iocost_grp *iocg)
+{
+	struct iocost_grp *g, *parent;
+	u64 hweight = IOCOST_HWEIGHT_ONE;
+
+	if (iocg->hweight_gen == iocg->iocd->hweight_gen)
+		return iocg->hweight;
+
+	for (g = iocg; (parent = iocg_parent(g)); g = parent)
+		hweight = div_u64(hweight * g->weight,
+				  parent->child_active_sum);
+
+	iocg->hweight = max_t(u64, hweight, 1);
+	iocg->hweight_gen = iocg->iocd->hweight_gen;
+	return iocg->hweight;
+}
+
+static u64 iocg_bio_cost(struct iocost_grp *iocg, struct bio *bio)
+{
+	struct iocost_data *iocd = iocg->iocd;
+	int rw = bio_data_dir(bio);
+	u64 cost = iocd->io_nsec[rw];
+
+	if (bio->bi_iter.bi_sector != iocg->cursor)
+		cost += iocd->seek_nsec[rw];
+	if (!(bio->bi_rw & REQ_DISCARD))
+		cost += iocd->page_nsec[rw] *
+			DIV_ROUND_UP(bio->bi_iter.bi_size,
+				     1 << IOCOST_PAGE_SHIFT);
+	return cost;
+}
+
+/*
+ * Charge @bio to @iocg if the group's vtime allows issuing it at @now.
+ * Otherwise leave @iocg alone and return in @wait_ns how long until it
+ * may be issued.
+ */
+static bool iocg_try_charge(struct iocost_grp *iocg, struct bio *bio,
+			    u64 now, u64 *wait_ns)
+{
+	u32 hweight = iocg_hweight(iocg);
+
+	/* don't let idle groups bank more than the margin */
+	if (now > IOCOST_MARGIN_NS && iocg->vtime < now - IOCOST_MARGIN_NS)
+		iocg->vtime = now - IOCOST_MARGIN_NS;
+
+	if (hweight < IOCOST_HWEIGHT_ONE) {
+		if (iocg->vtime > now) {
+			*wait_ns = iocg->vtime - now;
+			return false;
+		}
+		iocg->vtime += div_u64(iocg_bio_cost(iocg, bio) *
+				       IOCOST_HWEIGHT_ONE, hweight);
+	}
+
+	iocg->cursor = bio_end_sector(bio);
+	return true;
+}
+
+static void iocg_wait(struct iocost_grp *iocg, u64 wait_ns)
+{
+	mod_timer(&iocg->wait_timer, jiffies + nsecs_to_jiffies(wait_ns) + 1);
+}
+
+/* move @bio, charged or not, to the list issued by dispatch_work */
+static void iocg_dispatch_bio(struct iocost_grp *iocg, struct bio *bio)
+{
+	bio_list_add(&iocg->iocd->dispatch_bios, bio);
+	/* @iocg stays around, blkg destruction holds its own reference */
+	if (bio_list_empty(&iocg->bios))
+		blkg_put(iocg_to_blkg(iocg));
+}
+
+/* issue the bios of @iocg its vtime allows, called under queue_lock */
+static void iocg_dispatch(struct iocost_grp *iocg)
+{
+	struct iocost_data *iocd = iocg->iocd;
+	u64 now = ktime_get_ns(), wait_ns;
+	bool dispatched = false;
+	struct bio *bio;
+
+	while ((bio = bio_list_peek(&iocg->bios))) {
+		if (!iocg_try_charge(iocg, bio, now, &wait_ns)) {
+			iocg_wait(iocg, wait_ns);
+			break;
+		}
+		iocg_dispatch_bio(iocg, bio_list_pop(&iocg->bios));
+		dispatched = true;
+	}
+
+	if (dispatched)
+		kblockd_schedule_work(&iocd->dispatch_work);
+}
+
+/* issue all bios of @iocg right away, called under queue_lock */
+static void iocg_flush(struct iocost_grp *iocg)
+{
+	struct iocost_data *iocd = iocg->iocd;
+	struct bio *bio;
+
+	if (bio_list_empty(&iocg->bios))
+		return;
+
+	del_timer(&iocg->wait_timer);
+	while ((bio = bio_list_pop(&iocg->bios)))
+		iocg_dispatch_bio(iocg, bio);
+	kblockd_schedule_work(&iocd->dispatch_work);
+}
+
+static void iocg_wait_timer_fn(unsigned long arg)
+{
+	struct iocost_grp *iocg = (void *)arg;
+	struct request_queue *q = iocg->iocd->queue;
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	iocg_dispatch(iocg);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+
+static void iocost_period_timer_fn(unsigned long arg)
+{
+	struct iocost_data *iocd = (void *)arg;
+	struct request_queue *q = iocd->queue;
+	struct iocost_grp *iocg, *n;
+	unsigned long flags;
+	bool progress;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+
+	/*
+	 * Parents only become idle once their children are deactivated,
+	 * which may be after the parent was visited.  Walk until nothing
+	 * changes, bounded by the depth of the hierarchy.
+	 */
+	do {
+		progress = false;
+		list_for_each_entry_safe(iocg, n, &iocd->active_list,
+					 active_node) {
+			if (iocg->weight != iocg->new_weight)
+				iocg_set_weight(iocg, iocg->new_weight);
+			if (iocg_idle(iocg)) {
+				iocg_deactivate(iocg);
+				progress = true;
+			}
+		}
+	} while (progress);
+
+	/* shares may have grown, give the waiting groups another go */
+	list_for_each_entry(iocg, &iocd->active_list, active_node)
+		if (!bio_list_empty(&iocg->bios))
+			iocg_dispatch(iocg);
+
+	if (!list_empty(&iocd->active_list))
+		mod_timer(&iocd->period_timer, jiffies + IOCOST_PERIOD);
+
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+
+static void iocost_dispatch_work_fn(struct work_struct *work)
+{
+	struct iocost_data *iocd = container_of(work, struct iocost_data,
+						dispatch_work);
+	struct request_queue *q = iocd->queue;
+	struct bio_list bios;
+	struct blk_plug plug;
+	struct bio *bio;
+
+	spin_lock_irq(q->queue_lock);
+	bios = iocd->dispatch_bios;
+	bio_list_init(&iocd->dispatch_bios);
+	spin_unlock_irq(q->queue_lock);
+
+	blk_start_plug(&plug);
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+	blk_finish_plug(&plug);
+}
+
+static void iocost_pd_init(struct blkcg_gq *blkg)
+{
+	struct iocost_grp *iocg = blkg_to_iocg(blkg);
+	struct iocost_data *iocd = blkg->q->iocd;
+
+	iocg->iocd = iocd;
+	iocg->weight = blkg->blkcg->iocost_weight;
+	iocg->new_weight = iocg->weight;
+	INIT_LIST_HEAD(&iocg->active_node);
+	iocg->hweight_gen = iocd->hweight_gen - 1;
+	bio_list_init(&iocg->bios);
+	setup_timer(&iocg->wait_timer, iocg_wait_timer_fn,
+		    (unsigned long)iocg);
+}
+
+static void iocost_pd_offline(struct blkcg_gq *blkg)
+{
+	struct iocost_grp *iocg = blkg_to_iocg(blkg);
+
+	/* the group is going away, don't keep its bios waiting for it */
+	iocg_flush(iocg);
+	if (iocg->active)
+		iocg_deactivate(iocg);
+}
+
+static void iocost_pd_exit(struct blkcg_gq *blkg)
+{
+	del_timer_sync(&blkg_to_iocg(blkg)->wait_timer);
+}
+
+static void iocost_pd_reset_stats(struct blkcg_gq *blkg)
+{
+	blkg_to_iocg(blkg)->nr_waited = 0;
+}
+
+static u64 iocost_read_weight(struct cgroup_subsys_state *css,
+			      struct cftype *cft)
+{
+	return css_to_blkcg(css)->iocost_weight;
+}
+
+static int iocost_set_weight(struct cgroup_subsys_state *css,
+			     struct cftype *cft, u64 val)
+{
+	struct blkcg *blkcg = css_to_blkcg(css);
+	struct blkcg_gq *blkg;
+
+	if (val < IOCOST_WEIGHT_MIN || val > IOCOST_WEIGHT_MAX)
+		return -EINVAL;
+
+	spin_lock_irq(&blkcg->lock);
+	blkcg->iocost_weight = val;
+
+	/* picked up under queue_lock on activation or the next period */
+	hlist_for_each_entry(blkg, &blkcg->blkg_list, blkcg_node) {
+		struct iocost_grp *iocg = blkg_to_iocg(blkg);
+
+		if (iocg && !iocg->dev_weight)
+			iocg->new_weight = val;
+	}
+
+	spin_unlock_irq(&blkcg->lock);
+	return 0;
+}
+
+static u64 iocg_prfill_weight_device(struct seq_file *sf,
+				     struct blkg_policy_data *pd, int off)
+{
+	struct iocost_grp *iocg = pd_to_iocg(pd);
+
+	if (!iocg->dev_weight)
+		return 0;
+	return __blkg_prfill_u64(sf, pd, iocg->dev_weight);
+}
+
+static int iocg_print_weight_device(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)),
+			  iocg_prfill_weight_device, &blkcg_policy_iocost,
+			  0, false);
+	return 0;
+}
+
+static ssize_t iocg_set_weight_device(struct kernfs_open_file *of,
+				      char *buf, size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkg_conf_ctx ctx;
+	struct iocost_grp *iocg;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iocost, buf, &ctx);
+	if (ret)
+		return ret;
+
+	ret = -EINVAL;
+	iocg = blkg_to_iocg(ctx.blkg);
+	if (!ctx.v ||
+	    (ctx.v >= IOCOST_WEIGHT_MIN && ctx.v <= IOCOST_WEIGHT_MAX)) {
+		iocg->dev_weight = ctx.v;
+		iocg->new_weight = ctx.v ?: blkcg->iocost_weight;
+		iocg_set_weight(iocg, iocg->new_weight);
+		ret = 0;
+	}
+
+	blkg_conf_finish(&ctx);
+	return ret ?: nbytes;
+}
+
+static u64 iocg_prfill_model(struct seq_file *sf, struct blkg_policy_data *pd,
+			     int off)
+{
+	struct iocost_data *iocd = pd_to_iocg(pd)->iocd;
+
+	return __blkg_prfill_u64(sf, pd, *(u64 *)((void *)iocd + off));
+}
+
+static int iocg_print_model(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)), iocg_prfill_model,
+			  &blkcg_policy_iocost, seq_cft(sf)->private, false);
+	return 0;
+}
+
+static ssize_t iocg_set_model(struct kernfs_open_file *of,
+			      char *buf, size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkg_conf_ctx ctx;
+	struct iocost_data *iocd;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iocost, buf, &ctx);
+	if (ret)
+		return ret;
+
+	iocd = blkg_to_iocg(ctx.blkg)->iocd;
+	*(u64 *)((void *)iocd + of_cft(of)->private) = ctx.v;
+
+	blkg_conf_finish(&ctx);
+	return nbytes;
+}
+
+static u64 iocg_prfill_nr_waited(struct seq_file *sf,
+				 struct blkg_policy_data *pd, int off)
+{
+	return __blkg_prfill_u64(sf, pd, pd_to_iocg(pd)->nr_waited);
+}
+
+static int iocg_print_nr_waited(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)),
+			  iocg_prfill_nr_waited, &blkcg_policy_iocost,
+			  0, true);
+	return 0;
+}
+
+static struct cftype iocost_files[] = {
+	{
+		.name = "iocost.weight",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = iocost_read_weight,
+		.write_u64 = iocost_set_weight,
+	},
+	{
+		.name = "iocost.weight_device",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = iocg_print_weight_device,
+		.write = iocg_set_weight_device,
+	},
+	{
+		.name = "iocost.nr_waited",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = iocg_print_nr_waited,
+	},
+	{
+		.name = "iocost.read_io_nsec",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.private = offsetof(struct iocost_data, io_nsec[READ]),
+		.seq_show = iocg_print_model,
+		.write = iocg_set_model,
+	},
+	{
+		.name = "iocost.read_seek_nsec",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.private = offsetof(struct iocost_data, seek_nsec[READ]),
+		.seq_show = iocg_print_model,
+		.write = iocg_set_model,
+	},
+	{
+		.name = "iocost.read_page_nsec",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.private = offsetof(struct iocost_data, page_nsec[READ]),
+		.seq_show = iocg_print_model,
+		.write = iocg_set_model,
+	},
+	{
+		.name = "iocost.write_io_nsec",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.private = offsetof(struct iocost_data, io_nsec[WRITE]),
+		.seq_show = iocg_print_model,
+		.write = iocg_set_model,
+	},
+	{
+		.name = "iocost.write_seek_nsec",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.private = offsetof(struct iocost_data, seek_nsec[WRITE]),
+		.seq_show = iocg_print_model,
+		.write = iocg_set_model,
+	},
+	{
+		.name = "iocost.write_page_nsec",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.private = offsetof(struct iocost_data, page_nsec[WRITE]),
+		.seq_show = iocg_print_model,
+		.write = iocg_set_model,
+	},
+	{ }	/* terminate */
+};
+
+static struct blkcg_policy blkcg_policy_iocost = {
+	.pd_size		= sizeof(struct iocost_grp),
+	.cftypes		= iocost_files,
+
+	.pd_init_fn		= iocost_pd_init,
+	.pd_offline_fn		= iocost_pd_offline,
+	.pd_exit_fn		= iocost_pd_exit,
+	.pd_reset_stats_fn	= iocost_pd_reset_stats,
+};
+
+bool blk_iocost_bio(struct request_queue *q, struct bio *bio)
+{
+	struct blkcg_gq *blkg;
+	struct iocost_grp *iocg;
+	struct blkcg *blkcg;
+	bool throttled = false;
+	u64 wait_ns;
+
+	/* held and charged already, see iocg_dispatch() */
+	if (bio->bi_rw & REQ_COSTED) {
+		bio->bi_rw &= ~REQ_COSTED;
+		return false;
+	}
+
+	rcu_read_lock();
+	blkcg = bio_blkcg(bio);
+	/* the root cgroup isn't controlled, skip the lock */
+	if (blkcg == &blkcg_root)
+		goto out_unlock_rcu;
+
+	spin_lock_irq(q->queue_lock);
+	blkg = blkg_lookup_create(blkcg, q);
+	if (unlikely(IS_ERR(blkg)))
+		goto out_unlock;
+
+	iocg = blkg_to_iocg(blkg);
+	iocg->last_io = jiffies;
+	iocg_activate(iocg);
+
+	/* bios of a group are issued in order, wait behind any queued */
+	if (bio_list_empty(&iocg->bios)) {
+		if (iocg_try_charge(iocg, bio, ktime_get_ns(), &wait_ns))
+			goto out_unlock;
+		blkg_get(blkg);
+		iocg_wait(iocg, wait_ns);
+	}
+
+	bio_associate_current(bio);
+	bio->bi_rw |= REQ_COSTED;
+	bio_list_add(&iocg->bios, bio);
+	iocg->nr_waited++;
+	throttled = true;
+
+out_unlock:
+	spin_unlock_irq(q->queue_lock);
+out_unlock_rcu:
+	rcu_read_unlock();
+	return throttled;
+}
+
+/**
+ * blk_iocost_drain - issue held bios
+ * @q: request_queue to drain held bios for
+ *
+ * Issue all bios currently held on @q through ->make_request_fn().
+ */
+void blk_iocost_drain(struct request_queue *q)
+	__releases(q->queue_lock) __acquires(q->queue_lock)
+{
+	struct iocost_data *iocd = q->iocd;
+	struct iocost_grp *iocg;
+	struct bio_list bios;
+	struct bio *bio;
+
+	queue_lockdep_assert_held(q);
+
+	list_for_each_entry(iocg, &iocd->active_list, active_node)
+		iocg_flush(iocg);
+
+	bios = iocd->dispatch_bios;
+	bio_list_init(&iocd->dispatch_bios);
+	spin_unlock_irq(q->queue_lock);
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+
+	spin_lock_irq(q->queue_lock);
+}
+
+int blk_iocost_init(struct request_queue *q)
+{
+	struct iocost_data *iocd;
+	int ret;
+
+	iocd = kzalloc_node(sizeof(*iocd), GFP_KERNEL, q->node);
+	if (!iocd)
+		return -ENOMEM;
+
+	iocd->queue = q;
+	iocd->io_nsec[READ] = IOCOST_DFL_READ_IO_NSEC;
+	iocd->seek_nsec[READ] = IOCOST_DFL_READ_SEEK_NSEC;
+	iocd->page_nsec[READ] = IOCOST_DFL_READ_PAGE_NSEC;
+	iocd->io_nsec[WRITE] = IOCOST_DFL_WRITE_IO_NSEC;
+	iocd->seek_nsec[WRITE] = IOCOST_DFL_WRITE_SEEK_NSEC;
+	iocd->page_nsec[WRITE] = IOCOST_DFL_WRITE_PAGE_NSEC;
+	INIT_LIST_HEAD(&iocd->active_list);
+	setup_timer(&iocd->period_timer, iocost_period_timer_fn,
+		    (unsigned long)iocd);
+	bio_list_init(&iocd->dispatch_bios);
+	INIT_WORK(&iocd->dispatch_work, iocost_dispatch_work_fn);
+	q->iocd = iocd;
+
+	/* activate policy */
+	ret = blkcg_activate_policy(q, &blkcg_policy_iocost);
+	if (ret) {
+		q->iocd = NULL;
+		kfree(iocd);
+	}
+	return ret;
+}
+
+void blk_iocost_exit(struct request_queue *q)
+{
+	struct iocost_data *iocd = q->iocd;
+
+	BUG_ON(!iocd);
+	del_timer_sync(&iocd->period_timer);
+	cancel_work_sync(&iocd->dispatch_work);
+	blkcg_deactivate_policy(q, &blkcg_policy_iocost);
+	kfree(iocd);
+	q->iocd = NULL;
+}
+
+static int __init iocost_init(void)
+{
+	return blkcg_policy_register(&blkcg_policy_iocost);
+}
+
+module_init(iocost_init);
@@ -0,0 +1,110 @@
+/*
+ * io scheduler plumbing for blk-mq.  A scheduler attached to a blk-mq
+ * queue keeps its requests per hardware queue: they are handed to it
+ * instead of being put on the software queues, and pulled back out one
+ * at a time when the hardware queue is run.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+
+#include <linux/blk-mq.h>
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-sched.h"
+
+static void blk_mq_sched_exit_hctxs(struct request_queue *q,
+				    struct elevator_type *e, unsigned int nr)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (i == nr)
+			break;
+		if (e->mq_ops.exit_hctx)
+			e->mq_ops.exit_hctx(hctx, i);
+		hctx->sched_data = NULL;
+	}
+}
+
+/*
+ * Attach @e to @q.  The caller must have frozen the queue and holds the
+ * module reference of @e, which is passed on to the new elevator_queue
+ * on success and left with the caller on failure.
+ */
+int blk_mq_sched_setup(struct request_queue *q, struct elevator_type *e)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+	int ret;
+
+	ret = e->mq_ops.init_sched(q, e);
+	if (ret)
+		return ret;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!e->mq_ops.init_hctx)
+			continue;
+		ret = e->mq_ops.init_hctx(hctx, i);
+		if (ret) {
+			blk_mq_sched_exit_hctxs(q, e, i);
+			/* releasing the elevator_queue drops a reference */
+			__module_get(e->elevator_owner);
+			elevator_exit(q->elevator);
+			q->elevator = NULL;
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Detach the scheduler of @q, if any.  The queue must be frozen, so the
+ * scheduler holds no requests anymore.
+ */
+void blk_mq_sched_teardown(struct request_queue *q)
+{
+	struct elevator_queue *e = q->elevator;
+
+	if (!e)
+		return;
+
+	blk_mq_sched_exit_hctxs(q, e->type, q->nr_hw_queues);
+	q->elevator = NULL;
+	elevator_exit(e);
+}
+
+/**
+ * blk_mq_sched_try_merge - merge a bio into a request held by a scheduler
+ * @q:		the request queue
+ * @rq:		candidate request found by the scheduler
+ * @bio:	the bio to merge
+ *
+ * Description:
+ *	Returns ELEVATOR_BACK_MERGE or ELEVATOR_FRONT_MERGE if @bio ended up
+ *	in @rq, ELEVATOR_NO_MERGE otherwise.  After a front merge the start
+ *	sector of @rq has changed, so the scheduler has to reposition it.
+ **/
+int blk_mq_sched_try_merge(struct request_queue *q, struct request *rq,
+			   struct bio *bio)
+{
+	if (!blk_rq_merge_ok(rq, bio))
+		return ELEVATOR_NO_MERGE;
+
+	switch (blk_try_merge(rq, bio)) {
+	case ELEVATOR_BACK_MERGE:
+		if (bio_attempt_back_merge(q, rq, bio))
+			return ELEVATOR_BACK_MERGE;
+		break;
+	case ELEVATOR_FRONT_MERGE:
+		if (bio_attempt_front_merge(q, rq, bio))
+			return ELEVATOR_FRONT_MERGE;
+		break;
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+EXPORT_SYMBOL_GPL(blk_mq_sched_try_merge);
@@ -0,0 +1,61 @@
+#ifndef INT_BLK_MQ_SCHED_H
+#define INT_BLK_MQ_SCHED_H
+
+#include <linux/elevator.h>
+
+int blk_mq_sched_setup(struct request_queue *q, struct elevator_type *e);
+void blk_mq_sched_teardown(struct request_queue *q);
+int blk_mq_sched_try_merge(struct request_queue *q, struct request *rq,
+			   struct bio *bio);
+
+static inline struct elevator_mq_ops *blk_mq_sched_ops(struct request_queue *q)
+{
+	return q->elevator ? &q->elevator->type->mq_ops : NULL;
+}
+
+/*
+ * Flush sequences and passthrough requests never enter the scheduler,
+ * they go straight to the software queues like without one.
+ */
+static inline bool blk_mq_sched_bypass(struct request *rq)
+{
+	return rq->cmd_type != REQ_TYPE_FS ||
+		(rq->cmd_flags & (REQ_FLUSH | REQ_FUA | REQ_FLUSH_SEQ));
+}
+
+static inline bool blk_mq_sched_insert_request(struct blk_mq_hw_ctx *hctx,
+					       struct request *rq, bool at_head)
+{
+	struct elevator_mq_ops *ops = blk_mq_sched_ops(hctx->queue);
+
+	if (!ops || blk_mq_sched_bypass(rq))
+		return false;
+
+	ops->insert_request(hctx, rq, at_head);
+	return true;
+}
+
+static inline struct request *
+blk_mq_sched_dispatch_request(struct blk_mq_hw_ctx *hctx)
+{
+	struct elevator_mq_ops *ops = blk_mq_sched_ops(hctx->queue);
+
+	return ops ? ops->dispatch_request(hctx) : NULL;
+}
+
+static inline bool blk_mq_sched_has_work(struct blk_mq_hw_ctx *hctx)
+{
+	struct elevator_mq_ops *ops = blk_mq_sched_ops(hctx->queue);
+
+	return ops && ops->has_work(hctx);
+}
+
+static inline bool blk_mq_sched_bio_merge(struct blk_mq_hw_ctx *hctx,
+					  struct bio *bio)
+{
+	struct elevator_mq_ops *ops = blk_mq_sched_ops(hctx->queue);
+
+	return ops && ops->bio_merge && ops->bio_merge(hctx, bio);
+}
+
+#endif
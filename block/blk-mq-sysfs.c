@@ -12,6 +12,7 @@
 #include <linux/blk-mq.h>
 #include "blk-mq.h"
 #include "blk-mq-tag.h"
+#include "blk-stat.h"
 
 static void blk_mq_sysfs_release(struct kobject *kobj)
 {
@@ -185,6 +186,40 @@ static ssize_t blk_mq_hw_sysfs_run_show(struct blk_mq_hw_ctx *hctx, char *page)
 	return sprintf(page, "%lu\n", hctx->run);
 }
 
+static ssize_t blk_mq_hw_sysfs_poll_show(struct blk_mq_hw_ctx *hctx,
+					 char *page)
+{
+	return sprintf(page, "considered=%lu, invoked=%lu, success=%lu, "
+		       "sleeps=%lu, mean_nsec=%llu\n",
+		       hctx->poll_considered, hctx->poll_invoked,
+		       hctx->poll_success, hctx->poll_sleeps,
+		       (unsigned long long)hctx->poll_mean_nsec);
+}
+
+static ssize_t blk_mq_hw_sysfs_latency_show(struct blk_mq_hw_ctx *hctx,
+					    char *page)
+{
+	struct blk_lat_stat *stat;
+	ssize_t ret;
+
+	stat = kmalloc(sizeof(*stat), GFP_KERNEL);
+	if (!stat)
+		return -ENOMEM;
+
+	blk_hctx_stat_get(hctx, stat);
+	ret = blk_stat_show(stat, page);
+	kfree(stat);
+	return ret;
+}
+
+/* any write resets the histograms */
+static ssize_t blk_mq_hw_sysfs_latency_store(struct blk_mq_hw_ctx *hctx,
+					     const char *page, size_t count)
+{
+	blk_hctx_stat_reset(hctx);
+	return count;
+}
+
 static ssize_t blk_mq_hw_sysfs_dispatched_show(struct blk_mq_hw_ctx *hctx,
 					       char *page)
 {
@@ -299,6 +334,15 @@ static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_cpus = {
 	.attr = {.name = "cpu_list", .mode = S_IRUGO },
 	.show = blk_mq_hw_sysfs_cpus_show,
 };
+static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_latency = {
+	.attr = {.name = "latency", .mode = S_IRUGO | S_IWUSR },
+	.show = blk_mq_hw_sysfs_latency_show,
+	.store = blk_mq_hw_sysfs_latency_store,
+};
+static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_poll = {
+	.attr = {.name = "io_poll", .mode = S_IRUGO },
+	.show = blk_mq_hw_sysfs_poll_show,
+};
 
 static struct attribute *default_hw_ctx_attrs[] = {
 	&blk_mq_hw_sysfs_queued.attr,
@@ -308,6 +352,8 @@ static struct attribute *default_hw_ctx_attrs[] = {
 	&blk_mq_hw_sysfs_tags.attr,
 	&blk_mq_hw_sysfs_cpus.attr,
 	&blk_mq_hw_sysfs_active.attr,
+	&blk_mq_hw_sysfs_poll.attr,
+	&blk_mq_hw_sysfs_latency.attr,
 	NULL,
 };
 
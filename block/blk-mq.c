@@ -21,6 +21,7 @@
 #include <linux/sched/sysctl.h>
 #include <linux/delay.h>
 #include <linux/crash_dump.h>
+#include <linux/hrtimer.h>
 
 #include <trace/events/block.h>
 
@@ -28,6 +29,9 @@
 #include "blk.h"
 #include "blk-mq.h"
 #include "blk-mq-tag.h"
+#include "blk-stat.h"
+#include "blk-wbt.h"
+#include "blk-mq-sched.h"
 
 static DEFINE_MUTEX(all_q_mutex);
 static LIST_HEAD(all_q_list);
@@ -197,6 +201,7 @@ static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
 	rq->rq_disk = NULL;
 	rq->part = NULL;
 	rq->start_time = jiffies;
+	rq->issue_time = 0;
 #ifdef CONFIG_BLK_CGROUP
 	rq->rl = NULL;
 	set_start_time_ns(rq);
@@ -297,10 +302,12 @@ static void __blk_mq_free_request(struct blk_mq_hw_ctx *hctx,
 
 	if (rq->cmd_flags & REQ_MQ_INFLIGHT)
 		atomic_dec(&hctx->nr_active);
+	if (rq->cmd_flags & REQ_WBT_TRACKED)
+		wbt_done(q->rq_wb);
 	rq->cmd_flags = 0;
 
 	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
-	blk_mq_put_tag(hctx, tag, &ctx->last_tag);
+	blk_mq_put_tag(hctx, ctx, tag);
 	blk_mq_queue_exit(q);
 }
 
@@ -324,8 +331,41 @@ void blk_mq_free_request(struct request *rq)
 }
 EXPORT_SYMBOL_GPL(blk_mq_free_request);
 
+/*
+ * Fold the completion time of a polled request into the running average
+ * of its hardware queue.  Updates race with each other, but the result is
+ * only used as a sleep hint.
+ */
+static void blk_mq_poll_stat_add(struct blk_mq_hw_ctx *hctx,
+				 struct request *rq, u64 now)
+{
+	u64 delta, mean;
+
+	if (unlikely(now <= rq->issue_time))
+		return;
+
+	delta = now - rq->issue_time;
+	mean = ACCESS_ONCE(hctx->poll_mean_nsec);
+	if (mean)
+		mean = mean - (mean >> 3) + (delta >> 3);
+	else
+		mean = delta;
+	ACCESS_ONCE(hctx->poll_mean_nsec) = mean;
+}
+
 inline void __blk_mq_end_request(struct request *rq, int error)
 {
+	if (rq->cmd_type == REQ_TYPE_FS && rq->issue_time) {
+		struct request_queue *q = rq->q;
+		struct blk_mq_hw_ctx *hctx;
+		u64 now = ktime_get_ns();
+
+		hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+		blk_stat_add(hctx, rq, now);
+		if (rq->cmd_flags & REQ_HIPRI)
+			blk_mq_poll_stat_add(hctx, rq, now);
+	}
+
 	blk_account_io_done(rq);
 
 	if (rq->end_io) {
@@ -420,6 +460,15 @@ void blk_mq_start_request(struct request *rq)
 
 	trace_block_rq_issue(q, rq);
 
+	rq->issue_time = ktime_get_ns();
+	rq->issue_bytes = blk_rq_bytes(rq);
+	if (rq->cmd_flags & REQ_HIPRI) {
+		struct blk_mq_hw_ctx *hctx;
+
+		hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+		ACCESS_ONCE(hctx->poll_last_issue) = rq->issue_time;
+	}
+
 	rq->resid_len = blk_rq_bytes(rq);
 	if (unlikely(blk_bidi_rq(rq)))
 		rq->next_rq->resid_len = blk_rq_bytes(rq->next_rq);
@@ -475,6 +524,59 @@ void blk_mq_requeue_request(struct request *rq)
 }
 EXPORT_SYMBOL(blk_mq_requeue_request);
 
+/**
+ * blk_mq_poll_hybrid_sleep - sleep before polling a hardware queue
+ * @q:		the request queue being polled
+ * @hctx:	the hardware queue about to be polled
+ *
+ * Description:
+ *	With io_poll_delay set to 0 the poller sleeps until half of the mean
+ *	polled completion time of @hctx has passed since the last REQ_HIPRI
+ *	request was issued, with a positive io_poll_delay it sleeps for that
+ *	fixed amount instead.  We sleep at most once per issued request, so
+ *	once the timer has fired the caller goes back to spinning.  Returns
+ *	true if we slept.
+ **/
+bool blk_mq_poll_hybrid_sleep(struct request_queue *q,
+			      struct blk_mq_hw_ctx *hctx)
+{
+	struct hrtimer_sleeper hs;
+	u64 issue, nsecs, now;
+
+	if (q->poll_nsec < 0)
+		return false;
+
+	if (q->poll_nsec > 0)
+		nsecs = q->poll_nsec;
+	else
+		nsecs = ACCESS_ONCE(hctx->poll_mean_nsec) / 2;
+	if (!nsecs)
+		return false;
+
+	issue = ACCESS_ONCE(hctx->poll_last_issue);
+	if (!issue || issue == ACCESS_ONCE(hctx->poll_slept_issue))
+		return false;
+
+	now = ktime_get_ns();
+	if (issue + nsecs <= now)
+		return false;
+	hctx->poll_slept_issue = issue;
+
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_set_expires(&hs.timer, ns_to_ktime(issue + nsecs - now));
+	hrtimer_init_sleeper(&hs, current);
+
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	hrtimer_start_expires(&hs.timer, HRTIMER_MODE_REL);
+	if (hs.task)
+		io_schedule();
+	hrtimer_cancel(&hs.timer);
+	__set_current_state(TASK_RUNNING);
+
+	destroy_hrtimer_on_stack(&hs.timer);
+	return true;
+}
+
 static void blk_mq_requeue_work(struct work_struct *work)
 {
 	struct request_queue *q =
@@ -803,13 +905,31 @@ static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
 	dptr = NULL;
 
 	/*
-	 * Now process all the entries, sending them to the driver.
+	 * Now process all the entries, sending them to the driver.  Once the
+	 * software queues and the dispatch list are drained, requests held
+	 * by an io scheduler are pulled one at a time, so that it keeps
+	 * control over the order for as long as the driver is busy.  The
+	 * dispatch budget is taken before a request is pulled, so a request
+	 * the device has no room for stays with the scheduler.
 	 */
 	queued = 0;
-	while (!list_empty(&rq_list)) {
+	while (1) {
 		struct blk_mq_queue_data bd;
 		int ret;
 
+		if (list_empty(&rq_list) && !q->elevator)
+			break;
+		if (!blk_mq_get_dispatch_budget(hctx))
+			break;
+		if (list_empty(&rq_list)) {
+			rq = blk_mq_sched_dispatch_request(hctx);
+			if (!rq) {
+				blk_mq_put_dispatch_budget(hctx);
+				break;
+			}
+			list_add(&rq->queuelist, &rq_list);
+		}
+
 		rq = list_first_entry(&rq_list, struct request, queuelist);
 		list_del_init(&rq->queuelist);
 
@@ -926,7 +1046,8 @@ void blk_mq_run_hw_queues(struct request_queue *q, bool async)
 
 	queue_for_each_hw_ctx(q, hctx, i) {
 		if ((!blk_mq_hctx_has_pending(hctx) &&
-		    list_empty_careful(&hctx->dispatch)) ||
+		    list_empty_careful(&hctx->dispatch) &&
+		    !blk_mq_sched_has_work(hctx)) ||
 		    test_bit(BLK_MQ_S_STOPPED, &hctx->state))
 			continue;
 
@@ -1022,6 +1143,9 @@ static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
 
 	trace_block_rq_insert(hctx->queue, rq);
 
+	if (blk_mq_sched_insert_request(hctx, rq, at_head))
+		return;
+
 	if (at_head)
 		list_add(&rq->queuelist, &ctx->rq_list);
 	else
@@ -1175,6 +1299,11 @@ insert_rq:
 	} else {
 		struct request_queue *q = hctx->queue;
 
+		if (blk_mq_sched_bio_merge(hctx, bio)) {
+			__blk_mq_free_request(hctx, ctx, rq);
+			return true;
+		}
+
 		spin_lock(&ctx->lock);
 		if (!blk_mq_attempt_merge(q, ctx, bio)) {
 			blk_mq_bio_to_request(rq, bio);
@@ -1201,12 +1330,16 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 	struct request *rq;
 	int rw = bio_data_dir(bio);
 	struct blk_mq_alloc_data alloc_data;
+	bool wb_acct;
 
 	if (unlikely(blk_mq_queue_enter(q, GFP_KERNEL))) {
 		bio_endio(bio, -EIO);
 		return NULL;
 	}
 
+	/* may sleep, so it has to happen before we pin the sw queue */
+	wb_acct = wbt_wait(q->rq_wb, bio);
+
 	ctx = blk_mq_get_ctx(q);
 	hctx = q->mq_ops->map_queue(q, ctx->cpu);
 
@@ -1231,6 +1364,9 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 		hctx = alloc_data.hctx;
 	}
 
+	if (wb_acct)
+		rq->cmd_flags |= REQ_WBT_TRACKED;
+
 	hctx->queued++;
 	data->hctx = hctx;
 	data->ctx = ctx;
@@ -1269,9 +1405,11 @@ static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
 	/*
 	 * If the driver supports defer issued based on 'last', then
 	 * queue it up like normal since we can potentially save some
-	 * CPU this way.
+	 * CPU this way.  Same with an io scheduler, which wants to see
+	 * every request before it is issued.
 	 */
-	if (is_sync && !(data.hctx->flags & BLK_MQ_F_DEFER_ISSUE)) {
+	if (is_sync && !(data.hctx->flags & BLK_MQ_F_DEFER_ISSUE) &&
+	    !q->elevator && blk_mq_get_dispatch_budget(data.hctx)) {
 		struct blk_mq_queue_data bd = {
 			.rq = rq,
 			.list = NULL,
@@ -1894,6 +2032,7 @@ void blk_mq_release(struct request_queue *q)
 	queue_for_each_hw_ctx(q, hctx, i) {
 		if (!hctx)
 			continue;
+		free_percpu(hctx->lat_stat);
 		kfree(hctx->ctxs);
 		kfree(hctx);
 	}
@@ -1954,6 +2093,10 @@ struct request_queue *blk_mq_init_allocated_queue(struct blk_mq_tag_set *set,
 						node))
 			goto err_hctxs;
 
+		hctxs[i]->lat_stat = alloc_percpu(struct blk_lat_stat);
+		if (!hctxs[i]->lat_stat)
+			goto err_hctxs;
+
 		atomic_set(&hctxs[i]->nr_active, 0);
 		hctxs[i]->numa_node = node;
 		hctxs[i]->queue_num = i;
@@ -1983,6 +2126,14 @@ struct request_queue *blk_mq_init_allocated_queue(struct blk_mq_tag_set *set,
 	if (!(set->flags & BLK_MQ_F_SG_MERGE))
 		q->queue_flags |= 1 << QUEUE_FLAG_NO_SG_MERGE;
 
+	/*
+	 * Polling is on by default for drivers that support it, with the
+	 * classic busy spin until io_poll_delay asks for hybrid sleeping.
+	 */
+	if (set->ops->poll)
+		q->queue_flags |= 1 << QUEUE_FLAG_POLL;
+	q->poll_nsec = -1;
+
 	q->sg_reserved_size = INT_MAX;
 
 	INIT_WORK(&q->requeue_work, blk_mq_requeue_work);
@@ -2022,6 +2173,7 @@ err_hctxs:
 	for (i = 0; i < set->nr_hw_queues; i++) {
 		if (!hctxs[i])
 			break;
+		free_percpu(hctxs[i]->lat_stat);
 		free_cpumask_var(hctxs[i]->cpumask);
 		kfree(hctxs[i]);
 	}
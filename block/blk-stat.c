@@ -0,0 +1,173 @@
+/*
+ * Per hardware queue completion latency statistics.  Each hctx carries a
+ * percpu histogram, updated with this_cpu ops from the completion path so
+ * that nothing is shared between CPUs until somebody reads the stats.
+ */
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+
+#include <linux/blk-mq.h>
+#include "blk-mq.h"
+#include "blk-stat.h"
+
+static const char *blk_stat_size_names[BLK_STAT_SIZE_CLASSES] = {
+	[BLK_STAT_SIZE_4K]	= "4k",
+	[BLK_STAT_SIZE_16K]	= "16k",
+	[BLK_STAT_SIZE_64K]	= "64k",
+	[BLK_STAT_SIZE_LARGE]	= "large",
+};
+
+static inline unsigned int blk_stat_size_class(unsigned int bytes)
+{
+	if (bytes <= 4096)
+		return BLK_STAT_SIZE_4K;
+	if (bytes <= 16384)
+		return BLK_STAT_SIZE_16K;
+	if (bytes <= 65536)
+		return BLK_STAT_SIZE_64K;
+	return BLK_STAT_SIZE_LARGE;
+}
+
+static inline unsigned int blk_stat_bucket(u64 nsec)
+{
+	u64 usec = nsec >> 10;
+
+	if (!usec)
+		return 0;
+	return min_t(unsigned int, ilog2(usec) + 1, BLK_STAT_BUCKETS - 1);
+}
+
+/*
+ * Account the completion of @rq at @now; called from the completion path
+ * of every fs request, possibly from hard irq context.
+ */
+void blk_stat_add(struct blk_mq_hw_ctx *hctx, struct request *rq, u64 now)
+{
+	struct blk_lat_stat __percpu *stat = hctx->lat_stat;
+	int rw = rq_data_dir(rq);
+	u64 delta;
+
+	if (unlikely(!stat || now <= rq->issue_time))
+		return;
+
+	delta = now - rq->issue_time;
+
+	this_cpu_inc(stat->nr[rw]);
+	this_cpu_add(stat->nsec[rw], delta);
+	this_cpu_inc(stat->hist[rw][blk_stat_size_class(rq->issue_bytes)]
+			       [blk_stat_bucket(delta)]);
+}
+
+static void blk_stat_sum(struct blk_lat_stat *dst,
+			 struct blk_lat_stat __percpu *stat)
+{
+	int cpu, rw, size, i;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_lat_stat *src = per_cpu_ptr(stat, cpu);
+
+		for (rw = 0; rw < 2; rw++) {
+			dst->nr[rw] += src->nr[rw];
+			dst->nsec[rw] += src->nsec[rw];
+			for (size = 0; size < BLK_STAT_SIZE_CLASSES; size++)
+				for (i = 0; i < BLK_STAT_BUCKETS; i++)
+					dst->hist[rw][size][i] +=
+						src->hist[rw][size][i];
+		}
+	}
+}
+
+/*
+ * Fill @dst with the totals of @hctx.  The percpu counters are read
+ * without synchronisation, so concurrent completions may or may not be
+ * included.
+ */
+void blk_hctx_stat_get(struct blk_mq_hw_ctx *hctx, struct blk_lat_stat *dst)
+{
+	memset(dst, 0, sizeof(*dst));
+	if (hctx->lat_stat)
+		blk_stat_sum(dst, hctx->lat_stat);
+}
+
+/* Like blk_hctx_stat_get(), but summed over all hardware queues of @q. */
+void blk_queue_stat_get(struct request_queue *q, struct blk_lat_stat *dst)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	memset(dst, 0, sizeof(*dst));
+	queue_for_each_hw_ctx(q, hctx, i)
+		if (hctx->lat_stat)
+			blk_stat_sum(dst, hctx->lat_stat);
+}
+
+/*
+ * Only the request counts and summed latencies of @q, per data direction.
+ * Cheap enough to be sampled periodically, unlike the full histograms.
+ */
+void blk_queue_stat_totals(struct request_queue *q, u64 *nr, u64 *nsec)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+	int cpu, rw;
+
+	nr[READ] = nr[WRITE] = nsec[READ] = nsec[WRITE] = 0;
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!hctx->lat_stat)
+			continue;
+		for_each_possible_cpu(cpu) {
+			struct blk_lat_stat *src = per_cpu_ptr(hctx->lat_stat, cpu);
+
+			for (rw = 0; rw < 2; rw++) {
+				nr[rw] += src->nr[rw];
+				nsec[rw] += src->nsec[rw];
+			}
+		}
+	}
+}
+
+void blk_hctx_stat_reset(struct blk_mq_hw_ctx *hctx)
+{
+	int cpu;
+
+	if (!hctx->lat_stat)
+		return;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(hctx->lat_stat, cpu), 0,
+		       sizeof(struct blk_lat_stat));
+}
+
+ssize_t blk_stat_show(struct blk_lat_stat *stat, char *page)
+{
+	static const char *dir_names[2] = { "read", "write" };
+	char *start_page = page;
+	int rw, size, i;
+
+	page += sprintf(page, "%-12s", "lat_us");
+	for (i = 0; i < BLK_STAT_BUCKETS - 1; i++)
+		page += sprintf(page, " %lu", 1UL << i);
+	page += sprintf(page, " inf\n");
+
+	for (rw = 0; rw < 2; rw++) {
+		for (size = 0; size < BLK_STAT_SIZE_CLASSES; size++) {
+			char name[16];
+
+			snprintf(name, sizeof(name), "%s_%s", dir_names[rw],
+				 blk_stat_size_names[size]);
+			page += sprintf(page, "%-12s", name);
+			for (i = 0; i < BLK_STAT_BUCKETS; i++)
+				page += sprintf(page, " %llu",
+					(unsigned long long)stat->hist[rw][size][i]);
+			page += sprintf(page, "\n");
+		}
+	}
+
+	for (rw = 0; rw < 2; rw++)
+		page += sprintf(page, "%s_mean_ns %llu\n", dir_names[rw],
+				(unsigned long long)blk_stat_mean(stat, rw));
+
+	return page - start_page;
+}
@@ -0,0 +1,39 @@
+#ifndef INT_BLK_STAT_H
+#define INT_BLK_STAT_H
+
+#include <linux/math64.h>
+
+/*
+ * Completion latency histograms.  Bucket i counts completions that took
+ * less than (1024 << i) ns, i.e. roughly 2^i usecs; the last bucket is
+ * unbounded.  Requests are split by data direction and by size class.
+ */
+enum {
+	BLK_STAT_BUCKETS	= 20,
+
+	BLK_STAT_SIZE_4K	= 0,
+	BLK_STAT_SIZE_16K,
+	BLK_STAT_SIZE_64K,
+	BLK_STAT_SIZE_LARGE,
+	BLK_STAT_SIZE_CLASSES,
+};
+
+struct blk_lat_stat {
+	u64	nr[2];
+	u64	nsec[2];
+	u64	hist[2][BLK_STAT_SIZE_CLASSES][BLK_STAT_BUCKETS];
+};
+
+void blk_stat_add(struct blk_mq_hw_ctx *hctx, struct request *rq, u64 now);
+void blk_hctx_stat_get(struct blk_mq_hw_ctx *hctx, struct blk_lat_stat *dst);
+void blk_queue_stat_get(struct request_queue *q, struct blk_lat_stat *dst);
+void blk_queue_stat_totals(struct request_queue *q, u64 *nr, u64 *nsec);
+void blk_hctx_stat_reset(struct blk_mq_hw_ctx *hctx);
+ssize_t blk_stat_show(struct blk_lat_stat *stat, char *page);
+
+static inline u64 blk_stat_mean(struct blk_lat_stat *stat, int rw)
+{
+	return stat->nr[rw] ? div64_u64(stat->nsec[rw], stat->nr[rw]) : 0;
+}
+
+#endif
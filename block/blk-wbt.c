@@ -0,0 +1,256 @@
+/*
+ * Buffered writeback throttling.  Background writes are only allowed a
+ * limited number of requests in flight on a queue.  That limit is scaled
+ * down while the mean read completion latency of the queue exceeds the
+ * configured target, and back up again once reads are fast or the queue
+ * has gone quiet, so that a flood of writeback cannot starve sync reads
+ * sharing the same device.
+ *
+ * Read latencies come from the per hardware queue statistics kept by
+ * blk-stat, sampled once per window from the window timer.
+ */
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+
+#include <linux/blk-mq.h>
+#include "blk-mq.h"
+#include "blk-stat.h"
+#include "blk-wbt.h"
+
+enum {
+	/* cap for the unscaled depth limit */
+	RWB_MAX_DEPTH		= 64,
+
+	/* never scale below a single request in flight */
+	RWB_MIN_DEPTH		= 1,
+
+	/* keep sampling this long after the last tracked write */
+	RWB_IDLE_WINDOWS	= 10,
+};
+
+/* default read latency targets */
+#define RWB_NONROT_LAT_NSEC	(2 * NSEC_PER_MSEC)
+#define RWB_ROT_LAT_NSEC	(75 * NSEC_PER_MSEC)
+#define RWB_WINDOW_NSEC		(100 * NSEC_PER_MSEC)
+
+/* background writes: plain async WRITEs, not O_DIRECT, flushes or discards */
+static inline bool wbt_should_throttle(struct bio *bio)
+{
+	const u64 mask = REQ_WRITE | REQ_SYNC | REQ_FLUSH | REQ_FUA |
+			 REQ_DISCARD | REQ_WRITE_SAME;
+
+	return (bio->bi_rw & mask) == REQ_WRITE;
+}
+
+static inline bool rwb_enabled(struct rq_wb *rwb)
+{
+	return rwb && rwb->min_lat_nsec;
+}
+
+static void calc_wb_limits(struct rq_wb *rwb)
+{
+	unsigned int depth = rwb->wb_max;
+
+	if (rwb->scale_step > 0)
+		depth = max_t(unsigned int, RWB_MIN_DEPTH,
+			      depth >> rwb->scale_step);
+	rwb->wb_normal = depth;
+}
+
+static void scale_up(struct rq_wb *rwb)
+{
+	if (rwb->scale_step <= 0)
+		return;
+
+	rwb->scale_step--;
+	calc_wb_limits(rwb);
+	wake_up_all(&rwb->wait);
+}
+
+static void scale_down(struct rq_wb *rwb)
+{
+	if (rwb->wb_normal <= RWB_MIN_DEPTH)
+		return;
+
+	rwb->scale_step++;
+	calc_wb_limits(rwb);
+}
+
+static void rwb_arm_timer(struct rq_wb *rwb)
+{
+	mod_timer(&rwb->window_timer,
+		  jiffies + nsecs_to_jiffies(rwb->win_nsec));
+}
+
+static void rwb_read_totals(struct rq_wb *rwb, u64 *nr, u64 *nsec)
+{
+	u64 tot_nr[2], tot_nsec[2];
+
+	blk_queue_stat_totals(rwb->queue, tot_nr, tot_nsec);
+	*nr = tot_nr[READ];
+	*nsec = tot_nsec[READ];
+}
+
+static void wb_timer_fn(unsigned long data)
+{
+	struct rq_wb *rwb = (struct rq_wb *) data;
+	u64 nr, nsec, dnr;
+	unsigned long idle;
+
+	rwb_read_totals(rwb, &nr, &nsec);
+	dnr = nr - rwb->read_nr;
+
+	if (dnr) {
+		u64 mean = div64_u64(nsec - rwb->read_nsec, dnr);
+
+		if (mean > rwb->min_lat_nsec)
+			scale_down(rwb);
+		else
+			scale_up(rwb);
+	} else if (!atomic_read(&rwb->inflight)) {
+		/* no reads to protect and no writes queued, relax */
+		scale_up(rwb);
+	}
+
+	rwb->read_nr = nr;
+	rwb->read_nsec = nsec;
+
+	/*
+	 * Keep the window going while writes are in flight or were issued
+	 * recently; an idle queue doesn't need a timer.
+	 */
+	idle = RWB_IDLE_WINDOWS * nsecs_to_jiffies(rwb->win_nsec);
+	if (atomic_read(&rwb->inflight) || rwb->scale_step > 0 ||
+	    time_before(jiffies, rwb->last_issue + idle))
+		rwb_arm_timer(rwb);
+}
+
+/*
+ * Grab an inflight slot if we're below @limit.
+ */
+static bool atomic_inc_below(atomic_t *v, unsigned int limit)
+{
+	unsigned int cur = atomic_read(v);
+
+	for (;;) {
+		unsigned int old;
+
+		if (cur >= limit)
+			return false;
+		old = atomic_cmpxchg(v, cur, cur + 1);
+		if (old == cur)
+			break;
+		cur = old;
+	}
+
+	return true;
+}
+
+static inline unsigned int get_limit(struct rq_wb *rwb)
+{
+	/* don't throttle reclaim, it's trying to free memory for us */
+	if (current_is_kswapd())
+		return rwb->wb_max;
+
+	return rwb->wb_normal;
+}
+
+/**
+ * wbt_wait - throttle a background write
+ * @rwb:	the writeback throttling state of the queue, may be NULL
+ * @bio:	the bio about to get a request
+ *
+ * Description:
+ *	Sleeps until the write fits within the current depth limit.  Returns
+ *	true if the bio was accounted, in which case the request it ends up
+ *	in must be marked REQ_WBT_TRACKED so that freeing it calls
+ *	wbt_done().
+ **/
+bool wbt_wait(struct rq_wb *rwb, struct bio *bio)
+{
+	DEFINE_WAIT(wait);
+
+	if (!rwb_enabled(rwb) || !wbt_should_throttle(bio))
+		return false;
+
+	if (!atomic_inc_below(&rwb->inflight, get_limit(rwb))) {
+		do {
+			prepare_to_wait_exclusive(&rwb->wait, &wait,
+						  TASK_UNINTERRUPTIBLE);
+			if (atomic_inc_below(&rwb->inflight, get_limit(rwb)))
+				break;
+			io_schedule();
+		} while (1);
+		finish_wait(&rwb->wait, &wait);
+	}
+
+	rwb->last_issue = jiffies;
+	if (!timer_pending(&rwb->window_timer))
+		rwb_arm_timer(rwb);
+
+	return true;
+}
+
+void wbt_done(struct rq_wb *rwb)
+{
+	int inflight;
+
+	inflight = atomic_dec_return(&rwb->inflight);
+	if (waitqueue_active(&rwb->wait) && inflight < get_limit(rwb))
+		wake_up(&rwb->wait);
+}
+
+void wbt_set_min_lat(struct request_queue *q, u64 nsec)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb)
+		return;
+
+	rwb->min_lat_nsec = nsec;
+	rwb->scale_step = 0;
+	calc_wb_limits(rwb);
+	/* a disabled rwb lets everybody through */
+	wake_up_all(&rwb->wait);
+}
+
+int wbt_init(struct request_queue *q)
+{
+	struct rq_wb *rwb;
+
+	/* read latencies are only collected for blk-mq queues */
+	if (!q->mq_ops || q->rq_wb)
+		return 0;
+
+	rwb = kzalloc(sizeof(*rwb), GFP_KERNEL);
+	if (!rwb)
+		return -ENOMEM;
+
+	atomic_set(&rwb->inflight, 0);
+	init_waitqueue_head(&rwb->wait);
+	setup_timer(&rwb->window_timer, wb_timer_fn, (unsigned long) rwb);
+	rwb->queue = q;
+	rwb->win_nsec = RWB_WINDOW_NSEC;
+	rwb->wb_max = clamp_t(unsigned int, q->nr_requests * 3 / 4,
+			      RWB_MIN_DEPTH, RWB_MAX_DEPTH);
+	rwb->min_lat_nsec = blk_queue_nonrot(q) ? RWB_NONROT_LAT_NSEC :
+						  RWB_ROT_LAT_NSEC;
+	calc_wb_limits(rwb);
+	rwb_read_totals(rwb, &rwb->read_nr, &rwb->read_nsec);
+
+	q->rq_wb = rwb;
+	return 0;
+}
+
+void wbt_exit(struct request_queue *q)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (rwb) {
+		del_timer_sync(&rwb->window_timer);
+		q->rq_wb = NULL;
+		kfree(rwb);
+	}
+}
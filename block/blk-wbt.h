@@ -0,0 +1,63 @@
+#ifndef INT_BLK_WBT_H
+#define INT_BLK_WBT_H
+
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/timer.h>
+
+struct rq_wb {
+	/*
+	 * Depth limits for tracked (background) writes: wb_max is derived
+	 * from the device queue depth, wb_normal is the current limit after
+	 * scaling by scale_step.
+	 */
+	unsigned int		wb_max;
+	unsigned int		wb_normal;
+	int			scale_step;
+
+	u64			min_lat_nsec;	/* read latency target, 0 = off */
+	u64			win_nsec;	/* sampling window */
+	struct timer_list	window_timer;
+
+	/* read totals at the start of the current window */
+	u64			read_nr;
+	u64			read_nsec;
+	unsigned long		last_issue;	/* jiffies */
+
+	atomic_t		inflight;
+	wait_queue_head_t	wait;
+
+	struct request_queue	*queue;
+};
+
+#ifdef CONFIG_BLK_WBT
+
+int wbt_init(struct request_queue *q);
+void wbt_exit(struct request_queue *q);
+bool wbt_wait(struct rq_wb *rwb, struct bio *bio);
+void wbt_done(struct rq_wb *rwb);
+void wbt_set_min_lat(struct request_queue *q, u64 nsec);
+
+#else
+
+static inline int wbt_init(struct request_queue *q)
+{
+	return 0;
+}
+static inline void wbt_exit(struct request_queue *q)
+{
+}
+static inline bool wbt_wait(struct rq_wb *rwb, struct bio *bio)
+{
+	return false;
+}
+static inline void wbt_done(struct rq_wb *rwb)
+{
+}
+static inline void wbt_set_min_lat(struct request_queue *q, u64 nsec)
+{
+}
+
+#endif /* CONFIG_BLK_WBT */
+
+#endif
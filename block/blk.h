@@ -281,4 +281,22 @@ static inline int blk_throtl_init(struct request_queue *q) { return 0; }
 static inline void blk_throtl_exit(struct request_queue *q) { }
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
+/*
+ * Internal proportional IO control interface
+ */
+#ifdef CONFIG_BLK_CGROUP_IOCOST
+extern bool blk_iocost_bio(struct request_queue *q, struct bio *bio);
+extern void blk_iocost_drain(struct request_queue *q);
+extern int blk_iocost_init(struct request_queue *q);
+extern void blk_iocost_exit(struct request_queue *q);
+#else /* CONFIG_BLK_CGROUP_IOCOST */
+static inline bool blk_iocost_bio(struct request_queue *q, struct bio *bio)
+{
+	return false;
+}
+static inline void blk_iocost_drain(struct request_queue *q) { }
+static inline int blk_iocost_init(struct request_queue *q) { return 0; }
+static inline void blk_iocost_exit(struct request_queue *q) { }
+#endif /* CONFIG_BLK_CGROUP_IOCOST */
+
 #endif /* BLK_INTERNAL_H */
@@ -40,6 +40,7 @@
 
 #include "blk.h"
 #include "blk-cgroup.h"
+#include "blk-mq-sched.h"
 
 static DEFINE_SPINLOCK(elv_list_lock);
 static LIST_HEAD(elv_list);
@@ -200,6 +201,10 @@ int elevator_init(struct request_queue *q, char *name)
 		e = elevator_get(name, true);
 		if (!e)
 			return -EINVAL;
+		if (e->uses_mq) {
+			elevator_put(e);
+			return -EINVAL;
+		}
 	}
 
 	/*
@@ -209,6 +214,10 @@ int elevator_init(struct request_queue *q, char *name)
 	 */
 	if (!e && *chosen_elevator) {
 		e = elevator_get(chosen_elevator, false);
+		if (e && e->uses_mq) {
+			elevator_put(e);
+			e = NULL;
+		}
 		if (!e)
 			printk(KERN_ERR "I/O scheduler %s not found\n",
 							chosen_elevator);
@@ -234,7 +243,10 @@ EXPORT_SYMBOL(elevator_init);
 void elevator_exit(struct elevator_queue *e)
 {
 	mutex_lock(&e->sysfs_lock);
-	if (e->type->ops.elevator_exit_fn)
+	if (e->type->uses_mq) {
+		if (e->type->mq_ops.exit_sched)
+			e->type->mq_ops.exit_sched(e);
+	} else if (e->type->ops.elevator_exit_fn)
 		e->type->ops.elevator_exit_fn(e);
 	mutex_unlock(&e->sysfs_lock);
 
@@ -942,6 +954,70 @@ fail_init:
 	return err;
 }
 
+/*
+ * blk-mq variant of elevator_switch().  Freezing the queue empties the
+ * old scheduler, so it can simply be torn down before the new one is set
+ * up; @new_e may be NULL to run without a scheduler.
+ */
+static int elevator_switch_mq(struct request_queue *q,
+			      struct elevator_type *new_e)
+{
+	bool registered = q->kobj.state_in_sysfs;
+	int err = 0;
+
+	blk_mq_freeze_queue(q);
+
+	if (q->elevator) {
+		if (q->elevator->registered)
+			elv_unregister_queue(q);
+		blk_mq_sched_teardown(q);
+	}
+
+	if (new_e) {
+		err = blk_mq_sched_setup(q, new_e);
+		if (err) {
+			elevator_put(new_e);
+			goto out;
+		}
+		if (registered)
+			elv_register_queue(q);
+	}
+
+	blk_add_trace_msg(q, "elv switch: %s",
+			  new_e ? new_e->elevator_name : "none");
+out:
+	blk_mq_unfreeze_queue(q);
+	return err;
+}
+
+/*
+ * Pick the default scheduler of a blk-mq queue when it gets registered:
+ * rotational devices get mq-deadline for its read starvation protection,
+ * everything else runs without a scheduler.
+ */
+int elevator_init_mq(struct request_queue *q)
+{
+	struct elevator_type *e;
+	int err;
+
+	if (q->elevator || blk_queue_nonrot(q))
+		return 0;
+
+	e = elevator_get("mq-deadline", false);
+	if (!e)
+		return 0;
+
+	mutex_lock(&q->sysfs_lock);
+	if (q->elevator) {
+		elevator_put(e);
+		err = 0;
+	} else
+		err = elevator_switch_mq(q, e);
+	mutex_unlock(&q->sysfs_lock);
+
+	return err;
+}
+
 /*
  * Switch this queue to the given IO scheduler.
  */
@@ -950,21 +1026,38 @@ static int __elevator_change(struct request_queue *q, const char *name)
 	char elevator_name[ELV_NAME_MAX];
 	struct elevator_type *e;
 
-	if (!q->elevator)
+	if (!q->elevator && !q->mq_ops)
 		return -ENXIO;
 
 	strlcpy(elevator_name, name, sizeof(elevator_name));
-	e = elevator_get(strstrip(elevator_name), true);
+	strstrip(elevator_name);
+
+	if (q->mq_ops && !strcmp(elevator_name, "none")) {
+		if (!q->elevator)
+			return 0;
+		return elevator_switch_mq(q, NULL);
+	}
+
+	e = elevator_get(elevator_name, true);
 	if (!e) {
 		printk(KERN_ERR "elevator: type %s not found\n", elevator_name);
 		return -EINVAL;
 	}
 
-	if (!strcmp(elevator_name, q->elevator->type->elevator_name)) {
+	if (q->elevator &&
+	    !strcmp(elevator_name, q->elevator->type->elevator_name)) {
 		elevator_put(e);
 		return 0;
 	}
 
+	if (e->uses_mq != !!q->mq_ops) {
+		elevator_put(e);
+		return -EINVAL;
+	}
+
+	if (q->mq_ops)
+		return elevator_switch_mq(q, e);
+
 	return elevator_switch(q, e);
 }
 
@@ -986,7 +1079,7 @@ ssize_t elv_iosched_store(struct request_queue *q, const char *name,
 {
 	int ret;
 
-	if (!q->elevator)
+	if (!q->elevator && !q->mq_ops)
 		return count;
 
 	ret = __elevator_change(q, name);
@@ -1004,20 +1097,28 @@ ssize_t elv_iosched_show(struct request_queue *q, char *name)
 	struct elevator_type *__e;
 	int len = 0;
 
-	if (!q->elevator || !blk_queue_stackable(q))
-		return sprintf(name, "none\n");
-
-	elv = e->type;
+	if (q->mq_ops) {
+		elv = e ? e->type : NULL;
+	} else {
+		if (!q->elevator || !blk_queue_stackable(q))
+			return sprintf(name, "none\n");
+		elv = e->type;
+	}
 
 	spin_lock(&elv_list_lock);
 	list_for_each_entry(__e, &elv_list, list) {
-		if (!strcmp(elv->elevator_name, __e->elevator_name))
+		if (__e->uses_mq != !!q->mq_ops)
+			continue;
+		if (elv && !strcmp(elv->elevator_name, __e->elevator_name))
 			len += sprintf(name+len, "[%s] ", elv->elevator_name);
 		else
 			len += sprintf(name+len, "%s ", __e->elevator_name);
 	}
 	spin_unlock(&elv_list_lock);
 
+	if (q->mq_ops)
+		len += sprintf(name+len, elv ? "none " : "[none] ");
+
 	len += sprintf(len+name, "\n");
 	return len;
 }
@@ -12,6 +12,7 @@
 
 #include <linux/device.h>
 #include <linux/module.h>
+#include <linux/async.h>
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/init.h>
@@ -659,6 +660,31 @@ static ssize_t uevent_store(struct device_driver *drv, const char *buf,
 }
 static DRIVER_ATTR_WO(uevent);
 
+/*
+ * Drivers that probe asynchronously are attached from this domain so that
+ * bus_remove_driver() can flush them without waiting for unrelated work.
+ * It is a regular (non-exclusive) domain, so async_synchronize_full() from
+ * wait_for_device_probe() also covers it before the root fs is mounted.
+ */
+static ASYNC_DOMAIN(driver_attach_domain);
+
+static void driver_attach_async(void *_drv, async_cookie_t cookie)
+{
+	struct device_driver *drv = _drv;
+	ktime_t calltime, delta;
+	int ret;
+
+	calltime = ktime_get();
+	ret = driver_attach(drv);
+	delta = ktime_sub(ktime_get(), calltime);
+
+	pr_debug("bus: '%s': driver %s async attach completed: %d\n",
+		 drv->bus->name, drv->name, ret);
+	if (initcall_debug)
+		printk(KERN_DEBUG "async attach of driver %s took %lld usecs\n",
+		       drv->name, (long long)ktime_to_us(delta));
+}
+
 /**
  * bus_add_driver - Add a driver to the bus.
  * @drv: driver.
@@ -691,9 +717,16 @@ int bus_add_driver(struct device_driver *drv)
 
 	klist_add_tail(&priv->knode_bus, &bus->p->klist_drivers);
 	if (drv->bus->p->drivers_autoprobe) {
-		error = driver_attach(drv);
-		if (error)
-			goto out_unregister;
+		if (driver_allows_async_probing(drv)) {
+			pr_debug("bus: '%s': probing driver %s asynchronously\n",
+				 drv->bus->name, drv->name);
+			async_schedule_domain(driver_attach_async, drv,
+					      &driver_attach_domain);
+		} else {
+			error = driver_attach(drv);
+			if (error)
+				goto out_unregister;
+		}
 	}
 	module_add_driver(drv->owner, drv);
 
@@ -742,6 +775,10 @@ void bus_remove_driver(struct device_driver *drv)
 	if (!drv->bus)
 		return;
 
+	/* Let a pending asynchronous attach finish before tearing down */
+	if (driver_allows_async_probing(drv))
+		async_synchronize_full_domain(&driver_attach_domain);
+
 	if (!drv->suppress_bind_attrs)
 		remove_bind_files(drv);
 	driver_remove_groups(drv, drv->bus->drv_groups);
@@ -8,32 +8,84 @@
 #include <linux/slab.h>
 #include <linux/blk-mq.h>
 #include <linux/hrtimer.h>
+#include <linux/highmem.h>
+#include <linux/radix-tree.h>
+#include <linux/random.h>
+#include <linux/delay.h>
+#include <linux/configfs.h>
 
 struct nullb_cmd {
 	struct list_head list;
-	struct llist_node ll_list;
 	struct call_single_data csd;
 	struct request *rq;
 	struct bio *bio;
 	unsigned int tag;
+	int error;
 	struct nullb_queue *nq;
+	struct hrtimer timer;
 };
 
 struct nullb_queue {
 	unsigned long *tag_map;
 	wait_queue_head_t wait;
 	unsigned int queue_depth;
+	struct nullb_device *dev;
+
+	/* bandwidth limit, a token bucket refilled by elapsed time */
+	spinlock_t bw_lock;
+	s64 bw_tokens;
+	u64 bw_last;
 
 	struct nullb_cmd *cmds;
 };
 
+/*
+ * Zones of a zoned device only accept writes at their write pointer,
+ * a discard of a whole zone resets it.
+ */
+struct nullb_zone {
+	sector_t start;
+	sector_t len;
+	sector_t wp;
+};
+
+/*
+ * Configuration of a device.  Devices are either created at load time
+ * from the module parameters, or at runtime through configfs, where each
+ * field is an attribute and writing 1 to "power" brings the device up.
+ */
+struct nullb_device {
+	struct nullb *nullb;
+	struct config_item item;
+	spinlock_t lock;		/* protects data and zones */
+	struct radix_tree_root data;	/* pages of a memory backed device */
+	struct nullb_zone *zones;
+	unsigned int nr_zones;
+
+	unsigned long size;		/* device size in MB */
+	unsigned int blocksize;
+	unsigned int submit_queues;
+	int home_node;
+	int queue_mode;
+	int irqmode;
+	unsigned int hw_queue_depth;
+	unsigned long completion_nsec;
+	int lat_dist;
+	unsigned long lat_max_nsec;
+	unsigned int lat_tail_pct;
+	unsigned int mbps;
+	unsigned int zone_size;		/* MB, 0 means not zoned */
+	bool memory_backed;
+	bool use_per_node_hctx;
+};
+
 struct nullb {
 	struct list_head list;
 	unsigned int index;
+	struct nullb_device *dev;
 	struct request_queue *q;
 	struct gendisk *disk;
 	struct blk_mq_tag_set tag_set;
-	struct hrtimer timer;
 	unsigned int queue_depth;
 	spinlock_t lock;
 
@@ -46,17 +98,6 @@ static struct mutex lock;
 static int null_major;
 static int nullb_indexes;
 
-struct completion_queue {
-	struct llist_head list;
-	struct hrtimer timer;
-};
-
-/*
- * These are per-cpu for now, they will need to be configured by the
- * complete_queues parameter and appropriately mapped.
- */
-static DEFINE_PER_CPU(struct completion_queue, completion_queues);
-
 enum {
 	NULL_IRQ_NONE		= 0,
 	NULL_IRQ_SOFTIRQ	= 1,
@@ -69,6 +110,15 @@ enum {
 	NULL_Q_MQ		= 2,
 };
 
+enum {
+	NULL_LAT_FIXED		= 0,
+	NULL_LAT_UNIFORM	= 1,
+	NULL_LAT_TAIL		= 2,
+};
+
+#define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - 9)
+#define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
+
 static int submit_queues;
 module_param(submit_queues, int, S_IRUGO);
 MODULE_PARM_DESC(submit_queues, "Number of submission queues");
@@ -135,8 +185,8 @@ static struct kernel_param_ops null_irqmode_param_ops = {
 device_param_cb(irqmode, &null_irqmode_param_ops, &irqmode, S_IRUGO);
 MODULE_PARM_DESC(irqmode, "IRQ completion handler. 0-none, 1-softirq, 2-timer");
 
-static int completion_nsec = 10000;
-module_param(completion_nsec, int, S_IRUGO);
+static unsigned long completion_nsec = 10000;
+module_param(completion_nsec, ulong, S_IRUGO);
 MODULE_PARM_DESC(completion_nsec, "Time in ns to complete a request in hardware. Default: 10,000ns");
 
 static int hw_queue_depth = 64;
@@ -147,6 +197,42 @@ static bool use_per_node_hctx = false;
 module_param(use_per_node_hctx, bool, S_IRUGO);
 MODULE_PARM_DESC(use_per_node_hctx, "Use per-node allocation for hardware context queues. Default: false");
 
+static int lat_dist = NULL_LAT_FIXED;
+
+static int null_set_lat_dist(const char *str, const struct kernel_param *kp)
+{
+	return null_param_store_val(str, &lat_dist, NULL_LAT_FIXED,
+					NULL_LAT_TAIL);
+}
+
+static struct kernel_param_ops null_lat_dist_param_ops = {
+	.set	= null_set_lat_dist,
+	.get	= param_get_int,
+};
+
+device_param_cb(lat_dist, &null_lat_dist_param_ops, &lat_dist, S_IRUGO);
+MODULE_PARM_DESC(lat_dist, "Completion latency distribution with irqmode=2. 0-fixed, 1-uniform between completion_nsec and lat_max_nsec, 2-lat_tail_pct percent of requests take lat_max_nsec");
+
+static unsigned long lat_max_nsec = 100000;
+module_param(lat_max_nsec, ulong, S_IRUGO);
+MODULE_PARM_DESC(lat_max_nsec, "Upper/slow completion latency in ns for lat_dist 1 and 2. Default: 100,000ns");
+
+static unsigned int lat_tail_pct = 1;
+module_param(lat_tail_pct, uint, S_IRUGO);
+MODULE_PARM_DESC(lat_tail_pct, "Percentage of slow requests for lat_dist=2. Default: 1");
+
+static unsigned int mbps;
+module_param(mbps, uint, S_IRUGO);
+MODULE_PARM_DESC(mbps, "Bandwidth limit per submission queue in MB/s (10^6 bytes). Default: 0, unlimited");
+
+static unsigned int zone_size;
+module_param(zone_size, uint, S_IRUGO);
+MODULE_PARM_DESC(zone_size, "Emulate a zoned device with sequential write zones of this size in MB. Default: 0, not zoned");
+
+static bool memory_backed;
+module_param(memory_backed, bool, S_IRUGO);
+MODULE_PARM_DESC(memory_backed, "Store data in memory instead of discarding it. Default: false");
+
 static void put_tag(struct nullb_queue *nq, unsigned int tag)
 {
 	clear_bit_unlock(tag, nq->tag_map);
@@ -213,16 +299,16 @@ static struct nullb_cmd *alloc_cmd(struct nullb_queue *nq, int can_wait)
 
 static void end_cmd(struct nullb_cmd *cmd)
 {
-	switch (queue_mode)  {
+	switch (cmd->nq->dev->queue_mode)  {
 	case NULL_Q_MQ:
-		blk_mq_end_request(cmd->rq, 0);
+		blk_mq_end_request(cmd->rq, cmd->error);
 		return;
 	case NULL_Q_RQ:
 		INIT_LIST_HEAD(&cmd->rq->queuelist);
-		blk_end_request_all(cmd->rq, 0);
+		blk_end_request_all(cmd->rq, cmd->error);
 		break;
 	case NULL_Q_BIO:
-		bio_endio(cmd->bio, 0);
+		bio_endio(cmd->bio, cmd->error);
 		break;
 	}
 
@@ -231,52 +317,327 @@ static void end_cmd(struct nullb_cmd *cmd)
 
 static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
 {
-	struct completion_queue *cq;
-	struct llist_node *entry;
-	struct nullb_cmd *cmd;
+	end_cmd(container_of(timer, struct nullb_cmd, timer));
+	return HRTIMER_NORESTART;
+}
 
-	cq = &per_cpu(completion_queues, smp_processor_id());
+static void null_cmd_init_timer(struct nullb_cmd *cmd)
+{
+	hrtimer_init(&cmd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	cmd->timer.function = null_cmd_timer_expired;
+}
 
-	while ((entry = llist_del_all(&cq->list)) != NULL) {
-		entry = llist_reverse_order(entry);
-		do {
-			cmd = container_of(entry, struct nullb_cmd, ll_list);
-			entry = entry->next;
-			end_cmd(cmd);
-		} while (entry);
+/*
+ * Completion latency of a request in timer mode.  Each request gets its
+ * own timer, so latencies are independent of the other requests in flight.
+ */
+static u64 null_cmd_latency(struct nullb_device *dev)
+{
+	u64 lat = dev->completion_nsec;
+
+	if (dev->lat_max_nsec <= lat)
+		return lat;
+
+	switch (dev->lat_dist) {
+	case NULL_LAT_UNIFORM:
+		lat += prandom_u32_max(min_t(u64, dev->lat_max_nsec - lat,
+					     U32_MAX));
+		break;
+	case NULL_LAT_TAIL:
+		if (prandom_u32_max(100) < dev->lat_tail_pct)
+			lat = dev->lat_max_nsec;
+		break;
 	}
 
-	return HRTIMER_NORESTART;
+	return lat;
 }
 
 static void null_cmd_end_timer(struct nullb_cmd *cmd)
 {
-	struct completion_queue *cq = &per_cpu(completion_queues, get_cpu());
+	ktime_t kt = ns_to_ktime(null_cmd_latency(cmd->nq->dev));
 
-	cmd->ll_list.next = NULL;
-	if (llist_add(&cmd->ll_list, &cq->list)) {
-		ktime_t kt = ktime_set(0, completion_nsec);
-
-		hrtimer_start(&cq->timer, kt, HRTIMER_MODE_REL);
-	}
-
-	put_cpu();
+	hrtimer_start(&cmd->timer, kt, HRTIMER_MODE_REL);
 }
 
 static void null_softirq_done_fn(struct request *rq)
 {
-	if (queue_mode == NULL_Q_MQ)
+	struct nullb *nullb = rq->q->queuedata;
+
+	if (nullb->dev->queue_mode == NULL_Q_MQ)
 		end_cmd(blk_mq_rq_to_pdu(rq));
 	else
 		end_cmd(rq->special);
 }
 
+/*
+ * Token bucket bandwidth limit of a submission queue.  Tokens are bytes,
+ * refilled with the time elapsed since the last check and capped at a
+ * millisecond worth of bandwidth.  A request is let through as long as
+ * the bucket isn't empty, possibly taking it below zero, so requests
+ * larger than the bucket still make progress at the configured rate.
+ */
+static bool null_bw_throttle(struct nullb_queue *nq, unsigned int bytes)
+{
+	struct nullb_device *dev = nq->dev;
+	bool throttled = false;
+	unsigned long flags;
+	u64 now, elapsed;
+
+	if (!dev->mbps)
+		return false;
+
+	spin_lock_irqsave(&nq->bw_lock, flags);
+	now = ktime_get_ns();
+	elapsed = min_t(u64, now - nq->bw_last, NSEC_PER_SEC);
+	nq->bw_last = now;
+	nq->bw_tokens = min_t(s64, nq->bw_tokens + div_u64(elapsed * dev->mbps, 1000),
+				(s64) dev->mbps * 1000);
+
+	if (nq->bw_tokens <= 0)
+		throttled = true;
+	else
+		nq->bw_tokens -= bytes;
+	spin_unlock_irqrestore(&nq->bw_lock, flags);
+
+	return throttled;
+}
+
+/*
+ * Zone checks, called with dev->lock held.  Writes must start at the
+ * write pointer of a zone and not cross into the next one, a discard
+ * resets the write pointer of every zone it fully covers.
+ */
+static int null_zone_io(struct nullb_device *dev, sector_t sector,
+			unsigned int bytes, unsigned long rw)
+{
+	sector_t nr_sects = bytes >> 9, zno = sector;
+	struct nullb_zone *zone;
+
+	if (!nr_sects || !(rw & REQ_WRITE))
+		return 0;
+
+	sector_div(zno, dev->zones[0].len);
+	if (zno >= dev->nr_zones)
+		return -EIO;
+
+	if (rw & REQ_DISCARD) {
+		for (zone = &dev->zones[zno]; zone < &dev->zones[dev->nr_zones];
+		     zone++) {
+			if (zone->start >= sector + nr_sects)
+				break;
+			if (zone->start >= sector &&
+			    zone->start + zone->len <= sector + nr_sects)
+				zone->wp = zone->start;
+		}
+		return 0;
+	}
+
+	zone = &dev->zones[zno];
+	if (sector != zone->wp || sector + nr_sects > zone->start + zone->len)
+		return -EIO;
+
+	zone->wp += nr_sects;
+	return 0;
+}
+
+static struct page *null_lookup_page(struct nullb_device *dev, sector_t sector,
+				     bool alloc)
+{
+	pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+	struct page *page;
+
+	page = radix_tree_lookup(&dev->data, idx);
+	if (page || !alloc)
+		return page;
+
+	page = alloc_page(GFP_ATOMIC | __GFP_ZERO);
+	if (!page)
+		return NULL;
+
+	page->index = idx;
+	if (radix_tree_insert(&dev->data, idx, page)) {
+		__free_page(page);
+		return NULL;
+	}
+
+	return page;
+}
+
+/*
+ * Copy a segment to or from the backing pages, called with dev->lock
+ * held.  Never written sectors read back as zeroes.
+ */
+static int null_transfer(struct nullb_device *dev, struct page *page,
+			 unsigned int len, unsigned int off, bool is_write,
+			 sector_t sector)
+{
+	void *buf;
+	int err = 0;
+
+	buf = kmap_atomic(page);
+	while (len) {
+		unsigned int offset = (sector & (PAGE_SECTORS - 1)) << 9;
+		unsigned int chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+		struct page *store = null_lookup_page(dev, sector, is_write);
+
+		if (is_write) {
+			if (!store) {
+				err = -ENOMEM;
+				break;
+			}
+			memcpy(page_address(store) + offset, buf + off, chunk);
+		} else if (store)
+			memcpy(buf + off, page_address(store) + offset, chunk);
+		else
+			memset(buf + off, 0, chunk);
+
+		sector += chunk >> 9;
+		off += chunk;
+		len -= chunk;
+	}
+	kunmap_atomic(buf);
+
+	if (!is_write)
+		flush_dcache_page(page);
+
+	return err;
+}
+
+static void null_discard(struct nullb_device *dev, sector_t sector,
+			 unsigned int bytes)
+{
+	while (bytes) {
+		unsigned int offset = (sector & (PAGE_SECTORS - 1)) << 9;
+		unsigned int chunk = min_t(unsigned int, bytes, PAGE_SIZE - offset);
+		pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+		struct page *page;
+
+		if (chunk == PAGE_SIZE) {
+			page = radix_tree_delete(&dev->data, idx);
+			if (page)
+				__free_page(page);
+		} else {
+			page = radix_tree_lookup(&dev->data, idx);
+			if (page)
+				memset(page_address(page) + offset, 0, chunk);
+		}
+
+		sector += chunk >> 9;
+		bytes -= chunk;
+	}
+}
+
+#define FREE_BATCH		16
+static void null_free_data(struct nullb_device *dev)
+{
+	struct page *pages[FREE_BATCH];
+	pgoff_t pos = 0;
+	int nr_pages, i;
+
+	do {
+		nr_pages = radix_tree_gang_lookup(&dev->data, (void **)pages,
+						  pos, FREE_BATCH);
+
+		for (i = 0; i < nr_pages; i++) {
+			pos = pages[i]->index;
+			radix_tree_delete(&dev->data, pos);
+			__free_page(pages[i]);
+		}
+
+		pos++;
+	} while (nr_pages == FREE_BATCH);
+}
+
+/* Zone checks and discards common to bios and requests */
+static int null_prep_io(struct nullb_device *dev, sector_t sector,
+			unsigned int bytes, unsigned long rw)
+{
+	int err;
+
+	if (dev->zones) {
+		err = null_zone_io(dev, sector, bytes, rw);
+		if (err)
+			return err;
+	}
+
+	if ((rw & REQ_DISCARD) && dev->memory_backed)
+		null_discard(dev, sector, bytes);
+
+	return 0;
+}
+
+static int null_handle_rq(struct nullb_cmd *cmd)
+{
+	struct request *rq = cmd->rq;
+	struct nullb_device *dev = cmd->nq->dev;
+	sector_t sector = blk_rq_pos(rq);
+	struct req_iterator iter;
+	struct bio_vec bvec;
+	unsigned long flags;
+	int err;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	err = null_prep_io(dev, sector, blk_rq_bytes(rq), rq->cmd_flags);
+	if (err || !dev->memory_backed || (rq->cmd_flags & REQ_DISCARD))
+		goto out;
+
+	rq_for_each_segment(bvec, rq, iter) {
+		err = null_transfer(dev, bvec.bv_page, bvec.bv_len,
+				    bvec.bv_offset, rq_data_dir(rq) == WRITE,
+				    sector);
+		if (err)
+			break;
+		sector += bvec.bv_len >> 9;
+	}
+out:
+	spin_unlock_irqrestore(&dev->lock, flags);
+	return err;
+}
+
+static int null_handle_bio(struct nullb_cmd *cmd)
+{
+	struct bio *bio = cmd->bio;
+	struct nullb_device *dev = cmd->nq->dev;
+	sector_t sector = bio->bi_iter.bi_sector;
+	struct bvec_iter iter;
+	struct bio_vec bvec;
+	unsigned long flags;
+	int err;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	err = null_prep_io(dev, sector, bio->bi_iter.bi_size, bio->bi_rw);
+	if (err || !dev->memory_backed || (bio->bi_rw & REQ_DISCARD))
+		goto out;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		err = null_transfer(dev, bvec.bv_page, bvec.bv_len,
+				    bvec.bv_offset, bio_data_dir(bio) == WRITE,
+				    sector);
+		if (err)
+			break;
+		sector += bvec.bv_len >> 9;
+	}
+out:
+	spin_unlock_irqrestore(&dev->lock, flags);
+	return err;
+}
+
 static inline void null_handle_cmd(struct nullb_cmd *cmd)
 {
+	struct nullb_device *dev = cmd->nq->dev;
+
+	cmd->error = 0;
+	if (dev->memory_backed || dev->zones) {
+		if (dev->queue_mode == NULL_Q_BIO)
+			cmd->error = null_handle_bio(cmd);
+		else
+			cmd->error = null_handle_rq(cmd);
+	}
+
 	/* Complete IO by inline, softirq or timer */
-	switch (irqmode) {
+	switch (dev->irqmode) {
 	case NULL_IRQ_SOFTIRQ:
-		switch (queue_mode)  {
+		switch (dev->queue_mode)  {
 		case NULL_Q_MQ:
 			blk_mq_complete_request(cmd->rq);
 			break;
@@ -316,6 +677,9 @@ static void null_queue_bio(struct request_queue *q, struct bio *bio)
 	struct nullb_queue *nq = nullb_to_queue(nullb);
 	struct nullb_cmd *cmd;
 
+	while (null_bw_throttle(nq, bio->bi_iter.bi_size))
+		usleep_range(500, 1000);
+
 	cmd = alloc_cmd(nq, 1);
 	cmd->bio = bio;
 
@@ -332,6 +696,8 @@ static int null_rq_prep_fn(struct request_queue *q, struct request *req)
 	if (cmd) {
 		cmd->rq = req;
 		req->special = cmd;
+		/* keep the command if the request_fn has to back off */
+		req->cmd_flags |= REQ_DONTPREP;
 		return BLKPREP_OK;
 	}
 
@@ -342,9 +708,15 @@ static void null_request_fn(struct request_queue *q)
 {
 	struct request *rq;
 
-	while ((rq = blk_fetch_request(q)) != NULL) {
+	while ((rq = blk_peek_request(q)) != NULL) {
 		struct nullb_cmd *cmd = rq->special;
 
+		if (null_bw_throttle(cmd->nq, blk_rq_bytes(rq))) {
+			blk_delay_queue(q, 1);
+			break;
+		}
+
+		blk_start_request(rq);
 		spin_unlock_irq(q->queue_lock);
 		null_handle_cmd(cmd);
 		spin_lock_irq(q->queue_lock);
@@ -359,6 +731,12 @@ static int null_queue_rq(struct blk_mq_hw_ctx *hctx,
 	cmd->rq = bd->rq;
 	cmd->nq = hctx->driver_data;
 
+	if (null_bw_throttle(cmd->nq, blk_rq_bytes(bd->rq))) {
+		blk_mq_stop_hw_queue(hctx);
+		blk_mq_delay_queue(hctx, 1);
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	}
+
 	blk_mq_start_request(bd->rq);
 
 	null_handle_cmd(cmd);
@@ -372,6 +750,10 @@ static void null_init_queue(struct nullb *nullb, struct nullb_queue *nq)
 
 	init_waitqueue_head(&nq->wait);
 	nq->queue_depth = nullb->queue_depth;
+	nq->dev = nullb->dev;
+	spin_lock_init(&nq->bw_lock);
+	nq->bw_last = ktime_get_ns();
+	nq->bw_tokens = (s64) nq->dev->mbps * 1000;
 }
 
 static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
@@ -387,22 +769,42 @@ static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
 	return 0;
 }
 
+static int null_init_request(void *data, struct request *rq,
+			     unsigned int hctx_idx, unsigned int rq_idx,
+			     unsigned int numa_node)
+{
+	null_cmd_init_timer(blk_mq_rq_to_pdu(rq));
+	return 0;
+}
+
 static struct blk_mq_ops null_mq_ops = {
 	.queue_rq       = null_queue_rq,
 	.map_queue      = blk_mq_map_queue,
 	.init_hctx	= null_init_hctx,
+	.init_request	= null_init_request,
 	.complete	= null_softirq_done_fn,
 };
 
+static void cleanup_queues(struct nullb *nullb);
+
+/* Called with the lock mutex held */
 static void null_del_dev(struct nullb *nullb)
 {
+	struct nullb_device *dev = nullb->dev;
+
 	list_del_init(&nullb->list);
 
 	del_gendisk(nullb->disk);
 	blk_cleanup_queue(nullb->q);
-	if (queue_mode == NULL_Q_MQ)
+	if (dev->queue_mode == NULL_Q_MQ)
 		blk_mq_free_tag_set(&nullb->tag_set);
+	cleanup_queues(nullb);
 	put_disk(nullb->disk);
+
+	null_free_data(dev);
+	kfree(dev->zones);
+	dev->zones = NULL;
+	dev->nullb = NULL;
 	kfree(nullb);
 }
 
@@ -440,7 +842,7 @@ static int setup_commands(struct nullb_queue *nq)
 	for (i = 0; i < nq->queue_depth; i++) {
 		cmd = &nq->cmds[i];
 		INIT_LIST_HEAD(&cmd->list);
-		cmd->ll_list.next = NULL;
+		null_cmd_init_timer(cmd);
 		cmd->tag = -1U;
 	}
 
@@ -465,13 +867,13 @@ static void cleanup_queues(struct nullb *nullb)
 
 static int setup_queues(struct nullb *nullb)
 {
-	nullb->queues = kzalloc(submit_queues * sizeof(struct nullb_queue),
-								GFP_KERNEL);
+	nullb->queues = kzalloc(nullb->dev->submit_queues *
+				sizeof(struct nullb_queue), GFP_KERNEL);
 	if (!nullb->queues)
 		return -ENOMEM;
 
 	nullb->nr_queues = 0;
-	nullb->queue_depth = hw_queue_depth;
+	nullb->queue_depth = nullb->dev->hw_queue_depth;
 
 	return 0;
 }
@@ -481,7 +883,7 @@ static int init_driver_queues(struct nullb *nullb)
 	struct nullb_queue *nq;
 	int i, ret = 0;
 
-	for (i = 0; i < submit_queues; i++) {
+	for (i = 0; i < nullb->dev->submit_queues; i++) {
 		nq = &nullb->queues[i];
 
 		null_init_queue(nullb, nq);
@@ -494,33 +896,85 @@ static int init_driver_queues(struct nullb *nullb)
 	return 0;
 }
 
-static int null_add_dev(void)
+static int null_validate_conf(struct nullb_device *dev)
+{
+	if (dev->blocksize < 512 || dev->blocksize > PAGE_SIZE ||
+	    !is_power_of_2(dev->blocksize))
+		return -EINVAL;
+	if (dev->queue_mode < NULL_Q_BIO || dev->queue_mode > NULL_Q_MQ)
+		return -EINVAL;
+	if (dev->irqmode < NULL_IRQ_NONE || dev->irqmode > NULL_IRQ_TIMER)
+		return -EINVAL;
+	if (dev->lat_dist < NULL_LAT_FIXED || dev->lat_dist > NULL_LAT_TAIL)
+		return -EINVAL;
+	if (dev->lat_tail_pct > 100)
+		return -EINVAL;
+	if (!dev->size || !dev->hw_queue_depth)
+		return -EINVAL;
+	if (dev->zone_size > dev->size)
+		return -EINVAL;
+
+	if (dev->queue_mode == NULL_Q_MQ && dev->use_per_node_hctx)
+		dev->submit_queues = nr_online_nodes;
+	else if (dev->submit_queues > nr_cpu_ids)
+		dev->submit_queues = nr_cpu_ids;
+	else if (!dev->submit_queues)
+		dev->submit_queues = 1;
+
+	return 0;
+}
+
+static int null_init_zones(struct nullb_device *dev, sector_t capacity)
+{
+	sector_t zone_sects = (sector_t)dev->zone_size << (20 - 9);
+	sector_t start = 0;
+	unsigned int i;
+
+	dev->nr_zones = DIV_ROUND_UP_SECTOR_T(capacity, zone_sects);
+	dev->zones = kcalloc(dev->nr_zones, sizeof(struct nullb_zone),
+			     GFP_KERNEL);
+	if (!dev->zones)
+		return -ENOMEM;
+
+	for (i = 0; i < dev->nr_zones; i++) {
+		dev->zones[i].start = dev->zones[i].wp = start;
+		dev->zones[i].len = min(zone_sects, capacity - start);
+		start += zone_sects;
+	}
+
+	return 0;
+}
+
+/* Called with the lock mutex held */
+static int null_add_dev(struct nullb_device *dev)
 {
 	struct gendisk *disk;
 	struct nullb *nullb;
 	sector_t size;
 	int rv;
 
-	nullb = kzalloc_node(sizeof(*nullb), GFP_KERNEL, home_node);
+	rv = null_validate_conf(dev);
+	if (rv)
+		goto out;
+
+	nullb = kzalloc_node(sizeof(*nullb), GFP_KERNEL, dev->home_node);
 	if (!nullb) {
 		rv = -ENOMEM;
 		goto out;
 	}
 
 	spin_lock_init(&nullb->lock);
-
-	if (queue_mode == NULL_Q_MQ && use_per_node_hctx)
-		submit_queues = nr_online_nodes;
+	nullb->dev = dev;
 
 	rv = setup_queues(nullb);
 	if (rv)
 		goto out_free_nullb;
 
-	if (queue_mode == NULL_Q_MQ) {
+	if (dev->queue_mode == NULL_Q_MQ) {
 		nullb->tag_set.ops = &null_mq_ops;
-		nullb->tag_set.nr_hw_queues = submit_queues;
-		nullb->tag_set.queue_depth = hw_queue_depth;
-		nullb->tag_set.numa_node = home_node;
+		nullb->tag_set.nr_hw_queues = dev->submit_queues;
+		nullb->tag_set.queue_depth = dev->hw_queue_depth;
+		nullb->tag_set.numa_node = dev->home_node;
 		nullb->tag_set.cmd_size	= sizeof(struct nullb_cmd);
 		nullb->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
 		nullb->tag_set.driver_data = nullb;
@@ -534,8 +988,8 @@ static int null_add_dev(void)
 			rv = -ENOMEM;
 			goto out_cleanup_tags;
 		}
-	} else if (queue_mode == NULL_Q_BIO) {
-		nullb->q = blk_alloc_queue_node(GFP_KERNEL, home_node);
+	} else if (dev->queue_mode == NULL_Q_BIO) {
+		nullb->q = blk_alloc_queue_node(GFP_KERNEL, dev->home_node);
 		if (!nullb->q) {
 			rv = -ENOMEM;
 			goto out_cleanup_queues;
@@ -545,7 +999,8 @@ static int null_add_dev(void)
 		if (rv)
 			goto out_cleanup_blk_queue;
 	} else {
-		nullb->q = blk_init_queue_node(null_request_fn, &nullb->lock, home_node);
+		nullb->q = blk_init_queue_node(null_request_fn, &nullb->lock,
+					       dev->home_node);
 		if (!nullb->q) {
 			rv = -ENOMEM;
 			goto out_cleanup_queues;
@@ -561,22 +1016,35 @@ static int null_add_dev(void)
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
 	queue_flag_clear_unlocked(QUEUE_FLAG_ADD_RANDOM, nullb->q);
 
-	disk = nullb->disk = alloc_disk_node(1, home_node);
+	size = (sector_t)dev->size * 1024 * 1024;
+	sector_div(size, dev->blocksize);
+
+	if (dev->zone_size) {
+		rv = null_init_zones(dev, size);
+		if (rv)
+			goto out_cleanup_blk_queue;
+	}
+
+	/* Discards free memory and reset zones, so only offer them then */
+	if (dev->memory_backed || dev->zones) {
+		nullb->q->limits.discard_granularity = dev->blocksize;
+		blk_queue_max_discard_sectors(nullb->q, UINT_MAX >> 9);
+		queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, nullb->q);
+	}
+
+	disk = nullb->disk = alloc_disk_node(1, dev->home_node);
 	if (!disk) {
 		rv = -ENOMEM;
-		goto out_cleanup_blk_queue;
+		goto out_free_zones;
 	}
 
-	mutex_lock(&lock);
 	list_add_tail(&nullb->list, &nullb_list);
 	nullb->index = nullb_indexes++;
-	mutex_unlock(&lock);
+	dev->nullb = nullb;
 
-	blk_queue_logical_block_size(nullb->q, bs);
-	blk_queue_physical_block_size(nullb->q, bs);
+	blk_queue_logical_block_size(nullb->q, dev->blocksize);
+	blk_queue_physical_block_size(nullb->q, dev->blocksize);
 
-	size = gb * 1024 * 1024 * 1024ULL;
-	sector_div(size, bs);
 	set_capacity(disk, size);
 
 	disk->flags |= GENHD_FL_EXT_DEVT | GENHD_FL_SUPPRESS_PARTITION_INFO;
@@ -589,10 +1057,13 @@ static int null_add_dev(void)
 	add_disk(disk);
 	return 0;
 
+out_free_zones:
+	kfree(dev->zones);
+	dev->zones = NULL;
 out_cleanup_blk_queue:
 	blk_cleanup_queue(nullb->q);
 out_cleanup_tags:
-	if (queue_mode == NULL_Q_MQ)
+	if (dev->queue_mode == NULL_Q_MQ)
 		blk_mq_free_tag_set(&nullb->tag_set);
 out_cleanup_queues:
 	cleanup_queues(nullb);
@@ -602,9 +1073,244 @@ out:
 	return rv;
 }
 
+/* A device configured from the module parameters */
+static struct nullb_device *null_alloc_dev(void)
+{
+	struct nullb_device *dev;
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return NULL;
+
+	spin_lock_init(&dev->lock);
+	INIT_RADIX_TREE(&dev->data, GFP_ATOMIC);
+	dev->size = (unsigned long)gb * 1024;
+	dev->blocksize = bs;
+	dev->submit_queues = submit_queues;
+	dev->home_node = home_node;
+	dev->queue_mode = queue_mode;
+	dev->irqmode = irqmode;
+	dev->hw_queue_depth = hw_queue_depth;
+	dev->completion_nsec = completion_nsec;
+	dev->lat_dist = lat_dist;
+	dev->lat_max_nsec = lat_max_nsec;
+	dev->lat_tail_pct = lat_tail_pct;
+	dev->mbps = mbps;
+	dev->zone_size = zone_size;
+	dev->memory_backed = memory_backed;
+	dev->use_per_node_hctx = use_per_node_hctx;
+
+	return dev;
+}
+
+/*
+ * configfs interface: mkdir /sys/kernel/config/nullb/<name> creates a
+ * device configured from the module parameters, its attributes can be
+ * changed while it is powered off, and writing 1 to its "power" attribute
+ * creates the block device.
+ */
+static inline struct nullb_device *to_nullb_device(struct config_item *item)
+{
+	return item ? container_of(item, struct nullb_device, item) : NULL;
+}
+
+CONFIGFS_ATTR_STRUCT(nullb_device);
+#define NULLB_DEVICE_ATTR(_name, _mode, _show, _store)	\
+static struct nullb_device_attribute nullb_device_attr_##_name = \
+	__CONFIGFS_ATTR(_name, _mode, _show, _store)
+
+static int nullb_device_ulong_parse(const char *page, ulong *val)
+{
+	return kstrtoul(page, 0, val);
+}
+
+static int nullb_device_long_parse(const char *page, long *val)
+{
+	return kstrtol(page, 0, val);
+}
+
+/*
+ * Generate show and store functions for a configuration field, stores
+ * go through an unsigned long or long and are range checked against the
+ * field type.  Values are validated when the device is powered on, so
+ * they may only change, under the same lock, while it is powered off.
+ */
+#define NULLB_DEVICE_FIELD(_name, _type, _fmt, _stype, _min, _max)	\
+static ssize_t nullb_device_##_name##_show(struct nullb_device *dev,	\
+					   char *page)			\
+{									\
+	return sprintf(page, _fmt "\n", dev->_name);			\
+}									\
+static ssize_t nullb_device_##_name##_store(struct nullb_device *dev,	\
+					    const char *page,		\
+					    size_t count)		\
+{									\
+	_stype val;							\
+	ssize_t ret;							\
+									\
+	ret = nullb_device_##_stype##_parse(page, &val);		\
+	if (ret)							\
+		return ret;						\
+	if (val < (_min) || val > (_max))				\
+		return -EINVAL;						\
+									\
+	mutex_lock(&lock);						\
+	if (dev->nullb) {						\
+		ret = -EBUSY;						\
+	} else {							\
+		dev->_name = (_type)val;				\
+		ret = count;						\
+	}								\
+	mutex_unlock(&lock);						\
+									\
+	return ret;							\
+}									\
+NULLB_DEVICE_ATTR(_name, S_IRUGO | S_IWUSR,				\
+		  nullb_device_##_name##_show,				\
+		  nullb_device_##_name##_store)
+
+NULLB_DEVICE_FIELD(size, unsigned long, "%lu", ulong, 0, ULONG_MAX);
+NULLB_DEVICE_FIELD(blocksize, unsigned int, "%u", ulong, 0, UINT_MAX);
+NULLB_DEVICE_FIELD(submit_queues, unsigned int, "%u", ulong, 0, UINT_MAX);
+NULLB_DEVICE_FIELD(home_node, int, "%d", long, NUMA_NO_NODE, INT_MAX);
+NULLB_DEVICE_FIELD(queue_mode, int, "%d", long, NULL_Q_BIO, NULL_Q_MQ);
+NULLB_DEVICE_FIELD(irqmode, int, "%d", long, NULL_IRQ_NONE, NULL_IRQ_TIMER);
+NULLB_DEVICE_FIELD(hw_queue_depth, unsigned int, "%u", ulong, 1, UINT_MAX);
+NULLB_DEVICE_FIELD(completion_nsec, unsigned long, "%lu", ulong, 0, ULONG_MAX);
+NULLB_DEVICE_FIELD(lat_dist, int, "%d", long, NULL_LAT_FIXED, NULL_LAT_TAIL);
+NULLB_DEVICE_FIELD(lat_max_nsec, unsigned long, "%lu", ulong, 0, ULONG_MAX);
+NULLB_DEVICE_FIELD(lat_tail_pct, unsigned int, "%u", ulong, 0, 100);
+NULLB_DEVICE_FIELD(mbps, unsigned int, "%u", ulong, 0, UINT_MAX);
+NULLB_DEVICE_FIELD(zone_size, unsigned int, "%u", ulong, 0, UINT_MAX);
+NULLB_DEVICE_FIELD(memory_backed, bool, "%d", ulong, 0, 1);
+NULLB_DEVICE_FIELD(use_per_node_hctx, bool, "%d", ulong, 0, 1);
+
+static ssize_t nullb_device_power_show(struct nullb_device *dev, char *page)
+{
+	return sprintf(page, "%d\n", dev->nullb != NULL);
+}
+
+static ssize_t nullb_device_power_store(struct nullb_device *dev,
+					const char *page, size_t count)
+{
+	bool power;
+	int ret = 0;
+
+	if (strtobool(page, &power))
+		return -EINVAL;
+
+	mutex_lock(&lock);
+	if (power && !dev->nullb)
+		ret = null_add_dev(dev);
+	else if (!power && dev->nullb)
+		null_del_dev(dev->nullb);
+	mutex_unlock(&lock);
+
+	return ret ? ret : count;
+}
+
+NULLB_DEVICE_ATTR(power, S_IRUGO | S_IWUSR, nullb_device_power_show,
+		  nullb_device_power_store);
+
+static ssize_t nullb_device_index_show(struct nullb_device *dev, char *page)
+{
+	struct nullb *nullb = dev->nullb;
+
+	return sprintf(page, "%d\n", nullb ? (int)nullb->index : -1);
+}
+
+NULLB_DEVICE_ATTR(index, S_IRUGO, nullb_device_index_show, NULL);
+
+static struct configfs_attribute *nullb_device_attrs[] = {
+	&nullb_device_attr_size.attr,
+	&nullb_device_attr_blocksize.attr,
+	&nullb_device_attr_submit_queues.attr,
+	&nullb_device_attr_home_node.attr,
+	&nullb_device_attr_queue_mode.attr,
+	&nullb_device_attr_irqmode.attr,
+	&nullb_device_attr_hw_queue_depth.attr,
+	&nullb_device_attr_completion_nsec.attr,
+	&nullb_device_attr_lat_dist.attr,
+	&nullb_device_attr_lat_max_nsec.attr,
+	&nullb_device_attr_lat_tail_pct.attr,
+	&nullb_device_attr_mbps.attr,
+	&nullb_device_attr_zone_size.attr,
+	&nullb_device_attr_memory_backed.attr,
+	&nullb_device_attr_use_per_node_hctx.attr,
+	&nullb_device_attr_power.attr,
+	&nullb_device_attr_index.attr,
+	NULL,
+};
+
+CONFIGFS_ATTR_OPS(nullb_device);
+
+static void nullb_device_release(struct config_item *item)
+{
+	kfree(to_nullb_device(item));
+}
+
+static struct configfs_item_operations nullb_device_ops = {
+	.show_attribute		= nullb_device_attr_show,
+	.store_attribute	= nullb_device_attr_store,
+	.release		= nullb_device_release,
+};
+
+static struct config_item_type nullb_device_type = {
+	.ct_item_ops	= &nullb_device_ops,
+	.ct_attrs	= nullb_device_attrs,
+	.ct_owner	= THIS_MODULE,
+};
+
+static struct config_item *nullb_group_make_item(struct config_group *group,
+						 const char *name)
+{
+	struct nullb_device *dev;
+
+	dev = null_alloc_dev();
+	if (!dev)
+		return ERR_PTR(-ENOMEM);
+
+	config_item_init_type_name(&dev->item, name, &nullb_device_type);
+	return &dev->item;
+}
+
+static void nullb_group_drop_item(struct config_group *group,
+				  struct config_item *item)
+{
+	struct nullb_device *dev = to_nullb_device(item);
+
+	mutex_lock(&lock);
+	if (dev->nullb)
+		null_del_dev(dev->nullb);
+	mutex_unlock(&lock);
+
+	config_item_put(item);
+}
+
+static struct configfs_group_operations nullb_group_ops = {
+	.make_item	= nullb_group_make_item,
+	.drop_item	= nullb_group_drop_item,
+};
+
+static struct config_item_type nullb_group_type = {
+	.ct_group_ops	= &nullb_group_ops,
+	.ct_owner	= THIS_MODULE,
+};
+
+static struct configfs_subsystem nullb_subsys = {
+	.su_group = {
+		.cg_item = {
+			.ci_namebuf = "nullb",
+			.ci_type = &nullb_group_type,
+		},
+	},
+};
+
 static int __init null_init(void)
 {
+	struct nullb_device *dev;
 	unsigned int i;
+	int ret;
 
 	if (bs > PAGE_SIZE) {
 		pr_warn("null_blk: invalid block size\n");
@@ -625,44 +1331,63 @@ static int __init null_init(void)
 
 	mutex_init(&lock);
 
-	/* Initialize a separate list for each CPU for issuing softirqs */
-	for_each_possible_cpu(i) {
-		struct completion_queue *cq = &per_cpu(completion_queues, i);
-
-		init_llist_head(&cq->list);
-
-		if (irqmode != NULL_IRQ_TIMER)
-			continue;
-
-		hrtimer_init(&cq->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-		cq->timer.function = null_cmd_timer_expired;
-	}
-
 	null_major = register_blkdev(0, "nullb");
 	if (null_major < 0)
 		return null_major;
 
+	mutex_lock(&lock);
 	for (i = 0; i < nr_devices; i++) {
-		if (null_add_dev()) {
-			unregister_blkdev(null_major, "nullb");
-			return -EINVAL;
+		dev = null_alloc_dev();
+		if (!dev || null_add_dev(dev)) {
+			kfree(dev);
+			ret = -EINVAL;
+			goto err_dev;
 		}
 	}
+	mutex_unlock(&lock);
+
+	config_group_init(&nullb_subsys.su_group);
+	mutex_init(&nullb_subsys.su_mutex);
+
+	ret = configfs_register_subsystem(&nullb_subsys);
+	if (ret) {
+		mutex_lock(&lock);
+		goto err_dev;
+	}
 
 	pr_info("null: module loaded\n");
 	return 0;
+
+err_dev:
+	while (!list_empty(&nullb_list)) {
+		struct nullb *nullb;
+
+		nullb = list_entry(nullb_list.next, struct nullb, list);
+		dev = nullb->dev;
+		null_del_dev(nullb);
+		kfree(dev);
+	}
+	mutex_unlock(&lock);
+	unregister_blkdev(null_major, "nullb");
+	return ret;
 }
 
 static void __exit null_exit(void)
 {
+	struct nullb_device *dev;
 	struct nullb *nullb;
 
+	/* configfs items pin the module, only parameter devices are left */
+	configfs_unregister_subsystem(&nullb_subsys);
+
 	unregister_blkdev(null_major, "nullb");
 
 	mutex_lock(&lock);
 	while (!list_empty(&nullb_list)) {
 		nullb = list_entry(nullb_list.next, struct nullb, list);
+		dev = nullb->dev;
 		null_del_dev(nullb);
+		kfree(dev);
 	}
 	mutex_unlock(&lock);
 }
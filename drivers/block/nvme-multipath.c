@@ -0,0 +1,417 @@
+/*
+ * NVM Express device driver: native multipath
+ *
+ * A namespace that several controllers of the same NVM subsystem can reach
+ * shows up once per controller.  Rather than leaving it to a stacking driver
+ * to glue those devices back together, group them under an nvme_ns_head
+ * with a block device of its own, and pick one of the controllers for every
+ * bio that is submitted to it.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include <linux/nvme.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/idr.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/topology.h>
+
+static bool multipath = true;
+module_param(multipath, bool, 0444);
+MODULE_PARM_DESC(multipath,
+	"turn on native support for multiple controllers per subsystem");
+
+enum {
+	NVME_MPATH_NUMA,
+	NVME_MPATH_ROUND_ROBIN,
+	NVME_MPATH_QUEUE_DEPTH,
+};
+
+static const char * const nvme_mpath_policy_names[] = {
+	[NVME_MPATH_NUMA]		= "numa",
+	[NVME_MPATH_ROUND_ROBIN]	= "round-robin",
+	[NVME_MPATH_QUEUE_DEPTH]	= "queue-depth",
+};
+
+static int nvme_mpath_policy = NVME_MPATH_NUMA;
+
+static int nvme_mpath_set_policy(const char *val,
+				 const struct kernel_param *kp)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nvme_mpath_policy_names); i++) {
+		if (sysfs_streq(val, nvme_mpath_policy_names[i])) {
+			WRITE_ONCE(nvme_mpath_policy, i);
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int nvme_mpath_get_policy(char *buf, const struct kernel_param *kp)
+{
+	return sprintf(buf, "%s\n",
+		       nvme_mpath_policy_names[READ_ONCE(nvme_mpath_policy)]);
+}
+
+static const struct kernel_param_ops nvme_mpath_policy_ops = {
+	.set	= nvme_mpath_set_policy,
+	.get	= nvme_mpath_get_policy,
+};
+module_param_cb(multipath_policy, &nvme_mpath_policy_ops, NULL, 0644);
+MODULE_PARM_DESC(multipath_policy,
+	"path selection: numa (default), round-robin or queue-depth");
+
+/* Serialises path and head addition and removal */
+static DEFINE_MUTEX(nvme_mpath_mutex);
+static LIST_HEAD(nvme_mpath_heads);
+static DEFINE_IDA(nvme_mpath_ida);
+
+/*
+ * A path can take I/O while its controller has I/O queues and is not being
+ * reset; bios that find no such path wait on the head until one comes back.
+ */
+static bool nvme_path_usable(struct nvme_ns *ns)
+{
+	return ns->dev->online_queues > 1 && !blk_queue_stopped(ns->queue) &&
+		!blk_queue_dying(ns->queue);
+}
+
+static struct nvme_ns *nvme_find_path(struct nvme_ns_head *head)
+{
+	int policy = READ_ONCE(nvme_mpath_policy);
+	unsigned int last = READ_ONCE(head->rr_last);
+	unsigned int depth, min_depth = UINT_MAX;
+	unsigned int nr = 0, idx = 0;
+	int node = numa_node_id();
+	struct nvme_ns *ns, *found = NULL;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ns, &head->list, siblings) {
+		if (!nvme_path_usable(ns))
+			continue;
+
+		switch (policy) {
+		case NVME_MPATH_NUMA:
+			if (dev_to_node(&ns->dev->pci_dev->dev) == node) {
+				found = ns;
+				goto out;
+			}
+			if (!found)
+				found = ns;
+			break;
+		case NVME_MPATH_ROUND_ROBIN:
+			/* Next usable path after the last one, else the first */
+			if (!found || (nr > last && idx <= last)) {
+				found = ns;
+				idx = nr;
+			}
+			nr++;
+			break;
+		case NVME_MPATH_QUEUE_DEPTH:
+			depth = part_in_flight(&ns->disk->part0);
+			if (depth < min_depth) {
+				min_depth = depth;
+				found = ns;
+			}
+			break;
+		}
+	}
+	if (found && policy == NVME_MPATH_ROUND_ROBIN)
+		WRITE_ONCE(head->rr_last, idx);
+out:
+	rcu_read_unlock();
+	return found;
+}
+
+static void nvme_mpath_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct nvme_ns_head *head = q->queuedata;
+	struct nvme_ns *ns;
+	int srcu_idx;
+
+	srcu_idx = srcu_read_lock(&head->srcu);
+	ns = nvme_find_path(head);
+	if (likely(ns)) {
+		/*
+		 * Hand the bio straight to the path's queue while the srcu
+		 * read lock still pins the path, rather than deferring it
+		 * through generic_make_request().
+		 */
+		bio->bi_bdev = ns->bdev;
+		ns->queue->make_request_fn(ns->queue, bio);
+	} else if (!list_empty(&head->list)) {
+		spin_lock_irq(&head->requeue_lock);
+		bio_list_add(&head->requeue_list, bio);
+		spin_unlock_irq(&head->requeue_lock);
+	} else {
+		bio_endio(bio, -EIO);
+	}
+	srcu_read_unlock(&head->srcu, srcu_idx);
+}
+
+static void nvme_mpath_requeue_work(struct work_struct *work)
+{
+	struct nvme_ns_head *head =
+		container_of(work, struct nvme_ns_head, requeue_work);
+	struct bio *bio, *next;
+
+	spin_lock_irq(&head->requeue_lock);
+	next = bio_list_get(&head->requeue_list);
+	spin_unlock_irq(&head->requeue_lock);
+
+	while ((bio = next) != NULL) {
+		next = bio->bi_next;
+		bio->bi_next = NULL;
+		generic_make_request(bio);
+	}
+}
+
+static void nvme_mpath_free_head(struct kref *ref)
+{
+	struct nvme_ns_head *head = container_of(ref, struct nvme_ns_head, ref);
+
+	put_disk(head->disk);
+	cleanup_srcu_struct(&head->srcu);
+	ida_simple_remove(&nvme_mpath_ida, head->instance);
+	kfree(head);
+}
+
+static int nvme_mpath_open(struct block_device *bdev, fmode_t mode)
+{
+	struct nvme_ns_head *head = bdev->bd_disk->private_data;
+
+	if (!kref_get_unless_zero(&head->ref))
+		return -ENXIO;
+	return 0;
+}
+
+static void nvme_mpath_release(struct gendisk *disk, fmode_t mode)
+{
+	struct nvme_ns_head *head = disk->private_data;
+
+	kref_put(&head->ref, nvme_mpath_free_head);
+}
+
+static const struct block_device_operations nvme_mpath_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nvme_mpath_open,
+	.release	= nvme_mpath_release,
+};
+
+static bool nvme_mpath_id_match(const u8 *a, const u8 *b, size_t len)
+{
+	/* All zeroes means the controller does not report the identifier */
+	if (!memchr_inv(a, 0, len) || !memchr_inv(b, 0, len))
+		return true;
+	return !memcmp(a, b, len);
+}
+
+static struct nvme_ns_head *nvme_mpath_find_head(struct nvme_ns *ns)
+{
+	struct nvme_dev *dev = ns->dev;
+	struct nvme_ns_head *head;
+
+	list_for_each_entry(head, &nvme_mpath_heads, entry) {
+		if (head->ns_id != ns->ns_id ||
+		    memcmp(head->serial, dev->serial, sizeof(head->serial)) ||
+		    memcmp(head->model, dev->model, sizeof(head->model)))
+			continue;
+		if (!nvme_mpath_id_match(head->nguid, ns->nguid,
+					 sizeof(head->nguid)) ||
+		    !nvme_mpath_id_match(head->eui64, ns->eui64,
+					 sizeof(head->eui64)))
+			continue;
+		if (kref_get_unless_zero(&head->ref))
+			return head;
+	}
+	return NULL;
+}
+
+static struct nvme_ns_head *nvme_mpath_alloc_head(struct nvme_ns *ns)
+{
+	struct nvme_dev *dev = ns->dev;
+	int node = dev_to_node(&dev->pci_dev->dev);
+	struct nvme_ns_head *head;
+
+	head = kzalloc(sizeof(*head), GFP_KERNEL);
+	if (!head)
+		return NULL;
+
+	INIT_LIST_HEAD(&head->list);
+	kref_init(&head->ref);
+	spin_lock_init(&head->requeue_lock);
+	bio_list_init(&head->requeue_list);
+	INIT_WORK(&head->requeue_work, nvme_mpath_requeue_work);
+	head->ns_id = ns->ns_id;
+	memcpy(head->serial, dev->serial, sizeof(head->serial));
+	memcpy(head->model, dev->model, sizeof(head->model));
+	memcpy(head->nguid, ns->nguid, sizeof(head->nguid));
+	memcpy(head->eui64, ns->eui64, sizeof(head->eui64));
+
+	if (init_srcu_struct(&head->srcu))
+		goto out_free_head;
+
+	head->instance = ida_simple_get(&nvme_mpath_ida, 0, 0, GFP_KERNEL);
+	if (head->instance < 0)
+		goto out_cleanup_srcu;
+
+	head->queue = blk_alloc_queue_node(GFP_KERNEL, node);
+	if (!head->queue)
+		goto out_remove_ida;
+	blk_queue_make_request(head->queue, nvme_mpath_make_request);
+	head->queue->queuedata = head;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, head->queue);
+	blk_set_stacking_limits(&head->queue->limits);
+
+	head->disk = alloc_disk_node(0, node);
+	if (!head->disk)
+		goto out_cleanup_queue;
+	head->disk->fops = &nvme_mpath_fops;
+	head->disk->private_data = head;
+	head->disk->queue = head->queue;
+	head->disk->flags = GENHD_FL_EXT_DEVT;
+	sprintf(head->disk->disk_name, "nvmes%dn%d", head->instance,
+		ns->ns_id);
+	return head;
+
+ out_cleanup_queue:
+	blk_cleanup_queue(head->queue);
+ out_remove_ida:
+	ida_simple_remove(&nvme_mpath_ida, head->instance);
+ out_cleanup_srcu:
+	cleanup_srcu_struct(&head->srcu);
+ out_free_head:
+	kfree(head);
+	return NULL;
+}
+
+/*
+ * Called once a namespace has been added on a controller that says it is
+ * part of a multi-controller subsystem: attach it as a path to the head for
+ * that namespace, creating the head on the first controller to find it.
+ * Namespaces formatted with metadata stay per-controller only, as the head
+ * does not carry integrity profiles.
+ */
+void nvme_mpath_add_ns(struct nvme_ns *ns)
+{
+	struct nvme_dev *dev = ns->dev;
+	struct nvme_ns_head *head;
+	bool new = false;
+
+	if (!multipath || !(dev->cmic & NVME_CTRL_CMIC_MULTI_CTRL) || ns->ms)
+		return;
+
+	ns->bdev = bdget_disk(ns->disk, 0);
+	if (!ns->bdev)
+		return;
+
+	mutex_lock(&nvme_mpath_mutex);
+	head = nvme_mpath_find_head(ns);
+	if (!head) {
+		head = nvme_mpath_alloc_head(ns);
+		if (!head) {
+			mutex_unlock(&nvme_mpath_mutex);
+			dev_warn(&dev->pci_dev->dev,
+				"no multipath device for %s\n",
+				ns->disk->disk_name);
+			bdput(ns->bdev);
+			ns->bdev = NULL;
+			return;
+		}
+		list_add_tail(&head->entry, &nvme_mpath_heads);
+		new = true;
+	}
+
+	blk_queue_stack_limits(head->queue, ns->queue);
+	blk_queue_flush(head->queue, ns->queue->flush_flags);
+	if (blk_queue_discard(ns->queue))
+		queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, head->queue);
+
+	ns->head = head;
+	list_add_tail_rcu(&ns->siblings, &head->list);
+
+	if (new) {
+		set_capacity(head->disk, get_capacity(ns->disk));
+		add_disk(head->disk);
+	}
+	mutex_unlock(&nvme_mpath_mutex);
+
+	dev_info(&dev->pci_dev->dev, "%s is a path to %s\n",
+		ns->disk->disk_name, head->disk->disk_name);
+
+	/* Bios may have been waiting for any path to show up */
+	kblockd_schedule_work(&head->requeue_work);
+}
+
+/*
+ * Detach a path before its disk goes away.  In-flight bios on it complete
+ * or fail with the path; bios waiting on the head are retried on the
+ * remaining paths, or failed once the last path is gone.
+ */
+void nvme_mpath_remove_ns(struct nvme_ns *ns)
+{
+	struct nvme_ns_head *head = ns->head;
+	bool last;
+
+	if (!head)
+		return;
+
+	mutex_lock(&nvme_mpath_mutex);
+	list_del_rcu(&ns->siblings);
+	last = list_empty(&head->list);
+	if (last)
+		list_del(&head->entry);
+	mutex_unlock(&nvme_mpath_mutex);
+
+	synchronize_srcu(&head->srcu);
+	ns->head = NULL;
+	bdput(ns->bdev);
+	ns->bdev = NULL;
+
+	kblockd_schedule_work(&head->requeue_work);
+	if (last) {
+		flush_work(&head->requeue_work);
+		if (head->disk->flags & GENHD_FL_UP)
+			del_gendisk(head->disk);
+		blk_cleanup_queue(head->queue);
+	}
+	kref_put(&head->ref, nvme_mpath_free_head);
+}
+
+void nvme_mpath_revalidate(struct nvme_ns *ns)
+{
+	if (ns->head)
+		set_capacity(ns->head->disk, get_capacity(ns->disk));
+}
+
+/*
+ * The controller's queues are running again, so any bio that was held back
+ * because no path was usable can go now.
+ */
+void nvme_mpath_kick(struct nvme_dev *dev)
+{
+	struct nvme_ns *ns;
+
+	list_for_each_entry(ns, &dev->namespaces, list) {
+		if (ns->head)
+			kblockd_schedule_work(&ns->head->requeue_work);
+	}
+}
@@ -0,0 +1,1584 @@
+/*
+ * NVM Express over Fabrics RDMA host
+ *
+ * Connects to a remote NVMe controller over RDMA and exposes its
+ * namespaces as block devices.  The admin queue and each I/O queue are
+ * separate RDMA connections; commands go out as SEND capsules carrying the
+ * submission queue entry, data is described by a keyed SGL over a fast
+ * registered memory region which the target reads or writes directly, and
+ * completions come back as SENDs into pre-posted receive buffers.
+ *
+ * Controllers are created and deleted by writing option strings to
+ * /dev/nvme-fabrics, e.g.
+ *
+ *	echo traddr=192.168.1.10,nqn=testnqn > /dev/nvme-fabrics
+ *	echo delete=0 > /dev/nvme-fabrics
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include <linux/nvme.h>
+#include <linux/nvme-rdma.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/delay.h>
+#include <linux/genhd.h>
+#include <linux/idr.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/kernel.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/parser.h>
+#include <linux/random.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <asm/unaligned.h>
+#include <rdma/ib_verbs.h>
+#include <rdma/rdma_cm.h>
+
+#define NVME_RDMA_AQ_DEPTH		32
+#define NVME_RDMA_DEF_QUEUE_SIZE	128
+#define NVME_RDMA_MAX_SEGMENTS		32
+#define NVME_RDMA_MAX_PAGES		128
+#define NVME_RDMA_CM_TIMEOUT_MS		3000
+#define NVME_RDMA_SYNC_TIMEOUT		(60 * HZ)
+
+static unsigned char nvme_rdma_timeout_secs = 30;
+module_param_named(io_timeout, nvme_rdma_timeout_secs, byte, 0644);
+MODULE_PARM_DESC(io_timeout, "timeout in seconds for I/O");
+
+struct nvme_rdma_queue;
+
+/*
+ * Every work request we ask a completion for points at one of these through
+ * its wr_id, so the completion handler knows what finished.
+ */
+struct nvme_rdma_qe {
+	void (*done)(struct nvme_rdma_queue *queue, struct nvme_rdma_qe *qe,
+			struct ib_wc *wc);
+	void *data;
+	u64 dma;
+};
+
+struct nvme_rdma_request {
+	struct nvme_rdma_qe sqe;
+	struct nvme_rdma_queue *queue;
+	struct request *rq;
+	atomic_t ref;
+	bool rsp_seen;
+	u16 status;
+	u64 result;
+
+	struct scatterlist sg[NVME_RDMA_MAX_SEGMENTS];
+	int nents;
+	enum dma_data_direction dir;
+
+	struct ib_mr *mr;
+	struct ib_fast_reg_page_list *page_list;
+	struct ib_send_wr reg_wr;
+	struct ib_send_wr inv_wr;
+	bool mr_valid;
+};
+
+enum {
+	NVME_RDMA_Q_ALLOCATED,
+	NVME_RDMA_Q_CONNECTED,
+	NVME_RDMA_Q_LIVE,
+};
+
+struct nvme_rdma_queue {
+	struct nvme_rdma_ctrl *ctrl;
+	int qid;
+	int queue_size;
+	unsigned long flags;
+	spinlock_t lock;
+
+	struct rdma_cm_id *cm_id;
+	struct ib_cq *cq;
+	struct ib_qp *qp;
+	int cm_error;
+	struct completion cm_done;
+
+	struct nvme_completion *rsps;
+	u64 rsps_dma;
+	struct nvme_rdma_qe *rsp_qes;
+
+	/* Connect and admin commands, one at a time, outside of blk-mq */
+	struct nvme_rdma_request *sync_req;
+	struct mutex sync_mutex;
+	struct completion sync_done;
+
+	struct nvme_rdma_qe drain_qe;
+	struct completion drained;
+};
+
+struct nvme_rdma_ctrl {
+	struct list_head node;
+	int instance;
+	bool failed;
+	unsigned long deleting;
+	struct work_struct delete_work;
+	struct work_struct err_work;
+	/* Serializes disconnects from error recovery against queue teardown */
+	struct mutex teardown_mutex;
+
+	struct sockaddr_in addr;
+	char subsysnqn[NVMF_NQN_SIZE];
+	char hostnqn[NVMF_NQN_SIZE];
+	u16 cntlid;
+	u32 max_hw_sectors;
+	u8 vwc;
+	char serial[20];
+	char model[40];
+
+	struct ib_device *device;
+	struct ib_pd *pd;
+	struct ib_mr *mr;
+	struct ib_device_attr attr;
+
+	struct nvme_rdma_queue *queues;
+	unsigned int queue_count;
+	int queue_size;
+	struct blk_mq_tag_set tagset;
+	bool tagset_allocated;
+
+	struct list_head namespaces;
+};
+
+static LIST_HEAD(nvme_rdma_ctrls);
+static DEFINE_MUTEX(nvme_rdma_ctrl_mutex);
+static DEFINE_IDA(nvme_rdma_instance_ida);
+static struct workqueue_struct *nvme_rdma_wq;
+static u8 nvme_rdma_hostid[16];
+static char nvme_rdma_default_hostnqn[NVMF_NQN_SIZE];
+
+/*
+ * There is no reconnect: a controller whose transport fails is torn down
+ * and has to be created again.  This may be called from completion context.
+ */
+static void nvme_rdma_error_recovery(struct nvme_rdma_ctrl *ctrl)
+{
+	ctrl->failed = true;
+	queue_work(nvme_rdma_wq, &ctrl->err_work);
+}
+
+static int nvme_rdma_error_status(u16 status)
+{
+	switch (status & 0x7ff) {
+	case NVME_SC_SUCCESS:
+		return 0;
+	case NVME_SC_CAP_EXCEEDED:
+		return -ENOSPC;
+	default:
+		return -EIO;
+	}
+}
+
+static void nvme_rdma_put_request(struct nvme_rdma_request *req)
+{
+	struct nvme_rdma_queue *queue = req->queue;
+
+	if (!atomic_dec_and_test(&req->ref))
+		return;
+
+	if (req->nents) {
+		ib_dma_unmap_sg(queue->ctrl->device, req->sg, req->nents,
+				req->dir);
+		req->nents = 0;
+	}
+
+	if (req->rq) {
+		req->rq->errors = nvme_rdma_error_status(req->status);
+		blk_mq_complete_request(req->rq);
+	} else {
+		complete(&queue->sync_done);
+	}
+}
+
+static void nvme_rdma_send_done(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_qe *qe, struct ib_wc *wc)
+{
+	struct nvme_rdma_request *req =
+		container_of(qe, struct nvme_rdma_request, sqe);
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR)
+			dev_err(&queue->ctrl->device->dev,
+				"send failed on queue %d: %d\n", queue->qid,
+				wc->status);
+		req->status = NVME_SC_ABORT_REQ | NVME_SC_DNR;
+		nvme_rdma_error_recovery(queue->ctrl);
+		/* No response is coming for a command that never went out */
+		if (!req->rsp_seen)
+			atomic_dec(&req->ref);
+	}
+	nvme_rdma_put_request(req);
+}
+
+static int nvme_rdma_post_recv(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_qe *qe)
+{
+	struct ib_recv_wr wr, *bad_wr;
+	struct ib_sge sge;
+
+	sge.addr = qe->dma;
+	sge.length = sizeof(struct nvme_completion);
+	sge.lkey = queue->ctrl->mr->lkey;
+
+	wr.next = NULL;
+	wr.wr_id = (uintptr_t)qe;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+
+	return ib_post_recv(queue->qp, &wr, &bad_wr);
+}
+
+static void nvme_rdma_recv_done(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_qe *qe, struct ib_wc *wc)
+{
+	struct nvme_completion *cqe = qe->data;
+	struct nvme_rdma_request *req;
+	struct request *rq;
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR) {
+			dev_err(&queue->ctrl->device->dev,
+				"recv failed on queue %d: %d\n", queue->qid,
+				wc->status);
+			nvme_rdma_error_recovery(queue->ctrl);
+		}
+		return;
+	}
+
+	ib_dma_sync_single_for_cpu(queue->ctrl->device, qe->dma,
+			sizeof(*cqe), DMA_FROM_DEVICE);
+
+	if (cqe->command_id == queue->queue_size) {
+		req = queue->sync_req;
+	} else {
+		rq = NULL;
+		if (queue->qid && cqe->command_id < queue->queue_size)
+			rq = blk_mq_tag_to_rq(
+				queue->ctrl->tagset.tags[queue->qid - 1],
+				cqe->command_id);
+		if (unlikely(!rq)) {
+			dev_err(&queue->ctrl->device->dev,
+				"bogus command id %d on queue %d\n",
+				cqe->command_id, queue->qid);
+			nvme_rdma_error_recovery(queue->ctrl);
+			return;
+		}
+		req = blk_mq_rq_to_pdu(rq);
+	}
+
+	req->status = le16_to_cpu(cqe->status) >> 1;
+	/* Property Get returns eight bytes in dwords 0 and 1 */
+	req->result = get_unaligned_le64(&cqe->result);
+	req->rsp_seen = true;
+
+	ib_dma_sync_single_for_device(queue->ctrl->device, qe->dma,
+			sizeof(*cqe), DMA_FROM_DEVICE);
+	if (nvme_rdma_post_recv(queue, qe))
+		nvme_rdma_error_recovery(queue->ctrl);
+
+	nvme_rdma_put_request(req);
+}
+
+static void nvme_rdma_drain_done(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_qe *qe, struct ib_wc *wc)
+{
+	complete(&queue->drained);
+}
+
+static void nvme_rdma_handle_wc(struct nvme_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	struct nvme_rdma_qe *qe = (struct nvme_rdma_qe *)(uintptr_t)wc->wr_id;
+
+	if (qe)
+		qe->done(queue, qe, wc);
+	/* Unsignaled registration or invalidation */
+	else if (wc->status != IB_WC_SUCCESS &&
+		 wc->status != IB_WC_WR_FLUSH_ERR)
+		nvme_rdma_error_recovery(queue->ctrl);
+}
+
+static void nvme_rdma_cq_event(struct ib_cq *cq, void *cq_context)
+{
+	struct nvme_rdma_queue *queue = cq_context;
+	struct ib_wc wc[8];
+	int i, n;
+
+	do {
+		while ((n = ib_poll_cq(cq, ARRAY_SIZE(wc), wc)) > 0)
+			for (i = 0; i < n; i++)
+				nvme_rdma_handle_wc(queue, &wc[i]);
+	} while (ib_req_notify_cq(cq, IB_CQ_NEXT_COMP |
+				      IB_CQ_REPORT_MISSED_EVENTS) > 0);
+}
+
+static int nvme_rdma_init_request_res(struct nvme_rdma_ctrl *ctrl,
+		struct nvme_rdma_request *req, size_t capsule_size)
+{
+	req->sqe.done = nvme_rdma_send_done;
+	req->sqe.data = kzalloc(capsule_size, GFP_KERNEL);
+	if (!req->sqe.data)
+		return -ENOMEM;
+	req->sqe.dma = ib_dma_map_single(ctrl->device, req->sqe.data,
+			capsule_size, DMA_TO_DEVICE);
+	if (ib_dma_mapping_error(ctrl->device, req->sqe.dma))
+		goto out_free_sqe;
+
+	req->mr = ib_alloc_fast_reg_mr(ctrl->pd, NVME_RDMA_MAX_PAGES);
+	if (IS_ERR(req->mr))
+		goto out_unmap_sqe;
+	req->page_list = ib_alloc_fast_reg_page_list(ctrl->device,
+			NVME_RDMA_MAX_PAGES);
+	if (IS_ERR(req->page_list))
+		goto out_dereg_mr;
+	req->mr_valid = false;
+	return 0;
+
+ out_dereg_mr:
+	ib_dereg_mr(req->mr);
+ out_unmap_sqe:
+	ib_dma_unmap_single(ctrl->device, req->sqe.dma, capsule_size,
+			DMA_TO_DEVICE);
+ out_free_sqe:
+	kfree(req->sqe.data);
+	return -ENOMEM;
+}
+
+static void nvme_rdma_free_request_res(struct nvme_rdma_ctrl *ctrl,
+		struct nvme_rdma_request *req, size_t capsule_size)
+{
+	ib_free_fast_reg_page_list(req->page_list);
+	ib_dereg_mr(req->mr);
+	ib_dma_unmap_single(ctrl->device, req->sqe.dma, capsule_size,
+			DMA_TO_DEVICE);
+	kfree(req->sqe.data);
+}
+
+/*
+ * Register the data of a command as one virtually contiguous region and
+ * point its keyed SGL at it.  The block layer keeps segments free of gaps
+ * within a page (QUEUE_FLAG_SG_GAPS), so they line up into a page list.
+ */
+static int nvme_rdma_map_data(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_request *req, struct nvme_command *c,
+		unsigned int len)
+{
+	struct ib_device *ibdev = queue->ctrl->device;
+	struct nvme_keyed_sgl_desc *sg = &c->common.ksgl;
+	u64 *pages = req->page_list->page_list;
+	struct scatterlist *s;
+	int i, count, npages = 0;
+	u64 addr, end;
+	u32 rkey;
+
+	c->common.flags |= NVME_CMD_SGL_METABUF;
+	sg->type = NVME_KEY_SGL_FMT_DATA_DESC << 4;
+	if (!req->nents)
+		return 0;
+
+	count = ib_dma_map_sg(ibdev, req->sg, req->nents, req->dir);
+	if (!count)
+		return -EIO;
+
+	for_each_sg(req->sg, s, count, i) {
+		addr = ib_sg_dma_address(ibdev, s);
+		end = addr + ib_sg_dma_len(ibdev, s);
+		for (addr &= PAGE_MASK; addr < end; addr += PAGE_SIZE) {
+			if (npages == NVME_RDMA_MAX_PAGES)
+				goto out_unmap;
+			pages[npages++] = addr;
+		}
+	}
+
+	memset(&req->inv_wr, 0, sizeof(req->inv_wr));
+	if (req->mr_valid) {
+		req->inv_wr.opcode = IB_WR_LOCAL_INV;
+		req->inv_wr.ex.invalidate_rkey = req->mr->rkey;
+		req->inv_wr.next = &req->reg_wr;
+		rkey = ib_inc_rkey(req->mr->rkey);
+		ib_update_fast_reg_key(req->mr, rkey & 0xff);
+	}
+
+	memset(&req->reg_wr, 0, sizeof(req->reg_wr));
+	req->reg_wr.opcode = IB_WR_FAST_REG_MR;
+	req->reg_wr.wr.fast_reg.iova_start = ib_sg_dma_address(ibdev, req->sg);
+	req->reg_wr.wr.fast_reg.page_list = req->page_list;
+	req->reg_wr.wr.fast_reg.page_shift = PAGE_SHIFT;
+	req->reg_wr.wr.fast_reg.page_list_len = npages;
+	req->reg_wr.wr.fast_reg.length = len;
+	req->reg_wr.wr.fast_reg.access_flags = IB_ACCESS_LOCAL_WRITE |
+			IB_ACCESS_REMOTE_READ | IB_ACCESS_REMOTE_WRITE;
+	req->reg_wr.wr.fast_reg.rkey = req->mr->rkey;
+	req->mr_valid = true;
+
+	sg->addr = cpu_to_le64(req->reg_wr.wr.fast_reg.iova_start);
+	sg->length[0] = len;
+	sg->length[1] = len >> 8;
+	sg->length[2] = len >> 16;
+	put_unaligned_le32(req->mr->rkey, sg->key);
+	sg->type |= NVME_SGL_FMT_ADDRESS;
+	return 0;
+
+ out_unmap:
+	ib_dma_unmap_sg(ibdev, req->sg, req->nents, req->dir);
+	req->nents = 0;
+	return -EINVAL;
+}
+
+static int nvme_rdma_post_send(struct nvme_rdma_queue *queue,
+		struct nvme_rdma_request *req, unsigned int capsule_len)
+{
+	struct ib_send_wr wr, *first = &wr, *bad_wr;
+	struct ib_sge sge;
+
+	sge.addr = req->sqe.dma;
+	sge.length = capsule_len;
+	sge.lkey = queue->ctrl->mr->lkey;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.wr_id = (uintptr_t)&req->sqe;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+	wr.opcode = IB_WR_SEND;
+	wr.send_flags = IB_SEND_SIGNALED;
+
+	if (req->nents) {
+		req->reg_wr.next = &wr;
+		first = req->inv_wr.opcode == IB_WR_LOCAL_INV ?
+			&req->inv_wr : &req->reg_wr;
+	}
+
+	ib_dma_sync_single_for_device(queue->ctrl->device, req->sqe.dma,
+			capsule_len, DMA_TO_DEVICE);
+
+	/* One reference for the send completion, one for the response */
+	atomic_set(&req->ref, 2);
+	req->rsp_seen = false;
+	req->status = 0;
+	return ib_post_send(queue->qp, first, &bad_wr);
+}
+
+static int nvme_rdma_exec_sync(struct nvme_rdma_queue *queue,
+		unsigned int capsule_len, u64 *result)
+{
+	struct nvme_rdma_request *req = queue->sync_req;
+	int ret;
+
+	reinit_completion(&queue->sync_done);
+	ret = nvme_rdma_post_send(queue, req, capsule_len);
+	if (ret) {
+		if (req->nents) {
+			ib_dma_unmap_sg(queue->ctrl->device, req->sg,
+					req->nents, req->dir);
+			req->nents = 0;
+		}
+		return ret;
+	}
+
+	if (!wait_for_completion_timeout(&queue->sync_done,
+					 NVME_RDMA_SYNC_TIMEOUT)) {
+		/* Flush the command out before the request can be reused */
+		dev_warn(&queue->ctrl->device->dev,
+			"command timed out on queue %d\n", queue->qid);
+		nvme_rdma_error_recovery(queue->ctrl);
+		rdma_disconnect(queue->cm_id);
+		wait_for_completion(&queue->sync_done);
+		return -ETIMEDOUT;
+	}
+
+	if (result)
+		*result = req->result;
+	return req->status ? -EIO : 0;
+}
+
+/*
+ * Submit an admin or connect command and wait for it.  @buf, if given, is
+ * filled in by the target.
+ */
+static int nvme_rdma_sync_cmd(struct nvme_rdma_queue *queue,
+		struct nvme_command *cmd, void *buf, unsigned int len,
+		u64 *result)
+{
+	struct nvme_rdma_request *req = queue->sync_req;
+	struct nvme_command *c = req->sqe.data;
+	int ret;
+
+	mutex_lock(&queue->sync_mutex);
+	*c = *cmd;
+	c->common.command_id = queue->queue_size;
+
+	req->nents = 0;
+	if (buf) {
+		sg_init_one(req->sg, buf, len);
+		req->nents = 1;
+		req->dir = DMA_FROM_DEVICE;
+	}
+	ret = nvme_rdma_map_data(queue, req, c, len);
+	if (!ret)
+		ret = nvme_rdma_exec_sync(queue, sizeof(*c), result);
+	mutex_unlock(&queue->sync_mutex);
+	return ret;
+}
+
+static int nvme_rdma_connect_cmd(struct nvme_rdma_queue *queue)
+{
+	struct nvme_rdma_ctrl *ctrl = queue->ctrl;
+	struct nvme_rdma_request *req = queue->sync_req;
+	struct nvme_command *c = req->sqe.data;
+	struct nvmf_connect_data *data = (void *)(c + 1);
+	u64 result;
+	int ret;
+
+	mutex_lock(&queue->sync_mutex);
+	memset(c, 0, sizeof(*c) + sizeof(*data));
+	c->connect.opcode = nvme_fabrics_command;
+	c->connect.command_id = queue->queue_size;
+	c->connect.fctype = nvme_fabrics_type_connect;
+	c->connect.qid = cpu_to_le16(queue->qid);
+	c->connect.sqsize = cpu_to_le16(queue->queue_size - 1);
+	c->common.flags = NVME_CMD_SGL_METABUF;
+
+	/* The connect data travels in the capsule, right after the command */
+	c->common.sgl.addr = 0;
+	c->common.sgl.length = cpu_to_le32(sizeof(*data));
+	c->common.sgl.type = (NVME_SGL_FMT_DATA_DESC << 4) |
+			NVME_SGL_FMT_OFFSET;
+
+	memcpy(data->hostid, nvme_rdma_hostid, sizeof(data->hostid));
+	data->cntlid = cpu_to_le16(queue->qid ? ctrl->cntlid : 0xffff);
+	strncpy(data->subsysnqn, ctrl->subsysnqn, NVMF_NQN_SIZE);
+	strncpy(data->hostnqn, ctrl->hostnqn, NVMF_NQN_SIZE);
+
+	req->nents = 0;
+	ret = nvme_rdma_exec_sync(queue, sizeof(*c) + sizeof(*data), &result);
+	mutex_unlock(&queue->sync_mutex);
+	if (ret) {
+		dev_err(&ctrl->device->dev,
+			"connect of queue %d to %s failed: %d\n", queue->qid,
+			ctrl->subsysnqn, ret);
+		return ret;
+	}
+
+	if (!queue->qid)
+		ctrl->cntlid = result & 0xffff;
+	set_bit(NVME_RDMA_Q_LIVE, &queue->flags);
+	return 0;
+}
+
+static int nvme_rdma_reg_read(struct nvme_rdma_ctrl *ctrl, u32 off, bool is64,
+		u64 *val)
+{
+	struct nvme_command c;
+	int ret;
+
+	memset(&c, 0, sizeof(c));
+	c.prop_get.opcode = nvme_fabrics_command;
+	c.prop_get.fctype = nvme_fabrics_type_property_get;
+	c.prop_get.attrib = is64;
+	c.prop_get.offset = cpu_to_le32(off);
+
+	ret = nvme_rdma_sync_cmd(&ctrl->queues[0], &c, NULL, 0, val);
+	if (!ret && !is64)
+		*val &= 0xffffffff;
+	return ret;
+}
+
+static int nvme_rdma_reg_write32(struct nvme_rdma_ctrl *ctrl, u32 off, u32 val)
+{
+	struct nvme_command c;
+
+	memset(&c, 0, sizeof(c));
+	c.prop_set.opcode = nvme_fabrics_command;
+	c.prop_set.fctype = nvme_fabrics_type_property_set;
+	c.prop_set.offset = cpu_to_le32(off);
+	c.prop_set.value = cpu_to_le64(val);
+
+	return nvme_rdma_sync_cmd(&ctrl->queues[0], &c, NULL, 0, NULL);
+}
+
+static int nvme_rdma_wait_csts(struct nvme_rdma_ctrl *ctrl, u32 mask, u32 bits,
+		unsigned long timeout)
+{
+	u64 csts;
+	int ret;
+
+	timeout += jiffies;
+	for (;;) {
+		ret = nvme_rdma_reg_read(ctrl, NVME_REG_CSTS, false, &csts);
+		if (ret)
+			return ret;
+		if ((csts & mask) == bits)
+			return 0;
+		if (csts & NVME_CSTS_CFS || time_after(jiffies, timeout))
+			return -ENODEV;
+		msleep(100);
+	}
+}
+
+static int nvme_rdma_enable_ctrl(struct nvme_rdma_ctrl *ctrl, u64 cap)
+{
+	u32 cc;
+	int ret;
+
+	cc = NVME_CC_CSS_NVM | (PAGE_SHIFT - 12) << NVME_CC_MPS_SHIFT |
+		NVME_CC_ARB_RR | NVME_CC_SHN_NONE | NVME_CC_IOSQES |
+		NVME_CC_IOCQES | NVME_CC_ENABLE;
+	ret = nvme_rdma_reg_write32(ctrl, NVME_REG_CC, cc);
+	if (ret)
+		return ret;
+	return nvme_rdma_wait_csts(ctrl, NVME_CSTS_RDY, NVME_CSTS_RDY,
+			(NVME_CAP_TIMEOUT(cap) + 1) * HZ / 2);
+}
+
+static void nvme_rdma_shutdown_ctrl(struct nvme_rdma_ctrl *ctrl)
+{
+	u32 cc = NVME_CC_CSS_NVM | (PAGE_SHIFT - 12) << NVME_CC_MPS_SHIFT |
+		NVME_CC_ARB_RR | NVME_CC_SHN_NORMAL | NVME_CC_IOSQES |
+		NVME_CC_IOCQES | NVME_CC_ENABLE;
+
+	if (!test_bit(NVME_RDMA_Q_LIVE, &ctrl->queues[0].flags))
+		return;
+	if (nvme_rdma_reg_write32(ctrl, NVME_REG_CC, cc) ||
+	    nvme_rdma_wait_csts(ctrl, NVME_CSTS_SHST_MASK,
+				NVME_CSTS_SHST_CMPLT, 5 * HZ))
+		dev_warn(&ctrl->device->dev,
+			"controller %d did not shut down cleanly\n",
+			ctrl->instance);
+}
+
+static int nvme_rdma_init_device(struct nvme_rdma_ctrl *ctrl,
+		struct ib_device *device)
+{
+	int ret;
+
+	ret = ib_query_device(device, &ctrl->attr);
+	if (ret)
+		return ret;
+	if (!(ctrl->attr.device_cap_flags & IB_DEVICE_MEM_MGT_EXTENSIONS)) {
+		dev_err(&device->dev, "fast registration is not supported\n");
+		return -EOPNOTSUPP;
+	}
+
+	ctrl->pd = ib_alloc_pd(device);
+	if (IS_ERR(ctrl->pd)) {
+		ret = PTR_ERR(ctrl->pd);
+		ctrl->pd = NULL;
+		return ret;
+	}
+
+	/* Only covers our own buffers, the target gets no access to it */
+	ctrl->mr = ib_get_dma_mr(ctrl->pd, IB_ACCESS_LOCAL_WRITE);
+	if (IS_ERR(ctrl->mr)) {
+		ret = PTR_ERR(ctrl->mr);
+		ctrl->mr = NULL;
+		ib_dealloc_pd(ctrl->pd);
+		ctrl->pd = NULL;
+		return ret;
+	}
+
+	ctrl->device = device;
+	return 0;
+}
+
+static void nvme_rdma_qp_event(struct ib_event *event, void *context)
+{
+	struct nvme_rdma_queue *queue = context;
+
+	if (event->event != IB_EVENT_COMM_EST)
+		dev_err(&queue->ctrl->device->dev,
+			"QP event %d on queue %d\n", event->event, queue->qid);
+}
+
+/*
+ * The sync request of a queue carries Connect, whose data travels in the
+ * capsule, so its capsule is bigger than that of an I/O command.
+ */
+#define NVME_RDMA_SYNC_CAPSULE_SIZE \
+	(sizeof(struct nvme_command) + sizeof(struct nvmf_connect_data))
+
+static int nvme_rdma_create_queue_ib(struct nvme_rdma_queue *queue)
+{
+	struct nvme_rdma_ctrl *ctrl = queue->ctrl;
+	int nr_rsps = queue->queue_size + 1;
+	struct ib_qp_init_attr init_attr;
+	int i, ret;
+
+	/* Up to invalidate, register and send per command, plus the drain */
+	queue->cq = ib_create_cq(ctrl->device, nvme_rdma_cq_event, NULL, queue,
+			4 * nr_rsps + 1,
+			queue->qid % ctrl->device->num_comp_vectors);
+	if (IS_ERR(queue->cq)) {
+		ret = PTR_ERR(queue->cq);
+		queue->cq = NULL;
+		return ret;
+	}
+	ib_req_notify_cq(queue->cq, IB_CQ_NEXT_COMP);
+
+	memset(&init_attr, 0, sizeof(init_attr));
+	init_attr.event_handler = nvme_rdma_qp_event;
+	init_attr.qp_context = queue;
+	init_attr.send_cq = queue->cq;
+	init_attr.recv_cq = queue->cq;
+	init_attr.cap.max_send_wr = 3 * nr_rsps + 1;
+	init_attr.cap.max_recv_wr = nr_rsps;
+	init_attr.cap.max_send_sge = 1;
+	init_attr.cap.max_recv_sge = 1;
+	init_attr.sq_sig_type = IB_SIGNAL_REQ_WR;
+	init_attr.qp_type = IB_QPT_RC;
+	ret = rdma_create_qp(queue->cm_id, ctrl->pd, &init_attr);
+	if (ret)
+		return ret;
+	queue->qp = queue->cm_id->qp;
+
+	queue->sync_req = kzalloc(sizeof(*queue->sync_req), GFP_KERNEL);
+	if (!queue->sync_req)
+		return -ENOMEM;
+	queue->sync_req->queue = queue;
+	ret = nvme_rdma_init_request_res(ctrl, queue->sync_req,
+			NVME_RDMA_SYNC_CAPSULE_SIZE);
+	if (ret) {
+		kfree(queue->sync_req);
+		queue->sync_req = NULL;
+		return ret;
+	}
+
+	queue->rsps = kcalloc(nr_rsps, sizeof(*queue->rsps), GFP_KERNEL);
+	queue->rsp_qes = kcalloc(nr_rsps, sizeof(*queue->rsp_qes), GFP_KERNEL);
+	if (!queue->rsps || !queue->rsp_qes)
+		return -ENOMEM;
+	queue->rsps_dma = ib_dma_map_single(ctrl->device, queue->rsps,
+			nr_rsps * sizeof(*queue->rsps), DMA_FROM_DEVICE);
+	if (ib_dma_mapping_error(ctrl->device, queue->rsps_dma)) {
+		queue->rsps_dma = 0;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_rsps; i++) {
+		struct nvme_rdma_qe *qe = &queue->rsp_qes[i];
+
+		qe->done = nvme_rdma_recv_done;
+		qe->data = &queue->rsps[i];
+		qe->dma = queue->rsps_dma + i * sizeof(*queue->rsps);
+		ret = nvme_rdma_post_recv(queue, qe);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int nvme_rdma_addr_resolved(struct nvme_rdma_queue *queue)
+{
+	struct nvme_rdma_ctrl *ctrl = queue->ctrl;
+	struct ib_device *device = queue->cm_id->device;
+	int ret;
+
+	if (!queue->qid) {
+		ret = nvme_rdma_init_device(ctrl, device);
+		if (ret)
+			return ret;
+	} else if (device != ctrl->device) {
+		dev_err(&device->dev, "queue %d resolved to another device\n",
+			queue->qid);
+		return -EINVAL;
+	}
+
+	ret = nvme_rdma_create_queue_ib(queue);
+	if (ret)
+		return ret;
+	return rdma_resolve_route(queue->cm_id, NVME_RDMA_CM_TIMEOUT_MS);
+}
+
+static int nvme_rdma_route_resolved(struct nvme_rdma_queue *queue)
+{
+	struct nvme_rdma_ctrl *ctrl = queue->ctrl;
+	struct rdma_conn_param param;
+	struct nvme_rdma_cm_req priv;
+
+	memset(&priv, 0, sizeof(priv));
+	priv.recfmt = cpu_to_le16(NVME_RDMA_CM_FMT_1_0);
+	priv.qid = cpu_to_le16(queue->qid);
+	priv.hrqsize = cpu_to_le16(queue->queue_size);
+	priv.hsqsize = cpu_to_le16(queue->queue_size - 1);
+
+	memset(&param, 0, sizeof(param));
+	param.qp_num = queue->qp->qp_num;
+	param.flow_control = 1;
+	/* The target reads write data straight out of our memory */
+	param.responder_resources = min(ctrl->attr.max_qp_rd_atom, 255);
+	param.retry_count = 7;
+	param.rnr_retry_count = 7;
+	param.private_data = &priv;
+	param.private_data_len = sizeof(priv);
+
+	return rdma_connect(queue->cm_id, &param);
+}
+
+static int nvme_rdma_cm_handler(struct rdma_cm_id *cm_id,
+		struct rdma_cm_event *ev)
+{
+	struct nvme_rdma_queue *queue = cm_id->context;
+	int cm_error = 0;
+
+	switch (ev->event) {
+	case RDMA_CM_EVENT_ADDR_RESOLVED:
+		cm_error = nvme_rdma_addr_resolved(queue);
+		break;
+	case RDMA_CM_EVENT_ROUTE_RESOLVED:
+		cm_error = nvme_rdma_route_resolved(queue);
+		break;
+	case RDMA_CM_EVENT_ESTABLISHED:
+		set_bit(NVME_RDMA_Q_CONNECTED, &queue->flags);
+		queue->cm_error = 0;
+		complete(&queue->cm_done);
+		return 0;
+	case RDMA_CM_EVENT_REJECTED:
+		pr_err("nvme-rdma: queue %d rejected, status %d\n",
+			queue->qid, ev->status);
+		cm_error = -ECONNRESET;
+		break;
+	case RDMA_CM_EVENT_ADDR_ERROR:
+	case RDMA_CM_EVENT_ROUTE_ERROR:
+	case RDMA_CM_EVENT_CONNECT_ERROR:
+	case RDMA_CM_EVENT_UNREACHABLE:
+		pr_err("nvme-rdma: queue %d: CM event %d, status %d\n",
+			queue->qid, ev->event, ev->status);
+		cm_error = -ECONNRESET;
+		break;
+	case RDMA_CM_EVENT_DISCONNECTED:
+	case RDMA_CM_EVENT_ADDR_CHANGE:
+	case RDMA_CM_EVENT_TIMEWAIT_EXIT:
+	case RDMA_CM_EVENT_DEVICE_REMOVAL:
+		nvme_rdma_error_recovery(queue->ctrl);
+		break;
+	default:
+		break;
+	}
+
+	if (cm_error) {
+		queue->cm_error = cm_error;
+		complete(&queue->cm_done);
+	}
+	return 0;
+}
+
+static int nvme_rdma_init_queue(struct nvme_rdma_ctrl *ctrl, int qid,
+		int queue_size)
+{
+	struct nvme_rdma_queue *queue = &ctrl->queues[qid];
+	int ret;
+
+	queue->ctrl = ctrl;
+	queue->qid = qid;
+	queue->queue_size = queue_size;
+	spin_lock_init(&queue->lock);
+	init_completion(&queue->cm_done);
+	mutex_init(&queue->sync_mutex);
+	init_completion(&queue->sync_done);
+	init_completion(&queue->drained);
+	queue->drain_qe.done = nvme_rdma_drain_done;
+	queue->cm_error = -ETIMEDOUT;
+
+	queue->cm_id = rdma_create_id(nvme_rdma_cm_handler, queue,
+			RDMA_PS_TCP, IB_QPT_RC);
+	if (IS_ERR(queue->cm_id)) {
+		ret = PTR_ERR(queue->cm_id);
+		queue->cm_id = NULL;
+		return ret;
+	}
+	set_bit(NVME_RDMA_Q_ALLOCATED, &queue->flags);
+	ctrl->queue_count++;
+
+	ret = rdma_resolve_addr(queue->cm_id, NULL,
+			(struct sockaddr *)&ctrl->addr,
+			NVME_RDMA_CM_TIMEOUT_MS);
+	if (ret)
+		return ret;
+
+	wait_for_completion_timeout(&queue->cm_done,
+			msecs_to_jiffies(3 * NVME_RDMA_CM_TIMEOUT_MS));
+	if (queue->cm_error)
+		return queue->cm_error;
+
+	return nvme_rdma_connect_cmd(queue);
+}
+
+/*
+ * Fail the commands whose response will never arrive.  Called once the
+ * queue has been drained, so every send completion has been seen and a
+ * request still holding a reference is only waiting for its response.
+ */
+static void nvme_rdma_cancel_request(struct blk_mq_hw_ctx *hctx,
+		struct request *rq, void *data, bool reserved)
+{
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+
+	if (!blk_mq_request_started(rq) || atomic_read(&req->ref) != 1)
+		return;
+	req->status = NVME_SC_ABORT_REQ | NVME_SC_DNR;
+	nvme_rdma_put_request(req);
+}
+
+static void nvme_rdma_stop_queue(struct nvme_rdma_queue *queue)
+{
+	struct ib_send_wr wr, *bad_wr;
+
+	spin_lock(&queue->lock);
+	clear_bit(NVME_RDMA_Q_LIVE, &queue->flags);
+	spin_unlock(&queue->lock);
+
+	if (!queue->qp || !test_bit(NVME_RDMA_Q_CONNECTED, &queue->flags))
+		return;
+
+	/*
+	 * Once the QP is in the error state everything posted is flushed in
+	 * order, so a send posted now completes after all the others.
+	 */
+	rdma_disconnect(queue->cm_id);
+	memset(&wr, 0, sizeof(wr));
+	wr.wr_id = (uintptr_t)&queue->drain_qe;
+	wr.opcode = IB_WR_SEND;
+	wr.send_flags = IB_SEND_SIGNALED;
+	if (!ib_post_send(queue->qp, &wr, &bad_wr))
+		wait_for_completion(&queue->drained);
+
+	if (queue->sync_req && atomic_read(&queue->sync_req->ref) == 1) {
+		queue->sync_req->status = NVME_SC_ABORT_REQ | NVME_SC_DNR;
+		nvme_rdma_put_request(queue->sync_req);
+	}
+}
+
+static void nvme_rdma_free_queue(struct nvme_rdma_queue *queue)
+{
+	struct nvme_rdma_ctrl *ctrl = queue->ctrl;
+	int nr_rsps = queue->queue_size + 1;
+
+	if (!test_and_clear_bit(NVME_RDMA_Q_ALLOCATED, &queue->flags))
+		return;
+
+	/* No more CM events once the id is gone */
+	rdma_destroy_id(queue->cm_id);
+	queue->cm_id = NULL;
+
+	if (queue->qp)
+		ib_destroy_qp(queue->qp);
+	if (queue->rsps_dma)
+		ib_dma_unmap_single(ctrl->device, queue->rsps_dma,
+				nr_rsps * sizeof(*queue->rsps),
+				DMA_FROM_DEVICE);
+	kfree(queue->rsp_qes);
+	kfree(queue->rsps);
+	if (queue->sync_req) {
+		nvme_rdma_free_request_res(ctrl, queue->sync_req,
+				NVME_RDMA_SYNC_CAPSULE_SIZE);
+		kfree(queue->sync_req);
+	}
+	if (queue->cq)
+		ib_destroy_cq(queue->cq);
+}
+
+static int nvme_rdma_queue_rq(struct blk_mq_hw_ctx *hctx,
+		const struct blk_mq_queue_data *bd)
+{
+	struct nvme_ns *ns = hctx->queue->queuedata;
+	struct nvme_rdma_queue *queue = hctx->driver_data;
+	struct request *rq = bd->rq;
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+	struct nvme_command *c = req->sqe.data;
+	int ret;
+
+	req->nents = 0;
+	if (rq->cmd_flags & REQ_FLUSH) {
+		memset(c, 0, sizeof(*c));
+		c->common.opcode = nvme_cmd_flush;
+		c->common.command_id = rq->tag;
+		c->common.nsid = cpu_to_le32(ns->ns_id);
+	} else {
+		nvme_setup_rw(ns, rq, c);
+		sg_init_table(req->sg, rq->nr_phys_segments);
+		req->nents = blk_rq_map_sg(rq->q, rq, req->sg);
+		req->dir = rq_data_dir(rq) ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	}
+
+	ret = nvme_rdma_map_data(queue, req, c, blk_rq_bytes(rq));
+	if (ret)
+		return ret == -EINVAL ? BLK_MQ_RQ_QUEUE_ERROR :
+					BLK_MQ_RQ_QUEUE_BUSY;
+
+	spin_lock(&queue->lock);
+	if (likely(test_bit(NVME_RDMA_Q_LIVE, &queue->flags))) {
+		blk_mq_start_request(rq);
+		ret = nvme_rdma_post_send(queue, req, sizeof(*c));
+	} else {
+		ret = -EIO;
+	}
+	spin_unlock(&queue->lock);
+
+	if (unlikely(ret)) {
+		if (req->nents) {
+			ib_dma_unmap_sg(queue->ctrl->device, req->sg,
+					req->nents, req->dir);
+			req->nents = 0;
+		}
+		return BLK_MQ_RQ_QUEUE_ERROR;
+	}
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static enum blk_eh_timer_return nvme_rdma_timeout(struct request *rq,
+		bool reserved)
+{
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+
+	dev_warn(&req->queue->ctrl->device->dev,
+		"I/O %d on queue %d timed out\n", rq->tag, req->queue->qid);
+
+	/* The command completes with an error once its queue is flushed */
+	nvme_rdma_error_recovery(req->queue->ctrl);
+	return BLK_EH_RESET_TIMER;
+}
+
+static int nvme_rdma_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+		unsigned int hctx_idx)
+{
+	struct nvme_rdma_ctrl *ctrl = data;
+
+	hctx->driver_data = &ctrl->queues[hctx_idx + 1];
+	return 0;
+}
+
+static int nvme_rdma_init_request(void *data, struct request *rq,
+		unsigned int hctx_idx, unsigned int rq_idx,
+		unsigned int numa_node)
+{
+	struct nvme_rdma_ctrl *ctrl = data;
+	struct nvme_rdma_request *req = blk_mq_rq_to_pdu(rq);
+
+	req->rq = rq;
+	req->queue = &ctrl->queues[hctx_idx + 1];
+	return nvme_rdma_init_request_res(ctrl, req,
+			sizeof(struct nvme_command));
+}
+
+static void nvme_rdma_exit_request(void *data, struct request *rq,
+		unsigned int hctx_idx, unsigned int rq_idx)
+{
+	nvme_rdma_free_request_res(data, blk_mq_rq_to_pdu(rq),
+			sizeof(struct nvme_command));
+}
+
+static struct blk_mq_ops nvme_rdma_mq_ops = {
+	.queue_rq	= nvme_rdma_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.init_hctx	= nvme_rdma_init_hctx,
+	.init_request	= nvme_rdma_init_request,
+	.exit_request	= nvme_rdma_exit_request,
+	.timeout	= nvme_rdma_timeout,
+};
+
+static const struct block_device_operations nvme_rdma_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static void nvme_rdma_alloc_ns(struct nvme_rdma_ctrl *ctrl, unsigned nsid,
+		struct nvme_id_ns *id)
+{
+	u8 lbaf = id->flbas & NVME_NS_FLBAS_LBA_MASK;
+	struct gendisk *disk;
+	struct nvme_ns *ns;
+
+	if (!id->ncap)
+		return;
+	if (id->lbaf[lbaf].ms) {
+		dev_info(&ctrl->device->dev,
+			"skipping namespace %u formatted with metadata\n",
+			nsid);
+		return;
+	}
+
+	ns = kzalloc(sizeof(*ns), GFP_KERNEL);
+	if (!ns)
+		return;
+	ns->ns_id = nsid;
+	ns->lba_shift = id->lbaf[lbaf].ds ? id->lbaf[lbaf].ds : 9;
+
+	ns->queue = blk_mq_init_queue(&ctrl->tagset);
+	if (IS_ERR(ns->queue))
+		goto out_free_ns;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, ns->queue);
+	queue_flag_set_unlocked(QUEUE_FLAG_SG_GAPS, ns->queue);
+	ns->queue->queuedata = ns;
+	blk_queue_logical_block_size(ns->queue, 1 << ns->lba_shift);
+	blk_queue_max_hw_sectors(ns->queue, ctrl->max_hw_sectors);
+	blk_queue_max_segments(ns->queue, NVME_RDMA_MAX_SEGMENTS);
+	if (ctrl->vwc & NVME_CTRL_VWC_PRESENT)
+		blk_queue_flush(ns->queue, REQ_FLUSH | REQ_FUA);
+
+	disk = alloc_disk(0);
+	if (!disk)
+		goto out_free_queue;
+	ns->disk = disk;
+	disk->fops = &nvme_rdma_fops;
+	disk->private_data = ns;
+	disk->queue = ns->queue;
+	disk->flags = GENHD_FL_EXT_DEVT;
+	sprintf(disk->disk_name, "nvmef%dn%u", ctrl->instance, nsid);
+	set_capacity(disk, le64_to_cpu(id->nsze) << (ns->lba_shift - 9));
+
+	list_add_tail(&ns->list, &ctrl->namespaces);
+	add_disk(disk);
+	return;
+
+ out_free_queue:
+	blk_cleanup_queue(ns->queue);
+ out_free_ns:
+	kfree(ns);
+}
+
+static void nvme_rdma_remove_namespaces(struct nvme_rdma_ctrl *ctrl)
+{
+	struct nvme_ns *ns, *next;
+
+	list_for_each_entry_safe(ns, next, &ctrl->namespaces, list) {
+		list_del(&ns->list);
+		del_gendisk(ns->disk);
+		blk_cleanup_queue(ns->queue);
+		put_disk(ns->disk);
+		kfree(ns);
+	}
+}
+
+static int nvme_rdma_identify(struct nvme_rdma_ctrl *ctrl, unsigned nsid,
+		unsigned cns, void *buf)
+{
+	struct nvme_command c;
+
+	memset(&c, 0, sizeof(c));
+	c.identify.opcode = nvme_admin_identify;
+	c.identify.nsid = cpu_to_le32(nsid);
+	c.identify.cns = cpu_to_le32(cns);
+
+	return nvme_rdma_sync_cmd(&ctrl->queues[0], &c, buf, 4096, NULL);
+}
+
+static int nvme_rdma_setup_ctrl(struct nvme_rdma_ctrl *ctrl,
+		unsigned int nr_io_queues)
+{
+	struct nvme_id_ctrl *id;
+	struct nvme_command c;
+	unsigned int i, nn;
+	u64 cap, result;
+	int shift, ret;
+
+	ctrl->queues = kcalloc(nr_io_queues + 1, sizeof(*ctrl->queues),
+			GFP_KERNEL);
+	if (!ctrl->queues)
+		return -ENOMEM;
+
+	ret = nvme_rdma_init_queue(ctrl, 0, NVME_RDMA_AQ_DEPTH);
+	if (ret)
+		return ret;
+
+	ret = nvme_rdma_reg_read(ctrl, NVME_REG_CAP, true, &cap);
+	if (ret)
+		return ret;
+	ctrl->queue_size = min_t(int, ctrl->queue_size, NVME_CAP_MQES(cap) + 1);
+	ret = nvme_rdma_enable_ctrl(ctrl, cap);
+	if (ret)
+		return ret;
+
+	id = kmalloc(sizeof(*id), GFP_KERNEL);
+	if (!id)
+		return -ENOMEM;
+	ret = nvme_rdma_identify(ctrl, 0, 1, id);
+	if (ret)
+		goto out_free_id;
+	if (!(le32_to_cpu(id->sgls) & NVME_CTRL_SGLS_KEYED)) {
+		dev_err(&ctrl->device->dev,
+			"controller does not support keyed SGLs\n");
+		ret = -EINVAL;
+		goto out_free_id;
+	}
+	nn = le32_to_cpu(id->nn);
+	ctrl->vwc = id->vwc;
+	memcpy(ctrl->serial, id->sn, sizeof(id->sn));
+	memcpy(ctrl->model, id->mn, sizeof(id->mn));
+	shift = NVME_CAP_MPSMIN(cap) + 12;
+	ctrl->max_hw_sectors = (NVME_RDMA_MAX_PAGES - 1) << (PAGE_SHIFT - 9);
+	if (id->mdts)
+		ctrl->max_hw_sectors = min_t(u32, ctrl->max_hw_sectors,
+				1 << (id->mdts + shift - 9));
+
+	memset(&c, 0, sizeof(c));
+	c.features.opcode = nvme_admin_set_features;
+	c.features.fid = cpu_to_le32(NVME_FEAT_NUM_QUEUES);
+	c.features.dword11 = cpu_to_le32((nr_io_queues - 1) |
+			(nr_io_queues - 1) << 16);
+	ret = nvme_rdma_sync_cmd(&ctrl->queues[0], &c, NULL, 0, &result);
+	if (ret)
+		goto out_free_id;
+	nr_io_queues = min_t(unsigned int, nr_io_queues,
+			min(result & 0xffff, (result >> 16) & 0xffff) + 1);
+
+	for (i = 1; i <= nr_io_queues; i++) {
+		ret = nvme_rdma_init_queue(ctrl, i, ctrl->queue_size);
+		if (ret)
+			goto out_free_id;
+	}
+
+	ctrl->tagset.ops = &nvme_rdma_mq_ops;
+	ctrl->tagset.nr_hw_queues = nr_io_queues;
+	ctrl->tagset.queue_depth = ctrl->queue_size - 1;
+	ctrl->tagset.numa_node = NUMA_NO_NODE;
+	ctrl->tagset.timeout = nvme_rdma_timeout_secs * HZ;
+	ctrl->tagset.cmd_size = sizeof(struct nvme_rdma_request);
+	ctrl->tagset.flags = BLK_MQ_F_SHOULD_MERGE;
+	ctrl->tagset.driver_data = ctrl;
+	ret = blk_mq_alloc_tag_set(&ctrl->tagset);
+	if (ret)
+		goto out_free_id;
+	ctrl->tagset_allocated = true;
+
+	dev_info(&ctrl->device->dev,
+		"nvmef%d: %.40s over %pI4:%u, %u I/O queues of %d\n",
+		ctrl->instance, ctrl->model, &ctrl->addr.sin_addr.s_addr,
+		ntohs(ctrl->addr.sin_port), nr_io_queues, ctrl->queue_size);
+
+	for (i = 1; i <= nn; i++) {
+		if (nvme_rdma_identify(ctrl, i, 0, id))
+			continue;
+		nvme_rdma_alloc_ns(ctrl, i, (struct nvme_id_ns *)id);
+	}
+
+ out_free_id:
+	kfree(id);
+	return ret;
+}
+
+/*
+ * Tear down a controller.  A controller that is still healthy has its
+ * disks removed while I/O can complete and is shut down cleanly; a failed
+ * one has its queues flushed first, which errors out whatever is pending.
+ */
+static void nvme_rdma_teardown_ctrl(struct nvme_rdma_ctrl *ctrl)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct nvme_ns *ns;
+	int i, j;
+
+	mutex_lock(&nvme_rdma_ctrl_mutex);
+	list_del_init(&ctrl->node);
+	mutex_unlock(&nvme_rdma_ctrl_mutex);
+
+	if (!ctrl->failed && ctrl->queue_count) {
+		nvme_rdma_remove_namespaces(ctrl);
+		nvme_rdma_shutdown_ctrl(ctrl);
+	}
+
+	mutex_lock(&ctrl->teardown_mutex);
+	for (i = ctrl->queue_count - 1; i >= 0; i--)
+		nvme_rdma_stop_queue(&ctrl->queues[i]);
+	mutex_unlock(&ctrl->teardown_mutex);
+
+	list_for_each_entry(ns, &ctrl->namespaces, list) {
+		queue_for_each_hw_ctx(ns->queue, hctx, j)
+			blk_mq_tag_busy_iter(hctx, nvme_rdma_cancel_request,
+					NULL);
+	}
+	nvme_rdma_remove_namespaces(ctrl);
+	if (ctrl->tagset_allocated)
+		blk_mq_free_tag_set(&ctrl->tagset);
+
+	mutex_lock(&ctrl->teardown_mutex);
+	for (i = ctrl->queue_count - 1; i >= 0; i--)
+		nvme_rdma_free_queue(&ctrl->queues[i]);
+	mutex_unlock(&ctrl->teardown_mutex);
+	cancel_work_sync(&ctrl->err_work);
+
+	if (ctrl->mr)
+		ib_dereg_mr(ctrl->mr);
+	if (ctrl->pd)
+		ib_dealloc_pd(ctrl->pd);
+	kfree(ctrl->queues);
+	ida_simple_remove(&nvme_rdma_instance_ida, ctrl->instance);
+}
+
+static void nvme_rdma_delete_ctrl_work(struct work_struct *work)
+{
+	struct nvme_rdma_ctrl *ctrl =
+		container_of(work, struct nvme_rdma_ctrl, delete_work);
+
+	nvme_rdma_teardown_ctrl(ctrl);
+	kfree(ctrl);
+}
+
+static void nvme_rdma_delete_ctrl(struct nvme_rdma_ctrl *ctrl)
+{
+	if (!test_and_set_bit(0, &ctrl->deleting))
+		queue_work(nvme_rdma_wq, &ctrl->delete_work);
+}
+
+/*
+ * Disconnecting moves every QP to the error state, which flushes all
+ * outstanding work requests back to us so the commands can be failed.
+ */
+static void nvme_rdma_err_work(struct work_struct *work)
+{
+	struct nvme_rdma_ctrl *ctrl =
+		container_of(work, struct nvme_rdma_ctrl, err_work);
+	struct nvme_rdma_queue *queue;
+	int i;
+
+	mutex_lock(&ctrl->teardown_mutex);
+	for (i = 0; i < ctrl->queue_count; i++) {
+		queue = &ctrl->queues[i];
+		spin_lock(&queue->lock);
+		clear_bit(NVME_RDMA_Q_LIVE, &queue->flags);
+		spin_unlock(&queue->lock);
+		if (queue->cm_id &&
+		    test_bit(NVME_RDMA_Q_CONNECTED, &queue->flags))
+			rdma_disconnect(queue->cm_id);
+	}
+	mutex_unlock(&ctrl->teardown_mutex);
+
+	nvme_rdma_delete_ctrl(ctrl);
+}
+
+enum {
+	NVMF_OPT_ERR,
+	NVMF_OPT_TRADDR,
+	NVMF_OPT_TRSVCID,
+	NVMF_OPT_NQN,
+	NVMF_OPT_HOSTNQN,
+	NVMF_OPT_NR_IO_QUEUES,
+	NVMF_OPT_QUEUE_SIZE,
+	NVMF_OPT_DELETE,
+};
+
+static const match_table_t opt_tokens = {
+	{ NVMF_OPT_TRADDR,		"traddr=%s"		},
+	{ NVMF_OPT_TRSVCID,		"trsvcid=%d"		},
+	{ NVMF_OPT_NQN,			"nqn=%s"		},
+	{ NVMF_OPT_HOSTNQN,		"hostnqn=%s"		},
+	{ NVMF_OPT_NR_IO_QUEUES,	"nr_io_queues=%d"	},
+	{ NVMF_OPT_QUEUE_SIZE,		"queue_size=%d"		},
+	{ NVMF_OPT_DELETE,		"delete=%d"		},
+	{ NVMF_OPT_ERR,			NULL			}
+};
+
+static int nvme_rdma_delete_instance(int instance)
+{
+	struct nvme_rdma_ctrl *ctrl;
+	int ret = -ENODEV;
+
+	mutex_lock(&nvme_rdma_ctrl_mutex);
+	list_for_each_entry(ctrl, &nvme_rdma_ctrls, node) {
+		if (ctrl->instance == instance) {
+			nvme_rdma_delete_ctrl(ctrl);
+			ret = 0;
+			break;
+		}
+	}
+	mutex_unlock(&nvme_rdma_ctrl_mutex);
+	return ret;
+}
+
+static int nvme_rdma_parse_options(struct nvme_rdma_ctrl *ctrl, char *buf,
+		unsigned int *nr_io_queues, int *delete)
+{
+	substring_t args[MAX_OPT_ARGS];
+	bool have_addr = false;
+	char *p, *o;
+	int token, val;
+
+	while ((p = strsep(&buf, ",\n")) != NULL) {
+		if (!*p)
+			continue;
+
+		token = match_token(p, opt_tokens, args);
+		switch (token) {
+		case NVMF_OPT_TRADDR:
+			o = match_strdup(args);
+			if (!o)
+				return -ENOMEM;
+			have_addr = in4_pton(o, -1,
+					(u8 *)&ctrl->addr.sin_addr.s_addr,
+					'\0', NULL);
+			kfree(o);
+			if (!have_addr)
+				return -EINVAL;
+			break;
+		case NVMF_OPT_TRSVCID:
+			if (match_int(args, &val) || val <= 0 || val > 65535)
+				return -EINVAL;
+			ctrl->addr.sin_port = htons(val);
+			break;
+		case NVMF_OPT_NQN:
+		case NVMF_OPT_HOSTNQN:
+			o = match_strdup(args);
+			if (!o)
+				return -ENOMEM;
+			strlcpy(token == NVMF_OPT_NQN ? ctrl->subsysnqn :
+					ctrl->hostnqn, o, NVMF_NQN_SIZE);
+			kfree(o);
+			break;
+		case NVMF_OPT_NR_IO_QUEUES:
+			if (match_int(args, &val) || val <= 0)
+				return -EINVAL;
+			*nr_io_queues = min_t(unsigned int, val,
+					num_online_cpus());
+			break;
+		case NVMF_OPT_QUEUE_SIZE:
+			if (match_int(args, &val) || val < 2 ||
+			    val > BLK_MQ_MAX_DEPTH)
+				return -EINVAL;
+			ctrl->queue_size = val;
+			break;
+		case NVMF_OPT_DELETE:
+			if (match_int(args, &val) || val < 0)
+				return -EINVAL;
+			*delete = val;
+			return 0;
+		default:
+			pr_warn("nvme-rdma: unknown option \"%s\"\n", p);
+			return -EINVAL;
+		}
+	}
+
+	if (!have_addr || !ctrl->subsysnqn[0])
+		return -EINVAL;
+	return 0;
+}
+
+static ssize_t nvme_rdma_dev_write(struct file *file, const char __user *ubuf,
+		size_t count, loff_t *pos)
+{
+	struct nvme_rdma_ctrl *ctrl;
+	unsigned int nr_io_queues = num_online_cpus();
+	int delete = -1, ret;
+	char *buf;
+
+	if (count > PAGE_SIZE - 1)
+		return -EINVAL;
+	buf = kzalloc(count + 1, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	if (copy_from_user(buf, ubuf, count)) {
+		kfree(buf);
+		return -EFAULT;
+	}
+
+	ctrl = kzalloc(sizeof(*ctrl), GFP_KERNEL);
+	if (!ctrl) {
+		kfree(buf);
+		return -ENOMEM;
+	}
+	INIT_LIST_HEAD(&ctrl->node);
+	INIT_LIST_HEAD(&ctrl->namespaces);
+	INIT_WORK(&ctrl->delete_work, nvme_rdma_delete_ctrl_work);
+	INIT_WORK(&ctrl->err_work, nvme_rdma_err_work);
+	mutex_init(&ctrl->teardown_mutex);
+	ctrl->addr.sin_family = AF_INET;
+	ctrl->addr.sin_port = htons(NVME_RDMA_IP_PORT);
+	ctrl->queue_size = NVME_RDMA_DEF_QUEUE_SIZE;
+	strlcpy(ctrl->hostnqn, nvme_rdma_default_hostnqn, NVMF_NQN_SIZE);
+
+	ret = nvme_rdma_parse_options(ctrl, buf, &nr_io_queues, &delete);
+	kfree(buf);
+	if (!ret && delete >= 0)
+		ret = nvme_rdma_delete_instance(delete);
+	if (ret || delete >= 0) {
+		kfree(ctrl);
+		return ret ? ret : count;
+	}
+
+	ctrl->instance = ida_simple_get(&nvme_rdma_instance_ida, 0, 0,
+			GFP_KERNEL);
+	if (ctrl->instance < 0) {
+		ret = ctrl->instance;
+		kfree(ctrl);
+		return ret;
+	}
+
+	/* Errors during setup are handled here, not by the delete work */
+	set_bit(0, &ctrl->deleting);
+	ret = nvme_rdma_setup_ctrl(ctrl, nr_io_queues);
+	if (ret) {
+		ctrl->failed = true;
+		nvme_rdma_teardown_ctrl(ctrl);
+		kfree(ctrl);
+		return ret;
+	}
+
+	mutex_lock(&nvme_rdma_ctrl_mutex);
+	list_add_tail(&ctrl->node, &nvme_rdma_ctrls);
+	clear_bit(0, &ctrl->deleting);
+	if (ctrl->failed)
+		nvme_rdma_delete_ctrl(ctrl);
+	mutex_unlock(&nvme_rdma_ctrl_mutex);
+	return count;
+}
+
+static const struct file_operations nvme_rdma_dev_fops = {
+	.owner		= THIS_MODULE,
+	.write		= nvme_rdma_dev_write,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice nvme_rdma_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "nvme-fabrics",
+	.fops		= &nvme_rdma_dev_fops,
+};
+
+static int __init nvme_rdma_init(void)
+{
+	int ret;
+
+	nvme_rdma_wq = alloc_workqueue("nvme_rdma_wq", WQ_MEM_RECLAIM, 0);
+	if (!nvme_rdma_wq)
+		return -ENOMEM;
+
+	generate_random_uuid(nvme_rdma_hostid);
+	snprintf(nvme_rdma_default_hostnqn, NVMF_NQN_SIZE,
+		"nqn.2014-08.org.nvmexpress:NVMf:uuid:%pUb", nvme_rdma_hostid);
+
+	ret = misc_register(&nvme_rdma_misc);
+	if (ret)
+		destroy_workqueue(nvme_rdma_wq);
+	return ret;
+}
+
+static void __exit nvme_rdma_exit(void)
+{
+	struct nvme_rdma_ctrl *ctrl;
+
+	misc_deregister(&nvme_rdma_misc);
+
+	mutex_lock(&nvme_rdma_ctrl_mutex);
+	list_for_each_entry(ctrl, &nvme_rdma_ctrls, node)
+		nvme_rdma_delete_ctrl(ctrl);
+	mutex_unlock(&nvme_rdma_ctrl_mutex);
+
+	flush_workqueue(nvme_rdma_wq);
+	destroy_workqueue(nvme_rdma_wq);
+}
+
+MODULE_LICENSE("GPL");
+module_init(nvme_rdma_init);
+module_exit(nvme_rdma_exit);
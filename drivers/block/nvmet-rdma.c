@@ -0,0 +1,1401 @@
+/*
+ * NVM Express over Fabrics RDMA target
+ *
+ * Exports one block device as namespace 1 of an NVM subsystem to hosts
+ * connecting over RDMA.  Every queue is an RDMA connection with command
+ * capsules received into pre-posted buffers; data is moved with RDMA READ
+ * and WRITE against the host's keyed SGL, and completions are sent back
+ * as SENDs.  Command processing runs from a workqueue that polls the
+ * completion queue, so backing I/O can be submitted from process context.
+ *
+ * The subsystem is configured with module parameters, e.g.
+ *
+ *	modprobe nvmet-rdma bdev=/dev/sdb addr=192.168.1.10 nqn=testnqn
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#include <linux/nvme.h>
+#include <linux/nvme-rdma.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/fs.h>
+#include <linux/idr.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/kernel.h>
+#include <linux/kref.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <asm/unaligned.h>
+#include <rdma/ib_verbs.h>
+#include <rdma/rdma_cm.h>
+
+#define NVMET_RDMA_MAX_QUEUE_SIZE	128
+#define NVMET_RDMA_MAX_IO_QUEUES	64
+#define NVMET_RDMA_MAX_PAGES		128
+#define NVMET_RDMA_MAX_SGE		16
+#define NVMET_RDMA_BACKLOG		128
+#define NVMET_RDMA_BDEV_MODE	(FMODE_READ | FMODE_WRITE | FMODE_EXCL)
+
+#define NVMET_RDMA_CMD_SIZE \
+	(sizeof(struct nvme_command) + NVME_RDMA_INLINE_DATA_SIZE)
+
+static char *nvmet_rdma_bdev_path;
+module_param_named(bdev, nvmet_rdma_bdev_path, charp, 0444);
+MODULE_PARM_DESC(bdev, "block device exported as namespace 1");
+
+static char *nvmet_rdma_addr = "0.0.0.0";
+module_param_named(addr, nvmet_rdma_addr, charp, 0444);
+MODULE_PARM_DESC(addr, "IPv4 address to listen on (default: any)");
+
+static ushort nvmet_rdma_port = NVME_RDMA_IP_PORT;
+module_param_named(port, nvmet_rdma_port, ushort, 0444);
+MODULE_PARM_DESC(port, "port to listen on (default: 4420)");
+
+static char *nvmet_rdma_nqn = "nqn.2014-08.org.nvmexpress:NVMf:testnqn";
+module_param_named(nqn, nvmet_rdma_nqn, charp, 0444);
+MODULE_PARM_DESC(nqn, "NVMe qualified name of the subsystem");
+
+struct nvmet_rdma_queue;
+
+/* The wr_id of every signaled work request points at one of these */
+struct nvmet_rdma_qe {
+	void (*done)(struct nvmet_rdma_queue *queue, struct nvmet_rdma_qe *qe,
+			struct ib_wc *wc);
+};
+
+/* A receive buffer for one command capsule */
+struct nvmet_rdma_cmd {
+	struct nvmet_rdma_qe qe;
+	struct nvme_command *nvme_cmd;
+	u64 dma;
+};
+
+/*
+ * The state of one command from its arrival to the send of its response.
+ * Each receive buffer has a response of its own, and the buffer is posted
+ * again only once that response has gone out.
+ */
+struct nvmet_rdma_rsp {
+	struct nvmet_rdma_qe read_qe;
+	struct nvmet_rdma_qe send_qe;
+	struct list_head wait_entry;
+	struct nvmet_rdma_queue *queue;
+	struct nvmet_rdma_cmd *cmd;
+
+	struct nvme_completion cqe;
+	u64 cqe_dma;
+	u16 status;
+	u64 result;
+
+	/* Data of the command, either inline in the capsule or in pages */
+	bool to_ctrl;
+	u32 data_len;
+	void *inline_data;
+	u64 remote_addr;
+	u32 rkey;
+	int nr_pages;
+	struct page *pages[NVMET_RDMA_MAX_PAGES];
+	struct ib_sge sge[NVMET_RDMA_MAX_PAGES];
+
+	/* RDMA READs or WRITEs, followed by the response SEND */
+	struct ib_send_wr *rdma_wrs;
+	int n_rdma;
+	bool reading;
+	int n_wrs;
+	struct ib_send_wr send_wr;
+	struct ib_sge send_sge;
+	struct bio *bio;
+};
+
+struct nvmet_rdma_device {
+	struct list_head entry;
+	struct kref ref;
+	struct ib_device *device;
+	struct ib_pd *pd;
+	struct ib_mr *mr;
+	struct ib_device_attr attr;
+};
+
+struct nvmet_rdma_ctrl {
+	struct list_head entry;
+	struct kref ref;
+	u16 cntlid;
+	char hostnqn[NVMF_NQN_SIZE];
+	u32 cc;
+	u32 csts;
+	unsigned int nr_io_queues;
+};
+
+enum {
+	NVMET_RDMA_Q_RELEASING,
+};
+
+struct nvmet_rdma_queue {
+	struct list_head entry;
+	struct nvmet_rdma_device *dev;
+	struct rdma_cm_id *cm_id;
+	struct ib_cq *cq;
+	struct ib_qp *qp;
+	u16 qid;
+	int size;
+	int max_sge;
+	unsigned long flags;
+	struct nvmet_rdma_ctrl *ctrl;
+
+	struct nvmet_rdma_cmd *cmds;
+	struct nvmet_rdma_rsp *rsps;
+
+	/* Send queue slots, handed out to responses as they post */
+	spinlock_t wr_lock;
+	int sq_wr_avail;
+	struct list_head wr_wait_list;
+
+	atomic_t inflight;
+	wait_queue_head_t inflight_wait;
+
+	struct work_struct poll_work;
+	struct work_struct release_work;
+	struct nvmet_rdma_qe drain_qe;
+	struct completion drained;
+};
+
+static struct rdma_cm_id *nvmet_rdma_listener;
+static struct workqueue_struct *nvmet_rdma_wq;
+static LIST_HEAD(nvmet_rdma_queues);
+static LIST_HEAD(nvmet_rdma_devices);
+static LIST_HEAD(nvmet_rdma_ctrls);
+static DEFINE_MUTEX(nvmet_rdma_mutex);
+static DEFINE_IDA(nvmet_rdma_cntlid_ida);
+
+static struct block_device *nvmet_rdma_bdev;
+static int nvmet_rdma_lba_shift;
+static u64 nvmet_rdma_nr_blocks;
+static char nvmet_rdma_serial[20];
+
+static void nvmet_rdma_execute(struct nvmet_rdma_rsp *rsp);
+static void nvmet_rdma_complete(struct nvmet_rdma_rsp *rsp, u16 status);
+
+static void nvmet_rdma_queue_disconnect(struct nvmet_rdma_queue *queue)
+{
+	if (!test_and_set_bit(NVMET_RDMA_Q_RELEASING, &queue->flags))
+		queue_work(nvmet_rdma_wq, &queue->release_work);
+}
+
+static int nvmet_rdma_post_recv(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_cmd *cmd)
+{
+	struct ib_recv_wr wr, *bad_wr;
+	struct ib_sge sge;
+
+	sge.addr = cmd->dma;
+	sge.length = NVMET_RDMA_CMD_SIZE;
+	sge.lkey = queue->dev->mr->lkey;
+
+	wr.next = NULL;
+	wr.wr_id = (uintptr_t)&cmd->qe;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+
+	ib_dma_sync_single_for_device(queue->dev->device, cmd->dma,
+			NVMET_RDMA_CMD_SIZE, DMA_FROM_DEVICE);
+	return ib_post_recv(queue->qp, &wr, &bad_wr);
+}
+
+static void nvmet_rdma_free_pages(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *rsp)
+{
+	enum dma_data_direction dir =
+		rsp->to_ctrl ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	int i;
+
+	for (i = 0; i < rsp->nr_pages; i++) {
+		ib_dma_unmap_page(queue->dev->device, rsp->sge[i].addr,
+				PAGE_SIZE, dir);
+		__free_page(rsp->pages[i]);
+	}
+	rsp->nr_pages = 0;
+}
+
+static int nvmet_rdma_alloc_pages(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *rsp)
+{
+	enum dma_data_direction dir =
+		rsp->to_ctrl ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	int nr_pages = DIV_ROUND_UP(rsp->data_len, PAGE_SIZE);
+	u32 len = rsp->data_len;
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		rsp->pages[i] = alloc_page(GFP_KERNEL);
+		if (!rsp->pages[i])
+			goto out_free;
+		rsp->sge[i].addr = ib_dma_map_page(queue->dev->device,
+				rsp->pages[i], 0, PAGE_SIZE, dir);
+		if (ib_dma_mapping_error(queue->dev->device,
+					 rsp->sge[i].addr)) {
+			__free_page(rsp->pages[i]);
+			goto out_free;
+		}
+		rsp->sge[i].length = min_t(u32, len, PAGE_SIZE);
+		rsp->sge[i].lkey = queue->dev->mr->lkey;
+		len -= rsp->sge[i].length;
+		rsp->nr_pages++;
+	}
+	return 0;
+
+ out_free:
+	nvmet_rdma_free_pages(queue, rsp);
+	return -ENOMEM;
+}
+
+/* Copy between the command's data and a kernel buffer */
+static void nvmet_rdma_copy_data(struct nvmet_rdma_rsp *rsp, void *buf,
+		u32 len, bool to_buf)
+{
+	int i;
+
+	len = min(len, rsp->data_len);
+	if (rsp->inline_data) {
+		if (to_buf)
+			memcpy(buf, rsp->inline_data, len);
+		else
+			memcpy(rsp->inline_data, buf, len);
+		return;
+	}
+
+	for (i = 0; len; i++) {
+		u32 n = min_t(u32, len, PAGE_SIZE);
+
+		if (to_buf)
+			memcpy(buf, page_address(rsp->pages[i]), n);
+		else
+			memcpy(page_address(rsp->pages[i]), buf, n);
+		buf += n;
+		len -= n;
+	}
+}
+
+static void nvmet_rdma_build_rdma_wrs(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *rsp, enum ib_wr_opcode opcode)
+{
+	struct ib_send_wr *wr = NULL;
+	int i;
+
+	rsp->n_rdma = 0;
+	for (i = 0; i < rsp->nr_pages; i += queue->max_sge) {
+		if (wr)
+			wr->next = &rsp->rdma_wrs[rsp->n_rdma];
+		wr = &rsp->rdma_wrs[rsp->n_rdma++];
+		memset(wr, 0, sizeof(*wr));
+		wr->opcode = opcode;
+		wr->sg_list = &rsp->sge[i];
+		wr->num_sge = min(queue->max_sge, rsp->nr_pages - i);
+		wr->wr.rdma.remote_addr = rsp->remote_addr +
+				(u64)i * PAGE_SIZE;
+		wr->wr.rdma.rkey = rsp->rkey;
+	}
+}
+
+static void nvmet_rdma_release_rsp(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *rsp, bool repost)
+{
+	nvmet_rdma_free_pages(queue, rsp);
+	if (repost && nvmet_rdma_post_recv(queue, rsp->cmd))
+		nvmet_rdma_queue_disconnect(queue);
+	if (atomic_dec_and_test(&queue->inflight))
+		wake_up(&queue->inflight_wait);
+}
+
+static void nvmet_rdma_post_wrs(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *rsp)
+{
+	struct ib_send_wr *first, *bad_wr;
+	unsigned long flags;
+
+	if (rsp->reading) {
+		first = rsp->rdma_wrs;
+	} else {
+		first = rsp->n_rdma ? rsp->rdma_wrs : &rsp->send_wr;
+		if (rsp->n_rdma)
+			rsp->rdma_wrs[rsp->n_rdma - 1].next = &rsp->send_wr;
+	}
+
+	if (likely(!ib_post_send(queue->qp, first, &bad_wr)))
+		return;
+
+	pr_err("nvmet-rdma: post send failed on queue %d\n", queue->qid);
+	spin_lock_irqsave(&queue->wr_lock, flags);
+	queue->sq_wr_avail += rsp->n_wrs;
+	spin_unlock_irqrestore(&queue->wr_lock, flags);
+	nvmet_rdma_queue_disconnect(queue);
+	nvmet_rdma_release_rsp(queue, rsp, false);
+}
+
+/*
+ * Post the work requests of @rsp if the send queue has room for them, or
+ * park it until enough earlier work requests have completed.  Work
+ * requests are posted in the order they were asked for.
+ */
+static void nvmet_rdma_queue_wrs(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *rsp)
+{
+	unsigned long flags;
+
+	rsp->n_wrs = rsp->reading ? rsp->n_rdma : rsp->n_rdma + 1;
+
+	spin_lock_irqsave(&queue->wr_lock, flags);
+	if (!list_empty(&queue->wr_wait_list) ||
+	    queue->sq_wr_avail < rsp->n_wrs) {
+		list_add_tail(&rsp->wait_entry, &queue->wr_wait_list);
+		spin_unlock_irqrestore(&queue->wr_lock, flags);
+		return;
+	}
+	queue->sq_wr_avail -= rsp->n_wrs;
+	spin_unlock_irqrestore(&queue->wr_lock, flags);
+
+	nvmet_rdma_post_wrs(queue, rsp);
+}
+
+static void nvmet_rdma_put_wrs(struct nvmet_rdma_queue *queue, int n_wrs)
+{
+	struct nvmet_rdma_rsp *rsp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->wr_lock, flags);
+	queue->sq_wr_avail += n_wrs;
+	while (!list_empty(&queue->wr_wait_list)) {
+		rsp = list_first_entry(&queue->wr_wait_list,
+				struct nvmet_rdma_rsp, wait_entry);
+		if (queue->sq_wr_avail < rsp->n_wrs)
+			break;
+		queue->sq_wr_avail -= rsp->n_wrs;
+		list_del(&rsp->wait_entry);
+		spin_unlock_irqrestore(&queue->wr_lock, flags);
+
+		nvmet_rdma_post_wrs(queue, rsp);
+
+		spin_lock_irqsave(&queue->wr_lock, flags);
+	}
+	spin_unlock_irqrestore(&queue->wr_lock, flags);
+}
+
+static void nvmet_rdma_read_done(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_qe *qe, struct ib_wc *wc)
+{
+	struct nvmet_rdma_rsp *rsp =
+		container_of(qe, struct nvmet_rdma_rsp, read_qe);
+	int i;
+
+	nvmet_rdma_put_wrs(queue, rsp->n_wrs);
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR) {
+			pr_err("nvmet-rdma: RDMA READ failed on queue %d: %d\n",
+				queue->qid, wc->status);
+			nvmet_rdma_queue_disconnect(queue);
+		}
+		nvmet_rdma_release_rsp(queue, rsp, false);
+		return;
+	}
+
+	for (i = 0; i < rsp->nr_pages; i++)
+		ib_dma_sync_single_for_cpu(queue->dev->device,
+				rsp->sge[i].addr, PAGE_SIZE, DMA_FROM_DEVICE);
+	nvmet_rdma_execute(rsp);
+}
+
+static void nvmet_rdma_send_done(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_qe *qe, struct ib_wc *wc)
+{
+	struct nvmet_rdma_rsp *rsp =
+		container_of(qe, struct nvmet_rdma_rsp, send_qe);
+	bool ok = wc->status == IB_WC_SUCCESS;
+
+	if (unlikely(!ok && wc->status != IB_WC_WR_FLUSH_ERR)) {
+		pr_err("nvmet-rdma: response failed on queue %d: %d\n",
+			queue->qid, wc->status);
+		nvmet_rdma_queue_disconnect(queue);
+	}
+
+	nvmet_rdma_release_rsp(queue, rsp, ok);
+	nvmet_rdma_put_wrs(queue, rsp->n_wrs);
+}
+
+static void nvmet_rdma_drain_done(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_qe *qe, struct ib_wc *wc)
+{
+	complete(&queue->drained);
+}
+
+/*
+ * Keyed SGLs are fetched or filled with RDMA; offset SGLs point into the
+ * capsule and are only accepted for data going to the controller.
+ */
+static u16 nvmet_rdma_map_sgl(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_rsp *rsp, u32 capsule_len)
+{
+	struct nvme_command *c = rsp->cmd->nvme_cmd;
+	struct nvme_keyed_sgl_desc *ksgl = &c->common.ksgl;
+	struct nvme_sgl_desc *sgl = &c->common.sgl;
+	u64 off;
+
+	if (!(c->common.flags & NVME_CMD_SGL_METABUF))
+		return NVME_SC_INVALID_FIELD | NVME_SC_DNR;
+
+	switch (sgl->type) {
+	case (NVME_KEY_SGL_FMT_DATA_DESC << 4) | NVME_SGL_FMT_ADDRESS:
+	case (NVME_KEY_SGL_FMT_DATA_DESC << 4) | NVME_SGL_FMT_INVALIDATE:
+		rsp->data_len = ksgl->length[0] | ksgl->length[1] << 8 |
+				ksgl->length[2] << 16;
+		if (!rsp->data_len)
+			return 0;
+		if (rsp->data_len > NVMET_RDMA_MAX_PAGES * PAGE_SIZE)
+			return NVME_SC_SGL_INVALID_DATA | NVME_SC_DNR;
+		rsp->remote_addr = le64_to_cpu(ksgl->addr);
+		rsp->rkey = get_unaligned_le32(ksgl->key);
+		if (nvmet_rdma_alloc_pages(queue, rsp))
+			return NVME_SC_INTERNAL;
+		return 0;
+	case (NVME_SGL_FMT_DATA_DESC << 4) | NVME_SGL_FMT_OFFSET:
+		off = le64_to_cpu(sgl->addr);
+		rsp->data_len = le32_to_cpu(sgl->length);
+		if (!rsp->to_ctrl || off > NVME_RDMA_INLINE_DATA_SIZE ||
+		    rsp->data_len > NVME_RDMA_INLINE_DATA_SIZE - off ||
+		    sizeof(*c) + off + rsp->data_len > capsule_len)
+			return NVME_SC_SGL_INVALID_DATA | NVME_SC_DNR;
+		rsp->inline_data = (void *)(c + 1) + off;
+		return 0;
+	default:
+		return NVME_SC_SGL_INVALID_TYPE | NVME_SC_DNR;
+	}
+}
+
+static bool nvmet_rdma_data_to_ctrl(struct nvme_command *c)
+{
+	if (c->common.opcode == nvme_fabrics_command)
+		return c->fabrics.fctype == nvme_fabrics_type_connect;
+	/* The low two opcode bits give the direction of the transfer */
+	return (c->common.opcode & 3) == 1;
+}
+
+static void nvmet_rdma_recv_done(struct nvmet_rdma_queue *queue,
+		struct nvmet_rdma_qe *qe, struct ib_wc *wc)
+{
+	struct nvmet_rdma_cmd *cmd =
+		container_of(qe, struct nvmet_rdma_cmd, qe);
+	struct nvmet_rdma_rsp *rsp = &queue->rsps[cmd - queue->cmds];
+	u16 status;
+
+	if (unlikely(wc->status != IB_WC_SUCCESS)) {
+		if (wc->status != IB_WC_WR_FLUSH_ERR) {
+			pr_err("nvmet-rdma: recv failed on queue %d: %d\n",
+				queue->qid, wc->status);
+			nvmet_rdma_queue_disconnect(queue);
+		}
+		return;
+	}
+	if (unlikely(wc->byte_len < sizeof(struct nvme_command))) {
+		pr_err("nvmet-rdma: short capsule on queue %d\n", queue->qid);
+		nvmet_rdma_queue_disconnect(queue);
+		return;
+	}
+
+	ib_dma_sync_single_for_cpu(queue->dev->device, cmd->dma,
+			NVMET_RDMA_CMD_SIZE, DMA_FROM_DEVICE);
+	atomic_inc(&queue->inflight);
+
+	rsp->cmd = cmd;
+	rsp->status = 0;
+	rsp->result = 0;
+	rsp->data_len = 0;
+	rsp->inline_data = NULL;
+	rsp->nr_pages = 0;
+	rsp->n_rdma = 0;
+	rsp->to_ctrl = nvmet_rdma_data_to_ctrl(cmd->nvme_cmd);
+
+	status = nvmet_rdma_map_sgl(queue, rsp, wc->byte_len);
+	if (status) {
+		nvmet_rdma_complete(rsp, status);
+		return;
+	}
+
+	if (rsp->to_ctrl && rsp->nr_pages) {
+		nvmet_rdma_build_rdma_wrs(queue, rsp, IB_WR_RDMA_READ);
+		rsp->rdma_wrs[rsp->n_rdma - 1].wr_id =
+				(uintptr_t)&rsp->read_qe;
+		rsp->rdma_wrs[rsp->n_rdma - 1].send_flags = IB_SEND_SIGNALED;
+		rsp->reading = true;
+		nvmet_rdma_queue_wrs(queue, rsp);
+		return;
+	}
+
+	nvmet_rdma_execute(rsp);
+}
+
+static void nvmet_rdma_handle_wc(struct nvmet_rdma_queue *queue,
+		struct ib_wc *wc)
+{
+	struct nvmet_rdma_qe *qe = (struct nvmet_rdma_qe *)(uintptr_t)wc->wr_id;
+
+	if (qe)
+		qe->done(queue, qe, wc);
+	/* An unsignaled RDMA WRITE only completes to report an error */
+	else if (wc->status != IB_WC_WR_FLUSH_ERR)
+		nvmet_rdma_queue_disconnect(queue);
+}
+
+static void nvmet_rdma_poll_work(struct work_struct *work)
+{
+	struct nvmet_rdma_queue *queue =
+		container_of(work, struct nvmet_rdma_queue, poll_work);
+	struct ib_wc wc[16];
+	int i, n;
+
+	do {
+		while ((n = ib_poll_cq(queue->cq, ARRAY_SIZE(wc), wc)) > 0) {
+			for (i = 0; i < n; i++)
+				nvmet_rdma_handle_wc(queue, &wc[i]);
+			cond_resched();
+		}
+	} while (ib_req_notify_cq(queue->cq, IB_CQ_NEXT_COMP |
+				  IB_CQ_REPORT_MISSED_EVENTS) > 0);
+}
+
+static void nvmet_rdma_cq_event(struct ib_cq *cq, void *cq_context)
+{
+	struct nvmet_rdma_queue *queue = cq_context;
+
+	queue_work(nvmet_rdma_wq, &queue->poll_work);
+}
+
+
+/*
+ * Send the response of @rsp, preceded by the RDMA WRITEs of its data if
+ * it has any for the host.  May be called from bio completion context.
+ */
+static void nvmet_rdma_complete(struct nvmet_rdma_rsp *rsp, u16 status)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	struct nvme_completion *cqe = &rsp->cqe;
+	int i;
+
+	memset(cqe, 0, sizeof(*cqe));
+	put_unaligned_le64(rsp->result, &cqe->result);
+	cqe->sq_id = cpu_to_le16(queue->qid);
+	cqe->command_id = rsp->cmd->nvme_cmd->common.command_id;
+	cqe->status = cpu_to_le16(status << 1);
+	ib_dma_sync_single_for_device(queue->dev->device, rsp->cqe_dma,
+			sizeof(*cqe), DMA_TO_DEVICE);
+
+	rsp->n_rdma = 0;
+	rsp->reading = false;
+	if (!status && !rsp->to_ctrl && rsp->nr_pages) {
+		for (i = 0; i < rsp->nr_pages; i++)
+			ib_dma_sync_single_for_device(queue->dev->device,
+					rsp->sge[i].addr, PAGE_SIZE,
+					DMA_TO_DEVICE);
+		nvmet_rdma_build_rdma_wrs(queue, rsp, IB_WR_RDMA_WRITE);
+	}
+
+	nvmet_rdma_queue_wrs(queue, rsp);
+}
+
+static u64 nvmet_rdma_cap(void)
+{
+	/* Contiguous queues, a 7.5 second timeout and the NVM command set */
+	return (NVMET_RDMA_MAX_QUEUE_SIZE - 1) | 1ULL << 16 | 15ULL << 24 |
+		1ULL << 37;
+}
+
+static void nvmet_rdma_set_cc(struct nvmet_rdma_ctrl *ctrl, u32 cc)
+{
+	ctrl->cc = cc;
+	if (!(cc & NVME_CC_ENABLE))
+		ctrl->csts = 0;
+	else
+		ctrl->csts |= NVME_CSTS_RDY;
+	if (cc & NVME_CC_SHN_MASK)
+		ctrl->csts |= NVME_CSTS_SHST_CMPLT;
+}
+
+static void nvmet_rdma_free_ctrl(struct kref *ref)
+{
+	struct nvmet_rdma_ctrl *ctrl =
+		container_of(ref, struct nvmet_rdma_ctrl, ref);
+
+	list_del(&ctrl->entry);
+	ida_simple_remove(&nvmet_rdma_cntlid_ida, ctrl->cntlid);
+	kfree(ctrl);
+}
+
+static void nvmet_rdma_put_ctrl(struct nvmet_rdma_ctrl *ctrl)
+{
+	mutex_lock(&nvmet_rdma_mutex);
+	kref_put(&ctrl->ref, nvmet_rdma_free_ctrl);
+	mutex_unlock(&nvmet_rdma_mutex);
+}
+
+static u16 nvmet_rdma_connect_ctrl(struct nvmet_rdma_queue *queue,
+		struct nvmf_connect_data *d)
+{
+	struct nvmet_rdma_ctrl *ctrl;
+	u16 cntlid = le16_to_cpu(d->cntlid);
+	int ret;
+
+	mutex_lock(&nvmet_rdma_mutex);
+	if (queue->qid) {
+		list_for_each_entry(ctrl, &nvmet_rdma_ctrls, entry) {
+			if (ctrl->cntlid != cntlid ||
+			    strcmp(ctrl->hostnqn, d->hostnqn))
+				continue;
+			if (!(ctrl->csts & NVME_CSTS_RDY) ||
+			    queue->qid > ctrl->nr_io_queues)
+				break;
+			kref_get(&ctrl->ref);
+			queue->ctrl = ctrl;
+			mutex_unlock(&nvmet_rdma_mutex);
+			return 0;
+		}
+		mutex_unlock(&nvmet_rdma_mutex);
+		return NVME_SC_CONNECT_INVALID_PARAM | NVME_SC_DNR;
+	}
+
+	ret = -ENOMEM;
+	ctrl = kzalloc(sizeof(*ctrl), GFP_KERNEL);
+	if (ctrl)
+		ret = ida_simple_get(&nvmet_rdma_cntlid_ida, 1, 0xfff0,
+				GFP_KERNEL);
+	if (ret < 0) {
+		mutex_unlock(&nvmet_rdma_mutex);
+		kfree(ctrl);
+		return NVME_SC_CONNECT_CTRL_BUSY | NVME_SC_DNR;
+	}
+	kref_init(&ctrl->ref);
+	ctrl->cntlid = ret;
+	ctrl->nr_io_queues = 1;
+	strlcpy(ctrl->hostnqn, d->hostnqn, NVMF_NQN_SIZE);
+	list_add_tail(&ctrl->entry, &nvmet_rdma_ctrls);
+	queue->ctrl = ctrl;
+	mutex_unlock(&nvmet_rdma_mutex);
+
+	pr_info("nvmet-rdma: controller %d created for %s\n", ctrl->cntlid,
+		ctrl->hostnqn);
+	return 0;
+}
+
+static u16 nvmet_rdma_exec_connect(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	struct nvmf_connect_command *c = &rsp->cmd->nvme_cmd->connect;
+	struct nvmf_connect_data *d;
+	u16 status;
+
+	if (queue->ctrl)
+		return NVME_SC_CMD_SEQ_ERROR | NVME_SC_DNR;
+	if (le16_to_cpu(c->recfmt))
+		return NVME_SC_CONNECT_FORMAT | NVME_SC_DNR;
+	if (le16_to_cpu(c->qid) != queue->qid ||
+	    rsp->data_len < sizeof(*d))
+		return NVME_SC_CONNECT_INVALID_PARAM | NVME_SC_DNR;
+
+	d = kmalloc(sizeof(*d), GFP_KERNEL);
+	if (!d)
+		return NVME_SC_INTERNAL;
+	nvmet_rdma_copy_data(rsp, d, sizeof(*d), true);
+	d->subsysnqn[NVMF_NQN_SIZE - 1] = '\0';
+	d->hostnqn[NVMF_NQN_SIZE - 1] = '\0';
+
+	if (strcmp(d->subsysnqn, nvmet_rdma_nqn)) {
+		pr_warn("nvmet-rdma: connect to unknown subsystem %s\n",
+			d->subsysnqn);
+		status = NVME_SC_CONNECT_INVALID_PARAM | NVME_SC_DNR;
+	} else if (!queue->qid && le16_to_cpu(d->cntlid) != 0xffff) {
+		status = NVME_SC_CONNECT_INVALID_PARAM | NVME_SC_DNR;
+	} else {
+		status = nvmet_rdma_connect_ctrl(queue, d);
+	}
+	kfree(d);
+
+	if (!status)
+		rsp->result = queue->ctrl->cntlid;
+	return status;
+}
+
+static u16 nvmet_rdma_exec_fabrics(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvme_command *c = rsp->cmd->nvme_cmd;
+	struct nvmet_rdma_ctrl *ctrl = rsp->queue->ctrl;
+
+	if (c->fabrics.fctype == nvme_fabrics_type_connect)
+		return nvmet_rdma_exec_connect(rsp);
+	if (!ctrl || rsp->queue->qid)
+		return NVME_SC_CMD_SEQ_ERROR | NVME_SC_DNR;
+
+	switch (c->fabrics.fctype) {
+	case nvme_fabrics_type_property_get:
+		switch (le32_to_cpu(c->prop_get.offset)) {
+		case NVME_REG_CAP:
+			rsp->result = nvmet_rdma_cap();
+			return 0;
+		case NVME_REG_VS:
+			rsp->result = 0x00010200;
+			return 0;
+		case NVME_REG_CC:
+			rsp->result = ctrl->cc;
+			return 0;
+		case NVME_REG_CSTS:
+			rsp->result = ctrl->csts;
+			return 0;
+		}
+		break;
+	case nvme_fabrics_type_property_set:
+		if (le32_to_cpu(c->prop_set.offset) == NVME_REG_CC) {
+			nvmet_rdma_set_cc(ctrl, le64_to_cpu(c->prop_set.value));
+			return 0;
+		}
+		break;
+	}
+	return NVME_SC_INVALID_FIELD | NVME_SC_DNR;
+}
+
+static void nvmet_rdma_identify_ctrl(struct nvme_id_ctrl *id)
+{
+	static const char model[] = "Linux NVMe RDMA target";
+
+	memcpy(id->sn, nvmet_rdma_serial, sizeof(id->sn));
+	memset(id->mn, ' ', sizeof(id->mn));
+	memcpy(id->mn, model, sizeof(model) - 1);
+	memset(id->fr, ' ', sizeof(id->fr));
+	id->rab = 6;
+	id->mdts = ilog2(NVMET_RDMA_MAX_PAGES * PAGE_SIZE / 4096);
+	id->sqes = (6 << 4) | 6;
+	id->cqes = (4 << 4) | 4;
+	id->nn = cpu_to_le32(1);
+	id->vwc = NVME_CTRL_VWC_PRESENT;
+	id->sgls = cpu_to_le32(NVME_CTRL_SGLS_SUPPORTED |
+			NVME_CTRL_SGLS_KEYED | NVME_CTRL_SGLS_OFFSET);
+	strlcpy(id->subnqn, nvmet_rdma_nqn, sizeof(id->subnqn));
+	id->ioccsz = cpu_to_le32(NVMET_RDMA_CMD_SIZE / 16);
+	id->iorcsz = cpu_to_le32(sizeof(struct nvme_completion) / 16);
+	id->msdbd = 1;
+}
+
+static void nvmet_rdma_identify_ns(struct nvme_id_ns *id)
+{
+	id->nsze = cpu_to_le64(nvmet_rdma_nr_blocks);
+	id->ncap = id->nsze;
+	id->nuse = id->nsze;
+	id->lbaf[0].ds = nvmet_rdma_lba_shift;
+}
+
+static u16 nvmet_rdma_exec_identify(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvme_identify *c = &rsp->cmd->nvme_cmd->identify;
+	void *id;
+
+	if (rsp->data_len < 4096)
+		return NVME_SC_SGL_INVALID_DATA | NVME_SC_DNR;
+
+	id = kzalloc(4096, GFP_KERNEL);
+	if (!id)
+		return NVME_SC_INTERNAL;
+
+	switch (le32_to_cpu(c->cns)) {
+	case 0:
+		if (le32_to_cpu(c->nsid) != 1) {
+			kfree(id);
+			return NVME_SC_INVALID_NS | NVME_SC_DNR;
+		}
+		nvmet_rdma_identify_ns(id);
+		break;
+	case 1:
+		nvmet_rdma_identify_ctrl(id);
+		break;
+	default:
+		kfree(id);
+		return NVME_SC_INVALID_FIELD | NVME_SC_DNR;
+	}
+
+	nvmet_rdma_copy_data(rsp, id, 4096, false);
+	kfree(id);
+	return 0;
+}
+
+static u16 nvmet_rdma_exec_admin(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvme_command *c = rsp->cmd->nvme_cmd;
+	struct nvmet_rdma_ctrl *ctrl = rsp->queue->ctrl;
+	u32 dword11, n;
+
+	switch (c->common.opcode) {
+	case nvme_admin_identify:
+		return nvmet_rdma_exec_identify(rsp);
+	case nvme_admin_set_features:
+	case nvme_admin_get_features:
+		switch (le32_to_cpu(c->features.fid) & 0xff) {
+		case NVME_FEAT_NUM_QUEUES:
+			if (c->common.opcode == nvme_admin_set_features) {
+				dword11 = le32_to_cpu(c->features.dword11);
+				n = min(dword11 & 0xffff, dword11 >> 16) + 1;
+				ctrl->nr_io_queues = min_t(u32, n,
+						NVMET_RDMA_MAX_IO_QUEUES);
+			}
+			n = ctrl->nr_io_queues - 1;
+			rsp->result = n | n << 16;
+			return 0;
+		case NVME_FEAT_VOLATILE_WC:
+			rsp->result = 1;
+			return 0;
+		}
+		return NVME_SC_INVALID_FIELD | NVME_SC_DNR;
+	case nvme_admin_abort_cmd:
+		/* Nothing is aborted, commands run to completion */
+		rsp->result = 1;
+		return 0;
+	default:
+		return NVME_SC_INVALID_OPCODE | NVME_SC_DNR;
+	}
+}
+
+static void nvmet_rdma_bio_done(struct bio *bio, int error)
+{
+	struct nvmet_rdma_rsp *rsp = bio->bi_private;
+
+	bio_put(bio);
+	nvmet_rdma_complete(rsp, error ? NVME_SC_INTERNAL | NVME_SC_DNR : 0);
+}
+
+static u16 nvmet_rdma_exec_io(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvme_rw_command *c = &rsp->cmd->nvme_cmd->rw;
+	u64 slba = le64_to_cpu(c->slba);
+	u32 nlb = le16_to_cpu(c->length) + 1;
+	struct bio *bio;
+	int rw, i;
+
+	if (le32_to_cpu(c->nsid) != 1)
+		return NVME_SC_INVALID_NS | NVME_SC_DNR;
+
+	switch (c->opcode) {
+	case nvme_cmd_flush:
+		rw = WRITE_FLUSH;
+		break;
+	case nvme_cmd_write:
+	case nvme_cmd_read:
+		if (slba >= nvmet_rdma_nr_blocks ||
+		    nlb > nvmet_rdma_nr_blocks - slba)
+			return NVME_SC_LBA_RANGE | NVME_SC_DNR;
+		if ((u64)nlb << nvmet_rdma_lba_shift != rsp->data_len ||
+		    !rsp->nr_pages)
+			return NVME_SC_SGL_INVALID_DATA | NVME_SC_DNR;
+		if (c->opcode == nvme_cmd_read)
+			rw = READ;
+		else if (le16_to_cpu(c->control) & NVME_RW_FUA)
+			rw = WRITE_FUA;
+		else
+			rw = WRITE;
+		break;
+	default:
+		return NVME_SC_INVALID_OPCODE | NVME_SC_DNR;
+	}
+
+	bio = bio_alloc(GFP_KERNEL, rsp->nr_pages);
+	if (!bio)
+		return NVME_SC_INTERNAL;
+	bio->bi_bdev = nvmet_rdma_bdev;
+	bio->bi_iter.bi_sector = slba << (nvmet_rdma_lba_shift - 9);
+	bio->bi_private = rsp;
+	bio->bi_end_io = nvmet_rdma_bio_done;
+	for (i = 0; i < rsp->nr_pages; i++) {
+		if (!bio_add_page(bio, rsp->pages[i], rsp->sge[i].length, 0)) {
+			bio_put(bio);
+			return NVME_SC_INTERNAL;
+		}
+	}
+
+	submit_bio(rw, bio);
+	return 0;
+}
+
+static void nvmet_rdma_execute(struct nvmet_rdma_rsp *rsp)
+{
+	struct nvmet_rdma_queue *queue = rsp->queue;
+	struct nvme_command *c = rsp->cmd->nvme_cmd;
+	u16 status;
+
+	if (c->common.opcode == nvme_fabrics_command) {
+		status = nvmet_rdma_exec_fabrics(rsp);
+	} else if (!queue->ctrl || !(queue->ctrl->csts & NVME_CSTS_RDY)) {
+		status = NVME_SC_CMD_SEQ_ERROR | NVME_SC_DNR;
+	} else if (!queue->qid) {
+		status = nvmet_rdma_exec_admin(rsp);
+	} else {
+		/* Submitted I/O completes from the bio end_io handler */
+		status = nvmet_rdma_exec_io(rsp);
+		if (!status)
+			return;
+	}
+
+	nvmet_rdma_complete(rsp, status);
+}
+
+static void nvmet_rdma_free_device(struct kref *ref)
+{
+	struct nvmet_rdma_device *dev =
+		container_of(ref, struct nvmet_rdma_device, ref);
+
+	list_del(&dev->entry);
+	ib_dereg_mr(dev->mr);
+	ib_dealloc_pd(dev->pd);
+	kfree(dev);
+}
+
+static void nvmet_rdma_put_device(struct nvmet_rdma_device *dev)
+{
+	mutex_lock(&nvmet_rdma_mutex);
+	kref_put(&dev->ref, nvmet_rdma_free_device);
+	mutex_unlock(&nvmet_rdma_mutex);
+}
+
+static struct nvmet_rdma_device *
+nvmet_rdma_get_device(struct ib_device *device)
+{
+	struct nvmet_rdma_device *dev;
+
+	mutex_lock(&nvmet_rdma_mutex);
+	list_for_each_entry(dev, &nvmet_rdma_devices, entry) {
+		if (dev->device == device) {
+			kref_get(&dev->ref);
+			goto out_unlock;
+		}
+	}
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		goto out_unlock;
+	if (ib_query_device(device, &dev->attr))
+		goto out_free_dev;
+	dev->pd = ib_alloc_pd(device);
+	if (IS_ERR(dev->pd))
+		goto out_free_dev;
+	dev->mr = ib_get_dma_mr(dev->pd, IB_ACCESS_LOCAL_WRITE);
+	if (IS_ERR(dev->mr))
+		goto out_free_pd;
+	dev->device = device;
+	kref_init(&dev->ref);
+	list_add(&dev->entry, &nvmet_rdma_devices);
+	goto out_unlock;
+
+ out_free_pd:
+	ib_dealloc_pd(dev->pd);
+ out_free_dev:
+	kfree(dev);
+	dev = NULL;
+ out_unlock:
+	mutex_unlock(&nvmet_rdma_mutex);
+	return dev;
+}
+
+static void nvmet_rdma_free_queue(struct nvmet_rdma_queue *queue)
+{
+	struct ib_device *device = queue->dev->device;
+	int i;
+
+	if (queue->qp)
+		rdma_destroy_qp(queue->cm_id);
+	if (queue->cq) {
+		cancel_work_sync(&queue->poll_work);
+		ib_destroy_cq(queue->cq);
+	}
+
+	for (i = 0; queue->rsps && i < queue->size; i++) {
+		struct nvmet_rdma_rsp *rsp = &queue->rsps[i];
+
+		if (rsp->cqe_dma)
+			ib_dma_unmap_single(device, rsp->cqe_dma,
+					sizeof(rsp->cqe), DMA_TO_DEVICE);
+		kfree(rsp->rdma_wrs);
+	}
+	for (i = 0; queue->cmds && i < queue->size; i++) {
+		struct nvmet_rdma_cmd *cmd = &queue->cmds[i];
+
+		if (cmd->dma)
+			ib_dma_unmap_single(device, cmd->dma,
+					NVMET_RDMA_CMD_SIZE, DMA_FROM_DEVICE);
+		kfree(cmd->nvme_cmd);
+	}
+	kfree(queue->rsps);
+	kfree(queue->cmds);
+
+	nvmet_rdma_put_device(queue->dev);
+	kfree(queue);
+}
+
+/*
+ * Flush everything still posted on the queue, wait for the commands in
+ * flight to finish, then free it.
+ */
+static void nvmet_rdma_release_queue_work(struct work_struct *work)
+{
+	struct nvmet_rdma_queue *queue =
+		container_of(work, struct nvmet_rdma_queue, release_work);
+	struct ib_send_wr wr, *bad_wr;
+
+	rdma_disconnect(queue->cm_id);
+
+	memset(&wr, 0, sizeof(wr));
+	wr.wr_id = (uintptr_t)&queue->drain_qe;
+	wr.opcode = IB_WR_SEND;
+	wr.send_flags = IB_SEND_SIGNALED;
+	if (!ib_post_send(queue->qp, &wr, &bad_wr))
+		wait_for_completion(&queue->drained);
+	wait_event(queue->inflight_wait, !atomic_read(&queue->inflight));
+
+	mutex_lock(&nvmet_rdma_mutex);
+	list_del(&queue->entry);
+	mutex_unlock(&nvmet_rdma_mutex);
+
+	if (queue->ctrl)
+		nvmet_rdma_put_ctrl(queue->ctrl);
+
+	rdma_destroy_qp(queue->cm_id);
+	queue->qp = NULL;
+	rdma_destroy_id(queue->cm_id);
+	nvmet_rdma_free_queue(queue);
+}
+
+static int nvmet_rdma_alloc_buffers(struct nvmet_rdma_queue *queue)
+{
+	struct ib_device *device = queue->dev->device;
+	int nr_wrs = DIV_ROUND_UP(NVMET_RDMA_MAX_PAGES, queue->max_sge);
+	int i;
+
+	queue->cmds = kcalloc(queue->size, sizeof(*queue->cmds), GFP_KERNEL);
+	queue->rsps = kcalloc(queue->size, sizeof(*queue->rsps), GFP_KERNEL);
+	if (!queue->cmds || !queue->rsps)
+		return -ENOMEM;
+
+	for (i = 0; i < queue->size; i++) {
+		struct nvmet_rdma_cmd *cmd = &queue->cmds[i];
+		struct nvmet_rdma_rsp *rsp = &queue->rsps[i];
+
+		cmd->qe.done = nvmet_rdma_recv_done;
+		cmd->nvme_cmd = kmalloc(NVMET_RDMA_CMD_SIZE, GFP_KERNEL);
+		if (!cmd->nvme_cmd)
+			return -ENOMEM;
+		cmd->dma = ib_dma_map_single(device, cmd->nvme_cmd,
+				NVMET_RDMA_CMD_SIZE, DMA_FROM_DEVICE);
+		if (ib_dma_mapping_error(device, cmd->dma)) {
+			cmd->dma = 0;
+			return -ENOMEM;
+		}
+
+		rsp->queue = queue;
+		rsp->read_qe.done = nvmet_rdma_read_done;
+		rsp->send_qe.done = nvmet_rdma_send_done;
+		rsp->rdma_wrs = kcalloc(nr_wrs, sizeof(*rsp->rdma_wrs),
+				GFP_KERNEL);
+		if (!rsp->rdma_wrs)
+			return -ENOMEM;
+		rsp->cqe_dma = ib_dma_map_single(device, &rsp->cqe,
+				sizeof(rsp->cqe), DMA_TO_DEVICE);
+		if (ib_dma_mapping_error(device, rsp->cqe_dma)) {
+			rsp->cqe_dma = 0;
+			return -ENOMEM;
+		}
+
+		rsp->send_sge.addr = rsp->cqe_dma;
+		rsp->send_sge.length = sizeof(rsp->cqe);
+		rsp->send_sge.lkey = queue->dev->mr->lkey;
+		rsp->send_wr.wr_id = (uintptr_t)&rsp->send_qe;
+		rsp->send_wr.sg_list = &rsp->send_sge;
+		rsp->send_wr.num_sge = 1;
+		rsp->send_wr.opcode = IB_WR_SEND;
+		rsp->send_wr.send_flags = IB_SEND_SIGNALED;
+	}
+	return 0;
+}
+
+static struct nvmet_rdma_queue *
+nvmet_rdma_alloc_queue(struct nvmet_rdma_device *dev,
+		struct rdma_cm_id *cm_id, u16 qid, int size)
+{
+	struct ib_device_attr *attr = &dev->attr;
+	struct nvmet_rdma_queue *queue;
+	struct ib_qp_init_attr init_attr;
+	int nr_wrs, i;
+
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+	if (!queue)
+		return NULL;
+	queue->dev = dev;
+	queue->cm_id = cm_id;
+	queue->qid = qid;
+	queue->size = size;
+	queue->max_sge = min3(attr->max_sge, attr->max_sge_rd,
+			NVMET_RDMA_MAX_SGE);
+	spin_lock_init(&queue->wr_lock);
+	INIT_LIST_HEAD(&queue->wr_wait_list);
+	init_waitqueue_head(&queue->inflight_wait);
+	INIT_WORK(&queue->poll_work, nvmet_rdma_poll_work);
+	INIT_WORK(&queue->release_work, nvmet_rdma_release_queue_work);
+	init_completion(&queue->drained);
+	queue->drain_qe.done = nvmet_rdma_drain_done;
+
+	if (queue->max_sge < 1 || nvmet_rdma_alloc_buffers(queue))
+		goto out_free_queue;
+
+	/* Room for every command's RDMA and response at once, plus the drain */
+	nr_wrs = DIV_ROUND_UP(NVMET_RDMA_MAX_PAGES, queue->max_sge) + 1;
+	nr_wrs *= size;
+	nr_wrs = min(nr_wrs, attr->max_qp_wr - 1);
+	queue->sq_wr_avail = nr_wrs;
+
+	queue->cq = ib_create_cq(dev->device, nvmet_rdma_cq_event, NULL, queue,
+			min(nr_wrs + 1 + size, attr->max_cqe),
+			qid % dev->device->num_comp_vectors);
+	if (IS_ERR(queue->cq)) {
+		queue->cq = NULL;
+		goto out_free_queue;
+	}
+
+	memset(&init_attr, 0, sizeof(init_attr));
+	init_attr.qp_context = queue;
+	init_attr.send_cq = queue->cq;
+	init_attr.recv_cq = queue->cq;
+	init_attr.cap.max_send_wr = nr_wrs + 1;
+	init_attr.cap.max_recv_wr = size;
+	init_attr.cap.max_send_sge = queue->max_sge;
+	init_attr.cap.max_recv_sge = 1;
+	init_attr.sq_sig_type = IB_SIGNAL_REQ_WR;
+	init_attr.qp_type = IB_QPT_RC;
+	if (rdma_create_qp(cm_id, dev->pd, &init_attr))
+		goto out_free_queue;
+	queue->qp = cm_id->qp;
+	ib_req_notify_cq(queue->cq, IB_CQ_NEXT_COMP);
+
+	for (i = 0; i < size; i++)
+		if (nvmet_rdma_post_recv(queue, &queue->cmds[i]))
+			goto out_free_queue;
+	return queue;
+
+ out_free_queue:
+	nvmet_rdma_free_queue(queue);
+	return NULL;
+}
+
+static int nvmet_rdma_reject(struct rdma_cm_id *cm_id, u16 status)
+{
+	struct nvme_rdma_cm_rej rej;
+
+	rej.recfmt = cpu_to_le16(NVME_RDMA_CM_FMT_1_0);
+	rej.sts = cpu_to_le16(status);
+	rdma_reject(cm_id, &rej, sizeof(rej));
+	/* Have the CM destroy the id */
+	return -ECONNREFUSED;
+}
+
+static int nvmet_rdma_queue_connect(struct rdma_cm_id *cm_id,
+		struct rdma_cm_event *event)
+{
+	const struct nvme_rdma_cm_req *req = event->param.conn.private_data;
+	struct nvmet_rdma_device *dev;
+	struct nvmet_rdma_queue *queue;
+	struct rdma_conn_param param;
+	struct nvme_rdma_cm_rep rep;
+	u16 qid;
+	int size;
+
+	if (!req || event->param.conn.private_data_len < sizeof(*req))
+		return nvmet_rdma_reject(cm_id, NVME_RDMA_CM_INVALID_LEN);
+	if (le16_to_cpu(req->recfmt) != NVME_RDMA_CM_FMT_1_0)
+		return nvmet_rdma_reject(cm_id, NVME_RDMA_CM_INVALID_RECFMT);
+	qid = le16_to_cpu(req->qid);
+	if (qid > NVMET_RDMA_MAX_IO_QUEUES)
+		return nvmet_rdma_reject(cm_id, NVME_RDMA_CM_INVALID_QID);
+	size = le16_to_cpu(req->hsqsize) + 1;
+	if (size < 2 || size > NVMET_RDMA_MAX_QUEUE_SIZE)
+		return nvmet_rdma_reject(cm_id, NVME_RDMA_CM_INVALID_HSQSIZE);
+
+	dev = nvmet_rdma_get_device(cm_id->device);
+	if (!dev)
+		return nvmet_rdma_reject(cm_id, NVME_RDMA_CM_NO_RSC);
+	queue = nvmet_rdma_alloc_queue(dev, cm_id, qid, size);
+	if (!queue)
+		return nvmet_rdma_reject(cm_id, NVME_RDMA_CM_NO_RSC);
+	cm_id->context = queue;
+
+	memset(&rep, 0, sizeof(rep));
+	rep.recfmt = cpu_to_le16(NVME_RDMA_CM_FMT_1_0);
+	rep.crqsize = cpu_to_le16(size);
+
+	memset(&param, 0, sizeof(param));
+	param.initiator_depth = min_t(u8, event->param.conn.responder_resources,
+			dev->attr.max_qp_init_rd_atom);
+	param.flow_control = 1;
+	param.rnr_retry_count = 7;
+	param.private_data = &rep;
+	param.private_data_len = sizeof(rep);
+
+	mutex_lock(&nvmet_rdma_mutex);
+	list_add_tail(&queue->entry, &nvmet_rdma_queues);
+	mutex_unlock(&nvmet_rdma_mutex);
+
+	if (rdma_accept(cm_id, &param)) {
+		pr_err("nvmet-rdma: accept of queue %d failed\n", qid);
+		/* The id is destroyed by the CM, not by the release work */
+		mutex_lock(&nvmet_rdma_mutex);
+		list_del(&queue->entry);
+		mutex_unlock(&nvmet_rdma_mutex);
+		cm_id->context = NULL;
+		nvmet_rdma_free_queue(queue);
+		return -ECONNREFUSED;
+	}
+	return 0;
+}
+
+static int nvmet_rdma_cm_handler(struct rdma_cm_id *cm_id,
+		struct rdma_cm_event *event)
+{
+	struct nvmet_rdma_queue *queue = cm_id->context;
+
+	switch (event->event) {
+	case RDMA_CM_EVENT_CONNECT_REQUEST:
+		return nvmet_rdma_queue_connect(cm_id, event);
+	case RDMA_CM_EVENT_ESTABLISHED:
+		break;
+	case RDMA_CM_EVENT_DISCONNECTED:
+	case RDMA_CM_EVENT_ADDR_CHANGE:
+	case RDMA_CM_EVENT_TIMEWAIT_EXIT:
+	case RDMA_CM_EVENT_DEVICE_REMOVAL:
+	case RDMA_CM_EVENT_REJECTED:
+	case RDMA_CM_EVENT_UNREACHABLE:
+	case RDMA_CM_EVENT_CONNECT_ERROR:
+		if (queue)
+			nvmet_rdma_queue_disconnect(queue);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static int nvmet_rdma_open_bdev(void)
+{
+	unsigned int block_size;
+
+	if (!nvmet_rdma_bdev_path) {
+		pr_err("nvmet-rdma: no backing device given\n");
+		return -EINVAL;
+	}
+
+	nvmet_rdma_bdev = blkdev_get_by_path(nvmet_rdma_bdev_path,
+			NVMET_RDMA_BDEV_MODE, &nvmet_rdma_bdev);
+	if (IS_ERR(nvmet_rdma_bdev)) {
+		pr_err("nvmet-rdma: failed to open %s: %ld\n",
+			nvmet_rdma_bdev_path, PTR_ERR(nvmet_rdma_bdev));
+		return PTR_ERR(nvmet_rdma_bdev);
+	}
+
+	block_size = bdev_logical_block_size(nvmet_rdma_bdev);
+	nvmet_rdma_lba_shift = ilog2(block_size);
+	nvmet_rdma_nr_blocks = i_size_read(nvmet_rdma_bdev->bd_inode) >>
+			nvmet_rdma_lba_shift;
+	return 0;
+}
+
+static int __init nvmet_rdma_init(void)
+{
+	struct sockaddr_in addr;
+	u64 serial;
+	int ret;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(nvmet_rdma_port);
+	if (!in4_pton(nvmet_rdma_addr, -1, (u8 *)&addr.sin_addr.s_addr, '\0',
+		      NULL))
+		return -EINVAL;
+	if (strlen(nvmet_rdma_nqn) >= NVMF_NQN_SIZE)
+		return -EINVAL;
+
+	ret = nvmet_rdma_open_bdev();
+	if (ret)
+		return ret;
+	get_random_bytes(&serial, sizeof(serial));
+	snprintf(nvmet_rdma_serial, sizeof(nvmet_rdma_serial), "%016llx",
+		 serial);
+	memset(nvmet_rdma_serial + strlen(nvmet_rdma_serial), ' ',
+	       sizeof(nvmet_rdma_serial) - strlen(nvmet_rdma_serial));
+
+	ret = -ENOMEM;
+	nvmet_rdma_wq = alloc_workqueue("nvmet_rdma_wq",
+			WQ_MEM_RECLAIM | WQ_HIGHPRI, 0);
+	if (!nvmet_rdma_wq)
+		goto out_put_bdev;
+
+	nvmet_rdma_listener = rdma_create_id(nvmet_rdma_cm_handler, NULL,
+			RDMA_PS_TCP, IB_QPT_RC);
+	if (IS_ERR(nvmet_rdma_listener)) {
+		ret = PTR_ERR(nvmet_rdma_listener);
+		goto out_destroy_wq;
+	}
+	ret = rdma_bind_addr(nvmet_rdma_listener, (struct sockaddr *)&addr);
+	if (!ret)
+		ret = rdma_listen(nvmet_rdma_listener, NVMET_RDMA_BACKLOG);
+	if (ret) {
+		pr_err("nvmet-rdma: failed to listen on %pI4:%u: %d\n",
+			&addr.sin_addr.s_addr, nvmet_rdma_port, ret);
+		goto out_destroy_id;
+	}
+
+	pr_info("nvmet-rdma: %s exported as %s on %pI4:%u\n",
+		nvmet_rdma_bdev_path, nvmet_rdma_nqn, &addr.sin_addr.s_addr,
+		nvmet_rdma_port);
+	return 0;
+
+ out_destroy_id:
+	rdma_destroy_id(nvmet_rdma_listener);
+ out_destroy_wq:
+	destroy_workqueue(nvmet_rdma_wq);
+ out_put_bdev:
+	blkdev_put(nvmet_rdma_bdev, NVMET_RDMA_BDEV_MODE);
+	return ret;
+}
+
+static void __exit nvmet_rdma_exit(void)
+{
+	struct nvmet_rdma_queue *queue;
+
+	/* No new connections once the listener is gone */
+	rdma_destroy_id(nvmet_rdma_listener);
+
+	mutex_lock(&nvmet_rdma_mutex);
+	list_for_each_entry(queue, &nvmet_rdma_queues, entry)
+		nvmet_rdma_queue_disconnect(queue);
+	mutex_unlock(&nvmet_rdma_mutex);
+
+	flush_workqueue(nvmet_rdma_wq);
+	destroy_workqueue(nvmet_rdma_wq);
+	WARN_ON(!list_empty(&nvmet_rdma_devices));
+
+	blkdev_put(nvmet_rdma_bdev, NVMET_RDMA_BDEV_MODE);
+}
+
+MODULE_LICENSE("GPL");
+module_init(nvmet_rdma_init);
+module_exit(nvmet_rdma_exit);
@@ -26,6 +26,11 @@ struct virtio_blk_vq {
 	struct virtqueue *vq;
 	spinlock_t lock;
 	char name[VQ_NAME_LEN];
+
+	/* Completion stats, protected by lock. */
+	unsigned long irqs;
+	unsigned long completions;
+	unsigned long remote_irqs;
 } ____cacheline_aligned_in_smp;
 
 struct virtio_blk {
@@ -141,19 +146,28 @@ static void virtblk_done(struct virtqueue *vq)
 	unsigned int len;
 
 	spin_lock_irqsave(&vblk->vqs[qid].lock, flags);
+	vblk->vqs[qid].irqs++;
 	do {
 		virtqueue_disable_cb(vq);
 		while ((vbr = virtqueue_get_buf(vblk->vqs[qid].vq, &len)) != NULL) {
 			blk_mq_complete_request(vbr->req);
+			vblk->vqs[qid].completions++;
 			req_done = true;
 		}
 		if (unlikely(virtqueue_is_broken(vq)))
 			break;
 	} while (!virtqueue_enable_cb(vq));
 
-	/* In case queue is stopped waiting for more buffers. */
-	if (req_done)
+	if (req_done) {
+		struct blk_mq_hw_ctx *hctx =
+			vblk->disk->queue->queue_hw_ctx[qid];
+
+		if (!cpumask_test_cpu(smp_processor_id(), hctx->cpumask))
+			vblk->vqs[qid].remote_irqs++;
+
+		/* In case queue is stopped waiting for more buffers. */
 		blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
+	}
 	spin_unlock_irqrestore(&vblk->vqs[qid].lock, flags);
 }
 
@@ -334,6 +348,28 @@ static ssize_t virtblk_serial_show(struct device *dev,
 
 static DEVICE_ATTR(serial, S_IRUGO, virtblk_serial_show, NULL);
 
+/* One line per virtqueue: its name, the interrupts and requests it
+ * completed, and the interrupts taken on a cpu not mapped to it. */
+static ssize_t virtblk_queue_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct gendisk *disk = dev_to_disk(dev);
+	struct virtio_blk *vblk = disk->private_data;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < vblk->num_vqs; i++) {
+		struct virtio_blk_vq *vq = &vblk->vqs[i];
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %lu %lu %lu\n",
+				 vq->name, vq->irqs, vq->completions,
+				 vq->remote_irqs);
+	}
+	return len;
+}
+
+static DEVICE_ATTR(queue_stats, S_IRUGO, virtblk_queue_stats_show, NULL);
+
 static void virtblk_config_changed_work(struct work_struct *work)
 {
 	struct virtio_blk *vblk =
@@ -393,6 +429,9 @@ static int init_vq(struct virtio_blk *vblk)
 	if (err)
 		num_vqs = 1;
 
+	/* More queues than cpus would only leave hardware contexts unused. */
+	num_vqs = min_t(unsigned int, nr_cpu_ids, num_vqs);
+
 	vblk->vqs = kmalloc(sizeof(*vblk->vqs) * num_vqs, GFP_KERNEL);
 	if (!vblk->vqs) {
 		err = -ENOMEM;
@@ -425,6 +464,9 @@ static int init_vq(struct virtio_blk *vblk)
 	for (i = 0; i < num_vqs; i++) {
 		spin_lock_init(&vblk->vqs[i].lock);
 		vblk->vqs[i].vq = vqs[i];
+		vblk->vqs[i].irqs = 0;
+		vblk->vqs[i].completions = 0;
+		vblk->vqs[i].remote_irqs = 0;
 	}
 	vblk->num_vqs = num_vqs;
 
@@ -563,6 +605,33 @@ static struct blk_mq_ops virtio_mq_ops = {
 static unsigned int virtblk_queue_depth;
 module_param_named(queue_depth, virtblk_queue_depth, uint, 0444);
 
+/* Steer each virtqueue's interrupt to the cpus blk-mq maps to it, so that
+ * completions run where the requests were submitted. */
+static void virtblk_set_affinity(struct virtio_blk *vblk)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	/* With a single queue, leave the interrupt to irqbalance. */
+	if (vblk->num_vqs == 1)
+		return;
+
+	queue_for_each_hw_ctx(vblk->disk->queue, hctx, i) {
+		/* Queues with no cpu mapped to them are never used. */
+		if (cpumask_empty(hctx->cpumask))
+			continue;
+		virtqueue_set_affinity_mask(vblk->vqs[i].vq, hctx->cpumask);
+	}
+}
+
+static void virtblk_clean_affinity(struct virtio_blk *vblk)
+{
+	int i;
+
+	for (i = 0; i < vblk->num_vqs; i++)
+		virtqueue_set_affinity_mask(vblk->vqs[i].vq, NULL);
+}
+
 static int virtblk_probe(struct virtio_device *vdev)
 {
 	struct virtio_blk *vblk;
@@ -650,6 +719,8 @@ static int virtblk_probe(struct virtio_device *vdev)
 
 	q->queuedata = vblk;
 
+	virtblk_set_affinity(vblk);
+
 	virtblk_name_format("vd", index, vblk->disk->disk_name, DISK_NAME_LEN);
 
 	vblk->disk->major = major;
@@ -737,6 +808,11 @@ static int virtblk_probe(struct virtio_device *vdev)
 	if (err)
 		goto out_del_disk;
 
+	err = device_create_file(disk_to_dev(vblk->disk),
+				 &dev_attr_queue_stats);
+	if (err)
+		goto out_del_disk;
+
 	if (virtio_has_feature(vdev, VIRTIO_BLK_F_CONFIG_WCE))
 		err = device_create_file(disk_to_dev(vblk->disk),
 					 &dev_attr_cache_type_rw);
@@ -755,6 +831,7 @@ out_free_tags:
 out_put_disk:
 	put_disk(vblk->disk);
 out_free_vq:
+	virtblk_clean_affinity(vblk);
 	vdev->config->del_vqs(vdev);
 out_free_vblk:
 	kfree(vblk);
@@ -783,6 +860,7 @@ static void virtblk_remove(struct virtio_device *vdev)
 
 	refc = atomic_read(&disk_to_dev(vblk->disk)->kobj.kref.refcount);
 	put_disk(vblk->disk);
+	virtblk_clean_affinity(vblk);
 	vdev->config->del_vqs(vdev);
 	kfree(vblk->vqs);
 	kfree(vblk);
@@ -805,6 +883,7 @@ static int virtblk_freeze(struct virtio_device *vdev)
 
 	blk_mq_stop_hw_queues(vblk->disk->queue);
 
+	virtblk_clean_affinity(vblk);
 	vdev->config->del_vqs(vdev);
 	return 0;
 }
@@ -818,6 +897,8 @@ static int virtblk_restore(struct virtio_device *vdev)
 	if (ret)
 		return ret;
 
+	virtblk_set_affinity(vblk);
+
 	virtio_device_ready(vdev);
 
 	blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
@@ -11,48 +11,36 @@
 #define _ZCOMP_H_
 
 #include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/crypto.h>
 
 struct zcomp_strm {
-	/* compression/decompression buffer */
-	void *buffer;
 	/*
-	 * The private data of the compression stream, only compression
-	 * stream backend can touch this (e.g. compression algorithm
-	 * working memory)
+	 * Serializes users of the stream. The stream of a cpu is picked
+	 * with preemption enabled and the holder may sleep (zs_malloc()),
+	 * so a task that migrated meanwhile simply waits for its turn.
 	 */
-	void *private;
-	/* used in multi stream backend, protected by backend strm_lock */
-	struct list_head list;
-};
-
-/* static compression backend */
-struct zcomp_backend {
-	int (*compress)(const unsigned char *src, unsigned char *dst,
-			size_t *dst_len, void *private);
-
-	int (*decompress)(const unsigned char *src, size_t src_len,
-			unsigned char *dst);
-
-	void *(*create)(void);
-	void (*destroy)(void *private);
-
-	const char *name;
+	struct mutex lock;
+	/* compression buffer */
+	void *buffer;
+	struct crypto_comp *tfm;
 };
 
 /* dynamic per-device compression frontend */
 struct zcomp {
-	void *stream;
-	struct zcomp_backend *backend;
+	/* compression streams, one per cpu that has been online */
+	struct zcomp_strm * __percpu *stream;
+	/* decompression transforms, used with preemption disabled */
+	struct crypto_comp * __percpu *dtfm;
+	struct notifier_block notifier;
 
-	struct zcomp_strm *(*strm_find)(struct zcomp *comp);
-	void (*strm_release)(struct zcomp *comp, struct zcomp_strm *zstrm);
-	bool (*set_max_streams)(struct zcomp *comp, int num_strm);
-	void (*destroy)(struct zcomp *comp);
+	const char *name;
 };
 
 ssize_t zcomp_available_show(const char *comp, char *buf);
+bool zcomp_available_algorithm(const char *comp);
 
-struct zcomp *zcomp_create(const char *comp, int max_strm);
+struct zcomp *zcomp_create(const char *comp);
 void zcomp_destroy(struct zcomp *comp);
 
 struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
@@ -63,6 +51,4 @@ int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
 
 int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
 		size_t src_len, unsigned char *dst);
-
-bool zcomp_set_max_streams(struct zcomp *comp, int num_strm);
 #endif /* _ZCOMP_H_ */
@@ -405,6 +405,33 @@ static unsigned int check_freqs(const struct cpumask *mask, unsigned int freq,
 	return 0;
 }
 
+static int prepare_drv_cmd(struct acpi_cpufreq_data *data,
+			   unsigned int next_perf_state, struct drv_cmd *cmd)
+{
+	struct acpi_processor_performance *perf = data->acpi_data;
+
+	switch (data->cpu_feature) {
+	case SYSTEM_INTEL_MSR_CAPABLE:
+		cmd->type = SYSTEM_INTEL_MSR_CAPABLE;
+		cmd->addr.msr.reg = MSR_IA32_PERF_CTL;
+		break;
+	case SYSTEM_AMD_MSR_CAPABLE:
+		cmd->type = SYSTEM_AMD_MSR_CAPABLE;
+		cmd->addr.msr.reg = MSR_AMD_PERF_CTL;
+		break;
+	case SYSTEM_IO_CAPABLE:
+		cmd->type = SYSTEM_IO_CAPABLE;
+		cmd->addr.io.port = perf->control_register.address;
+		cmd->addr.io.bit_width = perf->control_register.bit_width;
+		break;
+	default:
+		return -ENODEV;
+	}
+
+	cmd->val = (u32) perf->states[next_perf_state].control;
+	return 0;
+}
+
 static int acpi_cpufreq_target(struct cpufreq_policy *policy,
 			       unsigned int index)
 {
@@ -433,27 +460,9 @@ static int acpi_cpufreq_target(struct cpufreq_policy *policy,
 		}
 	}
 
-	switch (data->cpu_feature) {
-	case SYSTEM_INTEL_MSR_CAPABLE:
-		cmd.type = SYSTEM_INTEL_MSR_CAPABLE;
-		cmd.addr.msr.reg = MSR_IA32_PERF_CTL;
-		cmd.val = (u32) perf->states[next_perf_state].control;
-		break;
-	case SYSTEM_AMD_MSR_CAPABLE:
-		cmd.type = SYSTEM_AMD_MSR_CAPABLE;
-		cmd.addr.msr.reg = MSR_AMD_PERF_CTL;
-		cmd.val = (u32) perf->states[next_perf_state].control;
-		break;
-	case SYSTEM_IO_CAPABLE:
-		cmd.type = SYSTEM_IO_CAPABLE;
-		cmd.addr.io.port = perf->control_register.address;
-		cmd.addr.io.bit_width = perf->control_register.bit_width;
-		cmd.val = (u32) perf->states[next_perf_state].control;
-		break;
-	default:
-		result = -ENODEV;
+	result = prepare_drv_cmd(data, next_perf_state, &cmd);
+	if (result)
 		goto out;
-	}
 
 	/* cpufreq holds the hotplug lock, so we are safe from here on */
 	if (policy->shared_type != CPUFREQ_SHARED_TYPE_ANY)
@@ -479,6 +488,42 @@ out:
 	return result;
 }
 
+/*
+ * Called from scheduler context on a CPU of the policy, with interrupts
+ * disabled: the P-state is written on the local CPU only, which is why
+ * fast switching is limited to policies that don't need the write
+ * replicated on other CPUs.
+ */
+static unsigned int acpi_cpufreq_fast_switch(struct cpufreq_policy *policy,
+					     unsigned int target_freq)
+{
+	struct acpi_cpufreq_data *data = per_cpu(acfreq_data, policy->cpu);
+	struct acpi_processor_performance *perf = data->acpi_data;
+	unsigned int next_perf_state, index;
+	struct drv_cmd cmd;
+
+	if (cpufreq_frequency_table_target(policy, data->freq_table,
+					   target_freq, CPUFREQ_RELATION_L,
+					   &index))
+		return CPUFREQ_ENTRY_INVALID;
+
+	next_perf_state = data->freq_table[index].driver_data;
+	if (perf->state == next_perf_state) {
+		if (unlikely(data->resume))
+			data->resume = 0;
+		else
+			return data->freq_table[index].frequency;
+	}
+
+	if (prepare_drv_cmd(data, next_perf_state, &cmd))
+		return CPUFREQ_ENTRY_INVALID;
+
+	do_drv_write(&cmd);
+	perf->state = next_perf_state;
+
+	return data->freq_table[index].frequency;
+}
+
 static unsigned long
 acpi_cpufreq_guess_freq(struct acpi_cpufreq_data *data, unsigned int cpu)
 {
@@ -795,6 +840,10 @@ static int acpi_cpufreq_cpu_init(struct cpufreq_policy *policy)
 	if (result)
 		goto err_freqfree;
 
+	policy->fast_switch_possible = !acpi_pstate_strict &&
+		!(policy_is_shared(policy) &&
+		  policy->shared_type != CPUFREQ_SHARED_TYPE_ANY);
+
 	if (perf->states[0].core_frequency * 1000 != policy->cpuinfo.max_freq)
 		printk(KERN_WARNING FW_WARN "P-state 0 is not max freq\n");
 
@@ -886,6 +935,7 @@ static struct freq_attr *acpi_cpufreq_attr[] = {
 static struct cpufreq_driver acpi_cpufreq_driver = {
 	.verify		= cpufreq_generic_frequency_table_verify,
 	.target_index	= acpi_cpufreq_target,
+	.fast_switch	= acpi_cpufreq_fast_switch,
 	.bios_limit	= acpi_processor_get_bios_limit,
 	.init		= acpi_cpufreq_cpu_init,
 	.exit		= acpi_cpufreq_cpu_exit,
@@ -35,6 +35,7 @@ struct hpet_scope {
 #define IRTE_DEST(dest) ((eim_mode) ? dest : dest << 8)
 
 static int __read_mostly eim_mode;
+static bool __read_mostly ir_posting;
 static struct ioapic_scope ir_ioapic[MAX_IO_APICS];
 static struct hpet_scope ir_hpet[MAX_HPET_TBS];
 
@@ -167,6 +168,7 @@ static int set_irte_irq(int irq, struct intel_iommu *iommu, u16 index, u16 subha
 	irq_iommu->irte_index = index;
 	irq_iommu->sub_handle = subhandle;
 	irq_iommu->irte_mask = 0;
+	irq_iommu->posted = 0;
 
 	raw_spin_unlock_irqrestore(&irq_2_ir_lock, flags);
 
@@ -191,8 +193,24 @@ static int modify_irte(int irq, struct irte *irte_modified)
 	index = irq_iommu->irte_index + irq_iommu->sub_handle;
 	irte = &iommu->ir_table->base[index];
 
-	set_64bit(&irte->low, irte_modified->low);
-	set_64bit(&irte->high, irte_modified->high);
+#if defined(CONFIG_X86_64)
+	/*
+	 * A posted format IRTE is read by the hardware as a whole, so it has
+	 * to be switched atomically.
+	 */
+	if (irte->p_pst || irte_modified->p_pst) {
+		bool ret;
+
+		ret = cmpxchg_double(&irte->low, &irte->high,
+				     irte->low, irte->high,
+				     irte_modified->low, irte_modified->high);
+		WARN_ON(!ret);
+	} else
+#endif
+	{
+		set_64bit(&irte->low, irte_modified->low);
+		set_64bit(&irte->high, irte_modified->high);
+	}
 	__iommu_flush_cache(iommu, irte, sizeof(*irte));
 
 	rc = qi_flush_iec(iommu, index, 0);
@@ -274,6 +292,7 @@ static int free_irte(int irq)
 	irq_iommu->irte_index = 0;
 	irq_iommu->sub_handle = 0;
 	irq_iommu->irte_mask = 0;
+	irq_iommu->posted = 0;
 
 	raw_spin_unlock_irqrestore(&irq_2_ir_lock, flags);
 
@@ -702,6 +721,18 @@ static int __init intel_enable_irq_remapping(void)
 
 	irq_remapping_enabled = 1;
 
+	/*
+	 * Posted interrupts need every unit to support them, and the IRTE
+	 * to be updated with a 128-bit cmpxchg.
+	 */
+	ir_posting = config_enabled(CONFIG_X86_64) && !disable_irq_post &&
+		     cpu_has_cx16;
+	for_each_iommu(iommu, drhd)
+		if (!cap_pi_support(iommu->cap))
+			ir_posting = false;
+	if (ir_posting)
+		pr_info("Enabled posted interrupts for guests\n");
+
 	/*
 	 * VT-d has a different layout for IO-APIC entries when
 	 * interrupt remapping is enabled. So it needs a special routine
@@ -1055,6 +1086,7 @@ intel_ioapic_set_affinity(struct irq_data *data, const struct cpumask *mask,
 			  bool force)
 {
 	struct irq_cfg *cfg = irqd_cfg(data);
+	struct irq_2_iommu *irq_iommu = &cfg->irq_2_iommu;
 	unsigned int dest, irq = data->irq;
 	struct irte irte;
 	int err;
@@ -1068,6 +1100,12 @@ intel_ioapic_set_affinity(struct irq_data *data, const struct cpumask *mask,
 	if (get_irte(irq, &irte))
 		return -EBUSY;
 
+	/* A posted interrupt goes to the vCPU, keep the host copy current */
+	if (irq_iommu->posted) {
+		irte.low = irq_iommu->irte_remapped_low;
+		irte.high = irq_iommu->irte_remapped_high;
+	}
+
 	err = assign_irq_vector(irq, cfg, mask);
 	if (err)
 		return err;
@@ -1086,7 +1124,12 @@ intel_ioapic_set_affinity(struct irq_data *data, const struct cpumask *mask,
 	 * Atomically updates the IRTE with the new destination, vector
 	 * and flushes the interrupt entry cache.
 	 */
-	modify_irte(irq, &irte);
+	if (irq_iommu->posted) {
+		irq_iommu->irte_remapped_low = irte.low;
+		irq_iommu->irte_remapped_high = irte.high;
+	} else {
+		modify_irte(irq, &irte);
+	}
 
 	/*
 	 * After this point, all the interrupts will start arriving
@@ -1202,6 +1245,61 @@ static int intel_alloc_hpet_msi(unsigned int irq, unsigned int id)
 	return ret;
 }
 
+static bool intel_ir_capability(enum irq_remap_cap cap)
+{
+	return cap == IRQ_POSTING_CAP && ir_posting;
+}
+
+/*
+ * Switch the IRTE of @irq to posted format so that the interrupt is
+ * recorded in the posted-interrupt descriptor of a vCPU, or back to the
+ * saved remapped format when @vcpu is NULL.  Called with the irq
+ * descriptor lock held.
+ */
+static int intel_ir_set_vcpu_affinity(int irq, struct vcpu_data *vcpu)
+{
+	struct irq_2_iommu *irq_iommu = irq_2_iommu(irq);
+	struct irte irte;
+
+	if (!ir_posting || !irq_iommu)
+		return -ENODEV;
+
+	if (get_irte(irq, &irte))
+		return -EBUSY;
+
+	if (!vcpu) {
+		if (!irq_iommu->posted)
+			return 0;
+		irte.low = irq_iommu->irte_remapped_low;
+		irte.high = irq_iommu->irte_remapped_high;
+		irq_iommu->posted = 0;
+		return modify_irte(irq, &irte);
+	}
+
+	if (!irq_iommu->posted) {
+		irq_iommu->irte_remapped_low = irte.low;
+		irq_iommu->irte_remapped_high = irte.high;
+	} else {
+		irte.low = irq_iommu->irte_remapped_low;
+		irte.high = irq_iommu->irte_remapped_high;
+	}
+
+	/* Keep present, fpd, avail and the source-id fields */
+	irte.p_res0 = 0;
+	irte.p_res1 = 0;
+	irte.p_urgent = 0;
+	irte.p_pst = 1;
+	irte.p_vector = vcpu->vector;
+	irte.p_res2 = 0;
+	irte.pda_l = (vcpu->pi_desc_addr >> (32 - PDA_LOW_BIT)) &
+		     ~(-1ULL << PDA_LOW_BIT);
+	irte.p_res3 = 0;
+	irte.pda_h = (vcpu->pi_desc_addr >> 32) & ~(-1ULL << PDA_HIGH_BIT);
+
+	irq_iommu->posted = 1;
+	return modify_irte(irq, &irte);
+}
+
 struct irq_remap_ops intel_irq_remap_ops = {
 	.prepare		= intel_prepare_irq_remapping,
 	.enable			= intel_enable_irq_remapping,
@@ -1215,6 +1313,8 @@ struct irq_remap_ops intel_irq_remap_ops = {
 	.msi_alloc_irq		= intel_msi_alloc_irq,
 	.msi_setup_irq		= intel_msi_setup_irq,
 	.alloc_hpet_msi		= intel_alloc_hpet_msi,
+	.capability		= intel_ir_capability,
+	.set_vcpu_affinity	= intel_ir_set_vcpu_affinity,
 };
 
 /*
@@ -34,6 +34,7 @@ struct msi_msg;
 extern int irq_remap_broken;
 extern int disable_sourceid_checking;
 extern int no_x2apic_optout;
+extern int disable_irq_post;
 extern int irq_remapping_enabled;
 
 struct irq_remap_ops {
@@ -77,6 +78,12 @@ struct irq_remap_ops {
 
 	/* Setup interrupt remapping for an HPET MSI */
 	int (*alloc_hpet_msi)(unsigned int, unsigned int);
+
+	/* Check whether the hardware supports a remapping feature */
+	bool (*capability)(enum irq_remap_cap);
+
+	/* Post the interrupt to a vCPU, or back to the host if NULL */
+	int (*set_vcpu_affinity)(int irq, struct vcpu_data *);
 };
 
 extern struct irq_remap_ops intel_irq_remap_ops;
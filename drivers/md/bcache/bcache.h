@@ -361,6 +361,15 @@ struct cached_dev {
 
 	struct cache_accounting	accounting;
 
+	atomic_t		hit_latency[BCH_LATENCY_BUCKETS];
+	atomic_t		bypass_reasons[BYPASS_NR];
+
+	/* For the writeback rate controller, in us */
+	atomic64_t		backing_latency_sum;
+	atomic_t		backing_latency_count;
+	/* jiffies of the last request from above, for idle detection */
+	unsigned long		last_foreground_io;
+
 	/* The rest of this all shows up in sysfs */
 	unsigned		sequential_cutoff;
 	unsigned		readahead;
@@ -378,8 +387,10 @@ struct cached_dev {
 	int64_t			writeback_rate_proportional;
 	int64_t			writeback_rate_derivative;
 	int64_t			writeback_rate_change;
+	unsigned		writeback_rate_backing_latency;
 
 	unsigned		writeback_rate_update_seconds;
+	unsigned		writeback_rate_target_latency_us;
 	unsigned		writeback_rate_d_term;
 	unsigned		writeback_rate_p_term_inverse;
 };
@@ -369,17 +369,27 @@ static bool check_should_bypass(struct cached_dev *dc, struct bio *bio)
 	unsigned sectors, congested = bch_get_congested(c);
 	struct task_struct *task = current;
 	struct io *i;
+	enum bch_bypass_reason reason;
 
-	if (test_bit(BCACHE_DEV_DETACHING, &dc->disk.flags) ||
-	    c->gc_stats.in_use > CUTOFF_CACHE_ADD ||
-	    (bio->bi_rw & REQ_DISCARD))
+	reason = BYPASS_DETACHING;
+	if (test_bit(BCACHE_DEV_DETACHING, &dc->disk.flags))
 		goto skip;
 
+	reason = BYPASS_CACHE_FULL;
+	if (c->gc_stats.in_use > CUTOFF_CACHE_ADD)
+		goto skip;
+
+	reason = BYPASS_DISCARD;
+	if (bio->bi_rw & REQ_DISCARD)
+		goto skip;
+
+	reason = BYPASS_CACHE_MODE;
 	if (mode == CACHE_MODE_NONE ||
 	    (mode == CACHE_MODE_WRITEAROUND &&
 	     (bio->bi_rw & REQ_WRITE)))
 		goto skip;
 
+	reason = BYPASS_UNALIGNED;
 	if (bio->bi_iter.bi_sector & (c->sb.block_size - 1) ||
 	    bio_sectors(bio) & (c->sb.block_size - 1)) {
 		pr_debug("skipping unaligned io");
@@ -387,6 +397,7 @@ static bool check_should_bypass(struct cached_dev *dc, struct bio *bio)
 	}
 
 	if (bypass_torture_test(dc)) {
+		reason = BYPASS_TORTURE_TEST;
 		if ((get_random_int() & 3) == 3)
 			goto skip;
 		else
@@ -433,11 +444,13 @@ found:
 	if (dc->sequential_cutoff &&
 	    sectors >= dc->sequential_cutoff >> 9) {
 		trace_bcache_bypass_sequential(bio);
+		reason = BYPASS_SEQUENTIAL;
 		goto skip;
 	}
 
 	if (congested && sectors >= congested) {
 		trace_bcache_bypass_congested(bio);
+		reason = BYPASS_CONGESTED;
 		goto skip;
 	}
 
@@ -445,7 +458,7 @@ rescale:
 	bch_rescale_priorities(c, bio_sectors(bio));
 	return false;
 skip:
-	bch_mark_sectors_bypassed(c, dc, bio_sectors(bio));
+	bch_mark_sectors_bypassed(c, dc, bio_sectors(bio), reason);
 	return true;
 }
 
@@ -466,6 +479,7 @@ struct search {
 	unsigned		read_dirty_data:1;
 
 	unsigned long		start_time;
+	unsigned		start_time_us;
 
 	struct btree_op		op;
 	struct data_insert_op	iop;
@@ -651,6 +665,7 @@ static inline struct search *search_alloc(struct bio *bio,
 	s->write		= (bio->bi_rw & REQ_WRITE) != 0;
 	s->read_dirty_data	= 0;
 	s->start_time		= jiffies;
+	s->start_time_us	= local_clock_us();
 
 	s->iop.c		= d->c;
 	s->iop.bio		= NULL;
@@ -760,11 +775,17 @@ static void cached_dev_read_done_bh(struct closure *cl)
 {
 	struct search *s = container_of(cl, struct search, cl);
 	struct cached_dev *dc = container_of(s->d, struct cached_dev, disk);
+	unsigned latency = local_clock_us() - s->start_time_us;
 
 	bch_mark_cache_accounting(s->iop.c, s->d,
 				  !s->cache_miss, s->iop.bypass);
 	trace_bcache_read(s->orig_bio, !s->cache_miss, s->iop.bypass);
 
+	if (s->cache_miss || s->iop.bypass)
+		bch_mark_backing_latency(dc, latency);
+	else
+		bch_mark_cache_hit_latency(dc, latency);
+
 	if (s->iop.error)
 		continue_at_nobarrier(cl, cached_dev_read_error, bcache_wq);
 	else if (s->iop.bio || verify(dc, &s->bio.bio))
@@ -860,6 +881,11 @@ static void cached_dev_write_complete(struct closure *cl)
 	struct search *s = container_of(cl, struct search, cl);
 	struct cached_dev *dc = container_of(s->d, struct cached_dev, disk);
 
+	/* Bypassed and writethrough writes waited on the backing device */
+	if (!s->iop.writeback && !(s->bio.bio.bi_rw & REQ_DISCARD))
+		bch_mark_backing_latency(dc,
+				local_clock_us() - s->start_time_us);
+
 	up_read_non_owner(&dc->writeback_lock);
 	cached_dev_bio_complete(cl);
 }
@@ -958,6 +984,9 @@ static void cached_dev_make_request(struct request_queue *q, struct bio *bio)
 
 	generic_start_io_acct(rw, bio_sectors(bio), &d->disk->part0);
 
+	if (dc->last_foreground_io != jiffies)
+		dc->last_foreground_io = jiffies;
+
 	bio->bi_bdev = dc->bdev;
 	bio->bi_iter.bi_sector += dc->sb.data_offset;
 
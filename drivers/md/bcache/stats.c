@@ -218,10 +218,37 @@ void bch_mark_cache_miss_collision(struct cache_set *c, struct bcache_device *d)
 }
 
 void bch_mark_sectors_bypassed(struct cache_set *c, struct cached_dev *dc,
-			       int sectors)
+			       int sectors, enum bch_bypass_reason reason)
 {
 	atomic_add(sectors, &dc->accounting.collector.sectors_bypassed);
 	atomic_add(sectors, &c->accounting.collector.sectors_bypassed);
+	atomic_inc(&dc->bypass_reasons[reason]);
+}
+
+void bch_mark_cache_hit_latency(struct cached_dev *dc, unsigned us)
+{
+	atomic_inc(&dc->hit_latency[min_t(unsigned, fls(us),
+					  BCH_LATENCY_BUCKETS - 1)]);
+}
+
+/*
+ * Foreground requests that had to go to the backing device; the writeback
+ * rate controller uses the average over each update period.
+ */
+void bch_mark_backing_latency(struct cached_dev *dc, unsigned us)
+{
+	atomic64_add(us, &dc->backing_latency_sum);
+	atomic_inc(&dc->backing_latency_count);
+}
+
+void bch_cached_dev_latency_clear(struct cached_dev *dc)
+{
+	unsigned i;
+
+	for (i = 0; i < BCH_LATENCY_BUCKETS; i++)
+		atomic_set(&dc->hit_latency[i], 0);
+	for (i = 0; i < BYPASS_NR; i++)
+		atomic_set(&dc->bypass_reasons[i], 0);
 }
 
 void bch_cache_accounting_init(struct cache_accounting *acc,
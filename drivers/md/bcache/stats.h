@@ -25,6 +25,25 @@ struct cache_stats {
 	unsigned		rescale;
 };
 
+/* Why check_should_bypass() sent a request straight to the backing device */
+enum bch_bypass_reason {
+	BYPASS_DETACHING,
+	BYPASS_CACHE_FULL,
+	BYPASS_DISCARD,
+	BYPASS_CACHE_MODE,
+	BYPASS_UNALIGNED,
+	BYPASS_TORTURE_TEST,
+	BYPASS_SEQUENTIAL,
+	BYPASS_CONGESTED,
+	BYPASS_NR,
+};
+
+/*
+ * Cache hit latencies are counted in power of two buckets of microseconds;
+ * bucket i holds latencies below 1 << i, the last one everything above.
+ */
+#define BCH_LATENCY_BUCKETS	16
+
 struct cache_accounting {
 	struct closure		cl;
 	struct timer_list	timer;
@@ -56,6 +75,10 @@ void bch_mark_cache_accounting(struct cache_set *, struct bcache_device *,
 			       bool, bool);
 void bch_mark_cache_readahead(struct cache_set *, struct bcache_device *);
 void bch_mark_cache_miss_collision(struct cache_set *, struct bcache_device *);
-void bch_mark_sectors_bypassed(struct cache_set *, struct cached_dev *, int);
+void bch_mark_sectors_bypassed(struct cache_set *, struct cached_dev *, int,
+			       enum bch_bypass_reason);
+void bch_mark_cache_hit_latency(struct cached_dev *, unsigned);
+void bch_mark_backing_latency(struct cached_dev *, unsigned);
+void bch_cached_dev_latency_clear(struct cached_dev *);
 
 #endif /* _BCACHE_STATS_H_ */
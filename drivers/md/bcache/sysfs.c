@@ -27,6 +27,17 @@ static const char * const error_actions[] = {
 	NULL
 };
 
+static const char * const bypass_reasons[] = {
+	"detaching",
+	"cache_full",
+	"discard",
+	"cache_mode",
+	"unaligned",
+	"torture_test",
+	"sequential",
+	"congested",
+};
+
 write_attribute(attach);
 write_attribute(detach);
 write_attribute(unregister);
@@ -82,7 +93,10 @@ rw_attribute(writeback_rate);
 rw_attribute(writeback_rate_update_seconds);
 rw_attribute(writeback_rate_d_term);
 rw_attribute(writeback_rate_p_term_inverse);
+rw_attribute(writeback_rate_target_latency_us);
 read_attribute(writeback_rate_debug);
+read_attribute(hit_latency_histogram);
+read_attribute(bypass_reasons);
 
 read_attribute(stripe_size);
 read_attribute(partial_stripes_expensive);
@@ -131,6 +145,7 @@ SHOW(__bch_cached_dev)
 	var_print(writeback_rate_update_seconds);
 	var_print(writeback_rate_d_term);
 	var_print(writeback_rate_p_term_inverse);
+	var_print(writeback_rate_target_latency_us);
 
 	if (attr == &sysfs_writeback_rate_debug) {
 		char rate[20];
@@ -158,9 +173,38 @@ SHOW(__bch_cached_dev)
 			       "proportional:\t%s\n"
 			       "derivative:\t%s\n"
 			       "change:\t\t%s/sec\n"
+			       "backing latency:%uus\n"
 			       "next io:\t%llims\n",
 			       rate, dirty, target, proportional,
-			       derivative, change, next_io);
+			       derivative, change,
+			       dc->writeback_rate_backing_latency, next_io);
+	}
+
+	if (attr == &sysfs_hit_latency_histogram) {
+		size_t ret = 0;
+		unsigned i;
+
+		for (i = 0; i < BCH_LATENCY_BUCKETS - 1; i++)
+			ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+					 "<%uus\t\t%u\n", 1U << i,
+					 atomic_read(&dc->hit_latency[i]));
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+				 ">=%uus\t%u\n", 1U << i,
+				 atomic_read(&dc->hit_latency[i]));
+		return ret;
+	}
+
+	if (attr == &sysfs_bypass_reasons) {
+		size_t ret = 0;
+		unsigned i;
+
+		BUILD_BUG_ON(ARRAY_SIZE(bypass_reasons) != BYPASS_NR);
+
+		for (i = 0; i < BYPASS_NR; i++)
+			ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+					 "%s:\t%u\n", bypass_reasons[i],
+					 atomic_read(&dc->bypass_reasons[i]));
+		return ret;
 	}
 
 	sysfs_hprint(dirty_data,
@@ -214,12 +258,15 @@ STORE(__cached_dev)
 	d_strtoul_nonzero(writeback_rate_update_seconds);
 	d_strtoul(writeback_rate_d_term);
 	d_strtoul_nonzero(writeback_rate_p_term_inverse);
+	d_strtoul(writeback_rate_target_latency_us);
 
 	d_strtoi_h(sequential_cutoff);
 	d_strtoi_h(readahead);
 
-	if (attr == &sysfs_clear_stats)
+	if (attr == &sysfs_clear_stats) {
 		bch_cache_accounting_clear(&dc->accounting);
+		bch_cached_dev_latency_clear(dc);
+	}
 
 	if (attr == &sysfs_running &&
 	    strtoul_or_return(buf))
@@ -320,12 +367,15 @@ static struct attribute *bch_cached_dev_files[] = {
 	&sysfs_writeback_rate_update_seconds,
 	&sysfs_writeback_rate_d_term,
 	&sysfs_writeback_rate_p_term_inverse,
+	&sysfs_writeback_rate_target_latency_us,
 	&sysfs_writeback_rate_debug,
 	&sysfs_dirty_data,
 	&sysfs_stripe_size,
 	&sysfs_partial_stripes_expensive,
 	&sysfs_sequential_cutoff,
 	&sysfs_clear_stats,
+	&sysfs_hit_latency_histogram,
+	&sysfs_bypass_reasons,
 	&sysfs_running,
 	&sysfs_state,
 	&sysfs_label,
@@ -33,7 +33,13 @@ static void __update_writeback_rate(struct cached_dev *dc)
 	int64_t dirty = bcache_dev_sectors_dirty(&dc->disk);
 	int64_t derivative = dirty - dc->disk.sectors_dirty_last;
 	int64_t proportional = dirty - target;
-	int64_t change;
+	int64_t change, rate;
+
+	/* Average latency of foreground I/O to the backing device, in us */
+	uint64_t latency_sum = atomic64_xchg(&dc->backing_latency_sum, 0);
+	unsigned latency_count = atomic_xchg(&dc->backing_latency_count, 0);
+	unsigned latency = latency_count
+		? div_u64(latency_sum, latency_count) : 0;
 
 	dc->disk.sectors_dirty_last = dirty;
 
@@ -59,10 +65,25 @@ static void __update_writeback_rate(struct cached_dev *dc)
 			 dc->writeback_rate.next + NSEC_PER_MSEC))
 		change = 0;
 
-	dc->writeback_rate.rate =
-		clamp_t(int64_t, (int64_t) dc->writeback_rate.rate + change,
-			1, NSEC_PER_MSEC);
+	rate = clamp_t(int64_t, (int64_t) dc->writeback_rate.rate + change,
+		       1, NSEC_PER_MSEC);
+
+	/*
+	 * If writeback is hurting foreground I/O to the backing device, back
+	 * off in proportion to how far over the target latency it is; the PD
+	 * controller above then only brings the rate back up gradually.
+	 */
+	if (dc->writeback_rate_target_latency_us &&
+	    latency > dc->writeback_rate_target_latency_us) {
+		rate = div_u64((uint64_t) rate *
+			       dc->writeback_rate_target_latency_us,
+			       latency) ?: 1;
+		change = rate - dc->writeback_rate.rate;
+	}
+
+	dc->writeback_rate.rate = rate;
 
+	dc->writeback_rate_backing_latency = latency;
 	dc->writeback_rate_proportional = proportional;
 	dc->writeback_rate_derivative = derivative;
 	dc->writeback_rate_change = change;
@@ -87,10 +108,21 @@ static void update_writeback_rate(struct work_struct *work)
 			      dc->writeback_rate_update_seconds * HZ);
 }
 
+/*
+ * No foreground I/O for a whole rate update period: there's nothing to slow
+ * down, so write back as fast as the backing device will take it.
+ */
+static bool backing_dev_idle(struct cached_dev *dc)
+{
+	return time_after(jiffies, dc->last_foreground_io +
+			  dc->writeback_rate_update_seconds * HZ);
+}
+
 static unsigned writeback_delay(struct cached_dev *dc, unsigned sectors)
 {
 	if (test_bit(BCACHE_DEV_DETACHING, &dc->disk.flags) ||
-	    !dc->writeback_percent)
+	    !dc->writeback_percent ||
+	    backing_dev_idle(dc))
 		return 0;
 
 	return bch_next_delay(&dc->writeback_rate, sectors);
@@ -516,6 +548,9 @@ void bch_cached_dev_writeback_init(struct cached_dev *dc)
 	dc->writeback_rate_update_seconds = 5;
 	dc->writeback_rate_d_term	= 30;
 	dc->writeback_rate_p_term_inverse = 6000;
+	dc->writeback_rate_target_latency_us = 0;
+
+	dc->last_foreground_io		= jiffies;
 
 	INIT_DELAYED_WORK(&dc->writeback_rate_update, update_writeback_rate);
 }
@@ -602,6 +602,7 @@ struct ixgbe_adapter {
 	/* OS defined structs */
 	struct net_device *netdev;
 	struct pci_dev *pdev;
+	struct bpf_prog __rcu *xdp_prog;
 
 	unsigned long state;
 
@@ -49,6 +49,8 @@
 #include <linux/if_macvlan.h>
 #include <linux/if_bridge.h>
 #include <linux/prefetch.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
 #include <scsi/fc/fc_fcoe.h>
 #include <net/vxlan.h>
 
@@ -1074,9 +1076,10 @@ static void ixgbe_tx_timeout_reset(struct ixgbe_adapter *adapter)
  * ixgbe_clean_tx_irq - Reclaim resources after transmit completes
  * @q_vector: structure containing interrupt and ring information
  * @tx_ring: tx ring to clean
+ * @napi_budget: Used to determine if we are in netpoll
  **/
 static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
-			       struct ixgbe_ring *tx_ring)
+			       struct ixgbe_ring *tx_ring, int napi_budget)
 {
 	struct ixgbe_adapter *adapter = q_vector->adapter;
 	struct ixgbe_tx_buffer *tx_buffer;
@@ -1114,7 +1117,7 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 		total_packets += tx_buffer->gso_segs;
 
 		/* free the skb */
-		dev_consume_skb_any(tx_buffer->skb);
+		napi_consume_skb(tx_buffer->skb, napi_budget);
 
 		/* unmap skb header data */
 		dma_unmap_single(tx_ring->dev,
@@ -1989,6 +1992,64 @@ dma_sync:
 	return skb;
 }
 
+/**
+ * ixgbe_run_xdp - run the XDP program on a frame still held in its page
+ * @rx_ring: rx descriptor ring the frame was received on
+ * @rx_desc: descriptor of the frame
+ * @xdp_prog: program to run
+ * @xdp_tx: set if the program asked for the frame to be sent back out
+ *
+ * Only frames received into a single buffer are handed to the program,
+ * anything else takes the regular path as if XDP_PASS was returned.
+ *
+ * Returns true if the frame was dropped and its page went back to the ring
+ **/
+static bool ixgbe_run_xdp(struct ixgbe_ring *rx_ring,
+			  union ixgbe_adv_rx_desc *rx_desc,
+			  struct bpf_prog *xdp_prog, bool *xdp_tx)
+{
+	struct ixgbe_rx_buffer *rx_buffer;
+	struct xdp_buff xdp;
+	unsigned int size;
+	u32 act;
+
+	rx_buffer = &rx_ring->rx_buffer_info[rx_ring->next_to_clean];
+
+	if (rx_buffer->skb ||
+	    !ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_EOP) ||
+	    ixgbe_test_staterr(rx_desc, IXGBE_RXDADV_ERR_FRAME_ERR_MASK))
+		return false;
+
+	size = le16_to_cpu(rx_desc->wb.upper.length);
+
+	dma_sync_single_range_for_cpu(rx_ring->dev, rx_buffer->dma,
+				      rx_buffer->page_offset, size,
+				      DMA_FROM_DEVICE);
+
+	xdp.data = page_address(rx_buffer->page) + rx_buffer->page_offset;
+	xdp.data_end = xdp.data + size;
+
+	act = bpf_prog_run_xdp(xdp_prog, &xdp);
+	switch (act) {
+	case XDP_PASS:
+		return false;
+	case XDP_TX:
+		*xdp_tx = true;
+		return false;
+	default:
+		bpf_warn_invalid_xdp_action(act);
+	case XDP_ABORTED:
+	case XDP_DROP:
+		break;
+	}
+
+	/* no skb was built, so the whole page can go straight back */
+	ixgbe_reuse_rx_page(rx_ring, rx_buffer);
+	rx_buffer->page = NULL;
+
+	return true;
+}
+
 /**
  * ixgbe_clean_rx_irq - Clean completed descriptors from Rx ring - bounce buf
  * @q_vector: structure containing interrupt and ring information
@@ -2013,10 +2074,15 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	unsigned int mss = 0;
 #endif /* IXGBE_FCOE */
 	u16 cleaned_count = ixgbe_desc_unused(rx_ring);
+	struct bpf_prog *xdp_prog;
+
+	rcu_read_lock();
+	xdp_prog = rcu_dereference(q_vector->adapter->xdp_prog);
 
 	while (likely(total_rx_packets < budget)) {
 		union ixgbe_adv_rx_desc *rx_desc;
 		struct sk_buff *skb;
+		bool xdp_tx = false;
 
 		/* return some buffers to hardware, one at a time is too slow */
 		if (cleaned_count >= IXGBE_RX_BUFFER_WRITE) {
@@ -2035,6 +2101,17 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		 */
 		dma_rmb();
 
+		if (xdp_prog &&
+		    ixgbe_run_xdp(rx_ring, rx_desc, xdp_prog, &xdp_tx)) {
+			u16 ntc = rx_ring->next_to_clean + 1;
+
+			rx_ring->next_to_clean = (ntc < rx_ring->count) ? ntc : 0;
+			total_rx_bytes += le16_to_cpu(rx_desc->wb.upper.length);
+			total_rx_packets++;
+			cleaned_count++;
+			continue;
+		}
+
 		/* retrieve a buffer from the ring */
 		skb = ixgbe_fetch_rx_buffer(rx_ring, rx_desc);
 
@@ -2055,6 +2132,15 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		/* probably a little skewed due to removing CRC */
 		total_rx_bytes += skb->len;
 
+		if (unlikely(xdp_tx)) {
+			/* no tx ring is set aside for XDP, use the stack's */
+			skb->dev = rx_ring->netdev;
+			skb->protocol = ((struct ethhdr *)skb->data)->h_proto;
+			dev_queue_xmit(skb);
+			total_rx_packets++;
+			continue;
+		}
+
 		/* populate checksum, timestamp, VLAN, and protocol */
 		ixgbe_process_skb_fields(rx_ring, rx_desc, skb);
 
@@ -2090,6 +2176,8 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		total_rx_packets++;
 	}
 
+	rcu_read_unlock();
+
 	u64_stats_update_begin(&rx_ring->syncp);
 	rx_ring->stats.packets += total_rx_packets;
 	rx_ring->stats.bytes += total_rx_bytes;
@@ -2702,7 +2790,7 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 #endif
 
 	ixgbe_for_each_ring(ring, q_vector->tx)
-		clean_complete &= !!ixgbe_clean_tx_irq(q_vector, ring);
+		clean_complete &= !!ixgbe_clean_tx_irq(q_vector, ring, budget);
 
 	if (!ixgbe_qv_lock_napi(q_vector))
 		return budget;
@@ -5636,6 +5724,14 @@ static int ixgbe_change_mtu(struct net_device *netdev, int new_mtu)
 	if ((new_mtu < 68) || (max_frame > IXGBE_MAX_JUMBO_FRAME_SIZE))
 		return -EINVAL;
 
+	/* XDP programs see one buffer, the frame must not spill over */
+	if (rtnl_dereference(adapter->xdp_prog) &&
+	    max_frame + VLAN_HLEN > IXGBE_RXBUFFER_2K) {
+		e_err(probe, "MTU %d too large while an XDP program is attached\n",
+		      new_mtu);
+		return -EINVAL;
+	}
+
 	/*
 	 * For 82599EB we cannot allow legacy VFs to enable their receive
 	 * paths when MTU greater than 1500 is configured.  So display a
@@ -7779,6 +7875,10 @@ static netdev_features_t ixgbe_fix_features(struct net_device *netdev,
 	if (!(adapter->flags2 & IXGBE_FLAG2_RSC_CAPABLE))
 		features &= ~NETIF_F_LRO;
 
+	/* Turn off LRO while XDP needs each frame in a single buffer */
+	if (rtnl_dereference(adapter->xdp_prog))
+		features &= ~NETIF_F_LRO;
+
 	return features;
 }
 
@@ -8147,6 +8247,45 @@ static void ixgbe_fwd_del(struct net_device *pdev, void *priv)
 	kfree(fwd_adapter);
 }
 
+static int ixgbe_xdp_setup(struct net_device *dev, struct bpf_prog *prog)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(dev);
+	int max_frame = dev->mtu + ETH_HLEN + ETH_FCS_LEN + VLAN_HLEN;
+	struct bpf_prog *old_prog;
+
+	/* the program sees one buffer, a frame must not spill over */
+	if (prog && max_frame > IXGBE_RXBUFFER_2K) {
+		e_err(probe, "MTU %d too large for XDP\n", dev->mtu);
+		return -EOPNOTSUPP;
+	}
+
+	old_prog = rtnl_dereference(adapter->xdp_prog);
+	rcu_assign_pointer(adapter->xdp_prog, prog);
+	if (old_prog)
+		bpf_prog_put(old_prog);
+
+	/* RSC chains several frames per descriptor, drop it while attached */
+	if (!!prog != !!old_prog)
+		netdev_update_features(dev);
+
+	return 0;
+}
+
+static int ixgbe_xdp(struct net_device *dev, struct netdev_xdp *xdp)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(dev);
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		return ixgbe_xdp_setup(dev, xdp->prog);
+	case XDP_QUERY_PROG:
+		xdp->prog_attached = !!rtnl_dereference(adapter->xdp_prog);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 static const struct net_device_ops ixgbe_netdev_ops = {
 	.ndo_open		= ixgbe_open,
 	.ndo_stop		= ixgbe_close,
@@ -8194,6 +8333,7 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 	.ndo_dfwd_del_station	= ixgbe_fwd_del,
 	.ndo_add_vxlan_port	= ixgbe_add_vxlan_port,
 	.ndo_del_vxlan_port	= ixgbe_del_vxlan_port,
+	.ndo_xdp		= ixgbe_xdp,
 };
 
 /**
@@ -8833,6 +8973,8 @@ static void ixgbe_remove(struct pci_dev *pdev)
 	e_dev_info("complete\n");
 
 	kfree(adapter->mac_table);
+	if (rcu_access_pointer(adapter->xdp_prog))
+		bpf_prog_put(rcu_dereference_protected(adapter->xdp_prog, 1));
 	disable_dev = !test_and_set_bit(__IXGBE_DISABLED, &adapter->state);
 	free_netdev(netdev);
 
@@ -41,6 +41,7 @@
 #include <linux/if_vlan.h>
 #include <linux/vmalloc.h>
 #include <linux/irq.h>
+#include <linux/filter.h>
 
 #if IS_ENABLED(CONFIG_IPV6)
 #include <net/ip6_checksum.h>
@@ -580,7 +581,7 @@ static int mlx4_en_complete_rx_desc(struct mlx4_en_priv *priv,
 fail:
 	while (nr > 0) {
 		nr--;
-		__skb_frag_unref(&skb_frags_rx[nr]);
+		__skb_frag_unref(&skb_frags_rx[nr], false);
 	}
 	return 0;
 }
@@ -747,6 +748,28 @@ static int check_csum(struct mlx4_cqe *cqe, struct sk_buff *skb, void *va,
 	return 0;
 }
 
+/* There is no tx ring dedicated to XDP: build an skb of the packet the
+ * program rewrote and send it back out of the port through the normal
+ * xmit path.
+ */
+static void mlx4_en_xdp_bounce(struct mlx4_en_priv *priv,
+			       struct mlx4_en_rx_desc *rx_desc,
+			       struct mlx4_en_rx_alloc *frags,
+			       unsigned int length)
+{
+	struct sk_buff *skb;
+
+	skb = mlx4_en_rx_skb(priv, rx_desc, frags, length);
+	if (!skb) {
+		priv->stats.rx_dropped++;
+		return;
+	}
+
+	skb->dev = priv->dev;
+	skb->protocol = ((struct ethhdr *)skb->data)->h_proto;
+	dev_queue_xmit(skb);
+}
+
 int mlx4_en_process_rx_cq(struct net_device *dev, struct mlx4_en_cq *cq, int budget)
 {
 	struct mlx4_en_priv *priv = netdev_priv(dev);
@@ -764,6 +787,7 @@ int mlx4_en_process_rx_cq(struct net_device *dev, struct mlx4_en_cq *cq, int bud
 	int factor = priv->cqe_factor;
 	u64 timestamp;
 	bool l2_tunnel;
+	struct bpf_prog *xdp_prog;
 
 	if (!priv->port_up)
 		return 0;
@@ -771,6 +795,10 @@ int mlx4_en_process_rx_cq(struct net_device *dev, struct mlx4_en_cq *cq, int bud
 	if (budget <= 0)
 		return polled;
 
+	/* the program is freed after a grace period once swapped out */
+	rcu_read_lock();
+	xdp_prog = rcu_dereference(priv->xdp_prog);
+
 	/* We assume a 1:1 mapping between CQEs and Rx descriptors, so Rx
 	 * descriptor offset can be deduced from the CQE index instead of
 	 * reading 'cqe->index' */
@@ -844,6 +872,38 @@ int mlx4_en_process_rx_cq(struct net_device *dev, struct mlx4_en_cq *cq, int bud
 		length -= ring->fcs_del;
 		ring->bytes += length;
 		ring->packets++;
+
+		/* A bpf program gets first chance to drop the packet, before
+		 * any skb is built for it. The mtu is limited so that the
+		 * whole packet sits in the first frag.
+		 */
+		if (xdp_prog) {
+			struct xdp_buff xdp;
+			dma_addr_t dma;
+			u32 act;
+
+			dma = be64_to_cpu(rx_desc->data[0].addr);
+			dma_sync_single_for_cpu(priv->ddev, dma, length,
+						DMA_FROM_DEVICE);
+
+			xdp.data = page_address(frags[0].page) +
+				   frags[0].page_offset;
+			xdp.data_end = xdp.data + length;
+
+			act = bpf_prog_run_xdp(xdp_prog, &xdp);
+			switch (act) {
+			case XDP_PASS:
+				break;
+			case XDP_TX:
+				mlx4_en_xdp_bounce(priv, rx_desc, frags, length);
+				goto next;
+			default:
+				bpf_warn_invalid_xdp_action(act);
+			case XDP_ABORTED:
+			case XDP_DROP:
+				goto next;
+			}
+		}
 		l2_tunnel = (dev->hw_enc_features & NETIF_F_RXCSUM) &&
 			(cqe->vlan_my_qpn & cpu_to_be32(MLX4_CQE_L2_TUNNEL));
 
@@ -1000,6 +1060,7 @@ next:
 	}
 
 out:
+	rcu_read_unlock();
 	AVG_PERF_COUNTER(priv->pstats.rx_coal_avg, polled);
 	mlx4_cq_set_ci(&cq->mcq);
 	wmb(); /* ensure HW sees CQ consumer before we post new buffers */
@@ -113,6 +113,9 @@ enum {
 };
 #define MLX4_EN_MAX_RX_FRAGS	4
 
+/* XDP programs see the packet in the first frag only */
+#define MLX4_EN_XDP_MAX_MTU	(FRAG_SZ0 - ETH_HLEN - VLAN_HLEN)
+
 /* Maximum ring sizes */
 #define MLX4_EN_MAX_TX_SIZE	8192
 #define MLX4_EN_MAX_RX_SIZE	8192
@@ -550,6 +553,7 @@ struct mlx4_en_priv {
 	struct mlx4_en_frag_info frag_info[MLX4_EN_MAX_RX_FRAGS];
 	u16 num_frags;
 	u16 log_rx_info;
+	struct bpf_prog __rcu *xdp_prog;
 
 	struct mlx4_en_tx_ring **tx_ring;
 	struct mlx4_en_rx_ring *rx_ring[MAX_RX_RINGS];
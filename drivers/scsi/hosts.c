@@ -23,6 +23,7 @@
 
 #include <linux/module.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/kthread.h>
@@ -34,6 +35,7 @@
 #include <linux/platform_device.h>
 #include <linux/pm_runtime.h>
 
+#include <scsi/scsi_cmnd.h>
 #include <scsi/scsi_device.h>
 #include <scsi/scsi_host.h>
 #include <scsi/scsi_transport.h>
@@ -580,6 +582,35 @@ void scsi_host_put(struct Scsi_Host *shost)
 }
 EXPORT_SYMBOL(scsi_host_put);
 
+static void scsi_count_inflight(struct request *rq, void *data,
+				bool reserved)
+{
+	struct scsi_cmnd *cmd = blk_mq_rq_to_pdu(rq);
+	int *count = data;
+
+	if (test_bit(SCMD_STATE_INFLIGHT, &cmd->state))
+		(*count)++;
+}
+
+/**
+ * scsi_host_busy - Return the number of commands active on a host
+ * @shost:	Pointer to Scsi_Host.
+ *
+ * With blk-mq this walks the tags of the host, so keep it out of the
+ * I/O path.
+ **/
+int scsi_host_busy(struct Scsi_Host *shost)
+{
+	int count = 0;
+
+	if (!shost_use_blk_mq(shost))
+		return atomic_read(&shost->host_busy);
+
+	blk_mq_tagset_busy_iter(&shost->tag_set, scsi_count_inflight, &count);
+	return count;
+}
+EXPORT_SYMBOL(scsi_host_busy);
+
 int scsi_init_hosts(void)
 {
 	return class_register(&shost_class);
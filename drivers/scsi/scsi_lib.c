@@ -154,7 +154,7 @@ static void __scsi_queue_insert(struct scsi_cmnd *cmd, int reason, int unbusy)
 	 * active on the host/device.
 	 */
 	if (unbusy)
-		scsi_device_unbusy(device);
+		scsi_device_unbusy(device, cmd);
 
 	/*
 	 * Requeue this command.  It will go before all other commands
@@ -305,13 +305,16 @@ static void scsi_init_cmd_errh(struct scsi_cmnd *cmd)
 		cmd->cmd_len = scsi_command_size(cmd->cmnd);
 }
 
-void scsi_device_unbusy(struct scsi_device *sdev)
+void scsi_device_unbusy(struct scsi_device *sdev, struct scsi_cmnd *cmd)
 {
 	struct Scsi_Host *shost = sdev->host;
 	struct scsi_target *starget = scsi_target(sdev);
 	unsigned long flags;
 
-	atomic_dec(&shost->host_busy);
+	if (shost_use_blk_mq(shost))
+		clear_bit(SCMD_STATE_INFLIGHT, &cmd->state);
+	else
+		atomic_dec(&shost->host_busy);
 	if (starget->can_queue > 0)
 		atomic_dec(&starget->target_busy);
 
@@ -402,7 +405,7 @@ static inline bool scsi_target_is_busy(struct scsi_target *starget)
 static inline bool scsi_host_is_busy(struct Scsi_Host *shost)
 {
 	if (shost->can_queue > 0 &&
-	    atomic_read(&shost->host_busy) >= shost->can_queue)
+	    scsi_host_busy(shost) >= shost->can_queue)
 		return true;
 	if (atomic_read(&shost->host_blocked) > 0)
 		return true;
@@ -1402,7 +1405,7 @@ static void scsi_unprep_fn(struct request_queue *q, struct request *req)
  * scsi_dev_queue_ready: if we can send requests to sdev, return 1 else
  * return 0.
  *
- * Called with the queue_lock held.
+ * Called with the queue_lock held, or to take a blk-mq dispatch budget.
  */
 static inline int scsi_dev_queue_ready(struct request_queue *q,
 				  struct scsi_device *sdev)
@@ -1496,17 +1499,27 @@ out_dec:
  * scsi_host_queue_ready: if we can send requests to shost, return 1 else
  * return 0. We must end up running the queue again whenever 0 is
  * returned, else IO can hang.
+ *
+ * With blk-mq the host-wide tag set already keeps the host below
+ * can_queue, so no shared busy count is touched here; the commands
+ * active on the host are only counted while it is blocked.
  */
 static inline int scsi_host_queue_ready(struct request_queue *q,
 				   struct Scsi_Host *shost,
 				   struct scsi_device *sdev)
 {
+	bool mq = shost_use_blk_mq(shost);
 	unsigned int busy;
 
 	if (scsi_host_in_recovery(shost))
 		return 0;
 
-	busy = atomic_inc_return(&shost->host_busy) - 1;
+	if (!mq)
+		busy = atomic_inc_return(&shost->host_busy) - 1;
+	else if (atomic_read(&shost->host_blocked) > 0)
+		busy = scsi_host_busy(shost);
+	else
+		busy = 0;
 	if (atomic_read(&shost->host_blocked) > 0) {
 		if (busy)
 			goto starved;
@@ -1522,7 +1535,7 @@ static inline int scsi_host_queue_ready(struct request_queue *q,
 				     "unblocking host at zero depth\n"));
 	}
 
-	if (shost->can_queue > 0 && busy >= shost->can_queue)
+	if (!mq && shost->can_queue > 0 && busy >= shost->can_queue)
 		goto starved;
 	if (shost->host_self_blocked)
 		goto starved;
@@ -1543,7 +1556,8 @@ starved:
 		list_add_tail(&sdev->starved_entry, &shost->starved_list);
 	spin_unlock_irq(shost->host_lock);
 out_dec:
-	atomic_dec(&shost->host_busy);
+	if (!mq)
+		atomic_dec(&shost->host_busy);
 	return 0;
 }
 
@@ -1963,6 +1977,33 @@ static void scsi_mq_done(struct scsi_cmnd *cmd)
 	blk_mq_complete_request(cmd->request);
 }
 
+/*
+ * The dispatch budget of a request is a slot of the per-device queue
+ * depth, i.e. a device_busy count that scsi_device_unbusy() drops when the
+ * command completes.
+ */
+static bool scsi_mq_get_budget(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct scsi_device *sdev = q->queuedata;
+
+	if (scsi_dev_queue_ready(q, sdev))
+		return true;
+
+	/* scsi_run_queue() restarts us once a command completes */
+	blk_mq_stop_hw_queue(hctx);
+	if (atomic_read(&sdev->device_busy) == 0 && !scsi_device_blocked(sdev))
+		blk_mq_delay_queue(hctx, SCSI_QUEUE_DELAY);
+	return false;
+}
+
+static void scsi_mq_put_budget(struct blk_mq_hw_ctx *hctx)
+{
+	struct scsi_device *sdev = hctx->queue->queuedata;
+
+	atomic_dec(&sdev->device_busy);
+}
+
 static int scsi_queue_rq(struct blk_mq_hw_ctx *hctx,
 			 const struct blk_mq_queue_data *bd)
 {
@@ -1974,18 +2015,17 @@ static int scsi_queue_rq(struct blk_mq_hw_ctx *hctx,
 	int ret;
 	int reason;
 
+	/* The dispatch budget is held already, see scsi_mq_get_budget() */
 	ret = prep_to_mq(scsi_prep_state_check(sdev, req));
 	if (ret)
-		goto out;
+		goto out_put_budget;
 
 	ret = BLK_MQ_RQ_QUEUE_BUSY;
 	if (!get_device(&sdev->sdev_gendev))
-		goto out;
+		goto out_put_budget;
 
-	if (!scsi_dev_queue_ready(q, sdev))
-		goto out_put_device;
 	if (!scsi_target_queue_ready(shost, sdev))
-		goto out_dec_device_busy;
+		goto out_put_device;
 	if (!scsi_host_queue_ready(q, shost, sdev))
 		goto out_dec_target_busy;
 
@@ -2006,6 +2046,7 @@ static int scsi_queue_rq(struct blk_mq_hw_ctx *hctx,
 
 	scsi_init_cmd_errh(cmd);
 	cmd->scsi_done = scsi_mq_done;
+	set_bit(SCMD_STATE_INFLIGHT, &cmd->state);
 
 	reason = scsi_dispatch_cmd(cmd);
 	if (reason) {
@@ -2017,15 +2058,14 @@ static int scsi_queue_rq(struct blk_mq_hw_ctx *hctx,
 	return BLK_MQ_RQ_QUEUE_OK;
 
 out_dec_host_busy:
-	atomic_dec(&shost->host_busy);
+	clear_bit(SCMD_STATE_INFLIGHT, &cmd->state);
 out_dec_target_busy:
 	if (scsi_target(sdev)->can_queue > 0)
 		atomic_dec(&scsi_target(sdev)->target_busy);
-out_dec_device_busy:
-	atomic_dec(&sdev->device_busy);
 out_put_device:
 	put_device(&sdev->sdev_gendev);
-out:
+out_put_budget:
+	scsi_mq_put_budget(hctx);
 	switch (ret) {
 	case BLK_MQ_RQ_QUEUE_BUSY:
 		blk_mq_stop_hw_queue(hctx);
@@ -2165,6 +2205,8 @@ struct request_queue *scsi_alloc_queue(struct scsi_device *sdev)
 
 static struct blk_mq_ops scsi_mq_ops = {
 	.map_queue	= blk_mq_map_queue,
+	.get_budget	= scsi_mq_get_budget,
+	.put_budget	= scsi_mq_put_budget,
 	.queue_rq	= scsi_queue_rq,
 	.complete	= scsi_softirq_done,
 	.timeout	= scsi_timeout,
@@ -43,6 +43,9 @@ MODULE_PARM_DESC(experimental_zcopytx, "Enable Zero Copy TX;"
 #define VHOST_MAX_PEND 128
 #define VHOST_GOODCOPY_LEN 256
 
+/* Max number of used buffers held back before updating the used ring. */
+#define VHOST_NET_BATCH 64
+
 /*
  * For transmit, used buffer len is unused; we override it to track buffer
  * status internally; used for zerocopy tx only.
@@ -62,7 +65,8 @@ enum {
 	VHOST_NET_FEATURES = VHOST_FEATURES |
 			 (1ULL << VHOST_NET_F_VIRTIO_NET_HDR) |
 			 (1ULL << VIRTIO_NET_F_MRG_RXBUF) |
-			 (1ULL << VIRTIO_F_VERSION_1),
+			 (1ULL << VIRTIO_F_VERSION_1) |
+			 (1ULL << VIRTIO_F_RING_PACKED),
 };
 
 enum {
@@ -89,7 +93,8 @@ struct vhost_net_virtqueue {
 	/* vhost zerocopy support fields below: */
 	/* last used idx for outstanding DMA zerocopy buffers */
 	int upend_idx;
-	/* first used idx for DMA done zerocopy buffers */
+	/* For zerocopy TX, first used idx for DMA done zerocopy buffers.
+	 * Otherwise, number of used buffers batched in vq->heads. */
 	int done_idx;
 	/* an array of userspace buffers info */
 	struct ubuf_info *ubuf_info;
@@ -262,6 +267,18 @@ static void vhost_zerocopy_signal_used(struct vhost_net *net,
 	}
 }
 
+/* Add the batched used buffers to the used ring and notify the guest. */
+static void vhost_net_signal_used(struct vhost_net_virtqueue *nvq)
+{
+	struct vhost_virtqueue *vq = &nvq->vq;
+
+	if (!nvq->done_idx)
+		return;
+
+	vhost_add_used_and_signal_n(vq->dev, vq, vq->heads, nvq->done_idx);
+	nvq->done_idx = 0;
+}
+
 static void vhost_zerocopy_callback(struct ubuf_info *ubuf, bool success)
 {
 	struct vhost_net_ubuf_ref *ubufs = ubuf->ctx;
@@ -288,6 +305,50 @@ static void vhost_zerocopy_callback(struct ubuf_info *ubuf, bool success)
 	rcu_read_unlock_bh();
 }
 
+static unsigned long busy_clock(void)
+{
+	return local_clock() >> 10;
+}
+
+static bool vhost_can_busy_poll(struct vhost_dev *dev,
+				unsigned long endtime)
+{
+	return likely(!need_resched()) &&
+	       likely(!time_after(busy_clock(), endtime)) &&
+	       likely(!signal_pending(current)) &&
+	       !vhost_has_work(dev);
+}
+
+/* Like vhost_get_vq_desc(), but busy polls the ring for a while when it is
+ * empty instead of going straight back to waiting for a kick. */
+static int vhost_net_tx_get_vq_desc(struct vhost_net *net,
+				    struct vhost_net_virtqueue *nvq,
+				    unsigned int *out_num,
+				    unsigned int *in_num, bool zcopy)
+{
+	struct vhost_virtqueue *vq = &nvq->vq;
+	unsigned long uninitialized_var(endtime);
+	int r = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
+				  out_num, in_num, NULL, NULL);
+
+	if (r == vq->num && vq->busyloop_timeout) {
+		/* Let the guest reclaim what we sent so far. */
+		if (!zcopy)
+			vhost_net_signal_used(nvq);
+
+		preempt_disable();
+		endtime = busy_clock() + vq->busyloop_timeout;
+		while (vhost_can_busy_poll(vq->dev, endtime) &&
+		       vhost_vq_avail_empty(vq->dev, vq))
+			cpu_relax_lowlatency();
+		preempt_enable();
+		r = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
+				      out_num, in_num, NULL, NULL);
+	}
+
+	return r;
+}
+
 /* Expects to be always run from workqueue - which acts as
  * read-size critical section for our kind of RCU. */
 static void handle_tx(struct vhost_net *net)
@@ -328,14 +389,12 @@ static void handle_tx(struct vhost_net *net)
 		/* If more outstanding DMAs, queue the work.
 		 * Handle upend_idx wrap around
 		 */
-		if (unlikely((nvq->upend_idx + vq->num - VHOST_MAX_PEND)
+		if (zcopy &&
+		    unlikely((nvq->upend_idx + vq->num - VHOST_MAX_PEND)
 			      % UIO_MAXIOV == nvq->done_idx))
 			break;
 
-		head = vhost_get_vq_desc(vq, vq->iov,
-					 ARRAY_SIZE(vq->iov),
-					 &out, &in,
-					 NULL, NULL);
+		head = vhost_net_tx_get_vq_desc(net, nvq, &out, &in, zcopy);
 		/* On error, stop handling until the next kick. */
 		if (unlikely(head < 0))
 			break;
@@ -403,10 +462,16 @@ static void handle_tx(struct vhost_net *net)
 		if (err != len)
 			pr_debug("Truncated TX packet: "
 				 " len %d != %zd\n", err, len);
-		if (!zcopy_used)
-			vhost_add_used_and_signal(&net->dev, vq, head, 0);
-		else
+		if (zcopy_used)
 			vhost_zerocopy_signal_used(net, vq);
+		else if (zcopy)
+			vhost_add_used_and_signal(&net->dev, vq, head, 0);
+		else {
+			vq->heads[nvq->done_idx].id = cpu_to_vhost32(vq, head);
+			vq->heads[nvq->done_idx].len = 0;
+			if (++nvq->done_idx >= VHOST_NET_BATCH)
+				vhost_net_signal_used(nvq);
+		}
 		total_len += len;
 		vhost_net_tx_packet(net);
 		if (unlikely(total_len >= VHOST_NET_WEIGHT)) {
@@ -414,6 +479,8 @@ static void handle_tx(struct vhost_net *net)
 			break;
 		}
 	}
+	if (!zcopy)
+		vhost_net_signal_used(nvq);
 out:
 	mutex_unlock(&vq->mutex);
 }
@@ -436,6 +503,45 @@ static int peek_head_len(struct sock *sk)
 	return len;
 }
 
+/* Busy poll both the rx socket and the tx ring while the socket is empty,
+ * so that a request/response workload does not sleep in between. */
+static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk)
+{
+	struct vhost_net_virtqueue *rnvq = &net->vqs[VHOST_NET_VQ_RX];
+	struct vhost_virtqueue *rvq = &rnvq->vq;
+	struct vhost_virtqueue *tvq = &net->vqs[VHOST_NET_VQ_TX].vq;
+	unsigned long uninitialized_var(endtime);
+	bool poll_tx;
+	int len = peek_head_len(sk);
+
+	if (!len && rvq->busyloop_timeout) {
+		/* Let the guest see what we received so far. */
+		vhost_net_signal_used(rnvq);
+
+		/* Nests inside the rx vq mutex, like vhost_dev_lock_vqs(). */
+		mutex_lock_nested(&tvq->mutex, 1);
+		poll_tx = tvq->private_data;
+		if (poll_tx)
+			vhost_disable_notify(&net->dev, tvq);
+
+		preempt_disable();
+		endtime = busy_clock() + rvq->busyloop_timeout;
+		while (vhost_can_busy_poll(&net->dev, endtime) &&
+		       skb_queue_empty(&sk->sk_receive_queue) &&
+		       (!poll_tx || vhost_vq_avail_empty(&net->dev, tvq)))
+			cpu_relax_lowlatency();
+		preempt_enable();
+
+		if (poll_tx && vhost_enable_notify(&net->dev, tvq))
+			vhost_poll_queue(&tvq->poll);
+		mutex_unlock(&tvq->mutex);
+
+		len = peek_head_len(sk);
+	}
+
+	return len;
+}
+
 /* This is a multi-buffer version of vhost_get_desc, that works if
  *	vq has read descriptors only.
  * @vq		- the relevant virtqueue
@@ -554,12 +660,13 @@ static void handle_rx(struct vhost_net *net)
 		vq->log : NULL;
 	mergeable = vhost_has_feature(vq, VIRTIO_NET_F_MRG_RXBUF);
 
-	while ((sock_len = peek_head_len(sock->sk))) {
+	while ((sock_len = vhost_net_rx_peek_head_len(net, sock->sk))) {
 		sock_len += sock_hlen;
 		vhost_len = sock_len + vhost_hlen;
-		headcount = get_rx_bufs(vq, vq->heads, vhost_len,
-					&in, vq_log, &log,
-					likely(mergeable) ? UIO_MAXIOV : 1);
+		headcount = get_rx_bufs(vq, vq->heads + nvq->done_idx,
+					vhost_len, &in, vq_log, &log,
+					likely(mergeable) ?
+					UIO_MAXIOV - nvq->done_idx : 1);
 		/* On error, stop handling until the next kick. */
 		if (unlikely(headcount < 0))
 			break;
@@ -627,8 +734,9 @@ static void handle_rx(struct vhost_net *net)
 			vhost_discard_vq_desc(vq, headcount);
 			break;
 		}
-		vhost_add_used_and_signal_n(&net->dev, vq, vq->heads,
-					    headcount);
+		nvq->done_idx += headcount;
+		if (nvq->done_idx > VHOST_NET_BATCH)
+			vhost_net_signal_used(nvq);
 		if (unlikely(vq_log))
 			vhost_log_write(vq, vq_log, log, vhost_len);
 		total_len += vhost_len;
@@ -637,6 +745,7 @@ static void handle_rx(struct vhost_net *net)
 			break;
 		}
 	}
+	vhost_net_signal_used(nvq);
 out:
 	mutex_unlock(&vq->mutex);
 }
@@ -168,6 +168,13 @@ void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
 }
 EXPORT_SYMBOL_GPL(vhost_work_queue);
 
+/* A lockless hint for busy polling code to exit the loop */
+bool vhost_has_work(struct vhost_dev *dev)
+{
+	return !list_empty(&dev->work_list);
+}
+EXPORT_SYMBOL_GPL(vhost_has_work);
+
 void vhost_poll_queue(struct vhost_poll *poll)
 {
 	vhost_work_queue(poll->dev, &poll->work);
@@ -186,6 +193,10 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->last_used_idx = 0;
 	vq->signalled_used = 0;
 	vq->signalled_used_valid = false;
+	vq->avail_wrap_counter = true;
+	vq->used_wrap_counter = true;
+	vq->signalled_used_wrap = true;
+	vq->fetched_idx = 0;
 	vq->used_flags = 0;
 	vq->log_used = false;
 	vq->log_addr = -1ull;
@@ -198,6 +209,7 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->call_ctx = NULL;
 	vq->call = NULL;
 	vq->log_ctx = NULL;
+	vq->busyloop_timeout = 0;
 	vq->memory = NULL;
 }
 
@@ -258,6 +270,8 @@ static void vhost_vq_free_iovecs(struct vhost_virtqueue *vq)
 	vq->log = NULL;
 	kfree(vq->heads);
 	vq->heads = NULL;
+	kfree(vq->packed_ndescs);
+	vq->packed_ndescs = NULL;
 }
 
 /* Helper to allocate iovec buffers for all vqs. */
@@ -313,6 +327,7 @@ void vhost_dev_init(struct vhost_dev *dev,
 		vq->log = NULL;
 		vq->indirect = NULL;
 		vq->heads = NULL;
+		vq->packed_ndescs = NULL;
 		vq->dev = dev;
 		mutex_init(&vq->mutex);
 		vhost_vq_reset(dev, vq);
@@ -552,6 +567,14 @@ static int vq_access_ok(struct vhost_virtqueue *vq, unsigned int num,
 			struct vring_used __user *used)
 {
 	size_t s = vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
+
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED))
+		return access_ok(VERIFY_WRITE, desc,
+				 num * sizeof(struct vring_packed_desc)) &&
+		       access_ok(VERIFY_READ, avail,
+				 sizeof(struct vring_packed_desc_event)) &&
+		       access_ok(VERIFY_WRITE, used,
+				 sizeof(struct vring_packed_desc_event));
 	return access_ok(VERIFY_READ, desc, num * sizeof *desc) &&
 	       access_ok(VERIFY_READ, avail,
 			 sizeof *avail + num * sizeof *avail->ring + s) &&
@@ -687,15 +710,38 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			break;
 		}
 		vq->last_avail_idx = s.num;
+		/* A packed ring base carries the wrap counter in bit 15. */
+		if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED)) {
+			vq->avail_wrap_counter =
+				s.num >> VRING_PACKED_EVENT_F_WRAP_CTR;
+			vq->last_avail_idx &=
+				~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+		}
 		/* Forget the cached index value. */
 		vq->avail_idx = vq->last_avail_idx;
 		break;
 	case VHOST_GET_VRING_BASE:
 		s.index = idx;
 		s.num = vq->last_avail_idx;
+		if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED))
+			s.num |= (u32)vq->avail_wrap_counter <<
+				 VRING_PACKED_EVENT_F_WRAP_CTR;
 		if (copy_to_user(argp, &s, sizeof s))
 			r = -EFAULT;
 		break;
+	case VHOST_SET_VRING_BUSYLOOP_TIMEOUT:
+		if (copy_from_user(&s, argp, sizeof(s))) {
+			r = -EFAULT;
+			break;
+		}
+		vq->busyloop_timeout = s.num;
+		break;
+	case VHOST_GET_VRING_BUSYLOOP_TIMEOUT:
+		s.index = idx;
+		s.num = vq->busyloop_timeout;
+		if (copy_to_user(argp, &s, sizeof(s)))
+			r = -EFAULT;
+		break;
 	case VHOST_SET_VRING_ADDR:
 		if (copy_from_user(&a, argp, sizeof a)) {
 			r = -EFAULT;
@@ -705,6 +751,12 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EOPNOTSUPP;
 			break;
 		}
+		/* Used ring logging only knows about the split layout. */
+		if ((a.flags & (0x1 << VHOST_VRING_F_LOG)) &&
+		    vhost_has_feature(vq, VIRTIO_F_RING_PACKED)) {
+			r = -EOPNOTSUPP;
+			break;
+		}
 		/* For 32bit, verify that the top 32bits of the user
 		   data are set to zero. */
 		if ((u64)(unsigned long)a.desc_user_addr != a.desc_user_addr ||
@@ -1041,6 +1093,60 @@ static int vhost_update_avail_event(struct vhost_virtqueue *vq, u16 avail_event)
 	return 0;
 }
 
+/* Tell the guest whether, and from which descriptor on, we want kicks. */
+static int vhost_update_device_event(struct vhost_virtqueue *vq)
+{
+	u16 flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	u16 off_wrap;
+
+	if (!(vq->used_flags & VRING_USED_F_NO_NOTIFY)) {
+		if (vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
+			off_wrap = vq->last_avail_idx |
+				   (u16)vq->avail_wrap_counter <<
+				   VRING_PACKED_EVENT_F_WRAP_CTR;
+			if (__put_user(cpu_to_le16(off_wrap),
+				       &vq->device_event->off_wrap))
+				return -EFAULT;
+			/* Make sure the offset is seen before the flags. */
+			smp_wmb();
+			flags = VRING_PACKED_EVENT_FLAG_DESC;
+		} else {
+			flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+		}
+	}
+	if (__put_user(cpu_to_le16(flags), &vq->device_event->flags))
+		return -EFAULT;
+	return 0;
+}
+
+static int vhost_init_used_packed(struct vhost_virtqueue *vq)
+{
+	u16 *ndescs;
+
+	/* The packed layout is little-endian only, its indices leave the top
+	 * bit for the wrap counter, and used ring logging only knows about
+	 * the split layout. */
+	if (!vhost_has_feature(vq, VIRTIO_F_VERSION_1) ||
+	    vq->num > 1 << VRING_PACKED_EVENT_F_WRAP_CTR || vq->log_used)
+		return -EINVAL;
+
+	ndescs = kmalloc(2 * vq->num * sizeof(*ndescs), GFP_KERNEL);
+	if (!ndescs)
+		return -ENOMEM;
+	kfree(vq->packed_ndescs);
+	vq->packed_ndescs = ndescs;
+	vq->packed_fetched = ndescs + vq->num;
+	vq->fetched_idx = 0;
+
+	/* There is no used index in guest memory to resume from: everything
+	 * before the base userspace gave us has been used. */
+	vq->last_used_idx = vq->last_avail_idx;
+	vq->used_wrap_counter = vq->avail_wrap_counter;
+	vq->signalled_used_valid = false;
+
+	return vhost_update_device_event(vq);
+}
+
 int vhost_init_used(struct vhost_virtqueue *vq)
 {
 	__virtio16 last_used_idx;
@@ -1048,6 +1154,9 @@ int vhost_init_used(struct vhost_virtqueue *vq)
 	if (!vq->private_data)
 		return 0;
 
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED))
+		return vhost_init_used_packed(vq);
+
 	r = vhost_update_used_flags(vq);
 	if (r)
 		return r;
@@ -1209,6 +1318,208 @@ static int get_indirect(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+static bool vhost_packed_desc_avail(u16 flags, bool wrap_counter)
+{
+	bool avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	bool used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+
+	return avail == wrap_counter && used != wrap_counter;
+}
+
+/* Has the guest made the descriptor at last_avail_idx available?  Returns 1
+ * if so, 0 if not, or a negative error. */
+static int vhost_packed_avail(struct vhost_virtqueue *vq)
+{
+	__le16 flags;
+
+	if (unlikely(__get_user(flags,
+				&vq->desc_packed[vq->last_avail_idx].flags))) {
+		vq_err(vq, "Failed to get descriptor flags at %p\n",
+		       &vq->desc_packed[vq->last_avail_idx].flags);
+		return -EFAULT;
+	}
+	return vhost_packed_desc_avail(le16_to_cpu(flags),
+				       vq->avail_wrap_counter);
+}
+
+/* Translate a packed ring descriptor, and account it as input or output. */
+static int packed_desc_to_iov(struct vhost_virtqueue *vq,
+			      struct vring_packed_desc *desc,
+			      struct iovec iov[], unsigned int iov_size,
+			      unsigned int *out_num, unsigned int *in_num,
+			      struct vhost_log *log, unsigned int *log_num)
+{
+	unsigned iov_count = *in_num + *out_num;
+	u64 addr = le64_to_cpu(desc->addr);
+	u32 len = le32_to_cpu(desc->len);
+	int ret;
+
+	ret = translate_desc(vq, addr, len, iov + iov_count,
+			     iov_size - iov_count);
+	if (unlikely(ret < 0)) {
+		vq_err(vq, "Translation failure %d\n", ret);
+		return ret;
+	}
+	if (desc->flags & cpu_to_le16(VRING_DESC_F_WRITE)) {
+		*in_num += ret;
+		if (unlikely(log)) {
+			log[*log_num].addr = addr;
+			log[*log_num].len = len;
+			++*log_num;
+		}
+	} else {
+		/* If it's an output descriptor, they're all supposed
+		 * to come before any input descriptors. */
+		if (unlikely(*in_num)) {
+			vq_err(vq, "Descriptor has out after in\n");
+			return -EINVAL;
+		}
+		*out_num += ret;
+	}
+	return 0;
+}
+
+/* Packed indirect tables are plain arrays: there is no next field. */
+static int get_indirect_packed(struct vhost_virtqueue *vq,
+			       struct iovec iov[], unsigned int iov_size,
+			       unsigned int *out_num, unsigned int *in_num,
+			       struct vhost_log *log, unsigned int *log_num,
+			       struct vring_packed_desc *indirect)
+{
+	struct vring_packed_desc desc;
+	u32 len = le32_to_cpu(indirect->len);
+	unsigned int i, count;
+	struct iov_iter from;
+	int ret;
+
+	/* Sanity check */
+	if (unlikely(!len || len % sizeof desc)) {
+		vq_err(vq, "Invalid length in indirect descriptor: "
+		       "len 0x%llx not multiple of 0x%zx\n",
+		       (unsigned long long)len,
+		       sizeof desc);
+		return -EINVAL;
+	}
+
+	ret = translate_desc(vq, le64_to_cpu(indirect->addr), len,
+			     vq->indirect, UIO_MAXIOV);
+	if (unlikely(ret < 0)) {
+		vq_err(vq, "Translation failure %d in indirect.\n", ret);
+		return ret;
+	}
+	iov_iter_init(&from, READ, vq->indirect, ret, len);
+
+	count = len / sizeof desc;
+	for (i = 0; i < count; i++) {
+		if (unlikely(copy_from_iter(&desc, sizeof(desc), &from) !=
+			     sizeof(desc))) {
+			vq_err(vq, "Failed indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)le64_to_cpu(indirect->addr) +
+			       i * sizeof desc);
+			return -EINVAL;
+		}
+		if (unlikely(desc.flags & cpu_to_le16(VRING_DESC_F_INDIRECT))) {
+			vq_err(vq, "Nested indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)le64_to_cpu(indirect->addr) +
+			       i * sizeof desc);
+			return -EINVAL;
+		}
+		ret = packed_desc_to_iov(vq, &desc, iov, iov_size,
+					 out_num, in_num, log, log_num);
+		if (unlikely(ret < 0)) {
+			vq_err(vq, "Failure detected in indirect idx %d\n", i);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* The packed ring version of vhost_get_vq_desc().  Returns the buffer id,
+ * which is what the guest expects to get back in the used descriptor. */
+static int vhost_get_vq_desc_packed(struct vhost_virtqueue *vq,
+				    struct iovec iov[], unsigned int iov_size,
+				    unsigned int *out_num, unsigned int *in_num,
+				    struct vhost_log *log,
+				    unsigned int *log_num)
+{
+	struct vring_packed_desc desc;
+	bool wrap_counter = vq->avail_wrap_counter;
+	u16 idx = vq->last_avail_idx;
+	unsigned int id, found = 0;
+	int ret;
+
+	ret = vhost_packed_avail(vq);
+	if (ret <= 0)
+		return ret ? ret : vq->num;
+
+	/* Only get the descriptor after it has been exposed by guest. */
+	smp_rmb();
+
+	/* When we start there are none of either input nor output. */
+	*out_num = *in_num = 0;
+	if (unlikely(log))
+		*log_num = 0;
+
+	do {
+		if (unlikely(++found > vq->num)) {
+			vq_err(vq, "Loop detected: last one at %u "
+			       "vq size %u\n", idx, vq->num);
+			return -EINVAL;
+		}
+		ret = __copy_from_user(&desc, vq->desc_packed + idx,
+				       sizeof desc);
+		if (unlikely(ret)) {
+			vq_err(vq, "Failed to get descriptor: idx %d addr %p\n",
+			       idx, vq->desc_packed + idx);
+			return -EFAULT;
+		}
+		if (desc.flags & cpu_to_le16(VRING_DESC_F_INDIRECT)) {
+			if (unlikely(desc.flags &
+				     cpu_to_le16(VRING_DESC_F_NEXT))) {
+				vq_err(vq, "Chained indirect descriptor: "
+				       "idx %d\n", idx);
+				return -EINVAL;
+			}
+			ret = get_indirect_packed(vq, iov, iov_size,
+						  out_num, in_num,
+						  log, log_num, &desc);
+		} else {
+			ret = packed_desc_to_iov(vq, &desc, iov, iov_size,
+						 out_num, in_num,
+						 log, log_num);
+		}
+		if (unlikely(ret < 0)) {
+			vq_err(vq, "Failure detected "
+			       "in descriptor at idx %d\n", idx);
+			return ret;
+		}
+
+		if (++idx >= vq->num) {
+			idx = 0;
+			wrap_counter ^= 1;
+		}
+	} while (desc.flags & cpu_to_le16(VRING_DESC_F_NEXT));
+
+	/* The buffer id is the one in the last descriptor of the chain. */
+	id = le16_to_cpu(desc.id);
+	if (unlikely(id >= vq->num)) {
+		vq_err(vq, "Guest says buffer id %u > %u is available",
+		       id, vq->num);
+		return -EINVAL;
+	}
+
+	/* On success, move past the chain and remember its length. */
+	vq->packed_ndescs[id] = found;
+	vq->packed_fetched[vq->fetched_idx++ & (vq->num - 1)] = id;
+	vq->last_avail_idx = idx;
+	vq->avail_wrap_counter = wrap_counter;
+
+	/* Assume notifications from guest are disabled at this point,
+	 * if they aren't we would need to update the device event. */
+	BUG_ON(!(vq->used_flags & VRING_USED_F_NO_NOTIFY));
+	return id;
+}
+
 /* This looks in the virtqueue and for the first available buffer, and converts
  * it to an iovec for convenient access.  Since descriptors consist of some
  * number of output then some number of input descriptors, it's actually two
@@ -1229,27 +1540,46 @@ int vhost_get_vq_desc(struct vhost_virtqueue *vq,
 	__virtio16 ring_head;
 	int ret;
 
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED))
+		return vhost_get_vq_desc_packed(vq, iov, iov_size,
+						out_num, in_num,
+						log, log_num);
+
 	/* Check it isn't doing very strange things with descriptor numbers. */
 	last_avail_idx = vq->last_avail_idx;
-	if (unlikely(__get_user(avail_idx, &vq->avail->idx))) {
-		vq_err(vq, "Failed to access avail idx at %p\n",
-		       &vq->avail->idx);
-		return -EFAULT;
-	}
-	vq->avail_idx = vhost16_to_cpu(vq, avail_idx);
 
-	if (unlikely((u16)(vq->avail_idx - last_avail_idx) > vq->num)) {
-		vq_err(vq, "Guest moved used index from %u to %u",
-		       last_avail_idx, vq->avail_idx);
-		return -EFAULT;
-	}
+	/*
+	 * Only re-read the avail index once the buffers seen last time are
+	 * used up, so that a burst of descriptors costs a single access to
+	 * the guest's cache line instead of one per descriptor.
+	 */
+	if (vq->avail_idx == last_avail_idx) {
+		if (unlikely(__get_user(avail_idx, &vq->avail->idx))) {
+			vq_err(vq, "Failed to access avail idx at %p\n",
+			       &vq->avail->idx);
+			return -EFAULT;
+		}
+		vq->avail_idx = vhost16_to_cpu(vq, avail_idx);
 
-	/* If there's nothing new since last we looked, return invalid. */
-	if (vq->avail_idx == last_avail_idx)
-		return vq->num;
+		if (unlikely((u16)(vq->avail_idx - last_avail_idx) > vq->num)) {
+			vq_err(vq, "Guest moved used index from %u to %u",
+			       last_avail_idx, vq->avail_idx);
+			return -EFAULT;
+		}
 
-	/* Only get avail ring entries after they have been exposed by guest. */
-	smp_rmb();
+		/*
+		 * If there's nothing new since last we looked, return
+		 * invalid.
+		 */
+		if (vq->avail_idx == last_avail_idx)
+			return vq->num;
+
+		/*
+		 * Only get avail ring entries after they have been exposed
+		 * by guest.
+		 */
+		smp_rmb();
+	}
 
 	/* Grab the next descriptor number they're advertising, and increment
 	 * the index we've seen. */
@@ -1346,9 +1676,28 @@ int vhost_get_vq_desc(struct vhost_virtqueue *vq,
 }
 EXPORT_SYMBOL_GPL(vhost_get_vq_desc);
 
+static void vhost_discard_vq_desc_packed(struct vhost_virtqueue *vq, int n)
+{
+	u16 id, ndescs;
+
+	while (n--) {
+		id = vq->packed_fetched[--vq->fetched_idx & (vq->num - 1)];
+		ndescs = vq->packed_ndescs[id];
+		if (vq->last_avail_idx < ndescs) {
+			vq->last_avail_idx += vq->num;
+			vq->avail_wrap_counter ^= 1;
+		}
+		vq->last_avail_idx -= ndescs;
+	}
+}
+
 /* Reverse the effect of vhost_get_vq_desc. Useful for error handling. */
 void vhost_discard_vq_desc(struct vhost_virtqueue *vq, int n)
 {
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED)) {
+		vhost_discard_vq_desc_packed(vq, n);
+		return;
+	}
 	vq->last_avail_idx -= n;
 }
 EXPORT_SYMBOL_GPL(vhost_discard_vq_desc);
@@ -1409,6 +1758,68 @@ static int __vhost_add_used_n(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* The packed ring version of vhost_add_used_n().  Each used descriptor
+ * goes where the guest expects it: right after the descriptors the
+ * previous buffer took when it was made available. */
+static int vhost_add_used_n_packed(struct vhost_virtqueue *vq,
+				   struct vring_used_elem *heads,
+				   unsigned count)
+{
+	struct vring_packed_desc __user *desc;
+	bool wrap_counter = vq->used_wrap_counter;
+	u16 idx = vq->last_used_idx;
+	__le16 flags, uninitialized_var(head_flags);
+	unsigned int i, id;
+
+	if (!count)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		id = vhost32_to_cpu(vq, heads[i].id);
+		if (unlikely(id >= vq->num)) {
+			vq_err(vq, "Used id %u > %u", id, vq->num);
+			return -EINVAL;
+		}
+		desc = vq->desc_packed + idx;
+		if (__put_user(cpu_to_le16(id), &desc->id) ||
+		    __put_user(cpu_to_le32(vhost32_to_cpu(vq, heads[i].len)),
+			       &desc->len)) {
+			vq_err(vq, "Failed to write used");
+			return -EFAULT;
+		}
+		flags = wrap_counter ?
+			cpu_to_le16(1 << VRING_PACKED_DESC_F_AVAIL |
+				    1 << VRING_PACKED_DESC_F_USED) : 0;
+		/* The first one is exposed last, below. */
+		if (i == 0)
+			head_flags = flags;
+		else if (__put_user(flags, &desc->flags)) {
+			vq_err(vq, "Failed to write used flags");
+			return -EFAULT;
+		}
+
+		idx += vq->packed_ndescs[id];
+		if (idx >= vq->num) {
+			idx -= vq->num;
+			wrap_counter ^= 1;
+			/* See __vhost_add_used_n(): twice around the ring
+			 * and signalled_used means nothing any more. */
+			if (wrap_counter == vq->signalled_used_wrap)
+				vq->signalled_used_valid = false;
+		}
+	}
+
+	/* Make sure the other buffers are written before the first one. */
+	smp_wmb();
+	if (__put_user(head_flags, &vq->desc_packed[vq->last_used_idx].flags)) {
+		vq_err(vq, "Failed to write used flags");
+		return -EFAULT;
+	}
+	vq->last_used_idx = idx;
+	vq->used_wrap_counter = wrap_counter;
+	return 0;
+}
+
 /* After we've used one of their buffers, we tell them about it.  We'll then
  * want to notify the guest, using eventfd. */
 int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
@@ -1416,6 +1827,9 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 {
 	int start, n, r;
 
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED))
+		return vhost_add_used_n_packed(vq, heads, count);
+
 	start = vq->last_used_idx % vq->num;
 	n = vq->num - start;
 	if (n < count) {
@@ -1445,6 +1859,49 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 }
 EXPORT_SYMBOL_GPL(vhost_add_used_n);
 
+static bool vhost_notify_packed(struct vhost_dev *dev,
+				struct vhost_virtqueue *vq)
+{
+	__le16 flags, off_wrap;
+	u16 old, new, event;
+	bool v;
+
+	/* Keep track of what we've signalled on even while the guest has
+	 * events disabled, so that old is recent when it turns them on. */
+	old = vq->signalled_used;
+	if (vq->signalled_used_wrap != vq->used_wrap_counter)
+		old -= vq->num;
+	v = vq->signalled_used_valid;
+	new = vq->signalled_used = vq->last_used_idx;
+	vq->signalled_used_wrap = vq->used_wrap_counter;
+	vq->signalled_used_valid = true;
+
+	if (__get_user(flags, &vq->driver_event->flags)) {
+		vq_err(vq, "Failed to get driver event flags");
+		return true;
+	}
+	if (flags == cpu_to_le16(VRING_PACKED_EVENT_FLAG_DISABLE))
+		return false;
+	if (flags != cpu_to_le16(VRING_PACKED_EVENT_FLAG_DESC) ||
+	    !vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX))
+		return true;
+
+	if (unlikely(!v))
+		return true;
+
+	/* Read the event offset after the flags that enable it. */
+	smp_rmb();
+	if (__get_user(off_wrap, &vq->driver_event->off_wrap)) {
+		vq_err(vq, "Failed to get driver event offset");
+		return true;
+	}
+	event = le16_to_cpu(off_wrap) & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((le16_to_cpu(off_wrap) >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+	    vq->used_wrap_counter)
+		event -= vq->num;
+	return vring_need_event(event, new, old);
+}
+
 static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__u16 old, new;
@@ -1455,6 +1912,9 @@ static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	 * interrupts. */
 	smp_mb();
 
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED))
+		return vhost_notify_packed(dev, vq);
+
 	if (vhost_has_feature(vq, VIRTIO_F_NOTIFY_ON_EMPTY) &&
 	    unlikely(vq->avail_idx == vq->last_avail_idx))
 		return true;
@@ -1511,6 +1971,26 @@ void vhost_add_used_and_signal_n(struct vhost_dev *dev,
 }
 EXPORT_SYMBOL_GPL(vhost_add_used_and_signal_n);
 
+/* Return true if the guest has not added buffers since we last looked. */
+bool vhost_vq_avail_empty(struct vhost_dev *dev, struct vhost_virtqueue *vq)
+{
+	__virtio16 avail_idx;
+	int r;
+
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED))
+		return vhost_packed_avail(vq) == 0;
+
+	if (vq->avail_idx != vq->last_avail_idx)
+		return false;
+
+	r = __get_user(avail_idx, &vq->avail->idx);
+	if (r)
+		return false;
+
+	return vhost16_to_cpu(vq, avail_idx) == vq->avail_idx;
+}
+EXPORT_SYMBOL_GPL(vhost_vq_avail_empty);
+
 /* OK, now we need to know about added descriptors. */
 bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
@@ -1520,6 +2000,17 @@ bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (!(vq->used_flags & VRING_USED_F_NO_NOTIFY))
 		return false;
 	vq->used_flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED)) {
+		r = vhost_update_device_event(vq);
+		if (r) {
+			vq_err(vq, "Failed to enable notification at %p: %d\n",
+			       vq->device_event, r);
+			return false;
+		}
+		/* See below. */
+		smp_mb();
+		return vhost_packed_avail(vq) > 0;
+	}
 	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r) {
@@ -1557,6 +2048,13 @@ void vhost_disable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (vq->used_flags & VRING_USED_F_NO_NOTIFY)
 		return;
 	vq->used_flags |= VRING_USED_F_NO_NOTIFY;
+	if (vhost_has_feature(vq, VIRTIO_F_RING_PACKED)) {
+		r = vhost_update_device_event(vq);
+		if (r)
+			vq_err(vq, "Failed to disable notification at %p: %d\n",
+			       vq->device_event, r);
+		return;
+	}
 	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r)
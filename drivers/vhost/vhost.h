@@ -56,12 +56,22 @@ struct vhost_log {
 struct vhost_virtqueue {
 	struct vhost_dev *dev;
 
-	/* The actual ring of buffers. */
+	/* The actual ring of buffers.  With VIRTIO_F_RING_PACKED, the avail
+	 * and used addresses are those of the driver and device event areas. */
 	struct mutex mutex;
 	unsigned int num;
-	struct vring_desc __user *desc;
-	struct vring_avail __user *avail;
-	struct vring_used __user *used;
+	union {
+		struct vring_desc __user *desc;
+		struct vring_packed_desc __user *desc_packed;
+	};
+	union {
+		struct vring_avail __user *avail;
+		struct vring_packed_desc_event __user *driver_event;
+	};
+	union {
+		struct vring_used __user *used;
+		struct vring_packed_desc_event __user *device_event;
+	};
 	struct file *kick;
 	struct file *call;
 	struct file *error;
@@ -92,6 +102,18 @@ struct vhost_virtqueue {
 	/* Last used index value we have signalled on */
 	bool signalled_used_valid;
 
+	/* Packed ring wrap counters for last_avail_idx, last_used_idx and
+	 * signalled_used. */
+	bool avail_wrap_counter;
+	bool used_wrap_counter;
+	bool signalled_used_wrap;
+
+	/* Packed ring: ring descriptors taken by each buffer id, and the ids
+	 * of the last buffers fetched, so they can be discarded. */
+	u16 *packed_ndescs;
+	u16 *packed_fetched;
+	u16 fetched_idx;
+
 	/* Log writes to used structure. */
 	bool log_used;
 	u64 log_addr;
@@ -106,6 +128,8 @@ struct vhost_virtqueue {
 	/* Log write descriptors */
 	void __user *log_base;
 	struct vhost_log *log;
+	/* How long to busy poll for new buffers before sleeping, in us */
+	u32 busyloop_timeout;
 };
 
 struct vhost_dev {
@@ -121,6 +145,8 @@ struct vhost_dev {
 	struct task_struct *worker;
 };
 
+bool vhost_has_work(struct vhost_dev *dev);
+
 void vhost_dev_init(struct vhost_dev *, struct vhost_virtqueue **vqs, int nvqs);
 long vhost_dev_set_owner(struct vhost_dev *dev);
 bool vhost_dev_has_owner(struct vhost_dev *dev);
@@ -151,6 +177,7 @@ void vhost_add_used_and_signal_n(struct vhost_dev *, struct vhost_virtqueue *,
 void vhost_signal(struct vhost_dev *, struct vhost_virtqueue *);
 void vhost_disable_notify(struct vhost_dev *, struct vhost_virtqueue *);
 bool vhost_enable_notify(struct vhost_dev *, struct vhost_virtqueue *);
+bool vhost_vq_avail_empty(struct vhost_dev *, struct vhost_virtqueue *);
 
 int vhost_log_write(struct vhost_virtqueue *vq, struct vhost_log *log,
 		    unsigned int log_num, u64 len);
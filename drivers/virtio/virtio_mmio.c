@@ -134,6 +134,11 @@ static int vm_finalize_features(struct virtio_device *vdev)
 	/* Give virtio_ring a chance to accept features. */
 	vring_transport_features(vdev);
 
+	/* Legacy devices only get the ring's PFN, which implies the split
+	 * layout. */
+	if (vm_dev->version == 1)
+		__virtio_clear_bit(vdev, VIRTIO_F_RING_PACKED);
+
 	/* Make sure there is are no mixed devices */
 	if (vm_dev->version == 2 &&
 			!__virtio_test_bit(vdev, VIRTIO_F_VERSION_1)) {
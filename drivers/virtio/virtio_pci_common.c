@@ -406,7 +406,7 @@ const char *vp_bus_name(struct virtio_device *vdev)
  * - OR over all affinities for shared MSI
  * - ignore the affinity request if we're using INTX
  */
-int vp_set_vq_affinity(struct virtqueue *vq, int cpu)
+int vp_set_vq_affinity_mask(struct virtqueue *vq, const struct cpumask *cpus)
 {
 	struct virtio_device *vdev = vq->vdev;
 	struct virtio_pci_device *vp_dev = to_vp_device(vdev);
@@ -420,17 +420,21 @@ int vp_set_vq_affinity(struct virtqueue *vq, int cpu)
 	if (vp_dev->msix_enabled) {
 		mask = vp_dev->msix_affinity_masks[info->msix_vector];
 		irq = vp_dev->msix_entries[info->msix_vector].vector;
-		if (cpu == -1)
+		if (!cpus)
 			irq_set_affinity_hint(irq, NULL);
 		else {
-			cpumask_clear(mask);
-			cpumask_set_cpu(cpu, mask);
+			cpumask_copy(mask, cpus);
 			irq_set_affinity_hint(irq, mask);
 		}
 	}
 	return 0;
 }
 
+int vp_set_vq_affinity(struct virtqueue *vq, int cpu)
+{
+	return vp_set_vq_affinity_mask(vq, cpu == -1 ? NULL : cpumask_of(cpu));
+}
+
 #ifdef CONFIG_PM_SLEEP
 static int virtio_pci_freeze(struct device *dev)
 {
@@ -478,6 +478,7 @@ static const struct virtio_config_ops virtio_pci_config_nodev_ops = {
 	.finalize_features = vp_finalize_features,
 	.bus_name	= vp_bus_name,
 	.set_vq_affinity = vp_set_vq_affinity,
+	.set_vq_affinity_mask = vp_set_vq_affinity_mask,
 };
 
 static const struct virtio_config_ops virtio_pci_config_ops = {
@@ -493,6 +494,7 @@ static const struct virtio_config_ops virtio_pci_config_ops = {
 	.finalize_features = vp_finalize_features,
 	.bus_name	= vp_bus_name,
 	.set_vq_affinity = vp_set_vq_affinity,
+	.set_vq_affinity_mask = vp_set_vq_affinity_mask,
 };
 
 /**
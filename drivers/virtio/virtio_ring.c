@@ -54,6 +54,15 @@
 #define END_USE(vq)
 #endif
 
+/* Per buffer id state of a packed ring. */
+struct vring_desc_state_packed {
+	void *data;			/* Token for callbacks. */
+	struct vring_packed_desc *indir_desc; /* Indirect table, if any. */
+	u16 num;			/* Ring descriptors the buffer uses. */
+	u16 next;			/* Next id in the free list. */
+	u16 last;			/* Last id taken by this buffer. */
+};
+
 struct vring_virtqueue {
 	struct virtqueue vq;
 
@@ -72,7 +81,10 @@ struct vring_virtqueue {
 	/* Host publishes avail event idx */
 	bool event;
 
-	/* Head of free buffer list. */
+	/* Is this a packed ring? */
+	bool packed_ring;
+
+	/* Head of free buffer list (of ids, for a packed ring). */
 	unsigned int free_head;
 	/* Number we've added since last sync. */
 	unsigned int num_added;
@@ -80,6 +92,29 @@ struct vring_virtqueue {
 	/* Last used index we've seen. */
 	u16 last_used_idx;
 
+	/* Packed ring layout and state, only valid if packed_ring.  The ring
+	 * size is kept in vring.num for both layouts. */
+	struct {
+		struct vring_packed_desc *desc;
+		struct vring_packed_desc_event *driver;
+		struct vring_packed_desc_event *device;
+
+		/* Wrap counters for next_avail_idx and last_used_idx. */
+		bool avail_wrap_counter;
+		bool used_wrap_counter;
+
+		/* AVAIL/USED flag bits for descriptors we make available. */
+		u16 avail_used_flags;
+
+		/* Index of the next descriptor to make available. */
+		u16 next_avail_idx;
+
+		/* Last flags value written to the driver event area. */
+		u16 event_flags_shadow;
+
+		struct vring_desc_state_packed *desc_state;
+	} packed;
+
 	/* How to notify other side. FIXME: commonalize hcalls! */
 	bool (*notify)(struct virtqueue *vq);
 
@@ -92,7 +127,7 @@ struct vring_virtqueue {
 	ktime_t last_add_time;
 #endif
 
-	/* Tokens for callbacks. */
+	/* Tokens for callbacks (split ring only). */
 	void *data[];
 };
 
@@ -120,6 +155,455 @@ static struct vring_desc *alloc_indirect(struct virtqueue *_vq,
 	return desc;
 }
 
+/*
+ * Packed ring.
+ *
+ * Driver and device share a single descriptor ring.  The driver makes a
+ * descriptor available by setting its AVAIL flag bit to, and its USED flag
+ * bit to the inverse of, its wrap counter; the device marks it used by
+ * making both bits equal to its own wrap counter.  Each buffer takes one
+ * free id for every ring descriptor it uses, so that a buffer id can never
+ * be outstanding twice.
+ */
+
+static inline bool is_used_desc_packed(const struct vring_virtqueue *vq,
+				       u16 idx, bool used_wrap_counter)
+{
+	bool avail, used;
+	u16 flags;
+
+	flags = le16_to_cpu(vq->packed.desc[idx].flags);
+	avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+
+	return avail == used && used == used_wrap_counter;
+}
+
+static inline bool more_used_packed(const struct vring_virtqueue *vq)
+{
+	return is_used_desc_packed(vq, vq->last_used_idx,
+				   vq->packed.used_wrap_counter);
+}
+
+static inline u16 packed_event_off_wrap(u16 idx, bool wrap_counter)
+{
+	return idx | ((u16)wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR);
+}
+
+static void packed_advance_avail(struct vring_virtqueue *vq, unsigned int n)
+{
+	n += vq->packed.next_avail_idx;
+	if (n >= vq->vring.num) {
+		n -= vq->vring.num;
+		vq->packed.avail_wrap_counter ^= 1;
+		vq->packed.avail_used_flags ^= 1 << VRING_PACKED_DESC_F_AVAIL |
+					       1 << VRING_PACKED_DESC_F_USED;
+	}
+	vq->packed.next_avail_idx = n;
+}
+
+static int virtqueue_add_indirect_packed(struct vring_virtqueue *vq,
+					 struct scatterlist *sgs[],
+					 unsigned int total_sg,
+					 unsigned int out_sgs,
+					 unsigned int in_sgs,
+					 void *data,
+					 gfp_t gfp)
+{
+	struct vring_packed_desc *desc;
+	struct scatterlist *sg;
+	unsigned int i, n;
+	u16 head, id;
+
+	/* See alloc_indirect(). */
+	gfp &= ~(__GFP_HIGHMEM | __GFP_HIGH);
+
+	desc = kmalloc(total_sg * sizeof(struct vring_packed_desc), gfp);
+	if (!desc)
+		return -ENOMEM;
+
+	i = 0;
+	for (n = 0; n < out_sgs + in_sgs; n++) {
+		for (sg = sgs[n]; sg; sg = sg_next(sg)) {
+			desc[i].flags = cpu_to_le16(n < out_sgs ?
+						    0 : VRING_DESC_F_WRITE);
+			desc[i].addr = cpu_to_le64(sg_phys(sg));
+			desc[i].len = cpu_to_le32(sg->length);
+			i++;
+		}
+	}
+
+	head = vq->packed.next_avail_idx;
+	id = vq->free_head;
+
+	vq->packed.desc[head].addr = cpu_to_le64(virt_to_phys(desc));
+	/* avoid kmemleak false positive (hidden by virt_to_phys) */
+	kmemleak_ignore(desc);
+	vq->packed.desc[head].len = cpu_to_le32(total_sg *
+					sizeof(struct vring_packed_desc));
+	vq->packed.desc[head].id = cpu_to_le16(id);
+
+	vq->packed.desc_state[id].data = data;
+	vq->packed.desc_state[id].indir_desc = desc;
+	vq->packed.desc_state[id].num = 1;
+	vq->packed.desc_state[id].last = id;
+	vq->free_head = vq->packed.desc_state[id].next;
+	vq->vq.num_free--;
+
+	/* The descriptor must be complete before it is made available. */
+	virtio_wmb(vq->weak_barriers);
+	vq->packed.desc[head].flags = cpu_to_le16(VRING_DESC_F_INDIRECT |
+						  vq->packed.avail_used_flags);
+
+	packed_advance_avail(vq, 1);
+	vq->num_added++;
+
+	pr_debug("Added indirect buffer head %i to %p\n", head, vq);
+	return 0;
+}
+
+static int virtqueue_add_packed(struct vring_virtqueue *vq,
+				struct scatterlist *sgs[],
+				unsigned int total_sg,
+				unsigned int out_sgs,
+				unsigned int in_sgs,
+				void *data,
+				gfp_t gfp)
+{
+	struct vring_packed_desc *desc = vq->packed.desc;
+	struct scatterlist *sg;
+	unsigned int i, n, c;
+	u16 head, id, curr, uninitialized_var(prev), flags;
+	u16 uninitialized_var(head_flags), avail_used_flags;
+	int err;
+
+	START_USE(vq);
+
+	BUG_ON(data == NULL);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return -EIO;
+	}
+
+	BUG_ON(total_sg > vq->vring.num);
+	BUG_ON(total_sg == 0);
+
+	/* If the host supports indirect descriptor tables, and we have multiple
+	 * buffers, then go indirect.  Fall back to direct descriptors if the
+	 * table cannot be allocated. */
+	if (vq->indirect && total_sg > 1 && vq->vq.num_free) {
+		err = virtqueue_add_indirect_packed(vq, sgs, total_sg, out_sgs,
+						    in_sgs, data, gfp);
+		if (err != -ENOMEM) {
+			END_USE(vq);
+			return err;
+		}
+	}
+
+	if (vq->vq.num_free < total_sg) {
+		pr_debug("Can't add buf len %i - avail = %i\n",
+			 total_sg, vq->vq.num_free);
+		/* See virtqueue_add(). */
+		if (out_sgs)
+			vq->notify(&vq->vq);
+		END_USE(vq);
+		return -ENOSPC;
+	}
+
+	head = vq->packed.next_avail_idx;
+	avail_used_flags = vq->packed.avail_used_flags;
+	id = vq->free_head;
+	curr = id;
+	i = head;
+	c = 0;
+
+	for (n = 0; n < out_sgs + in_sgs; n++) {
+		for (sg = sgs[n]; sg; sg = sg_next(sg)) {
+			flags = avail_used_flags |
+				(++c == total_sg ? 0 : VRING_DESC_F_NEXT) |
+				(n < out_sgs ? 0 : VRING_DESC_F_WRITE);
+			desc[i].addr = cpu_to_le64(sg_phys(sg));
+			desc[i].len = cpu_to_le32(sg->length);
+			desc[i].id = cpu_to_le16(id);
+			/* The head is exposed last, below. */
+			if (i == head)
+				head_flags = flags;
+			else
+				desc[i].flags = cpu_to_le16(flags);
+
+			prev = curr;
+			curr = vq->packed.desc_state[curr].next;
+
+			if (++i >= vq->vring.num) {
+				i = 0;
+				avail_used_flags ^=
+					1 << VRING_PACKED_DESC_F_AVAIL |
+					1 << VRING_PACKED_DESC_F_USED;
+			}
+		}
+	}
+
+	vq->packed.desc_state[id].data = data;
+	vq->packed.desc_state[id].indir_desc = NULL;
+	vq->packed.desc_state[id].num = total_sg;
+	vq->packed.desc_state[id].last = prev;
+	vq->free_head = curr;
+	vq->vq.num_free -= total_sg;
+
+	/* The rest of the chain must be visible before the head is made
+	 * available. */
+	virtio_wmb(vq->weak_barriers);
+	desc[head].flags = cpu_to_le16(head_flags);
+
+	packed_advance_avail(vq, total_sg);
+	vq->num_added += total_sg;
+
+	pr_debug("Added buffer head %i to %p\n", head, vq);
+	END_USE(vq);
+	return 0;
+}
+
+static bool virtqueue_kick_prepare_packed(struct vring_virtqueue *vq)
+{
+	u16 new, old, off_wrap, flags, event_idx;
+	bool needs_kick;
+
+	START_USE(vq);
+	/* We need to expose the new descriptors before checking the device
+	 * event area. */
+	virtio_mb(vq->weak_barriers);
+
+	old = vq->packed.next_avail_idx - vq->num_added;
+	new = vq->packed.next_avail_idx;
+	vq->num_added = 0;
+
+	flags = le16_to_cpu(ACCESS_ONCE(vq->packed.device->flags));
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC) {
+		needs_kick = flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+		goto out;
+	}
+
+	off_wrap = le16_to_cpu(ACCESS_ONCE(vq->packed.device->off_wrap));
+	event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+	    vq->packed.avail_wrap_counter)
+		event_idx -= vq->vring.num;
+
+	needs_kick = vring_need_event(event_idx, new, old);
+out:
+	END_USE(vq);
+	return needs_kick;
+}
+
+static void detach_buf_packed(struct vring_virtqueue *vq, unsigned int id)
+{
+	struct vring_desc_state_packed *state = &vq->packed.desc_state[id];
+
+	state->data = NULL;
+	kfree(state->indir_desc);
+	state->indir_desc = NULL;
+
+	vq->packed.desc_state[state->last].next = vq->free_head;
+	vq->free_head = id;
+	vq->vq.num_free += state->num;
+}
+
+static void *virtqueue_get_buf_packed(struct vring_virtqueue *vq,
+				      unsigned int *len)
+{
+	unsigned int id;
+	void *ret;
+	u16 last_used;
+
+	START_USE(vq);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return NULL;
+	}
+
+	if (!more_used_packed(vq)) {
+		pr_debug("No more buffers in queue\n");
+		END_USE(vq);
+		return NULL;
+	}
+
+	/* Only read the descriptor after the device has marked it used. */
+	virtio_rmb(vq->weak_barriers);
+
+	last_used = vq->last_used_idx;
+	id = le16_to_cpu(vq->packed.desc[last_used].id);
+	*len = le32_to_cpu(vq->packed.desc[last_used].len);
+
+	if (unlikely(id >= vq->vring.num)) {
+		BAD_RING(vq, "id %u out of range\n", id);
+		return NULL;
+	}
+	if (unlikely(!vq->packed.desc_state[id].data)) {
+		BAD_RING(vq, "id %u is not a head!\n", id);
+		return NULL;
+	}
+
+	/* detach_buf_packed clears data, so grab it now. */
+	ret = vq->packed.desc_state[id].data;
+	detach_buf_packed(vq, id);
+
+	/* The device skips the rest of the chain, and so do we. */
+	last_used += vq->packed.desc_state[id].num;
+	if (last_used >= vq->vring.num) {
+		last_used -= vq->vring.num;
+		vq->packed.used_wrap_counter ^= 1;
+	}
+	vq->last_used_idx = last_used;
+
+	/* If we expect an interrupt for the next entry, tell host
+	 * by writing event index and flush out the write before
+	 * the read in the next get_buf call. */
+	if (vq->packed.event_flags_shadow == VRING_PACKED_EVENT_FLAG_DESC) {
+		vq->packed.driver->off_wrap = cpu_to_le16(
+			packed_event_off_wrap(last_used,
+					      vq->packed.used_wrap_counter));
+		virtio_mb(vq->weak_barriers);
+	}
+
+	END_USE(vq);
+	return ret;
+}
+
+static void virtqueue_disable_cb_packed(struct vring_virtqueue *vq)
+{
+	if (vq->packed.event_flags_shadow != VRING_PACKED_EVENT_FLAG_DISABLE) {
+		vq->packed.event_flags_shadow = VRING_PACKED_EVENT_FLAG_DISABLE;
+		vq->packed.driver->flags =
+			cpu_to_le16(vq->packed.event_flags_shadow);
+	}
+}
+
+/* Turn events back on, either for any buffer or from the used
+ * descriptor at off_wrap on. */
+static void packed_enable_events(struct vring_virtqueue *vq, u16 off_wrap)
+{
+	if (vq->event) {
+		vq->packed.driver->off_wrap = cpu_to_le16(off_wrap);
+		/* The offset must be visible before the flags. */
+		virtio_wmb(vq->weak_barriers);
+	}
+
+	if (vq->packed.event_flags_shadow == VRING_PACKED_EVENT_FLAG_DISABLE) {
+		vq->packed.event_flags_shadow = vq->event ?
+			VRING_PACKED_EVENT_FLAG_DESC :
+			VRING_PACKED_EVENT_FLAG_ENABLE;
+		vq->packed.driver->flags =
+			cpu_to_le16(vq->packed.event_flags_shadow);
+	}
+}
+
+/* The opaque state returned packs the used index with its wrap counter,
+ * in the same format as the event areas use. */
+static unsigned virtqueue_enable_cb_prepare_packed(struct vring_virtqueue *vq)
+{
+	u16 off_wrap;
+
+	START_USE(vq);
+	off_wrap = packed_event_off_wrap(vq->last_used_idx,
+					 vq->packed.used_wrap_counter);
+	packed_enable_events(vq, off_wrap);
+	END_USE(vq);
+	return off_wrap;
+}
+
+static bool virtqueue_poll_packed(struct vring_virtqueue *vq, u16 off_wrap)
+{
+	bool wrap_counter = off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR;
+	u16 used_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+
+	return is_used_desc_packed(vq, used_idx, wrap_counter);
+}
+
+static bool virtqueue_enable_cb_delayed_packed(struct vring_virtqueue *vq)
+{
+	bool wrap_counter = vq->packed.used_wrap_counter;
+	u16 used_idx, bufs;
+
+	START_USE(vq);
+
+	/* TODO: tune this threshold */
+	bufs = (vq->vring.num - vq->vq.num_free) * 3 / 4;
+	used_idx = vq->last_used_idx + bufs;
+	if (used_idx >= vq->vring.num) {
+		used_idx -= vq->vring.num;
+		wrap_counter ^= 1;
+	}
+	packed_enable_events(vq, packed_event_off_wrap(used_idx, wrap_counter));
+
+	/* Expose the event before checking for more used buffers. */
+	virtio_mb(vq->weak_barriers);
+	if (unlikely(more_used_packed(vq))) {
+		END_USE(vq);
+		return false;
+	}
+
+	END_USE(vq);
+	return true;
+}
+
+static void *virtqueue_detach_unused_buf_packed(struct vring_virtqueue *vq)
+{
+	unsigned int i;
+	void *buf;
+
+	START_USE(vq);
+
+	for (i = 0; i < vq->vring.num; i++) {
+		if (!vq->packed.desc_state[i].data)
+			continue;
+		/* detach_buf_packed clears data, so grab it now. */
+		buf = vq->packed.desc_state[i].data;
+		detach_buf_packed(vq, i);
+		END_USE(vq);
+		return buf;
+	}
+	/* That should have freed everything. */
+	BUG_ON(vq->vq.num_free != vq->vring.num);
+
+	END_USE(vq);
+	return NULL;
+}
+
+/* The packed ring fits in the memory a transport sized with vring_size():
+ * the descriptors first, then the driver and device event areas. */
+static int vring_init_packed(struct vring_virtqueue *vq, unsigned int num,
+			     void *pages)
+{
+	unsigned int i;
+
+	vq->packed.desc_state = kmalloc_array(num,
+					      sizeof(*vq->packed.desc_state),
+					      GFP_KERNEL);
+	if (!vq->packed.desc_state)
+		return -ENOMEM;
+
+	vq->packed.desc = pages;
+	vq->packed.driver = pages + num * sizeof(struct vring_packed_desc);
+	vq->packed.device = (void *)(vq->packed.driver + 1);
+	memset(vq->packed.desc, 0, num * sizeof(struct vring_packed_desc));
+
+	vq->packed.avail_wrap_counter = 1;
+	vq->packed.used_wrap_counter = 1;
+	vq->packed.avail_used_flags = 1 << VRING_PACKED_DESC_F_AVAIL;
+	vq->packed.next_avail_idx = 0;
+	vq->packed.event_flags_shadow = VRING_PACKED_EVENT_FLAG_ENABLE;
+
+	/* Put everything in free lists. */
+	for (i = 0; i < num; i++) {
+		vq->packed.desc_state[i].data = NULL;
+		vq->packed.desc_state[i].indir_desc = NULL;
+		vq->packed.desc_state[i].next = i + 1;
+	}
+	return 0;
+}
+
 static inline int virtqueue_add(struct virtqueue *_vq,
 				struct scatterlist *sgs[],
 				unsigned int total_sg,
@@ -135,6 +619,10 @@ static inline int virtqueue_add(struct virtqueue *_vq,
 	int head;
 	bool indirect;
 
+	if (vq->packed_ring)
+		return virtqueue_add_packed(vq, sgs, total_sg, out_sgs, in_sgs,
+					    data, gfp);
+
 	START_USE(vq);
 
 	BUG_ON(data == NULL);
@@ -349,6 +837,9 @@ bool virtqueue_kick_prepare(struct virtqueue *_vq)
 	u16 new, old;
 	bool needs_kick;
 
+	if (vq->packed_ring)
+		return virtqueue_kick_prepare_packed(vq);
+
 	START_USE(vq);
 	/* We need to expose available array entries before checking avail
 	 * event. */
@@ -448,6 +939,8 @@ static void detach_buf(struct vring_virtqueue *vq, unsigned int head)
 
 static inline bool more_used(const struct vring_virtqueue *vq)
 {
+	if (vq->packed_ring)
+		return more_used_packed(vq);
 	return vq->last_used_idx != virtio16_to_cpu(vq->vq.vdev, vq->vring.used->idx);
 }
 
@@ -474,6 +967,9 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	unsigned int i;
 	u16 last_used;
 
+	if (vq->packed_ring)
+		return virtqueue_get_buf_packed(vq, len);
+
 	START_USE(vq);
 
 	if (unlikely(vq->broken)) {
@@ -537,6 +1033,10 @@ void virtqueue_disable_cb(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed_ring) {
+		virtqueue_disable_cb_packed(vq);
+		return;
+	}
 	vq->vring.avail->flags |= cpu_to_virtio16(_vq->vdev, VRING_AVAIL_F_NO_INTERRUPT);
 }
 EXPORT_SYMBOL_GPL(virtqueue_disable_cb);
@@ -558,6 +1058,9 @@ unsigned virtqueue_enable_cb_prepare(struct virtqueue *_vq)
 	struct vring_virtqueue *vq = to_vvq(_vq);
 	u16 last_used_idx;
 
+	if (vq->packed_ring)
+		return virtqueue_enable_cb_prepare_packed(vq);
+
 	START_USE(vq);
 
 	/* We optimistically turn back on interrupts, then check if there was
@@ -586,6 +1089,8 @@ bool virtqueue_poll(struct virtqueue *_vq, unsigned last_used_idx)
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
 	virtio_mb(vq->weak_barriers);
+	if (vq->packed_ring)
+		return virtqueue_poll_packed(vq, last_used_idx);
 	return (u16)last_used_idx != virtio16_to_cpu(_vq->vdev, vq->vring.used->idx);
 }
 EXPORT_SYMBOL_GPL(virtqueue_poll);
@@ -626,6 +1131,9 @@ bool virtqueue_enable_cb_delayed(struct virtqueue *_vq)
 	struct vring_virtqueue *vq = to_vvq(_vq);
 	u16 bufs;
 
+	if (vq->packed_ring)
+		return virtqueue_enable_cb_delayed_packed(vq);
+
 	START_USE(vq);
 
 	/* We optimistically turn back on interrupts, then check if there was
@@ -662,6 +1170,9 @@ void *virtqueue_detach_unused_buf(struct virtqueue *_vq)
 	unsigned int i;
 	void *buf;
 
+	if (vq->packed_ring)
+		return virtqueue_detach_unused_buf_packed(vq);
+
 	START_USE(vq);
 
 	for (i = 0; i < vq->vring.num; i++) {
@@ -713,6 +1224,7 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 				      const char *name)
 {
 	struct vring_virtqueue *vq;
+	bool packed = virtio_has_feature(vdev, VIRTIO_F_RING_PACKED);
 	unsigned int i;
 
 	/* We assume num is a power of 2. */
@@ -721,11 +1233,28 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 		return NULL;
 	}
 
-	vq = kmalloc(sizeof(*vq) + sizeof(void *)*num, GFP_KERNEL);
+	/* Packed ring indices leave the top bit for the wrap counter. */
+	if (packed && num > 1 << VRING_PACKED_EVENT_F_WRAP_CTR) {
+		dev_warn(&vdev->dev, "Bad packed virtqueue length %u\n", num);
+		return NULL;
+	}
+
+	vq = kmalloc(sizeof(*vq) + (packed ? 0 : sizeof(void *)*num),
+		     GFP_KERNEL);
 	if (!vq)
 		return NULL;
 
-	vring_init(&vq->vring, num, pages, vring_align);
+	vq->packed_ring = packed;
+	if (packed) {
+		if (vring_init_packed(vq, num, pages)) {
+			kfree(vq);
+			return NULL;
+		}
+		memset(&vq->vring, 0, sizeof(vq->vring));
+		vq->vring.num = num;
+	} else {
+		vring_init(&vq->vring, num, pages, vring_align);
+	}
 	vq->vq.callback = callback;
 	vq->vq.vdev = vdev;
 	vq->vq.name = name;
@@ -746,16 +1275,22 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
 
 	/* No callback?  Tell other side not to bother us. */
-	if (!callback)
-		vq->vring.avail->flags |= cpu_to_virtio16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
+	if (!callback) {
+		if (packed)
+			virtqueue_disable_cb_packed(vq);
+		else
+			vq->vring.avail->flags |= cpu_to_virtio16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
+	}
 
 	/* Put everything in free lists. */
 	vq->free_head = 0;
-	for (i = 0; i < num-1; i++) {
-		vq->vring.desc[i].next = cpu_to_virtio16(vdev, i + 1);
+	if (!packed) {
+		for (i = 0; i < num-1; i++) {
+			vq->vring.desc[i].next = cpu_to_virtio16(vdev, i + 1);
+			vq->data[i] = NULL;
+		}
 		vq->data[i] = NULL;
 	}
-	vq->data[i] = NULL;
 
 	return &vq->vq;
 }
@@ -764,6 +1299,8 @@ EXPORT_SYMBOL_GPL(vring_new_virtqueue);
 void vring_del_virtqueue(struct virtqueue *vq)
 {
 	list_del(&vq->list);
+	if (to_vvq(vq)->packed_ring)
+		kfree(to_vvq(vq)->packed.desc_state);
 	kfree(to_vvq(vq));
 }
 EXPORT_SYMBOL_GPL(vring_del_virtqueue);
@@ -781,11 +1318,18 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_F_VERSION_1:
 			break;
+		case VIRTIO_F_RING_PACKED:
+			break;
 		default:
 			/* We don't understand this bit. */
 			__virtio_clear_bit(vdev, i);
 		}
 	}
+
+	/* The packed layout is little-endian only, and needs a transport that
+	 * tells the device where each part of the ring lives. */
+	if (!__virtio_test_bit(vdev, VIRTIO_F_VERSION_1))
+		__virtio_clear_bit(vdev, VIRTIO_F_RING_PACKED);
 }
 EXPORT_SYMBOL_GPL(vring_transport_features);
 
@@ -832,6 +1376,8 @@ void *virtqueue_get_avail(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed_ring)
+		return vq->packed.driver;
 	return vq->vring.avail;
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_avail);
@@ -840,6 +1386,8 @@ void *virtqueue_get_used(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed_ring)
+		return vq->packed.device;
 	return vq->vring.used;
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_used);
@@ -40,6 +40,7 @@
 #include <linux/ramfs.h>
 #include <linux/percpu-refcount.h>
 #include <linux/mount.h>
+#include <linux/poll.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -109,6 +110,18 @@ struct kioctx {
 	/* Size of ringbuffer, in units of struct io_event */
 	unsigned		nr_events;
 
+	/* IOCTX_FLAG_* passed to io_setup2() */
+	unsigned		flags;
+
+	/*
+	 * Submission ring, if IOCTX_FLAG_SQRING: first page of the ring
+	 * within ring_pages, number of iocb slots and our trusted copy of
+	 * the consumer index.  sq_head is protected by ring_lock.
+	 */
+	unsigned		sq_page;
+	unsigned		sq_nr;
+	unsigned		sq_head;
+
 	unsigned long		mmap_base;
 	unsigned long		mmap_size;
 
@@ -169,15 +182,34 @@ struct kioctx {
  */
 #define KIOCB_CANCELLED		((void *) (~0ULL))
 
+/*
+ * A one-shot IOCB_CMD_POLL: waits on the file's wait queue and completes
+ * with the ready events, from aio_poll_complete_work().
+ */
+struct poll_iocb {
+	wait_queue_head_t	*head;
+	unsigned int		events;
+	bool			cancelled;
+	wait_queue_t		wait;
+	struct work_struct	work;
+};
+
 struct aio_kiocb {
 	struct kiocb		common;
 
 	struct kioctx		*ki_ctx;
 	kiocb_cancel_fn		*ki_cancel;
 
+	/* the submitter of a poll request holds a second reference */
+	atomic_t		ki_refcnt;
+	struct poll_iocb	ki_poll;
+
 	struct iocb __user	*ki_user_iocb;	/* user's aiocb */
 	__u64			ki_user_data;	/* user's data for completion */
 
+	/* queue to poll for completion on an IOCTX_FLAG_IOPOLL context */
+	struct request_queue	*ki_poll_q;
+
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
 
@@ -424,26 +456,43 @@ static const struct address_space_operations aio_ctx_aops = {
 #endif
 };
 
+#define AIO_SQ_IOCBS_PER_PAGE	(PAGE_SIZE / sizeof(struct iocb))
+
 static int aio_setup_ring(struct kioctx *ctx)
 {
 	struct aio_ring *ring;
 	unsigned nr_events = ctx->max_reqs;
 	struct mm_struct *mm = current->mm;
 	unsigned long size, unused;
-	int nr_pages;
+	int nr_pages, cq_pages, sq_pages = 0;
 	int i;
 	struct file *file;
 
+	BUILD_BUG_ON(sizeof(struct aio_sq_ring) != sizeof(struct iocb));
+
 	/* Compensate for the ring buffer's head/tail overlap entry */
 	nr_events += 2;	/* 1 is required, 2 for good luck */
 
 	size = sizeof(struct aio_ring);
 	size += sizeof(struct io_event) * nr_events;
 
-	nr_pages = PFN_UP(size);
-	if (nr_pages < 0)
+	cq_pages = PFN_UP(size);
+	if (cq_pages < 0)
 		return -EINVAL;
 
+	/*
+	 * The submission ring lives in the same file, starting on the page
+	 * after the last io_event, so userspace finds it from ring->nr.
+	 */
+	if (ctx->flags & IOCTX_FLAG_SQRING) {
+		size = sizeof(struct aio_sq_ring);
+		size += sizeof(struct iocb) * (ctx->max_reqs + 1);
+		sq_pages = PFN_UP(size);
+		if (sq_pages < 0)
+			return -EINVAL;
+	}
+	nr_pages = cq_pages + sq_pages;
+
 	file = aio_private_file(ctx, nr_pages);
 	if (IS_ERR(file)) {
 		ctx->aio_ring_file = NULL;
@@ -451,7 +500,7 @@ static int aio_setup_ring(struct kioctx *ctx)
 	}
 
 	ctx->aio_ring_file = file;
-	nr_events = (PAGE_SIZE * nr_pages - sizeof(struct aio_ring))
+	nr_events = (PAGE_SIZE * cq_pages - sizeof(struct aio_ring))
 			/ sizeof(struct io_event);
 
 	ctx->ring_pages = ctx->internal_pages;
@@ -514,6 +563,21 @@ static int aio_setup_ring(struct kioctx *ctx)
 	kunmap_atomic(ring);
 	flush_dcache_page(ctx->ring_pages[0]);
 
+	if (sq_pages) {
+		struct aio_sq_ring *sq;
+
+		/* slot 0 of the first page is taken by the header */
+		ctx->sq_page = cq_pages;
+		ctx->sq_nr = sq_pages * AIO_SQ_IOCBS_PER_PAGE - 1;
+		ctx->sq_head = 0;
+
+		sq = kmap_atomic(ctx->ring_pages[ctx->sq_page]);
+		sq->head = sq->tail = 0;
+		sq->nr = ctx->sq_nr;
+		kunmap_atomic(sq);
+		flush_dcache_page(ctx->ring_pages[ctx->sq_page]);
+	}
+
 	return 0;
 }
 
@@ -678,7 +742,7 @@ static void aio_nr_sub(unsigned nr)
 /* ioctx_alloc
  *	Allocates and initializes an ioctx.  Returns an ERR_PTR if it failed.
  */
-static struct kioctx *ioctx_alloc(unsigned nr_events)
+static struct kioctx *ioctx_alloc(unsigned nr_events, unsigned flags)
 {
 	struct mm_struct *mm = current->mm;
 	struct kioctx *ctx;
@@ -710,6 +774,7 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 		return ERR_PTR(-ENOMEM);
 
 	ctx->max_reqs = nr_events;
+	ctx->flags = flags;
 
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->completion_lock);
@@ -1002,6 +1067,7 @@ static inline struct aio_kiocb *aio_get_req(struct kioctx *ctx)
 	percpu_ref_get(&ctx->reqs);
 
 	req->ki_ctx = ctx;
+	atomic_set(&req->ki_refcnt, 1);
 	return req;
 out_put:
 	put_reqs_available(ctx, 1);
@@ -1017,6 +1083,12 @@ static void kiocb_free(struct aio_kiocb *req)
 	kmem_cache_free(kiocb_cachep, req);
 }
 
+static inline void iocb_put(struct aio_kiocb *req)
+{
+	if (atomic_dec_and_test(&req->ki_refcnt))
+		kiocb_free(req);
+}
+
 static struct kioctx *lookup_ioctx(unsigned long ctx_id)
 {
 	struct aio_ring __user *ring  = (void __user *)ctx_id;
@@ -1130,7 +1202,7 @@ static void aio_complete(struct kiocb *kiocb, long res, long res2)
 		eventfd_signal(iocb->ki_eventfd, 1);
 
 	/* everything turned out well, dispose of the aiocb. */
-	kiocb_free(iocb);
+	iocb_put(iocb);
 
 	/*
 	 * We have to order our ring_info tail store above and test
@@ -1321,7 +1393,7 @@ SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
 		goto out;
 	}
 
-	ioctx = ioctx_alloc(nr_events);
+	ioctx = ioctx_alloc(nr_events, 0);
 	ret = PTR_ERR(ioctx);
 	if (!IS_ERR(ioctx)) {
 		ret = put_user(ioctx->user_id, ctxp);
@@ -1334,6 +1406,44 @@ out:
 	return ret;
 }
 
+/* sys_io_setup2:
+ *	Like io_setup(), but takes IOCTX_FLAG_* flags selecting the ring
+ *	based submission interface (IOCTX_FLAG_SQRING) and/or polled
+ *	completions (IOCTX_FLAG_IOPOLL).  Fails with -EINVAL for unknown
+ *	flags.
+ */
+SYSCALL_DEFINE3(io_setup2, unsigned, nr_events, unsigned, flags,
+		aio_context_t __user *, ctxp)
+{
+	struct kioctx *ioctx;
+	unsigned long ctx;
+	long ret;
+
+	if (flags & ~(IOCTX_FLAG_SQRING | IOCTX_FLAG_IOPOLL))
+		return -EINVAL;
+
+	ret = get_user(ctx, ctxp);
+	if (unlikely(ret))
+		return ret;
+
+	if (unlikely(ctx || nr_events == 0)) {
+		pr_debug("EINVAL: ctx %lu nr_events %u\n",
+			 ctx, nr_events);
+		return -EINVAL;
+	}
+
+	ioctx = ioctx_alloc(nr_events, flags);
+	ret = PTR_ERR(ioctx);
+	if (!IS_ERR(ioctx)) {
+		ret = put_user(ioctx->user_id, ctxp);
+		if (ret)
+			kill_ioctx(current->mm, ioctx, NULL);
+		percpu_ref_put(&ioctx->users);
+	}
+
+	return ret;
+}
+
 /* sys_io_destroy:
  *	Destroy the aio_context specified.  May cancel any outstanding 
  *	AIOs and block on completion.  Will fail with -ENOSYS if not
@@ -1484,6 +1594,263 @@ rw_common:
 	return 0;
 }
 
+#ifdef CONFIG_BLOCK
+/*
+ * The queue backing @file, which is what a polling waiter must spin on to
+ * find completions for O_DIRECT I/O issued against it.
+ */
+static struct request_queue *aio_poll_queue(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev;
+
+	if (S_ISBLK(inode->i_mode))
+		bdev = I_BDEV(inode);
+	else
+		bdev = inode->i_sb->s_bdev;
+
+	return bdev ? bdev_get_queue(bdev) : NULL;
+}
+
+/* aio_iopoll
+ *	Spin once on the queue of the oldest polled request in flight.
+ *	Returns -EAGAIN if there is nothing to poll for, otherwise whether
+ *	the poll found any completions.
+ */
+static int aio_iopoll(struct kioctx *ctx)
+{
+	struct request_queue *q = NULL;
+	struct aio_kiocb *req;
+	int ret;
+
+	spin_lock_irq(&ctx->ctx_lock);
+	list_for_each_entry(req, &ctx->active_reqs, ki_list) {
+		if (req->ki_poll_q && blk_get_queue(req->ki_poll_q)) {
+			q = req->ki_poll_q;
+			break;
+		}
+	}
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (!q)
+		return -EAGAIN;
+
+	ret = blk_poll(q);
+	blk_put_queue(q);
+	return ret;
+}
+#else
+static inline struct request_queue *aio_poll_queue(struct file *file)
+{
+	return NULL;
+}
+
+static inline int aio_iopoll(struct kioctx *ctx)
+{
+	return -EAGAIN;
+}
+#endif /* CONFIG_BLOCK */
+
+static int aio_prep_iopoll(struct kioctx *ctx, struct aio_kiocb *req,
+			   unsigned opcode)
+{
+	switch (opcode) {
+	case IOCB_CMD_PREAD:
+	case IOCB_CMD_PREADV:
+	case IOCB_CMD_PWRITE:
+	case IOCB_CMD_PWRITEV:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!(req->common.ki_flags & IOCB_DIRECT))
+		return -EINVAL;
+
+	req->ki_poll_q = aio_poll_queue(req->common.ki_filp);
+	if (!req->ki_poll_q)
+		return -EINVAL;
+	req->common.ki_flags |= IOCB_HIPRI;
+
+	/*
+	 * Keep polled requests on active_reqs so that a waiter can find a
+	 * queue to spin on; aio_complete() takes them off again.
+	 */
+	spin_lock_irq(&ctx->ctx_lock);
+	list_add_tail(&req->ki_list, &ctx->active_reqs);
+	spin_unlock_irq(&ctx->ctx_lock);
+	return 0;
+}
+
+struct aio_poll_table {
+	struct poll_table_struct	pt;
+	struct aio_kiocb		*iocb;
+	int				error;
+};
+
+static void aio_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+				struct poll_table_struct *p)
+{
+	struct aio_poll_table *pt = container_of(p, struct aio_poll_table, pt);
+
+	/* multiple wait queues per file are not supported */
+	if (unlikely(pt->iocb->ki_poll.head)) {
+		pt->error = -EINVAL;
+		return;
+	}
+
+	pt->error = 0;
+	pt->iocb->ki_poll.head = head;
+	add_wait_queue(head, &pt->iocb->ki_poll.wait);
+}
+
+/*
+ * Whoever takes the request off its wait queue (a wakeup, cancellation or
+ * the work itself) queues this work, which either completes the request or
+ * waits again.
+ */
+static void aio_poll_complete_work(struct work_struct *work)
+{
+	struct poll_iocb *req = container_of(work, struct poll_iocb, work);
+	struct aio_kiocb *iocb = container_of(req, struct aio_kiocb, ki_poll);
+	struct poll_table_struct pt = { ._key = req->events };
+	struct file *file = iocb->common.ki_filp;
+	struct kioctx *ctx = iocb->ki_ctx;
+	unsigned int mask = 0;
+
+	if (!READ_ONCE(req->cancelled))
+		mask = file->f_op->poll(file, &pt) & req->events;
+
+	/*
+	 * Cancellation runs under ctx_lock, so checking for it and going
+	 * back on the wait queue must be done under it too.
+	 */
+	spin_lock_irq(&ctx->ctx_lock);
+	if (!mask && !READ_ONCE(req->cancelled)) {
+		add_wait_queue(req->head, &req->wait);
+		spin_unlock_irq(&ctx->ctx_lock);
+
+		/* catch an event that arrived before we were queued again */
+		mask = file->f_op->poll(file, &pt) & req->events;
+		if (mask) {
+			spin_lock_irq(&req->head->lock);
+			if (!list_empty(&req->wait.task_list)) {
+				list_del_init(&req->wait.task_list);
+				schedule_work(&req->work);
+			}
+			spin_unlock_irq(&req->head->lock);
+		}
+		return;
+	}
+	/* not on active_reqs if woken before aio_poll() could add it */
+	if (iocb->ki_list.next)
+		list_del_init(&iocb->ki_list);
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	aio_complete(&iocb->common, mask, 0);
+}
+
+/* called under ctx_lock with interrupts disabled */
+static int aio_poll_cancel(struct kiocb *kiocb)
+{
+	struct aio_kiocb *iocb = container_of(kiocb, struct aio_kiocb, common);
+	struct poll_iocb *req = &iocb->ki_poll;
+
+	spin_lock(&req->head->lock);
+	WRITE_ONCE(req->cancelled, true);
+	if (!list_empty(&req->wait.task_list)) {
+		list_del_init(&req->wait.task_list);
+		schedule_work(&req->work);
+	}
+	spin_unlock(&req->head->lock);
+
+	return 0;
+}
+
+static int aio_poll_wake(wait_queue_t *wait, unsigned mode, int sync,
+			 void *key)
+{
+	struct poll_iocb *req = container_of(wait, struct poll_iocb, wait);
+	unsigned long mask = (unsigned long)key;
+
+	/* wakeups that carry their events let us skip unrelated ones */
+	if (mask && !(mask & req->events))
+		return 0;
+
+	list_del_init(&req->wait.task_list);
+	schedule_work(&req->work);
+	return 1;
+}
+
+static int aio_poll(struct aio_kiocb *aiocb, struct iocb *iocb)
+{
+	struct kioctx *ctx = aiocb->ki_ctx;
+	struct poll_iocb *req = &aiocb->ki_poll;
+	struct file *file = aiocb->common.ki_filp;
+	struct aio_poll_table apt;
+	unsigned int mask;
+
+	/* reject any unknown events outside the normal event mask. */
+	if ((u16)iocb->aio_buf != iocb->aio_buf)
+		return -EINVAL;
+	/* reject fields that are not defined for poll */
+	if (iocb->aio_offset || iocb->aio_nbytes)
+		return -EINVAL;
+	if (!file->f_op->poll)
+		return -EINVAL;
+
+	INIT_WORK(&req->work, aio_poll_complete_work);
+	req->events = iocb->aio_buf | POLLERR | POLLHUP;
+	req->head = NULL;
+	req->cancelled = false;
+
+	apt.pt._qproc = aio_poll_queue_proc;
+	apt.pt._key = req->events;
+	apt.iocb = aiocb;
+	apt.error = -EINVAL;	/* the file never called poll_wait() */
+
+	/* initialise the list so that we can do list_empty checks */
+	INIT_LIST_HEAD(&req->wait.task_list);
+	init_waitqueue_func_entry(&req->wait, aio_poll_wake);
+
+	/* one for the completion, one for this function */
+	atomic_set(&aiocb->ki_refcnt, 2);
+
+	mask = file->f_op->poll(file, &apt.pt) & req->events;
+	if (unlikely(!req->head)) {
+		/* no wait queue to sleep on, but it may be ready already */
+		if (mask)
+			apt.error = 0;
+		goto out;
+	}
+
+	spin_lock_irq(&ctx->ctx_lock);
+	spin_lock(&req->head->lock);
+	if (list_empty(&req->wait.task_list)) {
+		/* a wakeup took us off the queue, its work completes us */
+		mask = 0;
+		apt.error = 0;
+	} else if (mask || apt.error) {
+		/* if we get an error or a mask we are done */
+		list_del_init(&req->wait.task_list);
+	} else {
+		/* actually waiting for an event */
+		list_add_tail(&aiocb->ki_list, &ctx->active_reqs);
+		aiocb->ki_cancel = aio_poll_cancel;
+	}
+	spin_unlock(&req->head->lock);
+	spin_unlock_irq(&ctx->ctx_lock);
+
+out:
+	if (unlikely(apt.error))
+		return apt.error;
+
+	if (mask)
+		aio_complete(&aiocb->common, mask, 0);
+	iocb_put(aiocb);
+	return 0;
+}
+
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			 struct iocb *iocb, bool compat)
 {
@@ -1545,15 +1912,29 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	req->ki_user_iocb = user_iocb;
 	req->ki_user_data = iocb->aio_data;
 
-	ret = aio_run_iocb(&req->common, iocb->aio_lio_opcode,
-			   (char __user *)(unsigned long)iocb->aio_buf,
-			   iocb->aio_nbytes,
-			   compat);
+	if (ctx->flags & IOCTX_FLAG_IOPOLL) {
+		ret = aio_prep_iopoll(ctx, req, iocb->aio_lio_opcode);
+		if (unlikely(ret))
+			goto out_put_req;
+	}
+
+	if (iocb->aio_lio_opcode == IOCB_CMD_POLL)
+		ret = aio_poll(req, iocb);
+	else
+		ret = aio_run_iocb(&req->common, iocb->aio_lio_opcode,
+				   (char __user *)(unsigned long)iocb->aio_buf,
+				   iocb->aio_nbytes,
+				   compat);
 	if (ret)
 		goto out_put_req;
 
 	return 0;
 out_put_req:
+	if (req->ki_list.next) {
+		spin_lock_irq(&ctx->ctx_lock);
+		list_del(&req->ki_list);
+		spin_unlock_irq(&ctx->ctx_lock);
+	}
 	put_reqs_available(ctx, 1);
 	percpu_ref_put(&ctx->reqs);
 	kiocb_free(req);
@@ -1631,6 +2012,173 @@ SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 	return do_io_submit(ctx_id, nr, iocbpp, 0);
 }
 
+/* aio_ring_submit
+ *	Consume up to to_submit iocbs from the submission ring.  A slot is
+ *	left in place if we run out of request slots (-EAGAIN) so that it
+ *	can be retried, malformed iocbs are consumed and counted in
+ *	sq->dropped.  Returns the number of iocbs submitted or the error
+ *	from the first failing one.
+ */
+static long aio_ring_submit(struct kioctx *ctx, unsigned to_submit)
+{
+	bool compat = is_compat_task();
+	struct iocb __user *user_sq;
+	struct aio_sq_ring *sq;
+	unsigned head, tail, dropped = 0;
+	struct blk_plug plug;
+	long ret = 0;
+	unsigned i = 0;
+
+	user_sq = (struct iocb __user *)(ctx->mmap_base +
+					 ((unsigned long)ctx->sq_page << PAGE_SHIFT));
+
+	/* ring_lock serialises submitters and keeps the pages from migrating */
+	mutex_lock(&ctx->ring_lock);
+
+	sq = kmap_atomic(ctx->ring_pages[ctx->sq_page]);
+	tail = ACCESS_ONCE(sq->tail);
+	kunmap_atomic(sq);
+
+	/* Pairs with the write barrier userspace issues before moving tail */
+	smp_rmb();
+
+	/* Clamp tail since userland can write to it. */
+	tail %= ctx->sq_nr;
+	head = ctx->sq_head;
+
+	blk_start_plug(&plug);
+	while (i < to_submit && head != tail) {
+		unsigned pos = head + 1;	/* skip the header slot */
+		struct page *page;
+		struct iocb tmp, *slot;
+
+		page = ctx->ring_pages[ctx->sq_page + pos / AIO_SQ_IOCBS_PER_PAGE];
+		slot = kmap_atomic(page);
+		memcpy(&tmp, slot + pos % AIO_SQ_IOCBS_PER_PAGE, sizeof(tmp));
+		kunmap_atomic(slot);
+
+		ret = io_submit_one(ctx, user_sq + pos, &tmp, compat);
+		if (ret == -EAGAIN)
+			break;
+
+		if (++head >= ctx->sq_nr)
+			head = 0;
+		if (unlikely(ret)) {
+			dropped++;
+			if (!i)
+				break;
+			continue;
+		}
+		i++;
+	}
+	blk_finish_plug(&plug);
+
+	ctx->sq_head = head;
+	sq = kmap_atomic(ctx->ring_pages[ctx->sq_page]);
+	sq->head = head;
+	sq->dropped += dropped;
+	kunmap_atomic(sq);
+	flush_dcache_page(ctx->ring_pages[ctx->sq_page]);
+
+	mutex_unlock(&ctx->ring_lock);
+
+	return i ? i : ret;
+}
+
+/* Number of events sitting in the completion ring, not yet reaped. */
+static unsigned aio_ring_avail(struct kioctx *ctx)
+{
+	struct aio_ring *ring;
+	unsigned head, tail;
+
+	spin_lock_irq(&ctx->completion_lock);
+	ring = kmap_atomic(ctx->ring_pages[0]);
+	head = ring->head;
+	kunmap_atomic(ring);
+	tail = ctx->tail;
+	spin_unlock_irq(&ctx->completion_lock);
+
+	head %= ctx->nr_events;
+	if (head <= tail)
+		return tail - head;
+	return ctx->nr_events - (head - tail);
+}
+
+static long aio_ring_wait(struct kioctx *ctx, unsigned min_complete)
+{
+	long ret;
+
+	min_complete = min(min_complete, ctx->nr_events - 1);
+
+	if (ctx->flags & IOCTX_FLAG_IOPOLL) {
+		while (aio_ring_avail(ctx) < min_complete) {
+			if (unlikely(atomic_read(&ctx->dead)))
+				return -EINVAL;
+			if (signal_pending(current))
+				return -EINTR;
+
+			ret = aio_iopoll(ctx);
+			if (ret == -EAGAIN)
+				break;
+			if (!ret)
+				cond_resched();
+		}
+	}
+
+	ret = wait_event_interruptible(ctx->wait,
+			aio_ring_avail(ctx) >= min_complete ||
+			atomic_read(&ctx->dead));
+	if (ret)
+		return -EINTR;
+	if (unlikely(atomic_read(&ctx->dead)))
+		return -EINVAL;
+	return 0;
+}
+
+/* sys_io_ring_enter:
+ *	Submit iocbs from and/or wait for events in the rings of a context
+ *	created with io_setup2(IOCTX_FLAG_SQRING).  With IORING_FLAG_SUBMIT
+ *	up to to_submit iocbs are consumed from the submission ring, with
+ *	IORING_FLAG_GETEVENTS the call returns once at least min_complete
+ *	events are in the completion ring, polling for them on an
+ *	IOCTX_FLAG_IOPOLL context.  Returns the number of iocbs submitted.
+ *	May fail with -EINVAL if the context is invalid or has no submission
+ *	ring, and with any error io_submit() may return for the first iocb.
+ */
+SYSCALL_DEFINE4(io_ring_enter, aio_context_t, ctx_id, unsigned, to_submit,
+		unsigned, min_complete, unsigned, flags)
+{
+	struct kioctx *ctx;
+	long ret = 0, submitted = 0;
+
+	if (flags & ~(IORING_FLAG_SUBMIT | IORING_FLAG_GETEVENTS))
+		return -EINVAL;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (unlikely(!ctx)) {
+		pr_debug("EINVAL: invalid context id\n");
+		return -EINVAL;
+	}
+
+	ret = -EINVAL;
+	if (!(ctx->flags & IOCTX_FLAG_SQRING))
+		goto out;
+
+	if ((flags & IORING_FLAG_SUBMIT) && to_submit) {
+		ret = aio_ring_submit(ctx, to_submit);
+		if (ret < 0)
+			goto out;
+		submitted = ret;
+	}
+
+	ret = 0;
+	if ((flags & IORING_FLAG_GETEVENTS) && min_complete)
+		ret = aio_ring_wait(ctx, min_complete);
+out:
+	percpu_ref_put(&ctx->users);
+	return submitted ? submitted : ret;
+}
+
 /* lookup_kiocb
  *	Finds a given iocb for cancellation.
  */
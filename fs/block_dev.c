@@ -27,6 +27,7 @@
 #include <linux/namei.h>
 #include <linux/log2.h>
 #include <linux/cleancache.h>
+#include <linux/task_io_accounting_ops.h>
 #include <asm/uaccess.h>
 #include "internal.h"
 
@@ -145,17 +146,270 @@ blkdev_get_block(struct inode *inode, sector_t iblock,
 	return 0;
 }
 
+/*
+ * A block device needs none of the mapping and partial block handling of
+ * the generic direct I/O code, so build the bios straight from the iov_iter.
+ * Small synchronous requests use a bio on the stack and need no allocation
+ * at all, larger and asynchronous ones one allocation per bio from
+ * blkdev_dio_pool.
+ */
+#define DIO_INLINE_BIO_VECS 4
+
+static int blkdev_dio_rw(struct kiocb *iocb, struct iov_iter *iter)
+{
+	int rw = iov_iter_rw(iter) == WRITE ? WRITE_ODIRECT : READ;
+
+	/* the submitter is going to poll for this one */
+	if (iocb->ki_flags & IOCB_HIPRI)
+		rw |= REQ_HIPRI;
+	return rw;
+}
+
+/* Sleep until the I/O is done, or spin on the queue if asked to poll */
+static void blkdev_dio_wait(struct kiocb *iocb, struct block_device *bdev,
+			    void **waiter)
+{
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!READ_ONCE(*waiter))
+			break;
+		if (!(iocb->ki_flags & IOCB_HIPRI) ||
+		    !blk_poll(bdev_get_queue(bdev)))
+			io_schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static void blkdev_bio_end_io_simple(struct bio *bio, int error)
+{
+	struct task_struct *waiter = bio->bi_private;
+
+	WRITE_ONCE(bio->bi_private, NULL);
+	wake_up_process(waiter);
+}
+
+static ssize_t
+__blkdev_direct_IO_simple(struct kiocb *iocb, struct iov_iter *iter,
+			  loff_t pos, int nr_pages)
+{
+	struct block_device *bdev = I_BDEV(iocb->ki_filp->f_mapping->host);
+	struct bio_vec inline_vecs[DIO_INLINE_BIO_VECS], *bvec;
+	bool should_dirty = false;
+	struct bio bio;
+	ssize_t ret;
+	int i;
+
+	bio_init(&bio);
+	bio.bi_max_vecs = nr_pages;
+	bio.bi_io_vec = inline_vecs;
+	bio.bi_bdev = bdev;
+	bio.bi_iter.bi_sector = pos >> 9;
+	bio.bi_private = current;
+	bio.bi_end_io = blkdev_bio_end_io_simple;
+
+	ret = bio_iov_iter_get_pages(&bio, iter);
+	if (unlikely(ret))
+		return ret;
+	ret = bio.bi_iter.bi_size;
+
+	if (iov_iter_rw(iter) == READ)
+		should_dirty = iter->type == ITER_IOVEC;
+	else
+		task_io_account_write(ret);
+
+	submit_bio(blkdev_dio_rw(iocb, iter), &bio);
+	blkdev_dio_wait(iocb, bdev, &bio.bi_private);
+
+	bio_for_each_segment_all(bvec, &bio, i) {
+		if (should_dirty && !PageCompound(bvec->bv_page))
+			set_page_dirty_lock(bvec->bv_page);
+		put_page(bvec->bv_page);
+	}
+
+	if (unlikely(!test_bit(BIO_UPTODATE, &bio.bi_flags)))
+		return -EIO;
+	return ret;
+}
+
+struct blkdev_dio {
+	union {
+		struct kiocb		*iocb;
+		struct task_struct	*waiter;
+	};
+	size_t			size;
+	atomic_t		ref;
+	int			error;
+	bool			multi_bio : 1;
+	bool			should_dirty : 1;
+	bool			is_sync : 1;
+	struct bio		bio;
+};
+
+static struct bio_set *blkdev_dio_pool __read_mostly;
+
+static void blkdev_bio_end_io(struct bio *bio, int error)
+{
+	struct blkdev_dio *dio = bio->bi_private;
+	bool should_dirty = dio->should_dirty;
+
+	if (error)
+		cmpxchg(&dio->error, 0, error);
+
+	if (!dio->multi_bio || atomic_dec_and_test(&dio->ref)) {
+		if (!dio->is_sync) {
+			struct kiocb *iocb = dio->iocb;
+			ssize_t ret = dio->error;
+
+			if (likely(!ret))
+				ret = dio->size;
+
+			iocb->ki_complete(iocb, ret, 0);
+			bio_put(&dio->bio);
+		} else {
+			struct task_struct *waiter = dio->waiter;
+
+			WRITE_ONCE(dio->waiter, NULL);
+			wake_up_process(waiter);
+		}
+	}
+
+	if (should_dirty) {
+		bio_check_pages_dirty(bio);
+	} else {
+		struct bio_vec *bvec;
+		int i;
+
+		bio_for_each_segment_all(bvec, bio, i)
+			put_page(bvec->bv_page);
+		bio_put(bio);
+	}
+}
+
+static ssize_t
+__blkdev_direct_IO(struct kiocb *iocb, struct iov_iter *iter, loff_t pos,
+		   int nr_pages)
+{
+	struct block_device *bdev = I_BDEV(iocb->ki_filp->f_mapping->host);
+	bool is_read = iov_iter_rw(iter) == READ;
+	int rw = blkdev_dio_rw(iocb, iter);
+	struct blk_plug plug;
+	struct blkdev_dio *dio;
+	struct bio *bio;
+	ssize_t ret;
+
+	bio = bio_alloc_bioset(GFP_KERNEL, nr_pages, blkdev_dio_pool);
+	bio_get(bio); /* extra ref for the completion handler */
+
+	dio = container_of(bio, struct blkdev_dio, bio);
+	dio->is_sync = is_sync_kiocb(iocb);
+	if (dio->is_sync)
+		dio->waiter = current;
+	else
+		dio->iocb = iocb;
+
+	dio->size = 0;
+	dio->error = 0;
+	dio->multi_bio = false;
+	dio->should_dirty = is_read && iter->type == ITER_IOVEC;
+
+	blk_start_plug(&plug);
+	for (;;) {
+		int err;
+
+		bio->bi_bdev = bdev;
+		bio->bi_iter.bi_sector = pos >> 9;
+		bio->bi_private = dio;
+		bio->bi_end_io = blkdev_bio_end_io;
+
+		err = bio_iov_iter_get_pages(bio, iter);
+		if (unlikely(err)) {
+			bio_endio(bio, err);
+			break;
+		}
+
+		if (is_read) {
+			if (dio->should_dirty)
+				bio_set_pages_dirty(bio);
+		} else {
+			task_io_account_write(bio->bi_iter.bi_size);
+		}
+
+		dio->size += bio->bi_iter.bi_size;
+		pos += bio->bi_iter.bi_size;
+
+		nr_pages = iov_iter_npages(iter, BIO_MAX_PAGES);
+		if (!nr_pages) {
+			submit_bio(rw, bio);
+			break;
+		}
+
+		if (!dio->multi_bio) {
+			dio->multi_bio = true;
+			atomic_set(&dio->ref, 2);
+		} else {
+			atomic_inc(&dio->ref);
+		}
+
+		submit_bio(rw, bio);
+		bio = bio_alloc(GFP_KERNEL, nr_pages);
+	}
+	blk_finish_plug(&plug);
+
+	if (!dio->is_sync)
+		return -EIOCBQUEUED;
+
+	blkdev_dio_wait(iocb, bdev, (void **)&dio->waiter);
+
+	ret = dio->error;
+	if (likely(!ret))
+		ret = dio->size;
+
+	bio_put(&dio->bio);
+	return ret;
+}
+
 static ssize_t
 blkdev_direct_IO(struct kiocb *iocb, struct iov_iter *iter, loff_t offset)
 {
 	struct file *file = iocb->ki_filp;
 	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev = I_BDEV(inode);
+	int nr_pages;
 
-	return __blockdev_direct_IO(iocb, inode, I_BDEV(inode), iter, offset,
+	/*
+	 * An O_DSYNC write has to be flushed before it completes, which
+	 * the generic code does from process context for aio.
+	 */
+	if (iov_iter_rw(iter) == WRITE && !is_sync_kiocb(iocb) &&
+	    (file->f_flags & O_DSYNC))
+		goto generic;
+
+	if ((offset | iov_iter_alignment(iter)) &
+	    (bdev_logical_block_size(bdev) - 1))
+		return -EINVAL;
+
+	nr_pages = iov_iter_npages(iter, BIO_MAX_PAGES);
+	if (!nr_pages)
+		return 0;
+	if (is_sync_kiocb(iocb) && nr_pages <= DIO_INLINE_BIO_VECS)
+		return __blkdev_direct_IO_simple(iocb, iter, offset, nr_pages);
+	return __blkdev_direct_IO(iocb, iter, offset, nr_pages);
+
+generic:
+	return __blockdev_direct_IO(iocb, inode, bdev, iter, offset,
 				    blkdev_get_block, NULL, NULL,
 				    DIO_SKIP_DIO_COUNT);
 }
 
+static __init int blkdev_init(void)
+{
+	blkdev_dio_pool = bioset_create(4, offsetof(struct blkdev_dio, bio));
+	if (!blkdev_dio_pool)
+		return -ENOMEM;
+	return 0;
+}
+module_init(blkdev_init);
+
 int __sync_blockdev(struct block_device *bdev, int wait)
 {
 	if (!bdev)
@@ -1469,6 +1723,7 @@ static int blkdev_open(struct inode * inode, struct file * filp)
 		filp->f_mode |= FMODE_EXCL;
 	if ((filp->f_flags & O_ACCMODE) == 3)
 		filp->f_mode |= FMODE_WRITE_IOCTL;
+	filp->f_mode |= FMODE_NOWAIT;
 
 	bdev = bd_acquire(inode);
 	if (bdev == NULL)
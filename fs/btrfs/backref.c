@@ -893,6 +893,7 @@ static int find_parent_nodes(struct btrfs_trans_handle *trans,
 	struct btrfs_key key;
 	struct btrfs_path *path;
 	struct btrfs_delayed_ref_root *delayed_refs = NULL;
+	struct btrfs_delayed_ref_shard *shard;
 	struct btrfs_delayed_ref_head *head;
 	int info_level = 0;
 	int ret;
@@ -943,12 +944,13 @@ again:
 		 * head
 		 */
 		delayed_refs = &trans->transaction->delayed_refs;
-		spin_lock(&delayed_refs->lock);
+		shard = btrfs_delayed_ref_shard(delayed_refs, bytenr);
+		spin_lock(&shard->lock);
 		head = btrfs_find_delayed_ref_head(trans, bytenr);
 		if (head) {
 			if (!mutex_trylock(&head->mutex)) {
 				atomic_inc(&head->node.refs);
-				spin_unlock(&delayed_refs->lock);
+				spin_unlock(&shard->lock);
 
 				btrfs_release_path(path);
 
@@ -961,7 +963,7 @@ again:
 				btrfs_put_delayed_ref(&head->node);
 				goto again;
 			}
-			spin_unlock(&delayed_refs->lock);
+			spin_unlock(&shard->lock);
 			ret = __add_delayed_refs(head, time_seq,
 						 &prefs_delayed, &total_refs,
 						 inum);
@@ -969,7 +971,7 @@ again:
 			if (ret)
 				goto out;
 		} else {
-			spin_unlock(&delayed_refs->lock);
+			spin_unlock(&shard->lock);
 		}
 	}
 
@@ -237,18 +237,19 @@ find_ref_head(struct rb_root *root, u64 bytenr,
 int btrfs_delayed_ref_lock(struct btrfs_trans_handle *trans,
 			   struct btrfs_delayed_ref_head *head)
 {
-	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 
-	delayed_refs = &trans->transaction->delayed_refs;
-	assert_spin_locked(&delayed_refs->lock);
+	shard = btrfs_delayed_ref_shard(&trans->transaction->delayed_refs,
+					head->node.bytenr);
+	assert_spin_locked(&shard->lock);
 	if (mutex_trylock(&head->mutex))
 		return 0;
 
 	atomic_inc(&head->node.refs);
-	spin_unlock(&delayed_refs->lock);
+	spin_unlock(&shard->lock);
 
 	mutex_lock(&head->mutex);
-	spin_lock(&delayed_refs->lock);
+	spin_lock(&shard->lock);
 	if (!head->node.in_tree) {
 		mutex_unlock(&head->mutex);
 		btrfs_put_delayed_ref(&head->node);
@@ -264,8 +265,11 @@ static inline void drop_delayed_ref(struct btrfs_trans_handle *trans,
 				    struct btrfs_delayed_ref_node *ref)
 {
 	if (btrfs_delayed_ref_is_head(ref)) {
+		struct btrfs_delayed_ref_shard *shard;
+
+		shard = btrfs_delayed_ref_shard(delayed_refs, ref->bytenr);
 		head = btrfs_delayed_node_to_head(ref);
-		rb_erase(&head->href_node, &delayed_refs->href_root);
+		rb_erase(&head->href_node, &shard->href_root);
 	} else {
 		assert_spin_locked(&head->lock);
 		rb_erase(&ref->rb_node, &head->ref_root);
@@ -394,24 +398,21 @@ int btrfs_check_delayed_seq(struct btrfs_fs_info *fs_info,
 	return ret;
 }
 
-struct btrfs_delayed_ref_head *
-btrfs_select_ref_head(struct btrfs_trans_handle *trans)
+static struct btrfs_delayed_ref_head *
+select_shard_ref_head(struct btrfs_delayed_ref_shard *shard)
 {
-	struct btrfs_delayed_ref_root *delayed_refs;
 	struct btrfs_delayed_ref_head *head;
 	u64 start;
 	bool loop = false;
 
-	delayed_refs = &trans->transaction->delayed_refs;
-
 again:
-	start = delayed_refs->run_delayed_start;
-	head = find_ref_head(&delayed_refs->href_root, start, 1);
+	start = shard->run_delayed_start;
+	head = find_ref_head(&shard->href_root, start, 1);
 	if (!head && !loop) {
-		delayed_refs->run_delayed_start = 0;
+		shard->run_delayed_start = 0;
 		start = 0;
 		loop = true;
-		head = find_ref_head(&delayed_refs->href_root, start, 1);
+		head = find_ref_head(&shard->href_root, start, 1);
 		if (!head)
 			return NULL;
 	} else if (!head && loop) {
@@ -425,7 +426,7 @@ again:
 		if (!node) {
 			if (loop)
 				return NULL;
-			delayed_refs->run_delayed_start = 0;
+			shard->run_delayed_start = 0;
 			start = 0;
 			loop = true;
 			goto again;
@@ -435,13 +436,45 @@ again:
 	}
 
 	head->processing = 1;
-	WARN_ON(delayed_refs->num_heads_ready == 0);
-	delayed_refs->num_heads_ready--;
-	delayed_refs->run_delayed_start = head->node.bytenr +
+	WARN_ON(shard->num_heads_ready == 0);
+	shard->num_heads_ready--;
+	shard->run_delayed_start = head->node.bytenr +
 		head->node.num_bytes;
 	return head;
 }
 
+/*
+ * Pick the next head ref to run and mark it as processing.  Each call
+ * starts in the shard after the one the previous call started in, so
+ * concurrent runners mostly work in different shards.  On success the
+ * head is returned with its shard lock held.
+ */
+struct btrfs_delayed_ref_head *
+btrfs_select_ref_head(struct btrfs_trans_handle *trans)
+{
+	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
+	struct btrfs_delayed_ref_head *head;
+	unsigned int first;
+	int i;
+
+	delayed_refs = &trans->transaction->delayed_refs;
+	first = atomic_inc_return(&delayed_refs->run_shard);
+
+	for (i = 0; i < BTRFS_DELAYED_REF_SHARDS; i++) {
+		shard = &delayed_refs->shards[(first + i) %
+					      BTRFS_DELAYED_REF_SHARDS];
+		if (RB_EMPTY_ROOT(&shard->href_root))
+			continue;
+		spin_lock(&shard->lock);
+		head = select_shard_ref_head(shard);
+		if (head)
+			return head;
+		spin_unlock(&shard->lock);
+	}
+	return NULL;
+}
+
 /*
  * helper function to update an extent delayed ref in the
  * rbtree.  existing and update must both have the same
@@ -489,7 +522,7 @@ update_existing_ref(struct btrfs_trans_handle *trans,
  * existing and update must have the same bytenr
  */
 static noinline void
-update_existing_head_ref(struct btrfs_delayed_ref_root *delayed_refs,
+update_existing_head_ref(struct btrfs_delayed_ref_shard *shard,
 			 struct btrfs_delayed_ref_node *existing,
 			 struct btrfs_delayed_ref_node *update)
 {
@@ -553,9 +586,9 @@ update_existing_head_ref(struct btrfs_delayed_ref_root *delayed_refs,
 	 */
 	if (existing_ref->is_data) {
 		if (existing_ref->total_ref_mod >= 0 && old_ref_mod < 0)
-			delayed_refs->pending_csums -= existing->num_bytes;
+			shard->pending_csums -= existing->num_bytes;
 		if (existing_ref->total_ref_mod < 0 && old_ref_mod >= 0)
-			delayed_refs->pending_csums += existing->num_bytes;
+			shard->pending_csums += existing->num_bytes;
 	}
 	spin_unlock(&existing_ref->lock);
 }
@@ -574,6 +607,7 @@ add_delayed_ref_head(struct btrfs_fs_info *fs_info,
 	struct btrfs_delayed_ref_head *existing;
 	struct btrfs_delayed_ref_head *head_ref = NULL;
 	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 	int count_mod = 1;
 	int must_insert_reserved = 0;
 
@@ -603,6 +637,7 @@ add_delayed_ref_head(struct btrfs_fs_info *fs_info,
 		must_insert_reserved = 0;
 
 	delayed_refs = &trans->transaction->delayed_refs;
+	shard = btrfs_delayed_ref_shard(delayed_refs, bytenr);
 
 	/* first set the basic ref node struct up */
 	atomic_set(&ref->refs, 1);
@@ -627,10 +662,9 @@ add_delayed_ref_head(struct btrfs_fs_info *fs_info,
 
 	trace_add_delayed_ref_head(ref, head_ref, action);
 
-	existing = htree_insert(&delayed_refs->href_root,
-				&head_ref->href_node);
+	existing = htree_insert(&shard->href_root, &head_ref->href_node);
 	if (existing) {
-		update_existing_head_ref(delayed_refs, &existing->node, ref);
+		update_existing_head_ref(shard, &existing->node, ref);
 		/*
 		 * we've updated the existing ref, free the newly
 		 * allocated ref
@@ -639,9 +673,9 @@ add_delayed_ref_head(struct btrfs_fs_info *fs_info,
 		head_ref = existing;
 	} else {
 		if (is_data && count_mod < 0)
-			delayed_refs->pending_csums += num_bytes;
-		delayed_refs->num_heads++;
-		delayed_refs->num_heads_ready++;
+			shard->pending_csums += num_bytes;
+		shard->num_heads++;
+		shard->num_heads_ready++;
 		atomic_inc(&delayed_refs->num_entries);
 		trans->delayed_ref_updates++;
 	}
@@ -789,7 +823,7 @@ int btrfs_add_delayed_tree_ref(struct btrfs_fs_info *fs_info,
 {
 	struct btrfs_delayed_tree_ref *ref;
 	struct btrfs_delayed_ref_head *head_ref;
-	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 
 	if (!is_fstree(ref_root) || !fs_info->quota_enabled)
 		no_quota = 0;
@@ -807,8 +841,9 @@ int btrfs_add_delayed_tree_ref(struct btrfs_fs_info *fs_info,
 
 	head_ref->extent_op = extent_op;
 
-	delayed_refs = &trans->transaction->delayed_refs;
-	spin_lock(&delayed_refs->lock);
+	shard = btrfs_delayed_ref_shard(&trans->transaction->delayed_refs,
+					bytenr);
+	spin_lock(&shard->lock);
 
 	/*
 	 * insert both the head node and the new ref without dropping
@@ -820,7 +855,7 @@ int btrfs_add_delayed_tree_ref(struct btrfs_fs_info *fs_info,
 	add_delayed_tree_ref(fs_info, trans, head_ref, &ref->node, bytenr,
 				   num_bytes, parent, ref_root, level, action,
 				   no_quota);
-	spin_unlock(&delayed_refs->lock);
+	spin_unlock(&shard->lock);
 
 	return 0;
 }
@@ -838,7 +873,7 @@ int btrfs_add_delayed_data_ref(struct btrfs_fs_info *fs_info,
 {
 	struct btrfs_delayed_data_ref *ref;
 	struct btrfs_delayed_ref_head *head_ref;
-	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 
 	if (!is_fstree(ref_root) || !fs_info->quota_enabled)
 		no_quota = 0;
@@ -856,8 +891,9 @@ int btrfs_add_delayed_data_ref(struct btrfs_fs_info *fs_info,
 
 	head_ref->extent_op = extent_op;
 
-	delayed_refs = &trans->transaction->delayed_refs;
-	spin_lock(&delayed_refs->lock);
+	shard = btrfs_delayed_ref_shard(&trans->transaction->delayed_refs,
+					bytenr);
+	spin_lock(&shard->lock);
 
 	/*
 	 * insert both the head node and the new ref without dropping
@@ -869,7 +905,7 @@ int btrfs_add_delayed_data_ref(struct btrfs_fs_info *fs_info,
 	add_delayed_data_ref(fs_info, trans, head_ref, &ref->node, bytenr,
 				   num_bytes, parent, ref_root, owner, offset,
 				   action, no_quota);
-	spin_unlock(&delayed_refs->lock);
+	spin_unlock(&shard->lock);
 
 	return 0;
 }
@@ -880,7 +916,7 @@ int btrfs_add_delayed_extent_op(struct btrfs_fs_info *fs_info,
 				struct btrfs_delayed_extent_op *extent_op)
 {
 	struct btrfs_delayed_ref_head *head_ref;
-	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 
 	head_ref = kmem_cache_alloc(btrfs_delayed_ref_head_cachep, GFP_NOFS);
 	if (!head_ref)
@@ -888,29 +924,88 @@ int btrfs_add_delayed_extent_op(struct btrfs_fs_info *fs_info,
 
 	head_ref->extent_op = extent_op;
 
-	delayed_refs = &trans->transaction->delayed_refs;
-	spin_lock(&delayed_refs->lock);
+	shard = btrfs_delayed_ref_shard(&trans->transaction->delayed_refs,
+					bytenr);
+	spin_lock(&shard->lock);
 
 	add_delayed_ref_head(fs_info, trans, &head_ref->node, bytenr,
 				   num_bytes, BTRFS_UPDATE_DELAYED_HEAD,
 				   extent_op->is_data);
 
-	spin_unlock(&delayed_refs->lock);
+	spin_unlock(&shard->lock);
 	return 0;
 }
 
 /*
  * this does a simple search for the head node for a given extent.
- * It must be called with the delayed ref spinlock held, and it returns
- * the head node if any where found, or NULL if not.
+ * It must be called with the lock of the shard holding bytenr held,
+ * and it returns the head node if any where found, or NULL if not.
  */
 struct btrfs_delayed_ref_head *
 btrfs_find_delayed_ref_head(struct btrfs_trans_handle *trans, u64 bytenr)
 {
-	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 
-	delayed_refs = &trans->transaction->delayed_refs;
-	return find_ref_head(&delayed_refs->href_root, bytenr, 0);
+	shard = btrfs_delayed_ref_shard(&trans->transaction->delayed_refs,
+					bytenr);
+	return find_ref_head(&shard->href_root, bytenr, 0);
+}
+
+void btrfs_init_delayed_ref_root(struct btrfs_delayed_ref_root *delayed_refs)
+{
+	struct btrfs_delayed_ref_shard *shard;
+	int i;
+
+	for (i = 0; i < BTRFS_DELAYED_REF_SHARDS; i++) {
+		shard = &delayed_refs->shards[i];
+		shard->href_root = RB_ROOT;
+		spin_lock_init(&shard->lock);
+		shard->num_heads = 0;
+		shard->num_heads_ready = 0;
+		shard->pending_csums = 0;
+		shard->run_delayed_start = 0;
+	}
+	atomic_set(&delayed_refs->num_entries, 0);
+	atomic_set(&delayed_refs->run_shard, 0);
+	delayed_refs->flushing = 0;
+}
+
+bool btrfs_delayed_refs_empty(struct btrfs_delayed_ref_root *delayed_refs)
+{
+	int i;
+
+	for (i = 0; i < BTRFS_DELAYED_REF_SHARDS; i++)
+		if (!RB_EMPTY_ROOT(&delayed_refs->shards[i].href_root))
+			return false;
+	return true;
+}
+
+/*
+ * The totals below are summed without the shard locks, they are only
+ * used as estimates for reservations and throttling.
+ */
+unsigned long
+btrfs_delayed_refs_heads_ready(struct btrfs_delayed_ref_root *delayed_refs)
+{
+	unsigned long num_heads = 0;
+	int i;
+
+	for (i = 0; i < BTRFS_DELAYED_REF_SHARDS; i++)
+		num_heads +=
+			ACCESS_ONCE(delayed_refs->shards[i].num_heads_ready);
+	return num_heads;
+}
+
+u64
+btrfs_delayed_refs_pending_csums(struct btrfs_delayed_ref_root *delayed_refs)
+{
+	u64 csum_bytes = 0;
+	int i;
+
+	for (i = 0; i < BTRFS_DELAYED_REF_SHARDS; i++)
+		csum_bytes +=
+			ACCESS_ONCE(delayed_refs->shards[i].pending_csums);
+	return csum_bytes;
 }
 
 void btrfs_delayed_ref_exit(void)
@@ -18,6 +18,8 @@
 #ifndef __DELAYED_REF__
 #define __DELAYED_REF__
 
+#include <linux/hash.h>
+
 /* these are the possible values of struct btrfs_delayed_ref_node->action */
 #define BTRFS_ADD_DELAYED_REF    1 /* add one backref to the tree */
 #define BTRFS_DROP_DELAYED_REF   2 /* delete one backref from the tree */
@@ -128,36 +130,59 @@ struct btrfs_delayed_data_ref {
 	u64 offset;
 };
 
-struct btrfs_delayed_ref_root {
+/*
+ * The head refs of a transaction are spread over several rbtrees by
+ * bytenr, each with its own lock, so that tasks adding refs and the
+ * workers running them don't all serialize on one spinlock.
+ */
+#define BTRFS_DELAYED_REF_SHARD_BITS	4
+#define BTRFS_DELAYED_REF_SHARDS	(1 << BTRFS_DELAYED_REF_SHARD_BITS)
+
+struct btrfs_delayed_ref_shard {
 	/* head ref rbtree */
 	struct rb_root href_root;
 
 	/* this spin lock protects the rbtree and the entries inside */
 	spinlock_t lock;
 
-	/* how many delayed ref updates we've queued, used by the
-	 * throttling code
-	 */
-	atomic_t num_entries;
-
-	/* total number of head nodes in tree */
+	/* total number of head nodes in this shard */
 	unsigned long num_heads;
 
-	/* total number of head nodes ready for processing */
+	/* number of head nodes in this shard ready for processing */
 	unsigned long num_heads_ready;
 
 	u64 pending_csums;
 
+	u64 run_delayed_start;
+} ____cacheline_aligned_in_smp;
+
+struct btrfs_delayed_ref_root {
+	struct btrfs_delayed_ref_shard shards[BTRFS_DELAYED_REF_SHARDS];
+
+	/* how many delayed ref updates we've queued, used by the
+	 * throttling code
+	 */
+	atomic_t num_entries;
+
+	/* shard the next btrfs_select_ref_head starts looking in */
+	atomic_t run_shard;
+
 	/*
 	 * set when the tree is flushing before a transaction commit,
 	 * used by the throttling code to decide if new updates need
 	 * to be run right away
 	 */
 	int flushing;
-
-	u64 run_delayed_start;
 };
 
+static inline struct btrfs_delayed_ref_shard *
+btrfs_delayed_ref_shard(struct btrfs_delayed_ref_root *delayed_refs,
+			u64 bytenr)
+{
+	return &delayed_refs->shards[hash_64(bytenr,
+					     BTRFS_DELAYED_REF_SHARD_BITS)];
+}
+
 extern struct kmem_cache *btrfs_delayed_ref_head_cachep;
 extern struct kmem_cache *btrfs_delayed_tree_ref_cachep;
 extern struct kmem_cache *btrfs_delayed_data_ref_cachep;
@@ -224,6 +249,13 @@ void btrfs_merge_delayed_refs(struct btrfs_trans_handle *trans,
 			      struct btrfs_delayed_ref_root *delayed_refs,
 			      struct btrfs_delayed_ref_head *head);
 
+void btrfs_init_delayed_ref_root(struct btrfs_delayed_ref_root *delayed_refs);
+bool btrfs_delayed_refs_empty(struct btrfs_delayed_ref_root *delayed_refs);
+unsigned long
+btrfs_delayed_refs_heads_ready(struct btrfs_delayed_ref_root *delayed_refs);
+u64
+btrfs_delayed_refs_pending_csums(struct btrfs_delayed_ref_root *delayed_refs);
+
 struct btrfs_delayed_ref_head *
 btrfs_find_delayed_ref_head(struct btrfs_trans_handle *trans, u64 bytenr);
 int btrfs_delayed_ref_lock(struct btrfs_trans_handle *trans,
@@ -42,6 +42,7 @@
 #include "locking.h"
 #include "tree-log.h"
 #include "free-space-cache.h"
+#include "free-space-tree.h"
 #include "inode-map.h"
 #include "check-integrity.h"
 #include "rcu-string.h"
@@ -175,6 +176,7 @@ static struct btrfs_lockdep_keyset {
 	{ .id = BTRFS_TREE_RELOC_OBJECTID,	.name_stem = "treloc"	},
 	{ .id = BTRFS_DATA_RELOC_TREE_OBJECTID,	.name_stem = "dreloc"	},
 	{ .id = BTRFS_UUID_TREE_OBJECTID,	.name_stem = "uuid"	},
+	{ .id = BTRFS_FREE_SPACE_TREE_OBJECTID,	.name_stem = "free-space" },
 	{ .id = 0,				.name_stem = "tree"	},
 };
 
@@ -1657,6 +1659,9 @@ struct btrfs_root *btrfs_get_fs_root(struct btrfs_fs_info *fs_info,
 	if (location->objectid == BTRFS_UUID_TREE_OBJECTID)
 		return fs_info->uuid_root ? fs_info->uuid_root :
 					    ERR_PTR(-ENOENT);
+	if (location->objectid == BTRFS_FREE_SPACE_TREE_OBJECTID)
+		return fs_info->free_space_root ? fs_info->free_space_root :
+						  ERR_PTR(-ENOENT);
 again:
 	root = btrfs_lookup_fs_root(fs_info, location->objectid);
 	if (root) {
@@ -2117,6 +2122,7 @@ static void free_root_pointers(struct btrfs_fs_info *info, int chunk_root)
 	free_root_extent_buffers(info->csum_root);
 	free_root_extent_buffers(info->quota_root);
 	free_root_extent_buffers(info->uuid_root);
+	free_root_extent_buffers(info->free_space_root);
 	if (chunk_root)
 		free_root_extent_buffers(info->chunk_root);
 }
@@ -2416,6 +2422,15 @@ static int btrfs_read_roots(struct btrfs_fs_info *fs_info,
 		fs_info->uuid_root = root;
 	}
 
+	if (btrfs_fs_compat_ro(fs_info, FREE_SPACE_TREE)) {
+		location.objectid = BTRFS_FREE_SPACE_TREE_OBJECTID;
+		root = btrfs_read_tree_root(tree_root, &location);
+		if (IS_ERR(root))
+			return PTR_ERR(root);
+		set_bit(BTRFS_ROOT_TRACK_DIRTY, &root->state);
+		fs_info->free_space_root = root;
+	}
+
 	return 0;
 }
 
@@ -3015,6 +3030,30 @@ retry_root_backup:
 	if (sb->s_flags & MS_RDONLY)
 		return 0;
 
+	if (btrfs_test_opt(tree_root, CLEAR_CACHE) &&
+	    btrfs_fs_compat_ro(fs_info, FREE_SPACE_TREE)) {
+		pr_info("BTRFS: clearing free space tree\n");
+		ret = btrfs_clear_free_space_tree(fs_info);
+		if (ret) {
+			pr_warn("BTRFS: failed to clear free space tree %d\n",
+				ret);
+			close_ctree(tree_root);
+			return ret;
+		}
+	}
+
+	if (btrfs_test_opt(tree_root, FREE_SPACE_TREE) &&
+	    !btrfs_fs_compat_ro(fs_info, FREE_SPACE_TREE)) {
+		pr_info("BTRFS: creating free space tree\n");
+		ret = btrfs_create_free_space_tree(fs_info);
+		if (ret) {
+			pr_warn("BTRFS: failed to create free space tree %d\n",
+				ret);
+			close_ctree(tree_root);
+			return ret;
+		}
+	}
+
 	down_read(&fs_info->cleanup_work_sem);
 	if ((ret = btrfs_orphan_cleanup(fs_info->fs_root)) ||
 	    (ret = btrfs_orphan_cleanup(fs_info->tree_root))) {
@@ -4072,24 +4111,15 @@ static void btrfs_destroy_all_ordered_extents(struct btrfs_fs_info *fs_info)
 	spin_unlock(&fs_info->ordered_root_lock);
 }
 
-static int btrfs_destroy_delayed_refs(struct btrfs_transaction *trans,
-				      struct btrfs_root *root)
+static void btrfs_destroy_delayed_ref_shard(struct btrfs_root *root,
+				struct btrfs_delayed_ref_root *delayed_refs,
+				struct btrfs_delayed_ref_shard *shard)
 {
 	struct rb_node *node;
-	struct btrfs_delayed_ref_root *delayed_refs;
 	struct btrfs_delayed_ref_node *ref;
-	int ret = 0;
-
-	delayed_refs = &trans->delayed_refs;
-
-	spin_lock(&delayed_refs->lock);
-	if (atomic_read(&delayed_refs->num_entries) == 0) {
-		spin_unlock(&delayed_refs->lock);
-		btrfs_info(root->fs_info, "delayed_refs has NO entry");
-		return ret;
-	}
 
-	while ((node = rb_first(&delayed_refs->href_root)) != NULL) {
+	spin_lock(&shard->lock);
+	while ((node = rb_first(&shard->href_root)) != NULL) {
 		struct btrfs_delayed_ref_head *head;
 		bool pin_bytes = false;
 
@@ -4097,12 +4127,12 @@ static int btrfs_destroy_delayed_refs(struct btrfs_transaction *trans,
 				href_node);
 		if (!mutex_trylock(&head->mutex)) {
 			atomic_inc(&head->node.refs);
-			spin_unlock(&delayed_refs->lock);
+			spin_unlock(&shard->lock);
 
 			mutex_lock(&head->mutex);
 			mutex_unlock(&head->mutex);
 			btrfs_put_delayed_ref(&head->node);
-			spin_lock(&delayed_refs->lock);
+			spin_lock(&shard->lock);
 			continue;
 		}
 		spin_lock(&head->lock);
@@ -4117,14 +4147,14 @@ static int btrfs_destroy_delayed_refs(struct btrfs_transaction *trans,
 		if (head->must_insert_reserved)
 			pin_bytes = true;
 		btrfs_free_delayed_extent_op(head->extent_op);
-		delayed_refs->num_heads--;
+		shard->num_heads--;
 		if (head->processing == 0)
-			delayed_refs->num_heads_ready--;
+			shard->num_heads_ready--;
 		atomic_dec(&delayed_refs->num_entries);
 		head->node.in_tree = 0;
-		rb_erase(&head->href_node, &delayed_refs->href_root);
+		rb_erase(&head->href_node, &shard->href_root);
 		spin_unlock(&head->lock);
-		spin_unlock(&delayed_refs->lock);
+		spin_unlock(&shard->lock);
 		mutex_unlock(&head->mutex);
 
 		if (pin_bytes)
@@ -4132,10 +4162,29 @@ static int btrfs_destroy_delayed_refs(struct btrfs_transaction *trans,
 					 head->node.num_bytes, 1);
 		btrfs_put_delayed_ref(&head->node);
 		cond_resched();
-		spin_lock(&delayed_refs->lock);
+		spin_lock(&shard->lock);
+	}
+
+	spin_unlock(&shard->lock);
+}
+
+static int btrfs_destroy_delayed_refs(struct btrfs_transaction *trans,
+				      struct btrfs_root *root)
+{
+	struct btrfs_delayed_ref_root *delayed_refs;
+	int ret = 0;
+	int i;
+
+	delayed_refs = &trans->delayed_refs;
+
+	if (atomic_read(&delayed_refs->num_entries) == 0) {
+		btrfs_info(root->fs_info, "delayed_refs has NO entry");
+		return ret;
 	}
 
-	spin_unlock(&delayed_refs->lock);
+	for (i = 0; i < BTRFS_DELAYED_REF_SHARDS; i++)
+		btrfs_destroy_delayed_ref_shard(root, delayed_refs,
+						&delayed_refs->shards[i]);
 
 	return ret;
 }
@@ -33,6 +33,7 @@
 #include "raid56.h"
 #include "locking.h"
 #include "free-space-cache.h"
+#include "free-space-tree.h"
 #include "math.h"
 #include "sysfs.h"
 #include "qgroup.h"
@@ -334,12 +335,13 @@ static void put_caching_control(struct btrfs_caching_control *ctl)
 }
 
 /*
- * this is only called by cache_block_group, since we could have freed extents
- * we need to check the pinned_extents for any extents that can't be used yet
- * since their free space will be released as soon as the transaction commits.
+ * this is only called by cache_block_group and load_free_space_tree, since
+ * we could have freed extents we need to check the pinned_extents for any
+ * extents that can't be used yet since their free space will be released as
+ * soon as the transaction commits.
  */
-static u64 add_new_free_space(struct btrfs_block_group_cache *block_group,
-			      struct btrfs_fs_info *info, u64 start, u64 end)
+u64 add_new_free_space(struct btrfs_block_group_cache *block_group,
+		       struct btrfs_fs_info *info, u64 start, u64 end)
 {
 	u64 extent_start, extent_end, size, total_added = 0;
 	int ret;
@@ -376,11 +378,10 @@ static u64 add_new_free_space(struct btrfs_block_group_cache *block_group,
 	return total_added;
 }
 
-static noinline void caching_thread(struct btrfs_work *work)
+static int load_extent_tree_free(struct btrfs_caching_control *caching_ctl)
 {
 	struct btrfs_block_group_cache *block_group;
 	struct btrfs_fs_info *fs_info;
-	struct btrfs_caching_control *caching_ctl;
 	struct btrfs_root *extent_root;
 	struct btrfs_path *path;
 	struct extent_buffer *leaf;
@@ -388,16 +389,15 @@ static noinline void caching_thread(struct btrfs_work *work)
 	u64 total_found = 0;
 	u64 last = 0;
 	u32 nritems;
-	int ret = -ENOMEM;
+	int ret;
 
-	caching_ctl = container_of(work, struct btrfs_caching_control, work);
 	block_group = caching_ctl->block_group;
 	fs_info = block_group->fs_info;
 	extent_root = fs_info->extent_root;
 
 	path = btrfs_alloc_path();
 	if (!path)
-		goto out;
+		return -ENOMEM;
 
 	last = max_t(u64, block_group->key.objectid, BTRFS_SUPER_INFO_OFFSET);
 
@@ -414,15 +414,11 @@ static noinline void caching_thread(struct btrfs_work *work)
 	key.objectid = last;
 	key.offset = 0;
 	key.type = BTRFS_EXTENT_ITEM_KEY;
-again:
-	mutex_lock(&caching_ctl->mutex);
-	/* need to make sure the commit_root doesn't disappear */
-	down_read(&fs_info->commit_root_sem);
 
 next:
 	ret = btrfs_search_slot(NULL, extent_root, &key, path, 0, 0);
 	if (ret < 0)
-		goto err;
+		goto out;
 
 	leaf = path->nodes[0];
 	nritems = btrfs_header_nritems(leaf);
@@ -447,12 +443,14 @@ next:
 				up_read(&fs_info->commit_root_sem);
 				mutex_unlock(&caching_ctl->mutex);
 				cond_resched();
-				goto again;
+				mutex_lock(&caching_ctl->mutex);
+				down_read(&fs_info->commit_root_sem);
+				goto next;
 			}
 
 			ret = btrfs_next_leaf(extent_root, path);
 			if (ret < 0)
-				goto err;
+				goto out;
 			if (ret)
 				break;
 			leaf = path->nodes[0];
@@ -490,7 +488,7 @@ next:
 			else
 				last = key.objectid + key.offset;
 
-			if (total_found > (1024 * 1024 * 2)) {
+			if (total_found > CACHING_CTL_WAKE_UP) {
 				total_found = 0;
 				wake_up(&caching_ctl->wait);
 			}
@@ -504,25 +502,40 @@ next:
 					  block_group->key.offset);
 	caching_ctl->progress = (u64)-1;
 
+out:
+	btrfs_free_path(path);
+	return ret;
+}
+
+static noinline void caching_thread(struct btrfs_work *work)
+{
+	struct btrfs_block_group_cache *block_group;
+	struct btrfs_fs_info *fs_info;
+	struct btrfs_caching_control *caching_ctl;
+	int ret;
+
+	caching_ctl = container_of(work, struct btrfs_caching_control, work);
+	block_group = caching_ctl->block_group;
+	fs_info = block_group->fs_info;
+
+	mutex_lock(&caching_ctl->mutex);
+	/* need to make sure the commit_root doesn't disappear */
+	down_read(&fs_info->commit_root_sem);
+
+	if (btrfs_fs_compat_ro(fs_info, FREE_SPACE_TREE))
+		ret = load_free_space_tree(caching_ctl);
+	else
+		ret = load_extent_tree_free(caching_ctl);
+
 	spin_lock(&block_group->lock);
 	block_group->caching_ctl = NULL;
-	block_group->cached = BTRFS_CACHE_FINISHED;
+	block_group->cached = ret ? BTRFS_CACHE_ERROR : BTRFS_CACHE_FINISHED;
 	spin_unlock(&block_group->lock);
 
-err:
-	btrfs_free_path(path);
 	up_read(&fs_info->commit_root_sem);
-
-	free_excluded_extents(extent_root, block_group);
-
+	free_excluded_extents(fs_info->extent_root, block_group);
 	mutex_unlock(&caching_ctl->mutex);
-out:
-	if (ret) {
-		spin_lock(&block_group->lock);
-		block_group->caching_ctl = NULL;
-		block_group->cached = BTRFS_CACHE_ERROR;
-		spin_unlock(&block_group->lock);
-	}
+
 	wake_up(&caching_ctl->wait);
 
 	put_caching_control(caching_ctl);
@@ -745,7 +758,7 @@ int btrfs_lookup_extent_info(struct btrfs_trans_handle *trans,
 			     u64 offset, int metadata, u64 *refs, u64 *flags)
 {
 	struct btrfs_delayed_ref_head *head;
-	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 	struct btrfs_path *path;
 	struct btrfs_extent_item *ei;
 	struct extent_buffer *leaf;
@@ -829,13 +842,14 @@ search_again:
 	if (!trans)
 		goto out;
 
-	delayed_refs = &trans->transaction->delayed_refs;
-	spin_lock(&delayed_refs->lock);
+	shard = btrfs_delayed_ref_shard(&trans->transaction->delayed_refs,
+					bytenr);
+	spin_lock(&shard->lock);
 	head = btrfs_find_delayed_ref_head(trans, bytenr);
 	if (head) {
 		if (!mutex_trylock(&head->mutex)) {
 			atomic_inc(&head->node.refs);
-			spin_unlock(&delayed_refs->lock);
+			spin_unlock(&shard->lock);
 
 			btrfs_release_path(path);
 
@@ -858,7 +872,7 @@ search_again:
 		spin_unlock(&head->lock);
 		mutex_unlock(&head->mutex);
 	}
-	spin_unlock(&delayed_refs->lock);
+	spin_unlock(&shard->lock);
 out:
 	WARN_ON(num_refs == 0);
 	if (refs)
@@ -2356,6 +2370,7 @@ static noinline int __btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 					     unsigned long nr)
 {
 	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard = NULL;
 	struct btrfs_delayed_ref_node *ref;
 	struct btrfs_delayed_ref_head *locked_ref = NULL;
 	struct btrfs_delayed_extent_op *extent_op;
@@ -2372,17 +2387,17 @@ static noinline int __btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 			if (count >= nr)
 				break;
 
-			spin_lock(&delayed_refs->lock);
+			/* this returns with the head's shard locked */
 			locked_ref = btrfs_select_ref_head(trans);
-			if (!locked_ref) {
-				spin_unlock(&delayed_refs->lock);
+			if (!locked_ref)
 				break;
-			}
+			shard = btrfs_delayed_ref_shard(delayed_refs,
+						locked_ref->node.bytenr);
 
 			/* grab the lock that says we are going to process
 			 * all the refs for this head */
 			ret = btrfs_delayed_ref_lock(trans, locked_ref);
-			spin_unlock(&delayed_refs->lock);
+			spin_unlock(&shard->lock);
 			/*
 			 * we may have dropped the spin lock to get the head
 			 * mutex lock, and that might have given someone else
@@ -2417,10 +2432,10 @@ static noinline int __btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 		    btrfs_check_delayed_seq(fs_info, delayed_refs, ref->seq)) {
 			spin_unlock(&locked_ref->lock);
 			btrfs_delayed_ref_unlock(locked_ref);
-			spin_lock(&delayed_refs->lock);
+			spin_lock(&shard->lock);
 			locked_ref->processing = 0;
-			delayed_refs->num_heads_ready++;
-			spin_unlock(&delayed_refs->lock);
+			shard->num_heads_ready++;
+			spin_unlock(&shard->lock);
 			locked_ref = NULL;
 			cond_resched();
 			count++;
@@ -2480,19 +2495,18 @@ static noinline int __btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 			 * nobody got added.
 			 */
 			spin_unlock(&locked_ref->lock);
-			spin_lock(&delayed_refs->lock);
+			spin_lock(&shard->lock);
 			spin_lock(&locked_ref->lock);
 			if (rb_first(&locked_ref->ref_root) ||
 			    locked_ref->extent_op) {
 				spin_unlock(&locked_ref->lock);
-				spin_unlock(&delayed_refs->lock);
+				spin_unlock(&shard->lock);
 				continue;
 			}
 			ref->in_tree = 0;
-			delayed_refs->num_heads--;
-			rb_erase(&locked_ref->href_node,
-				 &delayed_refs->href_root);
-			spin_unlock(&delayed_refs->lock);
+			shard->num_heads--;
+			rb_erase(&locked_ref->href_node, &shard->href_root);
+			spin_unlock(&shard->lock);
 		} else {
 			actual_count++;
 			ref->in_tree = 0;
@@ -2540,9 +2554,9 @@ static noinline int __btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 		if (btrfs_delayed_ref_is_head(ref)) {
 			if (locked_ref->is_data &&
 			    locked_ref->total_ref_mod < 0) {
-				spin_lock(&delayed_refs->lock);
-				delayed_refs->pending_csums -= ref->num_bytes;
-				spin_unlock(&delayed_refs->lock);
+				spin_lock(&shard->lock);
+				shard->pending_csums -= ref->num_bytes;
+				spin_unlock(&shard->lock);
 			}
 			btrfs_delayed_ref_unlock(locked_ref);
 			locked_ref = NULL;
@@ -2563,12 +2577,13 @@ static noinline int __btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 
 		/*
 		 * We weigh the current average higher than our current runtime
-		 * to avoid large swings in the average.
+		 * to avoid large swings in the average.  Runners on other
+		 * shards may update it at the same time, losing a sample then
+		 * doesn't matter for an estimate.
 		 */
-		spin_lock(&delayed_refs->lock);
-		avg = fs_info->avg_delayed_ref_runtime * 3 + runtime;
+		avg = ACCESS_ONCE(fs_info->avg_delayed_ref_runtime);
+		avg = avg * 3 + runtime;
 		fs_info->avg_delayed_ref_runtime = avg >> 2;	/* div by 4 */
-		spin_unlock(&delayed_refs->lock);
 	}
 	return 0;
 }
@@ -2654,13 +2669,18 @@ u64 btrfs_csum_bytes_to_leaves(struct btrfs_root *root, u64 csum_bytes)
 int btrfs_check_space_for_delayed_refs(struct btrfs_trans_handle *trans,
 				       struct btrfs_root *root)
 {
+	struct btrfs_delayed_ref_root *delayed_refs;
 	struct btrfs_block_rsv *global_rsv;
-	u64 num_heads = trans->transaction->delayed_refs.num_heads_ready;
-	u64 csum_bytes = trans->transaction->delayed_refs.pending_csums;
+	u64 num_heads;
+	u64 csum_bytes;
 	u64 num_dirty_bgs = trans->transaction->num_dirty_bgs;
 	u64 num_bytes, num_dirty_bgs_bytes;
 	int ret = 0;
 
+	delayed_refs = &trans->transaction->delayed_refs;
+	num_heads = btrfs_delayed_refs_heads_ready(delayed_refs);
+	csum_bytes = btrfs_delayed_refs_pending_csums(delayed_refs);
+
 	num_bytes = btrfs_calc_trans_metadata_size(root, 1);
 	num_heads = heads_to_leaves(root, num_heads);
 	if (num_heads > 1)
@@ -2749,16 +2769,10 @@ done:
 		kfree(async);
 }
 
-int btrfs_async_run_delayed_refs(struct btrfs_root *root,
-				 unsigned long count, int wait)
+static void queue_async_delayed_refs(struct async_delayed_refs *async,
+				     struct btrfs_root *root,
+				     unsigned long count, int wait)
 {
-	struct async_delayed_refs *async;
-	int ret;
-
-	async = kmalloc(sizeof(*async), GFP_NOFS);
-	if (!async)
-		return -ENOMEM;
-
 	async->root = root->fs_info->tree_root;
 	async->count = count;
 	async->error = 0;
@@ -2772,6 +2786,19 @@ int btrfs_async_run_delayed_refs(struct btrfs_root *root,
 			delayed_ref_async_start, NULL, NULL);
 
 	btrfs_queue_work(root->fs_info->extent_workers, &async->work);
+}
+
+int btrfs_async_run_delayed_refs(struct btrfs_root *root,
+				 unsigned long count, int wait)
+{
+	struct async_delayed_refs *async;
+	int ret;
+
+	async = kmalloc(sizeof(*async), GFP_NOFS);
+	if (!async)
+		return -ENOMEM;
+
+	queue_async_delayed_refs(async, root, count, wait);
 
 	if (wait) {
 		wait_for_completion(&async->wait);
@@ -2782,6 +2809,59 @@ int btrfs_async_run_delayed_refs(struct btrfs_root *root,
 	return 0;
 }
 
+/*
+ * Below this many queued updates a commit runs its delayed refs alone,
+ * waking up workers would cost more than it saves.
+ */
+#define BTRFS_DELAYED_REFS_PARALLEL_MIN	4096
+
+/*
+ * Run the delayed refs of a transaction that is about to commit with
+ * workers from the extent_workers pool next to the committing task.
+ * The workers join the same transaction and, since the head refs are
+ * sharded, mostly pick their heads from different shards.  This waits
+ * for all of the workers before returning.
+ */
+int btrfs_run_delayed_refs_parallel(struct btrfs_trans_handle *trans,
+				    struct btrfs_root *root)
+{
+	struct btrfs_fs_info *fs_info = root->fs_info;
+	struct async_delayed_refs *async;
+	unsigned long count;
+	int nr_workers;
+	int ret;
+	int i;
+
+	count = atomic_read(&trans->transaction->delayed_refs.num_entries);
+	nr_workers = min_t(int, num_online_cpus(), fs_info->thread_pool_size);
+	nr_workers = min_t(int, nr_workers, BTRFS_DELAYED_REF_SHARDS) - 1;
+	if (trans->aborted || nr_workers <= 0 ||
+	    count < BTRFS_DELAYED_REFS_PARALLEL_MIN)
+		return btrfs_run_delayed_refs(trans, root, 0);
+
+	async = kcalloc(nr_workers, sizeof(*async), GFP_NOFS);
+	if (!async)
+		return btrfs_run_delayed_refs(trans, root, 0);
+
+	/*
+	 * Everybody gets the budget of a full run, the runners stop as soon
+	 * as there are no heads left to pick.
+	 */
+	count *= 2;
+	for (i = 0; i < nr_workers; i++)
+		queue_async_delayed_refs(&async[i], root, count, 1);
+
+	ret = btrfs_run_delayed_refs(trans, root, count);
+
+	for (i = 0; i < nr_workers; i++) {
+		wait_for_completion(&async[i].wait);
+		if (async[i].error && !ret)
+			ret = async[i].error;
+	}
+	kfree(async);
+	return ret;
+}
+
 /*
  * this starts processing the delayed reference count updates and
  * extent insertions we have queued up so far.  count can be
@@ -2797,14 +2877,23 @@ int btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 {
 	struct rb_node *node;
 	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 	struct btrfs_delayed_ref_head *head;
 	int ret;
+	int i;
 	int run_all = count == (unsigned long)-1;
 
 	/* We'll clean this up in btrfs_cleanup_transaction */
 	if (trans->aborted)
 		return 0;
 
+	/*
+	 * The refs queued while the free space tree is being populated are
+	 * run at commit, once the tree is set up to track them.
+	 */
+	if (root->fs_info->creating_free_space_tree)
+		return 0;
+
 	if (root == root->fs_info->extent_root)
 		root = root->fs_info->tree_root;
 
@@ -2826,12 +2915,16 @@ again:
 		if (!list_empty(&trans->new_bgs))
 			btrfs_create_pending_block_groups(trans, root);
 
-		spin_lock(&delayed_refs->lock);
-		node = rb_first(&delayed_refs->href_root);
-		if (!node) {
-			spin_unlock(&delayed_refs->lock);
-			goto out;
+		for (i = 0; i < BTRFS_DELAYED_REF_SHARDS; i++) {
+			shard = &delayed_refs->shards[i];
+			spin_lock(&shard->lock);
+			node = rb_first(&shard->href_root);
+			if (node)
+				break;
+			spin_unlock(&shard->lock);
 		}
+		if (!node)
+			goto out;
 		count = (unsigned long)-1;
 
 		while (node) {
@@ -2843,7 +2936,7 @@ again:
 				ref = &head->node;
 				atomic_inc(&ref->refs);
 
-				spin_unlock(&delayed_refs->lock);
+				spin_unlock(&shard->lock);
 				/*
 				 * Mutex was contended, block until it's
 				 * released and try again
@@ -2859,7 +2952,7 @@ again:
 			}
 			node = rb_next(node);
 		}
-		spin_unlock(&delayed_refs->lock);
+		spin_unlock(&shard->lock);
 		cond_resched();
 		goto again;
 	}
@@ -2904,21 +2997,22 @@ static noinline int check_delayed_ref(struct btrfs_trans_handle *trans,
 	struct btrfs_delayed_ref_head *head;
 	struct btrfs_delayed_ref_node *ref;
 	struct btrfs_delayed_data_ref *data_ref;
-	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 	struct rb_node *node;
 	int ret = 0;
 
-	delayed_refs = &trans->transaction->delayed_refs;
-	spin_lock(&delayed_refs->lock);
+	shard = btrfs_delayed_ref_shard(&trans->transaction->delayed_refs,
+					bytenr);
+	spin_lock(&shard->lock);
 	head = btrfs_find_delayed_ref_head(trans, bytenr);
 	if (!head) {
-		spin_unlock(&delayed_refs->lock);
+		spin_unlock(&shard->lock);
 		return 0;
 	}
 
 	if (!mutex_trylock(&head->mutex)) {
 		atomic_inc(&head->node.refs);
-		spin_unlock(&delayed_refs->lock);
+		spin_unlock(&shard->lock);
 
 		btrfs_release_path(path);
 
@@ -2931,7 +3025,7 @@ static noinline int check_delayed_ref(struct btrfs_trans_handle *trans,
 		btrfs_put_delayed_ref(&head->node);
 		return -EAGAIN;
 	}
-	spin_unlock(&delayed_refs->lock);
+	spin_unlock(&shard->lock);
 
 	spin_lock(&head->lock);
 	node = rb_first(&head->ref_root);
@@ -5160,6 +5254,8 @@ static void init_global_block_rsv(struct btrfs_fs_info *fs_info)
 	fs_info->tree_root->block_rsv = &fs_info->global_block_rsv;
 	if (fs_info->quota_root)
 		fs_info->quota_root->block_rsv = &fs_info->global_block_rsv;
+	if (fs_info->free_space_root)
+		fs_info->free_space_root->block_rsv = &fs_info->global_block_rsv;
 	fs_info->chunk_root->block_rsv = &fs_info->chunk_block_rsv;
 
 	update_global_block_rsv(fs_info);
@@ -6354,6 +6450,11 @@ static int __btrfs_free_extent(struct btrfs_trans_handle *trans,
 			}
 		}
 
+		ret = add_to_free_space_tree(trans, root->fs_info, bytenr,
+					     num_bytes);
+		if (ret)
+			goto out;
+
 		ret = update_block_group(trans, root, bytenr, num_bytes, 0);
 		if (ret) {
 			btrfs_abort_transaction(trans, extent_root, ret);
@@ -6390,10 +6491,12 @@ static noinline int check_ref_cleanup(struct btrfs_trans_handle *trans,
 {
 	struct btrfs_delayed_ref_head *head;
 	struct btrfs_delayed_ref_root *delayed_refs;
+	struct btrfs_delayed_ref_shard *shard;
 	int ret = 0;
 
 	delayed_refs = &trans->transaction->delayed_refs;
-	spin_lock(&delayed_refs->lock);
+	shard = btrfs_delayed_ref_shard(delayed_refs, bytenr);
+	spin_lock(&shard->lock);
 	head = btrfs_find_delayed_ref_head(trans, bytenr);
 	if (!head)
 		goto out_delayed_unlock;
@@ -6421,7 +6524,7 @@ static noinline int check_ref_cleanup(struct btrfs_trans_handle *trans,
 	 * ahead and process it.
 	 */
 	head->node.in_tree = 0;
-	rb_erase(&head->href_node, &delayed_refs->href_root);
+	rb_erase(&head->href_node, &shard->href_root);
 
 	atomic_dec(&delayed_refs->num_entries);
 
@@ -6429,12 +6532,12 @@ static noinline int check_ref_cleanup(struct btrfs_trans_handle *trans,
 	 * we don't take a ref on the node because we're removing it from the
 	 * tree, so we just steal the ref the tree was holding.
 	 */
-	delayed_refs->num_heads--;
+	shard->num_heads--;
 	if (head->processing == 0)
-		delayed_refs->num_heads_ready--;
+		shard->num_heads_ready--;
 	head->processing = 0;
 	spin_unlock(&head->lock);
-	spin_unlock(&delayed_refs->lock);
+	spin_unlock(&shard->lock);
 
 	BUG_ON(head->extent_op);
 	if (head->must_insert_reserved)
@@ -6447,7 +6550,7 @@ out:
 	spin_unlock(&head->lock);
 
 out_delayed_unlock:
-	spin_unlock(&delayed_refs->lock);
+	spin_unlock(&shard->lock);
 	return 0;
 }
 
@@ -7316,6 +7419,11 @@ static int alloc_reserved_file_extent(struct btrfs_trans_handle *trans,
 	if (ret)
 		return ret;
 
+	ret = remove_from_free_space_tree(trans, fs_info, ins->objectid,
+					  ins->offset);
+	if (ret)
+		return ret;
+
 	ret = update_block_group(trans, root, ins->objectid, ins->offset, 1);
 	if (ret) { /* -ENOENT, logic error */
 		btrfs_err(fs_info, "update block group failed for %llu %llu",
@@ -7405,6 +7513,11 @@ static int alloc_reserved_tree_block(struct btrfs_trans_handle *trans,
 			return ret;
 	}
 
+	ret = remove_from_free_space_tree(trans, fs_info, ins->objectid,
+					  root->nodesize);
+	if (ret)
+		return ret;
+
 	ret = update_block_group(trans, root, ins->objectid, root->nodesize,
 				 1);
 	if (ret) { /* -ENOENT, logic error */
@@ -9304,6 +9417,8 @@ btrfs_create_block_group_cache(struct btrfs_root *root, u64 start, u64 size)
 	cache->full_stripe_len = btrfs_full_stripe_len(root,
 					       &root->fs_info->mapping_tree,
 					       start);
+	set_free_space_tree_thresholds(cache);
+
 	atomic_set(&cache->count, 1);
 	spin_lock_init(&cache->lock);
 	init_rwsem(&cache->data_rwsem);
@@ -9315,6 +9430,7 @@ btrfs_create_block_group_cache(struct btrfs_root *root, u64 start, u64 size)
 	INIT_LIST_HEAD(&cache->io_list);
 	btrfs_init_free_space_ctl(cache);
 	atomic_set(&cache->trimming, 0);
+	mutex_init(&cache->free_space_lock);
 
 	return cache;
 }
@@ -9523,6 +9639,8 @@ void btrfs_create_pending_block_groups(struct btrfs_trans_handle *trans,
 					       key.objectid, key.offset);
 		if (ret)
 			btrfs_abort_transaction(trans, extent_root, ret);
+		add_block_group_free_space(trans, root->fs_info, block_group);
+		/* already aborted the transaction if it failed. */
 next:
 		list_del_init(&block_group->bg_list);
 	}
@@ -9552,6 +9670,7 @@ int btrfs_make_block_group(struct btrfs_trans_handle *trans,
 	cache->flags = type;
 	cache->last_byte_to_unpin = (u64)-1;
 	cache->cached = BTRFS_CACHE_FINISHED;
+	cache->needs_free_space = 1;
 	ret = exclude_super_stripes(root, cache);
 	if (ret) {
 		/*
@@ -9892,6 +10011,10 @@ int btrfs_remove_block_group(struct btrfs_trans_handle *trans,
 
 	unlock_chunks(root);
 
+	ret = remove_block_group_free_space(trans, root->fs_info, block_group);
+	if (ret)
+		goto out;
+
 	btrfs_put_block_group(block_group);
 	btrfs_put_block_group(block_group);
 
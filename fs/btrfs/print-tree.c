@@ -276,6 +276,17 @@ void btrfs_print_leaf(struct btrfs_root *root, struct extent_buffer *l)
 			printk(KERN_INFO "\t\tblock group used %llu\n",
 			       btrfs_disk_block_group_used(l, bi));
 			break;
+		case BTRFS_FREE_SPACE_INFO_KEY: {
+			struct btrfs_free_space_info *fsi;
+
+			fsi = btrfs_item_ptr(l, i,
+					     struct btrfs_free_space_info);
+			printk(KERN_INFO "\t\tfree space info extent count %u "
+			       "flags %u\n",
+			       btrfs_free_space_extent_count(l, fsi),
+			       btrfs_free_space_flags(l, fsi));
+			break;
+		}
 		case BTRFS_CHUNK_ITEM_KEY:
 			print_chunk(l, btrfs_item_ptr(l, i,
 						      struct btrfs_chunk));
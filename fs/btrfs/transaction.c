@@ -60,13 +60,17 @@ static const unsigned int btrfs_blocked_trans_types[TRANS_STATE_MAX] = {
 
 void btrfs_put_transaction(struct btrfs_transaction *transaction)
 {
+	u64 pending_csums;
+
 	WARN_ON(atomic_read(&transaction->use_count) == 0);
 	if (atomic_dec_and_test(&transaction->use_count)) {
 		BUG_ON(!list_empty(&transaction->list));
-		WARN_ON(!RB_EMPTY_ROOT(&transaction->delayed_refs.href_root));
-		if (transaction->delayed_refs.pending_csums)
+		WARN_ON(!btrfs_delayed_refs_empty(&transaction->delayed_refs));
+		pending_csums = btrfs_delayed_refs_pending_csums(
+						&transaction->delayed_refs);
+		if (pending_csums)
 			printk(KERN_ERR "pending csums is %llu\n",
-			       transaction->delayed_refs.pending_csums);
+			       pending_csums);
 		while (!list_empty(&transaction->pending_chunks)) {
 			struct extent_map *em;
 
@@ -224,13 +228,7 @@ loop:
 	cur_trans->start_time = get_seconds();
 	cur_trans->dirty_bg_run = 0;
 
-	cur_trans->delayed_refs.href_root = RB_ROOT;
-	atomic_set(&cur_trans->delayed_refs.num_entries, 0);
-	cur_trans->delayed_refs.num_heads_ready = 0;
-	cur_trans->delayed_refs.pending_csums = 0;
-	cur_trans->delayed_refs.num_heads = 0;
-	cur_trans->delayed_refs.flushing = 0;
-	cur_trans->delayed_refs.run_delayed_start = 0;
+	btrfs_init_delayed_ref_root(&cur_trans->delayed_refs);
 
 	/*
 	 * although the tree mod log is per file system and not per transaction,
@@ -245,8 +243,6 @@ loop:
 			"creating a fresh transaction\n");
 	atomic64_set(&fs_info->tree_mod_seq, 0);
 
-	spin_lock_init(&cur_trans->delayed_refs.lock);
-
 	INIT_LIST_HEAD(&cur_trans->pending_snapshots);
 	INIT_LIST_HEAD(&cur_trans->pending_chunks);
 	INIT_LIST_HEAD(&cur_trans->switch_commits);
@@ -1767,12 +1763,28 @@ btrfs_wait_pending_ordered(struct btrfs_transaction *cur_trans,
 	spin_unlock(&fs_info->trans_lock);
 }
 
+/*
+ * Report how long the commit spent in the phase that ends now and start
+ * timing the next one.
+ */
+static void commit_phase_done(struct btrfs_root *root,
+			      struct btrfs_transaction *cur_trans,
+			      const char *phase, ktime_t *start)
+{
+	ktime_t now = ktime_get();
+
+	trace_btrfs_transaction_commit_phase(root->fs_info, cur_trans->transid,
+				phase, ktime_to_ns(ktime_sub(now, *start)));
+	*start = now;
+}
+
 int btrfs_commit_transaction(struct btrfs_trans_handle *trans,
 			     struct btrfs_root *root)
 {
 	struct btrfs_transaction *cur_trans = trans->transaction;
 	struct btrfs_transaction *prev_trans = NULL;
 	struct btrfs_inode *btree_ino = BTRFS_I(root->fs_info->btree_inode);
+	ktime_t phase_start = ktime_get();
 	int ret;
 
 	/* Stop the commit early if ->aborted is set */
@@ -1810,11 +1822,12 @@ int btrfs_commit_transaction(struct btrfs_trans_handle *trans,
 	if (!list_empty(&trans->new_bgs))
 		btrfs_create_pending_block_groups(trans, root);
 
-	ret = btrfs_run_delayed_refs(trans, root, 0);
+	ret = btrfs_run_delayed_refs_parallel(trans, root);
 	if (ret) {
 		btrfs_end_transaction(trans, root);
 		return ret;
 	}
+	commit_phase_done(root, cur_trans, "delayed_refs", &phase_start);
 
 	if (!cur_trans->dirty_bg_run) {
 		int run_it = 0;
@@ -1846,6 +1859,7 @@ int btrfs_commit_transaction(struct btrfs_trans_handle *trans,
 		btrfs_end_transaction(trans, root);
 		return ret;
 	}
+	commit_phase_done(root, cur_trans, "dirty_block_groups", &phase_start);
 
 	spin_lock(&root->fs_info->trans_lock);
 	list_splice_init(&trans->ordered, &cur_trans->pending_ordered);
@@ -1920,6 +1934,7 @@ int btrfs_commit_transaction(struct btrfs_trans_handle *trans,
 	spin_unlock(&root->fs_info->trans_lock);
 	wait_event(cur_trans->writer_wait,
 		   atomic_read(&cur_trans->num_writers) == 1);
+	commit_phase_done(root, cur_trans, "flush", &phase_start);
 
 	/* ->aborted might be set after the previous check, so check it */
 	if (unlikely(ACCESS_ONCE(cur_trans->aborted))) {
@@ -2064,6 +2079,7 @@ int btrfs_commit_transaction(struct btrfs_trans_handle *trans,
 	mutex_unlock(&root->fs_info->reloc_mutex);
 
 	wake_up(&root->fs_info->transaction_wait);
+	commit_phase_done(root, cur_trans, "commit_roots", &phase_start);
 
 	ret = btrfs_write_and_wait_transaction(trans, root);
 	if (ret) {
@@ -2072,12 +2088,14 @@ int btrfs_commit_transaction(struct btrfs_trans_handle *trans,
 		mutex_unlock(&root->fs_info->tree_log_mutex);
 		goto scrub_continue;
 	}
+	commit_phase_done(root, cur_trans, "write", &phase_start);
 
 	ret = write_ctree_super(trans, root, 0);
 	if (ret) {
 		mutex_unlock(&root->fs_info->tree_log_mutex);
 		goto scrub_continue;
 	}
+	commit_phase_done(root, cur_trans, "super", &phase_start);
 
 	/*
 	 * the super is written, we can safely allow the tree-loggers
@@ -2097,6 +2115,7 @@ int btrfs_commit_transaction(struct btrfs_trans_handle *trans,
 	 */
 	cur_trans->state = TRANS_STATE_COMPLETED;
 	wake_up(&cur_trans->commit_wait);
+	commit_phase_done(root, cur_trans, "finish", &phase_start);
 
 	spin_lock(&root->fs_info->trans_lock);
 	list_del_init(&cur_trans->list);
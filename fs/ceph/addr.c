@@ -263,6 +263,7 @@ static void finish_read(struct ceph_osd_request *req, struct ceph_msg *msg)
 	int i;
 
 	dout("finish_read %p req %p rc %d bytes %d\n", inode, req, rc, bytes);
+	atomic_dec(&ceph_inode_to_client(inode)->readahead_inflight);
 
 	/* unlock all pages, zeroing any data we didn't read */
 	osd_data = osd_req_op_extent_osd_data(req, 0);
@@ -375,9 +376,12 @@ static int start_read(struct inode *inode, struct list_head *page_list, int max)
 	ceph_osdc_build_request(req, off, NULL, vino.snap, NULL);
 
 	dout("start_read %p starting %p %lld~%lld\n", inode, req, off, len);
+	atomic_inc(&ceph_inode_to_client(inode)->readahead_inflight);
 	ret = ceph_osdc_start_request(osdc, req, false);
-	if (ret < 0)
+	if (ret < 0) {
+		atomic_dec(&ceph_inode_to_client(inode)->readahead_inflight);
 		goto out_pages;
+	}
 	ceph_osdc_put_request(req);
 	return nr_pages;
 
@@ -393,6 +397,12 @@ out:
 /*
  * Read multiple pages.  Leave pages we don't read + unlock in page_list;
  * the caller (VM) cleans them up.
+ *
+ * Each start_read() covers at most one object, so a large readahead window
+ * turns into one async OSD request per object, spread over the OSDs that
+ * hold them.  With readahead_max_inflight set, stop queueing once that
+ * many readahead requests are outstanding for the mount; pages left over
+ * are read later through ->readpage if they are actually needed.
  */
 static int ceph_readpages(struct file *file, struct address_space *mapping,
 			  struct list_head *page_list, unsigned nr_pages)
@@ -401,6 +411,7 @@ static int ceph_readpages(struct file *file, struct address_space *mapping,
 	struct ceph_fs_client *fsc = ceph_inode_to_client(inode);
 	int rc = 0;
 	int max = 0;
+	int max_inflight = fsc->mount_options->ra_max_inflight;
 
 	if (ceph_inode(inode)->i_inline_version != CEPH_INLINE_NONE)
 		return -EINVAL;
@@ -419,6 +430,13 @@ static int ceph_readpages(struct file *file, struct address_space *mapping,
 		file, nr_pages,
 	     max);
 	while (!list_empty(page_list)) {
+		if (max_inflight &&
+		    atomic_read(&fsc->readahead_inflight) >= max_inflight) {
+			dout("readpages %p %d reads in flight, stopping\n",
+			     inode, atomic_read(&fsc->readahead_inflight));
+			rc = 0;
+			break;
+		}
 		rc = start_read(inode, page_list, max);
 		if (rc < 0)
 			goto out;
@@ -46,6 +46,7 @@
 
 #define CEPH_RSIZE_DEFAULT             0           /* max read size */
 #define CEPH_RASIZE_DEFAULT            (8192*1024) /* readahead */
+#define CEPH_RA_MAX_INFLIGHT_DEFAULT    0           /* no limit */
 #define CEPH_MAX_READDIR_DEFAULT        1024
 #define CEPH_MAX_READDIR_BYTES_DEFAULT  (512*1024)
 #define CEPH_SNAPDIRNAME_DEFAULT        ".snap"
@@ -57,6 +58,7 @@ struct ceph_mount_options {
 	int wsize;            /* max write size */
 	int rsize;            /* max read size */
 	int rasize;           /* max readahead */
+	int ra_max_inflight;  /* max readahead OSD requests in flight */
 	int congestion_kb;    /* max writeback in flight */
 	int caps_wanted_delay_min, caps_wanted_delay_max;
 	int cap_release_safety;
@@ -89,6 +91,9 @@ struct ceph_fs_client {
 	struct workqueue_struct *trunc_wq;
 	atomic_long_t writeback_count;
 
+	/* readahead */
+	atomic_t readahead_inflight;
+
 	struct backing_dev_info backing_dev_info;
 
 #ifdef CONFIG_DEBUG_FS
@@ -39,6 +39,9 @@
 #include <linux/ratelimit.h>
 #include <linux/list_lru.h>
 #include <linux/kasan.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
 
 #include "internal.h"
 #include "mount.h"
@@ -118,6 +121,21 @@ struct dentry_stat_t dentry_stat = {
 
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
+static DEFINE_PER_CPU(long, nr_dentry_negative);
+
+/*
+ * Unused negative dentries are trimmed in the background once there are
+ * more of them than sysctl_negative_dentry_limit (in tenths of a percent
+ * of memory) allows.  0 means no limit.
+ */
+int sysctl_negative_dentry_limit __read_mostly;
+static unsigned long neg_dentry_limit __read_mostly;
+
+static void neg_dentry_trim_fn(struct work_struct *work);
+static DECLARE_WORK(neg_dentry_trim_work, neg_dentry_trim_fn);
+
+/* Check the limit every this many negative dentries added on a cpu */
+#define NEG_DENTRY_CHECK_MASK	255
 
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 
@@ -150,16 +168,75 @@ static long get_nr_dentry_unused(void)
 		sum += per_cpu(nr_dentry_unused, i);
 	return sum < 0 ? 0 : sum;
 }
+#endif
+
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
 
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 int proc_nr_dentry(struct ctl_table *table, int write, void __user *buffer,
 		   size_t *lenp, loff_t *ppos)
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
 	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
 }
+
+int proc_negative_dentry_limit(struct ctl_table *table, int write,
+			       void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	unsigned long pages;
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	pages = mult_frac(totalram_pages, sysctl_negative_dentry_limit, 1000);
+	neg_dentry_limit = pages * (PAGE_SIZE / sizeof(struct dentry));
+	if (neg_dentry_limit)
+		schedule_work(&neg_dentry_trim_work);
+	return 0;
+}
 #endif
 
+/*
+ * The negative dentry counts only cover dentries on the LRU, i.e. unused
+ * ones, which are the ones that can pile up after failed lookups.  They
+ * change with DCACHE_LRU_LIST and with the dentry type while the dentry
+ * is on the LRU.
+ */
+static inline void d_negative_inc(struct dentry *dentry)
+{
+	this_cpu_inc(nr_dentry_negative);
+	percpu_counter_inc(&dentry->d_sb->s_nr_dentry_negative);
+}
+
+static inline void d_negative_dec(struct dentry *dentry)
+{
+	this_cpu_dec(nr_dentry_negative);
+	percpu_counter_dec(&dentry->d_sb->s_nr_dentry_negative);
+}
+
+/* Kick the trimmer if there are more negative dentries than allowed */
+static inline void neg_dentry_check(void)
+{
+	if (likely(!neg_dentry_limit))
+		return;
+	if (this_cpu_read(nr_dentry_negative) & NEG_DENTRY_CHECK_MASK)
+		return;
+	if (!work_pending(&neg_dentry_trim_work) &&
+	    get_nr_dentry_negative() > neg_dentry_limit)
+		schedule_work(&neg_dentry_trim_work);
+}
+
 /*
  * Compare 2 name strings, return 0 if they match, otherwise non-zero.
  * The strings are both count bytes long, and count is non-zero.
@@ -277,6 +354,8 @@ static inline void __d_set_inode_and_type(struct dentry *dentry,
 
 	dentry->d_inode = inode;
 	flags = READ_ONCE(dentry->d_flags);
+	if ((flags & DCACHE_LRU_LIST) && d_is_negative(dentry))
+		d_negative_dec(dentry);
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	flags |= type_flags;
 	WRITE_ONCE(dentry->d_flags, flags);
@@ -286,6 +365,8 @@ static inline void __d_clear_type_and_inode(struct dentry *dentry)
 {
 	unsigned flags = READ_ONCE(dentry->d_flags);
 
+	if ((flags & DCACHE_LRU_LIST) && !d_is_negative(dentry))
+		d_negative_inc(dentry);
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	WRITE_ONCE(dentry->d_flags, flags);
 	dentry->d_inode = NULL;
@@ -392,6 +473,10 @@ static void d_lru_add(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, 0);
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry)) {
+		d_negative_inc(dentry);
+		neg_dentry_check();
+	}
 	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -400,6 +485,8 @@ static void d_lru_del(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -409,6 +496,8 @@ static void d_shrink_del(struct dentry *dentry)
 	list_del_init(&dentry->d_lru);
 	dentry->d_flags &= ~(DCACHE_SHRINK_LIST | DCACHE_LRU_LIST);
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 }
 
 static void d_shrink_add(struct dentry *dentry, struct list_head *list)
@@ -417,6 +506,8 @@ static void d_shrink_add(struct dentry *dentry, struct list_head *list)
 	list_add(&dentry->d_lru, list);
 	dentry->d_flags |= DCACHE_SHRINK_LIST | DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_inc(dentry);
 }
 
 /*
@@ -430,6 +521,8 @@ static void d_lru_isolate(struct list_lru_one *lru, struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_dec(dentry);
 	list_lru_isolate(lru, &dentry->d_lru);
 }
 
@@ -1133,6 +1226,134 @@ void shrink_dcache_sb(struct super_block *sb)
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
+static enum lru_status dentry_lru_isolate_negative(struct list_head *item,
+		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
+{
+	struct list_head *freeable = arg;
+	struct dentry	*dentry = container_of(item, struct dentry, d_lru);
+
+	if (!spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	if (dentry->d_lockref.count) {
+		d_lru_isolate(lru, dentry);
+		spin_unlock(&dentry->d_lock);
+		return LRU_REMOVED;
+	}
+
+	/*
+	 * Positive dentries are left to the shrinker.  Rotating them costs
+	 * them a little of their LRU age, but keeps every batch of the walk
+	 * making progress instead of rescanning them from the head.
+	 */
+	if (!d_is_negative(dentry) || (dentry->d_flags & DCACHE_REFERENCED)) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	d_lru_shrink_move(lru, dentry, freeable);
+	spin_unlock(&dentry->d_lock);
+
+	return LRU_REMOVED;
+}
+
+struct neg_dentry_trim {
+	long	total;		/* negative dentries when the trim started */
+	long	excess;		/* how many of them to get rid of */
+};
+
+#define NEG_DENTRY_TRIM_BATCH	1024UL
+
+/*
+ * Trim this superblock's share of the excess, at most one lap over its
+ * LRU and in batches so that the lru lock is not held for long.
+ */
+static void neg_dentry_trim_sb(struct super_block *sb, void *arg)
+{
+	struct neg_dentry_trim *nt = arg;
+	unsigned long walk, batch;
+	long nr, to_free;
+
+	nr = percpu_counter_read_positive(&sb->s_nr_dentry_negative);
+	if (!nr)
+		return;
+	to_free = mult_frac(nr, nt->excess, nt->total);
+	walk = list_lru_count(&sb->s_dentry_lru);
+
+	while (to_free > 0 && walk) {
+		LIST_HEAD(dispose);
+
+		batch = min(walk, NEG_DENTRY_TRIM_BATCH);
+		to_free -= list_lru_walk(&sb->s_dentry_lru,
+				dentry_lru_isolate_negative, &dispose, batch);
+		shrink_dentry_list(&dispose);
+		walk -= batch;
+		cond_resched();
+	}
+}
+
+/*
+ * Background trimming of negative dentries.  Each superblock gives up a
+ * share of the excess proportional to how many of the negative dentries
+ * it holds, and we aim a bit below the limit so that we are not kicked
+ * again straight away.
+ */
+static void neg_dentry_trim_fn(struct work_struct *work)
+{
+	unsigned long limit = READ_ONCE(neg_dentry_limit);
+	struct neg_dentry_trim nt;
+
+	nt.total = get_nr_dentry_negative();
+	if (!limit || nt.total <= limit)
+		return;
+	nt.excess = nt.total - (limit - limit / 8);
+	iterate_supers(neg_dentry_trim_sb, &nt);
+}
+
+#ifdef CONFIG_PROC_FS
+static void dentry_state_sb_show(struct super_block *sb, void *arg)
+{
+	struct seq_file *m = arg;
+	s64 negative = percpu_counter_sum_positive(&sb->s_nr_dentry_negative);
+
+	seq_printf(m, "%-16s %-12s %10lu %10lld\n", sb->s_id,
+		   sb->s_type->name, list_lru_count(&sb->s_dentry_lru),
+		   (long long)negative);
+}
+
+/*
+ * /proc/fs/dentry-state: unused and unused negative dentries per
+ * superblock, the breakdown of the totals in /proc/sys/fs/dentry-state.
+ */
+static int dentry_state_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "%-16s %-12s %10s %10s\n", "device", "type", "unused",
+		   "negative");
+	iterate_supers(dentry_state_sb_show, m);
+	return 0;
+}
+
+static int dentry_state_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dentry_state_show, NULL);
+}
+
+static const struct file_operations dentry_state_fops = {
+	.open		= dentry_state_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init dentry_state_init(void)
+{
+	proc_create("fs/dentry-state", 0444, NULL, &dentry_state_fops);
+	return 0;
+}
+fs_initcall(dentry_state_init);
+#endif
+
 /**
  * enum d_walk_ret - action to talke during tree walk
  * @D_WALK_CONTINUE:	contrinue walk
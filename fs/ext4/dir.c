@@ -100,7 +100,7 @@ int __ext4_check_dir_entry(const char *function, unsigned int line,
 	return 1;
 }
 
-static int ext4_readdir(struct file *file, struct dir_context *ctx)
+static int ext4_readdir_blocks(struct file *file, struct dir_context *ctx)
 {
 	unsigned int offset;
 	int i;
@@ -113,19 +113,6 @@ static int ext4_readdir(struct file *file, struct dir_context *ctx)
 	struct ext4_fname_crypto_ctx *enc_ctx = NULL;
 	struct ext4_str fname_crypto_str = {.name = NULL, .len = 0};
 
-	if (is_dx_dir(inode)) {
-		err = ext4_dx_readdir(file, ctx);
-		if (err != ERR_BAD_DX_DIR) {
-			return err;
-		}
-		/*
-		 * We don't set the inode dirty flag since it's not
-		 * critical that it get flushed back to the disk.
-		 */
-		ext4_clear_inode_flag(file_inode(file),
-				      EXT4_INODE_INDEX);
-	}
-
 	if (ext4_has_inline_data(inode)) {
 		int has_inline_data = 1;
 		err = ext4_read_inline_dir(file, ctx,
@@ -279,6 +266,33 @@ errout:
 	return err;
 }
 
+static int ext4_readdir(struct file *file, struct dir_context *ctx)
+{
+	struct inode *inode = file_inode(file);
+	struct ext4_dir_lock *dl;
+	int err = 0;
+
+	if (is_dx_dir(inode)) {
+		err = ext4_dx_readdir(file, ctx);
+		if (err != ERR_BAD_DX_DIR) {
+			return err;
+		}
+	}
+
+	/* Parallel lookups, creates and unlinks need the index, see namei.c */
+	dl = ext4_dir_write_lock(inode, 0);
+	if (err == ERR_BAD_DX_DIR) {
+		/*
+		 * We don't set the inode dirty flag since it's not
+		 * critical that it get flushed back to the disk.
+		 */
+		ext4_clear_inode_flag(inode, EXT4_INODE_INDEX);
+	}
+	err = ext4_readdir_blocks(file, ctx);
+	ext4_dir_write_unlock(dl);
+	return err;
+}
+
 static inline int is_32bit_api(void)
 {
 #ifdef CONFIG_COMPAT
@@ -635,6 +649,7 @@ const struct file_operations ext4_dir_operations = {
 	.llseek		= ext4_dir_llseek,
 	.read		= generic_read_dir,
 	.iterate	= ext4_readdir,
+	.dirent_getattr	= ext4_dirent_getattr,
 	.unlocked_ioctl = ext4_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= ext4_compat_ioctl,
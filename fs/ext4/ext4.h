@@ -811,6 +811,7 @@ do {									       \
 #endif /* defined(__KERNEL__) || defined(__linux__) */
 
 #include "extents_status.h"
+#include "fast_commit.h"
 
 /*
  * Lock subclasses for i_data_sem in the ext4_inode_info structure.
@@ -852,6 +853,7 @@ struct ext4_inode_info {
 	 */
 	ext4_group_t	i_block_group;
 	ext4_lblk_t	i_dir_start_lookup;
+	struct ext4_dir_lock *i_dir_lock;	/* S_PDIROPS directories */
 #if (BITS_PER_LONG < 64)
 	unsigned long	i_state_flags;		/* Dynamic state flags */
 #endif
@@ -978,6 +980,19 @@ struct ext4_inode_info {
 	tid_t i_sync_tid;
 	tid_t i_datasync_tid;
 
+	/*
+	 * Fast commit tracking, protected by s_fc_lock: the logical blocks
+	 * whose mapping changed in transaction i_fc_tid.  i_fc_commit_list
+	 * and the range being logged belong to the fast commit in progress.
+	 */
+	struct list_head i_fc_list;
+	struct list_head i_fc_commit_list;
+	ext4_lblk_t i_fc_lblk_start;
+	ext4_lblk_t i_fc_lblk_len;
+	ext4_lblk_t i_fc_commit_start;
+	ext4_lblk_t i_fc_commit_len;
+	tid_t i_fc_tid;
+
 #ifdef CONFIG_QUOTA
 	struct dquot *i_dquot[MAXQUOTAS];
 #endif
@@ -1031,6 +1046,7 @@ struct ext4_inode_info {
 #define EXT4_MOUNT_POSIX_ACL		0x08000	/* POSIX Access Control Lists */
 #define EXT4_MOUNT_NO_AUTO_DA_ALLOC	0x10000	/* No auto delalloc mapping */
 #define EXT4_MOUNT_BARRIER		0x20000 /* Use block barriers */
+#define EXT4_MOUNT_PDIROPS		0x40000 /* Parallel directory operations */
 #define EXT4_MOUNT_QUOTA		0x80000 /* Some quota option set */
 #define EXT4_MOUNT_USRQUOTA		0x100000 /* "old" user quota */
 #define EXT4_MOUNT_GRPQUOTA		0x200000 /* "old" group quota */
@@ -1055,6 +1071,8 @@ struct ext4_inode_info {
 						      blocks */
 #define EXT4_MOUNT2_HURD_COMPAT		0x00000004 /* Support HURD-castrated
 						      file systems */
+#define EXT4_MOUNT2_JOURNAL_FAST_COMMIT	0x00000008 /* fsync may use fast
+						      commits */
 
 #define clear_opt(sb, opt)		EXT4_SB(sb)->s_mount_opt &= \
 						~EXT4_MOUNT_##opt
@@ -1241,6 +1259,16 @@ struct ext4_super_block {
 /* Number of quota types we support */
 #define EXT4_MAXQUOTAS 2
 
+/* Number of criteria passes of the regular block allocator */
+#define EXT4_MB_NUM_CRITERIA 4
+
+/* Per criteria pass statistics of the block allocator */
+struct ext4_mb_cr_stats {
+	atomic64_t hits;		/* allocations satisfied */
+	atomic64_t groups_considered;	/* groups looked at */
+	atomic64_t failed;		/* passes that found nothing */
+};
+
 /*
  * fourth extended-fs super-block data in memory
  */
@@ -1336,6 +1364,7 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
 	unsigned int s_max_dir_size_kb;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
@@ -1349,6 +1378,7 @@ struct ext4_sb_info {
 	atomic_t s_bal_goals;	/* goal hits */
 	atomic_t s_bal_breaks;	/* too long searches */
 	atomic_t s_bal_2orders;	/* 2^order hits */
+	struct ext4_mb_cr_stats s_mb_cr_stats[EXT4_MB_NUM_CRITERIA];
 	spinlock_t s_bal_lock;
 	unsigned long s_mb_buddies_generated;
 	unsigned long long s_mb_generation_time;
@@ -1357,6 +1387,15 @@ struct ext4_sb_info {
 	atomic_t s_mb_discarded;
 	atomic_t s_lock_busy;
 
+	/*
+	 * groups by order of their largest free extent and by order of
+	 * their average free extent size, see mb_set_largest_free_order()
+	 */
+	struct list_head *s_mb_largest_free_orders;
+	rwlock_t *s_mb_largest_free_orders_locks;
+	struct list_head *s_mb_avg_fragment_size;
+	rwlock_t *s_mb_avg_fragment_size_locks;
+
 	/* locality groups */
 	struct ext4_locality_group __percpu *s_locality_groups;
 
@@ -1394,6 +1433,18 @@ struct ext4_sb_info {
 	/* Precomputed FS UUID checksum for seeding other checksums */
 	__u32 s_csum_seed;
 
+	/* Fast commits, see fast_commit.c */
+	struct list_head s_fc_q;	/* inodes changed in running trans */
+	struct list_head s_fc_dentry_q;	/* directory entry updates */
+	spinlock_t s_fc_lock;
+	bool s_fc_ineligible;		/* s_fc_ineligible_tid can't fast commit */
+	tid_t s_fc_ineligible_tid;
+	struct buffer_head *s_fc_bh;	/* block being filled */
+	unsigned int s_fc_bytes;	/* bytes used in this fast commit */
+	u32 s_fc_crc;
+	struct ext4_fc_replay_state *s_fc_replay;
+	struct ext4_fc_stats s_fc_stats;
+
 	/* Reclaim extents from extent status tree */
 	struct shrinker s_es_shrinker;
 	struct list_head s_es_list;	/* List of inodes with reclaimable extents */
@@ -1591,6 +1642,7 @@ static inline int ext4_encrypted_inode(struct inode *inode)
 #define EXT4_FEATURE_COMPAT_RESIZE_INODE	0x0010
 #define EXT4_FEATURE_COMPAT_DIR_INDEX		0x0020
 #define EXT4_FEATURE_COMPAT_SPARSE_SUPER2	0x0200
+#define EXT4_FEATURE_COMPAT_FAST_COMMIT		0x0400
 
 #define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT4_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
@@ -1818,6 +1870,19 @@ static inline __le16 ext4_rec_len_to_disk(unsigned len, unsigned blocksize)
 #define EXT4_DIR_LINK_MAX(dir) (!is_dx(dir) && (dir)->i_nlink >= EXT4_LINK_MAX)
 #define EXT4_DIR_LINK_EMPTY(dir) ((dir)->i_nlink == 2 || (dir)->i_nlink == 1)
 
+/*
+ * Locks of a directory taking lookups, creates and unlinks in parallel,
+ * see namei.c
+ */
+#define EXT4_DIR_LEAF_LOCK_BITS	5
+#define EXT4_DIR_LEAF_LOCKS	(1 << EXT4_DIR_LEAF_LOCK_BITS)
+
+struct ext4_dir_lock {
+	struct rw_semaphore	dl_sem;
+	struct rw_semaphore	dl_index;
+	struct mutex		dl_leaf[EXT4_DIR_LEAF_LOCKS];
+};
+
 /* Legal values for the dx_root hash_version field: */
 
 #define DX_HASH_LEGACY		0
@@ -2297,6 +2362,7 @@ extern struct inode *ext4_iget(struct super_block *, unsigned long);
 extern struct inode *ext4_iget_normal(struct super_block *, unsigned long);
 extern int  ext4_write_inode(struct inode *, struct writeback_control *);
 extern int  ext4_setattr(struct dentry *, struct iattr *);
+extern int  ext4_dirent_getattr(struct file *dir, u64 ino, struct kstat *stat);
 extern int  ext4_getattr(struct vfsmount *mnt, struct dentry *dentry,
 				struct kstat *stat);
 extern void ext4_evict_inode(struct inode *);
@@ -2350,6 +2416,10 @@ extern int ext4_orphan_add(handle_t *, struct inode *);
 extern int ext4_orphan_del(handle_t *, struct inode *);
 extern int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 				__u32 start_minor_hash, __u32 *next_hash);
+extern void ext4_dir_init_pdirops(struct inode *dir);
+extern struct ext4_dir_lock *ext4_dir_write_lock(struct inode *dir,
+						 unsigned int subclass);
+extern void ext4_dir_write_unlock(struct ext4_dir_lock *dl);
 extern int search_dir(struct buffer_head *bh,
 		      char *search_buf,
 		      int buf_size,
@@ -2365,6 +2435,12 @@ extern int ext4_generic_delete_entry(handle_t *handle,
 				     int buf_size,
 				     int csum_size);
 extern int ext4_empty_dir(struct inode *inode);
+extern int ext4_fc_replay_link_entry(handle_t *handle, struct inode *dir,
+				     struct inode *inode,
+				     const struct qstr *name);
+extern int ext4_fc_replay_unlink_entry(handle_t *handle, struct inode *dir,
+				       struct inode *inode,
+				       const struct qstr *name);
 
 /* resize.c */
 extern int ext4_group_add(struct super_block *sb,
@@ -2675,6 +2751,10 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	ext4_grpblk_t	bb_avg_fragment_size_order;/* order of avg frag size */
+	ext4_group_t	bb_group;	/* group number */
+	struct          list_head bb_largest_free_order_node;
+	struct          list_head bb_avg_fragment_size_node;
 	struct          list_head bb_prealloc_list;
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
@@ -0,0 +1,1518 @@
+/*
+ *  fs/ext4/fast_commit.c
+ *
+ *  Fast commits: fsync logs the changes of the inodes and directory
+ *  entries touched in the running transaction to the fast commit area at
+ *  the end of the journal, instead of committing the whole transaction.
+ *
+ *  Tracking.  ext4_fc_track_*() record which inodes changed, which logical
+ *  blocks of regular files were mapped or unmapped, and which directory
+ *  entries were created or removed.  Changes that can't be described this
+ *  way (rename, mkdir, xattrs, resize, ...) mark the transaction ineligible
+ *  and fsync falls back to a full commit.  A full commit drops the tracking
+ *  state of the transactions it covers.
+ *
+ *  Commit.  ext4_fc_commit() writes a HEAD record, the directory entry
+ *  updates, and for every inode the current mapping of its changed blocks
+ *  followed by a copy of the on-disk inode, then a TAIL record.  The data
+ *  of the logged blocks is written before the tail, which is written with
+ *  a cache flush and FUA.
+ *
+ *  Replay.  jbd2 recovery hands the fast commit blocks to
+ *  ext4_fc_replay_scan(), which keeps the records of all complete fast
+ *  commits of the transaction that was running at the crash.  When the
+ *  filesystem can run regular journalled operations, ext4_fc_replay()
+ *  applies them: namespace changes and unmapped ranges first, then, once a
+ *  commit released the freed blocks, mapped ranges and the inodes.  Every
+ *  step is idempotent and the records are logged again as a fast commit of
+ *  the new running transaction at each stage, so a crash during replay
+ *  replays again.
+ */
+
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/writeback.h>
+#include <linux/blkdev.h>
+#include <linux/quotaops.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+
+/* A directory entry update waiting for the next fast commit */
+struct ext4_fc_dentry_update {
+	struct list_head fcd_list;
+	int fcd_op;			/* EXT4_FC_TAG_{CREAT,LINK,UNLINK} */
+	tid_t fcd_tid;
+	u32 fcd_parent;
+	u32 fcd_ino;
+	unsigned int fcd_name_len;
+	unsigned char fcd_name[0];
+};
+
+/* Records of the complete fast commits found by recovery, in log order */
+struct ext4_fc_replay_state {
+	tid_t fcr_tid;			/* transaction they belong to */
+	u8 *fcr_buf;
+	unsigned int fcr_size;		/* size of fcr_buf */
+	unsigned int fcr_len;		/* bytes of records buffered */
+	unsigned int fcr_valid_len;	/* bytes covered by a valid tail */
+	bool fcr_in_commit;
+	u32 fcr_crc;
+	int fcr_commits;
+};
+
+enum {
+	EXT4_FC_REPLAY_NAMESPACE,	/* CREAT, LINK, UNLINK, DEL_RANGE */
+	EXT4_FC_REPLAY_UNMAP,		/* ADD_RANGE blocks mapped elsewhere */
+	EXT4_FC_REPLAY_MAP,		/* ADD_RANGE */
+	EXT4_FC_REPLAY_INODES,		/* INODE */
+};
+
+/*
+ * Tracking
+ */
+
+/* Called with s_fc_lock held */
+static bool ext4_fc_is_ineligible(struct ext4_sb_info *sbi, tid_t tid)
+{
+	/* Group descriptors change under us while resizing */
+	if (test_bit(EXT4_RESIZING, &sbi->s_resize_flags))
+		return true;
+	return sbi->s_fc_ineligible && !tid_gt(tid, sbi->s_fc_ineligible_tid);
+}
+
+static void ext4_fc_set_ineligible(struct ext4_sb_info *sbi, tid_t tid)
+{
+	spin_lock(&sbi->s_fc_lock);
+	if (!sbi->s_fc_ineligible || tid_gt(tid, sbi->s_fc_ineligible_tid))
+		sbi->s_fc_ineligible_tid = tid;
+	sbi->s_fc_ineligible = true;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * The transaction @handle belongs to, or the running one, can't be fast
+ * committed any more.
+ */
+void ext4_fc_mark_ineligible(struct super_block *sb, handle_t *handle)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	tid_t tid;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) || !journal)
+		return;
+
+	if (ext4_handle_valid(handle)) {
+		tid = handle->h_transaction->t_tid;
+	} else {
+		read_lock(&journal->j_state_lock);
+		if (journal->j_running_transaction)
+			tid = journal->j_running_transaction->t_tid;
+		else
+			tid = journal->j_transaction_sequence;
+		read_unlock(&journal->j_state_lock);
+	}
+	ext4_fc_set_ineligible(sbi, tid);
+}
+
+/* Can replay reproduce the changes of @inode? */
+static bool ext4_fc_inode_eligible(struct inode *inode)
+{
+	if (ext4_has_inline_data(inode) || ext4_encrypted_inode(inode))
+		return false;
+	/* Directories always journal their blocks, that's fine */
+	if (S_ISREG(inode->i_mode) &&
+	    (ext4_should_journal_data(inode) ||
+	     !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)))
+		return false;
+	return true;
+}
+
+static void ext4_fc_track(handle_t *handle, struct inode *inode,
+			  bool range, ext4_lblk_t start, ext4_lblk_t end)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t old_end;
+	tid_t tid;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) || !ext4_handle_valid(handle))
+		return;
+
+	/* Quota usage is redone by the operations replay repeats */
+	if (IS_NOQUOTA(inode) ||
+	    (inode->i_ino < EXT4_FIRST_INO(sb) && inode->i_ino != EXT4_ROOT_INO))
+		return;
+
+	if ((!S_ISREG(inode->i_mode) && !S_ISDIR(inode->i_mode)) ||
+	    !ext4_fc_inode_eligible(inode)) {
+		ext4_fc_mark_ineligible(sb, handle);
+		return;
+	}
+
+	/* Directory blocks are rebuilt by replaying the entries */
+	if (!S_ISREG(inode->i_mode) || start > end)
+		range = false;
+
+	tid = handle->h_transaction->t_tid;
+	spin_lock(&sbi->s_fc_lock);
+	if (ei->i_fc_tid != tid) {
+		ei->i_fc_tid = tid;
+		ei->i_fc_lblk_len = 0;
+	}
+	if (range && !ei->i_fc_lblk_len) {
+		ei->i_fc_lblk_start = start;
+		ei->i_fc_lblk_len = end - start + 1;
+	} else if (range) {
+		old_end = ei->i_fc_lblk_start + ei->i_fc_lblk_len - 1;
+		ei->i_fc_lblk_start = min(ei->i_fc_lblk_start, start);
+		ei->i_fc_lblk_len = max(old_end, end) - ei->i_fc_lblk_start + 1;
+	}
+	if (list_empty(&ei->i_fc_list))
+		list_add_tail(&ei->i_fc_list, &sbi->s_fc_q);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/* The on-disk inode of @inode changed */
+void ext4_fc_track_inode(handle_t *handle, struct inode *inode)
+{
+	ext4_fc_track(handle, inode, false, 0, 0);
+}
+
+/* The mapping of logical blocks @start to @end of @inode changed */
+void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+			 ext4_lblk_t start, ext4_lblk_t end)
+{
+	ext4_fc_track(handle, inode, true, start, end);
+}
+
+static void ext4_fc_track_dentry(handle_t *handle, struct dentry *dentry,
+				 int op)
+{
+	struct inode *dir = d_inode(dentry->d_parent);
+	struct super_block *sb = dir->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_dentry_update *fcd;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) || !ext4_handle_valid(handle))
+		return;
+
+	if (ext4_has_inline_data(dir) || ext4_encrypted_inode(dir)) {
+		ext4_fc_mark_ineligible(sb, handle);
+		return;
+	}
+
+	fcd = kmalloc(sizeof(*fcd) + dentry->d_name.len, GFP_NOFS);
+	if (!fcd) {
+		ext4_fc_mark_ineligible(sb, handle);
+		return;
+	}
+	fcd->fcd_op = op;
+	fcd->fcd_tid = handle->h_transaction->t_tid;
+	fcd->fcd_parent = dir->i_ino;
+	fcd->fcd_ino = d_inode(dentry)->i_ino;
+	fcd->fcd_name_len = dentry->d_name.len;
+	memcpy(fcd->fcd_name, dentry->d_name.name, dentry->d_name.len);
+
+	spin_lock(&sbi->s_fc_lock);
+	list_add_tail(&fcd->fcd_list, &sbi->s_fc_dentry_q);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+void ext4_fc_track_create(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_CREAT);
+}
+
+void ext4_fc_track_link(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_LINK);
+}
+
+void ext4_fc_track_unlink(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_UNLINK);
+}
+
+/* @inode is being evicted */
+void ext4_fc_del(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	bool tracked;
+
+	if (list_empty(&ei->i_fc_list))
+		return;
+
+	spin_lock(&sbi->s_fc_lock);
+	tracked = !list_empty(&ei->i_fc_list);
+	list_del_init(&ei->i_fc_list);
+	spin_unlock(&sbi->s_fc_lock);
+
+	/* Its changes can't be logged any more, unless it is gone anyway */
+	if (tracked && inode->i_nlink)
+		ext4_fc_set_ineligible(sbi, ei->i_fc_tid);
+}
+
+/* Called by jbd2 once a fast commit or a full commit of @tid is done */
+static void ext4_fc_cleanup(journal_t *journal, int full, tid_t tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei, *ei_n;
+	struct ext4_fc_dentry_update *fcd, *fcd_n;
+	LIST_HEAD(dentries);
+
+	/* A fast commit already dropped what it logged */
+	if (!full)
+		return;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_for_each_entry_safe(ei, ei_n, &sbi->s_fc_q, i_fc_list) {
+		if (tid_gt(ei->i_fc_tid, tid))
+			continue;
+		list_del_init(&ei->i_fc_list);
+		ei->i_fc_lblk_len = 0;
+	}
+	list_for_each_entry_safe(fcd, fcd_n, &sbi->s_fc_dentry_q, fcd_list)
+		if (!tid_gt(fcd->fcd_tid, tid))
+			list_move_tail(&fcd->fcd_list, &dentries);
+	if (sbi->s_fc_ineligible && !tid_gt(sbi->s_fc_ineligible_tid, tid))
+		sbi->s_fc_ineligible = false;
+	spin_unlock(&sbi->s_fc_lock);
+
+	list_for_each_entry_safe(fcd, fcd_n, &dentries, fcd_list)
+		kfree(fcd);
+}
+
+/*
+ * Writing fast commits
+ */
+
+static void ext4_fc_submit_bh(struct super_block *sb, int rw)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct buffer_head *bh = sbi->s_fc_bh;
+
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	get_bh(bh);
+	submit_bh(rw, bh);
+	sbi->s_fc_bh = NULL;
+}
+
+/* Cover the rest of the current block with a PAD record */
+static void ext4_fc_pad_block(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int off = sbi->s_fc_bytes % sb->s_blocksize;
+	unsigned int remaining = sb->s_blocksize - off;
+	struct ext4_fc_tl tl;
+
+	if (!sbi->s_fc_bh || !off)
+		return;
+
+	tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_PAD);
+	tl.fc_len = cpu_to_le16(remaining - sizeof(tl));
+	memcpy(sbi->s_fc_bh->b_data + off, &tl, sizeof(tl));
+	sbi->s_fc_crc = ext4_chksum(sbi, sbi->s_fc_crc, &tl, sizeof(tl));
+	sbi->s_fc_bytes += remaining;
+}
+
+/*
+ * Reserve @len bytes for a record.  Records don't cross blocks, and a
+ * block always keeps room for the PAD record closing it.
+ */
+static u8 *ext4_fc_reserve_space(struct super_block *sb, unsigned int len)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int off = sbi->s_fc_bytes % sb->s_blocksize;
+	unsigned int remaining = sb->s_blocksize - off;
+	struct buffer_head *bh;
+
+	if (sbi->s_fc_bh && off) {
+		if (len == remaining ||
+		    len + sizeof(struct ext4_fc_tl) <= remaining) {
+			sbi->s_fc_bytes += len;
+			return (u8 *)sbi->s_fc_bh->b_data + off;
+		}
+		ext4_fc_pad_block(sb);
+	}
+	if (sbi->s_fc_bh)
+		ext4_fc_submit_bh(sb, WRITE_SYNC);
+
+	if (jbd2_fc_get_buf(sbi->s_journal, &bh))
+		return NULL;
+	memset(bh->b_data, 0, sb->s_blocksize);
+	sbi->s_fc_bh = bh;
+	sbi->s_fc_bytes += len;
+	return (u8 *)bh->b_data;
+}
+
+/* Append a record whose value is @val followed by @val2 */
+static int ext4_fc_add_tlv(struct super_block *sb, u16 tag,
+			   const void *val, unsigned int len,
+			   const void *val2, unsigned int len2)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int size = sizeof(struct ext4_fc_tl) + len + len2;
+	struct ext4_fc_tl tl;
+	u8 *dst;
+
+	dst = ext4_fc_reserve_space(sb, size);
+	if (!dst)
+		return -ENOSPC;
+
+	tl.fc_tag = cpu_to_le16(tag);
+	tl.fc_len = cpu_to_le16(len + len2);
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), val, len);
+	if (len2)
+		memcpy(dst + sizeof(tl) + len, val2, len2);
+	sbi->s_fc_crc = ext4_chksum(sbi, sbi->s_fc_crc, dst, size);
+	return 0;
+}
+
+static int ext4_fc_write_head(struct super_block *sb, tid_t tid)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_head head;
+
+	sbi->s_fc_bh = NULL;
+	sbi->s_fc_bytes = 0;
+	sbi->s_fc_crc = ~0;
+
+	head.fc_features = 0;
+	head.fc_tid = cpu_to_le32(tid);
+	return ext4_fc_add_tlv(sb, EXT4_FC_TAG_HEAD, &head, sizeof(head),
+			       NULL, 0);
+}
+
+/*
+ * Write the TAIL record and submit the last block once all the others
+ * are on disk.
+ */
+static int ext4_fc_write_tail(struct super_block *sb, tid_t tid)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	struct buffer_head *bh;
+	int i, nblks;
+	u8 *dst;
+
+	dst = ext4_fc_reserve_space(sb, sizeof(tl) + sizeof(tail));
+	if (!dst)
+		return -ENOSPC;
+
+	tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_TAIL);
+	tl.fc_len = cpu_to_le16(sizeof(tail));
+	tail.fc_tid = cpu_to_le32(tid);
+	sbi->s_fc_crc = ext4_chksum(sbi, sbi->s_fc_crc, &tl, sizeof(tl));
+	sbi->s_fc_crc = ext4_chksum(sbi, sbi->s_fc_crc, &tail.fc_tid,
+				    sizeof(tail.fc_tid));
+	tail.fc_crc = cpu_to_le32(sbi->s_fc_crc);
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), &tail, sizeof(tail));
+	ext4_fc_pad_block(sb);
+
+	nblks = DIV_ROUND_UP(sbi->s_fc_bytes, sb->s_blocksize);
+	for (i = 2; i <= nblks; i++) {
+		bh = journal->j_fc_wbuf[journal->j_fc_off - i];
+		wait_on_buffer(bh);
+		if (!buffer_uptodate(bh))
+			return -EIO;
+	}
+
+	if (!(journal->j_flags & JBD2_BARRIER)) {
+		ext4_fc_submit_bh(sb, WRITE_SYNC);
+		return 0;
+	}
+	if (journal->j_fs_dev != journal->j_dev)
+		blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+	ext4_fc_submit_bh(sb, WRITE_FLUSH_FUA);
+	return 0;
+}
+
+/* Wait for the blocks of this fast commit and drop them */
+static int ext4_fc_wait_blocks(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int nblks = DIV_ROUND_UP(sbi->s_fc_bytes, sb->s_blocksize);
+	int ret;
+
+	ret = jbd2_fc_wait_bufs(sbi->s_journal, nblks);
+	sbi->s_fc_bh = NULL;
+	if (!ret)
+		atomic64_add(nblks, &sbi->s_fc_stats.fc_blocks);
+	return ret;
+}
+
+static int ext4_fc_write_dentry(struct super_block *sb,
+				struct ext4_fc_dentry_update *fcd)
+{
+	struct ext4_fc_dentry_info di;
+
+	di.fc_parent_ino = cpu_to_le32(fcd->fcd_parent);
+	di.fc_ino = cpu_to_le32(fcd->fcd_ino);
+	return ext4_fc_add_tlv(sb, fcd->fcd_op, &di, sizeof(di),
+			       fcd->fcd_name, fcd->fcd_name_len);
+}
+
+/* Byte range of the blocks logged for @inode */
+static void ext4_fc_data_range(struct inode *inode, loff_t *start,
+			       loff_t *end)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	u64 last = (u64)ei->i_fc_commit_start + ei->i_fc_commit_len;
+
+	*start = (loff_t)ei->i_fc_commit_start << inode->i_blkbits;
+	*end = min_t(u64, (last << inode->i_blkbits) - 1, LLONG_MAX);
+}
+
+/*
+ * Log the current mapping of the changed blocks of @inode and start
+ * writing their data, like a full commit does in data=ordered mode.
+ */
+static int ext4_fc_write_inode_data(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct super_block *sb = inode->i_sb;
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_ALL,
+		.nr_to_write = inode->i_mapping->nrpages * 2,
+	};
+	struct ext4_fc_add_range add;
+	struct ext4_fc_del_range del;
+	struct ext4_map_blocks map;
+	struct extent_status es;
+	ext4_lblk_t lblk, end;
+	u64 len;
+	int ret;
+
+	if (!ei->i_fc_commit_len)
+		return 0;
+
+	lblk = ei->i_fc_commit_start;
+	end = lblk + ei->i_fc_commit_len - 1;
+	while (lblk <= end) {
+		map.m_lblk = lblk;
+		map.m_len = min_t(u64, (u64)end - lblk + 1, EXT_INIT_MAX_LEN);
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			return ret;
+
+		if (ret > 0) {
+			add.fc_ino = cpu_to_le32(inode->i_ino);
+			add.fc_lblk = cpu_to_le32(map.m_lblk);
+			add.fc_len = cpu_to_le32(map.m_len);
+			add.fc_flags = cpu_to_le32(
+				map.m_flags & EXT4_MAP_UNWRITTEN ?
+				EXT4_FC_RANGE_UNWRITTEN : 0);
+			add.fc_pblk = cpu_to_le64(map.m_pblk);
+			ret = ext4_fc_add_tlv(sb, EXT4_FC_TAG_ADD_RANGE,
+					      &add, sizeof(add), NULL, 0);
+			if (ret)
+				return ret;
+			lblk += map.m_len;
+			continue;
+		}
+
+		/* A hole, the extent status tree knows how far it goes */
+		len = 1;
+		if (ext4_es_lookup_extent(inode, lblk, &es)) {
+			if (!ext4_es_is_hole(&es) && !ext4_es_is_delayed(&es))
+				continue;
+			len = (u64)es.es_lblk + es.es_len - lblk;
+		}
+		len = min_t(u64, len, (u64)end - lblk + 1);
+		del.fc_ino = cpu_to_le32(inode->i_ino);
+		del.fc_lblk = cpu_to_le32(lblk);
+		del.fc_len = cpu_to_le32(len);
+		ret = ext4_fc_add_tlv(sb, EXT4_FC_TAG_DEL_RANGE,
+				      &del, sizeof(del), NULL, 0);
+		if (ret)
+			return ret;
+		if ((u64)lblk + len > end)
+			break;
+		lblk += len;
+	}
+
+	ext4_fc_data_range(inode, &wbc.range_start, &wbc.range_end);
+	return generic_writepages(inode->i_mapping, &wbc);
+}
+
+static int ext4_fc_write_inode(struct inode *inode)
+{
+	struct ext4_fc_inode fc_inode;
+	struct ext4_iloc iloc;
+	unsigned int len = EXT4_GOOD_OLD_INODE_SIZE;
+	int ret;
+
+	if (EXT4_INODE_SIZE(inode->i_sb) > EXT4_GOOD_OLD_INODE_SIZE)
+		len += EXT4_I(inode)->i_extra_isize;
+	len = min_t(unsigned int, len, sizeof(struct ext4_inode));
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	fc_inode.fc_ino = cpu_to_le32(inode->i_ino);
+	ret = ext4_fc_add_tlv(inode->i_sb, EXT4_FC_TAG_INODE,
+			      &fc_inode, sizeof(fc_inode),
+			      ext4_raw_inode(&iloc), len);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * Log everything tracked so far.  The inodes logged are put on @inodes
+ * with a reference the caller drops.
+ */
+static int ext4_fc_perform_commit(journal_t *journal, tid_t tid,
+				  struct list_head *inodes)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_dentry_update *fcd, *fcd_n;
+	struct ext4_inode_info *ei, *ei_n;
+	LIST_HEAD(dentries);
+	loff_t start, end;
+	int ret = 0, err;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_splice_init(&sbi->s_fc_dentry_q, &dentries);
+	list_for_each_entry_safe(ei, ei_n, &sbi->s_fc_q, i_fc_list) {
+		/* Being evicted, ext4_fc_del() takes care of it */
+		if (!igrab(&ei->vfs_inode)) {
+			ret = -ENOENT;
+			break;
+		}
+		list_del_init(&ei->i_fc_list);
+		list_add_tail(&ei->i_fc_commit_list, inodes);
+		ei->i_fc_commit_start = ei->i_fc_lblk_start;
+		ei->i_fc_commit_len = ei->i_fc_lblk_len;
+		ei->i_fc_lblk_len = 0;
+	}
+	spin_unlock(&sbi->s_fc_lock);
+
+	if (ret || (list_empty(inodes) && list_empty(&dentries)))
+		goto out;
+
+	ret = ext4_fc_write_head(sb, tid);
+	list_for_each_entry(fcd, &dentries, fcd_list) {
+		if (ret)
+			break;
+		ret = ext4_fc_write_dentry(sb, fcd);
+	}
+	list_for_each_entry(ei, inodes, i_fc_commit_list) {
+		if (ret)
+			break;
+		ret = ext4_fc_write_inode_data(&ei->vfs_inode);
+		if (!ret)
+			ret = ext4_fc_write_inode(&ei->vfs_inode);
+	}
+
+	/* The data of the logged blocks goes to disk before the tail */
+	list_for_each_entry(ei, inodes, i_fc_commit_list) {
+		if (!ei->i_fc_commit_len)
+			continue;
+		ext4_fc_data_range(&ei->vfs_inode, &start, &end);
+		err = filemap_fdatawait_range(ei->vfs_inode.i_mapping,
+					      start, end);
+		if (!ret)
+			ret = err;
+	}
+
+	if (!ret)
+		ret = ext4_fc_write_tail(sb, tid);
+	err = ext4_fc_wait_blocks(sb);
+	if (!ret)
+		ret = err;
+	if (!ret)
+		ret = 1;
+out:
+	list_for_each_entry_safe(fcd, fcd_n, &dentries, fcd_list)
+		kfree(fcd);
+	return ret;
+}
+
+/*
+ * Make the changes of transaction @commit_tid tracked so far durable with
+ * a fast commit.  Returns 0 on success and 1 if the caller has to wait for
+ * a full commit of @commit_tid instead.
+ */
+int ext4_fc_commit(journal_t *journal, tid_t commit_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei, *ei_n;
+	LIST_HEAD(inodes);
+	bool ineligible;
+	int ret;
+
+restart:
+	/* Only the running transaction can be fast committed */
+	read_lock(&journal->j_state_lock);
+	ret = journal->j_running_transaction &&
+	      journal->j_running_transaction->t_tid == commit_tid;
+	read_unlock(&journal->j_state_lock);
+	if (!ret)
+		return 1;
+
+	ret = jbd2_fc_begin_commit(journal, commit_tid);
+	if (ret == -EALREADY)
+		goto restart;
+	if (ret)
+		return 1;
+
+	spin_lock(&sbi->s_fc_lock);
+	ineligible = ext4_fc_is_ineligible(sbi, commit_tid);
+	spin_unlock(&sbi->s_fc_lock);
+	if (ineligible) {
+		jbd2_fc_end_commit(journal, commit_tid);
+		atomic64_inc(&sbi->s_fc_stats.fc_ineligible);
+		return 1;
+	}
+
+	ret = ext4_fc_perform_commit(journal, commit_tid, &inodes);
+	/*
+	 * What was dropped from the queues is not on disk, and a later fsync
+	 * mustn't think otherwise.
+	 */
+	if (ret < 0)
+		ext4_fc_set_ineligible(sbi, commit_tid);
+	jbd2_fc_end_commit(journal, commit_tid);
+
+	/* The final iput may start a handle, not before the commit ended */
+	list_for_each_entry_safe(ei, ei_n, &inodes, i_fc_commit_list) {
+		list_del_init(&ei->i_fc_commit_list);
+		iput(&ei->vfs_inode);
+	}
+
+	if (ret < 0) {
+		atomic64_inc(&sbi->s_fc_stats.fc_failed);
+		return 1;
+	}
+	if (ret > 0)
+		atomic64_inc(&sbi->s_fc_stats.fc_commits);
+	return 0;
+}
+
+/*
+ * Recovery
+ */
+
+static void ext4_fc_free_replay(struct ext4_sb_info *sbi)
+{
+	struct ext4_fc_replay_state *state = sbi->s_fc_replay;
+
+	if (!state)
+		return;
+	vfree(state->fcr_buf);
+	kfree(state);
+	sbi->s_fc_replay = NULL;
+}
+
+static bool ext4_fc_tag_len_valid(u16 tag, unsigned int len)
+{
+	switch (tag) {
+	case EXT4_FC_TAG_HEAD:
+		return len == sizeof(struct ext4_fc_head);
+	case EXT4_FC_TAG_ADD_RANGE:
+		return len == sizeof(struct ext4_fc_add_range);
+	case EXT4_FC_TAG_DEL_RANGE:
+		return len == sizeof(struct ext4_fc_del_range);
+	case EXT4_FC_TAG_CREAT:
+	case EXT4_FC_TAG_LINK:
+	case EXT4_FC_TAG_UNLINK:
+		return len > sizeof(struct ext4_fc_dentry_info) &&
+		       len <= sizeof(struct ext4_fc_dentry_info) +
+			      EXT4_NAME_LEN;
+	case EXT4_FC_TAG_INODE:
+		return len >= sizeof(struct ext4_fc_inode) +
+			      EXT4_GOOD_OLD_INODE_SIZE;
+	case EXT4_FC_TAG_TAIL:
+		return len == sizeof(struct ext4_fc_tail);
+	case EXT4_FC_TAG_PAD:
+		return true;
+	}
+	return false;
+}
+
+/*
+ * jbd2 recovery callback, called for each block of the fast commit area
+ * in order.  The records of complete fast commits of @expected_tid are
+ * collected and applied by ext4_fc_replay() later.
+ */
+static int ext4_fc_replay_scan(journal_t *journal, struct buffer_head *bh,
+			       enum passtype pass, int off,
+			       tid_t expected_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_replay_state *state;
+	u8 *cur = (u8 *)bh->b_data;
+	u8 *end = cur + journal->j_blocksize;
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	unsigned int len, size;
+	u16 tag;
+	u32 crc;
+
+	if (pass != PASS_SCAN || !sbi->s_chksum_driver)
+		return JBD2_FC_REPLAY_STOP;
+
+	if (off == 0) {
+		ext4_fc_free_replay(sbi);
+		state = kzalloc(sizeof(*state), GFP_KERNEL);
+		if (!state)
+			return -ENOMEM;
+		state->fcr_size = (journal->j_fc_last - journal->j_fc_first) *
+				  journal->j_blocksize;
+		state->fcr_buf = vmalloc(state->fcr_size);
+		if (!state->fcr_buf) {
+			kfree(state);
+			return -ENOMEM;
+		}
+		state->fcr_tid = expected_tid;
+		sbi->s_fc_replay = state;
+	}
+	state = sbi->s_fc_replay;
+	if (!state)
+		return JBD2_FC_REPLAY_STOP;
+
+	for (; cur + sizeof(tl) <= end; cur += size) {
+		memcpy(&tl, cur, sizeof(tl));
+		tag = le16_to_cpu(tl.fc_tag);
+		len = le16_to_cpu(tl.fc_len);
+		size = sizeof(tl) + len;
+		if (cur + size > end || !ext4_fc_tag_len_valid(tag, len))
+			goto stop;
+
+		switch (tag) {
+		case EXT4_FC_TAG_HEAD:
+			memcpy(&head, cur + sizeof(tl), sizeof(head));
+			if (le32_to_cpu(head.fc_tid) != expected_tid ||
+			    head.fc_features)
+				goto stop;
+			/* Drop a fast commit that never got its tail */
+			state->fcr_len = state->fcr_valid_len;
+			state->fcr_in_commit = true;
+			state->fcr_crc = ext4_chksum(sbi, ~0, cur, size);
+			break;
+		case EXT4_FC_TAG_PAD:
+			if (state->fcr_in_commit)
+				state->fcr_crc = ext4_chksum(sbi, state->fcr_crc,
+							     cur, sizeof(tl));
+			break;
+		case EXT4_FC_TAG_TAIL:
+			if (!state->fcr_in_commit)
+				goto stop;
+			memcpy(&tail, cur + sizeof(tl), sizeof(tail));
+			crc = ext4_chksum(sbi, state->fcr_crc, cur,
+					  sizeof(tl) + sizeof(tail.fc_tid));
+			if (le32_to_cpu(tail.fc_tid) != expected_tid ||
+			    le32_to_cpu(tail.fc_crc) != crc)
+				goto stop;
+			state->fcr_valid_len = state->fcr_len;
+			state->fcr_in_commit = false;
+			state->fcr_commits++;
+			break;
+		default:
+			if (!state->fcr_in_commit ||
+			    state->fcr_len + size > state->fcr_size)
+				goto stop;
+			state->fcr_crc = ext4_chksum(sbi, state->fcr_crc,
+						     cur, size);
+			memcpy(state->fcr_buf + state->fcr_len, cur, size);
+			state->fcr_len += size;
+			break;
+		}
+	}
+	return JBD2_FC_REPLAY_CONTINUE;
+
+stop:
+	state->fcr_len = state->fcr_valid_len;
+	state->fcr_in_commit = false;
+	return JBD2_FC_REPLAY_STOP;
+}
+
+/* Record at @off of the replay buffer */
+static void ext4_fc_get_tl(struct ext4_fc_replay_state *state,
+			   unsigned int off, u16 *tag, unsigned int *len)
+{
+	struct ext4_fc_tl tl;
+
+	memcpy(&tl, state->fcr_buf + off, sizeof(tl));
+	*tag = le16_to_cpu(tl.fc_tag);
+	*len = le16_to_cpu(tl.fc_len);
+}
+
+/*
+ * Log the records being replayed again, as a fast commit of the running
+ * transaction: once a commit during replay made part of them durable,
+ * those found by recovery are of no use any more.
+ */
+static int ext4_fc_relog(struct super_block *sb,
+			 struct ext4_fc_replay_state *state)
+{
+	journal_t *journal = EXT4_SB(sb)->s_journal;
+	unsigned int off, len;
+	tid_t tid;
+	u16 tag;
+	int ret, err;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT))
+		return -EOPNOTSUPP;
+
+	read_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction)
+		tid = journal->j_running_transaction->t_tid;
+	else
+		tid = journal->j_transaction_sequence;
+	read_unlock(&journal->j_state_lock);
+
+	ret = jbd2_fc_begin_commit(journal, tid);
+	if (ret)
+		return ret;
+
+	ret = ext4_fc_write_head(sb, tid);
+	for (off = 0; !ret && off < state->fcr_valid_len;
+	     off += sizeof(struct ext4_fc_tl) + len) {
+		ext4_fc_get_tl(state, off, &tag, &len);
+		ret = ext4_fc_add_tlv(sb, tag, state->fcr_buf + off +
+				      sizeof(struct ext4_fc_tl), len, NULL, 0);
+	}
+	if (!ret)
+		ret = ext4_fc_write_tail(sb, tid);
+	err = ext4_fc_wait_blocks(sb);
+	jbd2_fc_end_commit(journal, tid);
+	return ret ? ret : err;
+}
+
+/* Commit what was replayed so far and log the records again */
+static int ext4_fc_replay_checkpoint(struct super_block *sb,
+				     struct ext4_fc_replay_state *state)
+{
+	int ret;
+
+	ret = ext4_force_commit(sb);
+	if (ret)
+		return ret;
+	ret = ext4_fc_relog(sb, state);
+	if (ret)
+		ext4_msg(sb, KERN_WARNING,
+			 "fast commit replay can't be logged (%d)", ret);
+	return 0;
+}
+
+/* Look up an inode of a record, NULL if it doesn't exist any more */
+static struct inode *ext4_fc_iget(struct super_block *sb, u32 ino)
+{
+	struct inode *inode;
+
+	inode = ext4_iget(sb, ino);
+	if (IS_ERR(inode) && PTR_ERR(inode) == -ESTALE)
+		return NULL;
+	return inode;
+}
+
+/* Mode of @ino in the last INODE record logged for it, 0 if none */
+static umode_t ext4_fc_replay_mode(struct ext4_fc_replay_state *state,
+				   u32 ino)
+{
+	struct ext4_fc_inode fc_inode;
+	unsigned int off, len;
+	__le16 mode = 0;
+	u8 *val;
+	u16 tag;
+
+	for (off = 0; off < state->fcr_valid_len;
+	     off += sizeof(struct ext4_fc_tl) + len) {
+		ext4_fc_get_tl(state, off, &tag, &len);
+		if (tag != EXT4_FC_TAG_INODE)
+			continue;
+		val = state->fcr_buf + off + sizeof(struct ext4_fc_tl);
+		memcpy(&fc_inode, val, sizeof(fc_inode));
+		if (le32_to_cpu(fc_inode.fc_ino) == ino)
+			memcpy(&mode, val + sizeof(fc_inode) +
+			       offsetof(struct ext4_inode, i_mode),
+			       sizeof(mode));
+	}
+	return le16_to_cpu(mode);
+}
+
+/* Allocate inode number @ino again, for a CREAT record */
+static struct inode *ext4_fc_replay_create(handle_t *handle,
+					   struct inode *dir,
+					   struct ext4_fc_replay_state *state,
+					   u32 ino, const struct qstr *name)
+{
+	umode_t mode = ext4_fc_replay_mode(state, ino);
+	struct inode *inode;
+
+	/* Gone again before the fast commit */
+	if (!mode)
+		return NULL;
+	if (!S_ISREG(mode))
+		return ERR_PTR(-EINVAL);
+
+	inode = ext4_new_inode(handle, dir, mode, name, ino, NULL);
+	if (IS_ERR(inode))
+		return inode;
+	inode->i_op = &ext4_file_inode_operations;
+	inode->i_fop = &ext4_file_operations;
+	ext4_set_aops(inode);
+	if (inode->i_ino != ino) {
+		clear_nlink(inode);
+		unlock_new_inode(inode);
+		iput(inode);
+		return ERR_PTR(-EEXIST);
+	}
+	ext4_mark_inode_dirty(handle, inode);
+	unlock_new_inode(inode);
+	return inode;
+}
+
+static int ext4_fc_replay_dentry(struct super_block *sb,
+				 struct ext4_fc_replay_state *state,
+				 u16 tag, u8 *val, unsigned int len)
+{
+	struct ext4_fc_dentry_info di;
+	struct inode *dir, *inode = NULL;
+	struct qstr name;
+	handle_t *handle;
+	int credits, ret;
+
+	memcpy(&di, val, sizeof(di));
+	name.name = val + sizeof(di);
+	name.len = len - sizeof(di);
+	name.hash = full_name_hash(name.name, name.len);
+
+	dir = ext4_fc_iget(sb, le32_to_cpu(di.fc_parent_ino));
+	if (IS_ERR_OR_NULL(dir))
+		return PTR_ERR(dir);
+	ret = -EIO;
+	if (!S_ISDIR(dir->i_mode))
+		goto out;
+
+	inode = ext4_fc_iget(sb, le32_to_cpu(di.fc_ino));
+	if (IS_ERR(inode)) {
+		ret = PTR_ERR(inode);
+		inode = NULL;
+		goto out;
+	}
+	ret = 0;
+	if (!inode && tag != EXT4_FC_TAG_CREAT)
+		goto out;
+
+	credits = EXT4_DATA_TRANS_BLOCKS(sb) + EXT4_INDEX_EXTRA_TRANS_BLOCKS +
+		  3 + EXT4_MAXQUOTAS_INIT_BLOCKS(sb);
+	handle = ext4_journal_start(dir, EXT4_HT_DIR, credits);
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out;
+	}
+
+	if (!inode) {
+		inode = ext4_fc_replay_create(handle, dir, state,
+					      le32_to_cpu(di.fc_ino), &name);
+		if (IS_ERR_OR_NULL(inode)) {
+			ret = PTR_ERR(inode);
+			inode = NULL;
+			goto out_stop;
+		}
+	}
+
+	if (tag == EXT4_FC_TAG_UNLINK) {
+		ret = ext4_fc_replay_unlink_entry(handle, dir, inode, &name);
+		if (ret > 0) {
+			drop_nlink(inode);
+			if (!inode->i_nlink)
+				ext4_orphan_add(handle, inode);
+		}
+	} else {
+		ret = ext4_fc_replay_link_entry(handle, dir, inode, &name);
+		/* A new inode starts with its first link already */
+		if (ret > 0 && tag == EXT4_FC_TAG_LINK)
+			inc_nlink(inode);
+	}
+	if (ret > 0) {
+		inode->i_ctime = ext4_current_time(inode);
+		ret = ext4_mark_inode_dirty(handle, inode);
+	}
+out_stop:
+	ext4_journal_stop(handle);
+out:
+	iput(inode);
+	iput(dir);
+	return ret;
+}
+
+/* Unmap @len blocks of @inode from @lblk */
+static int ext4_fc_replay_unmap(struct inode *inode, ext4_lblk_t lblk,
+				ext4_lblk_t len)
+{
+	handle_t *handle;
+	int ret;
+
+	handle = ext4_journal_start(inode, EXT4_HT_TRUNCATE,
+				    ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	down_write(&EXT4_I(inode)->i_data_sem);
+	ext4_discard_preallocations(inode);
+	ret = ext4_es_remove_extent(inode, lblk, len);
+	if (!ret)
+		ret = ext4_ext_remove_space(inode, lblk, lblk + len - 1);
+	up_write(&EXT4_I(inode)->i_data_sem);
+	if (!ret)
+		ret = ext4_mark_inode_dirty(handle, inode);
+	ext4_journal_stop(handle);
+	return ret;
+}
+
+static int ext4_fc_replay_del_range(struct super_block *sb, u8 *val)
+{
+	struct ext4_fc_del_range del;
+	struct inode *inode;
+	int ret = -EIO;
+
+	memcpy(&del, val, sizeof(del));
+	inode = ext4_fc_iget(sb, le32_to_cpu(del.fc_ino));
+	if (IS_ERR_OR_NULL(inode))
+		return PTR_ERR(inode);
+	if (S_ISREG(inode->i_mode) &&
+	    ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
+		ret = ext4_fc_replay_unmap(inode, le32_to_cpu(del.fc_lblk),
+					   le32_to_cpu(del.fc_len));
+	iput(inode);
+	return ret;
+}
+
+/* Map @len blocks of @inode from @lblk to exactly @pblk onwards */
+static int ext4_fc_replay_alloc(struct inode *inode, ext4_lblk_t lblk,
+				ext4_lblk_t len, ext4_fsblk_t pblk,
+				bool unwritten)
+{
+	struct ext4_allocation_request ar;
+	struct ext4_ext_path *path;
+	struct ext4_extent newex;
+	ext4_fsblk_t newblock;
+	handle_t *handle;
+	int ret = 0;
+
+	while (len) {
+		memset(&ar, 0, sizeof(ar));
+		ar.inode = inode;
+		ar.logical = lblk;
+		ar.goal = pblk;
+		ar.len = min_t(ext4_lblk_t, len, unwritten ?
+			       EXT_UNWRITTEN_MAX_LEN : EXT_INIT_MAX_LEN);
+		ar.flags = EXT4_MB_HINT_DATA | EXT4_MB_HINT_GOAL_ONLY |
+			   EXT4_MB_HINT_TRY_GOAL | EXT4_MB_HINT_NOPREALLOC |
+			   EXT4_MB_USE_RESERVED;
+
+		handle = ext4_journal_start(inode, EXT4_HT_MAP_BLOCKS,
+					    ext4_chunk_trans_blocks(inode,
+								    ar.len));
+		if (IS_ERR(handle))
+			return PTR_ERR(handle);
+
+		newblock = ext4_mb_new_blocks(handle, &ar, &ret);
+		if (!newblock)
+			goto out_stop;
+		if (newblock != pblk) {
+			ext4_free_blocks(handle, inode, NULL, newblock,
+					 ar.len, 0);
+			ret = -EBUSY;
+			goto out_stop;
+		}
+
+		newex.ee_block = cpu_to_le32(lblk);
+		ext4_ext_store_pblock(&newex, pblk);
+		newex.ee_len = cpu_to_le16(ar.len);
+		if (unwritten)
+			ext4_ext_mark_unwritten(&newex);
+
+		down_write(&EXT4_I(inode)->i_data_sem);
+		ret = ext4_es_remove_extent(inode, lblk, ar.len);
+		if (!ret) {
+			path = ext4_find_extent(inode, lblk, NULL, 0);
+			if (IS_ERR(path)) {
+				ret = PTR_ERR(path);
+			} else {
+				ret = ext4_ext_insert_extent(handle, inode,
+							     &path, &newex, 0);
+				ext4_ext_drop_refs(path);
+				kfree(path);
+			}
+		}
+		up_write(&EXT4_I(inode)->i_data_sem);
+		if (ret)
+			ext4_free_blocks(handle, inode, NULL, pblk, ar.len, 0);
+		else
+			ret = ext4_mark_inode_dirty(handle, inode);
+out_stop:
+		ext4_journal_stop(handle);
+		if (ret)
+			return ret;
+		lblk += ar.len;
+		pblk += ar.len;
+		len -= ar.len;
+	}
+	return 0;
+}
+
+/*
+ * Make @len blocks of @inode from @lblk map to @pblk onwards.  Blocks
+ * mapped elsewhere are unmapped in the UNMAP phase, so that the commit
+ * after it makes them available, and holes are filled in the MAP phase.
+ */
+static int ext4_fc_replay_map(struct inode *inode, ext4_lblk_t lblk,
+			      ext4_lblk_t len, ext4_fsblk_t pblk,
+			      bool unwritten, int phase)
+{
+	struct ext4_map_blocks map;
+	struct extent_status es;
+	ext4_lblk_t n;
+	int ret;
+
+	while (len) {
+		map.m_lblk = lblk;
+		map.m_len = len;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			return ret;
+
+		if (ret > 0) {
+			n = ret;
+			ret = 0;
+			if (map.m_pblk != pblk) {
+				if (phase != EXT4_FC_REPLAY_UNMAP)
+					return -EBUSY;
+				ret = ext4_fc_replay_unmap(inode, lblk, n);
+			} else if (phase == EXT4_FC_REPLAY_MAP && !unwritten &&
+				   (map.m_flags & EXT4_MAP_UNWRITTEN)) {
+				ret = ext4_convert_unwritten_extents(NULL,
+					inode, (loff_t)lblk << inode->i_blkbits,
+					(ssize_t)n << inode->i_blkbits);
+			}
+		} else {
+			n = len;
+			if (ext4_es_lookup_extent(inode, lblk, &es) &&
+			    ext4_es_is_hole(&es))
+				n = min_t(u64, n,
+					  (u64)es.es_lblk + es.es_len - lblk);
+			ret = 0;
+			if (phase == EXT4_FC_REPLAY_MAP)
+				ret = ext4_fc_replay_alloc(inode, lblk, n,
+							   pblk, unwritten);
+		}
+		if (ret)
+			return ret;
+		lblk += n;
+		pblk += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Apply the part of a mapped range that no record after @from maps or
+ * unmaps again: only the last state of a block counts.
+ */
+static int ext4_fc_replay_range(struct ext4_fc_replay_state *state,
+				unsigned int from, struct inode *inode,
+				ext4_lblk_t lblk, ext4_lblk_t len,
+				ext4_fsblk_t pblk, bool unwritten, int phase)
+{
+	struct ext4_fc_del_range del;
+	unsigned int off, next, tlen;
+	u64 end = (u64)lblk + len, t_lblk, t_end;
+	int ret = 0, err;
+	u16 tag;
+
+	for (off = from; off < state->fcr_valid_len; off = next) {
+		ext4_fc_get_tl(state, off, &tag, &tlen);
+		next = off + sizeof(struct ext4_fc_tl) + tlen;
+		if (tag != EXT4_FC_TAG_ADD_RANGE &&
+		    tag != EXT4_FC_TAG_DEL_RANGE)
+			continue;
+
+		/* Both records start with the same ino, lblk and len */
+		memcpy(&del, state->fcr_buf + off + sizeof(struct ext4_fc_tl),
+		       sizeof(del));
+		if (le32_to_cpu(del.fc_ino) != inode->i_ino)
+			continue;
+		t_lblk = le32_to_cpu(del.fc_lblk);
+		t_end = t_lblk + le32_to_cpu(del.fc_len);
+		if (t_end <= lblk || t_lblk >= end)
+			continue;
+
+		if (t_lblk > lblk)
+			ret = ext4_fc_replay_range(state, next, inode, lblk,
+						   t_lblk - lblk, pblk,
+						   unwritten, phase);
+		if (t_end < end) {
+			err = ext4_fc_replay_range(state, next, inode, t_end,
+						   end - t_end,
+						   pblk + (t_end - lblk),
+						   unwritten, phase);
+			if (!ret)
+				ret = err;
+		}
+		return ret;
+	}
+	return ext4_fc_replay_map(inode, lblk, len, pblk, unwritten, phase);
+}
+
+static int ext4_fc_replay_add_range(struct super_block *sb,
+				    struct ext4_fc_replay_state *state,
+				    unsigned int next, u8 *val, int phase)
+{
+	struct ext4_fc_add_range add;
+	struct inode *inode;
+	int ret = -EIO;
+
+	memcpy(&add, val, sizeof(add));
+	inode = ext4_fc_iget(sb, le32_to_cpu(add.fc_ino));
+	if (IS_ERR_OR_NULL(inode))
+		return PTR_ERR(inode);
+	if (S_ISREG(inode->i_mode) &&
+	    ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
+		ret = ext4_fc_replay_range(state, next, inode,
+				le32_to_cpu(add.fc_lblk),
+				le32_to_cpu(add.fc_len),
+				le64_to_cpu(add.fc_pblk),
+				le32_to_cpu(add.fc_flags) &
+				EXT4_FC_RANGE_UNWRITTEN, phase);
+	iput(inode);
+	return ret;
+}
+
+/* Bring the inode up to date with its logged copy */
+static int ext4_fc_replay_inode(struct super_block *sb, u8 *val,
+				unsigned int len)
+{
+	struct ext4_fc_inode fc_inode;
+	struct ext4_inode raw;
+	struct ext4_inode_info *ei;
+	struct inode *inode;
+	struct iattr attr;
+	handle_t *handle;
+	uid_t i_uid;
+	gid_t i_gid;
+	loff_t size;
+	int ret;
+
+	memcpy(&fc_inode, val, sizeof(fc_inode));
+	memset(&raw, 0, sizeof(raw));
+	memcpy(&raw, val + sizeof(fc_inode),
+	       min_t(unsigned int, len - sizeof(fc_inode), sizeof(raw)));
+
+	inode = ext4_fc_iget(sb, le32_to_cpu(fc_inode.fc_ino));
+	if (IS_ERR_OR_NULL(inode))
+		return PTR_ERR(inode);
+	ei = EXT4_I(inode);
+	ret = -EIO;
+	if ((le16_to_cpu(raw.i_mode) & S_IFMT) != (inode->i_mode & S_IFMT))
+		goto out;
+
+	i_uid = (uid_t)le16_to_cpu(raw.i_uid_low);
+	i_gid = (gid_t)le16_to_cpu(raw.i_gid_low);
+	if (!test_opt(sb, NO_UID32)) {
+		i_uid |= le16_to_cpu(raw.i_uid_high) << 16;
+		i_gid |= le16_to_cpu(raw.i_gid_high) << 16;
+	}
+
+	dquot_initialize(inode);
+	handle = ext4_journal_start(inode, EXT4_HT_INODE,
+			EXT4_MAXQUOTAS_INIT_BLOCKS(sb) +
+			EXT4_MAXQUOTAS_DEL_BLOCKS(sb) + 3);
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out;
+	}
+
+	attr.ia_valid = ATTR_UID | ATTR_GID;
+	attr.ia_uid = make_kuid(&init_user_ns, i_uid);
+	attr.ia_gid = make_kgid(&init_user_ns, i_gid);
+	if (!uid_eq(attr.ia_uid, inode->i_uid) ||
+	    !gid_eq(attr.ia_gid, inode->i_gid)) {
+		ret = dquot_transfer(inode, &attr);
+		if (ret)
+			goto out_stop;
+		inode->i_uid = attr.ia_uid;
+		inode->i_gid = attr.ia_gid;
+	}
+
+	inode->i_mode = le16_to_cpu(raw.i_mode);
+	if (S_ISREG(inode->i_mode)) {
+		size = ext4_isize(&raw);
+		i_size_write(inode, size);
+		ei->i_disksize = size;
+	}
+	set_nlink(inode, le16_to_cpu(raw.i_links_count));
+	EXT4_INODE_GET_XTIME(i_ctime, inode, &raw);
+	EXT4_INODE_GET_XTIME(i_mtime, inode, &raw);
+	EXT4_INODE_GET_XTIME(i_atime, inode, &raw);
+	ei->i_flags = (ei->i_flags & ~EXT4_FL_USER_MODIFIABLE) |
+		      (le32_to_cpu(raw.i_flags) & EXT4_FL_USER_MODIFIABLE);
+	ext4_set_inode_flags(inode);
+	inode->i_generation = le32_to_cpu(raw.i_generation);
+
+	ret = 0;
+	if (!inode->i_nlink)
+		ret = ext4_orphan_add(handle, inode);
+	if (!ret)
+		ret = ext4_mark_inode_dirty(handle, inode);
+out_stop:
+	ext4_journal_stop(handle);
+out:
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_phase(struct super_block *sb,
+				struct ext4_fc_replay_state *state, int phase)
+{
+	unsigned int off, next, len;
+	int ret = 0, err;
+	u8 *val;
+	u16 tag;
+
+	for (off = 0; off < state->fcr_valid_len; off = next) {
+		ext4_fc_get_tl(state, off, &tag, &len);
+		val = state->fcr_buf + off + sizeof(struct ext4_fc_tl);
+		next = off + sizeof(struct ext4_fc_tl) + len;
+
+		err = 0;
+		switch (tag) {
+		case EXT4_FC_TAG_CREAT:
+		case EXT4_FC_TAG_LINK:
+		case EXT4_FC_TAG_UNLINK:
+			if (phase == EXT4_FC_REPLAY_NAMESPACE)
+				err = ext4_fc_replay_dentry(sb, state, tag,
+							    val, len);
+			break;
+		case EXT4_FC_TAG_DEL_RANGE:
+			if (phase == EXT4_FC_REPLAY_NAMESPACE)
+				err = ext4_fc_replay_del_range(sb, val);
+			break;
+		case EXT4_FC_TAG_ADD_RANGE:
+			if (phase == EXT4_FC_REPLAY_UNMAP ||
+			    phase == EXT4_FC_REPLAY_MAP)
+				err = ext4_fc_replay_add_range(sb, state, next,
+							       val, phase);
+			break;
+		case EXT4_FC_TAG_INODE:
+			if (phase == EXT4_FC_REPLAY_INODES)
+				err = ext4_fc_replay_inode(sb, val, len);
+			break;
+		}
+		if (err) {
+			ext4_msg(sb, KERN_WARNING, "fast commit record %u at "
+				 "offset %u not replayed (%d)", tag, off, err);
+			if (!ret)
+				ret = err;
+		}
+	}
+	return ret;
+}
+
+/*
+ * Apply the fast commits found by recovery.  Called at mount time once
+ * regular journalled operations are possible, before orphan cleanup.
+ */
+int ext4_fc_replay(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_replay_state *state = sbi->s_fc_replay;
+	unsigned long s_flags = sb->s_flags;
+	int ret = 0, err;
+
+	if (!state->fcr_valid_len)
+		goto out;
+
+	if (bdev_read_only(sb->s_bdev)) {
+		ext4_msg(sb, KERN_ERR, "write access unavailable, "
+			 "skipping fast commit replay");
+		ret = -EROFS;
+		goto out;
+	}
+
+	ext4_msg(sb, KERN_INFO, "replaying %d fast commit(s) of transaction %u",
+		 state->fcr_commits, state->fcr_tid);
+	if (s_flags & MS_RDONLY) {
+		ext4_msg(sb, KERN_INFO, "write access will be enabled "
+			 "during fast commit replay");
+		sb->s_flags &= ~MS_RDONLY;
+	}
+
+	err = ext4_fc_relog(sb, state);
+	if (err)
+		ext4_msg(sb, KERN_WARNING,
+			 "fast commit replay can't be logged (%d)", err);
+
+	ret = ext4_fc_replay_phase(sb, state, EXT4_FC_REPLAY_NAMESPACE);
+	err = ext4_fc_replay_checkpoint(sb, state);
+	if (!ret)
+		ret = err;
+	err = ext4_fc_replay_phase(sb, state, EXT4_FC_REPLAY_UNMAP);
+	if (!ret)
+		ret = err;
+	/* Blocks freed so far can be allocated again after a commit */
+	err = ext4_fc_replay_checkpoint(sb, state);
+	if (!ret)
+		ret = err;
+	err = ext4_fc_replay_phase(sb, state, EXT4_FC_REPLAY_MAP);
+	if (!ret)
+		ret = err;
+	err = ext4_fc_replay_phase(sb, state, EXT4_FC_REPLAY_INODES);
+	if (!ret)
+		ret = err;
+	err = ext4_force_commit(sb);
+	if (!ret)
+		ret = err;
+
+	sb->s_flags |= s_flags & MS_RDONLY;
+out:
+	ext4_fc_free_replay(sbi);
+	return ret;
+}
+
+void ext4_fc_init(struct super_block *sb, journal_t *journal)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	INIT_LIST_HEAD(&sbi->s_fc_q);
+	INIT_LIST_HEAD(&sbi->s_fc_dentry_q);
+	spin_lock_init(&sbi->s_fc_lock);
+	sbi->s_fc_ineligible = false;
+	journal->j_fc_cleanup_callback = ext4_fc_cleanup;
+	journal->j_fc_replay_callback = ext4_fc_replay_scan;
+}
+
+void ext4_fc_destroy(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_dentry_update *fcd, *fcd_n;
+
+	ext4_fc_free_replay(sbi);
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT))
+		return;
+	list_for_each_entry_safe(fcd, fcd_n, &sbi->s_fc_dentry_q, fcd_list) {
+		list_del(&fcd->fcd_list);
+		kfree(fcd);
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ *  fs/ext4/fast_commit.h
+ *
+ *  On-disk format and interfaces of ext4 fast commits.
+ */
+
+#ifndef _EXT4_FAST_COMMIT_H
+#define _EXT4_FAST_COMMIT_H
+
+/*
+ * A fast commit is a sequence of tag-length-value records written to the
+ * fast commit area at the end of the journal.  It starts on a fresh block
+ * with a HEAD record and ends with a TAIL record carrying the transaction
+ * id and a crc32c of all the records before it.  Records never cross a
+ * block boundary, the unused end of a block is covered by a PAD record.
+ */
+#define EXT4_FC_TAG_HEAD	0x0001
+#define EXT4_FC_TAG_ADD_RANGE	0x0002
+#define EXT4_FC_TAG_DEL_RANGE	0x0003
+#define EXT4_FC_TAG_CREAT	0x0004
+#define EXT4_FC_TAG_LINK	0x0005
+#define EXT4_FC_TAG_UNLINK	0x0006
+#define EXT4_FC_TAG_INODE	0x0007
+#define EXT4_FC_TAG_PAD		0x0008
+#define EXT4_FC_TAG_TAIL	0x0009
+
+/* Record header, fc_len is the length of the value that follows */
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;
+};
+
+struct ext4_fc_head {
+	__le32 fc_features;
+	__le32 fc_tid;
+};
+
+/* Logical range of an inode now mapped to fc_pblk */
+struct ext4_fc_add_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le32 fc_len;
+	__le32 fc_flags;	/* EXT4_FC_RANGE_UNWRITTEN */
+	__le64 fc_pblk;
+};
+
+#define EXT4_FC_RANGE_UNWRITTEN	0x0001
+
+/* Logical range of an inode with no blocks mapped */
+struct ext4_fc_del_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le32 fc_len;
+};
+
+/* Directory entry created, linked or unlinked */
+struct ext4_fc_dentry_info {
+	__le32 fc_parent_ino;
+	__le32 fc_ino;
+	__u8 fc_dname[0];
+};
+
+/* Copy of the on-disk inode */
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__u8 fc_raw_inode[0];
+};
+
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;
+};
+
+struct ext4_fc_stats {
+	atomic64_t fc_commits;		/* fast commits written */
+	atomic64_t fc_ineligible;	/* fsyncs that needed a full commit */
+	atomic64_t fc_failed;		/* fast commits that failed */
+	atomic64_t fc_blocks;		/* fast commit blocks written */
+};
+
+struct ext4_fc_replay_state;
+
+extern void ext4_fc_init(struct super_block *sb, journal_t *journal);
+extern void ext4_fc_mark_ineligible(struct super_block *sb, handle_t *handle);
+extern void ext4_fc_track_inode(handle_t *handle, struct inode *inode);
+extern void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+				ext4_lblk_t start, ext4_lblk_t end);
+extern void ext4_fc_track_create(handle_t *handle, struct dentry *dentry);
+extern void ext4_fc_track_link(handle_t *handle, struct dentry *dentry);
+extern void ext4_fc_track_unlink(handle_t *handle, struct dentry *dentry);
+extern void ext4_fc_del(struct inode *inode);
+extern int ext4_fc_commit(journal_t *journal, tid_t commit_tid);
+extern int ext4_fc_replay(struct super_block *sb);
+extern void ext4_fc_destroy(struct super_block *sb);
+
+#endif /* _EXT4_FAST_COMMIT_H */
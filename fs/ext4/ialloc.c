@@ -1056,6 +1056,10 @@ got:
 	if (EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_INLINE_DATA))
 		ext4_set_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
 #endif
+	/* Only regular files can be recreated by fast commit replay */
+	if (!S_ISREG(mode))
+		ext4_fc_mark_ineligible(sb, handle);
+
 	ret = inode;
 	err = dquot_alloc_inode(inode);
 	if (err)
@@ -648,6 +648,9 @@ found:
 
 has_zeroout:
 	up_write((&EXT4_I(inode)->i_data_sem));
+	if (retval > 0)
+		ext4_fc_track_range(handle, inode, map->m_lblk,
+				    map->m_lblk + map->m_len - 1);
 	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
 		ret = check_block_validity(inode, map);
 		if (ret != 0)
@@ -3362,6 +3365,7 @@ void ext4_set_aops(struct inode *inode)
 		inode->i_mapping->a_ops = &ext4_da_aops;
 	else
 		inode->i_mapping->a_ops = &ext4_aops;
+	mapping_set_large_pages(inode->i_mapping);
 }
 
 static int __ext4_block_zero_page_range(handle_t *handle,
@@ -3706,6 +3710,7 @@ int ext4_punch_hole(struct inode *inode, loff_t offset, loff_t length)
 					    stop_block);
 
 	up_write(&EXT4_I(inode)->i_data_sem);
+	ext4_fc_track_range(handle, inode, first_block, stop_block - 1);
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
 
@@ -3848,6 +3853,9 @@ void ext4_truncate(struct inode *inode)
 		ext4_ind_truncate(handle, inode);
 
 	up_write(&ei->i_data_sem);
+	ext4_fc_track_range(handle, inode,
+			    (inode->i_size + inode->i_sb->s_blocksize - 1) >>
+			    inode->i_sb->s_blocksize_bits, EXT_MAX_BLOCKS - 1);
 
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
@@ -4296,9 +4304,11 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 	} else if (S_ISDIR(inode->i_mode)) {
 		inode->i_op = &ext4_dir_inode_operations;
 		inode->i_fop = &ext4_dir_operations;
+		ext4_dir_init_pdirops(inode);
 	} else if (S_ISLNK(inode->i_mode)) {
 		if (ext4_inode_is_fast_symlink(inode) &&
 		    !ext4_encrypted_inode(inode)) {
+			inode->i_link = (char *)ei->i_data;
 			inode->i_op = &ext4_fast_symlink_inode_operations;
 			nd_terminate_link(ei->i_data, inode->i_size,
 				sizeof(ei->i_data) - 1);
@@ -4872,13 +4882,10 @@ err_out:
 	return error;
 }
 
-int ext4_getattr(struct vfsmount *mnt, struct dentry *dentry,
-		 struct kstat *stat)
+static void ext4_fill_kstat(struct inode *inode, struct kstat *stat)
 {
-	struct inode *inode;
 	unsigned long long delalloc_blocks;
 
-	inode = d_inode(dentry);
 	generic_fillattr(inode, stat);
 
 	/*
@@ -4903,6 +4910,34 @@ int ext4_getattr(struct vfsmount *mnt, struct dentry *dentry,
 	delalloc_blocks = EXT4_C2B(EXT4_SB(inode->i_sb),
 				   EXT4_I(inode)->i_reserved_data_blocks);
 	stat->blocks += delalloc_blocks << (inode->i_sb->s_blocksize_bits - 9);
+}
+
+int ext4_getattr(struct vfsmount *mnt, struct dentry *dentry,
+		 struct kstat *stat)
+{
+	ext4_fill_kstat(d_inode(dentry), stat);
+	return 0;
+}
+
+/*
+ * getdents_attr() hook: fetch the attributes of a directory entry by
+ * inode number, skipping the dentry lookup.  ext4_iget() fails with
+ * -ESTALE if the entry was unlinked and the inode freed meanwhile.
+ */
+int ext4_dirent_getattr(struct file *dir, u64 ino, struct kstat *stat)
+{
+	struct super_block *sb = file_inode(dir)->i_sb;
+	struct inode *inode;
+
+	if (ino > le32_to_cpu(EXT4_SB(sb)->s_es->s_inodes_count))
+		return -ESTALE;
+
+	inode = ext4_iget_normal(sb, ino);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	ext4_fill_kstat(inode, stat);
+	iput(inode);
 	return 0;
 }
 
@@ -5098,6 +5133,7 @@ int ext4_mark_inode_dirty(handle_t *handle, struct inode *inode)
 
 	might_sleep();
 	trace_ext4_mark_inode_dirty(inode, _RET_IP_);
+	ext4_fc_track_inode(handle, inode);
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
 	if (ext4_handle_valid(handle) &&
 	    EXT4_I(inode)->i_extra_isize < sbi->s_want_extra_isize &&
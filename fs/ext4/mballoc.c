@@ -698,23 +698,88 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the per-order list matching it so that the
+ * allocator can find groups able to satisfy a request without scanning.
+ * Called with the group locked.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	int i;
-	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
+	int new_order = -1;
 
-	bits = sb->s_blocksize_bits + 1;
-	for (i = bits; i >= 0; i--) {
+	for (i = MB_NUM_ORDERS(sb) - 1; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new_order = i;
 			break;
 		}
 	}
+
+	if (!list_empty(&grp->bb_largest_free_order_node)) {
+		i = grp->bb_largest_free_order;
+		if (i == new_order)
+			return;
+		write_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
+	grp->bb_largest_free_order = new_order;
+	if (new_order < 0)
+		return;
+
+	write_lock(&sbi->s_mb_largest_free_orders_locks[new_order]);
+	list_add_tail(&grp->bb_largest_free_order_node,
+		      &sbi->s_mb_largest_free_orders[new_order]);
+	write_unlock(&sbi->s_mb_largest_free_orders_locks[new_order]);
+}
+
+/*
+ * Groups are bucketed by the order of their average free extent size:
+ * list N holds groups whose average is in [2^N, 2^(N+1)).
+ */
+static int mb_avg_fragment_size_order(struct super_block *sb,
+				      ext4_grpblk_t len)
+{
+	int order = fls(len) - 1;
+
+	if (order < 0)
+		return 0;
+	if (order >= MB_NUM_ORDERS(sb))
+		order = MB_NUM_ORDERS(sb) - 1;
+	return order;
+}
+
+/* Called with the group locked, after bb_free or bb_fragments changed */
+static void
+mb_update_avg_fragment_size(struct super_block *sb, struct ext4_group_info *grp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int i;
+	int new_order = -1;
+
+	if (grp->bb_fragments)
+		new_order = mb_avg_fragment_size_order(sb,
+				grp->bb_free / grp->bb_fragments);
+
+	if (!list_empty(&grp->bb_avg_fragment_size_node)) {
+		i = grp->bb_avg_fragment_size_order;
+		if (i == new_order)
+			return;
+		write_lock(&sbi->s_mb_avg_fragment_size_locks[i]);
+		list_del_init(&grp->bb_avg_fragment_size_node);
+		write_unlock(&sbi->s_mb_avg_fragment_size_locks[i]);
+	}
+
+	grp->bb_avg_fragment_size_order = new_order;
+	if (new_order < 0)
+		return;
+
+	write_lock(&sbi->s_mb_avg_fragment_size_locks[new_order]);
+	list_add_tail(&grp->bb_avg_fragment_size_node,
+		      &sbi->s_mb_avg_fragment_size[new_order]);
+	write_unlock(&sbi->s_mb_avg_fragment_size_locks[new_order]);
 }
 
 static noinline_for_stack
@@ -766,6 +831,7 @@ void ext4_mb_generate_buddy(struct super_block *sb,
 		set_bit(EXT4_GROUP_INFO_BBITMAP_CORRUPT_BIT, &grp->bb_state);
 	}
 	mb_set_largest_free_order(sb, grp);
+	mb_update_avg_fragment_size(sb, grp);
 
 	clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state));
 
@@ -1486,6 +1552,7 @@ static void mb_free_blocks(struct inode *inode, struct ext4_buddy *e4b,
 
 done:
 	mb_set_largest_free_order(sb, e4b->bd_info);
+	mb_update_avg_fragment_size(sb, e4b->bd_info);
 	mb_check_buddy(e4b);
 }
 
@@ -1610,6 +1677,7 @@ static int mb_mark_used(struct ext4_buddy *e4b, struct ext4_free_extent *ex)
 		e4b->bd_info->bb_counters[ord]++;
 	}
 	mb_set_largest_free_order(e4b->bd_sb, e4b->bd_info);
+	mb_update_avg_fragment_size(e4b->bd_sb, e4b->bd_info);
 
 	ext4_set_bits(e4b->bd_bitmap, ex->fe_start, len0);
 	mb_check_buddy(e4b);
@@ -2075,11 +2143,119 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Criteria 0: any group whose largest free extent is at least 2^ac_2order
+ * satisfies the request straight from its buddy, so take the first one
+ * off the per-order lists.  Called without any group locked, the choice
+ * is rechecked under the group lock by the caller.
+ */
+static bool ext4_mb_choose_next_group_cr0(struct ext4_allocation_context *ac,
+					  ext4_group_t *group)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	struct ext4_group_info *iter;
+	int i;
+
+	for (i = ac->ac_2order; i < MB_NUM_ORDERS(ac->ac_sb); i++) {
+		if (list_empty(&sbi->s_mb_largest_free_orders[i]))
+			continue;
+		read_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_for_each_entry(iter, &sbi->s_mb_largest_free_orders[i],
+				    bb_largest_free_order_node) {
+			if (iter->bb_group == ac->ac_last_optimal_group ||
+			    EXT4_MB_GRP_NEED_INIT(iter) ||
+			    !ext4_mb_good_group(ac, iter->bb_group, 0))
+				continue;
+			*group = iter->bb_group;
+			read_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+			return true;
+		}
+		read_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+	return false;
+}
+
+/*
+ * Criteria 1: look for a group whose average free extent is at least the
+ * goal length, starting with the smallest such groups so that the large
+ * extents are kept for the requests that need them.
+ */
+static bool ext4_mb_choose_next_group_cr1(struct ext4_allocation_context *ac,
+					  ext4_group_t *group)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	struct ext4_group_info *iter;
+	int i;
+
+	i = mb_avg_fragment_size_order(ac->ac_sb, ac->ac_g_ex.fe_len);
+	for (; i < MB_NUM_ORDERS(ac->ac_sb); i++) {
+		if (list_empty(&sbi->s_mb_avg_fragment_size[i]))
+			continue;
+		read_lock(&sbi->s_mb_avg_fragment_size_locks[i]);
+		list_for_each_entry(iter, &sbi->s_mb_avg_fragment_size[i],
+				    bb_avg_fragment_size_node) {
+			if (iter->bb_group == ac->ac_last_optimal_group ||
+			    EXT4_MB_GRP_NEED_INIT(iter) ||
+			    !ext4_mb_good_group(ac, iter->bb_group, 1))
+				continue;
+			*group = iter->bb_group;
+			read_unlock(&sbi->s_mb_avg_fragment_size_locks[i]);
+			return true;
+		}
+		read_unlock(&sbi->s_mb_avg_fragment_size_locks[i]);
+	}
+	return false;
+}
+
+static inline bool
+ext4_mb_should_optimize_scan(struct ext4_allocation_context *ac)
+{
+	if (!EXT4_SB(ac->ac_sb)->s_mb_optimize_scan)
+		return false;
+	if (ac->ac_criteria >= 2)
+		return false;
+	/* non-extent files are limited to low blocks/groups */
+	if (!ext4_test_inode_flag(ac->ac_inode, EXT4_INODE_EXTENTS))
+		return false;
+	return true;
+}
+
+/*
+ * Pick the group to try next.  For the first two criteria this jumps to a
+ * group known to be suitable, and moves on to the next criteria once the
+ * lists hold none.  Otherwise the groups are walked linearly from the goal.
+ */
+static void ext4_mb_choose_next_group(struct ext4_allocation_context *ac,
+				      int *new_cr, ext4_group_t *group,
+				      ext4_group_t ngroups)
+{
+	bool found;
+
+	*new_cr = ac->ac_criteria;
+	if (!ext4_mb_should_optimize_scan(ac)) {
+		*group = *group + 1;
+		if (*group >= ngroups)
+			*group = 0;
+		return;
+	}
+
+	if (ac->ac_criteria == 0)
+		found = ext4_mb_choose_next_group_cr0(ac, group);
+	else
+		found = ext4_mb_choose_next_group_cr1(ac, group);
+
+	if (found)
+		ac->ac_last_optimal_group = *group;
+	else
+		*new_cr = ac->ac_criteria + 1;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
 	ext4_group_t ngroups, group, i;
-	int cr;
+	int cr, new_cr;
+	struct ext4_mb_cr_stats *crs;
 	int err = 0;
 	struct ext4_sb_info *sbi;
 	struct super_block *sb;
@@ -2140,14 +2316,23 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+		ac->ac_last_optimal_group = ngroups;
+		crs = &sbi->s_mb_cr_stats[cr];
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
 		 */
 		group = ac->ac_g_ex.fe_group;
 
-		for (i = 0; i < ngroups; group++, i++) {
+		for (i = 0, new_cr = cr; i < ngroups; i++,
+		     ext4_mb_choose_next_group(ac, &new_cr, &group, ngroups)) {
 			cond_resched();
+			if (new_cr != cr) {
+				if (sbi->s_mb_stats)
+					atomic64_inc(&crs->failed);
+				cr = new_cr;
+				goto repeat;
+			}
 			/*
 			 * Artificially restricted ngroups for non-extent
 			 * files makes group > ngroups possible on first loop.
@@ -2155,6 +2340,9 @@ repeat:
 			if (group >= ngroups)
 				group = 0;
 
+			if (sbi->s_mb_stats)
+				atomic64_inc(&crs->groups_considered);
+
 			/* This now checks without needing the buddy page */
 			if (!ext4_mb_good_group(ac, group, cr))
 				continue;
@@ -2190,6 +2378,13 @@ repeat:
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
+
+		if (sbi->s_mb_stats) {
+			if (ac->ac_status == AC_STATUS_FOUND)
+				atomic64_inc(&crs->hits);
+			else if (ac->ac_status == AC_STATUS_CONTINUE)
+				atomic64_inc(&crs->failed);
+		}
 	}
 
 	if (ac->ac_b_ex.fe_len > 0 && ac->ac_status != AC_STATUS_FOUND &&
@@ -2425,6 +2620,10 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_avg_fragment_size_order = -1;  /* uninit */
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_avg_fragment_size_node);
+	meta_group_info[i]->bb_group = group;
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2595,6 +2794,29 @@ int ext4_mb_init(struct super_block *sb)
 		i++;
 	} while (i <= sb->s_blocksize_bits + 1);
 
+	i = MB_NUM_ORDERS(sb);
+	sbi->s_mb_largest_free_orders =
+		kmalloc_array(i, sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc_array(i, sizeof(rwlock_t), GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size =
+		kmalloc_array(i, sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size_locks =
+		kmalloc_array(i, sizeof(rwlock_t), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks ||
+	    !sbi->s_mb_avg_fragment_size ||
+	    !sbi->s_mb_avg_fragment_size_locks) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+		INIT_LIST_HEAD(&sbi->s_mb_avg_fragment_size[i]);
+		rwlock_init(&sbi->s_mb_avg_fragment_size_locks[i]);
+	}
+
 	spin_lock_init(&sbi->s_md_lock);
 	spin_lock_init(&sbi->s_bal_lock);
 
@@ -2603,6 +2825,7 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2659,6 +2882,14 @@ out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
 out:
+	kfree(sbi->s_mb_avg_fragment_size);
+	sbi->s_mb_avg_fragment_size = NULL;
+	kfree(sbi->s_mb_avg_fragment_size_locks);
+	sbi->s_mb_avg_fragment_size_locks = NULL;
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2714,6 +2945,10 @@ int ext4_mb_release(struct super_block *sb)
 			kfree(sbi->s_group_info[i]);
 		kvfree(sbi->s_group_info);
 	}
+	kfree(sbi->s_mb_avg_fragment_size);
+	kfree(sbi->s_mb_avg_fragment_size_locks);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
 	iput(sbi->s_buddy_cache);
@@ -2739,6 +2974,16 @@ int ext4_mb_release(struct super_block *sb)
 		       "mballoc: %u preallocated, %u discarded",
 				atomic_read(&sbi->s_mb_preallocated),
 				atomic_read(&sbi->s_mb_discarded));
+		for (i = 0; i < EXT4_MB_NUM_CRITERIA; i++) {
+			struct ext4_mb_cr_stats *st = &sbi->s_mb_cr_stats[i];
+
+			ext4_msg(sb, KERN_INFO,
+				 "mballoc: cr%u: %lld hits, %lld groups "
+				 "considered, %lld failed", i,
+				 (long long)atomic64_read(&st->hits),
+				 (long long)atomic64_read(&st->groups_considered),
+				 (long long)atomic64_read(&st->failed));
+		}
 	}
 
 	free_percpu(sbi->s_locality_groups);
@@ -89,6 +89,18 @@ extern ushort ext4_mballoc_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * use the per-order group lists instead of a linear scan for the
+ * first two criteria passes
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * number of orders tracked by the buddy, order 0 being the bitmap and
+ * the last one a whole group
+ */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* MUST be the first member */
@@ -175,6 +187,9 @@ struct ext4_allocation_context {
 	/* copy of the best found extent taken before preallocation efforts */
 	struct ext4_free_extent ac_f_ex;
 
+	/* group last picked from the per-order group lists */
+	ext4_group_t ac_last_optimal_group;
+
 	__u16 ac_groups_scanned;
 	__u16 ac_found;
 	__u16 ac_tail;
@@ -524,6 +524,8 @@ int ext4_ext_migrate(struct inode *inode)
 		retval = PTR_ERR(handle);
 		goto out;
 	}
+	/* The block map changes format, fast commits can't describe that */
+	ext4_fc_mark_ineligible(inode->i_sb, handle);
 
 	ei = EXT4_I(inode);
 	i_data = ei->i_data;
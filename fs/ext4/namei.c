@@ -33,6 +33,7 @@
 #include <linux/quotaops.h>
 #include <linux/buffer_head.h>
 #include <linux/bio.h>
+#include <linux/hash.h>
 #include "ext4.h"
 #include "ext4_jbd2.h"
 
@@ -47,6 +48,186 @@
 #define NAMEI_RA_BLOCKS  4
 #define NAMEI_RA_SIZE	     (NAMEI_RA_CHUNKS * NAMEI_RA_BLOCKS)
 
+/*
+ * Parallel directory operations
+ *
+ * With the pdirops mount option, htree directories are marked S_PDIROPS
+ * and the VFS calls lookup, create and unlink on them without i_mutex,
+ * only keeping operations on the same name apart.  These take dl_sem of
+ * the directory shared, everything else that changes the directory or
+ * needs a stable view of it still holds i_mutex and takes dl_sem
+ * exclusive.  A directory that is (no longer) indexed has dl_sem taken
+ * exclusive by lookup, create and unlink as well.  dl_sem ranks with
+ * i_mutex and is taken before the journal handle is started.
+ *
+ * Under dl_sem shared, the index is walked with dl_index held shared and
+ * a leaf block is only read or changed under the leaf lock its number
+ * hashes to.  Splitting a leaf, or falling back to a linear scan, takes
+ * dl_index exclusive, which keeps everybody else off both the index and
+ * the leaves.  dl_index and the leaf locks are taken inside a handle and
+ * dropped before it is stopped, at most one leaf lock is held at a time.
+ */
+struct ext4_dir_ctx {
+	struct ext4_dir_lock	*dc_dl;
+	bool			dc_shared;	/* dl_sem held shared */
+	int			dc_index;	/* DX_LOCK_* held on dl_index */
+	int			dc_leaf;	/* leaf lock held, or -1 */
+};
+
+#define DX_LOCK_NONE	0
+#define DX_LOCK_SHARED	1
+#define DX_LOCK_EXCL	2
+
+/*
+ * Let lookups, creates and unlinks in @dir run in parallel.  Called for a
+ * directory nobody else can see yet, or with i_mutex held on one that
+ * isn't S_PDIROPS, so no other operation is running on it.
+ */
+void ext4_dir_init_pdirops(struct inode *dir)
+{
+	struct ext4_dir_lock *dl;
+	int i;
+
+	if (!test_opt(dir->i_sb, PDIROPS) || EXT4_I(dir)->i_dir_lock ||
+	    !is_dx(dir) || ext4_has_inline_data(dir))
+		return;
+
+	dl = kmalloc(sizeof(*dl), GFP_NOFS);
+	if (!dl)
+		return;		/* stays serialized by i_mutex */
+	init_rwsem(&dl->dl_sem);
+	init_rwsem(&dl->dl_index);
+	for (i = 0; i < EXT4_DIR_LEAF_LOCKS; i++)
+		mutex_init(&dl->dl_leaf[i]);
+	EXT4_I(dir)->i_dir_lock = dl;
+	inode_set_flags(dir, S_PDIROPS, S_PDIROPS);
+}
+
+/*
+ * Keep lookups, creates and unlinks out of @dir.  Returns the lock to
+ * hand to ext4_dir_write_unlock(), the caller holds i_mutex which
+ * already does it if there is none.
+ */
+struct ext4_dir_lock *ext4_dir_write_lock(struct inode *dir,
+					  unsigned int subclass)
+{
+	struct ext4_dir_lock *dl = EXT4_I(dir)->i_dir_lock;
+
+	if (dl)
+		down_write_nested(&dl->dl_sem, subclass);
+	return dl;
+}
+
+void ext4_dir_write_unlock(struct ext4_dir_lock *dl)
+{
+	if (dl)
+		up_write(&dl->dl_sem);
+}
+
+/* Start a lookup, create or unlink in @dir */
+static void ext4_dir_lock(struct inode *dir, struct ext4_dir_ctx *dc)
+{
+	struct ext4_dir_lock *dl = EXT4_I(dir)->i_dir_lock;
+
+	dc->dc_dl = dl;
+	dc->dc_shared = false;
+	dc->dc_index = DX_LOCK_NONE;
+	dc->dc_leaf = -1;
+	if (!dl)
+		return;
+	down_read(&dl->dl_sem);
+	if (is_dx(dir)) {
+		dc->dc_shared = true;
+		return;
+	}
+	up_read(&dl->dl_sem);
+	down_write(&dl->dl_sem);
+}
+
+static void ext4_dir_leaf_unlock(struct ext4_dir_ctx *dc)
+{
+	if (dc->dc_leaf < 0)
+		return;
+	mutex_unlock(&dc->dc_dl->dl_leaf[dc->dc_leaf]);
+	dc->dc_leaf = -1;
+}
+
+/* Drop the index and leaf locks, to be done before stopping the handle */
+static void ext4_dir_index_unlock(struct ext4_dir_ctx *dc)
+{
+	if (!dc)
+		return;
+	ext4_dir_leaf_unlock(dc);
+	if (dc->dc_index == DX_LOCK_SHARED)
+		up_read(&dc->dc_dl->dl_index);
+	else if (dc->dc_index == DX_LOCK_EXCL)
+		up_write(&dc->dc_dl->dl_index);
+	dc->dc_index = DX_LOCK_NONE;
+}
+
+static void ext4_dir_unlock(struct ext4_dir_ctx *dc)
+{
+	struct ext4_dir_lock *dl = dc->dc_dl;
+
+	if (!dl)
+		return;
+	ext4_dir_index_unlock(dc);
+	if (dc->dc_shared)
+		up_read(&dl->dl_sem);
+	else
+		up_write(&dl->dl_sem);
+}
+
+/*
+ * Hold the index in @mode, or stronger.  Going from shared to exclusive
+ * drops the index in between, so whatever was read under it is stale.
+ */
+static void ext4_dir_index_lock(struct ext4_dir_ctx *dc, int mode)
+{
+	if (!dc || !dc->dc_shared || dc->dc_index >= mode)
+		return;
+	ext4_dir_index_unlock(dc);
+	if (mode == DX_LOCK_EXCL)
+		down_write(&dc->dc_dl->dl_index);
+	else
+		down_read(&dc->dc_dl->dl_index);
+	dc->dc_index = mode;
+}
+
+static inline bool ext4_dir_index_shared(struct ext4_dir_ctx *dc)
+{
+	return dc && dc->dc_index == DX_LOCK_SHARED;
+}
+
+/* Lock leaf @block, the caller holds the index shared */
+static void ext4_dir_leaf_lock(struct ext4_dir_ctx *dc, ext4_lblk_t block)
+{
+	int leaf;
+
+	if (!ext4_dir_index_shared(dc))
+		return;
+	leaf = hash_32(block, EXT4_DIR_LEAF_LOCK_BITS);
+	if (leaf == dc->dc_leaf)
+		return;
+	ext4_dir_leaf_unlock(dc);
+	mutex_lock(&dc->dc_dl->dl_leaf[leaf]);
+	dc->dc_leaf = leaf;
+}
+
+/*
+ * Operations holding i_mutex only race with those holding the name lock
+ * on the same dentry, and a create into a directory being removed only
+ * shows up once we have its lock.
+ */
+static int ext4_dir_check_create(struct inode *dir, struct dentry *dentry)
+{
+	if (!dir->i_nlink)
+		return -ENOENT;
+	if (d_really_is_positive(dentry))
+		return -EEXIST;
+	return 0;
+}
+
 static struct buffer_head *ext4_append(handle_t *handle,
 					struct inode *inode,
 					ext4_lblk_t *block)
@@ -268,9 +449,9 @@ static int ext4_htree_next_block(struct inode *dir, __u32 hash,
 				 __u32 *start_hash);
 static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 		const struct qstr *d_name,
-		struct ext4_dir_entry_2 **res_dir);
+		struct ext4_dir_entry_2 **res_dir, struct ext4_dir_ctx *dc);
 static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
-			     struct inode *inode);
+			     struct inode *inode, struct ext4_dir_ctx *dc);
 
 /* checksumming functions */
 void initialize_dirent_tail(struct ext4_dir_entry_tail *t,
@@ -1051,8 +1232,9 @@ errout:
  * This function returns the number of entries inserted into the tree,
  * or a negative error code.
  */
-int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
-			 __u32 start_minor_hash, __u32 *next_hash)
+static int __ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
+				  __u32 start_minor_hash, __u32 *next_hash,
+				  struct ext4_dir_ctx *dc)
 {
 	struct dx_hash_info hinfo;
 	struct ext4_dir_entry_2 *de;
@@ -1091,6 +1273,7 @@ int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 	}
 	hinfo.hash = start_hash;
 	hinfo.minor_hash = 0;
+	ext4_dir_index_lock(dc, DX_LOCK_SHARED);
 	frame = dx_probe(NULL, dir, &hinfo, frames);
 	if (IS_ERR(frame))
 		return PTR_ERR(frame);
@@ -1120,6 +1303,7 @@ int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 
 	while (1) {
 		block = dx_get_block(frame->at);
+		ext4_dir_leaf_lock(dc, block);
 		ret = htree_dirblock_to_tree(dir_file, dir, block, &hinfo,
 					     start_hash, start_minor_hash);
 		if (ret < 0) {
@@ -1153,6 +1337,19 @@ errout:
 	return (err);
 }
 
+int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
+			 __u32 start_minor_hash, __u32 *next_hash)
+{
+	struct ext4_dir_ctx dc;
+	int ret;
+
+	ext4_dir_lock(file_inode(dir_file), &dc);
+	ret = __ext4_htree_fill_tree(dir_file, start_hash, start_minor_hash,
+				     next_hash, &dc);
+	ext4_dir_unlock(&dc);
+	return ret;
+}
+
 static inline int search_dirblock(struct buffer_head *bh,
 				  struct inode *dir,
 				  const struct qstr *d_name,
@@ -1353,11 +1550,16 @@ static int is_dx_internal_node(struct inode *dir, ext4_lblk_t block,
  *
  * The returned buffer_head has ->b_count elevated.  The caller is expected
  * to brelse() it when appropriate.
+ *
+ * With @dc from ext4_dir_lock(), the block found stays locked until the
+ * caller drops the index.  A NULL @dc means the directory is the
+ * caller's alone.
  */
 static struct buffer_head * ext4_find_entry (struct inode *dir,
 					const struct qstr *d_name,
 					struct ext4_dir_entry_2 **res_dir,
-					int *inlined)
+					int *inlined,
+					struct ext4_dir_ctx *dc)
 {
 	struct super_block *sb;
 	struct buffer_head *bh_use[NAMEI_RA_SIZE];
@@ -1397,10 +1599,11 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 		 */
 		block = start = 0;
 		nblocks = 1;
+		ext4_dir_index_lock(dc, DX_LOCK_EXCL);
 		goto restart;
 	}
 	if (is_dx(dir)) {
-		bh = ext4_dx_find_entry(dir, d_name, res_dir);
+		bh = ext4_dx_find_entry(dir, d_name, res_dir, dc);
 		/*
 		 * On success, or if the error was file not found,
 		 * return.  Otherwise, fall back to doing a search the
@@ -1411,6 +1614,8 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 		dxtrace(printk(KERN_DEBUG "ext4_find_entry: dx failed, "
 			       "falling back\n"));
 	}
+	/* The linear scan goes through leaves and index blocks alike */
+	ext4_dir_index_lock(dc, DX_LOCK_EXCL);
 	nblocks = dir->i_size >> EXT4_BLOCK_SIZE_BITS(sb);
 	start = EXT4_I(dir)->i_dir_start_lookup;
 	if (start >= nblocks)
@@ -1504,7 +1709,8 @@ cleanup_and_exit:
 }
 
 static struct buffer_head * ext4_dx_find_entry(struct inode *dir, const struct qstr *d_name,
-		       struct ext4_dir_entry_2 **res_dir)
+		       struct ext4_dir_entry_2 **res_dir,
+		       struct ext4_dir_ctx *dc)
 {
 	struct super_block * sb = dir->i_sb;
 	struct dx_hash_info	hinfo;
@@ -1516,11 +1722,13 @@ static struct buffer_head * ext4_dx_find_entry(struct inode *dir, const struct q
 #ifdef CONFIG_EXT4_FS_ENCRYPTION
 	*res_dir = NULL;
 #endif
+	ext4_dir_index_lock(dc, DX_LOCK_SHARED);
 	frame = dx_probe(d_name, dir, &hinfo, frames);
 	if (IS_ERR(frame))
 		return (struct buffer_head *) frame;
 	do {
 		block = dx_get_block(frame->at);
+		ext4_dir_leaf_lock(dc, block);
 		bh = ext4_read_dirblock(dir, block, DIRENT);
 		if (IS_ERR(bh))
 			goto errout;
@@ -1561,16 +1769,22 @@ static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, unsi
 	struct inode *inode;
 	struct ext4_dir_entry_2 *de;
 	struct buffer_head *bh;
+	struct ext4_dir_ctx dc;
+	__u32 ino = 0;
 
 	if (dentry->d_name.len > EXT4_NAME_LEN)
 		return ERR_PTR(-ENAMETOOLONG);
 
-	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL);
+	ext4_dir_init_pdirops(dir);
+	ext4_dir_lock(dir, &dc);
+	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL, &dc);
+	if (!IS_ERR_OR_NULL(bh))
+		ino = le32_to_cpu(de->inode);
+	ext4_dir_unlock(&dc);
 	if (IS_ERR(bh))
 		return (struct dentry *) bh;
 	inode = NULL;
 	if (bh) {
-		__u32 ino = le32_to_cpu(de->inode);
 		brelse(bh);
 		if (!ext4_valid_inum(dir->i_sb, ino)) {
 			EXT4_ERROR_INODE(dir, "bad inode number: %u", ino);
@@ -1607,18 +1821,23 @@ static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, unsi
 
 struct dentry *ext4_get_parent(struct dentry *child)
 {
-	__u32 ino;
+	__u32 ino = 0;
 	static const struct qstr dotdot = QSTR_INIT("..", 2);
 	struct ext4_dir_entry_2 * de;
+	struct ext4_dir_lock *dl;
 	struct buffer_head *bh;
 
-	bh = ext4_find_entry(d_inode(child), &dotdot, &de, NULL);
+	dl = ext4_dir_write_lock(d_inode(child), 0);
+	bh = ext4_find_entry(d_inode(child), &dotdot, &de, NULL, NULL);
+	if (!IS_ERR_OR_NULL(bh)) {
+		ino = le32_to_cpu(de->inode);
+		brelse(bh);
+	}
+	ext4_dir_write_unlock(dl);
 	if (IS_ERR(bh))
 		return (struct dentry *) bh;
 	if (!bh)
 		return ERR_PTR(-ENOENT);
-	ino = le32_to_cpu(de->inode);
-	brelse(bh);
 
 	if (!ext4_valid_inum(d_inode(child)->i_sb, ino)) {
 		EXT4_ERROR_INODE(d_inode(child),
@@ -2140,7 +2359,7 @@ out_frames:
  * the entry, as someone else might have used it while you slept.
  */
 static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
-			  struct inode *inode)
+			  struct inode *inode, struct ext4_dir_ctx *dc)
 {
 	struct inode *dir = d_inode(dentry->d_parent);
 	struct buffer_head *bh = NULL;
@@ -2172,13 +2391,15 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	}
 
 	if (is_dx(dir)) {
-		retval = ext4_dx_add_entry(handle, dentry, inode);
+		retval = ext4_dx_add_entry(handle, dentry, inode, dc);
 		if (!retval || (retval != ERR_BAD_DX_DIR))
 			goto out;
+		ext4_dir_index_lock(dc, DX_LOCK_EXCL);
 		ext4_clear_inode_flag(dir, EXT4_INODE_INDEX);
 		dx_fallback++;
 		ext4_mark_inode_dirty(handle, dir);
 	}
+	ext4_dir_index_lock(dc, DX_LOCK_EXCL);
 	blocks = dir->i_size >> sb->s_blocksize_bits;
 	for (block = 0; block < blocks; block++) {
 		bh = ext4_read_dirblock(dir, block, DIRENT);
@@ -2221,7 +2442,7 @@ out:
  * Returns 0 for success, or a negative error value
  */
 static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
-			     struct inode *inode)
+			     struct inode *inode, struct ext4_dir_ctx *dc)
 {
 	struct dx_frame frames[2], *frame;
 	struct dx_entry *entries, *at;
@@ -2232,11 +2453,14 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 	struct ext4_dir_entry_2 *de;
 	int err;
 
+again:
+	ext4_dir_index_lock(dc, DX_LOCK_SHARED);
 	frame = dx_probe(&dentry->d_name, dir, &hinfo, frames);
 	if (IS_ERR(frame))
 		return PTR_ERR(frame);
 	entries = frame->entries;
 	at = frame->at;
+	ext4_dir_leaf_lock(dc, dx_get_block(frame->at));
 	bh = ext4_read_dirblock(dir, dx_get_block(frame->at), DIRENT);
 	if (IS_ERR(bh)) {
 		err = PTR_ERR(bh);
@@ -2253,6 +2477,14 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 	if (err != -ENOSPC)
 		goto cleanup;
 
+	if (ext4_dir_index_shared(dc)) {
+		/* Splitting changes the index, that needs it exclusive */
+		brelse(bh);
+		dx_release(frames);
+		ext4_dir_index_lock(dc, DX_LOCK_EXCL);
+		goto again;
+	}
+
 	/* Block full, should compress but for now just split */
 	dxtrace(printk(KERN_DEBUG "using %u of %u node entries\n",
 		       dx_get_count(entries), dx_get_limit(entries)));
@@ -2473,10 +2705,82 @@ static void ext4_dec_count(handle_t *handle, struct inode *inode)
 }
 
 
-static int ext4_add_nondir(handle_t *handle,
-		struct dentry *dentry, struct inode *inode)
+/*
+ * Fast commit replay: add the entry @name for @inode to @dir unless it is
+ * already there.  ext4_add_entry() wants a dentry, so build a temporary
+ * one that never gets instantiated.  Returns 1 if the entry was added, 0
+ * if it was already there.
+ */
+int ext4_fc_replay_link_entry(handle_t *handle, struct inode *dir,
+			      struct inode *inode, const struct qstr *name)
 {
-	int err = ext4_add_entry(handle, dentry, inode);
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+	struct dentry *parent, *dentry;
+	int err;
+
+	bh = ext4_find_entry(dir, name, &de, NULL, NULL);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+	if (bh) {
+		err = le32_to_cpu(de->inode) == inode->i_ino ? 0 : -EEXIST;
+		brelse(bh);
+		return err;
+	}
+
+	parent = d_obtain_alias(igrab(dir));
+	if (IS_ERR(parent))
+		return PTR_ERR(parent);
+	dentry = d_alloc(parent, name);
+	if (!dentry) {
+		dput(parent);
+		return -ENOMEM;
+	}
+	err = ext4_add_entry(handle, dentry, inode, NULL);
+	if (!err) {
+		dir->i_ctime = dir->i_mtime = ext4_current_time(dir);
+		ext4_mark_inode_dirty(handle, dir);
+		err = 1;
+	}
+	dput(dentry);
+	dput(parent);
+	return err;
+}
+
+/*
+ * Fast commit replay: remove the entry @name for @inode from @dir.
+ * Returns 1 if the entry was removed, 0 if it was already gone.
+ */
+int ext4_fc_replay_unlink_entry(handle_t *handle, struct inode *dir,
+				struct inode *inode, const struct qstr *name)
+{
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+	int err;
+
+	bh = ext4_find_entry(dir, name, &de, NULL, NULL);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+	if (!bh)
+		return 0;
+	if (le32_to_cpu(de->inode) != inode->i_ino) {
+		brelse(bh);
+		return 0;
+	}
+	err = ext4_delete_entry(handle, dir, de, bh);
+	brelse(bh);
+	if (err)
+		return err;
+	dir->i_ctime = dir->i_mtime = ext4_current_time(dir);
+	ext4_update_dx_flag(dir);
+	ext4_mark_inode_dirty(handle, dir);
+	return 1;
+}
+
+static int ext4_add_nondir(handle_t *handle, struct dentry *dentry,
+			   struct inode *inode, struct ext4_dir_ctx *dc)
+{
+	int err = ext4_add_entry(handle, dentry, inode, dc);
 	if (!err) {
 		ext4_mark_inode_dirty(handle, inode);
 		unlock_new_inode(inode);
@@ -2502,12 +2806,17 @@ static int ext4_create(struct inode *dir, struct dentry *dentry, umode_t mode,
 {
 	handle_t *handle;
 	struct inode *inode;
+	struct ext4_dir_ctx dc;
 	int err, credits, retries = 0;
 
 	dquot_initialize(dir);
 
 	credits = (EXT4_DATA_TRANS_BLOCKS(dir->i_sb) +
 		   EXT4_INDEX_EXTRA_TRANS_BLOCKS + 3);
+	ext4_dir_lock(dir, &dc);
+	err = ext4_dir_check_create(dir, dentry);
+	if (err)
+		goto out;
 retry:
 	inode = ext4_new_inode_start_handle(dir, mode, &dentry->d_name, 0,
 					    NULL, EXT4_HT_DIR, credits);
@@ -2530,14 +2839,19 @@ retry:
 		}
 #endif
 		if (!err)
-			err = ext4_add_nondir(handle, dentry, inode);
+			err = ext4_add_nondir(handle, dentry, inode, &dc);
+		if (!err)
+			ext4_fc_track_create(handle, dentry);
 		if (!err && IS_DIRSYNC(dir))
 			ext4_handle_sync(handle);
 	}
+	ext4_dir_index_unlock(&dc);
 	if (handle)
 		ext4_journal_stop(handle);
 	if (err == -ENOSPC && ext4_should_retry_alloc(dir->i_sb, &retries))
 		goto retry;
+out:
+	ext4_dir_unlock(&dc);
 	return err;
 }
 
@@ -2546,6 +2860,7 @@ static int ext4_mknod(struct inode *dir, struct dentry *dentry,
 {
 	handle_t *handle;
 	struct inode *inode;
+	struct ext4_dir_lock *dl;
 	int err, credits, retries = 0;
 
 	if (!new_valid_dev(rdev))
@@ -2555,6 +2870,10 @@ static int ext4_mknod(struct inode *dir, struct dentry *dentry,
 
 	credits = (EXT4_DATA_TRANS_BLOCKS(dir->i_sb) +
 		   EXT4_INDEX_EXTRA_TRANS_BLOCKS + 3);
+	dl = ext4_dir_write_lock(dir, 0);
+	err = ext4_dir_check_create(dir, dentry);
+	if (err)
+		goto out;
 retry:
 	inode = ext4_new_inode_start_handle(dir, mode, &dentry->d_name, 0,
 					    NULL, EXT4_HT_DIR, credits);
@@ -2563,7 +2882,7 @@ retry:
 	if (!IS_ERR(inode)) {
 		init_special_inode(inode, inode->i_mode, rdev);
 		inode->i_op = &ext4_special_inode_operations;
-		err = ext4_add_nondir(handle, dentry, inode);
+		err = ext4_add_nondir(handle, dentry, inode, NULL);
 		if (!err && IS_DIRSYNC(dir))
 			ext4_handle_sync(handle);
 	}
@@ -2571,6 +2890,8 @@ retry:
 		ext4_journal_stop(handle);
 	if (err == -ENOSPC && ext4_should_retry_alloc(dir->i_sb, &retries))
 		goto retry;
+out:
+	ext4_dir_write_unlock(dl);
 	return err;
 }
 
@@ -2688,6 +3009,7 @@ static int ext4_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 {
 	handle_t *handle;
 	struct inode *inode;
+	struct ext4_dir_lock *dl;
 	int err, credits, retries = 0;
 
 	if (EXT4_DIR_LINK_MAX(dir))
@@ -2697,6 +3019,10 @@ static int ext4_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 
 	credits = (EXT4_DATA_TRANS_BLOCKS(dir->i_sb) +
 		   EXT4_INDEX_EXTRA_TRANS_BLOCKS + 3);
+	dl = ext4_dir_write_lock(dir, 0);
+	err = ext4_dir_check_create(dir, dentry);
+	if (err)
+		goto out_unlock;
 retry:
 	inode = ext4_new_inode_start_handle(dir, S_IFDIR | mode,
 					    &dentry->d_name,
@@ -2721,7 +3047,7 @@ retry:
 #endif
 	err = ext4_mark_inode_dirty(handle, inode);
 	if (!err)
-		err = ext4_add_entry(handle, dentry, inode);
+		err = ext4_add_entry(handle, dentry, inode, NULL);
 	if (err) {
 out_clear_inode:
 		clear_nlink(inode);
@@ -2745,6 +3071,8 @@ out_stop:
 		ext4_journal_stop(handle);
 	if (err == -ENOSPC && ext4_should_retry_alloc(dir->i_sb, &retries))
 		goto retry;
+out_unlock:
+	ext4_dir_write_unlock(dl);
 	return err;
 }
 
@@ -2998,6 +3326,7 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 	struct inode *inode;
 	struct buffer_head *bh;
 	struct ext4_dir_entry_2 *de;
+	struct ext4_dir_lock *dl, *victim_dl;
 	handle_t *handle = NULL;
 
 	/* Initialize quotas before so that eventual writes go in
@@ -3005,10 +3334,15 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 	dquot_initialize(dir);
 	dquot_initialize(d_inode(dentry));
 
+	dl = ext4_dir_write_lock(dir, 0);
+	victim_dl = ext4_dir_write_lock(d_inode(dentry), 1);
 	retval = -ENOENT;
-	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL);
-	if (IS_ERR(bh))
-		return PTR_ERR(bh);
+	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL, NULL);
+	if (IS_ERR(bh)) {
+		retval = PTR_ERR(bh);
+		bh = NULL;
+		goto end_rmdir;
+	}
 	if (!bh)
 		goto end_rmdir;
 
@@ -3032,6 +3366,7 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 
 	if (IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 
 	retval = ext4_delete_entry(handle, dir, de, bh);
 	if (retval)
@@ -3057,6 +3392,8 @@ end_rmdir:
 	brelse(bh);
 	if (handle)
 		ext4_journal_stop(handle);
+	ext4_dir_write_unlock(victim_dl);
+	ext4_dir_write_unlock(dl);
 	return retval;
 }
 
@@ -3064,8 +3401,9 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 {
 	int retval;
 	struct inode *inode;
-	struct buffer_head *bh;
+	struct buffer_head *bh = NULL;
 	struct ext4_dir_entry_2 *de;
+	struct ext4_dir_ctx dc;
 	handle_t *handle = NULL;
 
 	trace_ext4_unlink_enter(dir, dentry);
@@ -3074,10 +3412,27 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	dquot_initialize(dir);
 	dquot_initialize(d_inode(dentry));
 
+	/*
+	 * Start the handle before looking the entry up: the block it is
+	 * found in may stay locked until the entry is deleted, and such
+	 * locks are only taken inside a handle.
+	 */
+	ext4_dir_lock(dir, &dc);
+	handle = ext4_journal_start(dir, EXT4_HT_DIR,
+				    EXT4_DATA_TRANS_BLOCKS(dir->i_sb));
+	if (IS_ERR(handle)) {
+		retval = PTR_ERR(handle);
+		handle = NULL;
+		goto end_unlink;
+	}
+
 	retval = -ENOENT;
-	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL);
-	if (IS_ERR(bh))
-		return PTR_ERR(bh);
+	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL, &dc);
+	if (IS_ERR(bh)) {
+		retval = PTR_ERR(bh);
+		bh = NULL;
+		goto end_unlink;
+	}
 	if (!bh)
 		goto end_unlink;
 
@@ -3087,14 +3442,6 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	if (le32_to_cpu(de->inode) != inode->i_ino)
 		goto end_unlink;
 
-	handle = ext4_journal_start(dir, EXT4_HT_DIR,
-				    EXT4_DATA_TRANS_BLOCKS(dir->i_sb));
-	if (IS_ERR(handle)) {
-		retval = PTR_ERR(handle);
-		handle = NULL;
-		goto end_unlink;
-	}
-
 	if (IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
 
@@ -3115,17 +3462,20 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 		ext4_orphan_add(handle, inode);
 	inode->i_ctime = ext4_current_time(inode);
 	ext4_mark_inode_dirty(handle, inode);
+	ext4_fc_track_unlink(handle, dentry);
 
 end_unlink:
 	brelse(bh);
+	ext4_dir_index_unlock(&dc);
 	if (handle)
 		ext4_journal_stop(handle);
+	ext4_dir_unlock(&dc);
 	trace_ext4_unlink_exit(dentry, retval);
 	return retval;
 }
 
-static int ext4_symlink(struct inode *dir,
-			struct dentry *dentry, const char *symname)
+static int __ext4_symlink(struct inode *dir,
+			  struct dentry *dentry, const char *symname)
 {
 	handle_t *handle;
 	struct inode *inode;
@@ -3249,15 +3599,18 @@ static int ext4_symlink(struct inode *dir,
 	} else {
 		/* clear the extent format for fast symlink */
 		ext4_clear_inode_flag(inode, EXT4_INODE_EXTENTS);
-		inode->i_op = encryption_required ?
-			&ext4_symlink_inode_operations :
-			&ext4_fast_symlink_inode_operations;
+		if (encryption_required) {
+			inode->i_op = &ext4_symlink_inode_operations;
+		} else {
+			inode->i_op = &ext4_fast_symlink_inode_operations;
+			inode->i_link = (char *)&EXT4_I(inode)->i_data;
+		}
 		memcpy((char *)&EXT4_I(inode)->i_data, disk_link.name,
 		       disk_link.len);
 		inode->i_size = disk_link.len - 1;
 	}
 	EXT4_I(inode)->i_disksize = inode->i_size;
-	err = ext4_add_nondir(handle, dentry, inode);
+	err = ext4_add_nondir(handle, dentry, inode, NULL);
 	if (!err && IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
 
@@ -3275,11 +3628,26 @@ err_drop_inode:
 	return err;
 }
 
+static int ext4_symlink(struct inode *dir,
+			struct dentry *dentry, const char *symname)
+{
+	struct ext4_dir_lock *dl;
+	int err;
+
+	dl = ext4_dir_write_lock(dir, 0);
+	err = ext4_dir_check_create(dir, dentry);
+	if (!err)
+		err = __ext4_symlink(dir, dentry, symname);
+	ext4_dir_write_unlock(dl);
+	return err;
+}
+
 static int ext4_link(struct dentry *old_dentry,
 		     struct inode *dir, struct dentry *dentry)
 {
 	handle_t *handle;
 	struct inode *inode = d_inode(old_dentry);
+	struct ext4_dir_lock *dl;
 	int err, retries = 0;
 
 	if (inode->i_nlink >= EXT4_LINK_MAX)
@@ -3289,12 +3657,18 @@ static int ext4_link(struct dentry *old_dentry,
 		return -EPERM;
 	dquot_initialize(dir);
 
+	dl = ext4_dir_write_lock(dir, 0);
+	err = ext4_dir_check_create(dir, dentry);
+	if (err)
+		goto out;
 retry:
 	handle = ext4_journal_start(dir, EXT4_HT_DIR,
 		(EXT4_DATA_TRANS_BLOCKS(dir->i_sb) +
 		 EXT4_INDEX_EXTRA_TRANS_BLOCKS) + 1);
-	if (IS_ERR(handle))
-		return PTR_ERR(handle);
+	if (IS_ERR(handle)) {
+		err = PTR_ERR(handle);
+		goto out;
+	}
 
 	if (IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
@@ -3303,15 +3677,18 @@ retry:
 	ext4_inc_count(handle, inode);
 	ihold(inode);
 
-	err = ext4_add_entry(handle, dentry, inode);
+	err = ext4_add_entry(handle, dentry, inode, NULL);
 	if (!err) {
 		ext4_mark_inode_dirty(handle, inode);
 		/* this can happen only for tmpfile being
 		 * linked the first time
 		 */
-		if (inode->i_nlink == 1)
+		if (inode->i_nlink == 1) {
 			ext4_orphan_del(handle, inode);
+			ext4_fc_mark_ineligible(inode->i_sb, handle);
+		}
 		d_instantiate(dentry, inode);
+		ext4_fc_track_link(handle, dentry);
 	} else {
 		drop_nlink(inode);
 		iput(inode);
@@ -3319,6 +3696,8 @@ retry:
 	ext4_journal_stop(handle);
 	if (err == -ENOSPC && ext4_should_retry_alloc(dir->i_sb, &retries))
 		goto retry;
+out:
+	ext4_dir_write_unlock(dl);
 	return err;
 }
 
@@ -3451,7 +3830,7 @@ static int ext4_find_delete_entry(handle_t *handle, struct inode *dir,
 	struct buffer_head *bh;
 	struct ext4_dir_entry_2 *de;
 
-	bh = ext4_find_entry(dir, d_name, &de, NULL);
+	bh = ext4_find_entry(dir, d_name, &de, NULL, NULL);
 	if (IS_ERR(bh))
 		return PTR_ERR(bh);
 	if (bh) {
@@ -3574,7 +3953,8 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	if (new.inode)
 		dquot_initialize(new.inode);
 
-	old.bh = ext4_find_entry(old.dir, &old.dentry->d_name, &old.de, NULL);
+	old.bh = ext4_find_entry(old.dir, &old.dentry->d_name, &old.de, NULL,
+				 NULL);
 	if (IS_ERR(old.bh))
 		return PTR_ERR(old.bh);
 	/*
@@ -3596,7 +3976,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	}
 
 	new.bh = ext4_find_entry(new.dir, &new.dentry->d_name,
-				 &new.de, &new.inlined);
+				 &new.de, &new.inlined, NULL);
 	if (IS_ERR(new.bh)) {
 		retval = PTR_ERR(new.bh);
 		new.bh = NULL;
@@ -3631,6 +4011,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(old.dir->i_sb, handle);
 
 	if (S_ISDIR(old.inode->i_mode)) {
 		if (new.inode) {
@@ -3669,7 +4050,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 		ext4_mark_inode_dirty(handle, whiteout);
 	}
 	if (!new.bh) {
-		retval = ext4_add_entry(handle, new.dentry, old.inode);
+		retval = ext4_add_entry(handle, new.dentry, old.inode, NULL);
 		if (retval)
 			goto end_rename;
 	} else {
@@ -3763,7 +4144,7 @@ static int ext4_cross_rename(struct inode *old_dir, struct dentry *old_dentry,
 	dquot_initialize(new.dir);
 
 	old.bh = ext4_find_entry(old.dir, &old.dentry->d_name,
-				 &old.de, &old.inlined);
+				 &old.de, &old.inlined, NULL);
 	if (IS_ERR(old.bh))
 		return PTR_ERR(old.bh);
 	/*
@@ -3777,7 +4158,7 @@ static int ext4_cross_rename(struct inode *old_dir, struct dentry *old_dentry,
 		goto end_rename;
 
 	new.bh = ext4_find_entry(new.dir, &new.dentry->d_name,
-				 &new.de, &new.inlined);
+				 &new.de, &new.inlined, NULL);
 	if (IS_ERR(new.bh)) {
 		retval = PTR_ERR(new.bh);
 		new.bh = NULL;
@@ -3799,6 +4180,7 @@ static int ext4_cross_rename(struct inode *old_dir, struct dentry *old_dentry,
 
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(old.dir->i_sb, handle);
 
 	if (S_ISDIR(old.inode->i_mode)) {
 		old.is_dir = true;
@@ -3868,19 +4250,50 @@ end_rename:
 	return retval;
 }
 
+/*
+ * Keep lookups, creates and unlinks out of every directory a rename
+ * touches: the parents, and directories moved or replaced, whose ".."
+ * changes or which go away.
+ */
+static void ext4_rename_lock(struct inode *old_dir, struct dentry *old_dentry,
+			     struct inode *new_dir, struct dentry *new_dentry,
+			     struct ext4_dir_lock **dl)
+{
+	struct inode *old_inode = d_inode(old_dentry);
+	struct inode *new_inode = d_inode(new_dentry);
+
+	dl[0] = ext4_dir_write_lock(old_dir, 0);
+	dl[1] = NULL;
+	if (new_dir != old_dir)
+		dl[1] = ext4_dir_write_lock(new_dir, 1);
+	dl[2] = NULL;
+	if (S_ISDIR(old_inode->i_mode))
+		dl[2] = ext4_dir_write_lock(old_inode, 2);
+	dl[3] = NULL;
+	if (new_inode && S_ISDIR(new_inode->i_mode))
+		dl[3] = ext4_dir_write_lock(new_inode, 3);
+}
+
 static int ext4_rename2(struct inode *old_dir, struct dentry *old_dentry,
 			struct inode *new_dir, struct dentry *new_dentry,
 			unsigned int flags)
 {
+	struct ext4_dir_lock *dl[4];
+	int i, err;
+
 	if (flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE | RENAME_WHITEOUT))
 		return -EINVAL;
 
-	if (flags & RENAME_EXCHANGE) {
-		return ext4_cross_rename(old_dir, old_dentry,
-					 new_dir, new_dentry);
-	}
-
-	return ext4_rename(old_dir, old_dentry, new_dir, new_dentry, flags);
+	ext4_rename_lock(old_dir, old_dentry, new_dir, new_dentry, dl);
+	if (flags & RENAME_EXCHANGE)
+		err = ext4_cross_rename(old_dir, old_dentry,
+					new_dir, new_dentry);
+	else
+		err = ext4_rename(old_dir, old_dentry, new_dir, new_dentry,
+				  flags);
+	for (i = 3; i >= 0; i--)
+		ext4_dir_write_unlock(dl[i]);
+	return err;
 }
 
 /*
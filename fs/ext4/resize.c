@@ -53,6 +53,11 @@ int ext4_resize_begin(struct super_block *sb)
 
 void ext4_resize_end(struct super_block *sb)
 {
+	/*
+	 * Fast commits are refused while EXT4_RESIZING is set, make sure the
+	 * transaction with the last resize changes is committed in full too.
+	 */
+	ext4_fc_mark_ineligible(sb, NULL);
 	clear_bit_unlock(EXT4_RESIZING, &EXT4_SB(sb)->s_resize_flags);
 	smp_mb__after_atomic();
 }
@@ -788,6 +788,7 @@ static void ext4_put_super(struct super_block *sb)
 		if (err < 0)
 			ext4_abort(sb, "Couldn't clean up the journal");
 	}
+	ext4_fc_destroy(sb);
 
 	ext4_es_unregister_shrinker(sbi);
 	del_timer_sync(&sbi->s_err_report);
@@ -896,10 +897,15 @@ static struct inode *ext4_alloc_inode(struct super_block *sb)
 	memset(&ei->i_dquot, 0, sizeof(ei->i_dquot));
 #endif
 	ei->jinode = NULL;
+	ei->i_dir_lock = NULL;
 	INIT_LIST_HEAD(&ei->i_rsv_conversion_list);
 	spin_lock_init(&ei->i_completed_io_lock);
 	ei->i_sync_tid = 0;
 	ei->i_datasync_tid = 0;
+	INIT_LIST_HEAD(&ei->i_fc_list);
+	INIT_LIST_HEAD(&ei->i_fc_commit_list);
+	ei->i_fc_lblk_len = 0;
+	ei->i_fc_tid = 0;
 	atomic_set(&ei->i_ioend_count, 0);
 	atomic_set(&ei->i_unwritten, 0);
 	INIT_WORK(&ei->i_rsv_conversion_work, ext4_end_io_rsv_work);
@@ -978,6 +984,9 @@ void ext4_clear_inode(struct inode *inode)
 	dquot_drop(inode);
 	ext4_discard_preallocations(inode);
 	ext4_es_remove_extent(inode, 0, EXT_MAX_BLOCKS);
+	ext4_fc_del(inode);
+	kfree(EXT4_I(inode)->i_dir_lock);
+	EXT4_I(inode)->i_dir_lock = NULL;
 	if (EXT4_I(inode)->jinode) {
 		jbd2_journal_release_jbd_inode(EXT4_JOURNAL(inode),
 					       EXT4_I(inode)->jinode);
@@ -1145,7 +1154,7 @@ enum {
 	Opt_inode_readahead_blks, Opt_journal_ioprio,
 	Opt_dioread_nolock, Opt_dioread_lock,
 	Opt_discard, Opt_nodiscard, Opt_init_itable, Opt_noinit_itable,
-	Opt_max_dir_size_kb, Opt_nojournal_checksum,
+	Opt_max_dir_size_kb, Opt_nojournal_checksum, Opt_pdirops, Opt_nopdirops,
 };
 
 static const match_table_t tokens = {
@@ -1225,6 +1234,8 @@ static const match_table_t tokens = {
 	{Opt_init_itable, "init_itable"},
 	{Opt_noinit_itable, "noinit_itable"},
 	{Opt_max_dir_size_kb, "max_dir_size_kb=%u"},
+	{Opt_pdirops, "pdirops"},
+	{Opt_nopdirops, "nopdirops"},
 	{Opt_test_dummy_encryption, "test_dummy_encryption"},
 	{Opt_removed, "check=none"},	/* mount option from ext2/3 */
 	{Opt_removed, "nocheck"},	/* mount option from ext2/3 */
@@ -1428,6 +1439,8 @@ static const struct mount_opts {
 	{Opt_jqfmt_vfsv1, QFMT_VFS_V1, MOPT_QFMT},
 	{Opt_max_dir_size_kb, 0, MOPT_GTE0},
 	{Opt_test_dummy_encryption, 0, MOPT_GTE0},
+	{Opt_pdirops, EXT4_MOUNT_PDIROPS, MOPT_EXT4_ONLY | MOPT_SET},
+	{Opt_nopdirops, EXT4_MOUNT_PDIROPS, MOPT_EXT4_ONLY | MOPT_CLEAR},
 	{Opt_err, 0, 0}
 };
 
@@ -2604,6 +2617,33 @@ static ssize_t trigger_test_error(struct ext4_attr *a,
 	return count;
 }
 
+static ssize_t mb_cr_stats_show(struct ext4_attr *a,
+				struct ext4_sb_info *sbi, char *buf)
+{
+	struct ext4_mb_cr_stats *st = (struct ext4_mb_cr_stats *)
+					(((char *) sbi) + a->u.offset);
+
+	return snprintf(buf, PAGE_SIZE,
+			"hits: %lld\ngroups_considered: %lld\nfailed: %lld\n",
+			(long long) atomic64_read(&st->hits),
+			(long long) atomic64_read(&st->groups_considered),
+			(long long) atomic64_read(&st->failed));
+}
+
+static ssize_t fc_stats_show(struct ext4_attr *a,
+			     struct ext4_sb_info *sbi, char *buf)
+{
+	struct ext4_fc_stats *st = &sbi->s_fc_stats;
+
+	return snprintf(buf, PAGE_SIZE,
+			"commits: %lld\nineligible: %lld\nfailed: %lld\n"
+			"blocks: %lld\n",
+			(long long) atomic64_read(&st->fc_commits),
+			(long long) atomic64_read(&st->fc_ineligible),
+			(long long) atomic64_read(&st->fc_failed),
+			(long long) atomic64_read(&st->fc_blocks));
+}
+
 static ssize_t sbi_deprecated_show(struct ext4_attr *a,
 				   struct ext4_sb_info *sbi, char *buf)
 {
@@ -2641,6 +2681,9 @@ static struct ext4_attr ext4_attr_##name = __ATTR(name, mode, show, store)
 	EXT4_ATTR_OFFSET_ES(name, 0444, es_ui_show, NULL, elname)
 #define EXT4_RW_ATTR_SBI_UI(name, elname)	\
 	EXT4_ATTR_OFFSET(name, 0644, sbi_ui_show, sbi_ui_store, elname)
+#define EXT4_RO_ATTR_MB_CR_STATS(cr)	\
+	EXT4_ATTR_OFFSET(mb_cr##cr##_stats, 0444, mb_cr_stats_show, NULL, \
+			 s_mb_cr_stats[cr])
 
 #define ATTR_LIST(name) &ext4_attr_##name.attr
 #define EXT4_DEPRECATED_ATTR(_name, _val)	\
@@ -2665,6 +2708,12 @@ EXT4_RW_ATTR_SBI_UI(mb_min_to_scan, s_mb_min_to_scan);
 EXT4_RW_ATTR_SBI_UI(mb_order2_req, s_mb_order2_reqs);
 EXT4_RW_ATTR_SBI_UI(mb_stream_req, s_mb_stream_request);
 EXT4_RW_ATTR_SBI_UI(mb_group_prealloc, s_mb_group_prealloc);
+EXT4_RW_ATTR_SBI_UI(mb_optimize_scan, s_mb_optimize_scan);
+EXT4_RO_ATTR_MB_CR_STATS(0);
+EXT4_RO_ATTR_MB_CR_STATS(1);
+EXT4_RO_ATTR_MB_CR_STATS(2);
+EXT4_RO_ATTR_MB_CR_STATS(3);
+EXT4_RO_ATTR(fc_stats);
 EXT4_DEPRECATED_ATTR(max_writeback_mb_bump, 128);
 EXT4_RW_ATTR_SBI_UI(extent_max_zeroout_kb, s_extent_max_zeroout_kb);
 EXT4_ATTR(trigger_fs_error, 0200, NULL, trigger_test_error);
@@ -2691,6 +2740,12 @@ static struct attribute *ext4_attrs[] = {
 	ATTR_LIST(mb_order2_req),
 	ATTR_LIST(mb_stream_req),
 	ATTR_LIST(mb_group_prealloc),
+	ATTR_LIST(mb_optimize_scan),
+	ATTR_LIST(mb_cr0_stats),
+	ATTR_LIST(mb_cr1_stats),
+	ATTR_LIST(mb_cr2_stats),
+	ATTR_LIST(mb_cr3_stats),
+	ATTR_LIST(fc_stats),
 	ATTR_LIST(max_writeback_mb_bump),
 	ATTR_LIST(extent_max_zeroout_kb),
 	ATTR_LIST(trigger_fs_error),
@@ -3534,9 +3589,10 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 		goto cantfind_ext4;
 	}
 
-	/* Load the checksum driver */
+	/* Load the checksum driver, fast commits use it as well */
 	if (EXT4_HAS_RO_COMPAT_FEATURE(sb,
-				       EXT4_FEATURE_RO_COMPAT_METADATA_CSUM)) {
+				       EXT4_FEATURE_RO_COMPAT_METADATA_CSUM) ||
+	    EXT4_HAS_COMPAT_FEATURE(sb, EXT4_FEATURE_COMPAT_FAST_COMMIT)) {
 		sbi->s_chksum_driver = crypto_alloc_shash("crc32c", 0, 0);
 		if (IS_ERR(sbi->s_chksum_driver)) {
 			ext4_msg(sb, KERN_ERR, "Cannot load crc32c driver.");
@@ -4080,6 +4136,24 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 	default:
 		break;
 	}
+
+	/*
+	 * Fast commits log inode changes instead of journalling blocks, which
+	 * doesn't work when data blocks are journalled too.  Replay allocates
+	 * blocks one by one, not clusters.  A read-only mount
+	 * still needs them if there's a fast commit left to replay.
+	 */
+	if (EXT4_HAS_COMPAT_FEATURE(sb, EXT4_FEATURE_COMPAT_FAST_COMMIT) &&
+	    !EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC) &&
+	    test_opt(sb, DATA_FLAGS) != EXT4_MOUNT_JOURNAL_DATA &&
+	    (!(sb->s_flags & MS_RDONLY) || sbi->s_fc_replay)) {
+		if (jbd2_journal_set_features(sbi->s_journal, 0, 0,
+					      JBD2_FEATURE_INCOMPAT_FAST_COMMIT))
+			set_opt2(sb, JOURNAL_FAST_COMMIT);
+		else
+			ext4_msg(sb, KERN_WARNING,
+				 "failed to enable fast commits");
+	}
 	set_task_ioprio(sbi->s_journal->j_task, journal_ioprio);
 
 	sbi->s_journal->j_commit_callback = ext4_journal_commit_callback;
@@ -4249,6 +4323,12 @@ no_journal:
 	}
 #endif  /* CONFIG_QUOTA */
 
+	if (sbi->s_fc_replay) {
+		err = ext4_fc_replay(sb);
+		if (err)
+			ext4_error(sb, "fast commit replay failed (%d)", err);
+	}
+
 	EXT4_SB(sb)->s_mount_state |= EXT4_ORPHAN_FS;
 	ext4_orphan_cleanup(sb, es);
 	EXT4_SB(sb)->s_mount_state &= ~EXT4_ORPHAN_FS;
@@ -4323,6 +4403,7 @@ failed_mount_wq:
 		jbd2_journal_destroy(sbi->s_journal);
 		sbi->s_journal = NULL;
 	}
+	ext4_fc_destroy(sb);
 failed_mount3a:
 	ext4_es_unregister_shrinker(sbi);
 failed_mount3:
@@ -4576,6 +4657,8 @@ static int ext4_load_journal(struct super_block *sb,
 	if (!(journal->j_flags & JBD2_BARRIER))
 		ext4_msg(sb, KERN_INFO, "barriers disabled");
 
+	ext4_fc_init(sb, journal);
+
 	if (!EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_RECOVER))
 		err = jbd2_journal_wipe(journal, !really_read_only);
 	if (!err) {
@@ -4593,6 +4676,7 @@ static int ext4_load_journal(struct super_block *sb,
 	if (err) {
 		ext4_msg(sb, KERN_ERR, "error loading journal");
 		jbd2_journal_destroy(journal);
+		ext4_fc_destroy(sb);
 		return err;
 	}
 
@@ -815,6 +815,20 @@ static int block_operations(struct f2fs_sb_info *sbi)
 
 	blk_start_plug(&plug);
 
+	/*
+	 * Write back the bulk of dirty dentry and node pages while other
+	 * operations are still allowed, so that the loops below only flush
+	 * what gets dirtied in the meantime with cp_rwsem held.
+	 */
+	if (get_pages(sbi, F2FS_DIRTY_DENTS))
+		sync_dirty_dir_inodes(sbi);
+	if (get_pages(sbi, F2FS_DIRTY_NODES))
+		sync_node_pages(sbi, 0, &wbc);
+	if (unlikely(f2fs_cp_error(sbi))) {
+		err = -EIO;
+		goto out;
+	}
+
 retry_flush_dents:
 	f2fs_lock_all(sbi);
 	/* write all the dirty dentry pages */
@@ -217,6 +217,16 @@ static inline bool __has_cursum_space(struct f2fs_summary_block *sum, int size,
 #define F2FS_IOC_START_VOLATILE_WRITE	_IO(F2FS_IOCTL_MAGIC, 3)
 #define F2FS_IOC_RELEASE_VOLATILE_WRITE	_IO(F2FS_IOCTL_MAGIC, 4)
 #define F2FS_IOC_ABORT_VOLATILE_WRITE	_IO(F2FS_IOCTL_MAGIC, 5)
+#define F2FS_IOC_GET_DATA_HINT		_IOR(F2FS_IOCTL_MAGIC, 6, __u32)
+#define F2FS_IOC_SET_DATA_HINT		_IOW(F2FS_IOCTL_MAGIC, 7, __u32)
+
+/*
+ * Data temperature hints for F2FS_IOC_{GET,SET}_DATA_HINT, used to pick the
+ * active log that new data blocks of a regular file are written to.
+ */
+#define F2FS_DATA_HINT_NONE		0	/* default placement */
+#define F2FS_DATA_HINT_HOT		1	/* often rewritten */
+#define F2FS_DATA_HINT_COLD		2	/* write-once data */
 
 /*
  * should be same as XFS_IOC_GOINGDOWN.
@@ -319,6 +329,7 @@ struct extent_tree {
  */
 #define FADVISE_COLD_BIT	0x01
 #define FADVISE_LOST_PINO_BIT	0x02
+#define FADVISE_HOT_BIT		0x04
 
 #define DEF_DIR_LEVEL		0
 
@@ -460,6 +471,8 @@ static inline void set_new_dnode(struct dnode_of_data *dn, struct inode *inode,
  * In the current design, you should not change the numbers intentionally.
  * Instead, as a mount option such as active_logs=x, you can use 2, 4, and 6
  * logs individually according to the underlying devices. (default: 6)
+ * With 4 or 6 logs, regular file data can be steered to the hot or cold data
+ * log by a per-file hint set through F2FS_IOC_SET_DATA_HINT.
  * Just in case, on-disk layout covers maximum 16 logs that consist of 8 for
  * data and 8 for node logs.
  */
@@ -491,6 +504,17 @@ struct flush_cmd_control {
 	struct llist_node *dispatch_list;	/* list for command dispatch */
 };
 
+struct discard_cmd_control {
+	struct task_struct *f2fs_issue_discard;	/* discard thread */
+	wait_queue_head_t discard_wait_queue;	/* wakes up the thread */
+	wait_queue_head_t discard_done_queue;	/* batch completion */
+	struct mutex cmd_lock;			/* protects lists, seq */
+	struct mutex issue_lock;		/* serialize command issuers */
+	struct list_head discard_pend_list;	/* discards not issued yet */
+	struct list_head discard_issue_list;	/* discards being issued */
+	unsigned int issue_seq;			/* # of batches done */
+};
+
 struct f2fs_sm_info {
 	struct sit_info *sit_info;		/* whole segment information */
 	struct free_segmap_info *free_info;	/* free segment information */
@@ -526,6 +550,9 @@ struct f2fs_sm_info {
 	/* for flush command control */
 	struct flush_cmd_control *cmd_control_info;
 
+	/* for discard command control */
+	struct discard_cmd_control *dcc_info;
+
 };
 
 /*
@@ -1546,6 +1573,8 @@ void f2fs_balance_fs_bg(struct f2fs_sb_info *);
 int f2fs_issue_flush(struct f2fs_sb_info *);
 int create_flush_cmd_control(struct f2fs_sb_info *);
 void destroy_flush_cmd_control(struct f2fs_sb_info *);
+int create_discard_cmd_control(struct f2fs_sb_info *);
+void destroy_discard_cmd_control(struct f2fs_sb_info *);
 void invalidate_blocks(struct f2fs_sb_info *, block_t);
 void refresh_sit_entry(struct f2fs_sb_info *, block_t, block_t);
 void clear_prefree_segments(struct f2fs_sb_info *);
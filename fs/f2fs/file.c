@@ -1044,6 +1044,55 @@ static int f2fs_ioc_abort_volatile_write(struct file *filp)
 	return ret;
 }
 
+static int f2fs_ioc_get_data_hint(struct file *filp, unsigned long arg)
+{
+	struct inode *inode = file_inode(filp);
+	__u32 hint = F2FS_DATA_HINT_NONE;
+
+	if (file_is_hot(inode))
+		hint = F2FS_DATA_HINT_HOT;
+	else if (file_is_cold(inode))
+		hint = F2FS_DATA_HINT_COLD;
+
+	return put_user(hint, (__u32 __user *)arg);
+}
+
+static int f2fs_ioc_set_data_hint(struct file *filp, unsigned long arg)
+{
+	struct inode *inode = file_inode(filp);
+	__u32 hint;
+	int ret;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+
+	if (!inode_owner_or_capable(inode))
+		return -EACCES;
+
+	if (get_user(hint, (__u32 __user *)arg))
+		return -EFAULT;
+
+	if (hint > F2FS_DATA_HINT_COLD)
+		return -EINVAL;
+
+	ret = mnt_want_write_file(filp);
+	if (ret)
+		return ret;
+
+	mutex_lock(&inode->i_mutex);
+	file_clear_hot(inode);
+	file_clear_cold(inode);
+	if (hint == F2FS_DATA_HINT_HOT)
+		file_set_hot(inode);
+	else if (hint == F2FS_DATA_HINT_COLD)
+		file_set_cold(inode);
+	mutex_unlock(&inode->i_mutex);
+
+	mark_inode_dirty(inode);
+	mnt_drop_write_file(filp);
+	return 0;
+}
+
 static int f2fs_ioc_shutdown(struct file *filp, unsigned long arg)
 {
 	struct inode *inode = file_inode(filp);
@@ -1128,6 +1177,10 @@ long f2fs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		return f2fs_ioc_release_volatile_write(filp);
 	case F2FS_IOC_ABORT_VOLATILE_WRITE:
 		return f2fs_ioc_abort_volatile_write(filp);
+	case F2FS_IOC_GET_DATA_HINT:
+		return f2fs_ioc_get_data_hint(filp, arg);
+	case F2FS_IOC_SET_DATA_HINT:
+		return f2fs_ioc_set_data_hint(filp, arg);
 	case F2FS_IOC_SHUTDOWN:
 		return f2fs_ioc_shutdown(filp, arg);
 	case FITRIM:
@@ -470,6 +470,211 @@ static int f2fs_issue_discard(struct f2fs_sb_info *sbi,
 	return blkdev_issue_discard(sbi->sb->s_bdev, start, len, GFP_NOFS, 0);
 }
 
+static void __queue_discard_cmd(struct f2fs_sb_info *sbi,
+				block_t blkstart, block_t blklen)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct list_head *head;
+	struct discard_entry *new, *last;
+
+	if (!dcc) {
+		f2fs_issue_discard(sbi, blkstart, blklen);
+		return;
+	}
+
+	head = &dcc->discard_pend_list;
+
+	mutex_lock(&dcc->cmd_lock);
+	if (!list_empty(head)) {
+		last = list_last_entry(head, struct discard_entry, list);
+		if (blkstart == last->blkaddr + last->len) {
+			last->len += blklen;
+			goto unlock;
+		}
+	}
+
+	new = f2fs_kmem_cache_alloc(discard_entry_slab, GFP_NOFS);
+	INIT_LIST_HEAD(&new->list);
+	new->blkaddr = blkstart;
+	new->len = blklen;
+	list_add_tail(&new->list, head);
+unlock:
+	mutex_unlock(&dcc->cmd_lock);
+}
+
+/*
+ * Issue a batch of queued discards. Returns the number of commands issued,
+ * so callers can loop until the pending list is drained.
+ */
+static int __issue_discard_cmds(struct f2fs_sb_info *sbi)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct discard_entry *entry, *this;
+	int issued = 0;
+
+	mutex_lock(&dcc->issue_lock);
+
+	mutex_lock(&dcc->cmd_lock);
+	list_for_each_entry_safe(entry, this, &dcc->discard_pend_list, list) {
+		list_move_tail(&entry->list, &dcc->discard_issue_list);
+		if (++issued >= DISCARD_ISSUE_BATCH)
+			break;
+	}
+	mutex_unlock(&dcc->cmd_lock);
+
+	if (!issued)
+		goto out;
+
+	/* only this issuer modifies the issue list, waiters just look at it */
+	list_for_each_entry(entry, &dcc->discard_issue_list, list)
+		f2fs_issue_discard(sbi, entry->blkaddr, entry->len);
+
+	mutex_lock(&dcc->cmd_lock);
+	list_for_each_entry_safe(entry, this, &dcc->discard_issue_list, list) {
+		list_del(&entry->list);
+		kmem_cache_free(discard_entry_slab, entry);
+	}
+	dcc->issue_seq++;
+	mutex_unlock(&dcc->cmd_lock);
+
+	wake_up_all(&dcc->discard_done_queue);
+out:
+	mutex_unlock(&dcc->issue_lock);
+	return issued;
+}
+
+static void __drain_discard_cmds(struct f2fs_sb_info *sbi)
+{
+	if (!SM_I(sbi)->dcc_info)
+		return;
+
+	while (__issue_discard_cmds(sbi))
+		cond_resched();
+}
+
+/*
+ * Blocks of prefree segments become reusable as soon as the checkpoint is
+ * done, while their discards may still be queued. Before a block is handed
+ * out again, drop the queued discards over its segment and wait for any
+ * in-flight discard covering it, so that new data is never discarded.
+ */
+static void f2fs_wait_discard_block(struct f2fs_sb_info *sbi, block_t blkaddr)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	struct discard_entry *entry, *this, *new;
+	block_t seg_start, seg_end;
+	unsigned int seq;
+	bool inflight = false;
+
+	if (!dcc || (list_empty_careful(&dcc->discard_pend_list) &&
+			list_empty_careful(&dcc->discard_issue_list)))
+		return;
+
+	seg_start = START_BLOCK(sbi, GET_SEGNO(sbi, blkaddr));
+	seg_end = seg_start + sbi->blocks_per_seg;
+
+	mutex_lock(&dcc->cmd_lock);
+	list_for_each_entry_safe(entry, this, &dcc->discard_pend_list, list) {
+		block_t end = entry->blkaddr + entry->len;
+
+		if (end <= seg_start || entry->blkaddr >= seg_end)
+			continue;
+
+		if (entry->blkaddr < seg_start && end > seg_end) {
+			new = f2fs_kmem_cache_alloc(discard_entry_slab,
+								GFP_NOFS);
+			new->blkaddr = seg_end;
+			new->len = end - seg_end;
+			list_add(&new->list, &entry->list);
+			entry->len = seg_start - entry->blkaddr;
+		} else if (entry->blkaddr < seg_start) {
+			entry->len = seg_start - entry->blkaddr;
+		} else if (end > seg_end) {
+			entry->blkaddr = seg_end;
+			entry->len = end - seg_end;
+		} else {
+			list_del(&entry->list);
+			kmem_cache_free(discard_entry_slab, entry);
+		}
+	}
+
+	list_for_each_entry(entry, &dcc->discard_issue_list, list) {
+		if (blkaddr >= entry->blkaddr &&
+				blkaddr < entry->blkaddr + entry->len) {
+			inflight = true;
+			break;
+		}
+	}
+	seq = dcc->issue_seq;
+	mutex_unlock(&dcc->cmd_lock);
+
+	if (inflight)
+		wait_event(dcc->discard_done_queue,
+				ACCESS_ONCE(dcc->issue_seq) != seq);
+}
+
+static int issue_discard_thread(void *data)
+{
+	struct f2fs_sb_info *sbi = data;
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+	wait_queue_head_t *q = &dcc->discard_wait_queue;
+repeat:
+	if (kthread_should_stop())
+		return 0;
+
+	while (__issue_discard_cmds(sbi)) {
+		if (kthread_should_stop())
+			return 0;
+		cond_resched();
+	}
+
+	wait_event_interruptible(*q, kthread_should_stop() ||
+				!list_empty_careful(&dcc->discard_pend_list));
+	goto repeat;
+}
+
+int create_discard_cmd_control(struct f2fs_sb_info *sbi)
+{
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	struct discard_cmd_control *dcc;
+	int err = 0;
+
+	dcc = kzalloc(sizeof(struct discard_cmd_control), GFP_KERNEL);
+	if (!dcc)
+		return -ENOMEM;
+	init_waitqueue_head(&dcc->discard_wait_queue);
+	init_waitqueue_head(&dcc->discard_done_queue);
+	mutex_init(&dcc->cmd_lock);
+	mutex_init(&dcc->issue_lock);
+	INIT_LIST_HEAD(&dcc->discard_pend_list);
+	INIT_LIST_HEAD(&dcc->discard_issue_list);
+	SM_I(sbi)->dcc_info = dcc;
+	dcc->f2fs_issue_discard = kthread_run(issue_discard_thread, sbi,
+				"f2fs_discard-%u:%u", MAJOR(dev), MINOR(dev));
+	if (IS_ERR(dcc->f2fs_issue_discard)) {
+		err = PTR_ERR(dcc->f2fs_issue_discard);
+		kfree(dcc);
+		SM_I(sbi)->dcc_info = NULL;
+		return err;
+	}
+
+	return err;
+}
+
+void destroy_discard_cmd_control(struct f2fs_sb_info *sbi)
+{
+	struct discard_cmd_control *dcc = SM_I(sbi)->dcc_info;
+
+	if (!dcc)
+		return;
+	if (dcc->f2fs_issue_discard)
+		kthread_stop(dcc->f2fs_issue_discard);
+	/* whatever is still queued is issued synchronously */
+	__drain_discard_cmds(sbi);
+	kfree(dcc);
+	SM_I(sbi)->dcc_info = NULL;
+}
+
 void discard_next_dnode(struct f2fs_sb_info *sbi, block_t blkaddr)
 {
 	if (f2fs_issue_discard(sbi, blkaddr, 1)) {
@@ -615,18 +820,22 @@ void clear_prefree_segments(struct f2fs_sb_info *sbi)
 		if (!test_opt(sbi, DISCARD))
 			continue;
 
-		f2fs_issue_discard(sbi, START_BLOCK(sbi, start),
+		__queue_discard_cmd(sbi, START_BLOCK(sbi, start),
 				(end - start) << sbi->log_blocks_per_seg);
 	}
 	mutex_unlock(&dirty_i->seglist_lock);
 
 	/* send small discards */
 	list_for_each_entry_safe(entry, this, head, list) {
-		f2fs_issue_discard(sbi, entry->blkaddr, entry->len);
+		__queue_discard_cmd(sbi, entry->blkaddr, entry->len);
 		list_del(&entry->list);
 		SM_I(sbi)->nr_discards -= entry->len;
 		kmem_cache_free(discard_entry_slab, entry);
 	}
+
+	/* the discards are issued by the discard thread, out of checkpoint */
+	if (SM_I(sbi)->dcc_info)
+		wake_up(&SM_I(sbi)->dcc_info->discard_wait_queue);
 }
 
 static bool __mark_sit_entry_dirty(struct f2fs_sb_info *sbi, unsigned int segno)
@@ -1086,6 +1295,9 @@ int f2fs_trim_fs(struct f2fs_sb_info *sbi, struct fstrim_range *range)
 		write_checkpoint(sbi, &cpc);
 		mutex_unlock(&sbi->gc_mutex);
 	}
+
+	/* FITRIM returns only after the queued discards hit the device */
+	__drain_discard_cmds(sbi);
 out:
 	range->len = F2FS_BLK_TO_BYTES(cpc.trimmed);
 	return 0;
@@ -1112,7 +1324,7 @@ static int __get_segment_type_4(struct page *page, enum page_type p_type)
 	if (p_type == DATA) {
 		struct inode *inode = page->mapping->host;
 
-		if (S_ISDIR(inode->i_mode))
+		if (S_ISDIR(inode->i_mode) || file_is_hot(inode))
 			return CURSEG_HOT_DATA;
 		else
 			return CURSEG_COLD_DATA;
@@ -1133,6 +1345,8 @@ static int __get_segment_type_6(struct page *page, enum page_type p_type)
 			return CURSEG_HOT_DATA;
 		else if (is_cold_data(page) || file_is_cold(inode))
 			return CURSEG_COLD_DATA;
+		else if (file_is_hot(inode))
+			return CURSEG_HOT_DATA;
 		else
 			return CURSEG_WARM_DATA;
 	} else {
@@ -1204,6 +1418,8 @@ void allocate_data_block(struct f2fs_sb_info *sbi, struct page *page,
 		fill_node_footer_blkaddr(page, NEXT_FREE_BLKADDR(sbi, curseg));
 
 	mutex_unlock(&curseg->curseg_mutex);
+
+	f2fs_wait_discard_block(sbi, *new_blkaddr);
 }
 
 static void do_write_page(struct f2fs_sb_info *sbi, struct page *page,
@@ -2153,6 +2369,12 @@ int build_segment_manager(struct f2fs_sb_info *sbi)
 			return err;
 	}
 
+	if (!f2fs_readonly(sbi->sb)) {
+		err = create_discard_cmd_control(sbi);
+		if (err)
+			return err;
+	}
+
 	err = build_sit_info(sbi);
 	if (err)
 		return err;
@@ -2265,6 +2487,7 @@ void destroy_segment_manager(struct f2fs_sb_info *sbi)
 	if (!sm_info)
 		return;
 	destroy_flush_cmd_control(sbi);
+	destroy_discard_cmd_control(sbi);
 	destroy_dirty_segmap(sbi);
 	destroy_curseg(sbi);
 	destroy_free_segmap(sbi);
@@ -719,6 +719,15 @@ static int f2fs_remount(struct super_block *sb, int *flags, char *data)
 		if (err)
 			goto restore_gc;
 	}
+
+	/* The discard thread is only needed while the FS is writable. */
+	if (*flags & MS_RDONLY) {
+		destroy_discard_cmd_control(sbi);
+	} else if (!SM_I(sbi)->dcc_info) {
+		err = create_discard_cmd_control(sbi);
+		if (err)
+			goto restore_gc;
+	}
 skip:
 	/* Update the POSIXACL Flag */
 	 sb->s_flags = (sb->s_flags & ~MS_POSIXACL) |
@@ -658,6 +658,67 @@ struct file *fget_raw(unsigned int fd)
 }
 EXPORT_SYMBOL(fget_raw);
 
+/*
+ * Files that threads of one process hit through a shared fd table
+ * bounce ->f_count between CPUs on every fdget()/fdput().  After
+ * FILE_PCPU_HOT such lookups a file switches to per-cpu mode: light
+ * references are then counted in ->f_pcpu_count, and the reference of
+ * the fd table keeps the file alive meanwhile.  Closing any descriptor
+ * of the file switches it back for good, see file_pcpu_deactivate().
+ */
+#define FILE_PCPU_HOT	64
+
+static void file_pcpu_activate(struct files_struct *files, unsigned int fd,
+			       struct file *file)
+{
+	long __percpu *count;
+
+	if (file->f_pcpu_count)
+		return;
+	count = alloc_percpu_gfp(long, GFP_NOWAIT | __GFP_NOWARN);
+	if (!count)
+		return;
+	if (cmpxchg(&file->f_pcpu_count, NULL, count)) {
+		free_percpu(count);
+		return;
+	}
+
+	/*
+	 * Only switch while the descriptor still refers to the file, so
+	 * that whoever removes it from the table sees ->f_pcpu_active.
+	 */
+	spin_lock(&files->file_lock);
+	if (fcheck_files(files, fd) == file)
+		smp_store_release(&file->f_pcpu_active, true);
+	spin_unlock(&files->file_lock);
+}
+
+static unsigned long __fget_pcpu(unsigned int fd, fmode_t mask)
+{
+	struct files_struct *files = current->files;
+	struct file *file;
+
+	rcu_read_lock();
+	preempt_disable();
+	file = fcheck_files(files, fd);
+	if (file && !(file->f_mode & mask) &&
+	    smp_load_acquire(&file->f_pcpu_active)) {
+		__this_cpu_inc(*file->f_pcpu_count);
+		preempt_enable();
+		rcu_read_unlock();
+		return FDPUT_PCPU | (unsigned long)file;
+	}
+	preempt_enable();
+	rcu_read_unlock();
+
+	file = __fget(fd, mask);
+	if (!file)
+		return 0;
+	if (unlikely(++file->f_pcpu_hits == FILE_PCPU_HOT))
+		file_pcpu_activate(files, fd, file);
+	return FDPUT_FPUT | (unsigned long)file;
+}
+
 /*
  * Lightweight file lookup - no refcnt increment if fd table isn't shared.
  *
@@ -685,10 +746,7 @@ static unsigned long __fget_light(unsigned int fd, fmode_t mask)
 			return 0;
 		return (unsigned long)file;
 	} else {
-		file = __fget(fd, mask);
-		if (!file)
-			return 0;
-		return FDPUT_FPUT | (unsigned long)file;
+		return __fget_pcpu(fd, mask);
 	}
 }
 unsigned long __fdget(unsigned int fd)
@@ -705,10 +763,10 @@ unsigned long __fdget_raw(unsigned int fd)
 unsigned long __fdget_pos(unsigned int fd)
 {
 	unsigned long v = __fdget(fd);
-	struct file *file = (struct file *)(v & ~3);
+	struct file *file = (struct file *)(v & ~7);
 
 	if (file && (file->f_mode & FMODE_ATOMIC_POS)) {
-		if (file_count(file) > 1) {
+		if ((v & FDPUT_PCPU) || file_count(file) > 1) {
 			v |= FDPUT_POS_UNLOCK;
 			mutex_lock(&file->f_pos_lock);
 		}
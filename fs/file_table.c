@@ -46,6 +46,7 @@ static void file_free_rcu(struct rcu_head *head)
 	struct file *f = container_of(head, struct file, f_u.fu_rcuhead);
 
 	put_cred(f->f_cred);
+	free_percpu(f->f_pcpu_count);
 	kmem_cache_free(filp_cachep, f);
 }
 
@@ -305,6 +306,85 @@ void fput(struct file *file)
 }
 EXPORT_SYMBOL(fput);
 
+/*
+ * Added to ->f_count by file_pcpu_deactivate() before it leaves per-cpu
+ * mode and taken off again by file_pcpu_fold().  Light references put in
+ * between are dropped from ->f_count although they were taken on
+ * ->f_pcpu_count; the bias keeps ->f_count from reaching zero until the
+ * fold has added the per-cpu sum, which still includes those references.
+ */
+#define FILE_PCPU_BIAS	(1L << (BITS_PER_LONG - 2))
+
+/**
+ * fput_pcpu - put a light reference obtained by fdget() on a hot file
+ * @file: file of which to put the reference
+ *
+ * While the file is in per-cpu mode the reference is dropped from
+ * ->f_pcpu_count.  Once file_pcpu_deactivate() has switched the file
+ * back, it is dropped from ->f_count instead, which is biased until
+ * file_pcpu_fold() has accounted for the per-cpu references.
+ */
+void fput_pcpu(struct file *file)
+{
+	preempt_disable();
+	if (likely(ACCESS_ONCE(file->f_pcpu_active))) {
+		__this_cpu_dec(*file->f_pcpu_count);
+		preempt_enable();
+		return;
+	}
+	preempt_enable();
+	fput(file);
+}
+EXPORT_SYMBOL(fput_pcpu);
+
+static void file_pcpu_fold(struct rcu_head *head)
+{
+	struct file *file = container_of(head, struct file, f_u.fu_rcuhead);
+	long sum = 0;
+	int cpu;
+
+	/*
+	 * Every fdget() and fput_pcpu() that saw ->f_pcpu_active has
+	 * finished with ->f_pcpu_count, and later puts went to ->f_count.
+	 * Adding the per-cpu sum accounts for all light references taken
+	 * in per-cpu mode, so the bias can go in the same step.
+	 */
+	for_each_possible_cpu(cpu)
+		sum += *per_cpu_ptr(file->f_pcpu_count, cpu);
+	atomic_long_add(sum - FILE_PCPU_BIAS, &file->f_count);
+
+	/* Now drop the reference of the descriptor that was closed. */
+	fput(file);
+}
+
+/**
+ * file_pcpu_deactivate - switch a hot file back to plain reference counting
+ * @file: file whose descriptor is being closed
+ *
+ * Called by filp_close() with the reference held by the closed
+ * descriptor.  Returns false if the file is not in per-cpu mode, in
+ * which case the caller drops that reference itself.  Otherwise
+ * ->f_count is biased before per-cpu mode is left, the light references
+ * are folded into it after an RCU-sched grace period, and the
+ * descriptor's reference is dropped only then, so the file can't be
+ * freed under a thread still using it.
+ */
+bool file_pcpu_deactivate(struct file *file)
+{
+	if (likely(!ACCESS_ONCE(file->f_pcpu_active)))
+		return false;
+
+	/* xchg() orders the bias before puts can see per-cpu mode gone */
+	atomic_long_add(FILE_PCPU_BIAS, &file->f_count);
+	if (!xchg(&file->f_pcpu_active, false)) {
+		/* lost against another close of the same file */
+		atomic_long_sub(FILE_PCPU_BIAS, &file->f_count);
+		return false;
+	}
+	call_rcu_sched(&file->f_u.fu_rcuhead, file_pcpu_fold);
+	return true;
+}
+
 /**
  * fput_global - do an fput without using task_work
  * @file: file of which to put the reference
@@ -53,6 +53,22 @@ struct wb_writeback_work {
 	struct completion *done;	/* set if the caller waits */
 };
 
+/*
+ * A helper runs one pass of writeback over wb->b_io next to the flusher,
+ * on its own copy of the flusher's work.  Inodes are handed out one at a
+ * time from the tail of b_io and I_SYNC keeps two workers off the same
+ * inode, so the helpers partition the batch by inode without any extra
+ * bookkeeping.
+ */
+struct wb_helper {
+	struct work_struct	work;
+	struct bdi_writeback	*wb;
+	struct wb_writeback_work wbw;	/* private copy of the flusher's work */
+	long			budget;	/* pages handed to this pass */
+	long			progress;
+	struct bdi_wb_worker_stats *stats;
+};
+
 /*
  * If an inode is constantly having its pages dirtied, but then the
  * updates stop dirtytime_expire_interval seconds in the past, it's
@@ -650,6 +666,9 @@ static long writeback_chunk_size(struct backing_dev_info *bdi,
 		pages = min(pages, work->nr_pages);
 		pages = round_down(pages + MIN_WRITEBACK_PAGES,
 				   MIN_WRITEBACK_PAGES);
+		/* Don't let one big file hog a worker for a whole pass */
+		if (bdi->wb_inode_chunk)
+			pages = min(pages, (long)bdi->wb_inode_chunk);
 	}
 
 	return pages;
@@ -857,6 +876,98 @@ static void wb_update_bandwidth(struct bdi_writeback *wb,
 	__bdi_update_bandwidth(wb->bdi, 0, 0, 0, 0, 0, start_time);
 }
 
+static void wb_account_worker(struct bdi_wb_worker_stats *stats,
+			      long pages, u64 start)
+{
+	stats->runs++;
+	stats->pages += pages;
+	stats->busy_ns += ktime_get_ns() - start;
+}
+
+static void wb_helper_workfn(struct work_struct *w)
+{
+	struct wb_helper *helper = container_of(w, struct wb_helper, work);
+	struct bdi_writeback *wb = helper->wb;
+	struct wb_writeback_work *work = &helper->wbw;
+	u64 start = ktime_get_ns();
+
+	set_worker_desc("flush-%s", dev_name(wb->bdi->dev));
+	current->flags |= PF_SWAPWRITE;
+
+	spin_lock(&wb->list_lock);
+	if (work->sb)
+		helper->progress = writeback_sb_inodes(work->sb, wb, work);
+	else
+		helper->progress = __writeback_inodes_wb(wb, work);
+	spin_unlock(&wb->list_lock);
+
+	current->flags &= ~PF_SWAPWRITE;
+	wb_account_worker(helper->stats, helper->budget - work->nr_pages, start);
+}
+
+/*
+ * Kick the helpers for one pass over b_io.  Data integrity writeback
+ * stays with the flusher: it waits on every inode anyway and its
+ * livelock avoidance depends on a single pass.  Each helper gets an even
+ * share of the remaining pages so that the workers together don't
+ * overshoot what was asked for.  Called with list_lock held, returns the
+ * number of workers taking part including the flusher.
+ */
+static unsigned int wb_start_helpers(struct bdi_writeback *wb,
+				     struct wb_writeback_work *work)
+{
+	struct backing_dev_info *bdi = wb->bdi;
+	unsigned int nr = ACCESS_ONCE(bdi->wb_workers);
+	struct wb_helper *helper;
+	long share;
+	unsigned int i;
+
+	if (nr < 2 || !bdi->wb_helpers || work->sync_mode == WB_SYNC_ALL ||
+	    list_empty(&wb->b_io))
+		return 1;
+
+	/* The helpers could only ever run after us on the rescuer */
+	if (current_is_workqueue_rescuer())
+		return 1;
+
+	share = max_t(long, work->nr_pages / nr, MIN_WRITEBACK_PAGES);
+	for (i = 1; i < nr; i++) {
+		helper = &bdi->wb_helpers[i];
+		helper->wbw = *work;
+		INIT_LIST_HEAD(&helper->wbw.list);
+		helper->wbw.done = NULL;
+		helper->wbw.nr_pages = share;
+		helper->budget = share;
+		helper->progress = 0;
+		queue_work(bdi_wq, &helper->work);
+	}
+	return nr;
+}
+
+/*
+ * Wait for the helpers started by wb_start_helpers() and charge what they
+ * wrote to the flusher's work.  The helpers may use work->sb, so they
+ * must be done before the work is completed and the sb unpinned.
+ */
+static long wb_wait_helpers(struct bdi_writeback *wb,
+			    struct wb_writeback_work *work, unsigned int nr)
+{
+	struct wb_helper *helper;
+	long progress = 0;
+	unsigned int i;
+
+	spin_unlock(&wb->list_lock);
+	for (i = 1; i < nr; i++) {
+		helper = &wb->bdi->wb_helpers[i];
+		flush_work(&helper->work);
+		work->nr_pages -= helper->budget - helper->wbw.nr_pages;
+		progress += helper->progress;
+	}
+	spin_lock(&wb->list_lock);
+
+	return progress;
+}
+
 /*
  * Explicit flushing or periodic writeback of "old" data.
  *
@@ -879,7 +990,10 @@ static long wb_writeback(struct bdi_writeback *wb,
 	long nr_pages = work->nr_pages;
 	unsigned long oldest_jif;
 	struct inode *inode;
+	unsigned int workers;
 	long progress;
+	long pass_pages;
+	u64 pass_start;
 
 	oldest_jif = jiffies;
 	work->older_than_this = &oldest_jif;
@@ -924,10 +1038,18 @@ static long wb_writeback(struct bdi_writeback *wb,
 		trace_writeback_start(wb->bdi, work);
 		if (list_empty(&wb->b_io))
 			queue_io(wb, work);
+		workers = wb_start_helpers(wb, work);
+		pass_pages = work->nr_pages;
+		pass_start = ktime_get_ns();
 		if (work->sb)
 			progress = writeback_sb_inodes(work->sb, wb, work);
 		else
 			progress = __writeback_inodes_wb(wb, work);
+		if (wb->bdi->wb_stats)
+			wb_account_worker(&wb->bdi->wb_stats[0],
+					  pass_pages - work->nr_pages, pass_start);
+		if (workers > 1)
+			progress += wb_wait_helpers(wb, work, workers);
 		trace_writeback_written(wb->bdi, work);
 
 		wb_update_bandwidth(wb, wb_start);
@@ -1084,6 +1206,68 @@ static long wb_do_writeback(struct bdi_writeback *wb)
 	return wrote;
 }
 
+/**
+ * bdi_set_wb_workers - set the number of workers writing back a bdi
+ * @bdi: the backing device
+ * @nr: flusher plus helpers, 1 turns parallel writeback off
+ *
+ * The helpers and per-worker statistics are allocated the first time
+ * more than one worker is asked for and stay around until bdi_destroy().
+ */
+int bdi_set_wb_workers(struct backing_dev_info *bdi, unsigned int nr)
+{
+	struct wb_helper *helpers;
+	struct bdi_wb_worker_stats *stats;
+	int i;
+
+	if (nr < 1 || nr > BDI_MAX_WB_WORKERS)
+		return -EINVAL;
+
+	if (nr > 1 && !ACCESS_ONCE(bdi->wb_helpers)) {
+		helpers = kcalloc(BDI_MAX_WB_WORKERS, sizeof(*helpers),
+				  GFP_KERNEL);
+		stats = kcalloc(BDI_MAX_WB_WORKERS, sizeof(*stats), GFP_KERNEL);
+		if (!helpers || !stats) {
+			kfree(helpers);
+			kfree(stats);
+			return -ENOMEM;
+		}
+		for (i = 0; i < BDI_MAX_WB_WORKERS; i++) {
+			INIT_WORK(&helpers[i].work, wb_helper_workfn);
+			helpers[i].wb = &bdi->wb;
+			helpers[i].stats = &stats[i];
+		}
+
+		spin_lock_bh(&bdi->wb_lock);
+		if (!bdi->wb_helpers) {
+			bdi->wb_stats = stats;
+			smp_wmb();
+			bdi->wb_helpers = helpers;
+			helpers = NULL;
+			stats = NULL;
+		}
+		spin_unlock_bh(&bdi->wb_lock);
+		kfree(helpers);
+		kfree(stats);
+	}
+
+	ACCESS_ONCE(bdi->wb_workers) = nr;
+	return 0;
+}
+
+/*
+ * Helpers only run while the flusher waits for them, so once the flusher
+ * has been shut down none of them can be in flight.
+ */
+void bdi_free_wb_workers(struct backing_dev_info *bdi)
+{
+	kfree(bdi->wb_helpers);
+	kfree(bdi->wb_stats);
+	bdi->wb_helpers = NULL;
+	bdi->wb_stats = NULL;
+	bdi->wb_workers = 1;
+}
+
 /*
  * Handle writeback of dirty data for the device backed by this bdi. Also
  * reschedules periodically and does kupdated style flushing.
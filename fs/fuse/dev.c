@@ -25,15 +25,74 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_chan *fuse_get_chan(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or clone and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+void fuse_chan_init(struct fuse_chan *ch, struct fuse_conn *fc)
+{
+	memset(ch, 0, sizeof(*ch));
+	spin_lock_init(&ch->lock);
+	ch->fc = fc;
+	INIT_LIST_HEAD(&ch->entry);
+	init_waitqueue_head(&ch->waitq);
+	INIT_LIST_HEAD(&ch->pending);
+	INIT_LIST_HEAD(&ch->processing);
+	INIT_LIST_HEAD(&ch->io);
+	INIT_LIST_HEAD(&ch->interrupts);
+	ch->forget_list_tail = &ch->forget_list_head;
+	ch->cpu = -1;
+}
+EXPORT_SYMBOL_GPL(fuse_chan_init);
+
+/*
+ * A request only moves between channels while it is pending, so
+ * recheck req->chan after taking the lock
+ */
+struct fuse_chan *fuse_req_chan_lock(struct fuse_req *req)
+{
+	struct fuse_chan *ch;
+
+	for (;;) {
+		ch = ACCESS_ONCE(req->chan);
+		if (!ch)
+			return NULL;
+		spin_lock(&ch->lock);
+		if (likely(req->chan == ch))
+			return ch;
+		spin_unlock(&ch->lock);
+	}
+}
+
+/*
+ * Pick and lock the channel for a new request: the one bound to the
+ * current CPU if it is still open, otherwise the main channel.  The
+ * caller has to check ch->connected.
+ */
+static struct fuse_chan *fuse_chan_lock_queue(struct fuse_conn *fc)
+{
+	struct fuse_chan **map = ACCESS_ONCE(fc->cpu_chan);
+	struct fuse_chan *ch = NULL;
+
+	if (map)
+		ch = ACCESS_ONCE(map[raw_smp_processor_id()]);
+	if (ch) {
+		spin_lock(&ch->lock);
+		if (ch->connected)
+			return ch;
+		spin_unlock(&ch->lock);
+	}
+	ch = &fc->main_chan;
+	spin_lock(&ch->lock);
+	return ch;
+}
+
 static void fuse_request_init(struct fuse_req *req, struct page **pages,
 			      struct fuse_page_desc *page_descs,
 			      unsigned npages)
@@ -311,44 +370,44 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
-	/* zero is special */
-	if (fc->reqctr == 0)
-		fc->reqctr = 1;
-
-	return fc->reqctr;
+	/* zero is special, the 64bit counter starts from it and never wraps */
+	return atomic64_inc_return(&fc->reqctr);
 }
 
-static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
+/* Called with ch->lock held */
+static void queue_request(struct fuse_chan *ch, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	req->chan = ch;
+	list_add_tail(&req->list, &ch->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
-		atomic_inc(&fc->num_waiting);
+		atomic_inc(&ch->fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	wake_up(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 		       u64 nodeid, u64 nlookup)
 {
+	struct fuse_chan *ch = &fc->main_chan;
+
 	forget->forget_one.nodeid = nodeid;
 	forget->forget_one.nlookup = nlookup;
 
-	spin_lock(&fc->lock);
-	if (fc->connected) {
-		fc->forget_list_tail->next = forget;
-		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	spin_lock(&ch->lock);
+	if (ch->connected) {
+		ch->forget_list_tail->next = forget;
+		ch->forget_list_tail = forget;
+		wake_up(&ch->waitq);
+		kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 	} else {
 		kfree(forget);
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 }
 
 static void flush_bg_queue(struct fuse_conn *fc)
@@ -356,15 +415,29 @@ static void flush_bg_queue(struct fuse_conn *fc)
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
 		struct fuse_req *req;
+		struct fuse_chan *ch;
 
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		ch = fuse_chan_lock_queue(fc);
+		queue_request(ch, req);
+		spin_unlock(&ch->lock);
 	}
 }
 
+/*
+ * Take a finished request off the lists of its channel.  Called with
+ * the channel lock held, before request_end()
+ */
+static void request_unlink(struct fuse_req *req)
+{
+	list_del_init(&req->list);
+	list_del_init(&req->intr_entry);
+	req->state = FUSE_REQ_FINISHED;
+}
+
 /*
  * This function is called when a request is finished.  Either a reply
  * has arrived or it was aborted (and not yet sent) or some error
@@ -373,17 +446,14 @@ static void flush_bg_queue(struct fuse_conn *fc)
  * the 'end' callback is called if given, else the reference to the
  * request is released
  *
- * Called with fc->lock, unlocks it
+ * Called without locks, after request_unlink()
  */
 static void request_end(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
 {
 	void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 	req->end = NULL;
-	list_del(&req->list);
-	list_del(&req->intr_entry);
-	req->state = FUSE_REQ_FINISHED;
 	if (req->background) {
+		spin_lock(&fc->lock);
 		req->background = 0;
 
 		if (fc->num_background == fc->max_background)
@@ -401,50 +471,48 @@ __releases(fc->lock)
 		fc->num_background--;
 		fc->active_background--;
 		flush_bg_queue(fc);
+		spin_unlock(&fc->lock);
 	}
-	spin_unlock(&fc->lock);
 	wake_up(&req->waitq);
 	if (end)
 		end(fc, req);
 	fuse_put_request(fc, req);
 }
 
-static void wait_answer_interruptible(struct fuse_conn *fc,
-				      struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void wait_answer_interruptible(struct fuse_req *req)
 {
 	if (signal_pending(current))
 		return;
 
-	spin_unlock(&fc->lock);
 	wait_event_interruptible(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
 }
 
-static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
+/* Called with ch->lock held */
+static void queue_interrupt(struct fuse_chan *ch, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->intr_entry, &ch->interrupts);
+	wake_up(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
 {
+	struct fuse_chan *ch;
+
 	if (!fc->no_interrupt) {
 		/* Any signal may interrupt this */
-		wait_answer_interruptible(fc, req);
+		wait_answer_interruptible(req);
 
+		ch = fuse_req_chan_lock(req);
 		if (req->aborted)
 			goto aborted;
 		if (req->state == FUSE_REQ_FINISHED)
-			return;
+			goto out_unlock;
 
 		req->interrupted = 1;
 		if (req->state == FUSE_REQ_SENT)
-			queue_interrupt(fc, req);
+			queue_interrupt(ch, req);
+		spin_unlock(&ch->lock);
 	}
 
 	if (!req->force) {
@@ -452,33 +520,34 @@ __acquires(fc->lock)
 
 		/* Only fatal signals may interrupt this */
 		block_sigs(&oldset);
-		wait_answer_interruptible(fc, req);
+		wait_answer_interruptible(req);
 		restore_sigs(&oldset);
 
+		ch = fuse_req_chan_lock(req);
 		if (req->aborted)
 			goto aborted;
 		if (req->state == FUSE_REQ_FINISHED)
-			return;
+			goto out_unlock;
 
 		/* Request is not yet in userspace, bail out */
 		if (req->state == FUSE_REQ_PENDING) {
 			list_del(&req->list);
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
-			return;
+			goto out_unlock;
 		}
+		spin_unlock(&ch->lock);
 	}
 
 	/*
 	 * Either request is already in userspace, or it was forced.
 	 * Wait it out.
 	 */
-	spin_unlock(&fc->lock);
 	wait_event(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
 
+	ch = fuse_req_chan_lock(req);
 	if (!req->aborted)
-		return;
+		goto out_unlock;
 
  aborted:
 	BUG_ON(req->state != FUSE_REQ_FINISHED);
@@ -488,30 +557,36 @@ __acquires(fc->lock)
 		   locked state, there mustn't be any filesystem
 		   operation (e.g. page fault), since that could lead
 		   to deadlock */
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 		wait_event(req->waitq, !req->locked);
-		spin_lock(&fc->lock);
+		return;
 	}
+ out_unlock:
+	spin_unlock(&ch->lock);
 }
 
 static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_chan *ch;
+
 	BUG_ON(req->background);
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	ch = fuse_chan_lock_queue(fc);
+	if (!ch->connected)
 		req->out.h.error = -ENOTCONN;
 	else if (fc->conn_error)
 		req->out.h.error = -ECONNREFUSED;
 	else {
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		queue_request(ch, req);
 		/* acquire extra reference, since request is still needed
 		   after request_end() */
 		__fuse_get_request(req);
+		spin_unlock(&ch->lock);
 
 		request_wait_answer(fc, req);
+		return;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 }
 
 void fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
@@ -609,7 +684,9 @@ static void fuse_request_send_nowait(struct fuse_conn *fc, struct fuse_req *req)
 		fuse_request_send_nowait_locked(fc, req);
 		spin_unlock(&fc->lock);
 	} else {
+		spin_unlock(&fc->lock);
 		req->out.h.error = -ENOTCONN;
+		req->state = FUSE_REQ_FINISHED;
 		request_end(fc, req);
 	}
 }
@@ -624,16 +701,17 @@ EXPORT_SYMBOL_GPL(fuse_request_send_background);
 static int fuse_request_send_notify_reply(struct fuse_conn *fc,
 					  struct fuse_req *req, u64 unique)
 {
+	struct fuse_chan *ch;
 	int err = -ENODEV;
 
 	req->isreply = 0;
 	req->in.h.unique = unique;
-	spin_lock(&fc->lock);
-	if (fc->connected) {
-		queue_request(fc, req);
+	ch = fuse_chan_lock_queue(fc);
+	if (ch->connected) {
+		queue_request(ch, req);
 		err = 0;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 
 	return err;
 }
@@ -676,16 +754,17 @@ void fuse_force_forget(struct file *file, u64 nodeid)
  * anything that could cause a page-fault.  If the request was already
  * aborted bail out.
  */
-static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
+static int lock_request(struct fuse_req *req)
 {
 	int err = 0;
 	if (req) {
-		spin_lock(&fc->lock);
+		struct fuse_chan *ch = fuse_req_chan_lock(req);
+
 		if (req->aborted)
 			err = -ENOENT;
 		else
 			req->locked = 1;
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 	}
 	return err;
 }
@@ -695,14 +774,15 @@ static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
  * requester thread is currently waiting for it to be unlocked, so
  * wake it up.
  */
-static void unlock_request(struct fuse_conn *fc, struct fuse_req *req)
+static void unlock_request(struct fuse_req *req)
 {
 	if (req) {
-		spin_lock(&fc->lock);
+		struct fuse_chan *ch = fuse_req_chan_lock(req);
+
 		req->locked = 0;
 		if (req->aborted)
 			wake_up(&req->waitq);
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 	}
 }
 
@@ -760,7 +840,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 	struct page *page;
 	int err;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 	if (cs->pipebufs) {
 		struct pipe_buffer *buf = cs->pipebufs;
@@ -809,7 +889,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 		iov_iter_advance(cs->iter, err);
 	}
 
-	return lock_request(cs->fc, cs->req);
+	return lock_request(cs->req);
 }
 
 /* Do as much copy to/from userspace buffer as we can */
@@ -859,8 +939,9 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 	struct page *oldpage = *pagep;
 	struct page *newpage;
 	struct pipe_buffer *buf = cs->pipebufs;
+	struct fuse_chan *ch;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 
 	err = buf->ops->confirm(cs->pipe, buf);
@@ -914,12 +995,12 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 		lru_cache_add_file(newpage);
 
 	err = 0;
-	spin_lock(&cs->fc->lock);
+	ch = fuse_req_chan_lock(cs->req);
 	if (cs->req->aborted)
 		err = -ENOENT;
 	else
 		*pagep = newpage;
-	spin_unlock(&cs->fc->lock);
+	spin_unlock(&ch->lock);
 
 	if (err) {
 		unlock_page(newpage);
@@ -939,7 +1020,7 @@ out_fallback:
 	cs->pg = buf->page;
 	cs->offset = buf->offset;
 
-	err = lock_request(cs->fc, cs->req);
+	err = lock_request(cs->req);
 	if (err)
 		return err;
 
@@ -954,7 +1035,7 @@ static int fuse_ref_page(struct fuse_copy_state *cs, struct page *page,
 	if (cs->nr_segs == cs->pipe->buffers)
 		return -EIO;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 
 	buf = cs->pipebufs;
@@ -1065,36 +1146,36 @@ static int fuse_copy_args(struct fuse_copy_state *cs, unsigned numargs,
 	return err;
 }
 
-static int forget_pending(struct fuse_conn *fc)
+static int forget_pending(struct fuse_chan *ch)
 {
-	return fc->forget_list_head.next != NULL;
+	return ch->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+static int request_pending(struct fuse_chan *ch)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	return !list_empty(&ch->pending) || !list_empty(&ch->interrupts) ||
+		forget_pending(ch);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void request_wait(struct fuse_chan *ch)
+__releases(ch->lock)
+__acquires(ch->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&ch->waitq, &wait);
+	while (ch->connected && !request_pending(ch)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 		schedule();
-		spin_lock(&fc->lock);
+		spin_lock(&ch->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&ch->waitq, &wait);
 }
 
 /*
@@ -1103,11 +1184,11 @@ __acquires(fc->lock)
  * Unlike other requests this is assembled on demand, without a need
  * to allocate a separate fuse_req structure.
  *
- * Called with fc->lock held, releases it
+ * Called with ch->lock held, releases it
  */
-static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_copy_state *cs,
+static int fuse_read_interrupt(struct fuse_chan *ch, struct fuse_copy_state *cs,
 			       size_t nbytes, struct fuse_req *req)
-__releases(fc->lock)
+__releases(ch->lock)
 {
 	struct fuse_in_header ih;
 	struct fuse_interrupt_in arg;
@@ -1115,7 +1196,7 @@ __releases(fc->lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = fuse_get_unique(ch->fc);
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -1123,7 +1204,7 @@ __releases(fc->lock)
 	ih.unique = req->intr_unique;
 	arg.unique = req->in.h.unique;
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 	if (nbytes < reqsize)
 		return -EINVAL;
 
@@ -1135,21 +1216,21 @@ __releases(fc->lock)
 	return err ? err : reqsize;
 }
 
-static struct fuse_forget_link *dequeue_forget(struct fuse_conn *fc,
+static struct fuse_forget_link *dequeue_forget(struct fuse_chan *ch,
 					       unsigned max,
 					       unsigned *countp)
 {
-	struct fuse_forget_link *head = fc->forget_list_head.next;
+	struct fuse_forget_link *head = ch->forget_list_head.next;
 	struct fuse_forget_link **newhead = &head;
 	unsigned count;
 
 	for (count = 0; *newhead != NULL && count < max; count++)
 		newhead = &(*newhead)->next;
 
-	fc->forget_list_head.next = *newhead;
+	ch->forget_list_head.next = *newhead;
 	*newhead = NULL;
-	if (fc->forget_list_head.next == NULL)
-		fc->forget_list_tail = &fc->forget_list_head;
+	if (ch->forget_list_head.next == NULL)
+		ch->forget_list_tail = &ch->forget_list_head;
 
 	if (countp != NULL)
 		*countp = count;
@@ -1157,24 +1238,24 @@ static struct fuse_forget_link *dequeue_forget(struct fuse_conn *fc,
 	return head;
 }
 
-static int fuse_read_single_forget(struct fuse_conn *fc,
+static int fuse_read_single_forget(struct fuse_chan *ch,
 				   struct fuse_copy_state *cs,
 				   size_t nbytes)
-__releases(fc->lock)
+__releases(ch->lock)
 {
 	int err;
-	struct fuse_forget_link *forget = dequeue_forget(fc, 1, NULL);
+	struct fuse_forget_link *forget = dequeue_forget(ch, 1, NULL);
 	struct fuse_forget_in arg = {
 		.nlookup = forget->forget_one.nlookup,
 	};
 	struct fuse_in_header ih = {
 		.opcode = FUSE_FORGET,
 		.nodeid = forget->forget_one.nodeid,
-		.unique = fuse_get_unique(fc),
+		.unique = fuse_get_unique(ch->fc),
 		.len = sizeof(ih) + sizeof(arg),
 	};
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 	kfree(forget);
 	if (nbytes < ih.len)
 		return -EINVAL;
@@ -1190,9 +1271,9 @@ __releases(fc->lock)
 	return ih.len;
 }
 
-static int fuse_read_batch_forget(struct fuse_conn *fc,
+static int fuse_read_batch_forget(struct fuse_chan *ch,
 				   struct fuse_copy_state *cs, size_t nbytes)
-__releases(fc->lock)
+__releases(ch->lock)
 {
 	int err;
 	unsigned max_forgets;
@@ -1201,18 +1282,18 @@ __releases(fc->lock)
 	struct fuse_batch_forget_in arg = { .count = 0 };
 	struct fuse_in_header ih = {
 		.opcode = FUSE_BATCH_FORGET,
-		.unique = fuse_get_unique(fc),
+		.unique = fuse_get_unique(ch->fc),
 		.len = sizeof(ih) + sizeof(arg),
 	};
 
 	if (nbytes < ih.len) {
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 		return -EINVAL;
 	}
 
 	max_forgets = (nbytes - ih.len) / sizeof(struct fuse_forget_one);
-	head = dequeue_forget(fc, max_forgets, &count);
-	spin_unlock(&fc->lock);
+	head = dequeue_forget(ch, max_forgets, &count);
+	spin_unlock(&ch->lock);
 
 	arg.count = count;
 	ih.len += count * sizeof(struct fuse_forget_one);
@@ -1239,14 +1320,14 @@ __releases(fc->lock)
 	return ih.len;
 }
 
-static int fuse_read_forget(struct fuse_conn *fc, struct fuse_copy_state *cs,
+static int fuse_read_forget(struct fuse_chan *ch, struct fuse_copy_state *cs,
 			    size_t nbytes)
-__releases(fc->lock)
+__releases(ch->lock)
 {
-	if (fc->minor < 16 || fc->forget_list_head.next->next == NULL)
-		return fuse_read_single_forget(fc, cs, nbytes);
+	if (ch->fc->minor < 16 || ch->forget_list_head.next->next == NULL)
+		return fuse_read_single_forget(ch, cs, nbytes);
 	else
-		return fuse_read_batch_forget(fc, cs, nbytes);
+		return fuse_read_batch_forget(ch, cs, nbytes);
 }
 
 /*
@@ -1255,49 +1336,50 @@ __releases(fc->lock)
  * the pending list and copies request data to userspace buffer.  If
  * no reply is needed (FORGET) or request has been aborted or there
  * was an error during the copying then it's finished by calling
- * request_end().  Otherwise add it to the processing list, and set
- * the 'sent' flag.
+ * request_end().  Otherwise add it to the processing list of the
+ * channel, and set the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_chan *ch, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_conn *fc = ch->fc;
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
 
  restart:
-	spin_lock(&fc->lock);
+	spin_lock(&ch->lock);
 	err = -EAGAIN;
-	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	if ((file->f_flags & O_NONBLOCK) && ch->connected &&
+	    !request_pending(ch))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(ch);
 	err = -ENODEV;
-	if (!fc->connected)
+	if (!ch->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(ch))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&ch->interrupts)) {
+		req = list_entry(ch->interrupts.next, struct fuse_req,
 				 intr_entry);
-		return fuse_read_interrupt(fc, cs, nbytes, req);
+		return fuse_read_interrupt(ch, cs, nbytes, req);
 	}
 
-	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
-			return fuse_read_forget(fc, cs, nbytes);
+	if (forget_pending(ch)) {
+		if (list_empty(&ch->pending) || ch->forget_batch-- > 0)
+			return fuse_read_forget(ch, cs, nbytes);
 
-		if (fc->forget_batch <= -8)
-			fc->forget_batch = 16;
+		if (ch->forget_batch <= -8)
+			ch->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(ch->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &ch->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
@@ -1307,40 +1389,47 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		/* SETXATTR is special, since it may contain too large data */
 		if (in->h.opcode == FUSE_SETXATTR)
 			req->out.h.error = -E2BIG;
+		request_unlink(req);
+		spin_unlock(&ch->lock);
 		request_end(fc, req);
 		goto restart;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 	cs->req = req;
 	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
 	if (!err)
 		err = fuse_copy_args(cs, in->numargs, in->argpages,
 				     (struct fuse_arg *) in->args, 0);
 	fuse_copy_finish(cs);
-	spin_lock(&fc->lock);
+	spin_lock(&ch->lock);
 	req->locked = 0;
 	if (req->aborted) {
+		spin_unlock(&ch->lock);
 		request_end(fc, req);
 		return -ENODEV;
 	}
 	if (err) {
 		req->out.h.error = -EIO;
+		request_unlink(req);
+		spin_unlock(&ch->lock);
 		request_end(fc, req);
 		return err;
 	}
-	if (!req->isreply)
+	if (!req->isreply) {
+		request_unlink(req);
+		spin_unlock(&ch->lock);
 		request_end(fc, req);
-	else {
+	} else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list, &ch->processing);
 		if (req->interrupted)
-			queue_interrupt(fc, req);
-		spin_unlock(&fc->lock);
+			queue_interrupt(ch, req);
+		spin_unlock(&ch->lock);
 	}
 	return reqsize;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 	return err;
 }
 
@@ -1348,8 +1437,9 @@ static int fuse_dev_open(struct inode *inode, struct file *file)
 {
 	/*
 	 * The fuse device's file's private_data is used to hold
-	 * the fuse_conn(ection) when it is mounted, and is used to
-	 * keep track of whether the file has been mounted already.
+	 * the request channel of the fuse_conn(ection) when it is
+	 * mounted or cloned, and is used to keep track of whether the
+	 * file has been attached already.
 	 */
 	file->private_data = NULL;
 	return 0;
@@ -1359,16 +1449,16 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, struct iov_iter *to)
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
 	if (!iter_is_iovec(to))
 		return -EINVAL;
 
-	fuse_copy_init(&cs, fc, 1, to);
+	fuse_copy_init(&cs, ch->fc, 1, to);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_iter_count(to));
+	return fuse_dev_do_read(ch, file, &cs, iov_iter_count(to));
 }
 
 static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
@@ -1380,18 +1470,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(in);
+	if (!ch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL);
+	fuse_copy_init(&cs, ch->fc, 1, NULL);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(ch, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1715,7 +1805,7 @@ static int fuse_retrieve(struct fuse_conn *fc, struct inode *inode,
 		num = file_size - outarg->offset;
 
 	num_pages = (num + offset + PAGE_SIZE - 1) >> PAGE_SHIFT;
-	num_pages = min(num_pages, FUSE_MAX_PAGES_PER_REQ);
+	num_pages = min(num_pages, fc->max_pages);
 
 	req = fuse_get_req(fc, num_pages);
 	if (IS_ERR(req))
@@ -1830,11 +1920,11 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct fuse_chan *ch, u64 unique)
 {
 	struct fuse_req *req;
 
-	list_for_each_entry(req, &fc->processing, list) {
+	list_for_each_entry(req, &ch->processing, list) {
 		if (req->in.h.unique == unique || req->intr_unique == unique)
 			return req;
 	}
@@ -1867,14 +1957,15 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
 /*
  * Write a single reply to a request.  First the header is copied from
  * the write buffer.  The request is then searched on the processing
- * list by the unique ID found in the header.  If found, then remove
- * it from the list and copy the rest of the buffer to the request.
- * The request is finished by calling request_end()
+ * list of the channel by the unique ID found in the header.  If found,
+ * then remove it from the list and copy the rest of the buffer to the
+ * request.  The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_chan *ch,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_conn *fc = ch->fc;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
 
@@ -1902,19 +1993,18 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (oh.error <= -1000 || oh.error > 0)
 		goto err_finish;
 
-	spin_lock(&fc->lock);
+	spin_lock(&ch->lock);
 	err = -ENOENT;
-	if (!fc->connected)
+	if (!ch->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(ch, oh.unique);
 	if (!req)
 		goto err_unlock;
 
 	if (req->aborted) {
-		spin_unlock(&fc->lock);
+		spin_unlock(&ch->lock);
 		fuse_copy_finish(cs);
-		spin_lock(&fc->lock);
 		request_end(fc, req);
 		return -ENOENT;
 	}
@@ -1924,41 +2014,46 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 		if (nbytes != sizeof(struct fuse_out_header))
 			goto err_unlock;
 
-		if (oh.error == -ENOSYS)
-			fc->no_interrupt = 1;
-		else if (oh.error == -EAGAIN)
-			queue_interrupt(fc, req);
+		if (oh.error == -EAGAIN)
+			queue_interrupt(ch, req);
+		spin_unlock(&ch->lock);
 
-		spin_unlock(&fc->lock);
+		if (oh.error == -ENOSYS) {
+			spin_lock(&fc->lock);
+			fc->no_interrupt = 1;
+			spin_unlock(&fc->lock);
+		}
 		fuse_copy_finish(cs);
 		return nbytes;
 	}
 
 	req->state = FUSE_REQ_WRITING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &ch->io);
 	req->out.h = oh;
 	req->locked = 1;
 	cs->req = req;
 	if (!req->out.page_replace)
 		cs->move_pages = 0;
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 
 	err = copy_out_args(cs, &req->out, nbytes);
 	fuse_copy_finish(cs);
 
-	spin_lock(&fc->lock);
+	spin_lock(&ch->lock);
 	req->locked = 0;
 	if (!err) {
 		if (req->aborted)
 			err = -ENOENT;
 	} else if (!req->aborted)
 		req->out.h.error = -EIO;
+	request_unlink(req);
+	spin_unlock(&ch->lock);
 	request_end(fc, req);
 
 	return err ? err : nbytes;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
  err_finish:
 	fuse_copy_finish(cs);
 	return err;
@@ -1967,16 +2062,16 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 static ssize_t fuse_dev_write(struct kiocb *iocb, struct iov_iter *from)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(iocb->ki_filp);
+	if (!ch)
 		return -EPERM;
 
 	if (!iter_is_iovec(from))
 		return -EINVAL;
 
-	fuse_copy_init(&cs, fc, 0, from);
+	fuse_copy_init(&cs, ch->fc, 0, from);
 
-	return fuse_dev_do_write(fc, &cs, iov_iter_count(from));
+	return fuse_dev_do_write(ch, &cs, iov_iter_count(from));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1987,12 +2082,12 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc;
+	struct fuse_chan *ch;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	ch = fuse_get_chan(out);
+	if (!ch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
@@ -2039,7 +2134,7 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	}
 	pipe_unlock(pipe);
 
-	fuse_copy_init(&cs, fc, 0, NULL);
+	fuse_copy_init(&cs, ch->fc, 0, NULL);
 	cs.pipebufs = bufs;
 	cs.nr_segs = nbuf;
 	cs.pipe = pipe;
@@ -2047,7 +2142,7 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(ch, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -2061,18 +2156,18 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	poll_wait(file, &ch->waitq, wait);
 
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	spin_lock(&ch->lock);
+	if (!ch->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(ch))
 		mask |= POLLIN | POLLRDNORM;
-	spin_unlock(&fc->lock);
+	spin_unlock(&ch->lock);
 
 	return mask;
 }
@@ -2080,18 +2175,20 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 /*
  * Abort all requests on the given list (pending or processing)
  *
- * This function releases and reacquires fc->lock
+ * This function releases and reacquires ch->lock
  */
-static void end_requests(struct fuse_conn *fc, struct list_head *head)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_requests(struct fuse_chan *ch, struct list_head *head)
+__releases(ch->lock)
+__acquires(ch->lock)
 {
 	while (!list_empty(head)) {
 		struct fuse_req *req;
 		req = list_entry(head->next, struct fuse_req, list);
 		req->out.h.error = -ECONNABORTED;
-		request_end(fc, req);
-		spin_lock(&fc->lock);
+		request_unlink(req);
+		spin_unlock(&ch->lock);
+		request_end(ch->fc, req);
+		spin_lock(&ch->lock);
 	}
 }
 
@@ -2106,42 +2203,49 @@ __acquires(fc->lock)
  * called after waiting for the request to be unlocked (if it was
  * locked).
  */
-static void end_io_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_io_requests(struct fuse_chan *ch)
+__releases(ch->lock)
+__acquires(ch->lock)
 {
-	while (!list_empty(&fc->io)) {
+	struct fuse_conn *fc = ch->fc;
+
+	while (!list_empty(&ch->io)) {
 		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
+			list_entry(ch->io.next, struct fuse_req, list);
 		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 
 		req->aborted = 1;
 		req->out.h.error = -ECONNABORTED;
-		req->state = FUSE_REQ_FINISHED;
-		list_del_init(&req->list);
+		request_unlink(req);
 		wake_up(&req->waitq);
 		if (end) {
 			req->end = NULL;
 			__fuse_get_request(req);
-			spin_unlock(&fc->lock);
+			spin_unlock(&ch->lock);
 			wait_event(req->waitq, !req->locked);
 			end(fc, req);
 			fuse_put_request(fc, req);
-			spin_lock(&fc->lock);
+			spin_lock(&ch->lock);
 		}
 	}
 }
 
-static void end_queued_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+/*
+ * Disconnect a channel and end everything queued on it.  Called with
+ * ch->lock held, releases and reacquires it
+ */
+static void end_chan_requests(struct fuse_chan *ch)
+__releases(ch->lock)
+__acquires(ch->lock)
 {
-	fc->max_background = UINT_MAX;
-	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
-	while (forget_pending(fc))
-		kfree(dequeue_forget(fc, 1, NULL));
+	ch->connected = 0;
+	end_io_requests(ch);
+	end_requests(ch, &ch->pending);
+	end_requests(ch, &ch->processing);
+	while (forget_pending(ch))
+		kfree(dequeue_forget(ch, 1, NULL));
+	wake_up_all(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 }
 
 static void end_polls(struct fuse_conn *fc)
@@ -2170,9 +2274,11 @@ static void end_polls(struct fuse_conn *fc)
  * is the combination of an asynchronous request and the tricky
  * deadlock (see Documentation/filesystems/fuse.txt).
  *
- * During the aborting, progression of requests from the pending and
- * processing lists onto the io list, and progression of new requests
- * onto the pending list is prevented by req->connected being false.
+ * Background requests are flushed to the channels first, then each
+ * channel is disconnected in turn.  During the aborting, progression
+ * of requests from the pending and processing lists onto the io list,
+ * and progression of new requests onto the pending list is prevented
+ * by ch->connected being false.
  *
  * Progression of requests under I/O to the processing list is
  * prevented by the req->aborted flag being true for these requests.
@@ -2180,34 +2286,76 @@ static void end_polls(struct fuse_conn *fc)
  */
 void fuse_abort_conn(struct fuse_conn *fc)
 {
+	struct fuse_chan *ch;
+
 	spin_lock(&fc->lock);
-	if (fc->connected) {
-		fc->connected = 0;
-		fc->blocked = 0;
-		fuse_set_initialized(fc);
-		end_io_requests(fc);
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->waitq);
-		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	if (!fc->connected) {
+		spin_unlock(&fc->lock);
+		return;
 	}
+	fc->connected = 0;
+	fc->blocked = 0;
+	fuse_set_initialized(fc);
+	fc->max_background = UINT_MAX;
+	flush_bg_queue(fc);
+	end_polls(fc);
+	wake_up_all(&fc->blocked_waitq);
 	spin_unlock(&fc->lock);
+
+	/*
+	 * Channels are added under fc->lock and only freed with the
+	 * connection, so the list can be walked without it.  Channels
+	 * added after fc->connected was cleared start out disconnected.
+	 */
+	list_for_each_entry_rcu(ch, &fc->chans, entry) {
+		spin_lock(&ch->lock);
+		end_chan_requests(ch);
+		spin_unlock(&ch->lock);
+	}
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * Release a cloned channel.  Requests not yet read from it are handed
+ * over to the main channel, requests already read are aborted since
+ * their replies can only arrive through this channel.
+ */
+static void fuse_chan_release(struct fuse_chan *ch)
+{
+	struct fuse_conn *fc = ch->fc;
+	struct fuse_chan *mch = &fc->main_chan;
+	struct fuse_req *req;
+
+	spin_lock(&fc->lock);
+	if (ch->cpu >= 0 && fc->cpu_chan[ch->cpu] == ch)
+		fc->cpu_chan[ch->cpu] = NULL;
+	spin_unlock(&fc->lock);
+
+	spin_lock(&mch->lock);
+	spin_lock_nested(&ch->lock, SINGLE_DEPTH_NESTING);
+	ch->connected = 0;
+	if (mch->connected && !list_empty(&ch->pending)) {
+		list_for_each_entry(req, &ch->pending, list)
+			req->chan = mch;
+		list_splice_tail_init(&ch->pending, &mch->pending);
+		wake_up(&mch->waitq);
+		kill_fasync(&mch->fasync, SIGIO, POLL_IN);
+	}
+	spin_unlock(&mch->lock);
+	end_chan_requests(ch);
+	spin_unlock(&ch->lock);
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
-		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		fuse_set_initialized(fc);
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->blocked_waitq);
-		spin_unlock(&fc->lock);
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (ch) {
+		struct fuse_conn *fc = ch->fc;
+
+		if (ch == &fc->main_chan)
+			fuse_abort_conn(fc);
+		else
+			fuse_chan_release(ch);
 		fuse_conn_put(fc);
 	}
 
@@ -2217,12 +2365,130 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &ch->fasync);
+}
+
+/* Attach a freshly opened /dev/fuse file to the connection of oldfd */
+static int fuse_dev_clone(struct file *file, int oldfd)
+{
+	struct fuse_chan *och, *ch;
+	struct fuse_conn *fc;
+	struct file *old;
+	int err = -EINVAL;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	if (old->f_op != &fuse_dev_operations)
+		goto out_fput;
+	och = fuse_get_chan(old);
+	if (!och)
+		goto out_fput;
+	fc = och->fc;
+
+	err = -ENOMEM;
+	ch = kmalloc(sizeof(*ch), GFP_KERNEL);
+	if (!ch)
+		goto out_fput;
+	fuse_chan_init(ch, fc);
+
+	mutex_lock(&fuse_mutex);
+	err = -EINVAL;
+	if (file->private_data) {
+		mutex_unlock(&fuse_mutex);
+		kfree(ch);
+		goto out_fput;
+	}
+	spin_lock(&fc->lock);
+	ch->connected = fc->connected;
+	list_add_tail_rcu(&ch->entry, &fc->chans);
+	spin_unlock(&fc->lock);
+	fuse_conn_get(fc);
+	file->private_data = ch;
+	mutex_unlock(&fuse_mutex);
+	err = 0;
+
+ out_fput:
+	fput(old);
+	return err;
+}
+
+/* Route requests submitted on @cpu to the channel */
+static int fuse_chan_bind_cpu(struct fuse_chan *ch, u32 cpu)
+{
+	struct fuse_conn *fc = ch->fc;
+	struct fuse_chan **map = NULL;
+
+	if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	if (!ACCESS_ONCE(fc->cpu_chan)) {
+		map = kcalloc(nr_cpu_ids, sizeof(*map), GFP_KERNEL);
+		if (!map)
+			return -ENOMEM;
+	}
+
+	spin_lock(&fc->lock);
+	if (!fc->cpu_chan && map) {
+		smp_store_release(&fc->cpu_chan, map);
+		map = NULL;
+	}
+	if (ch->cpu >= 0 && fc->cpu_chan[ch->cpu] == ch)
+		fc->cpu_chan[ch->cpu] = NULL;
+	ch->cpu = cpu;
+	fc->cpu_chan[cpu] = ch;
+	spin_unlock(&fc->lock);
+	kfree(map);
+
+	return 0;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fuse_backing_map map;
+	struct fuse_chan *ch;
+	u32 val;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		if (get_user(val, (u32 __user *) arg))
+			return -EFAULT;
+		return fuse_dev_clone(file, val);
+
+	case FUSE_DEV_IOC_BIND_CPU:
+		ch = fuse_get_chan(file);
+		if (!ch)
+			return -EPERM;
+		if (get_user(val, (u32 __user *) arg))
+			return -EFAULT;
+		return fuse_chan_bind_cpu(ch, val);
+
+	case FUSE_DEV_IOC_BACKING_OPEN:
+		ch = fuse_get_chan(file);
+		if (!ch)
+			return -EPERM;
+		if (copy_from_user(&map, (void __user *) arg, sizeof(map)))
+			return -EFAULT;
+		return fuse_backing_open(ch->fc, &map);
+
+	case FUSE_DEV_IOC_BACKING_CLOSE:
+		ch = fuse_get_chan(file);
+		if (!ch)
+			return -EPERM;
+		if (get_user(val, (u32 __user *) arg))
+			return -EFAULT;
+		return fuse_backing_close(ch->fc, val);
+
+	default:
+		return -ENOTTY;
+	}
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2236,6 +2502,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -439,6 +439,7 @@ static int fuse_create_open(struct inode *dir, struct dentry *entry,
 	ff->fh = outopen.fh;
 	ff->nodeid = outentry.nodeid;
 	ff->open_flags = outopen.open_flags;
+	fuse_passthrough_setup(fc, ff, &outopen);
 	inode = fuse_iget(dir->i_sb, outentry.nodeid, outentry.generation,
 			  &outentry.attr, entry_attr_timeout(&outentry), 0);
 	if (!inode) {
@@ -1728,11 +1729,22 @@ static int fuse_getattr(struct vfsmount *mnt, struct dentry *entry,
 {
 	struct inode *inode = d_inode(entry);
 	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_inode *fi = get_fuse_inode(inode);
 
 	if (!fuse_allow_current_process(fc))
 		return -EACCES;
 
-	return fuse_update_attributes(inode, stat, NULL, NULL);
+	switch (stat->query_flags & AT_STATX_SYNC_TYPE) {
+	case AT_STATX_FORCE_SYNC:
+		return fuse_do_getattr(inode, stat, NULL);
+	case AT_STATX_DONT_SYNC:
+		generic_fillattr(inode, stat);
+		stat->mode = fi->orig_i_mode;
+		stat->ino = fi->orig_ino;
+		return 0;
+	default:
+		return fuse_update_attributes(inode, stat, NULL, NULL);
+	}
 }
 
 static int fuse_setxattr(struct dentry *entry, const char *name,
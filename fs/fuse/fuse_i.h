@@ -23,10 +23,17 @@
 #include <linux/poll.h>
 #include <linux/workqueue.h>
 #include <linux/kref.h>
+#include <linux/idr.h>
 
 /** Max number of pages that can be used in a single read request */
 #define FUSE_MAX_PAGES_PER_REQ 32
 
+/** Upper limit for fc->max_pages, as negotiated with FUSE_MAX_PAGES */
+#define FUSE_MAX_MAX_PAGES 256
+
+/** Superblock magic of fuse filesystems */
+#define FUSE_SUPER_MAGIC 0x65735546
+
 /** Bias for fi->writectr, meaning new writepages must not be sent */
 #define FUSE_NOWRITE INT_MIN
 
@@ -156,6 +163,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Backing file for FOPEN_PASSTHROUGH, or NULL */
+	struct file *passthrough;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -292,10 +302,13 @@ struct fuse_req {
 	/** Unique ID for the interrupt request */
 	u64 intr_unique;
 
+	/** The channel the request is queued on */
+	struct fuse_chan *chan;
+
 	/*
 	 * The following bitfields are either set once before the
 	 * request is queued or setting/clearing them is protected by
-	 * fuse_conn->lock
+	 * the lock of the request's channel
 	 */
 
 	/** True if the request has reply */
@@ -389,6 +402,61 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * A request channel.
+ *
+ * Every /dev/fuse file attached to a connection has one.  The file
+ * the filesystem was mounted with owns the main channel embedded in
+ * the connection, further channels are cloned from it with the
+ * FUSE_DEV_IOC_CLONE ioctl.  A channel may be bound to a CPU, in
+ * which case requests submitted on that CPU are queued on it instead
+ * of on the main channel.  Replies must be written to the channel
+ * the request was read from.
+ *
+ * Channels are only freed together with the connection.
+ */
+struct fuse_chan {
+	/** Lock protecting the request lists and flags of the channel */
+	spinlock_t lock;
+
+	/** The connection this channel belongs to */
+	struct fuse_conn *fc;
+
+	/** Entry on fc->chans */
+	struct list_head entry;
+
+	/** Readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being processed */
+	struct list_head processing;
+
+	/** The list of requests under I/O */
+	struct list_head io;
+
+	/** Pending interrupts */
+	struct list_head interrupts;
+
+	/** Queue of pending forgets, only used on the main channel */
+	struct fuse_forget_link forget_list_head;
+	struct fuse_forget_link *forget_list_tail;
+
+	/** Batching of FORGET requests (positive indicates FORGET batch) */
+	int forget_batch;
+
+	/** CPU the channel is bound to, or -1; protected by fc->lock */
+	int cpu;
+
+	/** Channel accepts requests, cleared on release and abort */
+	unsigned connected;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+};
+
 /**
  * A Fuse connection.
  *
@@ -420,17 +488,17 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** Maximum number of pages in a read, write or writeback request */
+	unsigned max_pages;
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** The channel of the file the filesystem was mounted with */
+	struct fuse_chan main_chan;
 
-	/** The list of requests being processed */
-	struct list_head processing;
+	/** All channels of the connection, including the main one */
+	struct list_head chans;
 
-	/** The list of requests under I/O */
-	struct list_head io;
+	/** Channels bound to CPUs, indexed by CPU; NULL until first bind */
+	struct fuse_chan **cpu_chan;
 
 	/** The next unique kernel file handle */
 	u64 khctr;
@@ -453,16 +521,6 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
-	/** Queue of pending forgets */
-	struct fuse_forget_link forget_list_head;
-	struct fuse_forget_link *forget_list_tail;
-
-	/** Batching of FORGET requests (positive indicates FORGET batch) */
-	int forget_batch;
-
 	/** Flag indicating that INIT reply has been received. Allocating
 	 * any fuse request will be suspended until the flag is set */
 	int initialized;
@@ -479,7 +537,7 @@ struct fuse_conn {
 	wait_queue_head_t reserved_req_waitq;
 
 	/** The next unique request id */
-	u64 reqctr;
+	atomic64_t reqctr;
 
 	/** Connection established, cleared on umount, connection
 	    abort and device release */
@@ -508,6 +566,9 @@ struct fuse_conn {
 	/** write-back cache policy (default is write-through) */
 	unsigned writeback_cache:1;
 
+	/** Pass read, write and mmap of files through to backing files */
+	unsigned passthrough:1;
+
 	/*
 	 * The following bitfields are only for optimization purposes
 	 * and hence races in setting them will not cause malfunction
@@ -603,8 +664,8 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
+	/** Backing files registered for passthrough, protected by lock */
+	struct idr backing_files;
 
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
@@ -811,6 +872,17 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
+/**
+ * Initialize a request channel of a connection
+ */
+void fuse_chan_init(struct fuse_chan *ch, struct fuse_conn *fc);
+
+/**
+ * Lock the channel a request is queued on.  Returns the locked
+ * channel, or NULL if the request was never queued
+ */
+struct fuse_chan *fuse_req_chan_lock(struct fuse_req *req);
+
 /**
  * Invalidate inode attributes
  */
@@ -918,4 +990,14 @@ int fuse_do_setattr(struct inode *inode, struct iattr *attr,
 
 void fuse_set_initialized(struct fuse_conn *fc);
 
+/* passthrough.c */
+int fuse_backing_open(struct fuse_conn *fc, struct fuse_backing_map *map);
+int fuse_backing_close(struct fuse_conn *fc, int backing_id);
+void fuse_backing_files_free(struct fuse_conn *fc);
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
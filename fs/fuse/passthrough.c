@@ -0,0 +1,199 @@
+/*
+  FUSE: Filesystem in Userspace
+
+  File I/O passthrough to backing files registered by the daemon.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/idr.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+
+/*
+ * Register an open file of the daemon as a backing file.  The returned
+ * id can be handed back in fuse_open_out.backing_id together with
+ * FOPEN_PASSTHROUGH.  The connection keeps a reference to the file
+ * until the id is closed or the connection goes away.
+ */
+int fuse_backing_open(struct fuse_conn *fc, struct fuse_backing_map *map)
+{
+	struct file *file;
+	int id;
+
+	if (!fc->passthrough)
+		return -EOPNOTSUPP;
+
+	/* The backing file is accessed with the daemon's credentials */
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (map->flags || map->padding)
+		return -EINVAL;
+
+	file = fget(map->fd);
+	if (!file)
+		return -EBADF;
+
+	id = -EINVAL;
+	if (!S_ISREG(file_inode(file)->i_mode) ||
+	    file_inode(file)->i_sb->s_magic == FUSE_SUPER_MAGIC)
+		goto out_fput;
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->lock);
+	id = idr_alloc(&fc->backing_files, file, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->lock);
+	idr_preload_end();
+	if (id >= 0)
+		return id;
+
+ out_fput:
+	fput(file);
+	return id;
+}
+
+int fuse_backing_close(struct fuse_conn *fc, int backing_id)
+{
+	struct file *file;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (backing_id <= 0)
+		return -EINVAL;
+
+	spin_lock(&fc->lock);
+	file = idr_find(&fc->backing_files, backing_id);
+	if (file)
+		idr_remove(&fc->backing_files, backing_id);
+	spin_unlock(&fc->lock);
+	if (!file)
+		return -ENOENT;
+
+	/* Files opened in passthrough mode hold their own reference */
+	fput(file);
+	return 0;
+}
+
+static int fuse_backing_put_one(int id, void *p, void *data)
+{
+	fput(p);
+	return 0;
+}
+
+/* Called when the last reference to the connection is dropped */
+void fuse_backing_files_free(struct fuse_conn *fc)
+{
+	idr_for_each(&fc->backing_files, fuse_backing_put_one, NULL);
+	idr_destroy(&fc->backing_files);
+}
+
+/*
+ * Look at the reply to OPEN or CREATE and attach the backing file the
+ * daemon asked for.  If it doesn't exist, or the connection doesn't do
+ * passthrough, the file falls back to regular I/O through the daemon.
+ */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			    struct fuse_open_out *openarg)
+{
+	struct file *backing = NULL;
+
+	if (!(openarg->open_flags & FOPEN_PASSTHROUGH))
+		return;
+
+	ff->open_flags &= ~FOPEN_PASSTHROUGH;
+	if (!fc->passthrough || openarg->backing_id <= 0)
+		return;
+
+	spin_lock(&fc->lock);
+	backing = idr_find(&fc->backing_files, openarg->backing_id);
+	if (backing)
+		get_file(backing);
+	spin_unlock(&fc->lock);
+	if (!backing)
+		return;
+
+	ff->passthrough = backing;
+	ff->open_flags |= FOPEN_PASSTHROUGH;
+	ff->open_flags &= ~(FOPEN_DIRECT_IO | FOPEN_KEEP_CACHE);
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	ssize_t ret;
+
+	if (!(backing->f_mode & FMODE_READ))
+		return -EBADF;
+	if (!iov_iter_count(to))
+		return 0;
+
+	ret = vfs_iter_read(backing, to, &iocb->ki_pos);
+	if (ret >= 0)
+		fuse_invalidate_atime(file_inode(file));
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	ssize_t ret;
+
+	if (!(backing->f_mode & FMODE_WRITE))
+		return -EBADF;
+	if (!iov_iter_count(from))
+		return 0;
+
+	mutex_lock(&inode->i_mutex);
+	if (file->f_flags & O_APPEND)
+		iocb->ki_pos = i_size_read(file_inode(backing));
+
+	file_start_write(backing);
+	ret = vfs_iter_write(backing, from, &iocb->ki_pos);
+	file_end_write(backing);
+	if (ret > 0) {
+		fuse_write_update_size(inode, iocb->ki_pos);
+		fuse_invalidate_attr(inode);
+	}
+	mutex_unlock(&inode->i_mutex);
+
+	return ret;
+}
+
+/* Map the backing file directly, the fuse inode has no pages cached */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	int ret;
+
+	if (!backing->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(vma->vm_file != file))
+		return -EIO;
+
+	vma->vm_file = get_file(backing);
+	ret = backing->f_op->mmap(backing, vma);
+	if (ret) {
+		/* restore the fuse file on failure */
+		vma->vm_file = file;
+		fput(backing);
+	} else {
+		fput(file);
+		fuse_invalidate_atime(file_inode(file));
+	}
+
+	return ret;
+}
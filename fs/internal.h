@@ -43,6 +43,11 @@ extern void guard_bio_eod(int rw, struct bio *bio);
 extern int __block_write_begin_int(struct page *page, loff_t pos, unsigned len,
 		get_block_t *get_block, struct iomap *iomap);
 
+/*
+ * direct-io.c
+ */
+extern int sb_init_dio_done_wq(struct super_block *sb);
+
 /*
  * char_dev.c
  */
@@ -82,6 +87,7 @@ extern void chroot_fs_refs(const struct path *, const struct path *);
  * file_table.c
  */
 extern struct file *get_empty_filp(void);
+extern bool file_pcpu_deactivate(struct file *);
 
 /*
  * super.c
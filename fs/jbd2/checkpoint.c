@@ -178,6 +178,72 @@ void __jbd2_log_wait_for_space(journal_t *journal)
 	}
 }
 
+/*
+ * Free log space is considered low once it drops below twice what a new
+ * transaction needs.  Checkpointing from then on in the background keeps
+ * start_this_handle() from having to wait in __jbd2_log_wait_for_space().
+ */
+static int jbd2_log_space_low(journal_t *journal)
+{
+	return jbd2_log_space_left(journal) < 2 * jbd2_space_needed(journal);
+}
+
+/*
+ * jbd2_log_kick_checkpoint: start background checkpointing if the log is
+ * getting full and there is something to checkpoint.
+ *
+ * Called without any locks, or with j_state_lock held.
+ */
+void jbd2_log_kick_checkpoint(journal_t *journal)
+{
+	if (journal->j_flags & (JBD2_UNMOUNT | JBD2_ABORT))
+		return;
+	if (!journal->j_checkpoint_transactions || !jbd2_log_space_low(journal))
+		return;
+	queue_work(system_unbound_wq, &journal->j_chkpt_work);
+}
+
+void jbd2_checkpoint_work(struct work_struct *work)
+{
+	journal_t *journal = container_of(work, journal_t, j_chkpt_work);
+	int runs = 0;
+
+	/*
+	 * Somebody checkpointing already, either synchronously for space
+	 * or from unmount.  They will free what we would have.
+	 */
+	if (!mutex_trylock(&journal->j_checkpoint_mutex))
+		return;
+
+	while (!(journal->j_flags & (JBD2_UNMOUNT | JBD2_ABORT))) {
+		read_lock(&journal->j_state_lock);
+		if (!jbd2_log_space_low(journal)) {
+			read_unlock(&journal->j_state_lock);
+			break;
+		}
+		read_unlock(&journal->j_state_lock);
+
+		spin_lock(&journal->j_list_lock);
+		if (!journal->j_checkpoint_transactions) {
+			spin_unlock(&journal->j_list_lock);
+			break;
+		}
+		spin_unlock(&journal->j_list_lock);
+
+		if (jbd2_log_do_checkpoint(journal) < 0)
+			break;
+		runs++;
+		cond_resched();
+	}
+	mutex_unlock(&journal->j_checkpoint_mutex);
+
+	if (runs) {
+		spin_lock(&journal->j_history_lock);
+		journal->j_stats.ts_bg_checkpoints += runs;
+		spin_unlock(&journal->j_history_lock);
+	}
+}
+
 static void
 __flush_batch(journal_t *journal, int *batch_count)
 {
@@ -754,6 +754,167 @@ wait_commit:
 }
 EXPORT_SYMBOL(jbd2_complete_transaction);
 
+/*
+ * Fast commits log compact, client defined records for the running
+ * transaction into a small area at the end of the journal, without
+ * committing the transaction itself.  A fast commit and a full commit
+ * never run at the same time: the full commit of a transaction supersedes
+ * all its fast commits, after which the area is reused from its start.
+ */
+
+/*
+ * Start a fast commit of transaction @tid.  Returns -EALREADY if @tid has
+ * been or is being committed in full, in which case the caller should wait
+ * for that commit instead, after waiting for any commit in progress.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	if (unlikely(is_journal_aborted(journal)))
+		return -EIO;
+
+	if (!journal->j_fc_wbuf)
+		return -EOPNOTSUPP;
+
+	write_lock(&journal->j_state_lock);
+	if (tid_geq(journal->j_commit_sequence, tid)) {
+		write_unlock(&journal->j_state_lock);
+		return -EALREADY;
+	}
+
+	if (journal->j_flags &
+	    (JBD2_FAST_COMMIT_ONGOING | JBD2_FULL_COMMIT_ONGOING)) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		return -EALREADY;
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+
+	/*
+	 * A flushed journal is marked empty on disk and recovery would not
+	 * know which transaction the fast commit belongs to.  Point the
+	 * superblock at the current tail first, like a full commit does.
+	 */
+	if (journal->j_flags & JBD2_FLUSHED) {
+		int err;
+
+		mutex_lock(&journal->j_checkpoint_mutex);
+		err = jbd2_journal_update_sb_log_tail(journal,
+						      journal->j_tail_sequence,
+						      journal->j_tail,
+						      WRITE_FUA);
+		mutex_unlock(&journal->j_checkpoint_mutex);
+		if (err) {
+			jbd2_fc_end_commit(journal, tid);
+			return err;
+		}
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+
+/*
+ * Finish the fast commit started by jbd2_fc_begin_commit(), successful or
+ * not, and let a full commit or the next fast commit proceed.
+ */
+int jbd2_fc_end_commit(journal_t *journal, tid_t tid)
+{
+	if (journal->j_fc_cleanup_callback)
+		journal->j_fc_cleanup_callback(journal, 0, tid);
+
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+
+/*
+ * Return the next block of the fast commit area.  The buffer is neither
+ * read nor cleared, the caller fills it entirely before submitting it.
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	unsigned long blocknr;
+	struct buffer_head *bh;
+	int ret;
+
+	*bh_out = NULL;
+
+	if (journal->j_fc_first + journal->j_fc_off >= journal->j_fc_last)
+		return -ENOSPC;
+
+	blocknr = journal->j_fc_first + journal->j_fc_off;
+	ret = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (ret)
+		return ret;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+
+	journal->j_fc_wbuf[journal->j_fc_off++] = bh;
+	*bh_out = bh;
+
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_get_buf);
+
+/*
+ * Wait for the last @num_blks fast commit buffers handed out to be
+ * written, and drop them.
+ */
+int jbd2_fc_wait_bufs(journal_t *journal, int num_blks)
+{
+	struct buffer_head *bh;
+	int i, j_fc_off;
+	int ret = 0;
+
+	j_fc_off = journal->j_fc_off;
+
+	for (i = j_fc_off - 1; i >= j_fc_off - num_blks; i--) {
+		bh = journal->j_fc_wbuf[i];
+		if (!bh)
+			continue;
+		wait_on_buffer(bh);
+		if (unlikely(!buffer_uptodate(bh)))
+			ret = -EIO;
+		put_bh(bh);
+		journal->j_fc_wbuf[i] = NULL;
+	}
+
+	return ret;
+}
+EXPORT_SYMBOL(jbd2_fc_wait_bufs);
+
+/* Drop all fast commit buffers still held, without waiting for them */
+void jbd2_fc_release_bufs(journal_t *journal)
+{
+	struct buffer_head *bh;
+	int i;
+
+	if (!journal->j_fc_wbuf)
+		return;
+
+	for (i = journal->j_fc_off - 1; i >= 0; i--) {
+		bh = journal->j_fc_wbuf[i];
+		if (!bh)
+			continue;
+		put_bh(bh);
+		journal->j_fc_wbuf[i] = NULL;
+	}
+}
+EXPORT_SYMBOL(jbd2_fc_release_bufs);
+
 /*
  * Log buffer allocation routines:
  */
@@ -952,9 +1113,18 @@ static void *jbd2_seq_info_next(struct seq_file *seq, void *v, loff_t *pos)
 	return NULL;
 }
 
+static const char * const stall_names[JBD2_NR_STALLS] = {
+	[JBD2_STALL_LOCKED]	= "locked",
+	[JBD2_STALL_FULL]	= "full",
+	[JBD2_STALL_SPACE]	= "space",
+	[JBD2_STALL_RESERVED]	= "reserved",
+	[JBD2_STALL_BARRIER]	= "barrier",
+};
+
 static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 {
 	struct jbd2_stats_proc_session *s = seq->private;
+	int i;
 
 	if (v != SEQ_START_TOKEN)
 		return 0;
@@ -986,6 +1156,19 @@ static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 	    s->stats->run.rs_blocks / s->stats->ts_tid);
 	seq_printf(seq, "  %lu logged blocks per transaction\n",
 	    s->stats->run.rs_blocks_logged / s->stats->ts_tid);
+	seq_printf(seq, "%lu background checkpoints, "
+		   "%lu commits started early\n",
+		   s->stats->ts_bg_checkpoints, s->stats->ts_commit_ahead);
+	seq_puts(seq, "handle stalls (count, average us, max us):\n");
+	for (i = 0; i < JBD2_NR_STALLS; i++) {
+		struct jbd2_stall_stats_s *ss = &s->stats->stall[i];
+
+		seq_printf(seq, "  %-9s %lu %llu %llu\n", stall_names[i],
+			   ss->ss_count,
+			   ss->ss_count ?
+			   div_u64(div64_u64(ss->ss_time, ss->ss_count), 1000) : 0,
+			   div_u64(ss->ss_max, 1000));
+	}
 	return 0;
 }
 
@@ -1089,8 +1272,10 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
 	init_waitqueue_head(&journal->j_wait_reserved);
+	init_waitqueue_head(&journal->j_fc_wait);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
+	INIT_WORK(&journal->j_chkpt_work, jbd2_checkpoint_work);
 	spin_lock_init(&journal->j_revoke_lock);
 	spin_lock_init(&journal->j_list_lock);
 	rwlock_init(&journal->j_state_lock);
@@ -1288,6 +1473,8 @@ static int journal_reset(journal_t *journal)
 
 	first = be32_to_cpu(sb->s_first);
 	last = be32_to_cpu(sb->s_maxlen);
+	if (jbd2_has_fast_commit(journal))
+		last = journal->j_fc_first;
 	if (first + JBD2_MIN_JOURNAL_BLOCKS > last + 1) {
 		printk(KERN_ERR "JBD2: Journal too short (blocks %llu-%llu).\n",
 		       first, last);
@@ -1306,7 +1493,8 @@ static int journal_reset(journal_t *journal)
 	journal->j_commit_sequence = journal->j_transaction_sequence - 1;
 	journal->j_commit_request = journal->j_commit_sequence;
 
-	journal->j_max_transaction_buffers = journal->j_maxlen / 4;
+	journal->j_max_transaction_buffers = (journal->j_maxlen -
+		(journal->j_fc_last - journal->j_fc_first)) / 4;
 
 	/*
 	 * As a special case, if the on-disk copy is already marked as needing
@@ -1591,6 +1779,94 @@ out:
 	return err;
 }
 
+/*
+ * Allocate the buffer array for the fast commit area.
+ */
+static int jbd2_journal_alloc_fc_wbuf(journal_t *journal)
+{
+	int num_fc_blks = jbd2_journal_get_num_fc_blks(journal->j_superblock);
+
+	if (journal->j_fc_wbuf)
+		return 0;
+
+	journal->j_fc_wbuf = kcalloc(num_fc_blks, sizeof(struct buffer_head *),
+				     GFP_KERNEL);
+	if (!journal->j_fc_wbuf)
+		return -ENOMEM;
+	return 0;
+}
+
+/*
+ * Carve the fast commit area out of the end of the log.
+ */
+static int jbd2_journal_fc_layout(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long num_fc_blks = jbd2_journal_get_num_fc_blks(sb);
+	unsigned long last = be32_to_cpu(sb->s_maxlen);
+
+	if (journal->j_first + JBD2_MIN_JOURNAL_BLOCKS + num_fc_blks > last) {
+		printk(KERN_ERR "JBD2: Journal too short for %lu fast commit "
+		       "blocks.\n", num_fc_blks);
+		return -EINVAL;
+	}
+
+	journal->j_fc_last = last;
+	journal->j_fc_first = last - num_fc_blks;
+	journal->j_fc_off = 0;
+	journal->j_last = journal->j_fc_first;
+	return 0;
+}
+
+/*
+ * Enable fast commits on a loaded journal.  The area can only be taken
+ * from an empty log, i.e. right after the journal has been loaded.
+ */
+static int jbd2_journal_enable_fast_commit(journal_t *journal)
+{
+	unsigned long free;
+	int err;
+
+	if (!(journal->j_flags & JBD2_LOADED))
+		return 0;
+
+	err = jbd2_journal_alloc_fc_wbuf(journal);
+	if (err)
+		return err;
+
+	write_lock(&journal->j_state_lock);
+	free = journal->j_last - journal->j_first;
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_checkpoint_transactions ||
+	    journal->j_free != free) {
+		write_unlock(&journal->j_state_lock);
+		return -EBUSY;
+	}
+	err = jbd2_journal_fc_layout(journal);
+	if (!err) {
+		journal->j_free = journal->j_last - journal->j_first;
+		journal->j_head = journal->j_tail = journal->j_first;
+		journal->j_max_transaction_buffers =
+			(journal->j_last - journal->j_first) / 4;
+	}
+	write_unlock(&journal->j_state_lock);
+	if (err)
+		return err;
+
+	/*
+	 * Recovery must know about the area before the log can wrap short
+	 * of it, so write the feature out right away.
+	 */
+	journal->j_superblock->s_feature_incompat |=
+		cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+	mutex_lock(&journal->j_checkpoint_mutex);
+	jbd2_journal_update_sb_log_tail(journal, journal->j_tail_sequence,
+					journal->j_tail, WRITE_FUA);
+	mutex_unlock(&journal->j_checkpoint_mutex);
+	return 0;
+}
+
 /*
  * Load the on-disk journal superblock and read the key fields into the
  * journal_t.
@@ -1613,7 +1889,13 @@ static int load_superblock(journal_t *journal)
 	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
-	return 0;
+	if (jbd2_has_fast_commit(journal)) {
+		err = jbd2_journal_fc_layout(journal);
+		if (!err)
+			err = jbd2_journal_alloc_fc_wbuf(journal);
+	}
+
+	return err;
 }
 
 
@@ -1702,6 +1984,13 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_running_transaction)
 		jbd2_journal_commit_transaction(journal);
 
+	/*
+	 * JBD2_UNMOUNT is set now, so the work won't be queued again.  It
+	 * may have been waiting for the commit above, so only wait for it
+	 * once that is done.
+	 */
+	cancel_work_sync(&journal->j_chkpt_work);
+
 	/* Force any old transactions to disk */
 
 	/* Totally anal locking here... */
@@ -1751,6 +2040,8 @@ int jbd2_journal_destroy(journal_t *journal)
 		jbd2_journal_destroy_revoke(journal);
 	if (journal->j_chksum_driver)
 		crypto_free_shash(journal->j_chksum_driver);
+	jbd2_fc_release_bufs(journal);
+	kfree(journal->j_fc_wbuf);
 	kfree(journal->j_wbuf);
 	kfree(journal);
 
@@ -1898,6 +2189,11 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 			~cpu_to_be32(JBD2_FEATURE_INCOMPAT_CSUM_V2 |
 				     JBD2_FEATURE_INCOMPAT_CSUM_V3);
 
+	/* If enabling fast commits, reserve their area in the log */
+	if (INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+	    jbd2_journal_enable_fast_commit(journal))
+		return 0;
+
 	sb->s_feature_compat    |= cpu_to_be32(compat);
 	sb->s_feature_ro_compat |= cpu_to_be32(ro);
 	sb->s_feature_incompat  |= cpu_to_be32(incompat);
@@ -38,7 +38,6 @@ struct recovery_info
 	int		nr_revoke_hits;
 };
 
-enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
 static int do_one_pass(journal_t *journal,
 				struct recovery_info *info, enum passtype pass);
 static int scan_revoke_records(journal_t *, struct buffer_head *,
@@ -245,6 +244,53 @@ do {									\
  * blocks.  In the third and final pass, we replay any un-revoked blocks
  * in the log.
  */
+#ifdef __KERNEL__
+/*
+ * Hand the blocks of the fast commit area to the client.  Fast commits are
+ * only valid for the transaction following the last one found in the log,
+ * which is the transaction that was running when we crashed.
+ */
+static int fc_do_one_pass(journal_t *journal,
+			  struct recovery_info *info, enum passtype pass)
+{
+	unsigned int expected_commit_id = info->end_transaction;
+	unsigned long next_fc_block;
+	struct buffer_head *bh;
+	int err = 0;
+
+	if (!jbd2_has_fast_commit(journal) || !journal->j_fc_replay_callback)
+		return 0;
+
+	jbd_debug(1, "Processing fast commit blocks, pass %d\n", pass);
+	next_fc_block = journal->j_fc_first;
+	while (next_fc_block < journal->j_fc_last) {
+		err = jread(&bh, journal, next_fc_block);
+		if (err)
+			break;
+
+		err = journal->j_fc_replay_callback(journal, bh, pass,
+					next_fc_block - journal->j_fc_first,
+					expected_commit_id);
+		brelse(bh);
+		next_fc_block++;
+		if (err < 0 || err == JBD2_FC_REPLAY_STOP)
+			break;
+		err = 0;
+	}
+
+	if (err < 0)
+		printk(KERN_WARNING "JBD2: fast commit recovery failed, "
+		       "error %d\n", err);
+	return err < 0 ? err : 0;
+}
+#else
+static int fc_do_one_pass(journal_t *journal,
+			  struct recovery_info *info, enum passtype pass)
+{
+	return 0;
+}
+#endif
+
 int jbd2_journal_recover(journal_t *journal)
 {
 	int			err, err2;
@@ -265,7 +311,12 @@ int jbd2_journal_recover(journal_t *journal)
 		jbd_debug(1, "No recovery required, last transaction %d\n",
 			  be32_to_cpu(sb->s_sequence));
 		journal->j_transaction_sequence = be32_to_cpu(sb->s_sequence) + 1;
-		return 0;
+		/* The log was flushed, but fast commits may follow it */
+		info.end_transaction = be32_to_cpu(sb->s_sequence);
+		err = fc_do_one_pass(journal, &info, PASS_SCAN);
+		if (!err)
+			err = fc_do_one_pass(journal, &info, PASS_REPLAY);
+		return err;
 	}
 
 	err = do_one_pass(journal, &info, PASS_SCAN);
@@ -273,6 +324,10 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err)
+		err = fc_do_one_pass(journal, &info, PASS_SCAN);
+	if (!err)
+		err = fc_do_one_pass(journal, &info, PASS_REPLAY);
 
 	jbd_debug(1, "JBD2: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
@@ -163,6 +163,23 @@ static void wait_transaction_locked(journal_t *journal)
 	finish_wait(&journal->j_wait_transaction_locked, &wait);
 }
 
+/*
+ * Account time a handle spent blocked in start_this_handle() for the
+ * per-journal statistics in /proc/fs/jbd2/<dev>/info.
+ */
+static void jbd2_account_stall(journal_t *journal, int reason, u64 start)
+{
+	struct jbd2_stall_stats_s *ss = &journal->j_stats.stall[reason];
+	u64 delta = ktime_get_ns() - start;
+
+	spin_lock(&journal->j_history_lock);
+	ss->ss_count++;
+	ss->ss_time += delta;
+	if (delta > ss->ss_max)
+		ss->ss_max = delta;
+	spin_unlock(&journal->j_history_lock);
+}
+
 static void sub_reserved_credits(journal_t *journal, int blocks)
 {
 	atomic_sub(blocks, &journal->j_reserved_credits);
@@ -181,6 +198,7 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 	transaction_t *t = journal->j_running_transaction;
 	int needed;
 	int total = blocks + rsv_blocks;
+	u64 start = ktime_get_ns();
 
 	/*
 	 * If the current transaction is locked down for commit, wait
@@ -188,6 +206,7 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 	 */
 	if (t->t_state == T_LOCKED) {
 		wait_transaction_locked(journal);
+		jbd2_account_stall(journal, JBD2_STALL_LOCKED, start);
 		return 1;
 	}
 
@@ -205,6 +224,7 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 		 */
 		atomic_sub(total, &t->t_outstanding_credits);
 		wait_transaction_locked(journal);
+		jbd2_account_stall(journal, JBD2_STALL_FULL, start);
 		return 1;
 	}
 
@@ -226,9 +246,16 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 		if (jbd2_log_space_left(journal) < jbd2_space_needed(journal))
 			__jbd2_log_wait_for_space(journal);
 		write_unlock(&journal->j_state_lock);
+		jbd2_account_stall(journal, JBD2_STALL_SPACE, start);
 		return 1;
 	}
 
+	/*
+	 * Getting close to the point where we'd have to wait for space;
+	 * have the checkpoint work free some before we get there.
+	 */
+	jbd2_log_kick_checkpoint(journal);
+
 	/* No reservation? We are done... */
 	if (!rsv_blocks)
 		return 0;
@@ -242,6 +269,7 @@ static int add_transaction_credits(journal_t *journal, int blocks,
 		wait_event(journal->j_wait_reserved,
 			 atomic_read(&journal->j_reserved_credits) + rsv_blocks
 			 <= journal->j_max_transaction_buffers / 2);
+		jbd2_account_stall(journal, JBD2_STALL_RESERVED, start);
 		return 1;
 	}
 	return 0;
@@ -260,6 +288,8 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 	transaction_t	*transaction, *new_transaction = NULL;
 	int		blocks = handle->h_buffer_credits;
 	int		rsv_blocks = 0;
+	int		commit_ahead = 0;
+	tid_t		tid;
 	unsigned long ts = jiffies;
 
 	/*
@@ -318,9 +348,12 @@ repeat:
 	 * deadlock on page writeback not being able to complete.
 	 */
 	if (!handle->h_reserved && journal->j_barrier_count) {
+		u64 start = ktime_get_ns();
+
 		read_unlock(&journal->j_state_lock);
 		wait_event(journal->j_wait_transaction_locked,
 				journal->j_barrier_count == 0);
+		jbd2_account_stall(journal, JBD2_STALL_BARRIER, start);
 		goto repeat;
 	}
 
@@ -367,9 +400,29 @@ repeat:
 		  handle, blocks,
 		  atomic_read(&transaction->t_outstanding_credits),
 		  jbd2_log_space_left(journal));
+
+	/*
+	 * Only one transaction can be committing at a time.  If the commit
+	 * thread is idle and the running transaction is already half full,
+	 * ask for it to be committed now, so that its commit overlaps with
+	 * the next transaction filling up rather than with handles waiting
+	 * in T_LOCKED once it is full.
+	 */
+	tid = transaction->t_tid;
+	if (!journal->j_committing_transaction &&
+	    !tid_geq(journal->j_commit_request, tid) &&
+	    atomic_read(&transaction->t_outstanding_credits) >
+				journal->j_max_transaction_buffers / 2)
+		commit_ahead = 1;
 	read_unlock(&journal->j_state_lock);
 	current->journal_info = handle;
 
+	if (commit_ahead && jbd2_log_start_commit(journal, tid)) {
+		spin_lock(&journal->j_history_lock);
+		journal->j_stats.ts_commit_ahead++;
+		spin_unlock(&journal->j_history_lock);
+	}
+
 	lock_map_acquire(&handle->h_lockdep_map);
 	jbd2_journal_free_transaction(new_transaction);
 	return 0;
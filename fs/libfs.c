@@ -1033,6 +1033,19 @@ void kfree_put_link(struct dentry *dentry, struct nameidata *nd,
 }
 EXPORT_SYMBOL(kfree_put_link);
 
+/*
+ * ->follow_link() for symlinks whose body is kept in inode->i_link for
+ * the lifetime of the inode.  Path walk follows those without calling
+ * here when it can, so i_link must stay valid until the inode is freed
+ * (after an RCU grace period).
+ */
+void *simple_follow_link(struct dentry *dentry, struct nameidata *nd)
+{
+	nd_set_link(nd, d_inode(dentry)->i_link);
+	return NULL;
+}
+EXPORT_SYMBOL(simple_follow_link);
+
 /*
  * nop .set_page_dirty method so that people can use .page_mkwrite on
  * anon inodes.
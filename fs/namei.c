@@ -550,6 +550,7 @@ struct nameidata {
 	unsigned	seq, m_seq;
 	int		last_type;
 	unsigned	depth;
+	unsigned	rcu_links;	/* link bodies walked in rcu-walk */
 	struct file	*base;
 	char *saved_names[MAX_NESTED_LINKS + 1];
 };
@@ -600,6 +601,15 @@ static int unlazy_walk(struct nameidata *nd, struct dentry *dentry)
 
 	BUG_ON(!(nd->flags & LOOKUP_RCU));
 
+	/*
+	 * A symlink body followed in rcu-walk is only pinned by the rcu
+	 * read lock, and we hold no reference on its inode.  We can't drop
+	 * that lock while still walking the body, so restart the whole
+	 * walk in ref-walk instead.
+	 */
+	if (unlikely(nd->rcu_links))
+		return -ECHILD;
+
 	/*
 	 * After legitimizing the bastards, terminate_walk()
 	 * will do the right thing for non-RCU mode, and all our
@@ -938,7 +948,7 @@ follow_link(struct path *link, struct nameidata *nd, void **p)
 	touch_atime(link);
 	nd_set_link(nd, NULL);
 
-	error = security_inode_follow_link(link->dentry, nd);
+	error = security_inode_follow_link(dentry, dentry->d_inode, false);
 	if (error)
 		goto out_put_nd_path;
 
@@ -1455,7 +1465,69 @@ static struct dentry *lookup_real(struct inode *dir, struct dentry *dentry,
 	return dentry;
 }
 
-static struct dentry *__lookup_hash(struct qstr *name,
+/*
+ * Directories marked S_PDIROPS take lookups, creates and unlinks without
+ * i_mutex, the filesystem serializes what it has to by itself.  All the
+ * VFS needs is that operations on the same name don't overlap, which is
+ * what a small hashed table of mutexes gives us.  Everything else still
+ * takes i_mutex, and takes the name lock around its lookups as well.
+ */
+#define PDIROPS_HASH_BITS	8
+static struct mutex pdirops_locks[1 << PDIROPS_HASH_BITS];
+
+static int __init pdirops_locks_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(pdirops_locks); i++)
+		mutex_init(&pdirops_locks[i]);
+	return 0;
+}
+core_initcall(pdirops_locks_init);
+
+/* The name lock of @name in @dir, NULL if @dir isn't S_PDIROPS */
+static struct mutex *pdirops_lock(struct inode *dir, const struct qstr *name)
+{
+	if (!IS_PDIROPS(dir))
+		return NULL;
+	return &pdirops_locks[hash_long((unsigned long)dir ^ name->hash,
+					PDIROPS_HASH_BITS)];
+}
+
+/* The lock a lookup, create or unlink of @name in @dir has to hold */
+static struct mutex *dir_name_lock(struct inode *dir, const struct qstr *name)
+{
+	struct mutex *lock = pdirops_lock(dir, name);
+
+	return lock ? lock : &dir->i_mutex;
+}
+
+/* Lock both names of a rename, either lock may be NULL */
+static void pdirops_lock_two(struct mutex **l1, struct mutex **l2)
+{
+	if (*l1 == *l2)
+		*l2 = NULL;
+	else if (*l1 && *l2 && *l1 > *l2)
+		swap(*l1, *l2);
+	if (*l1)
+		mutex_lock(*l1);
+	if (*l2)
+		mutex_lock_nested(*l2, SINGLE_DEPTH_NESTING);
+}
+
+static void pdirops_unlock_two(struct mutex *l1, struct mutex *l2)
+{
+	if (l2)
+		mutex_unlock(l2);
+	if (l1)
+		mutex_unlock(l1);
+}
+
+/*
+ * The caller holds base->d_inode->i_mutex, or the name lock if base is
+ * an S_PDIROPS directory.
+ */
+static struct dentry *__lookup_hash_locked(struct qstr *name,
 		struct dentry *base, unsigned int flags)
 {
 	bool need_lookup;
@@ -1468,6 +1540,20 @@ static struct dentry *__lookup_hash(struct qstr *name,
 	return lookup_real(base->d_inode, dentry, flags);
 }
 
+static struct dentry *__lookup_hash(struct qstr *name,
+		struct dentry *base, unsigned int flags)
+{
+	struct mutex *lock = pdirops_lock(base->d_inode, name);
+	struct dentry *dentry;
+
+	if (lock)
+		mutex_lock(lock);
+	dentry = __lookup_hash_locked(name, base, flags);
+	if (lock)
+		mutex_unlock(lock);
+	return dentry;
+}
+
 /*
  *  It's more convoluted than I'd like it to be, but... it's still fairly
  *  small and for now I'd prefer to have fast path as straight as possible.
@@ -1583,9 +1669,14 @@ static int lookup_slow(struct nameidata *nd, struct path *path)
 	parent = nd->path.dentry;
 	BUG_ON(nd->inode != parent->d_inode);
 
-	mutex_lock(&parent->d_inode->i_mutex);
-	dentry = __lookup_hash(&nd->last, parent, nd->flags);
-	mutex_unlock(&parent->d_inode->i_mutex);
+	if (IS_PDIROPS(parent->d_inode)) {
+		/* __lookup_hash() takes the name lock */
+		dentry = __lookup_hash(&nd->last, parent, nd->flags);
+	} else {
+		mutex_lock(&parent->d_inode->i_mutex);
+		dentry = __lookup_hash(&nd->last, parent, nd->flags);
+		mutex_unlock(&parent->d_inode->i_mutex);
+	}
 	if (IS_ERR(dentry))
 		return PTR_ERR(dentry);
 	path->mnt = nd->path.mnt;
@@ -1647,8 +1738,13 @@ static inline int should_follow_link(struct dentry *dentry, int follow)
 	return unlikely(d_is_symlink(dentry)) ? follow : 0;
 }
 
+enum {
+	WALK_FOLLOW = 1,	/* follow a trailing symlink */
+	WALK_LINK_RCU = 2,	/* caller can follow symlinks in rcu-walk */
+};
+
 static inline int walk_component(struct nameidata *nd, struct path *path,
-		int follow)
+		int flags)
 {
 	struct inode *inode;
 	int err;
@@ -1674,10 +1770,16 @@ static inline int walk_component(struct nameidata *nd, struct path *path,
 		inode = path->dentry->d_inode;
 	}
 
-	if (should_follow_link(path->dentry, follow)) {
+	if (should_follow_link(path->dentry, flags & WALK_FOLLOW)) {
 		if (nd->flags & LOOKUP_RCU) {
-			if (unlikely(nd->path.mnt != path->mnt ||
-				     unlazy_walk(nd, path->dentry))) {
+			if (unlikely(nd->path.mnt != path->mnt)) {
+				err = -ECHILD;
+				goto out_err;
+			}
+			/* nd->seq is still that of the link, see follow_link_rcu() */
+			if (flags & WALK_LINK_RCU)
+				return 1;
+			if (unlikely(unlazy_walk(nd, path->dentry))) {
 				err = -ECHILD;
 				goto out_err;
 			}
@@ -1696,6 +1798,67 @@ out_err:
 	return err;
 }
 
+/*
+ * Follow a symlink without leaving rcu-walk.  That only works for fast
+ * symlinks, whose body sits in inode->i_link for as long as the inode
+ * is around; anything that might block - an atime update, an LSM that
+ * wants to audit, a filesystem's own ->follow_link() - has to be done
+ * in ref-walk.
+ *
+ * Called with nd->path still the directory the link was found in and
+ * nd->seq the sequence count of the link.  Returns 1 if the link has to
+ * be followed in ref-walk, with nothing changed, otherwise the result
+ * of walking the body.  In the latter case nd->last points into the body
+ * and nd->rcu_links has been raised; the caller drops it once it is done
+ * with nd->last.
+ */
+static int follow_link_rcu(struct path *link, struct nameidata *nd)
+{
+	struct dentry *dentry = link->dentry;
+	struct dentry *parent = nd->path.dentry;
+	struct inode *inode = ACCESS_ONCE(dentry->d_inode);
+	const char *s;
+	unsigned seq;
+
+	if (unlikely(!inode))
+		return 1;
+	s = ACCESS_ONCE(inode->i_link);
+	if (!s)
+		return 1;
+	if (unlikely(current->total_link_count >= 40))
+		return 1;
+	if (atime_needs_update(link, inode))
+		return 1;
+	if (security_inode_follow_link(dentry, inode, true))
+		return 1;
+
+	/*
+	 * Walking on from the parent needs its sequence count, which lookup
+	 * replaced with the link's.  Sample it again, then make sure the
+	 * link is still there, so we are looking at the same directory.
+	 */
+	seq = __read_seqcount_begin(&parent->d_seq);
+	if (read_seqcount_retry(&dentry->d_seq, nd->seq) ||
+	    nd->inode != parent->d_inode)
+		return 1;
+
+	current->total_link_count++;
+	nd->last_type = LAST_BIND;
+	if (*s == '/') {
+		if (!nd->root.mnt)
+			set_root_rcu(nd);
+		nd->path = nd->root;
+		nd->inode = nd->path.dentry->d_inode;
+		nd->seq = __read_seqcount_begin(&nd->path.dentry->d_seq);
+		nd->flags |= LOOKUP_JUMPED;
+	} else
+		nd->seq = seq;
+
+	/* unlazy_walk() fails until we are done with s, see there */
+	nd->rcu_links++;
+	return link_path_walk(s, nd);
+}
+
 /*
  * This limits recursive symlink follows to 8, while
  * limiting consecutive symlinks to 40.
@@ -1708,6 +1871,10 @@ static inline int nested_symlink(struct path *path, struct nameidata *nd)
 	int res;
 
 	if (unlikely(current->link_count >= MAX_NESTED_LINKS)) {
+		if (nd->flags & LOOKUP_RCU) {
+			terminate_walk(nd);
+			return -ELOOP;
+		}
 		path_put_conditional(path, nd);
 		path_put(&nd->path);
 		return -ELOOP;
@@ -1721,10 +1888,25 @@ static inline int nested_symlink(struct path *path, struct nameidata *nd)
 		struct path link = *path;
 		void *cookie;
 
+		if (nd->flags & LOOKUP_RCU) {
+			res = follow_link_rcu(&link, nd);
+			if (res <= 0) {
+				if (!res)
+					res = walk_component(nd, path,
+						WALK_FOLLOW | WALK_LINK_RCU);
+				nd->rcu_links--;
+				continue;
+			}
+			if (unlikely(unlazy_walk(nd, link.dentry))) {
+				terminate_walk(nd);
+				res = -ECHILD;
+				break;
+			}
+		}
 		res = follow_link(&link, nd, &cookie);
 		if (res)
 			break;
-		res = walk_component(nd, path, LOOKUP_FOLLOW);
+		res = walk_component(nd, path, WALK_FOLLOW | WALK_LINK_RCU);
 		put_link(nd, &link, cookie);
 	} while (res > 0);
 
@@ -1919,7 +2101,7 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 		if (!*name)
 			return 0;
 
-		err = walk_component(nd, &next, LOOKUP_FOLLOW);
+		err = walk_component(nd, &next, WALK_FOLLOW | WALK_LINK_RCU);
 		if (err < 0)
 			return err;
 
@@ -1946,6 +2128,7 @@ static int path_init(int dfd, const struct filename *name, unsigned int flags,
 	nd->last_type = LAST_ROOT; /* if there are only slashes... */
 	nd->flags = flags | LOOKUP_JUMPED | LOOKUP_PARENT;
 	nd->depth = 0;
+	nd->rcu_links = 0;
 	nd->base = NULL;
 	if (flags & LOOKUP_ROOT) {
 		struct dentry *root = nd->root.dentry;
@@ -2017,6 +2200,11 @@ static int path_init(int dfd, const struct filename *name, unsigned int flags,
 		if (flags & LOOKUP_RCU) {
 			if (f.flags & FDPUT_FPUT)
 				nd->base = f.file;
+			else if (f.flags & FDPUT_PCPU) {
+				/* ->base is dropped with fput() */
+				nd->base = get_file(f.file);
+				fput_pcpu(f.file);
+			}
 			nd->seq = __read_seqcount_begin(&nd->path.dentry->d_seq);
 			rcu_read_lock();
 		} else {
@@ -2055,7 +2243,8 @@ static inline int lookup_last(struct nameidata *nd, struct path *path)
 		nd->flags |= LOOKUP_FOLLOW | LOOKUP_DIRECTORY;
 
 	nd->flags &= ~LOOKUP_PARENT;
-	return walk_component(nd, path, nd->flags & LOOKUP_FOLLOW);
+	return walk_component(nd, path,
+			nd->flags & LOOKUP_FOLLOW ? WALK_FOLLOW : 0);
 }
 
 /* Returns 0 and nd will be valid on success; Retuns error, otherwise. */
@@ -3019,6 +3208,7 @@ static int do_last(struct nameidata *nd, struct path *path,
 	struct inode *inode;
 	bool symlink_ok = false;
 	struct path save_parent = { .dentry = NULL, .mnt = NULL };
+	struct mutex *lock;
 	bool retried = false;
 	int error;
 
@@ -3075,9 +3265,10 @@ retry_lookup:
 		 * dropping this one anyway.
 		 */
 	}
-	mutex_lock(&dir->d_inode->i_mutex);
+	lock = dir_name_lock(dir->d_inode, &nd->last);
+	mutex_lock(lock);
 	error = lookup_open(nd, path, file, op, got_write, opened);
-	mutex_unlock(&dir->d_inode->i_mutex);
+	mutex_unlock(lock);
 
 	if (error <= 0) {
 		if (error)
@@ -3864,6 +4055,7 @@ static long do_unlinkat(int dfd, const char __user *pathname)
 	struct nameidata nd;
 	struct inode *inode = NULL;
 	struct inode *delegated_inode = NULL;
+	struct mutex *lock;
 	unsigned int lookup_flags = 0;
 retry:
 	name = user_path_parent(dfd, pathname, &nd, lookup_flags);
@@ -3879,8 +4071,9 @@ retry:
 	if (error)
 		goto exit1;
 retry_deleg:
-	mutex_lock_nested(&nd.path.dentry->d_inode->i_mutex, I_MUTEX_PARENT);
-	dentry = lookup_hash(&nd);
+	lock = dir_name_lock(nd.path.dentry->d_inode, &nd.last);
+	mutex_lock_nested(lock, I_MUTEX_PARENT);
+	dentry = __lookup_hash_locked(&nd.last, nd.path.dentry, nd.flags);
 	error = PTR_ERR(dentry);
 	if (!IS_ERR(dentry)) {
 		/* Why not before? Because we want correct error value */
@@ -3897,7 +4090,7 @@ retry_deleg:
 exit2:
 		dput(dentry);
 	}
-	mutex_unlock(&nd.path.dentry->d_inode->i_mutex);
+	mutex_unlock(lock);
 	if (inode)
 		iput(inode);	/* truncate the inode here */
 	inode = NULL;
@@ -4341,6 +4534,7 @@ SYSCALL_DEFINE5(renameat2, int, olddfd, const char __user *, oldname,
 	struct dentry *old_dir, *new_dir;
 	struct dentry *old_dentry, *new_dentry;
 	struct dentry *trap;
+	struct mutex *old_lock, *new_lock;
 	struct nameidata oldnd, newnd;
 	struct inode *delegated_inode = NULL;
 	struct filename *from;
@@ -4398,8 +4592,11 @@ retry:
 
 retry_deleg:
 	trap = lock_rename(new_dir, old_dir);
+	old_lock = pdirops_lock(old_dir->d_inode, &oldnd.last);
+	new_lock = pdirops_lock(new_dir->d_inode, &newnd.last);
+	pdirops_lock_two(&old_lock, &new_lock);
 
-	old_dentry = lookup_hash(&oldnd);
+	old_dentry = __lookup_hash_locked(&oldnd.last, old_dir, oldnd.flags);
 	error = PTR_ERR(old_dentry);
 	if (IS_ERR(old_dentry))
 		goto exit3;
@@ -4407,7 +4604,7 @@ retry_deleg:
 	error = -ENOENT;
 	if (d_is_negative(old_dentry))
 		goto exit4;
-	new_dentry = lookup_hash(&newnd);
+	new_dentry = __lookup_hash_locked(&newnd.last, new_dir, newnd.flags);
 	error = PTR_ERR(new_dentry);
 	if (IS_ERR(new_dentry))
 		goto exit4;
@@ -4455,6 +4652,7 @@ exit5:
 exit4:
 	dput(old_dentry);
 exit3:
+	pdirops_unlock_two(old_lock, new_lock);
 	unlock_rename(new_dir, old_dir);
 	if (delegated_inode) {
 		error = break_deleg_wait(&delegated_inode);
@@ -698,11 +698,16 @@ int nfs_getattr(struct vfsmount *mnt, struct dentry *dentry, struct kstat *stat)
 {
 	struct inode *inode = d_inode(dentry);
 	int need_atime = NFS_I(inode)->cache_validity & NFS_INO_INVALID_ATIME;
+	unsigned int sync = stat->query_flags & AT_STATX_SYNC_TYPE;
 	int err = 0;
 
 	trace_nfs_getattr_enter(inode);
+	if (sync == AT_STATX_DONT_SYNC)
+		goto out_fill;
+
 	/* Flush out writes to the server in order to update c/mtime.  */
-	if (S_ISREG(inode->i_mode)) {
+	if ((stat->request_mask & (STATX_CTIME | STATX_MTIME)) &&
+	    S_ISREG(inode->i_mode)) {
 		err = filemap_write_and_wait(inode->i_mapping);
 		if (err)
 			goto out;
@@ -720,14 +725,25 @@ int nfs_getattr(struct vfsmount *mnt, struct dentry *dentry, struct kstat *stat)
  	if ((mnt->mnt_flags & MNT_NOATIME) ||
  	    ((mnt->mnt_flags & MNT_NODIRATIME) && S_ISDIR(inode->i_mode)))
 		need_atime = 0;
+	if (!(stat->request_mask & STATX_ATIME))
+		need_atime = 0;
+
+	/* Nothing the server could change was asked for */
+	if (!(stat->request_mask & (STATX_MODE | STATX_NLINK | STATX_UID |
+				    STATX_GID | STATX_ATIME | STATX_MTIME |
+				    STATX_CTIME | STATX_SIZE | STATX_BLOCKS)) &&
+	    sync != AT_STATX_FORCE_SYNC)
+		goto out_fill;
 
-	if (need_atime || nfs_need_revalidate_inode(inode)) {
+	if (sync == AT_STATX_FORCE_SYNC || need_atime ||
+	    nfs_need_revalidate_inode(inode)) {
 		struct nfs_server *server = NFS_SERVER(inode);
 
 		if (server->caps & NFS_CAP_READDIRPLUS)
 			nfs_request_parent_use_readdirplus(dentry);
 		err = __nfs_revalidate_inode(server, inode);
 	}
+out_fill:
 	if (!err) {
 		generic_fillattr(inode, stat);
 		stat->ino = nfs_compat_user_ino64(NFS_FILEID(inode));
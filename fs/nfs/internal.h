@@ -66,6 +66,11 @@ struct nfs_clone_mount {
  */
 #define NFS_MAX_READDIR_PAGES 8
 
+/*
+ * Maximum number of transports a client opens to one server
+ */
+#define NFS_MAX_CONNECTIONS 16
+
 struct nfs_client_initdata {
 	unsigned long init_flags;
 	const char *hostname;
@@ -73,6 +78,7 @@ struct nfs_client_initdata {
 	size_t addrlen;
 	struct nfs_subversion *nfs_mod;
 	int proto;
+	unsigned int nconnect;
 	u32 minorversion;
 	struct net *net;
 };
@@ -95,6 +101,7 @@ struct nfs_parsed_mount_data {
 	unsigned int		version;
 	unsigned int		minorversion;
 	char			*fscache_uniq;
+	unsigned int		nconnect;
 	bool			need_mount;
 
 	struct {
@@ -375,3 +375,130 @@ int nfs42_proc_clone(struct file *src_f, struct file *dst_f,
 	return err;
 
 }
+
+/*
+ * COMMIT the whole destination file after an unstable COPY.  If the
+ * server rebooted in between, the verifier changes and the copied data
+ * may be gone.
+ */
+static int nfs42_copy_commit(struct inode *inode,
+			     struct nfs_write_verifier *verf)
+{
+	struct nfs_server *server = NFS_SERVER(inode);
+	struct nfs_writeverf commit_verf;
+	struct nfs_commitargs args = {
+		.fh = NFS_FH(inode),
+	};
+	struct nfs_commitres res = {
+		.verf = &commit_verf,
+		.server = server,
+	};
+	struct rpc_message msg = {
+		.rpc_proc = &nfs4_procedures[NFSPROC4_CLNT_COMMIT],
+		.rpc_argp = &args,
+		.rpc_resp = &res,
+	};
+	int status;
+
+	status = nfs4_call_sync(server->client, server, &msg,
+				&args.seq_args, &res.seq_res, 0);
+	if (status)
+		return status;
+	if (memcmp(&commit_verf.verifier, verf, sizeof(*verf)))
+		return -EIO;
+	return 0;
+}
+
+static ssize_t _nfs42_proc_copy(struct file *src, loff_t pos_src,
+				struct file *dst, loff_t pos_dst,
+				size_t count)
+{
+	struct nfs42_copy_args args = {
+		.src_fh		= NFS_FH(file_inode(src)),
+		.src_pos	= pos_src,
+		.dst_fh		= NFS_FH(file_inode(dst)),
+		.dst_pos	= pos_dst,
+		.count		= count,
+	};
+	struct nfs42_copy_res res;
+	struct rpc_message msg = {
+		.rpc_proc = &nfs4_procedures[NFSPROC4_CLNT_COPY],
+		.rpc_argp = &args,
+		.rpc_resp = &res,
+	};
+	struct inode *dst_inode = file_inode(dst);
+	struct nfs_server *server = NFS_SERVER(dst_inode);
+	int status;
+
+	status = nfs42_set_rw_stateid(&args.src_stateid, src, FMODE_READ);
+	if (status)
+		return status;
+
+	status = nfs42_set_rw_stateid(&args.dst_stateid, dst, FMODE_WRITE);
+	if (status)
+		return status;
+
+	memset(&res, 0, sizeof(res));
+	status = nfs4_call_sync(server->client, server, &msg,
+				&args.seq_args, &res.seq_res, 0);
+	if (status)
+		return status;
+
+	/*
+	 * We asked for a synchronous copy.  A server that went
+	 * asynchronous anyway would report completion through CB_OFFLOAD,
+	 * which we don't handle, so stop using COPY on it.
+	 */
+	if (res.write_res.callback_ids) {
+		server->caps &= ~NFS_CAP_COPY;
+		return -EOPNOTSUPP;
+	}
+
+	if (res.write_res.verifier.committed != NFS_FILE_SYNC) {
+		status = nfs42_copy_commit(dst_inode,
+					   &res.write_res.verifier.verifier);
+		if (status)
+			return status;
+	}
+
+	if (res.write_res.count)
+		truncate_pagecache_range(dst_inode, pos_dst,
+					 pos_dst + res.write_res.count - 1);
+	nfs_mark_for_revalidate(dst_inode);
+
+	return res.write_res.count;
+}
+
+/*
+ * Server side copy: the data never crosses the wire.  Returns the number
+ * of bytes copied, which may be short.
+ */
+ssize_t nfs42_proc_copy(struct file *src, loff_t pos_src,
+			struct file *dst, loff_t pos_dst,
+			size_t count)
+{
+	struct nfs_server *server = NFS_SERVER(file_inode(dst));
+	struct nfs4_exception src_exception = { };
+	struct nfs4_exception dst_exception = { };
+	ssize_t err, err2;
+
+	if (!nfs_server_capable(file_inode(dst), NFS_CAP_COPY))
+		return -EOPNOTSUPP;
+
+	do {
+		err = _nfs42_proc_copy(src, pos_src, dst, pos_dst, count);
+		if (err >= 0)
+			break;
+		if (err == -ENOTSUPP || err == -EOPNOTSUPP) {
+			server->caps &= ~NFS_CAP_COPY;
+			err = -EOPNOTSUPP;
+			break;
+		}
+		err2 = nfs4_handle_exception(server, err, &src_exception);
+		err = nfs4_handle_exception(server, err, &dst_exception);
+		if (!err)
+			err = err2;
+	} while (src_exception.retry || dst_exception.retry);
+
+	return err;
+}
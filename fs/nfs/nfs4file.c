@@ -221,59 +221,34 @@ static long nfs42_fallocate(struct file *filep, int mode, loff_t offset, loff_t
 	return nfs42_proc_allocate(filep, offset, len);
 }
 
-static noinline long
-nfs42_ioctl_clone(struct file *dst_file, unsigned long srcfd,
-		  u64 src_off, u64 dst_off, u64 count)
+/*
+ * Clone a range of src_file into dst_file on the server.  A count of zero
+ * clones to the end of the source file.
+ */
+static int nfs42_clone_file_range(struct file *src_file, loff_t src_off,
+				  struct file *dst_file, loff_t dst_off,
+				  u64 count)
 {
 	struct inode *dst_inode = file_inode(dst_file);
+	struct inode *src_inode = file_inode(src_file);
 	struct nfs_server *server = NFS_SERVER(dst_inode);
-	struct fd src_file;
-	struct inode *src_inode;
 	unsigned int bs = server->clone_blksize;
 	int ret;
 
-	/* dst file must be opened for writing */
-	if (!(dst_file->f_mode & FMODE_WRITE))
-		return -EINVAL;
-
-	ret = mnt_want_write_file(dst_file);
-	if (ret)
-		return ret;
-
-	src_file = fdget(srcfd);
-	if (!src_file.file) {
-		ret = -EBADF;
-		goto out_drop_write;
-	}
-
-	src_inode = file_inode(src_file.file);
-
 	/* src and dst must be different files */
-	ret = -EINVAL;
 	if (src_inode == dst_inode)
-		goto out_fput;
-
-	/* src file must be opened for reading */
-	if (!(src_file.file->f_mode & FMODE_READ))
-		goto out_fput;
+		return -EINVAL;
 
 	/* src and dst must be regular files */
-	ret = -EISDIR;
 	if (!S_ISREG(src_inode->i_mode) || !S_ISREG(dst_inode->i_mode))
-		goto out_fput;
-
-	ret = -EXDEV;
-	if (src_file.file->f_path.mnt != dst_file->f_path.mnt ||
-	    src_inode->i_sb != dst_inode->i_sb)
-		goto out_fput;
+		return -EISDIR;
 
 	/* check alignment w.r.t. clone_blksize */
-	ret = -EINVAL;
 	if (bs) {
 		if (!IS_ALIGNED(src_off, bs) || !IS_ALIGNED(dst_off, bs))
-			goto out_fput;
+			return -EINVAL;
 		if (!IS_ALIGNED(count, bs) && i_size_read(src_inode) != (src_off + count))
-			goto out_fput;
+			return -EINVAL;
 	}
 
 	/* XXX: do we lock at all? what if server needs CB_RECALL_LAYOUT? */
@@ -294,12 +269,13 @@ nfs42_ioctl_clone(struct file *dst_file, unsigned long srcfd,
 	if (ret)
 		goto out_unlock;
 
-	ret = nfs42_proc_clone(src_file.file, dst_file, src_off, dst_off, count);
+	ret = nfs42_proc_clone(src_file, dst_file, src_off, dst_off, count);
 
 	/* truncate inode page cache of the dst range so that future reads can fetch
 	 * new data from server */
 	if (!ret)
-		truncate_inode_pages_range(&dst_inode->i_data, dst_off, dst_off + count - 1);
+		truncate_inode_pages_range(&dst_inode->i_data, dst_off,
+					   count ? dst_off + count - 1 : -1);
 
 out_unlock:
 	if (dst_inode < src_inode) {
@@ -309,6 +285,42 @@ out_unlock:
 		mutex_unlock(&dst_inode->i_mutex);
 		mutex_unlock(&src_inode->i_mutex);
 	}
+	return ret;
+}
+
+static noinline long
+nfs42_ioctl_clone(struct file *dst_file, unsigned long srcfd,
+		  u64 src_off, u64 dst_off, u64 count)
+{
+	struct fd src_file;
+	int ret;
+
+	/* dst file must be opened for writing */
+	if (!(dst_file->f_mode & FMODE_WRITE))
+		return -EINVAL;
+
+	ret = mnt_want_write_file(dst_file);
+	if (ret)
+		return ret;
+
+	src_file = fdget(srcfd);
+	if (!src_file.file) {
+		ret = -EBADF;
+		goto out_drop_write;
+	}
+
+	/* src file must be opened for reading */
+	ret = -EINVAL;
+	if (!(src_file.file->f_mode & FMODE_READ))
+		goto out_fput;
+
+	ret = -EXDEV;
+	if (src_file.file->f_path.mnt != dst_file->f_path.mnt ||
+	    file_inode(src_file.file)->i_sb != file_inode(dst_file)->i_sb)
+		goto out_fput;
+
+	ret = nfs42_clone_file_range(src_file.file, src_off, dst_file,
+				     dst_off, count);
 out_fput:
 	fdput(src_file);
 out_drop_write:
@@ -316,6 +328,31 @@ out_drop_write:
 	return ret;
 }
 
+static ssize_t nfs4_copy_file_range(struct file *file_in, loff_t pos_in,
+				    struct file *file_out, loff_t pos_out,
+				    size_t count, unsigned int flags)
+{
+	struct inode *in_inode = file_inode(file_in);
+	struct inode *out_inode = file_inode(file_out);
+	ssize_t ret;
+
+	if (in_inode == out_inode)
+		return -EINVAL;
+	if (!S_ISREG(in_inode->i_mode) || !S_ISREG(out_inode->i_mode))
+		return -EINVAL;
+
+	mutex_lock(&out_inode->i_mutex);
+	/* the server copies what it has, flush pending writes first */
+	ret = nfs_sync_inode(in_inode);
+	if (!ret)
+		ret = nfs_sync_inode(out_inode);
+	if (!ret)
+		ret = nfs42_proc_copy(file_in, pos_in, file_out, pos_out,
+				      count);
+	mutex_unlock(&out_inode->i_mutex);
+	return ret;
+}
+
 static long nfs42_ioctl_clone_range(struct file *dst_file, void __user *argp)
 {
 	struct nfs_ioctl_clone_range_args args;
@@ -364,6 +401,8 @@ const struct file_operations nfs4_file_operations = {
 	.splice_write	= iter_file_splice_write,
 #ifdef CONFIG_NFS_V4_2
 	.fallocate	= nfs42_fallocate,
+	.copy_file_range = nfs4_copy_file_range,
+	.clone_file_range = nfs42_clone_file_range,
 #endif /* CONFIG_NFS_V4_2 */
 	.check_flags	= nfs_check_flags,
 	.setlease	= simple_nosetlease,
@@ -27,13 +27,16 @@ static bool should_merge(struct fsnotify_event *old_fsn,
 	return false;
 }
 
-/* and the list better be locked by something too! */
-static int fanotify_merge(struct list_head *list, struct fsnotify_event *event)
+/* called with group->notification_mutex held */
+static int fanotify_merge(struct fsnotify_group *group,
+			  struct fsnotify_event *event)
 {
-	struct fsnotify_event *test_event;
+	struct fanotify_event_info *test_event;
+	struct hlist_head *hlist;
 	bool do_merge = false;
+	int i = 0;
 
-	pr_debug("%s: list=%p event=%p\n", __func__, list, event);
+	pr_debug("%s: group=%p event=%p\n", __func__, group, event);
 
 #ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
 	/*
@@ -45,8 +48,13 @@ static int fanotify_merge(struct list_head *list, struct fsnotify_event *event)
 		return 0;
 #endif
 
-	list_for_each_entry_reverse(test_event, list, list) {
-		if (should_merge(test_event, event)) {
+	/* buckets are kept newest first, like the old reverse list walk */
+	hlist = &group->fanotify_data.merge_hash[
+				fanotify_event_hash(FANOTIFY_E(event))];
+	hlist_for_each_entry(test_event, hlist, merge_list) {
+		if (++i > FANOTIFY_MAX_MERGE_EVENTS)
+			break;
+		if (should_merge(&test_event->fse, event)) {
 			do_merge = true;
 			break;
 		}
@@ -55,10 +63,39 @@ static int fanotify_merge(struct list_head *list, struct fsnotify_event *event)
 	if (!do_merge)
 		return 0;
 
-	test_event->mask |= event->mask;
+	test_event->fse.mask |= event->mask;
 	return 1;
 }
 
+/* called with group->notification_mutex held */
+static void fanotify_insert_event(struct fsnotify_group *group,
+				  struct fsnotify_event *fsn_event)
+{
+	struct fanotify_event_info *event = FANOTIFY_E(fsn_event);
+	struct hlist_head *hlist;
+
+#ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
+	/* permission events are never merged, don't bother hashing them */
+	if (fsn_event->mask & FAN_ALL_PERM_EVENTS)
+		return;
+#endif
+	hlist = &group->fanotify_data.merge_hash[fanotify_event_hash(event)];
+	hlist_add_head(&event->merge_list, hlist);
+}
+
+/*
+ * Drop a dequeued event from the merge hash.  Called with
+ * group->notification_mutex held.
+ */
+void fanotify_unhash_event(struct fsnotify_group *group,
+			   struct fsnotify_event *fsn_event)
+{
+	struct fanotify_event_info *event = FANOTIFY_E(fsn_event);
+
+	if (!hlist_unhashed(&event->merge_list))
+		hlist_del_init(&event->merge_list);
+}
+
 #ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
 static int fanotify_get_response(struct fsnotify_group *group,
 				 struct fanotify_perm_event_info *event)
@@ -173,6 +210,7 @@ struct fanotify_event_info *fanotify_alloc_event(struct inode *inode, u32 mask,
 		return NULL;
 init: __maybe_unused
 	fsnotify_init_event(&event->fse, inode, mask);
+	INIT_HLIST_NODE(&event->merge_list);
 	event->tgid = get_pid(task_tgid(current));
 	if (path) {
 		event->path = *path;
@@ -218,7 +256,8 @@ static int fanotify_handle_event(struct fsnotify_group *group,
 		return -ENOMEM;
 
 	fsn_event = &event->fse;
-	ret = fsnotify_add_event(group, fsn_event, fanotify_merge);
+	ret = fsnotify_add_event(group, fsn_event, fanotify_merge,
+				 fanotify_insert_event);
 	if (ret) {
 		/* Permission events shouldn't be merged */
 		BUG_ON(ret == 1 && mask & FAN_ALL_PERM_EVENTS);
@@ -244,6 +283,7 @@ static void fanotify_free_group_priv(struct fsnotify_group *group)
 	user = group->fanotify_data.user;
 	atomic_dec(&user->fanotify_listeners);
 	free_uid(user);
+	kfree(group->fanotify_data.merge_hash);
 }
 
 static void fanotify_free_event(struct fsnotify_event *fsn_event)
@@ -251,6 +291,13 @@ static void fanotify_free_event(struct fsnotify_event *fsn_event)
 	struct fanotify_event_info *event;
 
 	event = FANOTIFY_E(fsn_event);
+	/*
+	 * Events read by userspace were unhashed when dequeued; only events
+	 * flushed with the group are still hashed, and the flush holds
+	 * notification_mutex.
+	 */
+	if (!hlist_unhashed(&event->merge_list))
+		hlist_del_init(&event->merge_list);
 	path_put(&event->path);
 	put_pid(event->tgid);
 #ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
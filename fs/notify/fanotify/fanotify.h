@@ -1,10 +1,21 @@
 #include <linux/fsnotify_backend.h>
+#include <linux/hash.h>
 #include <linux/path.h>
 #include <linux/slab.h>
 
 extern struct kmem_cache *fanotify_event_cachep;
 extern struct kmem_cache *fanotify_perm_event_cachep;
 
+/*
+ * Queued events are hashed by inode and tgid, the fields which must match
+ * for two events to be merged, so that merging doesn't have to walk the
+ * whole notification queue.  A merge attempt still gives up after
+ * FANOTIFY_MAX_MERGE_EVENTS entries of a bucket.
+ */
+#define FANOTIFY_HTABLE_BITS		7
+#define FANOTIFY_HTABLE_SIZE		(1 << FANOTIFY_HTABLE_BITS)
+#define FANOTIFY_MAX_MERGE_EVENTS	128
+
 /*
  * Structure for normal fanotify events. It gets allocated in
  * fanotify_handle_event() and freed when the information is retrieved by
@@ -18,6 +29,8 @@ struct fanotify_event_info {
 	 */
 	struct path path;
 	struct pid *tgid;
+	/* in group->fanotify_data.merge_hash while queued */
+	struct hlist_node merge_list;
 };
 
 #ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
@@ -46,5 +59,14 @@ static inline struct fanotify_event_info *FANOTIFY_E(struct fsnotify_event *fse)
 	return container_of(fse, struct fanotify_event_info, fse);
 }
 
+static inline unsigned int
+fanotify_event_hash(struct fanotify_event_info *event)
+{
+	return hash_long((unsigned long)event->fse.inode ^
+			 (unsigned long)event->tgid, FANOTIFY_HTABLE_BITS);
+}
+
 struct fanotify_event_info *fanotify_alloc_event(struct inode *inode, u32 mask,
 						 struct path *path);
+void fanotify_unhash_event(struct fsnotify_group *group,
+			   struct fsnotify_event *fsn_event);
@@ -83,11 +83,17 @@ void fsnotify_destroy_event(struct fsnotify_group *group,
  * event off the queue to deal with.  The function returns 0 if the event was
  * added to the queue, 1 if the event was merged with some other queued event,
  * 2 if the queue of events has overflown.
+ *
+ * If given, @insert is called under notification_mutex right after a new
+ * event (but not the overflow event) has been queued, so that the group can
+ * index it for its @merge callback.
  */
 int fsnotify_add_event(struct fsnotify_group *group,
 		       struct fsnotify_event *event,
-		       int (*merge)(struct list_head *,
-				    struct fsnotify_event *))
+		       int (*merge)(struct fsnotify_group *,
+				    struct fsnotify_event *),
+		       void (*insert)(struct fsnotify_group *,
+				      struct fsnotify_event *))
 {
 	int ret = 0;
 	struct list_head *list = &group->notification_list;
@@ -108,7 +114,7 @@ int fsnotify_add_event(struct fsnotify_group *group,
 	}
 
 	if (!list_empty(list) && merge) {
-		ret = merge(list, event);
+		ret = merge(group, event);
 		if (ret) {
 			mutex_unlock(&group->notification_mutex);
 			return ret;
@@ -118,6 +124,8 @@ int fsnotify_add_event(struct fsnotify_group *group,
 queue:
 	group->q_len++;
 	list_add_tail(&event->list, list);
+	if (insert && !ret)
+		insert(group, event);
 	mutex_unlock(&group->notification_mutex);
 
 	wake_up(&group->notification_waitq);
@@ -1075,7 +1075,9 @@ int filp_close(struct file *filp, fl_owner_t id)
 		dnotify_flush(filp, id);
 		locks_remove_posix(filp, id);
 	}
-	fput(filp);
+	/* a hot file hands its reference over to file_pcpu_deactivate() */
+	if (!file_pcpu_deactivate(filp))
+		fput(filp);
 	return retval;
 }
 
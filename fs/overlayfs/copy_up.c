@@ -102,6 +102,12 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 		goto out_fput;
 	}
 
+	/* Share the extents if lower and upper are on the same fs */
+	error = vfs_clone_file_range(old_file, 0, new_file, 0, len);
+	if (!error)
+		goto out;
+	error = 0;
+
 	/* FIXME: copy up sparse files efficiently */
 	while (len) {
 		size_t this_len = OVL_COPY_UP_CHUNK_SIZE;
@@ -127,6 +133,7 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 		len -= bytes;
 	}
 
+out:
 	fput(new_file);
 out_fput:
 	fput(old_file);
@@ -207,7 +214,7 @@ int ovl_set_attr(struct dentry *upperdentry, struct kstat *stat)
 static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 			      struct dentry *dentry, struct path *lowerpath,
 			      struct kstat *stat, struct iattr *attr,
-			      const char *link)
+			      const char *link, bool metacopy)
 {
 	struct inode *wdir = workdir->d_inode;
 	struct inode *udir = upperdir->d_inode;
@@ -234,7 +241,7 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	if (err)
 		goto out2;
 
-	if (S_ISREG(stat->mode)) {
+	if (S_ISREG(stat->mode) && !metacopy) {
 		struct path upperpath;
 		ovl_path_upper(dentry, &upperpath);
 		BUG_ON(upperpath.dentry != NULL);
@@ -249,8 +256,23 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	if (err)
 		goto out_cleanup;
 
+	if (metacopy) {
+		err = ovl_do_setxattr(newdentry, OVL_XATTR_METACOPY, "y", 1, 0);
+		if (err)
+			goto out_cleanup;
+	}
+
 	mutex_lock(&newdentry->d_inode->i_mutex);
-	err = ovl_set_attr(newdentry, stat);
+	if (metacopy) {
+		/* No data, but getattr on the upper must see the real size */
+		struct iattr sattr = {
+			.ia_valid = ATTR_SIZE,
+			.ia_size = stat->size,
+		};
+		err = notify_change(newdentry, &sattr, NULL);
+	}
+	if (!err)
+		err = ovl_set_attr(newdentry, stat);
 	if (!err && attr)
 		err = notify_change(newdentry, attr, NULL);
 	mutex_unlock(&newdentry->d_inode->i_mutex);
@@ -261,6 +283,7 @@ static int ovl_copy_up_locked(struct dentry *workdir, struct dentry *upperdir,
 	if (err)
 		goto out_cleanup;
 
+	ovl_dentry_set_metacopy(dentry, metacopy);
 	ovl_dentry_update(dentry, newdentry);
 	newdentry = NULL;
 
@@ -281,6 +304,55 @@ out_cleanup:
 	goto out2;
 }
 
+/*
+ * Bring in the data of a metacopy upper from the lower file.  The upper
+ * already has the right size, so the data is written in place and the
+ * metacopy xattr is only removed once all of it is there.  A zero size
+ * means the file is being truncated and the data isn't needed at all.
+ */
+static int ovl_copy_up_meta_data(struct dentry *dentry,
+				 struct path *lowerpath, struct kstat *stat)
+{
+	struct path upperpath;
+	struct inode *uinode;
+	struct kstat ustat;
+	int err;
+
+	ovl_path_upper(dentry, &upperpath);
+	uinode = upperpath.dentry->d_inode;
+	err = vfs_getattr(&upperpath, &ustat);
+	if (err)
+		return err;
+
+	if (stat->size) {
+		err = ovl_copy_up_data(lowerpath, &upperpath, stat->size);
+	} else {
+		struct iattr attr = {
+			.ia_valid = ATTR_SIZE,
+			.ia_size = 0,
+		};
+
+		mutex_lock(&uinode->i_mutex);
+		err = notify_change(upperpath.dentry, &attr, NULL);
+		mutex_unlock(&uinode->i_mutex);
+	}
+	if (err)
+		return err;
+
+	err = ovl_do_removexattr(upperpath.dentry, OVL_XATTR_METACOPY);
+	if (err)
+		return err;
+
+	ovl_dentry_set_metacopy(dentry, false);
+
+	/* Filling in the data doesn't modify the file */
+	mutex_lock(&uinode->i_mutex);
+	ovl_set_timestamps(upperpath.dentry, &ustat);
+	mutex_unlock(&uinode->i_mutex);
+
+	return 0;
+}
+
 /*
  * Copy up a single dentry
  *
@@ -298,7 +370,7 @@ out_cleanup:
  */
 int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 		    struct path *lowerpath, struct kstat *stat,
-		    struct iattr *attr)
+		    struct iattr *attr, bool metacopy)
 {
 	struct dentry *workdir = ovl_workdir(dentry);
 	int err;
@@ -356,10 +428,13 @@ int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 	}
 	upperdentry = ovl_dentry_upper(dentry);
 	if (upperdentry) {
-		unlock_rename(workdir, upperdir);
 		err = 0;
+		/* Only the metadata is on upper, but the data is needed now */
+		if (!metacopy && ovl_dentry_is_metacopy(dentry))
+			err = ovl_copy_up_meta_data(dentry, lowerpath, stat);
+		unlock_rename(workdir, upperdir);
 		/* Raced with another copy-up?  Do the setattr here */
-		if (attr) {
+		if (!err && attr) {
 			mutex_lock(&upperdentry->d_inode->i_mutex);
 			err = notify_change(upperdentry, attr, NULL);
 			mutex_unlock(&upperdentry->d_inode->i_mutex);
@@ -367,8 +442,12 @@ int ovl_copy_up_one(struct dentry *parent, struct dentry *dentry,
 		goto out_put_cred;
 	}
 
+	/* Leave the data on lower until the file is opened for write */
+	metacopy = metacopy && S_ISREG(stat->mode) && stat->size &&
+		   ovl_metacopy_enabled(dentry);
+
 	err = ovl_copy_up_locked(workdir, upperdir, dentry, lowerpath,
-				 stat, attr, link);
+				 stat, attr, link, metacopy);
 	if (!err) {
 		/* Restore timestamps on parent (best effort) */
 		ovl_set_timestamps(upperdir, &pstat);
@@ -386,7 +465,7 @@ out_free_link:
 	return err;
 }
 
-int ovl_copy_up(struct dentry *dentry)
+static int __ovl_copy_up(struct dentry *dentry, bool metacopy)
 {
 	int err;
 
@@ -398,7 +477,8 @@ int ovl_copy_up(struct dentry *dentry)
 		struct kstat stat;
 		enum ovl_path_type type = ovl_path_type(dentry);
 
-		if (OVL_TYPE_UPPER(type))
+		if (OVL_TYPE_UPPER(type) &&
+		    (metacopy || !ovl_dentry_is_metacopy(dentry)))
 			break;
 
 		next = dget(dentry);
@@ -417,7 +497,8 @@ int ovl_copy_up(struct dentry *dentry)
 		ovl_path_lower(next, &lowerpath);
 		err = vfs_getattr(&lowerpath, &stat);
 		if (!err)
-			err = ovl_copy_up_one(parent, next, &lowerpath, &stat, NULL);
+			err = ovl_copy_up_one(parent, next, &lowerpath, &stat,
+					      NULL, metacopy);
 
 		dput(parent);
 		dput(next);
@@ -425,3 +506,18 @@ int ovl_copy_up(struct dentry *dentry)
 
 	return err;
 }
+
+/* Copy up dentry including its data, e.g. before it is opened for write */
+int ovl_copy_up(struct dentry *dentry)
+{
+	return __ovl_copy_up(dentry, false);
+}
+
+/*
+ * Copy up dentry for a metadata change.  With "metacopy=on" regular files
+ * get an upper inode without data, which stays on lower until needed.
+ */
+int ovl_copy_up_meta(struct dentry *dentry)
+{
+	return __ovl_copy_up(dentry, true);
+}
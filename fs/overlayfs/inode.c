@@ -33,7 +33,7 @@ static int ovl_copy_up_last(struct dentry *dentry, struct iattr *attr,
 	if (no_data)
 		stat.size = 0;
 
-	err = ovl_copy_up_one(parent, dentry, &lowerpath, &stat, attr);
+	err = ovl_copy_up_one(parent, dentry, &lowerpath, &stat, attr, false);
 
 out_dput_parent:
 	dput(parent);
@@ -62,7 +62,11 @@ int ovl_setattr(struct dentry *dentry, struct iattr *attr)
 	if (err)
 		goto out;
 
-	err = ovl_copy_up(dentry);
+	/* Only a size change needs the data */
+	if (attr->ia_valid & ATTR_SIZE)
+		err = ovl_copy_up(dentry);
+	else
+		err = ovl_copy_up_meta(dentry);
 	if (!err) {
 		upperdentry = ovl_dentry_upper(dentry);
 
@@ -81,9 +85,21 @@ static int ovl_getattr(struct vfsmount *mnt, struct dentry *dentry,
 			 struct kstat *stat)
 {
 	struct path realpath;
+	struct kstat lowerstat;
+	int err;
 
 	ovl_path_real(dentry, &realpath);
-	return vfs_getattr(&realpath, stat);
+	err = vfs_getattr(&realpath, stat);
+	if (err || !ovl_dentry_is_metacopy(dentry))
+		return err;
+
+	/* The blocks backing the data are still those of the lower file */
+	ovl_path_lower(dentry, &realpath);
+	err = vfs_getattr(&realpath, &lowerstat);
+	if (!err)
+		stat->blocks = lowerstat.blocks;
+
+	return err;
 }
 
 int ovl_permission(struct inode *inode, int mask)
@@ -237,7 +253,7 @@ int ovl_setxattr(struct dentry *dentry, const char *name,
 	if (ovl_is_private_xattr(name))
 		goto out_drop_write;
 
-	err = ovl_copy_up(dentry);
+	err = ovl_copy_up_meta(dentry);
 	if (err)
 		goto out_drop_write;
 
@@ -254,7 +270,8 @@ static bool ovl_need_xattr_filter(struct dentry *dentry,
 				  enum ovl_path_type type)
 {
 	if ((type & (__OVL_PATH_PURE | __OVL_PATH_UPPER)) == __OVL_PATH_UPPER)
-		return S_ISDIR(dentry->d_inode->i_mode);
+		return S_ISDIR(dentry->d_inode->i_mode) ||
+		       ovl_dentry_is_metacopy(dentry);
 	else
 		return false;
 }
@@ -322,7 +339,7 @@ int ovl_removexattr(struct dentry *dentry, const char *name)
 		if (err < 0)
 			goto out_drop_write;
 
-		err = ovl_copy_up(dentry);
+		err = ovl_copy_up_meta(dentry);
 		if (err)
 			goto out_drop_write;
 
@@ -336,10 +353,11 @@ out:
 	return err;
 }
 
-static bool ovl_open_need_copy_up(int flags, enum ovl_path_type type,
+static bool ovl_open_need_copy_up(struct dentry *dentry, int flags,
+				  enum ovl_path_type type,
 				  struct dentry *realdentry)
 {
-	if (OVL_TYPE_UPPER(type))
+	if (OVL_TYPE_UPPER(type) && !ovl_dentry_is_metacopy(dentry))
 		return false;
 
 	if (special_file(realdentry->d_inode->i_mode))
@@ -361,7 +379,7 @@ struct inode *ovl_d_select_inode(struct dentry *dentry, unsigned file_flags)
 		return d_backing_inode(dentry);
 
 	type = ovl_path_real(dentry, &realpath);
-	if (ovl_open_need_copy_up(file_flags, type, realpath.dentry)) {
+	if (ovl_open_need_copy_up(dentry, file_flags, type, realpath.dentry)) {
 		err = ovl_want_write(dentry);
 		if (err)
 			return ERR_PTR(err);
@@ -375,6 +393,9 @@ struct inode *ovl_d_select_inode(struct dentry *dentry, unsigned file_flags)
 			return ERR_PTR(err);
 
 		ovl_path_upper(dentry, &realpath);
+	} else if (ovl_dentry_is_metacopy(dentry)) {
+		/* Read only open, the data is still on lower */
+		ovl_path_lower(dentry, &realpath);
 	}
 
 	return d_backing_inode(realpath.dentry);
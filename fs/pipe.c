@@ -33,6 +33,14 @@
  */
 unsigned int pipe_max_size = 1048576;
 
+/*
+ * Maximum number of pages a user may have allocated in pipe buffers.
+ * The hard limit is unset by default, the soft limit allows the default
+ * pipe size for as many pipes as one process can have open files.
+ */
+unsigned long pipe_user_pages_hard;
+unsigned long pipe_user_pages_soft = PIPE_DEF_BUFFERS * INR_OPEN_CUR;
+
 /*
  * Minimum pipe size, as required by POSIX
  */
@@ -283,6 +291,7 @@ pipe_read(struct kiocb *iocb, struct iov_iter *to)
 				curbuf = (curbuf + 1) & (pipe->buffers - 1);
 				pipe->curbuf = curbuf;
 				pipe->nrbufs = --bufs;
+				pipe->drained++;
 				do_wakeup = 1;
 			}
 			total_len -= chars;
@@ -439,6 +448,9 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		}
 		if (bufs < pipe->buffers)
 			continue;
+		/* Rather grow than wait for a reader that keeps up */
+		if (pipe_autogrow(pipe))
+			continue;
 		if (filp->f_flags & O_NONBLOCK) {
 			if (!ret)
 				ret = -EAGAIN;
@@ -584,20 +596,49 @@ pipe_fasync(int fd, struct file *filp, int on)
 	return retval;
 }
 
+static void account_pipe_buffers(struct pipe_inode_info *pipe,
+				 unsigned long old, unsigned long new)
+{
+	atomic_long_add(new - old, &pipe->user->pipe_bufs);
+}
+
+static bool too_many_pipe_buffers_soft(struct user_struct *user)
+{
+	return pipe_user_pages_soft &&
+	       atomic_long_read(&user->pipe_bufs) >= pipe_user_pages_soft;
+}
+
+static bool too_many_pipe_buffers_hard(struct user_struct *user)
+{
+	return pipe_user_pages_hard &&
+	       atomic_long_read(&user->pipe_bufs) >= pipe_user_pages_hard;
+}
+
 struct pipe_inode_info *alloc_pipe_info(void)
 {
 	struct pipe_inode_info *pipe;
 
 	pipe = kzalloc(sizeof(struct pipe_inode_info), GFP_KERNEL);
 	if (pipe) {
-		pipe->bufs = kzalloc(sizeof(struct pipe_buffer) * PIPE_DEF_BUFFERS, GFP_KERNEL);
+		unsigned long pipe_bufs = PIPE_DEF_BUFFERS;
+		struct user_struct *user = get_current_user();
+
+		if (!too_many_pipe_buffers_hard(user)) {
+			if (too_many_pipe_buffers_soft(user))
+				pipe_bufs = 1;
+			pipe->bufs = kzalloc(sizeof(struct pipe_buffer) * pipe_bufs, GFP_KERNEL);
+		}
+
 		if (pipe->bufs) {
 			init_waitqueue_head(&pipe->wait);
 			pipe->r_counter = pipe->w_counter = 1;
-			pipe->buffers = PIPE_DEF_BUFFERS;
+			pipe->buffers = pipe_bufs;
+			pipe->user = user;
+			account_pipe_buffers(pipe, 0, pipe_bufs);
 			mutex_init(&pipe->mutex);
 			return pipe;
 		}
+		free_uid(user);
 		kfree(pipe);
 	}
 
@@ -615,6 +656,8 @@ void free_pipe_info(struct pipe_inode_info *pipe)
 	}
 	if (pipe->tmp_page)
 		__free_page(pipe->tmp_page);
+	account_pipe_buffers(pipe, pipe->buffers, 0);
+	free_uid(pipe->user);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -996,13 +1039,38 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long nr_pages)
 			memcpy(bufs + head, pipe->bufs, tail * sizeof(struct pipe_buffer));
 	}
 
+	account_pipe_buffers(pipe, pipe->buffers, nr_pages);
 	pipe->curbuf = 0;
 	kfree(pipe->bufs);
 	pipe->bufs = bufs;
 	pipe->buffers = nr_pages;
+	pipe->drained = 0;
 	return nr_pages * PAGE_SIZE;
 }
 
+/*
+ * Called with the pipe locked by a writer that found it full.  If the
+ * readers emptied the whole ring at least twice since it was last sized,
+ * the data is a sustained stream and a bigger ring means fewer context
+ * switches, so double it rather than wait.  A pipe nobody reads from
+ * never drains and never grows.  Pipes sized with F_SETPIPE_SZ are left
+ * alone, and the ring stays within pipe_max_size and the user's soft
+ * limit.  Returns true if the pipe has room now.
+ */
+bool pipe_autogrow(struct pipe_inode_info *pipe)
+{
+	unsigned long nr_pages = pipe->buffers * 2;
+
+	if (pipe->fixed_size || pipe->drained < 2 * pipe->buffers)
+		return false;
+	if (nr_pages > (pipe_max_size >> PAGE_SHIFT))
+		return false;
+	if (too_many_pipe_buffers_soft(pipe->user))
+		return false;
+
+	return pipe_set_size(pipe, nr_pages) > 0;
+}
+
 /*
  * Currently we rely on the pipe array holding a power-of-2 number
  * of pages.
@@ -1067,8 +1135,16 @@ long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
 		if (!capable(CAP_SYS_RESOURCE) && size > pipe_max_size) {
 			ret = -EPERM;
 			goto out;
+		} else if ((too_many_pipe_buffers_hard(pipe->user) ||
+			    too_many_pipe_buffers_soft(pipe->user)) &&
+			   !capable(CAP_SYS_RESOURCE) &&
+			   !capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			goto out;
 		}
 		ret = pipe_set_size(pipe, nr_pages);
+		if (ret > 0)
+			pipe->fixed_size = true;
 		break;
 		}
 	case F_GETPIPE_SZ:
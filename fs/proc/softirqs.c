@@ -36,9 +36,67 @@ static const struct file_operations proc_softirqs_operations = {
 	.release	= single_release,
 };
 
+/*
+ * /proc/softirq_stats  ... per-vector time, deferral and latency
+ *
+ * time is the time spent in the handler, deferred the number of times the
+ * vector overran its budget and was left to ksoftirqd, lat_avg and lat_max
+ * the delay between raising the vector and running its handler.  All times
+ * are in microseconds.
+ */
+static int show_softirq_stats(struct seq_file *p, void *v)
+{
+	int i, j;
+
+	seq_printf(p, "%35s", "");
+	for_each_possible_cpu(i)
+		seq_printf(p, "CPU%-8d", i);
+	seq_putc(p, '\n');
+
+	for (i = 0; i < NR_SOFTIRQS; i++) {
+		seq_printf(p, "%12s: %-14s", softirq_to_name[i], "time");
+		for_each_possible_cpu(j)
+			seq_printf(p, " %10llu",
+				   div_u64(softirq_stat_cpu(i, j)->time,
+					   NSEC_PER_USEC));
+		seq_printf(p, "\n%12s  %-14s", "", "deferred");
+		for_each_possible_cpu(j)
+			seq_printf(p, " %10u", softirq_stat_cpu(i, j)->deferred);
+		seq_printf(p, "\n%12s  %-14s", "", "lat_avg");
+		for_each_possible_cpu(j) {
+			struct softirq_stat *st = softirq_stat_cpu(i, j);
+			unsigned int count = st->lat_count;
+
+			seq_printf(p, " %10llu", count ?
+				   div_u64(div_u64(st->lat_total, count),
+					   NSEC_PER_USEC) : 0ULL);
+		}
+		seq_printf(p, "\n%12s  %-14s", "", "lat_max");
+		for_each_possible_cpu(j)
+			seq_printf(p, " %10llu",
+				   div_u64(softirq_stat_cpu(i, j)->lat_max,
+					   NSEC_PER_USEC));
+		seq_putc(p, '\n');
+	}
+	return 0;
+}
+
+static int softirq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, show_softirq_stats, NULL);
+}
+
+static const struct file_operations proc_softirq_stats_operations = {
+	.open		= softirq_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int __init proc_softirqs_init(void)
 {
 	proc_create("softirqs", 0, NULL, &proc_softirqs_operations);
+	proc_create("softirq_stats", 0, NULL, &proc_softirq_stats_operations);
 	return 0;
 }
 fs_initcall(proc_softirqs_init);
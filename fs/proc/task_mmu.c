@@ -13,6 +13,8 @@
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/mmu_notifier.h>
+#include <linux/futex.h>
+#include <linux/dax.h>
 
 #include <asm/elf.h>
 #include <asm/uaccess.h>
@@ -69,6 +71,36 @@ void task_mem(struct seq_file *m, struct mm_struct *mm)
 		ptes >> 10,
 		pmds >> 10,
 		swap << (PAGE_SHIFT-10));
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seq_printf(m,
+		"SpfSuccess:\t%lu\n"
+		"SpfAbort:\t%lu\n",
+		get_mm_spf_stat(mm, SPF_SUCCESS),
+		get_mm_spf_stat(mm, SPF_ABORT));
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	seq_printf(m,
+		"THPCollapsePriority:\t%d\n"
+		"THPCollapseScanned:\t%lu\n"
+		"THPCollapsed:\t%lu\n"
+		"THPCollapseFailed:\t%lu\n",
+		test_bit(MMF_THP_PRIORITY, &mm->flags),
+		mm->khugepaged_stat[KHUGEPAGED_SCANNED],
+		mm->khugepaged_stat[KHUGEPAGED_COLLAPSED],
+		mm->khugepaged_stat[KHUGEPAGED_COLLAPSE_FAILED]);
+#endif
+#ifdef CONFIG_KSM
+	seq_printf(m,
+		"KsmScanned:\t%lu\n"
+		"KsmSkipped:\t%lu\n"
+		"KsmMergeFailed:\t%lu\n"
+		"KsmMerging:\t%8lu kB\n",
+		mm->ksm_stat[KSM_PAGES_SCANNED],
+		mm->ksm_stat[KSM_PAGES_SKIPPED],
+		mm->ksm_stat[KSM_MERGE_FAILED],
+		mm->ksm_stat[KSM_PAGES_MERGING] << (PAGE_SHIFT-10));
+#endif
+	futex_hash_show(m, mm);
 }
 
 unsigned long task_vsize(struct mm_struct *mm)
@@ -574,6 +606,7 @@ static void show_smap_vma_flags(struct seq_file *m, struct vm_area_struct *vma)
 		[ilog2(VM_MAYEXEC)]	= "me",
 		[ilog2(VM_MAYSHARE)]	= "ms",
 		[ilog2(VM_GROWSDOWN)]	= "gd",
+		[ilog2(VM_UFFD_MISSING)]= "um",
 		[ilog2(VM_PFNMAP)]	= "pf",
 		[ilog2(VM_DENYWRITE)]	= "dw",
 #ifdef CONFIG_X86_INTEL_MPX
@@ -804,11 +837,12 @@ static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 			goto out;
 		}
 
-		page = pmd_page(*pmd);
-
 		/* Clear accessed and referenced bits. */
 		pmdp_test_and_clear_young(vma, addr, pmd);
-		ClearPageReferenced(page);
+		if (!vma_is_dax(vma)) {
+			page = pmd_page(*pmd);
+			ClearPageReferenced(page);
+		}
 out:
 		spin_unlock(ptl);
 		return 0;
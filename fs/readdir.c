@@ -15,7 +15,11 @@
 #include <linux/fs.h>
 #include <linux/fsnotify.h>
 #include <linux/dirent.h>
+#include <linux/dirent_attr.h>
+#include <linux/namei.h>
 #include <linux/security.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/syscalls.h>
 #include <linux/unistd.h>
 
@@ -307,3 +311,199 @@ SYSCALL_DEFINE3(getdents64, unsigned int, fd,
 	fdput(f);
 	return error;
 }
+
+/*
+ * getdents_attr() returns directory entries together with the attributes
+ * of the inodes they name, saving a stat() per entry.  The entries are
+ * collected first and the attributes are looked up once the filesystem
+ * is done iterating, as ->iterate() may hold locks that a lookup of the
+ * inode would also want.  Filesystems that can get at an inode by number
+ * cheaply provide ->dirent_getattr(), the others go through a dcache
+ * lookup and ->getattr().
+ */
+#define GETDENTS_ATTR_MAX	(256 * 1024)
+
+struct getdents_attr_callback {
+	struct dir_context ctx;
+	struct linux_dirent_attr *current_dir;
+	struct linux_dirent_attr *previous;
+	int count;
+	int error;
+};
+
+static int filldir_attr(struct dir_context *ctx, const char *name, int namlen,
+			loff_t offset, u64 ino, unsigned int d_type)
+{
+	struct linux_dirent_attr *dirent;
+	struct getdents_attr_callback *buf =
+		container_of(ctx, struct getdents_attr_callback, ctx);
+	int reclen = ALIGN(offsetof(struct linux_dirent_attr, d_name) +
+			   namlen + 1, sizeof(u64));
+
+	buf->error = -EINVAL;	/* only used if we fail.. */
+	if (reclen > buf->count)
+		return -EINVAL;
+	dirent = buf->previous;
+	if (dirent)
+		dirent->d_off = offset;
+	dirent = buf->current_dir;
+	memset(dirent, 0, offsetof(struct linux_dirent_attr, d_name));
+	dirent->d_ino = ino;
+	dirent->d_reclen = reclen;
+	dirent->d_type = d_type;
+	memcpy(dirent->d_name, name, namlen);
+	/* the terminating NUL and the padding up to reclen */
+	memset(dirent->d_name + namlen, 0,
+	       reclen - offsetof(struct linux_dirent_attr, d_name) - namlen);
+	buf->previous = dirent;
+	buf->current_dir = (void *)dirent + reclen;
+	buf->count -= reclen;
+	return 0;
+}
+
+static void dirent_attr_fill(struct linux_dirent_attr *dirent,
+			     struct kstat *stat)
+{
+	dirent->d_mask = stat->result_mask & STATX_BASIC_STATS;
+	dirent->d_nlink = stat->nlink;
+	dirent->d_uid = from_kuid_munged(current_user_ns(), stat->uid);
+	dirent->d_gid = from_kgid_munged(current_user_ns(), stat->gid);
+	dirent->d_mode = stat->mode;
+	dirent->d_size = stat->size;
+	dirent->d_blocks = stat->blocks;
+	dirent->d_atime.tv_sec = stat->atime.tv_sec;
+	dirent->d_atime.tv_nsec = stat->atime.tv_nsec;
+	dirent->d_mtime.tv_sec = stat->mtime.tv_sec;
+	dirent->d_mtime.tv_nsec = stat->mtime.tv_nsec;
+	dirent->d_ctime.tv_sec = stat->ctime.tv_sec;
+	dirent->d_ctime.tv_nsec = stat->ctime.tv_nsec;
+	dirent->d_rdev_major = MAJOR(stat->rdev);
+	dirent->d_rdev_minor = MINOR(stat->rdev);
+}
+
+/* Called with the directory's i_mutex held, as lookup_one_len() wants */
+static int dirent_attr_lookup(struct file *file,
+			      struct linux_dirent_attr *dirent,
+			      struct kstat *stat, u32 mask, unsigned int flags)
+{
+	struct dentry *parent = file->f_path.dentry;
+	struct path path = { .mnt = file->f_path.mnt };
+	int namlen = strlen(dirent->d_name);
+	int error;
+
+	if (namlen == 1 && dirent->d_name[0] == '.') {
+		path.dentry = dget(parent);
+	} else if (namlen == 2 && dirent->d_name[0] == '.' &&
+		   dirent->d_name[1] == '.') {
+		path.dentry = dget_parent(parent);
+	} else {
+		path.dentry = lookup_one_len(dirent->d_name, parent, namlen);
+		if (IS_ERR(path.dentry))
+			return PTR_ERR(path.dentry);
+	}
+
+	error = -ENOENT;
+	if (d_really_is_positive(path.dentry))
+		error = vfs_getattr_mask(&path, stat, mask, flags);
+	dput(path.dentry);
+	return error;
+}
+
+static void getdents_attr_fill(struct file *file, void *start, void *end,
+			       u32 mask, unsigned int flags)
+{
+	struct inode *inode = file_inode(file);
+	struct linux_dirent_attr *dirent;
+	struct kstat stat;
+	bool by_ino = file->f_op->dirent_getattr != NULL;
+
+	if (by_ino) {
+		/*
+		 * The entries are not looked up, so do the checks lookup
+		 * would: search permission on the directory, and the LSM.
+		 */
+		if (inode_permission(inode, MAY_EXEC) ||
+		    security_inode_getattr(&file->f_path))
+			return;
+	} else if (mutex_lock_killable(&inode->i_mutex)) {
+		return;
+	}
+
+	for (dirent = start; (void *)dirent < end;
+	     dirent = (void *)dirent + dirent->d_reclen) {
+		int error;
+
+		if (by_ino) {
+			stat.result_mask = STATX_BASIC_STATS;
+			stat.request_mask = mask;
+			stat.query_flags = flags;
+			error = file->f_op->dirent_getattr(file, dirent->d_ino,
+							   &stat);
+		} else {
+			error = dirent_attr_lookup(file, dirent, &stat, mask,
+						   flags);
+		}
+		if (!error)
+			dirent_attr_fill(dirent, &stat);
+
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+
+	if (!by_ino)
+		mutex_unlock(&inode->i_mutex);
+}
+
+SYSCALL_DEFINE5(getdents_attr, unsigned int, fd,
+		struct linux_dirent_attr __user *, dirent, unsigned int, count,
+		unsigned int, mask, unsigned int, flags)
+{
+	struct fd f;
+	struct getdents_attr_callback buf = {
+		.ctx.actor = filldir_attr,
+	};
+	void *kbuf;
+	int error;
+
+	if (flags & ~AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	if ((flags & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	if (mask & STATX__RESERVED)
+		return -EINVAL;
+
+	if (!access_ok(VERIFY_WRITE, dirent, count))
+		return -EFAULT;
+
+	count = min_t(unsigned int, count, GETDENTS_ATTR_MAX);
+	kbuf = kmalloc(count, GFP_KERNEL | __GFP_NOWARN);
+	if (!kbuf && count > PAGE_SIZE)
+		kbuf = vmalloc(count);
+	if (!kbuf)
+		return -ENOMEM;
+	buf.current_dir = kbuf;
+	buf.count = count;
+
+	error = -EBADF;
+	f = fdget(fd);
+	if (!f.file)
+		goto out_free;
+
+	error = iterate_dir(f.file, &buf.ctx);
+	if (error >= 0)
+		error = buf.error;
+	if (buf.previous) {
+		buf.previous->d_off = buf.ctx.pos;
+		if (mask)
+			getdents_attr_fill(f.file, kbuf, buf.current_dir,
+					   mask, flags);
+		error = count - buf.count;
+		if (copy_to_user(dirent, kbuf, error))
+			error = -EFAULT;
+	}
+	fdput(f);
+out_free:
+	kvfree(kbuf);
+	return error;
+}
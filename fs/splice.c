@@ -229,6 +229,10 @@ ssize_t splice_to_pipe(struct pipe_inode_info *pipe,
 			break;
 		}
 
+		/* Rather grow than wait for a reader that keeps up */
+		if (pipe_autogrow(pipe))
+			continue;
+
 		if (spd->flags & SPLICE_F_NONBLOCK) {
 			if (!ret)
 				ret = -EAGAIN;
@@ -581,7 +585,7 @@ static ssize_t kernel_readv(struct file *file, const struct iovec *vec,
 	old_fs = get_fs();
 	set_fs(get_ds());
 	/* The cast to a user pointer is valid due to the set_fs() */
-	res = vfs_readv(file, (const struct iovec __user *)vec, vlen, &pos);
+	res = vfs_readv(file, (const struct iovec __user *)vec, vlen, &pos, 0);
 	set_fs(old_fs);
 
 	return res;
@@ -719,6 +723,10 @@ static int pipe_to_sendpage(struct pipe_inode_info *pipe,
 	if (sd->len < sd->total_len && pipe->nrbufs > 1)
 		more |= MSG_SENDPAGE_NOTLAST;
 
+	/* Gifted pages won't be touched by their owner anymore */
+	if (buf->flags & PIPE_BUF_FLAG_GIFT)
+		more |= MSG_NO_SHARED_FRAGS;
+
 	return file->f_op->sendpage(file, buf->page, buf->offset,
 				    sd->len, &pos, more);
 }
@@ -788,6 +796,7 @@ static int splice_from_pipe_feed(struct pipe_inode_info *pipe, struct splice_des
 			ops->release(pipe, buf);
 			pipe->curbuf = (pipe->curbuf + 1) & (pipe->buffers - 1);
 			pipe->nrbufs--;
+			pipe->drained++;
 			if (pipe->files)
 				sd->need_wakeup = true;
 		}
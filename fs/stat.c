@@ -49,10 +49,15 @@ EXPORT_SYMBOL(generic_fillattr);
  * no attributes to any user.  Any other code probably wants
  * vfs_getattr.
  */
-int vfs_getattr_nosec(struct path *path, struct kstat *stat)
+static int __vfs_getattr(struct path *path, struct kstat *stat,
+			 u32 request_mask, unsigned int query_flags)
 {
 	struct inode *inode = d_backing_inode(path->dentry);
 
+	stat->result_mask = STATX_BASIC_STATS;
+	stat->request_mask = request_mask;
+	stat->query_flags = query_flags & AT_STATX_SYNC_TYPE;
+
 	if (inode->i_op->getattr)
 		return inode->i_op->getattr(path->mnt, path->dentry, stat);
 
@@ -60,16 +65,43 @@ int vfs_getattr_nosec(struct path *path, struct kstat *stat)
 	return 0;
 }
 
+int vfs_getattr_nosec(struct path *path, struct kstat *stat)
+{
+	return __vfs_getattr(path, stat, STATX_BASIC_STATS,
+			     AT_STATX_SYNC_AS_STAT);
+}
+
 EXPORT_SYMBOL(vfs_getattr_nosec);
 
-int vfs_getattr(struct path *path, struct kstat *stat)
+/**
+ * vfs_getattr_mask - getattr for a subset of the attributes
+ * @path: file to get attributes from
+ * @stat: structure to return attributes in
+ * @request_mask: STATX_* fields the caller is interested in
+ * @query_flags: AT_STATX_* synchronisation mode
+ *
+ * Like vfs_getattr, but lets a filesystem that has to talk to a server
+ * skip the round trip when the cached attributes cover @request_mask, or
+ * when the caller asked for AT_STATX_DONT_SYNC.  The fields actually
+ * filled in are reported in @stat->result_mask.
+ */
+int vfs_getattr_mask(struct path *path, struct kstat *stat,
+		     u32 request_mask, unsigned int query_flags)
 {
 	int retval;
 
 	retval = security_inode_getattr(path);
 	if (retval)
 		return retval;
-	return vfs_getattr_nosec(path, stat);
+	return __vfs_getattr(path, stat, request_mask, query_flags);
+}
+
+EXPORT_SYMBOL(vfs_getattr_mask);
+
+int vfs_getattr(struct path *path, struct kstat *stat)
+{
+	return vfs_getattr_mask(path, stat, STATX_BASIC_STATS,
+				AT_STATX_SYNC_AS_STAT);
 }
 
 EXPORT_SYMBOL(vfs_getattr);
@@ -87,15 +119,17 @@ int vfs_fstat(unsigned int fd, struct kstat *stat)
 }
 EXPORT_SYMBOL(vfs_fstat);
 
-int vfs_fstatat(int dfd, const char __user *filename, struct kstat *stat,
-		int flag)
+static int vfs_statx(int dfd, const char __user *filename, int flag,
+		     struct kstat *stat, u32 request_mask)
 {
 	struct path path;
 	int error = -EINVAL;
 	unsigned int lookup_flags = 0;
 
 	if ((flag & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT |
-		      AT_EMPTY_PATH)) != 0)
+		      AT_EMPTY_PATH | AT_STATX_SYNC_TYPE)) != 0)
+		goto out;
+	if ((flag & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE)
 		goto out;
 
 	if (!(flag & AT_SYMLINK_NOFOLLOW))
@@ -107,7 +141,7 @@ retry:
 	if (error)
 		goto out;
 
-	error = vfs_getattr(&path, stat);
+	error = vfs_getattr_mask(&path, stat, request_mask, flag);
 	path_put(&path);
 	if (retry_estale(error, lookup_flags)) {
 		lookup_flags |= LOOKUP_REVAL;
@@ -116,6 +150,14 @@ retry:
 out:
 	return error;
 }
+
+int vfs_fstatat(int dfd, const char __user *filename, struct kstat *stat,
+		int flag)
+{
+	if (flag & AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	return vfs_statx(dfd, filename, flag, stat, STATX_BASIC_STATS);
+}
 EXPORT_SYMBOL(vfs_fstatat);
 
 int vfs_stat(const char __user *name, struct kstat *stat)
@@ -312,6 +354,61 @@ SYSCALL_DEFINE2(newfstat, unsigned int, fd, struct stat __user *, statbuf)
 	return error;
 }
 
+static int cp_statx(const struct kstat *stat, struct statx __user *buffer)
+{
+	struct statx tmp;
+
+	memset(&tmp, 0, sizeof(tmp));
+
+	tmp.stx_mask = stat->result_mask;
+	tmp.stx_blksize = stat->blksize;
+	tmp.stx_nlink = stat->nlink;
+	tmp.stx_uid = from_kuid_munged(current_user_ns(), stat->uid);
+	tmp.stx_gid = from_kgid_munged(current_user_ns(), stat->gid);
+	tmp.stx_mode = stat->mode;
+	tmp.stx_ino = stat->ino;
+	tmp.stx_size = stat->size;
+	tmp.stx_blocks = stat->blocks;
+	tmp.stx_atime.tv_sec = stat->atime.tv_sec;
+	tmp.stx_atime.tv_nsec = stat->atime.tv_nsec;
+	tmp.stx_ctime.tv_sec = stat->ctime.tv_sec;
+	tmp.stx_ctime.tv_nsec = stat->ctime.tv_nsec;
+	tmp.stx_mtime.tv_sec = stat->mtime.tv_sec;
+	tmp.stx_mtime.tv_nsec = stat->mtime.tv_nsec;
+	tmp.stx_rdev_major = MAJOR(stat->rdev);
+	tmp.stx_rdev_minor = MINOR(stat->rdev);
+	tmp.stx_dev_major = MAJOR(stat->dev);
+	tmp.stx_dev_minor = MINOR(stat->dev);
+
+	return copy_to_user(buffer, &tmp, sizeof(tmp)) ? -EFAULT : 0;
+}
+
+/**
+ * sys_statx - System call to get enhanced stats
+ * @dfd: Base directory to pathwalk from *or* fd to stat.
+ * @filename: File to stat or "" with AT_EMPTY_PATH
+ * @flags: AT_* flags to control pathwalk and server synchronisation.
+ * @mask: Parts of statx struct actually required.
+ * @buffer: Result buffer.
+ *
+ * Note that fstat() can be emulated by setting dfd to the fd of interest,
+ * supplying "" as the filename and setting AT_EMPTY_PATH in the flags.
+ */
+SYSCALL_DEFINE5(statx, int, dfd, const char __user *, filename,
+		unsigned, flags, unsigned, mask, struct statx __user *, buffer)
+{
+	struct kstat stat;
+	int error;
+
+	if (mask & STATX__RESERVED)
+		return -EINVAL;
+
+	error = vfs_statx(dfd, filename, flags, &stat, mask);
+	if (error)
+		return error;
+	return cp_statx(&stat, buffer);
+}
+
 SYSCALL_DEFINE4(readlinkat, int, dfd, const char __user *, pathname,
 		char __user *, buf, int, bufsiz)
 {
@@ -129,6 +129,7 @@ xfs_ag_resv_needed(
 		len -= xfs_perag_resv(pag, type)->ar_reserved;
 		break;
 	case XFS_AG_RESV_NONE:
+	case XFS_AG_RESV_IGNORE:
 		/* empty */
 		break;
 	default:
@@ -277,6 +278,8 @@ xfs_ag_resv_alloc_extent(
 	case XFS_AG_RESV_AGFL:
 		resv = xfs_perag_resv(pag, type);
 		break;
+	case XFS_AG_RESV_IGNORE:
+		return;
 	default:
 		ASSERT(0);
 		/* fall through */
@@ -315,6 +318,8 @@ xfs_ag_resv_free_extent(
 	case XFS_AG_RESV_AGFL:
 		resv = xfs_perag_resv(pag, type);
 		break;
+	case XFS_AG_RESV_IGNORE:
+		return;
 	default:
 		ASSERT(0);
 		/* fall through */
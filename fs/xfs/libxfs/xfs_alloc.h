@@ -170,6 +170,16 @@ xfs_alloc_read_agf(
 	int		flags,		/* XFS_ALLOC_FLAG_... */
 	struct xfs_buf	**bpp);		/* buffer for the ag freelist header */
 
+/*
+ * Read in the allocation group free block array.
+ */
+int					/* error */
+xfs_alloc_read_agfl(
+	struct xfs_mount *mp,		/* mount point structure */
+	struct xfs_trans *tp,		/* transaction pointer */
+	xfs_agnumber_t	agno,		/* allocation group number */
+	struct xfs_buf	**bpp);		/* buffer for the ag free block array */
+
 /*
  * Allocate an extent (variable-size).
  */
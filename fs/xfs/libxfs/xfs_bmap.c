@@ -3683,6 +3683,7 @@ xfs_bmap_btalloc(
 	int		tryagain;
 	int		error;
 	int		stripe_align;
+	xfs_extlen_t	dax_align;	/* PMD alignment for DAX data */
 
 	ASSERT(ap->length);
 
@@ -3695,11 +3696,14 @@ xfs_bmap_btalloc(
 	else if (mp->m_dalign)
 		stripe_align = mp->m_dalign;
 
+	dax_align = 0;
 	if (ap->userdata) {
-		if (ap->flags & XFS_BMAPI_COWFORK)
+		if (ap->flags & XFS_BMAPI_COWFORK) {
 			align = xfs_get_cowextsz_hint(ap->ip);
-		else
+		} else {
 			align = xfs_get_extsz_hint(ap->ip);
+			dax_align = xfs_get_dax_align_hint(ap->ip);
+		}
 	} else
 		align = 0;
 	if (unlikely(align)) {
@@ -3793,7 +3797,19 @@ xfs_bmap_btalloc(
 	 * is >= the stripe unit and the allocation offset is
 	 * at the end of file.
 	 */
-	if (!ap->dfops->dop_low && ap->aeof) {
+	if (!ap->dfops->dop_low && dax_align) {
+		/*
+		 * DAX files with a huge page sized extent size hint get their
+		 * blocks aligned too, so they can be mapped with PMDs.  The
+		 * extent size hint already aligned the file offset.
+		 */
+		args.alignment = dax_align;
+		atype = args.type;
+		isaligned = 1;
+		if (blen > args.alignment && blen <= args.maxlen)
+			args.minlen = blen - args.alignment;
+		args.minalignslop = 0;
+	} else if (!ap->dfops->dop_low && ap->aeof) {
 		if (!ap->offset) {
 			args.alignment = stripe_align;
 			atype = args.type;
@@ -156,6 +156,37 @@ struct getfsmap {
 #define FMV_OWN_COW		(-9ULL) /* cow staging */
 #define FMV_OWN_DEFECTIVE	(-10ULL) /* bad blocks */
 
+/*
+ *	Structure for XFS_IOC_SCRUB_METADATA.
+ *
+ *	Checks one per-AG btree and, if XFS_SCRUB_FLAG_REPAIR is set and the
+ *	check fails, rebuilds the btree from the reverse mapping btree while
+ *	the filesystem stays mounted.  sm_flags returns XFS_SCRUB_FLAG_CORRUPT
+ *	if the btree was found damaged and XFS_SCRUB_FLAG_REPAIRED if it was
+ *	rebuilt.  The reserved fields must be zero.
+ */
+struct xfs_scrub_metadata {
+	__u32		sm_type;	/* what to check? */
+	__u32		sm_flags;	/* flags; see below. */
+	__u32		sm_agno;	/* AG number */
+	__u32		sm_reserved[5];	/* pad to 32 bytes */
+};
+
+/*	sm_type values */
+#define XFS_SCRUB_TYPE_BNOBT	0	/* freesp by block btree */
+#define XFS_SCRUB_TYPE_CNTBT	1	/* freesp by length btree */
+#define XFS_SCRUB_TYPE_INOBT	2	/* inode btree */
+#define XFS_SCRUB_TYPE_FINOBT	3	/* free inode btree */
+#define XFS_SCRUB_TYPE_RMAPBT	4	/* reverse mapping btree */
+#define XFS_SCRUB_TYPE_REFCNTBT	5	/* reference count btree */
+#define XFS_SCRUB_TYPE_MAX	5
+
+/*	sm_flags values */
+#define XFS_SCRUB_FLAG_REPAIR	(1 << 0)	/* i: repair if corrupt */
+#define XFS_SCRUB_FLAG_CORRUPT	(1 << 1)	/* o: needs repair */
+#define XFS_SCRUB_FLAG_REPAIRED	(1 << 2)	/* o: was repaired */
+#define XFS_SCRUB_FLAGS_IN	(XFS_SCRUB_FLAG_REPAIR)
+
 /*
  * Structure for XFS_IOC_FSSETDM.
  * For use by backup and restore programs to set the XFS on-disk inode
@@ -567,6 +598,7 @@ typedef struct xfs_swapext
 #define XFS_IOC_ZERO_RANGE	_IOW ('X', 57, struct xfs_flock64)
 #define XFS_IOC_FREE_EOFBLOCKS	_IOR ('X', 58, struct xfs_fs_eofblocks)
 #define XFS_IOC_GETFSMAP	_IOWR('X', 59, struct getfsmap)
+#define XFS_IOC_SCRUB_METADATA	_IOWR('X', 60, struct xfs_scrub_metadata)
 
 /*
  * ioctl commands that replace IRIX syssgi()'s
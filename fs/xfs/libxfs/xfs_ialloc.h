@@ -151,6 +151,13 @@ xfs_ialloc_pagi_init(
 int xfs_inobt_lookup(struct xfs_btree_cur *cur, xfs_agino_t ino,
 		xfs_lookup_t dir, int *stat);
 
+/*
+ * Insert a record at the position the cursor was looked up to.
+ */
+int xfs_inobt_insert_rec(struct xfs_btree_cur *cur, __uint16_t holemask,
+		__uint8_t count, __int32_t freecount, xfs_inofree_t free,
+		int *stat);
+
 /*
  * Get the data from the pointed-to record.
  */
@@ -22,7 +22,7 @@
  * Tunable XFS parameters.  xfs_params is required even when CONFIG_SYSCTL=n,
  * other XFS code uses these values.  Times are measured in centisecs (i.e.
  * 100ths of a second) with the exception of eofb_timer and cowb_timer, which
- * are measured in seconds.
+ * are measured in seconds, and repair_delay, which is in milliseconds.
  */
 xfs_param_t xfs_params = {
 			  /*	MIN		DFLT		MAX	*/
@@ -44,6 +44,7 @@ xfs_param_t xfs_params = {
 	.eofb_timer	= {	1,		300,		3600*24},
 	.cowb_timer	= {	1,		300,		3600*24},
 	.always_cow	= {	0,		0,		1	},
+	.repair_delay	= {	0,		0,		10000	},
 };
 
 struct xfs_globals xfs_globals = {
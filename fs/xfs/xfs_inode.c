@@ -100,6 +100,31 @@ xfs_get_cowextsz_hint(
 	return a;
 }
 
+/*
+ * Helper function to extract the physical alignment wanted for the data
+ * extents of a DAX file.  If the extent size hint is a multiple of the PMD
+ * size, aligning the blocks as well lets faults map them with huge pages.
+ * Returns zero if no alignment is wanted.
+ */
+xfs_extlen_t
+xfs_get_dax_align_hint(
+	struct xfs_inode	*ip)
+{
+#ifdef CONFIG_FS_DAX_PMD
+	xfs_extlen_t		pmd_fsb;
+	xfs_extlen_t		extsz;
+
+	if (!IS_DAX(VFS_I(ip)) || XFS_IS_REALTIME_INODE(ip))
+		return 0;
+
+	pmd_fsb = XFS_B_TO_FSBT(ip->i_mount, PMD_SIZE);
+	extsz = xfs_get_extsz_hint(ip);
+	if (extsz && !(extsz % pmd_fsb))
+		return pmd_fsb;
+#endif
+	return 0;
+}
+
 /*
  * These two are wrapper routines around the xfs_ilock() routine used to
  * centralize some grungy code.  They are used in places that wish to lock the
@@ -43,6 +43,7 @@
 #include "xfs_acl.h"
 #include "xfs_btree.h"
 #include "xfs_reflink.h"
+#include "xfs_repair.h"
 
 #include <linux/capability.h>
 #include <linux/dcache.h>
@@ -1679,6 +1680,39 @@ xfs_ioc_getfsmap(
 	return 0;
 }
 
+STATIC int
+xfs_ioc_scrub_metadata(
+	struct file			*filp,
+	void				__user *arg)
+{
+	struct xfs_inode		*ip = XFS_I(file_inode(filp));
+	struct xfs_scrub_metadata	sm;
+	bool				repair;
+	int				error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&sm, arg, sizeof(sm)))
+		return -EFAULT;
+
+	repair = sm.sm_flags & XFS_SCRUB_FLAG_REPAIR;
+	if (repair) {
+		error = mnt_want_write_file(filp);
+		if (error)
+			return error;
+	}
+	error = xfs_scrub_metadata(ip->i_mount, &sm);
+	if (repair)
+		mnt_drop_write_file(filp);
+	if (error)
+		return error;
+
+	if (copy_to_user(arg, &sm, sizeof(sm)))
+		return -EFAULT;
+	return 0;
+}
+
 int
 xfs_ioc_swapext(
 	xfs_swapext_t	*sxp)
@@ -1864,6 +1898,9 @@ xfs_file_ioctl(
 			return -EPERM;
 		return xfs_ioc_getfsmap(ip, arg);
 
+	case XFS_IOC_SCRUB_METADATA:
+		return xfs_ioc_scrub_metadata(filp, arg);
+
 	case XFS_IOC_FD_TO_HANDLE:
 	case XFS_IOC_PATH_TO_HANDLE:
 	case XFS_IOC_PATH_TO_FSHANDLE: {
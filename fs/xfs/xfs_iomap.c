@@ -1100,6 +1100,7 @@ xfs_file_iomap_begin(
 		iomap->type = IOMAP_HOLE;
 		iomap->offset = offset;
 		iomap->length = length;
+		iomap->bdev = xfs_find_bdev_for_inode(inode);
 	}
 
 	return 0;
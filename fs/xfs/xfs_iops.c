@@ -458,21 +458,14 @@ xfs_vn_follow_link_inline(
 	return NULL;
 }
 
-STATIC int
-xfs_vn_getattr(
-	struct vfsmount		*mnt,
-	struct dentry		*dentry,
+void
+xfs_fill_kstat(
+	struct xfs_inode	*ip,
 	struct kstat		*stat)
 {
-	struct inode		*inode = d_inode(dentry);
-	struct xfs_inode	*ip = XFS_I(inode);
+	struct inode		*inode = VFS_I(ip);
 	struct xfs_mount	*mp = ip->i_mount;
 
-	trace_xfs_getattr(ip);
-
-	if (XFS_FORCED_SHUTDOWN(mp))
-		return -EIO;
-
 	stat->size = XFS_ISIZE(ip);
 	stat->dev = inode->i_sb->s_dev;
 	stat->mode = inode->i_mode;
@@ -508,7 +501,22 @@ xfs_vn_getattr(
 		stat->rdev = 0;
 		break;
 	}
+}
+
+STATIC int
+xfs_vn_getattr(
+	struct vfsmount		*mnt,
+	struct dentry		*dentry,
+	struct kstat		*stat)
+{
+	struct xfs_inode	*ip = XFS_I(d_inode(dentry));
+
+	trace_xfs_getattr(ip);
+
+	if (XFS_FORCED_SHUTDOWN(ip->i_mount))
+		return -EIO;
 
+	xfs_fill_kstat(ip, stat);
 	return 0;
 }
 
@@ -1230,6 +1238,7 @@ xfs_setup_iops(
 		inode->i_op = &xfs_inode_operations;
 		inode->i_fop = &xfs_file_operations;
 		inode->i_mapping->a_ops = &xfs_address_space_operations;
+		mapping_set_large_pages(inode->i_mapping);
 		break;
 	case S_IFDIR:
 		if (xfs_sb_version_hasasciici(&XFS_M(inode->i_sb)->m_sb))
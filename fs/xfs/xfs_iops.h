@@ -24,6 +24,7 @@ extern const struct file_operations xfs_file_operations;
 extern const struct file_operations xfs_dir_file_operations;
 
 extern ssize_t xfs_vn_listxattr(struct dentry *, char *data, size_t size);
+extern void xfs_fill_kstat(struct xfs_inode *ip, struct kstat *stat);
 
 /*
  * Internal setattr interfaces.
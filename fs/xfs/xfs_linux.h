@@ -118,6 +118,7 @@ typedef __u32			xfs_nlink_t;
 #define xfs_eofb_secs		xfs_params.eofb_timer.val
 #define xfs_cowb_secs		xfs_params.cowb_timer.val
 #define xfs_always_cow		xfs_params.always_cow.val
+#define xfs_repair_delay_ms	xfs_params.repair_delay.val
 
 #define current_cpu()		(raw_smp_processor_id())
 #define current_pid()		(current->pid)
@@ -395,6 +395,11 @@ insert:
  * if the change requires additional log metadata. If it does, take that space
  * as well. Remove the amount of space we added to the checkpoint ticket from
  * the current transaction ticket so that the accounting works out correctly.
+ *
+ * Everything but the space and order counters goes to the per-cpu part of
+ * the context, so the only thing that keeps concurrent commits apart is the
+ * item locks they already hold. The per-cpu parts are folded into the
+ * context by xlog_cil_pcp_aggregate() at push time.
  */
 static void
 xlog_cil_insert_items(
@@ -403,10 +408,15 @@ xlog_cil_insert_items(
 {
 	struct xfs_cil		*cil = log->l_cilp;
 	struct xfs_cil_ctx	*ctx = cil->xc_ctx;
+	struct xlog_cil_pcp	*pcp;
 	struct xfs_log_item_desc *lidp;
 	int			len = 0;
 	int			diff_iovecs = 0;
 	int			iclog_space;
+	int			space_used;
+	int			hdrs = 0;
+	int			order;
+	bool			dirty = false;
 
 	ASSERT(tp);
 
@@ -416,66 +426,112 @@ xlog_cil_insert_items(
 	 */
 	xlog_cil_insert_format_items(log, tp, &len, &diff_iovecs);
 
-	/*
-	 * Now (re-)position everything modified at the tail of the CIL.
-	 * We do this here so we only need to take the CIL lock once during
-	 * the transaction commit.
-	 */
-	spin_lock(&cil->xc_cil_lock);
-	list_for_each_entry(lidp, &tp->t_items, lid_trans) {
-		struct xfs_log_item	*lip = lidp->lid_item;
-
-		/* Skip items which aren't dirty in this transaction. */
-		if (!(lidp->lid_flags & XFS_LID_DIRTY))
-			continue;
-
-		/*
-		 * Only move the item if it isn't already at the tail. This is
-		 * to prevent a transient list_empty() state when reinserting
-		 * an item that is already the only item in the CIL.
-		 */
-		if (!list_is_last(&lip->li_cil, &cil->xc_cil))
-			list_move_tail(&lip->li_cil, &cil->xc_cil);
-	}
-
 	/* account for space used by new iovec headers  */
 	len += diff_iovecs * sizeof(xlog_op_header_t);
-	ctx->nvecs += diff_iovecs;
-
-	/* attach the transaction to the CIL if it has any busy extents */
-	if (!list_empty(&tp->t_busy))
-		list_splice_init(&tp->t_busy, &ctx->busy_extents);
 
 	/*
 	 * Now transfer enough transaction reservation to the context ticket
 	 * for the checkpoint. The context ticket is special - the unit
 	 * reservation has to grow as well as the current reservation as we
 	 * steal from tickets so we can correctly determine the space used
-	 * during the transaction commit.
+	 * during the transaction commit. The ticket itself is only updated
+	 * at push time, here we just record what we took.
 	 */
-	if (ctx->ticket->t_curr_res == 0) {
-		ctx->ticket->t_curr_res = ctx->ticket->t_unit_res;
+	if (!test_and_set_bit(XLOG_CIL_CTX_TICKET, &ctx->flags))
 		tp->t_ticket->t_curr_res -= ctx->ticket->t_unit_res;
-	}
 
 	/* do we need space for more log record headers? */
 	iclog_space = log->l_iclog_size - log->l_iclog_hsize;
-	if (len > 0 && (ctx->space_used / iclog_space !=
-				(ctx->space_used + len) / iclog_space)) {
-		int hdrs;
-
+	space_used = atomic_add_return(len, &ctx->space_used) - len;
+	if (len > 0 && (space_used / iclog_space !=
+				(space_used + len) / iclog_space)) {
 		hdrs = (len + iclog_space - 1) / iclog_space;
 		/* need to take into account split region headers, too */
 		hdrs *= log->l_iclog_hsize + sizeof(struct xlog_op_header);
-		ctx->ticket->t_unit_res += hdrs;
-		ctx->ticket->t_curr_res += hdrs;
 		tp->t_ticket->t_curr_res -= hdrs;
 		ASSERT(tp->t_ticket->t_curr_res >= len);
 	}
 	tp->t_ticket->t_curr_res -= len;
-	ctx->space_used += len;
 
-	spin_unlock(&cil->xc_cil_lock);
+	/*
+	 * Now (re-)position everything modified at the tail of the CIL. An
+	 * item that is already in the CIL stays on whichever per-cpu list it
+	 * was first added to; the new order id moves it to the tail when the
+	 * push sorts the lists.
+	 */
+	order = atomic_inc_return(&ctx->order_id);
+	pcp = get_cpu_ptr(cil->xc_pcp);
+	pcp->space_reserved += hdrs;
+	pcp->nvecs += diff_iovecs;
+
+	/* attach the transaction to the CIL if it has any busy extents */
+	if (!list_empty(&tp->t_busy))
+		list_splice_init(&tp->t_busy, &pcp->busy_extents);
+
+	list_for_each_entry(lidp, &tp->t_items, lid_trans) {
+		struct xfs_log_item	*lip = lidp->lid_item;
+
+		/* Skip items which aren't dirty in this transaction. */
+		if (!(lidp->lid_flags & XFS_LID_DIRTY))
+			continue;
+
+		lip->li_order_id = order;
+		if (list_empty(&lip->li_cil))
+			list_add_tail(&lip->li_cil, &pcp->log_items);
+		dirty = true;
+	}
+	put_cpu_ptr(cil->xc_pcp);
+
+	/* avoid dirtying the shared cacheline once the CIL is in use */
+	if (dirty && test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
+		clear_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
+}
+
+static int
+xlog_cil_order_cmp(
+	void			*priv,
+	struct list_head	*a,
+	struct list_head	*b)
+{
+	struct xfs_log_item	*l1 = container_of(a, struct xfs_log_item, li_cil);
+	struct xfs_log_item	*l2 = container_of(b, struct xfs_log_item, li_cil);
+
+	return l1->li_order_id > l2->li_order_id;
+}
+
+/*
+ * Fold the per-cpu parts of the context into the context that is about to be
+ * pushed, and build the list of items to push in commit order. Called with the
+ * context lock held exclusively, so no commits can be adding to the per-cpu
+ * lists.
+ */
+static void
+xlog_cil_pcp_aggregate(
+	struct xfs_cil		*cil,
+	struct xfs_cil_ctx	*ctx,
+	struct list_head	*items)
+{
+	struct xlog_ticket	*tic = ctx->ticket;
+	int			reserved = 0;
+	int			cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct xlog_cil_pcp	*pcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		reserved += pcp->space_reserved;
+		ctx->nvecs += pcp->nvecs;
+		pcp->space_reserved = 0;
+		pcp->nvecs = 0;
+		list_splice_init(&pcp->busy_extents, &ctx->busy_extents);
+		list_splice_tail_init(&pcp->log_items, items);
+	}
+
+	if (test_bit(XLOG_CIL_CTX_TICKET, &ctx->flags))
+		tic->t_curr_res = tic->t_unit_res;
+	tic->t_unit_res += reserved;
+	tic->t_curr_res += reserved;
+
+	list_sort(NULL, items, xlog_cil_order_cmp);
 }
 
 static void
@@ -535,6 +591,8 @@ xlog_cil_committed(
 	kmem_free(ctx);
 }
 
+static void xlog_cil_push_work(struct work_struct *work);
+
 /*
  * Push the Committed Item List to the log. If @push_seq flag is zero, then it
  * is a background flush and so we can chose to ignore it. Otherwise, if the
@@ -566,12 +624,14 @@ xlog_cil_push(
 	struct xfs_log_vec	lvhdr = { NULL };
 	xfs_lsn_t		commit_lsn;
 	xfs_lsn_t		push_seq;
+	LIST_HEAD(items);
 
 	if (!cil)
 		return 0;
 
 	new_ctx = kmem_zalloc(sizeof(*new_ctx), KM_SLEEP|KM_NOFS);
 	new_ctx->ticket = xlog_cil_ticket_alloc(log);
+	INIT_WORK(&new_ctx->push_work, xlog_cil_push_work);
 
 	down_write(&cil->xc_ctx_lock);
 	ctx = cil->xc_ctx;
@@ -585,7 +645,7 @@ xlog_cil_push(
 	 * move on to a new sequence number and so we have to be able to push
 	 * this sequence again later.
 	 */
-	if (list_empty(&cil->xc_cil)) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		cil->xc_push_seq = 0;
 		spin_unlock(&cil->xc_push_lock);
 		goto out_skip;
@@ -627,17 +687,18 @@ xlog_cil_push(
 
 	/*
 	 * pull all the log vectors off the items in the CIL, and
-	 * remove the items from the CIL. We don't need the CIL lock
-	 * here because it's only needed on the transaction commit
-	 * side which is currently locked out by the flush lock.
+	 * remove the items from the CIL. We don't need any locks
+	 * here because the per-cpu lists are only modified on the
+	 * transaction commit side which is currently locked out by
+	 * the flush lock.
 	 */
+	xlog_cil_pcp_aggregate(cil, ctx, &items);
 	lv = NULL;
 	num_iovecs = 0;
-	while (!list_empty(&cil->xc_cil)) {
+	while (!list_empty(&items)) {
 		struct xfs_log_item	*item;
 
-		item = list_first_entry(&cil->xc_cil,
-					struct xfs_log_item, li_cil);
+		item = list_first_entry(&items, struct xfs_log_item, li_cil);
 		list_del_init(&item->li_cil);
 		if (!ctx->lv_chain)
 			ctx->lv_chain = item->li_lv;
@@ -647,6 +708,7 @@ xlog_cil_push(
 		item->li_lv = NULL;
 		num_iovecs += lv->lv_niovecs;
 	}
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 
 	/*
 	 * initialise the new context and attach it to the CIL. Then attach
@@ -658,7 +720,6 @@ xlog_cil_push(
 	INIT_LIST_HEAD(&new_ctx->busy_extents);
 	new_ctx->sequence = ctx->sequence + 1;
 	new_ctx->cil = cil;
-	cil->xc_ctx = new_ctx;
 
 	/*
 	 * The switch is now done, so we can drop the context lock and move out
@@ -684,8 +745,14 @@ xlog_cil_push(
 	 * committing list. This also ensures that we can do unlocked checks
 	 * against the current sequence in log forces without risking
 	 * deferencing a freed context pointer.
+	 *
+	 * Switching the context under the push lock as well lets pushes queue
+	 * the push work of the current context without holding the context
+	 * lock. Once we drop it, the next context can be pushed while this one
+	 * is still being written to the iclogs.
 	 */
 	spin_lock(&cil->xc_push_lock);
+	cil->xc_ctx = new_ctx;
 	cil->xc_current_sequence = new_ctx->sequence;
 	spin_unlock(&cil->xc_push_lock);
 	up_write(&cil->xc_ctx_lock);
@@ -793,9 +860,9 @@ static void
 xlog_cil_push_work(
 	struct work_struct	*work)
 {
-	struct xfs_cil		*cil = container_of(work, struct xfs_cil,
-							xc_push_work);
-	xlog_cil_push(cil->xc_log);
+	struct xfs_cil_ctx	*ctx = container_of(work, struct xfs_cil_ctx,
+							push_work);
+	xlog_cil_push(ctx->cil->xc_log);
 }
 
 /*
@@ -815,19 +882,20 @@ xlog_cil_push_background(
 	 * The cil won't be empty because we are called while holding the
 	 * context lock so whatever we added to the CIL will still be there
 	 */
-	ASSERT(!list_empty(&cil->xc_cil));
+	ASSERT(!test_bit(XLOG_CIL_EMPTY, &cil->xc_flags));
 
 	/*
 	 * don't do a background push if we haven't used up all the
 	 * space available yet.
 	 */
-	if (cil->xc_ctx->space_used < XLOG_CIL_SPACE_LIMIT(log))
+	if (atomic_read(&cil->xc_ctx->space_used) < XLOG_CIL_SPACE_LIMIT(log))
 		return;
 
 	spin_lock(&cil->xc_push_lock);
 	if (cil->xc_push_seq < cil->xc_current_sequence) {
 		cil->xc_push_seq = cil->xc_current_sequence;
-		queue_work(log->l_mp->m_cil_workqueue, &cil->xc_push_work);
+		queue_work(log->l_mp->m_cil_workqueue,
+			   &cil->xc_ctx->push_work);
 	}
 	spin_unlock(&cil->xc_push_lock);
 
@@ -851,21 +919,21 @@ xlog_cil_push_now(
 
 	ASSERT(push_seq && push_seq <= cil->xc_current_sequence);
 
-	/* start on any pending background push to minimise wait time on it */
-	flush_work(&cil->xc_push_work);
-
 	/*
 	 * If the CIL is empty or we've already pushed the sequence then
-	 * there's no work we need to do.
+	 * there's no work we need to do. A background push already queued
+	 * for the current context is the same work item, so we don't need
+	 * to wait for it to start before queueing ours.
 	 */
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil) || push_seq <= cil->xc_push_seq) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) ||
+	    push_seq <= cil->xc_push_seq) {
 		spin_unlock(&cil->xc_push_lock);
 		return;
 	}
 
 	cil->xc_push_seq = push_seq;
-	queue_work(log->l_mp->m_cil_workqueue, &cil->xc_push_work);
+	queue_work(log->l_mp->m_cil_workqueue, &cil->xc_ctx->push_work);
 	spin_unlock(&cil->xc_push_lock);
 }
 
@@ -877,7 +945,7 @@ xlog_cil_empty(
 	bool		empty = false;
 
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil))
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
 		empty = true;
 	spin_unlock(&cil->xc_push_lock);
 	return empty;
@@ -1023,7 +1091,7 @@ restart:
 	 * we would have found the context on the committing list.
 	 */
 	if (sequence == cil->xc_current_sequence &&
-	    !list_empty(&cil->xc_cil)) {
+	    !test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		spin_unlock(&cil->xc_push_lock);
 		goto restart;
 	}
@@ -1082,27 +1150,36 @@ xlog_cil_init(
 {
 	struct xfs_cil	*cil;
 	struct xfs_cil_ctx *ctx;
+	int		cpu;
 
 	cil = kmem_zalloc(sizeof(*cil), KM_SLEEP|KM_MAYFAIL);
 	if (!cil)
 		return -ENOMEM;
 
 	ctx = kmem_zalloc(sizeof(*ctx), KM_SLEEP|KM_MAYFAIL);
-	if (!ctx) {
-		kmem_free(cil);
-		return -ENOMEM;
+	if (!ctx)
+		goto out_free_cil;
+
+	cil->xc_pcp = alloc_percpu(struct xlog_cil_pcp);
+	if (!cil->xc_pcp)
+		goto out_free_ctx;
+
+	for_each_possible_cpu(cpu) {
+		struct xlog_cil_pcp	*pcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		INIT_LIST_HEAD(&pcp->busy_extents);
+		INIT_LIST_HEAD(&pcp->log_items);
 	}
 
-	INIT_WORK(&cil->xc_push_work, xlog_cil_push_work);
-	INIT_LIST_HEAD(&cil->xc_cil);
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 	INIT_LIST_HEAD(&cil->xc_committing);
-	spin_lock_init(&cil->xc_cil_lock);
 	spin_lock_init(&cil->xc_push_lock);
 	init_rwsem(&cil->xc_ctx_lock);
 	init_waitqueue_head(&cil->xc_commit_wait);
 
 	INIT_LIST_HEAD(&ctx->committing);
 	INIT_LIST_HEAD(&ctx->busy_extents);
+	INIT_WORK(&ctx->push_work, xlog_cil_push_work);
 	ctx->sequence = 1;
 	ctx->cil = cil;
 	cil->xc_ctx = ctx;
@@ -1111,6 +1188,12 @@ xlog_cil_init(
 	cil->xc_log = log;
 	log->l_cilp = cil;
 	return 0;
+
+out_free_ctx:
+	kmem_free(ctx);
+out_free_cil:
+	kmem_free(cil);
+	return -ENOMEM;
 }
 
 void
@@ -1123,7 +1206,8 @@ xlog_cil_destroy(
 		kmem_free(log->l_cilp->xc_ctx);
 	}
 
-	ASSERT(list_empty(&log->l_cilp->xc_cil));
+	ASSERT(test_bit(XLOG_CIL_EMPTY, &log->l_cilp->xc_flags));
+	free_percpu(log->l_cilp->xc_pcp);
 	kmem_free(log->l_cilp);
 }
 
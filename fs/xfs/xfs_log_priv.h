@@ -252,11 +252,33 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
 	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* commit order of items */
+	unsigned long		flags;		/* XLOG_CIL_CTX_* */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	struct xfs_log_callback	log_cb;		/* completion callback hook. */
 	struct list_head	committing;	/* ctx committing list */
+	struct work_struct	push_work;	/* push of this chkpt */
+};
+
+/* the ticket's unit reservation has been stolen from a transaction */
+#define XLOG_CIL_CTX_TICKET	0
+
+/*
+ * Per-cpu part of the CIL context.  Transaction commits add their items,
+ * busy extents and log record header reservation to the list of the CPU
+ * they run on, so that concurrent commits do not serialise on a CIL wide
+ * spinlock; only the space and ordering counters in the context are
+ * shared, and those are updated atomically.  The push merges them all into the checkpoint while holding
+ * the context lock exclusively, and restores commit order by sorting the
+ * items on li_order_id.
+ */
+struct xlog_cil_pcp {
+	int			space_reserved;	/* header space stolen */
+	int			nvecs;		/* number of regions */
+	struct list_head	busy_extents;
+	struct list_head	log_items;
 };
 
 /*
@@ -277,8 +299,8 @@ struct xfs_cil_ctx {
  */
 struct xfs_cil {
 	struct xlog		*xc_log;
-	struct list_head	xc_cil;
-	spinlock_t		xc_cil_lock;
+	struct xlog_cil_pcp __percpu *xc_pcp;
+	unsigned long		xc_flags;
 
 	struct rw_semaphore	xc_ctx_lock ____cacheline_aligned_in_smp;
 	struct xfs_cil_ctx	*xc_ctx;
@@ -288,9 +310,11 @@ struct xfs_cil {
 	struct list_head	xc_committing;
 	wait_queue_head_t	xc_commit_wait;
 	xfs_lsn_t		xc_current_sequence;
-	struct work_struct	xc_push_work;
 } ____cacheline_aligned_in_smp;
 
+/* no items have been committed to the current context */
+#define XLOG_CIL_EMPTY		0
+
 /*
  * The amount of log space we allow the CIL to aggregate is difficult to size.
  * Whatever we choose, we have to make sure we can get a reservation for the
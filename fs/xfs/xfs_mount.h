@@ -340,6 +340,11 @@ enum xfs_ag_resv_type {
 	XFS_AG_RESV_NONE = 0,
 	XFS_AG_RESV_METADATA,
 	XFS_AG_RESV_AGFL,
+	/*
+	 * Don't touch the superblock free block counters at all; used by
+	 * online repair, which settles them itself once a btree is rebuilt.
+	 */
+	XFS_AG_RESV_IGNORE,
 };
 
 struct xfs_ag_resv {
@@ -0,0 +1,1204 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_defer.h"
+#include "xfs_inode.h"
+#include "xfs_btree.h"
+#include "xfs_trans.h"
+#include "xfs_alloc.h"
+#include "xfs_alloc_btree.h"
+#include "xfs_ialloc.h"
+#include "xfs_ialloc_btree.h"
+#include "xfs_rmap.h"
+#include "xfs_rmap_btree.h"
+#include "xfs_refcount.h"
+#include "xfs_refcount_btree.h"
+#include "xfs_ag_resv.h"
+#include "xfs_repair.h"
+#include <linux/bsearch.h>
+#include <linux/sort.h>
+
+/*
+ * Online repair of per-AG btrees.
+ *
+ * The reverse mapping btree knows the owner of every allocated block in
+ * an AG, so the free space, inode and reference count btrees can all be
+ * regenerated from it.  A repair collects the records from the rmapbt,
+ * resets the broken btree to an empty root, inserts the new records and
+ * then frees the blocks of the old btree.
+ *
+ * The AG header stays locked for the whole rebuild, so nobody sees the
+ * btree while it is being refilled.  The allocator skips locked AGs, so
+ * foreground work elsewhere keeps going.  Every record goes in its own
+ * transaction and the online_repair_delay_ms sysctl adds a pause every
+ * few records, which keeps a large rebuild from monopolising the log.
+ *
+ * A crash in the middle of a rebuild leaves a valid but incomplete btree;
+ * the worst outcome is leaked free space that xfs_repair will recover.
+ */
+
+/* Records inserted between two throttling pauses */
+#define XFS_REPAIR_BATCH	64
+
+/* Blocks of an old btree invalidated and freed per transaction */
+#define XFS_REPAIR_REAP_MAX	16
+
+/* A growable array of fixed size items */
+struct xfs_repair_array {
+	void			*items;
+	size_t			size;
+	unsigned long		nr;
+	unsigned long		max;
+};
+
+#define XFS_REPAIR_ARRAY_INIT(type)	{ .size = sizeof(type) }
+#define xfs_repair_array_item(ra, i)	((ra)->items + (i) * (ra)->size)
+
+STATIC int
+xfs_repair_array_add(
+	struct xfs_repair_array	*ra,
+	const void		*item)
+{
+	unsigned long		max;
+	void			*items;
+
+	if (ra->nr == ra->max) {
+		max = ra->max ? ra->max * 2 : PAGE_SIZE / ra->size;
+		items = kmem_zalloc_large(max * ra->size, KM_MAYFAIL);
+		if (!items)
+			return -ENOMEM;
+		if (ra->items) {
+			memcpy(items, ra->items, ra->nr * ra->size);
+			kmem_free(ra->items);
+		}
+		ra->items = items;
+		ra->max = max;
+	}
+	memcpy(xfs_repair_array_item(ra, ra->nr), item, ra->size);
+	ra->nr++;
+	return 0;
+}
+
+STATIC void
+xfs_repair_array_free(
+	struct xfs_repair_array	*ra)
+{
+	kmem_free(ra->items);
+	ra->items = NULL;
+	ra->nr = ra->max = 0;
+}
+
+/* An extent of AG blocks */
+struct xfs_repair_extent {
+	xfs_agblock_t		agbno;
+	xfs_extlen_t		len;
+};
+
+/* Add an extent, merging it with the last one if they touch. */
+STATIC int
+xfs_repair_extent_add(
+	struct xfs_repair_array		*ra,
+	xfs_agblock_t			agbno,
+	xfs_extlen_t			len)
+{
+	struct xfs_repair_extent	*last;
+	struct xfs_repair_extent	ext;
+
+	if (ra->nr) {
+		last = xfs_repair_array_item(ra, ra->nr - 1);
+		if (last->agbno + last->len == agbno) {
+			last->len += len;
+			return 0;
+		}
+	}
+	ext.agbno = agbno;
+	ext.len = len;
+	return xfs_repair_array_add(ra, &ext);
+}
+
+/* Take the first block off a list of extents. */
+STATIC xfs_agblock_t
+xfs_repair_extent_take(
+	struct xfs_repair_array		*ra,
+	unsigned long			*first)
+{
+	struct xfs_repair_extent	*ext;
+	xfs_agblock_t			agbno;
+
+	while (*first < ra->nr) {
+		ext = xfs_repair_array_item(ra, *first);
+		if (ext->len) {
+			agbno = ext->agbno++;
+			ext->len--;
+			return agbno;
+		}
+		(*first)++;
+	}
+	return NULLAGBLOCK;
+}
+
+static int
+xfs_repair_agbno_cmp(
+	const void		*a,
+	const void		*b)
+{
+	xfs_agblock_t		x = *(const xfs_agblock_t *)a;
+	xfs_agblock_t		y = *(const xfs_agblock_t *)b;
+
+	if (x > y)
+		return 1;
+	if (x < y)
+		return -1;
+	return 0;
+}
+
+/*
+ * Turn the extents in @in into single blocks, drop the ones found in the
+ * sorted block array @skip and add the rest to @out.
+ */
+STATIC int
+xfs_repair_extent_subtract(
+	struct xfs_repair_array		*in,
+	struct xfs_repair_array		*skip,
+	struct xfs_repair_array		*out)
+{
+	struct xfs_repair_extent	*ext;
+	xfs_agblock_t			agbno;
+	unsigned long			i;
+	int				error;
+
+	for (i = 0; i < in->nr; i++) {
+		ext = xfs_repair_array_item(in, i);
+		for (agbno = ext->agbno; agbno < ext->agbno + ext->len;
+		     agbno++) {
+			if (bsearch(&agbno, skip->items, skip->nr, skip->size,
+					xfs_repair_agbno_cmp))
+				continue;
+			error = xfs_repair_extent_add(out, agbno, 1);
+			if (error)
+				return error;
+		}
+	}
+	return 0;
+}
+
+/* Record the location of every block of a btree. */
+STATIC int
+xfs_repair_collect_btree_block(
+	struct xfs_btree_cur	*cur,
+	int			level,
+	void			*priv)
+{
+	struct xfs_repair_array	*ra = priv;
+	struct xfs_buf		*bp;
+	xfs_agblock_t		agbno;
+
+	xfs_btree_get_block(cur, level, &bp);
+	if (!bp)
+		return 0;
+	agbno = xfs_daddr_to_agbno(cur->bc_mp, XFS_BUF_ADDR(bp));
+	return xfs_repair_array_add(ra, &agbno);
+}
+
+/* Walk every rmap in the AG. */
+STATIC int
+xfs_repair_walk_rmaps(
+	struct xfs_trans	*tp,
+	struct xfs_buf		*agf_bp,
+	xfs_agnumber_t		agno,
+	xfs_rmap_query_range_fn	fn,
+	void			*priv)
+{
+	struct xfs_btree_cur	*cur;
+	struct xfs_rmap_irec	low;
+	struct xfs_rmap_irec	high;
+	int			error;
+
+	memset(&low, 0, sizeof(low));
+	memset(&high, 0xFF, sizeof(high));
+	cur = xfs_rmapbt_init_cursor(tp->t_mountp, tp, agf_bp, agno);
+	error = xfs_rmap_query_range(cur, &low, &high, fn, priv);
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	return error;
+}
+
+/*
+ * Commit the work so far and start a new transaction, keeping the AG
+ * header locked.  Sleep every now and then if the admin asked us to.
+ */
+STATIC int
+xfs_repair_roll(
+	struct xfs_trans	**tpp,
+	struct xfs_buf		*agbp,
+	unsigned int		*nr)
+{
+	int			error;
+
+	xfs_trans_bhold(*tpp, agbp);
+	error = xfs_trans_roll(tpp, NULL);
+	xfs_trans_bjoin(*tpp, agbp);
+	if (error)
+		return error;
+
+	if (xfs_repair_delay_ms && !(++(*nr) % XFS_REPAIR_BATCH))
+		msleep(xfs_repair_delay_ms);
+	return 0;
+}
+
+/* Write an empty btree root into a block the old btree owned. */
+STATIC int
+xfs_repair_init_btree_root(
+	struct xfs_trans		*tp,
+	xfs_agnumber_t			agno,
+	xfs_agblock_t			agbno,
+	__uint32_t			magic,
+	const struct xfs_buf_ops	*ops)
+{
+	struct xfs_mount		*mp = tp->t_mountp;
+	struct xfs_buf			*bp;
+
+	bp = xfs_btree_get_bufs(mp, tp, agno, agbno, 0);
+	if (!bp)
+		return -ENOMEM;
+	bp->b_ops = ops;
+	/* rmapbt implies v5, so the btree blocks always carry a crc */
+	xfs_btree_init_block(mp, bp, magic, 0, 0, agno, XFS_BTREE_CRC_BLOCKS);
+	xfs_trans_buf_set_type(tp, bp, XFS_BLFT_BTREE_BUF);
+	xfs_trans_log_buf(tp, bp, 0, BBTOB(bp->b_length) - 1);
+	return 0;
+}
+
+/*
+ * Throw away the blocks of an old btree.  The buffers are invalidated so
+ * that stale btree blocks never get written over whatever reuses them.
+ */
+STATIC int
+xfs_repair_reap_extents(
+	struct xfs_trans		**tpp,
+	struct xfs_buf			*agbp,
+	xfs_agnumber_t			agno,
+	struct xfs_repair_array		*old,
+	unsigned long			first,
+	struct xfs_owner_info		*oinfo,
+	enum xfs_ag_resv_type		type,
+	unsigned int			*nr)
+{
+	struct xfs_mount		*mp = (*tpp)->t_mountp;
+	struct xfs_repair_extent	*ext;
+	struct xfs_buf			*bp;
+	xfs_agblock_t			agbno;
+	xfs_extlen_t			len;
+	xfs_extlen_t			i;
+	unsigned long			n;
+	int				error;
+
+	for (n = first; n < old->nr; n++) {
+		ext = xfs_repair_array_item(old, n);
+		agbno = ext->agbno;
+		while (agbno < ext->agbno + ext->len) {
+			len = min_t(xfs_extlen_t, XFS_REPAIR_REAP_MAX,
+					ext->agbno + ext->len - agbno);
+			for (i = 0; i < len; i++) {
+				bp = xfs_btree_get_bufs(mp, *tpp, agno,
+						agbno + i, 0);
+				if (!bp)
+					return -ENOMEM;
+				xfs_trans_binval(*tpp, bp);
+			}
+			error = xfs_free_extent(*tpp,
+					XFS_AGB_TO_FSB(mp, agno, agbno), len,
+					oinfo, type);
+			if (error)
+				return error;
+			error = xfs_repair_roll(tpp, agbp, nr);
+			if (error)
+				return error;
+			agbno += len;
+		}
+	}
+	return 0;
+}
+
+/* Free space btrees */
+
+struct xfs_repair_alloc {
+	struct xfs_repair_array	freesp;		/* gaps between rmaps */
+	struct xfs_repair_array	agblocks;	/* OWN_AG extents */
+	xfs_agblock_t		next;		/* end of the last rmap */
+};
+
+STATIC int
+xfs_repair_alloc_rmap(
+	struct xfs_btree_cur	*cur,
+	struct xfs_rmap_irec	*rec,
+	void			*priv)
+{
+	struct xfs_repair_alloc	*ra = priv;
+	xfs_agblock_t		agbno = rec->rm_startblock;
+	xfs_agblock_t		end = agbno + rec->rm_blockcount;
+	int			error;
+
+	if (rec->rm_owner == XFS_RMAP_OWN_AG) {
+		error = xfs_repair_extent_add(&ra->agblocks, agbno,
+				rec->rm_blockcount);
+		if (error)
+			return error;
+	}
+
+	/* shared blocks show up more than once, only count the gaps */
+	if (agbno > ra->next) {
+		error = xfs_repair_extent_add(&ra->freesp, ra->next,
+				agbno - ra->next);
+		if (error)
+			return error;
+	}
+	ra->next = max(ra->next, end);
+	return 0;
+}
+
+/*
+ * Rebuild both free space btrees.  Free space is whatever the rmapbt
+ * doesn't know about.  OWN_AG covers the bnobt, cntbt and rmapbt blocks
+ * as well as the AGFL, so the old bnobt/cntbt blocks are the OWN_AG
+ * blocks that are in neither of the other two.
+ */
+STATIC int
+xfs_repair_allocbt(
+	struct xfs_mount		*mp,
+	xfs_agnumber_t			agno)
+{
+	struct xfs_repair_alloc		ra = {
+		.freesp = XFS_REPAIR_ARRAY_INIT(struct xfs_repair_extent),
+		.agblocks = XFS_REPAIR_ARRAY_INIT(struct xfs_repair_extent),
+	};
+	struct xfs_repair_array		skip =
+			XFS_REPAIR_ARRAY_INIT(xfs_agblock_t);
+	struct xfs_repair_array		old =
+			XFS_REPAIR_ARRAY_INIT(struct xfs_repair_extent);
+	struct xfs_owner_info		oinfo;
+	struct xfs_trans		*tp;
+	struct xfs_buf			*agf_bp;
+	struct xfs_buf			*agfl_bp;
+	struct xfs_btree_cur		*cur;
+	struct xfs_perag		*pag;
+	struct xfs_agf			*agf;
+	struct xfs_repair_extent	*ext;
+	__be32				*agfl_bno;
+	xfs_agblock_t			agbno;
+	xfs_agblock_t			bno_root;
+	xfs_agblock_t			cnt_root;
+	xfs_extlen_t			rmap_blocks;
+	int64_t				old_free;
+	int64_t				new_free;
+	unsigned long			first = 0;
+	unsigned long			i;
+	unsigned int			nr = 0;
+	unsigned int			flidx;
+	int				error;
+
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_itruncate, 0, 0, 0, &tp);
+	if (error)
+		return error;
+	error = xfs_alloc_read_agf(mp, tp, agno, 0, &agf_bp);
+	if (error)
+		goto out_cancel;
+	agf = XFS_BUF_TO_AGF(agf_bp);
+	old_free = be32_to_cpu(agf->agf_freeblks) +
+		   be32_to_cpu(agf->agf_flcount) +
+		   be32_to_cpu(agf->agf_btreeblks);
+
+	error = xfs_repair_walk_rmaps(tp, agf_bp, agno,
+			xfs_repair_alloc_rmap, &ra);
+	if (error)
+		goto out_cancel;
+	if (ra.next < be32_to_cpu(agf->agf_length)) {
+		error = xfs_repair_extent_add(&ra.freesp, ra.next,
+				be32_to_cpu(agf->agf_length) - ra.next);
+		if (error)
+			goto out_cancel;
+	}
+
+	/* rmapbt blocks stay where they are */
+	cur = xfs_rmapbt_init_cursor(mp, tp, agf_bp, agno);
+	error = xfs_btree_visit_blocks(cur, xfs_repair_collect_btree_block,
+			&skip);
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	if (error)
+		goto out_cancel;
+	rmap_blocks = skip.nr;
+
+	/* so do the blocks on the AGFL */
+	error = xfs_alloc_read_agfl(mp, tp, agno, &agfl_bp);
+	if (error)
+		goto out_cancel;
+	agfl_bno = XFS_BUF_TO_AGFL_BNO(mp, agfl_bp);
+	flidx = be32_to_cpu(agf->agf_flfirst);
+	for (i = 0; i < be32_to_cpu(agf->agf_flcount); i++) {
+		agbno = be32_to_cpu(agfl_bno[flidx]);
+		error = xfs_repair_array_add(&skip, &agbno);
+		if (error)
+			break;
+		if (++flidx == XFS_AGFL_SIZE(mp))
+			flidx = 0;
+	}
+	xfs_trans_brelse(tp, agfl_bp);
+	if (error)
+		goto out_cancel;
+
+	sort(skip.items, skip.nr, skip.size, xfs_repair_agbno_cmp, NULL);
+	error = xfs_repair_extent_subtract(&ra.agblocks, &skip, &old);
+	if (error)
+		goto out_cancel;
+
+	/* recycle two of the old blocks as the new roots */
+	bno_root = xfs_repair_extent_take(&old, &first);
+	cnt_root = xfs_repair_extent_take(&old, &first);
+	if (bno_root == NULLAGBLOCK || cnt_root == NULLAGBLOCK) {
+		error = -EFSCORRUPTED;
+		goto out_cancel;
+	}
+	error = xfs_repair_init_btree_root(tp, agno, bno_root,
+			XFS_ABTB_CRC_MAGIC, &xfs_allocbt_buf_ops);
+	if (error)
+		goto out_cancel;
+	error = xfs_repair_init_btree_root(tp, agno, cnt_root,
+			XFS_ABTC_CRC_MAGIC, &xfs_allocbt_buf_ops);
+	if (error)
+		goto out_cancel;
+
+	agf->agf_roots[XFS_BTNUM_BNOi] = cpu_to_be32(bno_root);
+	agf->agf_levels[XFS_BTNUM_BNOi] = cpu_to_be32(1);
+	agf->agf_roots[XFS_BTNUM_CNTi] = cpu_to_be32(cnt_root);
+	agf->agf_levels[XFS_BTNUM_CNTi] = cpu_to_be32(1);
+	agf->agf_freeblks = 0;
+	agf->agf_longest = 0;
+	agf->agf_btreeblks = cpu_to_be32(rmap_blocks - 1);
+	xfs_alloc_log_agf(tp, agf_bp, XFS_AGF_ROOTS | XFS_AGF_LEVELS |
+			XFS_AGF_FREEBLKS | XFS_AGF_LONGEST | XFS_AGF_BTREEBLKS);
+
+	pag = xfs_perag_get(mp, agno);
+	pag->pagf_levels[XFS_BTNUM_BNOi] = 1;
+	pag->pagf_levels[XFS_BTNUM_CNTi] = 1;
+	pag->pagf_freeblks = 0;
+	pag->pagf_longest = 0;
+	pag->pagf_btreeblks = rmap_blocks - 1;
+	xfs_perag_put(pag);
+
+	error = xfs_repair_roll(&tp, agf_bp, &nr);
+	if (error)
+		goto out_cancel;
+
+	/*
+	 * Put the free space back.  These blocks are already accounted as
+	 * free in the superblock, so leave the counters alone; nor do they
+	 * have an rmap to remove.
+	 */
+	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_UNKNOWN);
+	for (i = 0; i < ra.freesp.nr; i++) {
+		ext = xfs_repair_array_item(&ra.freesp, i);
+		error = xfs_free_extent(tp, XFS_AGB_TO_FSB(mp, agno, ext->agbno),
+				ext->len, &oinfo, XFS_AG_RESV_IGNORE);
+		if (error)
+			goto out_cancel;
+		error = xfs_repair_roll(&tp, agf_bp, &nr);
+		if (error)
+			goto out_cancel;
+	}
+
+	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_AG);
+	error = xfs_repair_reap_extents(&tp, agf_bp, agno, &old, first,
+			&oinfo, XFS_AG_RESV_IGNORE, &nr);
+	if (error)
+		goto out_cancel;
+
+	new_free = be32_to_cpu(agf->agf_freeblks) +
+		   be32_to_cpu(agf->agf_flcount) +
+		   be32_to_cpu(agf->agf_btreeblks);
+	error = xfs_trans_commit(tp);
+	if (error)
+		goto out;
+
+	/*
+	 * Settle the superblock counter against what the old AGF claimed,
+	 * which is what the counter was built from.
+	 */
+	if (new_free != old_free)
+		xfs_mod_fdblocks(mp, new_free - old_free, true);
+	goto out;
+
+out_cancel:
+	xfs_trans_cancel(tp);
+out:
+	xfs_repair_array_free(&ra.freesp);
+	xfs_repair_array_free(&ra.agblocks);
+	xfs_repair_array_free(&skip);
+	xfs_repair_array_free(&old);
+	return error;
+}
+
+/* Inode btrees */
+
+struct xfs_repair_inobt {
+	struct xfs_repair_array	chunks;		/* OWN_INODES extents */
+	struct xfs_repair_array	oldbt;		/* OWN_INOBT extents */
+};
+
+STATIC int
+xfs_repair_inobt_rmap(
+	struct xfs_btree_cur	*cur,
+	struct xfs_rmap_irec	*rec,
+	void			*priv)
+{
+	struct xfs_repair_inobt	*ri = priv;
+
+	switch (rec->rm_owner) {
+	case XFS_RMAP_OWN_INODES:
+		return xfs_repair_extent_add(&ri->chunks, rec->rm_startblock,
+				rec->rm_blockcount);
+	case XFS_RMAP_OWN_INOBT:
+		return xfs_repair_extent_add(&ri->oldbt, rec->rm_startblock,
+				rec->rm_blockcount);
+	}
+	return 0;
+}
+
+/*
+ * Is this inode in use?  An inode in the cache is authoritative because
+ * its changes may not have reached the cluster buffer yet; otherwise the
+ * on-disk mode decides.  The caller holds the AGI, so no inode in this AG
+ * can be allocated or freed underneath us.
+ */
+STATIC bool
+xfs_repair_inode_in_use(
+	struct xfs_perag	*pag,
+	xfs_ino_t		ino,
+	xfs_agino_t		agino,
+	struct xfs_dinode	*dip)
+{
+	struct xfs_inode	*ip;
+	bool			cached = false;
+	bool			used = false;
+
+	rcu_read_lock();
+	ip = radix_tree_lookup(&pag->pag_ici_root, agino);
+	if (ip) {
+		spin_lock(&ip->i_flags_lock);
+		if (ip->i_ino == ino && !(ip->i_flags & XFS_IRECLAIM)) {
+			cached = true;
+			used = VFS_I(ip)->i_mode != 0;
+		}
+		spin_unlock(&ip->i_flags_lock);
+	}
+	rcu_read_unlock();
+
+	if (cached)
+		return used;
+	return dip->di_mode != 0;
+}
+
+/* Fill in the inobt records for one extent of inode chunks. */
+STATIC int
+xfs_repair_inobt_scan_chunk(
+	struct xfs_mount		*mp,
+	struct xfs_perag		*pag,
+	xfs_agnumber_t			agno,
+	struct xfs_repair_extent	*ext,
+	struct xfs_repair_array		*recs)
+{
+	struct xfs_inobt_rec_incore	irec;
+	struct xfs_inobt_rec_incore	*last;
+	struct xfs_buf			*bp;
+	struct xfs_dinode		*dip;
+	xfs_agblock_t			agbno;
+	xfs_agblock_t			cluster_blocks;
+	xfs_agino_t			agino;
+	xfs_agino_t			startino;
+	int				nr_inodes;
+	int				idx;
+	int				i;
+	int				error;
+
+	cluster_blocks = xfs_icluster_size_fsb(mp);
+	nr_inodes = cluster_blocks << mp->m_sb.sb_inopblog;
+	for (agbno = ext->agbno; agbno < ext->agbno + ext->len;
+	     agbno += cluster_blocks) {
+		error = xfs_trans_read_buf(mp, NULL, mp->m_ddev_targp,
+				XFS_AGB_TO_DADDR(mp, agno, agbno),
+				XFS_FSB_TO_BB(mp, cluster_blocks), 0, &bp,
+				&xfs_inode_buf_ops);
+		if (error)
+			return error;
+
+		for (i = 0; i < nr_inodes; i++) {
+			agino = XFS_OFFBNO_TO_AGINO(mp, agbno, 0) + i;
+			startino = rounddown(agino, XFS_INODES_PER_CHUNK);
+			idx = agino - startino;
+
+			last = NULL;
+			if (recs->nr)
+				last = xfs_repair_array_item(recs,
+						recs->nr - 1);
+			if (!last || last->ir_startino != startino) {
+				/* holes are marked free, sparse or not */
+				irec.ir_startino = startino;
+				irec.ir_holemask = (__uint16_t)~0U;
+				irec.ir_count = 0;
+				irec.ir_freecount = 0;
+				irec.ir_free = XFS_INOBT_ALL_FREE;
+				error = xfs_repair_array_add(recs, &irec);
+				if (error)
+					break;
+				last = xfs_repair_array_item(recs,
+						recs->nr - 1);
+			}
+
+			last->ir_holemask &=
+				~(1U << (idx / XFS_INODES_PER_HOLEMASK_BIT));
+			last->ir_count++;
+			dip = xfs_buf_offset(bp, i << mp->m_sb.sb_inodelog);
+			if (xfs_repair_inode_in_use(pag,
+					XFS_AGINO_TO_INO(mp, agno, agino),
+					agino, dip))
+				last->ir_free &= ~XFS_INOBT_MASK(idx);
+			else
+				last->ir_freecount++;
+		}
+		xfs_buf_relse(bp);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+/*
+ * Rebuild the inode btree and, if there is one, the free inode btree
+ * from the inode chunks in the rmapbt.  Whether an inode is free comes
+ * from the inode itself.
+ */
+STATIC int
+xfs_repair_inobt(
+	struct xfs_mount		*mp,
+	xfs_agnumber_t			agno)
+{
+	struct xfs_repair_inobt		ri = {
+		.chunks = XFS_REPAIR_ARRAY_INIT(struct xfs_repair_extent),
+		.oldbt = XFS_REPAIR_ARRAY_INIT(struct xfs_repair_extent),
+	};
+	struct xfs_repair_array		recs =
+			XFS_REPAIR_ARRAY_INIT(struct xfs_inobt_rec_incore);
+	struct xfs_inobt_rec_incore	*irec;
+	struct xfs_owner_info		oinfo;
+	struct xfs_trans		*tp;
+	struct xfs_buf			*agi_bp;
+	struct xfs_buf			*agf_bp;
+	struct xfs_btree_cur		*cur;
+	struct xfs_perag		*pag;
+	struct xfs_agi			*agi;
+	bool				finobt;
+	xfs_agblock_t			ino_root;
+	xfs_agblock_t			fino_root = NULLAGBLOCK;
+	xfs_agino_t			count = 0;
+	xfs_agino_t			freecount = 0;
+	xfs_extlen_t			resblks;
+	unsigned long			first = 0;
+	unsigned long			i;
+	unsigned int			nr = 0;
+	int				stat;
+	int				error;
+
+	/* the inobt doesn't say where unaligned chunks start */
+	if (!xfs_sb_version_hasalign(&mp->m_sb))
+		return -EOPNOTSUPP;
+	finobt = xfs_sb_version_hasfinobt(&mp->m_sb);
+
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_itruncate, 0, 0, 0, &tp);
+	if (error)
+		return error;
+	error = xfs_ialloc_read_agi(mp, tp, agno, &agi_bp);
+	if (error)
+		goto out_cancel;
+	agi = XFS_BUF_TO_AGI(agi_bp);
+
+	/* chunks can't come or go while we hold the AGI */
+	error = xfs_alloc_read_agf(mp, tp, agno, 0, &agf_bp);
+	if (error)
+		goto out_cancel;
+	error = xfs_repair_walk_rmaps(tp, agf_bp, agno,
+			xfs_repair_inobt_rmap, &ri);
+	xfs_trans_brelse(tp, agf_bp);
+	if (error)
+		goto out_cancel;
+
+	pag = xfs_perag_get(mp, agno);
+	for (i = 0; i < ri.chunks.nr; i++) {
+		error = xfs_repair_inobt_scan_chunk(mp, pag, agno,
+				xfs_repair_array_item(&ri.chunks, i), &recs);
+		if (error)
+			break;
+	}
+	xfs_perag_put(pag);
+	if (error)
+		goto out_cancel;
+
+	/*
+	 * Records go in in ascending order, so every leaf ends up at least
+	 * half full.  Reserve that much for each tree, plus a split per level.
+	 */
+	resblks = xfs_btree_calc_size(mp, mp->m_inobt_mnr, recs.nr) +
+		  mp->m_in_maxlevels;
+	if (finobt)
+		resblks *= 2;
+	error = xfs_trans_reserve_more(tp, resblks);
+	if (error)
+		goto out_cancel;
+
+	ino_root = xfs_repair_extent_take(&ri.oldbt, &first);
+	if (finobt)
+		fino_root = xfs_repair_extent_take(&ri.oldbt, &first);
+	if (ino_root == NULLAGBLOCK || (finobt && fino_root == NULLAGBLOCK)) {
+		error = -EFSCORRUPTED;
+		goto out_cancel;
+	}
+	error = xfs_repair_init_btree_root(tp, agno, ino_root,
+			XFS_IBT_CRC_MAGIC, &xfs_inobt_buf_ops);
+	if (error)
+		goto out_cancel;
+	agi->agi_root = cpu_to_be32(ino_root);
+	agi->agi_level = cpu_to_be32(1);
+	if (finobt) {
+		error = xfs_repair_init_btree_root(tp, agno, fino_root,
+				XFS_FIBT_CRC_MAGIC, &xfs_inobt_buf_ops);
+		if (error)
+			goto out_cancel;
+		agi->agi_free_root = cpu_to_be32(fino_root);
+		agi->agi_free_level = cpu_to_be32(1);
+	}
+	xfs_ialloc_log_agi(tp, agi_bp, XFS_AGI_ROOT | XFS_AGI_LEVEL |
+			(finobt ? XFS_AGI_FREE_ROOT | XFS_AGI_FREE_LEVEL : 0));
+	error = xfs_repair_roll(&tp, agi_bp, &nr);
+	if (error)
+		goto out_cancel;
+
+	for (i = 0; i < recs.nr; i++) {
+		irec = xfs_repair_array_item(&recs, i);
+		count += irec->ir_count;
+		freecount += irec->ir_freecount;
+
+		cur = xfs_inobt_init_cursor(mp, tp, agi_bp, agno,
+				XFS_BTNUM_INO);
+		error = xfs_inobt_lookup(cur, irec->ir_startino,
+				XFS_LOOKUP_EQ, &stat);
+		if (!error)
+			error = xfs_inobt_insert_rec(cur, irec->ir_holemask,
+					irec->ir_count, irec->ir_freecount,
+					irec->ir_free, &stat);
+		xfs_btree_del_cursor(cur,
+				error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+		if (error)
+			goto out_cancel;
+
+		if (finobt && irec->ir_freecount) {
+			cur = xfs_inobt_init_cursor(mp, tp, agi_bp, agno,
+					XFS_BTNUM_FINO);
+			error = xfs_inobt_lookup(cur, irec->ir_startino,
+					XFS_LOOKUP_EQ, &stat);
+			if (!error)
+				error = xfs_inobt_insert_rec(cur,
+						irec->ir_holemask,
+						irec->ir_count,
+						irec->ir_freecount,
+						irec->ir_free, &stat);
+			xfs_btree_del_cursor(cur,
+				error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+			if (error)
+				goto out_cancel;
+		}
+
+		error = xfs_repair_roll(&tp, agi_bp, &nr);
+		if (error)
+			goto out_cancel;
+	}
+
+	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_INOBT);
+	error = xfs_repair_reap_extents(&tp, agi_bp, agno, &ri.oldbt, first,
+			&oinfo, XFS_AG_RESV_NONE, &nr);
+	if (error)
+		goto out_cancel;
+
+	/* fix the inode counters */
+	xfs_trans_mod_sb(tp, XFS_TRANS_SB_ICOUNT,
+			(int64_t)count - be32_to_cpu(agi->agi_count));
+	xfs_trans_mod_sb(tp, XFS_TRANS_SB_IFREE,
+			(int64_t)freecount - be32_to_cpu(agi->agi_freecount));
+	agi->agi_count = cpu_to_be32(count);
+	agi->agi_freecount = cpu_to_be32(freecount);
+	xfs_ialloc_log_agi(tp, agi_bp, XFS_AGI_COUNT | XFS_AGI_FREECOUNT);
+	pag = xfs_perag_get(mp, agno);
+	pag->pagi_count = count;
+	pag->pagi_freecount = freecount;
+	xfs_perag_put(pag);
+
+	error = xfs_trans_commit(tp);
+	goto out;
+
+out_cancel:
+	xfs_trans_cancel(tp);
+out:
+	xfs_repair_array_free(&ri.chunks);
+	xfs_repair_array_free(&ri.oldbt);
+	xfs_repair_array_free(&recs);
+	return error;
+}
+
+/* Reference count btree */
+
+/* A change of reference count at a block */
+struct xfs_repair_refc_event {
+	xfs_agblock_t		agbno;
+	int			delta;
+};
+
+struct xfs_repair_refc {
+	struct xfs_repair_array	events;		/* data fork mappings */
+	struct xfs_repair_array	recs;		/* new refcount records */
+	struct xfs_repair_array	oldbt;		/* OWN_REFC extents */
+};
+
+STATIC int
+xfs_repair_refc_rmap(
+	struct xfs_btree_cur		*cur,
+	struct xfs_rmap_irec		*rec,
+	void				*priv)
+{
+	struct xfs_repair_refc		*rr = priv;
+	struct xfs_repair_refc_event	ev;
+	struct xfs_refcount_irec	irec;
+	int				error;
+
+	if (rec->rm_owner == XFS_RMAP_OWN_REFC)
+		return xfs_repair_extent_add(&rr->oldbt, rec->rm_startblock,
+				rec->rm_blockcount);
+
+	/* CoW staging extents have a refcount of one */
+	if (rec->rm_owner == XFS_RMAP_OWN_COW) {
+		irec.rc_startblock = rec->rm_startblock;
+		irec.rc_blockcount = rec->rm_blockcount;
+		irec.rc_refcount = 1;
+		return xfs_repair_array_add(&rr->recs, &irec);
+	}
+
+	/* only file data can be shared */
+	if (XFS_RMAP_NON_INODE_OWNER(rec->rm_owner) ||
+	    (rec->rm_flags & (XFS_RMAP_ATTR_FORK | XFS_RMAP_BMBT_BLOCK)))
+		return 0;
+
+	ev.agbno = rec->rm_startblock;
+	ev.delta = 1;
+	error = xfs_repair_array_add(&rr->events, &ev);
+	if (error)
+		return error;
+	ev.agbno = rec->rm_startblock + rec->rm_blockcount;
+	ev.delta = -1;
+	return xfs_repair_array_add(&rr->events, &ev);
+}
+
+static int
+xfs_repair_refc_event_cmp(
+	const void			*a,
+	const void			*b)
+{
+	const struct xfs_repair_refc_event	*x = a;
+	const struct xfs_repair_refc_event	*y = b;
+
+	if (x->agbno > y->agbno)
+		return 1;
+	if (x->agbno < y->agbno)
+		return -1;
+	return 0;
+}
+
+static int
+xfs_repair_refc_rec_cmp(
+	const void			*a,
+	const void			*b)
+{
+	const struct xfs_refcount_irec	*x = a;
+	const struct xfs_refcount_irec	*y = b;
+
+	if (x->rc_startblock > y->rc_startblock)
+		return 1;
+	if (x->rc_startblock < y->rc_startblock)
+		return -1;
+	return 0;
+}
+
+/*
+ * Sweep across the sorted mapping boundaries and emit a record for every
+ * stretch of blocks mapped by more than one file.
+ */
+STATIC int
+xfs_repair_refc_sweep(
+	struct xfs_repair_refc		*rr)
+{
+	struct xfs_repair_refc_event	*ev;
+	struct xfs_refcount_irec	irec;
+	struct xfs_refcount_irec	*last;
+	xfs_agblock_t			prev = 0;
+	xfs_nlink_t			refcount = 0;
+	unsigned long			i;
+	int				error;
+
+	sort(rr->events.items, rr->events.nr, rr->events.size,
+			xfs_repair_refc_event_cmp, NULL);
+
+	for (i = 0; i < rr->events.nr; i++) {
+		ev = xfs_repair_array_item(&rr->events, i);
+		if (refcount > 1 && ev->agbno > prev) {
+			last = NULL;
+			if (rr->recs.nr)
+				last = xfs_repair_array_item(&rr->recs,
+						rr->recs.nr - 1);
+			if (last && last->rc_refcount == refcount &&
+			    last->rc_startblock + last->rc_blockcount == prev) {
+				last->rc_blockcount += ev->agbno - prev;
+			} else {
+				irec.rc_startblock = prev;
+				irec.rc_blockcount = ev->agbno - prev;
+				irec.rc_refcount = refcount;
+				error = xfs_repair_array_add(&rr->recs, &irec);
+				if (error)
+					return error;
+			}
+		}
+		refcount += ev->delta;
+		prev = ev->agbno;
+	}
+
+	/* slot the CoW staging records in between */
+	sort(rr->recs.items, rr->recs.nr, rr->recs.size,
+			xfs_repair_refc_rec_cmp, NULL);
+	return 0;
+}
+
+/*
+ * Rebuild the refcount btree by counting how many data fork mappings
+ * cover each block.  CoW staging extents are recorded with a refcount of
+ * one, just as the CoW code does.
+ */
+STATIC int
+xfs_repair_refcountbt(
+	struct xfs_mount		*mp,
+	xfs_agnumber_t			agno)
+{
+	struct xfs_repair_refc		rr = {
+		.events = XFS_REPAIR_ARRAY_INIT(struct xfs_repair_refc_event),
+		.recs = XFS_REPAIR_ARRAY_INIT(struct xfs_refcount_irec),
+		.oldbt = XFS_REPAIR_ARRAY_INIT(struct xfs_repair_extent),
+	};
+	struct xfs_refcount_irec	*irec;
+	struct xfs_owner_info		oinfo;
+	struct xfs_trans		*tp;
+	struct xfs_buf			*agf_bp;
+	struct xfs_btree_cur		*cur;
+	struct xfs_perag		*pag;
+	struct xfs_agf			*agf;
+	xfs_agblock_t			root;
+	xfs_extlen_t			resblks;
+	unsigned long			first = 0;
+	unsigned long			i;
+	unsigned int			nr = 0;
+	int				stat;
+	int				error;
+
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_itruncate, 0, 0, 0, &tp);
+	if (error)
+		return error;
+	error = xfs_alloc_read_agf(mp, tp, agno, 0, &agf_bp);
+	if (error)
+		goto out_cancel;
+	agf = XFS_BUF_TO_AGF(agf_bp);
+
+	error = xfs_repair_walk_rmaps(tp, agf_bp, agno,
+			xfs_repair_refc_rmap, &rr);
+	if (error)
+		goto out_cancel;
+	error = xfs_repair_refc_sweep(&rr);
+	if (error)
+		goto out_cancel;
+
+	/* new blocks come from the AG reservation; this covers overflow */
+	resblks = xfs_btree_calc_size(mp, mp->m_refc_mnr, rr.recs.nr) +
+		  mp->m_refc_maxlevels;
+	error = xfs_trans_reserve_more(tp, resblks);
+	if (error)
+		goto out_cancel;
+
+	root = xfs_repair_extent_take(&rr.oldbt, &first);
+	if (root == NULLAGBLOCK) {
+		error = -EFSCORRUPTED;
+		goto out_cancel;
+	}
+	error = xfs_repair_init_btree_root(tp, agno, root,
+			XFS_REFC_CRC_MAGIC, &xfs_refcountbt_buf_ops);
+	if (error)
+		goto out_cancel;
+	agf->agf_refcount_root = cpu_to_be32(root);
+	agf->agf_refcount_level = cpu_to_be32(1);
+	xfs_alloc_log_agf(tp, agf_bp,
+			XFS_AGF_REFCOUNT_ROOT | XFS_AGF_REFCOUNT_LEVEL);
+	pag = xfs_perag_get(mp, agno);
+	pag->pagf_refcount_level = 1;
+	xfs_perag_put(pag);
+	error = xfs_repair_roll(&tp, agf_bp, &nr);
+	if (error)
+		goto out_cancel;
+
+	for (i = 0; i < rr.recs.nr; i++) {
+		irec = xfs_repair_array_item(&rr.recs, i);
+		cur = xfs_refcountbt_init_cursor(mp, tp, agf_bp, agno, NULL);
+		error = xfs_refcount_lookup_le(cur, irec->rc_startblock,
+				&stat);
+		if (!error)
+			error = xfs_refcount_insert(cur, irec, &stat);
+		xfs_btree_del_cursor(cur,
+				error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+		if (error)
+			goto out_cancel;
+		error = xfs_repair_roll(&tp, agf_bp, &nr);
+		if (error)
+			goto out_cancel;
+	}
+
+	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_REFC);
+	error = xfs_repair_reap_extents(&tp, agf_bp, agno, &rr.oldbt, first,
+			&oinfo, XFS_AG_RESV_METADATA, &nr);
+	if (error)
+		goto out_cancel;
+
+	error = xfs_trans_commit(tp);
+	goto out;
+
+out_cancel:
+	xfs_trans_cancel(tp);
+out:
+	xfs_repair_array_free(&rr.events);
+	xfs_repair_array_free(&rr.recs);
+	xfs_repair_array_free(&rr.oldbt);
+	return error;
+}
+
+/* Scrub and repair dispatch */
+
+struct xfs_scrub_meta_fns {
+	bool	(*has_feature)(struct xfs_sb *);
+	int	(*scrub)(struct xfs_mount *mp, xfs_agnumber_t agno);
+	int	(*repair)(struct xfs_mount *mp, xfs_agnumber_t agno);
+};
+
+static const struct xfs_scrub_meta_fns meta_scrub_fns[] = {
+	[XFS_SCRUB_TYPE_BNOBT] = {
+		.has_feature	= xfs_sb_version_hasrmapbt,
+		.scrub		= xfs_bnobt_scrub,
+		.repair		= xfs_repair_allocbt,
+	},
+	[XFS_SCRUB_TYPE_CNTBT] = {
+		.has_feature	= xfs_sb_version_hasrmapbt,
+		.scrub		= xfs_cntbt_scrub,
+		.repair		= xfs_repair_allocbt,
+	},
+	[XFS_SCRUB_TYPE_INOBT] = {
+		.has_feature	= xfs_sb_version_hasrmapbt,
+		.scrub		= xfs_inobt_scrub,
+		.repair		= xfs_repair_inobt,
+	},
+	[XFS_SCRUB_TYPE_FINOBT] = {
+		.has_feature	= xfs_sb_version_hasfinobt,
+		.scrub		= xfs_finobt_scrub,
+		.repair		= xfs_repair_inobt,
+	},
+	/* the rmapbt is what everything else is rebuilt from */
+	[XFS_SCRUB_TYPE_RMAPBT] = {
+		.has_feature	= xfs_sb_version_hasrmapbt,
+		.scrub		= xfs_rmapbt_scrub,
+	},
+	[XFS_SCRUB_TYPE_REFCNTBT] = {
+		.has_feature	= xfs_sb_version_hasreflink,
+		.scrub		= xfs_refcountbt_scrub,
+		.repair		= xfs_repair_refcountbt,
+	},
+};
+
+/*
+ * Check a per-AG btree and rebuild it if asked to.  Corruption isn't an
+ * error here, it is reported through sm_flags.
+ */
+int
+xfs_scrub_metadata(
+	struct xfs_mount		*mp,
+	struct xfs_scrub_metadata	*sm)
+{
+	const struct xfs_scrub_meta_fns	*fns;
+	int				i;
+	int				error;
+
+	if (sm->sm_type > XFS_SCRUB_TYPE_MAX ||
+	    (sm->sm_flags & ~XFS_SCRUB_FLAGS_IN))
+		return -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(sm->sm_reserved); i++)
+		if (sm->sm_reserved[i])
+			return -EINVAL;
+	if (sm->sm_agno >= mp->m_sb.sb_agcount)
+		return -EINVAL;
+
+	fns = &meta_scrub_fns[sm->sm_type];
+	if (fns->has_feature && !fns->has_feature(&mp->m_sb))
+		return -ENOENT;
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return -EIO;
+
+	error = fns->scrub(mp, sm->sm_agno);
+	if (error != -EFSCORRUPTED)
+		return error;
+	sm->sm_flags |= XFS_SCRUB_FLAG_CORRUPT;
+
+	if (!(sm->sm_flags & XFS_SCRUB_FLAG_REPAIR))
+		return 0;
+	if (!fns->repair || !xfs_sb_version_hasrmapbt(&mp->m_sb))
+		return -EOPNOTSUPP;
+	if (mp->m_flags & XFS_MOUNT_RDONLY)
+		return -EROFS;
+
+	xfs_warn(mp, "online repair of AG %u btree type %u",
+			sm->sm_agno, sm->sm_type);
+	error = fns->repair(mp, sm->sm_agno);
+	if (error)
+		return error;
+
+	error = fns->scrub(mp, sm->sm_agno);
+	if (error == -EFSCORRUPTED)
+		return 0;
+	if (error)
+		return error;
+	sm->sm_flags &= ~XFS_SCRUB_FLAG_CORRUPT;
+	sm->sm_flags |= XFS_SCRUB_FLAG_REPAIRED;
+	return 0;
+}
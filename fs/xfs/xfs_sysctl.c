@@ -193,6 +193,15 @@ static struct ctl_table xfs_table[] = {
 		.extra1		= &xfs_params.cowb_timer.min,
 		.extra2		= &xfs_params.cowb_timer.max,
 	},
+	{
+		.procname	= "online_repair_delay_ms",
+		.data		= &xfs_params.repair_delay.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.repair_delay.min,
+		.extra2		= &xfs_params.repair_delay.max,
+	},
 #ifdef DEBUG
 	{
 		.procname	= "always_cow",
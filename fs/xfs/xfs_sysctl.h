@@ -50,6 +50,7 @@ typedef struct xfs_param {
 	xfs_sysctl_val_t eofb_timer;	/* Interval between eofb scan wakeups */
 	xfs_sysctl_val_t cowb_timer;	/* Interval between cowb scan wakeups */
 	xfs_sysctl_val_t always_cow;	/* Always copy on write? */
+	xfs_sysctl_val_t repair_delay;	/* Pause between online repair steps */
 } xfs_param_t;
 
 /*
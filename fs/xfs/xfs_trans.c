@@ -262,6 +262,23 @@ xfs_trans_alloc(
 	return 0;
 }
 
+/*
+ * Add blocks to the reservation of a running transaction, for callers
+ * that only learn how much they need once they hold the AG headers.
+ */
+int
+xfs_trans_reserve_more(
+	struct xfs_trans	*tp,
+	uint			blocks)
+{
+	bool			rsvd = (tp->t_flags & XFS_TRANS_RESERVE) != 0;
+
+	if (xfs_mod_fdblocks(tp->t_mountp, -((int64_t)blocks), rsvd))
+		return -ENOSPC;
+	tp->t_blk_res += blocks;
+	return 0;
+}
+
 /*
  * Record the indicated change to the given field for application
  * to the file system's superblock when the transaction commits.
@@ -0,0 +1,16 @@
+/*
+ * Common values and helper functions for the ChaCha20 stream cipher
+ */
+
+#ifndef _CRYPTO_CHACHA20_H
+#define _CRYPTO_CHACHA20_H
+
+#include <linux/types.h>
+
+#define CHACHA20_IV_SIZE	16
+#define CHACHA20_KEY_SIZE	32
+#define CHACHA20_BLOCK_SIZE	64
+
+void chacha20_block(u32 *state, void *stream);
+
+#endif
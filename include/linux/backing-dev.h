@@ -59,6 +59,20 @@ struct bdi_writeback {
 	spinlock_t list_lock;		/* protects the b_* lists */
 };
 
+/*
+ * Writeback of a bdi can be spread over several workers pulling inodes
+ * off the same b_io list.  Worker 0 is the flusher itself.
+ */
+#define BDI_MAX_WB_WORKERS	16
+
+struct bdi_wb_worker_stats {
+	unsigned long runs;		/* passes over b_io */
+	unsigned long pages;		/* pages written */
+	u64 busy_ns;			/* time spent writing */
+};
+
+struct wb_helper;
+
 struct backing_dev_info {
 	struct list_head bdi_list;
 	unsigned long ra_pages;	/* max readahead in PAGE_CACHE_SIZE units */
@@ -97,6 +111,11 @@ struct backing_dev_info {
 
 	struct list_head work_list;
 
+	unsigned int wb_workers;	/* flusher plus helpers, at least 1 */
+	unsigned long wb_inode_chunk;	/* max pages per inode per pass, 0 = none */
+	struct wb_helper *wb_helpers;	/* allocated once wb_workers > 1 */
+	struct bdi_wb_worker_stats *wb_stats; /* per worker, [0] is the flusher */
+
 	struct device *dev;
 
 	struct timer_list laptop_mode_wb_timer;
@@ -123,6 +142,8 @@ void bdi_start_background_writeback(struct backing_dev_info *bdi);
 void bdi_writeback_workfn(struct work_struct *work);
 int bdi_has_dirty_io(struct backing_dev_info *bdi);
 void bdi_wakeup_thread_delayed(struct backing_dev_info *bdi);
+int bdi_set_wb_workers(struct backing_dev_info *bdi, unsigned int nr);
+void bdi_free_wb_workers(struct backing_dev_info *bdi);
 
 extern spinlock_t bdi_lock;
 extern struct list_head bdi_list;
@@ -5,6 +5,7 @@
 
 struct blk_mq_tags;
 struct blk_flush_queue;
+struct blk_lat_stat;
 
 struct blk_mq_cpu_notifier {
 	struct list_head list;
@@ -37,6 +38,7 @@ struct blk_mq_hw_ctx {
 	struct blk_flush_queue	*fq;
 
 	void			*driver_data;
+	void			*sched_data;	/* io scheduler private */
 
 	struct blk_mq_ctxmap	ctx_map;
 
@@ -57,6 +59,22 @@ struct blk_mq_hw_ctx {
 
 	atomic_t		nr_active;
 
+	/*
+	 * Polling state: running average of REQ_HIPRI completion times used
+	 * by the hybrid poll sleep, the issue time of the last REQ_HIPRI
+	 * request, and counters exported through sysfs.
+	 */
+	u64			poll_mean_nsec;
+	u64			poll_last_issue;
+	u64			poll_slept_issue;
+	unsigned long		poll_considered;
+	unsigned long		poll_invoked;
+	unsigned long		poll_success;
+	unsigned long		poll_sleeps;
+
+	/* percpu completion latency histograms, see block/blk-stat.c */
+	struct blk_lat_stat __percpu	*lat_stat;
+
 	struct blk_mq_cpu_notifier	cpu_notifier;
 	struct kobject		kobj;
 };
@@ -94,8 +112,13 @@ typedef int (init_request_fn)(void *, struct request *, unsigned int,
 typedef void (exit_request_fn)(void *, struct request *, unsigned int,
 		unsigned int);
 
+typedef int (poll_fn)(struct blk_mq_hw_ctx *);
+typedef bool (get_budget_fn)(struct blk_mq_hw_ctx *);
+typedef void (put_budget_fn)(struct blk_mq_hw_ctx *);
+
 typedef void (busy_iter_fn)(struct blk_mq_hw_ctx *, struct request *, void *,
 		bool);
+typedef void (busy_tag_iter_fn)(struct request *, void *, bool);
 
 struct blk_mq_ops {
 	/*
@@ -108,6 +131,17 @@ struct blk_mq_ops {
 	 */
 	map_queue_fn		*map_queue;
 
+	/*
+	 * Reserve room on the device before a request is handed to
+	 * ->queue_rq(), which then owns it: the driver gives it back when
+	 * the request completes, or right away if ->queue_rq() does not
+	 * return BLK_MQ_RQ_QUEUE_OK.  A driver that refuses a budget must
+	 * make sure the queue is run again once it frees up.  Requests
+	 * held by an io scheduler are only pulled once a budget is taken.
+	 */
+	get_budget_fn		*get_budget;
+	put_budget_fn		*put_budget;
+
 	/*
 	 * Called on request timeout
 	 */
@@ -115,6 +149,12 @@ struct blk_mq_ops {
 
 	softirq_done_fn		*complete;
 
+	/*
+	 * Called to poll for completion of requests on a hardware queue.
+	 * Returns the number of requests completed.
+	 */
+	poll_fn			*poll;
+
 	/*
 	 * Called when the block layer side of a hardware queue has been
 	 * set up, allowing the driver to allocate/init matching structures.
@@ -224,6 +264,8 @@ void blk_mq_run_hw_queues(struct request_queue *q, bool async);
 void blk_mq_delay_queue(struct blk_mq_hw_ctx *hctx, unsigned long msecs);
 void blk_mq_tag_busy_iter(struct blk_mq_hw_ctx *hctx, busy_iter_fn *fn,
 		void *priv);
+void blk_mq_tagset_busy_iter(struct blk_mq_tag_set *tagset,
+		busy_tag_iter_fn *fn, void *priv);
 void blk_mq_freeze_queue(struct request_queue *q);
 void blk_mq_unfreeze_queue(struct request_queue *q);
 void blk_mq_freeze_queue_start(struct request_queue *q);
@@ -12,6 +12,7 @@
 #include <linux/file.h>
 
 struct bpf_map;
+struct perf_event;
 
 /* map is generic key/value storage optionally accesible by eBPF programs */
 struct bpf_map_ops {
@@ -32,6 +33,7 @@ struct bpf_map {
 	u32 key_size;
 	u32 value_size;
 	u32 max_entries;
+	u32 map_flags;
 	const struct bpf_map_ops *ops;
 	struct work_struct work;
 };
@@ -42,6 +44,31 @@ struct bpf_map_type_list {
 	enum bpf_map_type type;
 };
 
+struct bpf_array {
+	struct bpf_map map;
+	u32 elem_size;
+	/* 'ownership' of prog_array is claimed by the first program that
+	 * is going to use this map or by the first program which FD is stored
+	 * in the map to make sure that all callers and callees have the same
+	 * prog_type and JITed flag
+	 */
+	enum bpf_prog_type owner_prog_type;
+	bool owner_jited;
+	union {
+		char value[0] __aligned(8);
+		void __percpu *pptrs[0] __aligned(8);	/* per-cpu arrays */
+		void *ptrs[0] __aligned(8);		/* perf event and prog arrays */
+	};
+};
+#define MAX_TAIL_CALL_CNT 32
+
+/* element of a perf event array, holds a reference on the event's file */
+struct bpf_event_entry {
+	struct perf_event *event;
+	struct file *perf_file;
+	struct rcu_head rcu;
+};
+
 /* function argument constraints */
 enum bpf_arg_type {
 	ARG_DONTCARE = 0,	/* unused argument in helper function */
@@ -63,6 +90,25 @@ enum bpf_arg_type {
 	ARG_ANYTHING,		/* any (initialized) argument is ok */
 };
 
+/* types of values stored in eBPF registers */
+enum bpf_reg_type {
+	NOT_INIT = 0,		 /* nothing was written into register */
+	UNKNOWN_VALUE,		 /* reg doesn't contain a valid pointer */
+	PTR_TO_CTX,		 /* reg points to bpf_context */
+	CONST_PTR_TO_MAP,	 /* reg points to struct bpf_map */
+	PTR_TO_MAP_VALUE,	 /* reg points to map element value */
+	PTR_TO_MAP_VALUE_OR_NULL,/* points to map elem value or NULL */
+	FRAME_PTR,		 /* reg == frame_pointer */
+	PTR_TO_STACK,		 /* reg == frame_pointer + imm */
+	CONST_IMM,		 /* constant integer value */
+
+	/* the following types are only returned by is_valid_access() of
+	 * program types whose context describes a packet
+	 */
+	PTR_TO_PACKET,		 /* reg points to skb->data or xdp->data */
+	PTR_TO_PACKET_END,	 /* skb->data + headlen or xdp->data_end */
+};
+
 /* type of values returned from helper functions */
 enum bpf_return_type {
 	RET_INTEGER,			/* function returns integer */
@@ -101,9 +147,11 @@ struct bpf_verifier_ops {
 	const struct bpf_func_proto *(*get_func_proto)(enum bpf_func_id func_id);
 
 	/* return true if 'size' wide access at offset 'off' within bpf_context
-	 * with 'type' (read or write) is allowed
+	 * with 'type' (read or write) is allowed, and set 'reg_type' for
+	 * fields that hold pointers the program may dereference
 	 */
-	bool (*is_valid_access)(int off, int size, enum bpf_access_type type);
+	bool (*is_valid_access)(int off, int size, enum bpf_access_type type,
+				enum bpf_reg_type *reg_type);
 
 	u32 (*convert_ctx_access)(int dst_reg, int src_reg, int ctx_off,
 				  struct bpf_insn *insn);
@@ -117,13 +165,19 @@ struct bpf_prog_type_list {
 
 struct bpf_prog;
 
+bool bpf_prog_array_compatible(struct bpf_array *array,
+			       const struct bpf_prog *fp);
+
 struct bpf_prog_aux {
 	atomic_t refcnt;
 	u32 used_map_cnt;
 	const struct bpf_verifier_ops *ops;
 	struct bpf_map **used_maps;
 	struct bpf_prog *prog;
-	struct work_struct work;
+	union {
+		struct work_struct work;
+		struct rcu_head rcu;
+	};
 };
 
 #ifdef CONFIG_BPF_SYSCALL
@@ -131,11 +185,22 @@ void bpf_register_prog_type(struct bpf_prog_type_list *tl);
 void bpf_register_map_type(struct bpf_map_type_list *tl);
 
 struct bpf_prog *bpf_prog_get(u32 ufd);
+struct bpf_prog *bpf_prog_get_type(u32 ufd, enum bpf_prog_type type);
 void bpf_prog_put(struct bpf_prog *prog);
 
 struct bpf_map *bpf_map_get(struct fd f);
 void bpf_map_put(struct bpf_map *map);
 
+/* per-cpu maps exchange the values of all possible cpus with user space */
+int bpf_percpu_hash_copy(struct bpf_map *map, void *key, void *value);
+int bpf_percpu_array_copy(struct bpf_map *map, void *key, void *value);
+int bpf_percpu_hash_update(struct bpf_map *map, void *key, void *value,
+			   u64 flags);
+int bpf_percpu_array_update(struct bpf_map *map, void *key, void *value,
+			    u64 flags);
+int bpf_stackmap_copy(struct bpf_map *map, void *key, void *value);
+void bpf_prog_array_map_clear(struct bpf_map *map);
+
 /* verify correctness of eBPF program */
 int bpf_check(struct bpf_prog **fp, union bpf_attr *attr);
 #else
@@ -148,6 +213,12 @@ static inline struct bpf_prog *bpf_prog_get(u32 ufd)
 	return ERR_PTR(-EOPNOTSUPP);
 }
 
+static inline struct bpf_prog *bpf_prog_get_type(u32 ufd,
+						 enum bpf_prog_type type)
+{
+	return ERR_PTR(-EOPNOTSUPP);
+}
+
 static inline void bpf_prog_put(struct bpf_prog *prog)
 {
 }
@@ -157,6 +228,8 @@ static inline void bpf_prog_put(struct bpf_prog *prog)
 extern const struct bpf_func_proto bpf_map_lookup_elem_proto;
 extern const struct bpf_func_proto bpf_map_update_elem_proto;
 extern const struct bpf_func_proto bpf_map_delete_elem_proto;
+extern const struct bpf_func_proto bpf_get_stackid_proto;
+extern const struct bpf_func_proto bpf_tail_call_proto;
 
 extern const struct bpf_func_proto bpf_get_prandom_u32_proto;
 extern const struct bpf_func_proto bpf_get_smp_processor_id_proto;
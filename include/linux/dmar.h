@@ -198,6 +198,20 @@ struct irte {
 				__reserved_2	: 8,
 				dest_id		: 32;
 		};
+
+		/* Posted format, used when the interrupt targets a vCPU */
+		struct {
+			__u64	p_present	: 1,
+				p_fpd		: 1,
+				p_res0		: 6,
+				p_avail		: 4,
+				p_res1		: 2,
+				p_urgent	: 1,
+				p_pst		: 1,
+				p_vector	: 8,
+				p_res2		: 14,
+				pda_l		: 26;
+		};
 		__u64 low;
 	};
 
@@ -208,10 +222,21 @@ struct irte {
 				svt		: 2,
 				__reserved_3	: 44;
 		};
+
+		struct {
+			__u64	p_sid		: 16,
+				p_sq		: 2,
+				p_svt		: 2,
+				p_res3		: 12,
+				pda_h		: 32;
+		};
 		__u64 high;
 	};
 };
 
+#define PDA_LOW_BIT	26
+#define PDA_HIGH_BIT	32
+
 enum {
 	IRQ_REMAP_XAPIC_MODE,
 	IRQ_REMAP_X2APIC_MODE,
@@ -12,6 +12,7 @@
 struct file;
 
 extern void fput(struct file *);
+extern void fput_pcpu(struct file *);
 extern bool fput_global(struct file *);
 
 struct file_operations;
@@ -21,23 +22,28 @@ struct path;
 extern struct file *alloc_file(struct path *, fmode_t mode,
 	const struct file_operations *fop);
 
-static inline void fput_light(struct file *file, int fput_needed)
-{
-	if (fput_needed)
-		fput(file);
-}
-
 struct fd {
 	struct file *file;
 	unsigned int flags;
 };
 #define FDPUT_FPUT       1
 #define FDPUT_POS_UNLOCK 2
+#define FDPUT_PCPU       4	/* reference is on ->f_pcpu_count */
+
+static inline void fput_light(struct file *file, int fput_needed)
+{
+	if (fput_needed & FDPUT_PCPU)
+		fput_pcpu(file);
+	else if (fput_needed)
+		fput(file);
+}
 
 static inline void fdput(struct fd fd)
 {
 	if (fd.flags & FDPUT_FPUT)
 		fput(fd.file);
+	else if (fd.flags & FDPUT_PCPU)
+		fput_pcpu(fd.file);
 }
 
 extern struct file *fget(unsigned int fd);
@@ -48,7 +54,7 @@ extern unsigned long __fdget_pos(unsigned int fd);
 
 static inline struct fd __to_fd(unsigned long v)
 {
-	return (struct fd){(struct file *)(v & ~3),v & 3};
+	return (struct fd){(struct file *)(v & ~7),v & 7};
 }
 
 static inline struct fd fdget(unsigned int fd)
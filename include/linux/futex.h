@@ -1,10 +1,12 @@
 #ifndef _LINUX_FUTEX_H
 #define _LINUX_FUTEX_H
 
+#include <linux/errno.h>
 #include <uapi/linux/futex.h>
 
 struct inode;
 struct mm_struct;
+struct seq_file;
 struct task_struct;
 union ktime;
 
@@ -68,4 +70,27 @@ static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
 #endif
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+extern int sysctl_futex_private_hash;
+
+extern int futex_hash_prctl(int option, unsigned long arg);
+extern void futex_hash_allocate_default(void);
+extern void futex_hash_free(struct mm_struct *mm);
+extern void futex_hash_show(struct seq_file *m, struct mm_struct *mm);
+#else
+static inline int futex_hash_prctl(int option, unsigned long arg)
+{
+	return -EINVAL;
+}
+static inline void futex_hash_allocate_default(void)
+{
+}
+static inline void futex_hash_free(struct mm_struct *mm)
+{
+}
+static inline void futex_hash_show(struct seq_file *m, struct mm_struct *mm)
+{
+}
+#endif
 #endif
@@ -182,6 +182,26 @@ alloc_zeroed_user_highpage_movable(struct vm_area_struct *vma,
 	return __alloc_zeroed_user_highpage(__GFP_MOVABLE, vma, vaddr);
 }
 
+#ifdef __HAVE_ARCH_CLEAR_PAGE_NOCACHE
+/*
+ * Only architectures whose clear_user_page() is a plain clear_page()
+ * provide clear_page_nocache().
+ */
+static inline void clear_user_highpage_nocache(struct page *page,
+					       unsigned long vaddr)
+{
+	void *addr = kmap_atomic(page);
+	clear_page_nocache(addr);
+	kunmap_atomic(addr);
+}
+#else
+static inline void clear_user_highpage_nocache(struct page *page,
+					       unsigned long vaddr)
+{
+	clear_user_highpage(page, vaddr);
+}
+#endif
+
 static inline void clear_highpage(struct page *page)
 {
 	void *kaddr = kmap_atomic(page);
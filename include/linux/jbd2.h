@@ -28,6 +28,7 @@
 #include <linux/stddef.h>
 #include <linux/mutex.h>
 #include <linux/timer.h>
+#include <linux/workqueue.h>
 #include <linux/slab.h>
 #include <crypto/hash.h>
 #endif
@@ -69,6 +70,7 @@ extern void *jbd2_alloc(size_t size, gfp_t flags);
 extern void jbd2_free(void *ptr, size_t size);
 
 #define JBD2_MIN_JOURNAL_BLOCKS 1024
+#define JBD2_DEFAULT_FAST_COMMIT_BLOCKS 256
 
 #ifdef __KERNEL__
 
@@ -269,7 +271,9 @@ typedef struct journal_superblock_s
 /* 0x0050 */
 	__u8	s_checksum_type;	/* checksum type */
 	__u8	s_padding2[3];
-	__u32	s_padding[42];
+/* 0x0054 */
+	__be32	s_num_fc_blks;		/* Number of fast commit blocks */
+	__u32	s_padding[41];
 	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
@@ -294,6 +298,7 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 #define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
 #define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x00000020
 
 /* Features known to this kernel version: */
 #define JBD2_KNOWN_COMPAT_FEATURES	JBD2_FEATURE_COMPAT_CHECKSUM
@@ -302,7 +307,15 @@ typedef struct journal_superblock_s
 					JBD2_FEATURE_INCOMPAT_64BIT | \
 					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
 					JBD2_FEATURE_INCOMPAT_CSUM_V2 | \
-					JBD2_FEATURE_INCOMPAT_CSUM_V3)
+					JBD2_FEATURE_INCOMPAT_CSUM_V3 | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
+
+/* Recovery passes, also handed to the fast commit replay callback */
+enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
+
+/* Return values of the fast commit replay callback */
+#define JBD2_FC_REPLAY_STOP	0
+#define JBD2_FC_REPLAY_CONTINUE	1
 
 #ifdef __KERNEL__
 
@@ -666,10 +679,29 @@ struct transaction_run_stats_s {
 	__u32			rs_blocks_logged;
 };
 
+/* Reasons for start_this_handle() to block */
+enum {
+	JBD2_STALL_LOCKED,	/* running transaction locked for commit */
+	JBD2_STALL_FULL,	/* running transaction full */
+	JBD2_STALL_SPACE,	/* waiting for checkpoint to free log space */
+	JBD2_STALL_RESERVED,	/* too many credits reserved */
+	JBD2_STALL_BARRIER,	/* journal barrier held */
+	JBD2_NR_STALLS,
+};
+
+struct jbd2_stall_stats_s {
+	unsigned long		ss_count;
+	u64			ss_time;	/* ns */
+	u64			ss_max;		/* ns */
+};
+
 struct transaction_stats_s {
 	unsigned long		ts_tid;
 	unsigned long		ts_requested;
 	struct transaction_run_stats_s run;
+	struct jbd2_stall_stats_s stall[JBD2_NR_STALLS];
+	unsigned long		ts_bg_checkpoints;
+	unsigned long		ts_commit_ahead;
 };
 
 static inline unsigned long
@@ -706,12 +738,19 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_wait_updates: Wait queue to wait for updates to complete
  * @j_wait_reserved: Wait queue to wait for reserved buffer credits to drop
  * @j_checkpoint_mutex: Mutex for locking against concurrent checkpoints
+ * @j_chkpt_work: Work item checkpointing in the background when the log is
+ *  getting full
  * @j_head: Journal head - identifies the first unused block in the journal
  * @j_tail: Journal tail - identifies the oldest still-used block in the
  *  journal.
  * @j_free: Journal free - how many free blocks are there in the journal?
  * @j_first: The block number of the first usable block
  * @j_last: The block number one beyond the last usable block
+ * @j_fc_first: The block number of the first fast commit block
+ * @j_fc_last: The block number one beyond the last fast commit block
+ * @j_fc_off: Number of fast commit blocks used by the running transaction
+ * @j_fc_wbuf: Array of fast commit buffers being written
+ * @j_fc_wait: Wait queue for fast and full commits to exclude each other
  * @j_dev: Device where we store the journal
  * @j_blocksize: blocksize for the location where we store the journal.
  * @j_blk_offset: starting block offset for into the device where we store the
@@ -751,6 +790,8 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_proc_entry: procfs entry for the jbd statistics directory
  * @j_stats: Overall statistics
  * @j_private: An opaque pointer to fs-private information.
+ * @j_fc_cleanup_callback: Called after a fast or full commit completed
+ * @j_fc_replay_callback: Called for each fast commit block at recovery
  */
 
 struct journal_s
@@ -830,6 +871,13 @@ struct journal_s
 	 * j_checkpoint_mutex.  [j_checkpoint_mutex]
 	 */
 	struct buffer_head	*j_chkpt_bhs[JBD2_NR_BATCH];
+
+	/*
+	 * Background checkpointing, queued when free log space drops
+	 * close to what a new transaction needs so that handles don't
+	 * have to checkpoint synchronously.
+	 */
+	struct work_struct	j_chkpt_work;
 	
 	/*
 	 * Journal head: identifies the first unused block in the journal.
@@ -856,6 +904,24 @@ struct journal_s
 	unsigned long		j_first;
 	unsigned long		j_last;
 
+	/*
+	 * Fast commit area at the end of the log: the block numbers of the
+	 * first block and one beyond the last block, and how many blocks
+	 * the running transaction has used so far. [j_state_lock]
+	 */
+	unsigned long		j_fc_first;
+	unsigned long		j_fc_last;
+	unsigned long		j_fc_off;
+
+	/*
+	 * Buffers of the fast commit area being written, indexed by offset
+	 * into the area.  Only touched by the fast commit owner.
+	 */
+	struct buffer_head	**j_fc_wbuf;
+
+	/* Wait queue for fast and full commits to exclude each other */
+	wait_queue_head_t	j_fc_wait;
+
 	/*
 	 * Device, blocksize and starting block offset for the location where we
 	 * store the journal.
@@ -993,6 +1059,24 @@ struct journal_s
 
 	/* Precomputed journal UUID checksum for seeding other checksums */
 	__u32 j_csum_seed;
+
+	/*
+	 * Called once a fast commit (full == 0) or a full commit of @tid
+	 * has completed, so that the client can drop the state it tracked
+	 * for it.
+	 */
+	void (*j_fc_cleanup_callback)(journal_t *journal, int full, tid_t tid);
+
+	/*
+	 * Called for each block of the fast commit area during recovery,
+	 * once with PASS_SCAN and once with PASS_REPLAY.  @off is the offset
+	 * into the area and @expected_tid the transaction the fast commits
+	 * must belong to.  Returns JBD2_FC_REPLAY_CONTINUE to be handed the
+	 * next block, JBD2_FC_REPLAY_STOP or a negative error.
+	 */
+	int (*j_fc_replay_callback)(journal_t *journal, struct buffer_head *bh,
+				    enum passtype pass, int off,
+				    tid_t expected_tid);
 };
 
 /*
@@ -1008,6 +1092,8 @@ struct journal_s
 						 * data write error in ordered
 						 * mode */
 #define JBD2_REC_ERR	0x080	/* The errno in the sb has been recorded */
+#define JBD2_FAST_COMMIT_ONGOING	0x100	/* Fast commit in progress */
+#define JBD2_FULL_COMMIT_ONGOING	0x200	/* Full commit in progress */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1246,7 +1332,14 @@ int __jbd2_log_start_commit(journal_t *journal, tid_t tid);
 int jbd2_journal_start_commit(journal_t *journal, tid_t *tid);
 int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
 int jbd2_complete_transaction(journal_t *journal, tid_t tid);
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid);
+int jbd2_fc_end_commit(journal_t *journal, tid_t tid);
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out);
+int jbd2_fc_wait_bufs(journal_t *journal, int num_blks);
+void jbd2_fc_release_bufs(journal_t *journal);
 int jbd2_log_do_checkpoint(journal_t *journal);
+void jbd2_log_kick_checkpoint(journal_t *journal);
+void jbd2_checkpoint_work(struct work_struct *work);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
@@ -1300,6 +1393,19 @@ static inline int tid_geq(tid_t x, tid_t y)
 extern int jbd2_journal_blocks_per_page(struct inode *inode);
 extern size_t journal_tag_bytes(journal_t *journal);
 
+static inline int jbd2_has_fast_commit(journal_t *journal)
+{
+	return JBD2_HAS_INCOMPAT_FEATURE(journal,
+					 JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+}
+
+static inline int jbd2_journal_get_num_fc_blks(journal_superblock_t *jsb)
+{
+	int num_fc_blocks = be32_to_cpu(jsb->s_num_fc_blks);
+
+	return num_fc_blocks ? num_fc_blocks : JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+}
+
 static inline int jbd2_journal_has_csum_v2or3(journal_t *journal)
 {
 	if (JBD2_HAS_INCOMPAT_FEATURE(journal, JBD2_FEATURE_INCOMPAT_CSUM_V2) ||
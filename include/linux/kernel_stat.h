@@ -40,8 +40,21 @@ struct kernel_stat {
 	unsigned int softirqs[NR_SOFTIRQS];
 };
 
+/*
+ * Per-vector softirq statistics.  Times are in nanoseconds of local_clock().
+ */
+struct softirq_stat {
+	u64 time;		/* spent in the handler */
+	u64 raised_at;		/* first raise still pending, 0 if none */
+	u64 lat_total;		/* raise to handler entry */
+	u64 lat_max;
+	unsigned int lat_count;
+	unsigned int deferred;	/* handed over to ksoftirqd */
+};
+
 DECLARE_PER_CPU(struct kernel_stat, kstat);
 DECLARE_PER_CPU(struct kernel_cpustat, kernel_cpustat);
+DECLARE_PER_CPU(struct softirq_stat [NR_SOFTIRQS], softirq_stat);
 
 /* Must have preemption disabled for this to be meaningful. */
 #define kstat_this_cpu this_cpu_ptr(&kstat)
@@ -64,6 +77,11 @@ static inline unsigned int kstat_softirqs_cpu(unsigned int irq, int cpu)
        return kstat_cpu(cpu).softirqs[irq];
 }
 
+static inline struct softirq_stat *softirq_stat_cpu(unsigned int irq, int cpu)
+{
+	return &per_cpu(softirq_stat, cpu)[irq];
+}
+
 /*
  * Number of interrupts per specific IRQ source, since bootup
  */
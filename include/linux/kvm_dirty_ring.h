@@ -0,0 +1,87 @@
+#ifndef __KVM_DIRTY_RING_H
+#define __KVM_DIRTY_RING_H
+
+#include <linux/kvm.h>
+
+/*
+ * struct kvm_dirty_ring - per-vcpu ring of dirty gfns shared with userspace
+ *
+ * @dirty_index: free running counter that points to the next slot in
+ *               dirty_gfns[] where a new dirty page should go
+ * @reset_index: free running counter that points to the next dirty page
+ *               in dirty_gfns[] for which the dirty bit needs to be reset
+ * @size:        size of the ring in entries, always a power of two
+ * @soft_limit:  when the number of dirty pages in the ring reaches this,
+ *               the vcpu exits to userspace before running the guest again
+ * @dirty_gfns:  the ring itself, vmalloc()ed and mmap()ed by userspace
+ */
+struct kvm_dirty_ring {
+	u32 dirty_index;
+	u32 reset_index;
+	u32 size;
+	u32 soft_limit;
+	struct kvm_dirty_gfn *dirty_gfns;
+};
+
+/*
+ * Entries kept free in the ring for pages dirtied between the last check
+ * before entering the guest and the vcpu getting back to userspace.
+ */
+#define KVM_DIRTY_RING_RSVD_ENTRIES	64
+#define KVM_DIRTY_RING_MAX_ENTRIES	65536
+
+struct kvm;
+struct kvm_vcpu;
+
+#ifdef KVM_DIRTY_LOG_PAGE_OFFSET
+
+int kvm_cpu_dirty_log_size(void);
+u32 kvm_dirty_ring_get_rsvd_entries(void);
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size);
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring);
+void kvm_dirty_ring_push(struct kvm_dirty_ring *ring, u32 slot, u64 offset);
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring);
+bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring);
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring, u32 offset);
+
+#else
+
+static inline u32 kvm_dirty_ring_get_rsvd_entries(void)
+{
+	return 0;
+}
+
+static inline int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size)
+{
+	return 0;
+}
+
+static inline void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+}
+
+static inline void kvm_dirty_ring_push(struct kvm_dirty_ring *ring,
+				       u32 slot, u64 offset)
+{
+}
+
+static inline int kvm_dirty_ring_reset(struct kvm *kvm,
+				       struct kvm_dirty_ring *ring)
+{
+	return 0;
+}
+
+static inline bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return false;
+}
+
+static inline struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring,
+						   u32 offset)
+{
+	return NULL;
+}
+
+#endif /* KVM_DIRTY_LOG_PAGE_OFFSET */
+
+#endif
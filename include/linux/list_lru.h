@@ -47,19 +47,36 @@ struct list_lru_node {
 } ____cacheline_aligned_in_smp;
 
 struct list_lru {
+	/*
+	 * nr_node_ids << shift lists: each node's objects are spread over
+	 * 1 << shift lists, each with its own lock, by hashing their address
+	 */
 	struct list_lru_node	*node;
+	unsigned int		shift;
+	/* list of the node that the next sharded walk starts from */
+	unsigned int		rotor;
 #ifdef CONFIG_MEMCG_KMEM
 	struct list_head	list;
 #endif
 };
 
 void list_lru_destroy(struct list_lru *lru);
-int __list_lru_init(struct list_lru *lru, bool memcg_aware,
+int __list_lru_init(struct list_lru *lru, bool memcg_aware, bool sharded,
 		    struct lock_class_key *key);
 
-#define list_lru_init(lru)		__list_lru_init((lru), false, NULL)
-#define list_lru_init_key(lru, key)	__list_lru_init((lru), false, (key))
-#define list_lru_init_memcg(lru)	__list_lru_init((lru), true, NULL)
+#define list_lru_init(lru) \
+	__list_lru_init((lru), false, false, NULL)
+#define list_lru_init_key(lru, key) \
+	__list_lru_init((lru), false, false, (key))
+#define list_lru_init_memcg(lru) \
+	__list_lru_init((lru), true, false, NULL)
+/*
+ * Split the lists of each node by object address so that adds and deletes
+ * on a node with many CPUs do not all serialise on one lock.  Walks scan
+ * the lists of a node in turn, in batches.
+ */
+#define list_lru_init_memcg_sharded(lru) \
+	__list_lru_init((lru), true, true, NULL)
 
 int memcg_update_all_list_lrus(int num_memcgs);
 void memcg_drain_all_list_lrus(int src_idx, int dst_idx);
@@ -148,6 +148,8 @@ static inline bool task_in_memcg_oom(struct task_struct *p)
 
 bool mem_cgroup_oom_synchronize(bool wait);
 
+void mem_cgroup_handle_over_high(void);
+
 #ifdef CONFIG_MEMCG_SWAP
 extern int do_swap_account;
 #endif
@@ -348,6 +350,10 @@ static inline bool mem_cgroup_oom_synchronize(bool wait)
 	return false;
 }
 
+static inline void mem_cgroup_handle_over_high(void)
+{
+}
+
 static inline void mem_cgroup_inc_page_stat(struct mem_cgroup *memcg,
 					    enum mem_cgroup_stat_index idx)
 {
@@ -444,6 +450,8 @@ struct mem_cgroup *__mem_cgroup_from_kmem(void *ptr);
 int memcg_charge_kmem(struct mem_cgroup *memcg, gfp_t gfp,
 		      unsigned long nr_pages);
 void memcg_uncharge_kmem(struct mem_cgroup *memcg, unsigned long nr_pages);
+int __memcg_charge_slab(struct kmem_cache *s, gfp_t gfp, int order);
+void __memcg_uncharge_slab(struct kmem_cache *s, int order);
 
 /**
  * memcg_kmem_newpage_charge: verify if a new kmem allocation is allowed.
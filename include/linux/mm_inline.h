@@ -8,8 +8,9 @@
  * page_is_file_cache - should the page be on a file LRU or anon LRU?
  * @page: the page to test
  *
- * Returns 1 if @page is page cache page backed by a regular filesystem,
- * or 0 if @page is anonymous, tmpfs or otherwise ram or swap backed.
+ * Returns 1 if @page is page cache page backed by a regular filesystem
+ * or an anonymous page freed with MADV_FREE, or 0 if @page is anonymous,
+ * tmpfs or otherwise ram or swap backed.
  * Used by functions that manipulate the LRU lists, to sort a page
  * onto the right LRU list.
  *
@@ -22,12 +23,156 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+/**
+ * page_lru_base_type - which LRU list type should a page be on?
+ * @page: the page to test
+ *
+ * Used for LRU list index arithmetic.
+ *
+ * Returns the base LRU type - file or anon - @page should be on.
+ */
+static inline enum lru_list page_lru_base_type(struct page *page)
+{
+	if (page_is_file_cache(page))
+		return LRU_INACTIVE_FILE;
+	return LRU_INACTIVE_ANON;
+}
+
+#ifdef CONFIG_LRU_GEN
+static inline bool lru_gen_enabled(void)
+{
+	return lru_gen_on;
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* The generation of a page, or -1 if it is not on a generation list */
+static inline int page_lru_gen(struct page *page)
+{
+	return (int)((READ_ONCE(page->flags) & LRU_GEN_MASK) >>
+		     LRU_GEN_PGOFF) - 1;
+}
+
+/*
+ * Move @page from generation @old to @gen, or onto a generation list if
+ * @old is -1; a page whose generation changed meanwhile is left alone.
+ * Pages are promoted without the lru_lock, hence the cmpxchg.
+ */
+static inline bool page_update_lru_gen(struct page *page, int old, int gen)
+{
+	unsigned long flags, new;
+
+	do {
+		flags = READ_ONCE(page->flags);
+		if (((flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) != old + 1)
+			return false;
+		new = (flags & ~LRU_GEN_MASK) |
+		      ((gen + 1UL) << LRU_GEN_PGOFF);
+	} while (cmpxchg(&page->flags, flags, new) != flags);
+
+	return true;
+}
+
+/*
+ * Put an evictable page on a generation list instead of lruvec->lists[]:
+ * active pages go to the youngest generation, the others to the second
+ * oldest one, or to the oldest one when @tail, to be reclaimed next.
+ * Generation pages are never PageActive and are accounted as inactive.
+ */
+static inline bool lru_gen_add_page(struct page *page, struct lruvec *lruvec,
+				    bool tail)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int type = page_is_file_cache(page);
+	unsigned long seq;
+
+	if (!lru_gen_enabled() || PageUnevictable(page))
+		return false;
+
+	if (PageActive(page)) {
+		ClearPageActive(page);
+		seq = lrugen->max_seq;
+	} else if (tail) {
+		seq = lrugen->min_seq[type];
+	} else {
+		seq = lrugen->min_seq[type] + 1;
+	}
+
+	VM_BUG_ON_PAGE(page_lru_gen(page) != -1, page);
+	page_update_lru_gen(page, -1, lru_gen_from_seq(seq));
+	if (tail)
+		list_add_tail(&page->lru,
+			      &lrugen->lists[lru_gen_from_seq(seq)][type]);
+	else
+		list_add(&page->lru,
+			 &lrugen->lists[lru_gen_from_seq(seq)][type]);
+	return true;
+}
+
+static inline bool lru_gen_del_page(struct page *page, struct lruvec *lruvec)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	/* retry if the page was promoted meanwhile */
+	while (!page_update_lru_gen(page, gen, -1))
+		gen = page_lru_gen(page);
+	list_del(&page->lru);
+	return true;
+}
+
+/* Move a page to the tail of the oldest generation, for rotation */
+static inline bool lru_gen_rotate_page(struct page *page,
+				       struct lruvec *lruvec)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	lru_gen_del_page(page, lruvec);
+	lru_gen_add_page(page, lruvec, true);
+	return true;
+}
+#else
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline bool lru_gen_add_page(struct page *page, struct lruvec *lruvec,
+				    bool tail)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct page *page, struct lruvec *lruvec)
+{
+	return false;
+}
+
+static inline bool lru_gen_rotate_page(struct page *page,
+				       struct lruvec *lruvec)
+{
+	return false;
+}
+#endif /* CONFIG_LRU_GEN */
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
+
+	if (lru_gen_add_page(page, lruvec, false))
+		lru = page_lru_base_type(page);
+	else
+		list_add(&page->lru, &lruvec->lists[lru]);
 	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
-	list_add(&page->lru, &lruvec->lists[lru]);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, nr_pages);
 }
 
@@ -35,26 +180,15 @@ static __always_inline void del_page_from_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
+
+	if (lru_gen_del_page(page, lruvec))
+		lru = page_lru_base_type(page);
+	else
+		list_del(&page->lru);
 	mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
-	list_del(&page->lru);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, -nr_pages);
 }
 
-/**
- * page_lru_base_type - which LRU list type should a page be on?
- * @page: the page to test
- *
- * Used for LRU list index arithmetic.
- *
- * Returns the base LRU type - file or anon - @page should be on.
- */
-static inline enum lru_list page_lru_base_type(struct page *page)
-{
-	if (page_is_file_cache(page))
-		return LRU_INACTIVE_FILE;
-	return LRU_INACTIVE_ANON;
-}
-
 /**
  * page_off_lru - which LRU list was page on? clearing its lru flags.
  * @page: the page to test
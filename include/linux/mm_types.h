@@ -8,6 +8,7 @@
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/uprobes.h>
@@ -132,6 +133,10 @@ struct page {
 		};
 
 		struct slab *slab_page; /* slab fields */
+		struct {		/* net/core/page_pool.c pages */
+			unsigned long pp_magic;	/* PP_SIGNATURE */
+			struct page_pool *pp;	/* owning pool */
+		};
 		struct rcu_head rcu_head;	/* Used by SLAB
 						 * when destroying via RCU
 						 */
@@ -238,6 +243,16 @@ struct vm_region {
 						* this region */
 };
 
+#ifdef CONFIG_USERFAULTFD
+#define NULL_VM_UFFD_CTX ((struct vm_userfaultfd_ctx) { NULL, })
+struct vm_userfaultfd_ctx {
+	struct userfaultfd_ctx *ctx;
+};
+#else /* CONFIG_USERFAULTFD */
+#define NULL_VM_UFFD_CTX ((struct vm_userfaultfd_ctx) {})
+struct vm_userfaultfd_ctx {};
+#endif /* CONFIG_USERFAULTFD */
+
 /*
  * This struct defines a memory VMM memory area. There is one of these
  * per VM-area/task.  A VM area is any part of the process virtual memory
@@ -303,6 +318,18 @@ struct vm_area_struct {
 #endif
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
+#endif
+	struct vm_userfaultfd_ctx vm_userfaultfd_ctx;
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * NUMA hinting faults taken in this VMA since the scanner last
+	 * started a pass over it, indexed by locality (remote, local).
+	 * VMAs that only fault locally are scanned less and less often,
+	 * numab_backoff is the log2 of the scan periods they are skipped.
+	 */
+	unsigned int numab_faults[2];
+	unsigned int numab_backoff;
+	unsigned long numab_next_scan;
 #endif
 };
 
@@ -324,12 +351,42 @@ enum {
 	NR_MM_COUNTERS
 };
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+enum {
+	SPF_SUCCESS,	/* faults handled without the mmap_sem */
+	SPF_ABORT,	/* attempts that fell back to the mmap_sem */
+	NR_SPF_COUNTERS
+};
+#endif
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+enum {
+	KHUGEPAGED_SCANNED,		/* pmd ranges looked at by khugepaged */
+	KHUGEPAGED_COLLAPSED,		/* ranges collapsed into a huge page */
+	KHUGEPAGED_COLLAPSE_FAILED,	/* collapses that were given up */
+	NR_KHUGEPAGED_COUNTERS
+};
+#endif
+
+#ifdef CONFIG_KSM
+enum {
+	KSM_PAGES_SCANNED,		/* pages looked at by ksmd */
+	KSM_PAGES_SKIPPED,		/* of those, left alone after failures */
+	KSM_MERGE_FAILED,		/* merges of identical pages given up */
+	KSM_PAGES_MERGING,		/* pages currently backed by a ksm page */
+	NR_KSM_COUNTERS
+};
+#endif
+
 #if USE_SPLIT_PTE_PTLOCKS && defined(CONFIG_MMU)
 #define SPLIT_RSS_COUNTING
 /* per-thread cached information, */
 struct task_rss_stat {
 	int events;	/* for synchronization threshold */
 	int count[NR_MM_COUNTERS];
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	int spf[NR_SPF_COUNTERS];
+#endif
 };
 #endif /* USE_SPLIT_PTE_PTLOCKS */
 
@@ -362,11 +419,24 @@ struct mm_struct {
 
 	spinlock_t page_table_lock;		/* Protects page tables and some counters */
 	struct rw_semaphore mmap_sem;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Odd while a holder of mmap_sem for writing changes vmas or page
+	 * tables under them, see handle_speculative_fault().
+	 */
+	seqcount_t mm_seq;
+	atomic_long_t spf_stat[NR_SPF_COUNTERS];
+#endif
 
 	struct list_head mmlist;		/* List of maybe swapped mm's.	These are globally strung
 						 * together off init_mm.mmlist, and are protected
 						 * by mmlist_lock
 						 */
+#ifdef CONFIG_LRU_GEN
+	/* On the list of mms whose page tables are walked to age pages */
+	struct list_head lru_gen_list;
+	unsigned long lru_gen_seq;	/* the last walk that visited it */
+#endif
 
 
 	unsigned long hiwater_rss;	/* High-watermark of RSS usage */
@@ -427,6 +497,18 @@ struct mm_struct {
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) && !USE_SPLIT_PMD_PTLOCKS
 	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/* Only written by the khugepaged worker scanning this mm */
+	unsigned long khugepaged_stat[NR_KHUGEPAGED_COUNTERS];
+#endif
+#ifdef CONFIG_KSM
+	/* Only written by ksmd */
+	unsigned long ksm_stat[NR_KSM_COUNTERS];
+#endif
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	/* Hash of the private futexes, set up while the mm has one user */
+	struct futex_private_hash *futex_hash;
+#endif
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
@@ -451,6 +533,10 @@ struct mm_struct {
 	 * PROT_NONE or PROT_NUMA mapped page.
 	 */
 	bool tlb_flush_pending;
+#endif
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	/* See flush_tlb_batched_pending() */
+	bool tlb_flush_batched;
 #endif
 	struct uprobes_state uprobes_state;
 #ifdef CONFIG_X86_INTEL_MPX
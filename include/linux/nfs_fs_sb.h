@@ -55,6 +55,7 @@ struct nfs_client {
 	struct rpc_clnt *	cl_rpcclient;
 	const struct nfs_rpc_ops *rpc_ops;	/* NFS protocol vector */
 	int			cl_proto;	/* Network transport protocol */
+	unsigned int		cl_nconnect;	/* Number of connections */
 	struct nfs_subversion *	cl_nfs_mod;	/* pointer to nfs version module */
 
 	u32			cl_minorversion;/* NFSv4 minorversion */
@@ -255,5 +256,6 @@ struct nfs_server {
 #define NFS_CAP_SYSTEM          (1U << 28)
 #define NFS_CAP_ARCHIVE         (1U << 29)
 #define NFS_CAP_TIME_BACKUP     (1U << 30)
+#define NFS_CAP_COPY		(1U << 31)
 
 #endif
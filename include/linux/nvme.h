@@ -19,6 +19,7 @@
 #include <linux/pci.h>
 #include <linux/kref.h>
 #include <linux/blk-mq.h>
+#include <linux/srcu.h>
 
 struct nvme_bar {
 	__u64			cap;	/* Controller Capabilities */
@@ -34,6 +35,14 @@ struct nvme_bar {
 	__u64			acq;	/* Admin CQ Base Address */
 };
 
+/* Register offsets, which the fabrics Property Get/Set commands also use */
+enum {
+	NVME_REG_CAP	= 0x0000,
+	NVME_REG_VS	= 0x0008,
+	NVME_REG_CC	= 0x0014,
+	NVME_REG_CSTS	= 0x001c,
+};
+
 #define NVME_CAP_MQES(cap)	((cap) & 0xffff)
 #define NVME_CAP_TIMEOUT(cap)	(((cap) >> 24) & 0xff)
 #define NVME_CAP_STRIDE(cap)	(((cap) >> 32) & 0xf)
@@ -103,6 +112,7 @@ struct nvme_dev {
 	u16 abort_limit;
 	u8 event_limit;
 	u8 vwc;
+	u8 cmic;
 };
 
 /*
@@ -120,9 +130,43 @@ struct nvme_ns {
 	u16 ms;
 	bool ext;
 	u8 pi_type;
+	u8 nguid[16];
+	u8 eui64[8];
 	u64 mode_select_num_blocks;
 	u32 mode_select_block_len;
+#ifdef CONFIG_NVME_MULTIPATH
+	struct nvme_ns_head *head;
+	struct list_head siblings;
+	struct block_device *bdev;
+#endif
+};
+
+#ifdef CONFIG_NVME_MULTIPATH
+/*
+ * A namespace shared by several controllers of one NVM subsystem.  Each
+ * controller's nvme_ns is a path to it; the head exposes a single block
+ * device and sends every bio down one of the usable paths.
+ */
+struct nvme_ns_head {
+	struct list_head entry;
+	struct kref ref;
+	struct list_head list;
+	struct srcu_struct srcu;
+	struct request_queue *queue;
+	struct gendisk *disk;
+	spinlock_t requeue_lock;
+	struct bio_list requeue_list;
+	struct work_struct requeue_work;
+
+	int instance;
+	char serial[20];
+	char model[40];
+	unsigned ns_id;
+	u8 nguid[16];
+	u8 eui64[8];
+	unsigned int rr_last;
 };
+#endif
 
 /*
  * The nvme_iod describes the data in an I/O, including the list of PRP
@@ -161,6 +205,8 @@ void nvme_unmap_user_pages(struct nvme_dev *dev, int write,
 int nvme_submit_io_cmd(struct nvme_dev *, struct nvme_ns *,
 						struct nvme_command *, u32 *);
 int nvme_submit_flush_data(struct nvme_queue *nvmeq, struct nvme_ns *ns);
+void nvme_setup_rw(struct nvme_ns *ns, struct request *req,
+						struct nvme_command *cmnd);
 int nvme_submit_admin_cmd(struct nvme_dev *, struct nvme_command *,
 							u32 *result);
 int nvme_identify(struct nvme_dev *, unsigned nsid, unsigned cns,
@@ -176,4 +222,24 @@ int nvme_sg_io(struct nvme_ns *ns, struct sg_io_hdr __user *u_hdr);
 int nvme_sg_io32(struct nvme_ns *ns, unsigned long arg);
 int nvme_sg_get_version_num(int __user *ip);
 
+#ifdef CONFIG_NVME_MULTIPATH
+void nvme_mpath_add_ns(struct nvme_ns *ns);
+void nvme_mpath_remove_ns(struct nvme_ns *ns);
+void nvme_mpath_revalidate(struct nvme_ns *ns);
+void nvme_mpath_kick(struct nvme_dev *dev);
+#else
+static inline void nvme_mpath_add_ns(struct nvme_ns *ns)
+{
+}
+static inline void nvme_mpath_remove_ns(struct nvme_ns *ns)
+{
+}
+static inline void nvme_mpath_revalidate(struct nvme_ns *ns)
+{
+}
+static inline void nvme_mpath_kick(struct nvme_dev *dev)
+{
+}
+#endif
+
 #endif /* _LINUX_NVME_H */
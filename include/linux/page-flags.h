@@ -299,7 +299,8 @@ PAGEFLAG_FALSE(HWPoison)
  * and then page->mapping points, not to an anon_vma, but to a private
  * structure which KSM associates with that merged page.  See ksm.h.
  *
- * PAGE_MAPPING_KSM without PAGE_MAPPING_ANON is currently never used.
+ * PAGE_MAPPING_KSM without PAGE_MAPPING_ANON is used by zsmalloc, whose
+ * pages point to the size class they belong to.  See mm/zsmalloc.c.
  *
  * Please note that, confusingly, "page_mapping" refers to the inode
  * address_space which maps the page from disk; whereas "page_mapped"
@@ -308,6 +309,7 @@ PAGEFLAG_FALSE(HWPoison)
 #define PAGE_MAPPING_ANON	1
 #define PAGE_MAPPING_KSM	2
 #define PAGE_MAPPING_FLAGS	(PAGE_MAPPING_ANON | PAGE_MAPPING_KSM)
+#define PAGE_MAPPING_ZSMALLOC	PAGE_MAPPING_KSM
 
 static inline int PageAnon(struct page *page)
 {
@@ -330,6 +332,12 @@ static inline int PageKsm(struct page *page)
 TESTPAGEFLAG_FALSE(Ksm)
 #endif
 
+static inline int PageZsmalloc(struct page *page)
+{
+	return ((unsigned long)READ_ONCE(page->mapping) &
+			PAGE_MAPPING_FLAGS) == PAGE_MAPPING_ZSMALLOC;
+}
+
 u64 stable_page_flags(struct page *page);
 
 static inline int PageUptodate(struct page *page)
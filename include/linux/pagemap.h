@@ -25,6 +25,7 @@ enum mapping_flags {
 	AS_MM_ALL_LOCKS	= __GFP_BITS_SHIFT + 2,	/* under mm_take_all_locks() */
 	AS_UNEVICTABLE	= __GFP_BITS_SHIFT + 3,	/* e.g., ramdisk, SHM_LOCK */
 	AS_EXITING	= __GFP_BITS_SHIFT + 4, /* final truncate in progress */
+	AS_LARGE_PAGES	= __GFP_BITS_SHIFT + 5, /* read ahead in large blocks */
 };
 
 static inline void mapping_set_error(struct address_space *mapping, int error)
@@ -64,6 +65,25 @@ static inline int mapping_exiting(struct address_space *mapping)
 	return test_bit(AS_EXITING, &mapping->flags);
 }
 
+/*
+ * Filesystems set AS_LARGE_PAGES on mappings whose readahead may allocate
+ * naturally aligned blocks of PAGE_CACHE_LARGE_NR pages at once.  The
+ * block is split before it enters the page cache, so the filesystem sees
+ * ordinary pages that merely happen to be physically contiguous.
+ */
+#define PAGE_CACHE_LARGE_ORDER	PAGE_ALLOC_COSTLY_ORDER
+#define PAGE_CACHE_LARGE_NR	(1UL << PAGE_CACHE_LARGE_ORDER)
+
+static inline void mapping_set_large_pages(struct address_space *mapping)
+{
+	set_bit(AS_LARGE_PAGES, &mapping->flags);
+}
+
+static inline int mapping_large_pages(struct address_space *mapping)
+{
+	return test_bit(AS_LARGE_PAGES, &mapping->flags);
+}
+
 static inline gfp_t mapping_gfp_mask(struct address_space * mapping)
 {
 	return (__force gfp_t)mapping->flags & __GFP_BITS_MASK;
@@ -212,8 +232,15 @@ static inline void page_unfreeze_refs(struct page *page, int count)
 }
 
 #ifdef CONFIG_NUMA
+extern struct page *__page_cache_alloc_order(gfp_t gfp, unsigned int order);
 extern struct page *__page_cache_alloc(gfp_t gfp);
 #else
+static inline struct page *__page_cache_alloc_order(gfp_t gfp,
+						    unsigned int order)
+{
+	return alloc_pages(gfp, order);
+}
+
 static inline struct page *__page_cache_alloc(gfp_t gfp)
 {
 	return alloc_pages(gfp, 0);
@@ -236,6 +263,13 @@ static inline struct page *page_cache_alloc_readahead(struct address_space *x)
 				  __GFP_COLD | __GFP_NORETRY | __GFP_NOWARN);
 }
 
+static inline struct page *page_cache_alloc_readahead_order(
+		struct address_space *x, unsigned int order)
+{
+	return __page_cache_alloc_order(mapping_gfp_mask(x) |
+			__GFP_COLD | __GFP_NORETRY | __GFP_NOWARN, order);
+}
+
 typedef int filler_t(void *, struct page *);
 
 pgoff_t page_cache_next_hole(struct address_space *mapping,
@@ -489,6 +489,12 @@ struct perf_event {
 #ifdef CONFIG_CGROUP_PERF
 	struct perf_cgroup		*cgrp; /* cgroup event is attach to */
 	int				cgrp_defer_enabled;
+
+	/* per-cgroup counts of a shared cpu event, see ATTACH_CGROUP */
+	struct perf_cgroup_node_table	*cgrp_nodes;
+	struct list_head		cgrp_node_entry;
+	u64				cgrp_node_count;
+	u64				cgrp_node_tstamp;
 #endif
 
 #endif /* CONFIG_PERF_EVENTS */
@@ -596,6 +602,25 @@ struct perf_cgroup {
 	struct perf_cgroup_info	__percpu *info;
 };
 
+/*
+ * A cgroup attached to a shared cpu event: the event's count is split
+ * among these at each cgroup switch on the event's cpu.  @id is the
+ * inode number of the cgroup directory.
+ */
+struct perf_cgroup_node {
+	struct hlist_node		node;
+	u64				id;
+	u64				count;
+	u64				time;
+};
+
+struct perf_cgroup_node_table {
+	unsigned int			hash_bits;
+	unsigned int			nr;
+	struct perf_cgroup_node		*nodes;
+	struct hlist_head		hash[0];
+};
+
 /*
  * Must ensure cgroup is pinned (css_get) before calling
  * this function. In other words, we cannot call this function
@@ -652,6 +677,7 @@ extern void perf_pmu_migrate_context(struct pmu *pmu,
 				int src_cpu, int dst_cpu);
 extern u64 perf_event_read_value(struct perf_event *event,
 				 u64 *enabled, u64 *running);
+extern struct file *perf_event_get(unsigned int fd);
 
 
 struct perf_sample_data {
@@ -725,6 +751,9 @@ extern void perf_prepare_sample(struct perf_event_header *header,
 				struct perf_sample_data *data,
 				struct perf_event *event,
 				struct pt_regs *regs);
+extern void perf_event_output(struct perf_event *event,
+			      struct perf_sample_data *data,
+			      struct pt_regs *regs);
 
 extern int perf_event_overflow(struct perf_event *event,
 				 struct perf_sample_data *data,
@@ -937,6 +966,10 @@ static inline int perf_event_refresh(struct perf_event *event, int refresh)
 {
 	return -EINVAL;
 }
+static inline struct file *perf_event_get(unsigned int fd)
+{
+	return ERR_PTR(-EINVAL);
+}
 
 static inline void
 perf_sw_event(u32 event_id, u64 nr, struct pt_regs *regs, u64 addr)	{ }
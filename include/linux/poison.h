@@ -29,6 +29,9 @@
  */
 #define TIMER_ENTRY_STATIC	((void *) 0x74737461)
 
+/********** net/core/page_pool.c **********/
+#define PP_SIGNATURE		(0x40 + POISON_POINTER_DELTA)
+
 /********** mm/debug-pagealloc.c **********/
 #define PAGE_POISON 0xaa
 
@@ -28,9 +28,8 @@
 #include <linux/rcupdate.h>
 
 /*
- * An indirect pointer (root->rnode pointing to a radix_tree_node, rather
- * than a data item) is signalled by the low bit set in the root->rnode
- * pointer.
+ * An indirect pointer (root->rnode or a slot pointing to a radix_tree_node,
+ * rather than a data item) is signalled by the low bit set in the pointer.
  *
  * In this case root->height is > 0, but the indirect pointer tests are
  * needed for RCU lookups (because root->height is unreliable). The only
@@ -40,6 +39,13 @@
  * Indirect pointer in fact is also used to tag the last pointer of a node
  * when it is shrunk, before we rcu free the node. See shrink code for
  * details.
+ *
+ * Multi-order entries cover 2^order indices with a single item.  The item
+ * is stored in the first slot of the range at the level of the tree whose
+ * slots cover 2^(order rounded down to RADIX_TREE_MAP_SHIFT) indices; the
+ * remaining slots of the range hold sibling entries, which are indirect
+ * pointers back to that canonical slot.  Lookups and iterators resolve
+ * sibling entries, so users of the API never see them.
  */
 #define RADIX_TREE_INDIRECT_PTR		1
 /*
@@ -84,6 +90,20 @@ static inline int radix_tree_is_indirect_ptr(void *ptr)
 #define RADIX_TREE_COUNT_SHIFT	(RADIX_TREE_MAP_SHIFT + 1)
 #define RADIX_TREE_COUNT_MASK	((1UL << RADIX_TREE_COUNT_SHIFT) - 1)
 
+/*
+ * A sibling entry points back to the canonical slot of its multi-order
+ * entry, which precedes it in the same node.  Child node pointers and
+ * items tagged by the shrink code never point that close before @slot.
+ */
+static inline int radix_tree_is_sibling(void **slot, void *entry)
+{
+	unsigned long canon = (unsigned long)entry & ~RADIX_TREE_INDIRECT_PTR;
+
+	return ((unsigned long)entry & 3) == RADIX_TREE_INDIRECT_PTR &&
+	       (unsigned long)slot - canon - 1 <
+			(RADIX_TREE_MAP_SIZE - 1) * sizeof(void *);
+}
+
 struct radix_tree_node {
 	unsigned int	path;	/* Offset in parent & height from the bottom */
 	unsigned int	count;
@@ -261,8 +281,15 @@ static inline void radix_tree_replace_slot(void **pslot, void *item)
 }
 
 int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
-			struct radix_tree_node **nodep, void ***slotp);
-int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
+			unsigned order, struct radix_tree_node **nodep,
+			void ***slotp);
+int __radix_tree_insert(struct radix_tree_root *, unsigned long index,
+			unsigned order, void *);
+static inline int radix_tree_insert(struct radix_tree_root *root,
+			unsigned long index, void *entry)
+{
+	return __radix_tree_insert(root, index, 0, entry);
+}
 void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
 			  struct radix_tree_node **nodep, void ***slotp);
 void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
@@ -312,6 +339,7 @@ static inline void radix_tree_preload_end(void)
  * @index:	index of current slot
  * @next_index:	next-to-last index for this chunk
  * @tags:	bit-mask for tag-iterating
+ * @shift:	log2 of the number of indices covered by each slot of the chunk
  *
  * This radix tree iterator works in terms of "chunks" of slots.  A chunk is a
  * subinterval of slots contained within one radix tree leaf node.  It is
@@ -319,11 +347,17 @@ static inline void radix_tree_preload_end(void)
  * which holds the chunk's position in the tree and its size.  For tagged
  * iteration radix_tree_iter also holds the slots' bit-mask for one chosen
  * radix tree tag.
+ *
+ * A multi-order entry stored above the leaf level forms a chunk of its own,
+ * with @shift set to the level it lives at.  Multi-order entries are
+ * returned once, at their first index; radix_tree_iter_span() tells how
+ * many indices the current one covers.
  */
 struct radix_tree_iter {
 	unsigned long	index;
 	unsigned long	next_index;
 	unsigned long	tags;
+	unsigned int	shift;
 };
 
 #define RADIX_TREE_ITER_TAG_MASK	0x00FF	/* tag index in lower byte */
@@ -394,7 +428,33 @@ void **radix_tree_iter_retry(struct radix_tree_iter *iter)
 static __always_inline long
 radix_tree_chunk_size(struct radix_tree_iter *iter)
 {
-	return iter->next_index - iter->index;
+	return (iter->next_index - iter->index) >> iter->shift;
+}
+
+/**
+ * radix_tree_iter_span - get number of indices covered by current slot
+ *
+ * @slot:	pointer to current slot
+ * @iter:	pointer to radix tree iterator
+ * Returns:	size of the run of indices starting at @iter->index which the
+ *		entry in @slot covers, 1 for plain entries
+ */
+static inline unsigned long
+radix_tree_iter_span(void **slot, struct radix_tree_iter *iter)
+{
+	unsigned long offset = (iter->index >> iter->shift) &
+				RADIX_TREE_MAP_MASK;
+	unsigned long n = 1;
+
+	/* The single-slot tree chunk is root->rnode, not part of a node */
+	if (iter->next_index == 1)
+		return 1;
+
+	while (offset + n < RADIX_TREE_MAP_SIZE &&
+	       radix_tree_is_sibling(slot + n, rcu_dereference_raw(slot[n])))
+		n++;
+
+	return n << iter->shift;
 }
 
 /**
@@ -429,7 +489,10 @@ radix_tree_next_slot(void **slot, struct radix_tree_iter *iter, unsigned flags)
 
 		while (--size > 0) {
 			slot++;
-			iter->index++;
+			iter->index += 1UL << iter->shift;
+			/* tail of a multi-order entry, already returned */
+			if (unlikely(radix_tree_is_sibling(slot, *slot)))
+				continue;
 			if (likely(*slot))
 				return slot;
 			if (flags & RADIX_TREE_ITER_CONTIG) {
@@ -55,6 +55,7 @@ struct rhash_head {
 /**
  * struct bucket_table - Table of hash buckets
  * @size: Number of hash buckets
+ * @nest: Number of bits of first-level nested table, zero for a flat table
  * @rehash: Current bucket being rehashed
  * @hash_rnd: Random seed to fold into hash
  * @locks_mask: Mask to apply before accessing locks[]
@@ -62,10 +63,19 @@ struct rhash_head {
  * @walkers: List of active walkers
  * @rcu: RCU structure for freeing the table
  * @future_tbl: Table under construction during rehashing
- * @buckets: size * hash buckets
+ * @buckets: size * hash buckets, or the first-level nested table if @nest
+ *
+ * Tables too large for a single allocation are built out of page sized
+ * pieces instead: buckets[0] then points to a page of pointers indexed by
+ * the low @nest bits of the hash, each of which leads (possibly through
+ * further pages of pointers) to a page of buckets.  Pages are allocated
+ * up front when the table is created from process context and on demand
+ * by rht_bucket_insert() otherwise.  Use the rht_bucket*() helpers rather
+ * than indexing @buckets directly.
  */
 struct bucket_table {
 	unsigned int		size;
+	unsigned int		nest;
 	unsigned int		rehash;
 	u32			hash_rnd;
 	unsigned int		locks_mask;
@@ -336,6 +346,60 @@ static inline int lockdep_rht_bucket_is_held(const struct bucket_table *tbl,
 }
 #endif /* CONFIG_PROVE_LOCKING */
 
+struct rhash_head __rcu **rht_bucket_nested(const struct bucket_table *tbl,
+					    unsigned int hash);
+struct rhash_head __rcu **rht_bucket_nested_insert(struct rhashtable *ht,
+						   struct bucket_table *tbl,
+						   unsigned int hash);
+
+/**
+ * rht_bucket - return the head of a hash chain for reading
+ * @tbl:	the &struct bucket_table
+ * @hash:	the hash value / bucket index
+ *
+ * For a nested table whose page for @hash has not been allocated yet
+ * this returns a pointer to a shared, always empty chain which must not
+ * be written to.
+ */
+static inline struct rhash_head __rcu *const *rht_bucket(
+	const struct bucket_table *tbl, unsigned int hash)
+{
+	return unlikely(tbl->nest) ? rht_bucket_nested(tbl, hash) :
+				     &tbl->buckets[hash];
+}
+
+/**
+ * rht_bucket_var - return the head of a hash chain for unlinking entries
+ * @tbl:	the &struct bucket_table
+ * @hash:	the hash value / bucket index
+ *
+ * Like rht_bucket(), the result may only be written through if the chain
+ * is known to be non-empty.
+ */
+static inline struct rhash_head __rcu **rht_bucket_var(
+	struct bucket_table *tbl, unsigned int hash)
+{
+	return unlikely(tbl->nest) ? rht_bucket_nested(tbl, hash) :
+				     &tbl->buckets[hash];
+}
+
+/**
+ * rht_bucket_insert - return the head of a hash chain for insertion
+ * @ht:		hash table
+ * @tbl:	the &struct bucket_table
+ * @hash:	the hash value / bucket index
+ *
+ * Allocates any missing pages of a nested table atomically.  Returns NULL
+ * if that fails, in which case the deferred worker is kicked to fill in
+ * the table from process context.
+ */
+static inline struct rhash_head __rcu **rht_bucket_insert(
+	struct rhashtable *ht, struct bucket_table *tbl, unsigned int hash)
+{
+	return unlikely(tbl->nest) ? rht_bucket_nested_insert(ht, tbl, hash) :
+				     &tbl->buckets[hash];
+}
+
 int rhashtable_init(struct rhashtable *ht,
 		    const struct rhashtable_params *params);
 
@@ -389,7 +453,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * @hash:	the hash value / bucket index
  */
 #define rht_for_each(pos, tbl, hash) \
-	rht_for_each_continue(pos, (tbl)->buckets[hash], tbl, hash)
+	rht_for_each_continue(pos, *rht_bucket(tbl, hash), tbl, hash)
 
 /**
  * rht_for_each_entry_continue - continue iterating over hash chain
@@ -414,7 +478,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * @member:	name of the &struct rhash_head within the hashable struct.
  */
 #define rht_for_each_entry(tpos, pos, tbl, hash, member)		\
-	rht_for_each_entry_continue(tpos, pos, (tbl)->buckets[hash],	\
+	rht_for_each_entry_continue(tpos, pos, *rht_bucket(tbl, hash),	\
 				    tbl, hash, member)
 
 /**
@@ -430,7 +494,8 @@ void rhashtable_destroy(struct rhashtable *ht);
  * remove the loop cursor from the list.
  */
 #define rht_for_each_entry_safe(tpos, pos, next, tbl, hash, member)	    \
-	for (pos = rht_dereference_bucket((tbl)->buckets[hash], tbl, hash), \
+	for (pos = rht_dereference_bucket(*rht_bucket(tbl, hash),	    \
+					  tbl, hash),			    \
 	     next = !rht_is_a_nulls(pos) ?				    \
 		       rht_dereference_bucket(pos->next, tbl, hash) : NULL; \
 	     (!rht_is_a_nulls(pos)) && rht_entry(tpos, pos, member);	    \
@@ -466,7 +531,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * traversal is guarded by rcu_read_lock().
  */
 #define rht_for_each_rcu(pos, tbl, hash)				\
-	rht_for_each_rcu_continue(pos, (tbl)->buckets[hash], tbl, hash)
+	rht_for_each_rcu_continue(pos, *rht_bucket(tbl, hash), tbl, hash)
 
 /**
  * rht_for_each_entry_rcu_continue - continue iterating over rcu hash chain
@@ -500,7 +565,7 @@ void rhashtable_destroy(struct rhashtable *ht);
  * traversal is guarded by rcu_read_lock().
  */
 #define rht_for_each_entry_rcu(tpos, pos, tbl, hash, member)		\
-	rht_for_each_entry_rcu_continue(tpos, pos, (tbl)->buckets[hash],\
+	rht_for_each_entry_rcu_continue(tpos, pos, *rht_bucket(tbl, hash),\
 					tbl, hash, member)
 
 static inline int rhashtable_compare(struct rhashtable_compare_arg *arg,
@@ -570,6 +635,7 @@ static inline int __rhashtable_insert_fast(
 		.key = key,
 	};
 	struct bucket_table *tbl, *new_tbl;
+	struct rhash_head __rcu **pprev;
 	struct rhash_head *head;
 	spinlock_t *lock;
 	unsigned int elasticity;
@@ -631,13 +697,18 @@ slow_path:
 			goto slow_path;
 	}
 
+	err = -ENOMEM;
+	pprev = rht_bucket_insert(ht, tbl, hash);
+	if (unlikely(!pprev))
+		goto out;
+
 	err = 0;
 
-	head = rht_dereference_bucket(tbl->buckets[hash], tbl, hash);
+	head = rht_dereference_bucket(*pprev, tbl, hash);
 
 	RCU_INIT_POINTER(obj->next, head);
 
-	rcu_assign_pointer(tbl->buckets[hash], obj);
+	rcu_assign_pointer(*pprev, obj);
 
 	atomic_inc(&ht->nelems);
 	if (rht_grow_above_75(ht, tbl))
@@ -753,7 +824,7 @@ static inline int __rhashtable_remove_fast(
 
 	spin_lock_bh(lock);
 
-	pprev = &tbl->buckets[hash];
+	pprev = rht_bucket_var(tbl, hash);
 	rht_for_each(he, tbl, hash) {
 		if (he != obj) {
 			pprev = &he->next;
@@ -89,6 +89,10 @@ enum ttu_flags {
 	TTU_IGNORE_MLOCK = (1 << 8),	/* ignore mlock */
 	TTU_IGNORE_ACCESS = (1 << 9),	/* don't age */
 	TTU_IGNORE_HWPOISON = (1 << 10),/* corrupted page is recoverable */
+	TTU_BATCH_FLUSH = (1 << 11),	/* Batch TLB flushes where possible
+					 * and caller guarantees they will
+					 * do a final flush if necessary */
+	TTU_LZFREE = (1 << 12),		/* discard clean MADV_FREE pages */
 };
 
 #ifdef CONFIG_MMU
@@ -171,6 +175,16 @@ static inline void page_dup_rmap(struct page *page)
 int page_referenced(struct page *, int is_locked,
 			struct mem_cgroup *memcg, unsigned long *vm_flags);
 
+#ifdef CONFIG_LRU_GEN
+void lru_gen_look_around(struct vm_area_struct *vma, pte_t *pte,
+			 unsigned long address);
+#else
+static inline void lru_gen_look_around(struct vm_area_struct *vma,
+				       pte_t *pte, unsigned long address)
+{
+}
+#endif
+
 #define TTU_ACTION(x) ((x) & TTU_ACTION_MASK)
 
 int try_to_unmap(struct page *, enum ttu_flags flags);
@@ -28,11 +28,14 @@ struct rw_semaphore {
 	long count;
 	struct list_head wait_list;
 	raw_spinlock_t wait_lock;
+	/* A waiter waited too long, the lock must not be stolen from it */
+	bool handoff;
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
 	struct optimistic_spin_queue osq; /* spinner MCS lock */
 	/*
-	 * Write owner. Used as a speculative check to see
-	 * if the owner is running on the cpu.
+	 * Write owner, or a marker for the lock being held by readers.
+	 * Used as a speculative check to see if the owner is running on
+	 * the cpu.
 	 */
 	struct task_struct *owner;
 #endif
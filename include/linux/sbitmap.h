@@ -0,0 +1,203 @@
+/*
+ * Fast and scalable bitmaps.
+ *
+ * A sbitmap spreads its bits over multiple words, each in its own
+ * cacheline, so that concurrent users tend to work on different
+ * cachelines until the map fills up.  A sbitmap_queue adds per-cpu
+ * allocation hints and a set of wait queues with batched wakeups on
+ * top, for users that sleep waiting for a free bit, such as tag
+ * allocation.
+ */
+#ifndef __LINUX_SCALE_BITMAP_H
+#define __LINUX_SCALE_BITMAP_H
+
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+
+/**
+ * struct sbitmap_word - Word in a &struct sbitmap.
+ * @word:	bits of this word, set == busy
+ * @depth:	number of bits of @word in use
+ */
+struct sbitmap_word {
+	unsigned long word;
+	unsigned long depth;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * struct sbitmap - Scalable bitmap.
+ * @depth:	number of bits in use, may be less than allocated
+ * @shift:	log2 of the number of bits per word
+ * @map_nr:	number of words
+ * @map:	the words
+ */
+struct sbitmap {
+	unsigned int depth;
+	unsigned int shift;
+	unsigned int map_nr;
+	struct sbitmap_word *map;
+};
+
+#define SB_NR_TO_INDEX(sb, bitnr)	((bitnr) >> (sb)->shift)
+#define SB_NR_TO_BIT(sb, bitnr)		((bitnr) & ((1U << (sb)->shift) - 1U))
+
+int sbitmap_init_node(struct sbitmap *sb, unsigned int depth, int shift,
+		      gfp_t flags, int node);
+void sbitmap_resize(struct sbitmap *sb, unsigned int depth);
+int sbitmap_get(struct sbitmap *sb, unsigned int alloc_hint, bool round_robin);
+bool sbitmap_any_bit_set(const struct sbitmap *sb);
+bool sbitmap_any_bit_clear(const struct sbitmap *sb);
+unsigned int sbitmap_weight(const struct sbitmap *sb);
+
+static inline void sbitmap_free(struct sbitmap *sb)
+{
+	kfree(sb->map);
+	sb->map = NULL;
+}
+
+static inline unsigned long *__sbitmap_word(struct sbitmap *sb,
+					    unsigned int bitnr)
+{
+	return &sb->map[SB_NR_TO_INDEX(sb, bitnr)].word;
+}
+
+static inline void sbitmap_set_bit(struct sbitmap *sb, unsigned int bitnr)
+{
+	set_bit(SB_NR_TO_BIT(sb, bitnr), __sbitmap_word(sb, bitnr));
+}
+
+static inline void sbitmap_clear_bit(struct sbitmap *sb, unsigned int bitnr)
+{
+	clear_bit(SB_NR_TO_BIT(sb, bitnr), __sbitmap_word(sb, bitnr));
+}
+
+static inline int sbitmap_test_bit(struct sbitmap *sb, unsigned int bitnr)
+{
+	return test_bit(SB_NR_TO_BIT(sb, bitnr), __sbitmap_word(sb, bitnr));
+}
+
+typedef bool (*sb_for_each_fn)(struct sbitmap *, unsigned int, void *);
+
+/*
+ * Call @fn for each set bit of @sb, stopping early if it returns false.
+ */
+static inline void sbitmap_for_each_set(struct sbitmap *sb, sb_for_each_fn fn,
+					void *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < sb->map_nr; i++) {
+		struct sbitmap_word *word = &sb->map[i];
+		unsigned int off, nr;
+
+		if (!word->word)
+			continue;
+
+		nr = 0;
+		off = i << sb->shift;
+		while (1) {
+			nr = find_next_bit(&word->word, word->depth, nr);
+			if (nr >= word->depth)
+				break;
+
+			if (!fn(sb, off + nr, data))
+				return;
+
+			nr++;
+		}
+	}
+}
+
+#define SBQ_WAIT_QUEUES 8
+#define SBQ_WAKE_BATCH 8
+
+/**
+ * struct sbq_wait_state - Wait queue in a &struct sbitmap_queue.
+ * @wait_cnt:	frees left before the next wakeup on this queue
+ * @wait:	the waiters
+ */
+struct sbq_wait_state {
+	atomic_t wait_cnt;
+	wait_queue_head_t wait;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * struct sbitmap_queue - Scalable bitmap with waiters.
+ * @sb:		the bitmap
+ * @alloc_hint:	per-cpu bit to start searching from
+ * @wake_batch:	number of frees between wakeups of one wait queue
+ * @wake_index:	next wait queue in @ws to wake
+ * @ws:		SBQ_WAIT_QUEUES wait queues, used round robin
+ * @round_robin: allocate bits strictly round robin instead of reusing
+ *		the most recently freed ones
+ */
+struct sbitmap_queue {
+	struct sbitmap sb;
+	unsigned int __percpu *alloc_hint;
+	unsigned int wake_batch;
+	atomic_t wake_index;
+	struct sbq_wait_state *ws;
+	bool round_robin;
+};
+
+int sbitmap_queue_init_node(struct sbitmap_queue *sbq, unsigned int depth,
+			    int shift, bool round_robin, gfp_t flags, int node);
+void sbitmap_queue_resize(struct sbitmap_queue *sbq, unsigned int depth);
+int __sbitmap_queue_get(struct sbitmap_queue *sbq);
+void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
+			 unsigned int cpu);
+void sbitmap_queue_wake_all(struct sbitmap_queue *sbq);
+
+static inline void sbitmap_queue_free(struct sbitmap_queue *sbq)
+{
+	kfree(sbq->ws);
+	free_percpu(sbq->alloc_hint);
+	sbitmap_free(&sbq->sb);
+}
+
+/*
+ * Like __sbitmap_queue_get(), but takes care of preemption itself.
+ */
+static inline int sbitmap_queue_get(struct sbitmap_queue *sbq,
+				    unsigned int *cpu)
+{
+	int nr;
+
+	*cpu = get_cpu();
+	nr = __sbitmap_queue_get(sbq);
+	put_cpu();
+	return nr;
+}
+
+static inline int sbq_index_inc(int index)
+{
+	return (index + 1) & (SBQ_WAIT_QUEUES - 1);
+}
+
+static inline void sbq_index_atomic_inc(atomic_t *index)
+{
+	int old = atomic_read(index);
+	int new = sbq_index_inc(old);
+	atomic_cmpxchg(index, old, new);
+}
+
+/*
+ * Pick the wait queue to sleep on, advancing the caller's @wait_index so
+ * that consecutive sleepers spread over all queues.
+ */
+static inline struct sbq_wait_state *sbq_wait_ptr(struct sbitmap_queue *sbq,
+						  atomic_t *wait_index)
+{
+	struct sbq_wait_state *ws;
+
+	ws = &sbq->ws[atomic_read(wait_index)];
+	sbq_index_atomic_inc(wait_index);
+	return ws;
+}
+
+#endif /* __LINUX_SCALE_BITMAP_H */
@@ -21,6 +21,7 @@ struct sem_array {
 	struct list_head	list_id;	/* undo requests on this array */
 	int			sem_nsems;	/* no. of semaphores in array */
 	int			complex_count;	/* pending complex operations */
+	int			use_global_lock;/* >0: global lock required */
 };
 
 #ifdef CONFIG_SYSVIPC
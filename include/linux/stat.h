@@ -19,6 +19,9 @@
 #include <linux/uidgid.h>
 
 struct kstat {
+	u32		result_mask;	/* What fields the user got */
+	u32		request_mask;	/* What fields the caller asked for */
+	unsigned int	query_flags;	/* AT_STATX_* sync flags */
 	u64		ino;
 	dev_t		dev;
 	umode_t		mode;
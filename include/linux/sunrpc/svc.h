@@ -17,6 +17,7 @@
 #include <linux/sunrpc/auth.h>
 #include <linux/sunrpc/svcauth.h>
 #include <linux/wait.h>
+#include <linux/llist.h>
 #include <linux/mm.h>
 
 /*
@@ -27,7 +28,7 @@ typedef int		(*svc_thread_fn)(void *);
 /* statistics for svc_pool structures */
 struct svc_pool_stats {
 	atomic_long_t	packets;
-	unsigned long	sockets_queued;
+	atomic_long_t	sockets_queued;
 	atomic_long_t	threads_woken;
 	atomic_long_t	threads_timedout;
 };
@@ -45,13 +46,20 @@ struct svc_pool_stats {
 struct svc_pool {
 	unsigned int		sp_id;	    	/* pool id; also node id on NUMA */
 	spinlock_t		sp_lock;	/* protects all fields */
+	struct llist_head	sp_new_sockets;	/* sockets queued without
+						 * sp_lock, not yet sorted
+						 * into sp_sockets */
 	struct list_head	sp_sockets;	/* pending sockets */
 	unsigned int		sp_nrthreads;	/* # of threads in pool */
 	unsigned int		sp_tmpthreads;	/* # of tmp threads in pool */
+	unsigned int		sp_dynthreads;	/* # of tmp threads started
+						 * for queue pressure */
 	struct list_head	sp_all_threads;	/* all server threads */
 	struct svc_pool_stats	sp_stats;	/* statistics on pool operation */
 #define	SP_TASK_PENDING		(0)		/* still work to do even if no
 						 * xprt is queued. */
+#define	SP_NEED_THREAD		(1)		/* xprts queued up with no idle
+						 * thread to take them */
 	unsigned long		sp_flags;
 	atomic_t		sp_need_rescue;	/* # of queued xprts that
 						 * might need rescuing */
@@ -90,6 +98,9 @@ struct svc_serv {
 	unsigned int		sv_nrpools;	/* number of thread pools */
 	struct svc_pool *	sv_pools;	/* array of thread pools */
 	struct task_struct	*sv_pool_mgr;	/* pool manager thread */
+	unsigned int		sv_max_dynthreads; /* max # of threads the pool
+						 * manager adds to a pool under
+						 * queue pressure */
 
 	void			(*sv_shutdown)(struct svc_serv *serv,
 					       struct net *net);
@@ -274,6 +285,8 @@ struct svc_rqst {
 #define	RQ_BUSY		(6)			/* request is busy */
 #define	RQ_DATA		(7)			/* request has data */
 #define	RQ_RESCUE	(8)			/* Rescue thread */
+#define	RQ_DYNAMIC	(9)			/* started for queue pressure,
+						 * exits once idle */
 	unsigned long		rq_flags;	/* flags field */
 
 	void *			rq_argp;	/* decoded arguments */
@@ -22,6 +22,7 @@ struct itimerval;
 struct kexec_segment;
 struct linux_dirent;
 struct linux_dirent64;
+struct linux_dirent_attr;
 struct list_head;
 struct mmap_arg_struct;
 struct msgbuf;
@@ -36,6 +37,7 @@ struct old_utsname;
 struct pollfd;
 struct rlimit;
 struct rlimit64;
+struct rseq;
 struct rusage;
 struct sched_param;
 struct sched_attr;
@@ -46,6 +48,7 @@ struct shmid_ds;
 struct sockaddr;
 struct stat;
 struct stat64;
+struct statx;
 struct statfs;
 struct statfs64;
 struct __sysctl_args;
@@ -507,10 +510,20 @@ asmlinkage long sys_io_submit(aio_context_t, long,
 				struct iocb __user * __user *);
 asmlinkage long sys_io_cancel(aio_context_t ctx_id, struct iocb __user *iocb,
 			      struct io_event __user *result);
+asmlinkage long sys_io_setup2(unsigned nr_reqs, unsigned flags,
+			      aio_context_t __user *ctx);
+asmlinkage long sys_io_ring_enter(aio_context_t ctx_id, unsigned to_submit,
+				  unsigned min_complete, unsigned flags);
+asmlinkage long sys_userfaultfd(int flags);
+asmlinkage long sys_rseq(struct rseq __user *rseq, u32 rseq_len,
+			 int flags, u32 sig);
 asmlinkage long sys_sendfile(int out_fd, int in_fd,
 			     off_t __user *offset, size_t count);
 asmlinkage long sys_sendfile64(int out_fd, int in_fd,
 			       loff_t __user *offset, size_t count);
+asmlinkage long sys_copy_file_range(int fd_in, loff_t __user *off_in,
+				    int fd_out, loff_t __user *off_out,
+				    size_t len, unsigned int flags);
 asmlinkage long sys_readlink(const char __user *path,
 				char __user *buf, int bufsiz);
 asmlinkage long sys_creat(const char __user *pathname, umode_t mode);
@@ -577,6 +590,12 @@ asmlinkage long sys_preadv(unsigned long fd, const struct iovec __user *vec,
 			   unsigned long vlen, unsigned long pos_l, unsigned long pos_h);
 asmlinkage long sys_pwritev(unsigned long fd, const struct iovec __user *vec,
 			    unsigned long vlen, unsigned long pos_l, unsigned long pos_h);
+asmlinkage long sys_preadv2(unsigned long fd, const struct iovec __user *vec,
+			    unsigned long vlen, unsigned long pos_l, unsigned long pos_h,
+			    int flags);
+asmlinkage long sys_pwritev2(unsigned long fd, const struct iovec __user *vec,
+			    unsigned long vlen, unsigned long pos_l, unsigned long pos_h,
+			    int flags);
 asmlinkage long sys_getcwd(char __user *buf, unsigned long size);
 asmlinkage long sys_mkdir(const char __user *pathname, umode_t mode);
 asmlinkage long sys_chdir(const char __user *filename);
@@ -591,6 +610,10 @@ asmlinkage long sys_getdents(unsigned int fd,
 asmlinkage long sys_getdents64(unsigned int fd,
 				struct linux_dirent64 __user *dirent,
 				unsigned int count);
+asmlinkage long sys_getdents_attr(unsigned int fd,
+				struct linux_dirent_attr __user *dirent,
+				unsigned int count, unsigned int mask,
+				unsigned int flags);
 
 asmlinkage long sys_setsockopt(int fd, int level, int optname,
 				char __user *optval, int optlen);
@@ -773,6 +796,8 @@ asmlinkage long sys_fchownat(int dfd, const char __user *filename, uid_t user,
 			     gid_t group, int flag);
 asmlinkage long sys_openat(int dfd, const char __user *filename, int flags,
 			   umode_t mode);
+asmlinkage long sys_statx(int dfd, const char __user *filename, unsigned flags,
+			  unsigned mask, struct statx __user *buffer);
 asmlinkage long sys_newfstatat(int dfd, const char __user *filename,
 			       struct stat __user *statbuf, int flag);
 asmlinkage long sys_readlinkat(int dfd, const char __user *path, char __user *buf,
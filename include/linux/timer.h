@@ -22,6 +22,7 @@ struct timer_list {
 	unsigned long data;
 
 	int slack;
+	unsigned int idx;	/* wheel bucket of a pending timer */
 
 #ifdef CONFIG_TIMER_STATS
 	int start_pid;
@@ -193,6 +194,7 @@ extern void set_timer_slack(struct timer_list *time, int slack_hz);
  * jiffie.
  */
 extern unsigned long get_next_timer_interrupt(unsigned long now);
+extern void timer_clear_idle(void);
 
 /*
  * Timer-statistics info:
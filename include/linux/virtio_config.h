@@ -56,6 +56,8 @@
  *      This returns a pointer to the bus name a la pci_name from which
  *      the caller can then copy.
  * @set_vq_affinity: set the affinity for a virtqueue.
+ * @set_vq_affinity_mask: set the affinity for a virtqueue to a set of cpus,
+ *	or clear it if mask is NULL.
  */
 typedef void vq_callback_t(struct virtqueue *);
 struct virtio_config_ops {
@@ -76,6 +78,8 @@ struct virtio_config_ops {
 	int (*finalize_features)(struct virtio_device *vdev);
 	const char *(*bus_name)(struct virtio_device *vdev);
 	int (*set_vq_affinity)(struct virtqueue *vq, int cpu);
+	int (*set_vq_affinity_mask)(struct virtqueue *vq,
+				    const struct cpumask *mask);
 };
 
 /* If driver didn't advertise the feature, it will never appear. */
@@ -205,6 +209,23 @@ int virtqueue_set_affinity(struct virtqueue *vq, int cpu)
 	return 0;
 }
 
+/**
+ * virtqueue_set_affinity_mask - setting affinity for a virtqueue to a cpumask
+ * @vq: the virtqueue
+ * @mask: the cpus to deliver the interrupt to, or NULL to clear the affinity
+ *
+ * Like virtqueue_set_affinity(), this is best-effort.
+ */
+static inline
+int virtqueue_set_affinity_mask(struct virtqueue *vq,
+				const struct cpumask *mask)
+{
+	struct virtio_device *vdev = vq->vdev;
+	if (vdev->config->set_vq_affinity_mask)
+		return vdev->config->set_vq_affinity_mask(vq, mask);
+	return 0;
+}
+
 /* Memory accessors */
 static inline u16 virtio16_to_cpu(struct virtio_device *vdev, __virtio16 val)
 {
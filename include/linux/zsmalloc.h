@@ -15,6 +15,7 @@
 #define _ZS_MALLOC_H_
 
 #include <linux/types.h>
+#include <linux/errno.h>
 
 /*
  * zsmalloc mapping modes
@@ -49,4 +50,26 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
 unsigned long zs_get_total_pages(struct zs_pool *pool);
 unsigned long zs_compact(struct zs_pool *pool);
 
+struct page;
+
+#ifdef CONFIG_ZSMALLOC_MIGRATION
+bool zs_page_isolate(struct page *page);
+int zs_page_migrate(struct page *newpage, struct page *page);
+void zs_page_putback(struct page *page);
+#else
+static inline bool zs_page_isolate(struct page *page)
+{
+	return false;
+}
+
+static inline int zs_page_migrate(struct page *newpage, struct page *page)
+{
+	return -EAGAIN;
+}
+
+static inline void zs_page_putback(struct page *page)
+{
+}
+#endif
+
 #endif
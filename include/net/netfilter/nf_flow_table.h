@@ -0,0 +1,83 @@
+#ifndef _NF_FLOW_TABLE_H
+#define _NF_FLOW_TABLE_H
+
+#include <linux/in.h>
+#include <linux/netdevice.h>
+#include <linux/rhashtable.h>
+#include <linux/rcupdate.h>
+#include <net/dst.h>
+#include <net/netfilter/nf_conntrack.h>
+
+/*
+ * Software fast path for established conntrack entries: the nft
+ * "flow_offload" expression enters a forwarded connection into the flow
+ * table of its netns, and the ingress side of each family looks packets
+ * up in it and forwards them with the cached route and NAT mapping,
+ * without going through conntrack, routing and the forward chain again.
+ */
+
+struct flow_offload_tuple {
+	__be32			src_v4;
+	__be32			dst_v4;
+	__be16			src_port;
+	__be16			dst_port;
+	int			iifidx;
+	u8			l4proto;
+
+	/* All members above are the lookup key, keep them first */
+	u8			dir;
+	u16			mtu;
+	int			oifidx;
+	struct dst_entry	*dst_cache;
+};
+
+struct flow_offload_tuple_rhash {
+	struct rhash_head		node;
+	struct flow_offload_tuple	tuple;
+};
+
+#define FLOW_OFFLOAD_SNAT	0x1
+#define FLOW_OFFLOAD_DNAT	0x2
+#define FLOW_OFFLOAD_TEARDOWN	0x4
+
+struct flow_offload {
+	struct flow_offload_tuple_rhash	tuplehash[IP_CT_DIR_MAX];
+	struct nf_conn			*ct;
+	u32				flags;
+	u32				timeout;
+	struct rcu_head			rcu_head;
+};
+
+/* How long a flow stays in the table without seeing a packet */
+#define NF_FLOW_TIMEOUT (30 * HZ)
+
+struct flow_offload *flow_offload_alloc(struct nf_conn *ct,
+					struct dst_entry *route[IP_CT_DIR_MAX]);
+void flow_offload_free(struct flow_offload *flow);
+
+int flow_offload_add(struct net *net, struct flow_offload *flow);
+struct flow_offload_tuple_rhash *
+flow_offload_lookup(struct net *net, const struct flow_offload_tuple *tuple);
+
+/* Hand the connection back to the slow path, the flow is removed from the
+ * table on the next garbage collection run.
+ */
+static inline void flow_offload_teardown(struct flow_offload *flow)
+{
+	flow->flags |= FLOW_OFFLOAD_TEARDOWN;
+}
+
+/* Packets of an offloaded flow do not reach conntrack: keep the entry from
+ * expiring under the flow, it gets its own timeout back once the flow is
+ * torn down or idles out.
+ */
+static inline void flow_offload_refresh(struct flow_offload *flow)
+{
+	struct nf_conn *ct = flow->ct;
+
+	WRITE_ONCE(flow->timeout, nfct_time_stamp + NF_FLOW_TIMEOUT);
+	if (nf_ct_expires(ct) < NF_FLOW_TIMEOUT)
+		WRITE_ONCE(ct->timeout, nfct_time_stamp + NF_FLOW_TIMEOUT);
+}
+
+#endif /* _NF_FLOW_TABLE_H */
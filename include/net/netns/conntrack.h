@@ -96,6 +96,7 @@ struct netns_ct {
 
 	unsigned int		htable_size;
 	seqcount_t		generation;
+	unsigned int		gc_next_bucket;
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
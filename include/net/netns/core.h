@@ -3,6 +3,7 @@
 
 struct ctl_table_header;
 struct prot_inuse;
+struct rps_sock_flow_table;
 
 struct netns_core {
 	/* core sysctls */
@@ -11,6 +12,10 @@ struct netns_core {
 	int	sysctl_somaxconn;
 
 	struct prot_inuse __percpu *inuse;
+#ifdef CONFIG_RPS
+	/* NULL: the netns shares the global table */
+	struct rps_sock_flow_table __rcu *rps_sock_flow_table;
+#endif
 };
 
 #endif
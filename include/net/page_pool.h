@@ -0,0 +1,161 @@
+/*
+ * page_pool.h - recycling allocator for network RX pages
+ *
+ * A page_pool hands out order-N pages to a single RX ring and keeps the
+ * pages it gets back, optionally still DMA mapped, so that a driver no
+ * longer pays for the page allocator and an IOMMU map/unmap per packet.
+ *
+ * Allocation and direct recycling (page_pool_recycle_direct()) are only
+ * allowed from the NAPI context that owns the ring.  Pages coming back
+ * from elsewhere, e.g. when an skb marked with skb_mark_for_recycle() is
+ * freed on another CPU, go through a locked ring that the allocation side
+ * drains when its own cache runs empty.
+ *
+ * Recycled pages are handed out as they were returned: a driver that lets
+ * the pool map its pages must still dma_sync_single_range_for_device()
+ * the part of the page the device may have dirtied in the CPU cache.
+ */
+#ifndef _NET_PAGE_POOL_H
+#define _NET_PAGE_POOL_H
+
+#include <linux/dma-direction.h>
+#include <linux/kfifo.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#define PP_FLAG_DMA_MAP	1	/* Should page_pool do the DMA map/unmap */
+#define PP_FLAG_ALL	PP_FLAG_DMA_MAP
+
+/* Pages cached for the NAPI side, refilled from the ring in batches */
+#define PP_ALLOC_CACHE_SIZE	128
+#define PP_ALLOC_CACHE_REFILL	64
+
+struct pp_alloc_cache {
+	u32 count;
+	struct page *cache[PP_ALLOC_CACHE_SIZE];
+};
+
+/**
+ * struct page_pool_params - page_pool configuration
+ * @flags:	PP_FLAG_*
+ * @order:	order of the pages handed out
+ * @pool_size:	number of pages the recycle ring holds, usually the RX
+ *		ring size
+ * @nid:	NUMA node to allocate from, NUMA_NO_NODE for the local one
+ * @dev:	device the pages are DMA mapped for, with PP_FLAG_DMA_MAP
+ * @dma_dir:	DMA mapping direction, with PP_FLAG_DMA_MAP
+ */
+struct page_pool_params {
+	unsigned int	flags;
+	unsigned int	order;
+	unsigned int	pool_size;
+	int		nid;
+	struct device	*dev;
+	enum dma_data_direction dma_dir;
+};
+
+/**
+ * struct page_pool_alloc_stats - allocation side statistics
+ * @fast:	pages served from the alloc cache
+ * @slow:	pages allocated and mapped from the page allocator
+ * @empty:	times the ring was empty on a cache refill
+ * @refill:	successful cache refills from the ring
+ * @waive:	pages from the ring released for being on a remote node
+ */
+struct page_pool_alloc_stats {
+	u64 fast;
+	u64 slow;
+	u64 empty;
+	u64 refill;
+	u64 waive;
+};
+
+/**
+ * struct page_pool_recycle_stats - recycle side statistics
+ * @cached:	pages recycled directly into the alloc cache
+ * @cache_full:	direct recycles that found the alloc cache full
+ * @ring:	pages recycled into the ring
+ * @ring_full:	pages released because the ring was full
+ * @released_refcnt: pages released because someone else still held them
+ */
+struct page_pool_recycle_stats {
+	u64 cached;
+	u64 cache_full;
+	u64 ring;
+	u64 ring_full;
+	u64 released_refcnt;
+};
+
+struct page_pool_stats {
+	struct page_pool_alloc_stats alloc_stats;
+	struct page_pool_recycle_stats recycle_stats;
+};
+
+struct page_pool {
+	struct page_pool_params p;
+
+	struct delayed_work release_dw;
+	unsigned long defer_start;
+	unsigned long defer_warn;
+
+	/* Only touched by the NAPI side of the pool */
+	u32 pages_state_hold_cnt;
+	struct page_pool_alloc_stats alloc_stats;
+	struct pp_alloc_cache alloc ____cacheline_aligned_in_smp;
+
+	/* Producers serialize on ring_lock, the NAPI side consumes without
+	 * it: that is all the locking kfifo needs.
+	 */
+	spinlock_t ring_lock ____cacheline_aligned_in_smp;
+	DECLARE_KFIFO_PTR(ring, struct page *);
+
+	struct page_pool_recycle_stats __percpu *recycle_stats;
+	atomic_t pages_state_release_cnt;
+};
+
+struct page_pool *page_pool_create(const struct page_pool_params *params);
+void page_pool_destroy(struct page_pool *pool);
+
+struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp);
+
+static inline struct page *page_pool_dev_alloc_pages(struct page_pool *pool)
+{
+	gfp_t gfp = (GFP_ATOMIC | __GFP_NOWARN | __GFP_COLD);
+
+	return page_pool_alloc_pages(pool, gfp);
+}
+
+void page_pool_put_page(struct page_pool *pool, struct page *page,
+			bool allow_direct);
+
+/* Only from the NAPI context that allocates from @pool */
+static inline void page_pool_recycle_direct(struct page_pool *pool,
+					    struct page *page)
+{
+	page_pool_put_page(pool, page, true);
+}
+
+/* Disconnect @page from @pool, e.g. before handing it to the stack in an
+ * skb that is not marked for recycling.  The caller keeps its reference.
+ */
+void page_pool_release_page(struct page_pool *pool, struct page *page);
+
+static inline dma_addr_t page_pool_get_dma_addr(struct page *page)
+{
+	return page->private;
+}
+
+bool page_pool_get_stats(struct page_pool *pool,
+			 struct page_pool_stats *stats);
+
+#ifdef CONFIG_PAGE_POOL
+bool page_pool_return_skb_page(struct page *page);
+#else
+static inline bool page_pool_return_skb_page(struct page *page)
+{
+	return false;
+}
+#endif
+
+#endif /* _NET_PAGE_POOL_H */
@@ -218,6 +218,15 @@ struct sock_common {
 };
 
 struct cg_proto;
+struct sock_reuseport;
+
+/* sk_pacing_status: who enforces sk_pacing_rate */
+enum sk_pacing {
+	SK_PACING_NONE		= 0,
+	SK_PACING_NEEDED	= 1,	/* pacing wanted, TCP paces internally */
+	SK_PACING_FQ		= 2,	/* sch_fq paces this socket */
+};
+
 /**
   *	struct sock - network layer representation of sockets
   *	@__sk_common: shared layout with inet_timewait_sock
@@ -241,6 +250,7 @@ struct cg_proto;
   *	@sk_allocation: allocation mode
   *	@sk_pacing_rate: Pacing rate (if supported by transport/packet scheduler)
   *	@sk_max_pacing_rate: Maximum pacing rate (%SO_MAX_PACING_RATE)
+  *	@sk_pacing_status: Pacing status (requested, handled by sch_fq)
   *	@sk_sndbuf: size of send buffer in bytes
   *	@sk_flags: %SO_LINGER (l_onoff), %SO_BROADCAST, %SO_KEEPALIVE,
   *		   %SO_OOBINLINE settings, %SO_TIMESTAMPING settings
@@ -281,6 +291,7 @@ struct cg_proto;
   *	@sk_stamp: time stamp of last packet received
   *	@sk_tsflags: SO_TIMESTAMPING socket options
   *	@sk_tskey: counter to disambiguate concurrent tstamp requests
+  *	@sk_zckey: counter to order MSG_ZEROCOPY notifications
   *	@sk_socket: Identd and reporting IO signals
   *	@sk_user_data: RPC layer private data
   *	@sk_frag: cached page frag
@@ -297,6 +308,7 @@ struct cg_proto;
   *	@sk_error_report: callback to indicate errors (e.g. %MSG_ERRQUEUE)
   *	@sk_backlog_rcv: callback to process the backlog
   *	@sk_destruct: called at sock freeing time, i.e. when all refcnt == 0
+  *	@sk_reuseport_cb: reuseport group container
  */
 struct sock {
 	/*
@@ -393,6 +405,7 @@ struct sock {
 	gfp_t			sk_allocation;
 	u32			sk_pacing_rate; /* bytes per second */
 	u32			sk_max_pacing_rate;
+	u32			sk_pacing_status; /* see enum sk_pacing */
 	netdev_features_t	sk_route_caps;
 	netdev_features_t	sk_route_nocaps;
 	int			sk_gso_type;
@@ -420,6 +433,7 @@ struct sock {
 	ktime_t			sk_stamp;
 	u16			sk_tsflags;
 	u32			sk_tskey;
+	atomic_t		sk_zckey;
 	struct socket		*sk_socket;
 	void			*sk_user_data;
 	struct page_frag	sk_frag;
@@ -439,6 +453,7 @@ struct sock {
 	int			(*sk_backlog_rcv)(struct sock *sk,
 						  struct sk_buff *skb);
 	void                    (*sk_destruct)(struct sock *sk);
+	struct sock_reuseport __rcu	*sk_reuseport_cb;
 };
 
 #define __sk_user_data(sk) ((*((void __rcu **)&(sk)->sk_user_data)))
@@ -721,6 +736,7 @@ enum sock_flags {
 		     */
 	SOCK_FILTER_LOCKED, /* Filter cannot be changed anymore */
 	SOCK_SELECT_ERR_QUEUE, /* Wake select on error queue */
+	SOCK_ZEROCOPY, /* buffers from userspace */
 };
 
 #define SK_FLAGS_TIMESTAMP ((1UL << SOCK_TIMESTAMP) | (1UL << SOCK_TIMESTAMPING_RX_SOFTWARE))
@@ -857,13 +873,14 @@ static inline void sk_incoming_cpu_update(struct sock *sk)
 	sk->sk_incoming_cpu = raw_smp_processor_id();
 }
 
-static inline void sock_rps_record_flow_hash(__u32 hash)
+static inline void sock_rps_record_flow_hash(const struct net *net,
+					     __u32 hash)
 {
 #ifdef CONFIG_RPS
 	struct rps_sock_flow_table *sock_flow_table;
 
 	rcu_read_lock();
-	sock_flow_table = rcu_dereference(rps_sock_flow_table);
+	sock_flow_table = rps_sock_flow_table_rcu(net);
 	rps_record_sock_flow(sock_flow_table, hash);
 	rcu_read_unlock();
 #endif
@@ -872,7 +889,7 @@ static inline void sock_rps_record_flow_hash(__u32 hash)
 static inline void sock_rps_record_flow(const struct sock *sk)
 {
 #ifdef CONFIG_RPS
-	sock_rps_record_flow_hash(sk->sk_rxhash);
+	sock_rps_record_flow_hash(read_pnet(&sk->sk_net), sk->sk_rxhash);
 #endif
 }
 
@@ -1001,6 +1018,7 @@ struct proto {
 	/* Memory pressure */
 	void			(*enter_memory_pressure)(struct sock *sk);
 	atomic_long_t		*memory_allocated;	/* Current allocated memory. */
+	int __percpu		*per_cpu_fw_alloc;	/* Batches memory_allocated updates */
 	struct percpu_counter	*sockets_allocated;	/* Current number of sockets. */
 	/*
 	 * Pressure flag: try to collapse.
@@ -1223,6 +1241,53 @@ static inline void memcg_memory_allocated_sub(struct cg_proto *prot,
 	page_counter_uncharge(&prot->memory_allocated, amt);
 }
 
+/*
+ * Protocols providing per_cpu_fw_alloc let each cpu run up to this many
+ * pages ahead of (or behind) memory_allocated before folding its
+ * reserve into the shared atomic, so a busy socket doesn't bounce that
+ * cacheline on every skb.  memory_allocated is then off by less than
+ * 1MB per cpu, which is well below the granularity of sysctl_mem.
+ */
+#define SK_MEMORY_PCPU_RESERVE (1 << (20 - PAGE_SHIFT))
+
+static inline void
+proto_memory_allocated_add(struct proto *prot, int amt)
+{
+	int local_reserve;
+
+	if (!prot->per_cpu_fw_alloc) {
+		atomic_long_add(amt, prot->memory_allocated);
+		return;
+	}
+
+	preempt_disable();
+	local_reserve = __this_cpu_add_return(*prot->per_cpu_fw_alloc, amt);
+	if (local_reserve >= SK_MEMORY_PCPU_RESERVE) {
+		__this_cpu_sub(*prot->per_cpu_fw_alloc, local_reserve);
+		atomic_long_add(local_reserve, prot->memory_allocated);
+	}
+	preempt_enable();
+}
+
+static inline void
+proto_memory_allocated_sub(struct proto *prot, int amt)
+{
+	int local_reserve;
+
+	if (!prot->per_cpu_fw_alloc) {
+		atomic_long_sub(amt, prot->memory_allocated);
+		return;
+	}
+
+	preempt_disable();
+	local_reserve = __this_cpu_sub_return(*prot->per_cpu_fw_alloc, amt);
+	if (local_reserve <= -SK_MEMORY_PCPU_RESERVE) {
+		__this_cpu_sub(*prot->per_cpu_fw_alloc, local_reserve);
+		atomic_long_add(local_reserve, prot->memory_allocated);
+	}
+	preempt_enable();
+}
+
 static inline long
 sk_memory_allocated(const struct sock *sk)
 {
@@ -1242,11 +1307,12 @@ sk_memory_allocated_add(struct sock *sk, int amt, int *parent_status)
 	if (mem_cgroup_sockets_enabled && sk->sk_cgrp) {
 		memcg_memory_allocated_add(sk->sk_cgrp, amt, parent_status);
 		/* update the root cgroup regardless */
-		atomic_long_add_return(amt, prot->memory_allocated);
+		proto_memory_allocated_add(prot, amt);
 		return page_counter_read(&sk->sk_cgrp->memory_allocated);
 	}
 
-	return atomic_long_add_return(amt, prot->memory_allocated);
+	proto_memory_allocated_add(prot, amt);
+	return atomic_long_read(prot->memory_allocated);
 }
 
 static inline void
@@ -1257,7 +1323,7 @@ sk_memory_allocated_sub(struct sock *sk, int amt)
 	if (mem_cgroup_sockets_enabled && sk->sk_cgrp)
 		memcg_memory_allocated_sub(sk->sk_cgrp, amt);
 
-	atomic_long_sub(amt, prot->memory_allocated);
+	proto_memory_allocated_sub(prot, amt);
 }
 
 static inline void sk_sockets_allocated_dec(struct sock *sk)
@@ -1533,6 +1599,8 @@ struct sock *sk_clone_lock(const struct sock *sk, const gfp_t priority);
 struct sk_buff *sock_wmalloc(struct sock *sk, unsigned long size, int force,
 			     gfp_t priority);
 void sock_wfree(struct sk_buff *skb);
+struct sk_buff *sock_omalloc(struct sock *sk, unsigned long size,
+			     gfp_t priority);
 void skb_orphan_partial(struct sk_buff *skb);
 void sock_rfree(struct sk_buff *skb);
 void sock_efree(struct sk_buff *skb);
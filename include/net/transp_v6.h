@@ -25,6 +25,8 @@ int rawv6_init(void);
 void rawv6_exit(void);
 int udpv6_init(void);
 void udpv6_exit(void);
+int udpv6_offload_init(void);
+int udpv6_offload_exit(void);
 int udplitev6_init(void);
 void udplitev6_exit(void);
 int tcpv6_init(void);
@@ -13,6 +13,8 @@
 #include <linux/mutex.h>
 #include <linux/audit.h>
 #include <linux/slab.h>
+#include <linux/crypto.h>
+#include <linux/padata.h>
 
 #include <net/sock.h>
 #include <net/dst.h>
@@ -1616,6 +1618,45 @@ int km_report(struct net *net, u8 proto, struct xfrm_selector *sel,
 	      xfrm_address_t *addr);
 
 void xfrm_input_init(void);
+
+/* Crypto of an SA run on other CPUs with the completions coming back in
+ * submission order, the job has to live as long as the request it runs.
+ */
+#ifdef CONFIG_XFRM_PARALLEL
+struct xfrm_crypto_job {
+	struct padata_priv		padata;
+	struct crypto_async_request	*base;
+	int (*crypt)(struct crypto_async_request *base);
+	crypto_completion_t		complete;
+	void				*data;
+};
+
+void xfrm_padata_init(void);
+bool xfrm_crypto_can_parallel(const struct xfrm_state *x);
+int xfrm_crypto_parallel(struct xfrm_crypto_job *job,
+			 struct crypto_async_request *base,
+			 int (*crypt)(struct crypto_async_request *base));
+#else
+struct xfrm_crypto_job {
+};
+
+static inline void xfrm_padata_init(void)
+{
+}
+
+static inline bool xfrm_crypto_can_parallel(const struct xfrm_state *x)
+{
+	return false;
+}
+
+static inline int xfrm_crypto_parallel(struct xfrm_crypto_job *job,
+			struct crypto_async_request *base,
+			int (*crypt)(struct crypto_async_request *base))
+{
+	return -EOPNOTSUPP;
+}
+#endif
+
 int xfrm_parse_spi(struct sk_buff *skb, u8 nexthdr, __be32 *spi, __be32 *seq);
 
 void xfrm_probe_algs(void);
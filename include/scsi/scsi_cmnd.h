@@ -56,6 +56,9 @@ struct scsi_pointer {
 /* for scmd->flags */
 #define SCMD_TAGGED		(1 << 0)
 
+/* for scmd->state, bit numbers */
+#define SCMD_STATE_INFLIGHT	0	/* counted by scsi_host_busy() */
+
 struct scsi_cmnd {
 	struct scsi_device *device;
 	struct list_head list;  /* scsi_cmnd participates in queue lists */
@@ -136,6 +139,7 @@ struct scsi_cmnd {
 
 	int result;		/* Status code from lower level driver */
 	int flags;		/* Command flags */
+	unsigned long state;	/* Command state, atomic bit operations */
 
 	unsigned char tag;	/* SCSI-II queued command tag */
 };
@@ -578,7 +578,13 @@ struct Scsi_Host {
 		struct blk_mq_tag_set	tag_set;
 	};
 
-	atomic_t host_busy;		   /* commands actually active on low-level */
+	/*
+	 * Commands actually active on low-level, use scsi_host_busy() to
+	 * read it.  Not maintained with blk-mq: the host-wide tag set
+	 * bounds the commands to can_queue already, and the active ones
+	 * are counted off the tags instead.
+	 */
+	atomic_t host_busy;
 	atomic_t host_blocked;
 
 	unsigned int host_failed;	   /* commands that failed.
@@ -783,6 +789,7 @@ static inline bool shost_use_blk_mq(struct Scsi_Host *shost)
 	return shost->use_blk_mq;
 }
 
+extern int scsi_host_busy(struct Scsi_Host *shost);
 extern int scsi_queue_work(struct Scsi_Host *, struct work_struct *);
 extern void scsi_flush_work(struct Scsi_Host *);
 
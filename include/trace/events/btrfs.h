@@ -45,13 +45,15 @@ struct btrfs_qgroup_operation;
 		{ BTRFS_TREE_LOG_OBJECTID,	"TREE_LOG"	},	\
 		{ BTRFS_QUOTA_TREE_OBJECTID,	"QUOTA_TREE"	},	\
 		{ BTRFS_TREE_RELOC_OBJECTID,	"TREE_RELOC"	},	\
-		{ BTRFS_UUID_TREE_OBJECTID,	"UUID_RELOC"	},	\
+		{ BTRFS_UUID_TREE_OBJECTID,	"UUID_TREE"	},	\
+		{ BTRFS_FREE_SPACE_TREE_OBJECTID, "FREE_SPACE_TREE" },	\
 		{ BTRFS_DATA_RELOC_TREE_OBJECTID, "DATA_RELOC_TREE" })
 
 #define show_root_type(obj)						\
 	obj, ((obj >= BTRFS_DATA_RELOC_TREE_OBJECTID) ||		\
 	      (obj >= BTRFS_ROOT_TREE_OBJECTID &&			\
-	       obj <= BTRFS_QUOTA_TREE_OBJECTID)) ? __show_root_type(obj) : "-"
+	       obj <= BTRFS_FREE_SPACE_TREE_OBJECTID)) ?			\
+	      __show_root_type(obj) : "-"
 
 #define BTRFS_GROUP_FLAGS	\
 	{ BTRFS_BLOCK_GROUP_DATA,	"DATA"},	\
@@ -87,6 +89,32 @@ TRACE_EVENT(btrfs_transaction_commit,
 		  (unsigned long long)__entry->generation)
 );
 
+TRACE_EVENT(btrfs_transaction_commit_phase,
+
+	TP_PROTO(struct btrfs_fs_info *fs_info, u64 transid, const char *phase,
+		 u64 duration),
+
+	TP_ARGS(fs_info, transid, phase, duration),
+
+	TP_STRUCT__entry(
+		__array(	u8,	fsid,	BTRFS_UUID_SIZE	)
+		__field(	u64,	transid			)
+		__string(	phase,	phase			)
+		__field(	u64,	duration		)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->fsid, fs_info->fsid, BTRFS_UUID_SIZE);
+		__entry->transid	= transid;
+		__assign_str(phase, phase);
+		__entry->duration	= duration;
+	),
+
+	TP_printk("%pU: transid = %llu, phase = %s, duration = %llu ns",
+		  __entry->fsid, (unsigned long long)__entry->transid,
+		  __get_str(phase), (unsigned long long)__entry->duration)
+);
+
 DECLARE_EVENT_CLASS(btrfs__inode,
 
 	TP_PROTO(struct inode *inode),
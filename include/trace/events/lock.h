@@ -80,6 +80,59 @@ DEFINE_EVENT(lock, lock_acquired,
 #endif
 #endif
 
+/*
+ * Contention events of the lock slowpaths. Unlike the lockdep based
+ * events above they are always available and cheap enough to enable
+ * in production; the caller is taken from the callchain of the event.
+ */
+#define LCB_F_SPIN	(1U << 0)	/* spinning for the lock */
+#define LCB_F_READ	(1U << 1)	/* rwsem or rwlock taken for read */
+#define LCB_F_WRITE	(1U << 2)	/* rwsem or rwlock taken for write */
+#define LCB_F_MUTEX	(1U << 3)	/* mutex */
+
+TRACE_EVENT(contention_begin,
+
+	TP_PROTO(void *lock, unsigned int flags),
+
+	TP_ARGS(lock, flags),
+
+	TP_STRUCT__entry(
+		__field(void *, lock_addr)
+		__field(unsigned int, flags)
+	),
+
+	TP_fast_assign(
+		__entry->lock_addr = lock;
+		__entry->flags = flags;
+	),
+
+	TP_printk("%p (flags=%s)", __entry->lock_addr,
+		  __print_flags(__entry->flags, "|",
+				{ LCB_F_SPIN,	"SPIN"	},
+				{ LCB_F_READ,	"READ"	},
+				{ LCB_F_WRITE,	"WRITE"	},
+				{ LCB_F_MUTEX,	"MUTEX"	}))
+);
+
+TRACE_EVENT(contention_end,
+
+	TP_PROTO(void *lock, int ret),
+
+	TP_ARGS(lock, ret),
+
+	TP_STRUCT__entry(
+		__field(void *, lock_addr)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->lock_addr = lock;
+		__entry->ret = ret;
+	),
+
+	TP_printk("%p (ret=%d)", __entry->lock_addr, __entry->ret)
+);
+
 #endif /* _TRACE_LOCK_H */
 
 /* This part must be outside protection */
@@ -214,6 +214,38 @@ TRACE_EVENT(rcu_nocb_wake,
 	TP_printk("%s %d %s", __entry->rcuname, __entry->cpu, __entry->reason)
 );
 
+/*
+ * Tracepoint for a batch of callbacks invoked by an rcuo kthread on
+ * behalf of a no-CBs CPU.  Track the type of RCU, the CPU that queued
+ * the callbacks, the number invoked, and the latency in milliseconds
+ * from the oldest callback of the batch being queued to the start of
+ * its invocation.
+ */
+TRACE_EVENT(rcu_nocb_batch,
+
+	TP_PROTO(const char *rcuname, int cpu, long count,
+		 unsigned int latency),
+
+	TP_ARGS(rcuname, cpu, count, latency),
+
+	TP_STRUCT__entry(
+		__field(const char *, rcuname)
+		__field(int, cpu)
+		__field(long, count)
+		__field(unsigned int, latency)
+	),
+
+	TP_fast_assign(
+		__entry->rcuname = rcuname;
+		__entry->cpu = cpu;
+		__entry->count = count;
+		__entry->latency = latency;
+	),
+
+	TP_printk("%s %d CBs=%ld lat=%ums", __entry->rcuname, __entry->cpu,
+		  __entry->count, __entry->latency)
+);
+
 /*
  * Tracepoint for tasks blocking within preemptible-RCU read-side
  * critical sections.  Track the type of RCU (which one day might
@@ -711,6 +743,7 @@ TRACE_EVENT(rcu_barrier,
 				      level, grplo, grphi, event) \
 				      do { } while (0)
 #define trace_rcu_nocb_wake(rcuname, cpu, reason) do { } while (0)
+#define trace_rcu_nocb_batch(rcuname, cpu, count, latency) do { } while (0)
 #define trace_rcu_preempt_task(rcuname, pid, gpnum) do { } while (0)
 #define trace_rcu_unlock_preempted_task(rcuname, gpnum, pid) do { } while (0)
 #define trace_rcu_quiescent_state_report(rcuname, gpnum, mask, qsmask, level, \
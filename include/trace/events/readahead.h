@@ -0,0 +1,95 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+#include <linux/kdev_t.h>
+
+/*
+ * Emitted for every readahead decision.  "hit" means the reader ran into
+ * a PG_readahead marker, i.e. the previous window was still ahead of it;
+ * "miss" means it found a page missing from the page cache.
+ */
+TRACE_EVENT(mm_readahead,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 unsigned long req_size, struct file_ra_state *ra,
+		 const char *pattern, bool hit),
+
+	TP_ARGS(mapping, offset, req_size, ra, pattern, hit),
+
+	TP_STRUCT__entry(
+		__field(dev_t, s_dev)
+		__field(unsigned long, i_ino)
+		__field(pgoff_t, offset)
+		__field(unsigned long, req_size)
+		__field(pgoff_t, start)
+		__field(unsigned int, size)
+		__field(unsigned int, async_size)
+		__field(unsigned int, boost)
+		__field(bool, hit)
+		__string(pattern, pattern)
+	),
+
+	TP_fast_assign(
+		__entry->s_dev = mapping->host->i_sb->s_dev;
+		__entry->i_ino = mapping->host->i_ino;
+		__entry->offset = offset;
+		__entry->req_size = req_size;
+		__entry->start = ra->start;
+		__entry->size = ra->size;
+		__entry->async_size = ra->async_size;
+		__entry->boost = ra->boost;
+		__entry->hit = hit;
+		__assign_str(pattern, pattern);
+	),
+
+	TP_printk("dev %d:%d ino %lx %s %s ofs=%lu req=%lu ra=%lu+%u-%u boost=%u",
+		MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+		__entry->i_ino,
+		__entry->hit ? "hit" : "miss",
+		__get_str(pattern),
+		__entry->offset,
+		__entry->req_size,
+		__entry->start,
+		__entry->size,
+		__entry->async_size,
+		__entry->boost)
+);
+
+TRACE_EVENT(mm_readahead_stall,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 struct file_ra_state *ra),
+
+	TP_ARGS(mapping, offset, ra),
+
+	TP_STRUCT__entry(
+		__field(dev_t, s_dev)
+		__field(unsigned long, i_ino)
+		__field(pgoff_t, offset)
+		__field(unsigned int, boost)
+	),
+
+	TP_fast_assign(
+		__entry->s_dev = mapping->host->i_sb->s_dev;
+		__entry->i_ino = mapping->host->i_ino;
+		__entry->offset = offset;
+		__entry->boost = ra->boost;
+	),
+
+	TP_printk("dev %d:%d ino %lx ofs=%lu boost=%u",
+		MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+		__entry->i_ino,
+		__entry->offset,
+		__entry->boost)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -710,8 +710,27 @@ __SYSCALL(__NR_bpf, sys_bpf)
 #define __NR_execveat 281
 __SC_COMP(__NR_execveat, sys_execveat, compat_sys_execveat)
 
+#define __NR_io_setup2 282
+__SYSCALL(__NR_io_setup2, sys_io_setup2)
+#define __NR_io_ring_enter 283
+__SYSCALL(__NR_io_ring_enter, sys_io_ring_enter)
+#define __NR_userfaultfd 284
+__SYSCALL(__NR_userfaultfd, sys_userfaultfd)
+#define __NR_rseq 285
+__SYSCALL(__NR_rseq, sys_rseq)
+#define __NR_statx 286
+__SYSCALL(__NR_statx, sys_statx)
+#define __NR_getdents_attr 287
+__SYSCALL(__NR_getdents_attr, sys_getdents_attr)
+#define __NR_copy_file_range 288
+__SYSCALL(__NR_copy_file_range, sys_copy_file_range)
+#define __NR_preadv2 289
+__SC_COMP(__NR_preadv2, sys_preadv2, compat_sys_preadv2)
+#define __NR_pwritev2 290
+__SC_COMP(__NR_pwritev2, sys_pwritev2, compat_sys_pwritev2)
+
 #undef __NR_syscalls
-#define __NR_syscalls 282
+#define __NR_syscalls 291
 
 /*
  * All syscalls below here should go away really,
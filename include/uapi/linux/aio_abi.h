@@ -37,10 +37,10 @@ enum {
 	IOCB_CMD_PWRITE = 1,
 	IOCB_CMD_FSYNC = 2,
 	IOCB_CMD_FDSYNC = 3,
-	/* These two are experimental.
+	/* This one is experimental.
 	 * IOCB_CMD_PREADX = 4,
-	 * IOCB_CMD_POLL = 5,
 	 */
+	IOCB_CMD_POLL = 5,
 	IOCB_CMD_NOOP = 6,
 	IOCB_CMD_PREADV = 7,
 	IOCB_CMD_PWRITEV = 8,
@@ -54,6 +54,32 @@ enum {
  */
 #define IOCB_FLAG_RESFD		(1 << 0)
 
+/*
+ * Flags for io_setup2().
+ *
+ * IOCTX_FLAG_SQRING - Map a submission ring behind the completion ring.
+ *                     The submission ring starts at the first page
+ *                     boundary after the io_event array and consists of
+ *                     a struct aio_sq_ring header followed by the iocb
+ *                     slots.  Submitted with io_ring_enter().
+ * IOCTX_FLAG_IOPOLL - Completions are found by polling the device rather
+ *                     than waiting for an interrupt.  Only O_DIRECT
+ *                     reads and writes are allowed on such a context.
+ */
+#define IOCTX_FLAG_SQRING	(1 << 0)
+#define IOCTX_FLAG_IOPOLL	(1 << 1)
+
+/*
+ * Flags for io_ring_enter().
+ *
+ * IORING_FLAG_SUBMIT    - Consume up to to_submit iocbs from the sq ring.
+ * IORING_FLAG_GETEVENTS - Wait for at least min_complete events to be
+ *                         available in the completion ring.  The events
+ *                         are not copied, userspace reaps them directly.
+ */
+#define IORING_FLAG_SUBMIT	(1 << 0)
+#define IORING_FLAG_GETEVENTS	(1 << 1)
+
 /* read() from /dev/aio returns these structures. */
 struct io_event {
 	__u64		data;		/* the data field from the iocb */
@@ -104,6 +130,22 @@ struct iocb {
 	__u32	aio_resfd;
 }; /* 64 bytes */
 
+/*
+ * Submission ring header, sized to match one iocb slot so that the slots
+ * following it never straddle a page.  Userspace fills iocbs[tail % nr],
+ * issues a write barrier and then advances tail; the kernel advances head
+ * once it has consumed a slot.
+ */
+struct aio_sq_ring {
+	__u32	head;		/* written by the kernel */
+	__u32	tail;		/* written by userspace */
+	__u32	nr;		/* number of iocb slots */
+	__u32	flags;
+	__u32	dropped;	/* iocbs rejected as malformed */
+	__u32	resv[11];
+	struct iocb iocbs[0];
+}; /* 64 bytes + ring size */
+
 #undef IFBIG
 #undef IFLITTLE
 
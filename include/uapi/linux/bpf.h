@@ -113,6 +113,11 @@ enum bpf_map_type {
 	BPF_MAP_TYPE_UNSPEC,
 	BPF_MAP_TYPE_HASH,
 	BPF_MAP_TYPE_ARRAY,
+	BPF_MAP_TYPE_PERCPU_HASH,
+	BPF_MAP_TYPE_PERCPU_ARRAY,
+	BPF_MAP_TYPE_STACK_TRACE,
+	BPF_MAP_TYPE_PERF_EVENT_ARRAY,
+	BPF_MAP_TYPE_PROG_ARRAY,
 };
 
 enum bpf_prog_type {
@@ -121,6 +126,7 @@ enum bpf_prog_type {
 	BPF_PROG_TYPE_KPROBE,
 	BPF_PROG_TYPE_SCHED_CLS,
 	BPF_PROG_TYPE_SCHED_ACT,
+	BPF_PROG_TYPE_XDP,
 };
 
 #define BPF_PSEUDO_MAP_FD	1
@@ -130,12 +136,26 @@ enum bpf_prog_type {
 #define BPF_NOEXIST	1 /* create new element if it didn't exist */
 #define BPF_EXIST	2 /* update existing element */
 
+/* flags for BPF_MAP_CREATE command */
+#define BPF_F_NO_PREALLOC	(1U << 0) /* allocate hash map elements on update */
+
+/* flags for BPF_FUNC_get_stackid */
+#define BPF_F_SKIP_FIELD_MASK	0xffULL
+#define BPF_F_USER_STACK	(1ULL << 8)
+#define BPF_F_FAST_STACK_CMP	(1ULL << 9)
+#define BPF_F_REUSE_STACKID	(1ULL << 10)
+
+/* flags for BPF_FUNC_perf_event_output */
+#define BPF_F_INDEX_MASK	0xffffffffULL
+#define BPF_F_CURRENT_CPU	BPF_F_INDEX_MASK
+
 union bpf_attr {
 	struct { /* anonymous struct used by BPF_MAP_CREATE command */
 		__u32	map_type;	/* one of enum bpf_map_type */
 		__u32	key_size;	/* size of key in bytes */
 		__u32	value_size;	/* size of value in bytes */
 		__u32	max_entries;	/* max number of entries in a map */
+		__u32	map_flags;	/* BPF_F_* flags of BPF_MAP_CREATE */
 	};
 
 	struct { /* anonymous struct used by BPF_MAP_*_ELEM commands */
@@ -210,6 +230,45 @@ enum bpf_func_id {
 	 * Return: 0 on success
 	 */
 	BPF_FUNC_l4_csum_replace,
+
+	/**
+	 * bpf_get_stackid(ctx, map, flags) - walk user or kernel stack and
+	 * return the id of the stack, stored in a BPF_MAP_TYPE_STACK_TRACE map
+	 * @ctx: struct pt_regs *
+	 * @map: pointer to stack trace map
+	 * @flags: bits 0-7 - number of stack frames to skip
+	 *         BPF_F_USER_STACK - collect user stack instead of kernel stack
+	 *         BPF_F_FAST_STACK_CMP - compare stacks by hash only
+	 *         BPF_F_REUSE_STACKID - if two different stacks hash into
+	 *         the same id, replace the old one
+	 * Return: >= 0 stackid on success or negative error
+	 */
+	BPF_FUNC_get_stackid,
+
+	/**
+	 * bpf_perf_event_output(ctx, map, flags, data, size) - append a raw
+	 * sample to the ring buffer of a perf event
+	 * @ctx: struct pt_regs *
+	 * @map: pointer to BPF_MAP_TYPE_PERF_EVENT_ARRAY map
+	 * @flags: bits 0-31 - index of the event in the map, or
+	 *         BPF_F_CURRENT_CPU to use the index of the current cpu
+	 * @data: pointer to the data on the program stack
+	 * @size: size of the data
+	 * Return: 0 on success or negative error
+	 */
+	BPF_FUNC_perf_event_output,
+
+	/**
+	 * bpf_tail_call(ctx, prog_array_map, index) - jump into another BPF
+	 * program, which reuses the stack frame and never returns here
+	 * @ctx: context pointer passed to the next program
+	 * @prog_array_map: pointer to BPF_MAP_TYPE_PROG_ARRAY map
+	 * @index: index inside the array that selects the program
+	 * Return: nothing on success; if the slot is empty, out of range, or
+	 *         more than MAX_TAIL_CALL_CNT tail calls were made already,
+	 *         execution continues with the next instruction
+	 */
+	BPF_FUNC_tail_call,
 	__BPF_FUNC_MAX_ID,
 };
 
@@ -228,4 +287,24 @@ struct __sk_buff {
 	__u32 priority;
 };
 
+/* verdicts of BPF_PROG_TYPE_XDP programs, which see the packet in the driver
+ * before any sk_buff is allocated for it. Unknown verdicts are treated as
+ * XDP_ABORTED.
+ */
+enum xdp_action {
+	XDP_ABORTED = 0,	/* program error, drop the packet */
+	XDP_DROP,		/* drop the packet */
+	XDP_PASS,		/* hand the packet to the network stack */
+	XDP_TX,			/* send the packet back out of the same port */
+};
+
+/* user accessible metadata for XDP programs. data and data_end are
+ * converted into pointers to the packet, bytes in [data, data_end) can be
+ * read and written once the program compared its pointer with data_end
+ */
+struct xdp_md {
+	__u32 data;
+	__u32 data_end;
+};
+
 #endif /* _UAPI__LINUX_BPF_H__ */
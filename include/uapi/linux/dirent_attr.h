@@ -0,0 +1,42 @@
+#ifndef _UAPI_LINUX_DIRENT_ATTR_H
+#define _UAPI_LINUX_DIRENT_ATTR_H
+
+/*
+ * linux/dirent_attr.h
+ *
+ * Directory entries with attributes, as returned by getdents_attr()
+ */
+
+#include <linux/types.h>
+#include <linux/stat.h>
+
+/*
+ * Each record carries the usual dirent fields followed by the attributes
+ * of the inode it names.  d_mask holds the STATX_* bits of the attributes
+ * that were filled in; it is zero if they could not be fetched, e.g.
+ * because the entry went away between reading the directory and looking
+ * at the inode.  Records are 8 byte aligned, d_name is NUL terminated.
+ */
+struct linux_dirent_attr {
+	__u64	d_ino;
+	__s64	d_off;
+	__u16	d_reclen;
+	__u8	d_type;
+	__u8	__pad0;
+	__u32	d_mask;
+	__u32	d_nlink;
+	__u32	d_uid;
+	__u32	d_gid;
+	__u16	d_mode;
+	__u16	__pad1;
+	__u64	d_size;
+	__u64	d_blocks;
+	struct statx_timestamp	d_atime;
+	struct statx_timestamp	d_mtime;
+	struct statx_timestamp	d_ctime;
+	__u32	d_rdev_major;
+	__u32	d_rdev_minor;
+	char	d_name[0];
+};
+
+#endif /* _UAPI_LINUX_DIRENT_ATTR_H */
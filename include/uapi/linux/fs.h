@@ -283,4 +283,8 @@ struct fsxattr {
 #define SYNC_FILE_RANGE_WRITE		2
 #define SYNC_FILE_RANGE_WAIT_AFTER	4
 
+/* flags for preadv2/pwritev2: */
+#define RWF_HIPRI			0x00000001 /* high priority request, poll if possible */
+#define RWF_NOWAIT			0x00000008 /* return -EAGAIN if the data isn't cached */
+
 #endif /* _UAPI_LINUX_FS_H */
@@ -183,6 +183,7 @@ struct kvm_s390_skeys {
 #define KVM_EXIT_EPR              23
 #define KVM_EXIT_SYSTEM_EVENT     24
 #define KVM_EXIT_S390_STSI        25
+#define KVM_EXIT_DIRTY_RING_FULL  26
 
 /* For KVM_EXIT_INTERNAL_ERROR */
 /* Emulate instruction failed. */
@@ -372,6 +373,25 @@ struct kvm_coalesced_mmio_ring {
 	((PAGE_SIZE - sizeof(struct kvm_coalesced_mmio_ring)) / \
 	 sizeof(struct kvm_coalesced_mmio))
 
+/*
+ * Entry of the per-vcpu dirty gfn ring, mapped at KVM_DIRTY_LOG_PAGE_OFFSET
+ * of the vcpu fd once KVM_CAP_DIRTY_LOG_RING has been enabled.
+ *
+ * KVM sets KVM_DIRTY_GFN_F_DIRTY after filling in slot and offset.
+ * Userspace collects the entry, sets KVM_DIRTY_GFN_F_RESET and then calls
+ * KVM_RESET_DIRTY_RINGS, which write protects the page again and clears
+ * the flags so that the entry can be reused.
+ */
+struct kvm_dirty_gfn {
+	__u32 flags;
+	__u32 slot;
+	__u64 offset;
+};
+
+#define KVM_DIRTY_GFN_F_DIRTY	(1 << 0)
+#define KVM_DIRTY_GFN_F_RESET	(1 << 1)
+#define KVM_DIRTY_GFN_F_MASK	0x3
+
 /* for KVM_TRANSLATE */
 struct kvm_translation {
 	/* in */
@@ -814,6 +834,7 @@ struct kvm_ppc_smmu_info {
 #define KVM_CAP_S390_INJECT_IRQ 113
 #define KVM_CAP_S390_IRQ_STATE 114
 #define KVM_CAP_PPC_HWRNG 115
+#define KVM_CAP_DIRTY_LOG_RING 116
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -1199,6 +1220,8 @@ struct kvm_s390_ucas_mapping {
 /* Available with KVM_CAP_S390_IRQ_STATE */
 #define KVM_S390_SET_IRQ_STATE	  _IOW(KVMIO, 0xb5, struct kvm_s390_irq_state)
 #define KVM_S390_GET_IRQ_STATE	  _IOW(KVMIO, 0xb6, struct kvm_s390_irq_state)
+/* Available with KVM_CAP_DIRTY_LOG_RING */
+#define KVM_RESET_DIRTY_RINGS	  _IO(KVMIO, 0xc7)
 
 #define KVM_DEV_ASSIGN_ENABLE_IOMMU	(1 << 0)
 #define KVM_DEV_ASSIGN_PCI_2_3		(1 << 1)
@@ -80,16 +80,29 @@ struct nvme_id_ctrl {
 	__le16			acwu;
 	__u8			rsvd534[2];
 	__le32			sgls;
-	__u8			rsvd540[1508];
+	__u8			rsvd540[228];
+	char			subnqn[256];
+	__u8			rsvd1024[768];
+	__le32			ioccsz;
+	__le32			iorcsz;
+	__le16			icdoff;
+	__u8			ctrattr;
+	__u8			msdbd;
+	__u8			rsvd1804[244];
 	struct nvme_id_power_state	psd[32];
 	__u8			vs[1024];
 };
 
 enum {
+	NVME_CTRL_CMIC_MULTI_PORT		= 1 << 0,
+	NVME_CTRL_CMIC_MULTI_CTRL		= 1 << 1,
 	NVME_CTRL_ONCS_COMPARE			= 1 << 0,
 	NVME_CTRL_ONCS_WRITE_UNCORRECTABLE	= 1 << 1,
 	NVME_CTRL_ONCS_DSM			= 1 << 2,
 	NVME_CTRL_VWC_PRESENT			= 1 << 0,
+	NVME_CTRL_SGLS_SUPPORTED		= 1 << 0,
+	NVME_CTRL_SGLS_KEYED			= 1 << 2,
+	NVME_CTRL_SGLS_OFFSET			= 1 << 20,
 };
 
 struct nvme_lbaf {
@@ -231,6 +244,34 @@ enum nvme_opcode {
 	nvme_cmd_resv_release	= 0x15,
 };
 
+/*
+ * SGL descriptors take the place of PRP1/PRP2 when the PSDT field in the
+ * command flags selects them; the fabrics transports always use them.
+ */
+struct nvme_sgl_desc {
+	__le64			addr;
+	__le32			length;
+	__u8			rsvd[3];
+	__u8			type;
+};
+
+struct nvme_keyed_sgl_desc {
+	__le64			addr;
+	__u8			length[3];
+	__u8			key[4];
+	__u8			type;
+};
+
+enum {
+	NVME_CMD_SGL_METABUF	= 1 << 6,
+
+	NVME_SGL_FMT_DATA_DESC		= 0x00,
+	NVME_KEY_SGL_FMT_DATA_DESC	= 0x04,
+	NVME_SGL_FMT_ADDRESS		= 0x00,
+	NVME_SGL_FMT_OFFSET		= 0x01,
+	NVME_SGL_FMT_INVALIDATE		= 0x0f,
+};
+
 struct nvme_common_command {
 	__u8			opcode;
 	__u8			flags;
@@ -238,8 +279,14 @@ struct nvme_common_command {
 	__le32			nsid;
 	__le32			cdw2[2];
 	__le64			metadata;
-	__le64			prp1;
-	__le64			prp2;
+	union {
+		struct {
+			__le64	prp1;
+			__le64	prp2;
+		};
+		struct nvme_sgl_desc	sgl;
+		struct nvme_keyed_sgl_desc ksgl;
+	};
 	__le32			cdw10[6];
 };
 
@@ -457,6 +504,82 @@ struct nvme_format_cmd {
 	__u32			rsvd11[5];
 };
 
+/* Fabrics commands */
+
+enum nvmf_fabrics_opcode {
+	nvme_fabrics_command		= 0x7f,
+};
+
+enum nvmf_capsule_command {
+	nvme_fabrics_type_property_set	= 0x00,
+	nvme_fabrics_type_connect	= 0x01,
+	nvme_fabrics_type_property_get	= 0x04,
+};
+
+struct nvmf_common_command {
+	__u8			opcode;
+	__u8			resv1;
+	__u16			command_id;
+	__u8			fctype;
+	__u8			resv2[35];
+	__u8			ts[24];
+};
+
+struct nvmf_connect_command {
+	__u8			opcode;
+	__u8			resv1;
+	__u16			command_id;
+	__u8			fctype;
+	__u8			resv2[19];
+	union {
+		struct nvme_sgl_desc	sgl;
+		struct nvme_keyed_sgl_desc ksgl;
+	} dptr;
+	__le16			recfmt;
+	__le16			qid;
+	__le16			sqsize;
+	__u8			cattr;
+	__u8			resv3;
+	__le32			kato;
+	__u8			resv4[12];
+};
+
+#define NVMF_NQN_SIZE		256
+
+struct nvmf_connect_data {
+	__u8			hostid[16];
+	__le16			cntlid;
+	char			resv4[238];
+	char			subsysnqn[NVMF_NQN_SIZE];
+	char			hostnqn[NVMF_NQN_SIZE];
+	char			resv5[256];
+};
+
+struct nvmf_property_set_command {
+	__u8			opcode;
+	__u8			resv1;
+	__u16			command_id;
+	__u8			fctype;
+	__u8			resv2[35];
+	__u8			attrib;
+	__u8			resv3[3];
+	__le32			offset;
+	__le64			value;
+	__u8			resv4[8];
+};
+
+struct nvmf_property_get_command {
+	__u8			opcode;
+	__u8			resv1;
+	__u16			command_id;
+	__u8			fctype;
+	__u8			resv2[35];
+	__u8			attrib;
+	__u8			resv3[3];
+	__le32			offset;
+	__u8			resv4[16];
+};
+
 struct nvme_command {
 	union {
 		struct nvme_common_command common;
@@ -470,6 +593,10 @@ struct nvme_command {
 		struct nvme_format_cmd format;
 		struct nvme_dsm_cmd dsm;
 		struct nvme_abort_cmd abort;
+		struct nvmf_common_command fabrics;
+		struct nvmf_connect_command connect;
+		struct nvmf_property_set_command prop_set;
+		struct nvmf_property_get_command prop_get;
 	};
 };
 
@@ -523,6 +650,10 @@ enum {
 	NVME_SC_REFTAG_CHECK		= 0x284,
 	NVME_SC_COMPARE_FAILED		= 0x285,
 	NVME_SC_ACCESS_DENIED		= 0x286,
+	NVME_SC_CONNECT_FORMAT		= 0x180,
+	NVME_SC_CONNECT_CTRL_BUSY	= 0x181,
+	NVME_SC_CONNECT_INVALID_PARAM	= 0x182,
+	NVME_SC_CONNECT_INVALID_HOST	= 0x184,
 	NVME_SC_DNR			= 0x4000,
 };
 
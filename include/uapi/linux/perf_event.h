@@ -110,6 +110,7 @@ enum perf_sw_ids {
 	PERF_COUNT_SW_ALIGNMENT_FAULTS		= 7,
 	PERF_COUNT_SW_EMULATION_FAULTS		= 8,
 	PERF_COUNT_SW_DUMMY			= 9,
+	PERF_COUNT_SW_BPF_OUTPUT		= 10,
 
 	PERF_COUNT_SW_MAX,			/* non-ABI */
 };
@@ -389,6 +390,20 @@ struct perf_event_attr {
 #define PERF_EVENT_IOC_SET_FILTER	_IOW('$', 6, char *)
 #define PERF_EVENT_IOC_ID		_IOR('$', 7, __u64 *)
 #define PERF_EVENT_IOC_SET_BPF		_IOW('$', 8, __u32)
+#define PERF_EVENT_IOC_ATTACH_CGROUP	_IOW('$', 9, __u64 *)
+#define PERF_EVENT_IOC_READ_CGROUP	_IOWR('$', 10, __u64 *)
+
+/*
+ * ATTACH_CGROUP makes a per-cpu event count for each of a set of cgroups,
+ * identified by the inode number of their directory:
+ *
+ *	{ u64 nr; u64 id[nr]; }		(nr == 0 detaches)
+ *
+ * READ_CGROUP fills in the count of one of them and the time the cgroup
+ * (or its descendants) ran on the event's cpu:
+ *
+ *	{ u64 id; u64 count; u64 time; }
+ */
 
 enum perf_event_ioc_flags {
 	PERF_IOC_FLAG_GROUP		= 1U << 0,
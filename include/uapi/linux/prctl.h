@@ -190,4 +190,25 @@ struct prctl_mm_map {
 # define PR_FP_MODE_FR		(1 << 0)	/* 64b FP registers */
 # define PR_FP_MODE_FRE		(1 << 1)	/* 32b compatibility */
 
+/*
+ * Have khugepaged scan this process ahead of the others.
+ */
+#define PR_SET_THP_PRIORITY	47
+#define PR_GET_THP_PRIORITY	48
+
+/*
+ * Give the private futexes of this process a hash table of their own,
+ * sized for the given number of threads (0: number of online CPUs).
+ * Only possible before the address space is shared with another thread.
+ */
+#define PR_SET_FUTEX_HASH	49
+#define PR_GET_FUTEX_HASH	50
+
+/*
+ * Have fork() share the page tables of private anonymous memory with the
+ * child, copying them on first write instead of up front.
+ */
+#define PR_SET_FORK_SHARE_PTE	51
+#define PR_GET_FORK_SHARE_PTE	52
+
 #endif /* _LINUX_PRCTL_H */
@@ -0,0 +1,171 @@
+/* task_diag.h - bulk dumping of per-task information
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2.1 of the GNU Lesser General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef _UAPI_LINUX_TASK_DIAG_H
+#define _UAPI_LINUX_TASK_DIAG_H
+
+#include <linux/types.h>
+
+/*
+ * task_diag answers a single generic netlink dump request with one
+ * message per task.  Each message carries a fixed-size record for every
+ * group selected in task_diag_pid.show_flags, so a monitoring agent can
+ * collect the same fields it would otherwise parse out of several
+ * /proc/<pid>/ files without opening anything per task.
+ *
+ * The structures below are only ever extended at their end.
+ */
+
+#define TASK_DIAG_GENL_NAME	"TASK_DIAG"
+#define TASK_DIAG_GENL_VERSION	0x1
+
+/* Attributes of a reply message, one per record group */
+enum {
+	TASK_DIAG_UNSPEC = 0,	/* Reserved */
+	TASK_DIAG_BASE,		/* struct task_diag_base */
+	TASK_DIAG_CRED,		/* struct task_diag_creds */
+	TASK_DIAG_STAT,		/* struct task_diag_stat */
+	TASK_DIAG_IO,		/* struct task_diag_io */
+	__TASK_DIAG_ATTR_MAX,
+};
+
+#define TASK_DIAG_ATTR_MAX (__TASK_DIAG_ATTR_MAX - 1)
+
+#define TASK_DIAG_SHOW_BASE	(1ULL << TASK_DIAG_BASE)
+#define TASK_DIAG_SHOW_CRED	(1ULL << TASK_DIAG_CRED)
+#define TASK_DIAG_SHOW_STAT	(1ULL << TASK_DIAG_STAT)
+#define TASK_DIAG_SHOW_IO	(1ULL << TASK_DIAG_IO)
+
+/* task_diag_base.state, in the order of the letters in /proc/<pid>/stat */
+enum {
+	TASK_DIAG_RUNNING,		/* R */
+	TASK_DIAG_INTERRUPTIBLE,	/* S */
+	TASK_DIAG_UNINTERRUPTIBLE,	/* D */
+	TASK_DIAG_STOPPED,		/* T */
+	TASK_DIAG_TRACE_STOP,		/* t */
+	TASK_DIAG_DEAD,			/* X */
+	TASK_DIAG_ZOMBIE,		/* Z */
+};
+
+#define TASK_DIAG_COMM_LEN 16
+
+/*
+ * Identifiers are reported in the pid namespace the dump was made in;
+ * a task that is not visible there (e.g. the parent of a namespace's
+ * init) is reported as 0.
+ */
+struct task_diag_base {
+	__u32	tgid;
+	__u32	pid;
+	__u32	ppid;
+	__u32	tpid;		/* tracer, 0 if not traced */
+	__u32	sid;
+	__u32	pgid;
+	__u8	state;		/* TASK_DIAG_RUNNING ... */
+	char	comm[TASK_DIAG_COMM_LEN];
+};
+
+/* Ids are mapped into the user namespace of the requester */
+struct task_diag_creds {
+	__u64	cap_inheritable;
+	__u64	cap_permitted;
+	__u64	cap_effective;
+	__u64	cap_bset;
+
+	__u32	uid;
+	__u32	euid;
+	__u32	suid;
+	__u32	fsuid;
+	__u32	gid;
+	__u32	egid;
+	__u32	sgid;
+	__u32	fsgid;
+};
+
+/*
+ * Times are in nanoseconds.  Process dumps (ALL, CHILDREN and ONE) cover
+ * the whole thread group, like /proc/<pid>/stat; thread dumps (ALL_THREAD
+ * and THREAD) report each thread on its own, like
+ * /proc/<pid>/task/<tid>/stat.
+ */
+struct task_diag_stat {
+	__u64	minflt;
+	__u64	cminflt;
+	__u64	majflt;
+	__u64	cmajflt;
+	__u64	utime;
+	__u64	stime;
+	__u64	cutime;
+	__u64	cstime;
+	__u64	start_time;	/* since boot */
+	__u64	vsize;		/* bytes */
+	__u64	rss;		/* pages */
+
+	__u32	threads;
+	__s32	nice;
+	__s32	prio;
+};
+
+/*
+ * Same counters as /proc/<pid>/io.  Only reported for tasks the
+ * requester may ptrace, and only if the kernel does I/O accounting.
+ */
+struct task_diag_io {
+	__u64	rchar;
+	__u64	wchar;
+	__u64	syscr;
+	__u64	syscw;
+	__u64	read_bytes;
+	__u64	write_bytes;
+	__u64	cancelled_write_bytes;
+};
+
+/* task_diag_pid.dump_strategy */
+enum {
+	TASK_DIAG_DUMP_ALL = 0,		/* every thread group leader */
+	TASK_DIAG_DUMP_ALL_THREAD,	/* every thread */
+	TASK_DIAG_DUMP_CHILDREN,	/* children of task_diag_pid.pid */
+	TASK_DIAG_DUMP_THREAD,		/* threads of task_diag_pid.pid */
+	TASK_DIAG_DUMP_ONE,		/* task_diag_pid.pid alone */
+};
+
+struct task_diag_pid {
+	__u64	show_flags;		/* TASK_DIAG_SHOW_* */
+	__u32	dump_strategy;		/* TASK_DIAG_DUMP_* */
+	__u32	pid;
+};
+
+/*
+ * Commands sent from userspace.  TASK_DIAG_CMD_GET must be sent with
+ * NLM_F_DUMP; replies carry the same command.
+ */
+enum {
+	TASK_DIAG_CMD_UNSPEC = 0,	/* Reserved */
+	TASK_DIAG_CMD_GET,		/* user->kernel request/get-response */
+	__TASK_DIAG_CMD_MAX,
+};
+
+#define TASK_DIAG_CMD_MAX (__TASK_DIAG_CMD_MAX - 1)
+
+enum {
+	TASK_DIAG_CMD_ATTR_UNSPEC = 0,
+	TASK_DIAG_CMD_ATTR_GET,		/* struct task_diag_pid, mandatory */
+	TASK_DIAG_CMD_ATTR_CGROUP_FD,	/* u32: only tasks in this cgroup's
+					 * subtree (fd of a cgroupfs dir) */
+	TASK_DIAG_CMD_ATTR_PIDNS_FD,	/* u32: dump this pid namespace
+					 * (fd of /proc/<pid>/ns/pid) instead
+					 * of the requester's */
+	__TASK_DIAG_CMD_ATTR_MAX,
+};
+
+#define TASK_DIAG_CMD_ATTR_MAX (__TASK_DIAG_CMD_ATTR_MAX - 1)
+
+#endif /* _UAPI_LINUX_TASK_DIAG_H */
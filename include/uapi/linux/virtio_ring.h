@@ -50,6 +50,22 @@
  * optimization.  */
 #define VRING_AVAIL_F_NO_INTERRUPT	1
 
+/* Mark a descriptor as available or used in the packed ring.  Notice: these
+ * are bit numbers, not masks. */
+#define VRING_PACKED_DESC_F_AVAIL	7
+#define VRING_PACKED_DESC_F_USED	15
+
+/* Enable events in the packed ring. */
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0x0
+/* Disable events in the packed ring. */
+#define VRING_PACKED_EVENT_FLAG_DISABLE	0x1
+/* Enable events for a specific descriptor in the packed ring, as given by
+ * the off_wrap field.  Only valid if VIRTIO_RING_F_EVENT_IDX is negotiated. */
+#define VRING_PACKED_EVENT_FLAG_DESC	0x2
+
+/* Wrap counter bit shift in the packed ring event suppression structure. */
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+
 /* We support indirect buffer descriptors */
 #define VIRTIO_RING_F_INDIRECT_DESC	28
 
@@ -101,6 +117,27 @@ struct vring {
 	struct vring_used *used;
 };
 
+/* Packed ring descriptors: 16 bytes.  Driver and device both write to the
+ * one ring, telling each other apart by the AVAIL and USED flag bits. */
+struct vring_packed_desc {
+	/* Buffer address (guest-physical). */
+	__le64 addr;
+	/* Buffer length. */
+	__le32 len;
+	/* Buffer ID. */
+	__le16 id;
+	/* The flags as indicated above, plus AVAIL and USED. */
+	__le16 flags;
+};
+
+/* Event suppression structure, one each for the driver and the device. */
+struct vring_packed_desc_event {
+	/* Descriptor ring change event offset and wrap counter. */
+	__le16 off_wrap;
+	/* Descriptor ring change event flags. */
+	__le16 flags;
+};
+
 /* Alignment requirements for vring elements.
  * When using pre-virtio 1.0 layout, these fall out naturally.
  */
@@ -320,6 +320,7 @@ static inline int audit_signal_info(int sig, struct task_struct *t)
 }
 extern void audit_filter_inodes(struct task_struct *, struct audit_context *);
 extern struct list_head *audit_killed_trees(void);
+extern u32 audit_syscall_mask[AUDIT_NR_FILTERS][AUDIT_BITMASK_SIZE];
 #else
 #define audit_signal_info(s,t) AUDIT_DISABLED
 #define audit_filter_inodes(t,c) AUDIT_DISABLED
@@ -856,6 +856,31 @@ out:
 static u64 prio_low = ~0ULL/2;
 static u64 prio_high = ~0ULL/2 - 1;
 
+#ifdef CONFIG_AUDITSYSCALL
+/*
+ * Recompute the union of the syscall masks of the rules on a syscall
+ * filter list.  Called with audit_filter_mutex held after the list has
+ * changed.  A reader racing with a rule removal may still see the bits
+ * of the removed rule, which only costs it a list walk.
+ */
+static void audit_update_syscall_mask(int listnr)
+{
+	u32 mask[AUDIT_BITMASK_SIZE] = { 0 };
+	struct audit_entry *e;
+	int i;
+
+	if (listnr != AUDIT_FILTER_ENTRY && listnr != AUDIT_FILTER_EXIT)
+		return;
+
+	list_for_each_entry(e, &audit_filter_list[listnr], list)
+		for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+			mask[i] |= e->rule.mask[i];
+
+	for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+		WRITE_ONCE(audit_syscall_mask[listnr][i], mask[i]);
+}
+#endif
+
 /* Add rule to given filterlist if not a duplicate. */
 static inline int audit_add_rule(struct audit_entry *entry)
 {
@@ -930,6 +955,8 @@ static inline int audit_add_rule(struct audit_entry *entry)
 
 	if (!audit_match_signal(entry))
 		audit_signals++;
+
+	audit_update_syscall_mask(entry->rule.listnr);
 #endif
 	mutex_unlock(&audit_filter_mutex);
 
@@ -982,6 +1009,8 @@ static inline int audit_del_rule(struct audit_entry *entry)
 
 	if (!audit_match_signal(entry))
 		audit_signals--;
+
+	audit_update_syscall_mask(entry->rule.listnr);
 #endif
 	mutex_unlock(&audit_filter_mutex);
 
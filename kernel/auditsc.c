@@ -94,6 +94,13 @@ int audit_n_rules;
 /* determines whether we collect data for signals sent */
 int audit_signals;
 
+/*
+ * Union of the syscall masks of all rules on each filter list, maintained
+ * by auditfilter.c under audit_filter_mutex.  Syscalls no rule on a list
+ * cares about skip walking that list altogether.
+ */
+u32 audit_syscall_mask[AUDIT_NR_FILTERS][AUDIT_BITMASK_SIZE];
+
 struct audit_aux_data {
 	struct audit_aux_data	*next;
 	int			type;
@@ -723,7 +730,7 @@ static enum audit_state audit_filter_task(struct task_struct *tsk, char **key)
 	return AUDIT_BUILD_CONTEXT;
 }
 
-static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
+static int __audit_in_mask(const u32 *mask, unsigned long val)
 {
 	int word, bit;
 
@@ -736,7 +743,12 @@ static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
 
 	bit = AUDIT_BIT(val);
 
-	return rule->mask[word] & bit;
+	return READ_ONCE(mask[word]) & bit;
+}
+
+static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
+{
+	return __audit_in_mask(rule->mask, val);
 }
 
 /* At syscall entry and exit time, this filter is called if the
@@ -746,14 +758,19 @@ static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
  */
 static enum audit_state audit_filter_syscall(struct task_struct *tsk,
 					     struct audit_context *ctx,
-					     struct list_head *list)
+					     int listnr)
 {
+	struct list_head *list = &audit_filter_list[listnr];
 	struct audit_entry *e;
 	enum audit_state state;
 
 	if (audit_pid && tsk->tgid == audit_pid)
 		return AUDIT_DISABLED;
 
+	/* no rule on this list matches the syscall, don't walk it */
+	if (!__audit_in_mask(audit_syscall_mask[listnr], ctx->major))
+		return AUDIT_BUILD_CONTEXT;
+
 	rcu_read_lock();
 	if (!list_empty(list)) {
 		list_for_each_entry_rcu(e, list, list) {
@@ -847,7 +864,7 @@ static inline struct audit_context *audit_take_context(struct task_struct *tsk,
 		context->return_code  = return_code;
 
 	if (context->in_syscall && !context->dummy) {
-		audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_EXIT]);
+		audit_filter_syscall(tsk, context, AUDIT_FILTER_EXIT);
 		audit_filter_inodes(tsk, context);
 	}
 
@@ -1517,7 +1534,7 @@ void __audit_syscall_entry(int major, unsigned long a1, unsigned long a2,
 	context->dummy = !audit_n_rules;
 	if (!context->dummy && state == AUDIT_BUILD_CONTEXT) {
 		context->prio = 0;
-		state = audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_ENTRY]);
+		state = audit_filter_syscall(tsk, context, AUDIT_FILTER_ENTRY);
 	}
 	if (state == AUDIT_DISABLED)
 		return;
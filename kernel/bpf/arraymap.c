@@ -14,32 +14,71 @@
 #include <linux/vmalloc.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
+#include <linux/perf_event.h>
 
-struct bpf_array {
-	struct bpf_map map;
-	u32 elem_size;
-	char value[0] __aligned(8);
-};
+static void bpf_array_free_percpu(struct bpf_array *array)
+{
+	int i;
+
+	for (i = 0; i < array->map.max_entries; i++)
+		free_percpu(array->pptrs[i]);
+}
+
+static int bpf_array_alloc_percpu(struct bpf_array *array)
+{
+	void __percpu *ptr;
+	int i;
+
+	for (i = 0; i < array->map.max_entries; i++) {
+		ptr = __alloc_percpu_gfp(array->elem_size, 8,
+					 GFP_USER | __GFP_NOWARN);
+		if (!ptr) {
+			bpf_array_free_percpu(array);
+			return -ENOMEM;
+		}
+		array->pptrs[i] = ptr;
+	}
+
+	return 0;
+}
 
 /* Called from syscall */
 static struct bpf_map *array_map_alloc(union bpf_attr *attr)
 {
+	bool percpu = attr->map_type == BPF_MAP_TYPE_PERCPU_ARRAY;
+	bool fd_array = attr->map_type == BPF_MAP_TYPE_PERF_EVENT_ARRAY ||
+			attr->map_type == BPF_MAP_TYPE_PROG_ARRAY;
 	struct bpf_array *array;
 	u32 elem_size, array_size;
 
 	/* check sanity of attributes */
 	if (attr->max_entries == 0 || attr->key_size != 4 ||
-	    attr->value_size == 0)
+	    attr->value_size == 0 || attr->map_flags)
+		return ERR_PTR(-EINVAL);
+
+	/* user space passes the fd of a perf event or program as the value */
+	if (fd_array && attr->value_size != sizeof(u32))
 		return ERR_PTR(-EINVAL);
 
 	elem_size = round_up(attr->value_size, 8);
 
 	/* check round_up into zero and u32 overflow */
-	if (elem_size == 0 ||
-	    attr->max_entries > (U32_MAX - sizeof(*array)) / elem_size)
+	if (elem_size == 0)
 		return ERR_PTR(-ENOMEM);
 
-	array_size = sizeof(*array) + attr->max_entries * elem_size;
+	if (percpu && elem_size > PCPU_MIN_UNIT_SIZE)
+		return ERR_PTR(-E2BIG);
+
+	if (percpu || fd_array) {
+		/* the array only holds pointers to the values */
+		if (attr->max_entries > (U32_MAX - sizeof(*array)) / sizeof(void *))
+			return ERR_PTR(-ENOMEM);
+		array_size = sizeof(*array) + attr->max_entries * sizeof(void *);
+	} else {
+		if (attr->max_entries > (U32_MAX - sizeof(*array)) / elem_size)
+			return ERR_PTR(-ENOMEM);
+		array_size = sizeof(*array) + attr->max_entries * elem_size;
+	}
 
 	/* allocate all map elements and zero-initialize them */
 	array = kzalloc(array_size, GFP_USER | __GFP_NOWARN);
@@ -56,6 +95,11 @@ static struct bpf_map *array_map_alloc(union bpf_attr *attr)
 
 	array->elem_size = elem_size;
 
+	if (percpu && bpf_array_alloc_percpu(array)) {
+		kvfree(array);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	return &array->map;
 }
 
@@ -71,6 +115,38 @@ static void *array_map_lookup_elem(struct bpf_map *map, void *key)
 	return array->value + array->elem_size * index;
 }
 
+/* Called from eBPF program, returns the value slot of the current cpu */
+static void *percpu_array_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 index = *(u32 *)key;
+
+	if (index >= array->map.max_entries)
+		return NULL;
+
+	return this_cpu_ptr(array->pptrs[index]);
+}
+
+/* Called from syscall, copies the values of all possible cpus to @value */
+int bpf_percpu_array_copy(struct bpf_map *map, void *key, void *value)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 index = *(u32 *)key;
+	void __percpu *pptr;
+	int cpu, off = 0;
+
+	if (index >= array->map.max_entries)
+		return -ENOENT;
+
+	pptr = array->pptrs[index];
+	for_each_possible_cpu(cpu) {
+		memcpy(value + off, per_cpu_ptr(pptr, cpu), array->elem_size);
+		off += array->elem_size;
+	}
+
+	return 0;
+}
+
 /* Called from syscall */
 static int array_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
 {
@@ -113,6 +189,60 @@ static int array_map_update_elem(struct bpf_map *map, void *key, void *value,
 	return 0;
 }
 
+/* Called from eBPF program, only updates the slot of the current cpu */
+static int percpu_array_map_update_elem(struct bpf_map *map, void *key,
+					void *value, u64 map_flags)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 index = *(u32 *)key;
+
+	if (map_flags > BPF_EXIST)
+		/* unknown flags */
+		return -EINVAL;
+
+	if (index >= array->map.max_entries)
+		/* all elements were pre-allocated, cannot insert a new one */
+		return -E2BIG;
+
+	if (map_flags == BPF_NOEXIST)
+		/* all elements already exist */
+		return -EEXIST;
+
+	memcpy(this_cpu_ptr(array->pptrs[index]), value, map->value_size);
+	return 0;
+}
+
+/* Called from syscall, @value holds the values of all possible cpus */
+int bpf_percpu_array_update(struct bpf_map *map, void *key, void *value,
+			    u64 map_flags)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 index = *(u32 *)key;
+	void __percpu *pptr;
+	int cpu, off = 0;
+
+	if (map_flags > BPF_EXIST)
+		/* unknown flags */
+		return -EINVAL;
+
+	if (index >= array->map.max_entries)
+		return -E2BIG;
+
+	if (map_flags == BPF_NOEXIST)
+		return -EEXIST;
+
+	/* the user may update a value while programs on other cpus are
+	 * working on it, same as with a shared array
+	 */
+	pptr = array->pptrs[index];
+	for_each_possible_cpu(cpu) {
+		memcpy(per_cpu_ptr(pptr, cpu), value + off, array->elem_size);
+		off += array->elem_size;
+	}
+
+	return 0;
+}
+
 /* Called from syscall or from eBPF program */
 static int array_map_delete_elem(struct bpf_map *map, void *key)
 {
@@ -131,9 +261,201 @@ static void array_map_free(struct bpf_map *map)
 	 */
 	synchronize_rcu();
 
+	if (map->map_type == BPF_MAP_TYPE_PERCPU_ARRAY)
+		bpf_array_free_percpu(array);
+
+	kvfree(array);
+}
+
+/* Called from eBPF program, which the verifier doesn't allow, and from
+ * syscall, where the fds that were stored can't be given back
+ */
+static void *perf_event_array_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	return NULL;
+}
+
+static void bpf_event_entry_free_rcu(struct rcu_head *rcu)
+{
+	struct bpf_event_entry *ee;
+
+	ee = container_of(rcu, struct bpf_event_entry, rcu);
+	fput(ee->perf_file);
+	kfree(ee);
+}
+
+/* Called from syscall, @value is the fd of a perf event */
+static int perf_event_array_map_update_elem(struct bpf_map *map, void *key,
+					    void *value, u64 map_flags)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	struct bpf_event_entry *ee, *old_ee;
+	u32 index = *(u32 *)key, ufd = *(u32 *)value;
+	struct perf_event *event;
+	struct file *perf_file;
+	int err;
+
+	if (map_flags != BPF_ANY)
+		/* the slots are overwritten as a whole */
+		return -EINVAL;
+
+	if (index >= array->map.max_entries)
+		return -E2BIG;
+
+	perf_file = perf_event_get(ufd);
+	if (IS_ERR(perf_file))
+		return PTR_ERR(perf_file);
+
+	/* only events that exist to carry bpf_perf_event_output() samples,
+	 * and no inherited ones, whose children the map couldn't track
+	 */
+	event = perf_file->private_data;
+	err = -EINVAL;
+	if (event->attr.type != PERF_TYPE_SOFTWARE ||
+	    event->attr.config != PERF_COUNT_SW_BPF_OUTPUT ||
+	    event->attr.inherit)
+		goto err_put;
+
+	/* we are under rcu_read_lock() of the syscall */
+	err = -ENOMEM;
+	ee = kzalloc(sizeof(*ee), GFP_ATOMIC | __GFP_NOWARN);
+	if (!ee)
+		goto err_put;
+
+	ee->event = event;
+	ee->perf_file = perf_file;
+
+	/* programs running on other cpus may still see the old entry */
+	old_ee = xchg(&array->ptrs[index], ee);
+	if (old_ee)
+		call_rcu(&old_ee->rcu, bpf_event_entry_free_rcu);
+	return 0;
+
+err_put:
+	fput(perf_file);
+	return err;
+}
+
+/* Called from syscall */
+static int perf_event_array_map_delete_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	struct bpf_event_entry *old_ee;
+	u32 index = *(u32 *)key;
+
+	if (index >= array->map.max_entries)
+		return -E2BIG;
+
+	old_ee = xchg(&array->ptrs[index], NULL);
+	if (!old_ee)
+		return -ENOENT;
+
+	call_rcu(&old_ee->rcu, bpf_event_entry_free_rcu);
+	return 0;
+}
+
+/* Called when map->refcnt goes to zero, either from workqueue or from syscall */
+static void perf_event_array_map_free(struct bpf_map *map)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	struct bpf_event_entry *ee;
+	int i;
+
+	/* wait for programs that might still be writing to the events */
+	synchronize_rcu();
+
+	for (i = 0; i < array->map.max_entries; i++) {
+		ee = array->ptrs[i];
+		if (ee) {
+			fput(ee->perf_file);
+			kfree(ee);
+		}
+	}
+
 	kvfree(array);
 }
 
+/* Called from eBPF program, which the verifier doesn't allow, and from
+ * syscall, where the fds that were stored can't be given back
+ */
+static void *prog_array_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	return NULL;
+}
+
+/* Called from syscall, @value is the fd of a program */
+static int prog_array_map_update_elem(struct bpf_map *map, void *key,
+				      void *value, u64 map_flags)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 index = *(u32 *)key, ufd = *(u32 *)value;
+	struct bpf_prog *prog, *old_prog;
+
+	if (map_flags != BPF_ANY)
+		/* the slots are overwritten as a whole */
+		return -EINVAL;
+
+	if (index >= array->map.max_entries)
+		return -E2BIG;
+
+	prog = bpf_prog_get(ufd);
+	if (IS_ERR(prog))
+		return PTR_ERR(prog);
+
+	if (!bpf_prog_array_compatible(array, prog)) {
+		bpf_prog_put(prog);
+		return -EINVAL;
+	}
+
+	/* bpf_prog_put() waits for a grace period before freeing, programs
+	 * that are in the middle of a tail call into @old_prog are fine
+	 */
+	old_prog = xchg(&array->ptrs[index], prog);
+	if (old_prog)
+		bpf_prog_put(old_prog);
+	return 0;
+}
+
+/* Called from syscall */
+static int prog_array_map_delete_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	struct bpf_prog *old_prog;
+	u32 index = *(u32 *)key;
+
+	if (index >= array->map.max_entries)
+		return -E2BIG;
+
+	old_prog = xchg(&array->ptrs[index], NULL);
+	if (!old_prog)
+		return -ENOENT;
+
+	bpf_prog_put(old_prog);
+	return 0;
+}
+
+/* Called when user space closes the map. The programs stored in the array
+ * may hold references on the map themselves, drop them here so that such
+ * cycles don't keep both alive forever
+ */
+void bpf_prog_array_map_clear(struct bpf_map *map)
+{
+	u32 i;
+
+	for (i = 0; i < map->max_entries; i++)
+		prog_array_map_delete_elem(map, &i);
+}
+
+/* Called when map->refcnt goes to zero, either from workqueue or from syscall */
+static void prog_array_map_free(struct bpf_map *map)
+{
+	/* wait for programs that might still be tail calling out of it */
+	synchronize_rcu();
+
+	bpf_prog_array_map_clear(map);
+	kvfree(container_of(map, struct bpf_array, map));
+}
+
 static const struct bpf_map_ops array_ops = {
 	.map_alloc = array_map_alloc,
 	.map_free = array_map_free,
@@ -148,9 +470,54 @@ static struct bpf_map_type_list array_type __read_mostly = {
 	.type = BPF_MAP_TYPE_ARRAY,
 };
 
+static const struct bpf_map_ops percpu_array_ops = {
+	.map_alloc = array_map_alloc,
+	.map_free = array_map_free,
+	.map_get_next_key = array_map_get_next_key,
+	.map_lookup_elem = percpu_array_map_lookup_elem,
+	.map_update_elem = percpu_array_map_update_elem,
+	.map_delete_elem = array_map_delete_elem,
+};
+
+static struct bpf_map_type_list percpu_array_type __read_mostly = {
+	.ops = &percpu_array_ops,
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+};
+
+static const struct bpf_map_ops perf_event_array_ops = {
+	.map_alloc = array_map_alloc,
+	.map_free = perf_event_array_map_free,
+	.map_get_next_key = array_map_get_next_key,
+	.map_lookup_elem = perf_event_array_map_lookup_elem,
+	.map_update_elem = perf_event_array_map_update_elem,
+	.map_delete_elem = perf_event_array_map_delete_elem,
+};
+
+static struct bpf_map_type_list perf_event_array_type __read_mostly = {
+	.ops = &perf_event_array_ops,
+	.type = BPF_MAP_TYPE_PERF_EVENT_ARRAY,
+};
+
+static const struct bpf_map_ops prog_array_ops = {
+	.map_alloc = array_map_alloc,
+	.map_free = prog_array_map_free,
+	.map_get_next_key = array_map_get_next_key,
+	.map_lookup_elem = prog_array_map_lookup_elem,
+	.map_update_elem = prog_array_map_update_elem,
+	.map_delete_elem = prog_array_map_delete_elem,
+};
+
+static struct bpf_map_type_list prog_array_type __read_mostly = {
+	.ops = &prog_array_ops,
+	.type = BPF_MAP_TYPE_PROG_ARRAY,
+};
+
 static int __init register_array_map(void)
 {
 	bpf_register_map_type(&array_type);
+	bpf_register_map_type(&percpu_array_type);
+	bpf_register_map_type(&perf_event_array_type);
+	bpf_register_map_type(&prog_array_type);
 	return 0;
 }
 late_initcall(register_array_map);
@@ -13,28 +13,121 @@
 #include <linux/jhash.h>
 #include <linux/filter.h>
 #include <linux/vmalloc.h>
+#include "percpu_freelist.h"
 
 struct bpf_htab {
 	struct bpf_map map;
 	struct hlist_head *buckets;
+	void *elems;			/* preallocated elements */
+	struct pcpu_freelist freelist;	/* free preallocated elements */
 	spinlock_t lock;
 	u32 count;	/* number of elements in this hashtable */
 	u32 n_buckets;	/* number of hash buckets */
 	u32 elem_size;	/* size of each element in bytes */
 };
 
-/* each htab element is struct htab_elem + key + value */
+/* each htab element is struct htab_elem + key + value, in per-cpu maps
+ * the value is a pointer to the per-cpu value area
+ */
 struct htab_elem {
 	struct hlist_node hash_node;
-	struct rcu_head rcu;
-	u32 hash;
+	union {
+		struct rcu_head rcu;
+		struct pcpu_freelist_node fnode;	/* preallocated maps */
+	};
+	union {
+		u32 hash;
+		u32 key_size;	/* used by the rcu callback once unlinked */
+	};
 	char key[0] __aligned(8);
 };
 
+static inline bool htab_is_percpu(const struct bpf_htab *htab)
+{
+	return htab->map.map_type == BPF_MAP_TYPE_PERCPU_HASH;
+}
+
+static inline bool htab_is_prealloc(const struct bpf_htab *htab)
+{
+	return !(htab->map.map_flags & BPF_F_NO_PREALLOC);
+}
+
+static inline void __percpu *htab_elem_get_ptr(struct htab_elem *l,
+					       u32 key_size)
+{
+	return *(void __percpu **)(l->key + round_up(key_size, 8));
+}
+
+static inline void htab_elem_set_ptr(struct htab_elem *l, u32 key_size,
+				     void __percpu *pptr)
+{
+	*(void __percpu **)(l->key + round_up(key_size, 8)) = pptr;
+}
+
+static inline struct htab_elem *get_htab_elem(struct bpf_htab *htab, int i)
+{
+	return (struct htab_elem *) (htab->elems + i * htab->elem_size);
+}
+
+static void htab_free_elems(struct bpf_htab *htab, u32 num_entries,
+			    bool percpu)
+{
+	int i;
+
+	if (percpu)
+		for (i = 0; i < num_entries; i++)
+			free_percpu(htab_elem_get_ptr(get_htab_elem(htab, i),
+						      htab->map.key_size));
+	vfree(htab->elems);
+}
+
+/* Allocate all elements at map creation, so that updates from programs
+ * attached anywhere, including to the allocator itself, never allocate
+ * memory.  Every possible cpu gets one element on top of max_entries for
+ * updates that replace an existing element.
+ */
+static int prealloc_init(struct bpf_htab *htab, u32 num_entries, bool percpu)
+{
+	int err = -ENOMEM, i;
+
+	htab->elems = vzalloc(htab->elem_size * num_entries);
+	if (!htab->elems)
+		return -ENOMEM;
+
+	if (percpu) {
+		for (i = 0; i < num_entries; i++) {
+			void __percpu *pptr;
+
+			pptr = __alloc_percpu_gfp(round_up(htab->map.value_size, 8),
+						  8, GFP_USER | __GFP_NOWARN);
+			if (!pptr)
+				goto free_elems;
+			htab_elem_set_ptr(get_htab_elem(htab, i),
+					  htab->map.key_size, pptr);
+		}
+	}
+
+	err = pcpu_freelist_init(&htab->freelist);
+	if (err)
+		goto free_elems;
+
+	pcpu_freelist_populate(&htab->freelist,
+			       htab->elems + offsetof(struct htab_elem, fnode),
+			       htab->elem_size, num_entries);
+	return 0;
+
+free_elems:
+	htab_free_elems(htab, num_entries, percpu);
+	return err;
+}
+
 /* Called from syscall */
 static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 {
+	bool percpu = attr->map_type == BPF_MAP_TYPE_PERCPU_HASH;
+	bool prealloc = !(attr->map_flags & BPF_F_NO_PREALLOC);
 	struct bpf_htab *htab;
+	u32 num_entries;
 	int err, i;
 
 	htab = kzalloc(sizeof(*htab), GFP_USER);
@@ -45,13 +138,15 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	htab->map.key_size = attr->key_size;
 	htab->map.value_size = attr->value_size;
 	htab->map.max_entries = attr->max_entries;
+	htab->map.map_flags = attr->map_flags;
 
 	/* check sanity of attributes.
 	 * value_size == 0 may be allowed in the future to use map as a set
 	 */
 	err = -EINVAL;
 	if (htab->map.max_entries == 0 || htab->map.key_size == 0 ||
-	    htab->map.value_size == 0)
+	    htab->map.value_size == 0 ||
+	    attr->map_flags & ~BPF_F_NO_PREALLOC)
 		goto free_htab;
 
 	/* hash table size must be power of 2 */
@@ -64,6 +159,23 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 		 */
 		goto free_htab;
 
+	if (percpu && round_up(htab->map.value_size, 8) > PCPU_MIN_UNIT_SIZE)
+		/* make sure the size of a per-cpu value area is sane */
+		goto free_htab;
+
+	htab->elem_size = sizeof(struct htab_elem) +
+			  round_up(htab->map.key_size, 8);
+	if (percpu)
+		htab->elem_size += sizeof(void *);
+	else
+		htab->elem_size += round_up(htab->map.value_size, 8);
+
+	num_entries = htab->map.max_entries + num_possible_cpus();
+	if (prealloc &&
+	    (u64) htab->elem_size * num_entries >= U32_MAX - PAGE_SIZE)
+		/* make sure the preallocated area size doesn't overflow */
+		goto free_htab;
+
 	err = -ENOMEM;
 	/* prevent zero size kmalloc and check for u32 overflow */
 	if (htab->n_buckets == 0 ||
@@ -85,11 +197,16 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	spin_lock_init(&htab->lock);
 	htab->count = 0;
 
-	htab->elem_size = sizeof(struct htab_elem) +
-			  round_up(htab->map.key_size, 8) +
-			  htab->map.value_size;
+	if (prealloc) {
+		err = prealloc_init(htab, num_entries, percpu);
+		if (err)
+			goto free_buckets;
+	}
+
 	return &htab->map;
 
+free_buckets:
+	kvfree(htab->buckets);
 free_htab:
 	kfree(htab);
 	return ERR_PTR(err);
@@ -117,12 +234,10 @@ static struct htab_elem *lookup_elem_raw(struct hlist_head *head, u32 hash,
 	return NULL;
 }
 
-/* Called from syscall or from eBPF program */
-static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
+static struct htab_elem *__htab_map_lookup_elem(struct bpf_map *map, void *key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct hlist_head *head;
-	struct htab_elem *l;
 	u32 hash, key_size;
 
 	/* Must be called with rcu_read_lock. */
@@ -134,7 +249,13 @@ static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
 
 	head = select_bucket(htab, hash);
 
-	l = lookup_elem_raw(head, hash, key, key_size);
+	return lookup_elem_raw(head, hash, key, key_size);
+}
+
+/* Called from syscall or from eBPF program */
+static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct htab_elem *l = __htab_map_lookup_elem(map, key);
 
 	if (l)
 		return l->key + round_up(map->key_size, 8);
@@ -142,6 +263,42 @@ static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
 	return NULL;
 }
 
+/* Called from eBPF program, returns the value slot of the current cpu */
+static void *htab_percpu_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct htab_elem *l = __htab_map_lookup_elem(map, key);
+
+	if (l)
+		return this_cpu_ptr(htab_elem_get_ptr(l, map->key_size));
+
+	return NULL;
+}
+
+/* Called from syscall, copies the values of all possible cpus to @value */
+int bpf_percpu_hash_copy(struct bpf_map *map, void *key, void *value)
+{
+	u32 size = round_up(map->value_size, 8);
+	void __percpu *pptr;
+	struct htab_elem *l;
+	int cpu, off = 0;
+	int ret = -ENOENT;
+
+	rcu_read_lock();
+	l = __htab_map_lookup_elem(map, key);
+	if (!l)
+		goto out;
+
+	pptr = htab_elem_get_ptr(l, map->key_size);
+	for_each_possible_cpu(cpu) {
+		memcpy(value + off, per_cpu_ptr(pptr, cpu), size);
+		off += size;
+	}
+	ret = 0;
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
 /* Called from syscall */
 static int htab_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
 {
@@ -200,6 +357,41 @@ find_first_elem:
 	return -ENOENT;
 }
 
+static void htab_elem_free_rcu(struct rcu_head *head)
+{
+	struct htab_elem *l = container_of(head, struct htab_elem, rcu);
+
+	free_percpu(htab_elem_get_ptr(l, l->key_size));
+	kfree(l);
+}
+
+static struct htab_elem *alloc_htab_elem(struct bpf_htab *htab)
+{
+	struct pcpu_freelist_node *node;
+
+	if (!htab_is_prealloc(htab))
+		return kmalloc(htab->elem_size, GFP_ATOMIC | __GFP_NOWARN);
+
+	node = pcpu_freelist_pop(&htab->freelist);
+	return node ? container_of(node, struct htab_elem, fnode) : NULL;
+}
+
+/* Called with the element unlinked from its bucket.  Preallocated elements
+ * are reused right away, a program still holding a pointer to the value
+ * may see it change under it.
+ */
+static void free_htab_elem(struct bpf_htab *htab, struct htab_elem *l)
+{
+	if (htab_is_prealloc(htab)) {
+		pcpu_freelist_push(&htab->freelist, &l->fnode);
+	} else if (htab_is_percpu(htab)) {
+		l->key_size = htab->map.key_size;
+		call_rcu(&l->rcu, htab_elem_free_rcu);
+	} else {
+		kfree_rcu(l, rcu);
+	}
+}
+
 /* Called from syscall or from eBPF program */
 static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 				u64 map_flags)
@@ -218,9 +410,9 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 	WARN_ON_ONCE(!rcu_read_lock_held());
 
 	/* allocate new element outside of lock */
-	l_new = kmalloc(htab->elem_size, GFP_ATOMIC);
+	l_new = alloc_htab_elem(htab);
 	if (!l_new)
-		return -ENOMEM;
+		return htab_is_prealloc(htab) ? -E2BIG : -ENOMEM;
 
 	key_size = map->key_size;
 
@@ -262,7 +454,7 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 	hlist_add_head_rcu(&l_new->hash_node, head);
 	if (l_old) {
 		hlist_del_rcu(&l_old->hash_node);
-		kfree_rcu(l_old, rcu);
+		free_htab_elem(htab, l_old);
 	} else {
 		htab->count++;
 	}
@@ -271,7 +463,142 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 	return 0;
 err:
 	spin_unlock_irqrestore(&htab->lock, flags);
-	kfree(l_new);
+	if (htab_is_prealloc(htab))
+		pcpu_freelist_push(&htab->freelist, &l_new->fnode);
+	else
+		kfree(l_new);
+	return ret;
+}
+
+static void pcpu_zero_value(struct bpf_htab *htab, void __percpu *pptr)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(pptr, cpu), 0, round_up(htab->map.value_size, 8));
+}
+
+static void pcpu_copy_value(struct bpf_htab *htab, void __percpu *pptr,
+			    void *value, bool onallcpus)
+{
+	u32 size = round_up(htab->map.value_size, 8);
+	int cpu, off = 0;
+
+	if (!onallcpus) {
+		/* an eBPF program only ever updates its own cpu slot */
+		memcpy(this_cpu_ptr(pptr), value, htab->map.value_size);
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		memcpy(per_cpu_ptr(pptr, cpu), value + off, size);
+		off += size;
+	}
+}
+
+/* Existing elements are updated in place, so that programs on other cpus
+ * keep their slots.  A new element starts out zeroed on all other cpus.
+ */
+static int __htab_percpu_map_update_elem(struct bpf_map *map, void *key,
+					 void *value, u64 map_flags,
+					 bool onallcpus)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	struct htab_elem *l_new, *l_old;
+	struct hlist_head *head;
+	void __percpu *pptr;
+	unsigned long flags;
+	u32 hash, key_size;
+	int ret;
+
+	if (map_flags > BPF_EXIST)
+		/* unknown flags */
+		return -EINVAL;
+
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	key_size = map->key_size;
+
+	hash = htab_map_hash(key, key_size);
+
+	/* bpf_map_update_elem() can be called in_irq() */
+	spin_lock_irqsave(&htab->lock, flags);
+
+	head = select_bucket(htab, hash);
+
+	l_old = lookup_elem_raw(head, hash, key, key_size);
+
+	if (!l_old && unlikely(htab->count >= map->max_entries)) {
+		ret = -E2BIG;
+		goto err;
+	}
+
+	if (l_old && map_flags == BPF_NOEXIST) {
+		ret = -EEXIST;
+		goto err;
+	}
+
+	if (!l_old && map_flags == BPF_EXIST) {
+		ret = -ENOENT;
+		goto err;
+	}
+
+	if (l_old) {
+		pcpu_copy_value(htab, htab_elem_get_ptr(l_old, key_size),
+				value, onallcpus);
+	} else {
+		l_new = alloc_htab_elem(htab);
+		if (!l_new) {
+			ret = htab_is_prealloc(htab) ? -E2BIG : -ENOMEM;
+			goto err;
+		}
+
+		if (htab_is_prealloc(htab)) {
+			/* a reused element must not leak old values */
+			pptr = htab_elem_get_ptr(l_new, key_size);
+			if (!onallcpus)
+				pcpu_zero_value(htab, pptr);
+		} else {
+			ret = -ENOMEM;
+			pptr = __alloc_percpu_gfp(round_up(map->value_size, 8),
+						  8, GFP_ATOMIC | __GFP_NOWARN);
+			if (!pptr) {
+				kfree(l_new);
+				goto err;
+			}
+			htab_elem_set_ptr(l_new, key_size, pptr);
+		}
+
+		memcpy(l_new->key, key, key_size);
+		pcpu_copy_value(htab, pptr, value, onallcpus);
+		l_new->hash = hash;
+
+		hlist_add_head_rcu(&l_new->hash_node, head);
+		htab->count++;
+	}
+	ret = 0;
+err:
+	spin_unlock_irqrestore(&htab->lock, flags);
+	return ret;
+}
+
+/* Called from eBPF program */
+static int htab_percpu_map_update_elem(struct bpf_map *map, void *key,
+				       void *value, u64 map_flags)
+{
+	return __htab_percpu_map_update_elem(map, key, value, map_flags, false);
+}
+
+/* Called from syscall, @value holds the values of all possible cpus */
+int bpf_percpu_hash_update(struct bpf_map *map, void *key, void *value,
+			   u64 map_flags)
+{
+	int ret;
+
+	rcu_read_lock();
+	ret = __htab_percpu_map_update_elem(map, key, value, map_flags, true);
+	rcu_read_unlock();
+
 	return ret;
 }
 
@@ -300,7 +627,7 @@ static int htab_map_delete_elem(struct bpf_map *map, void *key)
 	if (l) {
 		hlist_del_rcu(&l->hash_node);
 		htab->count--;
-		kfree_rcu(l, rcu);
+		free_htab_elem(htab, l);
 		ret = 0;
 	}
 
@@ -320,6 +647,8 @@ static void delete_all_elements(struct bpf_htab *htab)
 		hlist_for_each_entry_safe(l, n, head, hash_node) {
 			hlist_del_rcu(&l->hash_node);
 			htab->count--;
+			if (htab_is_percpu(htab))
+				free_percpu(htab_elem_get_ptr(l, htab->map.key_size));
 			kfree(l);
 		}
 	}
@@ -337,10 +666,17 @@ static void htab_map_free(struct bpf_map *map)
 	 */
 	synchronize_rcu();
 
-	/* some of kfree_rcu() callbacks for elements of this map may not have
-	 * executed. It's ok. Proceed to free residual elements and map itself
-	 */
-	delete_all_elements(htab);
+	if (htab_is_prealloc(htab)) {
+		htab_free_elems(htab, map->max_entries + num_possible_cpus(),
+				htab_is_percpu(htab));
+		pcpu_freelist_destroy(&htab->freelist);
+	} else {
+		/* some of kfree_rcu() callbacks for elements of this map may
+		 * not have executed. It's ok. Proceed to free residual
+		 * elements and map itself
+		 */
+		delete_all_elements(htab);
+	}
 	kvfree(htab->buckets);
 	kfree(htab);
 }
@@ -359,9 +695,24 @@ static struct bpf_map_type_list htab_type __read_mostly = {
 	.type = BPF_MAP_TYPE_HASH,
 };
 
+static const struct bpf_map_ops htab_percpu_ops = {
+	.map_alloc = htab_map_alloc,
+	.map_free = htab_map_free,
+	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_elem = htab_percpu_map_lookup_elem,
+	.map_update_elem = htab_percpu_map_update_elem,
+	.map_delete_elem = htab_map_delete_elem,
+};
+
+static struct bpf_map_type_list htab_percpu_type __read_mostly = {
+	.ops = &htab_percpu_ops,
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+};
+
 static int __init register_htab_map(void)
 {
 	bpf_register_map_type(&htab_type);
+	bpf_register_map_type(&htab_percpu_type);
 	return 0;
 }
 late_initcall(register_htab_map);
@@ -0,0 +1,321 @@
+/*
+ * Stack trace map: deduplicated kernel or user stack traces, keyed by an
+ * id derived from the hash of the stack, filled by bpf_get_stackid().
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/bpf.h>
+#include <linux/jhash.h>
+#include <linux/filter.h>
+#include <linux/vmalloc.h>
+#include <linux/stacktrace.h>
+#include "percpu_freelist.h"
+
+#define BPF_MAX_STACK_DEPTH	127
+
+struct stack_map_bucket {
+	struct pcpu_freelist_node fnode;
+	u32 hash;
+	u32 nr;
+	u64 ip[];
+};
+
+struct bpf_stack_map {
+	struct bpf_map map;
+	void *elems;
+	struct pcpu_freelist freelist;
+	u32 n_buckets;
+	struct stack_map_bucket *buckets[];
+};
+
+/* room for the deepest stack plus the frames the caller asks to skip, and
+ * the ULONG_MAX terminator some architectures append
+ */
+struct stack_map_buf {
+	unsigned long ips[BPF_MAX_STACK_DEPTH + BPF_F_SKIP_FIELD_MASK + 1];
+};
+
+/* eBPF programs don't nest on a cpu, see trace_call_bpf() */
+static DEFINE_PER_CPU(struct stack_map_buf, stack_map_buf);
+
+static int prealloc_elems_and_freelist(struct bpf_stack_map *smap)
+{
+	u32 elem_size = sizeof(struct stack_map_bucket) + smap->map.value_size;
+	int err;
+
+	smap->elems = vzalloc(elem_size * smap->map.max_entries);
+	if (!smap->elems)
+		return -ENOMEM;
+
+	err = pcpu_freelist_init(&smap->freelist);
+	if (err)
+		goto free_elems;
+
+	pcpu_freelist_populate(&smap->freelist, smap->elems, elem_size,
+			       smap->map.max_entries);
+	return 0;
+
+free_elems:
+	vfree(smap->elems);
+	return err;
+}
+
+/* Called from syscall */
+static struct bpf_map *stack_map_alloc(union bpf_attr *attr)
+{
+	u32 value_size = attr->value_size;
+	struct bpf_stack_map *smap;
+	u64 cost, n_buckets;
+	int err;
+
+	/* check sanity of attributes */
+	if (attr->max_entries == 0 || attr->key_size != 4 ||
+	    value_size < 8 || value_size % 8 ||
+	    value_size / 8 > BPF_MAX_STACK_DEPTH || attr->map_flags)
+		return ERR_PTR(-EINVAL);
+
+	if (attr->max_entries > 1U << 31)
+		return ERR_PTR(-E2BIG);
+
+	/* hash table size must be power of 2 */
+	n_buckets = roundup_pow_of_two(attr->max_entries);
+
+	/* both the bucket array and the preallocated traces must fit */
+	cost = (u64) attr->max_entries *
+	       (sizeof(struct stack_map_bucket) + value_size);
+	if (cost >= U32_MAX - PAGE_SIZE)
+		return ERR_PTR(-E2BIG);
+
+	cost = n_buckets * sizeof(struct stack_map_bucket *) + sizeof(*smap);
+	if (cost >= U32_MAX - PAGE_SIZE)
+		return ERR_PTR(-E2BIG);
+
+	smap = kzalloc(cost, GFP_USER | __GFP_NOWARN);
+	if (!smap) {
+		smap = vzalloc(cost);
+		if (!smap)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	smap->map.key_size = attr->key_size;
+	smap->map.value_size = value_size;
+	smap->map.max_entries = attr->max_entries;
+	smap->n_buckets = n_buckets;
+
+	err = prealloc_elems_and_freelist(smap);
+	if (err) {
+		kvfree(smap);
+		return ERR_PTR(err);
+	}
+
+	return &smap->map;
+}
+
+static bool stack_map_bucket_equal(struct stack_map_bucket *bucket,
+				   unsigned long *ips, u32 nr)
+{
+	u32 i;
+
+	if (bucket->nr != nr)
+		return false;
+
+	for (i = 0; i < nr; i++)
+		if (bucket->ip[i] != ips[i])
+			return false;
+
+	return true;
+}
+
+static u64 bpf_get_stackid(u64 r1, u64 r2, u64 flags, u64 r4, u64 r5)
+{
+	struct pt_regs *regs = (struct pt_regs *) (long) r1;
+	struct bpf_map *map = (struct bpf_map *) (long) r2;
+	struct bpf_stack_map *smap = container_of(map, struct bpf_stack_map, map);
+	struct stack_map_bucket *bucket, *new_bucket, *old_bucket;
+	u32 skip = flags & BPF_F_SKIP_FIELD_MASK;
+	struct pcpu_freelist_node *node;
+	struct stack_trace trace;
+	unsigned long *ips;
+	u32 hash, id, nr, i;
+
+	if (unlikely(flags & ~(BPF_F_SKIP_FIELD_MASK | BPF_F_USER_STACK |
+			       BPF_F_FAST_STACK_CMP | BPF_F_REUSE_STACKID)))
+		return -EINVAL;
+
+	ips = this_cpu_ptr(&stack_map_buf)->ips;
+
+	trace.nr_entries = 0;
+	trace.max_entries = map->value_size / 8 + skip;
+	trace.entries = ips;
+	trace.skip = 0;
+
+	if (flags & BPF_F_USER_STACK)
+		save_stack_trace_user(&trace);
+	else
+		save_stack_trace_regs(regs, &trace);
+
+	nr = trace.nr_entries;
+	if (nr && ips[nr - 1] == ULONG_MAX)
+		nr--;
+
+	if (nr <= skip)
+		/* no stack to store, e.g. no user stack of a kernel thread */
+		return -EFAULT;
+
+	ips += skip;
+	nr -= skip;
+
+	hash = jhash2((u32 *) ips, nr * sizeof(unsigned long) / sizeof(u32), 0);
+	id = hash & (smap->n_buckets - 1);
+	bucket = READ_ONCE(smap->buckets[id]);
+
+	if (bucket && bucket->hash == hash) {
+		if (flags & BPF_F_FAST_STACK_CMP)
+			return id;
+		if (stack_map_bucket_equal(bucket, ips, nr))
+			return id;
+	}
+
+	/* this stack is new, and another one already hashed into its id */
+	if (bucket && !(flags & BPF_F_REUSE_STACKID))
+		return -EEXIST;
+
+	node = pcpu_freelist_pop(&smap->freelist);
+	if (unlikely(!node))
+		return -ENOMEM;
+	new_bucket = container_of(node, struct stack_map_bucket, fnode);
+
+	for (i = 0; i < nr; i++)
+		new_bucket->ip[i] = ips[i];
+	new_bucket->hash = hash;
+	new_bucket->nr = nr;
+
+	old_bucket = xchg(&smap->buckets[id], new_bucket);
+	if (old_bucket)
+		pcpu_freelist_push(&smap->freelist, &old_bucket->fnode);
+	return id;
+}
+
+const struct bpf_func_proto bpf_get_stackid_proto = {
+	.func		= bpf_get_stackid,
+	.gpl_only	= true,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_CONST_MAP_PTR,
+	.arg3_type	= ARG_ANYTHING,
+};
+
+/* Called from eBPF program, which the verifier doesn't allow */
+static void *stack_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	return NULL;
+}
+
+/* Called from syscall, the ips are padded with zeroes to value_size */
+int bpf_stackmap_copy(struct bpf_map *map, void *key, void *value)
+{
+	struct bpf_stack_map *smap = container_of(map, struct bpf_stack_map, map);
+	struct stack_map_bucket *bucket, *old_bucket;
+	u32 id = *(u32 *)key, trace_len;
+
+	if (unlikely(id >= smap->n_buckets))
+		return -ENOENT;
+
+	/* take the bucket out while copying, so that it isn't reused under us */
+	bucket = xchg(&smap->buckets[id], NULL);
+	if (!bucket)
+		return -ENOENT;
+
+	trace_len = bucket->nr * sizeof(u64);
+	memcpy(value, bucket->ip, trace_len);
+	memset(value + trace_len, 0, map->value_size - trace_len);
+
+	old_bucket = xchg(&smap->buckets[id], bucket);
+	if (old_bucket)
+		pcpu_freelist_push(&smap->freelist, &old_bucket->fnode);
+	return 0;
+}
+
+/* Called from syscall */
+static int stack_map_get_next_key(struct bpf_map *map, void *key,
+				  void *next_key)
+{
+	struct bpf_stack_map *smap = container_of(map, struct bpf_stack_map, map);
+	u32 id = *(u32 *)key;
+
+	/* an id outside of the map starts the walk from the first stack */
+	if (id >= smap->n_buckets)
+		id = 0;
+	else
+		id++;
+
+	for (; id < smap->n_buckets; id++) {
+		if (READ_ONCE(smap->buckets[id])) {
+			*(u32 *)next_key = id;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int stack_map_update_elem(struct bpf_map *map, void *key, void *value,
+				 u64 map_flags)
+{
+	return -EINVAL;
+}
+
+/* Called from syscall */
+static int stack_map_delete_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_stack_map *smap = container_of(map, struct bpf_stack_map, map);
+	struct stack_map_bucket *old_bucket;
+	u32 id = *(u32 *)key;
+
+	if (unlikely(id >= smap->n_buckets))
+		return -EINVAL;
+
+	old_bucket = xchg(&smap->buckets[id], NULL);
+	if (old_bucket) {
+		pcpu_freelist_push(&smap->freelist, &old_bucket->fnode);
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+/* Called when map->refcnt goes to zero, either from workqueue or from syscall */
+static void stack_map_free(struct bpf_map *map)
+{
+	struct bpf_stack_map *smap = container_of(map, struct bpf_stack_map, map);
+
+	/* wait for bpf programs to complete before freeing stack map */
+	synchronize_rcu();
+
+	vfree(smap->elems);
+	pcpu_freelist_destroy(&smap->freelist);
+	kvfree(smap);
+}
+
+static const struct bpf_map_ops stack_map_ops = {
+	.map_alloc = stack_map_alloc,
+	.map_free = stack_map_free,
+	.map_get_next_key = stack_map_get_next_key,
+	.map_lookup_elem = stack_map_lookup_elem,
+	.map_update_elem = stack_map_update_elem,
+	.map_delete_elem = stack_map_delete_elem,
+};
+
+static struct bpf_map_type_list stack_map_type __read_mostly = {
+	.ops = &stack_map_ops,
+	.type = BPF_MAP_TYPE_STACK_TRACE,
+};
+
+static int __init register_stack_map(void)
+{
+	bpf_register_map_type(&stack_map_type);
+	return 0;
+}
+late_initcall(register_stack_map);
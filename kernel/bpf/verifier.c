@@ -63,12 +63,24 @@
  * (like pointer plus pointer becomes UNKNOWN_VALUE type)
  *
  * When verifier sees load or store instructions the type of base register
- * can be: PTR_TO_MAP_VALUE, PTR_TO_CTX, FRAME_PTR. These are three pointer
- * types recognized by check_mem_access() function.
+ * can be: PTR_TO_MAP_VALUE, PTR_TO_CTX, FRAME_PTR, PTR_TO_PACKET. These are
+ * four pointer types recognized by check_mem_access() function.
  *
  * PTR_TO_MAP_VALUE means that this register is pointing to 'map element value'
  * and the range of [ptr, ptr + map's value_size) is accessible.
  *
+ * PTR_TO_PACKET and PTR_TO_PACKET_END are loaded from the context of program
+ * types that see raw packets. A packet pointer may be moved forward by
+ * constants, and only the bytes that a comparison against PTR_TO_PACKET_END
+ * proved to be within the packet are accessible:
+ *    BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data)),
+ *    BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)),
+ *    BPF_MOV64_REG(BPF_REG_4, BPF_REG_2),
+ *    BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, 14),
+ *    BPF_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 1),
+ * after the jump, in the fall-through state, [R2, R2 + 14) is accessible.
+ * See find_good_pkt_pointers().
+ *
  * registers used to pass values to function calls are checked against
  * function argument constraints.
  *
@@ -125,19 +137,6 @@
  * are set to NOT_INIT to indicate that they are no longer readable.
  */
 
-/* types of values stored in eBPF registers */
-enum bpf_reg_type {
-	NOT_INIT = 0,		 /* nothing was written into register */
-	UNKNOWN_VALUE,		 /* reg doesn't contain a valid pointer */
-	PTR_TO_CTX,		 /* reg points to bpf_context */
-	CONST_PTR_TO_MAP,	 /* reg points to struct bpf_map */
-	PTR_TO_MAP_VALUE,	 /* reg points to map element value */
-	PTR_TO_MAP_VALUE_OR_NULL,/* points to map elem value or NULL */
-	FRAME_PTR,		 /* reg == frame_pointer */
-	PTR_TO_STACK,		 /* reg == frame_pointer + imm */
-	CONST_IMM,		 /* constant integer value */
-};
-
 struct reg_state {
 	enum bpf_reg_type type;
 	union {
@@ -148,9 +147,21 @@ struct reg_state {
 		 *   PTR_TO_MAP_VALUE_OR_NULL
 		 */
 		struct bpf_map *map_ptr;
+
+		/* valid when type == PTR_TO_PACKET: the register points 'off'
+		 * bytes past the start of the packet, and the first 'range'
+		 * bytes of the packet were checked against PTR_TO_PACKET_END
+		 */
+		struct {
+			u16 off;
+			u16 range;
+		};
 	};
 };
 
+/* packet pointers only move by constants, keep them well within u16 */
+#define MAX_PACKET_OFF 0xffff
+
 enum bpf_stack_slot_type {
 	STACK_INVALID,    /* nothing was stored in this stack slot */
 	STACK_SPILL,      /* register spilled into stack */
@@ -236,6 +247,8 @@ static const char * const reg_type_str[] = {
 	[FRAME_PTR]		= "fp",
 	[PTR_TO_STACK]		= "fp",
 	[CONST_IMM]		= "imm",
+	[PTR_TO_PACKET]		= "pkt",
+	[PTR_TO_PACKET_END]	= "pkt_end",
 };
 
 static void print_verifier_state(struct verifier_env *env)
@@ -255,6 +268,10 @@ static void print_verifier_state(struct verifier_env *env)
 			verbose("(ks=%d,vs=%d)",
 				env->cur_state.regs[i].map_ptr->key_size,
 				env->cur_state.regs[i].map_ptr->value_size);
+		else if (t == PTR_TO_PACKET)
+			verbose("(off=%d,r=%d)",
+				env->cur_state.regs[i].off,
+				env->cur_state.regs[i].range);
 	}
 	for (i = 0; i < MAX_BPF_STACK; i += BPF_REG_SIZE) {
 		if (env->cur_state.stack_slot_type[i] == STACK_SPILL)
@@ -544,7 +561,9 @@ static int check_stack_write(struct verifier_state *state, int off, int size,
 	if (value_regno >= 0 &&
 	    (state->regs[value_regno].type == PTR_TO_MAP_VALUE ||
 	     state->regs[value_regno].type == PTR_TO_STACK ||
-	     state->regs[value_regno].type == PTR_TO_CTX)) {
+	     state->regs[value_regno].type == PTR_TO_CTX ||
+	     state->regs[value_regno].type == PTR_TO_PACKET ||
+	     state->regs[value_regno].type == PTR_TO_PACKET_END)) {
 
 		/* register containing pointer is being spilled into stack */
 		if (size != BPF_REG_SIZE) {
@@ -623,12 +642,29 @@ static int check_map_access(struct verifier_env *env, u32 regno, int off,
 	return 0;
 }
 
+/* check read/write into the packet, [0, reg->range) of it is known to be
+ * within the packet
+ */
+static int check_packet_access(struct verifier_env *env, u32 regno, int off,
+			       int size)
+{
+	struct reg_state *reg = &env->cur_state.regs[regno];
+
+	off += reg->off;
+	if (off < 0 || off + size > reg->range) {
+		verbose("invalid access to packet, off=%d size=%d, R%d(off=%d,r=%d)\n",
+			off, size, regno, reg->off, reg->range);
+		return -EACCES;
+	}
+	return 0;
+}
+
 /* check access to 'struct bpf_context' fields */
 static int check_ctx_access(struct verifier_env *env, int off, int size,
-			    enum bpf_access_type t)
+			    enum bpf_access_type t, enum bpf_reg_type *reg_type)
 {
 	if (env->prog->aux->ops->is_valid_access &&
-	    env->prog->aux->ops->is_valid_access(off, size, t))
+	    env->prog->aux->ops->is_valid_access(off, size, t, reg_type))
 		return 0;
 
 	verbose("invalid bpf_context access off=%d size=%d\n", off, size);
@@ -663,7 +699,23 @@ static int check_mem_access(struct verifier_env *env, u32 regno, int off,
 			mark_reg_unknown_value(state->regs, value_regno);
 
 	} else if (state->regs[regno].type == PTR_TO_CTX) {
-		err = check_ctx_access(env, off, size, t);
+		enum bpf_reg_type reg_type = UNKNOWN_VALUE;
+
+		err = check_ctx_access(env, off, size, t, &reg_type);
+		if (!err && t == BPF_READ && value_regno >= 0) {
+			mark_reg_unknown_value(state->regs, value_regno);
+			/* packet pointers start out with nothing checked */
+			state->regs[value_regno].type = reg_type;
+		}
+
+	} else if (state->regs[regno].type == PTR_TO_PACKET) {
+		if (t == BPF_WRITE && value_regno >= 0 &&
+		    state->regs[value_regno].type != UNKNOWN_VALUE &&
+		    state->regs[value_regno].type != CONST_IMM) {
+			verbose("R%d leaks addr into packet\n", value_regno);
+			return -EACCES;
+		}
+		err = check_packet_access(env, regno, off, size);
 		if (!err && t == BPF_READ && value_regno >= 0)
 			mark_reg_unknown_value(state->regs, value_regno);
 
@@ -833,6 +885,39 @@ static int check_func_arg(struct verifier_env *env, u32 regno,
 	return err;
 }
 
+/* map types that only work with one helper, and that helper only with them:
+ * stack trace maps are only filled by bpf_get_stackid(), perf event arrays
+ * only written to by bpf_perf_event_output() and program arrays only jumped
+ * through by bpf_tail_call()
+ */
+static const struct {
+	int map_type;
+	int func_id;
+} func_limit[] = {
+	{BPF_MAP_TYPE_STACK_TRACE, BPF_FUNC_get_stackid},
+	{BPF_MAP_TYPE_PERF_EVENT_ARRAY, BPF_FUNC_perf_event_output},
+	{BPF_MAP_TYPE_PROG_ARRAY, BPF_FUNC_tail_call},
+};
+
+static int check_map_func_compatibility(struct bpf_map *map, int func_id)
+{
+	int i;
+
+	if (!map)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(func_limit); i++) {
+		if ((map->map_type == func_limit[i].map_type) !=
+		    (func_id == func_limit[i].func_id)) {
+			verbose("cannot pass map_type %d into func %d\n",
+				map->map_type, func_id);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
 static int check_call(struct verifier_env *env, int func_id)
 {
 	struct verifier_state *state = &env->cur_state;
@@ -879,6 +964,10 @@ static int check_call(struct verifier_env *env, int func_id)
 	if (err)
 		return err;
 
+	err = check_map_func_compatibility(map, func_id);
+	if (err)
+		return err;
+
 	/* reset caller saved regs */
 	for (i = 0; i < CALLER_SAVED_REGS; i++) {
 		reg = regs + caller_saved[i];
@@ -990,7 +1079,9 @@ static int check_alu_op(struct reg_state *regs, struct bpf_insn *insn)
 
 	} else {	/* all other ALU ops: and, sub, xor, add, ... */
 
-		bool stack_relative = false;
+		bool stack_relative = false, packet_relative = false;
+		struct reg_state pkt_reg;
+		s64 pkt_off = 0;
 
 		if (BPF_SRC(insn->code) == BPF_X) {
 			if (insn->imm != 0 || insn->off != 0) {
@@ -1035,6 +1126,25 @@ static int check_alu_op(struct reg_state *regs, struct bpf_insn *insn)
 		    BPF_SRC(insn->code) == BPF_K)
 			stack_relative = true;
 
+		/* pattern match 'bpf_add Rx, imm' and 'bpf_add Rx, Ry' where
+		 * Rx is a packet pointer and Ry a known constant
+		 */
+		if (opcode == BPF_ADD && BPF_CLASS(insn->code) == BPF_ALU64 &&
+		    regs[insn->dst_reg].type == PTR_TO_PACKET) {
+			if (BPF_SRC(insn->code) == BPF_K) {
+				pkt_off = insn->imm;
+				packet_relative = true;
+			} else if (regs[insn->src_reg].type == CONST_IMM) {
+				pkt_off = regs[insn->src_reg].imm;
+				packet_relative = true;
+			}
+			pkt_reg = regs[insn->dst_reg];
+			pkt_off += pkt_reg.off;
+			if (packet_relative &&
+			    (pkt_off < pkt_reg.off || pkt_off > MAX_PACKET_OFF))
+				packet_relative = false;
+		}
+
 		/* check dest operand */
 		err = check_reg_arg(regs, insn->dst_reg, DST_OP);
 		if (err)
@@ -1043,12 +1153,42 @@ static int check_alu_op(struct reg_state *regs, struct bpf_insn *insn)
 		if (stack_relative) {
 			regs[insn->dst_reg].type = PTR_TO_STACK;
 			regs[insn->dst_reg].imm = insn->imm;
+		} else if (packet_relative) {
+			/* the range checked so far stays valid */
+			regs[insn->dst_reg] = pkt_reg;
+			regs[insn->dst_reg].off = pkt_off;
 		}
 	}
 
 	return 0;
 }
 
+/* 'pkt' was compared with PTR_TO_PACKET_END and found not to be past it:
+ * every packet pointer of this state may now access the first pkt->off bytes
+ * of the packet. All packet pointers share the same base, so this holds for
+ * the ones spilled to the stack as well.
+ */
+static void find_good_pkt_pointers(struct verifier_state *state,
+				   const struct reg_state *pkt)
+{
+	struct reg_state *reg;
+	int i;
+
+	for (i = 0; i < MAX_BPF_REG; i++) {
+		reg = &state->regs[i];
+		if (reg->type == PTR_TO_PACKET && reg->range < pkt->off)
+			reg->range = pkt->off;
+	}
+
+	for (i = 0; i < MAX_BPF_STACK; i += BPF_REG_SIZE) {
+		if (state->stack_slot_type[i] != STACK_SPILL)
+			continue;
+		reg = &state->spilled_regs[i / BPF_REG_SIZE];
+		if (reg->type == PTR_TO_PACKET && reg->range < pkt->off)
+			reg->range = pkt->off;
+	}
+}
+
 static int check_cond_jmp_op(struct verifier_env *env,
 			     struct bpf_insn *insn, int *insn_idx)
 {
@@ -1142,6 +1282,23 @@ static int check_cond_jmp_op(struct verifier_env *env,
 			regs[insn->dst_reg].type = CONST_IMM;
 			regs[insn->dst_reg].imm = insn->imm;
 		}
+	} else if (BPF_SRC(insn->code) == BPF_X &&
+		   (opcode == BPF_JGT || opcode == BPF_JGE)) {
+		struct reg_state *dst = &regs[insn->dst_reg];
+		struct reg_state *src = &regs[insn->src_reg];
+
+		if (dst->type == PTR_TO_PACKET &&
+		    src->type == PTR_TO_PACKET_END)
+			/* if (pkt > pkt_end) goto, or if (pkt >= pkt_end) goto:
+			 * pkt is within the packet in the fall-through state
+			 */
+			find_good_pkt_pointers(&env->cur_state, dst);
+		else if (dst->type == PTR_TO_PACKET_END &&
+			 src->type == PTR_TO_PACKET)
+			/* if (pkt_end >= pkt) goto, or if (pkt_end > pkt) goto:
+			 * pkt is within the packet in the target state
+			 */
+			find_good_pkt_pointers(other_branch, src);
 	}
 	if (log_level)
 		print_verifier_state(env);
@@ -1496,6 +1653,12 @@ static bool states_equal(struct verifier_state *old, struct verifier_state *cur)
 			    (old->regs[i].type == UNKNOWN_VALUE &&
 			     cur->regs[i].type != NOT_INIT))
 				continue;
+			/* more of the packet checked than on the safe path */
+			if (old->regs[i].type == PTR_TO_PACKET &&
+			    cur->regs[i].type == PTR_TO_PACKET &&
+			    old->regs[i].off == cur->regs[i].off &&
+			    old->regs[i].range <= cur->regs[i].range)
+				continue;
 			return false;
 		}
 	}
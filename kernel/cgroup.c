@@ -46,6 +46,7 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/rwsem.h>
+#include <linux/percpu-rwsem.h>
 #include <linux/string.h>
 #include <linux/sort.h>
 #include <linux/kmod.h>
@@ -57,6 +58,7 @@
 #include <linux/vmalloc.h> /* TODO: replace with more sophisticated array */
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/psi.h>
 
 #include <linux/atomic.h>
 
@@ -103,6 +105,12 @@ static DEFINE_SPINLOCK(cgroup_idr_lock);
  */
 static DEFINE_SPINLOCK(release_agent_path_lock);
 
+/*
+ * Write-locked while migrating processes; fork, exit and exec read-lock
+ * it through threadgroup_change_begin/end().  See sched.h.
+ */
+struct percpu_rw_semaphore cgroup_threadgroup_rwsem;
+
 #define cgroup_assert_mutex_or_rcu_locked()				\
 	rcu_lockdep_assert(rcu_read_lock_held() ||			\
 			   lockdep_is_held(&cgroup_mutex),		\
@@ -2039,7 +2047,8 @@ struct task_struct *cgroup_taskset_next(struct cgroup_taskset *tset)
  * @tsk: the task being migrated
  * @new_cset: the new css_set @tsk is being attached to
  *
- * Must be called with cgroup_mutex, threadgroup and css_set_rwsem locked.
+ * Must be called with cgroup_mutex, cgroup_threadgroup_rwsem and
+ * css_set_rwsem locked.
  */
 static void cgroup_task_migrate(struct cgroup *old_cgrp,
 				struct task_struct *tsk,
@@ -2051,15 +2060,15 @@ static void cgroup_task_migrate(struct cgroup *old_cgrp,
 	lockdep_assert_held(&css_set_rwsem);
 
 	/*
-	 * We are synchronized through threadgroup_lock() against PF_EXITING
-	 * setting such that we can't race against cgroup_exit() changing the
-	 * css_set to init_css_set and dropping the old one.
+	 * We are synchronized through cgroup_threadgroup_rwsem against
+	 * PF_EXITING setting such that we can't race against cgroup_exit()
+	 * changing the css_set to init_css_set and dropping the old one.
 	 */
 	WARN_ON_ONCE(tsk->flags & PF_EXITING);
 	old_cset = task_css_set(tsk);
 
 	get_css_set(new_cset);
-	rcu_assign_pointer(tsk->cgroups, new_cset);
+	cgroup_move_task(tsk, new_cset);
 
 	/*
 	 * Use move_tail so that cgroup_taskset_first() still returns the
@@ -2110,10 +2119,11 @@ static void cgroup_migrate_finish(struct list_head *preloaded_csets)
  * @src_cset and add it to @preloaded_csets, which should later be cleaned
  * up by cgroup_migrate_finish().
  *
- * This function may be called without holding threadgroup_lock even if the
- * target is a process.  Threads may be created and destroyed but as long
- * as cgroup_mutex is not dropped, no new css_set can be put into play and
- * the preloaded css_sets are guaranteed to cover all migrations.
+ * This function may be called without holding cgroup_threadgroup_rwsem
+ * even if the target is a process.  Threads may be created and destroyed
+ * but as long as cgroup_mutex is not dropped, no new css_set can be put
+ * into play and the preloaded css_sets are guaranteed to cover all
+ * migrations.
  */
 static void cgroup_migrate_add_src(struct css_set *src_cset,
 				   struct cgroup *dst_cgrp,
@@ -2216,7 +2226,7 @@ err:
  * @threadgroup: whether @leader points to the whole process or a single task
  *
  * Migrate a process or task denoted by @leader to @cgrp.  If migrating a
- * process, the caller must be holding threadgroup_lock of @leader.  The
+ * process, the caller must be holding cgroup_threadgroup_rwsem.  The
  * caller is also responsible for invoking cgroup_migrate_add_src() and
  * cgroup_migrate_prepare_dst() on the targets before invoking this
  * function and following up with cgroup_migrate_finish().
@@ -2344,7 +2354,7 @@ out_release_tset:
  * @leader: the task or the leader of the threadgroup to be attached
  * @threadgroup: attach the whole threadgroup?
  *
- * Call holding cgroup_mutex and threadgroup_lock of @leader.
+ * Call holding cgroup_mutex and cgroup_threadgroup_rwsem.
  */
 static int cgroup_attach_task(struct cgroup *dst_cgrp,
 			      struct task_struct *leader, bool threadgroup)
@@ -2378,7 +2388,7 @@ static int cgroup_attach_task(struct cgroup *dst_cgrp,
 /*
  * Find the task_struct of the task to attach by vpid and pass it along to the
  * function to attach either it or all tasks in its threadgroup. Will lock
- * cgroup_mutex and threadgroup.
+ * cgroup_mutex and cgroup_threadgroup_rwsem.
  */
 static ssize_t __cgroup_procs_write(struct kernfs_open_file *of, char *buf,
 				    size_t nbytes, loff_t off, bool threadgroup)
@@ -2396,14 +2406,14 @@ static ssize_t __cgroup_procs_write(struct kernfs_open_file *of, char *buf,
 	if (!cgrp)
 		return -ENODEV;
 
-retry_find_task:
+	percpu_down_write(&cgroup_threadgroup_rwsem);
 	rcu_read_lock();
 	if (pid) {
 		tsk = find_task_by_vpid(pid);
 		if (!tsk) {
 			rcu_read_unlock();
 			ret = -ESRCH;
-			goto out_unlock_cgroup;
+			goto out_unlock_threadgroup;
 		}
 		/*
 		 * even if we're attaching all tasks in the thread group, we
@@ -2415,7 +2425,7 @@ retry_find_task:
 		    !uid_eq(cred->euid, tcred->suid)) {
 			rcu_read_unlock();
 			ret = -EACCES;
-			goto out_unlock_cgroup;
+			goto out_unlock_threadgroup;
 		}
 	} else
 		tsk = current;
@@ -2431,34 +2441,17 @@ retry_find_task:
 	if (tsk == kthreadd_task || (tsk->flags & PF_NO_SETAFFINITY)) {
 		ret = -EINVAL;
 		rcu_read_unlock();
-		goto out_unlock_cgroup;
+		goto out_unlock_threadgroup;
 	}
 
 	get_task_struct(tsk);
 	rcu_read_unlock();
 
-	threadgroup_lock(tsk);
-	if (threadgroup) {
-		if (!thread_group_leader(tsk)) {
-			/*
-			 * a race with de_thread from another thread's exec()
-			 * may strip us of our leadership, if this happens,
-			 * there is no choice but to throw this task away and
-			 * try again; this is
-			 * "double-double-toil-and-trouble-check locking".
-			 */
-			threadgroup_unlock(tsk);
-			put_task_struct(tsk);
-			goto retry_find_task;
-		}
-	}
-
 	ret = cgroup_attach_task(cgrp, tsk, threadgroup);
 
-	threadgroup_unlock(tsk);
-
 	put_task_struct(tsk);
-out_unlock_cgroup:
+out_unlock_threadgroup:
+	percpu_up_write(&cgroup_threadgroup_rwsem);
 	cgroup_kn_unlock(of->kn);
 	return ret ?: nbytes;
 }
@@ -2474,6 +2467,7 @@ int cgroup_attach_task_all(struct task_struct *from, struct task_struct *tsk)
 	int retval = 0;
 
 	mutex_lock(&cgroup_mutex);
+	percpu_down_write(&cgroup_threadgroup_rwsem);
 	for_each_root(root) {
 		struct cgroup *from_cgrp;
 
@@ -2488,6 +2482,7 @@ int cgroup_attach_task_all(struct task_struct *from, struct task_struct *tsk)
 		if (retval)
 			break;
 	}
+	percpu_up_write(&cgroup_threadgroup_rwsem);
 	mutex_unlock(&cgroup_mutex);
 
 	return retval;
@@ -2605,6 +2600,13 @@ static int cgroup_update_dfl_csses(struct cgroup *cgrp)
 
 	lockdep_assert_held(&cgroup_mutex);
 
+	/*
+	 * Hold cgroup_threadgroup_rwsem across the whole subtree so that
+	 * every process is migrated in one go instead of stalling fork and
+	 * exit once per process.
+	 */
+	percpu_down_write(&cgroup_threadgroup_rwsem);
+
 	/* look up all csses currently attached to @cgrp's subtree */
 	down_read(&css_set_rwsem);
 	css_for_each_descendant_pre(css, cgroup_css(cgrp, NULL)) {
@@ -2660,17 +2662,8 @@ static int cgroup_update_dfl_csses(struct cgroup *cgrp)
 				goto out_finish;
 			last_task = task;
 
-			threadgroup_lock(task);
-			/* raced against de_thread() from another thread? */
-			if (!thread_group_leader(task)) {
-				threadgroup_unlock(task);
-				put_task_struct(task);
-				continue;
-			}
-
 			ret = cgroup_migrate(src_cset->dfl_cgrp, task, true);
 
-			threadgroup_unlock(task);
 			put_task_struct(task);
 
 			if (WARN(ret, "cgroup: failed to update controllers for the default hierarchy (%d), further operations may crash or hang\n", ret))
@@ -2680,6 +2673,7 @@ static int cgroup_update_dfl_csses(struct cgroup *cgrp)
 
 out_finish:
 	cgroup_migrate_finish(&preloaded_csets);
+	percpu_up_write(&cgroup_threadgroup_rwsem);
 	return ret;
 }
 
@@ -2925,6 +2919,82 @@ static int cgroup_populated_show(struct seq_file *seq, void *v)
 	return 0;
 }
 
+#ifdef CONFIG_PSI
+static int cgroup_io_pressure_show(struct seq_file *seq, void *v)
+{
+	return psi_show(seq, cgroup_psi(seq_css(seq)->cgroup), PSI_IO);
+}
+
+static int cgroup_memory_pressure_show(struct seq_file *seq, void *v)
+{
+	return psi_show(seq, cgroup_psi(seq_css(seq)->cgroup), PSI_MEM);
+}
+
+static int cgroup_cpu_pressure_show(struct seq_file *seq, void *v)
+{
+	return psi_show(seq, cgroup_psi(seq_css(seq)->cgroup), PSI_CPU);
+}
+
+/*
+ * A trigger belongs to the open file it was written to and keeps the
+ * cgroup pinned until the file is closed, see cgroup_pressure_release().
+ */
+static ssize_t cgroup_pressure_write(struct kernfs_open_file *of, char *buf,
+				     size_t nbytes, enum psi_res res)
+{
+	struct cgroup *cgrp = of->kn->parent->priv;
+	struct psi_trigger *new;
+
+	new = psi_trigger_create(cgroup_psi(cgrp), buf, nbytes, res);
+	if (IS_ERR(new))
+		return PTR_ERR(new);
+
+	cgroup_get(cgrp);
+	if (cmpxchg(&of->priv, NULL, new)) {
+		psi_trigger_destroy(new);
+		cgroup_put(cgrp);
+		return -EBUSY;
+	}
+
+	return nbytes;
+}
+
+static ssize_t cgroup_io_pressure_write(struct kernfs_open_file *of,
+					char *buf, size_t nbytes, loff_t off)
+{
+	return cgroup_pressure_write(of, buf, nbytes, PSI_IO);
+}
+
+static ssize_t cgroup_memory_pressure_write(struct kernfs_open_file *of,
+					    char *buf, size_t nbytes,
+					    loff_t off)
+{
+	return cgroup_pressure_write(of, buf, nbytes, PSI_MEM);
+}
+
+static ssize_t cgroup_cpu_pressure_write(struct kernfs_open_file *of,
+					 char *buf, size_t nbytes, loff_t off)
+{
+	return cgroup_pressure_write(of, buf, nbytes, PSI_CPU);
+}
+
+static unsigned int cgroup_pressure_poll(struct kernfs_open_file *of,
+					 poll_table *pt)
+{
+	return psi_trigger_poll(READ_ONCE(of->priv), of->file, pt);
+}
+
+static void cgroup_pressure_release(struct kernfs_open_file *of)
+{
+	struct psi_trigger *t = of->priv;
+
+	if (t) {
+		psi_trigger_destroy(t);
+		cgroup_put(of->kn->parent->priv);
+	}
+}
+#endif /* CONFIG_PSI */
+
 static ssize_t cgroup_file_write(struct kernfs_open_file *of, char *buf,
 				 size_t nbytes, loff_t off)
 {
@@ -2995,15 +3065,38 @@ static int cgroup_seqfile_show(struct seq_file *m, void *arg)
 	return 0;
 }
 
+static unsigned int cgroup_file_poll(struct kernfs_open_file *of,
+				     poll_table *pt)
+{
+	struct cftype *cft = of->kn->priv;
+
+	if (cft->poll)
+		return cft->poll(of, pt);
+
+	return kernfs_generic_poll(of, pt);
+}
+
+static void cgroup_file_release(struct kernfs_open_file *of)
+{
+	struct cftype *cft = of->kn->priv;
+
+	if (cft->release)
+		cft->release(of);
+}
+
 static struct kernfs_ops cgroup_kf_single_ops = {
 	.atomic_write_len	= PAGE_SIZE,
 	.write			= cgroup_file_write,
+	.poll			= cgroup_file_poll,
+	.release		= cgroup_file_release,
 	.seq_show		= cgroup_seqfile_show,
 };
 
 static struct kernfs_ops cgroup_kf_ops = {
 	.atomic_write_len	= PAGE_SIZE,
 	.write			= cgroup_file_write,
+	.poll			= cgroup_file_poll,
+	.release		= cgroup_file_release,
 	.seq_start		= cgroup_seqfile_start,
 	.seq_next		= cgroup_seqfile_next,
 	.seq_stop		= cgroup_seqfile_stop,
@@ -4095,6 +4188,71 @@ int cgroupstats_build(struct cgroupstats *stats, struct dentry *dentry)
 	return 0;
 }
 
+/**
+ * cgroup_get_from_dir - get the cgroup of a cgroupfs directory
+ * @dentry: directory dentry in a cgroup hierarchy
+ *
+ * Return the cgroup @dentry stands for with a reference held, to be
+ * dropped with css_put(&cgrp->self), or an ERR_PTR() value.
+ */
+struct cgroup *cgroup_get_from_dir(struct dentry *dentry)
+{
+	struct kernfs_node *kn = kernfs_node_from_dentry(dentry);
+	struct cgroup *cgrp;
+
+	if (dentry->d_sb->s_type != &cgroup_fs_type || !kn ||
+	    kernfs_type(kn) != KERNFS_DIR)
+		return ERR_PTR(-EBADF);
+
+	/* see cgroupstats_build() on @kn->priv */
+	rcu_read_lock();
+	cgrp = rcu_dereference(kn->priv);
+	if (!cgrp || !css_tryget_online(&cgrp->self))
+		cgrp = ERR_PTR(-ENOENT);
+	rcu_read_unlock();
+	return cgrp;
+}
+
+/**
+ * task_under_cgroup - test whether a task is in a cgroup subtree
+ * @task: the task to be tested
+ * @ancestor: the root of the subtree, pinned by the caller
+ *
+ * Test whether @task's cgroup on @ancestor's hierarchy is @ancestor or
+ * one of its descendants.  The answer can be stale by the time it is
+ * returned if @task is being migrated concurrently.
+ */
+bool task_under_cgroup(struct task_struct *task, struct cgroup *ancestor)
+{
+	struct cgroup_root *root = ancestor->root;
+	struct cgroup *cgrp;
+	bool ret;
+
+	/*
+	 * Hierarchies with a controller attached can be resolved through
+	 * the task's css under RCU, which keeps this cheap enough to be
+	 * called for every task in the system.
+	 */
+	if (root == &cgrp_dfl_root || root->subsys_mask) {
+		rcu_read_lock();
+		if (root == &cgrp_dfl_root)
+			cgrp = task_css_set(task)->dfl_cgrp;
+		else
+			cgrp = task_cgroup(task, __ffs(root->subsys_mask));
+		ret = cgroup_is_descendant(cgrp, ancestor);
+		rcu_read_unlock();
+		return ret;
+	}
+
+	mutex_lock(&cgroup_mutex);
+	down_read(&css_set_rwsem);
+	cgrp = task_cgroup_from_root(task, root);
+	ret = cgroup_is_descendant(cgrp, ancestor);
+	up_read(&css_set_rwsem);
+	mutex_unlock(&cgroup_mutex);
+	return ret;
+}
+
 
 /*
  * seq_file methods for the tasks/procs files. The seq_file position is the
@@ -4264,6 +4422,32 @@ static struct cftype cgroup_dfl_base_files[] = {
 		.flags = CFTYPE_NOT_ON_ROOT,
 		.seq_show = cgroup_populated_show,
 	},
+#ifdef CONFIG_PSI
+	{
+		.name = "io.pressure",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cgroup_io_pressure_show,
+		.write = cgroup_io_pressure_write,
+		.poll = cgroup_pressure_poll,
+		.release = cgroup_pressure_release,
+	},
+	{
+		.name = "memory.pressure",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cgroup_memory_pressure_show,
+		.write = cgroup_memory_pressure_write,
+		.poll = cgroup_pressure_poll,
+		.release = cgroup_pressure_release,
+	},
+	{
+		.name = "cpu.pressure",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = cgroup_cpu_pressure_show,
+		.write = cgroup_cpu_pressure_write,
+		.poll = cgroup_pressure_poll,
+		.release = cgroup_pressure_release,
+	},
+#endif
 	{ }	/* terminate */
 };
 
@@ -4393,6 +4577,8 @@ static void css_free_work_fn(struct work_struct *work)
 		cancel_work_sync(&cgrp->release_agent_work);
 
 		if (cgroup_parent(cgrp)) {
+			if (cgroup_on_dfl(cgrp))
+				psi_cgroup_free(cgrp);
 			/*
 			 * We get a ref to the parent, and put the ref when
 			 * this cgroup is being freed, so it's guaranteed
@@ -4634,6 +4820,12 @@ static int cgroup_mkdir(struct kernfs_node *parent_kn, const char *name,
 	if (ret)
 		goto out_free_cgrp;
 
+	if (cgroup_on_dfl(parent)) {
+		ret = psi_cgroup_alloc(cgrp);
+		if (ret)
+			goto out_cancel_ref;
+	}
+
 	/*
 	 * Temporarily set the pointer to NULL, so idr_find() won't return
 	 * a half-baked cgroup.
@@ -4641,7 +4833,7 @@ static int cgroup_mkdir(struct kernfs_node *parent_kn, const char *name,
 	cgrp->id = cgroup_idr_alloc(&root->cgroup_idr, NULL, 2, 0, GFP_NOWAIT);
 	if (cgrp->id < 0) {
 		ret = -ENOMEM;
-		goto out_cancel_ref;
+		goto out_psi_free;
 	}
 
 	init_cgroup_housekeeping(cgrp);
@@ -4721,6 +4913,9 @@ static int cgroup_mkdir(struct kernfs_node *parent_kn, const char *name,
 
 out_free_id:
 	cgroup_idr_remove(&root->cgroup_idr, cgrp->id);
+out_psi_free:
+	if (cgroup_on_dfl(parent))
+		psi_cgroup_free(cgrp);
 out_cancel_ref:
 	percpu_ref_exit(&cgrp->self.refcnt);
 out_free_cgrp:
@@ -5000,6 +5195,7 @@ int __init cgroup_init(void)
 	unsigned long key;
 	int ssid, err;
 
+	BUG_ON(percpu_init_rwsem(&cgroup_threadgroup_rwsem));
 	BUG_ON(cgroup_init_cftypes(NULL, cgroup_dfl_base_files));
 	BUG_ON(cgroup_init_cftypes(NULL, cgroup_legacy_base_files));
 
@@ -5240,7 +5436,7 @@ void cgroup_post_fork(struct task_struct *child)
 		down_write(&css_set_rwsem);
 		cset = task_css_set(current);
 		if (list_empty(&child->cg_list)) {
-			rcu_assign_pointer(child->cgroups, cset);
+			cgroup_move_task(child, cset);
 			list_add(&child->cg_list, &cset->tasks);
 			get_css_set(cset);
 		}
@@ -5298,7 +5494,7 @@ void cgroup_exit(struct task_struct *tsk)
 
 	/* Reassign the task to the init_css_set. */
 	cset = task_css_set(tsk);
-	RCU_INIT_POINTER(tsk->cgroups, &init_css_set);
+	cgroup_move_task(tsk, &init_css_set);
 
 	if (need_forkexit_callback) {
 		/* see cgroup_post_fork() for details */
@@ -460,6 +460,264 @@ perf_cgroup_set_timestamp(struct task_struct *task,
 	info->timestamp = ctx->timestamp;
 }
 
+/*
+ * Shared cgroup counting.
+ *
+ * Instead of opening one event per cgroup per cpu, a cpu event can be
+ * given a table of cgroups.  Whenever the cpu switches cgroup, the count
+ * the event accumulated since the previous switch is added to the
+ * outgoing cgroup and those of its ancestors that are in the table.  The
+ * table is only modified and read on the event's cpu with interrupts
+ * disabled, so it needs no locking of its own.
+ */
+#define PERF_CGROUP_NODE_MAX	4096
+
+static DEFINE_PER_CPU(struct list_head, cgroup_node_events);
+
+static struct perf_cgroup_node *
+perf_cgroup_node_find(struct perf_cgroup_node_table *table, u64 id)
+{
+	struct perf_cgroup_node *cn;
+
+	hlist_for_each_entry(cn, &table->hash[hash_64(id, table->hash_bits)],
+			     node) {
+		if (cn->id == id)
+			return cn;
+	}
+	return NULL;
+}
+
+static void perf_cgroup_node_account(struct perf_event *event,
+				     struct perf_cgroup *cgrp, u64 now)
+{
+	struct perf_cgroup_node_table *table = event->cgrp_nodes;
+	struct cgroup_subsys_state *css;
+	struct perf_cgroup_node *cn;
+	u64 count, delta;
+
+	raw_spin_lock(&event->ctx->lock);
+	if (event->state == PERF_EVENT_STATE_ACTIVE)
+		event->pmu->read(event);
+	raw_spin_unlock(&event->ctx->lock);
+
+	count = local64_read(&event->count);
+	delta = count - event->cgrp_node_count;
+	/* PERF_EVENT_IOC_RESET went backwards */
+	if ((s64)delta < 0)
+		delta = 0;
+
+	for (css = &cgrp->css; css; css = css->parent) {
+		cn = perf_cgroup_node_find(table, css->cgroup->kn->ino);
+		if (cn) {
+			cn->count += delta;
+			cn->time += now - event->cgrp_node_tstamp;
+		}
+	}
+
+	event->cgrp_node_count = count;
+	event->cgrp_node_tstamp = now;
+}
+
+/* called with interrupts disabled when @task leaves this cpu's cgroup */
+static void perf_cgroup_node_switch(struct task_struct *task)
+{
+	struct perf_cgroup *cgrp = perf_cgroup_from_task(task);
+	struct perf_event *event;
+	u64 now = perf_clock();
+
+	list_for_each_entry(event, this_cpu_ptr(&cgroup_node_events),
+			    cgrp_node_entry)
+		perf_cgroup_node_account(event, cgrp, now);
+}
+
+struct cgroup_node_swap {
+	struct perf_event		*event;
+	struct perf_cgroup_node_table	*table;
+};
+
+static int __perf_cgroup_node_swap(void *info)
+{
+	struct cgroup_node_swap *swap = info;
+	struct perf_event *event = swap->event;
+	struct perf_cgroup_node_table *old = event->cgrp_nodes;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	rcu_read_lock();
+
+	/* settle the count so far against the old table */
+	if (old)
+		perf_cgroup_node_account(event, perf_cgroup_from_task(current),
+					 perf_clock());
+
+	if (!old && swap->table)
+		list_add(&event->cgrp_node_entry,
+			 per_cpu_ptr(&cgroup_node_events, event->cpu));
+	else if (old && !swap->table)
+		list_del(&event->cgrp_node_entry);
+
+	event->cgrp_nodes = swap->table;
+	event->cgrp_node_count = local64_read(&event->count);
+	event->cgrp_node_tstamp = perf_clock();
+	swap->table = old;
+
+	rcu_read_unlock();
+	local_irq_restore(flags);
+
+	return 0;
+}
+
+static void perf_cgroup_node_free(struct perf_cgroup_node_table *table)
+{
+	if (!table)
+		return;
+	vfree(table->nodes);
+	kfree(table);
+}
+
+static void perf_cgroup_node_swap(struct perf_event *event,
+				  struct perf_cgroup_node_table *table)
+{
+	struct cgroup_node_swap swap = {
+		.event	= event,
+		.table	= table,
+	};
+	bool was_attached = event->cgrp_nodes != NULL;
+
+	/* an offline cpu does no switching, update the event directly */
+	if (cpu_function_call(event->cpu, __perf_cgroup_node_swap, &swap))
+		__perf_cgroup_node_swap(&swap);
+
+	if (!was_attached && table) {
+		atomic_inc(&per_cpu(perf_cgroup_events, event->cpu));
+		static_key_slow_inc(&perf_sched_events.key);
+	} else if (was_attached && !table) {
+		atomic_dec(&per_cpu(perf_cgroup_events, event->cpu));
+		static_key_slow_dec_deferred(&perf_sched_events);
+	}
+
+	perf_cgroup_node_free(swap.table);
+}
+
+static int perf_cgroup_node_attach(struct perf_event *event, u64 __user *uarg)
+{
+	struct perf_cgroup_node_table *table;
+	struct perf_cgroup_node *cn;
+	int node = cpu_to_node(event->cpu);
+	unsigned int bits;
+	u64 nr, i, id;
+
+	/* only cpu-wide events see every cgroup that runs on the cpu */
+	if (event->cpu < 0 || event->ctx->task || event->parent ||
+	    is_cgroup_event(event))
+		return -EINVAL;
+
+	if (get_user(nr, uarg))
+		return -EFAULT;
+	if (nr > PERF_CGROUP_NODE_MAX)
+		return -E2BIG;
+
+	if (!nr) {
+		if (event->cgrp_nodes)
+			perf_cgroup_node_swap(event, NULL);
+		return 0;
+	}
+
+	/* at most half full, and hash_64() needs at least one bit */
+	bits = ilog2(roundup_pow_of_two(nr)) + 1;
+	table = kzalloc_node(sizeof(*table) +
+			     (sizeof(struct hlist_head) << bits),
+			     GFP_KERNEL, node);
+	if (!table)
+		return -ENOMEM;
+
+	table->hash_bits = bits;
+	table->nodes = vzalloc_node(nr * sizeof(*table->nodes), node);
+	if (!table->nodes) {
+		kfree(table);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (get_user(id, uarg + 1 + i)) {
+			perf_cgroup_node_free(table);
+			return -EFAULT;
+		}
+		if (perf_cgroup_node_find(table, id))
+			continue;
+
+		cn = &table->nodes[table->nr++];
+		cn->id = id;
+		hlist_add_head(&cn->node, &table->hash[hash_64(id, bits)]);
+	}
+
+	perf_cgroup_node_swap(event, table);
+	return 0;
+}
+
+struct cgroup_node_read {
+	struct perf_event	*event;
+	u64			id;
+	u64			count;
+	u64			time;
+	int			ret;
+};
+
+static int __perf_cgroup_node_read(void *info)
+{
+	struct cgroup_node_read *cr = info;
+	struct perf_event *event = cr->event;
+	struct perf_cgroup_node *cn;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	rcu_read_lock();
+
+	cr->ret = -ENOENT;
+	if (event->cgrp_nodes) {
+		/* fold in what the current cgroup did since its switch-in */
+		perf_cgroup_node_account(event, perf_cgroup_from_task(current),
+					 perf_clock());
+
+		cn = perf_cgroup_node_find(event->cgrp_nodes, cr->id);
+		if (cn) {
+			cr->count = cn->count;
+			cr->time = cn->time;
+			cr->ret = 0;
+		}
+	}
+
+	rcu_read_unlock();
+	local_irq_restore(flags);
+
+	return 0;
+}
+
+static int perf_cgroup_node_read(struct perf_event *event, u64 __user *uarg)
+{
+	struct cgroup_node_read cr = { .event = event };
+
+	if (!event->cgrp_nodes)
+		return -EINVAL;
+	if (get_user(cr.id, uarg))
+		return -EFAULT;
+
+	if (cpu_function_call(event->cpu, __perf_cgroup_node_read, &cr))
+		__perf_cgroup_node_read(&cr);
+	if (cr.ret)
+		return cr.ret;
+
+	if (put_user(cr.count, uarg + 1) || put_user(cr.time, uarg + 2))
+		return -EFAULT;
+	return 0;
+}
+
+static void perf_cgroup_node_detach(struct perf_event *event)
+{
+	if (event->cgrp_nodes)
+		perf_cgroup_node_swap(event, NULL);
+}
+
 #define PERF_CGROUP_SWOUT	0x1 /* cgroup switch out every event */
 #define PERF_CGROUP_SWIN	0x2 /* cgroup switch in events based on task */
 
@@ -488,6 +746,9 @@ void perf_cgroup_switch(struct task_struct *task, int mode)
 	 */
 	rcu_read_lock();
 
+	if (mode & PERF_CGROUP_SWOUT)
+		perf_cgroup_node_switch(task);
+
 	list_for_each_entry_rcu(pmu, &pmus, entry) {
 		cpuctx = this_cpu_ptr(pmu->pmu_cpu_context);
 		if (cpuctx->unique_pmu != pmu)
@@ -712,6 +973,22 @@ perf_cgroup_set_timestamp(struct task_struct *task,
 {
 }
 
+static inline int perf_cgroup_node_attach(struct perf_event *event,
+					  u64 __user *uarg)
+{
+	return -EINVAL;
+}
+
+static inline int perf_cgroup_node_read(struct perf_event *event,
+					u64 __user *uarg)
+{
+	return -EINVAL;
+}
+
+static inline void perf_cgroup_node_detach(struct perf_event *event)
+{
+}
+
 void
 perf_cgroup_switch(struct task_struct *task, struct task_struct *next)
 {
@@ -3606,6 +3883,7 @@ static void _free_event(struct perf_event *event)
 		mutex_unlock(&event->mmap_mutex);
 	}
 
+	perf_cgroup_node_detach(event);
 	if (is_cgroup_event(event))
 		perf_detach_cgroup(event);
 
@@ -4074,6 +4352,26 @@ static inline int perf_fget_light(int fd, struct fd *p)
 	return 0;
 }
 
+/*
+ * Take a reference on the perf event file behind @fd, for users that keep
+ * the event around beyond the syscall, such as bpf perf event arrays.
+ */
+struct file *perf_event_get(unsigned int fd)
+{
+	struct file *file;
+
+	file = fget(fd);
+	if (!file)
+		return ERR_PTR(-EBADF);
+
+	if (file->f_op != &perf_fops) {
+		fput(file);
+		return ERR_PTR(-EBADF);
+	}
+
+	return file;
+}
+
 static int perf_event_set_output(struct perf_event *event,
 				 struct perf_event *output_event);
 static int perf_event_set_filter(struct perf_event *event, void __user *arg);
@@ -4134,6 +4432,12 @@ static long _perf_ioctl(struct perf_event *event, unsigned int cmd, unsigned lon
 	case PERF_EVENT_IOC_SET_BPF:
 		return perf_event_set_bpf_prog(event, arg);
 
+	case PERF_EVENT_IOC_ATTACH_CGROUP:
+		return perf_cgroup_node_attach(event, (u64 __user *)arg);
+
+	case PERF_EVENT_IOC_READ_CGROUP:
+		return perf_cgroup_node_read(event, (u64 __user *)arg);
+
 	default:
 		return -ENOTTY;
 	}
@@ -4166,6 +4470,8 @@ static long perf_compat_ioctl(struct file *file, unsigned int cmd,
 	switch (_IOC_NR(cmd)) {
 	case _IOC_NR(PERF_EVENT_IOC_SET_FILTER):
 	case _IOC_NR(PERF_EVENT_IOC_ID):
+	case _IOC_NR(PERF_EVENT_IOC_ATTACH_CGROUP):
+	case _IOC_NR(PERF_EVENT_IOC_READ_CGROUP):
 		/* Fix up pointer size (usually 4 -> 8 in 32-on-64-bit case */
 		if (_IOC_SIZE(cmd) == sizeof(compat_uptr_t)) {
 			cmd &= ~IOCSIZE_MASK;
@@ -5155,6 +5461,15 @@ static void perf_output_read(struct perf_output_handle *handle,
 		perf_output_read_one(handle, event, enabled, running);
 }
 
+/*
+ * Raw records of eBPF programs come in any size, pad them so that the
+ * record (u32 size + data) stays u64 aligned.
+ */
+static u32 perf_raw_padded_size(struct perf_raw_record *raw)
+{
+	return round_up(raw->size + sizeof(u32), sizeof(u64)) - sizeof(u32);
+}
+
 void perf_output_sample(struct perf_output_handle *handle,
 			struct perf_event_header *header,
 			struct perf_sample_data *data,
@@ -5212,9 +5527,15 @@ void perf_output_sample(struct perf_output_handle *handle,
 
 	if (sample_type & PERF_SAMPLE_RAW) {
 		if (data->raw) {
-			perf_output_put(handle, data->raw->size);
+			u32 raw_size = perf_raw_padded_size(data->raw);
+			u64 zero = 0;
+
+			perf_output_put(handle, raw_size);
 			__output_copy(handle, data->raw->data,
 					   data->raw->size);
+			if (raw_size != data->raw->size)
+				__output_copy(handle, &zero,
+					      raw_size - data->raw->size);
 		} else {
 			struct {
 				u32	size;
@@ -5342,11 +5663,10 @@ void perf_prepare_sample(struct perf_event_header *header,
 		int size = sizeof(u32);
 
 		if (data->raw)
-			size += data->raw->size;
+			size += perf_raw_padded_size(data->raw);
 		else
 			size += sizeof(u32);
 
-		WARN_ON_ONCE(size & (sizeof(u64)-1));
 		header->size += size;
 	}
 
@@ -5416,9 +5736,9 @@ void perf_prepare_sample(struct perf_event_header *header,
 	}
 }
 
-static void perf_event_output(struct perf_event *event,
-				struct perf_sample_data *data,
-				struct pt_regs *regs)
+void perf_event_output(struct perf_event *event,
+			struct perf_sample_data *data,
+			struct pt_regs *regs)
 {
 	struct perf_output_handle handle;
 	struct perf_event_header header;
@@ -8880,6 +9200,9 @@ static void __init perf_event_init_all_cpus(void)
 		swhash = &per_cpu(swevent_htable, cpu);
 		mutex_init(&swhash->hlist_mutex);
 		INIT_LIST_HEAD(&per_cpu(active_ctx_list, cpu));
+#ifdef CONFIG_CGROUP_PERF
+		INIT_LIST_HEAD(&per_cpu(cgroup_node_events, cpu));
+#endif
 	}
 }
 
@@ -374,6 +374,7 @@ static struct task_struct *dup_task_struct(struct task_struct *orig)
 #endif
 	tsk->splice_pipe = NULL;
 	tsk->task_frag.page = NULL;
+	tsk->wake_q.next = NULL;
 
 	account_kernel_stack(ti, 1);
 
@@ -449,7 +450,8 @@ static int dup_mmap(struct mm_struct *mm, struct mm_struct *oldmm)
 		tmp->vm_mm = mm;
 		if (anon_vma_fork(tmp, mpnt))
 			goto fail_nomem_anon_vma_fork;
-		tmp->vm_flags &= ~VM_LOCKED;
+		tmp->vm_flags &= ~(VM_LOCKED | VM_UFFD_MISSING);
+		tmp->vm_userfaultfd_ctx = NULL_VM_UFFD_CTX;
 		tmp->vm_next = tmp->vm_prev = NULL;
 		file = tmp->vm_file;
 		if (file) {
@@ -584,6 +586,19 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 	atomic_set(&mm->mm_users, 1);
 	atomic_set(&mm->mm_count, 1);
 	init_rwsem(&mm->mmap_sem);
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_init(&mm->mm_seq);
+	memset(&mm->spf_stat, 0, sizeof(mm->spf_stat));
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	memset(&mm->khugepaged_stat, 0, sizeof(mm->khugepaged_stat));
+#endif
+#ifdef CONFIG_KSM
+	memset(&mm->ksm_stat, 0, sizeof(mm->ksm_stat));
+#endif
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	mm->futex_hash = NULL;
+#endif
 	INIT_LIST_HEAD(&mm->mmlist);
 	mm->core_state = NULL;
 	atomic_long_set(&mm->nr_ptes, 0);
@@ -616,6 +631,7 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 	if (init_new_context(p, mm))
 		goto fail_nocontext;
 
+	lru_gen_add_mm(mm);
 	return mm;
 
 fail_nocontext:
@@ -676,6 +692,7 @@ void __mmdrop(struct mm_struct *mm)
 	destroy_context(mm);
 	mmu_notifier_mm_destroy(mm);
 	check_mm(mm);
+	futex_hash_free(mm);
 	free_mm(mm);
 }
 EXPORT_SYMBOL_GPL(__mmdrop);
@@ -692,6 +709,7 @@ void mmput(struct mm_struct *mm)
 		exit_aio(mm);
 		ksm_exit(mm);
 		khugepaged_exit(mm); /* must run before exit_mmap */
+		lru_gen_del_mm(mm); /* likewise */
 		exit_mmap(mm);
 		set_mm_exe_file(mm, NULL);
 		if (!list_empty(&mm->mmlist)) {
@@ -1144,10 +1162,6 @@ static int copy_signal(unsigned long clone_flags, struct task_struct *tsk)
 	tty_audit_fork(sig);
 	sched_autogroup_fork(sig);
 
-#ifdef CONFIG_CGROUPS
-	init_rwsem(&sig->group_rwsem);
-#endif
-
 	sig->oom_score_adj = current->signal->oom_score_adj;
 	sig->oom_score_adj_min = current->signal->oom_score_adj_min;
 
@@ -1293,6 +1307,13 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	if (retval)
 		goto fork_out;
 
+	/*
+	 * The first thread is the last chance to give the process a
+	 * private futex hash, before the mm gets shared.
+	 */
+	if (clone_flags & CLONE_THREAD)
+		futex_hash_allocate_default();
+
 	retval = -ENOMEM;
 	p = dup_task_struct(current);
 	if (!p)
@@ -1409,6 +1430,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	p->sequential_io	= 0;
 	p->sequential_io_avg	= 0;
 #endif
+#ifdef CONFIG_MEMCG
+	p->memcg_nr_pages_over_high = 0;
+#endif
 
 	/* Perform scheduler related setup. Assign this task to a CPU. */
 	retval = sched_fork(clone_flags, p);
@@ -1475,6 +1499,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	INIT_LIST_HEAD(&p->pi_state_list);
 	p->pi_state_cache = NULL;
 #endif
+	rseq_fork(p, clone_flags);
 	/*
 	 * sigaltstack should be cleared when sharing the same VM
 	 */
@@ -1838,7 +1863,13 @@ void __init proc_caches_init(void)
 	mm_cachep = kmem_cache_create("mm_struct",
 			sizeof(struct mm_struct), ARCH_MIN_MMSTRUCT_ALIGN,
 			SLAB_HWCACHE_ALIGN|SLAB_PANIC|SLAB_NOTRACK, NULL);
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/* handle_speculative_fault() reads vmas that may be freed under it */
+	vm_area_cachep = KMEM_CACHE(vm_area_struct,
+				    SLAB_PANIC|SLAB_DESTROY_BY_RCU);
+#else
 	vm_area_cachep = KMEM_CACHE(vm_area_struct, SLAB_PANIC);
+#endif
 	mmap_init();
 	nsproxy_cache_init();
 }
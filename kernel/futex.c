@@ -45,6 +45,9 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/seq_file.h>
+#include <linux/prctl.h>
 #include <linux/poll.h>
 #include <linux/fs.h>
 #include <linux/file.h>
@@ -251,6 +254,8 @@ static const struct futex_q futex_q_init = {
 struct futex_hash_bucket {
 	atomic_t waiters;
 	spinlock_t lock;
+	/* Times the lock was found taken, updated under the lock */
+	unsigned int contended;
 	struct plist_head chain;
 } ____cacheline_aligned_in_smp;
 
@@ -258,6 +263,26 @@ static unsigned long __read_mostly futex_hashsize;
 
 static struct futex_hash_bucket *futex_queues;
 
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+/*
+ * The private futexes of a process can live in a hash of its own, which
+ * keeps the threads of a big process from colliding and contending with
+ * the futexes of all the other processes in the global hash, and which is
+ * allocated on the node the process runs on. It can only be set up while
+ * the mm has a single user: waiters already queued on the global hash
+ * would be missed by wakers looking in the private one.
+ */
+struct futex_private_hash {
+	unsigned int hashsize;
+	struct futex_hash_bucket queues[0];
+};
+
+#define FUTEX_PRIVATE_HASH_MIN	16
+#define FUTEX_PRIVATE_HASH_MAX	(1U << 16)
+
+int sysctl_futex_private_hash __read_mostly;
+#endif
+
 static inline void futex_get_mm(union futex_key *key)
 {
 	atomic_inc(&key->private.mm->mm_count);
@@ -303,6 +328,15 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 #endif
 }
 
+static inline void hb_lock(struct futex_hash_bucket *hb)
+	__acquires(&hb->lock)
+{
+	if (!spin_trylock(&hb->lock)) {
+		spin_lock(&hb->lock);
+		hb->contended++;
+	}
+}
+
 /*
  * We hash on the keys returned from get_futex_key (see below).
  */
@@ -311,6 +345,15 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		struct futex_private_hash *fph;
+
+		fph = READ_ONCE(key->private.mm->futex_hash);
+		if (fph)
+			return &fph->queues[hash & (fph->hashsize - 1)];
+	}
+#endif
 	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
@@ -1200,11 +1243,11 @@ static inline void
 double_lock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2)
 {
 	if (hb1 <= hb2) {
-		spin_lock(&hb1->lock);
+		hb_lock(hb1);
 		if (hb1 < hb2)
 			spin_lock_nested(&hb2->lock, SINGLE_DEPTH_NESTING);
 	} else { /* hb1 > hb2 */
-		spin_lock(&hb2->lock);
+		hb_lock(hb2);
 		spin_lock_nested(&hb1->lock, SINGLE_DEPTH_NESTING);
 	}
 }
@@ -1241,7 +1284,7 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 	if (!hb_waiters_pending(hb))
 		goto out_put_key;
 
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 
 	plist_for_each_entry_safe(this, next, &hb->chain, list) {
 		if (match_futex (&this->key, &key)) {
@@ -1768,7 +1811,7 @@ static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 
 	q->lock_ptr = &hb->lock;
 
-	spin_lock(&hb->lock); /* implies MB (A) */
+	hb_lock(hb); /* implies MB (A) */
 	return hb;
 }
 
@@ -2413,7 +2456,7 @@ retry:
 		return ret;
 
 	hb = hash_futex(&key);
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 
 	/*
 	 * Check waiters first. We do not trust user space values at
@@ -3046,6 +3089,101 @@ static void __init futex_detect_cmpxchg(void)
 #endif
 }
 
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+static void futex_hash_bucket_init(struct futex_hash_bucket *hb)
+{
+	atomic_set(&hb->waiters, 0);
+	plist_head_init(&hb->chain);
+	spin_lock_init(&hb->lock);
+}
+
+static int futex_hash_allocate(struct mm_struct *mm, unsigned int threads)
+{
+	struct futex_private_hash *fph;
+	unsigned int hashsize, i;
+	int node = numa_node_id();
+	size_t size;
+
+	if (mm->futex_hash)
+		return -EEXIST;
+	if (atomic_read(&mm->mm_users) != 1)
+		return -EBUSY;
+
+	if (!threads)
+		threads = num_online_cpus();
+	threads = min(threads, FUTEX_PRIVATE_HASH_MAX / 4);
+	hashsize = roundup_pow_of_two(max(4 * threads, FUTEX_PRIVATE_HASH_MIN));
+
+	size = sizeof(*fph) + hashsize * sizeof(fph->queues[0]);
+	fph = kzalloc_node(size, GFP_KERNEL | __GFP_NOWARN, node);
+	if (!fph)
+		fph = vzalloc_node(size, node);
+	if (!fph)
+		return -ENOMEM;
+
+	fph->hashsize = hashsize;
+	for (i = 0; i < hashsize; i++)
+		futex_hash_bucket_init(&fph->queues[i]);
+
+	/* Pairs with the READ_ONCE() in futex_hash_show() */
+	smp_store_release(&mm->futex_hash, fph);
+	return 0;
+}
+
+int futex_hash_prctl(int option, unsigned long arg)
+{
+	struct mm_struct *mm = current->mm;
+
+	switch (option) {
+	case PR_SET_FUTEX_HASH:
+		if (arg > UINT_MAX)
+			return -EINVAL;
+		return futex_hash_allocate(mm, arg);
+	case PR_GET_FUTEX_HASH:
+		return mm->futex_hash ? mm->futex_hash->hashsize : 0;
+	}
+	return -EINVAL;
+}
+
+/*
+ * Called when a process creates a thread: with kernel.futex_private_hash
+ * set, every process gets a private hash before it turns multithreaded.
+ */
+void futex_hash_allocate_default(void)
+{
+	struct mm_struct *mm = current->mm;
+
+	if (!sysctl_futex_private_hash || !mm || mm->futex_hash)
+		return;
+
+	/* Failing is fine, the global hash just keeps being used */
+	futex_hash_allocate(mm, 0);
+}
+
+void futex_hash_free(struct mm_struct *mm)
+{
+	kvfree(mm->futex_hash);
+}
+
+void futex_hash_show(struct seq_file *m, struct mm_struct *mm)
+{
+	struct futex_private_hash *fph = READ_ONCE(mm->futex_hash);
+	unsigned long contended = 0;
+	unsigned int i;
+
+	if (!fph)
+		return;
+
+	for (i = 0; i < fph->hashsize; i++)
+		contended += READ_ONCE(fph->queues[i].contended);
+
+	seq_printf(m,
+		"FutexHashSlots:\t%u\n"
+		"FutexHashContended:\t%lu\n",
+		fph->hashsize, contended);
+}
+#endif
+
 static int __init futex_init(void)
 {
 	unsigned int futex_shift;
@@ -3068,6 +3206,7 @@ static int __init futex_init(void)
 
 	for (i = 0; i < futex_hashsize; i++) {
 		atomic_set(&futex_queues[i].waiters, 0);
+		futex_queues[i].contended = 0;
 		plist_head_init(&futex_queues[i].chain);
 		spin_lock_init(&futex_queues[i].lock);
 	}
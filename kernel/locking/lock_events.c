@@ -0,0 +1,99 @@
+/*
+ * Collect locking event counts
+ *
+ * The counters are exported as one file per event in the
+ * lock_event_counts directory of debugfs. Writing to the .reset_counts
+ * file clears all of them.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+
+#include "lock_events.h"
+
+#undef  LOCK_EVENT
+#define LOCK_EVENT(name)	[LOCKEVENT_ ## name] = #name,
+
+static const char * const lockevent_names[lockevent_num + 1] = {
+
+#include "lock_events_list.h"
+
+	[LOCKEVENT_reset_cnts] = ".reset_counts",
+};
+
+DEFINE_PER_CPU(unsigned long, lockevents[lockevent_num]);
+
+static ssize_t lockevent_read(struct file *file, char __user *user_buf,
+			      size_t count, loff_t *ppos)
+{
+	char buf[64];
+	int cpu, id, len;
+	u64 sum = 0;
+
+	id = (long)file_inode(file)->i_private;
+	if (id >= lockevent_num)
+		return -EBADF;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu(lockevents[id], cpu);
+	len = snprintf(buf, sizeof(buf), "%llu\n", sum);
+
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static ssize_t lockevent_write(struct file *file, const char __user *user_buf,
+			       size_t count, loff_t *ppos)
+{
+	int cpu, i;
+
+	/* Only the .reset_counts file is writable */
+	if ((long)file_inode(file)->i_private != LOCKEVENT_reset_cnts)
+		return count;
+
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < lockevent_num; i++)
+			WRITE_ONCE(per_cpu(lockevents[i], cpu), 0);
+	}
+	return count;
+}
+
+static const struct file_operations fops_lockevent = {
+	.read	= lockevent_read,
+	.write	= lockevent_write,
+	.llseek	= default_llseek,
+};
+
+static int __init init_lockevent_counts(void)
+{
+	struct dentry *d_counts;
+	int i;
+
+	d_counts = debugfs_create_dir("lock_event_counts", NULL);
+	if (!d_counts)
+		goto out;
+
+	for (i = 0; i < lockevent_num; i++) {
+		if (!debugfs_create_file(lockevent_names[i], 0400, d_counts,
+					 (void *)(long)i, &fops_lockevent))
+			goto fail_undo;
+	}
+
+	if (!debugfs_create_file(lockevent_names[LOCKEVENT_reset_cnts], 0200,
+				 d_counts, (void *)(long)LOCKEVENT_reset_cnts,
+				 &fops_lockevent))
+		goto fail_undo;
+
+	return 0;
+fail_undo:
+	debugfs_remove_recursive(d_counts);
+out:
+	pr_warn("Could not create 'lock_event_counts' directory\n");
+	return 0;
+}
+fs_initcall(init_lockevent_counts);
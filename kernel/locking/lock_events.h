@@ -0,0 +1,50 @@
+/*
+ * Per-cpu counters of interesting events in the locking slowpaths,
+ * exported in debugfs under lock_event_counts/.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef __LOCKING_LOCK_EVENTS_H
+#define __LOCKING_LOCK_EVENTS_H
+
+enum lock_events {
+
+#include "lock_events_list.h"
+
+	lockevent_num,	/* Total number of lock event counts */
+	LOCKEVENT_reset_cnts = lockevent_num,
+};
+
+#ifdef CONFIG_LOCK_EVENT_COUNTS
+/*
+ * Per-cpu counters
+ */
+DECLARE_PER_CPU(unsigned long, lockevents[lockevent_num]);
+
+/*
+ * Increment or add to a lock event count. The counters are only
+ * statistics, so a racy update against a preempting context is fine.
+ */
+#define lockevent_inc(ev)	raw_cpu_inc(lockevents[LOCKEVENT_ ## ev])
+#define lockevent_cond_inc(ev, c)			\
+do {							\
+	if (c)						\
+		lockevent_inc(ev);			\
+} while (0)
+#define lockevent_add(ev, c)	raw_cpu_add(lockevents[LOCKEVENT_ ## ev], c)
+
+/* Timestamp for the time counting events */
+#define lockevent_clock()	local_clock()
+
+#else  /* CONFIG_LOCK_EVENT_COUNTS */
+
+#define lockevent_inc(ev)		do { } while (0)
+#define lockevent_cond_inc(ev, c)	do { (void)(c); } while (0)
+#define lockevent_add(ev, c)		do { (void)(c); } while (0)
+#define lockevent_clock()		0ULL
+
+#endif /* CONFIG_LOCK_EVENT_COUNTS */
+#endif /* __LOCKING_LOCK_EVENTS_H */
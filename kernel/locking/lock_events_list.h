@@ -0,0 +1,21 @@
+/*
+ * Lock event counts, see lock_events.h. The *_ns events are in
+ * nanoseconds.
+ */
+
+#ifndef LOCK_EVENT
+#define LOCK_EVENT(name)	LOCKEVENT_ ## name,
+#endif
+
+/*
+ * Locking events for rwsem
+ */
+LOCK_EVENT(rwsem_sleep_reader)	/* # of reader sleeps			*/
+LOCK_EVENT(rwsem_sleep_writer)	/* # of writer sleeps			*/
+LOCK_EVENT(rwsem_sleep_ns)	/* Time spent sleeping on the lock	*/
+LOCK_EVENT(rwsem_opt_wlock)	/* # of locks taken spinning on writers	*/
+LOCK_EVENT(rwsem_opt_rlock)	/* # of locks taken spinning on readers	*/
+LOCK_EVENT(rwsem_opt_fail)	/* # of failed optimistic spins		*/
+LOCK_EVENT(rwsem_opt_rtimeout)	/* # of reader spin budgets exhausted	*/
+LOCK_EVENT(rwsem_opt_spin_ns)	/* Time spent spinning on the lock	*/
+LOCK_EVENT(rwsem_handoff)	/* # of lock handoffs to a waiter	*/
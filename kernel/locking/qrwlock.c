@@ -21,6 +21,7 @@
 #include <linux/percpu.h>
 #include <linux/hardirq.h>
 #include <asm/qrwlock.h>
+#include <trace/events/lock.h>
 
 /**
  * rspin_until_writer_unlock - inc reader count & spin until writer is gone
@@ -61,6 +62,8 @@ void queue_read_lock_slowpath(struct qrwlock *lock)
 	}
 	atomic_sub(_QR_BIAS, &lock->cnts);
 
+	trace_contention_begin(lock, LCB_F_SPIN | LCB_F_READ);
+
 	/*
 	 * Put the reader into the wait queue
 	 */
@@ -83,6 +86,8 @@ void queue_read_lock_slowpath(struct qrwlock *lock)
 	 * Signal the next one in queue to become queue head
 	 */
 	arch_spin_unlock(&lock->lock);
+
+	trace_contention_end(lock, 0);
 }
 EXPORT_SYMBOL(queue_read_lock_slowpath);
 
@@ -94,6 +99,8 @@ void queue_write_lock_slowpath(struct qrwlock *lock)
 {
 	u32 cnts;
 
+	trace_contention_begin(lock, LCB_F_SPIN | LCB_F_WRITE);
+
 	/* Put the writer into the wait queue */
 	arch_spin_lock(&lock->lock);
 
@@ -128,5 +135,7 @@ void queue_write_lock_slowpath(struct qrwlock *lock)
 	}
 unlock:
 	arch_spin_unlock(&lock->lock);
+
+	trace_contention_end(lock, 0);
 }
 EXPORT_SYMBOL(queue_write_lock_slowpath);
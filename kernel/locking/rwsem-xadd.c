@@ -16,7 +16,10 @@
 #include <linux/sched/rt.h>
 #include <linux/osq_lock.h>
 
+#include <trace/events/lock.h>
+
 #include "rwsem.h"
+#include "lock_events.h"
 
 /*
  * Guide to the rw_semaphore's count field for common values.
@@ -83,6 +86,7 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 	sem->count = RWSEM_UNLOCKED_VALUE;
 	raw_spin_lock_init(&sem->wait_lock);
 	INIT_LIST_HEAD(&sem->wait_list);
+	sem->handoff = false;
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
 	sem->owner = NULL;
 	osq_lock_init(&sem->osq);
@@ -100,8 +104,17 @@ struct rwsem_waiter {
 	struct list_head list;
 	struct task_struct *task;
 	enum rwsem_waiter_type type;
+	unsigned long timeout;
 };
 
+/*
+ * The lock can be stolen from the waiter at the head of the queue by
+ * optimistic spinners and by writers queueing up behind it. Once it has
+ * waited for this long, the lock is handed off to it: sem->handoff is
+ * set and nobody but the head waiter may take the lock until it has it.
+ */
+#define RWSEM_WAIT_TIMEOUT	DIV_ROUND_UP(HZ, 250)
+
 enum rwsem_wake_type {
 	RWSEM_WAKE_ANY,		/* Wake whatever's at head of wait list */
 	RWSEM_WAKE_READERS,	/* Wake readers only */
@@ -127,6 +140,12 @@ __rwsem_do_wake(struct rw_semaphore *sem, enum rwsem_wake_type wake_type)
 	long oldcount, woken, loop, adjustment;
 
 	waiter = list_entry(sem->wait_list.next, struct rwsem_waiter, list);
+
+	if (!sem->handoff && time_after(jiffies, waiter->timeout)) {
+		sem->handoff = true;
+		lockevent_inc(rwsem_handoff);
+	}
+
 	if (waiter->type == RWSEM_WAITING_FOR_WRITE) {
 		if (wake_type == RWSEM_WAKE_ANY)
 			/* Wake writer at the front of the queue, but do not
@@ -203,6 +222,9 @@ __rwsem_do_wake(struct rw_semaphore *sem, enum rwsem_wake_type wake_type)
 	sem->wait_list.next = next;
 	next->prev = &sem->wait_list;
 
+	/* The readers at the head of the queue have the lock now */
+	sem->handoff = false;
+
  out:
 	return sem;
 }
@@ -216,12 +238,16 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	long count, adjustment = -RWSEM_ACTIVE_READ_BIAS;
 	struct rwsem_waiter waiter;
 	struct task_struct *tsk = current;
+	u64 start;
 
 	/* set up my own style of waitqueue */
 	waiter.task = tsk;
 	waiter.type = RWSEM_WAITING_FOR_READ;
+	waiter.timeout = jiffies + RWSEM_WAIT_TIMEOUT;
 	get_task_struct(tsk);
 
+	trace_contention_begin(sem, LCB_F_READ);
+
 	raw_spin_lock_irq(&sem->wait_lock);
 	if (list_empty(&sem->wait_list))
 		adjustment += RWSEM_WAITING_BIAS;
@@ -243,6 +269,8 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	raw_spin_unlock_irq(&sem->wait_lock);
 
 	/* wait to be given the lock */
+	lockevent_inc(rwsem_sleep_reader);
+	start = lockevent_clock();
 	while (true) {
 		set_task_state(tsk, TASK_UNINTERRUPTIBLE);
 		if (!waiter.task)
@@ -251,12 +279,19 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	}
 
 	__set_task_state(tsk, TASK_RUNNING);
+	lockevent_add(rwsem_sleep_ns, lockevent_clock() - start);
+	trace_contention_end(sem, 0);
 	return sem;
 }
 EXPORT_SYMBOL(rwsem_down_read_failed);
 
-static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
+static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem,
+					struct rwsem_waiter *waiter)
 {
+	/* The lock has been handed off to the waiter at the head */
+	if (sem->handoff && sem->wait_list.next != &waiter->list)
+		return false;
+
 	/*
 	 * Try acquiring the write lock. Check count first in order
 	 * to reduce unnecessary expensive cmpxchg() operations.
@@ -295,6 +330,32 @@ static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
 	}
 }
 
+/*
+ * How long a writer spins on an rwsem owned by readers: the more readers,
+ * the longer it may take for all of them to leave, but a reader may also
+ * hold the lock for a long time, so the budget is bounded.
+ */
+#define RWSEM_RSPIN_MAX_NS	(25 * NSEC_PER_USEC)
+
+static inline u64 rwsem_rspin_budget(struct rw_semaphore *sem)
+{
+	long readers = READ_ONCE(sem->count) & RWSEM_ACTIVE_MASK;
+
+	return min_t(u64, (1 + readers / 4) * NSEC_PER_USEC,
+		     RWSEM_RSPIN_MAX_NS);
+}
+
+/*
+ * The readers did not leave within the budget: have the following
+ * writers sleep right away, until the next writer owns the lock.
+ */
+static inline void rwsem_disable_reader_spin(struct rw_semaphore *sem,
+					     struct task_struct *owner)
+{
+	cmpxchg(&sem->owner, owner, (struct task_struct *)
+		((unsigned long)owner | RWSEM_RSPIN_DISABLED));
+}
+
 static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 {
 	struct task_struct *owner;
@@ -303,6 +364,10 @@ static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 	if (need_resched())
 		return false;
 
+	/* Leave the lock to the waiter it has been handed off to */
+	if (READ_ONCE(sem->handoff))
+		return false;
+
 	rcu_read_lock();
 	owner = READ_ONCE(sem->owner);
 	if (!owner) {
@@ -318,6 +383,11 @@ static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 		goto done;
 	}
 
+	if (rwsem_owner_is_reader(owner)) {
+		ret = !((unsigned long)owner & RWSEM_RSPIN_DISABLED);
+		goto done;
+	}
+
 	ret = owner->on_cpu;
 done:
 	rcu_read_unlock();
@@ -364,7 +434,8 @@ bool rwsem_spin_on_owner(struct rw_semaphore *sem, struct task_struct *owner)
 static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 {
 	struct task_struct *owner;
-	bool taken = false;
+	bool taken = false, rspin = false;
+	u64 start, rspin_deadline = 0;
 
 	preempt_disable();
 
@@ -375,9 +446,15 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 	if (!osq_lock(&sem->osq))
 		goto done;
 
+	start = lockevent_clock();
 	while (true) {
 		owner = READ_ONCE(sem->owner);
-		if (owner && !rwsem_spin_on_owner(sem, owner))
+		if (rwsem_owner_is_writer(owner) &&
+		    !rwsem_spin_on_owner(sem, owner))
+			break;
+
+		/* Leave the lock to the waiter it has been handed off to */
+		if (READ_ONCE(sem->handoff))
 			break;
 
 		/* wait_lock will be acquired if write_lock is obtained */
@@ -386,13 +463,31 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 			break;
 		}
 
+		/*
+		 * Readers do not tell whether they are running, so spin on
+		 * them for a bounded time only.
+		 */
+		if (rwsem_owner_is_reader(owner)) {
+			if (!rspin) {
+				rspin = true;
+				rspin_deadline = local_clock() +
+						 rwsem_rspin_budget(sem);
+			} else if (local_clock() > rspin_deadline) {
+				rwsem_disable_reader_spin(sem, owner);
+				lockevent_inc(rwsem_opt_rtimeout);
+				break;
+			}
+		}
+
 		/*
 		 * When there's no owner, we might have preempted between the
 		 * owner acquiring the lock and setting the owner field. If
 		 * we're an RT task that will live-lock because we won't let
-		 * the owner complete.
+		 * the owner complete. The same goes for readers, which are
+		 * not tracked at all.
 		 */
-		if (!owner && (need_resched() || rt_task(current)))
+		if (!rwsem_owner_is_writer(owner) &&
+		    (need_resched() || rt_task(current)))
 			break;
 
 		/*
@@ -404,8 +499,12 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 		cpu_relax_lowlatency();
 	}
 	osq_unlock(&sem->osq);
+	lockevent_add(rwsem_opt_spin_ns, lockevent_clock() - start);
 done:
 	preempt_enable();
+	lockevent_cond_inc(rwsem_opt_wlock, taken && !rspin);
+	lockevent_cond_inc(rwsem_opt_rlock, taken && rspin);
+	lockevent_cond_inc(rwsem_opt_fail, !taken);
 	return taken;
 }
 
@@ -425,13 +524,17 @@ struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 	long count;
 	bool waiting = true; /* any queued threads before us */
 	struct rwsem_waiter waiter;
+	u64 start;
 
 	/* undo write bias from down_write operation, stop active locking */
 	count = rwsem_atomic_update(-RWSEM_ACTIVE_WRITE_BIAS, sem);
 
 	/* do optimistic spinning and steal lock if possible */
-	if (rwsem_optimistic_spin(sem))
+	trace_contention_begin(sem, LCB_F_WRITE | LCB_F_SPIN);
+	if (rwsem_optimistic_spin(sem)) {
+		trace_contention_end(sem, 0);
 		return sem;
+	}
 
 	/*
 	 * Optimistic spinning failed, proceed to the slowpath
@@ -439,6 +542,11 @@ struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 	 */
 	waiter.task = current;
 	waiter.type = RWSEM_WAITING_FOR_WRITE;
+	waiter.timeout = jiffies + RWSEM_WAIT_TIMEOUT;
+
+	lockevent_inc(rwsem_sleep_writer);
+	start = lockevent_clock();
+	trace_contention_begin(sem, LCB_F_WRITE);
 
 	raw_spin_lock_irq(&sem->wait_lock);
 
@@ -466,7 +574,7 @@ struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 	/* wait until we successfully acquire the lock */
 	set_current_state(TASK_UNINTERRUPTIBLE);
 	while (true) {
-		if (rwsem_try_write_lock(count, sem))
+		if (rwsem_try_write_lock(count, sem, &waiter))
 			break;
 		raw_spin_unlock_irq(&sem->wait_lock);
 
@@ -480,8 +588,11 @@ struct rw_semaphore __sched *rwsem_down_write_failed(struct rw_semaphore *sem)
 	}
 	__set_current_state(TASK_RUNNING);
 
+	sem->handoff = false;
 	list_del(&waiter.list);
 	raw_spin_unlock_irq(&sem->wait_lock);
+	lockevent_add(rwsem_sleep_ns, lockevent_clock() - start);
+	trace_contention_end(sem, 0);
 
 	return sem;
 }
@@ -1,12 +1,43 @@
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+/*
+ * The owner field of an rwsem held for read holds RWSEM_READER_OWNED
+ * instead of a task. The readers never clear it again, so for readers it
+ * is a hint only, which tells writers that spinning may be worth it.
+ * RWSEM_RSPIN_DISABLED is set on top of it by a writer which spun on the
+ * readers in vain, so that the following writers sleep right away; it
+ * goes away with the next writer owning the lock.
+ */
+#define RWSEM_READER_OWNED	1UL
+#define RWSEM_RSPIN_DISABLED	2UL
+
 static inline void rwsem_set_owner(struct rw_semaphore *sem)
 {
-	sem->owner = current;
+	WRITE_ONCE(sem->owner, current);
 }
 
 static inline void rwsem_clear_owner(struct rw_semaphore *sem)
 {
-	sem->owner = NULL;
+	WRITE_ONCE(sem->owner, NULL);
+}
+
+static inline bool rwsem_owner_is_reader(struct task_struct *owner)
+{
+	return (unsigned long)owner & RWSEM_READER_OWNED;
+}
+
+static inline bool rwsem_owner_is_writer(struct task_struct *owner)
+{
+	return owner && !rwsem_owner_is_reader(owner);
+}
+
+static inline void rwsem_set_reader_owned(struct rw_semaphore *sem)
+{
+	/*
+	 * Check first, so that the readers do not keep dirtying the
+	 * cacheline the other readers are reading.
+	 */
+	if (!rwsem_owner_is_reader(READ_ONCE(sem->owner)))
+		WRITE_ONCE(sem->owner, (struct task_struct *)RWSEM_READER_OWNED);
 }
 
 #else
@@ -17,4 +48,8 @@ static inline void rwsem_set_owner(struct rw_semaphore *sem)
 static inline void rwsem_clear_owner(struct rw_semaphore *sem)
 {
 }
+
+static inline void rwsem_set_reader_owned(struct rw_semaphore *sem)
+{
+}
 #endif
@@ -43,6 +43,7 @@
 #include <linux/rculist.h>
 #include <linux/poll.h>
 #include <linux/irq_work.h>
+#include <linux/kthread.h>
 #include <linux/utsname.h>
 #include <linux/ctype.h>
 #include <linux/uio.h>
@@ -1489,6 +1490,29 @@ static int console_trylock_for_printk(void)
 	return 1;
 }
 
+static bool __read_mostly printk_sync;
+module_param_named(synchronous, printk_sync, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(synchronous,
+		 "print to the consoles from the context calling printk()");
+
+/* prints to the consoles on behalf of printk() callers once it runs */
+static struct task_struct *printk_kthread;
+
+static void wake_up_printk_kthread(void);
+
+/*
+ * Whether printk() should leave the consoles to printk_kthread.  Callers
+ * then never wait for a slow console, which would otherwise stall them
+ * for as long as any other CPU keeps adding messages.  When the system
+ * is crashing or going down, the kthread may never get to run, so the
+ * messages are printed right away as before.
+ */
+static bool printk_offload(void)
+{
+	return printk_kthread && !printk_sync && !oops_in_progress &&
+	       system_state == SYSTEM_RUNNING;
+}
+
 int printk_delay_msec __read_mostly;
 
 static inline void printk_delay(void)
@@ -1757,7 +1781,9 @@ asmlinkage int vprintk_emit(int facility, int level,
 	local_irq_restore(flags);
 
 	/* If called from the scheduler, we can not call up(). */
-	if (!in_sched) {
+	if (!in_sched && printk_offload()) {
+		wake_up_printk_kthread();
+	} else if (!in_sched) {
 		lockdep_off();
 		/*
 		 * Disable preemption to avoid being preempted while holding
@@ -1832,11 +1858,14 @@ DEFINE_PER_CPU(printk_func_t, printk_func) = vprintk_default;
  *
  * This is printk(). It can be called from any context. We want it to work.
  *
- * We try to grab the console_lock. If we succeed, it's easy - we log the
- * output and call the console drivers.  If we fail to get the semaphore, we
- * place the output into the log buffer and return. The current holder of
- * the console_sem will notice the new output in console_unlock(); and will
- * send it to the consoles before releasing the lock.
+ * Once the printk kthread runs, we place the output into the log buffer,
+ * wake the kthread to send it to the consoles and return.  Before that, or
+ * when the system is going down or printk.synchronous is set, we try to grab
+ * the console_lock. If we succeed, it's easy - we log the output and call
+ * the console drivers.  If we fail to get the semaphore, we place the output
+ * into the log buffer and return. The current holder of the console_sem will
+ * notice the new output in console_unlock(); and will send it to the
+ * consoles before releasing the lock.
  *
  * One effect of this deferred printing is that code which calls printk() and
  * then changes console_loglevel may break. This is because console_loglevel
@@ -2641,8 +2670,10 @@ static void wake_up_klogd_work_func(struct irq_work *irq_work)
 	int pending = __this_cpu_xchg(printk_pending, 0);
 
 	if (pending & PRINTK_PENDING_OUTPUT) {
+		if (printk_offload())
+			wake_up_process(printk_kthread);
 		/* If trylock fails, someone else is doing the printing */
-		if (console_trylock())
+		else if (console_trylock())
 			console_unlock();
 	}
 
@@ -2665,6 +2696,18 @@ void wake_up_klogd(void)
 	preempt_enable();
 }
 
+/*
+ * printk() may be called with the runqueue or pi locks held, so the
+ * kthread is woken from irq_work, like printk_deferred() does.
+ */
+static void wake_up_printk_kthread(void)
+{
+	preempt_disable();
+	__this_cpu_or(printk_pending, PRINTK_PENDING_OUTPUT);
+	irq_work_queue(this_cpu_ptr(&wake_up_klogd_work));
+	preempt_enable();
+}
+
 int printk_deferred(const char *fmt, ...)
 {
 	va_list args;
@@ -2682,6 +2725,50 @@ int printk_deferred(const char *fmt, ...)
 	return r;
 }
 
+static bool console_output_pending(void)
+{
+	unsigned long flags;
+	bool pending;
+
+	raw_spin_lock_irqsave(&logbuf_lock, flags);
+	pending = console_seq != log_next_seq;
+	raw_spin_unlock_irqrestore(&logbuf_lock, flags);
+
+	return pending;
+}
+
+static int printk_kthread_func(void *data)
+{
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		/* resume_console() flushes whatever piled up meanwhile */
+		if (console_suspended || !console_output_pending())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		/* console_lock() lets console_unlock() reschedule per line */
+		console_lock();
+		console_unlock();
+	}
+
+	return 0;
+}
+
+static int __init printk_kthread_init(void)
+{
+	struct task_struct *tsk;
+
+	tsk = kthread_run(printk_kthread_func, NULL, "printk");
+	if (IS_ERR(tsk)) {
+		pr_err("printk: unable to start printing thread, printing synchronously\n");
+		return PTR_ERR(tsk);
+	}
+	printk_kthread = tsk;
+
+	return 0;
+}
+late_initcall(printk_kthread_init);
+
 /*
  * printk rate limiting, lifted from the networking subsystem.
  *
@@ -1975,6 +1975,11 @@ static void __call_rcu_nocb_enqueue(struct rcu_data *rdp,
 	atomic_long_add(rhcount, &rdp->nocb_q_count);
 	/* rcu_barrier() relies on ->nocb_q_count add before xchg. */
 	old_rhpp = xchg(&rdp->nocb_tail, rhtp);
+	if (old_rhpp == &rdp->nocb_head) {
+		/* Start of a new batch, for callback-latency statistics. */
+		ACCESS_ONCE(rdp->nocb_enq_jiffies) = jiffies;
+		smp_wmb(); /* Timestamp before the CB becomes visible. */
+	}
 	ACCESS_ONCE(*old_rhpp) = rhp;
 	atomic_long_add(rhcount_lazy, &rdp->nocb_q_count_lazy);
 	smp_mb__after_atomic(); /* Store *old_rhpp before _wake test. */
@@ -2091,6 +2096,20 @@ static bool __maybe_unused rcu_nocb_adopt_orphan_cbs(struct rcu_state *rsp,
 	return true;
 }
 
+/*
+ * Number of callbacks queued on the CPUs of the specified leader's
+ * group that have not yet been invoked.
+ */
+static long rcu_nocb_group_backlog(struct rcu_data *my_rdp)
+{
+	long n = 0;
+	struct rcu_data *rdp;
+
+	for (rdp = my_rdp; rdp; rdp = rdp->nocb_next_follower)
+		n += atomic_long_read(&rdp->nocb_q_count);
+	return n;
+}
+
 /*
  * If necessary, kick off a new grace period, and either way wait
  * for a subsequent grace period to complete.
@@ -2110,6 +2129,16 @@ static void rcu_nocb_wait_gp(struct rcu_data *rdp)
 	if (needwake)
 		rcu_gp_kthread_wake(rdp->rsp);
 
+	/*
+	 * If this leader's group has a large backlog, push the grace
+	 * period along rather than letting memory pile up, just as
+	 * __call_rcu_core() does for non-offloaded CPUs.
+	 */
+	if (rcu_nocb_group_backlog(rdp) > qhimark) {
+		trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu, TPS("ForceQS"));
+		force_quiescent_state(rdp->rsp);
+	}
+
 	/*
 	 * Wait for the grace period.  Do so interruptibly to avoid messing
 	 * up the load average.
@@ -2164,6 +2193,8 @@ wait_again:
 			continue;  /* No CBs here, try next follower. */
 
 		/* Move callbacks to wait-for-GP list, which is empty. */
+		smp_rmb(); /* Read ->nocb_head before its timestamp. */
+		rdp->nocb_gp_jiffies = ACCESS_ONCE(rdp->nocb_enq_jiffies);
 		ACCESS_ONCE(rdp->nocb_head) = NULL;
 		rdp->nocb_gp_tail = xchg(&rdp->nocb_tail, &rdp->nocb_head);
 		gotcbs = true;
@@ -2212,6 +2243,9 @@ wait_again:
 
 		/* Append callbacks to follower's "done" list. */
 		tail = xchg(&rdp->nocb_follower_tail, rdp->nocb_gp_tail);
+		if (tail == &rdp->nocb_follower_head)
+			ACCESS_ONCE(rdp->nocb_follower_jiffies) =
+				rdp->nocb_gp_jiffies;
 		*tail = rdp->nocb_gp_head;
 		smp_mb__after_atomic(); /* Store *tail before wakeup. */
 		if (rdp != my_rdp && tail == &rdp->nocb_follower_head) {
@@ -2268,6 +2302,8 @@ static void nocb_follower_wait(struct rcu_data *rdp)
 static int rcu_nocb_kthread(void *arg)
 {
 	int c, cl;
+	long bl;
+	unsigned long lat;
 	struct rcu_head *list;
 	struct rcu_head *next;
 	struct rcu_head **tail;
@@ -2285,13 +2321,23 @@ static int rcu_nocb_kthread(void *arg)
 		list = ACCESS_ONCE(rdp->nocb_follower_head);
 		BUG_ON(!list);
 		trace_rcu_nocb_wake(rdp->rsp->name, rdp->cpu, "WokeNonEmpty");
+		lat = jiffies - ACCESS_ONCE(rdp->nocb_follower_jiffies);
 		ACCESS_ONCE(rdp->nocb_follower_head) = NULL;
 		tail = xchg(&rdp->nocb_follower_tail, &rdp->nocb_follower_head);
 
+		/*
+		 * Adapt the batch size to the backlog: yield the CPU every
+		 * blimit callbacks normally, but run the whole list once
+		 * the queue has grown past qhimark so that memory gets
+		 * freed before it piles up.
+		 */
+		bl = atomic_long_read(&rdp->nocb_q_count) > qhimark ?
+		     LONG_MAX : blimit;
+
 		/* Each pass through the following loop invokes a callback. */
 		trace_rcu_batch_start(rdp->rsp->name,
 				      atomic_long_read(&rdp->nocb_q_count_lazy),
-				      atomic_long_read(&rdp->nocb_q_count), -1);
+				      atomic_long_read(&rdp->nocb_q_count), bl);
 		c = cl = 0;
 		while (list) {
 			next = list->next;
@@ -2311,12 +2357,20 @@ static int rcu_nocb_kthread(void *arg)
 			c++;
 			local_bh_enable();
 			list = next;
+			if (bl != LONG_MAX && !(c % bl))
+				cond_resched_rcu_qs();
 		}
 		trace_rcu_batch_end(rdp->rsp->name, c, !!list, 0, 0, 1);
 		smp_mb__before_atomic();  /* _add after CB invocation. */
 		atomic_long_add(-c, &rdp->nocb_q_count);
 		atomic_long_add(-cl, &rdp->nocb_q_count_lazy);
 		rdp->n_nocbs_invoked += c;
+		rdp->n_nocb_batches++;
+		rdp->nocb_lat_total += lat;
+		if (lat > rdp->nocb_lat_max)
+			rdp->nocb_lat_max = lat;
+		trace_rcu_nocb_batch(rdp->rsp->name, rdp->cpu, c,
+				     jiffies_to_msecs(lat));
 	}
 	return 0;
 }
@@ -2444,10 +2498,16 @@ static void rcu_spawn_one_nocb_kthread(struct rcu_state *rsp, int cpu)
 		rdp_spawn->nocb_next_follower = rdp_old_leader;
 	}
 
-	/* Spawn the kthread for this CPU and RCU flavor. */
-	t = kthread_run(rcu_nocb_kthread, rdp_spawn,
-			"rcuo%c/%d", rsp->abbr, cpu);
+	/*
+	 * Spawn the kthread for this CPU and RCU flavor, with its stack
+	 * and task_struct on the CPU's node, where most of the callbacks
+	 * it invokes will free memory.
+	 */
+	t = kthread_create_on_node(rcu_nocb_kthread, rdp_spawn,
+				   cpu_to_node(cpu), "rcuo%c/%d",
+				   rsp->abbr, cpu);
 	BUG_ON(IS_ERR(t));
+	wake_up_process(t);
 	ACCESS_ONCE(rdp_spawn->nocb_kthread) = t;
 }
 
@@ -2482,6 +2542,10 @@ static void __init rcu_spawn_nocb_kthreads(void)
 static int rcu_nocb_leader_stride = -1;
 module_param(rcu_nocb_leader_stride, int, 0444);
 
+/* Start a new leader group at each NUMA node boundary? */
+static bool rcu_nocb_leader_per_node = true;
+module_param(rcu_nocb_leader_per_node, bool, 0444);
+
 /*
  * Initialize leader-follower relationships for all no-CBs CPU.
  */
@@ -2507,7 +2571,9 @@ static void __init rcu_organize_nocb_kthreads(struct rcu_state *rsp)
 	 */
 	for_each_cpu(cpu, rcu_nocb_mask) {
 		rdp = per_cpu_ptr(rsp->rda, cpu);
-		if (rdp->cpu >= nl) {
+		if (rdp->cpu >= nl ||
+		    (rcu_nocb_leader_per_node &&
+		     cpu_to_node(cpu) != cpu_to_node(rdp_leader->cpu))) {
 			/* New leader, set up for followers & next leader. */
 			nl = DIV_ROUND_UP(rdp->cpu + 1, ls) * ls;
 			rdp->nocb_leader = rdp;
@@ -599,18 +599,25 @@ int get_nohz_timer_target(int pinned)
 	int i;
 	struct sched_domain *sd;
 
-	if (pinned || !get_sysctl_timer_migration() || !idle_cpu(cpu))
+	if (pinned || !get_sysctl_timer_migration())
+		return cpu;
+
+	/* Unpinned timers are not left on full dynticks CPUs. */
+	if (!idle_cpu(cpu) && is_housekeeping_cpu(cpu))
 		return cpu;
 
 	rcu_read_lock();
 	for_each_domain(cpu, sd) {
 		for_each_cpu(i, sched_domain_span(sd)) {
-			if (!idle_cpu(i)) {
+			if (!idle_cpu(i) && is_housekeeping_cpu(i)) {
 				cpu = i;
 				goto unlock;
 			}
 		}
 	}
+
+	if (!is_housekeeping_cpu(cpu))
+		cpu = housekeeping_any_cpu();
 unlock:
 	rcu_read_unlock();
 	return cpu;
@@ -802,10 +809,251 @@ static void set_load_weight(struct task_struct *p)
 	load->inv_weight = prio_to_wmult[prio];
 }
 
+#ifdef CONFIG_UCLAMP_TASK
+/*
+ * Utilization clamping.
+ *
+ * Each RUNNABLE task is refcounted in one of UCLAMP_BUCKETS buckets per
+ * clamp of its runqueue, by the value of the clamp. The clamp of the
+ * runqueue is the max of the clamps of its RUNNABLE tasks, which only needs
+ * a scan of the buckets when the last task of the topmost one leaves, so
+ * that enqueue and dequeue stay O(1) in the number of tasks.
+ */
+#define UCLAMP_BUCKET_DELTA DIV_ROUND_CLOSEST(SCHED_CAPACITY_SCALE, UCLAMP_BUCKETS)
+
+static inline unsigned int uclamp_bucket_id(unsigned int clamp_value)
+{
+	return min_t(unsigned int, clamp_value / UCLAMP_BUCKET_DELTA,
+		     UCLAMP_BUCKETS - 1);
+}
+
+static inline unsigned int uclamp_none(enum uclamp_id clamp_id)
+{
+	if (clamp_id == UCLAMP_MIN)
+		return 0;
+	return SCHED_CAPACITY_SCALE;
+}
+
+static inline void uclamp_se_set(struct uclamp_se *uc_se, unsigned int value)
+{
+	uc_se->value = value;
+	uc_se->bucket_id = uclamp_bucket_id(value);
+}
+
+static inline
+unsigned int uclamp_rq_max_value(struct rq *rq, enum uclamp_id clamp_id)
+{
+	struct uclamp_bucket *bucket = rq->uclamp[clamp_id].bucket;
+	int bucket_id;
+
+	for (bucket_id = UCLAMP_BUCKETS - 1; bucket_id >= 0; bucket_id--) {
+		if (bucket[bucket_id].tasks)
+			return bucket[bucket_id].value;
+	}
+
+	return uclamp_none(clamp_id);
+}
+
+/*
+ * The clamps requested by a task are restricted to the effective clamps of
+ * its task group; tasks of the root group and of autogroups are not.
+ */
+static inline struct uclamp_se
+uclamp_tg_restrict(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	struct uclamp_se uc_req = p->uclamp_req[clamp_id];
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	struct task_group *tg = task_group(p);
+	unsigned int value;
+
+	if (tg == &root_task_group || task_group_is_autogroup(tg))
+		return uc_req;
+
+	value = clamp_t(unsigned int, uc_req.value,
+			tg->uclamp[UCLAMP_MIN].value,
+			tg->uclamp[UCLAMP_MAX].value);
+	uclamp_se_set(&uc_req, value);
+#endif
+	return uc_req;
+}
+
+unsigned int uclamp_eff_value(struct task_struct *p, enum uclamp_id clamp_id)
+{
+	if (p->uclamp[clamp_id].active)
+		return p->uclamp[clamp_id].value;
+
+	return uclamp_tg_restrict(p, clamp_id).value;
+}
+
+static inline void uclamp_rq_inc_id(struct rq *rq, struct task_struct *p,
+				    enum uclamp_id clamp_id)
+{
+	struct uclamp_rq *uc_rq = &rq->uclamp[clamp_id];
+	struct uclamp_se *uc_se = &p->uclamp[clamp_id];
+	struct uclamp_bucket *bucket;
+
+	lockdep_assert_held(&rq->lock);
+
+	*uc_se = uclamp_tg_restrict(p, clamp_id);
+	uc_se->active = true;
+
+	bucket = &uc_rq->bucket[uc_se->bucket_id];
+	bucket->tasks++;
+	if (bucket->tasks == 1 || uc_se->value > bucket->value)
+		bucket->value = uc_se->value;
+
+	if (uc_rq->nr_tasks++ == 0 || uc_se->value > uc_rq->value)
+		WRITE_ONCE(uc_rq->value, uc_se->value);
+}
+
+static inline void uclamp_rq_dec_id(struct rq *rq, struct task_struct *p,
+				    enum uclamp_id clamp_id)
+{
+	struct uclamp_rq *uc_rq = &rq->uclamp[clamp_id];
+	struct uclamp_se *uc_se = &p->uclamp[clamp_id];
+	struct uclamp_bucket *bucket;
+
+	lockdep_assert_held(&rq->lock);
+
+	bucket = &uc_rq->bucket[uc_se->bucket_id];
+	if (WARN_ON_ONCE(!bucket->tasks))
+		return;
+
+	bucket->tasks--;
+	uc_rq->nr_tasks--;
+	uc_se->active = false;
+
+	/*
+	 * A bucket keeps the max of the clamps of the tasks it ever held
+	 * while not empty; the (slight) overboost of the other tasks of the
+	 * bucket is accepted to keep this O(1).
+	 */
+	if (bucket->tasks)
+		return;
+
+	if (bucket->value >= uc_rq->value)
+		WRITE_ONCE(uc_rq->value, uclamp_rq_max_value(rq, clamp_id));
+}
+
+static inline void uclamp_rq_inc(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+		uclamp_rq_inc_id(rq, p, clamp_id);
+}
+
+static inline void uclamp_rq_dec(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++) {
+		if (p->uclamp[clamp_id].active)
+			uclamp_rq_dec_id(rq, p, clamp_id);
+	}
+}
+
+/*
+ * Refresh the clamps of a RUNNABLE task after its requested clamps, or those
+ * of its task group, changed.
+ */
+static void uclamp_update_active(struct rq *rq, struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++) {
+		if (!p->uclamp[clamp_id].active)
+			continue;
+		uclamp_rq_dec_id(rq, p, clamp_id);
+		uclamp_rq_inc_id(rq, p, clamp_id);
+	}
+}
+
+static int uclamp_validate(struct task_struct *p,
+			   const struct sched_attr *attr)
+{
+	unsigned int lower = p->uclamp_req[UCLAMP_MIN].value;
+	unsigned int upper = p->uclamp_req[UCLAMP_MAX].value;
+
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MIN)
+		lower = attr->sched_util_min;
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MAX)
+		upper = attr->sched_util_max;
+
+	if (lower > upper || upper > SCHED_CAPACITY_SCALE)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void __setscheduler_uclamp(struct rq *rq, struct task_struct *p,
+				  const struct sched_attr *attr)
+{
+	if (!(attr->sched_flags & SCHED_FLAG_UTIL_CLAMP))
+		return;
+
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MIN)
+		uclamp_se_set(&p->uclamp_req[UCLAMP_MIN], attr->sched_util_min);
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MAX)
+		uclamp_se_set(&p->uclamp_req[UCLAMP_MAX], attr->sched_util_max);
+
+	uclamp_update_active(rq, p);
+}
+
+static void uclamp_fork(struct task_struct *p)
+{
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++) {
+		p->uclamp[clamp_id].active = false;
+		if (unlikely(p->sched_reset_on_fork))
+			uclamp_se_set(&p->uclamp_req[clamp_id],
+				      uclamp_none(clamp_id));
+	}
+}
+
+static void __init init_uclamp(void)
+{
+	enum uclamp_id clamp_id;
+	int cpu;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++) {
+		for_each_possible_cpu(cpu)
+			cpu_rq(cpu)->uclamp[clamp_id].value =
+				uclamp_none(clamp_id);
+
+		uclamp_se_set(&init_task.uclamp_req[clamp_id],
+			      uclamp_none(clamp_id));
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+		root_task_group.uclamp_pct[clamp_id] =
+			clamp_id == UCLAMP_MIN ? 0 : 100;
+		uclamp_se_set(&root_task_group.uclamp_req[clamp_id],
+			      uclamp_none(clamp_id));
+		root_task_group.uclamp[clamp_id] =
+			root_task_group.uclamp_req[clamp_id];
+#endif
+	}
+}
+#else
+static inline void uclamp_rq_inc(struct rq *rq, struct task_struct *p) { }
+static inline void uclamp_rq_dec(struct rq *rq, struct task_struct *p) { }
+static inline int uclamp_validate(struct task_struct *p,
+				  const struct sched_attr *attr)
+{
+	return -EOPNOTSUPP;
+}
+static inline void __setscheduler_uclamp(struct rq *rq, struct task_struct *p,
+					 const struct sched_attr *attr) { }
+static inline void uclamp_fork(struct task_struct *p) { }
+static inline void init_uclamp(void) { }
+#endif /* CONFIG_UCLAMP_TASK */
+
 static void enqueue_task(struct rq *rq, struct task_struct *p, int flags)
 {
 	update_rq_clock(rq);
 	sched_info_queued(rq, p);
+	psi_enqueue(p, flags & ENQUEUE_WAKEUP);
+	uclamp_rq_inc(rq, p);
 	p->sched_class->enqueue_task(rq, p, flags);
 }
 
@@ -813,6 +1061,8 @@ static void dequeue_task(struct rq *rq, struct task_struct *p, int flags)
 {
 	update_rq_clock(rq);
 	sched_info_dequeued(rq, p);
+	psi_dequeue(p, flags & DEQUEUE_SLEEP);
+	uclamp_rq_dec(rq, p);
 	p->sched_class->dequeue_task(rq, p, flags);
 }
 
@@ -1049,6 +1299,7 @@ void set_task_cpu(struct task_struct *p, unsigned int new_cpu)
 		if (p->sched_class->migrate_task_rq)
 			p->sched_class->migrate_task_rq(p, new_cpu);
 		p->se.nr_migrations++;
+		rseq_migrate(p);
 		perf_sw_event_sched(PERF_COUNT_SW_CPU_MIGRATIONS, 1, 0);
 	}
 
@@ -1696,6 +1947,7 @@ try_to_wake_up(struct task_struct *p, unsigned int state, int wake_flags)
 	cpu = select_task_rq(p, p->wake_cpu, SD_BALANCE_WAKE, wake_flags);
 	if (task_cpu(p) != cpu) {
 		wake_flags |= WF_MIGRATED;
+		psi_ttwu_dequeue(p);
 		set_task_cpu(p, cpu);
 	}
 #endif /* CONFIG_SMP */
@@ -1745,6 +1997,52 @@ out:
 	raw_spin_unlock(&p->pi_lock);
 }
 
+void wake_q_add(struct wake_q_head *head, struct task_struct *task)
+{
+	struct wake_q_node *node = &task->wake_q;
+
+	/*
+	 * Atomically grab the task, if ->wake_q is !nil already it means
+	 * its already queued (either by us or someone else) and will get the
+	 * wakeup due to that.
+	 *
+	 * This cmpxchg() implies a full barrier, which pairs with the write
+	 * barrier implied by the wakeup in wake_up_q().
+	 */
+	if (cmpxchg(&node->next, NULL, WAKE_Q_TAIL))
+		return;
+
+	get_task_struct(task);
+
+	/*
+	 * The head is context local, there can be no concurrency.
+	 */
+	*head->lastp = node;
+	head->lastp = &node->next;
+}
+
+void wake_up_q(struct wake_q_head *head)
+{
+	struct wake_q_node *node = head->first;
+
+	while (node != WAKE_Q_TAIL) {
+		struct task_struct *task;
+
+		task = container_of(node, struct task_struct, wake_q);
+		BUG_ON(!task);
+		/* task can safely be re-inserted now */
+		node = node->next;
+		task->wake_q.next = NULL;
+
+		/*
+		 * wake_up_process() implies a wmb() to pair with the queueing
+		 * in wake_q_add() so as not to miss wakeups.
+		 */
+		wake_up_process(task);
+		put_task_struct(task);
+	}
+}
+
 /**
  * wake_up_process - Wake up a specific process
  * @p: The process to be woken up.
@@ -1818,6 +2116,12 @@ static void __sched_fork(unsigned long clone_flags, struct task_struct *p)
 
 	INIT_LIST_HEAD(&p->rt.run_list);
 
+#ifdef CONFIG_PSI
+	p->psi_flags = 0;
+	p->in_memstall = 0;
+	p->sched_psi_wake_requeue = 0;
+#endif
+
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
@@ -1838,6 +2142,9 @@ static void __sched_fork(unsigned long clone_flags, struct task_struct *p)
 	p->numa_scan_period = sysctl_numa_balancing_scan_delay;
 	p->numa_work.next = &p->numa_work;
 	p->numa_faults = NULL;
+	p->numa_hint_faults = 0;
+	p->numa_hint_faults_local = 0;
+	p->numa_pages_migrate_failed = 0;
 	p->last_task_numa_placement = 0;
 	p->last_sum_exec_runtime = 0;
 
@@ -1907,6 +2214,8 @@ int sched_fork(unsigned long clone_flags, struct task_struct *p)
 	 */
 	p->prio = current->normal_prio;
 
+	uclamp_fork(p);
+
 	/*
 	 * Revert to default priority/policy on fork if requested.
 	 */
@@ -2179,6 +2488,7 @@ prepare_task_switch(struct rq *rq, struct task_struct *prev,
 	trace_sched_switch(prev, next);
 	sched_info_switch(rq, prev, next);
 	perf_event_task_sched_out(prev, next);
+	rseq_preempt(prev);
 	fire_sched_out_preempt_notifiers(prev, next);
 	prepare_lock_switch(rq, next);
 	prepare_arch_switch(next);
@@ -2504,43 +2814,93 @@ void scheduler_tick(void)
 	update_rq_clock(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
 	update_cpu_load_active(rq);
+	psi_task_tick(rq);
 	raw_spin_unlock(&rq->lock);
 
+	if (sched_core_enabled())
+		sched_core_tick(rq);
+
 	perf_event_task_tick();
 
 #ifdef CONFIG_SMP
 	rq->idle_balance = idle_cpu(cpu);
 	trigger_load_balance(rq);
 #endif
-	rq_last_tick_reset(rq);
 }
 
 #ifdef CONFIG_NO_HZ_FULL
-/**
- * scheduler_tick_max_deferment
- *
- * Keep at least one tick per second when a single
- * active task is running because the scheduler doesn't
- * yet completely support full dynticks environment.
- *
- * This makes sure that uptime, CFS vruntime, load
- * balancing, etc... continue to move forward, even
- * with a very low granularity.
- *
- * Return: Maximum deferment in nanoseconds.
- */
-u64 scheduler_tick_max_deferment(void)
+/*
+ * The tick of a full dynticks CPU running a single task stays stopped, so a
+ * housekeeping CPU does the scheduler tick work for that task once per
+ * second instead: runtime and vruntime, load tracking and the slice checks
+ * that lead to preemption keep moving forward, with a low granularity.
+ */
+struct tick_work {
+	int			cpu;
+	struct delayed_work	work;
+};
+
+static struct tick_work __percpu *tick_work_cpu;
+
+static void sched_tick_remote(struct work_struct *work)
 {
-	struct rq *rq = this_rq();
-	unsigned long next, now = ACCESS_ONCE(jiffies);
+	struct delayed_work *dwork = to_delayed_work(work);
+	struct tick_work *twork = container_of(dwork, struct tick_work, work);
+	int cpu = twork->cpu;
+	struct rq *rq = cpu_rq(cpu);
+	struct task_struct *curr;
+	unsigned long flags;
+
+	/*
+	 * Only do the work while the remote tick is stopped. The check is
+	 * racy, but a tick more or less does not matter: the tick work does
+	 * not depend on when exactly it runs.
+	 */
+	if (!idle_cpu(cpu) && tick_nohz_tick_stopped_cpu(cpu)) {
+		raw_spin_lock_irqsave(&rq->lock, flags);
+		curr = rq->curr;
+		if (!is_idle_task(curr)) {
+			update_rq_clock(rq);
+			curr->sched_class->task_tick(rq, curr, 0);
+		}
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
+	}
+
+	queue_delayed_work(system_unbound_wq, dwork, HZ);
+}
 
-	next = rq->last_sched_tick + HZ;
+static void sched_tick_start(int cpu)
+{
+	struct tick_work *twork;
 
-	if (time_before_eq(next, now))
-		return 0;
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	twork = per_cpu_ptr(tick_work_cpu, cpu);
+	twork->cpu = cpu;
+	INIT_DELAYED_WORK(&twork->work, sched_tick_remote);
+	queue_delayed_work(system_unbound_wq, &twork->work, HZ);
+}
+
+#ifdef CONFIG_HOTPLUG_CPU
+static void sched_tick_stop(int cpu)
+{
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	cancel_delayed_work_sync(&per_cpu_ptr(tick_work_cpu, cpu)->work);
+}
+#endif
 
-	return jiffies_to_nsecs(next - now);
+static void __init sched_tick_offload_init(void)
+{
+	tick_work_cpu = alloc_percpu(struct tick_work);
+	BUG_ON(!tick_work_cpu);
 }
+#else
+static inline void sched_tick_start(int cpu) { }
+static inline void sched_tick_stop(int cpu) { }
+static inline void sched_tick_offload_init(void) { }
 #endif
 
 notrace unsigned long get_parent_ip(unsigned long addr)
@@ -2696,6 +3056,192 @@ again:
 	BUG(); /* the idle class will always have a runnable task */
 }
 
+#ifdef CONFIG_SCHED_CORE
+/*
+ * Core scheduling: SMT siblings only run tasks with the same cookie at the
+ * same time, so that tasks which don't trust each other never share a core.
+ *
+ * Each cpu publishes the cookie and priority of what it runs under the core
+ * lock. A cpu whose pick doesn't match what a sibling runs goes idle
+ * instead, unless its pick has a higher priority, or the same priority and
+ * the cpu has been kept idle for a whole sched_latency period. A cpu whose
+ * published state changes makes its siblings pick again, which is when a
+ * losing sibling goes idle and an idled one gets to run again.
+ */
+static struct static_key sched_core_key = STATIC_KEY_INIT_FALSE;
+static DEFINE_MUTEX(sched_core_mutex);
+static int sched_core_count;
+
+/* Priority published by a cpu running idle: it is compatible with anything. */
+#define CORE_PRIO_IDLE	MAX_PRIO
+
+static inline bool sched_core_enabled(void)
+{
+	return static_key_false(&sched_core_key);
+}
+
+static inline raw_spinlock_t *sched_core_lock(int cpu)
+{
+	return &cpu_rq(cpumask_first(cpu_smt_mask(cpu)))->core_lock;
+}
+
+static inline bool sched_core_starved(struct rq *rq, u64 now)
+{
+	u64 since = READ_ONCE(rq->core_forceidle);
+
+	return since && now - since >= sysctl_sched_latency;
+}
+
+static struct task_struct *
+pick_next_task_core(struct rq *rq, struct task_struct *next)
+{
+	int cpu = cpu_of(rq), i;
+	raw_spinlock_t *lock = sched_core_lock(cpu);
+	int prio = CORE_PRIO_IDLE;
+	unsigned long cookie = 0;
+	u64 now = rq_clock(rq);
+
+	/* The idle and stop tasks run no untrusted code. */
+	if (next != rq->idle && next->sched_class != &stop_sched_class) {
+		cookie = READ_ONCE(next->core_cookie);
+		prio = next->prio;
+	}
+
+	raw_spin_lock(lock);
+
+	for_each_cpu(i, cpu_smt_mask(cpu)) {
+		struct rq *srq = cpu_rq(i);
+
+		if (prio == CORE_PRIO_IDLE || i == cpu ||
+		    srq->core_prio == CORE_PRIO_IDLE ||
+		    srq->core_cookie == cookie)
+			continue;
+
+		if (prio < srq->core_prio ||
+		    (prio == srq->core_prio && sched_core_starved(rq, now)))
+			continue;
+
+		/* Lost against a sibling: put @next back and idle. */
+		next = idle_sched_class.pick_next_task(rq, next);
+		cookie = 0;
+		prio = CORE_PRIO_IDLE;
+		if (!rq->core_forceidle)
+			WRITE_ONCE(rq->core_forceidle, now ? now : 1);
+		goto publish;
+	}
+	WRITE_ONCE(rq->core_forceidle, 0);
+
+publish:
+	if (rq->core_cookie != cookie || rq->core_prio != prio)
+		rq->core_kick = true;
+	rq->core_cookie = cookie;
+	rq->core_prio = prio;
+
+	raw_spin_unlock(lock);
+
+	return next;
+}
+
+static void sched_core_resched(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	resched_curr(rq);
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/*
+ * Called without rq->lock after a pick that changed what this cpu
+ * publishes: the siblings have to pick again.
+ */
+static void sched_core_kick(struct rq *rq)
+{
+	int cpu = cpu_of(rq), i;
+
+	if (!rq->core_kick)
+		return;
+	rq->core_kick = false;
+
+	for_each_cpu(i, cpu_smt_mask(cpu)) {
+		if (i != cpu)
+			sched_core_resched(i);
+	}
+}
+
+/*
+ * Called from the tick of a busy cpu: give siblings that have been kept
+ * idle for too long a chance to take the core over.
+ */
+static void sched_core_tick(struct rq *rq)
+{
+	int cpu = cpu_of(rq), i;
+	u64 now = sched_clock_cpu(cpu);
+
+	if (rq->curr == rq->idle)
+		return;
+
+	for_each_cpu(i, cpu_smt_mask(cpu)) {
+		if (i != cpu && sched_core_starved(cpu_rq(i), now))
+			sched_core_resched(i);
+	}
+}
+
+static unsigned long sched_core_tg_cookie(struct task_group *tg)
+{
+	for (; tg; tg = tg->parent) {
+		if (tg->core_tagged)
+			return (unsigned long)tg;
+	}
+	return 0;
+}
+
+static void sched_core_update_cookies(void)
+{
+	struct task_struct *g, *p;
+	unsigned long flags;
+	struct rq *rq;
+
+	read_lock(&tasklist_lock);
+	for_each_process_thread(g, p) {
+		rq = task_rq_lock(p, &flags);
+		WRITE_ONCE(p->core_cookie,
+			   sched_core_tg_cookie(p->sched_task_group));
+		task_rq_unlock(rq, p, &flags);
+	}
+	read_unlock(&tasklist_lock);
+}
+
+static void sched_core_get(void)
+{
+	int cpu;
+
+	if (sched_core_count++)
+		return;
+
+	static_key_slow_inc(&sched_core_key);
+
+	/* What the cpus published last time around is stale. */
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		sched_core_resched(cpu);
+	put_online_cpus();
+}
+
+static void sched_core_put(void)
+{
+	if (!--sched_core_count)
+		static_key_slow_dec(&sched_core_key);
+}
+#else
+static inline bool sched_core_enabled(void) { return false; }
+static inline struct task_struct *
+pick_next_task_core(struct rq *rq, struct task_struct *next) { return next; }
+static inline void sched_core_kick(struct rq *rq) { }
+static inline void sched_core_tick(struct rq *rq) { }
+#endif /* CONFIG_SCHED_CORE */
+
 /*
  * __schedule() is the main scheduler function.
  *
@@ -2793,6 +3339,8 @@ static void __sched __schedule(void)
 		update_rq_clock(rq);
 
 	next = pick_next_task(rq, prev);
+	if (sched_core_enabled())
+		next = pick_next_task_core(rq, next);
 	clear_tsk_need_resched(prev);
 	clear_preempt_need_resched();
 	rq->clock_skip_update = 0;
@@ -2809,6 +3357,9 @@ static void __sched __schedule(void)
 
 	post_schedule(rq);
 
+	if (sched_core_enabled())
+		sched_core_kick(rq);
+
 	sched_preempt_enable_no_resched();
 }
 
@@ -3441,9 +3992,15 @@ recheck:
 			return -EINVAL;
 	}
 
-	if (attr->sched_flags & ~(SCHED_FLAG_RESET_ON_FORK))
+	if (attr->sched_flags & ~(SCHED_FLAG_RESET_ON_FORK | SCHED_FLAG_UTIL_CLAMP))
 		return -EINVAL;
 
+	if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP) {
+		retval = uclamp_validate(p, attr);
+		if (retval)
+			return retval;
+	}
+
 	/*
 	 * Valid priorities for SCHED_FIFO and SCHED_RR are
 	 * 1..MAX_USER_RT_PRIO-1, valid priority for SCHED_NORMAL,
@@ -3505,6 +4062,13 @@ recheck:
 		/* Normal users shall not reset the sched_reset_on_fork flag */
 		if (p->sched_reset_on_fork && !reset_on_fork)
 			return -EPERM;
+
+#ifdef CONFIG_UCLAMP_TASK
+		/* can't boost beyond the current min utilization */
+		if ((attr->sched_flags & SCHED_FLAG_UTIL_CLAMP_MIN) &&
+		    attr->sched_util_min > p->uclamp_req[UCLAMP_MIN].value)
+			return -EPERM;
+#endif
 	}
 
 	if (user) {
@@ -3541,6 +4105,8 @@ recheck:
 			goto change;
 		if (dl_policy(policy) && dl_param_changed(p, attr))
 			goto change;
+		if (attr->sched_flags & SCHED_FLAG_UTIL_CLAMP)
+			goto change;
 
 		p->sched_reset_on_fork = reset_on_fork;
 		task_rq_unlock(rq, p, &flags);
@@ -3599,6 +4165,8 @@ change:
 	p->sched_reset_on_fork = reset_on_fork;
 	oldprio = p->prio;
 
+	__setscheduler_uclamp(rq, p, attr);
+
 	/*
 	 * Take priority boosted tasks into account. If the new
 	 * effective priority is unchanged, we just store the new
@@ -4004,6 +4572,14 @@ SYSCALL_DEFINE4(sched_getattr, pid_t, pid, struct sched_attr __user *, uattr,
 	else
 		attr.sched_nice = task_nice(p);
 
+#ifdef CONFIG_UCLAMP_TASK
+	/* older user-space does not know about the clamps */
+	if (size >= SCHED_ATTR_SIZE_VER1) {
+		attr.sched_util_min = p->uclamp_req[UCLAMP_MIN].value;
+		attr.sched_util_max = p->uclamp_req[UCLAMP_MAX].value;
+	}
+#endif
+
 	rcu_read_unlock();
 
 	retval = sched_read_attr(uattr, &attr, size);
@@ -5284,6 +5860,7 @@ migration_call(struct notifier_block *nfb, unsigned long action, void *hcpu)
 			set_rq_online(rq);
 		}
 		raw_spin_unlock_irqrestore(&rq->lock, flags);
+		sched_tick_start(cpu);
 		break;
 
 #ifdef CONFIG_HOTPLUG_CPU
@@ -5301,6 +5878,7 @@ migration_call(struct notifier_block *nfb, unsigned long action, void *hcpu)
 		break;
 
 	case CPU_DEAD:
+		sched_tick_stop(cpu);
 		calc_load_migrate(rq);
 		break;
 #endif
@@ -5707,6 +6285,8 @@ static void free_sched_domain(struct rcu_head *rcu)
 		kfree(sd->groups->sgc);
 		kfree(sd->groups);
 	}
+	if (sd->shared && atomic_dec_and_test(&sd->shared->ref))
+		kfree(sd->shared);
 	kfree(sd);
 }
 
@@ -5733,6 +6313,7 @@ static void destroy_sched_domains(struct sched_domain *sd, int cpu)
 DEFINE_PER_CPU(struct sched_domain *, sd_llc);
 DEFINE_PER_CPU(int, sd_llc_size);
 DEFINE_PER_CPU(int, sd_llc_id);
+DEFINE_PER_CPU(struct sched_domain_shared *, sd_llc_shared);
 DEFINE_PER_CPU(struct sched_domain *, sd_numa);
 DEFINE_PER_CPU(struct sched_domain *, sd_busy);
 DEFINE_PER_CPU(struct sched_domain *, sd_asym);
@@ -5741,6 +6322,7 @@ static void update_top_cache_domain(int cpu)
 {
 	struct sched_domain *sd;
 	struct sched_domain *busy_sd = NULL;
+	struct sched_domain_shared *sds = NULL;
 	int id = cpu;
 	int size = 1;
 
@@ -5749,8 +6331,10 @@ static void update_top_cache_domain(int cpu)
 		id = cpumask_first(sched_domain_span(sd));
 		size = cpumask_weight(sched_domain_span(sd));
 		busy_sd = sd->parent; /* sd_busy */
+		sds = sd->shared;
 	}
 	rcu_assign_pointer(per_cpu(sd_busy, cpu), busy_sd);
+	rcu_assign_pointer(per_cpu(sd_llc_shared, cpu), sds);
 
 	rcu_assign_pointer(per_cpu(sd_llc, cpu), sd);
 	per_cpu(sd_llc_size, cpu) = size;
@@ -6139,6 +6723,9 @@ static void claim_allocations(int cpu, struct sched_domain *sd)
 
 	if (atomic_read(&(*per_cpu_ptr(sdd->sgc, cpu))->ref))
 		*per_cpu_ptr(sdd->sgc, cpu) = NULL;
+
+	if (atomic_read(&(*per_cpu_ptr(sdd->sds, cpu))->ref))
+		*per_cpu_ptr(sdd->sds, cpu) = NULL;
 }
 
 #ifdef CONFIG_NUMA
@@ -6160,6 +6747,9 @@ static int sched_domains_curr_level;
  *
  * Odd one out:
  * SD_ASYM_PACKING        - describes SMT quirks
+ *
+ * SD_ASYM_CPUCAPACITY is not part of the list: it is derived from the
+ * capacities the architecture reports for the CPUs of each domain.
  */
 #define TOPOLOGY_SD_FLAGS		\
 	(SD_SHARE_CPUCAPACITY |		\
@@ -6168,6 +6758,23 @@ static int sched_domains_curr_level;
 	 SD_ASYM_PACKING |		\
 	 SD_SHARE_POWERDOMAIN)
 
+/*
+ * Whether the CPUs spanned by @tl for @cpu have different original
+ * capacities, as on big.LITTLE systems.
+ */
+static bool sd_asym_cpucapacity(struct sched_domain_topology_level *tl, int cpu)
+{
+	unsigned long capacity = arch_scale_cpu_capacity(NULL, cpu);
+	int i;
+
+	for_each_cpu(i, tl->mask(cpu)) {
+		if (arch_scale_cpu_capacity(NULL, i) != capacity)
+			return true;
+	}
+
+	return false;
+}
+
 static struct sched_domain *
 sd_init(struct sched_domain_topology_level *tl, int cpu)
 {
@@ -6261,6 +6868,13 @@ sd_init(struct sched_domain_topology_level *tl, int cpu)
 		sd->idle_idx = 1;
 	}
 
+	/*
+	 * Spread wakeups across CPUs of different capacity so that tasks
+	 * which outgrow a small CPU can be placed on a bigger one.
+	 */
+	if (sd_asym_cpucapacity(tl, cpu))
+		sd->flags |= SD_ASYM_CPUCAPACITY | SD_BALANCE_WAKE;
+
 	sd->private = &tl->data;
 
 	return sd;
@@ -6604,10 +7218,15 @@ static int __sdt_alloc(const struct cpumask *cpu_map)
 		if (!sdd->sgc)
 			return -ENOMEM;
 
+		sdd->sds = alloc_percpu(struct sched_domain_shared *);
+		if (!sdd->sds)
+			return -ENOMEM;
+
 		for_each_cpu(j, cpu_map) {
 			struct sched_domain *sd;
 			struct sched_group *sg;
 			struct sched_group_capacity *sgc;
+			struct sched_domain_shared *sds;
 
 		       	sd = kzalloc_node(sizeof(struct sched_domain) + cpumask_size(),
 					GFP_KERNEL, cpu_to_node(j));
@@ -6631,6 +7250,13 @@ static int __sdt_alloc(const struct cpumask *cpu_map)
 				return -ENOMEM;
 
 			*per_cpu_ptr(sdd->sgc, j) = sgc;
+
+			sds = kzalloc_node(sizeof(struct sched_domain_shared) + cpumask_size(),
+					GFP_KERNEL, cpu_to_node(j));
+			if (!sds)
+				return -ENOMEM;
+
+			*per_cpu_ptr(sdd->sds, j) = sds;
 		}
 	}
 
@@ -6659,6 +7285,8 @@ static void __sdt_free(const struct cpumask *cpu_map)
 				kfree(*per_cpu_ptr(sdd->sg, j));
 			if (sdd->sgc)
 				kfree(*per_cpu_ptr(sdd->sgc, j));
+			if (sdd->sds)
+				kfree(*per_cpu_ptr(sdd->sds, j));
 		}
 		free_percpu(sdd->sd);
 		sdd->sd = NULL;
@@ -6666,6 +7294,8 @@ static void __sdt_free(const struct cpumask *cpu_map)
 		sdd->sg = NULL;
 		free_percpu(sdd->sgc);
 		sdd->sgc = NULL;
+		free_percpu(sdd->sds);
+		sdd->sds = NULL;
 	}
 }
 
@@ -6698,6 +7328,19 @@ struct sched_domain *build_sched_domain(struct sched_domain_topology_level *tl,
 		}
 
 	}
+
+	/*
+	 * Cache-sharing domains share the idle-core tracking used by
+	 * select_idle_sibling(), kept with the first CPU of the span.
+	 */
+	if (sd->flags & SD_SHARE_PKG_RESOURCES) {
+		struct sd_data *sdd = sd->private;
+
+		sd->shared = *per_cpu_ptr(sdd->sds,
+					  cpumask_first(sched_domain_span(sd)));
+		atomic_inc(&sd->shared->ref);
+	}
+
 	set_domain_attribute(sd, attr);
 
 	return sd;
@@ -6763,7 +7406,13 @@ static int build_sched_domains(const struct cpumask *cpu_map,
 	/* Attach the domains */
 	rcu_read_lock();
 	for_each_cpu(i, cpu_map) {
+		struct rq *rq = cpu_rq(i);
+
 		sd = *per_cpu_ptr(d.sd, i);
+
+		if (rq->cpu_capacity_orig > d.rd->max_cpu_capacity)
+			d.rd->max_cpu_capacity = rq->cpu_capacity_orig;
+
 		cpu_attach_domain(sd, d.rd, i);
 	}
 	rcu_read_unlock();
@@ -7168,6 +7817,10 @@ void __init sched_init(void)
 
 		rq = cpu_rq(i);
 		raw_spin_lock_init(&rq->lock);
+#ifdef CONFIG_SCHED_CORE
+		raw_spin_lock_init(&rq->core_lock);
+		rq->core_prio = CORE_PRIO_IDLE;
+#endif
 		rq->nr_running = 0;
 		rq->calc_load_active = 0;
 		rq->calc_load_update = jiffies + LOAD_FREQ;
@@ -7230,9 +7883,6 @@ void __init sched_init(void)
 #ifdef CONFIG_NO_HZ_COMMON
 		rq->nohz_flags = 0;
 #endif
-#ifdef CONFIG_NO_HZ_FULL
-		rq->last_sched_tick = 0;
-#endif
 #endif
 		init_rq_hrtick(rq);
 		atomic_set(&rq->nr_iowait, 0);
@@ -7275,6 +7925,12 @@ void __init sched_init(void)
 #endif
 	init_sched_fair_class();
 
+	init_uclamp();
+
+	sched_tick_offload_init();
+
+	psi_init();
+
 	scheduler_running = 1;
 }
 
@@ -7467,6 +8123,22 @@ static void free_sched_group(struct task_group *tg)
 }
 
 /* allocate runqueue etc for a new task group */
+static void alloc_uclamp_sched_group(struct task_group *tg,
+				     struct task_group *parent)
+{
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	enum uclamp_id clamp_id;
+
+	for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++) {
+		tg->uclamp_pct[clamp_id] = clamp_id == UCLAMP_MIN ? 0 : 100;
+		uclamp_se_set(&tg->uclamp_req[clamp_id], uclamp_none(clamp_id));
+		uclamp_se_set(&tg->uclamp[clamp_id],
+			      min_t(unsigned int, uclamp_none(clamp_id),
+				    parent->uclamp[clamp_id].value));
+	}
+#endif
+}
+
 struct task_group *sched_create_group(struct task_group *parent)
 {
 	struct task_group *tg;
@@ -7481,6 +8153,8 @@ struct task_group *sched_create_group(struct task_group *parent)
 	if (!alloc_rt_sched_group(tg, parent))
 		goto err;
 
+	alloc_uclamp_sched_group(tg, parent);
+
 	return tg;
 
 err:
@@ -7563,6 +8237,9 @@ void sched_move_task(struct task_struct *tsk)
 			  struct task_group, css);
 	tg = autogroup_task_group(tsk, tg);
 	tsk->sched_task_group = tg;
+#ifdef CONFIG_SCHED_CORE
+	WRITE_ONCE(tsk->core_cookie, sched_core_tg_cookie(tg));
+#endif
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	if (tsk->sched_class->task_move_group)
@@ -7992,6 +8669,12 @@ static void cpu_cgroup_css_free(struct cgroup_subsys_state *css)
 {
 	struct task_group *tg = css_tg(css);
 
+#ifdef CONFIG_SCHED_CORE
+	mutex_lock(&sched_core_mutex);
+	if (tg->core_tagged)
+		sched_core_put();
+	mutex_unlock(&sched_core_mutex);
+#endif
 	sched_destroy_group(tg);
 }
 
@@ -8335,6 +9018,141 @@ static u64 cpu_rt_period_read_uint(struct cgroup_subsys_state *css,
 }
 #endif /* CONFIG_RT_GROUP_SCHED */
 
+#ifdef CONFIG_SCHED_CORE
+static u64 cpu_core_tag_read_u64(struct cgroup_subsys_state *css,
+				 struct cftype *cft)
+{
+	return css_tg(css)->core_tagged;
+}
+
+static int cpu_core_tag_write_u64(struct cgroup_subsys_state *css,
+				  struct cftype *cft, u64 val)
+{
+	struct task_group *tg = css_tg(css);
+
+	if (val > 1)
+		return -ERANGE;
+
+	/* Tagging the root would give every task the same cookie. */
+	if (tg == &root_task_group)
+		return -EINVAL;
+
+	mutex_lock(&sched_core_mutex);
+	if (tg->core_tagged != val) {
+		tg->core_tagged = val;
+		if (val)
+			sched_core_get();
+		sched_core_update_cookies();
+		if (!val)
+			sched_core_put();
+	}
+	mutex_unlock(&sched_core_mutex);
+
+	return 0;
+}
+#endif /* CONFIG_SCHED_CORE */
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+/* serializes updates of the clamps of task groups */
+static DEFINE_MUTEX(uclamp_mutex);
+
+/*
+ * Recompute the effective clamps of the groups below @css, the first of
+ * which had its requested clamps changed: a group gets at most what its
+ * parent allows.
+ */
+static void cpu_util_update_eff(struct cgroup_subsys_state *css)
+{
+	struct cgroup_subsys_state *top_css = css;
+	unsigned int eff[UCLAMP_CNT];
+	enum uclamp_id clamp_id;
+	struct task_group *tg;
+
+	lockdep_assert_held(&uclamp_mutex);
+
+	rcu_read_lock();
+	css_for_each_descendant_pre(css, top_css) {
+		tg = css_tg(css);
+
+		for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+			eff[clamp_id] = min(tg->uclamp_req[clamp_id].value,
+					    tg->parent->uclamp[clamp_id].value);
+		eff[UCLAMP_MIN] = min(eff[UCLAMP_MIN], eff[UCLAMP_MAX]);
+
+		/* nothing changes below a group whose clamps did not */
+		if (css != top_css &&
+		    eff[UCLAMP_MIN] == tg->uclamp[UCLAMP_MIN].value &&
+		    eff[UCLAMP_MAX] == tg->uclamp[UCLAMP_MAX].value) {
+			css = css_rightmost_descendant(css);
+			continue;
+		}
+
+		for (clamp_id = 0; clamp_id < UCLAMP_CNT; clamp_id++)
+			uclamp_se_set(&tg->uclamp[clamp_id], eff[clamp_id]);
+	}
+	rcu_read_unlock();
+}
+
+static void uclamp_update_active_tasks(void)
+{
+	struct task_struct *g, *p;
+	unsigned long flags;
+	struct rq *rq;
+
+	read_lock(&tasklist_lock);
+	for_each_process_thread(g, p) {
+		rq = task_rq_lock(p, &flags);
+		uclamp_update_active(rq, p);
+		task_rq_unlock(rq, p, &flags);
+	}
+	read_unlock(&tasklist_lock);
+}
+
+static int cpu_uclamp_write(struct cgroup_subsys_state *css, u64 val,
+			    enum uclamp_id clamp_id)
+{
+	struct task_group *tg = css_tg(css);
+	unsigned int pct = val;
+
+	if (val > 100)
+		return -ERANGE;
+
+	mutex_lock(&uclamp_mutex);
+	tg->uclamp_pct[clamp_id] = pct;
+	uclamp_se_set(&tg->uclamp_req[clamp_id],
+		      DIV_ROUND_CLOSEST(pct * SCHED_CAPACITY_SCALE, 100));
+	cpu_util_update_eff(css);
+	uclamp_update_active_tasks();
+	mutex_unlock(&uclamp_mutex);
+
+	return 0;
+}
+
+static u64 cpu_uclamp_min_read_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cft)
+{
+	return css_tg(css)->uclamp_pct[UCLAMP_MIN];
+}
+
+static int cpu_uclamp_min_write_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cft, u64 val)
+{
+	return cpu_uclamp_write(css, val, UCLAMP_MIN);
+}
+
+static u64 cpu_uclamp_max_read_u64(struct cgroup_subsys_state *css,
+				   struct cftype *cft)
+{
+	return css_tg(css)->uclamp_pct[UCLAMP_MAX];
+}
+
+static int cpu_uclamp_max_write_u64(struct cgroup_subsys_state *css,
+				    struct cftype *cft, u64 val)
+{
+	return cpu_uclamp_write(css, val, UCLAMP_MAX);
+}
+#endif /* CONFIG_UCLAMP_TASK_GROUP */
+
 static struct cftype cpu_files[] = {
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	{
@@ -8370,6 +9188,28 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_rt_period_read_uint,
 		.write_u64 = cpu_rt_period_write_uint,
 	},
+#endif
+#ifdef CONFIG_SCHED_CORE
+	{
+		.name = "core_tag",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_core_tag_read_u64,
+		.write_u64 = cpu_core_tag_write_u64,
+	},
+#endif
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	{
+		.name = "uclamp.min",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_uclamp_min_read_u64,
+		.write_u64 = cpu_uclamp_min_write_u64,
+	},
+	{
+		.name = "uclamp.max",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = cpu_uclamp_max_read_u64,
+		.write_u64 = cpu_uclamp_max_write_u64,
+	},
 #endif
 	{ }	/* terminate */
 };
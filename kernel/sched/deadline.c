@@ -660,6 +660,9 @@ static void update_curr_dl(struct rq *rq)
 	if (!dl_task(curr) || !on_dl_rq(dl_se))
 		return;
 
+	/* Kick cpufreq to run -deadline tasks at the maximum frequency. */
+	cpufreq_update_util(rq, ULONG_MAX, 0);
+
 	/*
 	 * Consumed budget is computed considering the time as
 	 * observed by schedulable tasks (excluding time spent
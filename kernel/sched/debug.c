@@ -533,6 +533,10 @@ static void sched_show_numa(struct task_struct *p, struct seq_file *m)
 	mpol_get(pol);
 	task_unlock(p);
 
+	P(numa_scan_period);
+	P(numa_hint_faults);
+	P(numa_hint_faults_local);
+	P(numa_pages_migrate_failed);
 	SEQ_printf(m, "numa_migrations, %ld\n", xchg(&p->numa_pages_migrated, 0));
 
 	for_each_online_node(node) {
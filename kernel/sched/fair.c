@@ -2033,9 +2033,10 @@ void task_numa_free(struct task_struct *p)
 }
 
 /*
- * Got a PROT_NONE fault for a page on @node.
+ * Got a PROT_NONE fault in @vma for a page on @node.
  */
-void task_numa_fault(int last_cpupid, int mem_node, int pages, int flags)
+void task_numa_fault(struct vm_area_struct *vma, int last_cpupid,
+		     int mem_node, int pages, int flags)
 {
 	struct task_struct *p = current;
 	bool migrated = flags & TNF_MIGRATED;
@@ -2097,12 +2098,49 @@ void task_numa_fault(int last_cpupid, int mem_node, int pages, int flags)
 
 	if (migrated)
 		p->numa_pages_migrated += pages;
-	if (flags & TNF_MIGRATE_FAIL)
+	if (flags & TNF_MIGRATE_FAIL) {
 		p->numa_faults_locality[2] += pages;
+		p->numa_pages_migrate_failed += pages;
+	}
 
 	p->numa_faults[task_faults_idx(NUMA_MEMBUF, mem_node, priv)] += pages;
 	p->numa_faults[task_faults_idx(NUMA_CPUBUF, cpu_node, priv)] += pages;
 	p->numa_faults_locality[local] += pages;
+	p->numa_hint_faults += pages;
+	if (local)
+		p->numa_hint_faults_local += pages;
+
+	/* Racy against other threads, this only steers the scanner */
+	vma->numab_faults[local] += pages;
+}
+
+/*
+ * A VMA whose hinting faults during the last pass were all local is
+ * well placed already, and scanning it again only produces more local
+ * faults. Such VMAs back off exponentially, skipping up to
+ * 2^NUMA_VMA_BACKOFF_MAX - 1 scan periods, until a remote fault is
+ * seen. VMAs that took no faults at all keep their current rate.
+ */
+#define NUMA_VMA_BACKOFF_MAX	4
+
+static bool vma_numa_scan_due(struct task_struct *p,
+			      struct vm_area_struct *vma, unsigned long now)
+{
+	unsigned long period;
+
+	if (time_before(now, vma->numab_next_scan))
+		return false;
+
+	if (vma->numab_faults[0])
+		vma->numab_backoff = 0;
+	else if (vma->numab_faults[1] &&
+		 vma->numab_backoff < NUMA_VMA_BACKOFF_MAX)
+		vma->numab_backoff++;
+	vma->numab_faults[0] = vma->numab_faults[1] = 0;
+
+	period = msecs_to_jiffies(p->numa_scan_period);
+	vma->numab_next_scan = now + (period << vma->numab_backoff) - period;
+	return true;
 }
 
 static void reset_ptenuma_scan(struct task_struct *p)
@@ -2202,6 +2240,13 @@ void task_numa_work(struct callback_head *work)
 		if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
 			continue;
 
+		/*
+		 * Only decide when a pass over the VMA begins, so that a
+		 * VMA larger than the scan window is not left half done.
+		 */
+		if (start <= vma->vm_start && !vma_numa_scan_due(p, vma, now))
+			continue;
+
 		do {
 			start = max(start, vma->vm_start);
 			end = ALIGN(start + (pages << PAGE_SHIFT), HPAGE_SIZE);
@@ -2776,6 +2821,21 @@ static inline void subtract_blocked_load_contrib(struct cfs_rq *cfs_rq,
 static inline u64 cfs_rq_clock_task(struct cfs_rq *cfs_rq);
 
 /* Update a sched_entity's runnable average */
+/*
+ * Tell cpufreq about utilization changes of the root cfs_rq. Updates made
+ * on behalf of a remote CPU are dropped; the next local tick or schedule
+ * catches up.
+ */
+static inline void cfs_rq_util_change(struct cfs_rq *cfs_rq)
+{
+	struct rq *rq = rq_of(cfs_rq);
+
+	if (&rq->cfs == cfs_rq)
+		cpufreq_update_util(rq, min(cfs_rq->utilization_load_avg,
+					    (unsigned long)SCHED_LOAD_SCALE),
+				    SCHED_LOAD_SCALE);
+}
+
 static inline void update_entity_load_avg(struct sched_entity *se,
 					  int update_cfs_rq)
 {
@@ -2806,6 +2866,7 @@ static inline void update_entity_load_avg(struct sched_entity *se,
 	if (se->on_rq) {
 		cfs_rq->runnable_load_avg += contrib_delta;
 		cfs_rq->utilization_load_avg += utilization_delta;
+		cfs_rq_util_change(cfs_rq);
 	} else {
 		subtract_blocked_load_contrib(cfs_rq, -contrib_delta);
 	}
@@ -2884,6 +2945,7 @@ static inline void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
 
 	cfs_rq->runnable_load_avg += se->avg.load_avg_contrib;
 	cfs_rq->utilization_load_avg += se->avg.utilization_avg_contrib;
+	cfs_rq_util_change(cfs_rq);
 	/* we force update consideration on load-balancer moves */
 	update_cfs_rq_blocked_load(cfs_rq, !wakeup);
 }
@@ -2903,6 +2965,7 @@ static inline void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
 
 	cfs_rq->runnable_load_avg -= se->avg.load_avg_contrib;
 	cfs_rq->utilization_load_avg -= se->avg.utilization_avg_contrib;
+	cfs_rq_util_change(cfs_rq);
 	if (sleep) {
 		cfs_rq->blocked_load_avg += se->avg.load_avg_contrib;
 		se->avg.decay_count = atomic64_read(&cfs_rq->decay_counter);
@@ -4634,6 +4697,77 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 	return 1;
 }
 
+static int get_cpu_usage(int cpu);
+
+/*
+ * A task fits a CPU if its utilization stays below ~80% of the CPU's
+ * capacity, which leaves some headroom for the task to grow.
+ */
+static unsigned int capacity_margin = 1280; /* ~20% */
+
+/*
+ * task_util returns the utilization of @p in capacity units. The tracked
+ * utilization is the fraction of time the task ran on its last CPU, so it
+ * is scaled by that CPU's original capacity to be comparable across CPUs
+ * of different capacity.
+ */
+static unsigned long task_util(struct task_struct *p)
+{
+	unsigned long util = p->se.avg.utilization_avg_contrib;
+	unsigned long capacity = capacity_orig_of(task_cpu(p));
+
+	if (util >= SCHED_LOAD_SCALE)
+		return capacity;
+
+	return (util * capacity) >> SCHED_LOAD_SHIFT;
+}
+
+/*
+ * A min clamp asks for a CPU at least that big for @p, a max clamp says a
+ * CPU that big is enough.
+ */
+#ifdef CONFIG_UCLAMP_TASK
+static inline unsigned long uclamp_task_util(struct task_struct *p)
+{
+	return clamp(task_util(p),
+		     (unsigned long)uclamp_eff_value(p, UCLAMP_MIN),
+		     (unsigned long)uclamp_eff_value(p, UCLAMP_MAX));
+}
+#else
+static inline unsigned long uclamp_task_util(struct task_struct *p)
+{
+	return task_util(p);
+}
+#endif
+
+static inline bool task_fits_capacity(struct task_struct *p,
+				      unsigned long capacity)
+{
+	return capacity * SCHED_CAPACITY_SCALE >
+	       uclamp_task_util(p) * capacity_margin;
+}
+
+/*
+ * Disable WAKE_AFFINE in the case where task @p doesn't fit in the
+ * capacity of either the waking CPU @cpu or the previous CPU @prev_cpu.
+ *
+ * In that case WAKE_AFFINE doesn't make sense and we'll let
+ * BALANCE_WAKE sort things out.
+ */
+static int wake_cap(struct task_struct *p, int cpu, int prev_cpu)
+{
+	long min_cap, max_cap;
+
+	min_cap = min(capacity_orig_of(prev_cpu), capacity_orig_of(cpu));
+	max_cap = cpu_rq(cpu)->rd->max_cpu_capacity;
+
+	/* Minimum capacity is close to max, no need to abort wake_affine */
+	if (max_cap - min_cap < max_cap >> 3)
+		return 0;
+
+	return !task_fits_capacity(p, min_cap);
+}
+
 /*
  * find_idlest_group finds and returns the least busy CPU group within the
  * domain.
@@ -4643,7 +4777,9 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 		  int this_cpu, int sd_flag)
 {
 	struct sched_group *idlest = NULL, *group = sd->groups;
+	struct sched_group *most_spare_sg = NULL;
 	unsigned long min_load = ULONG_MAX, this_load = 0;
+	long most_spare = 0, this_spare = 0;
 	int load_idx = sd->forkexec_idx;
 	int imbalance = 100 + (sd->imbalance_pct-100)/2;
 
@@ -4652,6 +4788,7 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 
 	do {
 		unsigned long load, avg_load;
+		long spare_cap, max_spare_cap;
 		int local_group;
 		int i;
 
@@ -4663,8 +4800,12 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 		local_group = cpumask_test_cpu(this_cpu,
 					       sched_group_cpus(group));
 
-		/* Tally up the load of all CPUs in the group */
+		/*
+		 * Tally up the load of all CPUs in the group and find the
+		 * largest spare capacity among them.
+		 */
 		avg_load = 0;
+		max_spare_cap = 0;
 
 		for_each_cpu(i, sched_group_cpus(group)) {
 			/* Bias balancing toward cpus of our domain */
@@ -4674,6 +4815,10 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 				load = target_load(i, load_idx);
 
 			avg_load += load;
+
+			spare_cap = capacity_of(i) - get_cpu_usage(i);
+			if (spare_cap > max_spare_cap)
+				max_spare_cap = spare_cap;
 		}
 
 		/* Adjust by relative CPU capacity of the group */
@@ -4681,12 +4826,35 @@ find_idlest_group(struct sched_domain *sd, struct task_struct *p,
 
 		if (local_group) {
 			this_load = avg_load;
-		} else if (avg_load < min_load) {
-			min_load = avg_load;
-			idlest = group;
+			this_spare = max_spare_cap;
+		} else {
+			if (avg_load < min_load) {
+				min_load = avg_load;
+				idlest = group;
+			}
+
+			if (max_spare_cap > most_spare) {
+				most_spare = max_spare_cap;
+				most_spare_sg = group;
+			}
 		}
 	} while (group = group->next, group != sd->groups);
 
+	/*
+	 * On CPUs of different capacity, place the task where it fits: if
+	 * a group has a CPU with enough spare capacity for the task, go for
+	 * the group with the most spare capacity unless the local group is
+	 * almost as good. Otherwise fall back to balancing load.
+	 */
+	if ((sd->flags & SD_ASYM_CPUCAPACITY) &&
+	    this_spare > (long)task_util(p) / 2 &&
+	    imbalance * this_spare > 100 * most_spare)
+		return NULL;
+
+	if ((sd->flags & SD_ASYM_CPUCAPACITY) && most_spare_sg &&
+	    most_spare > (long)task_util(p) / 2)
+		return most_spare_sg;
+
 	if (!idlest || 100*this_load < imbalance*min_load)
 		return NULL;
 	return idlest;
@@ -4741,13 +4909,200 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	return shallowest_idle_cpu != -1 ? shallowest_idle_cpu : least_loaded_cpu;
 }
 
+static inline struct cpumask *sds_idle_cores(struct sched_domain_shared *sds)
+{
+	return to_cpumask(sds->idle_cores);
+}
+
+#ifdef CONFIG_SCHED_SMT
+
+static inline bool core_is_idle(int core)
+{
+	int cpu;
+
+	for_each_cpu(cpu, cpu_smt_mask(core)) {
+		if (!idle_cpu(cpu))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Called when @rq goes idle: if all its SMT siblings are idle too, record
+ * the core in the LLC's idle core mask. Bits are only cleared by
+ * select_idle_core() when it finds them stale, which keeps this cheap.
+ *
+ * Since SMT siblings share all cache levels, inspecting this limited remote
+ * state should be fairly cheap.
+ */
+void __update_idle_core(struct rq *rq)
+{
+	int cpu, core = cpu_of(rq);
+	struct sched_domain_shared *sds;
+	struct cpumask *idle_cores;
+
+	rcu_read_lock();
+	sds = rcu_dereference(per_cpu(sd_llc_shared, core));
+	if (!sds)
+		goto unlock;
+
+	for_each_cpu(cpu, cpu_smt_mask(core)) {
+		if (cpu == core)
+			continue;
+
+		if (!idle_cpu(cpu))
+			goto unlock;
+	}
+
+	core = cpumask_first(cpu_smt_mask(core));
+	idle_cores = sds_idle_cores(sds);
+	if (!cpumask_test_cpu(core, idle_cores))
+		cpumask_set_cpu(core, idle_cores);
+unlock:
+	rcu_read_unlock();
+}
+
 /*
- * Try and locate an idle CPU in the sched_domain.
+ * Scan the LLC domain for an idle core, using the cached idle core mask so
+ * that the cost is proportional to the number of cores recently seen idle
+ * rather than to the size of the domain. Stale entries are dropped on the
+ * way.
+ */
+static int select_idle_core(struct task_struct *p, struct sched_domain *sd,
+			    int target)
+{
+	struct sched_domain_shared *sds = sd->shared;
+	struct cpumask *idle_cores;
+	int core, cpu;
+
+	if (!sds)
+		return -1;
+
+	idle_cores = sds_idle_cores(sds);
+	for_each_cpu_and(core, idle_cores, sched_domain_span(sd)) {
+		schedstat_inc(this_rq(), sis_scanned);
+
+		if (!core_is_idle(core)) {
+			cpumask_clear_cpu(core, idle_cores);
+			continue;
+		}
+
+		cpu = cpumask_first_and(cpu_smt_mask(core),
+					tsk_cpus_allowed(p));
+		if (cpu < nr_cpu_ids)
+			return cpu;
+	}
+
+	return -1;
+}
+
+/*
+ * Scan the local SMT mask for idle CPUs.
+ */
+static int select_idle_smt(struct task_struct *p, struct sched_domain *sd,
+			   int target)
+{
+	int cpu;
+
+	for_each_cpu(cpu, cpu_smt_mask(target)) {
+		if (!cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
+			continue;
+		if (idle_cpu(cpu))
+			return cpu;
+	}
+
+	return -1;
+}
+
+#else /* CONFIG_SCHED_SMT */
+
+static inline int select_idle_core(struct task_struct *p,
+				   struct sched_domain *sd, int target)
+{
+	return -1;
+}
+
+static inline int select_idle_smt(struct task_struct *p,
+				  struct sched_domain *sd, int target)
+{
+	return -1;
+}
+
+#endif /* CONFIG_SCHED_SMT */
+
+/*
+ * Scan the LLC domain for idle CPUs, starting after @target. The number
+ * of CPUs scanned is bounded by the average idle time of this CPU compared
+ * with the average cost of a scan, so that a short idle period is not
+ * spent searching.
+ */
+static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd,
+			   int target)
+{
+	struct sched_domain *this_sd;
+	u64 avg_cost, avg_idle, span_avg;
+	u64 time, cost;
+	s64 delta;
+	int cpu = target, nr = INT_MAX, loops;
+
+	this_sd = rcu_dereference(*this_cpu_ptr(&sd_llc));
+	if (!this_sd)
+		return -1;
+
+	/*
+	 * Due to large variance we need a large fuzz factor; hackbench in
+	 * particularly is sensitive here.
+	 */
+	avg_idle = this_rq()->avg_idle / 512;
+	avg_cost = this_sd->avg_scan_cost + 1;
+
+	if (sched_feat(SIS_AVG_CPU) && avg_idle < avg_cost)
+		return -1;
+
+	if (sched_feat(SIS_PROP)) {
+		span_avg = sd->span_weight * avg_idle;
+		if (span_avg > 4 * avg_cost)
+			nr = div64_u64(span_avg, avg_cost);
+		else
+			nr = 4;
+	}
+
+	time = local_clock();
+
+	for (loops = sd->span_weight; loops; loops--) {
+		cpu = cpumask_next(cpu, sched_domain_span(sd));
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(sched_domain_span(sd));
+
+		if (!nr--) {
+			cpu = -1;
+			break;
+		}
+		schedstat_inc(this_rq(), sis_scanned);
+
+		if (!cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
+			continue;
+		if (idle_cpu(cpu))
+			break;
+	}
+	if (!loops)
+		cpu = -1;
+
+	time = local_clock() - time;
+	cost = this_sd->avg_scan_cost;
+	delta = (s64)(time - cost) / 8;
+	this_sd->avg_scan_cost += delta;
+
+	return cpu;
+}
+
+/*
+ * Try and locate an idle core/thread in the LLC cache domain.
  */
 static int select_idle_sibling(struct task_struct *p, int target)
 {
 	struct sched_domain *sd;
-	struct sched_group *sg;
 	int i = task_cpu(p);
 
 	if (idle_cpu(target))
@@ -4759,30 +5114,25 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	if (i != target && cpus_share_cache(i, target) && idle_cpu(i))
 		return i;
 
-	/*
-	 * Otherwise, iterate the domains and find an elegible idle cpu.
-	 */
 	sd = rcu_dereference(per_cpu(sd_llc, target));
-	for_each_lower_domain(sd) {
-		sg = sd->groups;
-		do {
-			if (!cpumask_intersects(sched_group_cpus(sg),
-						tsk_cpus_allowed(p)))
-				goto next;
+	if (!sd)
+		return target;
 
-			for_each_cpu(i, sched_group_cpus(sg)) {
-				if (i == target || !idle_cpu(i))
-					goto next;
-			}
+	schedstat_inc(this_rq(), sis_search);
 
-			target = cpumask_first_and(sched_group_cpus(sg),
-					tsk_cpus_allowed(p));
-			goto done;
-next:
-			sg = sg->next;
-		} while (sg != sd->groups);
-	}
-done:
+	i = select_idle_core(p, sd, target);
+	if ((unsigned)i < nr_cpumask_bits)
+		return i;
+
+	i = select_idle_cpu(p, sd, target);
+	if ((unsigned)i < nr_cpumask_bits)
+		return i;
+
+	i = select_idle_smt(p, sd, target);
+	if ((unsigned)i < nr_cpumask_bits)
+		return i;
+
+	schedstat_inc(this_rq(), sis_failed);
 	return target;
 }
 /*
@@ -4835,7 +5185,8 @@ select_task_rq_fair(struct task_struct *p, int prev_cpu, int sd_flag, int wake_f
 	int sync = wake_flags & WF_SYNC;
 
 	if (sd_flag & SD_BALANCE_WAKE)
-		want_affine = cpumask_test_cpu(cpu, tsk_cpus_allowed(p));
+		want_affine = !wake_cap(p, cpu, prev_cpu) &&
+			      cpumask_test_cpu(cpu, tsk_cpus_allowed(p));
 
 	rcu_read_lock();
 	for_each_domain(cpu, tmp) {
@@ -4856,10 +5207,17 @@ select_task_rq_fair(struct task_struct *p, int prev_cpu, int sd_flag, int wake_f
 			sd = tmp;
 	}
 
-	if (affine_sd && cpu != prev_cpu && wake_affine(affine_sd, p, sync))
-		prev_cpu = cpu;
+	if (affine_sd) {
+		sd = NULL; /* Prefer wake_affine over balance flags */
+		if (cpu != prev_cpu && wake_affine(affine_sd, p, sync))
+			prev_cpu = cpu;
+	}
 
-	if (sd_flag & SD_BALANCE_WAKE) {
+	/*
+	 * Wakeups only balance across domains of CPUs with different
+	 * capacity, for tasks that don't fit the waking or previous CPU.
+	 */
+	if (!sd && (sd_flag & SD_BALANCE_WAKE)) {
 		new_cpu = select_idle_sibling(p, prev_cpu);
 		goto unlock;
 	}
@@ -6019,7 +6377,7 @@ static inline int get_sd_load_idx(struct sched_domain *sd,
 
 static unsigned long default_scale_cpu_capacity(struct sched_domain *sd, int cpu)
 {
-	if ((sd->flags & SD_SHARE_CPUCAPACITY) && (sd->span_weight > 1))
+	if (sd && (sd->flags & SD_SHARE_CPUCAPACITY) && (sd->span_weight > 1))
 		return sd->smt_gain / sd->span_weight;
 
 	return SCHED_CAPACITY_SCALE;
@@ -73,6 +73,14 @@ SCHED_FEAT(FORCE_SD_OVERLAP, false)
 SCHED_FEAT(RT_RUNTIME_SHARE, true)
 SCHED_FEAT(LB_MIN, false)
 
+/*
+ * Bound the idle cpu scan of select_idle_sibling() by the average idle
+ * time of this cpu: SIS_AVG_CPU gives up when the idle time is shorter
+ * than a scan, SIS_PROP scans a number of cpus proportional to it.
+ */
+SCHED_FEAT(SIS_AVG_CPU, false)
+SCHED_FEAT(SIS_PROP, true)
+
 /*
  * Apply the automatic NUMA scheduling policy. Enabled automatically
  * at runtime if running on a NUMA machine. Can be controlled via
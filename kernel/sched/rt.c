@@ -942,6 +942,9 @@ static void update_curr_rt(struct rq *rq)
 	if (curr->sched_class != &rt_sched_class)
 		return;
 
+	/* Kick cpufreq to run RT tasks at the maximum frequency. */
+	cpufreq_update_util(rq, ULONG_MAX, 0);
+
 	delta_exec = rq_clock_task(rq) - curr->se.exec_start;
 	if (unlikely((s64)delta_exec <= 0))
 		return;
@@ -9,6 +9,7 @@
 #include <linux/irq_work.h>
 #include <linux/tick.h>
 #include <linux/slab.h>
+#include <linux/psi.h>
 
 #include "cpupri.h"
 #include "cpudeadline.h"
@@ -27,6 +28,10 @@ extern unsigned long calc_load_update;
 extern atomic_long_t calc_load_tasks;
 
 extern long calc_load_fold_active(struct rq *this_rq);
+extern unsigned long calc_load(unsigned long load, unsigned long exp,
+			       unsigned long active);
+extern unsigned long calc_load_n(unsigned long load, unsigned long exp,
+				 unsigned long active, unsigned int n);
 extern void update_cpu_load_active(struct rq *this_rq);
 
 /*
@@ -260,6 +265,20 @@ struct task_group {
 	struct autogroup *autogroup;
 #endif
 
+#ifdef CONFIG_SCHED_CORE
+	/* tasks of this group and its descendants share a core cookie */
+	bool core_tagged;
+#endif
+
+#ifdef CONFIG_UCLAMP_TASK_GROUP
+	/* clamps as written to cpu.uclamp.{min,max}, in percent */
+	unsigned int uclamp_pct[UCLAMP_CNT];
+	/* clamps requested for the group */
+	struct uclamp_se uclamp_req[UCLAMP_CNT];
+	/* effective clamps, i.e. restricted by the parent group */
+	struct uclamp_se uclamp[UCLAMP_CNT];
+#endif
+
 	struct cfs_bandwidth cfs_bandwidth;
 };
 
@@ -540,12 +559,41 @@ struct root_domain {
 	 */
 	cpumask_var_t rto_mask;
 	struct cpupri cpupri;
+
+	/* Maximum cpu_capacity_orig of the CPUs in this root domain */
+	unsigned long max_cpu_capacity;
 };
 
 extern struct root_domain def_root_domain;
 
+unsigned long arch_scale_cpu_capacity(struct sched_domain *sd, int cpu);
+
 #endif /* CONFIG_SMP */
 
+#ifdef CONFIG_UCLAMP_TASK
+#define UCLAMP_BUCKETS CONFIG_UCLAMP_BUCKETS_COUNT
+
+/*
+ * A utilization clamp bucket counts the RUNNABLE tasks of a runqueue whose
+ * clamp value falls in its range, and holds the largest of their values.
+ */
+struct uclamp_bucket {
+	unsigned long value : SCHED_CAPACITY_SHIFT + 1;
+	unsigned long tasks : BITS_PER_LONG - SCHED_CAPACITY_SHIFT - 1;
+};
+
+/*
+ * The clamp of a runqueue is the max of the clamps of its RUNNABLE tasks,
+ * i.e. the value of the topmost bucket with tasks in, or no clamping at
+ * all when none is RUNNABLE.
+ */
+struct uclamp_rq {
+	unsigned int value;
+	unsigned int nr_tasks;
+	struct uclamp_bucket bucket[UCLAMP_BUCKETS];
+};
+#endif /* CONFIG_UCLAMP_TASK */
+
 /*
  * This is the main, per-CPU runqueue data structure.
  *
@@ -572,9 +620,6 @@ struct rq {
 #ifdef CONFIG_NO_HZ_COMMON
 	u64 nohz_stamp;
 	unsigned long nohz_flags;
-#endif
-#ifdef CONFIG_NO_HZ_FULL
-	unsigned long last_sched_tick;
 #endif
 	/* capture load from *all* tasks on this cpu: */
 	struct load_weight load;
@@ -652,6 +697,23 @@ struct rq {
 	unsigned long calc_load_update;
 	long calc_load_active;
 
+#ifdef CONFIG_SCHED_CORE
+	/*
+	 * What this cpu runs, as seen by its SMT siblings; protected by the
+	 * core_lock of the first cpu of the core.
+	 */
+	raw_spinlock_t core_lock;
+	unsigned long core_cookie;
+	int core_prio;
+	u64 core_forceidle;		/* forced idle since, or 0 */
+	bool core_kick;			/* siblings need to pick again */
+#endif
+
+#ifdef CONFIG_UCLAMP_TASK
+	/* utilization clamps of the RUNNABLE tasks */
+	struct uclamp_rq uclamp[UCLAMP_CNT] ____cacheline_aligned;
+#endif
+
 #ifdef CONFIG_SCHED_HRTICK
 #ifdef CONFIG_SMP
 	int hrtick_csd_pending;
@@ -676,6 +738,11 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int ttwu_count;
 	unsigned int ttwu_local;
+
+	/* select_idle_sibling() stats */
+	unsigned int sis_search;	/* searches of the LLC domain */
+	unsigned int sis_scanned;	/* cores and cpus examined */
+	unsigned int sis_failed;	/* searches without an idle cpu */
 #endif
 
 #ifdef CONFIG_SMP
@@ -816,6 +883,7 @@ static inline struct sched_domain *lowest_flag_domain(int cpu, int flag)
 DECLARE_PER_CPU(struct sched_domain *, sd_llc);
 DECLARE_PER_CPU(int, sd_llc_size);
 DECLARE_PER_CPU(int, sd_llc_id);
+DECLARE_PER_CPU(struct sched_domain_shared *, sd_llc_shared);
 DECLARE_PER_CPU(struct sched_domain *, sd_numa);
 DECLARE_PER_CPU(struct sched_domain *, sd_busy);
 DECLARE_PER_CPU(struct sched_domain *, sd_asym);
@@ -1336,13 +1404,6 @@ static inline void sub_nr_running(struct rq *rq, unsigned count)
 	rq->nr_running -= count;
 }
 
-static inline void rq_last_tick_reset(struct rq *rq)
-{
-#ifdef CONFIG_NO_HZ_FULL
-	rq->last_sched_tick = jiffies;
-#endif
-}
-
 extern void update_rq_clock(struct rq *rq);
 
 extern void activate_task(struct rq *rq, struct task_struct *p, int flags);
@@ -1735,3 +1796,76 @@ static inline u64 irq_time_read(int cpu)
 }
 #endif /* CONFIG_64BIT */
 #endif /* CONFIG_IRQ_TIME_ACCOUNTING */
+
+#if defined(CONFIG_SMP) && defined(CONFIG_SCHED_SMT)
+void __update_idle_core(struct rq *rq);
+
+static inline void update_idle_core(struct rq *rq)
+{
+	__update_idle_core(rq);
+}
+#else
+static inline void update_idle_core(struct rq *rq) { }
+#endif
+
+#ifdef CONFIG_CPU_FREQ
+DECLARE_PER_CPU(struct update_util_data *, cpufreq_update_util_data);
+
+/**
+ * cpufreq_update_util - Take a note about CPU utilization changes.
+ * @rq: Runqueue whose utilization changed.
+ * @util: Current utilization.
+ * @max: Utilization ceiling.
+ *
+ * This function is called by the scheduler on the CPU whose utilization is
+ * being updated; updates for remote runqueues are dropped and picked up by
+ * the next local update.  Passing ULONG_MAX as @util requests the maximum
+ * frequency, which is what RT and deadline tasks get.
+ *
+ * It can only be called from RCU-sched read-side critical sections, which
+ * holding rq->lock guarantees.
+ */
+static inline void cpufreq_update_util(struct rq *rq, unsigned long util,
+				       unsigned long max)
+{
+	struct update_util_data *data;
+
+	if (cpu_of(rq) != smp_processor_id())
+		return;
+
+	data = rcu_dereference_sched(*this_cpu_ptr(&cpufreq_update_util_data));
+	if (data)
+		data->func(data, rq_clock(rq), util, max);
+}
+#else
+static inline void cpufreq_update_util(struct rq *rq, unsigned long util,
+				       unsigned long max) {}
+#endif /* CONFIG_CPU_FREQ */
+
+#ifdef CONFIG_UCLAMP_TASK
+unsigned int uclamp_eff_value(struct task_struct *p, enum uclamp_id clamp_id);
+
+/**
+ * uclamp_rq_util - Clamp a utilization to the clamps of a runqueue.
+ * @rq: Runqueue whose RUNNABLE tasks set the clamps.
+ * @util: Utilization, in SCHED_CAPACITY_SCALE units.
+ *
+ * Both clamps are max aggregated over tasks with different clamps, so the
+ * min clamp can end up above the max one; the min clamp wins then.
+ */
+static inline unsigned long uclamp_rq_util(struct rq *rq, unsigned long util)
+{
+	unsigned long min_util = READ_ONCE(rq->uclamp[UCLAMP_MIN].value);
+	unsigned long max_util = READ_ONCE(rq->uclamp[UCLAMP_MAX].value);
+
+	if (unlikely(min_util >= max_util))
+		return min_util;
+
+	return clamp(util, min_util, max_util);
+}
+#else
+static inline unsigned long uclamp_rq_util(struct rq *rq, unsigned long util)
+{
+	return util;
+}
+#endif /* CONFIG_UCLAMP_TASK */
@@ -57,6 +57,14 @@ static struct softirq_action softirq_vec[NR_SOFTIRQS] __cacheline_aligned_in_smp
 
 DEFINE_PER_CPU(struct task_struct *, ksoftirqd);
 
+DEFINE_PER_CPU(struct softirq_stat [NR_SOFTIRQS], softirq_stat);
+
+/*
+ * Vectors which overran their time budget and are left to ksoftirqd.
+ * Only touched with interrupts disabled on the local CPU.
+ */
+static DEFINE_PER_CPU(__u32, softirq_deferred);
+
 const char * const softirq_to_name[NR_SOFTIRQS] = {
 	"HI", "TIMER", "NET_TX", "NET_RX", "BLOCK", "BLOCK_IOPOLL",
 	"TASKLET", "SCHED", "HRTIMER", "RCU"
@@ -194,6 +202,16 @@ EXPORT_SYMBOL(__local_bh_enable_ip);
 #define MAX_SOFTIRQ_TIME  msecs_to_jiffies(2)
 #define MAX_SOFTIRQ_RESTART 10
 
+/*
+ * A single vector running for longer than MAX_SOFTIRQ_VEC_TIME within one
+ * __do_softirq() is deferred to ksoftirqd on its own, while the other
+ * vectors keep being served from irq_exit() and local_bh_enable().  This
+ * keeps e.g. a NET_RX flood from pushing timers and tasklets behind
+ * ksoftirqd as well.  The vector is served from irq context again once
+ * ksoftirqd has drained it.
+ */
+#define MAX_SOFTIRQ_VEC_TIME (2 * NSEC_PER_MSEC)
+
 #ifdef CONFIG_TRACE_IRQFLAGS
 /*
  * When we run softirqs from irq_exit() and thus on the hardirq stack we need
@@ -232,9 +250,11 @@ asmlinkage __visible void __do_softirq(void)
 	unsigned long end = jiffies + MAX_SOFTIRQ_TIME;
 	unsigned long old_flags = current->flags;
 	int max_restart = MAX_SOFTIRQ_RESTART;
+	u64 vec_time[NR_SOFTIRQS] = { 0 };
+	struct softirq_stat *stat;
 	struct softirq_action *h;
-	bool in_hardirq;
-	__u32 pending;
+	bool in_hardirq, in_ksoftirqd;
+	__u32 pending, deferred;
 	int softirq_bit;
 
 	/*
@@ -244,15 +264,20 @@ asmlinkage __visible void __do_softirq(void)
 	 */
 	current->flags &= ~PF_MEMALLOC;
 
-	pending = local_softirq_pending();
 	account_irq_enter_time(current);
 
 	__local_bh_disable_ip(_RET_IP_, SOFTIRQ_OFFSET);
 	in_hardirq = lockdep_softirq_start();
 
+	/* ksoftirqd serves everything, including the deferred vectors */
+	in_ksoftirqd = current == __this_cpu_read(ksoftirqd);
+	deferred = in_ksoftirqd ? 0 : __this_cpu_read(softirq_deferred);
+
 restart:
 	/* Reset the pending bitmask before enabling irqs */
-	set_softirq_pending(0);
+	pending = local_softirq_pending();
+	set_softirq_pending(pending & deferred);
+	pending &= ~deferred;
 
 	local_irq_enable();
 
@@ -261,6 +286,7 @@ restart:
 	while ((softirq_bit = ffs(pending))) {
 		unsigned int vec_nr;
 		int prev_count;
+		u64 start;
 
 		h += softirq_bit - 1;
 
@@ -269,6 +295,19 @@ restart:
 
 		kstat_incr_softirqs_this_cpu(vec_nr);
 
+		stat = this_cpu_ptr(&softirq_stat[vec_nr]);
+		start = local_clock();
+		if (stat->raised_at) {
+			u64 lat = start > stat->raised_at ?
+				  start - stat->raised_at : 0;
+
+			stat->lat_total += lat;
+			stat->lat_count++;
+			if (lat > stat->lat_max)
+				stat->lat_max = lat;
+			stat->raised_at = 0;
+		}
+
 		trace_softirq_entry(vec_nr);
 		h->action(h);
 		trace_softirq_exit(vec_nr);
@@ -278,6 +317,15 @@ restart:
 			       prev_count, preempt_count());
 			preempt_count_set(prev_count);
 		}
+
+		start = local_clock() - start;
+		stat->time += start;
+		vec_time[vec_nr] += start;
+		if (!in_ksoftirqd && vec_time[vec_nr] > MAX_SOFTIRQ_VEC_TIME) {
+			deferred |= 1U << vec_nr;
+			stat->deferred++;
+		}
+
 		h++;
 		pending >>= softirq_bit;
 	}
@@ -286,14 +334,21 @@ restart:
 	local_irq_disable();
 
 	pending = local_softirq_pending();
-	if (pending) {
+	if (pending & ~deferred) {
 		if (time_before(jiffies, end) && !need_resched() &&
 		    --max_restart)
 			goto restart;
 
+		wakeup_softirqd();
+	} else if (pending) {
 		wakeup_softirqd();
 	}
 
+	/* vectors ksoftirqd drained go back to being served inline */
+	if (in_ksoftirqd)
+		deferred = __this_cpu_read(softirq_deferred) & pending;
+	__this_cpu_write(softirq_deferred, deferred);
+
 	lockdep_softirq_end(in_hardirq);
 	account_irq_exit_time(current);
 	__local_bh_enable(SOFTIRQ_OFFSET);
@@ -427,6 +482,8 @@ void raise_softirq(unsigned int nr)
 void __raise_softirq_irqoff(unsigned int nr)
 {
 	trace_softirq_raise(nr);
+	if (!(local_softirq_pending() & (1UL << nr)))
+		__this_cpu_write(softirq_stat[nr].raised_at, local_clock());
 	or_softirq_pending(1UL << nr);
 }
 
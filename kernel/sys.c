@@ -8,6 +8,7 @@
 #include <linux/mm.h>
 #include <linux/utsname.h>
 #include <linux/mman.h>
+#include <linux/khugepaged.h>
 #include <linux/reboot.h>
 #include <linux/prctl.h>
 #include <linux/highuid.h>
@@ -52,6 +53,7 @@
 #include <linux/rcupdate.h>
 #include <linux/uidgid.h>
 #include <linux/cred.h>
+#include <linux/futex.h>
 
 #include <linux/kmsg_dump.h>
 /* Move somewhere else to avoid recompiling? */
@@ -2227,6 +2229,16 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			me->mm->def_flags &= ~VM_NOHUGEPAGE;
 		up_write(&me->mm->mmap_sem);
 		break;
+	case PR_GET_THP_PRIORITY:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = !!test_bit(MMF_THP_PRIORITY, &me->mm->flags);
+		break;
+	case PR_SET_THP_PRIORITY:
+		if (arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = khugepaged_set_priority(me->mm, !!arg2);
+		break;
 	case PR_MPX_ENABLE_MANAGEMENT:
 		if (arg2 || arg3 || arg4 || arg5)
 			return -EINVAL;
@@ -2243,6 +2255,27 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 	case PR_GET_FP_MODE:
 		error = GET_FP_MODE(me);
 		break;
+	case PR_SET_FUTEX_HASH:
+	case PR_GET_FUTEX_HASH:
+		if (arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = futex_hash_prctl(option, arg2);
+		break;
+	case PR_GET_FORK_SHARE_PTE:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = !!test_bit(MMF_SHARE_PTE_TABLES, &me->mm->flags);
+		break;
+	case PR_SET_FORK_SHARE_PTE:
+		if (arg3 || arg4 || arg5)
+			return -EINVAL;
+		if (!IS_ENABLED(CONFIG_FORK_SHARE_PTE_TABLES))
+			return -EINVAL;
+		if (arg2)
+			set_bit(MMF_SHARE_PTE_TABLES, &me->mm->flags);
+		else
+			clear_bit(MMF_SHARE_PTE_TABLES, &me->mm->flags);
+		break;
 	default:
 		error = -EINVAL;
 		break;
@@ -149,6 +149,10 @@ cond_syscall(sys_io_destroy);
 cond_syscall(sys_io_submit);
 cond_syscall(sys_io_cancel);
 cond_syscall(sys_io_getevents);
+cond_syscall(sys_io_setup2);
+cond_syscall(sys_io_ring_enter);
+cond_syscall(sys_userfaultfd);
+cond_syscall(sys_rseq);
 cond_syscall(sys_sysfs);
 cond_syscall(sys_syslog);
 cond_syscall(sys_process_vm_readv);
@@ -0,0 +1,659 @@
+/*
+ * task_diag.c - dump per-task information for many tasks at once
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Reading /proc/<pid>/{stat,status,io} for every task costs several
+ * open/read/close cycles and a text round trip per task, which dominates
+ * the runtime of monitoring agents on machines with tens of thousands
+ * of tasks.  This exports the same information as fixed-size records
+ * through a generic netlink dump, many tasks per recvmsg().
+ */
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/cred.h>
+#include <linux/ptrace.h>
+#include <linux/cgroup.h>
+#include <linux/file.h>
+#include <linux/proc_ns.h>
+#include <linux/pid_namespace.h>
+#include <linux/task_io_accounting_ops.h>
+#include <linux/task_diag.h>
+#include <net/genetlink.h>
+
+static struct genl_family family = {
+	.id		= GENL_ID_GENERATE,
+	.name		= TASK_DIAG_GENL_NAME,
+	.version	= TASK_DIAG_GENL_VERSION,
+	.maxattr	= TASK_DIAG_CMD_ATTR_MAX,
+	/* dumps only read task state, don't serialize them on genl_mutex */
+	.parallel_ops	= true,
+};
+
+static const struct nla_policy
+task_diag_cmd_policy[TASK_DIAG_CMD_ATTR_MAX+1] = {
+	[TASK_DIAG_CMD_ATTR_GET]	= { .len = sizeof(struct task_diag_pid) },
+	[TASK_DIAG_CMD_ATTR_CGROUP_FD]	= { .type = NLA_U32 },
+	[TASK_DIAG_CMD_ATTR_PIDNS_FD]	= { .type = NLA_U32 },
+};
+
+/* Dump state, hung off netlink_callback.args[0] */
+struct task_diag_cb {
+	struct task_diag_pid	req;
+	struct pid_namespace	*ns;
+	struct user_namespace	*user_ns;
+	struct cgroup		*cgrp;	/* subtree filter, or NULL */
+	struct pid		*pid;	/* task_diag_pid.pid, or NULL */
+	struct pid		*prev;	/* last child/thread reported */
+	pid_t			pos;	/* next pid to look up in @ns */
+	unsigned int		idx;	/* children/threads reported so far */
+	bool			done;
+};
+
+static u8 task_diag_state(struct task_struct *task)
+{
+	unsigned int state = (task->state | task->exit_state) & TASK_REPORT;
+
+	/* TASK_DIAG_* follow the bit order of TASK_REPORT */
+	BUILD_BUG_ON(1 + ilog2(TASK_REPORT) != TASK_DIAG_ZOMBIE);
+
+	return fls(state);
+}
+
+static u64 task_diag_cap(kernel_cap_t cap)
+{
+	unsigned __capi;
+	u64 val = 0;
+
+	BUILD_BUG_ON(_KERNEL_CAPABILITY_U32S > 2);
+
+	CAP_FOR_EACH_U32(__capi)
+		val |= (u64)cap.cap[__capi] << (32 * __capi);
+	return val;
+}
+
+static int fill_base(struct task_struct *task, struct sk_buff *skb,
+		     struct pid_namespace *ns)
+{
+	struct task_diag_base *base;
+	struct task_struct *tracer;
+	struct nlattr *attr;
+
+	attr = nla_reserve(skb, TASK_DIAG_BASE, sizeof(*base));
+	if (!attr)
+		return -EMSGSIZE;
+
+	base = nla_data(attr);
+	memset(base, 0, sizeof(*base));
+
+	base->state = task_diag_state(task);
+	get_task_comm(base->comm, task);
+
+	rcu_read_lock();
+	base->tgid = task_tgid_nr_ns(task, ns);
+	base->pid = task_pid_nr_ns(task, ns);
+	if (pid_alive(task))
+		base->ppid = task_tgid_nr_ns(rcu_dereference(task->real_parent),
+					     ns);
+	tracer = ptrace_parent(task);
+	if (tracer)
+		base->tpid = task_pid_nr_ns(tracer, ns);
+	base->sid = task_session_nr_ns(task, ns);
+	base->pgid = task_pgrp_nr_ns(task, ns);
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int fill_creds(struct task_struct *task, struct sk_buff *skb,
+		      struct user_namespace *user_ns)
+{
+	struct task_diag_creds *creds;
+	const struct cred *cred;
+	struct nlattr *attr;
+
+	attr = nla_reserve(skb, TASK_DIAG_CRED, sizeof(*creds));
+	if (!attr)
+		return -EMSGSIZE;
+
+	creds = nla_data(attr);
+	memset(creds, 0, sizeof(*creds));
+
+	rcu_read_lock();
+	cred = __task_cred(task);
+	creds->uid = from_kuid_munged(user_ns, cred->uid);
+	creds->euid = from_kuid_munged(user_ns, cred->euid);
+	creds->suid = from_kuid_munged(user_ns, cred->suid);
+	creds->fsuid = from_kuid_munged(user_ns, cred->fsuid);
+	creds->gid = from_kgid_munged(user_ns, cred->gid);
+	creds->egid = from_kgid_munged(user_ns, cred->egid);
+	creds->sgid = from_kgid_munged(user_ns, cred->sgid);
+	creds->fsgid = from_kgid_munged(user_ns, cred->fsgid);
+	creds->cap_inheritable = task_diag_cap(cred->cap_inheritable);
+	creds->cap_permitted = task_diag_cap(cred->cap_permitted);
+	creds->cap_effective = task_diag_cap(cred->cap_effective);
+	creds->cap_bset = task_diag_cap(cred->cap_bset);
+	rcu_read_unlock();
+
+	return 0;
+}
+
+/* The subset of do_task_stat() that isn't already in the other groups */
+static int fill_stat(struct task_struct *task, struct sk_buff *skb,
+		     bool whole)
+{
+	cputime_t utime = 0, stime = 0;
+	struct task_diag_stat *st;
+	struct mm_struct *mm;
+	struct nlattr *attr;
+	unsigned long flags;
+
+	attr = nla_reserve(skb, TASK_DIAG_STAT, sizeof(*st));
+	if (!attr)
+		return -EMSGSIZE;
+
+	st = nla_data(attr);
+	memset(st, 0, sizeof(*st));
+
+	if (lock_task_sighand(task, &flags)) {
+		struct signal_struct *sig = task->signal;
+
+		st->threads = get_nr_threads(task);
+		st->cminflt = sig->cmin_flt;
+		st->cmajflt = sig->cmaj_flt;
+		st->cutime = cputime_to_nsecs(sig->cutime);
+		st->cstime = cputime_to_nsecs(sig->cstime);
+
+		/* add up live thread stats at the group level */
+		if (whole) {
+			struct task_struct *t = task;
+
+			do {
+				st->minflt += t->min_flt;
+				st->majflt += t->maj_flt;
+			} while_each_thread(task, t);
+
+			st->minflt += sig->min_flt;
+			st->majflt += sig->maj_flt;
+			thread_group_cputime_adjusted(task, &utime, &stime);
+		}
+
+		unlock_task_sighand(task, &flags);
+	}
+
+	if (!whole) {
+		st->minflt = task->min_flt;
+		st->majflt = task->maj_flt;
+		task_cputime_adjusted(task, &utime, &stime);
+	}
+
+	st->utime = cputime_to_nsecs(utime);
+	st->stime = cputime_to_nsecs(stime);
+	st->start_time = task->real_start_time;
+	st->nice = task_nice(task);
+	st->prio = task_prio(task);
+
+	mm = get_task_mm(task);
+	if (mm) {
+		st->vsize = PAGE_SIZE * mm->total_vm;
+		st->rss = get_mm_rss(mm);
+		mmput(mm);
+	}
+
+	return 0;
+}
+
+#ifdef CONFIG_TASK_IO_ACCOUNTING
+/* Same checks as do_io_accounting(); not being allowed isn't an error */
+static int fill_io(struct task_struct *task, struct sk_buff *skb, bool whole)
+{
+	struct task_io_accounting acct;
+	struct task_diag_io *io;
+	struct nlattr *attr;
+	unsigned long flags;
+	int err;
+
+	err = mutex_lock_killable(&task->signal->cred_guard_mutex);
+	if (err)
+		return err;
+
+	if (!ptrace_may_access(task, PTRACE_MODE_READ_FSCREDS))
+		goto out_unlock;
+
+	acct = task->ioac;
+	if (whole && lock_task_sighand(task, &flags)) {
+		struct task_struct *t = task;
+
+		task_io_accounting_add(&acct, &task->signal->ioac);
+		while_each_thread(task, t)
+			task_io_accounting_add(&acct, &t->ioac);
+
+		unlock_task_sighand(task, &flags);
+	}
+
+	attr = nla_reserve(skb, TASK_DIAG_IO, sizeof(*io));
+	if (!attr) {
+		err = -EMSGSIZE;
+		goto out_unlock;
+	}
+
+	io = nla_data(attr);
+	io->rchar = acct.rchar;
+	io->wchar = acct.wchar;
+	io->syscr = acct.syscr;
+	io->syscw = acct.syscw;
+	io->read_bytes = acct.read_bytes;
+	io->write_bytes = acct.write_bytes;
+	io->cancelled_write_bytes = acct.cancelled_write_bytes;
+
+out_unlock:
+	mutex_unlock(&task->signal->cred_guard_mutex);
+	return err;
+}
+#else
+static int fill_io(struct task_struct *task, struct sk_buff *skb, bool whole)
+{
+	return 0;
+}
+#endif
+
+static int task_diag_fill(struct task_struct *task, struct sk_buff *skb,
+			  struct netlink_callback *cb, struct task_diag_cb *tcb)
+{
+	u64 show = tcb->req.show_flags;
+	bool whole;
+	void *reply;
+	int err = 0;
+
+	whole = tcb->req.dump_strategy != TASK_DIAG_DUMP_ALL_THREAD &&
+		tcb->req.dump_strategy != TASK_DIAG_DUMP_THREAD;
+
+	reply = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+			    cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+			    TASK_DIAG_CMD_GET);
+	if (!reply)
+		return -EMSGSIZE;
+
+	if (show & TASK_DIAG_SHOW_BASE)
+		err = fill_base(task, skb, tcb->ns);
+	if (!err && (show & TASK_DIAG_SHOW_CRED))
+		err = fill_creds(task, skb, tcb->user_ns);
+	if (!err && (show & TASK_DIAG_SHOW_STAT))
+		err = fill_stat(task, skb, whole);
+	if (!err && (show & TASK_DIAG_SHOW_IO))
+		err = fill_io(task, skb, whole);
+
+	if (err) {
+		genlmsg_cancel(skb, reply);
+		return err;
+	}
+
+	genlmsg_end(skb, reply);
+	return 0;
+}
+
+/*
+ * Every pid in @tcb->ns from @tcb->pos up, restricted to thread group
+ * leaders unless all threads were asked for.  Leaves @tcb->pos at the
+ * pid of the returned task.
+ */
+static struct task_struct *next_ns_task(struct task_diag_cb *tcb)
+{
+	bool threads = tcb->req.dump_strategy == TASK_DIAG_DUMP_ALL_THREAD;
+	struct task_struct *task;
+	struct pid *pid;
+
+	rcu_read_lock();
+retry:
+	task = NULL;
+	pid = find_ge_pid(tcb->pos, tcb->ns);
+	if (pid) {
+		tcb->pos = pid_nr_ns(pid, tcb->ns);
+		task = pid_task(pid, PIDTYPE_PID);
+		if (!task || (!threads && !has_group_leader_pid(task))) {
+			tcb->pos++;
+			goto retry;
+		}
+		get_task_struct(task);
+	}
+	rcu_read_unlock();
+
+	return task;
+}
+
+/* Continue after @tcb->prev if it is still a child, see get_children_pid() */
+static struct task_struct *next_child(struct task_diag_cb *tcb)
+{
+	struct task_struct *start, *pos, *task = NULL;
+	unsigned int nr = tcb->idx;
+
+	read_lock(&tasklist_lock);
+
+	start = pid_task(tcb->pid, PIDTYPE_PID);
+	if (!start)
+		goto out;
+
+	if (tcb->prev) {
+		pos = pid_task(tcb->prev, PIDTYPE_PID);
+		if (pos && pos->real_parent == start &&
+		    !list_empty(&pos->sibling)) {
+			if (!list_is_last(&pos->sibling, &start->children))
+				task = list_next_entry(pos, sibling);
+			goto out;
+		}
+	}
+
+	list_for_each_entry(pos, &start->children, sibling) {
+		if (nr-- == 0) {
+			task = pos;
+			break;
+		}
+	}
+out:
+	if (task)
+		get_task_struct(task);
+	read_unlock(&tasklist_lock);
+
+	return task;
+}
+
+/* Continue after @tcb->prev if it is still a thread, see first_tid() */
+static struct task_struct *next_thread_task(struct task_diag_cb *tcb)
+{
+	struct task_struct *leader, *pos, *task = NULL;
+	unsigned int nr = tcb->idx;
+
+	rcu_read_lock();
+
+	leader = pid_task(tcb->pid, PIDTYPE_PID);
+	if (!leader || !pid_alive(leader))
+		goto out;
+	leader = leader->group_leader;
+
+	if (tcb->prev) {
+		pos = pid_task(tcb->prev, PIDTYPE_PID);
+		if (pos && same_thread_group(pos, leader)) {
+			pos = next_thread(pos);
+			if (pos != leader)
+				task = pos;
+			goto out;
+		}
+	}
+
+	if (nr >= get_nr_threads(leader))
+		goto out;
+
+	pos = leader;
+	do {
+		if (nr-- == 0) {
+			task = pos;
+			break;
+		}
+	} while_each_thread(leader, pos);
+out:
+	if (task)
+		get_task_struct(task);
+	rcu_read_unlock();
+
+	return task;
+}
+
+static struct task_struct *task_diag_next(struct task_diag_cb *tcb)
+{
+	switch (tcb->req.dump_strategy) {
+	case TASK_DIAG_DUMP_ALL:
+	case TASK_DIAG_DUMP_ALL_THREAD:
+		return next_ns_task(tcb);
+	case TASK_DIAG_DUMP_CHILDREN:
+		return next_child(tcb);
+	case TASK_DIAG_DUMP_THREAD:
+		return next_thread_task(tcb);
+	default:
+		return tcb->idx ? NULL : get_pid_task(tcb->pid, PIDTYPE_PID);
+	}
+}
+
+static void task_diag_advance(struct task_diag_cb *tcb,
+			      struct task_struct *task)
+{
+	switch (tcb->req.dump_strategy) {
+	case TASK_DIAG_DUMP_ALL:
+	case TASK_DIAG_DUMP_ALL_THREAD:
+		tcb->pos++;
+		break;
+	default:
+		put_pid(tcb->prev);
+		tcb->prev = get_pid(task_pid(task));
+		tcb->idx++;
+		break;
+	}
+}
+
+static struct pid_namespace *task_diag_get_pidns(int fd)
+{
+	struct pid_namespace *ns, *ancestor;
+	struct pid_namespace *active = task_active_pid_ns(current);
+	struct ns_common *nsc;
+	struct file *file;
+
+	file = proc_ns_fget(fd);
+	if (IS_ERR(file))
+		return ERR_CAST(file);
+
+	nsc = get_proc_ns(file_inode(file));
+	if (nsc->ops->type != CLONE_NEWPID) {
+		ns = ERR_PTR(-EINVAL);
+		goto out;
+	}
+
+	/* Like setns(), only the caller's namespace and its descendants */
+	ns = container_of(nsc, struct pid_namespace, ns);
+	ancestor = ns;
+	while (ancestor->level > active->level)
+		ancestor = ancestor->parent;
+	if (ancestor != active)
+		ns = ERR_PTR(-EPERM);
+	else
+		get_pid_ns(ns);
+out:
+	fput(file);
+	return ns;
+}
+
+#ifdef CONFIG_CGROUPS
+static struct cgroup *task_diag_get_cgroup(int fd)
+{
+	struct cgroup *cgrp;
+	struct fd f;
+
+	f = fdget(fd);
+	if (!f.file)
+		return ERR_PTR(-EBADF);
+
+	cgrp = cgroup_get_from_dir(f.file->f_path.dentry);
+	fdput(f);
+	return cgrp;
+}
+
+static void task_diag_put_cgroup(struct cgroup *cgrp)
+{
+	css_put(&cgrp->self);
+}
+#else
+static struct cgroup *task_diag_get_cgroup(int fd)
+{
+	return ERR_PTR(-EOPNOTSUPP);
+}
+
+static void task_diag_put_cgroup(struct cgroup *cgrp)
+{
+}
+
+static bool task_under_cgroup(struct task_struct *task, struct cgroup *cgrp)
+{
+	return true;
+}
+#endif
+
+static void task_diag_free(struct task_diag_cb *tcb)
+{
+	put_pid(tcb->prev);
+	put_pid(tcb->pid);
+	if (tcb->cgrp)
+		task_diag_put_cgroup(tcb->cgrp);
+	if (tcb->ns)
+		put_pid_ns(tcb->ns);
+	put_user_ns(tcb->user_ns);
+	kfree(tcb);
+}
+
+/*
+ * Everything the request refers to is resolved once, in the context of
+ * the requester, and pinned until the dump is done.
+ */
+static struct task_diag_cb *task_diag_start(struct netlink_callback *cb)
+{
+	struct nlattr *attrs[TASK_DIAG_CMD_ATTR_MAX+1];
+	struct task_diag_cb *tcb;
+	struct nlattr *na;
+	int rc;
+
+	rc = nlmsg_parse(cb->nlh, GENL_HDRLEN, attrs, TASK_DIAG_CMD_ATTR_MAX,
+			 task_diag_cmd_policy);
+	if (rc < 0)
+		return ERR_PTR(rc);
+
+	if (!attrs[TASK_DIAG_CMD_ATTR_GET])
+		return ERR_PTR(-EINVAL);
+
+	tcb = kzalloc(sizeof(*tcb), GFP_KERNEL);
+	if (!tcb)
+		return ERR_PTR(-ENOMEM);
+
+	tcb->user_ns = get_user_ns(current_user_ns());
+	nla_memcpy(&tcb->req, attrs[TASK_DIAG_CMD_ATTR_GET], sizeof(tcb->req));
+	tcb->pos = 1;
+
+	na = attrs[TASK_DIAG_CMD_ATTR_PIDNS_FD];
+	if (na) {
+		struct pid_namespace *ns = task_diag_get_pidns(nla_get_u32(na));
+
+		if (IS_ERR(ns)) {
+			rc = PTR_ERR(ns);
+			goto err;
+		}
+		tcb->ns = ns;
+	} else {
+		tcb->ns = get_pid_ns(task_active_pid_ns(current));
+	}
+
+	na = attrs[TASK_DIAG_CMD_ATTR_CGROUP_FD];
+	if (na) {
+		struct cgroup *cgrp = task_diag_get_cgroup(nla_get_u32(na));
+
+		if (IS_ERR(cgrp)) {
+			rc = PTR_ERR(cgrp);
+			goto err;
+		}
+		tcb->cgrp = cgrp;
+	}
+
+	switch (tcb->req.dump_strategy) {
+	case TASK_DIAG_DUMP_ALL:
+	case TASK_DIAG_DUMP_ALL_THREAD:
+		break;
+	case TASK_DIAG_DUMP_CHILDREN:
+	case TASK_DIAG_DUMP_THREAD:
+	case TASK_DIAG_DUMP_ONE:
+		rcu_read_lock();
+		tcb->pid = get_pid(find_pid_ns(tcb->req.pid, tcb->ns));
+		rcu_read_unlock();
+		if (!tcb->pid) {
+			rc = -ESRCH;
+			goto err;
+		}
+		break;
+	default:
+		rc = -EINVAL;
+		goto err;
+	}
+
+	return tcb;
+err:
+	task_diag_free(tcb);
+	return ERR_PTR(rc);
+}
+
+static int task_diag_dumpit(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct task_diag_cb *tcb = (struct task_diag_cb *)cb->args[0];
+	struct task_struct *task;
+	int rc = 0;
+
+	if (!tcb) {
+		tcb = task_diag_start(cb);
+		if (IS_ERR(tcb))
+			return PTR_ERR(tcb);
+		cb->args[0] = (long)tcb;
+	}
+
+	while (!tcb->done) {
+		task = task_diag_next(tcb);
+		if (!task) {
+			tcb->done = true;
+			break;
+		}
+
+		if (!tcb->cgrp || task_under_cgroup(task, tcb->cgrp))
+			rc = task_diag_fill(task, skb, cb, tcb);
+		if (!rc)
+			task_diag_advance(tcb, task);
+		put_task_struct(task);
+
+		/* the current task is retried in the next skb */
+		if (rc)
+			break;
+
+		/* a selective filter can walk many tasks per message */
+		cond_resched();
+	}
+
+	if (rc && rc != -EMSGSIZE && !skb->len)
+		return rc;
+	return skb->len;
+}
+
+static int task_diag_dump_done(struct netlink_callback *cb)
+{
+	struct task_diag_cb *tcb = (struct task_diag_cb *)cb->args[0];
+
+	if (tcb)
+		task_diag_free(tcb);
+	return 0;
+}
+
+static const struct genl_ops task_diag_ops[] = {
+	{
+		.cmd		= TASK_DIAG_CMD_GET,
+		.dumpit		= task_diag_dumpit,
+		.done		= task_diag_dump_done,
+		.policy		= task_diag_cmd_policy,
+	},
+};
+
+static int __init task_diag_init(void)
+{
+	return genl_register_family_with_ops(&family, task_diag_ops);
+}
+
+late_initcall(task_diag_init);
@@ -24,6 +24,7 @@
 #include <linux/posix-timers.h>
 #include <linux/perf_event.h>
 #include <linux/context_tracking.h>
+#include <linux/vmstat.h>
 
 #include <asm/irq_regs.h>
 
@@ -157,23 +158,30 @@ cpumask_var_t tick_nohz_full_mask;
 cpumask_var_t housekeeping_mask;
 bool tick_nohz_full_running;
 
-static bool can_stop_full_tick(void)
+/*
+ * Check what still needs the tick on this full dynticks CPU. The result is
+ * kept in ts->tick_dep_mask, so that /proc/timer_list tells why the tick of
+ * a CPU keeps running.
+ */
+static bool can_stop_full_tick(struct tick_sched *ts)
 {
+	unsigned long dep = 0;
+
 	WARN_ON_ONCE(!irqs_disabled());
 
 	if (!sched_can_stop_tick()) {
 		trace_tick_stop(0, "more than 1 task in runqueue\n");
-		return false;
+		dep |= BIT(TICK_DEP_BIT_SCHED);
 	}
 
 	if (!posix_cpu_timers_can_stop_tick(current)) {
 		trace_tick_stop(0, "posix timers running\n");
-		return false;
+		dep |= BIT(TICK_DEP_BIT_POSIX_TIMER);
 	}
 
 	if (!perf_event_can_stop_tick()) {
 		trace_tick_stop(0, "perf events running\n");
-		return false;
+		dep |= BIT(TICK_DEP_BIT_PERF_EVENTS);
 	}
 
 	/* sched_clock_tick() needs us? */
@@ -190,11 +198,13 @@ static bool can_stop_full_tick(void)
 		 */
 		WARN_ONCE(tick_nohz_full_running,
 			  "NO_HZ FULL will not work with unstable sched clock");
-		return false;
+		dep |= BIT(TICK_DEP_BIT_CLOCK_UNSTABLE);
 	}
 #endif
 
-	return true;
+	ts->tick_dep_mask = dep;
+
+	return !dep;
 }
 
 static void tick_nohz_restart_sched_tick(struct tick_sched *ts, ktime_t now);
@@ -209,7 +219,7 @@ void __tick_nohz_full_check(void)
 
 	if (tick_nohz_full_cpu(smp_processor_id())) {
 		if (ts->tick_stopped && !is_idle_task(current)) {
-			if (!can_stop_full_tick())
+			if (!can_stop_full_tick(ts))
 				tick_nohz_restart_sched_tick(ts, ktime_get());
 		}
 	}
@@ -285,7 +295,8 @@ void __tick_nohz_task_switch(struct task_struct *tsk)
 	if (!tick_nohz_full_cpu(smp_processor_id()))
 		goto out;
 
-	if (tick_nohz_tick_stopped() && !can_stop_full_tick())
+	if (tick_nohz_tick_stopped() &&
+	    !can_stop_full_tick(this_cpu_ptr(&tick_cpu_sched)))
 		tick_nohz_full_kick();
 
 out:
@@ -421,6 +432,11 @@ int tick_nohz_tick_stopped(void)
 	return __this_cpu_read(tick_cpu_sched.tick_stopped);
 }
 
+int tick_nohz_tick_stopped_cpu(int cpu)
+{
+	return per_cpu(tick_cpu_sched, cpu).tick_stopped;
+}
+
 /**
  * tick_nohz_update_jiffies - update jiffies when idle was interrupted
  *
@@ -630,13 +646,6 @@ static ktime_t tick_nohz_stop_sched_tick(struct tick_sched *ts,
 			time_delta = KTIME_MAX;
 		}
 
-#ifdef CONFIG_NO_HZ_FULL
-		if (!ts->inidle) {
-			time_delta = min(time_delta,
-					 scheduler_tick_max_deferment());
-		}
-#endif
-
 		/*
 		 * calculate the expiry time for the next timer wheel
 		 * timer. delta_jiffies >= NEXT_TIMER_MAX_DELTA signals
@@ -677,6 +686,7 @@ static ktime_t tick_nohz_stop_sched_tick(struct tick_sched *ts,
 		if (!ts->tick_stopped) {
 			nohz_balance_enter_idle(cpu);
 			calc_load_enter_idle();
+			quiet_vmstat();
 
 			ts->last_tick = hrtimer_get_expires(&ts->sched_timer);
 			ts->tick_stopped = 1;
@@ -728,7 +738,7 @@ static void tick_nohz_full_stop_tick(struct tick_sched *ts)
 	if (!ts->tick_stopped && ts->nohz_mode == NOHZ_MODE_INACTIVE)
 		return;
 
-	if (!can_stop_full_tick())
+	if (!can_stop_full_tick(ts))
 		return;
 
 	tick_nohz_stop_sched_tick(ts, ktime_get(), cpu);
@@ -908,6 +918,12 @@ static void tick_nohz_restart_sched_tick(struct tick_sched *ts, ktime_t now)
 	tick_do_update_jiffies64(now);
 	update_cpu_load_nohz();
 
+	/*
+	 * Clear the timer idle flag, so we avoid IPIs on remote queueing
+	 * of timers which expire before the tick would have woken us up.
+	 */
+	timer_clear_idle();
+
 	calc_load_exit_idle();
 	touch_softlockup_watchdog();
 	/*
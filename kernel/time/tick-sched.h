@@ -19,6 +19,14 @@ enum tick_nohz_mode {
 	NOHZ_MODE_HIGHRES,
 };
 
+enum tick_dep_bits {
+	TICK_DEP_BIT_SCHED,		/* more than one task to run */
+	TICK_DEP_BIT_POSIX_TIMER,	/* posix cpu timers armed */
+	TICK_DEP_BIT_PERF_EVENTS,	/* perf events need the tick */
+	TICK_DEP_BIT_CLOCK_UNSTABLE,	/* sched_clock is unstable */
+	TICK_DEP_BIT_MAX
+};
+
 /**
  * struct tick_sched - sched tick emulation and no idle tick control/stats
  * @sched_timer:	hrtimer to schedule the periodic tick in high
@@ -38,6 +46,8 @@ enum tick_nohz_mode {
  * @iowait_sleeptime:	Sum of the time slept in idle with sched tick stopped, with IO outstanding
  * @sleep_length:	Duration of the current idle sleep
  * @do_timer_lst:	CPU was the last one doing do_timer before going idle
+ * @tick_dep_mask:	What kept the tick of a full dynticks CPU running, as
+ *			of its last check (TICK_DEP_BIT_*)
  */
 struct tick_sched {
 	struct hrtimer			sched_timer;
@@ -60,6 +70,7 @@ struct tick_sched {
 	unsigned long			next_jiffies;
 	ktime_t				idle_expires;
 	int				do_timer_last;
+	unsigned long			tick_dep_mask;
 };
 
 extern struct tick_sched *tick_get_tick_sched(int cpu);
@@ -1091,6 +1091,13 @@ extern const struct file_operations event_trigger_fops;
 extern int register_trigger_cmds(void);
 extern void clear_event_triggers(struct trace_array *tr);
 
+#ifdef CONFIG_HIST_TRIGGERS
+extern const struct file_operations event_hist_fops;
+extern int register_trigger_hist_cmd(void);
+#else
+static inline int register_trigger_hist_cmd(void) { return 0; }
+#endif
+
 struct event_trigger_data {
 	unsigned long			count;
 	int				ref;
@@ -1114,7 +1121,9 @@ struct event_trigger_data {
  * @func: The trigger 'probe' function called when the triggering
  *	event occurs.  The data passed into this callback is the data
  *	that was supplied to the event_command @reg() function that
- *	registered the trigger (see struct event_command).
+ *	registered the trigger (see struct event_command).  @rec is the
+ *	trace record of the event, or NULL for unconditional and
+ *	post_trigger invocations.
  *
  * @init: An optional initialization function called for the trigger
  *	when the trigger is registered (via the event_command reg()
@@ -1139,7 +1148,8 @@ struct event_trigger_data {
  *	(see trace_event_triggers.c).
  */
 struct event_trigger_ops {
-	void			(*func)(struct event_trigger_data *data);
+	void			(*func)(struct event_trigger_data *data,
+					void *rec);
 	int			(*init)(struct event_trigger_ops *ops,
 					struct event_trigger_data *data);
 	void			(*free)(struct event_trigger_ops *ops,
@@ -1202,6 +1212,11 @@ struct event_trigger_ops {
  *	itself logs to the trace buffer, this flag should be set,
  *	otherwise it can be left unspecified.
  *
+ * @needs_rec: A flag that says whether or not this command needs the
+ *	trace record passed to its @func(), as hist triggers do to read
+ *	the event's fields.  Like a filter, this makes the trigger
+ *	conditional so it is only invoked once the record exists.
+ *
  * All the methods below, except for @set_filter(), must be
  * implemented.
  *
@@ -1242,6 +1257,7 @@ struct event_command {
 	char			*name;
 	enum event_trigger_type	trigger_type;
 	bool			post_trigger;
+	bool			needs_rec;
 	int			(*func)(struct event_command *cmd_ops,
 					struct ftrace_event_file *file,
 					char *glob, char *cmd, char *params);
@@ -1261,6 +1277,17 @@ struct event_command {
 
 extern int trace_event_enable_disable(struct ftrace_event_file *file,
 				      int enable, int soft_disable);
+extern int trace_event_trigger_enable_disable(struct ftrace_event_file *file,
+					      int trigger_enable);
+extern void update_cond_flag(struct ftrace_event_file *file);
+extern int event_trigger_init(struct event_trigger_ops *ops,
+			      struct event_trigger_data *data);
+extern void event_trigger_free(struct event_trigger_ops *ops,
+			       struct event_trigger_data *data);
+extern int set_trigger_filter(char *filter_str,
+			      struct event_trigger_data *trigger_data,
+			      struct ftrace_event_file *file);
+extern int register_event_command(struct event_command *cmd);
 extern int tracing_alloc_snapshot(void);
 
 extern const char *__start___trace_bprintk_fmt[];
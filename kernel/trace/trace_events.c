@@ -1630,9 +1630,14 @@ event_create_dir(struct dentry *parent, struct ftrace_event_file *file)
 	 * Only event directories that can be enabled should have
 	 * triggers.
 	 */
-	if (!(call->flags & TRACE_EVENT_FL_IGNORE_ENABLE))
+	if (!(call->flags & TRACE_EVENT_FL_IGNORE_ENABLE)) {
 		trace_create_file("trigger", 0644, file->dir, file,
 				  &event_trigger_fops);
+#ifdef CONFIG_HIST_TRIGGERS
+		trace_create_file("hist", 0444, file->dir, file,
+				  &event_hist_fops);
+#endif
+	}
 
 	trace_create_file("format", 0444, file->dir, call,
 			  &ftrace_event_format_fops);
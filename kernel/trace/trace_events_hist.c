@@ -0,0 +1,1120 @@
+/*
+ * trace_events_hist - trace event hist triggers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A hist trigger aggregates the events it is attached to in a hash
+ * table instead of having them streamed to userspace:
+ *
+ *   echo 'hist:keys=<field>[,<field>...][:values=<field>[,<field>...]]
+ *         [:sort=<field>[.descending]][:size=<entries>]
+ *         [:pause][:continue][:clear] [if <filter>]' > \
+ *         events/<system>/<event>/trigger
+ *
+ * Every entry keeps a hitcount and the sum of each of the values
+ * fields.  Numeric keys take an optional .hex, .sym, .execname or .log2
+ * modifier, the last one bucketing the key by power of two.  Reading
+ * events/<system>/<event>/hist prints the table, sorted by hitcount
+ * unless sort= says otherwise.  'pause', 'continue' and 'clear' act on
+ * the existing trigger with the same keys, values and sort key, and
+ * '!hist:keys=...' removes it.
+ */
+
+#include <linux/module.h>
+#include <linux/kallsyms.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
+
+#include "trace.h"
+
+#define HIST_KEYS_MAX		3
+#define HIST_VALS_MAX		4	/* not counting the hitcount */
+#define HIST_KEY_SIZE_MAX	256
+#define HIST_KEY_STR_MAX	128
+#define HIST_BITS_DEFAULT	11
+#define HIST_BITS_MIN		7
+#define HIST_BITS_MAX		17
+
+enum hist_field_flags {
+	HIST_FIELD_HEX		= 1 << 0,
+	HIST_FIELD_SYM		= 1 << 1,
+	HIST_FIELD_EXECNAME	= 1 << 2,
+	HIST_FIELD_LOG2		= 1 << 3,
+	HIST_FIELD_STRING	= 1 << 4,
+};
+
+struct hist_field {
+	struct ftrace_event_field	*field;
+	unsigned long			flags;
+	unsigned int			offset;	/* in the key */
+	unsigned int			size;
+};
+
+/*
+ * The map is a lock-free open addressing hash table with twice as many
+ * slots as elements, the elements being preallocated so that an insert
+ * from any context never allocates.  Once the elements run out new keys
+ * are dropped and counted.
+ */
+struct hist_elt {
+	void			*key;
+	atomic64_t		*sums;	/* sums[0] is the hitcount */
+};
+
+struct hist_map_entry {
+	u32			key_hash;
+	struct hist_elt		*elt;
+};
+
+struct hist_map {
+	unsigned int		map_bits;
+	unsigned int		map_size;
+	unsigned int		max_elts;
+	unsigned int		key_size;
+	unsigned int		n_sums;
+	atomic_t		next_elt;
+	atomic64_t		drops;
+	struct hist_map_entry	*entries;
+	struct hist_elt		*elts;
+	void			*keys;
+	atomic64_t		*sums;
+};
+
+struct hist_trigger_attrs {
+	char			*keys_str;
+	char			*vals_str;
+	char			*sort_str;
+	bool			pause;
+	bool			cont;
+	bool			clear;
+	unsigned int		map_bits;
+};
+
+struct hist_trigger_data {
+	struct hist_field	keys[HIST_KEYS_MAX];
+	unsigned int		n_keys;
+	unsigned int		key_size;
+	/* vals[0] is the hitcount and has no field */
+	struct hist_field	vals[HIST_VALS_MAX + 1];
+	unsigned int		n_vals;
+	bool			sort_on_key;
+	unsigned int		sort_idx;
+	bool			sort_descending;
+	bool			paused;
+	struct hist_trigger_attrs *attrs;
+	struct hist_map		*map;
+};
+
+static void hist_map_destroy(struct hist_map *map)
+{
+	if (!map)
+		return;
+
+	vfree(map->entries);
+	vfree(map->elts);
+	vfree(map->keys);
+	vfree(map->sums);
+	kfree(map);
+}
+
+static struct hist_map *hist_map_create(unsigned int map_bits,
+					unsigned int key_size,
+					unsigned int n_sums)
+{
+	struct hist_map *map;
+	unsigned int i;
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return ERR_PTR(-ENOMEM);
+
+	map->map_bits = map_bits;
+	map->max_elts = 1 << map_bits;
+	map->map_size = map->max_elts * 2;
+	map->key_size = key_size;
+	map->n_sums = n_sums;
+
+	map->entries = vzalloc(map->map_size * sizeof(*map->entries));
+	map->elts = vzalloc(map->max_elts * sizeof(*map->elts));
+	map->keys = vzalloc(map->max_elts * key_size);
+	map->sums = vzalloc(map->max_elts * n_sums * sizeof(*map->sums));
+	if (!map->entries || !map->elts || !map->keys || !map->sums) {
+		hist_map_destroy(map);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	for (i = 0; i < map->max_elts; i++) {
+		map->elts[i].key = map->keys + i * key_size;
+		map->elts[i].sums = map->sums + i * n_sums;
+	}
+
+	return map;
+}
+
+/* Only called with the trigger paused and the events drained. */
+static void hist_map_clear(struct hist_map *map)
+{
+	memset(map->entries, 0, map->map_size * sizeof(*map->entries));
+	memset(map->keys, 0, map->max_elts * map->key_size);
+	memset(map->sums, 0, map->max_elts * map->n_sums * sizeof(*map->sums));
+	atomic_set(&map->next_elt, 0);
+	atomic64_set(&map->drops, 0);
+}
+
+static unsigned int hist_map_nr_elts(struct hist_map *map)
+{
+	return min_t(unsigned int, atomic_read(&map->next_elt), map->max_elts);
+}
+
+static struct hist_elt *hist_map_insert(struct hist_map *map, void *key)
+{
+	struct hist_map_entry *entry;
+	struct hist_elt *elt;
+	u32 idx, key_hash, test_key;
+	unsigned int i;
+	int n;
+
+	key_hash = jhash(key, map->key_size, 0);
+	if (key_hash == 0)
+		key_hash = 1;	/* 0 marks a free slot */
+	idx = key_hash >> (32 - (map->map_bits + 1));
+
+	for (i = 0; i < map->map_size; i++, idx++) {
+		entry = &map->entries[idx & (map->map_size - 1)];
+		test_key = ACCESS_ONCE(entry->key_hash);
+
+		if (test_key == key_hash) {
+			elt = smp_load_acquire(&entry->elt);
+			if (elt && !memcmp(elt->key, key, map->key_size))
+				return elt;
+			continue;
+		}
+
+		if (test_key || cmpxchg(&entry->key_hash, 0, key_hash))
+			continue;
+
+		n = atomic_inc_return(&map->next_elt) - 1;
+		if (n >= map->max_elts)
+			break;
+
+		elt = &map->elts[n];
+		memcpy(elt->key, key, map->key_size);
+		/* publish the key before the element */
+		smp_store_release(&entry->elt, elt);
+		return elt;
+	}
+
+	atomic64_inc(&map->drops);
+	return NULL;
+}
+
+static u64 hist_field_value(struct ftrace_event_field *field, void *rec)
+{
+	void *addr = rec + field->offset;
+
+	switch (field->size) {
+	case 1:
+		return field->is_signed ? (u64)*(s8 *)addr : *(u8 *)addr;
+	case 2:
+		return field->is_signed ? (u64)*(s16 *)addr : *(u16 *)addr;
+	case 4:
+		return field->is_signed ? (u64)*(s32 *)addr : *(u32 *)addr;
+	case 8:
+		return *(u64 *)addr;
+	}
+	return 0;
+}
+
+static void hist_field_key(struct hist_field *hist_field, void *rec,
+			   void *key)
+{
+	struct ftrace_event_field *field = hist_field->field;
+	unsigned int len = hist_field->size - 1;
+	const char *str;
+	u64 val;
+
+	if (!(hist_field->flags & HIST_FIELD_STRING)) {
+		val = hist_field_value(field, rec);
+		if (hist_field->flags & HIST_FIELD_LOG2)
+			val = val > 1 ? fls64(val - 1) : 0;
+		memcpy(key, &val, sizeof(val));
+		return;
+	}
+
+	switch (field->filter_type) {
+	case FILTER_DYN_STRING: {
+		u32 loc = *(u32 *)(rec + field->offset);
+
+		str = rec + (loc & 0xffff);
+		len = min(len, loc >> 16);
+		break;
+	}
+	case FILTER_PTR_STRING:
+		str = *(char **)(rec + field->offset);
+		if (!str)
+			return;
+		break;
+	default:
+		str = rec + field->offset;
+		len = min_t(unsigned int, len, field->size);
+		break;
+	}
+
+	/* the key was zeroed, so this stays terminated */
+	strncpy(key, str, len);
+}
+
+static void event_hist_trigger(struct event_trigger_data *data, void *rec)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	char compound_key[HIST_KEY_SIZE_MAX];
+	struct hist_field *key;
+	struct hist_elt *elt;
+	unsigned int i;
+
+	if (!rec || ACCESS_ONCE(hist_data->paused))
+		return;
+
+	memset(compound_key, 0, hist_data->key_size);
+	for (i = 0; i < hist_data->n_keys; i++) {
+		key = &hist_data->keys[i];
+		hist_field_key(key, rec, compound_key + key->offset);
+	}
+
+	elt = hist_map_insert(hist_data->map, compound_key);
+	if (!elt)
+		return;
+
+	atomic64_inc(&elt->sums[0]);
+	for (i = 1; i < hist_data->n_vals; i++)
+		atomic64_add(hist_field_value(hist_data->vals[i].field, rec),
+			     &elt->sums[i]);
+}
+
+static void destroy_hist_trigger_attrs(struct hist_trigger_attrs *attrs)
+{
+	if (!attrs)
+		return;
+
+	kfree(attrs->keys_str);
+	kfree(attrs->vals_str);
+	kfree(attrs->sort_str);
+	kfree(attrs);
+}
+
+static int parse_hist_size(struct hist_trigger_attrs *attrs, char *str)
+{
+	unsigned int size;
+	int ret;
+
+	ret = kstrtouint(str, 0, &size);
+	if (ret)
+		return ret;
+
+	attrs->map_bits = ilog2(roundup_pow_of_two(size));
+	if (attrs->map_bits < HIST_BITS_MIN ||
+	    attrs->map_bits > HIST_BITS_MAX)
+		return -EINVAL;
+
+	return 0;
+}
+
+static struct hist_trigger_attrs *parse_hist_trigger_attrs(char *trigger_str)
+{
+	struct hist_trigger_attrs *attrs;
+	char **dup, *str;
+	int ret = 0;
+
+	attrs = kzalloc(sizeof(*attrs), GFP_KERNEL);
+	if (!attrs)
+		return ERR_PTR(-ENOMEM);
+
+	attrs->map_bits = HIST_BITS_DEFAULT;
+
+	while (trigger_str && !ret) {
+		str = strsep(&trigger_str, ":");
+		dup = NULL;
+
+		if (!strncmp(str, "keys=", 5) || !strncmp(str, "key=", 4))
+			dup = &attrs->keys_str;
+		else if (!strncmp(str, "values=", 7) ||
+			 !strncmp(str, "vals=", 5))
+			dup = &attrs->vals_str;
+		else if (!strncmp(str, "sort=", 5))
+			dup = &attrs->sort_str;
+		else if (!strncmp(str, "size=", 5))
+			ret = parse_hist_size(attrs, str + 5);
+		else if (!strcmp(str, "pause"))
+			attrs->pause = true;
+		else if (!strcmp(str, "continue") || !strcmp(str, "cont"))
+			attrs->cont = true;
+		else if (!strcmp(str, "clear"))
+			attrs->clear = true;
+		else
+			ret = -EINVAL;
+
+		if (dup) {
+			kfree(*dup);
+			*dup = kstrdup(strchr(str, '=') + 1, GFP_KERNEL);
+			if (!*dup)
+				ret = -ENOMEM;
+		}
+	}
+
+	if (!ret && !attrs->keys_str)
+		ret = -EINVAL;
+
+	if (ret) {
+		destroy_hist_trigger_attrs(attrs);
+		return ERR_PTR(ret);
+	}
+
+	return attrs;
+}
+
+static void destroy_hist_data(struct hist_trigger_data *hist_data)
+{
+	if (!hist_data)
+		return;
+
+	destroy_hist_trigger_attrs(hist_data->attrs);
+	hist_map_destroy(hist_data->map);
+	kfree(hist_data);
+}
+
+static bool is_string_field(struct ftrace_event_field *field)
+{
+	return field->filter_type == FILTER_STATIC_STRING ||
+	       field->filter_type == FILTER_DYN_STRING ||
+	       field->filter_type == FILTER_PTR_STRING;
+}
+
+static int parse_hist_field(struct hist_field *hist_field,
+			    struct ftrace_event_call *call, char *str,
+			    bool is_key)
+{
+	struct ftrace_event_field *field;
+	char *name, *modifier;
+
+	name = strsep(&str, ".");
+	modifier = str;
+
+	field = trace_find_event_field(call, name);
+	if (!field)
+		return -EINVAL;
+
+	hist_field->field = field;
+	hist_field->flags = 0;
+
+	if (is_string_field(field)) {
+		if (!is_key || modifier)
+			return -EINVAL;
+		hist_field->flags = HIST_FIELD_STRING;
+		hist_field->size = HIST_KEY_STR_MAX;
+		if (field->filter_type == FILTER_STATIC_STRING &&
+		    field->size < HIST_KEY_STR_MAX)
+			hist_field->size = ALIGN(field->size + 1, sizeof(u64));
+		return 0;
+	}
+
+	hist_field->size = sizeof(u64);
+
+	if (!modifier)
+		return 0;
+	if (!is_key)
+		return -EINVAL;
+
+	if (!strcmp(modifier, "hex"))
+		hist_field->flags = HIST_FIELD_HEX;
+	else if (!strcmp(modifier, "sym"))
+		hist_field->flags = HIST_FIELD_SYM;
+	else if (!strcmp(modifier, "execname"))
+		hist_field->flags = HIST_FIELD_EXECNAME;
+	else if (!strcmp(modifier, "log2"))
+		hist_field->flags = HIST_FIELD_LOG2;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int create_key_fields(struct hist_trigger_data *hist_data,
+			     struct ftrace_event_call *call)
+{
+	char *dup, *fields, *str;
+	int ret = 0;
+
+	fields = dup = kstrdup(hist_data->attrs->keys_str, GFP_KERNEL);
+	if (!dup)
+		return -ENOMEM;
+
+	while (fields && !ret) {
+		struct hist_field *key = &hist_data->keys[hist_data->n_keys];
+
+		str = strsep(&fields, ",");
+		if (hist_data->n_keys == HIST_KEYS_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = parse_hist_field(key, call, str, true);
+		if (ret)
+			break;
+
+		key->offset = hist_data->key_size;
+		hist_data->key_size += key->size;
+		if (hist_data->key_size > HIST_KEY_SIZE_MAX)
+			ret = -EINVAL;
+		hist_data->n_keys++;
+	}
+
+	kfree(dup);
+	return ret;
+}
+
+static int create_val_fields(struct hist_trigger_data *hist_data,
+			     struct ftrace_event_call *call)
+{
+	char *dup, *fields, *str;
+	int ret = 0;
+
+	hist_data->n_vals = 1;	/* the hitcount */
+
+	if (!hist_data->attrs->vals_str)
+		return 0;
+
+	fields = dup = kstrdup(hist_data->attrs->vals_str, GFP_KERNEL);
+	if (!dup)
+		return -ENOMEM;
+
+	while (fields && !ret) {
+		str = strsep(&fields, ",");
+		if (!strcmp(str, "hitcount"))
+			continue;
+		if (hist_data->n_vals > HIST_VALS_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = parse_hist_field(&hist_data->vals[hist_data->n_vals],
+				       call, str, false);
+		hist_data->n_vals++;
+	}
+
+	kfree(dup);
+	return ret;
+}
+
+static int create_sort_key(struct hist_trigger_data *hist_data)
+{
+	char *str = hist_data->attrs->sort_str;
+	char *name, *modifier, *dup;
+	unsigned int i;
+	int ret = -EINVAL;
+
+	/* default to sorting by hitcount, ascending */
+	if (!str)
+		return 0;
+
+	dup = kstrdup(str, GFP_KERNEL);
+	if (!dup)
+		return -ENOMEM;
+
+	str = dup;
+	name = strsep(&str, ".");
+	modifier = str;
+
+	if (modifier) {
+		if (!strcmp(modifier, "descending"))
+			hist_data->sort_descending = true;
+		else if (strcmp(modifier, "ascending"))
+			goto out;
+	}
+
+	if (!strcmp(name, "hitcount")) {
+		ret = 0;
+		goto out;
+	}
+
+	for (i = 1; i < hist_data->n_vals; i++) {
+		if (!strcmp(name, hist_data->vals[i].field->name)) {
+			hist_data->sort_idx = i;
+			ret = 0;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < hist_data->n_keys; i++) {
+		if (!strcmp(name, hist_data->keys[i].field->name)) {
+			hist_data->sort_on_key = true;
+			hist_data->sort_idx = i;
+			ret = 0;
+			goto out;
+		}
+	}
+ out:
+	kfree(dup);
+	return ret;
+}
+
+static struct hist_trigger_data *
+create_hist_data(struct hist_trigger_attrs *attrs,
+		 struct ftrace_event_file *file)
+{
+	struct hist_trigger_data *hist_data;
+	int ret;
+
+	hist_data = kzalloc(sizeof(*hist_data), GFP_KERNEL);
+	if (!hist_data)
+		return ERR_PTR(-ENOMEM);
+
+	hist_data->attrs = attrs;
+
+	ret = create_key_fields(hist_data, file->event_call);
+	if (!ret)
+		ret = create_val_fields(hist_data, file->event_call);
+	if (!ret)
+		ret = create_sort_key(hist_data);
+
+	if (ret) {
+		hist_data->attrs = NULL;
+		destroy_hist_data(hist_data);
+		return ERR_PTR(ret);
+	}
+
+	return hist_data;
+}
+
+static const char *hist_field_modifier(struct hist_field *hist_field)
+{
+	if (hist_field->flags & HIST_FIELD_HEX)
+		return ".hex";
+	if (hist_field->flags & HIST_FIELD_SYM)
+		return ".sym";
+	if (hist_field->flags & HIST_FIELD_EXECNAME)
+		return ".execname";
+	if (hist_field->flags & HIST_FIELD_LOG2)
+		return ".log2";
+	return "";
+}
+
+static int event_hist_trigger_print(struct seq_file *m,
+				    struct event_trigger_ops *ops,
+				    struct event_trigger_data *data)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	struct hist_field *hist_field;
+	unsigned int i;
+
+	seq_puts(m, "hist:keys=");
+	for (i = 0; i < hist_data->n_keys; i++) {
+		hist_field = &hist_data->keys[i];
+		seq_printf(m, "%s%s%s", i ? "," : "", hist_field->field->name,
+			   hist_field_modifier(hist_field));
+	}
+
+	seq_puts(m, ":vals=hitcount");
+	for (i = 1; i < hist_data->n_vals; i++)
+		seq_printf(m, ",%s", hist_data->vals[i].field->name);
+
+	seq_puts(m, ":sort=");
+	if (hist_data->sort_on_key)
+		seq_puts(m, hist_data->keys[hist_data->sort_idx].field->name);
+	else if (hist_data->sort_idx)
+		seq_puts(m, hist_data->vals[hist_data->sort_idx].field->name);
+	else
+		seq_puts(m, "hitcount");
+	if (hist_data->sort_descending)
+		seq_puts(m, ".descending");
+
+	seq_printf(m, ":size=%u", 1 << hist_data->attrs->map_bits);
+	seq_puts(m, hist_data->paused ? " [paused]" : " [active]");
+
+	if (data->filter_str)
+		seq_printf(m, " if %s", data->filter_str);
+	seq_putc(m, '\n');
+
+	return 0;
+}
+
+static int event_hist_trigger_init(struct event_trigger_ops *ops,
+				   struct event_trigger_data *data)
+{
+	data->ref++;
+	return 0;
+}
+
+static void event_hist_trigger_free(struct event_trigger_ops *ops,
+				    struct event_trigger_data *data)
+{
+	if (WARN_ON_ONCE(data->ref <= 0))
+		return;
+
+	data->ref--;
+	if (data->ref)
+		return;
+
+	set_trigger_filter(NULL, data, NULL);
+	synchronize_sched(); /* make sure current triggers exit before free */
+	destroy_hist_data(data->private_data);
+	kfree(data);
+}
+
+static struct event_trigger_ops event_hist_trigger_ops = {
+	.func			= event_hist_trigger,
+	.print			= event_hist_trigger_print,
+	.init			= event_hist_trigger_init,
+	.free			= event_hist_trigger_free,
+};
+
+static struct event_trigger_ops *event_hist_get_trigger_ops(char *cmd,
+							    char *param)
+{
+	return &event_hist_trigger_ops;
+}
+
+static bool hist_field_match(struct hist_field *a, struct hist_field *b)
+{
+	return a->field == b->field && a->flags == b->flags;
+}
+
+static bool hist_trigger_match(struct event_trigger_data *data,
+			       struct event_trigger_data *data_test)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	struct hist_trigger_data *hist_data_test = data_test->private_data;
+	unsigned int i;
+
+	if (hist_data->n_keys != hist_data_test->n_keys ||
+	    hist_data->n_vals != hist_data_test->n_vals ||
+	    hist_data->sort_on_key != hist_data_test->sort_on_key ||
+	    hist_data->sort_idx != hist_data_test->sort_idx ||
+	    hist_data->sort_descending != hist_data_test->sort_descending)
+		return false;
+
+	for (i = 0; i < hist_data->n_keys; i++)
+		if (!hist_field_match(&hist_data->keys[i],
+				      &hist_data_test->keys[i]))
+			return false;
+
+	for (i = 1; i < hist_data->n_vals; i++)
+		if (!hist_field_match(&hist_data->vals[i],
+				      &hist_data_test->vals[i]))
+			return false;
+
+	if (data_test->filter_str &&
+	    (!data->filter_str ||
+	     strcmp(data->filter_str, data_test->filter_str)))
+		return false;
+
+	return true;
+}
+
+static void hist_clear(struct event_trigger_data *data)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	bool paused = hist_data->paused;
+
+	hist_data->paused = true;
+	synchronize_sched(); /* let running triggers see the pause */
+	hist_map_clear(hist_data->map);
+	hist_data->paused = paused;
+}
+
+static int hist_register_trigger(char *glob, struct event_trigger_ops *ops,
+				 struct event_trigger_data *data,
+				 struct ftrace_event_file *file)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	struct hist_trigger_attrs *attrs = hist_data->attrs;
+	struct event_trigger_data *test;
+	struct hist_map *map;
+	int ret = 0;
+
+	list_for_each_entry_rcu(test, &file->triggers, list) {
+		struct hist_trigger_data *test_data;
+
+		if (test->cmd_ops->trigger_type != ETT_EVENT_HIST ||
+		    !hist_trigger_match(test, data))
+			continue;
+
+		test_data = test->private_data;
+		if (attrs->pause)
+			test_data->paused = true;
+		else if (attrs->cont)
+			test_data->paused = false;
+		else if (attrs->clear)
+			hist_clear(test);
+		else
+			ret = -EEXIST;
+		goto out;
+	}
+
+	if (attrs->cont || attrs->clear) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	map = hist_map_create(attrs->map_bits, hist_data->key_size,
+			      hist_data->n_vals);
+	if (IS_ERR(map)) {
+		ret = PTR_ERR(map);
+		goto out;
+	}
+	hist_data->map = map;
+	hist_data->paused = attrs->pause;
+
+	if (data->ops->init) {
+		ret = data->ops->init(data->ops, data);
+		if (ret < 0)
+			goto out;
+	}
+
+	list_add_rcu(&data->list, &file->triggers);
+	ret++;
+
+	/* make the trigger conditional before the event is enabled */
+	update_cond_flag(file);
+	if (trace_event_trigger_enable_disable(file, 1) < 0) {
+		list_del_rcu(&data->list);
+		update_cond_flag(file);
+		ret--;
+	}
+ out:
+	return ret;
+}
+
+static void hist_unregister_trigger(char *glob, struct event_trigger_ops *ops,
+				    struct event_trigger_data *data,
+				    struct ftrace_event_file *file)
+{
+	struct event_trigger_data *test;
+	bool unregistered = false;
+
+	list_for_each_entry_rcu(test, &file->triggers, list) {
+		if (test->cmd_ops->trigger_type == ETT_EVENT_HIST &&
+		    hist_trigger_match(test, data)) {
+			unregistered = true;
+			list_del_rcu(&test->list);
+			trace_event_trigger_enable_disable(file, 0);
+			update_cond_flag(file);
+			break;
+		}
+	}
+
+	if (unregistered && test->ops->free)
+		test->ops->free(test->ops, test);
+}
+
+static int event_hist_trigger_func(struct event_command *cmd_ops,
+				   struct ftrace_event_file *file,
+				   char *glob, char *cmd, char *param)
+{
+	struct hist_trigger_attrs *attrs;
+	struct event_trigger_ops *trigger_ops;
+	struct hist_trigger_data *hist_data;
+	struct event_trigger_data *trigger_data;
+	char *trigger;
+	int ret;
+
+	if (!param)
+		return -EINVAL;
+
+	/* separate the trigger from the filter (k:v [if filter]) */
+	trigger = strsep(&param, " \t");
+	if (!trigger)
+		return -EINVAL;
+
+	attrs = parse_hist_trigger_attrs(trigger);
+	if (IS_ERR(attrs))
+		return PTR_ERR(attrs);
+
+	hist_data = create_hist_data(attrs, file);
+	if (IS_ERR(hist_data)) {
+		destroy_hist_trigger_attrs(attrs);
+		return PTR_ERR(hist_data);
+	}
+
+	trigger_ops = cmd_ops->get_trigger_ops(cmd, trigger);
+
+	ret = -ENOMEM;
+	trigger_data = kzalloc(sizeof(*trigger_data), GFP_KERNEL);
+	if (!trigger_data)
+		goto out_free;
+
+	trigger_data->count = -1;
+	trigger_data->ops = trigger_ops;
+	trigger_data->cmd_ops = cmd_ops;
+	trigger_data->private_data = hist_data;
+	INIT_LIST_HEAD(&trigger_data->list);
+
+	if (glob[0] == '!') {
+		cmd_ops->unreg(glob+1, trigger_ops, trigger_data, file);
+		ret = 0;
+		goto out_free;
+	}
+
+	if (param) { /* if param is non-empty, it's supposed to be a filter */
+		ret = cmd_ops->set_filter(param, trigger_data, file);
+		if (ret < 0)
+			goto out_free;
+	}
+
+	ret = cmd_ops->reg(glob, trigger_ops, trigger_data, file);
+	/*
+	 * The above returns on success the # of triggers registered, or
+	 * zero if it only paused, continued or cleared an existing one,
+	 * in which case this instance isn't needed anymore.
+	 */
+	if (ret > 0)
+		return 0;
+	if (!ret && !(attrs->pause || attrs->cont || attrs->clear))
+		ret = -ENOENT;
+ out_free:
+	if (trigger_data && cmd_ops->set_filter)
+		cmd_ops->set_filter(NULL, trigger_data, NULL);
+	kfree(trigger_data);
+	destroy_hist_data(hist_data);
+	return ret;
+}
+
+static struct event_command trigger_hist_cmd = {
+	.name			= "hist",
+	.trigger_type		= ETT_EVENT_HIST,
+	.needs_rec		= true,
+	.func			= event_hist_trigger_func,
+	.reg			= hist_register_trigger,
+	.unreg			= hist_unregister_trigger,
+	.get_trigger_ops	= event_hist_get_trigger_ops,
+	.set_filter		= set_trigger_filter,
+};
+
+__init int register_trigger_hist_cmd(void)
+{
+	int ret;
+
+	ret = register_event_command(&trigger_hist_cmd);
+	WARN_ON(ret < 0);
+
+	return ret;
+}
+
+/*
+ * Reading the hist file
+ */
+struct hist_sort_entry {
+	struct hist_elt		*elt;
+	u64			val;
+	const char		*str;
+};
+
+static int hist_sort_cmp_u64(const void *a, const void *b)
+{
+	const struct hist_sort_entry *x = a, *y = b;
+
+	return x->val < y->val ? -1 : x->val > y->val;
+}
+
+static int hist_sort_cmp_s64(const void *a, const void *b)
+{
+	const struct hist_sort_entry *x = a, *y = b;
+
+	return (s64)x->val < (s64)y->val ? -1 : (s64)x->val > (s64)y->val;
+}
+
+static int hist_sort_cmp_str(const void *a, const void *b)
+{
+	const struct hist_sort_entry *x = a, *y = b;
+
+	return strcmp(x->str, y->str);
+}
+
+static void hist_trigger_print_key(struct seq_file *m,
+				   struct hist_trigger_data *hist_data,
+				   struct hist_elt *elt)
+{
+	struct hist_field *hist_field;
+	char str[KSYM_SYMBOL_LEN];
+	const char *name;
+	unsigned int i;
+	u64 uval;
+
+	seq_puts(m, "{ ");
+
+	for (i = 0; i < hist_data->n_keys; i++) {
+		hist_field = &hist_data->keys[i];
+		name = hist_field->field->name;
+
+		if (i)
+			seq_puts(m, ", ");
+
+		if (hist_field->flags & HIST_FIELD_STRING) {
+			seq_printf(m, "%s: %-50s", name,
+				   (char *)(elt->key + hist_field->offset));
+			continue;
+		}
+
+		memcpy(&uval, elt->key + hist_field->offset, sizeof(uval));
+
+		if (hist_field->flags & HIST_FIELD_HEX) {
+			seq_printf(m, "%s: %llx", name, uval);
+		} else if (hist_field->flags & HIST_FIELD_SYM) {
+			sprint_symbol_no_offset(str, uval);
+			seq_printf(m, "%s: [%llx] %-45s", name, uval, str);
+		} else if (hist_field->flags & HIST_FIELD_EXECNAME) {
+			trace_find_cmdline(uval, str);
+			seq_printf(m, "%s: %-16s[%10llu]", name, str, uval);
+		} else if (hist_field->flags & HIST_FIELD_LOG2) {
+			seq_printf(m, "%s: ~ 2^%-2llu", name, uval);
+		} else if (hist_field->field->is_signed) {
+			seq_printf(m, "%s: %10lld", name, (s64)uval);
+		} else {
+			seq_printf(m, "%s: %10llu", name, uval);
+		}
+	}
+
+	seq_puts(m, " }");
+}
+
+static void hist_trigger_print_entry(struct seq_file *m,
+				     struct hist_trigger_data *hist_data,
+				     struct hist_elt *elt)
+{
+	unsigned int i;
+
+	hist_trigger_print_key(m, hist_data, elt);
+
+	seq_printf(m, " hitcount: %10llu",
+		   (u64)atomic64_read(&elt->sums[0]));
+	for (i = 1; i < hist_data->n_vals; i++)
+		seq_printf(m, "  %s: %10llu", hist_data->vals[i].field->name,
+			   (u64)atomic64_read(&elt->sums[i]));
+
+	seq_putc(m, '\n');
+}
+
+static int hist_trigger_print_entries(struct seq_file *m,
+				      struct hist_trigger_data *hist_data,
+				      u64 *hits)
+{
+	struct hist_map *map = hist_data->map;
+	unsigned int i, n = hist_map_nr_elts(map);
+	int (*cmp)(const void *, const void *) = hist_sort_cmp_u64;
+	struct hist_sort_entry *entries;
+	struct hist_field *sort_key = NULL;
+
+	entries = vmalloc(n * sizeof(*entries));
+	if (n && !entries)
+		return -ENOMEM;
+
+	if (hist_data->sort_on_key) {
+		sort_key = &hist_data->keys[hist_data->sort_idx];
+		if (sort_key->flags & HIST_FIELD_STRING)
+			cmp = hist_sort_cmp_str;
+		else if (sort_key->field->is_signed &&
+			 !(sort_key->flags & HIST_FIELD_LOG2))
+			cmp = hist_sort_cmp_s64;
+	}
+
+	*hits = 0;
+	for (i = 0; i < n; i++) {
+		struct hist_elt *elt = &map->elts[i];
+
+		entries[i].elt = elt;
+		*hits += atomic64_read(&elt->sums[0]);
+
+		if (!sort_key)
+			entries[i].val =
+				atomic64_read(&elt->sums[hist_data->sort_idx]);
+		else if (sort_key->flags & HIST_FIELD_STRING)
+			entries[i].str = elt->key + sort_key->offset;
+		else
+			memcpy(&entries[i].val, elt->key + sort_key->offset,
+			       sizeof(u64));
+	}
+
+	sort(entries, n, sizeof(*entries), cmp, NULL);
+
+	for (i = 0; i < n; i++) {
+		unsigned int idx = hist_data->sort_descending ? n - 1 - i : i;
+
+		hist_trigger_print_entry(m, hist_data, entries[idx].elt);
+	}
+
+	vfree(entries);
+	return n;
+}
+
+static void hist_trigger_show(struct seq_file *m,
+			      struct event_trigger_data *data, int n)
+{
+	struct hist_trigger_data *hist_data = data->private_data;
+	int n_entries;
+	u64 hits = 0;
+
+	if (n > 0)
+		seq_puts(m, "\n\n");
+
+	seq_puts(m, "# event histogram\n#\n# trigger info: ");
+	data->ops->print(m, data->ops, data);
+	seq_puts(m, "#\n\n");
+
+	n_entries = hist_trigger_print_entries(m, hist_data, &hits);
+	if (n_entries < 0)
+		n_entries = 0;
+
+	seq_puts(m, "\nTotals:\n");
+	seq_printf(m, "    Hits: %llu\n", hits);
+	seq_printf(m, "    Entries: %d\n", n_entries);
+	seq_printf(m, "    Dropped: %llu\n",
+		   (u64)atomic64_read(&hist_data->map->drops));
+}
+
+static int hist_show(struct seq_file *m, void *v)
+{
+	struct event_trigger_data *data;
+	struct ftrace_event_file *event_file;
+	int n = 0, ret = 0;
+
+	mutex_lock(&event_mutex);
+
+	event_file = event_file_data(m->private);
+	if (unlikely(!event_file)) {
+		ret = -ENODEV;
+		goto out_unlock;
+	}
+
+	list_for_each_entry_rcu(data, &event_file->triggers, list) {
+		if (data->cmd_ops->trigger_type == ETT_EVENT_HIST)
+			hist_trigger_show(m, data, n++);
+	}
+
+ out_unlock:
+	mutex_unlock(&event_mutex);
+
+	return ret;
+}
+
+static int event_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hist_show, file);
+}
+
+const struct file_operations event_hist_fops = {
+	.open = event_hist_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
@@ -48,6 +48,8 @@
 #include <linux/nodemask.h>
 #include <linux/moduleparam.h>
 #include <linux/uaccess.h>
+#include <linux/tick.h>
+#include <linux/topology.h>
 
 #include "workqueue_internal.h"
 
@@ -103,6 +105,9 @@ enum {
 	HIGHPRI_NICE_LEVEL	= MIN_NICE,
 
 	WQ_NAME_LEN		= 24,
+
+	/* log2 usecs buckets of the per-workqueue latency histograms */
+	WQ_LAT_BUCKETS		= 16,
 };
 
 /*
@@ -230,6 +235,16 @@ struct wq_flusher {
 
 struct wq_device;
 
+/*
+ * Queueing latency and execution time histograms of a workqueue.  Slot
+ * 0 counts samples below 1us and slot n samples in [2^(n-1), 2^n) us,
+ * the last slot absorbs everything longer.
+ */
+struct wq_lat_stats {
+	u64			queued[WQ_LAT_BUCKETS];
+	u64			executed[WQ_LAT_BUCKETS];
+};
+
 /*
  * The externally visible workqueue.  It relays the issued work items to
  * the appropriate worker_pool through its pool_workqueues.
@@ -260,6 +275,9 @@ struct workqueue_struct {
 #endif
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
+#endif
+#ifdef CONFIG_WQ_LATENCY_STATS
+	struct wq_lat_stats __percpu *lat_stats; /* I: latency histograms */
 #endif
 	char			name[WQ_NAME_LEN]; /* I: workqueue name */
 
@@ -273,7 +291,7 @@ struct workqueue_struct {
 	/* hot fields used during command issue, aligned to cacheline */
 	unsigned int		flags ____cacheline_aligned; /* WQ: WQ_* flags */
 	struct pool_workqueue __percpu *cpu_pwqs; /* I: per-cpu pwqs */
-	struct pool_workqueue __rcu *numa_pwq_tbl[]; /* PWR: unbound pwqs indexed by node */
+	struct pool_workqueue __rcu *unbound_pwq_tbl[]; /* PWR: unbound pwqs indexed by cpu */
 };
 
 static struct kmem_cache *pwq_cache;
@@ -295,8 +313,55 @@ module_param_named(power_efficient, wq_power_efficient, bool, 0444);
 
 static bool wq_numa_enabled;		/* unbound NUMA affinity enabled */
 
-/* buf for wq_update_unbound_numa_attrs(), protected by CPU hotplug exclusion */
-static struct workqueue_attrs *wq_update_unbound_numa_attrs_buf;
+static const char *wq_affn_names[WQ_AFFN_NR_TYPES] = {
+	[WQ_AFFN_DFL]		= "default",
+	[WQ_AFFN_CPU]		= "cpu",
+	[WQ_AFFN_SMT]		= "smt",
+	[WQ_AFFN_CACHE]		= "cache",
+	[WQ_AFFN_NUMA]		= "numa",
+	[WQ_AFFN_SYSTEM]	= "system",
+};
+
+/* affinity scope used by unbound workqueues which didn't pick one */
+static enum wq_affn_scope wq_affn_dfl = WQ_AFFN_NUMA;
+
+static int parse_affn_scope(const char *val)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(wq_affn_names); i++)
+		if (sysfs_streq(val, wq_affn_names[i]))
+			return i;
+	return -EINVAL;
+}
+
+static int wq_affn_dfl_set(const char *val, const struct kernel_param *kp)
+{
+	int affn = parse_affn_scope(val);
+
+	if (affn < 0)
+		return affn;
+	if (affn == WQ_AFFN_DFL)
+		return -EINVAL;
+
+	wq_affn_dfl = affn;
+	return 0;
+}
+
+static int wq_affn_dfl_get(char *buffer, const struct kernel_param *kp)
+{
+	return scnprintf(buffer, PAGE_SIZE, "%s", wq_affn_names[wq_affn_dfl]);
+}
+
+static const struct kernel_param_ops wq_affn_dfl_ops = {
+	.set	= wq_affn_dfl_set,
+	.get	= wq_affn_dfl_get,
+};
+
+module_param_cb(default_affinity_scope, &wq_affn_dfl_ops, NULL, 0444);
+
+/* buf for wq_update_pod(), protected by CPU hotplug exclusion */
+static struct workqueue_attrs *wq_update_pod_attrs_buf;
 
 static DEFINE_MUTEX(wq_pool_mutex);	/* protects pools and workqueues list */
 static DEFINE_SPINLOCK(wq_mayday_lock);	/* protects wq->maydays list */
@@ -558,32 +623,79 @@ static int worker_pool_assign_id(struct worker_pool *pool)
 }
 
 /**
- * unbound_pwq_by_node - return the unbound pool_workqueue for the given node
+ * unbound_pwq_by_cpu - return the unbound pool_workqueue for the given CPU
  * @wq: the target workqueue
- * @node: the node ID
+ * @cpu: the CPU work is being issued on
  *
  * This must be called with any of wq_pool_mutex, wq->mutex or sched RCU
  * read locked.
  * If the pwq needs to be used beyond the locking in effect, the caller is
  * responsible for guaranteeing that the pwq stays online.
  *
- * Return: The unbound pool_workqueue for @node.
+ * Return: The unbound pool_workqueue serving the affinity pod of @cpu.
  */
-static struct pool_workqueue *unbound_pwq_by_node(struct workqueue_struct *wq,
-						  int node)
+static struct pool_workqueue *unbound_pwq_by_cpu(struct workqueue_struct *wq,
+						 int cpu)
 {
 	assert_rcu_or_wq_mutex_or_pool_mutex(wq);
 
-	/*
-	 * XXX: @node can be NUMA_NO_NODE if CPU goes offline while a
-	 * delayed item is pending.  The plan is to keep CPU -> NODE
-	 * mapping valid and stable across CPU on/offlines.  Once that
-	 * happens, this workaround can be removed.
-	 */
-	if (unlikely(node == NUMA_NO_NODE))
-		return wq->dfl_pwq;
+	return rcu_dereference_raw(wq->unbound_pwq_tbl[cpu]);
+}
+
+/* resolve %WQ_AFFN_DFL into the system default scope */
+static enum wq_affn_scope
+wqattrs_affn_scope(const struct workqueue_attrs *attrs)
+{
+	return attrs->affn_scope == WQ_AFFN_DFL ? wq_affn_dfl :
+						  attrs->affn_scope;
+}
+
+static const struct cpumask *wq_cache_cpumask(int cpu)
+{
+#ifdef CONFIG_SCHED_MC
+	return cpu_coregroup_mask(cpu);
+#else
+	return topology_core_cpumask(cpu);
+#endif
+}
+
+/**
+ * wq_pod_cpumask - return the affinity pod of a CPU
+ * @scope: the affinity scope
+ * @cpu: the CPU of interest
+ *
+ * NUMA pods are made of the possible CPUs of each node.  SMT and cache
+ * pods follow the arch topology masks which only cover online CPUs, so an
+ * offline CPU forms a pod of its own until it comes up.  The returned
+ * masks are disjoint for different pods and stay stable while CPU hotplug
+ * is excluded.
+ *
+ * Return: The cpumask of the pod @cpu belongs to under @scope.
+ */
+static const struct cpumask *wq_pod_cpumask(enum wq_affn_scope scope, int cpu)
+{
+	const struct cpumask *pod;
+
+	switch (scope) {
+	case WQ_AFFN_CPU:
+		return cpumask_of(cpu);
+	case WQ_AFFN_SMT:
+		pod = topology_thread_cpumask(cpu);
+		break;
+	case WQ_AFFN_CACHE:
+		pod = wq_cache_cpumask(cpu);
+		break;
+	case WQ_AFFN_NUMA:
+		if (wq_numa_enabled)
+			return wq_numa_possible_cpumask[cpu_to_node(cpu)];
+		/* fall through */
+	default:
+		return cpu_possible_mask;
+	}
 
-	return rcu_dereference_raw(wq->numa_pwq_tbl[node]);
+	if (!cpumask_test_cpu(cpu, pod))
+		return cpumask_of(cpu);
+	return pod;
 }
 
 static unsigned int work_color_to_flags(int color)
@@ -1301,6 +1413,43 @@ fail:
  * CONTEXT:
  * spin_lock_irq(pool->lock).
  */
+#ifdef CONFIG_WQ_LATENCY_STATS
+static int wq_lat_bucket(u64 ns)
+{
+	return min_t(int, fls64(ns >> 10), WQ_LAT_BUCKETS - 1);
+}
+
+static void wq_lat_stamp(struct work_struct *work)
+{
+	work->queued_at = local_clock();
+}
+
+/* account the queueing latency of @work and return its start time */
+static u64 wq_lat_exec_start(struct pool_workqueue *pwq,
+			     struct work_struct *work)
+{
+	u64 now = local_clock();
+
+	if (work->queued_at && now > work->queued_at)
+		this_cpu_inc(pwq->wq->lat_stats->queued[
+				wq_lat_bucket(now - work->queued_at)]);
+	return now;
+}
+
+static void wq_lat_exec_end(struct pool_workqueue *pwq, u64 start)
+{
+	u64 now = local_clock();
+
+	this_cpu_inc(pwq->wq->lat_stats->executed[
+			wq_lat_bucket(now > start ? now - start : 0)]);
+}
+#else	/* CONFIG_WQ_LATENCY_STATS */
+static inline void wq_lat_stamp(struct work_struct *work) { }
+static inline u64 wq_lat_exec_start(struct pool_workqueue *pwq,
+				    struct work_struct *work) { return 0; }
+static inline void wq_lat_exec_end(struct pool_workqueue *pwq, u64 start) { }
+#endif	/* CONFIG_WQ_LATENCY_STATS */
+
 static void insert_work(struct pool_workqueue *pwq, struct work_struct *work,
 			struct list_head *head, unsigned int extra_flags)
 {
@@ -1309,6 +1458,7 @@ static void insert_work(struct pool_workqueue *pwq, struct work_struct *work,
 	/* we own @work, set data and link */
 	set_work_pwq(work, pwq, extra_flags);
 	list_add_tail(&work->entry, head);
+	wq_lat_stamp(work);
 	get_pwq(pwq);
 
 	/*
@@ -1369,7 +1519,7 @@ retry:
 	if (!(wq->flags & WQ_UNBOUND))
 		pwq = per_cpu_ptr(wq->cpu_pwqs, cpu);
 	else
-		pwq = unbound_pwq_by_node(wq, cpu_to_node(cpu));
+		pwq = unbound_pwq_by_cpu(wq, cpu);
 
 	/*
 	 * If @work was previously on a different pool, it might still be
@@ -1399,7 +1549,7 @@ retry:
 	 * pwq is determined and locked.  For unbound pools, we could have
 	 * raced with pwq release and it could already be dead.  If its
 	 * refcnt is zero, repeat pwq selection.  Note that pwqs never die
-	 * without another pwq replacing it in the numa_pwq_tbl or while
+	 * without another pwq replacing it in the unbound_pwq_tbl or while
 	 * work items are executing on it, so the retrying is guaranteed to
 	 * make forward-progress.
 	 */
@@ -2003,6 +2153,7 @@ __acquires(&pool->lock)
 	bool cpu_intensive = pwq->wq->flags & WQ_CPU_INTENSIVE;
 	int work_color;
 	struct worker *collision;
+	u64 exec_start;
 #ifdef CONFIG_LOCKDEP
 	/*
 	 * It is permissible to free the struct work_struct from
@@ -2073,11 +2224,13 @@ __acquires(&pool->lock)
 	lock_map_acquire_read(&pwq->wq->lockdep_map);
 	lock_map_acquire(&lockdep_map);
 	trace_workqueue_execute_start(work);
+	exec_start = wq_lat_exec_start(pwq, work);
 	worker->current_func(work);
 	/*
 	 * While we must be careful to not use "work" after this, the trace
 	 * point will only record its address.
 	 */
+	wq_lat_exec_end(pwq, exec_start);
 	trace_workqueue_execute_end(work);
 	lock_map_release(&lockdep_map);
 	lock_map_release(&pwq->wq->lockdep_map);
@@ -3100,10 +3253,10 @@ static void copy_workqueue_attrs(struct workqueue_attrs *to,
 	cpumask_copy(to->cpumask, from->cpumask);
 	/*
 	 * Unlike hash and equality test, this function doesn't ignore
-	 * ->no_numa as it is used for both pool and wq attrs.  Instead,
-	 * get_unbound_pool() explicitly clears ->no_numa after copying.
+	 * ->affn_scope as it is used for both pool and wq attrs.  Instead,
+	 * get_unbound_pool() explicitly clears ->affn_scope after copying.
 	 */
-	to->no_numa = from->no_numa;
+	to->affn_scope = from->affn_scope;
 }
 
 /* hash value of the content of @attr */
@@ -3181,6 +3334,9 @@ static void rcu_free_wq(struct rcu_head *rcu)
 	else
 		free_workqueue_attrs(wq->unbound_attrs);
 
+#ifdef CONFIG_WQ_LATENCY_STATS
+	free_percpu(wq->lat_stats);
+#endif
 	kfree(wq->rescuer);
 	kfree(wq);
 }
@@ -3295,10 +3451,10 @@ static struct worker_pool *get_unbound_pool(const struct workqueue_attrs *attrs)
 	copy_workqueue_attrs(pool->attrs, attrs);
 
 	/*
-	 * no_numa isn't a worker_pool attribute, always clear it.  See
+	 * affn_scope isn't a worker_pool attribute, always clear it.  See
 	 * 'struct workqueue_attrs' comments for detail.
 	 */
-	pool->attrs->no_numa = false;
+	pool->attrs->affn_scope = WQ_AFFN_DFL;
 
 	/* if cpumask is contained inside a NUMA node, we belong to that node */
 	if (wq_numa_enabled) {
@@ -3477,43 +3633,47 @@ static struct pool_workqueue *alloc_unbound_pwq(struct workqueue_struct *wq,
 }
 
 /**
- * wq_calc_node_mask - calculate a wq_attrs' cpumask for the specified node
+ * wq_calc_pod_cpumask - calculate a wq_attrs' cpumask for the pod of a CPU
  * @attrs: the wq_attrs of interest
- * @node: the target NUMA node
+ * @cpu: the target CPU
  * @cpu_going_down: if >= 0, the CPU to consider as offline
  * @cpumask: outarg, the resulting cpumask
  *
- * Calculate the cpumask a workqueue with @attrs should use on @node.  If
- * @cpu_going_down is >= 0, that cpu is considered offline during
- * calculation.  The result is stored in @cpumask.
+ * Calculate the cpumask a workqueue with @attrs should use for the
+ * affinity pod of @cpu.  If @cpu_going_down is >= 0, that cpu is
+ * considered offline during calculation.  The result is stored in
+ * @cpumask.
  *
- * If NUMA affinity is not enabled, @attrs->cpumask is always used.  If
- * enabled and @node has online CPUs requested by @attrs, the returned
- * cpumask is the intersection of the possible CPUs of @node and
- * @attrs->cpumask.
+ * If the affinity scope is %WQ_AFFN_SYSTEM, @attrs->cpumask is always
+ * used.  Otherwise, if the pod has online CPUs requested by @attrs, the
+ * returned cpumask is the intersection of the pod and @attrs->cpumask.
  *
- * The caller is responsible for ensuring that the cpumask of @node stays
+ * The caller is responsible for ensuring that the pod of @cpu stays
  * stable.
  *
  * Return: %true if the resulting @cpumask is different from @attrs->cpumask,
  * %false if equal.
  */
-static bool wq_calc_node_cpumask(const struct workqueue_attrs *attrs, int node,
-				 int cpu_going_down, cpumask_t *cpumask)
+static bool wq_calc_pod_cpumask(const struct workqueue_attrs *attrs, int cpu,
+				int cpu_going_down, cpumask_t *cpumask)
 {
-	if (!wq_numa_enabled || attrs->no_numa)
+	enum wq_affn_scope scope = wqattrs_affn_scope(attrs);
+	const struct cpumask *pod = wq_pod_cpumask(scope, cpu);
+
+	if (scope == WQ_AFFN_SYSTEM)
 		goto use_dfl;
 
-	/* does @node have any online CPUs @attrs wants? */
-	cpumask_and(cpumask, cpumask_of_node(node), attrs->cpumask);
+	/* does the pod have any online CPUs @attrs wants? */
+	cpumask_and(cpumask, pod, attrs->cpumask);
+	cpumask_and(cpumask, cpumask, cpu_online_mask);
 	if (cpu_going_down >= 0)
 		cpumask_clear_cpu(cpu_going_down, cpumask);
 
 	if (cpumask_empty(cpumask))
 		goto use_dfl;
 
-	/* yeap, return possible CPUs in @node that @attrs wants */
-	cpumask_and(cpumask, attrs->cpumask, wq_numa_possible_cpumask[node]);
+	/* yeap, return CPUs in the pod that @attrs wants */
+	cpumask_and(cpumask, attrs->cpumask, pod);
 	return !cpumask_equal(cpumask, attrs->cpumask);
 
 use_dfl:
@@ -3521,10 +3681,10 @@ use_dfl:
 	return false;
 }
 
-/* install @pwq into @wq's numa_pwq_tbl[] for @node and return the old pwq */
-static struct pool_workqueue *numa_pwq_tbl_install(struct workqueue_struct *wq,
-						   int node,
-						   struct pool_workqueue *pwq)
+/* install @pwq into @wq's unbound_pwq_tbl[] for @cpu and return the old pwq */
+static struct pool_workqueue *
+unbound_pwq_tbl_install(struct workqueue_struct *wq, int cpu,
+			struct pool_workqueue *pwq)
 {
 	struct pool_workqueue *old_pwq;
 
@@ -3534,11 +3694,31 @@ static struct pool_workqueue *numa_pwq_tbl_install(struct workqueue_struct *wq,
 	/* link_pwq() can handle duplicate calls */
 	link_pwq(pwq);
 
-	old_pwq = rcu_access_pointer(wq->numa_pwq_tbl[node]);
-	rcu_assign_pointer(wq->numa_pwq_tbl[node], pwq);
+	old_pwq = rcu_access_pointer(wq->unbound_pwq_tbl[cpu]);
+	rcu_assign_pointer(wq->unbound_pwq_tbl[cpu], pwq);
 	return old_pwq;
 }
 
+/*
+ * Install @pwq for every possible CPU of @pod and put the replaced pwqs.
+ * Each slot takes its own reference, the one passed in by the caller is
+ * consumed.
+ */
+static void unbound_pwq_install_pod(struct workqueue_struct *wq,
+				    const struct cpumask *pod,
+				    struct pool_workqueue *pwq)
+{
+	int cpu;
+
+	for_each_cpu_and(cpu, pod, cpu_possible_mask) {
+		spin_lock_irq(&pwq->pool->lock);
+		get_pwq(pwq);
+		spin_unlock_irq(&pwq->pool->lock);
+		put_pwq_unlocked(unbound_pwq_tbl_install(wq, cpu, pwq));
+	}
+	put_pwq_unlocked(pwq);
+}
+
 /* context to store the prepared attrs & pwqs before applying */
 struct apply_wqattrs_ctx {
 	struct workqueue_struct	*wq;		/* target workqueue */
@@ -3551,10 +3731,10 @@ struct apply_wqattrs_ctx {
 static void apply_wqattrs_cleanup(struct apply_wqattrs_ctx *ctx)
 {
 	if (ctx) {
-		int node;
+		int cpu;
 
-		for_each_node(node)
-			put_pwq_unlocked(ctx->pwq_tbl[node]);
+		for_each_possible_cpu(cpu)
+			put_pwq_unlocked(ctx->pwq_tbl[cpu]);
 		put_pwq_unlocked(ctx->dfl_pwq);
 
 		free_workqueue_attrs(ctx->attrs);
@@ -3570,11 +3750,11 @@ apply_wqattrs_prepare(struct workqueue_struct *wq,
 {
 	struct apply_wqattrs_ctx *ctx;
 	struct workqueue_attrs *new_attrs, *tmp_attrs;
-	int node;
+	int cpu;
 
 	lockdep_assert_held(&wq_pool_mutex);
 
-	ctx = kzalloc(sizeof(*ctx) + nr_node_ids * sizeof(ctx->pwq_tbl[0]),
+	ctx = kzalloc(sizeof(*ctx) + nr_cpu_ids * sizeof(ctx->pwq_tbl[0]),
 		      GFP_KERNEL);
 
 	new_attrs = alloc_workqueue_attrs(GFP_KERNEL);
@@ -3602,14 +3782,26 @@ apply_wqattrs_prepare(struct workqueue_struct *wq,
 	if (!ctx->dfl_pwq)
 		goto out_free;
 
-	for_each_node(node) {
-		if (wq_calc_node_cpumask(attrs, node, -1, tmp_attrs->cpumask)) {
-			ctx->pwq_tbl[node] = alloc_unbound_pwq(wq, tmp_attrs);
-			if (!ctx->pwq_tbl[node])
+	for_each_possible_cpu(cpu) {
+		const struct cpumask *pod;
+		int first;
+
+		/* CPUs of a pod share the pwq created for its first CPU */
+		pod = wq_pod_cpumask(wqattrs_affn_scope(new_attrs), cpu);
+		first = cpumask_first(pod);
+		if (first != cpu) {
+			ctx->pwq_tbl[cpu] = ctx->pwq_tbl[first];
+			ctx->pwq_tbl[cpu]->refcnt++;
+			continue;
+		}
+
+		if (wq_calc_pod_cpumask(new_attrs, cpu, -1, tmp_attrs->cpumask)) {
+			ctx->pwq_tbl[cpu] = alloc_unbound_pwq(wq, tmp_attrs);
+			if (!ctx->pwq_tbl[cpu])
 				goto out_free;
 		} else {
 			ctx->dfl_pwq->refcnt++;
-			ctx->pwq_tbl[node] = ctx->dfl_pwq;
+			ctx->pwq_tbl[cpu] = ctx->dfl_pwq;
 		}
 	}
 
@@ -3628,7 +3820,7 @@ out_free:
 /* set attrs and install prepared pwqs, @ctx points to old pwqs on return */
 static void apply_wqattrs_commit(struct apply_wqattrs_ctx *ctx)
 {
-	int node;
+	int cpu;
 
 	/* all pwqs have been created successfully, let's install'em */
 	mutex_lock(&ctx->wq->mutex);
@@ -3636,9 +3828,9 @@ static void apply_wqattrs_commit(struct apply_wqattrs_ctx *ctx)
 	copy_workqueue_attrs(ctx->wq->unbound_attrs, ctx->attrs);
 
 	/* save the previous pwq and install the new one */
-	for_each_node(node)
-		ctx->pwq_tbl[node] = numa_pwq_tbl_install(ctx->wq, node,
-							  ctx->pwq_tbl[node]);
+	for_each_possible_cpu(cpu)
+		ctx->pwq_tbl[cpu] = unbound_pwq_tbl_install(ctx->wq, cpu,
+							    ctx->pwq_tbl[cpu]);
 
 	/* @dfl_pwq might not have been used, ensure it's linked */
 	link_pwq(ctx->dfl_pwq);
@@ -3652,12 +3844,12 @@ static void apply_wqattrs_commit(struct apply_wqattrs_ctx *ctx)
  * @wq: the target workqueue
  * @attrs: the workqueue_attrs to apply, allocated with alloc_workqueue_attrs()
  *
- * Apply @attrs to an unbound workqueue @wq.  Unless disabled, on NUMA
- * machines, this function maps a separate pwq to each NUMA node with
- * possibles CPUs in @attrs->cpumask so that work items are affine to the
- * NUMA node it was issued on.  Older pwqs are released as in-flight work
- * items finish.  Note that a work item which repeatedly requeues itself
- * back-to-back will stay on its current pwq.
+ * Apply @attrs to an unbound workqueue @wq.  The CPUs are grouped into
+ * pods according to @attrs->affn_scope and a separate pwq is mapped to
+ * each pod with possible CPUs in @attrs->cpumask so that work items are
+ * affine to the pod they were issued on.  Older pwqs are released as
+ * in-flight work items finish.  Note that a work item which repeatedly
+ * requeues itself back-to-back will stay on its current pwq.
  *
  * Performs GFP_KERNEL allocations.
  *
@@ -3679,7 +3871,7 @@ int apply_workqueue_attrs(struct workqueue_struct *wq,
 
 	/*
 	 * CPUs should stay stable across pwq creations and installations.
-	 * Pin CPUs, determine the target cpumask for each node and create
+	 * Pin CPUs, determine the target cpumask for each pod and create
 	 * pwqs accordingly.
 	 */
 	get_online_cpus();
@@ -3702,39 +3894,39 @@ int apply_workqueue_attrs(struct workqueue_struct *wq,
 }
 
 /**
- * wq_update_unbound_numa - update NUMA affinity of a wq for CPU hot[un]plug
+ * wq_update_pod - update affinity pod of a wq for CPU hot[un]plug
  * @wq: the target workqueue
  * @cpu: the CPU coming up or going down
  * @online: whether @cpu is coming up or going down
  *
  * This function is to be called from %CPU_DOWN_PREPARE, %CPU_ONLINE and
- * %CPU_DOWN_FAILED.  @cpu is being hot[un]plugged, update NUMA affinity of
- * @wq accordingly.
+ * %CPU_DOWN_FAILED.  @cpu is being hot[un]plugged, update the pwq serving
+ * the affinity pod of @cpu accordingly.  SMT and cache pods change shape
+ * as CPUs come and go, so every CPU of the current pod is updated.
  *
- * If NUMA affinity can't be adjusted due to memory allocation failure, it
- * falls back to @wq->dfl_pwq which may not be optimal but is always
+ * If the pod affinity can't be adjusted due to memory allocation failure,
+ * it falls back to @wq->dfl_pwq which may not be optimal but is always
  * correct.
  *
- * Note that when the last allowed CPU of a NUMA node goes offline for a
- * workqueue with a cpumask spanning multiple nodes, the workers which were
+ * Note that when the last allowed CPU of a pod goes offline for a
+ * workqueue with a cpumask spanning multiple pods, the workers which were
  * already executing the work items for the workqueue will lose their CPU
  * affinity and may execute on any CPU.  This is similar to how per-cpu
  * workqueues behave on CPU_DOWN.  If a workqueue user wants strict
  * affinity, it's the user's responsibility to flush the work item from
  * CPU_DOWN_PREPARE.
  */
-static void wq_update_unbound_numa(struct workqueue_struct *wq, int cpu,
-				   bool online)
+static void wq_update_pod(struct workqueue_struct *wq, int cpu, bool online)
 {
-	int node = cpu_to_node(cpu);
 	int cpu_off = online ? -1 : cpu;
-	struct pool_workqueue *old_pwq = NULL, *pwq;
+	struct pool_workqueue *pwq;
 	struct workqueue_attrs *target_attrs;
+	const struct cpumask *pod;
 	cpumask_t *cpumask;
 
 	lockdep_assert_held(&wq_pool_mutex);
 
-	if (!wq_numa_enabled || !(wq->flags & WQ_UNBOUND))
+	if (!(wq->flags & WQ_UNBOUND))
 		return;
 
 	/*
@@ -3742,15 +3934,16 @@ static void wq_update_unbound_numa(struct workqueue_struct *wq, int cpu,
 	 * Let's use a preallocated one.  The following buf is protected by
 	 * CPU hotplug exclusion.
 	 */
-	target_attrs = wq_update_unbound_numa_attrs_buf;
+	target_attrs = wq_update_pod_attrs_buf;
 	cpumask = target_attrs->cpumask;
 
 	mutex_lock(&wq->mutex);
-	if (wq->unbound_attrs->no_numa)
+	if (wqattrs_affn_scope(wq->unbound_attrs) == WQ_AFFN_SYSTEM)
 		goto out_unlock;
 
 	copy_workqueue_attrs(target_attrs, wq->unbound_attrs);
-	pwq = unbound_pwq_by_node(wq, node);
+	pod = wq_pod_cpumask(wqattrs_affn_scope(target_attrs), cpu);
+	pwq = unbound_pwq_by_cpu(wq, cpu);
 
 	/*
 	 * Let's determine what needs to be done.  If the target cpumask is
@@ -3758,7 +3951,7 @@ static void wq_update_unbound_numa(struct workqueue_struct *wq, int cpu,
 	 * a new one if they don't match.  If the target cpumask equals
 	 * wq's, the default pwq should be used.
 	 */
-	if (wq_calc_node_cpumask(wq->unbound_attrs, node, cpu_off, cpumask)) {
+	if (wq_calc_pod_cpumask(wq->unbound_attrs, cpu, cpu_off, cpumask)) {
 		if (cpumask_equal(cpumask, pwq->pool->attrs->cpumask))
 			goto out_unlock;
 	} else {
@@ -3770,7 +3963,7 @@ static void wq_update_unbound_numa(struct workqueue_struct *wq, int cpu,
 	/* create a new pwq */
 	pwq = alloc_unbound_pwq(wq, target_attrs);
 	if (!pwq) {
-		pr_warn("workqueue: allocation failed while updating NUMA affinity of \"%s\"\n",
+		pr_warn("workqueue: allocation failed while updating affinity of \"%s\"\n",
 			wq->name);
 		mutex_lock(&wq->mutex);
 		goto use_dfl_pwq;
@@ -3783,17 +3976,16 @@ static void wq_update_unbound_numa(struct workqueue_struct *wq, int cpu,
 	 * inbetween.
 	 */
 	mutex_lock(&wq->mutex);
-	old_pwq = numa_pwq_tbl_install(wq, node, pwq);
+	unbound_pwq_install_pod(wq, pod, pwq);
 	goto out_unlock;
 
 use_dfl_pwq:
 	spin_lock_irq(&wq->dfl_pwq->pool->lock);
 	get_pwq(wq->dfl_pwq);
 	spin_unlock_irq(&wq->dfl_pwq->pool->lock);
-	old_pwq = numa_pwq_tbl_install(wq, node, wq->dfl_pwq);
+	unbound_pwq_install_pod(wq, pod, wq->dfl_pwq);
 out_unlock:
 	mutex_unlock(&wq->mutex);
-	put_pwq_unlocked(old_pwq);
 }
 
 static int alloc_and_link_pwqs(struct workqueue_struct *wq)
@@ -3860,7 +4052,7 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 
 	/* allocate wq and format name */
 	if (flags & WQ_UNBOUND)
-		tbl_size = nr_node_ids * sizeof(wq->numa_pwq_tbl[0]);
+		tbl_size = nr_cpu_ids * sizeof(wq->unbound_pwq_tbl[0]);
 
 	wq = kzalloc(sizeof(*wq) + tbl_size, GFP_KERNEL);
 	if (!wq)
@@ -3872,6 +4064,12 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 			goto err_free_wq;
 	}
 
+#ifdef CONFIG_WQ_LATENCY_STATS
+	wq->lat_stats = alloc_percpu(struct wq_lat_stats);
+	if (!wq->lat_stats)
+		goto err_free_wq;
+#endif
+
 	va_start(args, lock_name);
 	vsnprintf(wq->name, sizeof(wq->name), fmt, args);
 	va_end(args);
@@ -3941,6 +4139,9 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	return wq;
 
 err_free_wq:
+#ifdef CONFIG_WQ_LATENCY_STATS
+	free_percpu(wq->lat_stats);
+#endif
 	free_workqueue_attrs(wq->unbound_attrs);
 	kfree(wq);
 	return NULL;
@@ -3959,7 +4160,7 @@ EXPORT_SYMBOL_GPL(__alloc_workqueue_key);
 void destroy_workqueue(struct workqueue_struct *wq)
 {
 	struct pool_workqueue *pwq;
-	int node;
+	int cpu;
 
 	/* drain it before proceeding with destruction */
 	drain_workqueue(wq);
@@ -4007,12 +4208,12 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	} else {
 		/*
 		 * We're the sole accessor of @wq at this point.  Directly
-		 * access numa_pwq_tbl[] and dfl_pwq to put the base refs.
+		 * access unbound_pwq_tbl[] and dfl_pwq to put the base refs.
 		 * @wq will be freed when the last pwq is released.
 		 */
-		for_each_node(node) {
-			pwq = rcu_access_pointer(wq->numa_pwq_tbl[node]);
-			RCU_INIT_POINTER(wq->numa_pwq_tbl[node], NULL);
+		for_each_possible_cpu(cpu) {
+			pwq = rcu_access_pointer(wq->unbound_pwq_tbl[cpu]);
+			RCU_INIT_POINTER(wq->unbound_pwq_tbl[cpu], NULL);
 			put_pwq_unlocked(pwq);
 		}
 
@@ -4104,7 +4305,7 @@ bool workqueue_congested(int cpu, struct workqueue_struct *wq)
 	if (!(wq->flags & WQ_UNBOUND))
 		pwq = per_cpu_ptr(wq->cpu_pwqs, cpu);
 	else
-		pwq = unbound_pwq_by_node(wq, cpu_to_node(cpu));
+		pwq = unbound_pwq_by_cpu(wq, cpu);
 
 	ret = !list_empty(&pwq->delayed_works);
 	rcu_read_unlock_sched();
@@ -4598,9 +4799,9 @@ static int workqueue_cpu_up_callback(struct notifier_block *nfb,
 			mutex_unlock(&pool->attach_mutex);
 		}
 
-		/* update NUMA affinity of unbound workqueues */
+		/* update pod affinity of unbound workqueues */
 		list_for_each_entry(wq, &workqueues, list)
-			wq_update_unbound_numa(wq, cpu, true);
+			wq_update_pod(wq, cpu, true);
 
 		mutex_unlock(&wq_pool_mutex);
 		break;
@@ -4626,10 +4827,10 @@ static int workqueue_cpu_down_callback(struct notifier_block *nfb,
 		INIT_WORK_ONSTACK(&unbind_work, wq_unbind_fn);
 		queue_work_on(cpu, system_highpri_wq, &unbind_work);
 
-		/* update NUMA affinity of unbound workqueues */
+		/* update pod affinity of unbound workqueues */
 		mutex_lock(&wq_pool_mutex);
 		list_for_each_entry(wq, &workqueues, list)
-			wq_update_unbound_numa(wq, cpu, false);
+			wq_update_pod(wq, cpu, false);
 		mutex_unlock(&wq_pool_mutex);
 
 		/* wait for per-cpu unbinding to finish */
@@ -4800,12 +5001,15 @@ out_unlock:
  *
  *  per_cpu	RO bool	: whether the workqueue is per-cpu or unbound
  *  max_active	RW int	: maximum number of in-flight work items
+ *  latency	RO	: queueing latency and execution time histograms,
+ *			  only with CONFIG_WQ_LATENCY_STATS
  *
  * Unbound workqueues have the following extra attributes.
  *
- *  id		RO int	: the associated pool ID
+ *  pool_ids	RO int	: the associated pool ID for each CPU
  *  nice	RW int	: nice value of the workers
  *  cpumask	RW mask	: bitmask of allowed CPUs for the workers
+ *  affinity_scope RW	: cpu, smt, cache, numa, system or default
  */
 struct wq_device {
 	struct workqueue_struct		*wq;
@@ -4851,9 +5055,43 @@ static ssize_t max_active_store(struct device *dev,
 }
 static DEVICE_ATTR_RW(max_active);
 
+#ifdef CONFIG_WQ_LATENCY_STATS
+static ssize_t latency_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written, i, cpu;
+
+	written = scnprintf(buf, PAGE_SIZE, "%8s %12s %12s\n",
+			    "usecs", "queued", "executed");
+
+	for (i = 0; i < WQ_LAT_BUCKETS; i++) {
+		u64 queued = 0, executed = 0;
+
+		for_each_possible_cpu(cpu) {
+			struct wq_lat_stats *stats =
+				per_cpu_ptr(wq->lat_stats, cpu);
+
+			queued += stats->queued[i];
+			executed += stats->executed[i];
+		}
+		written += scnprintf(buf + written, PAGE_SIZE - written,
+				     "%8llu %12llu %12llu\n",
+				     i ? 1ULL << (i - 1) : 0ULL,
+				     queued, executed);
+	}
+
+	return written;
+}
+static DEVICE_ATTR_RO(latency);
+#endif
+
 static struct attribute *wq_sysfs_attrs[] = {
 	&dev_attr_per_cpu.attr,
 	&dev_attr_max_active.attr,
+#ifdef CONFIG_WQ_LATENCY_STATS
+	&dev_attr_latency.attr,
+#endif
 	NULL,
 };
 ATTRIBUTE_GROUPS(wq_sysfs);
@@ -4863,13 +5101,13 @@ static ssize_t wq_pool_ids_show(struct device *dev,
 {
 	struct workqueue_struct *wq = dev_to_wq(dev);
 	const char *delim = "";
-	int node, written = 0;
+	int cpu, written = 0;
 
 	rcu_read_lock_sched();
-	for_each_node(node) {
+	for_each_possible_cpu(cpu) {
 		written += scnprintf(buf + written, PAGE_SIZE - written,
-				     "%s%d:%d", delim, node,
-				     unbound_pwq_by_node(wq, node)->pool->id);
+				     "%s%d:%d", delim, cpu,
+				     unbound_pwq_by_cpu(wq, cpu)->pool->id);
 		delim = " ";
 	}
 	written += scnprintf(buf + written, PAGE_SIZE - written, "\n");
@@ -4964,11 +5202,12 @@ static ssize_t wq_numa_show(struct device *dev, struct device_attribute *attr,
 			    char *buf)
 {
 	struct workqueue_struct *wq = dev_to_wq(dev);
+	enum wq_affn_scope scope;
 	int written;
 
 	mutex_lock(&wq->mutex);
-	written = scnprintf(buf, PAGE_SIZE, "%d\n",
-			    !wq->unbound_attrs->no_numa);
+	scope = wqattrs_affn_scope(wq->unbound_attrs);
+	written = scnprintf(buf, PAGE_SIZE, "%d\n", scope != WQ_AFFN_SYSTEM);
 	mutex_unlock(&wq->mutex);
 
 	return written;
@@ -4987,7 +5226,7 @@ static ssize_t wq_numa_store(struct device *dev, struct device_attribute *attr,
 
 	ret = -EINVAL;
 	if (sscanf(buf, "%d", &v) == 1) {
-		attrs->no_numa = !v;
+		attrs->affn_scope = v ? WQ_AFFN_NUMA : WQ_AFFN_SYSTEM;
 		ret = apply_workqueue_attrs(wq, attrs);
 	}
 
@@ -4995,11 +5234,54 @@ static ssize_t wq_numa_store(struct device *dev, struct device_attribute *attr,
 	return ret ?: count;
 }
 
+static ssize_t wq_affn_scope_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written;
+
+	mutex_lock(&wq->mutex);
+	if (wq->unbound_attrs->affn_scope == WQ_AFFN_DFL)
+		written = scnprintf(buf, PAGE_SIZE, "%s (%s)\n",
+				    wq_affn_names[WQ_AFFN_DFL],
+				    wq_affn_names[wq_affn_dfl]);
+	else
+		written = scnprintf(buf, PAGE_SIZE, "%s\n",
+				    wq_affn_names[wq->unbound_attrs->affn_scope]);
+	mutex_unlock(&wq->mutex);
+
+	return written;
+}
+
+static ssize_t wq_affn_scope_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	struct workqueue_attrs *attrs;
+	int affn, ret;
+
+	affn = parse_affn_scope(buf);
+	if (affn < 0)
+		return affn;
+
+	attrs = wq_sysfs_prep_attrs(wq);
+	if (!attrs)
+		return -ENOMEM;
+
+	attrs->affn_scope = affn;
+	ret = apply_workqueue_attrs(wq, attrs);
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
 static struct device_attribute wq_sysfs_unbound_attrs[] = {
 	__ATTR(pool_ids, 0444, wq_pool_ids_show, NULL),
 	__ATTR(nice, 0644, wq_nice_show, wq_nice_store),
 	__ATTR(cpumask, 0644, wq_cpumask_show, wq_cpumask_store),
 	__ATTR(numa, 0644, wq_numa_show, wq_numa_store),
+	__ATTR(affinity_scope, 0644, wq_affn_scope_show, wq_affn_scope_store),
 	__ATTR_NULL,
 };
 
@@ -5122,9 +5404,6 @@ static void __init wq_numa_init(void)
 		return;
 	}
 
-	wq_update_unbound_numa_attrs_buf = alloc_workqueue_attrs(GFP_KERNEL);
-	BUG_ON(!wq_update_unbound_numa_attrs_buf);
-
 	/*
 	 * We want masks of possible CPUs of each node which isn't readily
 	 * available.  Build one from cpu_to_node() which should have been
@@ -5163,6 +5442,9 @@ static int __init init_workqueues(void)
 	cpu_notifier(workqueue_cpu_up_callback, CPU_PRI_WORKQUEUE_UP);
 	hotcpu_notifier(workqueue_cpu_down_callback, CPU_PRI_WORKQUEUE_DOWN);
 
+	wq_update_pod_attrs_buf = alloc_workqueue_attrs(GFP_KERNEL);
+	BUG_ON(!wq_update_pod_attrs_buf);
+
 	wq_numa_init();
 
 	/* initialize CPU pools */
@@ -5200,16 +5482,19 @@ static int __init init_workqueues(void)
 
 		BUG_ON(!(attrs = alloc_workqueue_attrs(GFP_KERNEL)));
 		attrs->nice = std_nice[i];
+		/* keep unbound work off the full dynticks CPUs */
+		cpumask_copy(attrs->cpumask, housekeeping_cpumask());
 		unbound_std_wq_attrs[i] = attrs;
 
 		/*
 		 * An ordered wq should have only one pwq as ordering is
 		 * guaranteed by max_active which is enforced by pwqs.
-		 * Turn off NUMA so that dfl_pwq is used for all nodes.
+		 * Use the system scope so that dfl_pwq is used for all CPUs.
 		 */
 		BUG_ON(!(attrs = alloc_workqueue_attrs(GFP_KERNEL)));
 		attrs->nice = std_nice[i];
-		attrs->no_numa = true;
+		attrs->affn_scope = WQ_AFFN_SYSTEM;
+		cpumask_copy(attrs->cpumask, housekeeping_cpumask());
 		ordered_wq_attrs[i] = attrs;
 	}
 
@@ -79,6 +79,21 @@ static inline void *indirect_to_ptr(void *ptr)
 	return (void *)((unsigned long)ptr & ~RADIX_TREE_INDIRECT_PTR);
 }
 
+/*
+ * Return the offset of the canonical slot of the entry at @offset, which
+ * differs from @offset if that slot holds a sibling entry.
+ */
+static inline unsigned int canonical_offset(struct radix_tree_node *node,
+					    unsigned int offset)
+{
+	void **slot = node->slots + offset;
+	void *entry = rcu_dereference_raw(*slot);
+
+	if (radix_tree_is_sibling(slot, entry))
+		return (void **)indirect_to_ptr(entry) - node->slots;
+	return offset;
+}
+
 static inline gfp_t root_gfp_mask(struct radix_tree_root *root)
 {
 	return root->gfp_mask & __GFP_BITS_MASK;
@@ -352,10 +367,12 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 		node->path = newheight;
 		node->count = 1;
 		node->parent = NULL;
+		/* Child nodes are linked with indirect pointers as well */
 		slot = root->rnode;
 		if (newheight > 1) {
-			slot = indirect_to_ptr(slot);
-			slot->parent = node;
+			struct radix_tree_node *child = indirect_to_ptr(slot);
+
+			child->parent = node;
 		}
 		node->slots[0] = slot;
 		node = ptr_to_indirect(node);
@@ -370,33 +387,49 @@ out:
  *	__radix_tree_create	-	create a slot in a radix tree
  *	@root:		radix tree root
  *	@index:		index key
+ *	@order:		log2 of the number of indices the item will cover
  *	@nodep:		returns node
  *	@slotp:		returns slot
  *
  *	Create, if necessary, and return the node and slot for an item
- *	at position @index in the radix tree @root.
+ *	at position @index in the radix tree @root.  For @order > 0 this
+ *	is the canonical slot of the range, @index must be aligned to it.
  *
  *	Until there is more than one item in the tree, no nodes are
  *	allocated and @root->rnode is used as a direct slot instead of
  *	pointing to a node, in which case *@nodep will be NULL.
  *
- *	Returns -ENOMEM, or 0 for success.
+ *	Returns -ENOMEM, -EEXIST if a multi-order entry already covers
+ *	@index, or 0 for success.
  */
 int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
-			struct radix_tree_node **nodep, void ***slotp)
+			unsigned order, struct radix_tree_node **nodep,
+			void ***slotp)
 {
-	struct radix_tree_node *node = NULL, *slot;
+	struct radix_tree_node *node = NULL, *child;
+	unsigned int order_shift = order - order % RADIX_TREE_MAP_SHIFT;
 	unsigned int height, shift, offset;
+	unsigned long max;
+	void *slot;
 	int error;
 
+	BUG_ON(order >= RADIX_TREE_INDEX_BITS);
+	max = index | ((1UL << order) - 1);
+	BUG_ON(index & ((1UL << order) - 1));
+
+	/* The node holding the entry must exist below the root. */
+	if (order)
+		max = max(max, radix_tree_maxindex(order_shift /
+						   RADIX_TREE_MAP_SHIFT + 1));
+
 	/* Make sure the tree is high enough.  */
-	if (index > radix_tree_maxindex(root->height)) {
-		error = radix_tree_extend(root, index);
+	if (max > radix_tree_maxindex(root->height)) {
+		error = radix_tree_extend(root, max);
 		if (error)
 			return error;
 	}
 
-	slot = indirect_to_ptr(root->rnode);
+	slot = root->rnode;
 
 	height = root->height;
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
@@ -405,22 +438,31 @@ int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
 	while (height > 0) {
 		if (slot == NULL) {
 			/* Have to add a child node.  */
-			if (!(slot = radix_tree_node_alloc(root)))
+			if (!(child = radix_tree_node_alloc(root)))
 				return -ENOMEM;
-			slot->path = height;
-			slot->parent = node;
+			child->path = height;
+			child->parent = node;
+			slot = ptr_to_indirect(child);
 			if (node) {
 				rcu_assign_pointer(node->slots[offset], slot);
 				node->count++;
-				slot->path |= offset << RADIX_TREE_HEIGHT_SHIFT;
+				child->path |=
+					offset << RADIX_TREE_HEIGHT_SHIFT;
 			} else
-				rcu_assign_pointer(root->rnode, ptr_to_indirect(slot));
+				rcu_assign_pointer(root->rnode, slot);
+		} else if (!radix_tree_is_indirect_ptr(slot) ||
+			   (node && radix_tree_is_sibling(node->slots + offset,
+							  slot))) {
+			/* A multi-order entry covers this index already */
+			return -EEXIST;
 		}
 
 		/* Go a level down */
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		node = slot;
+		node = indirect_to_ptr(slot);
 		slot = node->slots[offset];
+		if (shift == order_shift)
+			break;
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
@@ -433,41 +475,59 @@ int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
 }
 
 /**
- *	radix_tree_insert    -    insert into a radix tree
+ *	__radix_tree_insert    -    insert into a radix tree
  *	@root:		radix tree root
  *	@index:		index key
+ *	@order:		log2 of the number of indices the item covers
  *	@item:		item to insert
  *
- *	Insert an item into the radix tree at position @index.
+ *	Insert an item into the radix tree covering the 2^@order indices
+ *	starting at @index, which must be aligned to that size.  All of
+ *	them must be empty.
  */
-int radix_tree_insert(struct radix_tree_root *root,
-			unsigned long index, void *item)
+int __radix_tree_insert(struct radix_tree_root *root, unsigned long index,
+			unsigned order, void *item)
 {
 	struct radix_tree_node *node;
+	unsigned int offset, i, n;
 	void **slot;
 	int error;
 
 	BUG_ON(radix_tree_is_indirect_ptr(item));
 
-	error = __radix_tree_create(root, index, &node, &slot);
+	error = __radix_tree_create(root, index, order, &node, &slot);
 	if (error)
 		return error;
 	if (*slot != NULL)
 		return -EEXIST;
-	rcu_assign_pointer(*slot, item);
 
-	if (node) {
-		node->count++;
-		BUG_ON(tag_get(node, 0, index & RADIX_TREE_MAP_MASK));
-		BUG_ON(tag_get(node, 1, index & RADIX_TREE_MAP_MASK));
-	} else {
+	if (!node) {
+		rcu_assign_pointer(*slot, item);
 		BUG_ON(root_tag_get(root, 0));
 		BUG_ON(root_tag_get(root, 1));
+		return 0;
 	}
 
+	offset = slot - node->slots;
+	n = 1U << (order % RADIX_TREE_MAP_SHIFT);
+	for (i = 1; i < n; i++) {
+		if (node->slots[offset + i])
+			return -EEXIST;
+	}
+
+	/* Siblings first: until the item shows up they resolve to NULL */
+	for (i = 1; i < n; i++)
+		rcu_assign_pointer(node->slots[offset + i],
+				   ptr_to_indirect(slot));
+	rcu_assign_pointer(*slot, item);
+
+	node->count += n;
+	BUG_ON(tag_get(node, 0, offset));
+	BUG_ON(tag_get(node, 1, offset));
+
 	return 0;
 }
-EXPORT_SYMBOL(radix_tree_insert);
+EXPORT_SYMBOL(__radix_tree_insert);
 
 /**
  *	__radix_tree_lookup	-	lookup an item in a radix tree
@@ -512,16 +572,22 @@ void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
 
-	do {
+	for (;;) {
 		parent = node;
-		slot = node->slots + ((index >> shift) & RADIX_TREE_MAP_MASK);
+		slot = node->slots + canonical_offset(node,
+				(index >> shift) & RADIX_TREE_MAP_MASK);
 		node = rcu_dereference_raw(*slot);
 		if (node == NULL)
 			return NULL;
 
+		/* Leaf item, or a multi-order entry above the leaves */
+		if (height == 1 || !radix_tree_is_indirect_ptr(node))
+			break;
+		node = indirect_to_ptr(node);
+
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
-	} while (height > 0);
+	}
 
 	if (nodep)
 		*nodep = parent;
@@ -597,13 +663,18 @@ void *radix_tree_tag_set(struct radix_tree_root *root,
 	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
 
 	while (height > 0) {
+		struct radix_tree_node *node = slot;
 		int offset;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		if (!tag_get(slot, tag, offset))
-			tag_set(slot, tag, offset);
-		slot = slot->slots[offset];
+		offset = canonical_offset(node,
+				(index >> shift) & RADIX_TREE_MAP_MASK);
+		if (!tag_get(node, tag, offset))
+			tag_set(node, tag, offset);
+		slot = node->slots[offset];
 		BUG_ON(slot == NULL);
+		if (!radix_tree_is_indirect_ptr(slot))
+			break;
+		slot = indirect_to_ptr(slot);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
@@ -650,9 +721,13 @@ void *radix_tree_tag_clear(struct radix_tree_root *root,
 			goto out;
 
 		shift -= RADIX_TREE_MAP_SHIFT;
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 		node = slot;
-		slot = slot->slots[offset];
+		offset = canonical_offset(node,
+				(index >> shift) & RADIX_TREE_MAP_MASK);
+		slot = node->slots[offset];
+		if (!radix_tree_is_indirect_ptr(slot))
+			break;
+		slot = indirect_to_ptr(slot);
 	}
 
 	if (slot == NULL)
@@ -665,8 +740,7 @@ void *radix_tree_tag_clear(struct radix_tree_root *root,
 		if (any_tag_set(node, tag))
 			goto out;
 
-		index >>= RADIX_TREE_MAP_SHIFT;
-		offset = index & RADIX_TREE_MAP_MASK;
+		offset = node->path >> RADIX_TREE_HEIGHT_SHIFT;
 		node = node->parent;
 	}
 
@@ -724,12 +798,17 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 		if (node == NULL)
 			return 0;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		offset = canonical_offset(node,
+				(index >> shift) & RADIX_TREE_MAP_MASK);
 		if (!tag_get(node, tag, offset))
 			return 0;
 		if (height == 1)
 			return 1;
 		node = rcu_dereference_raw(node->slots[offset]);
+		/* A tagged multi-order entry */
+		if (node && !radix_tree_is_indirect_ptr(node))
+			return 1;
+		node = indirect_to_ptr(node);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
@@ -750,6 +829,7 @@ void **radix_tree_next_chunk(struct radix_tree_root *root,
 	unsigned shift, tag = flags & RADIX_TREE_ITER_TAG_MASK;
 	struct radix_tree_node *rnode, *node;
 	unsigned long index, offset, height;
+	void *child;
 
 	if ((flags & RADIX_TREE_ITER_TAGGED) && !root_tag_get(root, tag))
 		return NULL;
@@ -775,6 +855,7 @@ void **radix_tree_next_chunk(struct radix_tree_root *root,
 		iter->index = 0;
 		iter->next_index = 1;
 		iter->tags = 1;
+		iter->shift = 0;
 		return (void **)&root->rnode;
 	} else
 		return NULL;
@@ -816,13 +897,45 @@ restart:
 				goto restart;
 		}
 
+		/* Started inside a multi-order entry: step back to its head */
+		if (!(flags & RADIX_TREE_ITER_TAGGED)) {
+			unsigned long canon = canonical_offset(node, offset);
+
+			index -= (offset - canon) << shift;
+			offset = canon;
+		}
+
 		/* This is leaf-node */
 		if (!shift)
 			break;
 
-		node = rcu_dereference_raw(node->slots[offset]);
-		if (node == NULL)
+		child = rcu_dereference_raw(node->slots[offset]);
+		if (child == NULL)
 			goto restart;
+		if (!radix_tree_is_indirect_ptr(child)) {
+			unsigned long n = 1;
+
+			/*
+			 * A multi-order entry above the leaves makes up a
+			 * chunk of its own: the canonical slot and its
+			 * siblings, which radix_tree_next_slot() skips.
+			 */
+			while (offset + n < RADIX_TREE_MAP_SIZE) {
+				void **s = node->slots + offset + n;
+
+				if (!radix_tree_is_sibling(s,
+						rcu_dereference_raw(*s)))
+					break;
+				n++;
+			}
+
+			iter->index = index & ~((1UL << shift) - 1);
+			iter->next_index = iter->index + (n << shift);
+			iter->shift = shift;
+			iter->tags = 1;
+			return node->slots + offset;
+		}
+		node = indirect_to_ptr(child);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 	}
@@ -830,6 +943,7 @@ restart:
 	/* Update the iterator state */
 	iter->index = index;
 	iter->next_index = (index | RADIX_TREE_MAP_MASK) + 1;
+	iter->shift = 0;
 
 	/* Construct iter->tags bit-mask from node->tags[tag] array */
 	if (flags & RADIX_TREE_ITER_TAGGED) {
@@ -919,20 +1033,20 @@ unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 			goto next;
 		if (!tag_get(slot, iftag, offset))
 			goto next;
-		if (shift) {
-			/* Go down one level */
+		/* Go down one level, unless this is a multi-order entry */
+		if (shift && radix_tree_is_indirect_ptr(slot->slots[offset])) {
 			shift -= RADIX_TREE_MAP_SHIFT;
 			node = slot;
-			slot = slot->slots[offset];
+			slot = indirect_to_ptr(slot->slots[offset]);
 			continue;
 		}
 
-		/* tag the leaf */
+		/* tag the entry */
 		tagged++;
 		tag_set(slot, settag, offset);
 
 		/* walk back up the path tagging interior nodes */
-		upindex = index;
+		upindex = index >> shift;
 		while (node) {
 			upindex >>= RADIX_TREE_MAP_SHIFT;
 			offset = upindex & RADIX_TREE_MAP_MASK;
@@ -969,6 +1083,9 @@ next:
 			 */
 			slot = slot->parent;
 			shift += RADIX_TREE_MAP_SHIFT;
+			/* keep node pointing at the parent of slot, if set */
+			if (node)
+				node = slot->parent;
 		}
 	}
 	/*
@@ -1158,6 +1275,7 @@ static unsigned long __locate(struct radix_tree_node *slot, void *item,
 {
 	unsigned int shift, height;
 	unsigned long i;
+	void *child;
 
 	height = slot->path & RADIX_TREE_HEIGHT_MASK;
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
@@ -1176,10 +1294,23 @@ static unsigned long __locate(struct radix_tree_node *slot, void *item,
 				goto out;
 		}
 
-		shift -= RADIX_TREE_MAP_SHIFT;
-		slot = rcu_dereference_raw(slot->slots[i]);
-		if (slot == NULL)
+		child = rcu_dereference_raw(slot->slots[i]);
+		if (child == NULL)
+			goto out;
+		if (!radix_tree_is_indirect_ptr(child) ||
+		    radix_tree_is_sibling(slot->slots + i, child)) {
+			/* A multi-order entry: check it and skip past it */
+			index &= ~((1UL << shift) - 1);
+			if (child == item) {
+				*found_index = index;
+				index = 0;
+			} else
+				index += 1UL << shift;
 			goto out;
+		}
+
+		shift -= RADIX_TREE_MAP_SHIFT;
+		slot = indirect_to_ptr(child);
 	}
 
 	/* Bottom level: check items */
@@ -1265,6 +1396,10 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 			break;
 		if (!to_free->slots[0])
 			break;
+		/* nor if it is a multi-order entry above the leaves */
+		if (root->height > 1 &&
+		    !radix_tree_is_indirect_ptr(to_free->slots[0]))
+			break;
 
 		/*
 		 * We don't need rcu_assign_pointer(), since we are simply
@@ -1275,8 +1410,9 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 		 */
 		slot = to_free->slots[0];
 		if (root->height > 1) {
-			slot->parent = NULL;
-			slot = ptr_to_indirect(slot);
+			struct radix_tree_node *child = indirect_to_ptr(slot);
+
+			child->parent = NULL;
 		}
 		root->rnode = slot;
 		root->height--;
@@ -1372,7 +1508,7 @@ void *radix_tree_delete_item(struct radix_tree_root *root,
 			     unsigned long index, void *item)
 {
 	struct radix_tree_node *node;
-	unsigned int offset;
+	unsigned int offset, i;
 	void **slot;
 	void *entry;
 	int tag;
@@ -1390,7 +1526,7 @@ void *radix_tree_delete_item(struct radix_tree_root *root,
 		return entry;
 	}
 
-	offset = index & RADIX_TREE_MAP_MASK;
+	offset = slot - node->slots;
 
 	/*
 	 * Clear all tags associated with the item to be deleted.
@@ -1401,6 +1537,12 @@ void *radix_tree_delete_item(struct radix_tree_root *root,
 			radix_tree_tag_clear(root, index, tag);
 	}
 
+	/* Siblings of a multi-order entry go first, then the entry itself */
+	for (i = offset + 1; i < RADIX_TREE_MAP_SIZE &&
+	     radix_tree_is_sibling(node->slots + i, node->slots[i]); i++) {
+		node->slots[i] = NULL;
+		node->count--;
+	}
 	node->slots[offset] = NULL;
 	node->count--;
 
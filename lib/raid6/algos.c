@@ -88,6 +88,9 @@ EXPORT_SYMBOL_GPL(raid6_2data_recov);
 void (*raid6_datap_recov)(int, size_t, int, void **);
 EXPORT_SYMBOL_GPL(raid6_datap_recov);
 
+const char *raid6_recov_name = "none";
+EXPORT_SYMBOL_GPL(raid6_recov_name);
+
 const struct raid6_recov_calls *const raid6_recov_algos[] = {
 #ifdef CONFIG_AS_AVX2
 	&raid6_recov_avx2,
@@ -120,6 +123,7 @@ static inline const struct raid6_recov_calls *raid6_choose_recov(void)
 	if (best) {
 		raid6_2data_recov = best->data2;
 		raid6_datap_recov = best->datap;
+		raid6_recov_name = best->name;
 
 		pr_info("raid6: using %s recovery algorithm\n", best->name);
 	} else
@@ -0,0 +1,88 @@
+/*
+ * IPv4 FIB lookup benchmark
+ *
+ * Looks up random destinations in a routing table of the initial network
+ * namespace and reports how many lookups per second it managed, e.g.
+ *
+ *	modprobe test_fib_lookup iterations=10000000 table=254
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/ktime.h>
+#include <net/net_namespace.h>
+#include <net/ip_fib.h>
+
+static unsigned int iterations = 1000000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "Number of lookups to run (default: 1000000)");
+
+static unsigned int table = RT_TABLE_MAIN;
+module_param(table, uint, 0444);
+MODULE_PARM_DESC(table, "Routing table to look up in (default: main)");
+
+/* Lookups are done in batches so the rcu read side stays short */
+#define TEST_FIB_BATCH	1024
+
+static int __init test_fib_lookup_init(void)
+{
+	unsigned int i, done = 0, hits = 0;
+	struct fib_result res;
+	struct fib_table *tb;
+	ktime_t start;
+	u64 ns;
+
+	/* tables of the initial namespace are never freed */
+	rcu_read_lock();
+	tb = fib_get_table(&init_net, table);
+	rcu_read_unlock();
+	if (!tb) {
+		pr_warn("no routing table %u\n", table);
+		return -ENOENT;
+	}
+
+	start = ktime_get();
+	while (done < iterations) {
+		unsigned int batch = min_t(unsigned int, iterations - done,
+					   TEST_FIB_BATCH);
+
+		rcu_read_lock();
+		for (i = 0; i < batch; i++) {
+			struct flowi4 fl4 = {
+				.daddr = (__force __be32)prandom_u32(),
+			};
+
+			if (!fib_table_lookup(tb, &fl4, &res, FIB_LOOKUP_NOREF))
+				hits++;
+		}
+		rcu_read_unlock();
+
+		done += batch;
+		cond_resched();
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("table %u: %u lookups, %u hits in %llu ns, %llu lookups/s\n",
+		table, done, hits, ns,
+		ns ? div64_u64((u64)done * NSEC_PER_SEC, ns) : 0);
+
+	return 0;
+}
+
+static void __exit test_fib_lookup_exit(void)
+{
+}
+
+module_init(test_fib_lookup_init);
+module_exit(test_fib_lookup_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,205 @@
+/*
+ * Multi-order radix tree entry test and benchmark
+ *
+ * Checks that multi-order entries can be looked up, tagged, iterated over
+ * and deleted through any index they cover, then times tagged gang lookups
+ * over a range filled with single-index entries against the same range
+ * filled with entries of the given order, e.g.
+ *
+ *	modprobe test_radix_tree nr_indices=1048576 order=9
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/radix-tree.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+
+static unsigned long nr_indices = 1UL << 20;
+module_param(nr_indices, ulong, 0444);
+MODULE_PARM_DESC(nr_indices, "Number of indices covered in the benchmark (default: 1048576)");
+
+static unsigned int order = 9;
+module_param(order, uint, 0444);
+MODULE_PARM_DESC(order, "Order of the multi-order entries in the benchmark (default: 9)");
+
+/* Gang lookups are done in batches so the rcu read side stays short */
+#define TEST_BATCH	64
+
+static RADIX_TREE(test_tree, GFP_KERNEL);
+
+/* Items encode their first index, exceptional entries need no memory */
+static void *test_item(unsigned long index)
+{
+	return (void *)((index << RADIX_TREE_EXCEPTIONAL_SHIFT) |
+			RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static unsigned long test_item_index(void *item)
+{
+	return (unsigned long)item >> RADIX_TREE_EXCEPTIONAL_SHIFT;
+}
+
+static int __init test_multiorder(unsigned long index, unsigned int ord)
+{
+	unsigned long size = 1UL << ord, i;
+	void *item = test_item(index);
+	struct radix_tree_iter iter;
+	unsigned int found = 0;
+	void **slot;
+	int err;
+
+	err = __radix_tree_insert(&test_tree, index, ord, item);
+	if (err) {
+		pr_warn("order %u: insert at %lu failed: %d\n",
+			ord, index, err);
+		return err;
+	}
+
+	err = -EINVAL;
+	if (radix_tree_insert(&test_tree, index + size - 1, item) != -EEXIST) {
+		pr_warn("order %u: overlapping insert succeeded\n", ord);
+		goto out;
+	}
+
+	for (i = 0; i < size; i++) {
+		if (radix_tree_lookup(&test_tree, index + i) != item) {
+			pr_warn("order %u: lookup at %lu failed\n", ord,
+				index + i);
+			goto out;
+		}
+	}
+	if ((index && radix_tree_lookup(&test_tree, index - 1)) ||
+	    radix_tree_lookup(&test_tree, index + size)) {
+		pr_warn("order %u: entry leaks out of its range\n", ord);
+		goto out;
+	}
+
+	radix_tree_tag_set(&test_tree, index + size - 1, 0);
+	if (!radix_tree_tag_get(&test_tree, index, 0)) {
+		pr_warn("order %u: tag not visible at %lu\n", ord, index);
+		goto out;
+	}
+
+	rcu_read_lock();
+	radix_tree_for_each_tagged(slot, &test_tree, &iter, 0, 0) {
+		if (radix_tree_deref_slot(slot) != item ||
+		    iter.index != index ||
+		    radix_tree_iter_span(slot, &iter) != size)
+			break;
+		found++;
+	}
+	rcu_read_unlock();
+	if (found != 1) {
+		pr_warn("order %u: tagged iteration found %u entries\n", ord,
+			found);
+		goto out;
+	}
+
+	if (radix_tree_delete(&test_tree, index + size / 2) != item ||
+	    radix_tree_lookup(&test_tree, index) ||
+	    radix_tree_tagged(&test_tree, 0)) {
+		pr_warn("order %u: delete through a sibling failed\n", ord);
+		goto out;
+	}
+
+	return 0;
+
+out:
+	radix_tree_delete(&test_tree, index);
+	return err;
+}
+
+static int __init bench_tagged_lookup(unsigned int ord)
+{
+	unsigned long size = 1UL << ord, index, found = 0;
+	void **slots[TEST_BATCH];
+	u64 insert_ns, lookup_ns;
+	unsigned int n;
+	ktime_t start;
+	int err = 0;
+
+	start = ktime_get();
+	for (index = 0; index < nr_indices; index += size) {
+		err = __radix_tree_insert(&test_tree, index, ord,
+					  test_item(index));
+		if (err)
+			break;
+		radix_tree_tag_set(&test_tree, index, 0);
+		cond_resched();
+	}
+	insert_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (err) {
+		pr_warn("order %u: insert at %lu failed: %d\n",
+			ord, index, err);
+		goto out;
+	}
+
+	start = ktime_get();
+	index = 0;
+	do {
+		rcu_read_lock();
+		n = radix_tree_gang_lookup_tag_slot(&test_tree, slots, index,
+						    TEST_BATCH, 0);
+		if (n)
+			index = test_item_index(radix_tree_deref_slot(
+							slots[n - 1])) + size;
+		rcu_read_unlock();
+
+		found += n;
+		cond_resched();
+	} while (n == TEST_BATCH && index);
+	lookup_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("order %u: %lu entries over %lu indices, insert+tag %llu ns, tagged lookup %llu ns\n",
+		ord, found, nr_indices, insert_ns, lookup_ns);
+
+out:
+	for (index = 0; index < nr_indices; index += size) {
+		radix_tree_delete(&test_tree, index);
+		cond_resched();
+	}
+
+	return err;
+}
+
+static int __init test_radix_tree_init(void)
+{
+	unsigned int ord;
+	int err;
+
+	for (ord = 0; ord <= 2 * RADIX_TREE_MAP_SHIFT + 1; ord++) {
+		err = test_multiorder(0, ord);
+		if (!err)
+			err = test_multiorder(5UL << ord, ord);
+		if (err)
+			return err;
+	}
+	pr_info("multi-order entries: all tests passed\n");
+
+	if (order >= BITS_PER_LONG - RADIX_TREE_EXCEPTIONAL_SHIFT)
+		return -EINVAL;
+
+	err = bench_tagged_lookup(0);
+	if (!err && order)
+		err = bench_tagged_lookup(order);
+
+	return err;
+}
+
+static void __exit test_radix_tree_exit(void)
+{
+}
+
+module_init(test_radix_tree_init);
+module_exit(test_radix_tree_exit);
+
+MODULE_LICENSE("GPL");
@@ -18,13 +18,19 @@
  * Self Test
  **************************************************************************/
 
+#include <linux/delay.h>
 #include <linux/init.h>
 #include <linux/jhash.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/rcupdate.h>
 #include <linux/rhashtable.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 
 
 #define TEST_HT_SIZE	8
@@ -32,6 +38,14 @@
 #define TEST_PTR	((void *) 0xdeadbeef)
 #define TEST_NEXPANDS	4
 
+static int tcount;
+module_param(tcount, int, 0);
+MODULE_PARM_DESC(tcount, "Number of threads for the scaling benchmark (default: 0, skip)");
+
+static int bench_entries = 100000;
+module_param(bench_entries, int, 0);
+MODULE_PARM_DESC(bench_entries, "Number of entries inserted by each benchmark thread (default: 100000)");
+
 struct test_obj {
 	void			*ptr;
 	int			value;
@@ -107,7 +121,7 @@ static void test_bucket_stats(struct rhashtable *ht, bool quiet)
 
 		if (!quiet)
 			pr_cont("\n  [%#x] first element: %p, chain length: %u\n",
-				i, tbl->buckets[i], cnt);
+				i, rcu_dereference(*rht_bucket(tbl, i)), cnt);
 	}
 
 	pr_info("  Traversal complete: counted=%u, nelems=%u, entries=%d\n",
@@ -182,6 +196,175 @@ error:
 
 static struct rhashtable ht;
 
+/*
+ * Scaling benchmark:
+ * tcount threads each insert, look up and remove bench_entries keys of
+ * their own concurrently, starting from a tiny table so that the run
+ * also covers growing through the resize path under contention.
+ */
+struct bench_thread {
+	int			id;
+	struct task_struct	*task;
+	struct test_obj		*objs;
+	u64			insert_ns;
+	u64			lookup_ns;
+	int			err;
+};
+
+static atomic_t bench_startup;
+static DECLARE_WAIT_QUEUE_HEAD(bench_wait);
+
+static int bench_insert(struct bench_thread *bt)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < bench_entries; i++) {
+		struct test_obj *obj = &bt->objs[i];
+
+		obj->ptr = TEST_PTR;
+		obj->value = bt->id * bench_entries + i;
+retry:
+		err = rhashtable_insert_fast(&ht, &obj->node, test_rht_params);
+		if (err == -EBUSY || err == -ENOMEM) {
+			/* Resize in progress or atomic allocation failed,
+			 * let the deferred worker catch up.
+			 */
+			msleep(1);
+			goto retry;
+		}
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static int bench_lookup(struct bench_thread *bt)
+{
+	unsigned int i;
+
+	for (i = 0; i < bench_entries; i++) {
+		u32 key = bt->id * bench_entries + i;
+
+		if (rhashtable_lookup_fast(&ht, &key, test_rht_params) !=
+		    &bt->objs[i]) {
+			pr_warn("Test failed: thread %d could not find key %u\n",
+				bt->id, key);
+			return -ENOENT;
+		}
+	}
+
+	return 0;
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *bt = data;
+	unsigned int i;
+	u64 start;
+
+	if (atomic_dec_and_test(&bench_startup))
+		wake_up(&bench_wait);
+	if (wait_event_interruptible(bench_wait,
+				     atomic_read(&bench_startup) == -1)) {
+		bt->err = -EINTR;
+		goto out;
+	}
+
+	start = ktime_get_ns();
+	bt->err = bench_insert(bt);
+	bt->insert_ns = ktime_get_ns() - start;
+	if (bt->err)
+		goto out;
+
+	start = ktime_get_ns();
+	bt->err = bench_lookup(bt);
+	bt->lookup_ns = ktime_get_ns() - start;
+
+out:
+	for (i = 0; i < bench_entries; i++)
+		rhashtable_remove_fast(&ht, &bt->objs[i].node,
+				       test_rht_params);
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule();
+	}
+
+	return 0;
+}
+
+static int __init test_rht_bench(void)
+{
+	struct bench_thread *bts;
+	u64 insert_ns = 0, lookup_ns = 0;
+	int i, started = 0, err = 0;
+
+	pr_info("  Benchmarking %d threads x %d keys\n", tcount,
+		bench_entries);
+
+	bts = kcalloc(tcount, sizeof(*bts), GFP_KERNEL);
+	if (!bts)
+		return -ENOMEM;
+
+	err = rhashtable_init(&ht, &test_rht_params);
+	if (err < 0)
+		goto out_free;
+
+	atomic_set(&bench_startup, tcount);
+	for (i = 0; i < tcount; i++) {
+		bts[i].id = i;
+		bts[i].objs = vzalloc(bench_entries * sizeof(*bts[i].objs));
+		if (!bts[i].objs) {
+			err = -ENOMEM;
+			break;
+		}
+
+		bts[i].task = kthread_run(bench_thread_fn, &bts[i],
+					  "rhashtable_bench[%d]", i);
+		if (IS_ERR(bts[i].task)) {
+			err = PTR_ERR(bts[i].task);
+			bts[i].task = NULL;
+			break;
+		}
+		started++;
+	}
+
+	/* Account for threads that were never started, then release
+	 * everybody at once.
+	 */
+	if (started < tcount &&
+	    atomic_sub_and_test(tcount - started, &bench_startup))
+		wake_up(&bench_wait);
+	wait_event(bench_wait, atomic_read(&bench_startup) == 0);
+	atomic_dec(&bench_startup);
+	wake_up_all(&bench_wait);
+
+	for (i = 0; i < started; i++) {
+		kthread_stop(bts[i].task);
+		if (bts[i].err && !err)
+			err = bts[i].err;
+		insert_ns = max(insert_ns, bts[i].insert_ns);
+		lookup_ns = max(lookup_ns, bts[i].lookup_ns);
+	}
+
+	if (!err && started)
+		pr_info("  %d threads: insert %llu ns, lookup %llu ns (%llu / %llu ns per key and thread)\n",
+			started, insert_ns, lookup_ns,
+			div_u64(insert_ns, bench_entries),
+			div_u64(lookup_ns, bench_entries));
+
+	rhashtable_destroy(&ht);
+
+out_free:
+	for (i = 0; i < tcount; i++)
+		vfree(bts[i].objs);
+	kfree(bts);
+
+	return err;
+}
+
 static int __init test_rht_init(void)
 {
 	int err;
@@ -199,6 +382,9 @@ static int __init test_rht_init(void)
 
 	rhashtable_destroy(&ht);
 
+	if (!err && tcount > 0 && bench_entries > 0)
+		err = test_rht_bench();
+
 	return err;
 }
 
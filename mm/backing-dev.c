@@ -97,6 +97,23 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   nr_more_io,
 		   nr_dirty_time,
 		   !list_empty(&bdi->bdi_list), bdi->state);
+
+	if (bdi->wb_stats) {
+		struct bdi_wb_worker_stats *stats;
+		unsigned long ms;
+		int i;
+
+		for (i = 0; i < BDI_MAX_WB_WORKERS; i++) {
+			stats = &bdi->wb_stats[i];
+			if (!stats->runs)
+				continue;
+			ms = div_u64(stats->busy_ns, NSEC_PER_MSEC);
+			seq_printf(m, "worker%-2d: runs %lu written %lu kB "
+				   "busy %lu ms rate %lu kBps\n", i,
+				   stats->runs, K(stats->pages), ms,
+				   ms ? K(stats->pages) * 1000 / ms : 0);
+		}
+	}
 #undef K
 
 	return 0;
@@ -208,6 +225,42 @@ static ssize_t max_ratio_store(struct device *dev,
 }
 BDI_SHOW(max_ratio, bdi->max_ratio)
 
+static ssize_t writeback_workers_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct backing_dev_info *bdi = dev_get_drvdata(dev);
+	unsigned int nr;
+	ssize_t ret;
+
+	ret = kstrtouint(buf, 10, &nr);
+	if (ret < 0)
+		return ret;
+
+	ret = bdi_set_wb_workers(bdi, nr);
+	if (!ret)
+		ret = count;
+
+	return ret;
+}
+BDI_SHOW(writeback_workers, bdi->wb_workers)
+
+static ssize_t writeback_inode_chunk_kb_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct backing_dev_info *bdi = dev_get_drvdata(dev);
+	unsigned long chunk_kb;
+	ssize_t ret;
+
+	ret = kstrtoul(buf, 10, &chunk_kb);
+	if (ret < 0)
+		return ret;
+
+	bdi->wb_inode_chunk = chunk_kb >> (PAGE_SHIFT - 10);
+
+	return count;
+}
+BDI_SHOW(writeback_inode_chunk_kb, K(bdi->wb_inode_chunk))
+
 static ssize_t stable_pages_required_show(struct device *dev,
 					  struct device_attribute *attr,
 					  char *page)
@@ -223,6 +276,8 @@ static struct attribute *bdi_dev_attrs[] = {
 	&dev_attr_read_ahead_kb.attr,
 	&dev_attr_min_ratio.attr,
 	&dev_attr_max_ratio.attr,
+	&dev_attr_writeback_workers.attr,
+	&dev_attr_writeback_inode_chunk_kb.attr,
 	&dev_attr_stable_pages_required.attr,
 	NULL,
 };
@@ -390,6 +445,10 @@ int bdi_init(struct backing_dev_info *bdi)
 	spin_lock_init(&bdi->wb_lock);
 	INIT_LIST_HEAD(&bdi->bdi_list);
 	INIT_LIST_HEAD(&bdi->work_list);
+	bdi->wb_workers = 1;
+	bdi->wb_inode_chunk = 0;
+	bdi->wb_helpers = NULL;
+	bdi->wb_stats = NULL;
 
 	bdi_wb_init(&bdi->wb, bdi);
 
@@ -430,6 +489,7 @@ void bdi_destroy(struct backing_dev_info *bdi)
 
 	WARN_ON(!list_empty(&bdi->work_list));
 	WARN_ON(delayed_work_pending(&bdi->wb.dwork));
+	bdi_free_wb_workers(bdi);
 
 	if (bdi->dev) {
 		bdi_debug_unregister(bdi);
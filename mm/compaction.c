@@ -15,8 +15,11 @@
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
 #include <linux/balloon_compaction.h>
+#include <linux/zsmalloc.h>
 #include <linux/page-isolation.h>
 #include <linux/kasan.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 #ifdef CONFIG_COMPACTION
@@ -511,6 +514,7 @@ isolate_fail:
 	if (blockpfn == end_pfn)
 		update_pageblock_skip(cc, valid_page, total_isolated, false);
 
+	cc->total_free_scanned += nr_scanned;
 	count_compact_events(COMPACTFREE_SCANNED, nr_scanned);
 	if (total_isolated)
 		count_compact_events(COMPACTISOLATED, total_isolated);
@@ -622,6 +626,42 @@ static bool too_many_isolated(struct zone *zone)
 	return isolated > (inactive + active) / 2;
 }
 
+#ifdef CONFIG_ZSMALLOC_MIGRATION
+/*
+ * zsmalloc chains the pages of a zspage through page->lru, so isolated
+ * zsmalloc pages are collected in cc->zspages rather than on
+ * cc->migratepages, and moved by migrate_zspages().
+ */
+static bool isolate_zspage(struct compact_control *cc, struct page *page,
+			   isolate_mode_t isolate_mode)
+{
+	if (!(isolate_mode & ISOLATE_ZSMALLOC) || !PageZsmalloc(page))
+		return false;
+
+	if (cc->nr_zspages == COMPACT_CLUSTER_MAX || !zs_page_isolate(page))
+		return false;
+
+	cc->zspages[cc->nr_zspages++] = page;
+	return true;
+}
+
+static inline unsigned int compact_nr_zspages(struct compact_control *cc)
+{
+	return cc->nr_zspages;
+}
+#else
+static inline bool isolate_zspage(struct compact_control *cc,
+				  struct page *page, isolate_mode_t isolate_mode)
+{
+	return false;
+}
+
+static inline unsigned int compact_nr_zspages(struct compact_control *cc)
+{
+	return 0;
+}
+#endif
+
 /**
  * isolate_migratepages_block() - isolate all migrate-able pages within
  *				  a single pageblock
@@ -724,6 +764,14 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 					goto isolate_success;
 				}
 			}
+			if (isolate_zspage(cc, page, isolate_mode)) {
+				nr_isolated++;
+				if (compact_nr_zspages(cc) ==
+						COMPACT_CLUSTER_MAX) {
+					++low_pfn;
+					break;
+				}
+			}
 			continue;
 		}
 
@@ -815,6 +863,7 @@ isolate_success:
 	trace_mm_compaction_isolate_migratepages(start_pfn, low_pfn,
 						nr_scanned, nr_isolated);
 
+	cc->total_migrate_scanned += nr_scanned;
 	count_compact_events(COMPACTMIGRATE_SCANNED, nr_scanned);
 	if (nr_isolated)
 		count_compact_events(COMPACTISOLATED, nr_isolated);
@@ -867,6 +916,79 @@ isolate_migratepages_range(struct compact_control *cc, unsigned long start_pfn,
 #endif /* CONFIG_COMPACTION || CONFIG_CMA */
 #ifdef CONFIG_COMPACTION
 
+/*
+ * Fragmentation is measured against the order the huge pages of this
+ * system come in, which is what proactive compaction tries to make
+ * available.
+ */
+#if defined CONFIG_TRANSPARENT_HUGEPAGE
+#define COMPACTION_HPAGE_ORDER	HPAGE_PMD_ORDER
+#elif defined CONFIG_HUGETLB_PAGE
+#define COMPACTION_HPAGE_ORDER	HUGETLB_PAGE_ORDER
+#else
+#define COMPACTION_HPAGE_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+#endif
+
+/*
+ * How much kcompactd works to keep huge pages available, 0 to 100.
+ * Zero disables proactive compaction.
+ */
+int sysctl_compaction_proactiveness = 20;
+
+static inline bool kswapd_is_running(pg_data_t *pgdat)
+{
+	return pgdat->kswapd && (pgdat->kswapd->state == TASK_RUNNING);
+}
+
+/*
+ * A zone's fragmentation score is the external fragmentation wrt to the
+ * COMPACTION_HPAGE_ORDER, in the range [0, 100].
+ */
+static unsigned int fragmentation_score_zone(struct zone *zone)
+{
+	return extfrag_for_order(zone, COMPACTION_HPAGE_ORDER);
+}
+
+/*
+ * The node's score is the zones' scores weighted by their size, so a
+ * fragmented but tiny ZONE_DMA does not keep kcompactd busy.
+ */
+static unsigned int fragmentation_score_node(pg_data_t *pgdat)
+{
+	unsigned long score = 0;
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+		score += zone->present_pages * fragmentation_score_zone(zone);
+	}
+
+	return div64_ul(score, pgdat->node_present_pages + 1);
+}
+
+/*
+ * Proactive compaction starts when the node score goes above the high
+ * mark and stops once each zone is below the low mark.
+ */
+static unsigned int fragmentation_score_wmark(bool low)
+{
+	unsigned int wmark_low;
+
+	wmark_low = max(100U - sysctl_compaction_proactiveness, 5U);
+	return low ? wmark_low : min(wmark_low + 10, 100U);
+}
+
+static bool should_proactive_compact_node(pg_data_t *pgdat)
+{
+	if (!sysctl_compaction_proactiveness || kswapd_is_running(pgdat))
+		return false;
+
+	return fragmentation_score_node(pgdat) > fragmentation_score_wmark(false);
+}
+
 /* Returns true if the page is within a block suitable for migration to */
 static bool suitable_migration_target(struct page *page)
 {
@@ -1032,6 +1154,46 @@ static void compaction_free(struct page *page, unsigned long data)
 	cc->nr_freepages++;
 }
 
+#ifdef CONFIG_ZSMALLOC_MIGRATION
+/* zsmalloc moves the page itself, it only needs a free page to move to */
+static void migrate_zspages(struct compact_control *cc)
+{
+	struct page *page, *newpage;
+	unsigned int i;
+
+	for (i = 0; i < cc->nr_zspages; i++) {
+		page = cc->zspages[i];
+		newpage = compaction_alloc(page, (unsigned long)cc, NULL);
+		if (newpage && !zs_page_migrate(newpage, page)) {
+			count_vm_event(PGMIGRATE_SUCCESS);
+		} else {
+			if (newpage)
+				compaction_free(newpage, (unsigned long)cc);
+			count_vm_event(PGMIGRATE_FAIL);
+		}
+		zs_page_putback(page);
+	}
+	cc->nr_zspages = 0;
+}
+
+static void putback_zspages(struct compact_control *cc)
+{
+	unsigned int i;
+
+	for (i = 0; i < cc->nr_zspages; i++)
+		zs_page_putback(cc->zspages[i]);
+	cc->nr_zspages = 0;
+}
+#else
+static inline void migrate_zspages(struct compact_control *cc)
+{
+}
+
+static inline void putback_zspages(struct compact_control *cc)
+{
+}
+#endif
+
 /* possible outcome of isolate_migratepages */
 typedef enum {
 	ISOLATE_ABORT,		/* Abort compaction now */
@@ -1057,7 +1219,8 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 	struct page *page;
 	const isolate_mode_t isolate_mode =
 		(sysctl_compact_unevictable_allowed ? ISOLATE_UNEVICTABLE : 0) |
-		(cc->mode == MIGRATE_ASYNC ? ISOLATE_ASYNC_MIGRATE : 0);
+		(cc->mode == MIGRATE_ASYNC ? ISOLATE_ASYNC_MIGRATE : 0) |
+		(IS_ENABLED(CONFIG_ZSMALLOC_MIGRATION) ? ISOLATE_ZSMALLOC : 0);
 
 	/*
 	 * Start at where we last stopped, or beginning of the zone as
@@ -1126,7 +1289,8 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 	 */
 	cc->migrate_pfn = (end_pfn <= cc->free_pfn) ? low_pfn : cc->free_pfn;
 
-	return cc->nr_migratepages ? ISOLATE_SUCCESS : ISOLATE_NONE;
+	return cc->nr_migratepages || compact_nr_zspages(cc) ?
+		ISOLATE_SUCCESS : ISOLATE_NONE;
 }
 
 static int __compact_finished(struct zone *zone, struct compact_control *cc,
@@ -1157,6 +1321,16 @@ static int __compact_finished(struct zone *zone, struct compact_control *cc,
 		return COMPACT_COMPLETE;
 	}
 
+	if (cc->proactive_compaction) {
+		/* Leave the memory to kswapd when it is reclaiming */
+		if (kswapd_is_running(zone->zone_pgdat))
+			return COMPACT_PARTIAL;
+		if (fragmentation_score_zone(zone) >
+		    fragmentation_score_wmark(true))
+			return COMPACT_CONTINUE;
+		return COMPACT_PARTIAL;
+	}
+
 	/*
 	 * order == -1 is expected when compacting via
 	 * /proc/sys/vm/compact_memory
@@ -1341,6 +1515,7 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 			ret = COMPACT_PARTIAL;
 			putback_movable_pages(&cc->migratepages);
 			cc->nr_migratepages = 0;
+			putback_zspages(cc);
 			goto out;
 		case ISOLATE_NONE:
 			/*
@@ -1353,6 +1528,8 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 			;
 		}
 
+		migrate_zspages(cc);
+
 		err = migrate_pages(&cc->migratepages, compaction_alloc,
 				compaction_free, (unsigned long)cc, cc->mode,
 				MR_COMPACTION);
@@ -1620,19 +1797,6 @@ static void __compact_pgdat(pg_data_t *pgdat, struct compact_control *cc)
 	}
 }
 
-void compact_pgdat(pg_data_t *pgdat, int order)
-{
-	struct compact_control cc = {
-		.order = order,
-		.mode = MIGRATE_ASYNC,
-	};
-
-	if (!order)
-		return;
-
-	__compact_pgdat(pgdat, &cc);
-}
-
 static void compact_node(int nid)
 {
 	struct compact_control cc = {
@@ -1706,4 +1870,275 @@ void compaction_unregister_node(struct node *node)
 }
 #endif /* CONFIG_SYSFS && CONFIG_NUMA */
 
+/* How often kcompactd checks whether proactive compaction is due */
+#define KCOMPACTD_FRAG_CHECK_INTERVAL_MSEC	500
+
+static inline bool kcompactd_work_requested(pg_data_t *pgdat)
+{
+	return pgdat->kcompactd_max_order > 0 || kthread_should_stop();
+}
+
+static bool kcompactd_node_suitable(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	enum zone_type classzone_idx = pgdat->kcompactd_classzone_idx;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_suitable(zone, pgdat->kcompactd_max_order, 0,
+					classzone_idx) == COMPACT_CONTINUE)
+			return true;
+	}
+
+	return false;
+}
+
+static void kcompactd_compact_zone(struct zone *zone,
+				   struct compact_control *cc)
+{
+	cc->nr_freepages = 0;
+	cc->nr_migratepages = 0;
+	cc->total_migrate_scanned = 0;
+	cc->total_free_scanned = 0;
+	cc->zone = zone;
+	INIT_LIST_HEAD(&cc->freepages);
+	INIT_LIST_HEAD(&cc->migratepages);
+
+	compact_zone(zone, cc);
+
+	count_compact_events(KCOMPACTD_MIGRATE_SCANNED,
+			     cc->total_migrate_scanned);
+	count_compact_events(KCOMPACTD_FREE_SCANNED, cc->total_free_scanned);
+
+	VM_BUG_ON(!list_empty(&cc->freepages));
+	VM_BUG_ON(!list_empty(&cc->migratepages));
+}
+
+/*
+ * Compact the zones of a node up to the requested classzone for the
+ * highest order an allocation was woken up for.
+ */
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	struct compact_control cc = {
+		.order = pgdat->kcompactd_max_order,
+		.classzone_idx = pgdat->kcompactd_classzone_idx,
+		.mode = MIGRATE_SYNC_LIGHT,
+		.ignore_skip_hint = true,
+		.gfp_mask = GFP_KERNEL,
+	};
+
+	count_compact_event(KCOMPACTD_WAKE);
+
+	for (zoneid = 0; zoneid <= cc.classzone_idx; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_deferred(zone, cc.order))
+			continue;
+
+		if (compaction_suitable(zone, cc.order, 0, zoneid) !=
+							COMPACT_CONTINUE)
+			continue;
+
+		if (kthread_should_stop())
+			return;
+
+		kcompactd_compact_zone(zone, &cc);
+
+		if (zone_watermark_ok(zone, cc.order, low_wmark_pages(zone),
+				      cc.classzone_idx, 0))
+			compaction_defer_reset(zone, cc.order, false);
+		else
+			defer_compaction(zone, cc.order);
+	}
+
+	/*
+	 * Regardless of success, we are done until woken up next. But remember
+	 * the requested order/classzone_idx in case it was higher/tighter than
+	 * our current ones
+	 */
+	if (pgdat->kcompactd_max_order <= cc.order)
+		pgdat->kcompactd_max_order = 0;
+	if (pgdat->kcompactd_classzone_idx >= cc.classzone_idx)
+		pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+}
+
+/*
+ * Compact the whole node until its fragmentation score drops below the
+ * low mark, without waiting for an allocation to ask for it.
+ */
+static void proactive_compact_node(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	struct compact_control cc = {
+		.order = -1,
+		.mode = MIGRATE_SYNC_LIGHT,
+		.ignore_skip_hint = true,
+		.gfp_mask = GFP_KERNEL,
+		.proactive_compaction = true,
+	};
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (kthread_should_stop())
+			return;
+
+		kcompactd_compact_zone(zone, &cc);
+	}
+}
+
+void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	if (!order)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	if (!kcompactd_node_suitable(pgdat))
+		return;
+
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * The background compaction daemon, started as a kernel thread
+ * from the init process.
+ */
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = (pg_data_t *)p;
+	struct task_struct *tsk = current;
+	const long default_timeout =
+		msecs_to_jiffies(KCOMPACTD_FRAG_CHECK_INTERVAL_MSEC);
+	long timeout = default_timeout;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(tsk, cpumask);
+
+	set_freezable();
+
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	while (!kthread_should_stop()) {
+		unsigned int prev_score, score;
+
+		if (wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kcompactd_work_requested(pgdat), timeout)) {
+			if (kthread_should_stop())
+				break;
+			kcompactd_do_work(pgdat);
+			timeout = default_timeout;
+			continue;
+		}
+
+		/* Timed out: see whether the node needs proactive compaction */
+		timeout = default_timeout;
+		if (!should_proactive_compact_node(pgdat))
+			continue;
+
+		prev_score = fragmentation_score_node(pgdat);
+		proactive_compact_node(pgdat);
+		score = fragmentation_score_node(pgdat);
+		/* Back off if compaction could not make progress */
+		if (unlikely(score >= prev_score))
+			timeout = default_timeout << COMPACT_MAX_DEFER_SHIFT;
+	}
+
+	return 0;
+}
+
+/*
+ * This kcompactd start function will be called by init and node-hot-add.
+ * On node-hot-add, kcompactd will moved to proper cpus if cpus are hot-added.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		pr_err("Failed to start kcompactd on node %d\n", nid);
+		ret = PTR_ERR(pgdat->kcompactd);
+		pgdat->kcompactd = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined. Caller must
+ * hold mem_hotplug_begin/end().
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+/*
+ * It's optimal to keep kcompactd on the same CPUs as their memory, but
+ * not required for correctness. So if the last cpu in a node goes
+ * away, we get changed to run anywhere: as the first one comes back,
+ * restore their cpu bindings.
+ */
+static int cpu_callback(struct notifier_block *nfb, unsigned long action,
+			void *hcpu)
+{
+	int nid;
+
+	if (action == CPU_ONLINE || action == CPU_ONLINE_FROZEN) {
+		for_each_node_state(nid, N_MEMORY) {
+			pg_data_t *pgdat = NODE_DATA(nid);
+			const struct cpumask *mask;
+
+			mask = cpumask_of_node(pgdat->node_id);
+
+			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
+				/* One of our CPUs online: restore mask */
+				set_cpus_allowed_ptr(pgdat->kcompactd, mask);
+		}
+	}
+	return NOTIFY_OK;
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_MEMORY)
+		kcompactd_run(nid);
+	hotcpu_notifier(cpu_callback, 0);
+	return 0;
+}
+subsys_initcall(kcompactd_init)
+
 #endif /* CONFIG_COMPACTION */
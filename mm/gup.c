@@ -66,7 +66,8 @@ retry:
 	}
 	if ((flags & FOLL_NUMA) && pte_protnone(pte))
 		goto no_page;
-	if ((flags & FOLL_WRITE) && !pte_write(pte)) {
+	if ((flags & FOLL_WRITE) &&
+	    (!pte_write(pte) || pmd_shared_pte_table(*pmd))) {
 		pte_unmap_unlock(ptep, ptl);
 		return NULL;
 	}
@@ -1079,6 +1080,10 @@ static int gup_huge_pmd(pmd_t orig, pmd_t *pmdp, unsigned long addr,
 	if (write && !pmd_write(orig))
 		return 0;
 
+	/* DAX maps memory without struct pages with huge PMDs */
+	if (!pfn_valid(pmd_pfn(orig)))
+		return 0;
+
 	refs = 0;
 	head = pmd_page(orig);
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
@@ -23,6 +23,9 @@
 #include <linux/pagemap.h>
 #include <linux/migrate.h>
 #include <linux/hashtable.h>
+#include <linux/userfaultfd_k.h>
+#include <linux/dax.h>
+#include <linux/page_idle.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -49,12 +52,11 @@ unsigned long transparent_hugepage_flags __read_mostly =
 
 /* default scan 8*512 pte (or vmas) every 30 second */
 static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR*8;
-static unsigned int khugepaged_pages_collapsed;
+static atomic_t khugepaged_pages_collapsed;
 static unsigned int khugepaged_full_scans;
 static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
 /* during fragmentation poll the hugepage allocator once every minute */
 static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
-static struct task_struct *khugepaged_thread __read_mostly;
 static DEFINE_MUTEX(khugepaged_mutex);
 static DEFINE_SPINLOCK(khugepaged_mm_lock);
 static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
@@ -65,7 +67,7 @@ static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
  */
 static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
 
-static int khugepaged(void *none);
+static int khugepaged(void *p);
 static int khugepaged_slab_init(void);
 static void khugepaged_slab_exit(void);
 
@@ -78,31 +80,60 @@ static struct kmem_cache *mm_slot_cache __read_mostly;
  * struct mm_slot - hash lookup from mm to mm_slot
  * @hash: hash collision list
  * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @prio_node: priority list headed in khugepaged_scan.prio_head
  * @mm: the mm that this information is valid for
+ * @worker: the khugepaged worker scanning this mm, if any
+ * @address: the next address inside the mm to be scanned
+ * @full_scans: khugepaged_full_scans when the mm was last handed to a worker
  */
 struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
+	struct list_head prio_node;
 	struct mm_struct *mm;
+	struct khugepaged_worker *worker;
+	unsigned long address;
+	unsigned int full_scans;
 };
 
 /**
  * struct khugepaged_scan - cursor for scanning
  * @mm_head: the head of the mm list to scan
- * @mm_slot: the current mm_slot we are scanning
- * @address: the next address inside that to be scanned
+ * @prio_head: the mms of @mm_head with a collapse priority
+ * @mm_slot: the next mm_slot of @mm_head to hand to a worker
  *
  * There is only the one khugepaged_scan instance of this cursor structure.
  */
 struct khugepaged_scan {
 	struct list_head mm_head;
+	struct list_head prio_head;
 	struct mm_slot *mm_slot;
-	unsigned long address;
 };
 static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+	.prio_head = LIST_HEAD_INIT(khugepaged_scan.prio_head),
 };
 
+/**
+ * struct khugepaged_worker - one khugepaged thread
+ * @task: the thread
+ * @nid: the node whose cpus it runs on
+ * @mm_slot: the mm it is scanning, kept until it reaches the end
+ * @node_load: where the pages of the range being scanned live
+ * @last_target_node: node of the previous collapse, to spread ties
+ *
+ * There is a worker for each node with memory, all walking the same
+ * mm list, so that the scan rate of a big machine grows with its size.
+ */
+struct khugepaged_worker {
+	struct task_struct *task;
+	int nid;
+	struct mm_slot *mm_slot;
+	int node_load[MAX_NUMNODES];
+	int last_target_node;
+};
+static struct khugepaged_worker *khugepaged_workers[MAX_NUMNODES];
+
 
 static int set_recommended_min_free_kbytes(void)
 {
@@ -142,27 +173,60 @@ static int set_recommended_min_free_kbytes(void)
 	return 0;
 }
 
+static int khugepaged_run_worker(int nid)
+{
+	struct khugepaged_worker *worker = khugepaged_workers[nid];
+	int err;
+
+	if (worker)
+		return 0;
+
+	worker = kzalloc_node(sizeof(*worker), GFP_KERNEL, nid);
+	if (!worker)
+		return -ENOMEM;
+	worker->nid = nid;
+	worker->last_target_node = NUMA_NO_NODE;
+
+	worker->task = kthread_run(khugepaged, worker, "khugepaged%d", nid);
+	if (IS_ERR(worker->task)) {
+		pr_err("khugepaged: kthread_run(khugepaged%d) failed\n", nid);
+		err = PTR_ERR(worker->task);
+		kfree(worker);
+		return err;
+	}
+	khugepaged_workers[nid] = worker;
+	return 0;
+}
+
+static void khugepaged_stop_worker(int nid)
+{
+	struct khugepaged_worker *worker = khugepaged_workers[nid];
+
+	if (!worker)
+		return;
+	kthread_stop(worker->task);
+	khugepaged_workers[nid] = NULL;
+	kfree(worker);
+}
+
 static int start_stop_khugepaged(void)
 {
-	int err = 0;
+	int nid, err = 0;
+
 	if (khugepaged_enabled()) {
-		if (!khugepaged_thread)
-			khugepaged_thread = kthread_run(khugepaged, NULL,
-							"khugepaged");
-		if (unlikely(IS_ERR(khugepaged_thread))) {
-			pr_err("khugepaged: kthread_run(khugepaged) failed\n");
-			err = PTR_ERR(khugepaged_thread);
-			khugepaged_thread = NULL;
-			goto fail;
+		for_each_node_state(nid, N_MEMORY) {
+			err = khugepaged_run_worker(nid);
+			if (err)
+				goto fail;
 		}
 
 		if (!list_empty(&khugepaged_scan.mm_head))
 			wake_up_interruptible(&khugepaged_wait);
 
 		set_recommended_min_free_kbytes();
-	} else if (khugepaged_thread) {
-		kthread_stop(khugepaged_thread);
-		khugepaged_thread = NULL;
+	} else {
+		for_each_node(nid)
+			khugepaged_stop_worker(nid);
 	}
 fail:
 	return err;
@@ -492,7 +556,7 @@ static ssize_t pages_collapsed_show(struct kobject *kobj,
 				    struct kobj_attribute *attr,
 				    char *buf)
 {
-	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+	return sprintf(buf, "%u\n", atomic_read(&khugepaged_pages_collapsed));
 }
 static struct kobj_attribute pages_collapsed_attr =
 	__ATTR_RO(pages_collapsed);
@@ -641,6 +705,9 @@ static int __init hugepage_init(void)
 	err = register_shrinker(&huge_zero_page_shrinker);
 	if (err)
 		goto err_hzp_shrinker;
+	err = register_shrinker(&deferred_split_shrinker);
+	if (err)
+		goto err_split_shrinker;
 
 	/*
 	 * By default disable transparent hugepages on smaller systems,
@@ -658,6 +725,8 @@ static int __init hugepage_init(void)
 
 	return 0;
 err_khugepaged:
+	unregister_shrinker(&deferred_split_shrinker);
+err_split_shrinker:
 	unregister_shrinker(&huge_zero_page_shrinker);
 err_hzp_shrinker:
 	khugepaged_slab_exit();
@@ -699,6 +768,55 @@ out:
 }
 __setup("transparent_hugepage=", setup_transparent_hugepage);
 
+static unsigned long __thp_get_unmapped_area(struct file *filp,
+		unsigned long len, loff_t off, unsigned long flags,
+		unsigned long size)
+{
+	unsigned long addr;
+	loff_t off_end = off + len;
+	loff_t off_align = round_up(off, size);
+	unsigned long len_pad;
+
+	if (off_end <= off_align || (off_end - off_align) < size)
+		return 0;
+
+	len_pad = len + size;
+	if (len_pad < len || (off + len_pad) < off)
+		return 0;
+
+	addr = current->mm->get_unmapped_area(filp, 0, len_pad,
+					      off >> PAGE_SHIFT, flags);
+	if (IS_ERR_VALUE(addr))
+		return 0;
+
+	addr += (off - addr) & (size - 1);
+	return addr;
+}
+
+/*
+ * ->get_unmapped_area() for files that can be mapped with huge PMDs: pick
+ * a virtual address with the same offset into a PMD as the file offset,
+ * so that PMD aligned file blocks land on PMD aligned addresses.
+ */
+unsigned long thp_get_unmapped_area(struct file *filp, unsigned long addr,
+		unsigned long len, unsigned long pgoff, unsigned long flags)
+{
+	loff_t off = (loff_t)pgoff << PAGE_SHIFT;
+
+	if (addr)
+		goto out;
+	if (!IS_DAX(filp->f_mapping->host) || !IS_ENABLED(CONFIG_FS_DAX_PMD))
+		goto out;
+
+	addr = __thp_get_unmapped_area(filp, len, off, flags, PMD_SIZE);
+	if (addr)
+		return addr;
+
+ out:
+	return current->mm->get_unmapped_area(filp, addr, len, pgoff, flags);
+}
+EXPORT_SYMBOL_GPL(thp_get_unmapped_area);
+
 pmd_t maybe_pmd_mkwrite(pmd_t pmd, struct vm_area_struct *vma)
 {
 	if (likely(vma->vm_flags & VM_WRITE))
@@ -714,11 +832,71 @@ static inline pmd_t mk_huge_pmd(struct page *page, pgprot_t prot)
 	return entry;
 }
 
+/*
+ * Anonymous THPs faulted in whole are queued on their node so that the
+ * deferred split shrinker can break up the ones that are mostly unused
+ * when memory gets tight.  The list_head lives in the third page, whose
+ * ->lru is free while the page is compound; a queued page gets its own
+ * destructor to take it off the list when it is freed.
+ */
+static inline struct list_head *page_deferred_list(struct page *page)
+{
+	return &page[2].lru;
+}
+
+static void free_transhuge_page(struct page *page)
+{
+	struct pglist_data *pgdat = NODE_DATA(page_to_nid(page));
+	unsigned long flags;
+
+	spin_lock_irqsave(&pgdat->split_queue_lock, flags);
+	if (!list_empty(page_deferred_list(page))) {
+		pgdat->split_queue_len--;
+		list_del(page_deferred_list(page));
+	}
+	spin_unlock_irqrestore(&pgdat->split_queue_lock, flags);
+	free_compound_page(page);
+}
+
+static void deferred_split_huge_page(struct page *page)
+{
+	struct pglist_data *pgdat = NODE_DATA(page_to_nid(page));
+	unsigned long flags;
+
+	INIT_LIST_HEAD(page_deferred_list(page));
+	set_compound_page_dtor(page, free_transhuge_page);
+
+	spin_lock_irqsave(&pgdat->split_queue_lock, flags);
+	list_add_tail(page_deferred_list(page), &pgdat->split_queue);
+	pgdat->split_queue_len++;
+	spin_unlock_irqrestore(&pgdat->split_queue_lock, flags);
+
+	count_vm_event(THP_DEFERRED_SPLIT_PAGE);
+}
+
+/* Called with the anon_vma lock held, which keeps the page compound */
+static void dequeue_deferred_split_page(struct page *page)
+{
+	struct pglist_data *pgdat = NODE_DATA(page_to_nid(page));
+	unsigned long flags;
+
+	if (get_compound_page_dtor(page) != free_transhuge_page)
+		return;
+
+	spin_lock_irqsave(&pgdat->split_queue_lock, flags);
+	if (!list_empty(page_deferred_list(page))) {
+		pgdat->split_queue_len--;
+		list_del_init(page_deferred_list(page));
+	}
+	spin_unlock_irqrestore(&pgdat->split_queue_lock, flags);
+}
+
 static int __do_huge_pmd_anonymous_page(struct mm_struct *mm,
 					struct vm_area_struct *vma,
-					unsigned long haddr, pmd_t *pmd,
+					unsigned long address, pmd_t *pmd,
 					struct page *page, gfp_t gfp)
 {
+	unsigned long haddr = address & HPAGE_PMD_MASK;
 	struct mem_cgroup *memcg;
 	pgtable_t pgtable;
 	spinlock_t *ptl;
@@ -734,7 +912,7 @@ static int __do_huge_pmd_anonymous_page(struct mm_struct *mm,
 		return VM_FAULT_OOM;
 	}
 
-	clear_huge_page(page, haddr, HPAGE_PMD_NR);
+	clear_huge_page(page, address, HPAGE_PMD_NR);
 	/*
 	 * The memory barrier inside __SetPageUptodate makes sure that
 	 * clear_huge_page writes become visible before the set_pmd_at()
@@ -742,6 +920,9 @@ static int __do_huge_pmd_anonymous_page(struct mm_struct *mm,
 	 */
 	__SetPageUptodate(page);
 
+	/* Queue it before anyone else can find it; freeing dequeues it */
+	deferred_split_huge_page(page);
+
 	ptl = pmd_lock(mm, pmd);
 	if (unlikely(!pmd_none(*pmd))) {
 		spin_unlock(ptl);
@@ -796,6 +977,9 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
 		return VM_FAULT_FALLBACK;
+	/* userland resolves missing pages one pte at a time */
+	if (userfaultfd_missing(vma))
+		return VM_FAULT_FALLBACK;
 	if (unlikely(anon_vma_prepare(vma)))
 		return VM_FAULT_OOM;
 	if (unlikely(khugepaged_enter(vma, vma->vm_flags)))
@@ -831,7 +1015,8 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		count_vm_event(THP_FAULT_FALLBACK);
 		return VM_FAULT_FALLBACK;
 	}
-	if (unlikely(__do_huge_pmd_anonymous_page(mm, vma, haddr, pmd, page, gfp))) {
+	if (unlikely(__do_huge_pmd_anonymous_page(mm, vma, address, pmd,
+						  page, gfp))) {
 		put_page(page);
 		count_vm_event(THP_FAULT_FALLBACK);
 		return VM_FAULT_FALLBACK;
@@ -841,6 +1026,64 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	return 0;
 }
 
+static void insert_pfn_pmd(struct vm_area_struct *vma, unsigned long addr,
+		pmd_t *pmd, unsigned long pfn, pgprot_t prot, bool write)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pmd_t entry;
+	spinlock_t *ptl;
+
+	ptl = pmd_lock(mm, pmd);
+	if (!pmd_none(*pmd)) {
+		/*
+		 * Somebody else mapped it, or this is a write fault on a
+		 * read-only mapping of the same blocks: just upgrade it.
+		 */
+		if (write && pmd_trans_huge(*pmd) && pmd_pfn(*pmd) == pfn) {
+			entry = pmd_mkyoung(pmd_mkdirty(*pmd));
+			entry = maybe_pmd_mkwrite(entry, vma);
+			if (pmdp_set_access_flags(vma, addr & HPAGE_PMD_MASK,
+						  pmd, entry, 1))
+				update_mmu_cache_pmd(vma, addr, pmd);
+		}
+		goto out_unlock;
+	}
+
+	entry = pmd_mkhuge(pfn_pmd(pfn, prot));
+	if (write) {
+		entry = pmd_mkyoung(pmd_mkdirty(entry));
+		entry = maybe_pmd_mkwrite(entry, vma);
+	}
+	set_pmd_at(mm, addr & HPAGE_PMD_MASK, pmd, entry);
+	update_mmu_cache_pmd(vma, addr, pmd);
+out_unlock:
+	spin_unlock(ptl);
+}
+
+/*
+ * Map @pfn with a huge PMD, for VM_MIXEDMAP file mappings of memory that
+ * has no struct page.  No page table is deposited and nothing is counted
+ * against the mm, like insert_pfn() for a PTE.
+ */
+int vmf_insert_pfn_pmd(struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd, unsigned long pfn, bool write)
+{
+	pgprot_t pgprot = vma->vm_page_prot;
+
+	BUG_ON(!(vma->vm_flags & (VM_PFNMAP|VM_MIXEDMAP)));
+	BUG_ON((vma->vm_flags & (VM_PFNMAP|VM_MIXEDMAP)) ==
+						(VM_PFNMAP|VM_MIXEDMAP));
+	BUG_ON((vma->vm_flags & VM_MIXEDMAP) && pfn_valid(pfn));
+
+	if (addr < vma->vm_start || addr >= vma->vm_end)
+		return VM_FAULT_SIGBUS;
+	if (track_pfn_insert(vma, &pgprot, pfn))
+		return VM_FAULT_SIGBUS;
+	insert_pfn_pmd(vma, addr, pmd, pfn, pgprot, write);
+	return VM_FAULT_NOPAGE;
+}
+EXPORT_SYMBOL_GPL(vmf_insert_pfn_pmd);
+
 int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
 		  struct vm_area_struct *vma)
@@ -851,6 +1094,10 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	pgtable_t pgtable;
 	int ret;
 
+	/* DAX PMDs are not copied, the child simply faults them in again */
+	if (vma_is_dax(vma))
+		return 0;
+
 	ret = -ENOMEM;
 	pgtable = pte_alloc_one(dst_mm, addr);
 	if (unlikely(!pgtable))
@@ -1153,7 +1400,7 @@ alloc:
 	count_vm_event(THP_FAULT_ALLOC);
 
 	if (!page)
-		clear_huge_page(new_page, haddr, HPAGE_PMD_NR);
+		clear_huge_page(new_page, address, HPAGE_PMD_NR);
 	else
 		copy_user_huge_page(new_page, page, haddr, vma, HPAGE_PMD_NR);
 	__SetPageUptodate(new_page);
@@ -1221,6 +1468,10 @@ struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
 	if ((flags & FOLL_NUMA) && pmd_protnone(*pmd))
 		goto out;
 
+	/* DAX PMDs map memory without struct pages, like a special PTE */
+	if (vma_is_dax(vma))
+		return ERR_PTR(-EFAULT);
+
 	page = pmd_page(*pmd);
 	VM_BUG_ON_PAGE(!PageHead(page), page);
 	if (flags & FOLL_TOUCH) {
@@ -1379,7 +1630,8 @@ out:
 		page_unlock_anon_vma_read(anon_vma);
 
 	if (page_nid != -1)
-		task_numa_fault(last_cpupid, page_nid, HPAGE_PMD_NR, flags);
+		task_numa_fault(vma, last_cpupid, page_nid, HPAGE_PMD_NR,
+				flags);
 
 	return 0;
 }
@@ -1403,6 +1655,11 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		orig_pmd = pmdp_get_and_clear_full(tlb->mm, addr, pmd,
 						   tlb->fullmm);
 		tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
+		if (vma_is_dax(vma)) {
+			/* no deposited page table, no page to free */
+			spin_unlock(ptl);
+			return 1;
+		}
 		pgtable = pgtable_trans_huge_withdraw(tlb->mm, pmd);
 		if (is_huge_zero_pmd(orig_pmd)) {
 			atomic_long_dec(&tlb->mm->nr_ptes);
@@ -1686,6 +1943,11 @@ static void __split_huge_page_refcount(struct page *page,
 				      (1L << PG_unevictable)));
 		page_tail->flags |= (1L << PG_dirty);
 
+		if (page_is_young(page))
+			set_page_young(page_tail);
+		if (page_is_idle(page))
+			set_page_idle(page_tail);
+
 		/* clear PageTail before overwriting first_page */
 		smp_wmb();
 
@@ -1906,6 +2168,7 @@ int split_huge_page_to_list(struct page *page, struct list_head *list)
 		goto out_unlock;
 
 	BUG_ON(!PageSwapBacked(page));
+	dequeue_deferred_split_page(page);
 	__split_huge_page(page, anon_vma, list);
 	count_vm_event(THP_SPLIT);
 
@@ -1917,6 +2180,202 @@ out:
 	return ret;
 }
 
+/*
+ * A THP is underused when more of its subpages are zero-filled than
+ * khugepaged would tolerate as empty ptes when collapsing, so splitting
+ * it will not just have it collapsed again.
+ */
+static bool thp_underused(struct page *page)
+{
+	int num_zero_pages = 0, num_filled_pages = 0;
+	void *kaddr;
+	int i;
+
+	if (khugepaged_max_ptes_none == HPAGE_PMD_NR - 1)
+		return false;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		kaddr = kmap_atomic(page + i);
+		if (!memchr_inv(kaddr, 0, PAGE_SIZE)) {
+			num_zero_pages++;
+			if (num_zero_pages > khugepaged_max_ptes_none) {
+				kunmap_atomic(kaddr);
+				return true;
+			}
+		} else {
+			num_filled_pages++;
+			if (num_filled_pages >=
+			    HPAGE_PMD_NR - khugepaged_max_ptes_none) {
+				kunmap_atomic(kaddr);
+				return false;
+			}
+		}
+		kunmap_atomic(kaddr);
+	}
+	return false;
+}
+
+/*
+ * Replace the mapping of a zero-filled page with the zero page.  The pte
+ * is cleared and flushed before the contents are checked, so nothing can
+ * write to the page behind our back; a gup pin makes us leave it alone.
+ */
+static int remap_zero_subpage_one(struct page *page,
+				  struct vm_area_struct *vma,
+				  unsigned long address, void *arg)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pte_t *pte, entry;
+	spinlock_t *ptl;
+	void *kaddr;
+	bool zero;
+
+	if ((vma->vm_flags & VM_LOCKED) || mm_forbids_zeropage(mm))
+		return SWAP_FAIL;
+
+	pte = page_check_address(page, mm, address, &ptl, 0);
+	if (!pte)
+		return SWAP_AGAIN;
+
+	entry = ptep_clear_flush(vma, address, pte);
+	/* one reference for the mapping and one for the caller */
+	if (page_count(page) != 2) {
+		set_pte_at(mm, address, pte, entry);
+		pte_unmap_unlock(pte, ptl);
+		return SWAP_FAIL;
+	}
+
+	kaddr = kmap_atomic(page);
+	zero = !memchr_inv(kaddr, 0, PAGE_SIZE);
+	kunmap_atomic(kaddr);
+	if (!zero) {
+		set_pte_at(mm, address, pte, entry);
+		pte_unmap_unlock(pte, ptl);
+		return SWAP_FAIL;
+	}
+
+	entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+				      vma->vm_page_prot));
+	set_pte_at(mm, address, pte, entry);
+	update_mmu_cache(vma, address, pte);
+	page_remove_rmap(page);
+	dec_mm_counter(mm, MM_ANONPAGES);
+	pte_unmap_unlock(pte, ptl);
+	mmu_notifier_invalidate_page(mm, address);
+	page_cache_release(page);
+
+	return SWAP_AGAIN;
+}
+
+/*
+ * Called on a freshly split, locked and pinned head page: hand the
+ * zero-filled subpages mapped once back to the page allocator.
+ */
+static void remap_zero_subpages(struct page *head)
+{
+	struct rmap_walk_control rwc = {
+		.rmap_one = remap_zero_subpage_one,
+	};
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		struct page *page = head + i;
+
+		if (i) {
+			if (!get_page_unless_zero(page))
+				continue;
+			if (!trylock_page(page)) {
+				put_page(page);
+				continue;
+			}
+		}
+
+		if (PageAnon(page) && !PageKsm(page) &&
+		    !PageSwapCache(page) && page_mapcount(page) == 1)
+			rmap_walk(page, &rwc);
+
+		if (i) {
+			unlock_page(page);
+			put_page(page);
+		}
+	}
+}
+
+static unsigned long deferred_split_count(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	struct pglist_data *pgdat = NODE_DATA(sc->nid);
+
+	if (khugepaged_max_ptes_none == HPAGE_PMD_NR - 1)
+		return 0;
+	return ACCESS_ONCE(pgdat->split_queue_len);
+}
+
+#define DEFERRED_SPLIT_BATCH	32
+
+/*
+ * Splitters do not hold the page lock, so the pages being looked at stay
+ * on the queue: they are rotated to its tail and pinned, and whoever
+ * splits one takes it off under the queue lock.
+ */
+static unsigned long deferred_split_scan(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	struct pglist_data *pgdat = NODE_DATA(sc->nid);
+	struct page *pages[DEFERRED_SPLIT_BATCH];
+	unsigned long flags, nr_scan;
+	int i, nr = 0, split = 0;
+
+	spin_lock_irqsave(&pgdat->split_queue_lock, flags);
+	nr_scan = min3(sc->nr_to_scan, pgdat->split_queue_len,
+		       (unsigned long)DEFERRED_SPLIT_BATCH);
+	while (nr_scan--) {
+		struct list_head *pos = pgdat->split_queue.next;
+		struct page *page = compound_head(list_entry(pos, struct page,
+							      lru));
+
+		if (get_page_unless_zero(page)) {
+			list_move_tail(pos, &pgdat->split_queue);
+			pages[nr++] = page;
+		} else {
+			/* We lost the race with the page being freed */
+			list_del_init(pos);
+			pgdat->split_queue_len--;
+		}
+	}
+	spin_unlock_irqrestore(&pgdat->split_queue_lock, flags);
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+
+		if (!trylock_page(page))
+			goto next;
+		if (PageCompound(page) && thp_underused(page)) {
+			split_huge_page(page);
+			if (!PageCompound(page)) {
+				count_vm_event(THP_UNDERUSED_SPLIT_PAGE);
+				remap_zero_subpages(page);
+				split++;
+			}
+		}
+		unlock_page(page);
+next:
+		put_page(page);
+	}
+
+	if (!split && !ACCESS_ONCE(pgdat->split_queue_len))
+		return SHRINK_STOP;
+	return split;
+}
+
+static struct shrinker deferred_split_shrinker = {
+	.count_objects = deferred_split_count,
+	.scan_objects = deferred_split_scan,
+	.seeks = DEFAULT_SEEKS,
+	.batch = DEFERRED_SPLIT_BATCH,
+	.flags = SHRINKER_NUMA_AWARE,
+};
+
 #define VM_NO_THP (VM_SPECIAL | VM_HUGETLB | VM_SHARED | VM_MAYSHARE)
 
 int hugepage_madvise(struct vm_area_struct *vma,
@@ -2034,6 +2493,8 @@ int __khugepaged_enter(struct mm_struct *mm)
 		return 0;
 	}
 
+	INIT_LIST_HEAD(&mm_slot->prio_node);
+
 	spin_lock(&khugepaged_mm_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
@@ -2042,6 +2503,9 @@ int __khugepaged_enter(struct mm_struct *mm)
 	 */
 	wakeup = list_empty(&khugepaged_scan.mm_head);
 	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	mm_slot->full_scans = khugepaged_full_scans - 1;
+	if (test_bit(MMF_THP_PRIORITY, &mm->flags))
+		list_add_tail(&mm_slot->prio_node, &khugepaged_scan.prio_head);
 	spin_unlock(&khugepaged_mm_lock);
 
 	atomic_inc(&mm->mm_count);
@@ -2071,6 +2535,68 @@ int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 	return 0;
 }
 
+/*
+ * Move the scan cursor past @mm_slot; wrapping around to the head of the
+ * list completes a full scan.
+ */
+static void khugepaged_advance_cursor(struct mm_slot *mm_slot)
+{
+	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+
+	if (list_is_last(&mm_slot->mm_node, &khugepaged_scan.mm_head)) {
+		khugepaged_scan.mm_slot = NULL;
+		khugepaged_full_scans++;
+	} else {
+		khugepaged_scan.mm_slot = list_next_entry(mm_slot, mm_node);
+	}
+}
+
+static void del_mm_slot(struct mm_slot *mm_slot)
+{
+	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
+	VM_BUG_ON(mm_slot->worker);
+
+	if (khugepaged_scan.mm_slot == mm_slot)
+		khugepaged_advance_cursor(mm_slot);
+	hash_del(&mm_slot->hash);
+	list_del(&mm_slot->mm_node);
+	list_del(&mm_slot->prio_node);
+}
+
+/*
+ * Give @mm priority with khugepaged, or take it away: its mm_slot is
+ * handed to the next idle worker, ahead of the regular list, once in
+ * every full scan.
+ */
+int khugepaged_set_priority(struct mm_struct *mm, bool prio)
+{
+	struct mm_slot *mm_slot;
+	bool wakeup = false;
+
+	if (prio)
+		set_bit(MMF_THP_PRIORITY, &mm->flags);
+	else
+		clear_bit(MMF_THP_PRIORITY, &mm->flags);
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (mm_slot) {
+		if (!prio) {
+			list_del_init(&mm_slot->prio_node);
+		} else if (list_empty(&mm_slot->prio_node)) {
+			list_add_tail(&mm_slot->prio_node,
+				      &khugepaged_scan.prio_head);
+			mm_slot->full_scans = khugepaged_full_scans - 1;
+			wakeup = true;
+		}
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+	return 0;
+}
+
 void __khugepaged_exit(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
@@ -2078,9 +2604,8 @@ void __khugepaged_exit(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
-		hash_del(&mm_slot->hash);
-		list_del(&mm_slot->mm_node);
+	if (mm_slot && !mm_slot->worker) {
+		del_mm_slot(mm_slot);
 		free = 1;
 	}
 	spin_unlock(&khugepaged_mm_lock);
@@ -2133,7 +2658,8 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 		pte_t pteval = *_pte;
 		if (pte_none(pteval) || (pte_present(pteval) &&
 			is_zero_pfn(pte_pfn(pteval)))) {
-			if (++none_or_zero <= khugepaged_max_ptes_none)
+			if (!userfaultfd_armed(vma) &&
+			    ++none_or_zero <= khugepaged_max_ptes_none)
 				continue;
 			else
 				goto out;
@@ -2146,7 +2672,6 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 
 		VM_BUG_ON_PAGE(PageCompound(page), page);
 		VM_BUG_ON_PAGE(!PageAnon(page), page);
-		VM_BUG_ON_PAGE(!PageSwapBacked(page), page);
 
 		/*
 		 * We can do it before isolate_lru_page because the
@@ -2261,9 +2786,7 @@ static void khugepaged_alloc_sleep(void)
 			msecs_to_jiffies(khugepaged_alloc_sleep_millisecs));
 }
 
-static int khugepaged_node_load[MAX_NUMNODES];
-
-static bool khugepaged_scan_abort(int nid)
+static bool khugepaged_scan_abort(struct khugepaged_worker *worker, int nid)
 {
 	int i;
 
@@ -2275,11 +2798,11 @@ static bool khugepaged_scan_abort(int nid)
 		return false;
 
 	/* If there is a count for this node already, it must be acceptable */
-	if (khugepaged_node_load[nid])
+	if (worker->node_load[nid])
 		return false;
 
 	for (i = 0; i < MAX_NUMNODES; i++) {
-		if (!khugepaged_node_load[i])
+		if (!worker->node_load[i])
 			continue;
 		if (node_distance(nid, i) > RECLAIM_DISTANCE)
 			return true;
@@ -2288,28 +2811,27 @@ static bool khugepaged_scan_abort(int nid)
 }
 
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct khugepaged_worker *worker)
 {
-	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
 
 	/* find first node with max normal pages hit */
 	for (nid = 0; nid < MAX_NUMNODES; nid++)
-		if (khugepaged_node_load[nid] > max_value) {
-			max_value = khugepaged_node_load[nid];
+		if (worker->node_load[nid] > max_value) {
+			max_value = worker->node_load[nid];
 			target_node = nid;
 		}
 
 	/* do some balance if several nodes have the same hit record */
-	if (target_node <= last_khugepaged_target_node)
-		for (nid = last_khugepaged_target_node + 1; nid < MAX_NUMNODES;
+	if (target_node <= worker->last_target_node)
+		for (nid = worker->last_target_node + 1; nid < MAX_NUMNODES;
 				nid++)
-			if (max_value == khugepaged_node_load[nid]) {
+			if (max_value == worker->node_load[nid]) {
 				target_node = nid;
 				break;
 			}
 
-	last_khugepaged_target_node = target_node;
+	worker->last_target_node = target_node;
 	return target_node;
 }
 
@@ -2356,7 +2878,7 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, struct mm_struct *mm,
 	return *hpage;
 }
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct khugepaged_worker *worker)
 {
 	return 0;
 }
@@ -2475,7 +2997,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	if (!hugepage_vma_check(vma))
 		goto out;
 	pmd = mm_find_pmd(mm, address);
-	if (!pmd)
+	if (!pmd || pmd_shared_pte_table(*pmd))
 		goto out;
 
 	anon_vma_lock_write(vma->anon_vma);
@@ -2549,7 +3071,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 
 	*hpage = NULL;
 
-	khugepaged_pages_collapsed++;
+	atomic_inc(&khugepaged_pages_collapsed);
 out_up_write:
 	up_write(&mm->mmap_sem);
 	return;
@@ -2559,7 +3081,8 @@ out:
 	goto out_up_write;
 }
 
-static int khugepaged_scan_pmd(struct mm_struct *mm,
+static int khugepaged_scan_pmd(struct khugepaged_worker *worker,
+			       struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
 			       struct page **hpage)
@@ -2576,16 +3099,18 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
 	pmd = mm_find_pmd(mm, address);
-	if (!pmd)
+	if (!pmd || pmd_shared_pte_table(*pmd))
 		goto out;
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	mm->khugepaged_stat[KHUGEPAGED_SCANNED]++;
+	memset(worker->node_load, 0, sizeof(worker->node_load));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
-			if (++none_or_zero <= khugepaged_max_ptes_none)
+			if (!userfaultfd_armed(vma) &&
+			    ++none_or_zero <= khugepaged_max_ptes_none)
 				continue;
 			else
 				goto out_unmap;
@@ -2600,14 +3125,14 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			goto out_unmap;
 		/*
 		 * Record which node the original page is from and save this
-		 * information to khugepaged_node_load[].
+		 * information to the worker's node_load[].
 		 * Khupaged will allocate hugepage from the node has the max
 		 * hit record.
 		 */
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node))
+		if (khugepaged_scan_abort(worker, node))
 			goto out_unmap;
-		khugepaged_node_load[node]++;
+		worker->node_load[node]++;
 		VM_BUG_ON_PAGE(PageCompound(page), page);
 		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page))
 			goto out_unmap;
@@ -2627,9 +3152,14 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret) {
-		node = khugepaged_find_target_node();
+		node = khugepaged_find_target_node(worker);
 		/* collapse_huge_page will return with the mmap_sem released */
 		collapse_huge_page(mm, address, hpage, vma, node);
+		/* the new page is consumed only by a successful collapse */
+		if (*hpage)
+			mm->khugepaged_stat[KHUGEPAGED_COLLAPSE_FAILED]++;
+		else
+			mm->khugepaged_stat[KHUGEPAGED_COLLAPSED]++;
 	}
 out:
 	return ret;
@@ -2643,8 +3173,7 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 
 	if (khugepaged_test_exit(mm)) {
 		/* free mm_slot */
-		hash_del(&mm_slot->hash);
-		list_del(&mm_slot->mm_node);
+		del_mm_slot(mm_slot);
 
 		/*
 		 * Not strictly needed because the mm exited already.
@@ -2658,27 +3187,69 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 	}
 }
 
-static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+/*
+ * Find the next mm for @worker: first an mm with a collapse priority
+ * that has not been handed out during this full scan, then the regular
+ * list from the cursor on.  Mms being scanned by another worker, and
+ * priority mms already handed out during this full scan, are passed
+ * over.
+ */
+static struct mm_slot *khugepaged_claim_mm_slot(struct khugepaged_worker *worker,
+						unsigned int *pass_through_head)
+{
+	struct mm_slot *mm_slot, *first = NULL;
+	unsigned int full_scans;
+
+	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
+
+	full_scans = khugepaged_full_scans;
+	list_for_each_entry(mm_slot, &khugepaged_scan.prio_head, prio_node)
+		if (!mm_slot->worker && mm_slot->full_scans != full_scans)
+			goto claim;
+
+	while (!list_empty(&khugepaged_scan.mm_head)) {
+		mm_slot = khugepaged_scan.mm_slot;
+		if (!mm_slot) {
+			if (++*pass_through_head >= 2)
+				break;
+			mm_slot = list_first_entry(&khugepaged_scan.mm_head,
+						   struct mm_slot, mm_node);
+			khugepaged_scan.mm_slot = mm_slot;
+		}
+		/* every mm is busy or done */
+		if (mm_slot == first)
+			break;
+		if (!first)
+			first = mm_slot;
+
+		full_scans = khugepaged_full_scans;
+		khugepaged_advance_cursor(mm_slot);
+		if (!mm_slot->worker && mm_slot->full_scans != full_scans)
+			goto claim;
+	}
+	return NULL;
+
+claim:
+	mm_slot->full_scans = full_scans;
+	mm_slot->worker = worker;
+	worker->mm_slot = mm_slot;
+	return mm_slot;
+}
+
+static unsigned int khugepaged_scan_mm_slot(struct khugepaged_worker *worker,
+					    unsigned int pages,
 					    struct page **hpage)
 	__releases(&khugepaged_mm_lock)
 	__acquires(&khugepaged_mm_lock)
 {
-	struct mm_slot *mm_slot;
+	struct mm_slot *mm_slot = worker->mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
 	int progress = 0;
 
 	VM_BUG_ON(!pages);
 	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
-
-	if (khugepaged_scan.mm_slot)
-		mm_slot = khugepaged_scan.mm_slot;
-	else {
-		mm_slot = list_entry(khugepaged_scan.mm_head.next,
-				     struct mm_slot, mm_node);
-		khugepaged_scan.address = 0;
-		khugepaged_scan.mm_slot = mm_slot;
-	}
+	VM_BUG_ON(mm_slot->worker != worker);
 	spin_unlock(&khugepaged_mm_lock);
 
 	mm = mm_slot->mm;
@@ -2686,7 +3257,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	if (unlikely(khugepaged_test_exit(mm)))
 		vma = NULL;
 	else
-		vma = find_vma(mm, khugepaged_scan.address);
+		vma = find_vma(mm, mm_slot->address);
 
 	progress++;
 	for (; vma; vma = vma->vm_next) {
@@ -2706,26 +3277,26 @@ skip:
 		hend = vma->vm_end & HPAGE_PMD_MASK;
 		if (hstart >= hend)
 			goto skip;
-		if (khugepaged_scan.address > hend)
+		if (mm_slot->address > hend)
 			goto skip;
-		if (khugepaged_scan.address < hstart)
-			khugepaged_scan.address = hstart;
-		VM_BUG_ON(khugepaged_scan.address & ~HPAGE_PMD_MASK);
+		if (mm_slot->address < hstart)
+			mm_slot->address = hstart;
+		VM_BUG_ON(mm_slot->address & ~HPAGE_PMD_MASK);
 
-		while (khugepaged_scan.address < hend) {
+		while (mm_slot->address < hend) {
 			int ret;
 			cond_resched();
 			if (unlikely(khugepaged_test_exit(mm)))
 				goto breakouterloop;
 
-			VM_BUG_ON(khugepaged_scan.address < hstart ||
-				  khugepaged_scan.address + HPAGE_PMD_SIZE >
+			VM_BUG_ON(mm_slot->address < hstart ||
+				  mm_slot->address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
+			ret = khugepaged_scan_pmd(worker, mm, vma,
+						  mm_slot->address,
 						  hpage);
 			/* move to next address */
-			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			mm_slot->address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
 			if (ret)
 				/* we released mmap_sem so break loop */
@@ -2739,27 +3310,14 @@ breakouterloop:
 breakouterloop_mmap_sem:
 
 	spin_lock(&khugepaged_mm_lock);
-	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
 	/*
 	 * Release the current mm_slot if this mm is about to die, or
 	 * if we scanned all vmas of this mm.
 	 */
 	if (khugepaged_test_exit(mm) || !vma) {
-		/*
-		 * Make sure that if mm_users is reaching zero while
-		 * khugepaged runs here, khugepaged_exit will find
-		 * mm_slot not pointing to the exiting mm.
-		 */
-		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
-			khugepaged_scan.mm_slot = list_entry(
-				mm_slot->mm_node.next,
-				struct mm_slot, mm_node);
-			khugepaged_scan.address = 0;
-		} else {
-			khugepaged_scan.mm_slot = NULL;
-			khugepaged_full_scans++;
-		}
-
+		mm_slot->address = 0;
+		mm_slot->worker = NULL;
+		worker->mm_slot = NULL;
 		collect_mm_slot(mm_slot);
 	}
 
@@ -2778,7 +3336,7 @@ static int khugepaged_wait_event(void)
 		kthread_should_stop();
 }
 
-static void khugepaged_do_scan(void)
+static void khugepaged_do_scan(struct khugepaged_worker *worker)
 {
 	struct page *hpage = NULL;
 	unsigned int progress = 0, pass_through_head = 0;
@@ -2797,11 +3355,11 @@ static void khugepaged_do_scan(void)
 			break;
 
 		spin_lock(&khugepaged_mm_lock);
-		if (!khugepaged_scan.mm_slot)
-			pass_through_head++;
 		if (khugepaged_has_work() &&
-		    pass_through_head < 2)
-			progress += khugepaged_scan_mm_slot(pages - progress,
+		    (worker->mm_slot ||
+		     khugepaged_claim_mm_slot(worker, &pass_through_head)))
+			progress += khugepaged_scan_mm_slot(worker,
+							    pages - progress,
 							    &hpage);
 		else
 			progress = pages;
@@ -2830,23 +3388,30 @@ static void khugepaged_wait_work(void)
 		wait_event_freezable(khugepaged_wait, khugepaged_wait_event());
 }
 
-static int khugepaged(void *none)
+static int khugepaged(void *p)
 {
+	struct khugepaged_worker *worker = p;
+	const struct cpumask *cpumask = cpumask_of_node(worker->nid);
 	struct mm_slot *mm_slot;
 
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
 	set_freezable();
 	set_user_nice(current, MAX_NICE);
 
 	while (!kthread_should_stop()) {
-		khugepaged_do_scan();
+		khugepaged_do_scan(worker);
 		khugepaged_wait_work();
 	}
 
+	/* leave a partly scanned mm for the others to pick up */
 	spin_lock(&khugepaged_mm_lock);
-	mm_slot = khugepaged_scan.mm_slot;
-	khugepaged_scan.mm_slot = NULL;
-	if (mm_slot)
+	mm_slot = worker->mm_slot;
+	worker->mm_slot = NULL;
+	if (mm_slot) {
+		mm_slot->worker = NULL;
 		collect_mm_slot(mm_slot);
+	}
 	spin_unlock(&khugepaged_mm_lock);
 	return 0;
 }
@@ -2889,10 +3454,24 @@ void __split_huge_page_pmd(struct vm_area_struct *vma, unsigned long address,
 	unsigned long mmun_start;	/* For mmu_notifiers */
 	unsigned long mmun_end;		/* For mmu_notifiers */
 
-	BUG_ON(vma->vm_start > haddr || vma->vm_end < haddr + HPAGE_PMD_SIZE);
-
 	mmun_start = haddr;
 	mmun_end   = haddr + HPAGE_PMD_SIZE;
+
+	/*
+	 * A DAX PMD maps file blocks directly and has nothing to split:
+	 * clear it and let the range fault back in with PTEs.
+	 */
+	if (vma_is_dax(vma)) {
+		mmu_notifier_invalidate_range_start(mm, mmun_start, mmun_end);
+		ptl = pmd_lock(mm, pmd);
+		if (pmd_trans_huge(*pmd))
+			pmdp_clear_flush(vma, haddr, pmd);
+		spin_unlock(ptl);
+		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
+		return;
+	}
+
+	BUG_ON(vma->vm_start > haddr || vma->vm_end < haddr + HPAGE_PMD_SIZE);
 again:
 	mmu_notifier_invalidate_range_start(mm, mmun_start, mmun_end);
 	ptl = pmd_lock(mm, pmd);
@@ -23,7 +23,7 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
+#include <linux/crc32c.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -154,6 +154,8 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @nr_failures: consecutive scans on which the page changed or failed to merge
+ * @skip: number of coming scans to leave the page alone for
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -169,6 +171,8 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	unsigned char nr_failures;
+	unsigned char skip;
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -223,6 +227,12 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Most full scans a page that keeps failing to merge is skipped for */
+static unsigned int ksm_max_skip_scans = 8;
+
+/* The number of pages ksmd skipped as repeatedly failing */
+static unsigned long ksm_pages_skipped;
+
 #ifdef CONFIG_NUMA
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
@@ -501,6 +511,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_stat[KSM_PAGES_MERGING]--;
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
 		cond_resched();
@@ -629,6 +640,7 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_stat[KSM_PAGES_MERGING]--;
 
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
@@ -825,11 +837,16 @@ error:
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * The checksum only tells whether a page changed between two scans, so
+ * crc32c is as good as any hash here, and the crypto API picks the
+ * instruction based implementation where the cpu has one.
+ */
 static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	checksum = crc32c(0, addr, PAGE_SIZE);
 	kunmap_atomic(addr);
 	return checksum;
 }
@@ -1401,6 +1418,42 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_sharing++;
 	else
 		ksm_pages_shared++;
+	rmap_item->mm->ksm_stat[KSM_PAGES_MERGING]++;
+}
+
+/*
+ * A page that changes under us or cannot be merged scan after scan (it
+ * may be pinned, or be rewritten all the time) is left alone for a
+ * growing number of scans, rather than costing a checksum and tree
+ * searches on every pass. The first two failures are free: a page seen
+ * for the first time always looks like it changed.
+ */
+static void rmap_item_failed(struct rmap_item *rmap_item)
+{
+	unsigned int nr;
+
+	if (rmap_item->nr_failures < 16)
+		rmap_item->nr_failures++;
+	nr = rmap_item->nr_failures;
+	if (nr > 2)
+		rmap_item->skip = min(1U << (nr - 3), ksm_max_skip_scans);
+}
+
+static void rmap_item_settled(struct rmap_item *rmap_item)
+{
+	rmap_item->nr_failures = 0;
+	rmap_item->skip = 0;
+}
+
+static bool rmap_item_should_skip(struct rmap_item *rmap_item)
+{
+	if (!rmap_item->skip || (rmap_item->address & STABLE_FLAG))
+		return false;
+
+	rmap_item->skip--;
+	/* left over from an earlier scan: must not outlive the next one */
+	remove_rmap_item_from_tree(rmap_item);
+	return true;
 }
 
 /*
@@ -1454,6 +1507,10 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			lock_page(kpage);
 			stable_tree_append(rmap_item, page_stable_node(kpage));
 			unlock_page(kpage);
+			rmap_item_settled(rmap_item);
+		} else {
+			rmap_item->mm->ksm_stat[KSM_MERGE_FAILED]++;
+			rmap_item_failed(rmap_item);
 		}
 		put_page(kpage);
 		return;
@@ -1468,12 +1525,15 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
+		rmap_item_failed(rmap_item);
 		return;
 	}
 
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
-	if (tree_rmap_item) {
+	if (!tree_rmap_item)
+		rmap_item_settled(rmap_item);
+	else {
 		kpage = try_to_merge_two_pages(rmap_item, page,
 						tree_rmap_item, tree_page);
 		put_page(tree_page);
@@ -1500,6 +1560,10 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 				break_cow(tree_rmap_item);
 				break_cow(rmap_item);
 			}
+			rmap_item_settled(rmap_item);
+		} else {
+			rmap_item->mm->ksm_stat[KSM_MERGE_FAILED]++;
+			rmap_item_failed(rmap_item);
 		}
 	}
 }
@@ -1700,7 +1764,12 @@ static void ksm_do_scan(unsigned int scan_npages)
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
 			return;
-		cmp_and_merge_page(page, rmap_item);
+		rmap_item->mm->ksm_stat[KSM_PAGES_SCANNED]++;
+		if (rmap_item_should_skip(rmap_item)) {
+			rmap_item->mm->ksm_stat[KSM_PAGES_SKIPPED]++;
+			ksm_pages_skipped++;
+		} else
+			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
 	}
 }
@@ -2127,6 +2196,29 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t max_skip_scans_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_max_skip_scans);
+}
+
+static ssize_t max_skip_scans_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int err;
+	unsigned long scans;
+
+	err = kstrtoul(buf, 10, &scans);
+	if (err || scans > U8_MAX)
+		return -EINVAL;
+
+	ksm_max_skip_scans = scans;
+
+	return count;
+}
+KSM_ATTR(max_skip_scans);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -2278,6 +2370,13 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_skipped);
+}
+KSM_ATTR_RO(pages_skipped);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -2287,6 +2386,8 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&max_skip_scans_attr.attr,
+	&pages_skipped_attr.attr,
 #ifdef CONFIG_NUMA
 	&merge_across_nodes_attr.attr,
 #endif
@@ -7,11 +7,30 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/mm.h>
+#include <linux/hash.h>
 #include <linux/list_lru.h>
 #include <linux/slab.h>
 #include <linux/mutex.h>
 #include <linux/memcontrol.h>
 
+/* Upper bound on the number of lists a node is split into when sharded */
+#define LIST_LRU_MAX_SHARDS	16
+
+static inline int list_lru_nr_lists(struct list_lru *lru)
+{
+	return nr_node_ids << lru->shift;
+}
+
+static inline struct list_lru_node *
+list_lru_node_of(struct list_lru *lru, struct list_head *item)
+{
+	int idx = page_to_nid(virt_to_page(item)) << lru->shift;
+
+	if (lru->shift)
+		idx += hash_ptr(item, lru->shift);
+	return &lru->node[idx];
+}
+
 #ifdef CONFIG_MEMCG_KMEM
 static LIST_HEAD(list_lrus);
 static DEFINE_MUTEX(list_lrus_mutex);
@@ -94,8 +113,7 @@ list_lru_from_kmem(struct list_lru_node *nlru, void *ptr)
 
 bool list_lru_add(struct list_lru *lru, struct list_head *item)
 {
-	int nid = page_to_nid(virt_to_page(item));
-	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_node *nlru = list_lru_node_of(lru, item);
 	struct list_lru_one *l;
 
 	spin_lock(&nlru->lock);
@@ -113,8 +131,7 @@ EXPORT_SYMBOL_GPL(list_lru_add);
 
 bool list_lru_del(struct list_lru *lru, struct list_head *item)
 {
-	int nid = page_to_nid(virt_to_page(item));
-	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_node *nlru = list_lru_node_of(lru, item);
 	struct list_lru_one *l;
 
 	spin_lock(&nlru->lock);
@@ -148,16 +165,28 @@ EXPORT_SYMBOL_GPL(list_lru_isolate_move);
 static unsigned long __list_lru_count_one(struct list_lru *lru,
 					  int nid, int memcg_idx)
 {
-	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_node *nlru = &lru->node[nid << lru->shift];
 	struct list_lru_one *l;
-	unsigned long count;
+	long count = 0;
+	int i;
 
-	spin_lock(&nlru->lock);
-	l = list_lru_from_memcg_idx(nlru, memcg_idx);
-	count = l->nr_items;
-	spin_unlock(&nlru->lock);
+	for (i = 0; i < 1 << lru->shift; i++, nlru++) {
+		/*
+		 * The global list is never relocated, so shrinkers can sum
+		 * its counters without bouncing the lock of every list.
+		 */
+		if (memcg_idx < 0 || !list_lru_memcg_aware(lru)) {
+			count += READ_ONCE(nlru->lru.nr_items);
+			continue;
+		}
+		spin_lock(&nlru->lock);
+		l = list_lru_from_memcg_idx(nlru, memcg_idx);
+		count += l->nr_items;
+		spin_unlock(&nlru->lock);
+	}
 
-	return count;
+	/* counters may be transiently negative during memcg reparenting */
+	return count > 0 ? count : 0;
 }
 
 unsigned long list_lru_count_one(struct list_lru *lru,
@@ -182,12 +211,10 @@ unsigned long list_lru_count_node(struct list_lru *lru, int nid)
 EXPORT_SYMBOL_GPL(list_lru_count_node);
 
 static unsigned long
-__list_lru_walk_one(struct list_lru *lru, int nid, int memcg_idx,
-		    list_lru_walk_cb isolate, void *cb_arg,
-		    unsigned long *nr_to_walk)
+__list_lru_walk_list(struct list_lru_node *nlru, int memcg_idx,
+		     list_lru_walk_cb isolate, void *cb_arg,
+		     unsigned long *nr_to_walk)
 {
-
-	struct list_lru_node *nlru = &lru->node[nid];
 	struct list_lru_one *l;
 	struct list_head *item, *n;
 	unsigned long isolated = 0;
@@ -241,6 +268,42 @@ restart:
 	return isolated;
 }
 
+static unsigned long
+__list_lru_walk_one(struct list_lru *lru, int nid, int memcg_idx,
+		    list_lru_walk_cb isolate, void *cb_arg,
+		    unsigned long *nr_to_walk)
+{
+	struct list_lru_node *nlru = &lru->node[nid << lru->shift];
+	unsigned int nr = 1 << lru->shift, start, i;
+	unsigned long isolated = 0;
+
+	if (nr == 1)
+		return __list_lru_walk_list(nlru, memcg_idx, isolate, cb_arg,
+					    nr_to_walk);
+
+	/*
+	 * Give each list of the node a share of the scan so that no lock is
+	 * held for the whole of it and all lists age at the same rate.  The
+	 * share of a list that runs out of items is passed on to the ones
+	 * after it.  Start from a different list each time so that small
+	 * scans do not always hit the same one.
+	 */
+	start = READ_ONCE(lru->rotor);
+	WRITE_ONCE(lru->rotor, start + 1);
+	for (i = 0; i < nr && *nr_to_walk; i++) {
+		unsigned long batch, left;
+
+		batch = min(*nr_to_walk, *nr_to_walk / (nr - i) + 1);
+		left = batch;
+
+		isolated += __list_lru_walk_list(&nlru[(start + i) & (nr - 1)],
+						 memcg_idx, isolate, cb_arg,
+						 &left);
+		*nr_to_walk -= batch - left;
+	}
+	return isolated;
+}
+
 unsigned long
 list_lru_walk_one(struct list_lru *lru, int nid, struct mem_cgroup *memcg,
 		  list_lru_walk_cb isolate, void *cb_arg,
@@ -377,7 +440,7 @@ static int memcg_init_list_lru(struct list_lru *lru, bool memcg_aware)
 {
 	int i;
 
-	for (i = 0; i < nr_node_ids; i++) {
+	for (i = 0; i < list_lru_nr_lists(lru); i++) {
 		if (!memcg_aware)
 			lru->node[i].memcg_lrus = NULL;
 		else if (memcg_init_list_lru_node(&lru->node[i]))
@@ -397,7 +460,7 @@ static void memcg_destroy_list_lru(struct list_lru *lru)
 	if (!list_lru_memcg_aware(lru))
 		return;
 
-	for (i = 0; i < nr_node_ids; i++)
+	for (i = 0; i < list_lru_nr_lists(lru); i++)
 		memcg_destroy_list_lru_node(&lru->node[i]);
 }
 
@@ -409,7 +472,7 @@ static int memcg_update_list_lru(struct list_lru *lru,
 	if (!list_lru_memcg_aware(lru))
 		return 0;
 
-	for (i = 0; i < nr_node_ids; i++) {
+	for (i = 0; i < list_lru_nr_lists(lru); i++) {
 		if (memcg_update_list_lru_node(&lru->node[i],
 					       old_size, new_size))
 			goto fail;
@@ -430,7 +493,7 @@ static void memcg_cancel_update_list_lru(struct list_lru *lru,
 	if (!list_lru_memcg_aware(lru))
 		return;
 
-	for (i = 0; i < nr_node_ids; i++)
+	for (i = 0; i < list_lru_nr_lists(lru); i++)
 		memcg_cancel_update_list_lru_node(&lru->node[i],
 						  old_size, new_size);
 }
@@ -485,7 +548,7 @@ static void memcg_drain_list_lru(struct list_lru *lru,
 	if (!list_lru_memcg_aware(lru))
 		return;
 
-	for (i = 0; i < nr_node_ids; i++)
+	for (i = 0; i < list_lru_nr_lists(lru); i++)
 		memcg_drain_list_lru_node(&lru->node[i], src_idx, dst_idx);
 }
 
@@ -509,20 +572,31 @@ static void memcg_destroy_list_lru(struct list_lru *lru)
 }
 #endif /* CONFIG_MEMCG_KMEM */
 
-int __list_lru_init(struct list_lru *lru, bool memcg_aware,
+static unsigned int list_lru_shard_shift(void)
+{
+	unsigned int cpus = DIV_ROUND_UP(num_possible_cpus(), nr_node_ids);
+
+	cpus = min_t(unsigned int, cpus, LIST_LRU_MAX_SHARDS);
+	return ilog2(roundup_pow_of_two(cpus));
+}
+
+int __list_lru_init(struct list_lru *lru, bool memcg_aware, bool sharded,
 		    struct lock_class_key *key)
 {
 	int i;
-	size_t size = sizeof(*lru->node) * nr_node_ids;
+	size_t size;
 	int err = -ENOMEM;
 
 	memcg_get_cache_ids();
 
+	lru->shift = sharded ? list_lru_shard_shift() : 0;
+	lru->rotor = 0;
+	size = sizeof(*lru->node) * list_lru_nr_lists(lru);
 	lru->node = kzalloc(size, GFP_KERNEL);
 	if (!lru->node)
 		goto out;
 
-	for (i = 0; i < nr_node_ids; i++) {
+	for (i = 0; i < list_lru_nr_lists(lru); i++) {
 		spin_lock_init(&lru->node[i].lock);
 		if (key)
 			lockdep_set_class(&lru->node[i].lock, key);
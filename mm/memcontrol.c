@@ -54,10 +54,13 @@
 #include <linux/poll.h>
 #include <linux/sort.h>
 #include <linux/fs.h>
+#include <linux/dax.h>
 #include <linux/seq_file.h>
 #include <linux/vmpressure.h>
 #include <linux/mm_inline.h>
 #include <linux/swap_cgroup.h>
+#include <linux/tracehook.h>
+#include <linux/psi.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
 #include <linux/lockdep.h>
@@ -130,6 +133,9 @@ struct mem_cgroup_stat_cpu {
 	unsigned long events[MEMCG_NR_EVENTS];
 	unsigned long nr_page_events;
 	unsigned long targets[MEM_CGROUP_NTARGETS];
+	/* count[] and events[] as of the last mem_cgroup_flush_stats() */
+	long count_prev[MEM_CGROUP_STAT_NSTATS];
+	unsigned long events_prev[MEMCG_NR_EVENTS];
 };
 
 struct reclaim_iter {
@@ -323,11 +329,16 @@ struct mem_cgroup {
 	 */
 	struct mem_cgroup_stat_cpu __percpu *stat;
 	/*
-	 * used when a cpu is offlined or other synchronizations
-	 * See mem_cgroup_read_stat().
+	 * The percpu counters folded by mem_cgroup_flush_stats(): the totals
+	 * of this memcg alone, of its hierarchy, and what the hierarchy
+	 * still has to pass on to the parent.
 	 */
-	struct mem_cgroup_stat_cpu nocpu_base;
-	spinlock_t pcp_counter_lock;
+	long stat_local[MEM_CGROUP_STAT_NSTATS];
+	long stat_tree[MEM_CGROUP_STAT_NSTATS];
+	long stat_pending[MEM_CGROUP_STAT_NSTATS];
+	unsigned long events_local[MEMCG_NR_EVENTS];
+	unsigned long events_tree[MEMCG_NR_EVENTS];
+	unsigned long events_pending[MEMCG_NR_EVENTS];
 
 #if defined(CONFIG_MEMCG_KMEM) && defined(CONFIG_INET)
 	struct cg_proto tcp_mem;
@@ -773,56 +784,144 @@ mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_zone *mctz)
 /*
  * Implementation Note: reading percpu statistics for memcg.
  *
- * Both of vmstat[] and percpu_counter has threshold and do periodic
- * synchronization to implement "quick" read. There are trade-off between
- * reading cost and precision of value. Then, we may have a chance to implement
- * a periodic synchronizion of counter in memcg's counter.
+ * Summing the percpu counters on every read costs a walk over all cpus,
+ * and a walk over all cpus of every descendant for the hierarchical
+ * totals, which adds up quickly with thousands of cgroups. Instead the
+ * counters are folded into per-memcg totals by mem_cgroup_flush_stats(),
+ * which walks the hierarchy children first, so each memcg hands the
+ * changes of its whole subtree up to its parent in one go.
  *
- * But this _read() function is used for user interface now. The user accounts
- * memory usage by memory cgroup and he _always_ requires exact value because
- * he accounts memory. Even if we provide quick-and-fuzzy read, we always
- * have to visit all online cpus and make sum. So, for now, unnecessary
- * synchronization is not implemented. (just implemented for cpu hotplug)
- *
- * If there are kernel internal actions which can make use of some not-exact
- * value, and reading all cpu value can be performance bottleneck in some
- * common workload, threashold and synchonization as vmstat[] should be
- * implemented.
+ * Readers flush only once enough updates have piled up across the cpus,
+ * and a worker flushes every couple of seconds regardless, so what they
+ * see is off by at most a few batches of pages per cpu.
+ */
+#define MEMCG_STATS_BATCH	64
+#define MEMCG_FLUSH_INTERVAL	(2 * HZ)
+
+static DEFINE_PER_CPU(unsigned int, memcg_stats_updates);
+static atomic_t memcg_stats_flush_threshold = ATOMIC_INIT(0);
+static DEFINE_MUTEX(memcg_stats_flush_mutex);
+
+static void flush_memcg_stats_dwork(struct work_struct *w);
+static DECLARE_DEFERRABLE_WORK(memcg_stats_flush_dwork,
+			       flush_memcg_stats_dwork);
+
+/* Called with irqs disabled, after updating the percpu counters */
+static inline void memcg_stats_updated(long nr_pages)
+{
+	unsigned int x;
+
+	x = __this_cpu_add_return(memcg_stats_updates, abs(nr_pages));
+	if (x > MEMCG_STATS_BATCH) {
+		__this_cpu_write(memcg_stats_updates, 0);
+		atomic_inc(&memcg_stats_flush_threshold);
+	}
+}
+
+/*
+ * The memcg whose totals include those of @memcg: the parent with
+ * use_hierarchy, and the root, which accounts for everything, otherwise.
  */
+static struct mem_cgroup *mem_cgroup_stats_parent(struct mem_cgroup *memcg)
+{
+	struct cgroup_subsys_state *parent = memcg->css.parent;
+
+	if (!parent)
+		return NULL;
+	if (mem_cgroup_from_css(parent)->use_hierarchy)
+		return mem_cgroup_from_css(parent);
+	return root_mem_cgroup;
+}
+
+static void mem_cgroup_flush_one(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup *parent = mem_cgroup_stats_parent(memcg);
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct mem_cgroup_stat_cpu *statc = per_cpu_ptr(memcg->stat, cpu);
+
+		for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
+			long val = READ_ONCE(statc->count[i]);
+			long delta = val - statc->count_prev[i];
+
+			if (!delta)
+				continue;
+			statc->count_prev[i] = val;
+			memcg->stat_local[i] += delta;
+			memcg->stat_pending[i] += delta;
+		}
+		for (i = 0; i < MEMCG_NR_EVENTS; i++) {
+			unsigned long val = READ_ONCE(statc->events[i]);
+			unsigned long delta = val - statc->events_prev[i];
+
+			if (!delta)
+				continue;
+			statc->events_prev[i] = val;
+			memcg->events_local[i] += delta;
+			memcg->events_pending[i] += delta;
+		}
+	}
+
+	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
+		long delta = memcg->stat_pending[i];
+
+		if (!delta)
+			continue;
+		memcg->stat_pending[i] = 0;
+		memcg->stat_tree[i] += delta;
+		if (parent)
+			parent->stat_pending[i] += delta;
+	}
+	for (i = 0; i < MEMCG_NR_EVENTS; i++) {
+		unsigned long delta = memcg->events_pending[i];
+
+		if (!delta)
+			continue;
+		memcg->events_pending[i] = 0;
+		memcg->events_tree[i] += delta;
+		if (parent)
+			parent->events_pending[i] += delta;
+	}
+}
+
+static void __mem_cgroup_flush_stats(void)
+{
+	struct cgroup_subsys_state *css;
+
+	mutex_lock(&memcg_stats_flush_mutex);
+	atomic_set(&memcg_stats_flush_threshold, 0);
+	rcu_read_lock();
+	css_for_each_descendant_post(css, &root_mem_cgroup->css)
+		mem_cgroup_flush_one(mem_cgroup_from_css(css));
+	rcu_read_unlock();
+	mutex_unlock(&memcg_stats_flush_mutex);
+}
+
+static void mem_cgroup_flush_stats(void)
+{
+	if (atomic_read(&memcg_stats_flush_threshold) > num_online_cpus())
+		__mem_cgroup_flush_stats();
+}
+
+static void flush_memcg_stats_dwork(struct work_struct *w)
+{
+	__mem_cgroup_flush_stats();
+	queue_delayed_work(system_unbound_wq, &memcg_stats_flush_dwork,
+			   MEMCG_FLUSH_INTERVAL);
+}
+
+/* Values as of the last flush, which the caller may have to trigger */
 static long mem_cgroup_read_stat(struct mem_cgroup *memcg,
 				 enum mem_cgroup_stat_index idx)
 {
-	long val = 0;
-	int cpu;
-
-	get_online_cpus();
-	for_each_online_cpu(cpu)
-		val += per_cpu(memcg->stat->count[idx], cpu);
-#ifdef CONFIG_HOTPLUG_CPU
-	spin_lock(&memcg->pcp_counter_lock);
-	val += memcg->nocpu_base.count[idx];
-	spin_unlock(&memcg->pcp_counter_lock);
-#endif
-	put_online_cpus();
-	return val;
+	return READ_ONCE(memcg->stat_local[idx]);
 }
 
 static unsigned long mem_cgroup_read_events(struct mem_cgroup *memcg,
 					    enum mem_cgroup_events_index idx)
 {
-	unsigned long val = 0;
-	int cpu;
-
-	get_online_cpus();
-	for_each_online_cpu(cpu)
-		val += per_cpu(memcg->stat->events[idx], cpu);
-#ifdef CONFIG_HOTPLUG_CPU
-	spin_lock(&memcg->pcp_counter_lock);
-	val += memcg->nocpu_base.events[idx];
-	spin_unlock(&memcg->pcp_counter_lock);
-#endif
-	put_online_cpus();
-	return val;
+	return READ_ONCE(memcg->events_local[idx]);
 }
 
 static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
@@ -853,6 +952,7 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 	}
 
 	__this_cpu_add(memcg->stat->nr_page_events, nr_pages);
+	memcg_stats_updated(nr_pages);
 }
 
 unsigned long mem_cgroup_get_lru_size(struct lruvec *lruvec, enum lru_list lru)
@@ -1469,6 +1569,8 @@ void mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
 		K((u64)page_counter_read(&memcg->kmem)),
 		K((u64)memcg->kmem.limit), memcg->kmem.failcnt);
 
+	mem_cgroup_flush_stats();
+
 	for_each_mem_cgroup_tree(iter, memcg) {
 		pr_info("Memory cgroup stats for ");
 		pr_cont_cgroup_path(iter->css.cgroup);
@@ -2049,12 +2151,16 @@ void mem_cgroup_update_page_stat(struct mem_cgroup *memcg,
 
 /*
  * size of first charge trial. "32" comes from vmscan.c's magic value.
- * TODO: maybe necessary to use big numbers in big irons.
+ * A cpu that keeps charging to the same memcg, far from its limit, gets
+ * its batch doubled at every refill, up to CHARGE_BATCH_MAX; switching
+ * memcgs or draining under limit pressure starts over at CHARGE_BATCH.
  */
 #define CHARGE_BATCH	32U
+#define CHARGE_BATCH_MAX	512U
 struct memcg_stock_pcp {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	unsigned int nr_pages;
+	unsigned int batch;	/* charge batch for cached */
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	0
@@ -2078,7 +2184,7 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	struct memcg_stock_pcp *stock;
 	bool ret = false;
 
-	if (nr_pages > CHARGE_BATCH)
+	if (nr_pages > CHARGE_BATCH_MAX)
 		return ret;
 
 	stock = &get_cpu_var(memcg_stock);
@@ -2105,6 +2211,7 @@ static void drain_stock(struct memcg_stock_pcp *stock)
 		stock->nr_pages = 0;
 	}
 	stock->cached = NULL;
+	stock->batch = CHARGE_BATCH;
 }
 
 /*
@@ -2129,11 +2236,38 @@ static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	if (stock->cached != memcg) { /* reset if necessary */
 		drain_stock(stock);
 		stock->cached = memcg;
+	} else if (!stock->nr_pages && stock->batch < CHARGE_BATCH_MAX &&
+		   mem_cgroup_margin(memcg) >
+		   4 * stock->batch * num_online_cpus()) {
+		/* used up: charge more at once next time, if there's room */
+		stock->batch *= 2;
 	}
 	stock->nr_pages += nr_pages;
 	put_cpu_var(memcg_stock);
 }
 
+/* The batch to charge @memcg in from this cpu */
+static unsigned int charge_batch(struct mem_cgroup *memcg)
+{
+	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+	unsigned int batch = CHARGE_BATCH;
+
+	if (stock->cached == memcg)
+		batch = stock->batch;
+	put_cpu_var(memcg_stock);
+	return batch;
+}
+
+/* @memcg got close to its limit: stop charging ahead from this cpu */
+static void reset_charge_batch(struct mem_cgroup *memcg)
+{
+	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+
+	if (stock->cached == memcg)
+		stock->batch = CHARGE_BATCH;
+	put_cpu_var(memcg_stock);
+}
+
 /*
  * Drains all per-CPU charge caches for given root_memcg resp. subtree
  * of the hierarchy under it.
@@ -2169,37 +2303,12 @@ static void drain_all_stock(struct mem_cgroup *root_memcg)
 	mutex_unlock(&percpu_charge_mutex);
 }
 
-/*
- * This function drains percpu counter value from DEAD cpu and
- * move it to local cpu. Note that this function can be preempted.
- */
-static void mem_cgroup_drain_pcp_counter(struct mem_cgroup *memcg, int cpu)
-{
-	int i;
-
-	spin_lock(&memcg->pcp_counter_lock);
-	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
-		long x = per_cpu(memcg->stat->count[i], cpu);
-
-		per_cpu(memcg->stat->count[i], cpu) = 0;
-		memcg->nocpu_base.count[i] += x;
-	}
-	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++) {
-		unsigned long x = per_cpu(memcg->stat->events[i], cpu);
-
-		per_cpu(memcg->stat->events[i], cpu) = 0;
-		memcg->nocpu_base.events[i] += x;
-	}
-	spin_unlock(&memcg->pcp_counter_lock);
-}
-
 static int memcg_cpu_hotplug_callback(struct notifier_block *nb,
 					unsigned long action,
 					void *hcpu)
 {
 	int cpu = (unsigned long)hcpu;
 	struct memcg_stock_pcp *stock;
-	struct mem_cgroup *iter;
 
 	if (action == CPU_ONLINE)
 		return NOTIFY_OK;
@@ -2207,9 +2316,7 @@ static int memcg_cpu_hotplug_callback(struct notifier_block *nb,
 	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
 		return NOTIFY_OK;
 
-	for_each_mem_cgroup(iter)
-		mem_cgroup_drain_pcp_counter(iter, cpu);
-
+	/* the stats flush reads the counters of offline cpus as well */
 	stock = &per_cpu(memcg_stock, cpu);
 	drain_stock(stock);
 	return NOTIFY_OK;
@@ -2218,7 +2325,7 @@ static int memcg_cpu_hotplug_callback(struct notifier_block *nb,
 static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		      unsigned int nr_pages)
 {
-	unsigned int batch = max(CHARGE_BATCH, nr_pages);
+	unsigned int batch;
 	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct mem_cgroup *mem_over_limit;
 	struct page_counter *counter;
@@ -2229,6 +2336,7 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 
 	if (mem_cgroup_is_root(memcg))
 		goto done;
+	batch = max(charge_batch(memcg), nr_pages);
 retry:
 	if (consume_stock(memcg, nr_pages))
 		goto done;
@@ -2246,6 +2354,7 @@ retry:
 	}
 
 	if (batch > nr_pages) {
+		reset_charge_batch(memcg);
 		batch = nr_pages;
 		goto retry;
 	}
@@ -2323,20 +2432,123 @@ done_restock:
 	css_get_many(&memcg->css, batch);
 	if (batch > nr_pages)
 		refill_stock(memcg, batch - nr_pages);
-	if (!(gfp_mask & __GFP_WAIT))
-		goto done;
 	/*
-	 * If the hierarchy is above the normal consumption range,
-	 * make the charging task trim their excess contribution.
+	 * If the hierarchy is above the normal consumption range, have
+	 * the charging task reclaim, and be throttled, on its way back to
+	 * userland, where it holds no locks and GFP_KERNEL can always be
+	 * used.  Kernel threads and interrupts never get there; memory.high
+	 * is not enforced against them.  @memcg is not recorded: it most
+	 * likely matches current's, and mem_cgroup_handle_over_high()
+	 * checks the high boundaries again anyway.
 	 */
+	if (in_interrupt() || (current->flags & PF_KTHREAD))
+		goto done;
 	do {
-		if (page_counter_read(&memcg->memory) <= memcg->high)
+		if (page_counter_read(&memcg->memory) > memcg->high) {
+			current->memcg_nr_pages_over_high += batch;
+			set_notify_resume(current);
+			break;
+		}
+	} while ((memcg = parent_mem_cgroup(memcg)));
+done:
+	return ret;
+}
+
+static void reclaim_high(struct mem_cgroup *memcg, unsigned int nr_pages,
+			 gfp_t gfp_mask)
+{
+	do {
+		if (page_counter_read(&memcg->memory) <= READ_ONCE(memcg->high))
 			continue;
 		mem_cgroup_events(memcg, MEMCG_HIGH, 1);
 		try_to_free_mem_cgroup_pages(memcg, nr_pages, gfp_mask, true);
 	} while ((memcg = parent_mem_cgroup(memcg)));
-done:
-	return ret;
+}
+
+/*
+ * Throttling over memory.high: a task is put to sleep for a time that
+ * grows with the square of the largest relative overage in its
+ * hierarchy, scaled by how much it charged, so that a workload slightly
+ * over the boundary barely notices while a runaway one is slowed down
+ * until reclaim catches up.  Overages are fixed point fractions of the
+ * boundary: 1% over goes unthrottled, 5% costs about 160ms per batch of
+ * pages charged, and 10% about 640ms.
+ */
+#define MEMCG_MAX_HIGH_DELAY_JIFFIES	(2UL * HZ)
+#define MEMCG_DELAY_PRECISION_SHIFT	20
+#define MEMCG_DELAY_SCALING_SHIFT	14
+
+static unsigned long calculate_high_delay(struct mem_cgroup *memcg,
+					  unsigned int nr_pages)
+{
+	u64 penalty_jiffies, max_overage = 0;
+
+	do {
+		unsigned long usage, high;
+		u64 overage;
+
+		usage = page_counter_read(&memcg->memory);
+		high = READ_ONCE(memcg->high);
+		if (usage <= high)
+			continue;
+
+		/* Prevent division by 0 in overage calculation */
+		high = max(high, 1UL);
+		overage = usage - high;
+		overage <<= MEMCG_DELAY_PRECISION_SHIFT;
+		overage = div64_u64(overage, high);
+		if (overage > max_overage)
+			max_overage = overage;
+	} while ((memcg = parent_mem_cgroup(memcg)));
+
+	if (!max_overage)
+		return 0;
+
+	/* clamped first, so that the square can't overflow */
+	max_overage = min_t(u64, max_overage,
+			    1ULL << (MEMCG_DELAY_PRECISION_SHIFT + 4));
+	penalty_jiffies = max_overage * max_overage * HZ;
+	penalty_jiffies >>= MEMCG_DELAY_PRECISION_SHIFT;
+	penalty_jiffies >>= MEMCG_DELAY_SCALING_SHIFT;
+
+	/* Charging ahead more than a batch costs proportionally more */
+	penalty_jiffies = div_u64(penalty_jiffies * nr_pages, CHARGE_BATCH);
+
+	return min_t(u64, penalty_jiffies, MEMCG_MAX_HIGH_DELAY_JIFFIES);
+}
+
+/*
+ * Scheduled by try_charge() to be called from the userland return path
+ * and reclaims memory over the high limit.
+ */
+void mem_cgroup_handle_over_high(void)
+{
+	unsigned int nr_pages = current->memcg_nr_pages_over_high;
+	unsigned long penalty_jiffies;
+	struct mem_cgroup *memcg;
+	unsigned long pflags;
+
+	if (likely(!nr_pages))
+		return;
+
+	current->memcg_nr_pages_over_high = 0;
+
+	memcg = get_mem_cgroup_from_mm(current->mm);
+	reclaim_high(memcg, nr_pages, GFP_KERNEL);
+
+	/*
+	 * Whatever reclaim could not get back is made up for in time, so
+	 * the task doesn't keep growing the overage at full speed.  Delays
+	 * too short to matter are not worth a trip through the scheduler.
+	 */
+	penalty_jiffies = calculate_high_delay(memcg, nr_pages);
+	if (penalty_jiffies > HZ / 100) {
+		psi_memstall_enter(&pflags);
+		schedule_timeout_killable(penalty_jiffies);
+		psi_memstall_leave(&pflags);
+	}
+
+	css_put(&memcg->css);
 }
 
 static void cancel_charge(struct mem_cgroup *memcg, unsigned int nr_pages)
@@ -2489,17 +2701,63 @@ int memcg_charge_kmem(struct mem_cgroup *memcg, gfp_t gfp,
 	return ret;
 }
 
-void memcg_uncharge_kmem(struct mem_cgroup *memcg, unsigned long nr_pages)
+static void __memcg_uncharge_kmem(struct mem_cgroup *memcg,
+				  unsigned long nr_pages)
 {
 	page_counter_uncharge(&memcg->memory, nr_pages);
 	if (do_swap_account)
 		page_counter_uncharge(&memcg->memsw, nr_pages);
 
 	page_counter_uncharge(&memcg->kmem, nr_pages);
+}
 
+void memcg_uncharge_kmem(struct mem_cgroup *memcg, unsigned long nr_pages)
+{
+	__memcg_uncharge_kmem(memcg, nr_pages);
 	css_put_many(&memcg->css, nr_pages);
 }
 
+/*
+ * Slab pages don't pin the memcg they are charged to, they pin their cache
+ * instead, which in turn holds a reference to its memcg. This way a removed
+ * cgroup can hand its caches over to the parent and be freed, while the
+ * objects still allocated from them live on. The charges are hierarchical,
+ * so uncharging whatever memcg the cache points to at free time is correct
+ * for every level above the removed cgroup.
+ */
+int __memcg_charge_slab(struct kmem_cache *s, gfp_t gfp, int order)
+{
+	unsigned int nr_pages = 1 << order;
+	struct mem_cgroup *memcg;
+	int ret;
+
+	rcu_read_lock();
+	do {
+		memcg = READ_ONCE(s->memcg_params.memcg);
+	} while (!css_tryget(&memcg->css));
+	rcu_read_unlock();
+
+	ret = memcg_charge_kmem(memcg, gfp, nr_pages);
+	if (!ret) {
+		percpu_ref_get_many(&s->memcg_params.refcnt, nr_pages);
+		css_put_many(&memcg->css, nr_pages);
+	}
+
+	css_put(&memcg->css);
+	return ret;
+}
+
+void __memcg_uncharge_slab(struct kmem_cache *s, int order)
+{
+	unsigned int nr_pages = 1 << order;
+
+	rcu_read_lock();
+	__memcg_uncharge_kmem(READ_ONCE(s->memcg_params.memcg), nr_pages);
+	rcu_read_unlock();
+
+	percpu_ref_put_many(&s->memcg_params.refcnt, nr_pages);
+}
+
 /*
  * helper for acessing a memcg's index. It will be used as an index in the
  * child cache array in kmem_cache, and also to derive its name. This function
@@ -2644,8 +2902,18 @@ struct kmem_cache *__memcg_kmem_get_cache(struct kmem_cache *cachep)
 		goto out;
 
 	memcg_cachep = cache_from_memcg_idx(cachep, kmemcg_id);
-	if (likely(memcg_cachep))
+	if (likely(memcg_cachep)) {
+		/*
+		 * Pin the cache rather than the memcg for the duration of the
+		 * allocation: the cache may be handed over to the parent
+		 * memcg at any time once its cgroup is removed.
+		 */
+		if (unlikely(!percpu_ref_tryget_live(
+					&memcg_cachep->memcg_params.refcnt)))
+			memcg_cachep = cachep;
+		css_put(&memcg->css);
 		return memcg_cachep;
+	}
 
 	/*
 	 * If we are in a safe context (can wait, and not in interrupt
@@ -2668,7 +2936,7 @@ out:
 void __memcg_kmem_put_cache(struct kmem_cache *cachep)
 {
 	if (!is_root_cache(cachep))
-		css_put(&cachep->memcg_params.memcg->css);
+		percpu_ref_put(&cachep->memcg_params.refcnt);
 }
 
 /*
@@ -3114,12 +3382,7 @@ out:
 static unsigned long tree_stat(struct mem_cgroup *memcg,
 			       enum mem_cgroup_stat_index idx)
 {
-	struct mem_cgroup *iter;
-	long val = 0;
-
-	/* Per-cpu values can be negative, use a signed accumulator */
-	for_each_mem_cgroup_tree(iter, memcg)
-		val += mem_cgroup_read_stat(iter, idx);
+	long val = READ_ONCE(memcg->stat_tree[idx]);
 
 	if (val < 0) /* race ? */
 		val = 0;
@@ -3131,6 +3394,7 @@ static inline u64 mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
 	u64 val;
 
 	if (mem_cgroup_is_root(memcg)) {
+		mem_cgroup_flush_stats();
 		val = tree_stat(memcg, MEM_CGROUP_STAT_CACHE);
 		val += tree_stat(memcg, MEM_CGROUP_STAT_RSS);
 		if (swap)
@@ -3462,6 +3726,8 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 		     MEM_CGROUP_EVENTS_NSTATS);
 	BUILD_BUG_ON(ARRAY_SIZE(mem_cgroup_lru_names) != NR_LRU_LISTS);
 
+	mem_cgroup_flush_stats();
+
 	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
 		if (i == MEM_CGROUP_STAT_SWAP && !do_swap_account)
 			continue;
@@ -3490,23 +3756,17 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 			   (u64)memsw * PAGE_SIZE);
 
 	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
-		long long val = 0;
+		long long val;
 
 		if (i == MEM_CGROUP_STAT_SWAP && !do_swap_account)
 			continue;
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_read_stat(mi, i) * PAGE_SIZE;
+		val = (long long)READ_ONCE(memcg->stat_tree[i]) * PAGE_SIZE;
 		seq_printf(m, "total_%s %lld\n", mem_cgroup_stat_names[i], val);
 	}
 
-	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++) {
-		unsigned long long val = 0;
-
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_read_events(mi, i);
-		seq_printf(m, "total_%s %llu\n",
-			   mem_cgroup_events_names[i], val);
-	}
+	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++)
+		seq_printf(m, "total_%s %lu\n", mem_cgroup_events_names[i],
+			   READ_ONCE(memcg->events_tree[i]));
 
 	for (i = 0; i < NR_LRU_LISTS; i++) {
 		unsigned long long val = 0;
@@ -3975,11 +4235,14 @@ static void memcg_deactivate_kmem(struct mem_cgroup *memcg)
 
 static void memcg_destroy_kmem(struct mem_cgroup *memcg)
 {
-	if (memcg->kmem_acct_activated) {
-		memcg_destroy_kmem_caches(memcg);
+	/*
+	 * The caches of this memcg were handed over to the parent when it
+	 * went offline and are destroyed once empty, and slab pages freed
+	 * since then were uncharged from the parent. So the kmem counter
+	 * may legitimately still show slab pages here.
+	 */
+	if (memcg->kmem_acct_activated)
 		static_key_slow_dec(&memcg_kmem_enabled_key);
-		WARN_ON(page_counter_read(&memcg->kmem));
-	}
 	mem_cgroup_sockets_destroy(memcg);
 }
 #else
@@ -4381,7 +4644,6 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 	memcg->stat = alloc_percpu(struct mem_cgroup_stat_cpu);
 	if (!memcg->stat)
 		goto out_free;
-	spin_lock_init(&memcg->pcp_counter_lock);
 	return memcg;
 
 out_free:
@@ -4554,6 +4816,11 @@ static void mem_cgroup_css_free(struct cgroup_subsys_state *css)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
 
+	/* hand what is left over to the parent, which outlives us */
+	mutex_lock(&memcg_stats_flush_mutex);
+	mem_cgroup_flush_one(memcg);
+	mutex_unlock(&memcg_stats_flush_mutex);
+
 	memcg_destroy_kmem(memcg);
 	__mem_cgroup_free(memcg);
 }
@@ -4867,6 +5134,10 @@ static enum mc_target_type get_mctgt_type_thp(struct vm_area_struct *vma,
 	struct page *page = NULL;
 	enum mc_target_type ret = MC_TARGET_NONE;
 
+	/* DAX PMDs map memory without struct pages */
+	if (vma_is_dax(vma))
+		return ret;
+
 	page = pmd_page(pmd);
 	VM_BUG_ON_PAGE(!page || !PageHead(page), page);
 	if (!(mc.flags & MOVE_ANON))
@@ -5344,6 +5615,8 @@ static int memory_events_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
 
+	mem_cgroup_flush_stats();
+
 	seq_printf(m, "low %lu\n", mem_cgroup_read_events(memcg, MEMCG_LOW));
 	seq_printf(m, "high %lu\n", mem_cgroup_read_events(memcg, MEMCG_HIGH));
 	seq_printf(m, "max %lu\n", mem_cgroup_read_events(memcg, MEMCG_MAX));
@@ -5616,6 +5889,7 @@ static void uncharge_batch(struct mem_cgroup *memcg, unsigned long pgpgout,
 	__this_cpu_sub(memcg->stat->count[MEM_CGROUP_STAT_RSS_HUGE], nr_huge);
 	__this_cpu_add(memcg->stat->events[MEM_CGROUP_EVENTS_PGPGOUT], pgpgout);
 	__this_cpu_add(memcg->stat->nr_page_events, nr_pages);
+	memcg_stats_updated(nr_pages);
 	memcg_check_events(memcg, dummy_page);
 	local_irq_restore(flags);
 
@@ -5788,6 +6062,10 @@ static int __init mem_cgroup_init(void)
 		INIT_WORK(&per_cpu_ptr(&memcg_stock, cpu)->work,
 			  drain_local_stock);
 
+	if (!mem_cgroup_disabled())
+		queue_delayed_work(system_unbound_wq, &memcg_stats_flush_dwork,
+				   MEMCG_FLUSH_INTERVAL);
+
 	for_each_node(node) {
 		struct mem_cgroup_tree_per_node *rtpn;
 		int zone;
@@ -61,6 +61,10 @@
 #include <linux/string.h>
 #include <linux/dma-debug.h>
 #include <linux/debugfs.h>
+#include <linux/vmacache.h>
+#include <linux/userfaultfd_k.h>
+#include <linux/dax.h>
+#include <linux/workqueue.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -143,6 +147,15 @@ void sync_mm_rss(struct mm_struct *mm)
 			current->rss_stat.count[i] = 0;
 		}
 	}
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	for (i = 0; i < NR_SPF_COUNTERS; i++) {
+		if (current->rss_stat.spf[i]) {
+			atomic_long_add(current->rss_stat.spf[i],
+					&mm->spf_stat[i]);
+			current->rss_stat.spf[i] = 0;
+		}
+	}
+#endif
 	current->rss_stat.events = 0;
 }
 
@@ -947,6 +960,227 @@ again:
 	return 0;
 }
 
+#ifdef CONFIG_FORK_SHARE_PTE_TABLES
+/*
+ * With MMF_SHARE_PTE_TABLES, fork hands the child the parent's last level
+ * page tables instead of copying them: the pmd entry is write-protected in
+ * both mms, which the hardware honours for every pte below it, and the
+ * number of extra sharers is kept in the table page's otherwise unused
+ * _mapcount. The pages keep a single mapping, which belongs to the table.
+ *
+ * Any change to the ptes of a shared table, including faults, first gives
+ * the mm a private copy (unshare_pte_table), so shared tables only ever
+ * hold present ptes. rmap leaves them alone, which means their pages are
+ * not reclaimed or migrated until the table is unshared or released.
+ * Shared tables never straddle a vma boundary: vma_adjust() unshares them.
+ */
+static bool pte_table_shareable(struct vm_area_struct *vma,
+				unsigned long addr, unsigned long end)
+{
+	if (!USE_SPLIT_PTE_PTLOCKS)
+		return false;
+	if (vma->vm_file || !vma->anon_vma || !is_cow_mapping(vma->vm_flags))
+		return false;
+	if (vma->vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP))
+		return false;
+	return !(addr & ~PMD_MASK) && end - addr == PMD_SIZE;
+}
+
+/*
+ * Add @delta for each page mapped by the pte table at @pte to @rss.
+ * Returns false if the table holds anything other than present ptes.
+ */
+static bool pte_table_rss(struct vm_area_struct *vma, pte_t *pte,
+			  unsigned long addr, int *rss, int delta)
+{
+	int i;
+
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (pte_none(*pte))
+			continue;
+		if (!pte_present(*pte))
+			return false;
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page)
+			continue;
+		if (PageAnon(page))
+			rss[MM_ANONPAGES] += delta;
+		else
+			rss[MM_FILEPAGES] += delta;
+	}
+	return true;
+}
+
+static bool share_pte_table(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
+		unsigned long addr, unsigned long end)
+{
+	int rss[NR_MM_COUNTERS];
+	spinlock_t *ptl;
+	pte_t *pte;
+	bool shared;
+
+	if (!test_bit(MMF_SHARE_PTE_TABLES, &src_mm->flags) ||
+	    !pte_table_shareable(vma, addr, end))
+		return false;
+
+	init_rss_vec(rss);
+	pte = pte_offset_map_lock(src_mm, src_pmd, addr, &ptl);
+	shared = pte_table_rss(vma, pte, addr, rss, 1);
+	if (shared) {
+		atomic_inc(&pmd_page(*src_pmd)->_mapcount);
+		set_pmd(src_pmd, pmd_wrprotect(*src_pmd));
+		set_pmd(dst_pmd, *src_pmd);
+		atomic_long_inc(&dst_mm->nr_ptes);
+		add_mm_rss_vec(dst_mm, rss);
+	}
+	pte_unmap_unlock(pte, ptl);
+	return shared;
+}
+
+/*
+ * Give the mm of @vma its own copy of the shared pte table mapped by @pmd,
+ * or just make the pmd writable again if everybody else has gone away.
+ * The copy takes an extra mapping of each page, write-protected in both
+ * tables for COW, as at fork.
+ */
+int unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+		      unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start = address & PMD_MASK;
+	unsigned long addr;
+	int rss[NR_MM_COUNTERS];
+	pte_t *src_pte, *dst_pte;
+	spinlock_t *ptl;
+	pgtable_t new;
+	int i;
+
+	new = pte_alloc_one(mm, start);
+	if (!new)
+		return -ENOMEM;
+
+	src_pte = pte_offset_map_lock(mm, pmd, start, &ptl);
+	/* Another thread of this mm may have beaten us to it */
+	if (!pmd_shared_pte_table(*pmd))
+		goto out;
+
+	if (!atomic_add_unless(&pmd_page(*pmd)->_mapcount, -1, -1)) {
+		if (!(vma->vm_flags & VM_WRITE)) {
+			for (i = 0, addr = start; i < PTRS_PER_PTE;
+			     i++, addr += PAGE_SIZE)
+				if (pte_present(src_pte[i]))
+					ptep_set_wrprotect(mm, addr,
+							   src_pte + i);
+		}
+		set_pmd(pmd, pmd_mkwrite(*pmd));
+		goto out;
+	}
+
+	/* The mm already accounts for these pages, so rss is dropped */
+	init_rss_vec(rss);
+	dst_pte = kmap_atomic(new);
+	for (i = 0, addr = start; i < PTRS_PER_PTE; i++, addr += PAGE_SIZE)
+		if (!pte_none(src_pte[i]))
+			copy_one_pte(mm, mm, dst_pte + i, src_pte + i, vma,
+				     addr, rss);
+	kunmap_atomic(dst_pte);
+
+	smp_wmb(); /* See comment in __pte_alloc */
+	pmd_populate(mm, pmd, new);
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+	new = NULL;
+out:
+	pte_unmap_unlock(src_pte, ptl);
+	if (new)
+		pte_free(mm, new);
+	return 0;
+}
+
+/*
+ * Unshare every pte table of @vma's mm that maps part of [start, end),
+ * or straddles @start or @end; start == end checks a single boundary.
+ */
+int unshare_pte_tables(struct vm_area_struct *vma, unsigned long start,
+		       unsigned long end)
+{
+	unsigned long addr;
+	pmd_t *pmd;
+	int err;
+
+	if (vma->vm_file || !vma->anon_vma)
+		return 0;
+
+	for (addr = start & PMD_MASK; addr < end || addr < start;
+	     addr += PMD_SIZE) {
+		pmd = mm_find_pmd(vma->vm_mm, addr);
+		if (!pmd || !pmd_shared_pte_table(*pmd))
+			continue;
+		err = unshare_pte_table(vma, pmd, addr);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * Drop this mm's share of a shared pte table when [addr, end) covers all
+ * of it. Returns false if the ptes still have to be zapped, because the
+ * table turned out to be ours alone or had to be unshared.
+ */
+static bool zap_shared_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+				 unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int rss[NR_MM_COUNTERS];
+	spinlock_t *ptl;
+	bool dropped;
+	pte_t *pte;
+
+	if ((addr & ~PMD_MASK) || end - addr != PMD_SIZE) {
+		/*
+		 * Callers unshare partial ranges first, see
+		 * unshare_pte_tables(). Dropping the whole table is the
+		 * only safe fallback.
+		 */
+		if (!WARN_ON_ONCE(unshare_pte_table(vma, pmd, addr)))
+			return false;
+		addr &= PMD_MASK;
+		end = addr + PMD_SIZE;
+	}
+
+	init_rss_vec(rss);
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	dropped = atomic_add_unless(&pmd_page(*pmd)->_mapcount, -1, -1);
+	if (dropped) {
+		pte_table_rss(vma, pte, addr, rss, -1);
+		add_mm_rss_vec(mm, rss);
+		pmd_clear(pmd);
+		atomic_long_dec(&mm->nr_ptes);
+		/* The last sharer may free the table once we unlock it */
+		flush_tlb_range(vma, addr, end);
+	}
+	pte_unmap_unlock(pte, ptl);
+	return dropped;
+}
+#else
+static inline bool share_pte_table(struct mm_struct *dst_mm,
+		struct mm_struct *src_mm, pmd_t *dst_pmd, pmd_t *src_pmd,
+		struct vm_area_struct *vma, unsigned long addr,
+		unsigned long end)
+{
+	return false;
+}
+
+static inline bool zap_shared_pte_table(struct vm_area_struct *vma,
+		pmd_t *pmd, unsigned long addr, unsigned long end)
+{
+	return false;
+}
+#endif /* CONFIG_FORK_SHARE_PTE_TABLES */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -973,6 +1207,9 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (share_pte_table(dst_mm, src_mm, dst_pmd, src_pmd,
+				    vma, addr, next))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -1086,6 +1323,7 @@ again:
 	init_rss_vec(rss);
 	start_pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
 	pte = start_pte;
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 	do {
 		pte_t ptent = *pte;
@@ -1195,7 +1433,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		if (pmd_trans_huge(*pmd)) {
 			if (next - addr != HPAGE_PMD_SIZE) {
 #ifdef CONFIG_DEBUG_VM
-				if (!rwsem_is_locked(&tlb->mm->mmap_sem)) {
+				/* DAX truncate unmaps under i_mmap_rwsem only */
+				if (!vma_is_dax(vma) &&
+				    !rwsem_is_locked(&tlb->mm->mmap_sem)) {
 					pr_err("%s: mmap_sem is unlocked! addr=0x%lx end=0x%lx vma->vm_start=0x%lx vma->vm_end=0x%lx\n",
 						__func__, addr, end,
 						vma->vm_start,
@@ -1217,6 +1457,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		if (pmd_shared_pte_table(*pmd) &&
+		    zap_shared_pte_table(vma, pmd, addr, next))
+			goto next;
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -2677,6 +2920,10 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (check_stack_guard_page(vma, address) < 0)
 		return VM_FAULT_SIGSEGV;
 
+	/* Deliver the page fault to userland */
+	if (userfaultfd_missing(vma))
+		return handle_userfault(vma, address, flags, VM_UFFD_MISSING);
+
 	/* Use the zero-page for reads */
 	if (!(flags & FAULT_FLAG_WRITE) && !mm_forbids_zeropage(mm)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
@@ -3210,7 +3457,7 @@ static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
 
 out:
 	if (page_nid != -1)
-		task_numa_fault(last_cpupid, page_nid, 1, flags);
+		task_numa_fault(vma, last_cpupid, page_nid, 1, flags);
 	return 0;
 }
 
@@ -3291,6 +3538,37 @@ unlock:
 	return 0;
 }
 
+static int create_huge_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long address, pmd_t *pmd, unsigned int flags)
+{
+	if (!vma->vm_ops)
+		return do_huge_pmd_anonymous_page(mm, vma, address, pmd, flags);
+	if (vma->vm_ops->pmd_fault)
+		return vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+	return VM_FAULT_FALLBACK;
+}
+
+static int wp_huge_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long address, pmd_t *pmd, pmd_t orig_pmd,
+			unsigned int flags)
+{
+	int ret;
+
+	if (!vma->vm_ops)
+		return do_huge_pmd_wp_page(mm, vma, address, pmd, orig_pmd);
+	if (vma->vm_ops->pmd_fault) {
+		ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+		/*
+		 * A file PMD that can't be made writable, e.g. because the
+		 * write needs to COW, is torn down so PTEs can be used.
+		 */
+		if (ret & VM_FAULT_FALLBACK)
+			split_huge_page_pmd(vma, address, pmd);
+		return ret;
+	}
+	return VM_FAULT_FALLBACK;
+}
+
 /*
  * By the time we get here, we already hold the mm semaphore
  *
@@ -3316,10 +3594,7 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (!pmd)
 		return VM_FAULT_OOM;
 	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
-		int ret = VM_FAULT_FALLBACK;
-		if (!vma->vm_ops)
-			ret = do_huge_pmd_anonymous_page(mm, vma, address,
-					pmd, flags);
+		int ret = create_huge_pmd(mm, vma, address, pmd, flags);
 		if (!(ret & VM_FAULT_FALLBACK))
 			return ret;
 	} else {
@@ -3343,8 +3618,8 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 							     orig_pmd, pmd);
 
 			if (dirty && !pmd_write(orig_pmd)) {
-				ret = do_huge_pmd_wp_page(mm, vma, address, pmd,
-							  orig_pmd);
+				ret = wp_huge_pmd(mm, vma, address, pmd,
+						  orig_pmd, flags);
 				if (!(ret & VM_FAULT_FALLBACK))
 					return ret;
 			} else {
@@ -3376,6 +3651,10 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	 */
 	if (unlikely(pmd_trans_unstable(pmd)))
 		return 0;
+	/* Every fault below a pte table shared by fork needs a private one */
+	if (unlikely(pmd_shared_pte_table(*pmd)) &&
+	    unshare_pte_table(vma, pmd, address))
+		return VM_FAULT_OOM;
 	/*
 	 * A regular pmd is established and it can't morph into a huge pmd
 	 * from under us anymore at this point because we hold the mmap_sem
@@ -3431,6 +3710,184 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void count_spf_event(struct mm_struct *mm, int item)
+{
+#ifdef SPLIT_RSS_COUNTING
+	current->rss_stat.spf[item]++;
+#else
+	atomic_long_inc(&mm->spf_stat[item]);
+#endif
+}
+
+/*
+ * Walk down to the pte of @address with interrupts disabled, which keeps
+ * the page tables from being freed under us as gup_fast relies on.
+ * Returns NULL if there is no pte table to map, or it is a huge pmd.
+ */
+static pte_t *spf_walk_pte(struct mm_struct *mm, unsigned long address,
+			   pmd_t **pmdp, pmd_t *pmdval)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		return NULL;
+	pmd = *pmdp = pmd_offset(pud, address);
+	*pmdval = ACCESS_ONCE(*pmd);
+	if (pmd_none(*pmdval) || pmd_trans_huge(*pmdval) ||
+	    unlikely(pmd_bad(*pmdval)))
+		return NULL;
+	/* Unsharing allocates and needs mmap_sem, leave it to the slow path */
+	if (pmd_shared_pte_table(*pmdval))
+		return NULL;
+	return pte_offset_map(pmd, address);
+}
+
+/*
+ * Try to handle a fault on private anonymous memory without taking the
+ * mmap_sem.  The vma is found through the per-thread vmacache and copied;
+ * mm->mm_seq tells us whether it, or the page tables under it, changed
+ * while we were looking.  Only not-present faults on vmas that already
+ * have an anon_vma and page tables are handled: everything else, and any
+ * race with a writer, returns VM_FAULT_RETRY and the caller falls back to
+ * handle_mm_fault() under the mmap_sem.
+ *
+ * Must be called by a task on its own mm with interrupts enabled.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma, copy;
+	struct mem_cgroup *memcg;
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+	unsigned int seq;
+
+	seq = raw_read_seqcount(&mm->mm_seq);
+	if (seq & 1)
+		return VM_FAULT_RETRY;
+	smp_rmb();
+
+	rcu_read_lock();
+	vma = vmacache_find(mm, address);
+	if (vma)
+		copy = *vma;
+	rcu_read_unlock();
+	if (!vma || read_seqcount_retry(&mm->mm_seq, seq))
+		return VM_FAULT_RETRY;
+
+	/*
+	 * Anything but a plain private anonymous vma takes the slow path,
+	 * and so do userfaultfd-registered ranges, whose missing faults
+	 * must reach userspace.
+	 */
+	if (copy.vm_mm != mm || copy.vm_ops || !copy.anon_vma ||
+	    vma_policy(&copy) || userfaultfd_armed(&copy) ||
+	    !is_mergeable_vm_userfaultfd_ctx(&copy, NULL_VM_UFFD_CTX) ||
+	    (copy.vm_flags & (VM_SHARED | VM_HUGETLB | VM_PFNMAP |
+			      VM_MIXEDMAP | VM_IO | VM_GROWSDOWN |
+			      VM_GROWSUP)))
+		return VM_FAULT_RETRY;
+	if (address < copy.vm_start || address >= copy.vm_end)
+		return VM_FAULT_RETRY;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(copy.vm_flags & VM_WRITE))
+			return VM_FAULT_RETRY;
+	} else if (!(copy.vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		return VM_FAULT_RETRY;
+
+	__set_current_state(TASK_RUNNING);
+
+	if (!(flags & FAULT_FLAG_WRITE) && !mm_forbids_zeropage(mm)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+					      copy.vm_page_prot));
+	} else {
+		/* Don't allocate for a swap entry we could not handle. */
+		local_irq_disable();
+		pte = spf_walk_pte(mm, address, &pmd, &pmdval);
+		if (pte) {
+			entry = ACCESS_ONCE(*pte);
+			pte_unmap(pte);
+		}
+		local_irq_enable();
+		if (!pte || !pte_none(entry))
+			goto abort;
+
+		page = alloc_zeroed_user_highpage_movable(&copy, address);
+		if (!page)
+			goto abort;
+		/* Order the page contents against set_pte_at(), as above. */
+		__SetPageUptodate(page);
+
+		if (mem_cgroup_try_charge(page, mm, GFP_KERNEL, &memcg)) {
+			page_cache_release(page);
+			goto abort;
+		}
+
+		entry = mk_pte(page, copy.vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+	}
+
+	/*
+	 * A writer holding the pte lock may be waiting for us to take a TLB
+	 * flush IPI, so only trylock it with interrupts off.  Once we hold
+	 * it and mm_seq is unchanged, any writer that comes later has to
+	 * take the lock to touch this pte, and will see ours.
+	 */
+	local_irq_disable();
+	pte = spf_walk_pte(mm, address, &pmd, &pmdval);
+	if (!pte)
+		goto abort_irq;
+	ptl = pte_lockptr(mm, &pmdval);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto abort_irq;
+	}
+	if (!pmd_same(pmdval, *pmd) || read_seqcount_retry(&mm->mm_seq, seq) ||
+	    !pte_none(*pte)) {
+		pte_unmap_unlock(pte, ptl);
+		goto abort_irq;
+	}
+	local_irq_enable();
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, &copy, address);
+		mem_cgroup_commit_charge(page, memcg, false);
+		lru_cache_add_active_or_unevictable(page, &copy);
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(&copy, address, pte);
+	pte_unmap_unlock(pte, ptl);
+
+	count_vm_event(PGFAULT);
+	mem_cgroup_count_vm_event(mm, PGFAULT);
+	count_spf_event(mm, SPF_SUCCESS);
+	check_sync_rss_stat(current);
+	return 0;
+
+abort_irq:
+	local_irq_enable();
+	if (page) {
+		mem_cgroup_cancel_charge(page, memcg);
+		page_cache_release(page);
+	}
+abort:
+	count_spf_event(mm, SPF_ABORT);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -3781,35 +4238,123 @@ EXPORT_SYMBOL(might_fault);
 #endif
 
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) || defined(CONFIG_HUGETLBFS)
+static void clear_gigantic_page_range(struct page *page, unsigned long addr,
+				      unsigned int start, unsigned int end)
+{
+	unsigned int i;
+	struct page *p = nth_page(page, start);
+
+	for (i = start; i < end; i++, p = mem_map_next(p, page, i)) {
+		cond_resched();
+		clear_user_highpage_nocache(p, addr + i * PAGE_SIZE);
+	}
+}
+
+/*
+ * Zeroing a gigantic page takes hundreds of milliseconds on one CPU, all
+ * of it spent with the fault mutex for that page held.  Split the work
+ * over a few kworkers on the page's node and do one chunk ourselves.
+ */
+#define CLEAR_GIGANTIC_MAX_WORKERS	8
+
+struct clear_gigantic_work {
+	struct work_struct	work;
+	struct page		*page;
+	unsigned long		addr;
+	unsigned int		start;
+	unsigned int		end;
+};
+
+static void clear_gigantic_work_fn(struct work_struct *work)
+{
+	struct clear_gigantic_work *cgw =
+		container_of(work, struct clear_gigantic_work, work);
+
+	clear_gigantic_page_range(cgw->page, cgw->addr, cgw->start, cgw->end);
+}
+
 static void clear_gigantic_page(struct page *page,
 				unsigned long addr,
 				unsigned int pages_per_huge_page)
 {
-	int i;
-	struct page *p = page;
+	struct clear_gigantic_work works[CLEAR_GIGANTIC_MAX_WORKERS];
+	const struct cpumask *mask = cpumask_of_node(page_to_nid(page));
+	unsigned int nr, chunk, i;
+	int cpu;
 
 	might_sleep();
-	for (i = 0; i < pages_per_huge_page;
-	     i++, p = mem_map_next(p, page, i)) {
-		cond_resched();
-		clear_user_highpage(p, addr + i * PAGE_SIZE);
+
+	nr = min_t(unsigned int, CLEAR_GIGANTIC_MAX_WORKERS,
+		   pages_per_huge_page / MAX_ORDER_NR_PAGES);
+	nr = min(nr, cpumask_weight(mask));
+	if (nr <= 1) {
+		clear_gigantic_page_range(page, addr, 0, pages_per_huge_page);
+		return;
+	}
+
+	chunk = DIV_ROUND_UP(pages_per_huge_page, nr);
+	cpu = cpumask_first(mask);
+	for (i = 1; i < nr; i++) {
+		struct clear_gigantic_work *cgw = &works[i];
+
+		INIT_WORK_ONSTACK(&cgw->work, clear_gigantic_work_fn);
+		cgw->page = page;
+		cgw->addr = addr;
+		cgw->start = i * chunk;
+		cgw->end = min(cgw->start + chunk, pages_per_huge_page);
+
+		cpu = cpumask_next(cpu, mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(mask);
+		queue_work_on(cpu, system_unbound_wq, &cgw->work);
+	}
+
+	clear_gigantic_page_range(page, addr, 0, chunk);
+
+	for (i = 1; i < nr; i++) {
+		flush_work(&works[i].work);
+		destroy_work_on_stack(&works[i].work);
 	}
 }
+/*
+ * The subpages around the faulting address are cleared last and through
+ * the cache, so the access that faulted finds them hot.  Everything else
+ * is cleared with non-temporal stores where the architecture has them.
+ */
+#define CLEAR_HUGE_PAGE_HOT_NR	8
+
 void clear_huge_page(struct page *page,
-		     unsigned long addr, unsigned int pages_per_huge_page)
+		     unsigned long addr_hint, unsigned int pages_per_huge_page)
 {
-	int i;
+	unsigned long addr = addr_hint &
+		~(((unsigned long)pages_per_huge_page << PAGE_SHIFT) - 1);
+	unsigned int target = (addr_hint - addr) >> PAGE_SHIFT;
+	unsigned int hot_start, hot_end, i;
 
+	hot_start = round_down(target, CLEAR_HUGE_PAGE_HOT_NR);
+	hot_end = min_t(unsigned int, hot_start + CLEAR_HUGE_PAGE_HOT_NR,
+			pages_per_huge_page);
+
+	might_sleep();
 	if (unlikely(pages_per_huge_page > MAX_ORDER_NR_PAGES)) {
+		/* Clears the hot subpages twice, noise next to the rest */
 		clear_gigantic_page(page, addr, pages_per_huge_page);
-		return;
+	} else {
+		for (i = 0; i < pages_per_huge_page; i++) {
+			if (i >= hot_start && i < hot_end)
+				continue;
+			cond_resched();
+			clear_user_highpage_nocache(page + i,
+						    addr + i * PAGE_SIZE);
+		}
 	}
 
-	might_sleep();
-	for (i = 0; i < pages_per_huge_page; i++) {
-		cond_resched();
-		clear_user_highpage(page + i, addr + i * PAGE_SIZE);
+	for (i = hot_start; i < hot_end; i++) {
+		if (i == target)
+			continue;
+		clear_user_highpage(nth_page(page, i), addr + i * PAGE_SIZE);
 	}
+	clear_user_highpage(nth_page(page, target), addr + target * PAGE_SIZE);
 }
 
 static void copy_user_gigantic_page(struct page *dst, struct page *src,
@@ -140,6 +140,143 @@ static void *remove_element(mempool_t *pool)
 	return element;
 }
 
+/*
+ * Pools under steady pressure take pool->lock for every allocation and
+ * every free. A per-cpu reserve cache in front of the shared reserve lets
+ * those be served locally, and moves elements to and from the shared
+ * reserve in batches. Elements in the per-cpu caches are part of the
+ * reserve; before anybody sleeps waiting for the shared reserve they are
+ * pulled back into it, so the forward progress guarantee is kept.
+ */
+#define MEMPOOL_PCP_SIZE	16
+#define MEMPOOL_PCP_BATCH	8
+
+struct mempool_pcp {
+	int nr;
+	void *elements[MEMPOOL_PCP_SIZE];
+};
+
+static void add_pcp_element(mempool_t *pool, struct mempool_pcp *pcp,
+			    void *element)
+{
+	poison_element(pool, element);
+	kasan_poison_element(pool, element);
+	pcp->elements[pcp->nr++] = element;
+}
+
+static void *remove_pcp_element(mempool_t *pool, struct mempool_pcp *pcp)
+{
+	void *element = pcp->elements[--pcp->nr];
+
+	check_element(pool, element);
+	kasan_unpoison_element(pool, element);
+	return element;
+}
+
+/*
+ * Elements move between the per-cpu and the shared reserve as they are,
+ * already poisoned. Called with pool->lock held and interrupts disabled.
+ */
+static void pcp_refill(mempool_t *pool, struct mempool_pcp *pcp)
+{
+	while (pcp->nr < MEMPOOL_PCP_BATCH && pool->curr_nr)
+		pcp->elements[pcp->nr++] = pool->elements[--pool->curr_nr];
+}
+
+static void pcp_drain(mempool_t *pool, struct mempool_pcp *pcp, int keep)
+{
+	while (pcp->nr > keep && pool->curr_nr < pool->min_nr)
+		pool->elements[pool->curr_nr++] = pcp->elements[--pcp->nr];
+}
+
+static void *mempool_pcp_alloc(mempool_t *pool)
+{
+	struct mempool_pcp *pcp;
+	unsigned long flags;
+	void *element = NULL;
+
+	local_irq_save(flags);
+	pcp = this_cpu_ptr(pool->pcp);
+	if (!pcp->nr) {
+		spin_lock(&pool->lock);
+		pcp_refill(pool, pcp);
+		spin_unlock(&pool->lock);
+	}
+	if (pcp->nr)
+		element = remove_pcp_element(pool, pcp);
+	local_irq_restore(flags);
+
+	return element;
+}
+
+static bool mempool_pcp_free(mempool_t *pool, void *element)
+{
+	struct mempool_pcp *pcp;
+	unsigned long flags;
+	bool cached = false;
+
+	/*
+	 * Waiters sleep on the shared reserve, feed it directly. Pairs
+	 * with the barrier in prepare_to_wait() in mempool_alloc().
+	 */
+	smp_mb();
+	if (waitqueue_active(&pool->wait))
+		return false;
+
+	local_irq_save(flags);
+	pcp = this_cpu_ptr(pool->pcp);
+	if (pcp->nr == MEMPOOL_PCP_SIZE) {
+		spin_lock(&pool->lock);
+		pcp_drain(pool, pcp, MEMPOOL_PCP_SIZE - MEMPOOL_PCP_BATCH);
+		spin_unlock(&pool->lock);
+	}
+	if (pcp->nr < MEMPOOL_PCP_SIZE) {
+		add_pcp_element(pool, pcp, element);
+		cached = true;
+	}
+	local_irq_restore(flags);
+
+	return cached;
+}
+
+static void mempool_drain_pcp_cpu(void *info)
+{
+	mempool_t *pool = info;
+
+	spin_lock(&pool->lock);
+	pcp_drain(pool, this_cpu_ptr(pool->pcp), 0);
+	spin_unlock(&pool->lock);
+}
+
+/*
+ * Pull the elements cached on all CPUs back into the shared reserve.
+ * Returns true if the shared reserve is not empty afterwards.
+ */
+static bool mempool_drain_pcp(mempool_t *pool)
+{
+	on_each_cpu(mempool_drain_pcp_cpu, pool, 1);
+	return READ_ONCE(pool->curr_nr) != 0;
+}
+
+/**
+ * mempool_enable_percpu - add per-cpu reserve caches to a memory pool
+ * @pool:      pointer to the memory pool which was allocated via
+ *             mempool_create().
+ * @gfp_mask:  allocation flags for the per-cpu caches.
+ *
+ * Meant for pools that are hit hard from many CPUs at once while memory
+ * is short, such as bio and request pools. Must be called before the
+ * pool is used. On failure the pool keeps working without the caches.
+ */
+int mempool_enable_percpu(mempool_t *pool, gfp_t gfp_mask)
+{
+	pool->pcp = alloc_percpu_gfp(struct mempool_pcp, gfp_mask);
+	if (!pool->pcp)
+		return -ENOMEM;
+	return 0;
+}
+EXPORT_SYMBOL(mempool_enable_percpu);
+
 /**
  * mempool_destroy - deallocate a memory pool
  * @pool:      pointer to the memory pool which was allocated via
@@ -150,10 +287,23 @@ static void *remove_element(mempool_t *pool)
  */
 void mempool_destroy(mempool_t *pool)
 {
+	int cpu;
+
 	while (pool->curr_nr) {
 		void *element = remove_element(pool);
 		pool->free(element, pool->pool_data);
 	}
+	if (pool->pcp) {
+		for_each_possible_cpu(cpu) {
+			struct mempool_pcp *pcp = per_cpu_ptr(pool->pcp, cpu);
+
+			while (pcp->nr) {
+				void *element = remove_pcp_element(pool, pcp);
+				pool->free(element, pool->pool_data);
+			}
+		}
+		free_percpu(pool->pcp);
+	}
 	kfree(pool->elements);
 	kfree(pool);
 }
@@ -331,6 +481,16 @@ repeat_alloc:
 	if (likely(element != NULL))
 		return element;
 
+	if (pool->pcp) {
+		element = mempool_pcp_alloc(pool);
+		if (element) {
+			/* paired with rmb in mempool_free() */
+			smp_wmb();
+			kmemleak_update_trace(element);
+			return element;
+		}
+	}
+
 	spin_lock_irqsave(&pool->lock, flags);
 	if (likely(pool->curr_nr)) {
 		element = remove_element(pool);
@@ -367,6 +527,16 @@ repeat_alloc:
 
 	spin_unlock_irqrestore(&pool->lock, flags);
 
+	/*
+	 * Other CPUs may be holding on to elements in their per-cpu caches.
+	 * Frees from now on see us waiting and go to the shared reserve,
+	 * so once those are pulled back nothing can be stranded there.
+	 */
+	if (pool->pcp && mempool_drain_pcp(pool)) {
+		finish_wait(&pool->wait, &wait);
+		goto repeat_alloc;
+	}
+
 	/*
 	 * FIXME: this should be io_schedule().  The timeout is there as a
 	 * workaround for some DM problems in 2.6.18.
@@ -427,6 +597,9 @@ void mempool_free(void *element, mempool_t *pool)
 	 * pool waking up the waiters.
 	 */
 	if (unlikely(pool->curr_nr < pool->min_nr)) {
+		if (pool->pcp && mempool_pcp_free(pool, element))
+			return;
+
 		spin_lock_irqsave(&pool->lock, flags);
 		if (likely(pool->curr_nr < pool->min_nr)) {
 			add_element(pool, element);
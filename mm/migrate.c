@@ -37,6 +37,7 @@
 #include <linux/gfp.h>
 #include <linux/balloon_compaction.h>
 #include <linux/mmu_notifier.h>
+#include <linux/page_idle.h>
 
 #include <asm/tlbflush.h>
 
@@ -524,6 +525,11 @@ void migrate_page_copy(struct page *newpage, struct page *page)
 			__set_page_dirty_nobuffers(newpage);
  	}
 
+	if (page_is_young(page))
+		set_page_young(newpage);
+	if (page_is_idle(page))
+		set_page_idle(newpage);
+
 	/*
 	 * Copy NUMA information to the new page, to prevent over-eager
 	 * future migrations of this same page.
@@ -877,10 +883,15 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 		goto skip_unmap;
 	}
 
-	/* Establish migration ptes or remove ptes */
+	/*
+	 * Establish migration ptes or remove ptes. A page mapped into
+	 * several mms is unmapped with a single TLB flush, which has to
+	 * complete before the contents are copied.
+	 */
 	if (page_mapped(page)) {
-		try_to_unmap(page,
-			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
+		try_to_unmap(page, TTU_MIGRATION|TTU_IGNORE_MLOCK|
+				   TTU_IGNORE_ACCESS|TTU_BATCH_FLUSH);
+		try_to_unmap_flush();
 		page_was_mapped = 1;
 	}
 
@@ -93,6 +93,18 @@ void lruvec_init(struct lruvec *lruvec)
 
 	for_each_lru(lru)
 		INIT_LIST_HEAD(&lruvec->lists[lru]);
+
+#ifdef CONFIG_LRU_GEN
+	{
+		int gen, type;
+
+		/* start with the oldest generations of both types in place */
+		lruvec->lrugen.max_seq = MIN_NR_GENS - 1;
+		for (gen = 0; gen < MAX_NR_GENS; gen++)
+			for (type = 0; type < 2; type++)
+				INIT_LIST_HEAD(&lruvec->lrugen.lists[gen][type]);
+	}
+#endif
 }
 
 #if defined(CONFIG_NUMA_BALANCING) && !defined(LAST_CPUPID_NOT_IN_PAGE_FLAGS)
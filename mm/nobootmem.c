@@ -117,10 +117,14 @@ static unsigned long __init free_low_memory_core_early(void)
 {
 	unsigned long count = 0;
 	phys_addr_t start, end;
+	struct memblock_region *r;
 	u64 i;
 
 	memblock_clear_hotplug(0, -1);
 
+	for_each_memblock(reserved, r)
+		reserve_bootmem_region(r->base, r->base + r->size);
+
 	for_each_free_mem_range(i, NUMA_NO_NODE, &start, &end, NULL)
 		count += __free_memory_core(start, end);
 
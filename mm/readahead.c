@@ -20,6 +20,9 @@
 
 #include "internal.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -141,6 +144,49 @@ out:
 	return ret;
 }
 
+/*
+ * For a mapping with AS_LARGE_PAGES, try to back the naturally aligned block
+ * of PAGE_CACHE_LARGE_NR pages at @offset with a single allocation and queue
+ * its pages on @pool.  This is only done when the whole block is within the
+ * @nr pages still to be read and none of it is cached yet.  @mark is the
+ * index that gets PG_readahead.  Returns the number of pages queued, or 0
+ * to fall back to allocating single pages.
+ */
+static unsigned long ra_alloc_large_block(struct address_space *mapping,
+		struct list_head *pool, pgoff_t offset, unsigned long nr,
+		pgoff_t mark)
+{
+	struct page *page;
+	unsigned long i;
+
+	if (!mapping_large_pages(mapping) || nr < PAGE_CACHE_LARGE_NR ||
+	    (offset & (PAGE_CACHE_LARGE_NR - 1)))
+		return 0;
+
+	if (find_get_pages(mapping, offset, 1, &page)) {
+		bool cached = page->index < offset + PAGE_CACHE_LARGE_NR;
+
+		page_cache_release(page);
+		if (cached)
+			return 0;
+	}
+
+	page = page_cache_alloc_readahead_order(mapping,
+						PAGE_CACHE_LARGE_ORDER);
+	if (!page)
+		return 0;
+
+	split_page(page, PAGE_CACHE_LARGE_ORDER);
+	for (i = 0; i < PAGE_CACHE_LARGE_NR; i++) {
+		page[i].index = offset + i;
+		list_add(&page[i].lru, pool);
+		if (offset + i == mark)
+			SetPageReadahead(&page[i]);
+	}
+
+	return PAGE_CACHE_LARGE_NR;
+}
+
 /*
  * __do_page_cache_readahead() actually reads a chunk of disk.  It allocates all
  * the pages first, then submits them all for I/O. This avoids the very bad
@@ -171,10 +217,21 @@ int __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	 */
 	for (page_idx = 0; page_idx < nr_to_read; page_idx++) {
 		pgoff_t page_offset = offset + page_idx;
+		unsigned long nr;
 
 		if (page_offset > end_index)
 			break;
 
+		nr = ra_alloc_large_block(mapping, &page_pool, page_offset,
+				min(nr_to_read - page_idx,
+				    end_index - page_offset + 1),
+				offset + nr_to_read - lookahead_size);
+		if (nr) {
+			page_idx += nr - 1;
+			ret += nr;
+			continue;
+		}
+
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
 		rcu_read_unlock();
@@ -317,6 +374,14 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
  * it approaches max_readhead.
+ *
+ * Up to RA_NR_STREAMS windows of other streams are remembered in ->streams,
+ * so that reads interleaving that many sequential streams on one file each
+ * keep ramping up their own window instead of restarting from the page
+ * cache history.  Random misses a constant stride apart are served by also
+ * reading the next few strides.  The window limit is ra_pages scaled by
+ * ->boost, which grows when readers wait for readahead I/O to complete and
+ * shrinks when the device is congested.
  */
 
 /*
@@ -364,6 +429,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_push_stream(ra);
 	ra->start = offset;
 	ra->size = min(size + req_size, max);
 	ra->async_size = 1;
@@ -371,8 +437,123 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+#define RA_MAX_BOOST	2	/* up to 4 * ra_pages, for slow devices */
+#define RA_MAX_STRIDES	8	/* strides read ahead at a time */
+
+static unsigned long ra_max_pages(struct file_ra_state *ra)
+{
+	return max_sane_readahead((unsigned long)ra->ra_pages << ra->boost);
+}
+
+static bool ra_continues(pgoff_t start, unsigned int size,
+			 unsigned int async_size, pgoff_t offset)
+{
+	return offset == start + size - async_size || offset == start + size;
+}
+
+/*
+ * @offset continues one of the other streams remembered for this file.
+ * Make it the current window and remember the current one in its place.
+ */
+static bool ra_switch_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	int i;
+
+	for (i = 0; i < RA_NR_STREAMS; i++) {
+		struct file_ra_stream *stream = &ra->streams[i];
+
+		if (!stream->size ||
+		    !ra_continues(stream->start, stream->size,
+				  stream->async_size, offset))
+			continue;
+
+		swap(ra->start, stream->start);
+		swap(ra->size, stream->size);
+		swap(ra->async_size, stream->async_size);
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * A new stream is about to take over the current window.  Remember the
+ * current one, forgetting the least recently started stream.
+ */
+static void ra_push_stream(struct file_ra_state *ra)
+{
+	if (!ra->size)
+		return;
+
+	memmove(&ra->streams[1], &ra->streams[0],
+		sizeof(ra->streams[0]) * (RA_NR_STREAMS - 1));
+	ra->streams[0].start = ra->start;
+	ra->streams[0].size = ra->size;
+	ra->streams[0].async_size = ra->async_size;
+}
+
 /*
- * A minimal readahead algorithm for trivial sequential/random reads.
+ * Strided reads: the previous random miss is a whole number of strides
+ * back.  Two misses establish the stride, later ones only have to land
+ * on it, which they do after ra_strided() read the strides in between.
+ */
+static bool ra_detect_stride(struct file_ra_state *ra, pgoff_t offset,
+			     unsigned long req_size)
+{
+	pgoff_t prev = ra->stride_pos;
+	unsigned long dist = offset - prev;
+
+	ra->stride_pos = offset;
+	if (offset <= prev || dist <= req_size) {
+		ra->stride = 0;
+		return false;
+	}
+
+	if (ra->stride && dist % ra->stride == 0 &&
+	    dist / ra->stride <= RA_MAX_STRIDES + 1)
+		return true;
+
+	ra->stride = dist;
+	return false;
+}
+
+static unsigned long ra_strided(struct address_space *mapping,
+				struct file_ra_state *ra, struct file *filp,
+				pgoff_t offset, unsigned long req_size,
+				unsigned long max)
+{
+	unsigned long nr_strides = clamp(max / req_size, 1UL,
+					 (unsigned long)RA_MAX_STRIDES);
+	unsigned long i, nr = 0;
+
+	for (i = 0; i <= nr_strides; i++)
+		nr += __do_page_cache_readahead(mapping, filp,
+						offset + i * ra->stride,
+						req_size, 0);
+
+	return nr;
+}
+
+/*
+ * The reader had to wait for a page that readahead had submitted an
+ * earlier window for, so I/O takes longer than the window assumes.  Allow
+ * larger windows on this file; congestion at async readahead time scales
+ * them back down.
+ */
+void page_cache_ra_stall(struct address_space *mapping,
+			 struct file_ra_state *ra, pgoff_t offset)
+{
+	if (offset >= ra->start || ra->start - offset > ra->size)
+		return;
+
+	if (ra->boost < RA_MAX_BOOST)
+		ra->boost++;
+	trace_mm_readahead_stall(mapping, offset, ra);
+}
+
+/*
+ * A readahead algorithm for sequential, interleaved, strided and random
+ * reads.
  */
 static unsigned long
 ondemand_readahead(struct address_space *mapping,
@@ -380,30 +561,35 @@ ondemand_readahead(struct address_space *mapping,
 		   bool hit_readahead_marker, pgoff_t offset,
 		   unsigned long req_size)
 {
-	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long max = ra_max_pages(ra);
 	pgoff_t prev_offset;
+	const char *pattern;
 
 	/*
 	 * start of file
 	 */
-	if (!offset)
+	if (!offset) {
+		pattern = "initial";
 		goto initial_readahead;
+	}
 
 	/*
 	 * It's the expected callback offset, assume sequential access.
-	 * Ramp up sizes, and push forward the readahead window.
+	 * Ramp up sizes, and push forward the readahead window.  The
+	 * offset may also continue another stream interleaved on this file.
 	 */
-	if ((offset == (ra->start + ra->size - ra->async_size) ||
-	     offset == (ra->start + ra->size))) {
+	if (ra_continues(ra->start, ra->size, ra->async_size, offset) ||
+	    ra_switch_stream(ra, offset)) {
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = "sequential";
 		goto readit;
 	}
 
 	/*
 	 * Hit a marked page without valid readahead state.
-	 * E.g. interleaved reads.
+	 * E.g. interleaved reads of more streams than we remember.
 	 * Query the pagecache for async_size, which normally equals to
 	 * readahead size. Ramp it up and use it as the new readahead size.
 	 */
@@ -417,19 +603,23 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_push_stream(ra);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = "interleaved";
 		goto readit;
 	}
 
 	/*
 	 * oversize read
 	 */
-	if (req_size > max)
+	if (req_size > max) {
+		pattern = "oversize";
 		goto initial_readahead;
+	}
 
 	/*
 	 * sequential cache miss
@@ -437,23 +627,39 @@ ondemand_readahead(struct address_space *mapping,
 	 * unaligned reads: (offset - prev_offset) == 0
 	 */
 	prev_offset = (unsigned long long)ra->prev_pos >> PAGE_CACHE_SHIFT;
-	if (offset - prev_offset <= 1UL)
+	if (offset - prev_offset <= 1UL) {
+		pattern = "initial";
 		goto initial_readahead;
+	}
 
 	/*
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, offset, req_size, max)) {
+		pattern = "context";
 		goto readit;
+	}
+
+	/*
+	 * Strided reads: read the next few strides along with this one,
+	 * without disturbing the sequential readahead state.
+	 */
+	if (ra_detect_stride(ra, offset, req_size)) {
+		trace_mm_readahead(mapping, offset, req_size, ra, "strided",
+				   false);
+		return ra_strided(mapping, ra, filp, offset, req_size, max);
+	}
 
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
+	trace_mm_readahead(mapping, offset, req_size, ra, "random", false);
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
+	ra_push_stream(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -469,6 +675,8 @@ readit:
 		ra->size += ra->async_size;
 	}
 
+	trace_mm_readahead(mapping, offset, req_size, ra, pattern,
+			   hit_readahead_marker);
 	return ra_submit(ra, mapping, filp);
 }
 
@@ -539,10 +747,14 @@ page_cache_async_readahead(struct address_space *mapping,
 	ClearPageReadahead(page);
 
 	/*
-	 * Defer asynchronous read-ahead on IO congestion.
+	 * Defer asynchronous read-ahead on IO congestion, and stop scaling
+	 * up the window for this file.
 	 */
-	if (bdi_read_congested(inode_to_bdi(mapping->host)))
+	if (bdi_read_congested(inode_to_bdi(mapping->host))) {
+		if (ra->boost)
+			ra->boost--;
 		return;
+	}
 
 	/* do read-ahead */
 	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
@@ -113,15 +113,39 @@ void slab_init_memcg_params(struct kmem_cache *s)
 	RCU_INIT_POINTER(s->memcg_params.memcg_caches, NULL);
 }
 
+static void kmemcg_cache_workfn(struct work_struct *work);
+
+static void kmemcg_cache_schedule_work(struct percpu_ref *ref)
+{
+	struct kmem_cache *s = container_of(ref, struct kmem_cache,
+					    memcg_params.refcnt);
+
+	schedule_work(&s->memcg_params.work);
+}
+
 static int init_memcg_params(struct kmem_cache *s,
 		struct mem_cgroup *memcg, struct kmem_cache *root_cache)
 {
 	struct memcg_cache_array *arr;
+	int ret;
 
 	if (memcg) {
+		ret = percpu_ref_init(&s->memcg_params.refcnt,
+				      kmemcg_cache_schedule_work, 0,
+				      GFP_KERNEL);
+		if (ret)
+			return ret;
+		INIT_WORK(&s->memcg_params.work, kmemcg_cache_workfn);
+
 		s->memcg_params.is_root_cache = false;
 		s->memcg_params.memcg = memcg;
 		s->memcg_params.root_cache = root_cache;
+		css_get(mem_cgroup_css(memcg));
+		/*
+		 * The cache may outlive its memcg, keep kmem accounting
+		 * enabled so that its pages get uncharged.
+		 */
+		static_key_slow_inc(&memcg_kmem_enabled_key);
 		return 0;
 	}
 
@@ -142,8 +166,14 @@ static int init_memcg_params(struct kmem_cache *s,
 
 static void destroy_memcg_params(struct kmem_cache *s)
 {
-	if (is_root_cache(s))
+	if (is_root_cache(s)) {
 		kfree(rcu_access_pointer(s->memcg_params.memcg_caches));
+		return;
+	}
+
+	percpu_ref_exit(&s->memcg_params.refcnt);
+	css_put(mem_cgroup_css(s->memcg_params.memcg));
+	static_key_slow_dec(&memcg_kmem_enabled_key);
 }
 
 static int update_memcg_params(struct kmem_cache *s, int new_array_size)
@@ -319,7 +349,7 @@ do_kmem_cache_create(const char *name, size_t object_size, size_t size,
 
 	err = __kmem_cache_create(s, flags);
 	if (err)
-		goto out_free_cache;
+		goto out_destroy_params;
 
 	s->refcount = 1;
 	list_add(&s->list, &slab_caches);
@@ -328,8 +358,9 @@ out:
 		return ERR_PTR(err);
 	return s;
 
-out_free_cache:
+out_destroy_params:
 	destroy_memcg_params(s);
+out_free_cache:
 	kmem_cache_free(kmem_cache, s);
 	goto out;
 }
@@ -441,7 +472,7 @@ static int do_kmem_cache_shutdown(struct kmem_cache *s,
 
 #ifdef CONFIG_MEMCG_KMEM
 	if (!is_root_cache(s))
-		list_del(&s->memcg_params.list);
+		list_del_init(&s->memcg_params.list);
 #endif
 	list_move(&s->list, release);
 	return 0;
@@ -545,11 +576,23 @@ out_unlock:
 	put_online_cpus();
 }
 
+/*
+ * Called when @memcg goes offline. Its caches stop being used for new
+ * allocations and are handed over to the parent memcg, together with any
+ * dead caches it had inherited from its own children, so that @memcg can
+ * be freed without waiting for every object in them to be freed. Each
+ * dead cache is destroyed as soon as its last slab page is gone.
+ *
+ * Without use_hierarchy the parent was never charged for this memcg's
+ * pages, so the caches can't be handed over and keep @memcg alive until
+ * they are empty, as before.
+ */
 void memcg_deactivate_kmem_caches(struct mem_cgroup *memcg)
 {
 	int idx;
 	struct memcg_cache_array *arr;
 	struct kmem_cache *s, *c;
+	struct mem_cgroup *parent = parent_mem_cgroup(memcg);
 
 	idx = memcg_cache_id(memcg);
 
@@ -569,6 +612,24 @@ void memcg_deactivate_kmem_caches(struct mem_cgroup *memcg)
 
 		__kmem_cache_shrink(c, true);
 		arr->entries[idx] = NULL;
+
+		/*
+		 * Once no new allocation can pin the cache, shrink it again
+		 * to release cpu slabs refilled by allocations that raced
+		 * with us; it is destroyed when its refcount drops to zero.
+		 */
+		percpu_ref_kill_and_confirm(&c->memcg_params.refcnt,
+					    kmemcg_cache_schedule_work);
+	}
+
+	list_for_each_entry(s, &slab_caches, list) {
+		if (!parent || is_root_cache(s) ||
+		    s->memcg_params.memcg != memcg)
+			continue;
+
+		css_get(mem_cgroup_css(parent));
+		WRITE_ONCE(s->memcg_params.memcg, parent);
+		css_put(mem_cgroup_css(memcg));
 	}
 	mutex_unlock(&slab_mutex);
 
@@ -576,25 +637,32 @@ void memcg_deactivate_kmem_caches(struct mem_cgroup *memcg)
 	put_online_cpus();
 }
 
-void memcg_destroy_kmem_caches(struct mem_cgroup *memcg)
+/*
+ * Shrink a dead memcg cache after its refcount was killed, and destroy it
+ * once no slab page or allocation in flight refers to it anymore.
+ */
+static void kmemcg_cache_workfn(struct work_struct *work)
 {
+	struct kmem_cache *s = container_of(work, struct kmem_cache,
+					    memcg_params.work);
 	LIST_HEAD(release);
 	bool need_rcu_barrier = false;
-	struct kmem_cache *s, *s2;
 
 	get_online_cpus();
 	get_online_mems();
 
 	mutex_lock(&slab_mutex);
-	list_for_each_entry_safe(s, s2, &slab_caches, list) {
-		if (is_root_cache(s) || s->memcg_params.memcg != memcg)
-			continue;
-		/*
-		 * The cgroup is about to be freed and therefore has no charges
-		 * left. Hence, all its caches must be empty by now.
-		 */
+
+	/* Already shut down together with its root cache */
+	if (list_empty(&s->memcg_params.list))
+		goto out_unlock;
+
+	if (percpu_ref_is_zero(&s->memcg_params.refcnt))
 		BUG_ON(do_kmem_cache_shutdown(s, &release, &need_rcu_barrier));
-	}
+	else
+		__kmem_cache_shrink(s, false);
+
+out_unlock:
 	mutex_unlock(&slab_mutex);
 
 	put_online_mems();
@@ -602,6 +670,31 @@ void memcg_destroy_kmem_caches(struct mem_cgroup *memcg)
 
 	do_kmem_cache_release(&release, need_rcu_barrier);
 }
+
+/*
+ * Wait for the refcount switch and work of the dead memcg caches on
+ * @release, which kmem_cache_destroy() is about to free.
+ */
+static void memcg_flush_kmem_cache_work(struct list_head *release)
+{
+	struct kmem_cache *s;
+	bool memcg_caches = false;
+
+	list_for_each_entry(s, release, list)
+		if (!is_root_cache(s))
+			memcg_caches = true;
+	if (!memcg_caches)
+		return;
+
+	rcu_barrier_sched();
+	list_for_each_entry(s, release, list)
+		if (!is_root_cache(s))
+			cancel_work_sync(&s->memcg_params.work);
+}
+#else
+static inline void memcg_flush_kmem_cache_work(struct list_head *release)
+{
+}
 #endif /* CONFIG_MEMCG_KMEM */
 
 void slab_kmem_cache_release(struct kmem_cache *s)
@@ -643,6 +736,7 @@ out_unlock:
 	put_online_mems();
 	put_online_cpus();
 
+	memcg_flush_kmem_cache_work(&release);
 	do_kmem_cache_release(&release, need_rcu_barrier);
 }
 EXPORT_SYMBOL(kmem_cache_destroy);
@@ -667,6 +761,31 @@ int kmem_cache_shrink(struct kmem_cache *cachep)
 }
 EXPORT_SYMBOL(kmem_cache_shrink);
 
+void __kmem_cache_free_bulk(struct kmem_cache *s, size_t nr, void **p)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		kmem_cache_free(s, p[i]);
+}
+
+/* Returns @nr, or 0 if the objects could not all be allocated */
+int __kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t nr,
+			    void **p)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		void *x = p[i] = kmem_cache_alloc(s, flags);
+
+		if (!x) {
+			__kmem_cache_free_bulk(s, i, p);
+			return 0;
+		}
+	}
+	return i;
+}
+
 int slab_is_available(void)
 {
 	return slab_state >= UP;
@@ -21,7 +21,7 @@
 #include <linux/debugobjects.h>
 #include <linux/kallsyms.h>
 #include <linux/list.h>
-#include <linux/rbtree.h>
+#include <linux/rbtree_augmented.h>
 #include <linux/radix-tree.h>
 #include <linux/rcupdate.h>
 #include <linux/pfn.h>
@@ -281,11 +281,8 @@ static DEFINE_SPINLOCK(vmap_area_lock);
 LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
+/* Lazily freed areas waiting for a TLB flush, see free_vmap_area_noflush() */
+static LLIST_HEAD(vmap_purge_list);
 
 static unsigned long vmap_area_pcpu_hole;
 
@@ -308,6 +305,51 @@ static struct vmap_area *__find_vmap_area(unsigned long addr)
 	return NULL;
 }
 
+/*
+ * The rbtree is augmented with the size of the largest hole that precedes
+ * any area in a subtree, the same way the mm's vma tree tracks
+ * rb_subtree_gap. This lets alloc_vmap_area() skip whole subtrees that
+ * have no room for the request instead of walking every area in turn.
+ */
+static unsigned long vmap_prev_end(struct vmap_area *va)
+{
+	if (va->list.prev == &vmap_area_list)
+		return 0;
+	return list_entry(va->list.prev, struct vmap_area, list)->va_end;
+}
+
+static unsigned long vmap_compute_subtree_gap(struct vmap_area *va)
+{
+	unsigned long max, subtree_gap;
+
+	max = va->va_start - vmap_prev_end(va);
+	if (va->rb_node.rb_left) {
+		subtree_gap = rb_entry(va->rb_node.rb_left,
+				struct vmap_area, rb_node)->subtree_gap;
+		if (subtree_gap > max)
+			max = subtree_gap;
+	}
+	if (va->rb_node.rb_right) {
+		subtree_gap = rb_entry(va->rb_node.rb_right,
+				struct vmap_area, rb_node)->subtree_gap;
+		if (subtree_gap > max)
+			max = subtree_gap;
+	}
+	return max;
+}
+
+RB_DECLARE_CALLBACKS(static, vmap_gap_callbacks, struct vmap_area, rb_node,
+		     unsigned long, subtree_gap, vmap_compute_subtree_gap)
+
+/*
+ * Update subtree_gap values after the end of the area preceding va has
+ * changed, without moving va in the rbtree.
+ */
+static void vmap_gap_update(struct vmap_area *va)
+{
+	vmap_gap_callbacks_propagate(&va->rb_node, NULL);
+}
+
 static void __insert_vmap_area(struct vmap_area *va)
 {
 	struct rb_node **p = &vmap_area_root.rb_node;
@@ -327,8 +369,8 @@ static void __insert_vmap_area(struct vmap_area *va)
 			BUG();
 	}
 
+	va->subtree_gap = 0;
 	rb_link_node(&va->rb_node, parent, p);
-	rb_insert_color(&va->rb_node, &vmap_area_root);
 
 	/* address-sort this list */
 	tmp = rb_prev(&va->rb_node);
@@ -338,6 +380,113 @@ static void __insert_vmap_area(struct vmap_area *va)
 		list_add_rcu(&va->list, &prev->list);
 	} else
 		list_add_rcu(&va->list, &vmap_area_list);
+
+	/*
+	 * va was linked in with a zero gap and now splits the hole in front
+	 * of the following area. Fix up that area and then va itself, and
+	 * only rebalance once all subtree_gap values are consistent again.
+	 */
+	if (!list_is_last(&va->list, &vmap_area_list))
+		vmap_gap_update(list_next_entry(va, list));
+	vmap_gap_update(va);
+	rb_insert_augmented(&va->rb_node, &vmap_area_root, &vmap_gap_callbacks);
+}
+
+/*
+ * Check whether the hole [gap_start, gap_end) can hold size bytes aligned
+ * to align within [vstart, vend), and if so return the lowest such address.
+ */
+static bool vmap_gap_fits(unsigned long gap_start, unsigned long gap_end,
+			  unsigned long size, unsigned long align,
+			  unsigned long vstart, unsigned long vend,
+			  unsigned long *addrp)
+{
+	unsigned long addr = ALIGN(max(gap_start, vstart), align);
+
+	/* ALIGN() or the end of the allocation wrapped around */
+	if (addr < vstart || addr + size < addr)
+		return false;
+	if (addr + size > gap_end || addr + size > vend)
+		return false;
+
+	*addrp = addr;
+	return true;
+}
+
+/*
+ * Find the lowest address within [vstart, vend) that can hold size bytes
+ * aligned to align. Subtrees whose largest hole is smaller than size are
+ * skipped, so the search only descends where a fit is possible.
+ */
+static bool find_vmap_lowest_hole(unsigned long size, unsigned long align,
+				  unsigned long vstart, unsigned long vend,
+				  unsigned long *addrp)
+{
+	struct vmap_area *va;
+	unsigned long gap_start, gap_end;
+
+	if (RB_EMPTY_ROOT(&vmap_area_root))
+		goto check_highest;
+	va = rb_entry(vmap_area_root.rb_node, struct vmap_area, rb_node);
+	if (va->subtree_gap < size)
+		goto check_highest;
+
+	while (true) {
+		/* Visit left subtree if it looks promising */
+		gap_end = va->va_start;
+		if (gap_end >= vstart + size && va->rb_node.rb_left) {
+			struct vmap_area *left =
+				rb_entry(va->rb_node.rb_left,
+					 struct vmap_area, rb_node);
+			if (left->subtree_gap >= size) {
+				va = left;
+				continue;
+			}
+		}
+
+		gap_start = vmap_prev_end(va);
+check_current:
+		/* Every hole from here on starts past the range */
+		if (gap_start >= vend)
+			return false;
+		if (vmap_gap_fits(gap_start, gap_end, size, align,
+				  vstart, vend, addrp))
+			return true;
+
+		/* Visit right subtree if it looks promising */
+		if (va->rb_node.rb_right) {
+			struct vmap_area *right =
+				rb_entry(va->rb_node.rb_right,
+					 struct vmap_area, rb_node);
+			if (right->subtree_gap >= size) {
+				va = right;
+				continue;
+			}
+		}
+
+		/* Go back up the rbtree to find next candidate node */
+		while (true) {
+			struct rb_node *prev = &va->rb_node;
+
+			if (!rb_parent(prev))
+				goto check_highest;
+			va = rb_entry(rb_parent(prev), struct vmap_area, rb_node);
+			if (prev == va->rb_node.rb_left) {
+				gap_start = vmap_prev_end(va);
+				gap_end = va->va_start;
+				goto check_current;
+			}
+		}
+	}
+
+check_highest:
+	/* Check the hole above the highest area */
+	gap_start = 0;
+	if (!list_empty(&vmap_area_list))
+		gap_start = list_last_entry(&vmap_area_list,
+					    struct vmap_area, list)->va_end;
+	return vmap_gap_fits(gap_start, ULONG_MAX, size, align,
+			     vstart, vend, addrp);
 }
 
 static void purge_vmap_area_lazy(void);
@@ -352,10 +501,8 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				int node, gfp_t gfp_mask)
 {
 	struct vmap_area *va;
-	struct rb_node *n;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
@@ -374,84 +521,13 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 
 retry:
 	spin_lock(&vmap_area_lock);
-	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
-	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
-	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size < addr)
-			goto overflow;
-
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
-
-		if (!first)
-			goto found;
-	}
-
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size < addr)
-			goto overflow;
-
-		if (list_is_last(&first->list, &vmap_area_list))
-			goto found;
-
-		first = list_entry(first->list.next,
-				struct vmap_area, list);
-	}
-
-found:
-	if (addr + size > vend)
+	if (!find_vmap_lowest_hole(size, align, vstart, vend, &addr))
 		goto overflow;
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
 
 	BUG_ON(va->va_start & (align-1));
@@ -476,27 +552,21 @@ overflow:
 
 static void __free_vmap_area(struct vmap_area *va)
 {
+	struct vmap_area *next = NULL;
+
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
-	rb_erase(&va->rb_node, &vmap_area_root);
+	if (!list_is_last(&va->list, &vmap_area_list))
+		next = list_next_entry(va, list);
+
+	rb_erase_augmented(&va->rb_node, &vmap_area_root, &vmap_gap_callbacks);
 	RB_CLEAR_NODE(&va->rb_node);
 	list_del_rcu(&va->list);
 
+	/* The hole va leaves behind now belongs to the following area */
+	if (next)
+		vmap_gap_update(next);
+
 	/*
 	 * Track the highest possible candidate for pcpu area
 	 * allocation.  Areas outside of vmalloc area can be returned
@@ -601,7 +671,7 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 					int sync, int force_flush)
 {
 	static DEFINE_SPINLOCK(purge_lock);
-	LIST_HEAD(valist);
+	struct llist_node *valist;
 	struct vmap_area *va;
 	struct vmap_area *n_va;
 	int nr = 0;
@@ -620,31 +690,37 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	/*
+	 * Only the lazily freed areas are visited here, not every area in
+	 * the vmap space; they were queued without taking any lock.
+	 */
+	valist = llist_del_all(&vmap_purge_list);
+	llist_for_each_entry(va, valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
 	}
-	rcu_read_unlock();
-
-	if (nr)
-		atomic_sub(nr, &vmap_lazy_nr);
 
 	if (nr || force_flush)
 		flush_tlb_kernel_range(*start, *end);
 
 	if (nr) {
+		/*
+		 * There may be a great many areas to return, so don't hold
+		 * vmap_area_lock across all of them and stall allocators.
+		 */
 		spin_lock(&vmap_area_lock);
-		list_for_each_entry_safe(va, n_va, &valist, purge_list)
+		llist_for_each_entry_safe(va, n_va, valist, purge_list) {
+			int nr_pages = (va->va_end - va->va_start) >> PAGE_SHIFT;
+
 			__free_vmap_area(va);
+			atomic_sub(nr_pages, &vmap_lazy_nr);
+			cond_resched_lock(&vmap_area_lock);
+		}
 		spin_unlock(&vmap_area_lock);
 	}
 	spin_unlock(&purge_lock);
@@ -680,6 +756,7 @@ static void free_vmap_area_noflush(struct vmap_area *va)
 {
 	va->flags |= VM_LAZY_FREE;
 	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
+	llist_add(&va->purge_list, &vmap_purge_list);
 	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
 }
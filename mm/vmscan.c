@@ -46,12 +46,15 @@
 #include <linux/oom.h>
 #include <linux/prefetch.h>
 #include <linux/printk.h>
+#include <linux/dax.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
 
 #include <linux/swapops.h>
 #include <linux/balloon_compaction.h>
+#include <linux/psi.h>
+#include <linux/page_idle.h>
 
 #include "internal.h"
 
@@ -818,7 +821,7 @@ static void page_check_dirty_writeback(struct page *page,
 	 * Anonymous pages are not handled by flushers and must be written
 	 * from reclaim context. Do not stall reclaim based on them
 	 */
-	if (!page_is_file_cache(page)) {
+	if (!page_is_file_cache(page) || PageAnon(page)) {
 		*dirty = false;
 		*writeback = false;
 		return;
@@ -869,6 +872,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		int may_enter_fs;
 		enum page_references references = PAGEREF_RECLAIM_CLEAN;
 		bool dirty, writeback;
+		bool lazyfree = false;
 
 		cond_resched();
 
@@ -1000,11 +1004,23 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * A clean MADV_FREE page is discarded rather than swapped.
+		 * One that KSM has merged since is shared with other users
+		 * and must keep its data.
+		 */
+		if (PageAnon(page) && !PageSwapBacked(page)) {
+			if (PageKsm(page))
+				SetPageSwapBacked(page);
+			else
+				lazyfree = true;
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
 		 */
-		if (PageAnon(page) && !PageSwapCache(page)) {
+		if (PageAnon(page) && !lazyfree && !PageSwapCache(page)) {
 			if (!(sc->gfp_mask & __GFP_IO))
 				goto keep_locked;
 			if (!add_to_swap(page, page_list))
@@ -1019,8 +1035,9 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * The page is mapped into the page tables of one or more
 		 * processes. Try to unmap it here.
 		 */
-		if (page_mapped(page) && mapping) {
-			switch (try_to_unmap(page, ttu_flags)) {
+		if (page_mapped(page) && (mapping || lazyfree)) {
+			switch (try_to_unmap(page, ttu_flags | TTU_BATCH_FLUSH |
+					     (lazyfree ? TTU_LZFREE : 0))) {
 			case SWAP_FAIL:
 				goto activate_locked;
 			case SWAP_AGAIN:
@@ -1060,7 +1077,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			if (!sc->may_writepage)
 				goto keep_locked;
 
-			/* Page is dirty, try to write it out here */
+			/*
+			 * Page is dirty. Flush the TLB if a writable entry
+			 * potentially exists to avoid CPU writes after IO
+			 * starts and then write it out here.
+			 */
+			try_to_unmap_flush_dirty();
 			switch (pageout(page, mapping, sc)) {
 			case PAGE_KEEP:
 				goto keep_locked;
@@ -1128,7 +1150,16 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page, true))
+		if (lazyfree) {
+			/* Like __remove_mapping(), minus the mapping */
+			if (!page_freeze_refs(page, 1))
+				goto keep_locked;
+			if (PageDirty(page)) {
+				page_unfreeze_refs(page, 1);
+				goto keep_locked;
+			}
+			count_vm_event(PGLAZYFREED);
+		} else if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -1171,6 +1202,7 @@ keep:
 	}
 
 	mem_cgroup_uncharge_list(&free_pages);
+	try_to_unmap_flush();
 	free_hot_cold_page_list(&free_pages, true);
 
 	list_splice(&ret_pages, page_list);
@@ -1286,6 +1318,101 @@ int __isolate_lru_page(struct page *page, isolate_mode_t mode)
 	return ret;
 }
 
+#ifdef CONFIG_LRU_GEN
+bool lru_gen_on __read_mostly = true;
+
+static int __init setup_lru_gen(char *str)
+{
+	return strtobool(str, &lru_gen_on);
+}
+early_param("lru_gen", setup_lru_gen);
+
+/*
+ * Retire empty oldest generations of @type, as long as MIN_NR_GENS are
+ * left.  Called with the lru_lock held.
+ */
+static void lru_gen_try_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+
+	while (lrugen->max_seq - lrugen->min_seq[type] + 1 > MIN_NR_GENS) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+
+		if (!list_empty(&lrugen->lists[gen][type]))
+			break;
+		WRITE_ONCE(lrugen->min_seq[type], lrugen->min_seq[type] + 1);
+	}
+}
+
+/*
+ * Take pages off the tail of the oldest generation of the type of @lru,
+ * the counterpart of isolate_lru_pages().  Pages that were promoted
+ * since they were put there are moved to their new generation instead.
+ */
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, isolate_mode_t mode,
+		enum lru_list lru)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int type = is_file_lru(lru);
+	unsigned long nr_taken = 0;
+	unsigned long scan;
+
+	for (scan = 0; scan < nr_to_scan; scan++) {
+		struct list_head *src;
+		struct page *page;
+		int gen, nr_pages;
+
+		lru_gen_try_inc_min_seq(lruvec, type);
+		gen = lru_gen_from_seq(lrugen->min_seq[type]);
+		src = &lrugen->lists[gen][type];
+		if (list_empty(src))
+			break;
+
+		page = lru_to_page(src);
+		prefetchw_prev_lru_page(page, src, flags);
+
+		VM_BUG_ON_PAGE(!PageLRU(page), page);
+
+		if (page_lru_gen(page) != gen) {
+			list_move(&page->lru,
+				  &lrugen->lists[page_lru_gen(page)][type]);
+			continue;
+		}
+
+		switch (__isolate_lru_page(page, mode)) {
+		case 0:
+			nr_pages = hpage_nr_pages(page);
+			mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
+			lru_gen_del_page(page, lruvec);
+			list_add(&page->lru, dst);
+			nr_taken += nr_pages;
+			break;
+
+		case -EBUSY:
+			/* else it is being freed elsewhere */
+			list_move(&page->lru, src);
+			continue;
+
+		default:
+			BUG();
+		}
+	}
+
+	*nr_scanned = scan;
+	return nr_taken;
+}
+#else
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, isolate_mode_t mode,
+		enum lru_list lru)
+{
+	return 0;
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * zone->lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
@@ -1315,6 +1442,14 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 	unsigned long nr_taken = 0;
 	unsigned long scan;
 
+	if (lru_gen_enabled() && !is_active_lru(lru)) {
+		nr_taken = lru_gen_isolate_pages(nr_to_scan, lruvec, dst,
+						 nr_scanned, mode, lru);
+		trace_mm_vmscan_lru_isolate(sc->order, nr_to_scan, *nr_scanned,
+					    nr_taken, mode, is_file_lru(lru));
+		return nr_taken;
+	}
+
 	for (scan = 0; scan < nr_to_scan && !list_empty(src); scan++) {
 		struct page *page;
 		int nr_pages;
@@ -2114,6 +2249,332 @@ out:
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Aging for the multi-generational LRU.  Instead of scanning the LRU
+ * lists and walking the rmap of every page, a new generation is created
+ * by walking the page tables of the mms on lru_gen_mm_list and moving
+ * the pages whose accessed bit is set into it.  The list is rotated as
+ * mms are visited, so consecutive aging passes spread the work.
+ */
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+static DEFINE_MUTEX(lru_gen_walk_mutex);
+static struct mm_struct *lru_gen_walk_mm;
+static unsigned long lru_gen_walk_seq;
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	INIT_LIST_HEAD(&mm->lru_gen_list);
+	mm->lru_gen_seq = 0;
+	if (!lru_gen_enabled())
+		return;
+
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	bool walking;
+
+	spin_lock(&lru_gen_mm_lock);
+	list_del_init(&mm->lru_gen_list);
+	walking = lru_gen_walk_mm == mm;
+	spin_unlock(&lru_gen_mm_lock);
+
+	/*
+	 * Like khugepaged, wait for a walk in progress to drop the
+	 * mmap_sem before the page tables go away.
+	 */
+	if (walking) {
+		down_write(&mm->mmap_sem);
+		up_write(&mm->mmap_sem);
+	}
+}
+
+/* Move a mapped page into the youngest generation of its lruvec */
+static void lru_gen_promote_page(struct page *page)
+{
+	struct lruvec *lruvec;
+	int old = page_lru_gen(page);
+
+	if (old < 0)
+		return;
+
+	/* the accessed bit this consumed is lost to idle page tracking */
+	clear_page_idle(page);
+
+	lruvec = mem_cgroup_page_lruvec(page, page_zone(page));
+	page_update_lru_gen(page, old,
+			    lru_gen_from_seq(READ_ONCE(lruvec->lrugen.max_seq)));
+}
+
+static int lru_gen_test_walk(unsigned long start, unsigned long end,
+			     struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+
+	if (vma->vm_flags & (VM_PFNMAP | VM_IO | VM_LOCKED | VM_HUGETLB |
+			     VM_SEQ_READ))
+		return 0;
+
+	return 1;
+}
+
+static int lru_gen_walk_pmd_range(pmd_t *pmd, unsigned long addr,
+				  unsigned long end, struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+	spinlock_t *ptl;
+	pte_t *pte, *orig_pte;
+
+	if (pmd_trans_huge_lock(pmd, vma, &ptl) == 1) {
+		if (pmdp_test_and_clear_young(vma, addr, pmd) &&
+		    !vma_is_dax(vma))
+			lru_gen_promote_page(pmd_page(*pmd));
+		spin_unlock(ptl);
+		return 0;
+	}
+
+	/* Like rmap, leave pte tables shared by fork alone */
+	if (pmd_trans_unstable(pmd) || pmd_shared_pte_table(*pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page)
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			lru_gen_promote_page(page);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+
+	return 0;
+}
+
+/*
+ * Walk every mm on lru_gen_mm_list once, or only those charged to
+ * @memcg for limit reclaim.
+ */
+static void lru_gen_walk_mms(struct mem_cgroup *memcg)
+{
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pmd_range,
+		.test_walk = lru_gen_test_walk,
+	};
+	unsigned long seq;
+
+	spin_lock(&lru_gen_mm_lock);
+	seq = ++lru_gen_walk_seq;
+	while (!list_empty(&lru_gen_mm_list)) {
+		struct mm_struct *mm;
+
+		mm = list_first_entry(&lru_gen_mm_list, struct mm_struct,
+				      lru_gen_list);
+		if (mm->lru_gen_seq == seq)
+			break;
+
+		mm->lru_gen_seq = seq;
+		list_move_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+
+		if (!atomic_read(&mm->mm_users))
+			continue;
+		if (memcg && !mm_match_cgroup(mm, memcg))
+			continue;
+
+		lru_gen_walk_mm = mm;
+		atomic_inc(&mm->mm_count);
+		spin_unlock(&lru_gen_mm_lock);
+
+		if (down_read_trylock(&mm->mmap_sem)) {
+			if (atomic_read(&mm->mm_users)) {
+				walk.mm = mm;
+				walk_page_range(0, mm->highest_vm_end, &walk);
+			}
+			up_read(&mm->mmap_sem);
+		}
+
+		spin_lock(&lru_gen_mm_lock);
+		lru_gen_walk_mm = NULL;
+		spin_unlock(&lru_gen_mm_lock);
+		mmdrop(mm);
+		cond_resched();
+		spin_lock(&lru_gen_mm_lock);
+	}
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+#define LRU_GEN_LOOK_AROUND	32
+
+/*
+ * page_referenced_one() found a young pte during eviction.  Its
+ * neighbours are likely to be young as well, so clear their accessed
+ * bits and promote them here while the page table is mapped and locked,
+ * instead of having rmap find each of them later.
+ */
+void lru_gen_look_around(struct vm_area_struct *vma, pte_t *pte,
+			 unsigned long address)
+{
+	unsigned long start, end, addr;
+	pte_t *first;
+
+	if (!lru_gen_enabled() || (vma->vm_flags & VM_SEQ_READ))
+		return;
+
+	start = max3(address & PMD_MASK, vma->vm_start,
+		     address - LRU_GEN_LOOK_AROUND * PAGE_SIZE);
+	end = min3(pmd_addr_end(address, vma->vm_end), vma->vm_end,
+		   address + (LRU_GEN_LOOK_AROUND + 1) * PAGE_SIZE);
+
+	first = pte - (address - start) / PAGE_SIZE;
+	for (addr = start; addr != end; first++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (addr == address)
+			continue;
+		if (!pte_present(*first) || !pte_young(*first))
+			continue;
+
+		page = vm_normal_page(vma, addr, *first);
+		if (!page)
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, first))
+			lru_gen_promote_page(page);
+	}
+}
+
+/*
+ * Fold the oldest generation of @type into the next one, to make room
+ * for a new youngest generation.  Called with the lru_lock held.
+ */
+static void lru_gen_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int old = lru_gen_from_seq(lrugen->min_seq[type]);
+	int new = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+	struct page *page;
+
+	list_for_each_entry(page, &lrugen->lists[old][type], lru)
+		page_update_lru_gen(page, old, new);
+	list_splice_tail_init(&lrugen->lists[old][type],
+			      &lrugen->lists[new][type]);
+	WRITE_ONCE(lrugen->min_seq[type], lrugen->min_seq[type] + 1);
+}
+
+static void lru_gen_inc_max_seq(struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int type;
+
+	for (type = 0; type < 2; type++) {
+		lru_gen_try_inc_min_seq(lruvec, type);
+		if (lrugen->max_seq - lrugen->min_seq[type] + 1 >= MAX_NR_GENS)
+			lru_gen_inc_min_seq(lruvec, type);
+	}
+
+	WRITE_ONCE(lrugen->max_seq, lrugen->max_seq + 1);
+}
+
+/*
+ * Create a new generation and fill it from the page tables.  The walk
+ * may sleep on filesystem or I/O locks held by the mms being walked, so
+ * reclaim that cannot enter them only creates the empty generation and
+ * relies on rmap during eviction.
+ */
+static void lru_gen_age(struct lruvec *lruvec, struct scan_control *sc)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	unsigned long max_seq = READ_ONCE(lruvec->lrugen.max_seq);
+	bool walk = (sc->gfp_mask & GFP_IOFS) == GFP_IOFS &&
+		    mutex_trylock(&lru_gen_walk_mutex);
+
+	spin_lock_irq(&zone->lru_lock);
+	if (lruvec->lrugen.max_seq == max_seq)
+		lru_gen_inc_max_seq(lruvec);
+	spin_unlock_irq(&zone->lru_lock);
+
+	if (walk) {
+		lru_gen_walk_mms(sc->target_mem_cgroup);
+		mutex_unlock(&lru_gen_walk_mutex);
+	}
+}
+
+/*
+ * The multi-generational counterpart of shrink_lruvec().  Evicts from
+ * the type with the older oldest generation, aging first when only
+ * MIN_NR_GENS generations are left.
+ */
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec, int swappiness,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	bool can_swap = sc->may_swap && swappiness &&
+			get_nr_swap_pages() > 0;
+	unsigned long size[2], nr_to_scan;
+	unsigned long nr_reclaimed = 0;
+	struct blk_plug plug;
+	int type;
+
+	size[0] = get_lru_size(lruvec, LRU_INACTIVE_ANON) +
+		  get_lru_size(lruvec, LRU_ACTIVE_ANON);
+	size[1] = get_lru_size(lruvec, LRU_INACTIVE_FILE) +
+		  get_lru_size(lruvec, LRU_ACTIVE_FILE);
+	*lru_pages = size[0] + size[1];
+	if (!can_swap)
+		size[0] = 0;
+
+	nr_to_scan = (size[0] + size[1]) >> sc->priority;
+	if (!nr_to_scan && (current_is_kswapd() || !global_reclaim(sc)))
+		nr_to_scan = min(size[0] + size[1], SWAP_CLUSTER_MAX);
+
+	blk_start_plug(&plug);
+	while (nr_to_scan && nr_reclaimed < sc->nr_to_reclaim) {
+		unsigned long min_seq[2], batch;
+
+		min_seq[0] = READ_ONCE(lrugen->min_seq[0]);
+		min_seq[1] = READ_ONCE(lrugen->min_seq[1]);
+
+		if (!size[0])
+			type = 1;
+		else if (!size[1])
+			type = 0;
+		else
+			type = min_seq[0] < min_seq[1] ? 0 : 1;
+
+		if (READ_ONCE(lrugen->max_seq) - min_seq[type] + 1 <=
+		    MIN_NR_GENS)
+			lru_gen_age(lruvec, sc);
+
+		batch = min(nr_to_scan, SWAP_CLUSTER_MAX);
+		nr_to_scan -= batch;
+		nr_reclaimed += shrink_inactive_list(batch, lruvec, sc,
+				type ? LRU_INACTIVE_FILE : LRU_INACTIVE_ANON);
+	}
+	blk_finish_plug(&plug);
+	sc->nr_reclaimed += nr_reclaimed;
+
+	throttle_vm_writeout(sc->gfp_mask);
+}
+#else
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec, int swappiness,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -2129,6 +2590,11 @@ static void shrink_lruvec(struct lruvec *lruvec, int swappiness,
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, swappiness, sc, lru_pages);
+		return;
+	}
+
 	get_scan_count(lruvec, swappiness, sc, nr, lru_pages);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -2762,6 +3228,7 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 				gfp_t gfp_mask, nodemask_t *nodemask)
 {
 	unsigned long nr_reclaimed;
+	unsigned long pflags;
 	struct scan_control sc = {
 		.nr_to_reclaim = SWAP_CLUSTER_MAX,
 		.gfp_mask = (gfp_mask = memalloc_noio_flags(gfp_mask)),
@@ -2778,8 +3245,11 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 	 * 1 is returned so that the page allocator does not OOM kill at this
 	 * point.
 	 */
-	if (throttle_direct_reclaim(gfp_mask, zonelist, nodemask))
+	psi_memstall_enter(&pflags);
+	if (throttle_direct_reclaim(gfp_mask, zonelist, nodemask)) {
+		psi_memstall_leave(&pflags);
 		return 1;
+	}
 
 	trace_mm_vmscan_direct_reclaim_begin(order,
 				sc.may_writepage,
@@ -2788,6 +3258,7 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
 
 	trace_mm_vmscan_direct_reclaim_end(nr_reclaimed);
+	psi_memstall_leave(&pflags);
 
 	return nr_reclaimed;
 }
@@ -2839,6 +3310,7 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 {
 	struct zonelist *zonelist;
 	unsigned long nr_reclaimed;
+	unsigned long pflags;
 	int nid;
 	struct scan_control sc = {
 		.nr_to_reclaim = max(nr_pages, SWAP_CLUSTER_MAX),
@@ -2864,7 +3336,9 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 					    sc.may_writepage,
 					    sc.gfp_mask);
 
+	psi_memstall_enter(&pflags);
 	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
+	psi_memstall_leave(&pflags);
 
 	trace_mm_vmscan_memcg_reclaim_end(nr_reclaimed);
 
@@ -2876,7 +3350,7 @@ static void age_active_anon(struct zone *zone, struct scan_control *sc)
 {
 	struct mem_cgroup *memcg;
 
-	if (!total_swap_pages)
+	if (!total_swap_pages || lru_gen_enabled())
 		return;
 
 	memcg = mem_cgroup_iter(NULL, NULL, NULL);
@@ -3108,7 +3582,6 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 	do {
 		unsigned long nr_attempted = 0;
 		bool raise_priority = true;
-		bool pgdat_needs_compaction = (order > 0);
 
 		sc.nr_reclaimed = 0;
 
@@ -3159,24 +3632,6 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 		if (i < 0)
 			goto out;
 
-		for (i = 0; i <= end_zone; i++) {
-			struct zone *zone = pgdat->node_zones + i;
-
-			if (!populated_zone(zone))
-				continue;
-
-			/*
-			 * If any zone is currently balanced then kswapd will
-			 * not call compaction as it is expected that the
-			 * necessary pages are already available.
-			 */
-			if (pgdat_needs_compaction &&
-					zone_watermark_ok(zone, order,
-						low_wmark_pages(zone),
-						*classzone_idx, 0))
-				pgdat_needs_compaction = false;
-		}
-
 		/*
 		 * If we're getting trouble reclaiming, start doing writepage
 		 * even in laptop mode.
@@ -3249,13 +3704,6 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 		if (try_to_freeze() || kthread_should_stop())
 			break;
 
-		/*
-		 * Compact if necessary and kswapd is reclaiming at least the
-		 * high watermark number of pages as requsted
-		 */
-		if (pgdat_needs_compaction && sc.nr_reclaimed > nr_attempted)
-			compact_pgdat(pgdat, order);
-
 		/*
 		 * Raise priority if scanning rate is too low or there was no
 		 * progress in reclaiming pages
@@ -3276,7 +3724,8 @@ out:
 	return order;
 }
 
-static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
+static void kswapd_try_to_sleep(pg_data_t *pgdat, int alloc_order, int order,
+				int classzone_idx)
 {
 	long remaining = 0;
 	DEFINE_WAIT(wait);
@@ -3318,6 +3767,12 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 		 */
 		reset_isolation_suitable(pgdat);
 
+		/*
+		 * kswapd may have dropped to order-0 reclaim once it freed
+		 * enough; compact for the order that was actually requested.
+		 */
+		wakeup_kcompactd(pgdat, alloc_order, classzone_idx);
+
 		if (!kthread_should_stop())
 			schedule();
 
@@ -3407,7 +3862,7 @@ static int kswapd(void *p)
 			order = new_order;
 			classzone_idx = new_classzone_idx;
 		} else {
-			kswapd_try_to_sleep(pgdat, balanced_order,
+			kswapd_try_to_sleep(pgdat, order, balanced_order,
 						balanced_classzone_idx);
 			order = pgdat->kswapd_max_order;
 			classzone_idx = pgdat->classzone_idx;
@@ -27,6 +27,7 @@
 #include <linux/mm_inline.h>
 #include <linux/page_ext.h>
 #include <linux/page_owner.h>
+#include <linux/tick.h>
 
 #include "internal.h"
 
@@ -459,8 +460,11 @@ static int fold_diff(int *diff)
  * bouncing and will have to be only done when necessary.
  *
  * The function returns the number of global counters updated.
+ *
+ * With @do_pagesets false only the counters are folded and the function
+ * does not sleep, as needed when it is called from the tick code.
  */
-static int refresh_cpu_vm_stats(void)
+static int refresh_cpu_vm_stats(bool do_pagesets)
 {
 	struct zone *zone;
 	int i;
@@ -484,6 +488,8 @@ static int refresh_cpu_vm_stats(void)
 #endif
 			}
 		}
+		if (!do_pagesets)
+			continue;
 		cond_resched();
 #ifdef CONFIG_NUMA
 		/*
@@ -671,6 +677,24 @@ int fragmentation_index(struct zone *zone, unsigned int order)
 	fill_contig_page_info(zone, order, &info);
 	return __fragmentation_index(order, &info);
 }
+
+/*
+ * Percentage of free memory in the zone that is not available to an
+ * allocation of the given order: 0 means every free page sits in a
+ * suitable block, 100 means none does.
+ */
+unsigned int extfrag_for_order(struct zone *zone, unsigned int order)
+{
+	struct contig_page_info info;
+
+	fill_contig_page_info(zone, order, &info);
+	if (info.free_pages == 0)
+		return 0;
+
+	return div_u64((info.free_pages -
+			(info.free_blocks_suitable << order)) * 100,
+			info.free_pages);
+}
 #endif
 
 #if defined(CONFIG_PROC_FS) || defined(CONFIG_SYSFS) || defined(CONFIG_NUMA)
@@ -756,6 +780,7 @@ const char * const vmstat_text[] = {
 	"pgfree",
 	"pgactivate",
 	"pgdeactivate",
+	"pglazyfree",
 
 	"pgfault",
 	"pgmajfault",
@@ -779,6 +804,7 @@ const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"pglazyfreed",
 
 	"drop_pagecache",
 	"drop_slab",
@@ -801,6 +827,9 @@ const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_daemon_wake",
+	"compact_daemon_migrate_scanned",
+	"compact_daemon_free_scanned",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -821,9 +850,16 @@ const char * const vmstat_text[] = {
 	"thp_collapse_alloc",
 	"thp_collapse_alloc_failed",
 	"thp_split",
+	"thp_deferred_split_page",
+	"thp_underused_split_page",
 	"thp_zero_page_alloc",
 	"thp_zero_page_alloc_failed",
 #endif
+#ifdef CONFIG_FS_DAX
+	"dax_pte_fault",
+	"dax_pmd_fault",
+	"dax_pmd_fault_fallback",
+#endif
 #ifdef CONFIG_MEMORY_BALLOON
 	"balloon_inflate",
 	"balloon_deflate",
@@ -1223,11 +1259,13 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   "\n    cpu: %i"
 			   "\n              count: %i"
 			   "\n              high:  %i"
-			   "\n              batch: %i",
+			   "\n              batch: %i"
+			   "\n              free_factor: %i",
 			   i,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
-			   pageset->pcp.batch);
+			   pageset->pcp.batch,
+			   pageset->pcp.free_factor);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
@@ -1363,7 +1401,7 @@ static cpumask_var_t cpu_stat_off;
 
 static void vmstat_update(struct work_struct *w)
 {
-	if (refresh_cpu_vm_stats())
+	if (refresh_cpu_vm_stats(true))
 		/*
 		 * Counters were updated so we expect more updates
 		 * to occur in the future. Keep on running the
@@ -1377,22 +1415,34 @@ static void vmstat_update(struct work_struct *w)
 		 * a mode where it does not cause counter updates.
 		 * We may be uselessly running vmstat_update.
 		 * Defer the checking for differentials to the
-		 * shepherd thread on a different processor.
+		 * shepherd thread on a different processor. The bit may
+		 * already be set by quiet_vmstat().
 		 */
-		int r;
-		/*
-		 * Shepherd work thread does not race since it never
-		 * changes the bit if its zero but the cpu
-		 * online / off line code may race if
-		 * worker threads are still allowed during
-		 * shutdown / startup.
-		 */
-		r = cpumask_test_and_set_cpu(smp_processor_id(),
-			cpu_stat_off);
-		VM_BUG_ON(r);
+		cpumask_set_cpu(smp_processor_id(), cpu_stat_off);
 	}
 }
 
+/*
+ * Fold the counters of this cpu as its tick stops, and hand the cpu over
+ * to the shepherd: a full dynticks cpu is then not woken up by the vmstat
+ * worker unless it actually touches the counters again.
+ */
+void quiet_vmstat(void)
+{
+	if (system_state != SYSTEM_RUNNING)
+		return;
+
+	/* Already in the hands of the shepherd, nothing to do. */
+	if (cpumask_test_and_set_cpu(smp_processor_id(), cpu_stat_off))
+		return;
+
+	/*
+	 * A pending vmstat_update is left alone, it finds nothing to do
+	 * and does not requeue itself.
+	 */
+	refresh_cpu_vm_stats(false);
+}
+
 /*
  * Check if the diffs for a certain cpu indicate that
  * an update is needed.
@@ -1442,7 +1492,7 @@ static void vmstat_shepherd(struct work_struct *w)
 
 	put_online_cpus();
 
-	schedule_delayed_work(&shepherd,
+	schedule_delayed_work_on(housekeeping_any_cpu(), &shepherd,
 		round_jiffies_relative(sysctl_stat_interval));
 
 }
@@ -1459,7 +1509,7 @@ static void __init start_shepherd_timer(void)
 		BUG();
 	cpumask_copy(cpu_stat_off, cpu_online_mask);
 
-	schedule_delayed_work(&shepherd,
+	schedule_delayed_work_on(housekeeping_any_cpu(), &shepherd,
 		round_jiffies_relative(sysctl_stat_interval));
 }
 
@@ -12,6 +12,7 @@
 #include <linux/swap.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/mm_inline.h>
 
 /*
  *		Double CLOCK lists
@@ -231,12 +232,22 @@ void *workingset_eviction(struct address_space *mapping, struct page *page)
 bool workingset_refault(void *shadow)
 {
 	unsigned long refault_distance;
+	unsigned long active_file;
 	struct zone *zone;
 
 	unpack_shadow(shadow, &zone, &refault_distance);
 	inc_zone_state(zone, WORKINGSET_REFAULT);
 
-	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+	/*
+	 * The multi-generational LRU accounts all its pages as inactive;
+	 * take the younger half of the file pages as the active share.
+	 */
+	if (lru_gen_enabled())
+		active_file = zone_page_state(zone, NR_INACTIVE_FILE) / 2;
+	else
+		active_file = zone_page_state(zone, NR_ACTIVE_FILE);
+
+	if (refault_distance <= active_file) {
 		inc_zone_state(zone, WORKINGSET_ACTIVATE);
 		return true;
 	}
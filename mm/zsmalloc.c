@@ -33,11 +33,16 @@
  *	page->freelist: points to the first free object in zspage.
  *		Free objects are linked together using in-place
  *		metadata.
- *	page->objects: maximum number of objects we can store in this
- *		zspage (class->zspage_order * PAGE_SIZE / class->size)
+ *	page->inuse: number of objects allocated in this zspage
+ *	page->objects: fullness group of the zspage
  *	page->lru: links together first pages of various zspages.
  *		Basically forming list of zspages in a fullness group.
- *	page->mapping: class index and fullness group of the zspage
+ *
+ *	For all pages:
+ *
+ *	page->mapping: size class of the zspage, tagged with
+ *		PAGE_MAPPING_ZSMALLOC so that compaction can recognize
+ *		the page (see PageZsmalloc())
  *
  * Usage of struct page flags:
  *	PG_private: identifies the first component page
@@ -66,6 +71,8 @@
 #include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/debugfs.h>
+#include <linux/shrinker.h>
+#include <linux/rcupdate.h>
 #include <linux/zsmalloc.h>
 #include <linux/zpool.h>
 
@@ -173,14 +180,12 @@ enum zs_stat_type {
 	NR_ZS_STAT_TYPE,
 };
 
-#ifdef CONFIG_ZSMALLOC_STAT
-
-static struct dentry *zs_stat_root;
-
 struct zs_size_stat {
 	unsigned long objs[NR_ZS_STAT_TYPE];
 };
 
+#ifdef CONFIG_ZSMALLOC_STAT
+static struct dentry *zs_stat_root;
 #endif
 
 /*
@@ -217,9 +222,8 @@ struct size_class {
 	/* huge object: pages_per_zspage == 1 && maxobj_per_zspage == 1 */
 	bool huge;
 
-#ifdef CONFIG_ZSMALLOC_STAT
+	/* protected by lock, also used to tell what compaction can free */
 	struct zs_size_stat stats;
-#endif
 
 	spinlock_t lock;
 
@@ -254,21 +258,17 @@ struct zs_pool {
 
 	gfp_t flags;	/* allocation flags used when growing pool */
 	atomic_long_t pages_allocated;
+	/* pages freed by zs_compact(), read by the shrinker */
+	atomic_long_t pages_compacted;
+
+	struct shrinker shrinker;
+	bool shrinker_enabled;
 
 #ifdef CONFIG_ZSMALLOC_STAT
 	struct dentry *stat_dentry;
 #endif
 };
 
-/*
- * A zspage's class index and fullness group
- * are encoded in its (first)page->mapping
- */
-#define CLASS_IDX_BITS	28
-#define FULLNESS_BITS	4
-#define CLASS_IDX_MASK	((1 << CLASS_IDX_BITS) - 1)
-#define FULLNESS_MASK	((1 << FULLNESS_BITS) - 1)
-
 struct mapping_area {
 #ifdef CONFIG_PGTABLE_MAPPING
 	struct vm_struct *vm; /* vm area for mapping object that span pages */
@@ -409,26 +409,35 @@ static int is_last_page(struct page *page)
 	return PagePrivate2(page);
 }
 
-static void get_zspage_mapping(struct page *page, unsigned int *class_idx,
-				enum fullness_group *fullness)
+/*
+ * Every component page of a zspage points to the size class through
+ * page->mapping, see the comment at the top of this file.
+ */
+static struct size_class *get_zspage_class(struct page *page)
 {
-	unsigned long m;
-	BUG_ON(!is_first_page(page));
+	unsigned long m = (unsigned long)page->mapping;
 
-	m = (unsigned long)page->mapping;
-	*fullness = m & FULLNESS_MASK;
-	*class_idx = (m >> FULLNESS_BITS) & CLASS_IDX_MASK;
+	VM_BUG_ON_PAGE(!PageZsmalloc(page), page);
+	return (struct size_class *)(m & ~PAGE_MAPPING_FLAGS);
 }
 
-static void set_zspage_mapping(struct page *page, unsigned int class_idx,
-				enum fullness_group fullness)
+static void set_zspage_class(struct page *page, struct size_class *class)
+{
+	page->mapping = (struct address_space *)((unsigned long)class |
+						 PAGE_MAPPING_ZSMALLOC);
+}
+
+static enum fullness_group get_zspage_fullness(struct page *page)
 {
-	unsigned long m;
 	BUG_ON(!is_first_page(page));
+	return page->objects;
+}
 
-	m = ((class_idx & CLASS_IDX_MASK) << FULLNESS_BITS) |
-			(fullness & FULLNESS_MASK);
-	page->mapping = (struct address_space *)m;
+static void set_zspage_fullness(struct page *page,
+				enum fullness_group fullness)
+{
+	BUG_ON(!is_first_page(page));
+	page->objects = fullness;
 }
 
 /*
@@ -449,8 +458,6 @@ static int get_size_class_index(int size)
 	return min(zs_size_classes - 1, idx);
 }
 
-#ifdef CONFIG_ZSMALLOC_STAT
-
 static inline void zs_stat_inc(struct size_class *class,
 				enum zs_stat_type type, unsigned long cnt)
 {
@@ -469,6 +476,8 @@ static inline unsigned long zs_stat_get(struct size_class *class,
 	return class->stats.objs[type];
 }
 
+#ifdef CONFIG_ZSMALLOC_STAT
+
 static int __init zs_stat_init(void)
 {
 	if (!debugfs_initialized())
@@ -585,22 +594,6 @@ static void zs_pool_stat_destroy(struct zs_pool *pool)
 
 #else /* CONFIG_ZSMALLOC_STAT */
 
-static inline void zs_stat_inc(struct size_class *class,
-				enum zs_stat_type type, unsigned long cnt)
-{
-}
-
-static inline void zs_stat_dec(struct size_class *class,
-				enum zs_stat_type type, unsigned long cnt)
-{
-}
-
-static inline unsigned long zs_stat_get(struct size_class *class,
-				enum zs_stat_type type)
-{
-	return 0;
-}
-
 static int __init zs_stat_init(void)
 {
 	return 0;
@@ -629,14 +622,16 @@ static inline void zs_pool_stat_destroy(struct zs_pool *pool)
  * the pool (not yet implemented). This function returns fullness
  * status of the given page.
  */
-static enum fullness_group get_fullness_group(struct page *page)
+static enum fullness_group get_fullness_group(struct size_class *class,
+						struct page *page)
 {
 	int inuse, max_objects;
 	enum fullness_group fg;
 	BUG_ON(!is_first_page(page));
 
 	inuse = page->inuse;
-	max_objects = page->objects;
+	max_objects = get_maxobj_per_zspage(class->size,
+					    class->pages_per_zspage);
 
 	if (inuse == 0)
 		fg = ZS_EMPTY;
@@ -714,19 +709,18 @@ static void remove_zspage(struct page *page, struct size_class *class,
 static enum fullness_group fix_fullness_group(struct size_class *class,
 						struct page *page)
 {
-	int class_idx;
 	enum fullness_group currfg, newfg;
 
 	BUG_ON(!is_first_page(page));
 
-	get_zspage_mapping(page, &class_idx, &currfg);
-	newfg = get_fullness_group(page);
+	currfg = get_zspage_fullness(page);
+	newfg = get_fullness_group(class, page);
 	if (newfg == currfg)
 		goto out;
 
 	remove_zspage(page, class, currfg);
 	insert_zspage(page, class, newfg);
-	set_zspage_mapping(page, class_idx, newfg);
+	set_zspage_fullness(page, newfg);
 
 out:
 	return newfg;
@@ -838,7 +832,7 @@ static unsigned long obj_to_head(struct size_class *class, struct page *page,
 {
 	if (class->huge) {
 		VM_BUG_ON(!is_first_page(page));
-		return *(unsigned long *)page_private(page);
+		return page_private(page);
 	} else
 		return *(unsigned long *)obj;
 }
@@ -957,7 +951,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 {
 	int i, error;
-	struct page *first_page = NULL, *uninitialized_var(prev_page);
+	struct page *page, *first_page = NULL, *uninitialized_var(prev_page);
 
 	/*
 	 * Allocate individual pages and link them together as:
@@ -972,8 +966,6 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 	 */
 	error = -ENOMEM;
 	for (i = 0; i < class->pages_per_zspage; i++) {
-		struct page *page;
-
 		page = alloc_page(flags);
 		if (!page)
 			goto cleanup;
@@ -999,8 +991,14 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 	init_zspage(first_page, class);
 
 	first_page->freelist = location_to_obj(first_page, 0);
-	/* Maximum number of objects we can store in this zspage */
-	first_page->objects = class->pages_per_zspage * PAGE_SIZE / class->size;
+
+	/*
+	 * Tag the pages last: once compaction sees the tag, the links
+	 * above must be there (see zs_page_migrate()).
+	 */
+	smp_wmb();
+	for (page = first_page; page; page = get_next_page(page))
+		set_zspage_class(page, class);
 
 	error = 0; /* Success */
 
@@ -1231,11 +1229,12 @@ static bool can_merge(struct size_class *prev, int size, int pages_per_zspage)
 	return true;
 }
 
-static bool zspage_full(struct page *page)
+static bool zspage_full(struct size_class *class, struct page *page)
 {
 	BUG_ON(!is_first_page(page));
 
-	return page->inuse == page->objects;
+	return page->inuse == get_maxobj_per_zspage(class->size,
+						    class->pages_per_zspage);
 }
 
 unsigned long zs_get_total_pages(struct zs_pool *pool)
@@ -1264,8 +1263,6 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 	struct page *page;
 	unsigned long obj, obj_idx, off;
 
-	unsigned int class_idx;
-	enum fullness_group fg;
 	struct size_class *class;
 	struct mapping_area *area;
 	struct page *pages[2];
@@ -1285,8 +1282,7 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 
 	obj = handle_to_obj(handle);
 	obj_to_location(obj, &page, &obj_idx);
-	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
-	class = pool->size_class[class_idx];
+	class = get_zspage_class(page);
 	off = obj_idx_to_offset(page, obj_idx, class->size);
 
 	area = &get_cpu_var(zs_map_area);
@@ -1317,8 +1313,6 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 	struct page *page;
 	unsigned long obj, obj_idx, off;
 
-	unsigned int class_idx;
-	enum fullness_group fg;
 	struct size_class *class;
 	struct mapping_area *area;
 
@@ -1326,8 +1320,7 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 
 	obj = handle_to_obj(handle);
 	obj_to_location(obj, &page, &obj_idx);
-	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
-	class = pool->size_class[class_idx];
+	class = get_zspage_class(page);
 	off = obj_idx_to_offset(page, obj_idx, class->size);
 
 	area = this_cpu_ptr(&zs_map_area);
@@ -1416,7 +1409,7 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 			return 0;
 		}
 
-		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
+		set_zspage_fullness(first_page, ZS_EMPTY);
 		atomic_long_add(class->pages_per_zspage,
 					&pool->pages_allocated);
 
@@ -1442,8 +1435,6 @@ static void obj_free(struct zs_pool *pool, struct size_class *class,
 	struct page *first_page, *f_page;
 	unsigned long f_objidx, f_offset;
 	void *vaddr;
-	int class_idx;
-	enum fullness_group fullness;
 
 	BUG_ON(!obj);
 
@@ -1451,7 +1442,6 @@ static void obj_free(struct zs_pool *pool, struct size_class *class,
 	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
-	get_zspage_mapping(first_page, &class_idx, &fullness);
 	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	vaddr = kmap_atomic(f_page);
@@ -1471,7 +1461,6 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 {
 	struct page *first_page, *f_page;
 	unsigned long obj, f_objidx;
-	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
@@ -1482,9 +1471,7 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	obj = handle_to_obj(handle);
 	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
-
-	get_zspage_mapping(first_page, &class_idx, &fullness);
-	class = pool->size_class[class_idx];
+	class = get_zspage_class(first_page);
 
 	spin_lock(&class->lock);
 	obj_free(pool, class, obj);
@@ -1636,7 +1623,7 @@ static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
 		}
 
 		/* Stop if there is no more space */
-		if (zspage_full(d_page)) {
+		if (zspage_full(class, d_page)) {
 			unpin_tag(handle);
 			ret = -ENOMEM;
 			break;
@@ -1690,15 +1677,17 @@ static void putback_zspage(struct zs_pool *pool, struct size_class *class,
 
 	BUG_ON(!is_first_page(first_page));
 
-	fullness = get_fullness_group(first_page);
+	fullness = get_fullness_group(class, first_page);
 	insert_zspage(first_page, class, fullness);
-	set_zspage_mapping(first_page, class->index, fullness);
+	set_zspage_fullness(first_page, fullness);
 
 	if (fullness == ZS_EMPTY) {
 		zs_stat_dec(class, OBJ_ALLOCATED, get_maxobj_per_zspage(
 			class->size, class->pages_per_zspage));
 		atomic_long_sub(class->pages_per_zspage,
 				&pool->pages_allocated);
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_compacted);
 
 		free_zspage(first_page);
 	}
@@ -1768,6 +1757,21 @@ static unsigned long __zs_compact(struct zs_pool *pool,
 	return nr_total_migrated;
 }
 
+/*
+ * Number of zspages __zs_compact() could free in @class, were the live
+ * objects packed into as few zspages as possible.
+ */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	obj_wasted = zs_stat_get(class, OBJ_ALLOCATED) -
+		zs_stat_get(class, OBJ_USED);
+
+	return obj_wasted / get_maxobj_per_zspage(class->size,
+						 class->pages_per_zspage);
+}
+
 unsigned long zs_compact(struct zs_pool *pool)
 {
 	int i;
@@ -1787,6 +1791,294 @@ unsigned long zs_compact(struct zs_pool *pool)
 }
 EXPORT_SYMBOL_GPL(zs_compact);
 
+static unsigned long zs_shrinker_scan(struct shrinker *shrinker,
+		struct shrink_control *sc)
+{
+	unsigned long pages_freed;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+			shrinker);
+
+	pages_freed = atomic_long_read(&pool->pages_compacted);
+	zs_compact(pool);
+	pages_freed = atomic_long_read(&pool->pages_compacted) - pages_freed;
+
+	return pages_freed ? pages_freed : SHRINK_STOP;
+}
+
+static unsigned long zs_shrinker_count(struct shrinker *shrinker,
+		struct shrink_control *sc)
+{
+	int i;
+	struct size_class *class;
+	unsigned long pages_to_free = 0;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+			shrinker);
+
+	for (i = zs_size_classes - 1; i >= 0; i--) {
+		class = pool->size_class[i];
+		if (!class)
+			continue;
+		if (class->index != i)
+			continue;
+
+		pages_to_free += zs_can_compact(class) *
+			class->pages_per_zspage;
+	}
+
+	return pages_to_free;
+}
+
+static void zs_unregister_shrinker(struct zs_pool *pool)
+{
+	if (pool->shrinker_enabled) {
+		unregister_shrinker(&pool->shrinker);
+		pool->shrinker_enabled = false;
+	}
+}
+
+static int zs_register_shrinker(struct zs_pool *pool)
+{
+	pool->shrinker.scan_objects = zs_shrinker_scan;
+	pool->shrinker.count_objects = zs_shrinker_count;
+	pool->shrinker.batch = 0;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+
+	return register_shrinker(&pool->shrinker);
+}
+
+#ifdef CONFIG_ZSMALLOC_MIGRATION
+/*
+ * Page migration for compaction.
+ *
+ * The pages of a zspage are chained through page->lru, so they can't go
+ * on the migration lists: compaction collects them on its own and hands
+ * each one to zs_page_migrate(). That copies the page and relinks the
+ * zspage under the class lock, with every allocated object that has data
+ * in the page pinned, so that no handle can be mapped or freed meanwhile.
+ *
+ * The class is found through page->mapping before its lock is taken;
+ * zs_destroy_pool() waits for an RCU grace period before freeing it.
+ */
+
+static unsigned long page_obj_handle(struct size_class *class,
+			struct page *page, void *vaddr, unsigned long off)
+{
+	unsigned long head = obj_to_head(class, page, vaddr + off);
+
+	if (!(head & OBJ_ALLOCATED_TAG))
+		return 0;
+	return head & ~OBJ_ALLOCATED_TAG;
+}
+
+/*
+ * Pin the allocated objects that keep data in @page: the one spilling
+ * over from @prev and those starting in @page. With @pin false, unpin
+ * the first @nr of them instead. Returns the number of objects handled,
+ * or -EBUSY, with nothing left pinned, if one of them is in use.
+ */
+static int zs_pin_page_objects(struct size_class *class, struct page *prev,
+			struct page *page, bool pin, int nr)
+{
+	unsigned long handle, off;
+	void *vaddr;
+	int done = 0;
+
+	if (prev && page->index && nr) {
+		vaddr = kmap_atomic(prev);
+		handle = page_obj_handle(class, prev, vaddr,
+				page->index + PAGE_SIZE - class->size);
+		kunmap_atomic(vaddr);
+		if (handle) {
+			if (!pin)
+				unpin_tag(handle);
+			else if (!trypin_tag(handle))
+				return -EBUSY;
+			done++;
+		}
+	}
+
+	off = prev ? page->index : 0;
+	vaddr = kmap_atomic(page);
+	for (; off < PAGE_SIZE && done < nr; off += class->size) {
+		handle = page_obj_handle(class, page, vaddr, off);
+		if (handle) {
+			if (!pin) {
+				unpin_tag(handle);
+			} else if (!trypin_tag(handle)) {
+				kunmap_atomic(vaddr);
+				zs_pin_page_objects(class, prev, page,
+						false, done);
+				return -EBUSY;
+			}
+			done++;
+		}
+		if (class->huge)
+			break;
+	}
+	kunmap_atomic(vaddr);
+
+	return done;
+}
+
+/* Make @newpage take the place of @page in the zspage headed by @first */
+static void zs_replace_page(struct size_class *class, struct page *first,
+			struct page *page, struct page *newpage)
+{
+	struct page *p;
+	enum fullness_group fg;
+
+	if (page == first) {
+		SetPagePrivate(newpage);
+		set_page_private(newpage, page_private(page));
+		newpage->freelist = page->freelist;
+		newpage->inuse = page->inuse;
+		newpage->objects = page->objects;
+
+		list_replace(&page->lru, &newpage->lru);
+		fg = get_zspage_fullness(page);
+		if (fg < _ZS_NR_FULLNESS_GROUPS &&
+		    class->fullness_list[fg] == page)
+			class->fullness_list[fg] = newpage;
+
+		for (p = get_next_page(newpage); p; p = get_next_page(p))
+			p->first_page = newpage;
+	} else {
+		newpage->first_page = first;
+		newpage->index = page->index;
+		list_replace(&page->lru, &newpage->lru);
+		if ((struct page *)page_private(first) == page)
+			set_page_private(first, (unsigned long)newpage);
+	}
+
+	if (is_last_page(page))
+		SetPagePrivate2(newpage);
+	set_zspage_class(newpage, class);
+}
+
+static void *relocate_obj(void *obj, struct page *page, struct page *newpage)
+{
+	struct page *obj_page;
+	unsigned long obj_idx;
+
+	if (!obj)
+		return NULL;
+
+	obj_to_location((unsigned long)obj, &obj_page, &obj_idx);
+	return obj_page == page ? location_to_obj(newpage, obj_idx) : obj;
+}
+
+/*
+ * Point the handles of the objects starting in @newpage, and the free
+ * list links leading into it, away from @page, which it replaced.
+ */
+static void zs_relocate_objects(struct size_class *class, struct page *page,
+			struct page *newpage)
+{
+	unsigned long handle, off, obj_idx = 0;
+	struct page *first, *obj_page;
+	struct link_free *link;
+	void *obj, *vaddr;
+
+	off = is_first_page(newpage) ? 0 : newpage->index;
+	vaddr = kmap_atomic(newpage);
+	for (; off < PAGE_SIZE; off += class->size, obj_idx++) {
+		handle = page_obj_handle(class, newpage, vaddr, off);
+		/* keep the pin taken by zs_pin_page_objects() */
+		if (handle)
+			record_obj(handle, (unsigned long)location_to_obj(
+					newpage, obj_idx) | BIT(HANDLE_PIN_BIT));
+		if (class->huge)
+			break;
+	}
+	kunmap_atomic(vaddr);
+
+	first = get_first_page(newpage);
+	first->freelist = relocate_obj(first->freelist, page, newpage);
+	for (obj = first->freelist; obj; obj = link->next) {
+		obj_to_location((unsigned long)obj, &obj_page, &obj_idx);
+		vaddr = kmap_atomic(obj_page);
+		link = (struct link_free *)(vaddr +
+			obj_idx_to_offset(obj_page, obj_idx, class->size));
+		link->next = relocate_obj(link->next, page, newpage);
+		kunmap_atomic(vaddr);
+	}
+}
+
+bool zs_page_isolate(struct page *page)
+{
+	if (!get_page_unless_zero(page))
+		return false;
+
+	if (!PageZsmalloc(page)) {
+		put_page(page);
+		return false;
+	}
+
+	return true;
+}
+
+void zs_page_putback(struct page *page)
+{
+	put_page(page);
+}
+
+/**
+ * zs_page_migrate - move a page isolated by zs_page_isolate() to @newpage
+ * @newpage: free page to move the contents to
+ * @page: isolated zspage component page
+ *
+ * Returns 0 with the reference from zs_page_isolate() still to be
+ * dropped by the caller, or -EAGAIN if the page can't be moved now:
+ * an object in it is mapped or being freed, or the zspage went away.
+ */
+int zs_page_migrate(struct page *newpage, struct page *page)
+{
+	struct size_class *class;
+	struct page *first, *prev, *p;
+	int nr, ret = -EAGAIN;
+
+	rcu_read_lock();
+	if (!PageZsmalloc(page))
+		goto out_rcu;
+	class = get_zspage_class(page);
+
+	spin_lock(&class->lock);
+	/* the zspage may have been freed, and reused, before the lock */
+	if (!PageZsmalloc(page) || get_zspage_class(page) != class)
+		goto out_unlock;
+	/* pairs with smp_wmb() in alloc_zspage() */
+	smp_rmb();
+	first = get_first_page(page);
+	/* not yet handed out by zs_malloc() */
+	if (!first->inuse)
+		goto out_unlock;
+
+	prev = NULL;
+	for (p = first; p != page; p = get_next_page(p))
+		prev = p;
+
+	nr = zs_pin_page_objects(class, prev, page, true, INT_MAX);
+	if (nr < 0)
+		goto out_unlock;
+
+	copy_highpage(newpage, page);
+	zs_replace_page(class, first, page, newpage);
+	zs_relocate_objects(class, page, newpage);
+	zs_pin_page_objects(class, prev, newpage, false, nr);
+
+	/* @page holds the isolation reference only from now on */
+	reset_page(page);
+	put_page(page);
+	ret = 0;
+
+out_unlock:
+	spin_unlock(&class->lock);
+out_rcu:
+	rcu_read_unlock();
+	return ret;
+}
+#endif /* CONFIG_ZSMALLOC_MIGRATION */
+
 /**
  * zs_create_pool - Creates an allocation pool to work from.
  * @flags: allocation flags used to allocate pool metadata
@@ -1872,6 +2164,13 @@ struct zs_pool *zs_create_pool(char *name, gfp_t flags)
 	if (zs_pool_stat_create(name, pool))
 		goto err;
 
+	/*
+	 * Not critical, we still can use the pool
+	 * and user can trigger compaction manually.
+	 */
+	if (zs_register_shrinker(pool) == 0)
+		pool->shrinker_enabled = true;
+
 	return pool;
 
 err:
@@ -1884,8 +2183,12 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	zs_unregister_shrinker(pool);
 	zs_pool_stat_destroy(pool);
 
+	/* let zs_page_migrate() callers still looking at a class leave */
+	synchronize_rcu();
+
 	for (i = 0; i < zs_size_classes; i++) {
 		int fg;
 		struct size_class *class = pool->size_class[i];
@@ -0,0 +1,432 @@
+/*
+ * page_pool.c - recycling allocator for network RX pages
+ *
+ * The alloc cache is only touched from the NAPI context owning the pool,
+ * everything else returns pages through the ring.  A page is only ever
+ * recycled while the pool holds its sole reference; a page someone else
+ * still references is unmapped and disconnected from the pool instead,
+ * so that whoever drops the last reference can simply put_page() it.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/poison.h>
+#include <linux/export.h>
+#include <net/page_pool.h>
+
+#define DEFER_TIME		(msecs_to_jiffies(1000))
+#define DEFER_WARN_INTERVAL	(60 * HZ)
+
+#define alloc_stat_inc(pool, __stat)	(pool->alloc_stats.__stat++)
+#define recycle_stat_inc(pool, __stat)	this_cpu_inc(pool->recycle_stats->__stat)
+
+static int page_pool_init(struct page_pool *pool,
+			  const struct page_pool_params *params)
+{
+	unsigned int ring_qsize = 1024; /* Default */
+	int err;
+
+	memcpy(&pool->p, params, sizeof(pool->p));
+
+	if (pool->p.flags & ~(PP_FLAG_ALL))
+		return -EINVAL;
+
+	if (pool->p.pool_size)
+		ring_qsize = pool->p.pool_size;
+
+	/* Sanity limit mem that can be pinned down */
+	if (ring_qsize > 32768)
+		return -E2BIG;
+
+	if (pool->p.flags & PP_FLAG_DMA_MAP) {
+		/* The DMA address is kept in page->private */
+		if (sizeof(dma_addr_t) > sizeof(unsigned long))
+			return -EOPNOTSUPP;
+
+		if (!pool->p.dev || (pool->p.dma_dir != DMA_FROM_DEVICE &&
+				     pool->p.dma_dir != DMA_BIDIRECTIONAL))
+			return -EINVAL;
+	}
+
+	pool->recycle_stats = alloc_percpu(struct page_pool_recycle_stats);
+	if (!pool->recycle_stats)
+		return -ENOMEM;
+
+	err = kfifo_alloc(&pool->ring, ring_qsize, GFP_KERNEL);
+	if (err) {
+		free_percpu(pool->recycle_stats);
+		return err;
+	}
+
+	spin_lock_init(&pool->ring_lock);
+	atomic_set(&pool->pages_state_release_cnt, 0);
+
+	if (pool->p.flags & PP_FLAG_DMA_MAP)
+		get_device(pool->p.dev);
+
+	return 0;
+}
+
+/**
+ * page_pool_create - create a page pool for one RX ring
+ * @params: pool configuration, copied into the pool
+ *
+ * Returns the pool or an ERR_PTR().
+ */
+struct page_pool *page_pool_create(const struct page_pool_params *params)
+{
+	struct page_pool *pool;
+	int err;
+
+	pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, params->nid);
+	if (!pool)
+		return ERR_PTR(-ENOMEM);
+
+	err = page_pool_init(pool, params);
+	if (err < 0) {
+		pr_warn("%s() gave up with errno %d\n", __func__, err);
+		kfree(pool);
+		return ERR_PTR(err);
+	}
+
+	return pool;
+}
+EXPORT_SYMBOL(page_pool_create);
+
+static void page_pool_return_page(struct page_pool *pool, struct page *page);
+
+static struct page *page_pool_refill_alloc_cache(struct page_pool *pool)
+{
+	int pref_nid = pool->p.nid;
+	struct page *page;
+
+	if (pref_nid == NUMA_NO_NODE)
+		pref_nid = numa_mem_id();
+
+	if (kfifo_is_empty(&pool->ring)) {
+		alloc_stat_inc(pool, empty);
+		return NULL;
+	}
+
+	while (pool->alloc.count < PP_ALLOC_CACHE_REFILL &&
+	       kfifo_get(&pool->ring, &page)) {
+		if (unlikely(page_to_nid(page) != pref_nid)) {
+			/* Hand remote pages back rather than feed them to
+			 * the device on this node.
+			 */
+			page_pool_return_page(pool, page);
+			alloc_stat_inc(pool, waive);
+			continue;
+		}
+		pool->alloc.cache[pool->alloc.count++] = page;
+	}
+
+	if (!pool->alloc.count)
+		return NULL;
+
+	alloc_stat_inc(pool, refill);
+	return pool->alloc.cache[--pool->alloc.count];
+}
+
+static struct page *__page_pool_get_cached(struct page_pool *pool)
+{
+	if (likely(pool->alloc.count)) {
+		alloc_stat_inc(pool, fast);
+		return pool->alloc.cache[--pool->alloc.count];
+	}
+
+	return page_pool_refill_alloc_cache(pool);
+}
+
+static struct page *__page_pool_alloc_pages_slow(struct page_pool *pool,
+						 gfp_t gfp)
+{
+	struct page *page;
+	dma_addr_t dma;
+
+	if (pool->p.order)
+		gfp |= __GFP_COMP;
+
+	page = alloc_pages_node(pool->p.nid, gfp, pool->p.order);
+	if (!page)
+		return NULL;
+
+	if (pool->p.flags & PP_FLAG_DMA_MAP) {
+		dma = dma_map_page(pool->p.dev, page, 0,
+				   PAGE_SIZE << pool->p.order,
+				   pool->p.dma_dir);
+		if (dma_mapping_error(pool->p.dev, dma)) {
+			put_page(page);
+			return NULL;
+		}
+		set_page_private(page, dma);
+	}
+
+	page->pp_magic = PP_SIGNATURE;
+	page->pp = pool;
+
+	pool->pages_state_hold_cnt++;
+	alloc_stat_inc(pool, slow);
+	return page;
+}
+
+/**
+ * page_pool_alloc_pages - get a page from the pool
+ * @pool: pool to allocate from
+ * @gfp: allocation flags for when the pool has to go to the page allocator
+ *
+ * Only from the NAPI context owning @pool.
+ */
+struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp)
+{
+	struct page *page;
+
+	page = __page_pool_get_cached(pool);
+	if (page)
+		return page;
+
+	return __page_pool_alloc_pages_slow(pool, gfp);
+}
+EXPORT_SYMBOL(page_pool_alloc_pages);
+
+static s32 page_pool_inflight(struct page_pool *pool)
+{
+	u32 release_cnt = atomic_read(&pool->pages_state_release_cnt);
+	u32 hold_cnt = READ_ONCE(pool->pages_state_hold_cnt);
+	s32 inflight;
+
+	inflight = (s32)(hold_cnt - release_cnt);
+	WARN(inflight < 0, "page_pool: negative inflight %d\n", inflight);
+	return inflight;
+}
+
+void page_pool_release_page(struct page_pool *pool, struct page *page)
+{
+	if (pool->p.flags & PP_FLAG_DMA_MAP) {
+		dma_unmap_page(pool->p.dev, page_pool_get_dma_addr(page),
+			       PAGE_SIZE << pool->p.order, pool->p.dma_dir);
+		set_page_private(page, 0);
+	}
+
+	page->pp_magic = 0;
+	page->pp = NULL;
+
+	/* Last access to @pool for this page: the pool may be freed as soon
+	 * as the release count catches up with the hold count.
+	 */
+	atomic_inc(&pool->pages_state_release_cnt);
+}
+EXPORT_SYMBOL(page_pool_release_page);
+
+static void page_pool_return_page(struct page_pool *pool, struct page *page)
+{
+	page_pool_release_page(pool, page);
+	put_page(page);
+}
+
+static bool page_pool_recycle_in_ring(struct page_pool *pool,
+				      struct page *page)
+{
+	bool ret;
+
+	spin_lock_bh(&pool->ring_lock);
+	ret = kfifo_put(&pool->ring, page);
+	if (ret)
+		recycle_stat_inc(pool, ring);
+	else
+		recycle_stat_inc(pool, ring_full);
+	spin_unlock_bh(&pool->ring_lock);
+
+	return ret;
+}
+
+static bool page_pool_recycle_in_cache(struct page_pool *pool,
+				       struct page *page)
+{
+	if (unlikely(pool->alloc.count == PP_ALLOC_CACHE_SIZE)) {
+		recycle_stat_inc(pool, cache_full);
+		return false;
+	}
+
+	pool->alloc.cache[pool->alloc.count++] = page;
+	recycle_stat_inc(pool, cached);
+	return true;
+}
+
+/**
+ * page_pool_put_page - give a page back to its pool
+ * @pool: pool the page was allocated from
+ * @page: the page
+ * @allow_direct: caller runs in the NAPI context owning @pool
+ */
+void page_pool_put_page(struct page_pool *pool, struct page *page,
+			bool allow_direct)
+{
+	if (likely(page_count(page) == 1 && !page_is_pfmemalloc(page))) {
+		if (allow_direct && in_serving_softirq() &&
+		    page_pool_recycle_in_cache(pool, page))
+			return;
+
+		if (!page_pool_recycle_in_ring(pool, page))
+			page_pool_return_page(pool, page);
+		return;
+	}
+
+	/* Someone else holds the page too, or it came from the reserves:
+	 * the pool can't have it back, so let the last holder free it as
+	 * an ordinary page.
+	 */
+	recycle_stat_inc(pool, released_refcnt);
+	page_pool_return_page(pool, page);
+}
+EXPORT_SYMBOL(page_pool_put_page);
+
+/**
+ * page_pool_return_skb_page - recycle a page of an skb marked for recycling
+ * @page: head or frag page of the skb
+ *
+ * Returns false if @page does not belong to a page_pool and has to be
+ * released by the caller.
+ */
+bool page_pool_return_skb_page(struct page *page)
+{
+	page = compound_head(page);
+	if (unlikely(page->pp_magic != PP_SIGNATURE))
+		return false;
+
+	/* Nothing tells us this runs in the NAPI context that owns the
+	 * pool, so the page goes back through the ring.
+	 */
+	page_pool_put_page(page->pp, page, false);
+	return true;
+}
+EXPORT_SYMBOL(page_pool_return_skb_page);
+
+/**
+ * page_pool_get_stats - fetch the statistics of a pool
+ * @pool: the pool
+ * @stats: the counters of @pool are added to these
+ *
+ * Adding lets a driver sum up all the pools of a device.  The allocation
+ * counters are read without synchronizing with the NAPI side.
+ */
+bool page_pool_get_stats(struct page_pool *pool,
+			 struct page_pool_stats *stats)
+{
+	int cpu;
+
+	if (!stats)
+		return false;
+
+	stats->alloc_stats.fast += pool->alloc_stats.fast;
+	stats->alloc_stats.slow += pool->alloc_stats.slow;
+	stats->alloc_stats.empty += pool->alloc_stats.empty;
+	stats->alloc_stats.refill += pool->alloc_stats.refill;
+	stats->alloc_stats.waive += pool->alloc_stats.waive;
+
+	for_each_possible_cpu(cpu) {
+		const struct page_pool_recycle_stats *pcpu;
+
+		pcpu = per_cpu_ptr(pool->recycle_stats, cpu);
+		stats->recycle_stats.cached += pcpu->cached;
+		stats->recycle_stats.cache_full += pcpu->cache_full;
+		stats->recycle_stats.ring += pcpu->ring;
+		stats->recycle_stats.ring_full += pcpu->ring_full;
+		stats->recycle_stats.released_refcnt += pcpu->released_refcnt;
+	}
+
+	return true;
+}
+EXPORT_SYMBOL(page_pool_get_stats);
+
+static void page_pool_empty_alloc_cache(struct page_pool *pool)
+{
+	while (pool->alloc.count)
+		page_pool_return_page(pool,
+				      pool->alloc.cache[--pool->alloc.count]);
+}
+
+static void page_pool_empty_ring(struct page_pool *pool)
+{
+	struct page *page;
+
+	/* Producers may still run once the pool is destroyed, and must be
+	 * done with the ring before their pages are counted as released.
+	 */
+	spin_lock_bh(&pool->ring_lock);
+	while (kfifo_get(&pool->ring, &page))
+		page_pool_return_page(pool, page);
+	spin_unlock_bh(&pool->ring_lock);
+}
+
+static void page_pool_free(struct page_pool *pool)
+{
+	kfifo_free(&pool->ring);
+	free_percpu(pool->recycle_stats);
+
+	if (pool->p.flags & PP_FLAG_DMA_MAP)
+		put_device(pool->p.dev);
+
+	kfree(pool);
+}
+
+static void page_pool_release_retry(struct work_struct *wq)
+{
+	struct delayed_work *dwq = to_delayed_work(wq);
+	struct page_pool *pool = container_of(dwq, typeof(*pool), release_dw);
+	s32 inflight;
+
+	page_pool_empty_ring(pool);
+	inflight = page_pool_inflight(pool);
+	if (!inflight) {
+		page_pool_free(pool);
+		return;
+	}
+
+	/* Periodic warning while skbs keep pages of the pool alive */
+	if (time_after_eq(jiffies, pool->defer_warn)) {
+		int sec = (s32)((u32)jiffies - (u32)pool->defer_start) / HZ;
+
+		pr_warn("%s() stalled pool shutdown %d inflight %d sec\n",
+			__func__, inflight, sec);
+		pool->defer_warn = jiffies + DEFER_WARN_INTERVAL;
+	}
+
+	schedule_delayed_work(&pool->release_dw, DEFER_TIME);
+}
+
+/**
+ * page_pool_destroy - release a pool
+ * @pool: the pool, may be NULL
+ *
+ * The NAPI context owning @pool must be stopped.  Pages still held by skbs
+ * come back later; the pool is freed once the last one did.
+ */
+void page_pool_destroy(struct page_pool *pool)
+{
+	if (!pool)
+		return;
+
+	page_pool_empty_alloc_cache(pool);
+	page_pool_empty_ring(pool);
+
+	if (!page_pool_inflight(pool)) {
+		page_pool_free(pool);
+		return;
+	}
+
+	pool->defer_start = jiffies;
+	pool->defer_warn = jiffies + DEFER_WARN_INTERVAL;
+
+	INIT_DELAYED_WORK(&pool->release_dw, page_pool_release_retry);
+	schedule_delayed_work(&pool->release_dw, DEFER_TIME);
+}
+EXPORT_SYMBOL(page_pool_destroy);
@@ -31,9 +31,13 @@ static int max_skb_frags = MAX_SKB_FRAGS;
 static int net_msg_warn;	/* Unused, but still a sysctl */
 
 #ifdef CONFIG_RPS
+/* table->data points to the global table for init_net, and to the table
+ * of its own for any other netns.
+ */
 static int rps_sock_flow_sysctl(struct ctl_table *table, int write,
 				void __user *buffer, size_t *lenp, loff_t *ppos)
 {
+	struct rps_sock_flow_table __rcu **tablep = table->data;
 	unsigned int orig_size, size;
 	int ret, i;
 	struct ctl_table tmp = {
@@ -46,7 +50,7 @@ static int rps_sock_flow_sysctl(struct ctl_table *table, int write,
 
 	mutex_lock(&sock_flow_mutex);
 
-	orig_sock_table = rcu_dereference_protected(rps_sock_flow_table,
+	orig_sock_table = rcu_dereference_protected(*tablep,
 					lockdep_is_held(&sock_flow_mutex));
 	size = orig_size = orig_sock_table ? orig_sock_table->mask + 1 : 0;
 
@@ -78,7 +82,7 @@ static int rps_sock_flow_sysctl(struct ctl_table *table, int write,
 			sock_table = NULL;
 
 		if (sock_table != orig_sock_table) {
-			rcu_assign_pointer(rps_sock_flow_table, sock_table);
+			rcu_assign_pointer(*tablep, sock_table);
 			if (sock_table)
 				static_key_slow_inc(&rps_needed);
 			if (orig_sock_table) {
@@ -332,14 +336,6 @@ static struct ctl_table net_core_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one
 	},
-#ifdef CONFIG_RPS
-	{
-		.procname	= "rps_sock_flow_entries",
-		.maxlen		= sizeof(int),
-		.mode		= 0644,
-		.proc_handler	= rps_sock_flow_sysctl
-	},
-#endif
 #ifdef CONFIG_NET_FLOW_LIMIT
 	{
 		.procname	= "flow_limit_cpu_bitmap",
@@ -414,6 +410,15 @@ static struct ctl_table netns_core_table[] = {
 		.extra1		= &zero,
 		.proc_handler	= proc_dointvec_minmax
 	},
+#ifdef CONFIG_RPS
+	{
+		.procname	= "rps_sock_flow_entries",
+		.data		= &rps_sock_flow_table,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= rps_sock_flow_sysctl
+	},
+#endif
 	{ }
 };
 
@@ -430,6 +435,9 @@ static __net_init int sysctl_core_net_init(struct net *net)
 			goto err_dup;
 
 		tbl[0].data = &net->core.sysctl_somaxconn;
+#ifdef CONFIG_RPS
+		tbl[1].data = &net->core.rps_sock_flow_table;
+#endif
 
 		/* Don't export any sysctls to unprivileged users */
 		if (net->user_ns != &init_user_ns) {
@@ -452,12 +460,26 @@ err_dup:
 
 static __net_exit void sysctl_core_net_exit(struct net *net)
 {
+#ifdef CONFIG_RPS
+	struct rps_sock_flow_table *sock_table;
+#endif
 	struct ctl_table *tbl;
 
 	tbl = net->core.sysctl_hdr->ctl_table_arg;
 	unregister_net_sysctl_table(net->core.sysctl_hdr);
 	BUG_ON(tbl == netns_core_table);
 	kfree(tbl);
+
+#ifdef CONFIG_RPS
+	/* No writer left now that the sysctl is gone */
+	sock_table = rcu_dereference_protected(net->core.rps_sock_flow_table, 1);
+	if (sock_table) {
+		RCU_INIT_POINTER(net->core.rps_sock_flow_table, NULL);
+		static_key_slow_dec(&rps_needed);
+		synchronize_rcu();
+		vfree(sock_table);
+	}
+#endif
 }
 
 static __net_initdata struct pernet_operations sysctl_core_ops = {
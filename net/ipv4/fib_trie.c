@@ -71,6 +71,8 @@
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <linux/export.h>
 #include <net/net_namespace.h>
 #include <net/ip.h>
@@ -144,11 +146,36 @@ struct trie {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	struct trie_use_stats __percpu *stats;
 #endif
+#ifdef CONFIG_IP_FIB_TRIE_ACCEL
+	struct fib_accel __rcu *accel;
+	spinlock_t accel_lock;
+	unsigned int accel_gen;
+	bool accel_dead;
+	bool accel_stale;
+	struct delayed_work accel_work;
+#endif
 };
 
 static struct key_vector *resize(struct trie *t, struct key_vector *tn);
 static size_t tnode_free_size;
 
+#ifdef CONFIG_IP_FIB_TRIE_ACCEL
+static void fib_accel_put_child(struct key_vector *tn, struct key_vector *chi,
+				struct key_vector *n);
+static void fib_accel_set_slen(struct key_vector *tn, unsigned char slen);
+#else
+static inline void fib_accel_put_child(struct key_vector *tn,
+				       struct key_vector *chi,
+				       struct key_vector *n)
+{
+}
+
+static inline void fib_accel_set_slen(struct key_vector *tn,
+				      unsigned char slen)
+{
+}
+#endif
+
 /*
  * synchronize_rcu after call_rcu for that many pages; it should be especially
  * useful before resizing the root node with PREEMPT_NONE configs; the value was
@@ -405,9 +432,12 @@ static void put_child(struct key_vector *tn, unsigned long i,
 	else if (!wasfull && isfull)
 		tn_info(tn)->full_children++;
 
-	if (n && (tn->slen < n->slen))
+	if (n && (tn->slen < n->slen)) {
+		fib_accel_set_slen(tn, n->slen);
 		tn->slen = n->slen;
+	}
 
+	fib_accel_put_child(tn, chi, n);
 	rcu_assign_pointer(tn->tnode[i], n);
 }
 
@@ -436,9 +466,10 @@ static void update_children(struct key_vector *tn)
 static inline void put_child_root(struct key_vector *tp, t_key key,
 				  struct key_vector *n)
 {
-	if (IS_TRIE(tp))
+	if (IS_TRIE(tp)) {
+		fib_accel_put_child(tp, get_child(tp, 0), n);
 		rcu_assign_pointer(tp->tnode[0], n);
-	else
+	} else
 		put_child(tp, get_index(key, tp), n);
 }
 
@@ -703,6 +734,7 @@ static unsigned char update_suffix(struct key_vector *tn)
 			break;
 	}
 
+	fib_accel_set_slen(tn, slen);
 	tn->slen = slen;
 
 	return slen;
@@ -881,8 +913,10 @@ static struct key_vector *resize(struct trie *t, struct key_vector *tn)
 	if (tn->slen > tn->pos) {
 		unsigned char slen = update_suffix(tn);
 
-		if (slen > tp->slen)
+		if (slen > tp->slen) {
+			fib_accel_set_slen(tp, slen);
 			tp->slen = slen;
+		}
 	}
 
 	return tp;
@@ -903,6 +937,7 @@ static void leaf_push_suffix(struct key_vector *tn, struct key_vector *l)
 	 * out parent suffix lengths as a part of trie_rebalance
 	 */
 	while (tn->slen < l->slen) {
+		fib_accel_set_slen(tn, l->slen);
 		tn->slen = l->slen;
 		tn = node_parent(tn);
 	}
@@ -986,6 +1021,277 @@ static void trie_rebalance(struct trie *t, struct key_vector *tn)
 		tn = resize(t, tn);
 }
 
+#ifdef CONFIG_IP_FIB_TRIE_ACCEL
+/* Large tables get a jump table indexed by the top FIB_ACCEL_BITS of the
+ * key.  Each slot holds the state the walk in fib_table_lookup() is in
+ * when it gets to the last tnode looking at one of those bits: the node
+ * and the last node backtracking would have restarted from.  Lookups
+ * start from there and go on exactly as they would have, so the result
+ * is the same as without the table.
+ *
+ * The table only points at tnodes with pos >= FIB_ACCEL_SHIFT, and only
+ * depends on which of their children are such tnodes too and on whether
+ * their suffix reaches above pos.  Changes further down, which is where
+ * most prefixes of a big table live, leave it alone.  Anything else makes
+ * the table go away before the trie is touched, and a rebuild of the
+ * whole table is scheduled once the change is done.  Rebuilds of back
+ * to back changes are batched up.
+ */
+#define FIB_ACCEL_BITS		20
+#define FIB_ACCEL_SHIFT		(KEYLENGTH - FIB_ACCEL_BITS)
+#define FIB_ACCEL_SLOTS		(1ul << FIB_ACCEL_BITS)
+#define FIB_ACCEL_MIN_ROOT_BITS	8
+#define FIB_ACCEL_DELAY		HZ
+
+struct fib_accel_slot {
+	struct key_vector *n;
+	struct key_vector *pn;
+};
+
+struct fib_accel {
+	struct rcu_head rcu;
+	struct fib_accel_slot slots[0];
+};
+
+static void fib_accel_fill(struct fib_accel *accel, unsigned long lo,
+			   unsigned long nr, struct key_vector *n,
+			   struct key_vector *pn)
+{
+	struct fib_accel_slot *slot = &accel->slots[lo];
+
+	for (; nr; nr--, slot++) {
+		slot->n = n;
+		slot->pn = pn;
+	}
+}
+
+/* @n is reached by the keys of slots [@lo, @lo + @nr) with @pn recorded */
+static void fib_accel_build_node(struct fib_accel *accel, struct key_vector *n,
+				 struct key_vector *pn, unsigned long lo,
+				 unsigned long nr)
+{
+	struct key_vector *cpn = pn;
+	unsigned long base, span, child_nr, i;
+
+	/* keys outside of the prefix of n fall out of the walk at n */
+	span = 1ul << (n->pos + n->bits - FIB_ACCEL_SHIFT);
+	base = (n->key >> FIB_ACCEL_SHIFT) & ~(span - 1);
+	fib_accel_fill(accel, lo, base - lo, n, pn);
+	fib_accel_fill(accel, base + span, lo + nr - base - span, n, pn);
+
+	if (n->slen > n->pos)
+		cpn = n;
+
+	child_nr = 1ul << (n->pos - FIB_ACCEL_SHIFT);
+	for (i = 0; i < child_length(n); i++, base += child_nr) {
+		struct key_vector *child = get_child_rcu(n, i);
+
+		/* the walk reads anything below the cut from n onwards */
+		if (!child || IS_LEAF(child) || child->pos < FIB_ACCEL_SHIFT)
+			fib_accel_fill(accel, base, child_nr, n, pn);
+		else
+			fib_accel_build_node(accel, child, cpn, base, child_nr);
+	}
+}
+
+/* Start the walk in fib_table_lookup(), caller must hold RCU read lock */
+static inline struct key_vector *fib_accel_lookup(struct trie *t, t_key key,
+						  struct key_vector **pn,
+						  t_key *cindex)
+{
+	struct fib_accel *accel = rcu_dereference(t->accel);
+	struct fib_accel_slot *slot;
+
+	if (!accel)
+		return NULL;
+
+	slot = &accel->slots[key >> FIB_ACCEL_SHIFT];
+	*pn = slot->pn;
+	*cindex = get_index(key, slot->pn);
+
+	return slot->n;
+}
+
+static void fib_accel_free_rcu(struct rcu_head *head)
+{
+	vfree(container_of(head, struct fib_accel, rcu));
+}
+
+/* Caller must hold RTNL, before the trie is changed */
+static void fib_accel_invalidate(struct trie *t)
+{
+	struct fib_accel *old;
+
+	spin_lock(&t->accel_lock);
+	t->accel_gen++;
+	old = rcu_dereference_protected(t->accel,
+					lockdep_is_held(&t->accel_lock));
+	RCU_INIT_POINTER(t->accel, NULL);
+	spin_unlock(&t->accel_lock);
+
+	if (old)
+		call_rcu(&old->rcu, fib_accel_free_rcu);
+}
+
+/* Caller must hold RTNL, after the trie has been changed */
+static void fib_accel_schedule(struct trie *t)
+{
+	bool dead;
+
+	t->accel_stale = false;
+
+	spin_lock(&t->accel_lock);
+	t->accel_gen++;
+	dead = t->accel_dead;
+	spin_unlock(&t->accel_lock);
+
+	if (!dead)
+		queue_delayed_work(system_power_efficient_wq, &t->accel_work,
+				   FIB_ACCEL_DELAY);
+}
+
+/* Caller must hold RTNL, after a route has been added or removed */
+static void fib_accel_update(struct trie *t)
+{
+	if (t->accel_stale || !rcu_access_pointer(t->accel))
+		fib_accel_schedule(t);
+}
+
+static bool fib_accel_covers(const struct key_vector *n)
+{
+	return n && IS_TNODE(n) && n->pos >= FIB_ACCEL_SHIFT;
+}
+
+/* Nodes being put together by inflate() and halve() have no parent yet,
+ * the table only cares about them once they are linked into the trie.
+ */
+static void fib_accel_node_changed(struct key_vector *tn)
+{
+	struct trie *t;
+
+	while (!IS_TRIE(tn)) {
+		tn = node_parent(tn);
+		if (!tn)
+			return;
+	}
+
+	t = container_of(tn, struct trie, kv[0]);
+	t->accel_stale = true;
+	fib_accel_invalidate(t);
+}
+
+/* Caller must hold RTNL, before @chi in @tn is replaced with @n */
+static void fib_accel_put_child(struct key_vector *tn, struct key_vector *chi,
+				struct key_vector *n)
+{
+	if (tn->pos >= FIB_ACCEL_SHIFT &&
+	    (fib_accel_covers(chi) || fib_accel_covers(n)))
+		fib_accel_node_changed(tn);
+}
+
+/* Caller must hold RTNL, before the suffix length of @tn is changed */
+static void fib_accel_set_slen(struct key_vector *tn, unsigned char slen)
+{
+	if (tn->pos >= FIB_ACCEL_SHIFT &&
+	    (tn->slen > tn->pos) != (slen > tn->pos))
+		fib_accel_node_changed(tn);
+}
+
+/* Too small a root and most of the table would point at it */
+static bool fib_accel_worth_it(const struct key_vector *root)
+{
+	return root && IS_TNODE(root) && root->pos >= FIB_ACCEL_SHIFT &&
+	       root->bits >= FIB_ACCEL_MIN_ROOT_BITS;
+}
+
+/* Runs without RTNL: a table built while the trie was being changed is
+ * thrown away, the change schedules another rebuild when it is done.
+ */
+static void fib_accel_work(struct work_struct *work)
+{
+	struct trie *t = container_of(work, struct trie, accel_work.work);
+	struct fib_accel *accel;
+	struct key_vector *root;
+	unsigned int gen;
+	bool built;
+
+	spin_lock(&t->accel_lock);
+	gen = t->accel_gen;
+	spin_unlock(&t->accel_lock);
+
+	rcu_read_lock();
+	built = fib_accel_worth_it(get_child_rcu(t->kv, 0));
+	rcu_read_unlock();
+	if (!built)
+		return;
+
+	accel = vmalloc(sizeof(*accel) +
+			FIB_ACCEL_SLOTS * sizeof(struct fib_accel_slot));
+	if (!accel)
+		return;
+
+	rcu_read_lock();
+	root = get_child_rcu(t->kv, 0);
+	built = fib_accel_worth_it(root);
+	if (built)
+		fib_accel_build_node(accel, root, t->kv, 0, FIB_ACCEL_SLOTS);
+	rcu_read_unlock();
+
+	spin_lock(&t->accel_lock);
+	if (built && gen == t->accel_gen) {
+		rcu_assign_pointer(t->accel, accel);
+		accel = NULL;
+	}
+	spin_unlock(&t->accel_lock);
+
+	vfree(accel);
+}
+
+static void fib_accel_init(struct trie *t)
+{
+	spin_lock_init(&t->accel_lock);
+	INIT_DELAYED_WORK(&t->accel_work, fib_accel_work);
+}
+
+/* The trie is on its way out, but tables aliasing it may still flush it */
+static void fib_accel_destroy(struct trie *t)
+{
+	spin_lock(&t->accel_lock);
+	t->accel_dead = true;
+	spin_unlock(&t->accel_lock);
+
+	cancel_delayed_work_sync(&t->accel_work);
+	fib_accel_invalidate(t);
+}
+#else
+static inline struct key_vector *fib_accel_lookup(struct trie *t, t_key key,
+						  struct key_vector **pn,
+						  t_key *cindex)
+{
+	return NULL;
+}
+
+static inline void fib_accel_invalidate(struct trie *t)
+{
+}
+
+static inline void fib_accel_schedule(struct trie *t)
+{
+}
+
+static inline void fib_accel_update(struct trie *t)
+{
+}
+
+static inline void fib_accel_init(struct trie *t)
+{
+}
+
+static inline void fib_accel_destroy(struct trie *t)
+{
+}
+#endif /* CONFIG_IP_FIB_TRIE_ACCEL */
+
 static int fib_insert_node(struct trie *t, struct key_vector *tp,
 			   struct fib_alias *new, t_key key)
 {
@@ -1227,6 +1533,7 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 
 	/* Insert new entry to the list. */
 	err = fib_insert_alias(t, tp, l, new_fa, fa, key);
+	fib_accel_update(t);
 	if (err)
 		goto out_sw_fib_del;
 
@@ -1270,12 +1577,15 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 	unsigned long index;
 	t_key cindex;
 
-	pn = t->kv;
-	cindex = 0;
+	n = fib_accel_lookup(t, key, &pn, &cindex);
+	if (!n) {
+		pn = t->kv;
+		cindex = 0;
 
-	n = get_child_rcu(pn, cindex);
-	if (!n)
-		return -EAGAIN;
+		n = get_child_rcu(pn, cindex);
+		if (!n)
+			return -EAGAIN;
+	}
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	this_cpu_inc(stats->gets);
@@ -1528,6 +1838,7 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 		tb->tb_num_default--;
 
 	fib_remove_alias(t, tp, l, fa_to_delete);
+	fib_accel_update(t);
 
 	if (fa_to_delete->fa_state & FA_S_ACCESSED)
 		rt_cache_flush(cfg->fc_nlinfo.nl_net);
@@ -1702,6 +2013,8 @@ struct fib_table *fib_trie_unmerge(struct fib_table *oldtb)
 			break;
 	}
 
+	fib_accel_schedule(lt);
+
 	return local_tb;
 out:
 	fib_trie_free(local_tb);
@@ -1718,6 +2031,8 @@ void fib_table_flush_external(struct fib_table *tb)
 	struct hlist_node *tmp;
 	struct fib_alias *fa;
 
+	fib_accel_invalidate(t);
+
 	/* walk trie in reverse order */
 	for (;;) {
 		unsigned char slen = 0;
@@ -1782,6 +2097,8 @@ void fib_table_flush_external(struct fib_table *tb)
 			node_free(n);
 		}
 	}
+
+	fib_accel_schedule(t);
 }
 
 /* Caller must hold RTNL. */
@@ -1794,6 +2111,8 @@ int fib_table_flush(struct fib_table *tb)
 	struct fib_alias *fa;
 	int found = 0;
 
+	fib_accel_invalidate(t);
+
 	/* walk trie in reverse order */
 	for (;;) {
 		unsigned char slen = 0;
@@ -1853,6 +2172,8 @@ int fib_table_flush(struct fib_table *tb)
 		}
 	}
 
+	fib_accel_schedule(t);
+
 	pr_debug("trie_flush found=%d\n", found);
 	return found;
 }
@@ -1871,6 +2192,9 @@ static void __trie_free_rcu(struct rcu_head *head)
 
 void fib_free_table(struct fib_table *tb)
 {
+	if (tb->tb_data == tb->__data)
+		fib_accel_destroy((struct trie *)tb->tb_data);
+
 	call_rcu(&tb->rcu, __trie_free_rcu);
 }
 
@@ -1986,6 +2310,7 @@ struct fib_table *fib_trie_table(u32 id, struct fib_table *alias)
 	t = (struct trie *) tb->tb_data;
 	t->kv[0].pos = KEYLENGTH;
 	t->kv[0].slen = KEYLENGTH;
+	fib_accel_init(t);
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	t->stats = alloc_percpu(struct trie_use_stats);
 	if (!t->stats) {
@@ -0,0 +1,272 @@
+/*
+ * IPv4 fast path for connections in the netfilter flow table.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/ip.h>
+#include <net/route.h>
+#include <net/neighbour.h>
+#include <net/checksum.h>
+#include <net/netfilter/nf_flow_table.h>
+
+struct flow_ports {
+	__be16 source, dest;
+};
+
+static bool ip_has_options(unsigned int thoff)
+{
+	return thoff != sizeof(struct iphdr);
+}
+
+static int nf_flow_tuple_ip(struct sk_buff *skb, const struct net_device *dev,
+			    struct flow_offload_tuple *tuple)
+{
+	struct flow_ports *ports;
+	unsigned int thoff;
+	struct iphdr *iph;
+
+	if (!pskb_may_pull(skb, sizeof(*iph)))
+		return -1;
+
+	iph = ip_hdr(skb);
+	thoff = iph->ihl * 4;
+
+	if (ip_is_fragment(iph) ||
+	    unlikely(ip_has_options(thoff)))
+		return -1;
+
+	if (iph->protocol != IPPROTO_TCP &&
+	    iph->protocol != IPPROTO_UDP)
+		return -1;
+
+	/* let the slow path send the time exceeded */
+	if (iph->ttl <= 1)
+		return -1;
+
+	if (!pskb_may_pull(skb, thoff + sizeof(*ports)))
+		return -1;
+
+	iph = ip_hdr(skb);
+	ports = (struct flow_ports *)(skb_network_header(skb) + thoff);
+
+	tuple->src_v4	= iph->saddr;
+	tuple->dst_v4	= iph->daddr;
+	tuple->src_port	= ports->source;
+	tuple->dst_port	= ports->dest;
+	tuple->l4proto	= iph->protocol;
+	tuple->iifidx	= dev->ifindex;
+
+	return 0;
+}
+
+/* connection teardown has to go through conntrack */
+static int nf_flow_state_check(struct flow_offload *flow, int proto,
+			       struct sk_buff *skb, unsigned int thoff)
+{
+	struct tcphdr *tcph;
+
+	if (proto != IPPROTO_TCP)
+		return 0;
+
+	if (!pskb_may_pull(skb, thoff + sizeof(*tcph)))
+		return -1;
+
+	tcph = (void *)(skb_network_header(skb) + thoff);
+	if (unlikely(tcph->fin || tcph->rst)) {
+		flow_offload_teardown(flow);
+		return -1;
+	}
+
+	return 0;
+}
+
+static bool nf_flow_exceeds_mtu(const struct sk_buff *skb, unsigned int mtu)
+{
+	if (skb->len <= mtu)
+		return false;
+
+	if (skb_is_gso(skb) && skb_gso_network_seglen(skb) <= mtu)
+		return false;
+
+	return true;
+}
+
+static __sum16 *nf_flow_l4_csum(struct sk_buff *skb, unsigned int thoff,
+				u8 protocol)
+{
+	struct udphdr *udph;
+
+	if (protocol == IPPROTO_TCP)
+		return &((struct tcphdr *)(skb->data + thoff))->check;
+
+	udph = (void *)(skb->data + thoff);
+	if (!udph->check && skb->ip_summed != CHECKSUM_PARTIAL)
+		return NULL;
+
+	return &udph->check;
+}
+
+static void nf_flow_nat_ip_l4(struct sk_buff *skb, __sum16 *check,
+			      u8 protocol, __be32 addr, __be32 new_addr)
+{
+	inet_proto_csum_replace4(check, skb, addr, new_addr, 1);
+	if (protocol == IPPROTO_UDP && !*check)
+		*check = CSUM_MANGLED_0;
+}
+
+static void nf_flow_nat_port(struct sk_buff *skb, __sum16 *check,
+			     u8 protocol, __be16 *port, __be16 new_port)
+{
+	if (*port == new_port)
+		return;
+
+	if (check) {
+		inet_proto_csum_replace2(check, skb, *port, new_port, 0);
+		if (protocol == IPPROTO_UDP && !*check)
+			*check = CSUM_MANGLED_0;
+	}
+	*port = new_port;
+}
+
+/* Rewrite the packet to what the other direction of the connection
+ * expects to see, which is the inverse of its tuple.
+ */
+static void nf_flow_nat_ip(const struct flow_offload *flow, struct sk_buff *skb,
+			   unsigned int thoff, enum ip_conntrack_dir dir)
+{
+	const struct flow_offload_tuple *other = &flow->tuplehash[!dir].tuple;
+	struct flow_ports *ports;
+	struct iphdr *iph;
+	__sum16 *check;
+	u8 protocol;
+
+	if (!(flow->flags & (FLOW_OFFLOAD_SNAT | FLOW_OFFLOAD_DNAT)))
+		return;
+
+	iph = ip_hdr(skb);
+	protocol = iph->protocol;
+	check = nf_flow_l4_csum(skb, thoff, protocol);
+
+	if (iph->saddr != other->dst_v4) {
+		if (check)
+			nf_flow_nat_ip_l4(skb, check, protocol, iph->saddr,
+					  other->dst_v4);
+		csum_replace4(&iph->check, iph->saddr, other->dst_v4);
+		iph->saddr = other->dst_v4;
+	}
+	if (iph->daddr != other->src_v4) {
+		if (check)
+			nf_flow_nat_ip_l4(skb, check, protocol, iph->daddr,
+					  other->src_v4);
+		csum_replace4(&iph->check, iph->daddr, other->src_v4);
+		iph->daddr = other->src_v4;
+	}
+
+	ports = (void *)(skb->data + thoff);
+	nf_flow_nat_port(skb, check, protocol, &ports->source, other->dst_port);
+	nf_flow_nat_port(skb, check, protocol, &ports->dest, other->src_port);
+}
+
+static unsigned int
+nf_flow_offload_ip_hook(const struct nf_hook_ops *ops, struct sk_buff *skb,
+			const struct nf_hook_state *state)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct flow_offload_tuple tuple = {};
+	struct net *net = dev_net(state->in);
+	struct net_device *outdev;
+	enum ip_conntrack_dir dir;
+	struct flow_offload *flow;
+	struct rtable *rt;
+	unsigned int thoff;
+	struct iphdr *iph;
+	__be32 nexthop;
+	u8 protocol;
+
+	if (nf_flow_tuple_ip(skb, state->in, &tuple) < 0)
+		return NF_ACCEPT;
+
+	tuplehash = flow_offload_lookup(net, &tuple);
+	if (!tuplehash)
+		return NF_ACCEPT;
+
+	dir = tuplehash->tuple.dir;
+	flow = container_of(tuplehash, struct flow_offload, tuplehash[dir]);
+	rt = (struct rtable *)tuplehash->tuple.dst_cache;
+
+	if (unlikely(flow->flags & FLOW_OFFLOAD_TEARDOWN ||
+		     nf_ct_is_dying(flow->ct)))
+		return NF_ACCEPT;
+
+	outdev = dev_get_by_index_rcu(net, tuplehash->tuple.oifidx);
+	if (!outdev)
+		return NF_ACCEPT;
+
+	if (unlikely(nf_flow_exceeds_mtu(skb, tuplehash->tuple.mtu)))
+		return NF_ACCEPT;
+
+	/* the route changed, find the new one in the slow path */
+	if (!dst_check(&rt->dst, 0)) {
+		flow_offload_teardown(flow);
+		return NF_ACCEPT;
+	}
+
+	iph = ip_hdr(skb);
+	thoff = iph->ihl * 4;
+	protocol = iph->protocol;
+	if (nf_flow_state_check(flow, protocol, skb, thoff))
+		return NF_ACCEPT;
+
+	if (!skb_make_writable(skb, thoff + (protocol == IPPROTO_TCP ?
+					     sizeof(struct tcphdr) :
+					     sizeof(struct udphdr))))
+		return NF_DROP;
+
+	nf_flow_nat_ip(flow, skb, thoff, dir);
+	flow_offload_refresh(flow);
+
+	iph = ip_hdr(skb);
+	ip_decrease_ttl(iph);
+
+	skb->dev = outdev;
+	nexthop = rt_nexthop(rt, flow->tuplehash[!dir].tuple.src_v4);
+	skb_dst_set_noref(skb, &rt->dst);
+	neigh_xmit(NEIGH_ARP_TABLE, outdev, &nexthop, skb);
+
+	return NF_STOLEN;
+}
+
+static struct nf_hook_ops nf_flow_offload_ip_ops __read_mostly = {
+	.hook		= nf_flow_offload_ip_hook,
+	.owner		= THIS_MODULE,
+	.pf		= NFPROTO_IPV4,
+	.hooknum	= NF_INET_PRE_ROUTING,
+	/* ahead of defrag and conntrack, fragments are left alone */
+	.priority	= NF_IP_PRI_CONNTRACK_DEFRAG - 1,
+};
+
+static int __init nf_flow_ipv4_module_init(void)
+{
+	return nf_register_hook(&nf_flow_offload_ip_ops);
+}
+
+static void __exit nf_flow_ipv4_module_exit(void)
+{
+	nf_unregister_hook(&nf_flow_offload_ip_ops);
+}
+
+module_init(nf_flow_ipv4_module_init);
+module_exit(nf_flow_ipv4_module_exit);
+
+MODULE_LICENSE("GPL");
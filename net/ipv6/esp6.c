@@ -62,7 +62,8 @@ static u32 esp6_get_mtu(struct xfrm_state *x, int mtu);
  *
  * TODO: Use spare space in skb for this where possible.
  */
-static void *esp_alloc_tmp(struct crypto_aead *aead, int nfrags, int seqihlen)
+static void *esp_alloc_tmp(struct crypto_aead *aead, int nfrags, int seqihlen,
+			   int joblen)
 {
 	unsigned int len;
 
@@ -81,6 +82,11 @@ static void *esp_alloc_tmp(struct crypto_aead *aead, int nfrags, int seqihlen)
 
 	len += sizeof(struct scatterlist) * nfrags;
 
+	if (joblen) {
+		len = ALIGN(len, __alignof__(struct xfrm_crypto_job));
+		len += joblen;
+	}
+
 	return kmalloc(len, GFP_ATOMIC);
 }
 
@@ -133,6 +139,30 @@ static inline struct scatterlist *esp_givreq_sg(
 			     __alignof__(struct scatterlist));
 }
 
+/* The job for parallel crypto goes after the SG list */
+static inline struct xfrm_crypto_job *esp_tmp_job(struct scatterlist *sg,
+						  int nsg)
+{
+	return PTR_ALIGN((void *)(sg + nsg),
+			 __alignof__(struct xfrm_crypto_job));
+}
+
+static int esp_givencrypt(struct crypto_async_request *base)
+{
+	struct aead_request *areq = container_of(base, struct aead_request,
+						 base);
+
+	return crypto_aead_givencrypt(container_of(areq,
+						   struct aead_givcrypt_request,
+						   areq));
+}
+
+static int esp_decrypt(struct crypto_async_request *base)
+{
+	return crypto_aead_decrypt(container_of(base, struct aead_request,
+						base));
+}
+
 static void esp_output_done(struct crypto_async_request *base, int err)
 {
 	struct sk_buff *skb = base->data;
@@ -160,6 +190,7 @@ static int esp6_output(struct xfrm_state *x, struct sk_buff *skb)
 	int assoclen;
 	int sglists;
 	int seqhilen;
+	int joblen;
 	u8 *iv;
 	u8 *tail;
 	__be32 *seqhi;
@@ -196,7 +227,11 @@ static int esp6_output(struct xfrm_state *x, struct sk_buff *skb)
 		assoclen += seqhilen;
 	}
 
-	tmp = esp_alloc_tmp(aead, nfrags + sglists, seqhilen);
+	joblen = 0;
+	if (xfrm_crypto_can_parallel(x))
+		joblen = sizeof(struct xfrm_crypto_job);
+
+	tmp = esp_alloc_tmp(aead, nfrags + sglists, seqhilen, joblen);
 	if (!tmp) {
 		err = -ENOMEM;
 		goto error;
@@ -252,7 +287,11 @@ static int esp6_output(struct xfrm_state *x, struct sk_buff *skb)
 			      ((u64)XFRM_SKB_CB(skb)->seq.output.hi << 32));
 
 	ESP_SKB_CB(skb)->tmp = tmp;
-	err = crypto_aead_givencrypt(req);
+	if (joblen)
+		err = xfrm_crypto_parallel(esp_tmp_job(asg, nfrags + sglists),
+					   &req->areq.base, esp_givencrypt);
+	else
+		err = crypto_aead_givencrypt(req);
 	if (err == -EINPROGRESS)
 		goto error;
 
@@ -329,6 +368,7 @@ static int esp6_input(struct xfrm_state *x, struct sk_buff *skb)
 	int assoclen;
 	int sglists;
 	int seqhilen;
+	int joblen;
 	int ret = 0;
 	void *tmp;
 	__be32 *seqhi;
@@ -364,7 +404,11 @@ static int esp6_input(struct xfrm_state *x, struct sk_buff *skb)
 		assoclen += seqhilen;
 	}
 
-	tmp = esp_alloc_tmp(aead, nfrags + sglists, seqhilen);
+	joblen = 0;
+	if (xfrm_crypto_can_parallel(x))
+		joblen = sizeof(struct xfrm_crypto_job);
+
+	tmp = esp_alloc_tmp(aead, nfrags + sglists, seqhilen, joblen);
 	if (!tmp)
 		goto out;
 
@@ -398,7 +442,11 @@ static int esp6_input(struct xfrm_state *x, struct sk_buff *skb)
 	aead_request_set_crypt(req, sg, sg, elen, iv);
 	aead_request_set_assoc(req, asg, assoclen);
 
-	ret = crypto_aead_decrypt(req);
+	if (joblen)
+		ret = xfrm_crypto_parallel(esp_tmp_job(asg, nfrags + sglists),
+					  &req->base, esp_decrypt);
+	else
+		ret = crypto_aead_decrypt(req);
 	if (ret == -EINPROGRESS)
 		goto out;
 
@@ -12,7 +12,6 @@
 #define __ip6_offload_h
 
 int ipv6_exthdrs_offload_init(void);
-int udp_offload_init(void);
 int tcpv6_offload_init(void);
 
 #endif
@@ -37,6 +37,8 @@
 #include <linux/seq_file.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
 
 #include <net/net_namespace.h>
 #include <net/ip_vs.h>
@@ -46,21 +48,60 @@
 #define CONFIG_IP_VS_TAB_BITS	12
 #endif
 
+#define IP_VS_CONN_TAB_MIN_BITS	8
+#define IP_VS_CONN_TAB_MAX_BITS	20
+
+/* buckets moved by a resize before the bucket locks are dropped again */
+#define IP_VS_CONN_TAB_MOVE_BATCH	256
+
+static int ip_vs_conn_tab_set_bits(const char *val,
+				   const struct kernel_param *kp);
+
+static const struct kernel_param_ops ip_vs_conn_tab_bits_ops = {
+	.set	= ip_vs_conn_tab_set_bits,
+	.get	= param_get_int,
+};
+
 /*
- * Connection hash size. Default is what was selected at compile time.
+ * Connection hash size. Default is what was selected at compile time,
+ * writing it resizes the table in place.
 */
 static int ip_vs_conn_tab_bits = CONFIG_IP_VS_TAB_BITS;
-module_param_named(conn_tab_bits, ip_vs_conn_tab_bits, int, 0444);
+module_param_cb(conn_tab_bits, &ip_vs_conn_tab_bits_ops,
+		&ip_vs_conn_tab_bits, 0644);
 MODULE_PARM_DESC(conn_tab_bits, "Set connections' hash size");
 
-/* size and mask values */
+/* size value */
 int ip_vs_conn_tab_size __read_mostly;
-static int ip_vs_conn_tab_mask __read_mostly;
 
 /*
- *  Connection hash table: for input and output packets lookups of IPVS
+ *  Connection hash table: for input and output packets lookups of IPVS.
+ *
+ *  The table is replaced by a bigger or smaller one as it fills up or on
+ *  request.  Writers find the current table under any of the bucket
+ *  locks.  The resizer publishes the new table right away, then moves
+ *  the entries over from ip_vs_conn_tab_old a batch of buckets at a time,
+ *  holding all bucket locks only for the batch.  Until it is done,
+ *  readers look in both tables.  They only need RCU, but a lookup that
+ *  misses while entries are being moved has to be retried,
+ *  ip_vs_conn_tab_seq tells them.
  */
-static struct hlist_head *ip_vs_conn_tab __read_mostly;
+struct ip_vs_conn_htable {
+	unsigned int		size;
+	unsigned int		mask;
+	struct hlist_head	buckets[0];
+};
+
+static struct ip_vs_conn_htable __rcu *ip_vs_conn_tab __read_mostly;
+static struct ip_vs_conn_htable __rcu *ip_vs_conn_tab_old __read_mostly;
+static seqcount_t ip_vs_conn_tab_seq;
+
+/* hashed entries, the table grows once there are two per bucket */
+static atomic_t ip_vs_conn_tab_count = ATOMIC_INIT(0);
+
+static DEFINE_MUTEX(ip_vs_conn_resize_mutex);
+static void ip_vs_conn_resize_work_handler(struct work_struct *work);
+static DECLARE_WORK(ip_vs_conn_resize_work, ip_vs_conn_resize_work_handler);
 
 /*  SLAB cache for IPVS connections */
 static struct kmem_cache *ip_vs_conn_cachep __read_mostly;
@@ -72,7 +113,9 @@ static atomic_t ip_vs_conn_no_cport_cnt = ATOMIC_INIT(0);
 static unsigned int ip_vs_conn_rnd __read_mostly;
 
 /*
- *  Fine locking granularity for big connection hash table
+ *  Fine locking granularity for big connection hash table.  The lock of an
+ *  entry only depends on the low bits of its hash, which every table size
+ *  keeps, so it does not change when the table is resized.
  */
 #define CT_LOCKARRAY_BITS  5
 #define CT_LOCKARRAY_SIZE  (1<<CT_LOCKARRAY_BITS)
@@ -104,9 +147,74 @@ static inline void ct_write_unlock_bh(unsigned int key)
 	spin_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
+/* Any of the bucket locks keeps the table from being replaced */
+static inline struct ip_vs_conn_htable *ip_vs_conn_tab_locked(void)
+{
+	return rcu_dereference_protected(ip_vs_conn_tab, 1);
+}
+
+static void ct_write_lock_all_bh(void)
+{
+	int idx;
+
+	local_bh_disable();
+	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)
+		spin_lock_nest_lock(&__ip_vs_conntbl_lock_array[idx].l,
+				    &ip_vs_conn_resize_mutex);
+}
+
+static void ct_write_unlock_all_bh(void)
+{
+	int idx;
+
+	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)
+		spin_unlock(&__ip_vs_conntbl_lock_array[idx].l);
+	local_bh_enable();
+}
+
+static inline struct hlist_head *
+ip_vs_conn_bucket(struct ip_vs_conn_htable *t, unsigned int hash)
+{
+	return &t->buckets[hash & t->mask];
+}
 
 /*
- *	Returns hash value for IPVS connection entry
+ *  Readers walk the table a resize is emptying, if any, and then the
+ *  current one.  Under rcu_read_lock().
+ */
+static inline struct ip_vs_conn_htable *ip_vs_conn_tab_first(void)
+{
+	struct ip_vs_conn_htable *t = rcu_dereference(ip_vs_conn_tab_old);
+
+	return t ? : rcu_dereference(ip_vs_conn_tab);
+}
+
+static inline struct ip_vs_conn_htable *
+ip_vs_conn_tab_next(struct ip_vs_conn_htable *t)
+{
+	struct ip_vs_conn_htable *cur = rcu_dereference(ip_vs_conn_tab);
+
+	return t == cur ? NULL : cur;
+}
+
+/*
+ *  After dropping the RCU read lock, @t may have been emptied and freed
+ *  by a resize; the walk then goes on in the current table.
+ */
+static inline struct ip_vs_conn_htable *
+ip_vs_conn_tab_recheck(struct ip_vs_conn_htable *t)
+{
+	struct ip_vs_conn_htable *cur = rcu_dereference(ip_vs_conn_tab);
+
+	if (t == cur || t == rcu_dereference(ip_vs_conn_tab_old))
+		return t;
+	return cur;
+}
+
+
+/*
+ *	Returns hash value for IPVS connection entry, the bucket is
+ *	selected from its low bits.
  */
 static unsigned int ip_vs_conn_hashkey(struct net *net, int af, unsigned int proto,
 				       const union nf_inet_addr *addr,
@@ -116,11 +224,11 @@ static unsigned int ip_vs_conn_hashkey(struct net *net, int af, unsigned int pro
 	if (af == AF_INET6)
 		return (jhash_3words(jhash(addr, 16, ip_vs_conn_rnd),
 				    (__force u32)port, proto, ip_vs_conn_rnd) ^
-			((size_t)net>>8)) & ip_vs_conn_tab_mask;
+			((size_t)net>>8));
 #endif
 	return (jhash_3words((__force u32)addr->ip, (__force u32)port, proto,
 			    ip_vs_conn_rnd) ^
-		((size_t)net>>8)) & ip_vs_conn_tab_mask;
+		((size_t)net>>8));
 }
 
 static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
@@ -130,8 +238,7 @@ static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
 	__be16 port;
 
 	if (p->pe_data && p->pe->hashkey_raw)
-		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse) &
-			ip_vs_conn_tab_mask;
+		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse);
 
 	if (likely(!inverse)) {
 		addr = p->caddr;
@@ -179,9 +286,14 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	spin_lock(&cp->lock);
 
 	if (!(cp->flags & IP_VS_CONN_F_HASHED)) {
+		struct ip_vs_conn_htable *t = ip_vs_conn_tab_locked();
+
 		cp->flags |= IP_VS_CONN_F_HASHED;
 		atomic_inc(&cp->refcnt);
-		hlist_add_head_rcu(&cp->c_list, &ip_vs_conn_tab[hash]);
+		hlist_add_head_rcu(&cp->c_list, ip_vs_conn_bucket(t, hash));
+		if (atomic_inc_return(&ip_vs_conn_tab_count) > 2 * t->size &&
+		    t->size < (1 << IP_VS_CONN_TAB_MAX_BITS))
+			schedule_work(&ip_vs_conn_resize_work);
 		ret = 1;
 	} else {
 		pr_err("%s(): request for already hashed, called from %pF\n",
@@ -215,6 +327,7 @@ static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
 		hlist_del_rcu(&cp->c_list);
 		cp->flags &= ~IP_VS_CONN_F_HASHED;
 		atomic_dec(&cp->refcnt);
+		atomic_dec(&ip_vs_conn_tab_count);
 		ret = 1;
 	} else
 		ret = 0;
@@ -244,6 +357,7 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 		if (atomic_cmpxchg(&cp->refcnt, 1, 0) == 1) {
 			hlist_del_rcu(&cp->c_list);
 			cp->flags &= ~IP_VS_CONN_F_HASHED;
+			atomic_dec(&ip_vs_conn_tab_count);
 			ret = true;
 		}
 	} else
@@ -265,28 +379,37 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 static inline struct ip_vs_conn *
 __ip_vs_conn_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	struct ip_vs_conn_htable *t;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (p->cport == cp->cport && p->vport == cp->vport &&
-		    cp->af == p->af &&
-		    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
-		    ip_vs_addr_equal(p->af, p->vaddr, &cp->vaddr) &&
-		    ((!p->cport) ^ (!(cp->flags & IP_VS_CONN_F_NO_CPORT))) &&
-		    p->protocol == cp->protocol &&
-		    ip_vs_conn_net_eq(cp, p->net)) {
-			if (!__ip_vs_conn_get(cp))
-				continue;
-			/* HIT */
-			rcu_read_unlock();
-			return cp;
+retry:
+	seq = read_seqcount_begin(&ip_vs_conn_tab_seq);
+	for (t = ip_vs_conn_tab_first(); t; t = ip_vs_conn_tab_next(t)) {
+		hlist_for_each_entry_rcu(cp, ip_vs_conn_bucket(t, hash),
+					 c_list) {
+			if (p->cport == cp->cport && p->vport == cp->vport &&
+			    cp->af == p->af &&
+			    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
+			    ip_vs_addr_equal(p->af, p->vaddr, &cp->vaddr) &&
+			    ((!p->cport) ^
+			     (!(cp->flags & IP_VS_CONN_F_NO_CPORT))) &&
+			    p->protocol == cp->protocol &&
+			    ip_vs_conn_net_eq(cp, p->net)) {
+				if (!__ip_vs_conn_get(cp))
+					continue;
+				/* HIT */
+				rcu_read_unlock();
+				return cp;
+			}
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto retry;
 
 	rcu_read_unlock();
 
@@ -350,38 +473,48 @@ EXPORT_SYMBOL_GPL(ip_vs_conn_in_get_proto);
 /* Get reference to connection template */
 struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	struct ip_vs_conn_htable *t;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (unlikely(p->pe_data && p->pe->ct_match)) {
-			if (!ip_vs_conn_net_eq(cp, p->net))
+retry:
+	seq = read_seqcount_begin(&ip_vs_conn_tab_seq);
+	for (t = ip_vs_conn_tab_first(); t; t = ip_vs_conn_tab_next(t)) {
+		hlist_for_each_entry_rcu(cp, ip_vs_conn_bucket(t, hash),
+					 c_list) {
+			if (unlikely(p->pe_data && p->pe->ct_match)) {
+				if (!ip_vs_conn_net_eq(cp, p->net))
+					continue;
+				if (p->pe == cp->pe &&
+				    p->pe->ct_match(p, cp)) {
+					if (__ip_vs_conn_get(cp))
+						goto out;
+				}
 				continue;
-			if (p->pe == cp->pe && p->pe->ct_match(p, cp)) {
+			}
+
+			if (cp->af == p->af &&
+			    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
+			    /* protocol should only be IPPROTO_IP if
+			     * p->vaddr is a fwmark */
+			    ip_vs_addr_equal(p->protocol == IPPROTO_IP ?
+					     AF_UNSPEC : p->af,
+					     p->vaddr, &cp->vaddr) &&
+			    p->vport == cp->vport && p->cport == cp->cport &&
+			    cp->flags & IP_VS_CONN_F_TEMPLATE &&
+			    p->protocol == cp->protocol &&
+			    ip_vs_conn_net_eq(cp, p->net)) {
 				if (__ip_vs_conn_get(cp))
 					goto out;
 			}
-			continue;
-		}
-
-		if (cp->af == p->af &&
-		    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
-		    /* protocol should only be IPPROTO_IP if
-		     * p->vaddr is a fwmark */
-		    ip_vs_addr_equal(p->protocol == IPPROTO_IP ? AF_UNSPEC :
-				     p->af, p->vaddr, &cp->vaddr) &&
-		    p->vport == cp->vport && p->cport == cp->cport &&
-		    cp->flags & IP_VS_CONN_F_TEMPLATE &&
-		    p->protocol == cp->protocol &&
-		    ip_vs_conn_net_eq(cp, p->net)) {
-			if (__ip_vs_conn_get(cp))
-				goto out;
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto retry;
 	cp = NULL;
 
   out:
@@ -402,7 +535,8 @@ struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
  *	p->vaddr, p->vport: pkt dest address (foreign host) */
 struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	struct ip_vs_conn_htable *t;
+	unsigned int hash, seq;
 	struct ip_vs_conn *cp, *ret=NULL;
 
 	/*
@@ -412,21 +546,29 @@ struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (p->vport == cp->cport && p->cport == cp->dport &&
-		    cp->af == p->af &&
-		    ip_vs_addr_equal(p->af, p->vaddr, &cp->caddr) &&
-		    ip_vs_addr_equal(p->af, p->caddr, &cp->daddr) &&
-		    p->protocol == cp->protocol &&
-		    ip_vs_conn_net_eq(cp, p->net)) {
-			if (!__ip_vs_conn_get(cp))
-				continue;
-			/* HIT */
-			ret = cp;
-			break;
+retry:
+	seq = read_seqcount_begin(&ip_vs_conn_tab_seq);
+	for (t = ip_vs_conn_tab_first(); t; t = ip_vs_conn_tab_next(t)) {
+		hlist_for_each_entry_rcu(cp, ip_vs_conn_bucket(t, hash),
+					 c_list) {
+			if (p->vport == cp->cport && p->cport == cp->dport &&
+			    cp->af == p->af &&
+			    ip_vs_addr_equal(p->af, p->vaddr, &cp->caddr) &&
+			    ip_vs_addr_equal(p->af, p->caddr, &cp->daddr) &&
+			    p->protocol == cp->protocol &&
+			    ip_vs_conn_net_eq(cp, p->net)) {
+				if (!__ip_vs_conn_get(cp))
+					continue;
+				/* HIT */
+				ret = cp;
+				goto out;
+			}
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		goto retry;
 
+out:
 	rcu_read_unlock();
 
 	IP_VS_DBG_BUF(9, "lookup/out %s %s:%d->%s:%d %s\n",
@@ -978,6 +1120,7 @@ ip_vs_conn_new(const struct ip_vs_conn_param *p, int dest_af,
 #ifdef CONFIG_PROC_FS
 struct ip_vs_iter_state {
 	struct seq_net_private	p;
+	struct ip_vs_conn_htable *t;
 	struct hlist_head	*l;
 };
 
@@ -986,18 +1129,25 @@ static void *ip_vs_conn_array(struct seq_file *seq, loff_t pos)
 	int idx;
 	struct ip_vs_conn *cp;
 	struct ip_vs_iter_state *iter = seq->private;
-
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
-			/* __ip_vs_conn_get() is not needed by
-			 * ip_vs_conn_seq_show and ip_vs_conn_sync_seq_show
-			 */
-			if (pos-- == 0) {
-				iter->l = &ip_vs_conn_tab[idx];
-				return cp;
+	struct ip_vs_conn_htable *t;
+
+	for (t = ip_vs_conn_tab_first(); t; t = ip_vs_conn_tab_next(t)) {
+		for (idx = 0; idx < t->size; idx++) {
+			hlist_for_each_entry_rcu(cp, &t->buckets[idx],
+						 c_list) {
+				/* __ip_vs_conn_get() is not needed by
+				 * ip_vs_conn_seq_show and
+				 * ip_vs_conn_sync_seq_show
+				 */
+				if (pos-- == 0) {
+					iter->t = t;
+					iter->l = &t->buckets[idx];
+					return cp;
+				}
 			}
+			cond_resched_rcu();
+			t = ip_vs_conn_tab_recheck(t);
 		}
-		cond_resched_rcu();
 	}
 
 	return NULL;
@@ -1008,6 +1158,7 @@ static void *ip_vs_conn_seq_start(struct seq_file *seq, loff_t *pos)
 {
 	struct ip_vs_iter_state *iter = seq->private;
 
+	iter->t = NULL;
 	iter->l = NULL;
 	rcu_read_lock();
 	return *pos ? ip_vs_conn_array(seq, *pos - 1) :SEQ_START_TOKEN;
@@ -1017,6 +1168,7 @@ static void *ip_vs_conn_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
 	struct ip_vs_conn *cp = v;
 	struct ip_vs_iter_state *iter = seq->private;
+	struct ip_vs_conn_htable *t = iter->t;
 	struct hlist_node *e;
 	struct hlist_head *l = iter->l;
 	int idx;
@@ -1030,14 +1182,20 @@ static void *ip_vs_conn_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 	if (e)
 		return hlist_entry(e, struct ip_vs_conn, c_list);
 
-	idx = l - ip_vs_conn_tab;
-	while (++idx < ip_vs_conn_tab_size) {
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
-			iter->l = &ip_vs_conn_tab[idx];
-			return cp;
+	idx = l - t->buckets;
+	do {
+		while (++idx < t->size) {
+			hlist_for_each_entry_rcu(cp, &t->buckets[idx],
+						 c_list) {
+				iter->t = t;
+				iter->l = &t->buckets[idx];
+				return cp;
+			}
+			cond_resched_rcu();
+			t = ip_vs_conn_tab_recheck(t);
 		}
-		cond_resched_rcu();
-	}
+		idx = -1;
+	} while ((t = ip_vs_conn_tab_next(t)));
 	iter->l = NULL;
 	return NULL;
 }
@@ -1244,15 +1402,18 @@ void ip_vs_random_dropentry(struct net *net)
 {
 	int idx;
 	struct ip_vs_conn *cp, *cp_c;
+	struct ip_vs_conn_htable *t;
 
 	rcu_read_lock();
+	t = rcu_dereference(ip_vs_conn_tab);
 	/*
 	 * Randomly scan 1/32 of the whole table every second
 	 */
-	for (idx = 0; idx < (ip_vs_conn_tab_size>>5); idx++) {
-		unsigned int hash = prandom_u32() & ip_vs_conn_tab_mask;
+	for (idx = 0; idx < (t->size>>5); idx++) {
+		unsigned int hash = prandom_u32();
 
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+		hlist_for_each_entry_rcu(cp, ip_vs_conn_bucket(t, hash),
+					 c_list) {
 			if (cp->flags & IP_VS_CONN_F_TEMPLATE)
 				/* connection template */
 				continue;
@@ -1300,6 +1461,7 @@ void ip_vs_random_dropentry(struct net *net)
 			}
 		}
 		cond_resched_rcu();
+		t = rcu_dereference(ip_vs_conn_tab);
 	}
 	rcu_read_unlock();
 }
@@ -1313,25 +1475,31 @@ static void ip_vs_conn_flush(struct net *net)
 	int idx;
 	struct ip_vs_conn *cp, *cp_c;
 	struct netns_ipvs *ipvs = net_ipvs(net);
+	struct ip_vs_conn_htable *t;
 
 flush_again:
 	rcu_read_lock();
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
-
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
-			if (!ip_vs_conn_net_eq(cp, net))
-				continue;
-			IP_VS_DBG(4, "del connection\n");
-			ip_vs_conn_expire_now(cp);
-			cp_c = cp->control;
-			/* cp->control is valid only with reference to cp */
-			if (cp_c && __ip_vs_conn_get(cp)) {
-				IP_VS_DBG(4, "del conn template\n");
-				ip_vs_conn_expire_now(cp_c);
-				__ip_vs_conn_put(cp);
+	for (t = ip_vs_conn_tab_first(); t; t = ip_vs_conn_tab_next(t)) {
+		for (idx = 0; idx < t->size; idx++) {
+			hlist_for_each_entry_rcu(cp, &t->buckets[idx],
+						 c_list) {
+				if (!ip_vs_conn_net_eq(cp, net))
+					continue;
+				IP_VS_DBG(4, "del connection\n");
+				ip_vs_conn_expire_now(cp);
+				cp_c = cp->control;
+				/* cp->control is valid only with reference
+				 * to cp
+				 */
+				if (cp_c && __ip_vs_conn_get(cp)) {
+					IP_VS_DBG(4, "del conn template\n");
+					ip_vs_conn_expire_now(cp_c);
+					__ip_vs_conn_put(cp);
+				}
 			}
+			cond_resched_rcu();
+			t = ip_vs_conn_tab_recheck(t);
 		}
-		cond_resched_rcu();
 	}
 	rcu_read_unlock();
 
@@ -1342,6 +1510,122 @@ flush_again:
 		goto flush_again;
 	}
 }
+static struct ip_vs_conn_htable *ip_vs_conn_tab_alloc(int bits)
+{
+	struct ip_vs_conn_htable *t;
+	unsigned int idx, size = 1 << bits;
+
+	t = vmalloc(sizeof(*t) + size * sizeof(struct hlist_head));
+	if (!t)
+		return NULL;
+
+	t->size = size;
+	t->mask = size - 1;
+	for (idx = 0; idx < size; idx++)
+		INIT_HLIST_HEAD(&t->buckets[idx]);
+
+	return t;
+}
+
+/*
+ *	Move all entries to a table of 2^bits buckets.  New entries go to the
+ *	new table at once, the old ones are moved IP_VS_CONN_TAB_MOVE_BATCH
+ *	buckets at a time.  Lookups racing with a batch retry once it is
+ *	done, entries being added or removed wait on their bucket lock.
+ */
+static int ip_vs_conn_tab_resize(int bits)
+{
+	struct ip_vs_conn_htable *old, *t;
+	struct hlist_node *n;
+	struct ip_vs_conn *cp;
+	unsigned int idx, end;
+
+	mutex_lock(&ip_vs_conn_resize_mutex);
+	old = rcu_dereference_protected(ip_vs_conn_tab,
+				lockdep_is_held(&ip_vs_conn_resize_mutex));
+	if (old->size == 1 << bits) {
+		mutex_unlock(&ip_vs_conn_resize_mutex);
+		return 0;
+	}
+
+	t = ip_vs_conn_tab_alloc(bits);
+	if (!t) {
+		mutex_unlock(&ip_vs_conn_resize_mutex);
+		return -ENOMEM;
+	}
+
+	ct_write_lock_all_bh();
+	rcu_assign_pointer(ip_vs_conn_tab_old, old);
+	rcu_assign_pointer(ip_vs_conn_tab, t);
+	ip_vs_conn_tab_size = t->size;
+	ip_vs_conn_tab_bits = bits;
+	ct_write_unlock_all_bh();
+
+	for (idx = 0; idx < old->size; idx = end) {
+		end = min_t(unsigned int, idx + IP_VS_CONN_TAB_MOVE_BATCH,
+			    old->size);
+
+		ct_write_lock_all_bh();
+		write_seqcount_begin(&ip_vs_conn_tab_seq);
+		for (; idx < end; idx++) {
+			hlist_for_each_entry_safe(cp, n, &old->buckets[idx],
+						  c_list) {
+				hlist_del_rcu(&cp->c_list);
+				hlist_add_head_rcu(&cp->c_list,
+					ip_vs_conn_bucket(t,
+						ip_vs_conn_hashkey_conn(cp)));
+			}
+		}
+		write_seqcount_end(&ip_vs_conn_tab_seq);
+		ct_write_unlock_all_bh();
+
+		cond_resched();
+	}
+
+	RCU_INIT_POINTER(ip_vs_conn_tab_old, NULL);
+	mutex_unlock(&ip_vs_conn_resize_mutex);
+
+	pr_info("Connection hash table resized (size=%d, memory=%ldKbytes)\n",
+		t->size, (long)(t->size * sizeof(struct hlist_head)) / 1024);
+
+	synchronize_rcu();
+	vfree(old);
+	return 0;
+}
+
+static void ip_vs_conn_resize_work_handler(struct work_struct *work)
+{
+	int count = atomic_read(&ip_vs_conn_tab_count);
+	int bits = ip_vs_conn_tab_bits;
+
+	/* grow to one entry per bucket */
+	while (bits < IP_VS_CONN_TAB_MAX_BITS && (1 << bits) < count)
+		bits++;
+
+	if (bits > ip_vs_conn_tab_bits)
+		ip_vs_conn_tab_resize(bits);
+}
+
+static int ip_vs_conn_tab_set_bits(const char *val,
+				   const struct kernel_param *kp)
+{
+	int bits, err;
+
+	err = kstrtoint(val, 0, &bits);
+	if (err)
+		return err;
+	if (bits < IP_VS_CONN_TAB_MIN_BITS || bits > IP_VS_CONN_TAB_MAX_BITS)
+		return -EINVAL;
+
+	/* before module init this only sets the initial size */
+	if (!rcu_access_pointer(ip_vs_conn_tab)) {
+		ip_vs_conn_tab_bits = bits;
+		return 0;
+	}
+
+	return ip_vs_conn_tab_resize(bits);
+}
+
 /*
  * per netns init and exit
  */
@@ -1366,25 +1650,23 @@ void __net_exit ip_vs_conn_net_cleanup(struct net *net)
 
 int __init ip_vs_conn_init(void)
 {
+	struct ip_vs_conn_htable *t;
 	int idx;
 
-	/* Compute size and mask */
-	ip_vs_conn_tab_size = 1 << ip_vs_conn_tab_bits;
-	ip_vs_conn_tab_mask = ip_vs_conn_tab_size - 1;
-
 	/*
 	 * Allocate the connection hash table and initialize its list heads
 	 */
-	ip_vs_conn_tab = vmalloc(ip_vs_conn_tab_size * sizeof(*ip_vs_conn_tab));
-	if (!ip_vs_conn_tab)
+	t = ip_vs_conn_tab_alloc(ip_vs_conn_tab_bits);
+	if (!t)
 		return -ENOMEM;
+	ip_vs_conn_tab_size = t->size;
 
 	/* Allocate ip_vs_conn slab cache */
 	ip_vs_conn_cachep = kmem_cache_create("ip_vs_conn",
 					      sizeof(struct ip_vs_conn), 0,
 					      SLAB_HWCACHE_ALIGN, NULL);
 	if (!ip_vs_conn_cachep) {
-		vfree(ip_vs_conn_tab);
+		vfree(t);
 		return -ENOMEM;
 	}
 
@@ -1395,24 +1677,29 @@ int __init ip_vs_conn_init(void)
 	IP_VS_DBG(0, "Each connection entry needs %Zd bytes at least\n",
 		  sizeof(struct ip_vs_conn));
 
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++)
-		INIT_HLIST_HEAD(&ip_vs_conn_tab[idx]);
-
 	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)  {
 		spin_lock_init(&__ip_vs_conntbl_lock_array[idx].l);
 	}
+	seqcount_init(&ip_vs_conn_tab_seq);
 
 	/* calculate the random value for connection hash */
 	get_random_bytes(&ip_vs_conn_rnd, sizeof(ip_vs_conn_rnd));
 
+	rcu_assign_pointer(ip_vs_conn_tab, t);
+
 	return 0;
 }
 
 void ip_vs_conn_cleanup(void)
 {
+	struct ip_vs_conn_htable *t;
+
+	cancel_work_sync(&ip_vs_conn_resize_work);
 	/* Wait all ip_vs_conn_rcu_free() callbacks to complete */
 	rcu_barrier();
 	/* Release the empty cache */
 	kmem_cache_destroy(ip_vs_conn_cachep);
-	vfree(ip_vs_conn_tab);
+	t = rcu_dereference_protected(ip_vs_conn_tab, 1);
+	RCU_INIT_POINTER(ip_vs_conn_tab, NULL);
+	vfree(t);
 }
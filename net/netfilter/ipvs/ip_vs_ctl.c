@@ -735,6 +735,9 @@ ip_vs_copy_stats(struct ip_vs_kstats *dst, struct ip_vs_stats *src)
 
 	spin_lock_bh(&src->lock);
 
+	/* the estimator only sums the counters up every 2 seconds */
+	ip_vs_read_cpu_stats(&src->kstats, src->cpustats);
+
 	IP_VS_SHOW_STATS_COUNTER(conns);
 	IP_VS_SHOW_STATS_COUNTER(inpkts);
 	IP_VS_SHOW_STATS_COUNTER(outpkts);
@@ -767,6 +770,7 @@ ip_vs_zero_stats(struct ip_vs_stats *stats)
 	spin_lock_bh(&stats->lock);
 
 	/* get current counters as zero point, rates are zeroed */
+	ip_vs_read_cpu_stats(&stats->kstats, stats->cpustats);
 
 #define IP_VS_ZERO_STATS_COUNTER(c) stats->kstats0.c = stats->kstats.c
 
@@ -55,10 +55,12 @@
 
 
 /*
- * Make a summary from each cpu
+ * Make a summary from each cpu.  The counters are only summed up when
+ * somebody looks: here for the rates and in ip_vs_ctl.c when the stats
+ * are shown or zeroed.
  */
-static void ip_vs_read_cpu_stats(struct ip_vs_kstats *sum,
-				 struct ip_vs_cpu_stats __percpu *stats)
+void ip_vs_read_cpu_stats(struct ip_vs_kstats *sum,
+			  struct ip_vs_cpu_stats __percpu *stats)
 {
 	int i;
 	bool add = false;
@@ -140,6 +140,24 @@ static u32 hash_conntrack_raw(const struct nf_conntrack_tuple *tuple, u16 zone)
 		      tuple->dst.protonum));
 }
 
+/* must be called with rcu read lock held; the returned sequence lets a
+ * lookup that came up empty tell whether it raced with a resize.
+ */
+static unsigned int nf_conntrack_get_ht(struct net *net,
+					struct hlist_nulls_head **hash,
+					unsigned int *hsize)
+{
+	unsigned int sequence;
+
+	do {
+		sequence = read_seqcount_begin(&net->ct.generation);
+		*hsize = net->ct.htable_size;
+		*hash = net->ct.hash;
+	} while (read_seqcount_retry(&net->ct.generation, sequence));
+
+	return sequence;
+}
+
 static u32 __hash_bucket(u32 hash, unsigned int size)
 {
 	return reciprocal_scale(hash, size);
@@ -296,7 +314,6 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	pr_debug("destroy_conntrack(%p)\n", ct);
 	NF_CT_ASSERT(atomic_read(&nfct->use) == 0);
-	NF_CT_ASSERT(!timer_pending(&ct->timeout));
 
 	rcu_read_lock();
 	l4proto = __nf_ct_l4proto_find(nf_ct_l3num(ct), nf_ct_protonum(ct));
@@ -356,35 +373,33 @@ bool nf_ct_delete(struct nf_conn *ct, u32 portid, int report)
 {
 	struct nf_conn_tstamp *tstamp;
 
+	/* Whoever sets the DYING bit owns the hash table reference, this
+	 * used to be decided by del_timer() on the per-conntrack timer.
+	 */
+	if (test_and_set_bit(IPS_DYING_BIT, &ct->status))
+		return false;
+
 	tstamp = nf_conn_tstamp_find(ct);
 	if (tstamp && tstamp->stop == 0)
 		tstamp->stop = ktime_get_real_ns();
 
-	if (nf_ct_is_dying(ct))
-		goto delete;
-
 	if (nf_conntrack_event_report(IPCT_DESTROY, ct,
 				    portid, report) < 0) {
-		/* destroy event was not delivered */
+		/* destroy event was not delivered, the event cache worker
+		 * drops the reference once it is.
+		 */
 		nf_ct_delete_from_lists(ct);
 		nf_conntrack_ecache_delayed_work(nf_ct_net(ct));
 		return false;
 	}
 
 	nf_conntrack_ecache_work(nf_ct_net(ct));
-	set_bit(IPS_DYING_BIT, &ct->status);
- delete:
 	nf_ct_delete_from_lists(ct);
 	nf_ct_put(ct);
 	return true;
 }
 EXPORT_SYMBOL_GPL(nf_ct_delete);
 
-static void death_by_timeout(unsigned long ul_conntrack)
-{
-	nf_ct_delete((struct nf_conn *)ul_conntrack, 0, 0);
-}
-
 static inline bool
 nf_ct_key_equal(struct nf_conntrack_tuple_hash *h,
 			const struct nf_conntrack_tuple *tuple,
@@ -400,6 +415,18 @@ nf_ct_key_equal(struct nf_conntrack_tuple_hash *h,
 		nf_ct_is_confirmed(ct);
 }
 
+/* caller must hold rcu readlock and none of the nf_conntrack_locks */
+static void nf_ct_gc_expired(struct nf_conn *ct)
+{
+	if (!atomic_inc_not_zero(&ct->ct_general.use))
+		return;
+
+	if (nf_ct_should_gc(ct))
+		nf_ct_kill(ct);
+
+	nf_ct_put(ct);
+}
+
 /*
  * Warning :
  * - Caller must take a reference on returned object
@@ -410,15 +437,26 @@ ____nf_conntrack_find(struct net *net, u16 zone,
 		      const struct nf_conntrack_tuple *tuple, u32 hash)
 {
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *ct_hash;
 	struct hlist_nulls_node *n;
-	unsigned int bucket = hash_bucket(hash, net);
+	unsigned int bucket, hsize, sequence;
 
 	/* Disable BHs the entire time since we normally need to disable them
 	 * at least once for the stats anyway.
 	 */
 	local_bh_disable();
 begin:
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[bucket], hnnode) {
+	sequence = nf_conntrack_get_ht(net, &ct_hash, &hsize);
+	bucket = __hash_bucket(hash, hsize);
+
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[bucket], hnnode) {
+		struct nf_conn *ct = nf_ct_tuplehash_to_ctrack(h);
+
+		if (nf_ct_is_expired(ct)) {
+			nf_ct_gc_expired(ct);
+			continue;
+		}
+
 		if (nf_ct_key_equal(h, tuple, zone)) {
 			NF_CT_STAT_INC(net, found);
 			local_bh_enable();
@@ -435,6 +473,13 @@ begin:
 		NF_CT_STAT_INC(net, search_restart);
 		goto begin;
 	}
+	/* The table was resized under us, the entry may have been moved
+	 * to the new one before we got to its bucket.
+	 */
+	if (read_seqcount_retry(&net->ct.generation, sequence)) {
+		NF_CT_STAT_INC(net, search_restart);
+		goto begin;
+	}
 	local_bh_enable();
 
 	return NULL;
@@ -522,7 +567,6 @@ nf_conntrack_hash_check_insert(struct nf_conn *ct)
 		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
 			goto out;
 
-	add_timer(&ct->timeout);
 	smp_wmb();
 	/* The caller holds a reference to this object */
 	atomic_set(&ct->ct_general.use, 2);
@@ -635,11 +679,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
 			goto out;
 
-	/* Timer relative to confirmation time, not original
+	/* Timeout is relative to confirmation time, not original
 	   setting time, otherwise we'd get timer wrap in
 	   weird delay cases. */
-	ct->timeout.expires += jiffies;
-	add_timer(&ct->timeout);
+	ct->timeout += nfct_time_stamp;
 	atomic_inc(&ct->ct_general.use);
 	ct->status |= IPS_CONFIRMED;
 
@@ -652,7 +695,7 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		tstamp->start = ktime_to_ns(skb->tstamp);
 	}
 	/* Since the lookup is lockless, hash insertion must be done after
-	 * starting the timer and setting the CONFIRMED bit. The RCU barriers
+	 * setting the timeout and the CONFIRMED bit. The RCU barriers
 	 * guarantee that no other CPU can find the conntrack before the above
 	 * stores are visible.
 	 */
@@ -686,17 +729,27 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 {
 	struct net *net = nf_ct_net(ignored_conntrack);
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *ct_hash;
 	struct hlist_nulls_node *n;
 	struct nf_conn *ct;
 	u16 zone = nf_ct_zone(ignored_conntrack);
-	unsigned int hash = hash_conntrack(net, zone, tuple);
+	unsigned int hash, hsize;
 
 	/* Disable BHs the entire time since we need to disable them at
 	 * least once for the stats anyway.
 	 */
 	rcu_read_lock_bh();
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash], hnnode) {
+	nf_conntrack_get_ht(net, &ct_hash, &hsize);
+	hash = __hash_conntrack(tuple, zone, hsize);
+
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[hash], hnnode) {
 		ct = nf_ct_tuplehash_to_ctrack(h);
+
+		if (nf_ct_is_expired(ct)) {
+			nf_ct_gc_expired(ct);
+			continue;
+		}
+
 		if (ct != ignored_conntrack &&
 		    nf_ct_tuple_equal(tuple, &h->tuple) &&
 		    nf_ct_zone(ct) == zone) {
@@ -741,7 +794,8 @@ restart:
 		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
 					 hnnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
-			if (!test_bit(IPS_ASSURED_BIT, &tmp->status) &&
+			if ((!test_bit(IPS_ASSURED_BIT, &tmp->status) ||
+			     nf_ct_is_expired(tmp)) &&
 			    !nf_ct_is_dying(tmp) &&
 			    atomic_inc_not_zero(&tmp->ct_general.use)) {
 				ct = tmp;
@@ -762,16 +816,113 @@ restart:
 	if (!ct)
 		return dropped;
 
-	if (del_timer(&ct->timeout)) {
-		if (nf_ct_delete(ct, 0, 0)) {
-			dropped = 1;
-			NF_CT_STAT_INC_ATOMIC(net, early_drop);
-		}
+	if (nf_ct_delete(ct, 0, 0)) {
+		dropped = 1;
+		NF_CT_STAT_INC_ATOMIC(net, early_drop);
 	}
 	nf_ct_put(ct);
 	return dropped;
 }
 
+/* Expired entries are reaped by lookups that walk over them and by this
+ * worker, which scans a slice of the table of every namespace per run so
+ * that the whole of a table of up to GC_MAX_BUCKETS_DIV * GC_MAX_BUCKETS
+ * buckets is covered about once per GC_INTERVAL.  It comes back sooner
+ * while it keeps finding expired entries.  A single worker serves all
+ * namespaces, so that thousands of them do not mean thousands of timers.
+ */
+#define GC_MAX_BUCKETS_DIV	64u
+#define GC_MAX_BUCKETS		8192u
+#define GC_INTERVAL		(5 * HZ)
+#define GC_MAX_EVICTS		256u
+
+static struct delayed_work conntrack_gc_dwork;
+static bool conntrack_gc_exiting;
+
+static unsigned int gc_scan_net(struct net *net)
+{
+	unsigned int i, goal, buckets = 0, expired_count = 0;
+
+	goal = clamp(net->ct.htable_size / GC_MAX_BUCKETS_DIV,
+		     1u, GC_MAX_BUCKETS);
+	i = net->ct.gc_next_bucket;
+
+	do {
+		struct nf_conntrack_tuple_hash *h;
+		struct hlist_nulls_head *ct_hash;
+		struct hlist_nulls_node *n;
+		unsigned int hsize;
+		struct nf_conn *tmp;
+
+		rcu_read_lock();
+
+		nf_conntrack_get_ht(net, &ct_hash, &hsize);
+		if (i >= hsize)
+			i = 0;
+
+		hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[i], hnnode) {
+			tmp = nf_ct_tuplehash_to_ctrack(h);
+
+			if (nf_ct_is_expired(tmp)) {
+				nf_ct_gc_expired(tmp);
+				expired_count++;
+			}
+		}
+
+		/* An entry moved to another chain ends the walk of this
+		 * one early, gc is best effort: whatever it missed is
+		 * found on the next pass.
+		 */
+		rcu_read_unlock();
+		cond_resched_rcu_qs();
+		i++;
+	} while (++buckets < goal && expired_count < GC_MAX_EVICTS);
+
+	net->ct.gc_next_bucket = i;
+
+	return expired_count;
+}
+
+static void gc_worker(struct work_struct *work)
+{
+	unsigned long next_run = GC_INTERVAL / GC_MAX_BUCKETS_DIV;
+	unsigned int expired_count = 0;
+	struct net *net, *prev = NULL;
+
+	/* A reference keeps net on the list while the rcu lock is dropped,
+	 * so the walk can go on from it.  Namespaces on their way out have
+	 * none left and are skipped.
+	 */
+	rcu_read_lock();
+	for_each_net_rcu(net) {
+		if (!maybe_get_net(net))
+			continue;
+		rcu_read_unlock();
+
+		if (prev)
+			put_net(prev);
+		prev = net;
+
+		expired_count = max(expired_count, gc_scan_net(net));
+
+		rcu_read_lock();
+	}
+	rcu_read_unlock();
+
+	if (prev)
+		put_net(prev);
+
+	if (conntrack_gc_exiting)
+		return;
+
+	if (expired_count >= GC_MAX_EVICTS)
+		next_run = 0;
+	else if (expired_count)
+		next_run = msecs_to_jiffies(1);
+
+	queue_delayed_work(system_long_wq, &conntrack_gc_dwork, next_run);
+}
+
 void init_nf_conntrack_hash_rnd(void)
 {
 	unsigned int rand;
@@ -829,8 +980,8 @@ __nf_conntrack_alloc(struct net *net, u16 zone,
 	/* save hash for reusing when confirming */
 	*(unsigned long *)(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev) = hash;
 	ct->status = 0;
-	/* Don't set timer yet: wait for confirmation */
-	setup_timer(&ct->timeout, death_by_timeout, (unsigned long)ct);
+	/* relative until confirmation, see __nf_conntrack_confirm() */
+	ct->timeout = 0;
 	write_pnet(&ct->ct_net, net);
 	memset(&ct->__nfct_init_offset[0], 0,
 	       offsetof(struct nf_conn, proto) -
@@ -1207,24 +1358,23 @@ void __nf_ct_refresh_acct(struct nf_conn *ct,
 			  unsigned long extra_jiffies,
 			  int do_acct)
 {
-	NF_CT_ASSERT(ct->timeout.data == (unsigned long)ct);
 	NF_CT_ASSERT(skb);
 
 	/* Only update if this is not a fixed timeout */
 	if (test_bit(IPS_FIXED_TIMEOUT_BIT, &ct->status))
 		goto acct;
 
-	/* If not in hash table, timer will not be active yet */
+	/* If not in hash table, timeout is relative to confirmation */
 	if (!nf_ct_is_confirmed(ct)) {
-		ct->timeout.expires = extra_jiffies;
+		ct->timeout = extra_jiffies;
 	} else {
-		unsigned long newtime = jiffies + extra_jiffies;
+		u32 newtime = nfct_time_stamp + extra_jiffies;
 
 		/* Only update the timeout if the new timeout is at least
-		   HZ jiffies from the old timeout. Need del_timer for race
-		   avoidance (may already be dying). */
-		if (newtime - ct->timeout.expires >= HZ)
-			mod_timer_pending(&ct->timeout, newtime);
+		   HZ jiffies from the old timeout, this keeps the cache
+		   line clean for most packets. */
+		if (newtime - ct->timeout >= HZ)
+			WRITE_ONCE(ct->timeout, newtime);
 	}
 
 acct:
@@ -1260,11 +1410,7 @@ bool __nf_ct_kill_acct(struct nf_conn *ct,
 		}
 	}
 
-	if (del_timer(&ct->timeout)) {
-		ct->timeout.function((unsigned long)ct);
-		return true;
-	}
-	return false;
+	return nf_ct_delete(ct, 0, 0);
 }
 EXPORT_SYMBOL_GPL(__nf_ct_kill_acct);
 
@@ -1399,11 +1545,7 @@ void nf_ct_iterate_cleanup(struct net *net,
 
 	while ((ct = get_next_corpse(net, iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
-		if (del_timer(&ct->timeout))
-			nf_ct_delete(ct, portid, report);
-
-		/* ... else the timer will get him soon. */
-
+		nf_ct_delete(ct, portid, report);
 		nf_ct_put(ct);
 	}
 }
@@ -1438,6 +1580,8 @@ static int untrack_refs(void)
 
 void nf_conntrack_cleanup_start(void)
 {
+	conntrack_gc_exiting = true;
+	cancel_delayed_work_sync(&conntrack_gc_dwork);
 	RCU_INIT_POINTER(ip_ct_attach, NULL);
 }
 
@@ -1484,6 +1628,7 @@ void nf_conntrack_cleanup_net_list(struct list_head *net_exit_list)
 	 *  delete...
 	 */
 	synchronize_net();
+
 i_see_dead_people:
 	busy = 0;
 	list_for_each_entry(net, net_exit_list, exit_list) {
@@ -1564,10 +1709,9 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 	nf_conntrack_all_lock();
 	write_seqcount_begin(&init_net.ct.generation);
 
-	/* Lookups in the old hash might happen in parallel, which means we
-	 * might get false negatives during connection lookup. New connections
-	 * created because of a false negative won't make it into the hash
-	 * though since that required taking the locks.
+	/* Lookups in the old hash might happen in parallel, they restart
+	 * in the new one when they come up empty and see the generation
+	 * change, so they do not report false negatives.
 	 */
 
 	for (i = 0; i < init_net.ct.htable_size; i++) {
@@ -1591,6 +1735,8 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 	nf_conntrack_all_unlock();
 	local_bh_enable();
 
+	/* lockless lookups may still walk the old table */
+	synchronize_net();
 	nf_ct_free_hashtable(old_hash, old_size);
 	return 0;
 }
@@ -1724,6 +1870,10 @@ void nf_conntrack_init_end(void)
 	/* For use by REJECT target */
 	RCU_INIT_POINTER(ip_ct_attach, nf_conntrack_attach);
 	RCU_INIT_POINTER(nf_ct_destroy, destroy_conntrack);
+
+	conntrack_gc_exiting = false;
+	INIT_DEFERRABLE_WORK(&conntrack_gc_dwork, gc_worker);
+	queue_delayed_work(system_long_wq, &conntrack_gc_dwork, GC_INTERVAL);
 }
 
 /*
@@ -1796,6 +1946,8 @@ int nf_conntrack_init_net(struct net *net)
 	ret = nf_conntrack_proto_pernet_init(net);
 	if (ret < 0)
 		goto err_proto;
+
+	net->ct.gc_next_bucket = 0;
 	return 0;
 
 err_proto:
@@ -0,0 +1,295 @@
+/*
+ * Flow table for the software fast path of established connections.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netfilter.h>
+#include <linux/rhashtable.h>
+#include <linux/netdevice.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_flow_table.h>
+
+struct nf_flowtable {
+	struct rhashtable	rhashtable;
+	struct delayed_work	gc_work;
+};
+
+static int nf_flowtable_net_id __read_mostly;
+
+static inline struct nf_flowtable *nf_flowtable_pernet(struct net *net)
+{
+	return net_generic(net, nf_flowtable_net_id);
+}
+
+static const struct rhashtable_params nf_flow_offload_rhash_params = {
+	.head_offset		= offsetof(struct flow_offload_tuple_rhash, node),
+	.key_offset		= offsetof(struct flow_offload_tuple_rhash, tuple),
+	.key_len		= offsetof(struct flow_offload_tuple, dir),
+	.automatic_shrinking	= true,
+};
+
+static void
+flow_offload_fill_dir(struct flow_offload *flow, struct nf_conn *ct,
+		      struct dst_entry *route[IP_CT_DIR_MAX],
+		      enum ip_conntrack_dir dir)
+{
+	struct flow_offload_tuple *ft = &flow->tuplehash[dir].tuple;
+	struct nf_conntrack_tuple *ctt = &ct->tuplehash[dir].tuple;
+
+	ft->dir = dir;
+	ft->src_v4 = ctt->src.u3.ip;
+	ft->dst_v4 = ctt->dst.u3.ip;
+	ft->l4proto = ctt->dst.protonum;
+	ft->src_port = ctt->src.u.tcp.port;
+	ft->dst_port = ctt->dst.u.tcp.port;
+
+	/* packets of this direction arrive where the other one leaves */
+	ft->iifidx = route[!dir]->dev->ifindex;
+	ft->oifidx = route[dir]->dev->ifindex;
+	ft->mtu = dst_mtu(route[dir]);
+	ft->dst_cache = route[dir];
+}
+
+struct flow_offload *
+flow_offload_alloc(struct nf_conn *ct, struct dst_entry *route[IP_CT_DIR_MAX])
+{
+	struct flow_offload *flow;
+
+	if (unlikely(nf_ct_is_dying(ct) ||
+		     !atomic_inc_not_zero(&ct->ct_general.use)))
+		return NULL;
+
+	flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow)
+		goto err_ct_refcnt;
+
+	if (!dst_hold_safe(route[IP_CT_DIR_ORIGINAL]))
+		goto err_dst_cache_original;
+
+	if (!dst_hold_safe(route[IP_CT_DIR_REPLY]))
+		goto err_dst_cache_reply;
+
+	flow->ct = ct;
+
+	flow_offload_fill_dir(flow, ct, route, IP_CT_DIR_ORIGINAL);
+	flow_offload_fill_dir(flow, ct, route, IP_CT_DIR_REPLY);
+
+	if (ct->status & IPS_SRC_NAT)
+		flow->flags |= FLOW_OFFLOAD_SNAT;
+	if (ct->status & IPS_DST_NAT)
+		flow->flags |= FLOW_OFFLOAD_DNAT;
+
+	return flow;
+
+err_dst_cache_reply:
+	dst_release(route[IP_CT_DIR_ORIGINAL]);
+err_dst_cache_original:
+	kfree(flow);
+err_ct_refcnt:
+	nf_ct_put(ct);
+
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(flow_offload_alloc);
+
+void flow_offload_free(struct flow_offload *flow)
+{
+	dst_release(flow->tuplehash[IP_CT_DIR_ORIGINAL].tuple.dst_cache);
+	dst_release(flow->tuplehash[IP_CT_DIR_REPLY].tuple.dst_cache);
+	nf_ct_put(flow->ct);
+	kfree(flow);
+}
+EXPORT_SYMBOL_GPL(flow_offload_free);
+
+static void flow_offload_free_rcu(struct rcu_head *head)
+{
+	flow_offload_free(container_of(head, struct flow_offload, rcu_head));
+}
+
+/* On error the flow is released, the caller must not touch it again */
+int flow_offload_add(struct net *net, struct flow_offload *flow)
+{
+	struct nf_flowtable *ft = nf_flowtable_pernet(net);
+	int err;
+
+	flow->timeout = nfct_time_stamp + NF_FLOW_TIMEOUT;
+
+	err = rhashtable_lookup_insert_fast(&ft->rhashtable,
+			&flow->tuplehash[IP_CT_DIR_ORIGINAL].node,
+			nf_flow_offload_rhash_params);
+	if (err < 0) {
+		flow_offload_free(flow);
+		return err;
+	}
+
+	err = rhashtable_lookup_insert_fast(&ft->rhashtable,
+			&flow->tuplehash[IP_CT_DIR_REPLY].node,
+			nf_flow_offload_rhash_params);
+	if (err < 0) {
+		rhashtable_remove_fast(&ft->rhashtable,
+				&flow->tuplehash[IP_CT_DIR_ORIGINAL].node,
+				nf_flow_offload_rhash_params);
+		/* lookups may have found the original direction already */
+		call_rcu(&flow->rcu_head, flow_offload_free_rcu);
+		return err;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(flow_offload_add);
+
+static void flow_offload_del(struct nf_flowtable *ft,
+			     struct flow_offload *flow)
+{
+	rhashtable_remove_fast(&ft->rhashtable,
+			       &flow->tuplehash[IP_CT_DIR_ORIGINAL].node,
+			       nf_flow_offload_rhash_params);
+	rhashtable_remove_fast(&ft->rhashtable,
+			       &flow->tuplehash[IP_CT_DIR_REPLY].node,
+			       nf_flow_offload_rhash_params);
+
+	call_rcu(&flow->rcu_head, flow_offload_free_rcu);
+}
+
+/* must be called with rcu read lock held */
+struct flow_offload_tuple_rhash *
+flow_offload_lookup(struct net *net, const struct flow_offload_tuple *tuple)
+{
+	struct nf_flowtable *ft = nf_flowtable_pernet(net);
+
+	return rhashtable_lookup_fast(&ft->rhashtable, tuple,
+				      nf_flow_offload_rhash_params);
+}
+EXPORT_SYMBOL_GPL(flow_offload_lookup);
+
+static inline bool nf_flow_has_expired(const struct flow_offload *flow)
+{
+	return (__s32)(flow->timeout - nfct_time_stamp) <= 0;
+}
+
+/* Each flow is hashed once per direction, the walk handles it on its
+ * original direction entry.
+ */
+static void nf_flow_offload_gc_step(struct nf_flowtable *ft)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct rhashtable_iter hti;
+	struct flow_offload *flow;
+	int err;
+
+	err = rhashtable_walk_init(&ft->rhashtable, &hti);
+	if (err)
+		return;
+
+	err = rhashtable_walk_start(&hti);
+	if (err && err != -EAGAIN)
+		goto out;
+
+	while ((tuplehash = rhashtable_walk_next(&hti))) {
+		if (IS_ERR(tuplehash)) {
+			if (PTR_ERR(tuplehash) != -EAGAIN)
+				break;
+			continue;
+		}
+		if (tuplehash->tuple.dir != IP_CT_DIR_ORIGINAL)
+			continue;
+
+		flow = container_of(tuplehash, struct flow_offload,
+				    tuplehash[IP_CT_DIR_ORIGINAL]);
+
+		if (nf_flow_has_expired(flow) ||
+		    (flow->flags & FLOW_OFFLOAD_TEARDOWN) ||
+		    nf_ct_is_dying(flow->ct))
+			flow_offload_del(ft, flow);
+	}
+
+	rhashtable_walk_stop(&hti);
+out:
+	rhashtable_walk_exit(&hti);
+}
+
+static void nf_flow_offload_work_gc(struct work_struct *work)
+{
+	struct nf_flowtable *ft;
+
+	ft = container_of(work, struct nf_flowtable, gc_work.work);
+	nf_flow_offload_gc_step(ft);
+	queue_delayed_work(system_power_efficient_wq, &ft->gc_work, HZ);
+}
+
+static int __net_init nf_flow_table_net_init(struct net *net)
+{
+	struct nf_flowtable *ft = nf_flowtable_pernet(net);
+	int err;
+
+	err = rhashtable_init(&ft->rhashtable, &nf_flow_offload_rhash_params);
+	if (err < 0)
+		return err;
+
+	INIT_DEFERRABLE_WORK(&ft->gc_work, nf_flow_offload_work_gc);
+	queue_delayed_work(system_power_efficient_wq, &ft->gc_work, HZ);
+
+	return 0;
+}
+
+/* The reply direction entry may still be ahead in the walk, so the flow
+ * goes away after a grace period here too.
+ */
+static void nf_flow_offload_free_entry(void *ptr, void *arg)
+{
+	struct flow_offload_tuple_rhash *tuplehash = ptr;
+	struct flow_offload *flow;
+
+	if (tuplehash->tuple.dir != IP_CT_DIR_ORIGINAL)
+		return;
+
+	flow = container_of(tuplehash, struct flow_offload,
+			    tuplehash[IP_CT_DIR_ORIGINAL]);
+	call_rcu(&flow->rcu_head, flow_offload_free_rcu);
+}
+
+/* Runs before the conntrack pernet exit, which waits for the references
+ * the flows hold on their conntrack entries.
+ */
+static void __net_exit nf_flow_table_net_exit(struct net *net)
+{
+	struct nf_flowtable *ft = nf_flowtable_pernet(net);
+
+	cancel_delayed_work_sync(&ft->gc_work);
+	rhashtable_free_and_destroy(&ft->rhashtable,
+				    nf_flow_offload_free_entry, NULL);
+}
+
+static struct pernet_operations nf_flow_table_net_ops = {
+	.init	= nf_flow_table_net_init,
+	.exit	= nf_flow_table_net_exit,
+	.id	= &nf_flowtable_net_id,
+	.size	= sizeof(struct nf_flowtable),
+};
+
+static int __init nf_flow_table_module_init(void)
+{
+	return register_pernet_subsys(&nf_flow_table_net_ops);
+}
+
+static void __exit nf_flow_table_module_exit(void)
+{
+	unregister_pernet_subsys(&nf_flow_table_net_ops);
+	/* wait for the flows released from call_rcu() */
+	rcu_barrier();
+}
+
+module_init(nf_flow_table_module_init);
+module_exit(nf_flow_table_module_exit);
+
+MODULE_LICENSE("GPL");
@@ -2454,7 +2454,7 @@ static int netlink_recvmsg(struct socket *sock, struct msghdr *msg, size_t len,
 	/* Record the max length of recvmsg() calls for future allocations */
 	nlk->max_recvmsg_len = max(nlk->max_recvmsg_len, len);
 	nlk->max_recvmsg_len = min_t(size_t, nlk->max_recvmsg_len,
-				     16384);
+				     32768);
 
 	copied = data_skb->len;
 	if (len < copied) {
@@ -2686,6 +2686,7 @@ static int netlink_dump(struct sock *sk)
 	int len, err = -ENOBUFS;
 	int alloc_min_size;
 	int alloc_size;
+	int batch = 0;
 
 	mutex_lock(nlk->cb_mutex);
 	if (!nlk->cb_running) {
@@ -2693,18 +2694,22 @@ static int netlink_dump(struct sock *sk)
 		goto errout_skb;
 	}
 
-	if (!netlink_rx_is_mmaped(sk) &&
-	    atomic_read(&sk->sk_rmem_alloc) >= sk->sk_rcvbuf)
-		goto errout_skb;
-
 	/* NLMSG_GOODSIZE is small to avoid high order allocations being
-	 * required, but it makes sense to _attempt_ a 16K bytes allocation
+	 * required, but it makes sense to _attempt_ a 32K bytes allocation
 	 * to reduce number of system calls on dump operations, if user
 	 * ever provided a big enough buffer.
 	 */
 	cb = &nlk->cb;
 	alloc_min_size = max_t(int, cb->min_dump_alloc, NLMSG_GOODSIZE);
 
+next_skb:
+	if (!netlink_rx_is_mmaped(sk) &&
+	    atomic_read(&sk->sk_rmem_alloc) >= sk->sk_rcvbuf) {
+		if (batch)
+			goto out_unlock;
+		goto errout_skb;
+	}
+
 	if (alloc_min_size < nlk->max_recvmsg_len) {
 		alloc_size = nlk->max_recvmsg_len;
 		skb = netlink_alloc_skb(sk, alloc_size, nlk->portid,
@@ -2717,11 +2722,14 @@ static int netlink_dump(struct sock *sk)
 		skb = netlink_alloc_skb(sk, alloc_size, nlk->portid,
 					GFP_KERNEL);
 	}
-	if (!skb)
+	if (!skb) {
+		if (batch)
+			goto out_unlock;
 		goto errout_skb;
+	}
 
 	/* Trim skb to allocated size. User is expected to provide buffer as
-	 * large as max(min_dump_alloc, 16KiB (mac_recvmsg_len capped at
+	 * large as max(min_dump_alloc, 32KiB (max_recvmsg_len capped at
 	 * netlink_recvmsg())). dump will pack as many smaller messages as
 	 * could fit within the allocated skb. skb is typically allocated
 	 * with larger space than required (could be as much as near 2x the
@@ -2736,13 +2744,21 @@ static int netlink_dump(struct sock *sk)
 	len = cb->dump(skb, cb);
 
 	if (len > 0) {
-		mutex_unlock(nlk->cb_mutex);
-
 		if (sk_filter(sk, skb))
 			kfree_skb(skb);
 		else
 			__netlink_sendskb(sk, skb);
-		return 0;
+		skb = NULL;
+
+		/* Keep filling the receive queue while there is room, so
+		 * a reader draining a large table finds several skbs per
+		 * wakeup instead of restarting the dump after each one.
+		 * Memory mapped sockets are refilled from netlink_poll().
+		 */
+		if (!netlink_rx_is_mmaped(sk) &&
+		    ++batch < NETLINK_DUMP_BATCH && !need_resched())
+			goto next_skb;
+		goto out_unlock;
 	}
 
 	nlh = nlmsg_put_answer(skb, cb, NLMSG_DONE, sizeof(len), NLM_F_MULTI);
@@ -2767,6 +2783,10 @@ static int netlink_dump(struct sock *sk)
 	consume_skb(cb->skb);
 	return 0;
 
+out_unlock:
+	mutex_unlock(nlk->cb_mutex);
+	return 0;
+
 errout_skb:
 	mutex_unlock(nlk->cb_mutex);
 	kfree_skb(skb);
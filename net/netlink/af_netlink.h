@@ -8,6 +8,9 @@
 #define NLGRPSZ(x)	(ALIGN(x, sizeof(unsigned long) * 8) / 8)
 #define NLGRPLONGS(x)	(NLGRPSZ(x)/sizeof(unsigned long))
 
+/* Maximum number of skbs a single netlink_dump() call queues */
+#define NETLINK_DUMP_BATCH	16
+
 struct netlink_ring {
 	void			**pg_vec;
 	unsigned int		head;
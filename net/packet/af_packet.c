@@ -243,7 +243,10 @@ struct packet_skb_cb {
 static void __fanout_unlink(struct sock *sk, struct packet_sock *po);
 static void __fanout_link(struct sock *sk, struct packet_sock *po);
 
-static int packet_direct_xmit(struct sk_buff *skb)
+/* @more tells the driver that the caller has another packet for the same
+ * queue ready, so it may leave the doorbell for that one to ring.
+ */
+static int __packet_direct_xmit(struct sk_buff *skb, bool more)
 {
 	struct net_device *dev = skb->dev;
 	netdev_features_t features;
@@ -265,7 +268,7 @@ static int packet_direct_xmit(struct sk_buff *skb)
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
 	if (!netif_xmit_frozen_or_drv_stopped(txq))
-		ret = netdev_start_xmit(skb, dev, txq, false);
+		ret = netdev_start_xmit(skb, dev, txq, more);
 	HARD_TX_UNLOCK(dev, txq);
 
 	local_bh_enable();
@@ -280,6 +283,11 @@ drop:
 	return NET_XMIT_DROP;
 }
 
+static int packet_direct_xmit(struct sk_buff *skb)
+{
+	return __packet_direct_xmit(skb, false);
+}
+
 static struct net_device *packet_cached_dev_get(struct packet_sock *po)
 {
 	struct net_device *dev;
@@ -309,8 +317,17 @@ static bool packet_use_direct_xmit(const struct packet_sock *po)
 	return po->xmit == packet_direct_xmit;
 }
 
+/* Members of a fanout group bypassing the qdisc each get a queue of their
+ * own, so that one thread per socket can drive all queues of a device
+ * without contending on the tx lock.
+ */
 static u16 __packet_pick_tx_queue(struct net_device *dev, struct sk_buff *skb)
 {
+	struct packet_sock *po = pkt_sk(skb->sk);
+
+	if (po->fanout && packet_use_direct_xmit(po))
+		return (u16) READ_ONCE(po->fanout_idx) % dev->real_num_tx_queues;
+
 	return (u16) raw_smp_processor_id() % dev->real_num_tx_queues;
 }
 
@@ -406,6 +423,9 @@ static void __packet_set_status(struct packet_sock *po, void *frame, int status)
 		flush_dcache_page(pgv_to_page(&h.h2->tp_status));
 		break;
 	case TPACKET_V3:
+		h.h3->tp_status = status;
+		flush_dcache_page(pgv_to_page(&h.h3->tp_status));
+		break;
 	default:
 		WARN(1, "TPACKET version not supported.\n");
 		BUG();
@@ -429,6 +449,8 @@ static int __packet_get_status(struct packet_sock *po, void *frame)
 		flush_dcache_page(pgv_to_page(&h.h2->tp_status));
 		return h.h2->tp_status;
 	case TPACKET_V3:
+		flush_dcache_page(pgv_to_page(&h.h3->tp_status));
+		return h.h3->tp_status;
 	default:
 		WARN(1, "TPACKET version not supported.\n");
 		BUG();
@@ -473,6 +495,9 @@ static __u32 __packet_set_timestamp(struct packet_sock *po, void *frame,
 		h.h2->tp_nsec = ts.tv_nsec;
 		break;
 	case TPACKET_V3:
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		break;
 	default:
 		WARN(1, "TPACKET version not supported.\n");
 		BUG();
@@ -1395,6 +1420,7 @@ static void __fanout_link(struct sock *sk, struct packet_sock *po)
 	struct packet_fanout *f = po->fanout;
 
 	spin_lock(&f->lock);
+	WRITE_ONCE(po->fanout_idx, f->num_members);
 	f->arr[f->num_members] = sk;
 	smp_wmb();
 	f->num_members++;
@@ -1413,6 +1439,7 @@ static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
 	}
 	BUG_ON(i >= f->num_members);
 	f->arr[i] = f->arr[f->num_members - 1];
+	WRITE_ONCE(pkt_sk(f->arr[i])->fanout_idx, i);
 	f->num_members--;
 	spin_unlock(&f->lock);
 }
@@ -2151,6 +2178,14 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	skb_shinfo(skb)->destructor_arg = ph.raw;
 
 	switch (po->tp_version) {
+	case TPACKET_V3:
+		/* the tx ring has fixed size frames */
+		if (unlikely(ph.h3->tp_next_offset)) {
+			pr_warn_once("variable sized slot not supported\n");
+			return -EINVAL;
+		}
+		tp_len = ph.h3->tp_len;
+		break;
 	case TPACKET_V2:
 		tp_len = ph.h2->tp_len;
 		break;
@@ -2172,6 +2207,9 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 		off_max = po->tx_ring.frame_size - tp_len;
 		if (sock->type == SOCK_DGRAM) {
 			switch (po->tp_version) {
+			case TPACKET_V3:
+				off = ph.h3->tp_net;
+				break;
 			case TPACKET_V2:
 				off = ph.h2->tp_net;
 				break;
@@ -2181,6 +2219,9 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 			}
 		} else {
 			switch (po->tp_version) {
+			case TPACKET_V3:
+				off = ph.h3->tp_mac;
+				break;
 			case TPACKET_V2:
 				off = ph.h2->tp_mac;
 				break;
@@ -2252,9 +2293,30 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	return tp_len;
 }
 
+/* Sends the frame tpacket_snd() held back to batch it with the next one.
+ * Returns an error if the frame has to go out again on the next call.
+ */
+static int tpacket_xmit_held(struct packet_sock *po, struct sk_buff *skb,
+			     void *ph, bool more)
+{
+	int err;
+
+	err = __packet_direct_xmit(skb, more);
+	if (unlikely(err > 0)) {
+		err = net_xmit_errno(err);
+		if (err && __packet_get_status(po, ph) == TP_STATUS_AVAILABLE)
+			return err;
+		/* dropped but not destructed yet, like congestion */
+	}
+
+	return 0;
+}
+
 static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 {
-	struct sk_buff *skb;
+	struct sk_buff *skb, *held = NULL;
+	unsigned int held_head = 0;
+	void *held_ph = NULL;
 	struct net_device *dev;
 	__be16 proto;
 	int err, reserve = 0;
@@ -2266,6 +2328,11 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 	int len_sum = 0;
 	int status = TP_STATUS_AVAILABLE;
 	int hlen, tlen;
+	/* Bypassing the qdisc, each frame is held back until the next one is
+	 * built, so that the driver learns through xmit_more whether it can
+	 * leave the doorbell for the next one.
+	 */
+	bool batch = packet_use_direct_xmit(po);
 
 	mutex_lock(&po->pg_vec_lock);
 
@@ -2305,6 +2372,12 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 		ph = packet_current_frame(po, &po->tx_ring,
 					  TP_STATUS_SEND_REQUEST);
 		if (unlikely(ph == NULL)) {
+			if (held) {
+				err = tpacket_xmit_held(po, held, held_ph, false);
+				held = NULL;
+				if (unlikely(err))
+					goto out_held;
+			}
 			if (need_wait && need_resched())
 				schedule();
 			continue;
@@ -2313,9 +2386,19 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 		status = TP_STATUS_SEND_REQUEST;
 		hlen = LL_RESERVED_SPACE(dev);
 		tlen = dev->needed_tailroom;
+		/* never sleep on sndbuf with the doorbell left unrung */
 		skb = sock_alloc_send_skb(&po->sk,
 				hlen + tlen + sizeof(struct sockaddr_ll),
-				!need_wait, &err);
+				!need_wait || held, &err);
+		if (unlikely(skb == NULL) && held) {
+			err = tpacket_xmit_held(po, held, held_ph, false);
+			held = NULL;
+			if (unlikely(err))
+				goto out_held;
+			skb = sock_alloc_send_skb(&po->sk,
+					hlen + tlen + sizeof(struct sockaddr_ll),
+					!need_wait, &err);
+		}
 
 		if (unlikely(skb == NULL)) {
 			/* we assume the socket was initially writeable ... */
@@ -2331,6 +2414,12 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 			tp_len = -EMSGSIZE;
 
 		if (unlikely(tp_len < 0)) {
+			if (held) {
+				err = tpacket_xmit_held(po, held, held_ph, false);
+				held = NULL;
+				if (unlikely(err))
+					goto out_held_free;
+			}
 			if (po->tp_loss) {
 				__packet_set_status(po, ph,
 						TP_STATUS_AVAILABLE);
@@ -2346,11 +2435,29 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 
 		packet_pick_tx_queue(dev, skb);
 
+		if (held) {
+			err = tpacket_xmit_held(po, held, held_ph,
+						skb_get_queue_mapping(held) ==
+						skb_get_queue_mapping(skb));
+			held = NULL;
+			if (unlikely(err))
+				goto out_held_free;
+		}
+
 		skb->destructor = tpacket_destruct_skb;
 		__packet_set_status(po, ph, TP_STATUS_SENDING);
 		packet_inc_pending(&po->tx_ring);
 
 		status = TP_STATUS_SEND_REQUEST;
+		if (batch) {
+			held = skb;
+			held_ph = ph;
+			held_head = po->tx_ring.head;
+			packet_increment_head(&po->tx_ring);
+			len_sum += tp_len;
+			continue;
+		}
+
 		err = po->xmit(skb);
 		if (unlikely(err > 0)) {
 			err = net_xmit_errno(err);
@@ -2380,6 +2487,13 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 	err = len_sum;
 	goto out_put;
 
+out_held_free:
+	kfree_skb(skb);
+out_held:
+	/* the held back frame goes out again on the next call */
+	po->tx_ring.head = held_head;
+	__packet_set_status(po, held_ph, TP_STATUS_SEND_REQUEST);
+	goto out_put;
 out_status:
 	__packet_set_status(po, ph, status);
 	kfree_skb(skb);
@@ -3823,12 +3937,6 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	/* Added to avoid minimal code churn */
 	struct tpacket_req *req = &req_u->req;
 
-	/* Opening a Tx-ring is NOT supported in TPACKET_V3 */
-	if (!closing && tx_ring && (po->tp_version > TPACKET_V2)) {
-		WARN(1, "Tx-ring is not supported.\n");
-		goto out;
-	}
-
 	rb = tx_ring ? &po->tx_ring : &po->rx_ring;
 	rb_queue = tx_ring ? &sk->sk_write_queue : &sk->sk_receive_queue;
 
@@ -3863,10 +3971,14 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 			goto out;
 		if (unlikely(req->tp_block_size & (PAGE_SIZE - 1)))
 			goto out;
-		if (po->tp_version >= TPACKET_V3 &&
+		/* a V3 tx ring is laid out in frames, not blocks */
+		if (po->tp_version >= TPACKET_V3 && !tx_ring &&
 		    (int)(req->tp_block_size -
 			  BLK_PLUS_PRIV(req_u->req3.tp_sizeof_priv)) <= 0)
 			goto out;
+		if (po->tp_version >= TPACKET_V3 && tx_ring &&
+		    req_u->req3.tp_sizeof_priv)
+			goto out;
 		if (unlikely(req->tp_frame_size < po->tp_hdrlen +
 					po->tp_reserve))
 			goto out;
@@ -3887,9 +3999,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 			goto out;
 		switch (po->tp_version) {
 		case TPACKET_V3:
-		/* Transmit path is not supported. We checked
-		 * it above but just being paranoid
-		 */
+			/* Block-based V3 is only used on the rx ring */
 			if (!tx_ring)
 				init_prb_bdqc(po, rb, pg_vec, req_u, tx_ring);
 			break;
@@ -3949,7 +4059,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	}
 	spin_unlock(&po->bind_lock);
 	if (closing && (po->tp_version > TPACKET_V2)) {
-		/* Because we don't support block-based V3 on tx-ring */
+		/* Because we don't use block-based V3 on tx-ring */
 		if (!tx_ring)
 			prb_shutdown_retire_blk_timer(po, tx_ring, rb_queue);
 	}
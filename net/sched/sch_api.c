@@ -860,6 +860,13 @@ skip:
 	} else {
 		const struct Qdisc_class_ops *cops = parent->ops->cl_ops;
 
+		/* A classful parent dequeues its children under its own root
+		 * lock, only mq/mqprio leave them to run lockless.
+		 */
+		if (new && (new->flags & TCQ_F_NOLOCK) &&
+		    !(parent->flags & TCQ_F_MQROOT))
+			return -EOPNOTSUPP;
+
 		err = -EOPNOTSUPP;
 		if (cops && cops->graft) {
 			unsigned long cl = cops->get(parent, classid);
@@ -957,6 +964,7 @@ qdisc_create(struct net_device *dev, struct netdev_queue *dev_queue,
 
 	if (!ops->init || (err = ops->init(sch, tca[TCA_OPTIONS])) == 0) {
 		if (qdisc_is_percpu_stats(sch)) {
+			err = -ENOMEM;
 			sch->cpu_bstats =
 				netdev_alloc_pcpu_stats(struct gnet_stats_basic_cpu);
 			if (!sch->cpu_bstats)
@@ -1356,7 +1364,7 @@ static int tc_fill_qdisc(struct sk_buff *skb, struct Qdisc *q, u32 clid,
 		goto nla_put_failure;
 	if (q->ops->dump && q->ops->dump(q, skb) < 0)
 		goto nla_put_failure;
-	qlen = q->q.qlen;
+	qlen = qdisc_qlen_sum(q);
 
 	stab = rtnl_dereference(q->stab);
 	if (stab && qdisc_dump_stab(skb, stab) < 0)
@@ -1961,6 +1969,7 @@ static int __init pktsched_init(void)
 	}
 
 	register_qdisc(&pfifo_fast_ops);
+	register_qdisc(&pfifo_lockless_ops);
 	register_qdisc(&pfifo_qdisc_ops);
 	register_qdisc(&bfifo_qdisc_ops);
 	register_qdisc(&pfifo_head_drop_qdisc_ops);
@@ -26,6 +26,7 @@
 #include <linux/list.h>
 #include <linux/slab.h>
 #include <linux/if_vlan.h>
+#include <linux/ptr_ring.h>
 #include <net/sch_generic.h>
 #include <net/pkt_sched.h>
 #include <net/dst.h>
@@ -43,13 +44,61 @@ EXPORT_SYMBOL(default_qdisc_ops);
  * - enqueue, dequeue are serialized via qdisc root lock
  * - ingress filtering is also serialized via qdisc root lock
  * - updates to tree and tree walking are only done under the rtnl mutex.
+ *
+ * A TCQ_F_NOLOCK qdisc does its own enqueue/dequeue synchronization and
+ * keeps its queue length in per-cpu stats; q->gso_skb and q->skb_bad_txq
+ * are then protected by q->seqlock, which qdisc_run_begin() takes.
  */
 
+static inline void qdisc_qlen_inc(struct Qdisc *q)
+{
+	if (qdisc_is_percpu_stats(q))
+		qdisc_qstats_cpu_qlen_inc(q);
+	else
+		q->q.qlen++;
+}
+
+static inline void qdisc_qlen_dec(struct Qdisc *q)
+{
+	if (qdisc_is_percpu_stats(q))
+		qdisc_qstats_cpu_qlen_dec(q);
+	else
+		q->q.qlen--;
+}
+
+/* q->skb_bad_txq is still part of the queue, in qlen and backlog */
+static inline void qdisc_enqueue_skb_bad_txq(struct Qdisc *q,
+					     struct sk_buff *skb)
+{
+	q->skb_bad_txq = skb;
+	if (qdisc_is_percpu_stats(q))
+		qdisc_qstats_cpu_backlog_inc(q, qdisc_pkt_len(skb));
+	else
+		qdisc_qstats_backlog_inc(q, skb);
+	qdisc_qlen_inc(q);
+}
+
+static inline struct sk_buff *qdisc_dequeue_skb_bad_txq(struct Qdisc *q)
+{
+	struct sk_buff *skb = q->skb_bad_txq;
+
+	q->skb_bad_txq = NULL;
+	if (qdisc_is_percpu_stats(q))
+		qdisc_qstats_cpu_backlog_dec(q, qdisc_pkt_len(skb));
+	else
+		qdisc_qstats_backlog_dec(q, skb);
+	qdisc_qlen_dec(q);
+	return skb;
+}
+
 static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 {
 	q->gso_skb = skb;
-	q->qstats.requeues++;
-	q->q.qlen++;	/* it's still part of the queue */
+	if (qdisc_is_percpu_stats(q))
+		qdisc_qstats_cpu_requeues_inc(q);
+	else
+		q->qstats.requeues++;
+	qdisc_qlen_inc(q);	/* it's still part of the queue */
 	__netif_schedule(q);
 
 	return 0;
@@ -76,6 +125,37 @@ static void try_bulk_dequeue_skb(struct Qdisc *q,
 	skb->next = NULL;
 }
 
+/* This variant of try_bulk_dequeue_skb() is for qdiscs feeding several
+ * TX queues: the list handed to the driver must target a single one, so
+ * the first skb for another queue ends the batch and is held back in
+ * q->skb_bad_txq for the next round.
+ */
+static void try_bulk_dequeue_skb_slow(struct Qdisc *q,
+				      struct sk_buff *skb,
+				      int *packets)
+{
+	const struct netdev_queue *txq = skb_get_tx_queue(qdisc_dev(q), skb);
+	int mapping = skb_get_queue_mapping(skb);
+	int bytelimit = qdisc_avail_bulklimit(txq) - skb->len;
+
+	while (bytelimit > 0) {
+		struct sk_buff *nskb = q->dequeue(q);
+
+		if (!nskb)
+			break;
+		if (unlikely(skb_get_queue_mapping(nskb) != mapping)) {
+			qdisc_enqueue_skb_bad_txq(q, nskb);
+			break;
+		}
+
+		bytelimit -= nskb->len; /* covers GSO len */
+		skb->next = nskb;
+		skb = nskb;
+		(*packets)++; /* GSO counts as one pkt */
+	}
+	skb->next = NULL;
+}
+
 /* Note that dequeue_skb can possibly return a SKB list (via skb->next).
  * A requeued skb (via q->gso_skb) can also be a SKB list.
  */
@@ -92,18 +172,37 @@ static struct sk_buff *dequeue_skb(struct Qdisc *q, bool *validate,
 		txq = skb_get_tx_queue(txq->dev, skb);
 		if (!netif_xmit_frozen_or_stopped(txq)) {
 			q->gso_skb = NULL;
-			q->q.qlen--;
+			qdisc_qlen_dec(q);
 		} else
 			skb = NULL;
 		/* skb in gso_skb were already validated */
 		*validate = false;
-	} else {
-		if (!(q->flags & TCQ_F_ONETXQUEUE) ||
-		    !netif_xmit_frozen_or_stopped(txq)) {
-			skb = q->dequeue(q);
-			if (skb && qdisc_may_bulk(q))
-				try_bulk_dequeue_skb(q, skb, txq, packets);
-		}
+		goto out;
+	}
+
+	skb = q->skb_bad_txq;
+	if (unlikely(skb)) {
+		txq = skb_get_tx_queue(txq->dev, skb);
+		if (netif_xmit_frozen_or_stopped(txq))
+			return NULL;
+		qdisc_dequeue_skb_bad_txq(q);
+		goto bulk;
+	}
+
+	if (!(q->flags & TCQ_F_ONETXQUEUE) ||
+	    !netif_xmit_frozen_or_stopped(txq))
+		skb = q->dequeue(q);
+	if (skb) {
+bulk:
+		if (qdisc_may_bulk(q))
+			try_bulk_dequeue_skb(q, skb, txq, packets);
+		else
+			try_bulk_dequeue_skb_slow(q, skb, packets);
+	}
+out:
+	if (skb) {
+		__this_cpu_inc(softnet_data.xmit_batches);
+		__this_cpu_add(softnet_data.xmit_batch_pkts, *packets);
 	}
 	return skb;
 }
@@ -124,7 +223,7 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 		kfree_skb_list(skb);
 		net_warn_ratelimited("Dead loop on netdevice %s, fix it urgently!\n",
 				     dev_queue->dev->name);
-		ret = qdisc_qlen(q);
+		ret = (q->flags & TCQ_F_NOLOCK) ? 1 : qdisc_qlen(q);
 	} else {
 		/*
 		 * Another cpu is holding lock, requeue & delay xmits for
@@ -142,6 +241,9 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
  * required. Holding the __QDISC___STATE_RUNNING bit guarantees that
  * only one CPU can execute this function.
  *
+ * root_lock is NULL for a TCQ_F_NOLOCK qdisc, which can not tell whether
+ * it is empty without dequeueing: it gets >0 until dequeue_skb() fails.
+ *
  * Returns to the caller:
  *				0  - queue is empty or throttled.
  *				>0 - queue is not empty.
@@ -153,7 +255,8 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 	int ret = NETDEV_TX_BUSY;
 
 	/* And release qdisc */
-	spin_unlock(root_lock);
+	if (root_lock)
+		spin_unlock(root_lock);
 
 	/* Note that we validate skb (GSO, checksum, ...) outside of locks */
 	if (validate)
@@ -166,11 +269,12 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 
 		HARD_TX_UNLOCK(dev, txq);
 	}
-	spin_lock(root_lock);
+	if (root_lock)
+		spin_lock(root_lock);
 
 	if (dev_xmit_complete(ret)) {
 		/* Driver sent out skb successfully or skb was consumed */
-		ret = qdisc_qlen(q);
+		ret = root_lock ? qdisc_qlen(q) : 1;
 	} else if (ret == NETDEV_TX_LOCKED) {
 		/* Driver try lock failed */
 		ret = handle_dev_cpu_collision(skb, txq, q);
@@ -212,7 +316,7 @@ static inline int qdisc_restart(struct Qdisc *q, int *packets)
 {
 	struct netdev_queue *txq;
 	struct net_device *dev;
-	spinlock_t *root_lock;
+	spinlock_t *root_lock = NULL;
 	struct sk_buff *skb;
 	bool validate;
 
@@ -221,7 +325,8 @@ static inline int qdisc_restart(struct Qdisc *q, int *packets)
 	if (unlikely(!skb))
 		return 0;
 
-	root_lock = qdisc_lock(q);
+	if (!(q->flags & TCQ_F_NOLOCK))
+		root_lock = qdisc_lock(q);
 	dev = qdisc_dev(q);
 	txq = skb_get_tx_queue(dev, skb);
 
@@ -576,6 +681,138 @@ struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 	.owner		=	THIS_MODULE,
 };
 
+/* pfifo_fast without the root lock: the same three bands, each a ptr_ring
+ * holding up to tx_queue_len skbs, so that cpus transmitting on the same
+ * TX queue only contend on the ring of their band. Only usable where no
+ * parent takes the root lock around it, i.e. at the root or under mq.
+ */
+struct pfifo_lockless_priv {
+	struct ptr_ring q[PFIFO_FAST_BANDS];
+};
+
+static int pfifo_lockless_enqueue(struct sk_buff *skb, struct Qdisc *qdisc)
+{
+	int band = prio2band[skb->priority & TC_PRIO_MAX];
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	unsigned int pkt_len = qdisc_pkt_len(skb);
+
+	/* Once produced, skb may be sent and freed by another cpu */
+	if (unlikely(ptr_ring_produce(&priv->q[band], skb))) {
+		qdisc_qstats_drop_cpu(qdisc);
+		kfree_skb(skb);
+		return NET_XMIT_DROP;
+	}
+
+	qdisc_qstats_cpu_backlog_inc(qdisc, pkt_len);
+	qdisc_qstats_cpu_qlen_inc(qdisc);
+	return NET_XMIT_SUCCESS;
+}
+
+static struct sk_buff *pfifo_lockless_dequeue(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb = NULL;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++) {
+		struct ptr_ring *q = &priv->q[band];
+
+		if (__ptr_ring_empty(q))
+			continue;
+
+		skb = ptr_ring_consume(q);
+	}
+
+	if (likely(skb)) {
+		qdisc_qstats_cpu_backlog_dec(qdisc, qdisc_pkt_len(skb));
+		qdisc_bstats_update_cpu(qdisc, skb);
+		qdisc_qstats_cpu_qlen_dec(qdisc);
+	}
+
+	return skb;
+}
+
+static struct sk_buff *pfifo_lockless_peek(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb = NULL;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = __ptr_ring_peek(&priv->q[band]);
+
+	return skb;
+}
+
+static void pfifo_lockless_reset(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb;
+	int band, i;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		while ((skb = ptr_ring_consume(&priv->q[band])) != NULL)
+			kfree_skb(skb);
+	}
+
+	if (!qdisc->cpu_qstats)
+		return;
+
+	for_each_possible_cpu(i) {
+		struct gnet_stats_queue *q = per_cpu_ptr(qdisc->cpu_qstats, i);
+
+		q->backlog = 0;
+		q->qlen = 0;
+	}
+}
+
+static void pfifo_lockless_destroy(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	/* qdisc_destroy() has reset the rings already */
+	for (band = 0; band < PFIFO_FAST_BANDS; band++)
+		ptr_ring_cleanup(&priv->q[band], NULL);
+}
+
+static int pfifo_lockless_init(struct Qdisc *qdisc, struct nlattr *opt)
+{
+	unsigned int qlen = qdisc_dev(qdisc)->tx_queue_len;
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	int band, err;
+
+	/* guard against zero length rings */
+	if (!qlen)
+		qlen = 1;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		err = ptr_ring_init(&priv->q[band], qlen, GFP_KERNEL);
+		if (err) {
+			/* qdisc_create_dflt() still calls ->destroy() */
+			pfifo_lockless_destroy(qdisc);
+			memset(priv, 0, sizeof(*priv));
+			return err;
+		}
+	}
+
+	qdisc->flags |= TCQ_F_NOLOCK | TCQ_F_CPUSTATS;
+	return 0;
+}
+
+struct Qdisc_ops pfifo_lockless_ops __read_mostly = {
+	.id		=	"pfifo_lockless",
+	.priv_size	=	sizeof(struct pfifo_lockless_priv),
+	.enqueue	=	pfifo_lockless_enqueue,
+	.dequeue	=	pfifo_lockless_dequeue,
+	.peek		=	pfifo_lockless_peek,
+	.init		=	pfifo_lockless_init,
+	.reset		=	pfifo_lockless_reset,
+	.destroy	=	pfifo_lockless_destroy,
+	.dump		=	pfifo_fast_dump,
+	.owner		=	THIS_MODULE,
+};
+
 static struct lock_class_key qdisc_tx_busylock;
 
 struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
@@ -605,6 +842,7 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 	}
 	INIT_LIST_HEAD(&sch->list);
 	skb_queue_head_init(&sch->q);
+	spin_lock_init(&sch->seqlock);
 
 	spin_lock_init(&sch->busylock);
 	lockdep_set_class(&sch->busylock,
@@ -636,8 +874,16 @@ struct Qdisc *qdisc_create_dflt(struct netdev_queue *dev_queue,
 		goto errout;
 	sch->parent = parentid;
 
-	if (!ops->init || ops->init(sch, NULL) == 0)
-		return sch;
+	if (!ops->init || ops->init(sch, NULL) == 0) {
+		if (!qdisc_is_percpu_stats(sch))
+			return sch;
+
+		sch->cpu_bstats =
+			netdev_alloc_pcpu_stats(struct gnet_stats_basic_cpu);
+		sch->cpu_qstats = alloc_percpu(struct gnet_stats_queue);
+		if (sch->cpu_bstats && sch->cpu_qstats)
+			return sch;
+	}
 
 	qdisc_destroy(sch);
 errout:
@@ -659,6 +905,11 @@ void qdisc_reset(struct Qdisc *qdisc)
 		qdisc->gso_skb = NULL;
 		qdisc->q.qlen = 0;
 	}
+	if (qdisc->skb_bad_txq) {
+		kfree_skb(qdisc->skb_bad_txq);
+		qdisc->skb_bad_txq = NULL;
+		qdisc->q.qlen = 0;
+	}
 }
 EXPORT_SYMBOL(qdisc_reset);
 
@@ -697,6 +948,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	dev_put(qdisc_dev(qdisc));
 
 	kfree_skb_list(qdisc->gso_skb);
+	kfree_skb(qdisc->skb_bad_txq);
 	/*
 	 * gen_estimator est_timer() might access qdisc->q.lock,
 	 * wait a RCU grace period before freeing qdisc.
@@ -824,6 +1076,10 @@ static void dev_deactivate_queue(struct net_device *dev,
 
 	qdisc = rtnl_dereference(dev_queue->qdisc);
 	if (qdisc) {
+		bool nolock = qdisc->flags & TCQ_F_NOLOCK;
+
+		if (nolock)
+			spin_lock_bh(&qdisc->seqlock);
 		spin_lock_bh(qdisc_lock(qdisc));
 
 		if (!(qdisc->flags & TCQ_F_BUILTIN))
@@ -833,9 +1089,29 @@ static void dev_deactivate_queue(struct net_device *dev,
 		qdisc_reset(qdisc);
 
 		spin_unlock_bh(qdisc_lock(qdisc));
+		if (nolock)
+			spin_unlock_bh(&qdisc->seqlock);
 	}
 }
 
+/* A TCQ_F_NOLOCK qdisc is not serialized against dev_queue_xmit() by the
+ * root lock: flush what senders racing with dev_deactivate_queue() queued.
+ */
+static void dev_reset_queue(struct net_device *dev,
+			    struct netdev_queue *dev_queue,
+			    void *_unused)
+{
+	struct Qdisc *qdisc = dev_queue->qdisc_sleeping;
+
+	if (!qdisc || !(qdisc->flags & TCQ_F_NOLOCK))
+		return;
+
+	spin_lock_bh(&qdisc->seqlock);
+	qdisc_reset(qdisc);
+	clear_bit(__QDISC_STATE_MISSED, &qdisc->state);
+	spin_unlock_bh(&qdisc->seqlock);
+}
+
 static bool some_qdisc_is_busy(struct net_device *dev)
 {
 	unsigned int i;
@@ -894,9 +1170,12 @@ void dev_deactivate_many(struct list_head *head)
 		synchronize_net();
 
 	/* Wait for outstanding qdisc_run calls. */
-	list_for_each_entry(dev, head, close_list)
+	list_for_each_entry(dev, head, close_list) {
 		while (some_qdisc_is_busy(dev))
 			yield();
+
+		netdev_for_each_tx_queue(dev, dev_reset_queue, NULL);
+	}
 }
 
 void dev_deactivate(struct net_device *dev)
@@ -36,7 +36,15 @@
 static void svc_unregister(const struct svc_serv *serv, struct net *net);
 static struct svc_rqst *
 __svc_prepare_thread(struct svc_serv *serv, struct svc_pool *pool, int node,
-		bool istmp);
+		int tmpflag);
+
+/*
+ * Upper bound on the threads the pool manager adds to each pool of a
+ * service when all of its threads are busy and transports queue up. Such
+ * threads go away again once they find nothing to do. 0 turns this off.
+ */
+static unsigned int svc_max_dynamic_threads __read_mostly;
+module_param(svc_max_dynamic_threads, uint, 0644);
 
 #define svc_serv_is_pooled(serv)    ((serv)->sv_function)
 
@@ -481,6 +489,7 @@ __svc_create(struct svc_program *prog, unsigned int bufsize, int npools,
 				i, serv->sv_name);
 
 		pool->sp_id = i;
+		init_llist_head(&pool->sp_new_sockets);
 		INIT_LIST_HEAD(&pool->sp_sockets);
 		INIT_LIST_HEAD(&pool->sp_all_threads);
 		spin_lock_init(&pool->sp_lock);
@@ -517,12 +526,35 @@ svc_pool_manager_should_sleep(struct svc_serv *serv, int nthreads)
 	/* did someone want to create new threads? */
 	for (i = 0; i < serv->sv_nrpools; i++) {
 		struct svc_pool *pool = &serv->sv_pools[i];
-		if (pool->sp_tmpthreads < atomic_read(&pool->sp_need_rescue))
+		if (pool->sp_tmpthreads - pool->sp_dynthreads <
+		    atomic_read(&pool->sp_need_rescue))
+			return false;
+		if (test_bit(SP_NEED_THREAD, &pool->sp_flags))
 			return false;
 	}
 	return true;
 }
 
+/*
+ * Pick the kind of thread to start in a pool, if any: rescuing an xprt
+ * that has nothing in flight comes first, then growing a busy pool.
+ */
+static int
+svc_pool_want_thread(struct svc_serv *serv, struct svc_pool *pool)
+{
+	if (pool->sp_tmpthreads - pool->sp_dynthreads <
+	    atomic_read(&pool->sp_need_rescue))
+		return RQ_RESCUE;
+
+	if (test_and_clear_bit(SP_NEED_THREAD, &pool->sp_flags) &&
+	    pool->sp_dynthreads < serv->sv_max_dynthreads &&
+	    (!list_empty(&pool->sp_sockets) ||
+	     !llist_empty(&pool->sp_new_sockets)))
+		return RQ_DYNAMIC;
+
+	return -1;
+}
+
 static int
 svc_pool_manager(void *data)
 {
@@ -566,11 +598,13 @@ svc_pool_manager(void *data)
 			int cpu = svc_pool_map_get_node(i);
 			struct task_struct *task;
 			struct svc_rqst *rqstp;
+			int tmpflag;
 
-			if (pool->sp_tmpthreads >= atomic_read(&pool->sp_need_rescue))
+			tmpflag = svc_pool_want_thread(serv, pool);
+			if (tmpflag < 0)
 				continue;
 
-			rqstp = __svc_prepare_thread(serv, pool, cpu, true);
+			rqstp = __svc_prepare_thread(serv, pool, cpu, tmpflag);
 			if (!rqstp) {
 				dprintk("svc: failed to prepare new thread\n");
 				break;
@@ -619,6 +653,7 @@ svc_create_pooled(struct svc_program *prog, unsigned int bufsize,
 
 	if (run_once_func) {
 		serv->sv_run_once = run_once_func;
+		serv->sv_max_dynthreads = svc_max_dynamic_threads;
 		serv->sv_pool_mgr = kthread_run(svc_pool_manager,
 					serv, "%s-mgr", serv->sv_name);
 		if (IS_ERR(serv->sv_pool_mgr)) {
@@ -726,7 +761,7 @@ svc_release_buffer(struct svc_rqst *rqstp)
 
 static struct svc_rqst *
 __svc_prepare_thread(struct svc_serv *serv, struct svc_pool *pool, int node,
-		bool istmp)
+		int tmpflag)
 	__must_hold(&serv->sv_pool_mutex)
 {
 	struct svc_rqst	*rqstp;
@@ -741,9 +776,11 @@ __svc_prepare_thread(struct svc_serv *serv, struct svc_pool *pool, int node,
 	rqstp->rq_server = serv;
 	rqstp->rq_pool = pool;
 	spin_lock_bh(&pool->sp_lock);
-	if (istmp) {
-		__set_bit(RQ_RESCUE, &rqstp->rq_flags);
+	if (tmpflag >= 0) {
+		__set_bit(tmpflag, &rqstp->rq_flags);
 		pool->sp_tmpthreads++;
+		if (tmpflag == RQ_DYNAMIC)
+			pool->sp_dynthreads++;
 	}
 	pool->sp_nrthreads++;
 	list_add_rcu(&rqstp->rq_all, &pool->sp_all_threads);
@@ -775,7 +812,7 @@ svc_prepare_thread(struct svc_serv *serv, struct svc_pool *pool, int node)
 	struct svc_rqst *rqstp;
 
 	mutex_lock(&serv->sv_pool_mutex);
-	rqstp = __svc_prepare_thread(serv, pool, node, false);
+	rqstp = __svc_prepare_thread(serv, pool, node, -1);
 	mutex_unlock(&serv->sv_pool_mutex);
 	return rqstp;
 }
@@ -825,7 +862,8 @@ found_pool:
 		 * so we don't try to kill it again.
 		 */
 		list_for_each_entry_rcu(rqstp, &pool->sp_all_threads, rq_all) {
-			if (test_bit(RQ_RESCUE, &rqstp->rq_flags))
+			if (test_bit(RQ_RESCUE, &rqstp->rq_flags) ||
+			    test_bit(RQ_DYNAMIC, &rqstp->rq_flags))
 				continue;
 			task = rqstp->rq_task;
 			if (!task)
@@ -965,8 +1003,12 @@ svc_exit_thread(struct svc_rqst *rqstp)
 	if (test_bit(RQ_RESCUE, &rqstp->rq_flags)) {
 		pool->sp_tmpthreads--;
 		/* Handle races with svc_xprt_do_enqueue() */
-		if (pool->sp_tmpthreads < atomic_read(&pool->sp_need_rescue))
+		if (pool->sp_tmpthreads - pool->sp_dynthreads <
+		    atomic_read(&pool->sp_need_rescue))
 			wake_up_process(serv->sv_pool_mgr);
+	} else if (test_bit(RQ_DYNAMIC, &rqstp->rq_flags)) {
+		pool->sp_tmpthreads--;
+		pool->sp_dynthreads--;
 	}
 	if (!test_and_set_bit(RQ_VICTIM, &rqstp->rq_flags))
 		list_del_rcu(&rqstp->rq_all);
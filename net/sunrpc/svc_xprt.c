@@ -36,6 +36,11 @@ static void svc_xprt_do_enqueue(struct svc_xprt *xprt);
  */
 static int svc_conn_age_period = 6*60;
 
+/* How long a thread started for queue pressure waits for work before it
+ * goes away again.
+ */
+#define SVC_DYNAMIC_IDLE	(30 * HZ)
+
 /* List of registered transport classes */
 static DEFINE_SPINLOCK(svc_xprt_class_lock);
 static LIST_HEAD(svc_xprt_class_list);
@@ -362,16 +367,45 @@ static bool svc_xprt_has_something_to_do(struct svc_xprt *xprt)
 	return false;
 }
 
+/*
+ * Transports are queued from data_ready callbacks in softirq context on
+ * every cpu of the pool, so they only go on a lockless list here. XPT_BUSY
+ * keeps a transport from being queued twice. Threads looking for work sort
+ * the new ones into sp_sockets under sp_lock.
+ */
 static void
 svc_queue_xprt_to_pool(struct svc_xprt *xprt, struct svc_pool *pool)
 {
-	spin_lock_bh(&pool->sp_lock);
-	if (test_bit(XPT_CLOSE, &xprt->xpt_flags))
-		list_add(&xprt->xpt_ready, &pool->sp_sockets);
-	else
-		list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
-	pool->sp_stats.sockets_queued++;
-	spin_unlock_bh(&pool->sp_lock);
+	llist_add(&xprt->xpt_qnode, &pool->sp_new_sockets);
+	atomic_long_inc(&pool->sp_stats.sockets_queued);
+}
+
+static void
+svc_pool_sort_new_xprts(struct svc_pool *pool)
+	__must_hold(&pool->sp_lock)
+{
+	struct llist_node *first;
+	struct svc_xprt *xprt, *next;
+
+	first = llist_del_all(&pool->sp_new_sockets);
+	if (!first)
+		return;
+
+	/* keep arrival order, closes still go first */
+	first = llist_reverse_order(first);
+	llist_for_each_entry_safe(xprt, next, first, xpt_qnode) {
+		if (test_bit(XPT_CLOSE, &xprt->xpt_flags))
+			list_add(&xprt->xpt_ready, &pool->sp_sockets);
+		else
+			list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
+	}
+}
+
+static inline bool
+svc_pool_has_xprts(struct svc_pool *pool)
+{
+	return !list_empty(&pool->sp_sockets) ||
+	       !llist_empty(&pool->sp_new_sockets);
 }
 
 static void
@@ -447,7 +481,7 @@ redo_search:
 		if (!queued) {
 			spin_lock_bh(&rqstp->rq_lock);
 			/* Enforce queue ordering */
-			if (!list_empty(&pool->sp_sockets)) {
+			if (svc_pool_has_xprts(pool)) {
 				spin_unlock_bh(&rqstp->rq_lock);
 				break;
 			}
@@ -496,6 +530,17 @@ redo_search:
 			atomic_inc(&pool->sp_need_rescue);
 			atomic_long_inc(&pool->sp_stats.threads_woken);
 			wake_up_process(serv->sv_pool_mgr);
+		} else if (serv->sv_pool_mgr &&
+			   pool->sp_dynthreads < serv->sv_max_dynthreads &&
+			   !list_empty(&pool->sp_all_threads) &&
+			   !test_and_set_bit(SP_NEED_THREAD, &pool->sp_flags)) {
+			/*
+			 * All threads are busy and the queue is building up:
+			 * have the manager add a thread to this pool. Only
+			 * one request is outstanding per pool at a time, so
+			 * the pool grows by one thread per burst of misses.
+			 */
+			wake_up_process(serv->sv_pool_mgr);
 		}
 		goto redo_search;
 	}
@@ -529,10 +574,11 @@ static struct svc_xprt *svc_xprt_dequeue(struct svc_pool *pool, bool rescue)
 	int inflight;
 	int prev_inflight = INT_MAX;
 
-	if (list_empty(&pool->sp_sockets))
+	if (!svc_pool_has_xprts(pool))
 		goto out;
 
 	spin_lock_bh(&pool->sp_lock);
+	svc_pool_sort_new_xprts(pool);
 	if (likely(!list_empty(&pool->sp_sockets))) {
 		list_for_each_entry(xprt, &pool->sp_sockets, xpt_ready) {
 			/* Handle transport close and connection first! */
@@ -780,7 +826,7 @@ rqst_should_sleep(struct svc_rqst *rqstp)
 		return false;
 
 	/* was a socket queued? */
-	if (!list_empty(&pool->sp_sockets))
+	if (svc_pool_has_xprts(pool))
 		return false;
 
 	/* are we shutting down? */
@@ -847,6 +893,9 @@ static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 	clear_bit(RQ_BUSY, &rqstp->rq_flags);
 	smp_mb();
 
+	if (test_bit(RQ_DYNAMIC, &rqstp->rq_flags))
+		timeout = min_t(long, timeout, SVC_DYNAMIC_IDLE);
+
 	if (likely(rqst_should_sleep(rqstp)))
 		time_left = schedule_timeout(timeout);
 	else
@@ -865,6 +914,10 @@ static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 	if (!time_left)
 		atomic_long_inc(&pool->sp_stats.threads_timedout);
 
+	/* The pressure it was started for is gone */
+	if (!time_left && test_bit(RQ_DYNAMIC, &rqstp->rq_flags))
+		return ERR_PTR(-EINTR);
+
 	if (signalled() || kthread_should_stop())
 		return ERR_PTR(-EINTR);
 	return ERR_PTR(-EAGAIN);
@@ -1174,6 +1227,7 @@ static struct svc_xprt *svc_dequeue_net(struct svc_serv *serv, struct net *net)
 		pool = &serv->sv_pools[i];
 
 		spin_lock_bh(&pool->sp_lock);
+		svc_pool_sort_new_xprts(pool);
 		list_for_each_entry_safe(xprt, tmp, &pool->sp_sockets, xpt_ready) {
 			if (xprt->xpt_net != net)
 				continue;
@@ -1497,7 +1551,7 @@ static int svc_pool_stats_show(struct seq_file *m, void *p)
 	seq_printf(m, "%u %lu %lu %lu %lu\n",
 		pool->sp_id,
 		(unsigned long)atomic_long_read(&pool->sp_stats.packets),
-		pool->sp_stats.sockets_queued,
+		(unsigned long)atomic_long_read(&pool->sp_stats.sockets_queued),
 		(unsigned long)atomic_long_read(&pool->sp_stats.threads_woken),
 		(unsigned long)atomic_long_read(&pool->sp_stats.threads_timedout));
 
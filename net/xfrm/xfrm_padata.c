@@ -0,0 +1,124 @@
+/*
+ * Parallel crypto for xfrm states.
+ *
+ * The crypto requests of states flagged with XFRM_SA_XFLAG_PARALLEL are
+ * handed to padata, which runs them on all CPUs and calls the completions
+ * back on the submitting CPU in the order the requests were submitted,
+ * so the packets of an SA leave in sequence number order.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <linux/crypto.h>
+#include <linux/export.h>
+#include <linux/init.h>
+#include <linux/padata.h>
+#include <linux/smp.h>
+#include <linux/workqueue.h>
+#include <net/xfrm.h>
+
+static struct padata_instance *xfrm_padata __read_mostly;
+
+static void xfrm_crypto_serial(struct padata_priv *padata)
+{
+	struct xfrm_crypto_job *job = container_of(padata,
+						   struct xfrm_crypto_job,
+						   padata);
+	struct crypto_async_request *base = job->base;
+
+	/* the completion may free the job */
+	base->complete = job->complete;
+	base->data = job->data;
+	base->complete(base, padata->info);
+}
+
+static void xfrm_crypto_done(struct crypto_async_request *base, int err)
+{
+	struct xfrm_crypto_job *job = base->data;
+
+	job->padata.info = err;
+
+	local_bh_disable();
+	padata_do_serial(&job->padata);
+	local_bh_enable();
+}
+
+/* Called by padata in softirq context on one of the parallel CPUs */
+static void xfrm_crypto_run(struct padata_priv *padata)
+{
+	struct xfrm_crypto_job *job = container_of(padata,
+						   struct xfrm_crypto_job,
+						   padata);
+	int err;
+
+	err = job->crypt(job->base);
+	if (err == -EINPROGRESS)
+		return;
+
+	padata->info = err;
+	padata_do_serial(padata);
+}
+
+bool xfrm_crypto_can_parallel(const struct xfrm_state *x)
+{
+	return (x->props.extra_flags & XFRM_SA_XFLAG_PARALLEL) && xfrm_padata;
+}
+EXPORT_SYMBOL_GPL(xfrm_crypto_can_parallel);
+
+/* Runs @crypt on @base somewhere else and calls the completion of @base
+ * once all the requests submitted before on this CPU are done.  Returns
+ * -EINPROGRESS or an error, in which case @base was not run.
+ */
+int xfrm_crypto_parallel(struct xfrm_crypto_job *job,
+			 struct crypto_async_request *base,
+			 int (*crypt)(struct crypto_async_request *base))
+{
+	int err, cpu;
+
+	memset(&job->padata, 0, sizeof(job->padata));
+	job->padata.parallel = xfrm_crypto_run;
+	job->padata.serial = xfrm_crypto_serial;
+	job->base = base;
+	job->crypt = crypt;
+	job->complete = base->complete;
+	job->data = base->data;
+
+	base->complete = xfrm_crypto_done;
+	base->data = job;
+
+	cpu = get_cpu();
+	err = padata_do_parallel(xfrm_padata, &job->padata, cpu);
+	put_cpu();
+	if (!err)
+		return -EINPROGRESS;
+
+	base->complete = job->complete;
+	base->data = job->data;
+	return err;
+}
+EXPORT_SYMBOL_GPL(xfrm_crypto_parallel);
+
+void __init xfrm_padata_init(void)
+{
+	struct workqueue_struct *wq;
+
+	wq = alloc_workqueue("xfrm_crypto",
+			     WQ_MEM_RECLAIM | WQ_CPU_INTENSIVE, 1);
+	if (!wq)
+		goto err;
+
+	xfrm_padata = padata_alloc_possible(wq);
+	if (!xfrm_padata)
+		goto err_destroy_wq;
+
+	padata_start(xfrm_padata);
+	return;
+
+err_destroy_wq:
+	destroy_workqueue(wq);
+err:
+	pr_warn("xfrm: parallel crypto unavailable\n");
+}
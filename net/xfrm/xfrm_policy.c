@@ -3063,6 +3063,7 @@ void __init xfrm_init(void)
 {
 	register_pernet_subsys(&xfrm_net_ops);
 	xfrm_input_init();
+	xfrm_padata_init();
 }
 
 #ifdef CONFIG_AUDITSYSCALL
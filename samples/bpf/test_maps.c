@@ -142,7 +142,163 @@ static void test_arraymap_sanity(int i, void *data)
 	close(map_fd);
 }
 
+/* per-cpu maps exchange one value per possible cpu with user space */
+static void test_hashmap_percpu(int task, void *data)
+{
+	unsigned int nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	long long key, next_key, value[nr_cpus];
+	int map_fd, i;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_PERCPU_HASH, sizeof(key),
+				sizeof(value[0]), 2);
+	if (map_fd < 0) {
+		printf("failed to create percpu hashmap '%s'\n", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < nr_cpus; i++)
+		value[i] = i + 100;
+
+	key = 1;
+	/* insert key=1 element with a different value on each cpu */
+	assert(bpf_update_elem(map_fd, &key, value, BPF_ANY) == 0);
+
+	assert(bpf_update_elem(map_fd, &key, value, BPF_NOEXIST) == -1 &&
+	       errno == EEXIST);
+
+	/* check that key=1 can be found and all cpu values came back */
+	memset(value, 0, sizeof(value));
+	assert(bpf_lookup_elem(map_fd, &key, value) == 0);
+	for (i = 0; i < nr_cpus; i++)
+		assert(value[i] == i + 100);
+
+	key = 2;
+	assert(bpf_lookup_elem(map_fd, &key, value) == -1 && errno == ENOENT);
+	assert(bpf_update_elem(map_fd, &key, value, BPF_EXIST) == -1 &&
+	       errno == ENOENT);
+
+	/* insert key=2 element, then check the max_entries limit */
+	assert(bpf_update_elem(map_fd, &key, value, BPF_NOEXIST) == 0);
+	key = 0;
+	assert(bpf_update_elem(map_fd, &key, value, BPF_NOEXIST) == -1 &&
+	       errno == E2BIG);
+
+	/* iterate over two elements */
+	assert(bpf_get_next_key(map_fd, &key, &next_key) == 0 &&
+	       (next_key == 1 || next_key == 2));
+	assert(bpf_get_next_key(map_fd, &next_key, &next_key) == 0 &&
+	       (next_key == 1 || next_key == 2));
+	assert(bpf_get_next_key(map_fd, &next_key, &next_key) == -1 &&
+	       errno == ENOENT);
+
+	/* delete both elements */
+	key = 1;
+	assert(bpf_delete_elem(map_fd, &key) == 0);
+	key = 2;
+	assert(bpf_delete_elem(map_fd, &key) == 0);
+	assert(bpf_delete_elem(map_fd, &key) == -1 && errno == ENOENT);
+
+	close(map_fd);
+}
+
+static void test_arraymap_percpu(int task, void *data)
+{
+	unsigned int nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	long long value[nr_cpus];
+	int key, map_fd, i;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(key),
+				sizeof(value[0]), 2);
+	if (map_fd < 0) {
+		printf("failed to create percpu arraymap '%s'\n", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < nr_cpus; i++)
+		value[i] = i + 100;
+
+	key = 1;
+	assert(bpf_update_elem(map_fd, &key, value, BPF_ANY) == 0);
+	assert(bpf_update_elem(map_fd, &key, value, BPF_NOEXIST) == -1 &&
+	       errno == EEXIST);
+
+	memset(value, 0, sizeof(value));
+	assert(bpf_lookup_elem(map_fd, &key, value) == 0);
+	for (i = 0; i < nr_cpus; i++)
+		assert(value[i] == i + 100);
+
+	/* check that key=0 is also found and zero initialized on all cpus */
+	key = 0;
+	assert(bpf_lookup_elem(map_fd, &key, value) == 0);
+	for (i = 0; i < nr_cpus; i++)
+		assert(value[i] == 0);
+
+	key = 2;
+	assert(bpf_update_elem(map_fd, &key, value, BPF_EXIST) == -1 &&
+	       errno == E2BIG);
+	assert(bpf_lookup_elem(map_fd, &key, value) == -1 && errno == ENOENT);
+
+	/* delete shouldn't succeed */
+	key = 1;
+	assert(bpf_delete_elem(map_fd, &key) == -1 && errno == EINVAL);
+
+	close(map_fd);
+}
+
 #define MAP_SIZE (32 * 1024)
+static void test_prog_array(void)
+{
+	struct bpf_insn prog[] = {
+		BPF_MOV64_IMM(BPF_REG_0, 0),
+		BPF_EXIT_INSN(),
+	};
+	int key, map_fd, sock_fd, cls_fd, value;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_PROG_ARRAY, sizeof(key),
+				sizeof(value), 2);
+	if (map_fd < 0) {
+		printf("failed to create prog array '%s'\n", strerror(errno));
+		exit(1);
+	}
+
+	sock_fd = bpf_prog_load(BPF_PROG_TYPE_SOCKET_FILTER, prog, sizeof(prog),
+				"GPL", 0);
+	cls_fd = bpf_prog_load(BPF_PROG_TYPE_SCHED_CLS, prog, sizeof(prog),
+			       "GPL", 0);
+	if (sock_fd < 0 || cls_fd < 0) {
+		printf("failed to load prog '%s'\n", strerror(errno));
+		exit(1);
+	}
+
+	key = 0;
+	assert(bpf_update_elem(map_fd, &key, &sock_fd, BPF_ANY) == 0);
+
+	/* the first program stored decides the type of all others */
+	key = 1;
+	assert(bpf_update_elem(map_fd, &key, &cls_fd, BPF_ANY) == -1 &&
+	       errno == EINVAL);
+
+	/* only program fds can be stored */
+	assert(bpf_update_elem(map_fd, &key, &map_fd, BPF_ANY) == -1 &&
+	       errno == EINVAL);
+
+	key = 2;
+	assert(bpf_update_elem(map_fd, &key, &sock_fd, BPF_ANY) == -1 &&
+	       errno == E2BIG);
+
+	/* the stored fds are not handed back to user space */
+	key = 0;
+	assert(bpf_lookup_elem(map_fd, &key, &value) == -1 && errno == ENOENT);
+
+	/* the map keeps the program alive after its fd is closed */
+	close(sock_fd);
+	assert(bpf_delete_elem(map_fd, &key) == 0);
+	assert(bpf_delete_elem(map_fd, &key) == -1 && errno == ENOENT);
+
+	close(cls_fd);
+	close(map_fd);
+}
+
 static void test_map_large(void)
 {
 	struct bigkey {
@@ -283,6 +439,9 @@ int main(void)
 {
 	test_hashmap_sanity(0, NULL);
 	test_arraymap_sanity(0, NULL);
+	test_hashmap_percpu(0, NULL);
+	test_arraymap_percpu(0, NULL);
+	test_prog_array();
 	test_map_large();
 	test_map_parallel();
 	test_map_stress();
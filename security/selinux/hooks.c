@@ -2862,11 +2862,30 @@ static int selinux_inode_readlink(struct dentry *dentry)
 	return dentry_has_perm(cred, dentry, FILE__READ);
 }
 
-static int selinux_inode_follow_link(struct dentry *dentry, struct nameidata *nameidata)
+static int selinux_inode_follow_link(struct dentry *dentry, struct inode *inode,
+				     bool rcu)
 {
 	const struct cred *cred = current_cred();
+	struct inode_security_struct *isec;
+	struct av_decision avd;
+	u32 sid, audited, denied;
+	int rc;
 
-	return dentry_has_perm(cred, dentry, FILE__READ);
+	if (!rcu)
+		return dentry_has_perm(cred, dentry, FILE__READ);
+
+	validate_creds(cred);
+	sid = cred_sid(cred);
+	isec = inode->i_security;
+
+	rc = avc_has_perm_noaudit(sid, isec->sid, isec->sclass, FILE__READ,
+				  0, &avd);
+	audited = avc_audit_required(FILE__READ, &avd, rc, 0, &denied);
+	if (likely(!audited))
+		return rc;
+
+	/* Auditing the dentry name isn't rcu-safe, redo it in ref-walk */
+	return -ECHILD;
 }
 
 static noinline int audit_inode_permission(struct inode *inode,
@@ -0,0 +1,264 @@
+/*
+ * block-aio.c
+ *
+ * block aio: drive a block device (null_blk by default) with O_DIRECT
+ * native aio at a fixed queue depth and report IOPS, bandwidth and the
+ * per-request completion latency distribution.
+ *
+ * Using null_blk takes the media out of the picture, so the numbers
+ * reflect the cost of the aio, block layer and driver submission paths.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+#include "latency.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+
+static const char	*device		= "/dev/nullb0";
+static unsigned int	block_size	= 4096;
+static unsigned int	queue_depth	= 32;
+static unsigned int	nsecs		= 5;
+static bool		do_write;
+static bool		do_random;
+
+static const struct option options[] = {
+	OPT_STRING('d', "device", &device, "dev",
+		   "Block device to benchmark (default: /dev/nullb0)"),
+	OPT_UINTEGER('b', "block-size", &block_size,
+		     "Size of each I/O in bytes (default: 4096)"),
+	OPT_UINTEGER('q', "queue-depth", &queue_depth,
+		     "Number of I/Os kept in flight (default: 32)"),
+	OPT_UINTEGER('r', "runtime", &nsecs, "Specify runtime (in seconds)"),
+	OPT_BOOLEAN('w', "write", &do_write,
+		    "Issue writes instead of reads (destroys device data)"),
+	OPT_BOOLEAN('R', "random", &do_random,
+		    "Use random instead of sequential offsets"),
+	OPT_END()
+};
+
+static const char * const bench_block_aio_usage[] = {
+	"perf bench block aio <options>",
+	NULL
+};
+
+struct aio_slot {
+	struct iocb	iocb;
+	void		*buf;
+	u64		start;
+};
+
+static u64 dev_size, next_offset;
+
+static inline int io_setup(unsigned int nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static inline int io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static inline int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+static inline int io_getevents(aio_context_t ctx, long min_nr, long nr,
+			       struct io_event *events)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, NULL);
+}
+
+static u64 pick_offset(void)
+{
+	u64 nr_blocks = dev_size / block_size;
+	u64 off;
+
+	if (do_random)
+		return ((u64)random() * RAND_MAX + random()) % nr_blocks *
+			block_size;
+
+	off = next_offset;
+	next_offset += block_size;
+	if (next_offset + block_size > dev_size)
+		next_offset = 0;
+	return off;
+}
+
+static void prep_slot(struct aio_slot *slot, int fd)
+{
+	struct iocb *iocb = &slot->iocb;
+
+	memset(iocb, 0, sizeof(*iocb));
+	iocb->aio_data = (u64)(unsigned long)slot;
+	iocb->aio_lio_opcode = do_write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+	iocb->aio_fildes = fd;
+	iocb->aio_buf = (u64)(unsigned long)slot->buf;
+	iocb->aio_nbytes = block_size;
+	iocb->aio_offset = pick_offset();
+	slot->start = bench_now_ns();
+}
+
+int bench_block_aio(int argc, const char **argv,
+		    const char *prefix __maybe_unused)
+{
+	struct aio_slot *slots;
+	struct iocb **iocbs;
+	struct io_event *events;
+	struct lat_samples lat;
+	aio_context_t ctx = 0;
+	unsigned long nr_submit = 0, nr_getevents = 0;
+	unsigned int i, inflight;
+	u64 start, deadline, end, ios = 0;
+	double secs;
+	int fd, ret;
+
+	argc = parse_options(argc, argv, options, bench_block_aio_usage, 0);
+	if (argc) {
+		usage_with_options(bench_block_aio_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!queue_depth || !block_size || block_size % 512) {
+		fprintf(stderr, "queue depth must be non-zero and block size a multiple of 512\n");
+		return 1;
+	}
+
+	fd = open(device, (do_write ? O_WRONLY : O_RDONLY) | O_DIRECT);
+	if (fd < 0)
+		err(EXIT_FAILURE, "open %s", device);
+	if (ioctl(fd, BLKGETSIZE64, &dev_size))
+		err(EXIT_FAILURE, "BLKGETSIZE64 %s", device);
+	if (dev_size < block_size) {
+		fprintf(stderr, "%s is smaller than one block\n", device);
+		return 1;
+	}
+
+	slots = calloc(queue_depth, sizeof(*slots));
+	iocbs = calloc(queue_depth, sizeof(*iocbs));
+	events = calloc(queue_depth, sizeof(*events));
+	if (!slots || !iocbs || !events)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < queue_depth; i++) {
+		if (posix_memalign(&slots[i].buf, 4096, block_size))
+			err(EXIT_FAILURE, "posix_memalign");
+		memset(slots[i].buf, 0x5a, block_size);
+	}
+
+	if (io_setup(queue_depth, &ctx))
+		err(EXIT_FAILURE, "io_setup");
+
+	lat_init(&lat);
+
+	start = bench_now_ns();
+	deadline = start + (u64)nsecs * 1000000000ULL;
+
+	for (i = 0; i < queue_depth; i++) {
+		prep_slot(&slots[i], fd);
+		iocbs[i] = &slots[i].iocb;
+	}
+	ret = io_submit(ctx, queue_depth, iocbs);
+	nr_submit++;
+	if (ret != (int)queue_depth)
+		err(EXIT_FAILURE, "io_submit");
+	inflight = queue_depth;
+
+	while (inflight) {
+		bool done;
+		u64 now;
+		int nr, resubmit = 0;
+
+		nr = io_getevents(ctx, 1, queue_depth, events);
+		nr_getevents++;
+		if (nr < 0)
+			err(EXIT_FAILURE, "io_getevents");
+
+		now = bench_now_ns();
+		done = now >= deadline;
+
+		for (i = 0; i < (unsigned int)nr; i++) {
+			struct aio_slot *slot;
+
+			slot = (struct aio_slot *)(unsigned long)events[i].data;
+			if (events[i].res != block_size) {
+				errno = -(long)events[i].res;
+				err(EXIT_FAILURE, "aio %s", do_write ? "write" : "read");
+			}
+
+			lat_add(&lat, now - slot->start);
+			ios++;
+			inflight--;
+
+			if (done)
+				continue;
+			prep_slot(slot, fd);
+			iocbs[resubmit++] = &slot->iocb;
+		}
+
+		if (resubmit) {
+			ret = io_submit(ctx, resubmit, iocbs);
+			nr_submit++;
+			if (ret != resubmit)
+				err(EXIT_FAILURE, "io_submit");
+			inflight += resubmit;
+		}
+	}
+	end = bench_now_ns();
+	secs = (end - start) / 1e9;
+
+	io_destroy(ctx);
+	close(fd);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s: %s %s, %u bytes, queue depth %u\n", device,
+		       do_random ? "random" : "sequential",
+		       do_write ? "writes" : "reads", block_size, queue_depth);
+		printf(" %14s: %.0f IOPS\n", "throughput", ios / secs);
+		printf(" %14s: %.2f MB/s\n", "bandwidth",
+		       ios * block_size / secs / (1024 * 1024));
+		printf(" %14s: %.1f IOs/call\n", "io_submit",
+		       (double)ios / nr_submit);
+		printf(" %14s: %.1f IOs/call\n", "io_getevents",
+		       (double)ios / nr_getevents);
+		lat_print(&lat, "aio");
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("aio_ios=%llu\n", (unsigned long long)ios);
+		printf("aio_iops=%.0f\n", ios / secs);
+		printf("aio_mb_per_sec=%.2f\n",
+		       ios * block_size / secs / (1024 * 1024));
+		printf("aio_submit_calls=%lu\n", nr_submit);
+		printf("aio_getevents_calls=%lu\n", nr_getevents);
+		lat_print(&lat, "aio");
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	lat_free(&lat);
+	for (i = 0; i < queue_depth; i++)
+		free(slots[i].buf);
+	free(events);
+	free(iocbs);
+	free(slots);
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * latency.c
+ *
+ * Latency sample collection and percentile reporting shared by the
+ * block and net benchmarks.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "bench.h"
+#include "latency.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void lat_init(struct lat_samples *lat)
+{
+	lat->ns = NULL;
+	lat->nr = 0;
+	lat->alloc = 0;
+}
+
+void lat_add(struct lat_samples *lat, u64 ns)
+{
+	if (lat->nr == lat->alloc) {
+		size_t alloc = lat->alloc ? lat->alloc * 2 : 4096;
+		u64 *p = realloc(lat->ns, alloc * sizeof(*p));
+
+		if (!p)
+			err(EXIT_FAILURE, "realloc");
+		lat->ns = p;
+		lat->alloc = alloc;
+	}
+	lat->ns[lat->nr++] = ns;
+}
+
+void lat_free(struct lat_samples *lat)
+{
+	free(lat->ns);
+	lat_init(lat);
+}
+
+static int lat_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* nearest-rank percentile of a sorted sample set */
+static u64 lat_percentile(struct lat_samples *lat, double pct)
+{
+	size_t idx = (size_t)(pct / 100.0 * lat->nr);
+
+	if (idx >= lat->nr)
+		idx = lat->nr - 1;
+	return lat->ns[idx];
+}
+
+static const double lat_pcts[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+
+/*
+ * Print min/avg/max and the percentiles above in usecs.  The simple
+ * format emits one "name_metric=value" pair per line so results can
+ * be collected by scripts.
+ */
+void lat_print(struct lat_samples *lat, const char *name)
+{
+	double sum = 0;
+	size_t i;
+
+	if (!lat->nr)
+		return;
+
+	qsort(lat->ns, lat->nr, sizeof(*lat->ns), lat_cmp);
+	for (i = 0; i < lat->nr; i++)
+		sum += lat->ns[i];
+
+	if (bench_format == BENCH_FORMAT_SIMPLE) {
+		printf("%s_lat_min_usec=%.3f\n", name, lat->ns[0] / 1000.0);
+		printf("%s_lat_avg_usec=%.3f\n", name, sum / lat->nr / 1000.0);
+		for (i = 0; i < ARRAY_SIZE(lat_pcts); i++)
+			printf("%s_lat_p%g_usec=%.3f\n", name, lat_pcts[i],
+			       lat_percentile(lat, lat_pcts[i]) / 1000.0);
+		printf("%s_lat_max_usec=%.3f\n", name,
+		       lat->ns[lat->nr - 1] / 1000.0);
+		return;
+	}
+
+	printf(" %14s: %zu samples\n", "latency", lat->nr);
+	printf(" %14s: %.3f usecs\n", "min", lat->ns[0] / 1000.0);
+	printf(" %14s: %.3f usecs\n", "avg", sum / lat->nr / 1000.0);
+	for (i = 0; i < ARRAY_SIZE(lat_pcts); i++) {
+		char label[16];
+
+		snprintf(label, sizeof(label), "p%g", lat_pcts[i]);
+		printf(" %14s: %.3f usecs\n", label,
+		       lat_percentile(lat, lat_pcts[i]) / 1000.0);
+	}
+	printf(" %14s: %.3f usecs\n", "max", lat->ns[lat->nr - 1] / 1000.0);
+}
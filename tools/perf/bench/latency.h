@@ -0,0 +1,31 @@
+#ifndef BENCH_LATENCY_H
+#define BENCH_LATENCY_H
+
+#include <linux/types.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Per-operation latency samples, kept in full so that percentiles can
+ * be reported without binning error.
+ */
+struct lat_samples {
+	u64	*ns;
+	size_t	nr;
+	size_t	alloc;
+};
+
+static inline u64 bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void lat_init(struct lat_samples *lat);
+void lat_add(struct lat_samples *lat, u64 ns);
+void lat_free(struct lat_samples *lat);
+void lat_print(struct lat_samples *lat, const char *name);
+
+#endif /* BENCH_LATENCY_H */
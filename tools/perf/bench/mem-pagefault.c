@@ -0,0 +1,172 @@
+/*
+ * mem-pagefault.c
+ *
+ * mem pagefault: measure anonymous page fault scalability.  Each thread
+ * repeatedly mmap()s a private anonymous region, touches every page of
+ * it and munmap()s it again.  The run is repeated for 1, 2, 4, ... up to
+ * the requested number of threads so that contention on mmap_sem and the
+ * page allocator shows up as sub-linear scaling of faults per second.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+#include "latency.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+static unsigned int	max_threads;
+static unsigned int	nsecs		= 1;
+static const char	*size_str	= "16MB";
+static bool		use_thp;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &max_threads,
+		     "Maximum number of threads (default: number of CPUs)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Runtime of each step (in seconds)"),
+	OPT_STRING('s', "size", &size_str, "16MB",
+		   "Size of the region each thread maps and touches"),
+	OPT_BOOLEAN('H', "thp", &use_thp,
+		    "Allow transparent hugepages for the region"),
+	OPT_END()
+};
+
+static const char * const bench_mem_pagefault_usage[] = {
+	"perf bench mem pagefault <options>",
+	NULL
+};
+
+struct pf_worker {
+	pthread_t	thread;
+	unsigned long	faults;
+};
+
+static size_t region_size;
+static volatile bool done;
+static pthread_barrier_t start_barrier;
+
+static void *workerfn(void *arg)
+{
+	struct pf_worker *w = arg;
+	size_t off;
+	char *p;
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!done) {
+		p = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			err(EXIT_FAILURE, "mmap");
+		madvise(p, region_size,
+			use_thp ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+
+		for (off = 0; off < region_size; off += page_size)
+			p[off] = 1;
+		w->faults += region_size / page_size;
+
+		munmap(p, region_size);
+	}
+
+	return NULL;
+}
+
+static double run_step(struct pf_worker *workers, unsigned int nthreads)
+{
+	unsigned long faults = 0;
+	unsigned int i;
+	u64 start;
+
+	done = false;
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i].faults = 0;
+		if (pthread_create(&workers[i].thread, NULL, workerfn,
+				   &workers[i]))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = bench_now_ns();
+	sleep(nsecs);
+	done = true;
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			err(EXIT_FAILURE, "pthread_join");
+		faults += workers[i].faults;
+	}
+	pthread_barrier_destroy(&start_barrier);
+
+	return faults / ((bench_now_ns() - start) / 1e9);
+}
+
+int bench_mem_pagefault(int argc, const char **argv,
+			const char *prefix __maybe_unused)
+{
+	struct pf_worker *workers;
+	unsigned int nthreads;
+	double rate, base = 0;
+
+	argc = parse_options(argc, argv, options, bench_mem_pagefault_usage, 0);
+	if (argc) {
+		usage_with_options(bench_mem_pagefault_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	region_size = perf_atoll(size_str);
+	if (!region_size || (s64)region_size < 0) {
+		fprintf(stderr, "Invalid size:%s\n", size_str);
+		return 1;
+	}
+	region_size = (region_size + page_size - 1) & ~(page_size - 1);
+
+	if (!max_threads)
+		max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	workers = calloc(max_threads, sizeof(*workers));
+	if (!workers)
+		err(EXIT_FAILURE, "calloc");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %zu bytes per thread, %u secs per step\n",
+		       region_size, nsecs);
+
+	for (nthreads = 1; ; nthreads *= 2) {
+		if (nthreads > max_threads)
+			nthreads = max_threads;
+
+		rate = run_step(workers, nthreads);
+		if (nthreads == 1)
+			base = rate;
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf(" %4u threads: %12.0f faults/sec, %10.0f per thread, scaling %.2fx\n",
+			       nthreads, rate, rate / nthreads, rate / base);
+			break;
+		case BENCH_FORMAT_SIMPLE:
+			printf("pagefault_threads_%u_faults_per_sec=%.0f\n",
+			       nthreads, rate);
+			break;
+		default:
+			/* reaching this means there's some disaster: */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+
+		if (nthreads == max_threads)
+			break;
+	}
+
+	free(workers);
+	return 0;
+}
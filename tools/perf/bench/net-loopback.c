@@ -0,0 +1,309 @@
+/*
+ * net-loopback.c
+ *
+ * net tcp-rr/udp-rr: ping-pong fixed size messages between a client and
+ * a server thread over loopback, reporting transactions per second and
+ * the round trip latency distribution.
+ *
+ * net tcp-stream: push data one way over a loopback TCP connection and
+ * report the throughput.
+ *
+ * Loopback removes the NIC from the picture, so these measure the cost
+ * of the socket, protocol and wakeup paths.  The per-syscall cost is the
+ * client's wall time divided by the number of send/recv calls it made.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+#include "latency.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+static unsigned int	msg_size;
+static unsigned int	size;
+static unsigned int	nsecs		= 5;
+
+static const struct option options[] = {
+	OPT_UINTEGER('s', "size", &msg_size,
+		     "Message size in bytes (default: 1 for rr, 65536 for stream)"),
+	OPT_UINTEGER('r', "runtime", &nsecs, "Specify runtime (in seconds)"),
+	OPT_END()
+};
+
+static const char * const bench_net_usage[] = {
+	"perf bench net tcp-rr <options>",
+	"perf bench net udp-rr <options>",
+	"perf bench net tcp-stream <options>",
+	NULL
+};
+
+enum net_mode {
+	NET_TCP_RR,
+	NET_UDP_RR,
+	NET_TCP_STREAM,
+};
+
+struct net_server {
+	enum net_mode	mode;
+	int		fd;
+	pthread_t	thread;
+};
+
+static const char *net_mode_name[] = {
+	[NET_TCP_RR]	 = "tcp_rr",
+	[NET_UDP_RR]	 = "udp_rr",
+	[NET_TCP_STREAM] = "tcp_stream",
+};
+
+/* returns 0 on orderly shutdown by the peer */
+static ssize_t read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t ret = read(fd, buf + done, len - done);
+
+		if (ret <= 0)
+			return ret;
+		done += ret;
+	}
+	return done;
+}
+
+static ssize_t write_full(int fd, const void *buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t ret = write(fd, buf + done, len - done);
+
+		if (ret < 0)
+			return ret;
+		done += ret;
+	}
+	return done;
+}
+
+static void set_nodelay(int fd)
+{
+	int one = 1;
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+		err(EXIT_FAILURE, "setsockopt TCP_NODELAY");
+}
+
+static void *serverfn(void *arg)
+{
+	struct net_server *srv = arg;
+	char *buf = malloc(size);
+	int fd;
+
+	if (!buf)
+		err(EXIT_FAILURE, "malloc");
+
+	if (srv->mode == NET_UDP_RR) {
+		struct sockaddr_in peer;
+		socklen_t plen;
+		ssize_t ret;
+
+		/* a zero length datagram tells us the client is done */
+		for (;;) {
+			plen = sizeof(peer);
+			ret = recvfrom(srv->fd, buf, size, 0,
+				       (struct sockaddr *)&peer, &plen);
+			if (ret <= 0)
+				break;
+			if (sendto(srv->fd, buf, ret, 0,
+				   (struct sockaddr *)&peer, plen) != ret)
+				err(EXIT_FAILURE, "sendto");
+		}
+		goto out;
+	}
+
+	fd = accept(srv->fd, NULL, NULL);
+	if (fd < 0)
+		err(EXIT_FAILURE, "accept");
+	set_nodelay(fd);
+
+	if (srv->mode == NET_TCP_STREAM) {
+		while (read(fd, buf, size) > 0)
+			;
+	} else {
+		while (read_full(fd, buf, size) > 0)
+			if (write_full(fd, buf, size) < 0)
+				err(EXIT_FAILURE, "write");
+	}
+	close(fd);
+out:
+	free(buf);
+	return NULL;
+}
+
+static int server_start(struct net_server *srv, struct sockaddr_in *addr)
+{
+	socklen_t alen = sizeof(*addr);
+	int type = srv->mode == NET_UDP_RR ? SOCK_DGRAM : SOCK_STREAM;
+
+	srv->fd = socket(AF_INET, type, 0);
+	if (srv->fd < 0)
+		err(EXIT_FAILURE, "socket");
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr->sin_port = 0;
+	if (bind(srv->fd, (struct sockaddr *)addr, alen))
+		err(EXIT_FAILURE, "bind");
+	if (getsockname(srv->fd, (struct sockaddr *)addr, &alen))
+		err(EXIT_FAILURE, "getsockname");
+	if (type == SOCK_STREAM && listen(srv->fd, 1))
+		err(EXIT_FAILURE, "listen");
+
+	if (pthread_create(&srv->thread, NULL, serverfn, srv))
+		err(EXIT_FAILURE, "pthread_create");
+
+	return socket(AF_INET, type, 0);
+}
+
+static void print_result(enum net_mode mode, unsigned long ops,
+			 unsigned long syscalls, double secs)
+{
+	const char *name = net_mode_name[mode];
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s over loopback, %u byte messages, %.2f secs\n",
+		       name, size, secs);
+		if (mode == NET_TCP_STREAM) {
+			printf(" %14s: %.2f MB/s\n", "throughput",
+			       (double)ops * size / secs / (1024 * 1024));
+		} else {
+			printf(" %14s: %.0f trans/sec\n", "throughput",
+			       ops / secs);
+			printf(" %14s: %.3f usecs/op\n", "round trip",
+			       secs * 1e6 / ops);
+		}
+		printf(" %14s: %.3f usecs/call\n", "syscall",
+		       secs * 1e6 / syscalls);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%s_ops=%lu\n", name, ops);
+		if (mode == NET_TCP_STREAM)
+			printf("%s_mb_per_sec=%.2f\n", name,
+			       (double)ops * size / secs / (1024 * 1024));
+		else
+			printf("%s_trans_per_sec=%.0f\n", name, ops / secs);
+		printf("%s_syscalls=%lu\n", name, syscalls);
+		printf("%s_usec_per_syscall=%.3f\n", name,
+		       secs * 1e6 / syscalls);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int bench_net(enum net_mode mode, int argc, const char **argv)
+{
+	struct net_server srv = { .mode = mode };
+	struct sockaddr_in addr;
+	struct lat_samples lat;
+	unsigned long ops = 0, syscalls = 0;
+	u64 start, deadline, now;
+	char *buf;
+	int fd;
+
+	argc = parse_options(argc, argv, options, bench_net_usage, 0);
+	if (argc) {
+		usage_with_options(bench_net_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	size = msg_size;
+	if (!size)
+		size = mode == NET_TCP_STREAM ? 65536 : 1;
+
+	buf = malloc(size);
+	if (!buf)
+		err(EXIT_FAILURE, "malloc");
+	memset(buf, 0xa5, size);
+
+	fd = server_start(&srv, &addr);
+	if (fd < 0)
+		err(EXIT_FAILURE, "socket");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		err(EXIT_FAILURE, "connect");
+	if (mode != NET_UDP_RR)
+		set_nodelay(fd);
+
+	lat_init(&lat);
+	start = now = bench_now_ns();
+	deadline = start + (u64)nsecs * 1000000000ULL;
+
+	while (now < deadline) {
+		u64 t0 = now;
+
+		if (mode == NET_TCP_STREAM) {
+			if (write(fd, buf, size) != (ssize_t)size)
+				err(EXIT_FAILURE, "write");
+			syscalls++;
+		} else {
+			if (send(fd, buf, size, 0) != (ssize_t)size)
+				err(EXIT_FAILURE, "send");
+			if (recv(fd, buf, size, MSG_WAITALL) !=
+			    (ssize_t)size)
+				err(EXIT_FAILURE, "recv");
+			syscalls += 2;
+		}
+		ops++;
+		now = bench_now_ns();
+		if (mode != NET_TCP_STREAM)
+			lat_add(&lat, now - t0);
+	}
+
+	/* an empty datagram or EOF stops the server */
+	if (mode == NET_UDP_RR)
+		send(fd, buf, 0, 0);
+	else
+		shutdown(fd, SHUT_WR);
+	pthread_join(srv.thread, NULL);
+	close(fd);
+	close(srv.fd);
+
+	print_result(mode, ops, syscalls, (now - start) / 1e9);
+	lat_print(&lat, net_mode_name[mode]);
+
+	lat_free(&lat);
+	free(buf);
+	return 0;
+}
+
+int bench_net_tcp_rr(int argc, const char **argv,
+		     const char *prefix __maybe_unused)
+{
+	return bench_net(NET_TCP_RR, argc, argv);
+}
+
+int bench_net_udp_rr(int argc, const char **argv,
+		     const char *prefix __maybe_unused)
+{
+	return bench_net(NET_UDP_RR, argc, argv);
+}
+
+int bench_net_tcp_stream(int argc, const char **argv,
+			 const char *prefix __maybe_unused)
+{
+	return bench_net(NET_TCP_STREAM, argc, argv);
+}
@@ -13,6 +13,8 @@
  *  mem   ... memory access performance
  *  numa  ... NUMA scheduling and MM performance
  *  futex ... Futex performance
+ *  block ... Block layer submission performance
+ *  net   ... Loopback network stack performance
  */
 #include "perf.h"
 #include "util/util.h"
@@ -51,6 +53,7 @@ static struct bench sched_benchmarks[] = {
 static struct bench mem_benchmarks[] = {
 	{ "memcpy",	"Benchmark for memcpy()",			bench_mem_memcpy	},
 	{ "memset",	"Benchmark for memset() tests",			bench_mem_memset	},
+	{ "pagefault",	"Benchmark for page fault scalability",		bench_mem_pagefault	},
 	{ "all",	"Test all memory benchmarks",			NULL			},
 	{ NULL,		NULL,						NULL			}
 };
@@ -63,6 +66,20 @@ static struct bench futex_benchmarks[] = {
 	{ NULL,		NULL,						NULL			}
 };
 
+static struct bench block_benchmarks[] = {
+	{ "aio",	"Benchmark for O_DIRECT aio submission",	bench_block_aio		},
+	{ "all",	"Test all block benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench net_benchmarks[] = {
+	{ "tcp-rr",	"Benchmark for TCP request/response",		bench_net_tcp_rr	},
+	{ "udp-rr",	"Benchmark for UDP request/response",		bench_net_udp_rr	},
+	{ "tcp-stream",	"Benchmark for TCP streaming",			bench_net_tcp_stream	},
+	{ "all",	"Test all net benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
 struct collection {
 	const char	*name;
 	const char	*summary;
@@ -76,6 +93,8 @@ static struct collection collections[] = {
 	{ "numa",	"NUMA scheduling and MM benchmarks",		numa_benchmarks		},
 #endif
 	{"futex",       "Futex stressing benchmarks",                   futex_benchmarks        },
+	{ "block",	"Block layer benchmarks",			block_benchmarks	},
+	{ "net",	"Loopback network stack benchmarks",		net_benchmarks		},
 	{ "all",	"All benchmarks",				NULL			},
 	{ NULL,		NULL,						NULL			}
 };
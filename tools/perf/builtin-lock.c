@@ -13,6 +13,7 @@
 #include "util/trace-event.h"
 
 #include "util/debug.h"
+#include "util/callchain.h"
 #include "util/session.h"
 #include "util/tool.h"
 #include "util/data.h"
@@ -65,6 +66,8 @@ struct lock_stat {
 	u64			wait_time_max;
 
 	int			discard; /* flag of blacklist */
+
+	unsigned int		flags;	/* LCB_F_* of contention_begin */
 };
 
 /*
@@ -104,6 +107,7 @@ struct lock_seq_stat {
 	void                    *addr;
 
 	int                     read_count;
+	struct lock_stat	*ls;	/* used by contention mode */
 };
 
 struct thread_stat {
@@ -354,6 +358,12 @@ struct trace_lock_handler {
 
 	int (*release_event)(struct perf_evsel *evsel,
 			     struct perf_sample *sample);
+
+	int (*contention_begin_event)(struct perf_evsel *evsel,
+				      struct perf_sample *sample);
+
+	int (*contention_end_event)(struct perf_evsel *evsel,
+				    struct perf_sample *sample);
 };
 
 static struct lock_seq_stat *get_seq(struct thread_stat *ts, void *addr)
@@ -650,6 +660,178 @@ static struct trace_lock_handler report_lock_ops  = {
 	.release_event		= report_lock_release_event,
 };
 
+/*
+ * Contention mode: built on lock:contention_begin/end, which are
+ * available without lockdep.  Waits are attributed to the first
+ * caller in the callchain that is not part of the locking code
+ * itself, or to the lock instance when no callchain was recorded.
+ */
+
+/* must match include/trace/events/lock.h */
+#define LCB_F_SPIN	(1U << 0)
+#define LCB_F_READ	(1U << 1)
+#define LCB_F_WRITE	(1U << 2)
+#define LCB_F_MUTEX	(1U << 3)
+
+static bool contention_by_addr;
+
+static const char *lock_func_prefixes[] = {
+	"mutex_lock",
+	"__mutex_lock",
+	"ww_mutex_lock",
+	"__ww_mutex_lock",
+	"down_read",
+	"down_write",
+	"rwsem_down",
+	"call_rwsem_down",
+	"queue_read_lock",
+	"queue_write_lock",
+	"_raw_read_lock",
+	"_raw_write_lock",
+	NULL
+};
+
+static bool is_lock_function(struct symbol *sym)
+{
+	int i;
+
+	for (i = 0; lock_func_prefixes[i]; i++) {
+		if (!strncmp(sym->name, lock_func_prefixes[i],
+			     strlen(lock_func_prefixes[i])))
+			return true;
+	}
+	return false;
+}
+
+static struct symbol *contention_caller(struct perf_evsel *evsel,
+					struct perf_sample *sample)
+{
+	struct callchain_cursor_node *node;
+	struct thread *thread;
+
+	if (!sample->callchain)
+		return NULL;
+
+	thread = machine__findnew_thread(&session->machines.host,
+					 sample->pid, sample->tid);
+	if (!thread)
+		return NULL;
+
+	if (thread__resolve_callchain(thread, evsel, sample, NULL, NULL,
+				      PERF_MAX_STACK_DEPTH))
+		return NULL;
+
+	callchain_cursor_commit(&callchain_cursor);
+	while ((node = callchain_cursor_current(&callchain_cursor))) {
+		callchain_cursor_advance(&callchain_cursor);
+		if (node->sym && !is_lock_function(node->sym))
+			return node->sym;
+	}
+	return NULL;
+}
+
+static const char *contention_type(unsigned int flags)
+{
+	if (flags & LCB_F_MUTEX)
+		return "mutex";
+	if (flags & LCB_F_SPIN)
+		return flags & LCB_F_READ ? "rwlock:R" : "rwlock:W";
+	return flags & LCB_F_READ ? "rwsem:R" : "rwsem:W";
+}
+
+static int report_contention_begin_event(struct perf_evsel *evsel,
+					 struct perf_sample *sample)
+{
+	void *addr;
+	struct lock_stat *ls;
+	struct thread_stat *ts;
+	struct lock_seq_stat *seq;
+	struct symbol *caller = NULL;
+	char buf[32];
+	u64 tmp = perf_evsel__intval(evsel, sample, "lock_addr");
+	unsigned int flags = perf_evsel__intval(evsel, sample, "flags");
+
+	memcpy(&addr, &tmp, sizeof(void *));
+
+	ts = thread_stat_findnew(sample->tid);
+	if (!ts)
+		return -ENOMEM;
+
+	seq = get_seq(ts, addr);
+	if (!seq)
+		return -ENOMEM;
+
+	/*
+	 * A waiter that gave up spinning and goes to sleep emits a
+	 * second begin for the same lock; keep the first timestamp.
+	 */
+	if (seq->state == SEQ_STATE_CONTENDED)
+		return 0;
+
+	if (!contention_by_addr)
+		caller = contention_caller(evsel, sample);
+
+	if (caller) {
+		ls = lock_stat_findnew(caller, caller->name);
+	} else {
+		scnprintf(buf, sizeof(buf), "%p", addr);
+		ls = lock_stat_findnew(addr, buf);
+	}
+	if (!ls)
+		return -ENOMEM;
+
+	ls->flags = flags;
+	seq->ls = ls;
+	seq->state = SEQ_STATE_CONTENDED;
+	seq->prev_event_time = sample->time;
+	return 0;
+}
+
+static int report_contention_end_event(struct perf_evsel *evsel,
+				       struct perf_sample *sample)
+{
+	void *addr;
+	struct lock_stat *ls;
+	struct thread_stat *ts;
+	struct lock_seq_stat *seq;
+	u64 contended_term;
+	u64 tmp = perf_evsel__intval(evsel, sample, "lock_addr");
+
+	memcpy(&addr, &tmp, sizeof(void *));
+
+	ts = thread_stat_findnew(sample->tid);
+	if (!ts)
+		return -ENOMEM;
+
+	seq = get_seq(ts, addr);
+	if (!seq)
+		return -ENOMEM;
+
+	/* the begin event was lost or happened before recording started */
+	if (seq->state != SEQ_STATE_CONTENDED)
+		goto free_seq;
+
+	ls = seq->ls;
+	contended_term = sample->time - seq->prev_event_time;
+	ls->nr_contended++;
+	ls->wait_time_total += contended_term;
+	if (contended_term < ls->wait_time_min)
+		ls->wait_time_min = contended_term;
+	if (ls->wait_time_max < contended_term)
+		ls->wait_time_max = contended_term;
+	ls->avg_wait_time = ls->wait_time_total / ls->nr_contended;
+
+free_seq:
+	list_del(&seq->list);
+	free(seq);
+	return 0;
+}
+
+static struct trace_lock_handler contention_lock_ops  = {
+	.contention_begin_event	= report_contention_begin_event,
+	.contention_end_event	= report_contention_end_event,
+};
+
 static struct trace_lock_handler *trace_handler;
 
 static int perf_evsel__process_lock_acquire(struct perf_evsel *evsel,
@@ -684,6 +866,22 @@ static int perf_evsel__process_lock_release(struct perf_evsel *evsel,
 	return 0;
 }
 
+static int perf_evsel__process_contention_begin(struct perf_evsel *evsel,
+					       struct perf_sample *sample)
+{
+	if (trace_handler->contention_begin_event)
+		return trace_handler->contention_begin_event(evsel, sample);
+	return 0;
+}
+
+static int perf_evsel__process_contention_end(struct perf_evsel *evsel,
+					     struct perf_sample *sample)
+{
+	if (trace_handler->contention_end_event)
+		return trace_handler->contention_end_event(evsel, sample);
+	return 0;
+}
+
 static void print_bad_events(int bad, int total)
 {
 	/* Output for debug, this have to be removed */
@@ -753,6 +951,32 @@ static void print_result(void)
 	print_bad_events(bad, total);
 }
 
+static void print_contention_result(void)
+{
+	struct lock_stat *st;
+
+	pr_info("%10s ", "contended");
+	pr_info("%15s ", "total wait (ns)");
+	pr_info("%15s ", "max wait (ns)");
+	pr_info("%15s ", "avg wait (ns)");
+	pr_info("%10s ", "type");
+	pr_info("  %s", "caller");
+
+	pr_info("\n\n");
+
+	while ((st = pop_from_result())) {
+		if (!st->nr_contended)
+			continue;
+
+		pr_info("%10u ", st->nr_contended);
+		pr_info("%15" PRIu64 " ", st->wait_time_total);
+		pr_info("%15" PRIu64 " ", st->wait_time_max);
+		pr_info("%15" PRIu64 " ", st->avg_wait_time);
+		pr_info("%10s ", contention_type(st->flags));
+		pr_info("  %s\n", st->name);
+	}
+}
+
 static bool info_threads, info_map;
 
 static void dump_threads(void)
@@ -846,6 +1070,11 @@ static const struct perf_evsel_str_handler lock_tracepoints[] = {
 	{ "lock:lock_release",	 perf_evsel__process_lock_release,   }, /* CONFIG_LOCKDEP */
 };
 
+static const struct perf_evsel_str_handler contention_tracepoints[] = {
+	{ "lock:contention_begin", perf_evsel__process_contention_begin, },
+	{ "lock:contention_end",   perf_evsel__process_contention_end,   },
+};
+
 static bool force;
 
 static int __cmd_report(bool display_info)
@@ -873,7 +1102,14 @@ static int __cmd_report(bool display_info)
 	if (!perf_session__has_traces(session, "lock record"))
 		goto out_delete;
 
-	if (perf_session__set_tracepoints_handlers(session, lock_tracepoints)) {
+	if (trace_handler == &contention_lock_ops) {
+		symbol_conf.use_callchain = true;
+		if (perf_session__set_tracepoints_handlers(session,
+							   contention_tracepoints)) {
+			pr_err("Initializing perf session tracepoint handlers failed\n");
+			goto out_delete;
+		}
+	} else if (perf_session__set_tracepoints_handlers(session, lock_tracepoints)) {
 		pr_err("Initializing perf session tracepoint handlers failed\n");
 		goto out_delete;
 	}
@@ -890,7 +1126,10 @@ static int __cmd_report(bool display_info)
 		err = dump_info();
 	else {
 		sort_result();
-		print_result();
+		if (trace_handler == &contention_lock_ops)
+			print_contention_result();
+		else
+			print_result();
 	}
 
 out_delete:
@@ -903,21 +1142,42 @@ static int __cmd_record(int argc, const char **argv)
 	const char *record_args[] = {
 		"record", "-R", "-m", "1024", "-c", "1",
 	};
+	const char *callgraph_args[] = {
+		"-g",
+	};
+	const struct perf_evsel_str_handler *tracepoints = lock_tracepoints;
+	unsigned int nr_tracepoints = ARRAY_SIZE(lock_tracepoints);
+	unsigned int nr_callgraph_args = 0;
 	unsigned int rec_argc, i, j, ret;
 	const char **rec_argv;
 
-	for (i = 0; i < ARRAY_SIZE(lock_tracepoints); i++) {
+	for (i = 0; i < nr_tracepoints; i++) {
 		if (!is_valid_tracepoint(lock_tracepoints[i].name)) {
-				pr_err("tracepoint %s is not enabled. "
-				       "Are CONFIG_LOCKDEP and CONFIG_LOCK_STAT enabled?\n",
-				       lock_tracepoints[i].name);
-				return 1;
+			pr_debug("tracepoint %s is not enabled. "
+				 "Are CONFIG_LOCKDEP and CONFIG_LOCK_STAT enabled?\n",
+				 lock_tracepoints[i].name);
+			goto setup_contention;
 		}
 	}
+	goto setup_args;
+
+setup_contention:
+	/* without lockdep, record the contention tracepoints with callchains */
+	tracepoints = contention_tracepoints;
+	nr_tracepoints = ARRAY_SIZE(contention_tracepoints);
+	for (i = 0; i < nr_tracepoints; i++) {
+		if (!is_valid_tracepoint(contention_tracepoints[i].name)) {
+			pr_err("tracepoint %s is not enabled.\n",
+			       contention_tracepoints[i].name);
+			return 1;
+		}
+	}
+	nr_callgraph_args = ARRAY_SIZE(callgraph_args);
 
-	rec_argc = ARRAY_SIZE(record_args) + argc - 1;
+setup_args:
+	rec_argc = ARRAY_SIZE(record_args) + nr_callgraph_args + argc - 1;
 	/* factor of 2 is for -e in front of each tracepoint */
-	rec_argc += 2 * ARRAY_SIZE(lock_tracepoints);
+	rec_argc += 2 * nr_tracepoints;
 
 	rec_argv = calloc(rec_argc + 1, sizeof(char *));
 	if (!rec_argv)
@@ -926,9 +1186,12 @@ static int __cmd_record(int argc, const char **argv)
 	for (i = 0; i < ARRAY_SIZE(record_args); i++)
 		rec_argv[i] = strdup(record_args[i]);
 
-	for (j = 0; j < ARRAY_SIZE(lock_tracepoints); j++) {
+	for (j = 0; j < nr_callgraph_args; j++, i++)
+		rec_argv[i] = strdup(callgraph_args[j]);
+
+	for (j = 0; j < nr_tracepoints; j++) {
 		rec_argv[i++] = "-e";
-		rec_argv[i++] = strdup(lock_tracepoints[j].name);
+		rec_argv[i++] = strdup(tracepoints[j].name);
 	}
 
 	for (j = 1; j < (unsigned int)argc; j++, i++)
@@ -964,12 +1227,20 @@ int cmd_lock(int argc, const char **argv, const char *prefix __maybe_unused)
 	/* TODO: type */
 	OPT_END()
 	};
+	const struct option contention_options[] = {
+	OPT_STRING('k', "key", &sort_key, "wait_total",
+		    "key for sorting (contended / wait_total / wait_max / avg_wait)"),
+	OPT_BOOLEAN('a', "lock-addr", &contention_by_addr,
+		    "aggregate by lock instance instead of caller"),
+	OPT_BOOLEAN('f', "force", &force, "don't complain, do it"),
+	OPT_END()
+	};
 	const char * const info_usage[] = {
 		"perf lock info [<options>]",
 		NULL
 	};
 	const char *const lock_subcommands[] = { "record", "report", "script",
-						 "info", NULL };
+						 "info", "contention", NULL };
 	const char *lock_usage[] = {
 		NULL,
 		NULL
@@ -978,6 +1249,10 @@ int cmd_lock(int argc, const char **argv, const char *prefix __maybe_unused)
 		"perf lock report [<options>]",
 		NULL
 	};
+	const char * const contention_usage[] = {
+		"perf lock contention [<options>]",
+		NULL
+	};
 	unsigned int i;
 	int rc = 0;
 
@@ -1013,6 +1288,17 @@ int cmd_lock(int argc, const char **argv, const char *prefix __maybe_unused)
 		/* recycling report_lock_ops */
 		trace_handler = &report_lock_ops;
 		rc = __cmd_report(true);
+	} else if (!strncmp(argv[0], "contention", 3)) {
+		trace_handler = &contention_lock_ops;
+		sort_key = "wait_total";
+		if (argc) {
+			argc = parse_options(argc, argv, contention_options,
+					     contention_usage, 0);
+			if (argc)
+				usage_with_options(contention_usage,
+						   contention_options);
+		}
+		rc = __cmd_report(false);
 	} else {
 		usage_with_options(lock_usage, lock_options);
 	}
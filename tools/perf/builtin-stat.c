@@ -107,6 +107,26 @@ enum {
 	T_CYCLES_IN_TX_CP,
 };
 
+/* Level 1 TopDown events used for perf stat --topdown */
+static const char * const topdown_attrs[] = {
+	"{"
+	"cpu/topdown-total-slots/,"
+	"cpu/topdown-slots-issued/,"
+	"cpu/topdown-slots-retired/,"
+	"cpu/topdown-fetch-bubbles/,"
+	"cpu/topdown-recovery-bubbles/"
+	"}"
+};
+
+/* must match topdown_attrs */
+enum {
+	TD_TOTAL_SLOTS,
+	TD_SLOTS_ISSUED,
+	TD_SLOTS_RETIRED,
+	TD_FETCH_BUBBLES,
+	TD_RECOVERY_BUBBLES,
+};
+
 static struct perf_evlist	*evsel_list;
 
 static struct target target = {
@@ -128,6 +148,8 @@ static volatile pid_t		child_pid			= -1;
 static bool			null_run			=  false;
 static int			detailed_run			=  0;
 static bool			transaction_run;
+static bool			topdown_run;
+static const char		*each_cgroup_str;
 static bool			big_num				=  true;
 static int			big_num_opt			=  -1;
 static const char		*csv_sep			= NULL;
@@ -262,10 +284,30 @@ static struct stats runtime_cycles_in_tx_stats[MAX_NR_CPUS];
 static struct stats walltime_nsecs_stats;
 static struct stats runtime_transaction_stats[MAX_NR_CPUS];
 static struct stats runtime_elision_stats[MAX_NR_CPUS];
+static struct stats runtime_topdown_total_slots[MAX_NR_CPUS];
+static struct stats runtime_topdown_slots_issued[MAX_NR_CPUS];
+static struct stats runtime_topdown_slots_retired[MAX_NR_CPUS];
+static struct stats runtime_topdown_fetch_bubbles[MAX_NR_CPUS];
+static struct stats runtime_topdown_recovery_bubbles[MAX_NR_CPUS];
+
+/*
+ * --for-each-cgroup: one event per cpu counts for all these cgroups,
+ * the kernel splitting the count at cgroup switch time.
+ */
+struct each_cgroup {
+	char	*name;
+	u64	id;
+	double	*counts;	/* per evsel idx, summed over cpus and runs */
+};
+
+static struct each_cgroup	*each_cgroups;
+static int			nr_each_cgroups;
+static u64			*each_cgroup_ids;	/* { nr, id[nr] } */
 
 static void perf_stat__reset_stats(struct perf_evlist *evlist)
 {
 	struct perf_evsel *evsel;
+	int i;
 
 	evlist__for_each(evlist, evsel) {
 		perf_evsel__reset_stat_priv(evsel);
@@ -288,7 +330,114 @@ static void perf_stat__reset_stats(struct perf_evlist *evlist)
 	memset(runtime_transaction_stats, 0,
 		sizeof(runtime_transaction_stats));
 	memset(runtime_elision_stats, 0, sizeof(runtime_elision_stats));
+	memset(runtime_topdown_total_slots, 0,
+		sizeof(runtime_topdown_total_slots));
+	memset(runtime_topdown_slots_issued, 0,
+		sizeof(runtime_topdown_slots_issued));
+	memset(runtime_topdown_slots_retired, 0,
+		sizeof(runtime_topdown_slots_retired));
+	memset(runtime_topdown_fetch_bubbles, 0,
+		sizeof(runtime_topdown_fetch_bubbles));
+	memset(runtime_topdown_recovery_bubbles, 0,
+		sizeof(runtime_topdown_recovery_bubbles));
 	memset(&walltime_nsecs_stats, 0, sizeof(walltime_nsecs_stats));
+
+	for (i = 0; i < nr_each_cgroups; i++) {
+		if (each_cgroups[i].counts)
+			memset(each_cgroups[i].counts, 0,
+			       evlist->nr_entries * sizeof(double));
+	}
+}
+
+static int parse_each_cgroups(const char *str)
+{
+	char *names, *name, *saved = NULL;
+	int i;
+
+	names = strdup(str);
+	if (!names)
+		return -ENOMEM;
+
+	for (name = strtok_r(names, ",", &saved); name;
+	     name = strtok_r(NULL, ",", &saved)) {
+		struct each_cgroup *cg;
+
+		cg = realloc(each_cgroups,
+			     (nr_each_cgroups + 1) * sizeof(*each_cgroups));
+		if (!cg)
+			goto out_err;
+		each_cgroups = cg;
+
+		cg = &each_cgroups[nr_each_cgroups];
+		cg->name = strdup(name);
+		cg->counts = NULL;
+		if (!cg->name || cgroup__id(name, &cg->id))
+			goto out_err;
+		nr_each_cgroups++;
+	}
+
+	each_cgroup_ids = calloc(nr_each_cgroups + 1, sizeof(u64));
+	if (!each_cgroup_ids)
+		goto out_err;
+
+	each_cgroup_ids[0] = nr_each_cgroups;
+	for (i = 0; i < nr_each_cgroups; i++)
+		each_cgroup_ids[i + 1] = each_cgroups[i].id;
+
+	free(names);
+	return 0;
+
+out_err:
+	free(names);
+	return -1;
+}
+
+static int attach_each_cgroups(void)
+{
+	struct perf_evsel *counter;
+	char msg[512];
+	int i;
+
+	for (i = 0; i < nr_each_cgroups; i++) {
+		if (each_cgroups[i].counts)
+			continue;
+		each_cgroups[i].counts = calloc(evsel_list->nr_entries,
+						sizeof(double));
+		if (!each_cgroups[i].counts)
+			return -ENOMEM;
+	}
+
+	evlist__for_each(evsel_list, counter) {
+		if (!counter->supported)
+			continue;
+		if (perf_evsel__attach_cgroups(counter,
+					       perf_evsel__nr_cpus(counter),
+					       each_cgroup_ids)) {
+			error("failed to attach cgroups to event %s with %d (%s)\n",
+			      perf_evsel__name(counter), errno,
+			      strerror_r(errno, msg, sizeof(msg)));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void read_each_cgroups(struct perf_evsel *counter)
+{
+	int cpu, i;
+	u64 val;
+
+	if (!counter->supported)
+		return;
+
+	for (cpu = 0; cpu < perf_evsel__nr_cpus(counter); cpu++) {
+		for (i = 0; i < nr_each_cgroups; i++) {
+			struct each_cgroup *cg = &each_cgroups[i];
+
+			if (!perf_evsel__read_cgroup(counter, cpu, cg->id, &val))
+				cg->counts[counter->idx] += val;
+		}
+	}
 }
 
 static int create_perf_stat_counter(struct perf_evsel *evsel)
@@ -369,6 +518,26 @@ static void update_shadow_stats(struct perf_evsel *counter, u64 *count,
 	else if (transaction_run &&
 		 perf_evsel__cmp(counter, nth_evsel(T_ELISION_START)))
 		update_stats(&runtime_elision_stats[cpu], count[0]);
+	else if (topdown_run &&
+		 perf_evsel__cmp(counter, nth_evsel(TD_TOTAL_SLOTS)))
+		update_stats(&runtime_topdown_total_slots[cpu],
+			     count[0] * counter->scale);
+	else if (topdown_run &&
+		 perf_evsel__cmp(counter, nth_evsel(TD_SLOTS_ISSUED)))
+		update_stats(&runtime_topdown_slots_issued[cpu],
+			     count[0] * counter->scale);
+	else if (topdown_run &&
+		 perf_evsel__cmp(counter, nth_evsel(TD_SLOTS_RETIRED)))
+		update_stats(&runtime_topdown_slots_retired[cpu],
+			     count[0] * counter->scale);
+	else if (topdown_run &&
+		 perf_evsel__cmp(counter, nth_evsel(TD_FETCH_BUBBLES)))
+		update_stats(&runtime_topdown_fetch_bubbles[cpu],
+			     count[0] * counter->scale);
+	else if (topdown_run &&
+		 perf_evsel__cmp(counter, nth_evsel(TD_RECOVERY_BUBBLES)))
+		update_stats(&runtime_topdown_recovery_bubbles[cpu],
+			     count[0] * counter->scale);
 	else if (perf_evsel__match(counter, HARDWARE, HW_STALLED_CYCLES_FRONTEND))
 		update_stats(&runtime_stalled_cycles_front_stats[cpu], count[0]);
 	else if (perf_evsel__match(counter, HARDWARE, HW_STALLED_CYCLES_BACKEND))
@@ -691,6 +860,9 @@ static int __run_perf_stat(int argc, const char **argv)
 		return -1;
 	}
 
+	if (nr_each_cgroups && attach_each_cgroups())
+		return -1;
+
 	/*
 	 * Enable counters and exec the command:
 	 */
@@ -733,12 +905,16 @@ static int __run_perf_stat(int argc, const char **argv)
 	if (aggr_mode == AGGR_GLOBAL) {
 		evlist__for_each(evsel_list, counter) {
 			read_counter_aggr(counter);
+			if (nr_each_cgroups)
+				read_each_cgroups(counter);
 			perf_evsel__close_fd(counter, perf_evsel__nr_cpus(counter),
 					     thread_map__nr(evsel_list->threads));
 		}
 	} else {
 		evlist__for_each(evsel_list, counter) {
 			read_counter(counter);
+			if (nr_each_cgroups)
+				read_each_cgroups(counter);
 			perf_evsel__close_fd(counter, perf_evsel__nr_cpus(counter), 1);
 		}
 	}
@@ -1054,6 +1230,58 @@ static void print_ll_cache_misses(int cpu,
 	fprintf(output, " of all LL-cache hits   ");
 }
 
+/*
+ * TopDown level 1: every issue slot is either lost in the frontend
+ * (fetch bubbles), wasted on speculation that was thrown away, used by
+ * a retiring uop, or stalled in the backend, which is the rest.
+ */
+static double td_clamp(double val)
+{
+	if (val < 0)
+		return 0;
+	if (val > 1)
+		return 1;
+	return val;
+}
+
+static double td_ratio(int cpu, double val)
+{
+	double total = avg_stats(&runtime_topdown_total_slots[cpu]);
+
+	return total ? td_clamp(val / total) : 0;
+}
+
+static double td_frontend_bound(int cpu)
+{
+	return td_ratio(cpu, avg_stats(&runtime_topdown_fetch_bubbles[cpu]));
+}
+
+static double td_bad_spec(int cpu)
+{
+	return td_ratio(cpu, avg_stats(&runtime_topdown_slots_issued[cpu]) -
+			     avg_stats(&runtime_topdown_slots_retired[cpu]) +
+			     avg_stats(&runtime_topdown_recovery_bubbles[cpu]));
+}
+
+static double td_retiring(int cpu)
+{
+	return td_ratio(cpu, avg_stats(&runtime_topdown_slots_retired[cpu]));
+}
+
+static double td_backend_bound(int cpu)
+{
+	if (!avg_stats(&runtime_topdown_total_slots[cpu]))
+		return 0;
+
+	return td_clamp(1 - td_frontend_bound(cpu) - td_bad_spec(cpu) -
+			td_retiring(cpu));
+}
+
+static void print_topdown(const char *name, double ratio)
+{
+	fprintf(output, " #   %5.2f%% %-22s", 100.0 * ratio, name);
+}
+
 static void abs_printout(int id, int nr, struct perf_evsel *evsel, double avg)
 {
 	double total, ratio = 0.0, total2;
@@ -1169,6 +1397,21 @@ static void abs_printout(int id, int nr, struct perf_evsel *evsel, double avg)
 		} else {
 			fprintf(output, "                                   ");
 		}
+	} else if (topdown_run &&
+		   perf_evsel__cmp(evsel, nth_evsel(TD_TOTAL_SLOTS))) {
+		print_topdown("backend bound", td_backend_bound(cpu));
+	} else if (topdown_run &&
+		   perf_evsel__cmp(evsel, nth_evsel(TD_SLOTS_ISSUED))) {
+		print_topdown("bad speculation", td_bad_spec(cpu));
+	} else if (topdown_run &&
+		   perf_evsel__cmp(evsel, nth_evsel(TD_SLOTS_RETIRED))) {
+		print_topdown("retiring", td_retiring(cpu));
+	} else if (topdown_run &&
+		   perf_evsel__cmp(evsel, nth_evsel(TD_FETCH_BUBBLES))) {
+		print_topdown("frontend bound", td_frontend_bound(cpu));
+	} else if (topdown_run &&
+		   perf_evsel__cmp(evsel, nth_evsel(TD_RECOVERY_BUBBLES))) {
+		fprintf(output, "                                   ");
 	} else if (transaction_run &&
 		   perf_evsel__cmp(evsel, nth_evsel(T_CYCLES_IN_TX))) {
 		total = avg_stats(&runtime_cycles_stats[cpu]);
@@ -1400,6 +1643,41 @@ static void print_counter(struct perf_evsel *counter, char *prefix)
 	}
 }
 
+/*
+ * Per-cgroup counts are not scaled for multiplexing: keep the number
+ * of events within what the PMU can count at once.
+ */
+static void print_each_cgroups(void)
+{
+	struct perf_evsel *counter;
+	int i;
+
+	for (i = 0; i < nr_each_cgroups; i++) {
+		struct each_cgroup *cg = &each_cgroups[i];
+
+		if (!csv_output)
+			fprintf(output, "\n");
+
+		evlist__for_each(evsel_list, counter) {
+			double avg = cg->counts[counter->idx] / run_count;
+
+			if (!counter->supported)
+				continue;
+
+			if (csv_output) {
+				fprintf(output, "%.0f%s%s%s%s\n", avg, csv_sep,
+					perf_evsel__name(counter), csv_sep,
+					cg->name);
+				continue;
+			}
+
+			fprintf(output, big_num ? "%'18.0f " : "%18.0f ", avg);
+			fprintf(output, "%-25s %s\n",
+				perf_evsel__name(counter), cg->name);
+		}
+	}
+}
+
 static void print_stat(int argc, const char **argv)
 {
 	struct perf_evsel *counter;
@@ -1446,6 +1724,9 @@ static void print_stat(int argc, const char **argv)
 		break;
 	}
 
+	if (nr_each_cgroups)
+		print_each_cgroups();
+
 	if (!csv_output) {
 		if (!null_run)
 			fprintf(output, "\n");
@@ -1663,6 +1944,18 @@ static int add_default_attributes(void)
 	if (null_run)
 		return 0;
 
+	if (topdown_run) {
+		if (!pmu_have_event("cpu", "topdown-total-slots")) {
+			fprintf(stderr, "TopDown events not supported by this CPU\n");
+			return -1;
+		}
+		if (setup_events(topdown_attrs, ARRAY_SIZE(topdown_attrs)) < 0) {
+			fprintf(stderr, "Cannot set up TopDown events\n");
+			return -1;
+		}
+		return 0;
+	}
+
 	if (transaction_run) {
 		int err;
 		if (pmu_have_event("cpu", "cycles-ct") &&
@@ -1715,6 +2008,8 @@ int cmd_stat(int argc, const char **argv, const char *prefix __maybe_unused)
 	const struct option options[] = {
 	OPT_BOOLEAN('T', "transaction", &transaction_run,
 		    "hardware transaction statistics"),
+	OPT_BOOLEAN(0, "topdown", &topdown_run,
+		    "TopDown level 1 metrics: frontend bound, bad speculation, retiring, backend bound"),
 	OPT_CALLBACK('e', "event", &evsel_list, "event",
 		     "event selector. use 'perf list' to list available events",
 		     parse_events_option),
@@ -1752,6 +2047,9 @@ int cmd_stat(int argc, const char **argv, const char *prefix __maybe_unused)
 		   "print counts with custom separator"),
 	OPT_CALLBACK('G', "cgroup", &evsel_list, "name",
 		     "monitor event in cgroup name only", parse_cgroups),
+	OPT_STRING(0, "for-each-cgroup", &each_cgroup_str, "name",
+		   "count events for each cgroup in a comma separated list, "
+		   "sharing one event per cpu"),
 	OPT_STRING('o', "output", &output_name, "file", "output file name"),
 	OPT_BOOLEAN(0, "append", &append_file, "append to the output file"),
 	OPT_INTEGER(0, "log-fd", &output_fd,
@@ -1869,6 +2167,25 @@ int cmd_stat(int argc, const char **argv, const char *prefix __maybe_unused)
 		goto out;
 	}
 
+	if (each_cgroup_str) {
+		if (!target__has_cpu(&target) || nr_cgroups) {
+			fprintf(stderr, "--for-each-cgroup is only available "
+				"in system-wide mode and without -G\n");
+			parse_options_usage(stat_usage, options,
+					    "for-each-cgroup", 0);
+			goto out;
+		}
+		if (parse_each_cgroups(each_cgroup_str))
+			goto out;
+	}
+
+	if (topdown_run && transaction_run) {
+		fprintf(stderr, "--topdown and -T cannot be used together\n");
+		parse_options_usage(stat_usage, options, "topdown", 0);
+		parse_options_usage(NULL, options, "T", 1);
+		goto out;
+	}
+
 	if (add_default_attributes())
 		goto out;
 
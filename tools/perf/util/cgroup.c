@@ -125,6 +125,30 @@ found:
 	return 0;
 }
 
+/*
+ * The kernel identifies cgroups attached with PERF_EVENT_IOC_ATTACH_CGROUP
+ * by the inode number of their directory in the perf_event hierarchy.
+ */
+int cgroup__id(const char *name, u64 *id)
+{
+	char path[PATH_MAX + 1];
+	char mnt[PATH_MAX + 1];
+	struct stat st;
+
+	if (cgroupfs_find_mountpoint(mnt, PATH_MAX + 1))
+		return -1;
+
+	snprintf(path, PATH_MAX, "%s/%s", mnt, name);
+
+	if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "no access to cgroup %s\n", path);
+		return -1;
+	}
+
+	*id = st.st_ino;
+	return 0;
+}
+
 void close_cgroup(struct cgroup_sel *cgrp)
 {
 	if (!cgrp)
@@ -1,6 +1,8 @@
 #ifndef __CGROUP_H__
 #define __CGROUP_H__
 
+#include <linux/types.h>
+
 struct option;
 
 struct cgroup_sel {
@@ -13,5 +15,6 @@ struct cgroup_sel {
 extern int nr_cgroups; /* number of explicit cgroups defined */
 extern void close_cgroup(struct cgroup_sel *cgrp);
 extern int parse_cgroups(const struct option *opt, const char *str, int unset);
+extern int cgroup__id(const char *name, u64 *id);
 
 #endif /* __CGROUP_H__ */
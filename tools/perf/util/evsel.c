@@ -829,6 +829,29 @@ int perf_evsel__enable(struct perf_evsel *evsel, int ncpus, int nthreads)
 				     0);
 }
 
+/*
+ * Make each per-cpu event count separately for the cgroups in @ids,
+ * laid out as { nr, id[nr] }.
+ */
+int perf_evsel__attach_cgroups(struct perf_evsel *evsel, int ncpus, u64 *ids)
+{
+	return perf_evsel__run_ioctl(evsel, ncpus, 1,
+				     PERF_EVENT_IOC_ATTACH_CGROUP,
+				     ids);
+}
+
+int perf_evsel__read_cgroup(struct perf_evsel *evsel, int cpu, u64 id,
+			    u64 *count)
+{
+	u64 buf[3] = { id, };
+
+	if (ioctl(FD(evsel, cpu, 0), PERF_EVENT_IOC_READ_CGROUP, buf))
+		return -errno;
+
+	*count = buf[1];
+	return 0;
+}
+
 int perf_evsel__alloc_id(struct perf_evsel *evsel, int ncpus, int nthreads)
 {
 	if (ncpus == 0 || nthreads == 0)
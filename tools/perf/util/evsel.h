@@ -192,6 +192,9 @@ void perf_evsel__set_sample_id(struct perf_evsel *evsel,
 int perf_evsel__set_filter(struct perf_evsel *evsel, int ncpus, int nthreads,
 			   const char *filter);
 int perf_evsel__enable(struct perf_evsel *evsel, int ncpus, int nthreads);
+int perf_evsel__attach_cgroups(struct perf_evsel *evsel, int ncpus, u64 *ids);
+int perf_evsel__read_cgroup(struct perf_evsel *evsel, int cpu, u64 id,
+			    u64 *count);
 
 int perf_evsel__open_per_cpu(struct perf_evsel *evsel,
 			     struct cpu_map *cpus);
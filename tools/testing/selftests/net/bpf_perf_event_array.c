@@ -0,0 +1,126 @@
+/*
+ * Test of the BPF_MAP_TYPE_PERF_EVENT_ARRAY map API.
+ *
+ * - only int sized values, which are perf event fds, are accepted
+ * - only PERF_COUNT_SW_BPF_OUTPUT events can be stored
+ * - stored fds are not handed back to user space
+ * - the map keeps the event alive after its fd is closed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/perf_event.h>
+
+static __u64 ptr_to_u64(void *ptr)
+{
+	return (__u64) (unsigned long) ptr;
+}
+
+static int bpf_create_map(enum bpf_map_type map_type, int key_size,
+			  int value_size, int max_entries)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = map_type;
+	attr.key_size = key_size;
+	attr.value_size = value_size;
+	attr.max_entries = max_entries;
+
+	return syscall(__NR_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+}
+
+static int bpf_elem(int cmd, int fd, void *key, void *value,
+		    unsigned long long flags)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = ptr_to_u64(key);
+	attr.value = ptr_to_u64(value);
+	attr.flags = flags;
+
+	return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+static void expect(int ret, int err, const char *what)
+{
+	if (err ? (ret != -1 || errno != err) : ret != 0) {
+		fprintf(stderr, "%s: got %d (%s), expected %s\n", what, ret,
+			ret == -1 ? strerror(errno) : "no error",
+			err ? strerror(err) : "no error");
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	struct perf_event_attr attr;
+	int key, map_fd, pmu_fd, value;
+
+	/* the values are perf event fds */
+	map_fd = bpf_create_map(BPF_MAP_TYPE_PERF_EVENT_ARRAY, sizeof(key),
+				sizeof(long long), 2);
+	if (map_fd == -1 && (errno == EPERM || errno == ENOSYS)) {
+		fprintf(stderr, "bpf maps not available: %s, skipping\n",
+			strerror(errno));
+		return 0;
+	}
+	expect(map_fd, EINVAL, "create with 8 byte values");
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_PERF_EVENT_ARRAY, sizeof(key),
+				sizeof(value), 2);
+	if (map_fd < 0) {
+		perror("create perf event array");
+		return 1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_BPF_OUTPUT;
+	attr.sample_type = PERF_SAMPLE_RAW;
+
+	pmu_fd = syscall(__NR_perf_event_open, &attr, -1, 0, -1, 0);
+	if (pmu_fd < 0) {
+		perror("open bpf output event");
+		return 1;
+	}
+
+	key = 1;
+	expect(bpf_elem(BPF_MAP_UPDATE_ELEM, map_fd, &key, &pmu_fd, BPF_ANY),
+	       0, "update");
+	expect(bpf_elem(BPF_MAP_UPDATE_ELEM, map_fd, &key, &pmu_fd,
+			BPF_NOEXIST), EINVAL, "update with BPF_NOEXIST");
+
+	/* only perf event fds can be stored */
+	key = 0;
+	expect(bpf_elem(BPF_MAP_UPDATE_ELEM, map_fd, &key, &map_fd, BPF_ANY),
+	       EBADF, "update with a map fd");
+
+	key = 2;
+	expect(bpf_elem(BPF_MAP_UPDATE_ELEM, map_fd, &key, &pmu_fd, BPF_ANY),
+	       E2BIG, "update out of range");
+
+	/* the stored fds are not handed back to user space */
+	key = 1;
+	expect(bpf_elem(BPF_MAP_LOOKUP_ELEM, map_fd, &key, &value, 0),
+	       ENOENT, "lookup");
+
+	/* the map keeps the event alive after its fd is closed */
+	close(pmu_fd);
+	expect(bpf_elem(BPF_MAP_DELETE_ELEM, map_fd, &key, NULL, 0),
+	       0, "delete");
+	expect(bpf_elem(BPF_MAP_DELETE_ELEM, map_fd, &key, NULL, 0),
+	       ENOENT, "delete again");
+
+	close(map_fd);
+
+	fprintf(stderr, "OK\n");
+	return 0;
+}
@@ -18,7 +18,7 @@
  *   The test currently runs for
  *   - TPACKET_V1: RX_RING, TX_RING
  *   - TPACKET_V2: RX_RING, TX_RING
- *   - TPACKET_V3: RX_RING
+ *   - TPACKET_V3: RX_RING, TX_RING
  *
  * License (GPLv2):
  *
@@ -311,20 +311,33 @@ static inline void __v2_tx_user_ready(struct tpacket2_hdr *hdr)
 	__sync_synchronize();
 }
 
-static inline int __v1_v2_tx_kernel_ready(void *base, int version)
+static inline int __v3_tx_kernel_ready(struct tpacket3_hdr *hdr)
+{
+	return !(hdr->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING));
+}
+
+static inline void __v3_tx_user_ready(struct tpacket3_hdr *hdr)
+{
+	hdr->tp_status = TP_STATUS_SEND_REQUEST;
+	__sync_synchronize();
+}
+
+static inline int __tx_kernel_ready(void *base, int version)
 {
 	switch (version) {
 	case TPACKET_V1:
 		return __v1_tx_kernel_ready(base);
 	case TPACKET_V2:
 		return __v2_tx_kernel_ready(base);
+	case TPACKET_V3:
+		return __v3_tx_kernel_ready(base);
 	default:
 		bug_on(1);
 		return 0;
 	}
 }
 
-static inline void __v1_v2_tx_user_ready(void *base, int version)
+static inline void __tx_user_ready(void *base, int version)
 {
 	switch (version) {
 	case TPACKET_V1:
@@ -333,10 +346,13 @@ static inline void __v1_v2_tx_user_ready(void *base, int version)
 	case TPACKET_V2:
 		__v2_tx_user_ready(base);
 		break;
+	case TPACKET_V3:
+		__v3_tx_user_ready(base);
+		break;
 	}
 }
 
-static void __v1_v2_set_packet_loss_discard(int sock)
+static void __set_packet_loss_discard(int sock)
 {
 	int ret, discard = 1;
 
@@ -348,7 +364,7 @@ static void __v1_v2_set_packet_loss_discard(int sock)
 	}
 }
 
-static void walk_v1_v2_tx(int sock, struct ring *ring)
+static void walk_tx(int sock, struct ring *ring)
 {
 	struct pollfd pfd;
 	int rcv_sock, ret;
@@ -388,8 +404,8 @@ static void walk_v1_v2_tx(int sock, struct ring *ring)
 	create_payload(packet, &packet_len);
 
 	while (total_packets > 0) {
-		while (__v1_v2_tx_kernel_ready(ring->rd[frame_num].iov_base,
-					       ring->version) &&
+		while (__tx_kernel_ready(ring->rd[frame_num].iov_base,
+					 ring->version) &&
 		       total_packets > 0) {
 			ppd.raw = ring->rd[frame_num].iov_base;
 
@@ -413,12 +429,26 @@ static void walk_v1_v2_tx(int sock, struct ring *ring)
 				       packet_len);
 				total_bytes += ppd.v2->tp_h.tp_snaplen;
 				break;
+
+			case TPACKET_V3: {
+				struct tpacket3_hdr *tx = ppd.raw;
+
+				tx->tp_snaplen = packet_len;
+				tx->tp_len = packet_len;
+				tx->tp_next_offset = 0;
+
+				memcpy((uint8_t *) ppd.raw + TPACKET3_HDRLEN -
+				       sizeof(struct sockaddr_ll), packet,
+				       packet_len);
+				total_bytes += tx->tp_snaplen;
+				break;
+			}
 			}
 
 			status_bar_update();
 			total_packets--;
 
-			__v1_v2_tx_user_ready(ppd.raw, ring->version);
+			__tx_user_ready(ppd.raw, ring->version);
 
 			frame_num = (frame_num + 1) % ring->rd_num;
 		}
@@ -460,7 +490,7 @@ static void walk_v1_v2(int sock, struct ring *ring)
 	if (ring->type == PACKET_RX_RING)
 		walk_v1_v2_rx(sock, ring);
 	else
-		walk_v1_v2_tx(sock, ring);
+		walk_tx(sock, ring);
 }
 
 static uint64_t __v3_prev_block_seq_num = 0;
@@ -583,7 +613,7 @@ static void walk_v3(int sock, struct ring *ring)
 	if (ring->type == PACKET_RX_RING)
 		walk_v3_rx(sock, ring);
 	else
-		bug_on(1);
+		walk_tx(sock, ring);
 }
 
 static void __v1_v2_fill(struct ring *ring, unsigned int blocks)
@@ -602,7 +632,7 @@ static void __v1_v2_fill(struct ring *ring, unsigned int blocks)
 	ring->flen = ring->req.tp_frame_size;
 }
 
-static void __v3_fill(struct ring *ring, unsigned int blocks)
+static void __v3_fill(struct ring *ring, unsigned int blocks, int type)
 {
 	ring->req3.tp_retire_blk_tov = 64;
 	ring->req3.tp_sizeof_priv = 0;
@@ -618,8 +648,17 @@ static void __v3_fill(struct ring *ring, unsigned int blocks)
 
 	ring->mm_len = ring->req3.tp_block_size * ring->req3.tp_block_nr;
 	ring->walk = walk_v3;
-	ring->rd_num = ring->req3.tp_block_nr;
-	ring->flen = ring->req3.tp_block_size;
+
+	/* the tx ring is walked frame by frame */
+	if (type == PACKET_TX_RING) {
+		ring->req3.tp_retire_blk_tov = 0;
+		ring->req3.tp_feature_req_word = 0;
+		ring->rd_num = ring->req3.tp_frame_nr;
+		ring->flen = ring->req3.tp_frame_size;
+	} else {
+		ring->rd_num = ring->req3.tp_block_nr;
+		ring->flen = ring->req3.tp_block_size;
+	}
 }
 
 static void setup_ring(int sock, struct ring *ring, int version, int type)
@@ -634,14 +673,16 @@ static void setup_ring(int sock, struct ring *ring, int version, int type)
 	case TPACKET_V1:
 	case TPACKET_V2:
 		if (type == PACKET_TX_RING)
-			__v1_v2_set_packet_loss_discard(sock);
+			__set_packet_loss_discard(sock);
 		__v1_v2_fill(ring, blocks);
 		ret = setsockopt(sock, SOL_PACKET, type, &ring->req,
 				 sizeof(ring->req));
 		break;
 
 	case TPACKET_V3:
-		__v3_fill(ring, blocks);
+		if (type == PACKET_TX_RING)
+			__set_packet_loss_discard(sock);
+		__v3_fill(ring, blocks, type);
 		ret = setsockopt(sock, SOL_PACKET, type, &ring->req3,
 				 sizeof(ring->req3));
 		break;
@@ -796,6 +837,7 @@ int main(void)
 	ret |= test_tpacket(TPACKET_V2, PACKET_TX_RING);
 
 	ret |= test_tpacket(TPACKET_V3, PACKET_RX_RING);
+	ret |= test_tpacket(TPACKET_V3, PACKET_TX_RING);
 
 	if (ret)
 		return 1;
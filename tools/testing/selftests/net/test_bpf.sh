@@ -1,5 +1,5 @@
 #!/bin/sh
-# Runs bpf test using test_bpf kernel module
+# Runs bpf test using test_bpf kernel module, then the map API tests
 
 if /sbin/modprobe -q test_bpf ; then
 	/sbin/modprobe -q -r test_bpf;
@@ -8,3 +8,10 @@ else
 	echo "test_bpf: [FAIL]";
 	exit 1;
 fi
+
+if ./bpf_perf_event_array ; then
+	echo "bpf_perf_event_array: ok";
+else
+	echo "bpf_perf_event_array: [FAIL]";
+	exit 1;
+fi
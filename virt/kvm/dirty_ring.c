@@ -0,0 +1,164 @@
+/*
+ * KVM dirty gfn ring
+ *
+ * Each vcpu records the pages it dirties in a ring that userspace maps
+ * from the vcpu fd, so that collecting the dirty pages costs time
+ * proportional to the number of dirty pages instead of the guest size.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <linux/kvm_host.h>
+#include <linux/kvm.h>
+#include <linux/vmalloc.h>
+#include <linux/kvm_dirty_ring.h>
+
+#include "mmu_lock.h"
+
+/*
+ * Number of pages that hardware dirty logging (e.g. PML) can report at
+ * once after the last check for a full ring.
+ */
+int __weak kvm_cpu_dirty_log_size(void)
+{
+	return 0;
+}
+
+u32 kvm_dirty_ring_get_rsvd_entries(void)
+{
+	return KVM_DIRTY_RING_RSVD_ENTRIES + kvm_cpu_dirty_log_size();
+}
+
+static u32 kvm_dirty_ring_used(struct kvm_dirty_ring *ring)
+{
+	return ACCESS_ONCE(ring->dirty_index) - ACCESS_ONCE(ring->reset_index);
+}
+
+bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return kvm_dirty_ring_used(ring) >= ring->soft_limit;
+}
+
+static bool kvm_dirty_ring_full(struct kvm_dirty_ring *ring)
+{
+	return kvm_dirty_ring_used(ring) >= ring->size;
+}
+
+static void kvm_reset_dirty_gfn(struct kvm *kvm, u32 slot, u64 offset,
+				unsigned long mask)
+{
+	struct kvm_memory_slot *memslot;
+
+	if (!mask || slot >= KVM_USER_MEM_SLOTS)
+		return;
+
+	memslot = id_to_memslot(kvm->memslots, slot);
+	if (!memslot->dirty_bitmap ||
+	    offset + __fls(mask) >= memslot->npages)
+		return;
+
+	KVM_MMU_LOCK(kvm);
+	kvm_arch_mmu_enable_log_dirty_pt_masked(kvm, memslot, offset, mask);
+	KVM_MMU_UNLOCK(kvm);
+}
+
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size)
+{
+	ring->dirty_gfns = vzalloc(size);
+	if (!ring->dirty_gfns)
+		return -ENOMEM;
+
+	ring->size = size / sizeof(struct kvm_dirty_gfn);
+	ring->soft_limit = ring->size - kvm_dirty_ring_get_rsvd_entries();
+	ring->dirty_index = 0;
+	ring->reset_index = 0;
+
+	return 0;
+}
+
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+	vfree(ring->dirty_gfns);
+	ring->dirty_gfns = NULL;
+}
+
+/*
+ * Called with slots_lock held.  Returns the number of entries that were
+ * harvested by userspace and have been reset.
+ */
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring)
+{
+	struct kvm_dirty_gfn *entry;
+	u32 cur_slot = 0, next_slot;
+	u64 cur_offset = 0, next_offset;
+	unsigned long mask = 0;
+	int count = 0;
+
+	while (ring->reset_index != ACCESS_ONCE(ring->dirty_index)) {
+		entry = &ring->dirty_gfns[ring->reset_index & (ring->size - 1)];
+
+		/* Pairs with userspace setting the flag after reading slot. */
+		if (!(smp_load_acquire(&entry->flags) & KVM_DIRTY_GFN_F_RESET))
+			break;
+
+		next_slot = ACCESS_ONCE(entry->slot);
+		next_offset = ACCESS_ONCE(entry->offset);
+
+		entry->flags = 0;
+		ring->reset_index++;
+		count++;
+
+		/*
+		 * Coalesce the resets of nearby pages in the same slot, which
+		 * is what a guest scanning through memory produces.
+		 */
+		if (mask && next_slot == cur_slot) {
+			s64 delta = next_offset - cur_offset;
+
+			if (delta >= 0 && delta < BITS_PER_LONG) {
+				mask |= 1ul << delta;
+				continue;
+			}
+
+			/* Backwards visit, careful about overflows. */
+			if (delta > -BITS_PER_LONG && delta < 0 &&
+			    (mask << -delta >> -delta) == mask) {
+				cur_offset = next_offset;
+				mask = (mask << -delta) | 1;
+				continue;
+			}
+		}
+
+		kvm_reset_dirty_gfn(kvm, cur_slot, cur_offset, mask);
+		cur_slot = next_slot;
+		cur_offset = next_offset;
+		mask = 1;
+	}
+
+	kvm_reset_dirty_gfn(kvm, cur_slot, cur_offset, mask);
+
+	return count;
+}
+
+/* Only called by the vcpu that owns the ring. */
+void kvm_dirty_ring_push(struct kvm_dirty_ring *ring, u32 slot, u64 offset)
+{
+	struct kvm_dirty_gfn *entry;
+
+	/* The soft limit keeps the vcpu from ever filling the ring. */
+	WARN_ON_ONCE(kvm_dirty_ring_full(ring));
+
+	entry = &ring->dirty_gfns[ring->dirty_index & (ring->size - 1)];
+	entry->slot = slot;
+	entry->offset = offset;
+	/* Make the entry visible to userspace before the flag. */
+	smp_wmb();
+	entry->flags = KVM_DIRTY_GFN_F_DIRTY;
+	ring->dirty_index++;
+}
+
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring, u32 offset)
+{
+	return vmalloc_to_page((void *)ring->dirty_gfns + offset * PAGE_SIZE);
+}
@@ -0,0 +1,18 @@
+#ifndef __KVM_MMU_LOCK_H__
+#define __KVM_MMU_LOCK_H__
+
+/*
+ * Generic code always takes mmu_lock exclusively; architectures that
+ * define KVM_HAVE_MMU_RWLOCK may also take it for read.
+ */
+#ifdef KVM_HAVE_MMU_RWLOCK
+#define KVM_MMU_LOCK_INIT(kvm)		rwlock_init(&(kvm)->mmu_lock)
+#define KVM_MMU_LOCK(kvm)		write_lock(&(kvm)->mmu_lock)
+#define KVM_MMU_UNLOCK(kvm)		write_unlock(&(kvm)->mmu_lock)
+#else
+#define KVM_MMU_LOCK_INIT(kvm)		spin_lock_init(&(kvm)->mmu_lock)
+#define KVM_MMU_LOCK(kvm)		spin_lock(&(kvm)->mmu_lock)
+#define KVM_MMU_UNLOCK(kvm)		spin_unlock(&(kvm)->mmu_lock)
+#endif
+
+#endif